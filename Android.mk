@@ -107,6 +107,7 @@ ue_libpayload_consumer_exported_static_libraries := \
     libbspatch \
     libbrotli \
     libpuffpatch \
+    libzstd \
     $(ue_update_metadata_protos_exported_static_libraries)
 ue_libpayload_consumer_exported_shared_libraries := \
     libcrypto \
@@ -115,6 +116,8 @@ ue_libpayload_consumer_exported_shared_libraries := \
 
 ue_libpayload_consumer_src_files := \
     common/action_processor.cc \
+    common/bandwidth_limiter.cc \
+    common/blob_pool.cc \
     common/boot_control_stub.cc \
     common/clock.cc \
     common/constants.cc \
@@ -122,18 +125,31 @@ ue_libpayload_consumer_src_files := \
     common/error_code_utils.cc \
     common/file_fetcher.cc \
     common/hash_calculator.cc \
+    common/hot_path_log.cc \
     common/http_common.cc \
     common/http_fetcher.cc \
     common/hwid_override.cc \
+    common/idle_memory.cc \
+    common/io_limiter.cc \
     common/multi_range_http_fetcher.cc \
+    common/multipart_byteranges_parser.cc \
     common/platform_constants_android.cc \
     common/prefs.cc \
+    common/progress_sampler.cc \
+    common/resource_scheduler.cc \
+    common/resource_usage.cc \
+    common/spawned_process.cc \
     common/subprocess.cc \
     common/terminator.cc \
+    common/throughput_estimator.cc \
     common/utils.cc \
+    payload_consumer/aio_file_descriptor.cc \
+    payload_consumer/apply_stats.cc \
     payload_consumer/bzip_extent_writer.cc \
     payload_consumer/cached_file_descriptor.cc \
+    payload_consumer/decoder_pool.cc \
     payload_consumer/delta_performer.cc \
+    payload_consumer/direct_file_descriptor.cc \
     payload_consumer/download_action.cc \
     payload_consumer/extent_reader.cc \
     payload_consumer/extent_writer.cc \
@@ -141,13 +157,24 @@ ue_libpayload_consumer_src_files := \
     payload_consumer/file_descriptor_utils.cc \
     payload_consumer/file_writer.cc \
     payload_consumer/filesystem_verifier_action.cc \
+    payload_consumer/hashing_file_descriptor.cc \
     payload_consumer/install_plan.cc \
+    payload_consumer/io_trace.cc \
+    payload_consumer/metadata_prefetcher.cc \
     payload_consumer/mount_history.cc \
+    payload_consumer/operation_pipeline.cc \
+    payload_consumer/p2p_file_writer.cc \
+    payload_consumer/payload_cache_downloader.cc \
     payload_consumer/payload_constants.cc \
     payload_consumer/payload_metadata.cc \
     payload_consumer/payload_verifier.cc \
     payload_consumer/postinstall_runner_action.cc \
-    payload_consumer/xz_extent_writer.cc
+    payload_consumer/public_key_cache.cc \
+    payload_consumer/segmented_buffer.cc \
+    payload_consumer/verity_writer.cc \
+    payload_consumer/writeback_file_descriptor.cc \
+    payload_consumer/xz_extent_writer.cc \
+    payload_consumer/zstd_extent_writer.cc
 
 ifeq ($(HOST_OS),linux)
 # Build for the host.
@@ -244,6 +271,7 @@ ue_libupdate_engine_exported_static_libraries := \
     libfs_mgr \
     libbase \
     liblog \
+    libz \
     $(ue_libpayload_consumer_exported_static_libraries) \
     $(ue_update_metadata_protos_exported_static_libraries) \
     libupdate_engine_boot_control \
@@ -295,6 +323,7 @@ LOCAL_SRC_FILES := \
     common_service.cc \
     connection_manager_android.cc \
     connection_utils.cc \
+    connection_warmer.cc \
     daemon.cc \
     hardware_android.cc \
     image_properties_android.cc \
@@ -310,6 +339,7 @@ LOCAL_SRC_FILES := \
     power_manager_android.cc \
     proxy_resolver.cc \
     real_system_state.cc \
+    status_page.cc \
     update_attempter.cc \
     update_manager/android_things_policy.cc \
     update_manager/api_restricted_downloads_policy_impl.cc \
@@ -321,6 +351,7 @@ LOCAL_SRC_FILES := \
     update_manager/next_update_check_policy_impl.cc \
     update_manager/official_build_check_policy_impl.cc \
     update_manager/policy.cc \
+    update_manager/policy_trace.cc \
     update_manager/real_config_provider.cc \
     update_manager/real_device_policy_provider.cc \
     update_manager/real_random_provider.cc \
@@ -328,7 +359,10 @@ LOCAL_SRC_FILES := \
     update_manager/real_time_provider.cc \
     update_manager/real_updater_provider.cc \
     update_manager/state_factory.cc \
+    update_manager/timer_wheel.cc \
     update_manager/update_manager.cc \
+    update_manager/variable.cc \
+    update_manager/variable_snapshot.cc \
     update_status_utils.cc \
     utils_android.cc
 ifeq ($(local_use_binder),1)
@@ -337,6 +371,7 @@ LOCAL_SRC_FILES += \
     binder_bindings/android/brillo/IUpdateEngine.aidl \
     binder_bindings/android/brillo/IUpdateEngineStatusCallback.aidl \
     binder_service_brillo.cc \
+    parcelable_update_engine_performance.cc \
     parcelable_update_engine_status.cc
 endif  # local_use_binder == 1
 ifeq ($(local_use_chrome_network_proxy),1)
@@ -562,6 +597,7 @@ LOCAL_SRC_FILES += \
     binder_bindings/android/brillo/IUpdateEngine.aidl \
     binder_bindings/android/brillo/IUpdateEngineStatusCallback.aidl \
     client_library/client_binder.cc \
+    parcelable_update_engine_performance.cc \
     parcelable_update_engine_status.cc
 endif  # local_use_binder == 1
 
@@ -631,29 +667,42 @@ ue_libpayload_generator_exported_shared_libraries := \
 ue_libpayload_generator_src_files := \
     payload_generator/ab_generator.cc \
     payload_generator/annotated_operation.cc \
+    payload_generator/apply_time_estimator.cc \
     payload_generator/blob_file_writer.cc \
+    payload_generator/block_bitmap.cc \
     payload_generator/block_mapping.cc \
     payload_generator/bzip.cc \
+    payload_generator/content_chunker.cc \
     payload_generator/cycle_breaker.cc \
     payload_generator/deflate_utils.cc \
     payload_generator/delta_diff_generator.cc \
     payload_generator/delta_diff_utils.cc \
+    payload_generator/diff_cache.cc \
     payload_generator/ext2_filesystem.cc \
     payload_generator/extent_ranges.cc \
     payload_generator/extent_utils.cc \
     payload_generator/full_update_generator.cc \
+    payload_generator/generation_profile.cc \
     payload_generator/graph_types.cc \
     payload_generator/graph_utils.cc \
+    payload_generator/greedy_cycle_breaker.cc \
     payload_generator/inplace_generator.cc \
     payload_generator/mapfile_filesystem.cc \
+    payload_generator/memory_budget.cc \
+    payload_generator/numa_topology.cc \
+    payload_generator/partition_reader.cc \
     payload_generator/payload_file.cc \
     payload_generator/payload_generation_config.cc \
     payload_generator/payload_signer.cc \
+    payload_generator/previous_payload.cc \
     payload_generator/raw_filesystem.cc \
+    payload_generator/source_block_index.cc \
+    payload_generator/sparse_image.cc \
     payload_generator/squashfs_filesystem.cc \
     payload_generator/tarjan.cc \
     payload_generator/topological_sort.cc \
-    payload_generator/xz_android.cc
+    payload_generator/xz_android.cc \
+    payload_generator/zstd.cc
 
 ifeq ($(HOST_OS),linux)
 # Build for the host.
@@ -819,6 +868,7 @@ $(call ue-unittest-sample-image,disk_ext2_1k.img)
 $(call ue-unittest-sample-image,disk_ext2_4k.img)
 $(call ue-unittest-sample-image,disk_ext2_4k_empty.img)
 $(call ue-unittest-sample-image,disk_ext2_unittest.img)
+$(call ue-unittest-sample-image,disk_ext4_4k.img)
 
 # update_engine.conf
 # ========================================================
@@ -866,6 +916,127 @@ LOCAL_STATIC_LIBRARIES := $(ue_common_static_libraries)
 LOCAL_SRC_FILES := test_subprocess.cc
 include $(BUILD_EXECUTABLE)
 
+# update_engine_benchmarks (type: executable)
+# ========================================================
+# Benchmark of the payload apply throughput per operation type.
+include $(CLEAR_VARS)
+LOCAL_MODULE := update_engine_benchmarks
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/update_engine_unittests
+LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS := $(ue_common_cflags)
+LOCAL_CPPFLAGS := $(ue_common_cppflags)
+LOCAL_LDFLAGS := $(ue_common_ldflags)
+LOCAL_C_INCLUDES := $(ue_common_c_includes)
+LOCAL_STATIC_LIBRARIES := \
+    libpayload_consumer \
+    libpayload_generator \
+    $(ue_common_static_libraries) \
+    $(ue_libpayload_consumer_exported_static_libraries:-host=) \
+    $(ue_libpayload_generator_exported_static_libraries:-host=)
+LOCAL_SHARED_LIBRARIES := \
+    $(ue_common_shared_libraries) \
+    $(ue_libpayload_consumer_exported_shared_libraries:-host=) \
+    $(ue_libpayload_generator_exported_shared_libraries:-host=)
+LOCAL_SRC_FILES := payload_consumer/delta_performer_benchmark.cc
+include $(BUILD_EXECUTABLE)
+
+# extent_io_benchmarks (type: executable)
+# ========================================================
+# Benchmark of the extent writers, readers and write cache.
+include $(CLEAR_VARS)
+LOCAL_MODULE := extent_io_benchmarks
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/update_engine_unittests
+LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS := $(ue_common_cflags)
+LOCAL_CPPFLAGS := $(ue_common_cppflags)
+LOCAL_LDFLAGS := $(ue_common_ldflags)
+LOCAL_C_INCLUDES := $(ue_common_c_includes)
+LOCAL_STATIC_LIBRARIES := \
+    libpayload_consumer \
+    libpayload_generator \
+    $(ue_common_static_libraries) \
+    $(ue_libpayload_consumer_exported_static_libraries:-host=) \
+    $(ue_libpayload_generator_exported_static_libraries:-host=)
+LOCAL_SHARED_LIBRARIES := \
+    $(ue_common_shared_libraries) \
+    $(ue_libpayload_consumer_exported_shared_libraries:-host=) \
+    $(ue_libpayload_generator_exported_shared_libraries:-host=)
+LOCAL_SRC_FILES := \
+    payload_consumer/extent_io_benchmark.cc \
+    payload_consumer/fake_file_descriptor.cc
+include $(BUILD_EXECUTABLE)
+
+# io_trace_replay (type: executable)
+# ========================================================
+# Replay of the I/O traces recorded while applying an update.
+include $(CLEAR_VARS)
+LOCAL_MODULE := io_trace_replay
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/update_engine_unittests
+LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS := $(ue_common_cflags)
+LOCAL_CPPFLAGS := $(ue_common_cppflags)
+LOCAL_LDFLAGS := $(ue_common_ldflags)
+LOCAL_C_INCLUDES := $(ue_common_c_includes)
+LOCAL_STATIC_LIBRARIES := \
+    libpayload_consumer \
+    $(ue_common_static_libraries) \
+    $(ue_libpayload_consumer_exported_static_libraries:-host=)
+LOCAL_SHARED_LIBRARIES := \
+    $(ue_common_shared_libraries) \
+    $(ue_libpayload_consumer_exported_shared_libraries:-host=)
+LOCAL_SRC_FILES := payload_consumer/io_trace_replay.cc
+include $(BUILD_EXECUTABLE)
+
+# delta_generator_benchmarks (type: executable)
+# ========================================================
+# Benchmark of the delta generation scaling with the thread count, built for
+# the host where the payloads are generated.
+ifeq ($(HOST_OS),linux)
+include $(CLEAR_VARS)
+LOCAL_MODULE := delta_generator_benchmarks
+LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS := $(ue_common_cflags)
+LOCAL_CPPFLAGS := $(ue_common_cppflags)
+LOCAL_LDFLAGS := $(ue_common_ldflags)
+LOCAL_C_INCLUDES := $(ue_common_c_includes)
+LOCAL_STATIC_LIBRARIES := \
+    libpayload_consumer \
+    libpayload_generator \
+    $(ue_common_static_libraries) \
+    $(ue_libpayload_consumer_exported_static_libraries) \
+    $(ue_libpayload_generator_exported_static_libraries)
+LOCAL_SHARED_LIBRARIES := \
+    $(ue_common_shared_libraries) \
+    $(ue_libpayload_consumer_exported_shared_libraries) \
+    $(ue_libpayload_generator_exported_shared_libraries)
+LOCAL_SRC_FILES := payload_generator/delta_generator_benchmark.cc
+include $(BUILD_HOST_EXECUTABLE)
+endif  # HOST_OS == linux
+
+# update_engine_payload_metadata_fuzzer (type: executable)
+# ========================================================
+# Fuzzer of the payload metadata parsing.
+include $(CLEAR_VARS)
+LOCAL_MODULE := update_engine_payload_metadata_fuzzer
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS := $(ue_common_cflags)
+LOCAL_CPPFLAGS := $(ue_common_cppflags)
+LOCAL_LDFLAGS := $(ue_common_ldflags)
+LOCAL_C_INCLUDES := $(ue_common_c_includes)
+LOCAL_STATIC_LIBRARIES := \
+    libpayload_consumer \
+    $(ue_common_static_libraries) \
+    $(ue_libpayload_consumer_exported_static_libraries:-host=)
+LOCAL_SHARED_LIBRARIES := \
+    $(ue_common_shared_libraries) \
+    $(ue_libpayload_consumer_exported_shared_libraries:-host=)
+LOCAL_SRC_FILES := payload_consumer/payload_metadata_fuzzer.cc
+include $(BUILD_FUZZ_TEST)
+
 # update_engine_unittests (type: executable)
 # ========================================================
 # Main unittest file.
@@ -879,6 +1050,7 @@ LOCAL_REQUIRED_MODULES := \
     ue_unittest_disk_ext2_4k.img \
     ue_unittest_disk_ext2_4k_empty.img \
     ue_unittest_disk_ext2_unittest.img \
+    ue_unittest_disk_ext4_4k.img \
     ue_unittest_key.pem \
     ue_unittest_key.pub.pem \
     ue_unittest_key2.pem \
@@ -906,47 +1078,86 @@ LOCAL_SRC_FILES := \
     common/action_pipe_unittest.cc \
     common/action_processor_unittest.cc \
     common/action_unittest.cc \
+    common/bandwidth_limiter_unittest.cc \
+    common/blob_pool_unittest.cc \
     common/cpu_limiter_unittest.cc \
     common/fake_prefs.cc \
     common/file_fetcher_unittest.cc \
     common/hash_calculator_unittest.cc \
+    common/hot_path_log_unittest.cc \
     common/http_fetcher_unittest.cc \
     common/hwid_override_unittest.cc \
+    common/idle_memory_unittest.cc \
+    common/io_limiter_unittest.cc \
     common/mock_http_fetcher.cc \
+    common/multipart_byteranges_parser_unittest.cc \
     common/prefs_unittest.cc \
+    common/progress_sampler_unittest.cc \
+    common/resource_scheduler_unittest.cc \
+    common/resource_usage_unittest.cc \
+    common/spawned_process_unittest.cc \
     common/subprocess_unittest.cc \
     common/terminator_unittest.cc \
+    common/throughput_estimator_unittest.cc \
     common/test_utils.cc \
     common/utils_unittest.cc \
+    payload_consumer/aio_file_descriptor_unittest.cc \
+    payload_consumer/apply_stats_unittest.cc \
     payload_consumer/bzip_extent_writer_unittest.cc \
     payload_consumer/cached_file_descriptor_unittest.cc \
+    payload_consumer/decoder_pool_unittest.cc \
     payload_consumer/delta_performer_integration_test.cc \
     payload_consumer/delta_performer_unittest.cc \
+    payload_consumer/direct_file_descriptor_unittest.cc \
     payload_consumer/extent_reader_unittest.cc \
+    payload_consumer/extent_span_unittest.cc \
     payload_consumer/extent_writer_unittest.cc \
     payload_consumer/fake_file_descriptor.cc \
+    payload_consumer/fake_file_descriptor_unittest.cc \
     payload_consumer/file_descriptor_utils_unittest.cc \
     payload_consumer/file_writer_unittest.cc \
     payload_consumer/filesystem_verifier_action_unittest.cc \
+    payload_consumer/hashing_file_descriptor_unittest.cc \
+    payload_consumer/io_trace_unittest.cc \
+    payload_consumer/metadata_prefetcher_unittest.cc \
+    payload_consumer/operation_pipeline_unittest.cc \
+    payload_consumer/p2p_file_writer_unittest.cc \
     payload_consumer/postinstall_runner_action_unittest.cc \
+    payload_consumer/public_key_cache_unittest.cc \
+    payload_consumer/segmented_buffer_unittest.cc \
+    payload_consumer/verity_writer_unittest.cc \
+    payload_consumer/writeback_file_descriptor_unittest.cc \
     payload_consumer/xz_extent_writer_unittest.cc \
+    payload_consumer/zstd_extent_writer_unittest.cc \
     payload_generator/ab_generator_unittest.cc \
+    payload_generator/apply_time_estimator_unittest.cc \
     payload_generator/blob_file_writer_unittest.cc \
+    payload_generator/block_bitmap_unittest.cc \
     payload_generator/block_mapping_unittest.cc \
+    payload_generator/content_chunker_unittest.cc \
     payload_generator/cycle_breaker_unittest.cc \
     payload_generator/deflate_utils_unittest.cc \
     payload_generator/delta_diff_utils_unittest.cc \
+    payload_generator/diff_cache_unittest.cc \
     payload_generator/ext2_filesystem_unittest.cc \
     payload_generator/extent_ranges_unittest.cc \
     payload_generator/extent_utils_unittest.cc \
     payload_generator/fake_filesystem.cc \
     payload_generator/full_update_generator_unittest.cc \
+    payload_generator/generation_profile_unittest.cc \
     payload_generator/graph_utils_unittest.cc \
+    payload_generator/greedy_cycle_breaker_unittest.cc \
     payload_generator/inplace_generator_unittest.cc \
     payload_generator/mapfile_filesystem_unittest.cc \
+    payload_generator/memory_budget_unittest.cc \
+    payload_generator/numa_topology_unittest.cc \
+    payload_generator/partition_reader_unittest.cc \
     payload_generator/payload_file_unittest.cc \
     payload_generator/payload_generation_config_unittest.cc \
     payload_generator/payload_signer_unittest.cc \
+    payload_generator/previous_payload_unittest.cc \
+    payload_generator/source_block_index_unittest.cc \
+    payload_generator/sparse_image_unittest.cc \
     payload_generator/squashfs_filesystem_unittest.cc \
     payload_generator/tarjan_unittest.cc \
     payload_generator/topological_sort_unittest.cc \
@@ -963,6 +1174,7 @@ LOCAL_SHARED_LIBRARIES += \
     $(ue_libupdate_engine_exported_shared_libraries:-host=)
 LOCAL_SRC_FILES += \
     common_service_unittest.cc \
+    connection_warmer_unittest.cc \
     fake_system_state.cc \
     image_properties_android_unittest.cc \
     metrics_reporter_omaha_unittest.cc \
@@ -973,8 +1185,11 @@ LOCAL_SRC_FILES += \
     omaha_utils_unittest.cc \
     p2p_manager_unittest.cc \
     payload_consumer/download_action_unittest.cc \
+    payload_consumer/payload_cache_downloader_unittest.cc \
     payload_state_unittest.cc \
+    parcelable_update_engine_performance_unittest.cc \
     parcelable_update_engine_status_unittest.cc \
+    status_page_unittest.cc \
     update_attempter_unittest.cc \
     update_manager/android_things_policy_unittest.cc \
     update_manager/boxed_value_unittest.cc \
@@ -986,14 +1201,17 @@ LOCAL_SRC_FILES += \
     update_manager/next_update_check_policy_impl_unittest.cc \
     update_manager/out_of_box_experience_policy_impl.cc \
     update_manager/policy_test_utils.cc \
+    update_manager/policy_trace_unittest.cc \
     update_manager/prng_unittest.cc \
     update_manager/real_device_policy_provider_unittest.cc \
     update_manager/real_random_provider_unittest.cc \
     update_manager/real_system_provider_unittest.cc \
     update_manager/real_time_provider_unittest.cc \
     update_manager/real_updater_provider_unittest.cc \
+    update_manager/timer_wheel_unittest.cc \
     update_manager/umtest_utils.cc \
     update_manager/update_manager_unittest.cc \
+    update_manager/variable_snapshot_unittest.cc \
     update_manager/variable_unittest.cc
 else  # local_use_omaha == 1
 LOCAL_STATIC_LIBRARIES += \
@@ -29,10 +29,12 @@ using android::String16;
 using android::String8;
 using android::binder::Status;
 using android::brillo::IUpdateEngineStatusCallback;
+using android::brillo::ParcelableUpdateEnginePerformance;
 using android::brillo::ParcelableUpdateEngineStatus;
 using android::sp;
 using brillo::ErrorPtr;
 using std::string;
+using update_engine::UpdateEnginePerformance;
 using update_engine::UpdateEngineStatus;
 
 namespace chromeos_update_engine {
@@ -99,6 +101,19 @@ Status BinderUpdateEngineBrilloService::GetStatus(
   return ret;
 }
 
+Status BinderUpdateEngineBrilloService::GetPerformance(
+    ParcelableUpdateEnginePerformance* performance) {
+  UpdateEnginePerformance update_engine_performance;
+  auto ret = CallCommonHandler(&UpdateEngineService::GetPerformance,
+                               &update_engine_performance);
+
+  if (ret.isOk()) {
+    *performance = ParcelableUpdateEnginePerformance(update_engine_performance);
+  }
+
+  return ret;
+}
+
 Status BinderUpdateEngineBrilloService::RebootIfNeeded() {
   return CallCommonHandler(&UpdateEngineService::RebootIfNeeded);
 }
@@ -214,6 +229,19 @@ Status BinderUpdateEngineBrilloService::GetEolStatus(int* out_eol_status) {
   return CallCommonHandler(&UpdateEngineService::GetEolStatus, out_eol_status);
 }
 
+Status BinderUpdateEngineBrilloService::GetPolicyEvaluationTrace(
+    String16* out_policy_evaluation_trace) {
+  string trace;
+  auto ret = CallCommonHandler(&UpdateEngineService::GetPolicyEvaluationTrace,
+                               &trace);
+
+  if (ret.isOk()) {
+    *out_policy_evaluation_trace = String16(trace.c_str());
+  }
+
+  return ret;
+}
+
 void BinderUpdateEngineBrilloService::UnregisterStatusCallback(
     IUpdateEngineStatusCallback* callback) {
   auto it = callbacks_.begin();
@@ -26,6 +26,7 @@
 #include <utils/RefBase.h>
 
 #include "update_engine/common_service.h"
+#include "update_engine/parcelable_update_engine_performance.h"
 #include "update_engine/parcelable_update_engine_status.h"
 #include "update_engine/service_observer_interface.h"
 
@@ -61,6 +62,8 @@ class BinderUpdateEngineBrilloService : public android::brillo::BnUpdateEngine,
   android::binder::Status ResetStatus() override;
   android::binder::Status GetStatus(
       android::brillo::ParcelableUpdateEngineStatus* status);
+  android::binder::Status GetPerformance(
+      android::brillo::ParcelableUpdateEnginePerformance* performance);
   android::binder::Status RebootIfNeeded() override;
   android::binder::Status SetChannel(const android::String16& target_channel,
                                      bool powerwash) override;
@@ -89,6 +92,8 @@ class BinderUpdateEngineBrilloService : public android::brillo::BnUpdateEngine,
   android::binder::Status GetLastAttemptError(
       int* out_last_attempt_error) override;
   android::binder::Status GetEolStatus(int* out_eol_status) override;
+  android::binder::Status GetPolicyEvaluationTrace(
+      android::String16* out_policy_evaluation_trace) override;
 
  private:
   // Generic function for dispatching to the common service.
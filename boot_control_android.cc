@@ -19,8 +19,10 @@
 #include <base/bind.h>
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/single_thread_task_runner.h>
 #include <base/strings/string_util.h>
-#include <brillo/message_loops/message_loop.h>
+#include <base/synchronization/waitable_event.h>
+#include <base/threading/thread_task_runner_handle.h>
 
 #include "update_engine/common/utils.h"
 #include "update_engine/utils_android.h"
@@ -63,9 +65,62 @@ bool BootControlAndroid::Init() {
 
   LOG(INFO) << "Loaded boot control hidl hal.";
 
+  thread_.reset(new base::DelegateSimpleThread(this, "boot-control"));
+  thread_->Start();
   return true;
 }
 
+BootControlAndroid::~BootControlAndroid() {
+  {
+    base::AutoLock auto_lock(lock_);
+    stopping_ = true;
+    cond_.Broadcast();
+  }
+  if (thread_)
+    thread_->Join();
+}
+
+void BootControlAndroid::Run() {
+  base::AutoLock auto_lock(lock_);
+  while (true) {
+    while (!stopping_ && queue_.empty())
+      cond_.Wait();
+    // The commands queued before stopping are still run.
+    if (queue_.empty())
+      break;
+    base::Closure command = queue_.front();
+    queue_.pop_front();
+    {
+      base::AutoUnlock auto_unlock(lock_);
+      command.Run();
+    }
+  }
+}
+
+void BootControlAndroid::QueueCommand(const base::Closure& command) {
+  base::AutoLock auto_lock(lock_);
+  queue_.push_back(command);
+  cond_.Broadcast();
+}
+
+bool BootControlAndroid::RunCommand(const base::Callback<bool()>& command) {
+  bool result = false;
+  base::WaitableEvent done(base::WaitableEvent::ResetPolicy::MANUAL,
+                           base::WaitableEvent::InitialState::NOT_SIGNALED);
+  QueueCommand(base::Bind(
+      [](const base::Callback<bool()>& command,
+         bool* result,
+         base::WaitableEvent* done) {
+        *result = command.Run();
+        done->Signal();
+      },
+      command,
+      base::Unretained(&result),
+      base::Unretained(&done)));
+  done.Wait();
+  return result;
+}
+
 unsigned int BootControlAndroid::GetNumSlots() const {
   return module_->getNumberSlots();
 }
@@ -149,6 +204,34 @@ bool BootControlAndroid::IsSlotBootable(Slot slot) const {
 }
 
 bool BootControlAndroid::MarkSlotUnbootable(Slot slot) {
+  return RunCommand(base::Bind(&BootControlAndroid::DoMarkSlotUnbootable,
+                               base::Unretained(this),
+                               slot));
+}
+
+bool BootControlAndroid::SetActiveBootSlot(Slot slot) {
+  return RunCommand(base::Bind(&BootControlAndroid::DoSetActiveBootSlot,
+                               base::Unretained(this),
+                               slot));
+}
+
+bool BootControlAndroid::MarkBootSuccessfulAsync(
+    base::Callback<void(bool)> callback) {
+  // The result is reported on the thread of the caller.
+  QueueCommand(base::Bind(
+      [](BootControlAndroid* boot_control,
+         scoped_refptr<base::SingleThreadTaskRunner> task_runner,
+         const base::Callback<void(bool)>& callback) {
+        bool success = boot_control->DoMarkBootSuccessful();
+        task_runner->PostTask(FROM_HERE, base::Bind(callback, success));
+      },
+      base::Unretained(this),
+      base::ThreadTaskRunnerHandle::Get(),
+      callback));
+  return true;
+}
+
+bool BootControlAndroid::DoMarkSlotUnbootable(Slot slot) {
   CommandResult result;
   auto ret = module_->setSlotAsUnbootable(slot, StoreResultCallback(&result));
   if (!ret.isOk()) {
@@ -164,7 +247,7 @@ bool BootControlAndroid::MarkSlotUnbootable(Slot slot) {
   return result.success;
 }
 
-bool BootControlAndroid::SetActiveBootSlot(Slot slot) {
+bool BootControlAndroid::DoSetActiveBootSlot(Slot slot) {
   CommandResult result;
   auto ret = module_->setActiveBootSlot(slot, StoreResultCallback(&result));
   if (!ret.isOk()) {
@@ -179,8 +262,17 @@ bool BootControlAndroid::SetActiveBootSlot(Slot slot) {
   return result.success;
 }
 
-bool BootControlAndroid::MarkBootSuccessfulAsync(
-    base::Callback<void(bool)> callback) {
+bool BootControlAndroid::DoMarkBootSuccessful() {
+  // Writing the flags is the slow part, and the booted slot is usually
+  // already marked as successful.
+  Slot current_slot = GetCurrentSlot();
+  Return<BoolResult> marked = module_->isSlotMarkedSuccessful(current_slot);
+  if (marked.isOk() && marked == BoolResult::TRUE) {
+    LOG(INFO) << "Slot " << SlotName(current_slot)
+              << " is already marked as successful.";
+    return true;
+  }
+
   CommandResult result;
   auto ret = module_->markBootSuccessful(StoreResultCallback(&result));
   if (!ret.isOk()) {
@@ -191,9 +283,7 @@ bool BootControlAndroid::MarkBootSuccessfulAsync(
   if (!result.success) {
     LOG(ERROR) << "Unable to mark boot successful: " << result.errMsg.c_str();
   }
-  return brillo::MessageLoop::current()->PostTask(
-             FROM_HERE, base::Bind(callback, result.success)) !=
-         brillo::MessageLoop::kTaskIdNull;
+  return result.success;
 }
 
 }  // namespace chromeos_update_engine
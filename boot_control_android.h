@@ -17,9 +17,15 @@
 #ifndef UPDATE_ENGINE_BOOT_CONTROL_ANDROID_H_
 #define UPDATE_ENGINE_BOOT_CONTROL_ANDROID_H_
 
+#include <deque>
+#include <memory>
 #include <string>
 
 #include <android/hardware/boot/1.0/IBootControl.h>
+#include <base/callback.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/boot_control.h"
 
@@ -27,10 +33,17 @@ namespace chromeos_update_engine {
 
 // The Android implementation of the BootControlInterface. This implementation
 // uses the libhardware's boot_control HAL to access the bootloader.
-class BootControlAndroid : public BootControlInterface {
+//
+// The HAL calls changing the slot flags can take hundreds of milliseconds on
+// some bootloaders, so they run on a dedicated thread, one at a time and in
+// the order requested. MarkBootSuccessfulAsync() returns right away and the
+// later calls changing the slot flags are only applied after it.
+class BootControlAndroid : public BootControlInterface,
+                           public base::DelegateSimpleThread::Delegate {
  public:
   BootControlAndroid() = default;
-  ~BootControlAndroid() = default;
+  // Waits for the queued HAL calls.
+  ~BootControlAndroid() override;
 
   // Load boot_control HAL implementation using libhardware and
   // initializes it. Returns false if an error occurred.
@@ -47,9 +60,33 @@ class BootControlAndroid : public BootControlInterface {
   bool SetActiveBootSlot(BootControlInterface::Slot slot) override;
   bool MarkBootSuccessfulAsync(base::Callback<void(bool)> callback) override;
 
+  // DelegateSimpleThread::Delegate overrides.
+  void Run() override;
+
  private:
+  // Queues |command| to run on the HAL thread after the ones already queued.
+  void QueueCommand(const base::Closure& command);
+
+  // Runs |command| on the HAL thread after the queued ones and returns its
+  // result.
+  bool RunCommand(const base::Callback<bool()>& command);
+
+  // The HAL calls run on the HAL thread.
+  bool DoMarkSlotUnbootable(BootControlInterface::Slot slot);
+  bool DoSetActiveBootSlot(BootControlInterface::Slot slot);
+  bool DoMarkBootSuccessful();
+
   ::android::sp<::android::hardware::boot::V1_0::IBootControl> module_;
 
+  // The members below are protected by |lock_|. |cond_| is signaled when a
+  // command is queued or the thread is stopping.
+  base::Lock lock_;
+  base::ConditionVariable cond_{&lock_};
+  std::deque<base::Closure> queue_;
+  bool stopping_{false};
+
+  std::unique_ptr<base::DelegateSimpleThread> thread_;
+
   DISALLOW_COPY_AND_ASSIGN(BootControlAndroid);
 };
 
@@ -164,6 +164,13 @@ bool CertificateChecker::CheckCertificateChange(int preverify_ok,
   string storage_key =
       base::StringPrintf("%s-%d-%d", kPrefsUpdateServerCertificate,
                          static_cast<int>(server_to_check), depth);
+  string& seen_digest = seen_digests_[storage_key];
+  if (seen_digest == digest_string) {
+    NotifyCertificateChecked(server_to_check, CertificateCheckResult::kValid);
+    return true;
+  }
+  seen_digest = digest_string;
+
   string stored_digest;
   // If there's no stored certificate, we just store the current one and return.
   if (!prefs_->GetString(storage_key, &stored_digest)) {
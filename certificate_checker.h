@@ -20,6 +20,7 @@
 #include <curl/curl.h>
 #include <openssl/ssl.h>
 
+#include <map>
 #include <string>
 
 #include <base/macros.h>
@@ -125,6 +126,8 @@ class CertificateChecker {
   FRIEND_TEST(CertificateCheckerTest, SameCertificate);
   FRIEND_TEST(CertificateCheckerTest, ChangedCertificate);
   FRIEND_TEST(CertificateCheckerTest, FailedCertificate);
+  FRIEND_TEST(CertificateCheckerTest, CachedCertificate);
+  FRIEND_TEST(CertificateCheckerTest, CachedCertificateChanged);
 
   // These callbacks are asynchronously called by openssl after initial SSL
   // verification. They are used to perform any additional security verification
@@ -167,6 +170,11 @@ class CertificateChecker {
   // The observer called whenever a certificate is checked, if not null.
   Observer* observer_{nullptr};
 
+  // The digests of the certificates last seen by this process, by their
+  // storage key in the prefs. Each TLS handshake checks the certificates
+  // again, so the prefs are only read the first time, or when they change.
+  std::map<std::string, std::string> seen_digests_;
+
   DISALLOW_COPY_AND_ASSIGN(CertificateChecker);
 };
 
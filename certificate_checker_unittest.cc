@@ -127,6 +127,59 @@ TEST_F(CertificateCheckerTest, ChangedCertificate) {
       cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
 }
 
+// check certificate change, unchanged since already checked
+TEST_F(CertificateCheckerTest, CachedCertificate) {
+  EXPECT_CALL(openssl_wrapper_, GetCertificateDigest(nullptr, _, _, _))
+      .Times(2)
+      .WillRepeatedly(DoAll(
+          SetArgPointee<1>(depth_),
+          SetArgPointee<2>(length_),
+          SetArrayArgument<3>(digest_, digest_ + 4),
+          Return(true)));
+  // The prefs are only read by the first check.
+  EXPECT_CALL(prefs_, GetString(cert_key_, _))
+      .WillOnce(DoAll(SetArgPointee<1>(digest_hex_), Return(true)));
+  EXPECT_CALL(prefs_, SetString(_, _)).Times(0);
+  EXPECT_CALL(observer_,
+              CertificateChecked(server_to_check_,
+                                 CertificateCheckResult::kValid))
+      .Times(2);
+  ASSERT_TRUE(
+      cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
+  ASSERT_TRUE(
+      cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
+}
+
+// check certificate change, changed since already checked
+TEST_F(CertificateCheckerTest, CachedCertificateChanged) {
+  uint8_t diff_digest[4]{0x12, 0x34, 0xAB, 0xCD};
+  EXPECT_CALL(openssl_wrapper_, GetCertificateDigest(nullptr, _, _, _))
+      .WillOnce(DoAll(
+          SetArgPointee<1>(depth_),
+          SetArgPointee<2>(length_),
+          SetArrayArgument<3>(diff_digest, diff_digest + 4),
+          Return(true)))
+      .WillOnce(DoAll(
+          SetArgPointee<1>(depth_),
+          SetArgPointee<2>(length_),
+          SetArrayArgument<3>(digest_, digest_ + 4),
+          Return(true)));
+  EXPECT_CALL(prefs_, GetString(cert_key_, _))
+      .WillOnce(DoAll(SetArgPointee<1>(diff_digest_hex_), Return(true)))
+      .WillOnce(DoAll(SetArgPointee<1>(diff_digest_hex_), Return(true)));
+  EXPECT_CALL(prefs_, SetString(cert_key_, digest_hex_)).WillOnce(Return(true));
+  EXPECT_CALL(observer_,
+              CertificateChecked(server_to_check_,
+                                 CertificateCheckResult::kValid));
+  EXPECT_CALL(observer_,
+              CertificateChecked(server_to_check_,
+                                 CertificateCheckResult::kValidChanged));
+  ASSERT_TRUE(
+      cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
+  ASSERT_TRUE(
+      cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
+}
+
 // check certificate change, failed
 TEST_F(CertificateCheckerTest, FailedCertificate) {
   EXPECT_CALL(observer_, CertificateChecked(server_to_check_,
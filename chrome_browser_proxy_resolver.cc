@@ -16,17 +16,25 @@
 
 #include "update_engine/chrome_browser_proxy_resolver.h"
 
+#include <algorithm>
 #include <utility>
 
 #include <base/bind.h>
+#include <base/location.h>
 #include <base/memory/ptr_util.h>
 #include <base/strings/string_util.h>
 #include <brillo/http/http_proxy.h>
 
 #include "update_engine/dbus_connection.h"
 
+using brillo::MessageLoop;
+using std::string;
+
 namespace chromeos_update_engine {
 
+const int ChromeBrowserProxyResolver::kCacheTtlSeconds = 5 * 60;
+const int ChromeBrowserProxyResolver::kCacheRefreshSeconds = 60;
+
 ChromeBrowserProxyResolver::ChromeBrowserProxyResolver()
     : next_request_id_(kProxyRequestIdNull + 1),
       weak_ptr_factory_(this) {}
@@ -36,11 +44,31 @@ ChromeBrowserProxyResolver::~ChromeBrowserProxyResolver() = default;
 ProxyRequestId ChromeBrowserProxyResolver::GetProxiesForUrl(
     const std::string& url, const ProxiesResolvedFn& callback) {
   const ProxyRequestId id = next_request_id_++;
-  brillo::http::GetChromeProxyServersAsync(
-      DBusConnection::Get()->GetDBus(), url,
-      base::Bind(&ChromeBrowserProxyResolver::OnGetChromeProxyServers,
-                 weak_ptr_factory_.GetWeakPtr(), id));
   pending_callbacks_[id] = callback;
+
+  const string origin = GetOrigin(url);
+  CacheEntry& entry = cache_[origin];
+  const base::TimeDelta age = base::TimeTicks::Now() - entry.resolved_time;
+  if (entry.resolved_time.is_null() ||
+      age >= base::TimeDelta::FromSeconds(kCacheTtlSeconds)) {
+    entry.waiting_requests.push_back(id);
+    if (!entry.resolving)
+      Resolve(origin, url);
+    return id;
+  }
+
+  // The callback is always run from the message loop, like when waiting for
+  // Chrome.
+  MessageLoop::current()->PostTask(
+      FROM_HERE,
+      base::Bind(&ChromeBrowserProxyResolver::RunCallback,
+                 weak_ptr_factory_.GetWeakPtr(),
+                 id,
+                 entry.proxies));
+  if (!entry.resolving &&
+      age >= base::TimeDelta::FromSeconds(kCacheRefreshSeconds)) {
+    Resolve(origin, url);
+  }
   return id;
 }
 
@@ -48,18 +76,67 @@ bool ChromeBrowserProxyResolver::CancelProxyRequest(ProxyRequestId request) {
   return pending_callbacks_.erase(request) != 0;
 }
 
+void ChromeBrowserProxyResolver::ReportProxyFailure(const std::string& url,
+                                                    const std::string& proxy) {
+  auto entry = cache_.find(GetOrigin(url));
+  if (entry == cache_.end())
+    return;
+  std::deque<string>& proxies = entry->second.proxies;
+  auto it = std::find(proxies.begin(), proxies.end(), proxy);
+  if (it == proxies.end() || it + 1 == proxies.end())
+    return;
+  LOG(INFO) << "Trying the proxy " << proxy << " last for " << entry->first;
+  proxies.erase(it);
+  proxies.push_back(proxy);
+}
+
+// static
+string ChromeBrowserProxyResolver::GetOrigin(const string& url) {
+  size_t host_start = url.find("://");
+  if (host_start == string::npos)
+    return url;
+  host_start += 3;
+  return url.substr(0, url.find_first_of("/?#", host_start));
+}
+
+void ChromeBrowserProxyResolver::Resolve(const string& origin,
+                                         const string& url) {
+  cache_[origin].resolving = true;
+  brillo::http::GetChromeProxyServersAsync(
+      DBusConnection::Get()->GetDBus(), url,
+      base::Bind(&ChromeBrowserProxyResolver::OnGetChromeProxyServers,
+                 weak_ptr_factory_.GetWeakPtr(), origin));
+}
+
 void ChromeBrowserProxyResolver::OnGetChromeProxyServers(
-    ProxyRequestId request_id, bool success,
+    const string& origin, bool success,
     const std::vector<std::string>& proxies) {
+  CacheEntry& entry = cache_[origin];
+  entry.resolving = false;
   // If |success| is false, |proxies| will still hold the direct proxy option
-  // which is what we do in our error case.
+  // which is what we do in our error case. It isn't cached, so the next
+  // request asks Chrome again.
+  std::deque<string> resolved_proxies(proxies.begin(), proxies.end());
+  if (success) {
+    entry.proxies = resolved_proxies;
+    entry.resolved_time = base::TimeTicks::Now();
+  }
+
+  std::vector<ProxyRequestId> waiting_requests;
+  waiting_requests.swap(entry.waiting_requests);
+  for (ProxyRequestId request_id : waiting_requests)
+    RunCallback(request_id, resolved_proxies);
+}
+
+void ChromeBrowserProxyResolver::RunCallback(
+    ProxyRequestId request_id, const std::deque<std::string>& proxies) {
   auto it = pending_callbacks_.find(request_id);
   if (it == pending_callbacks_.end())
     return;
 
   ProxiesResolvedFn callback = it->second;
   pending_callbacks_.erase(it);
-  callback.Run(std::deque<std::string>(proxies.begin(), proxies.end()));
+  callback.Run(proxies);
 }
 
 }  // namespace chromeos_update_engine
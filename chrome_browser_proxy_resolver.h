@@ -23,13 +23,20 @@
 #include <vector>
 
 #include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
 
 #include "update_engine/proxy_resolver.h"
 
 namespace chromeos_update_engine {
 
+// Resolves the proxies with Chrome over D-Bus. The proxies are cached per
+// origin for kCacheTtlSeconds, and refreshed in the background once they are
+// kCacheRefreshSeconds old, so most requests don't wait for Chrome.
 class ChromeBrowserProxyResolver : public ProxyResolver {
  public:
+  static const int kCacheTtlSeconds;
+  static const int kCacheRefreshSeconds;
+
   ChromeBrowserProxyResolver();
   ~ChromeBrowserProxyResolver() override;
 
@@ -37,10 +44,28 @@ class ChromeBrowserProxyResolver : public ProxyResolver {
   ProxyRequestId GetProxiesForUrl(const std::string& url,
                                   const ProxiesResolvedFn& callback) override;
   bool CancelProxyRequest(ProxyRequestId request) override;
+  void ReportProxyFailure(const std::string& url,
+                          const std::string& proxy) override;
+
+  // Returns the scheme, host and port of |url|, the key of the cache.
+  static std::string GetOrigin(const std::string& url);
 
  private:
-  // Callback for calls made by GetProxiesForUrl().
-  void OnGetChromeProxyServers(ProxyRequestId request_id,
+  struct CacheEntry {
+    std::deque<std::string> proxies;
+    // When |proxies| were resolved, or null if never.
+    base::TimeTicks resolved_time;
+    // Whether there is a call to Chrome in progress for this origin.
+    bool resolving{false};
+    // The requests waiting for that call, as there were no fresh proxies.
+    std::vector<ProxyRequestId> waiting_requests;
+  };
+
+  // Asks Chrome for the proxies of |url|, stored in the entry of |origin|.
+  void Resolve(const std::string& origin, const std::string& url);
+
+  // Callback for calls made by Resolve().
+  void OnGetChromeProxyServers(const std::string& origin,
                                bool success,
                                const std::vector<std::string>& proxies);
 
@@ -56,6 +81,9 @@ class ChromeBrowserProxyResolver : public ProxyResolver {
   // Callbacks that were passed to GetProxiesForUrl() but haven't yet been run.
   std::map<ProxyRequestId, ProxiesResolvedFn> pending_callbacks_;
 
+  // The proxies resolved for each origin.
+  std::map<std::string, CacheEntry> cache_;
+
   base::WeakPtrFactory<ChromeBrowserProxyResolver> weak_ptr_factory_;
 
   DISALLOW_COPY_AND_ASSIGN(ChromeBrowserProxyResolver);
@@ -22,10 +22,12 @@
 #include <utils/String8.h>
 
 #include "update_engine/common_service.h"
+#include "update_engine/parcelable_update_engine_performance.h"
 #include "update_engine/parcelable_update_engine_status.h"
 #include "update_engine/update_status_utils.h"
 
 using android::binder::Status;
+using android::brillo::ParcelableUpdateEnginePerformance;
 using android::brillo::ParcelableUpdateEngineStatus;
 using android::getService;
 using android::OK;
@@ -77,6 +79,27 @@ bool BinderUpdateEngineClient::GetStatus(int64_t* out_last_checked_time,
   return true;
 }
 
+bool BinderUpdateEngineClient::GetStatusFromPage(
+    int64_t* out_last_checked_time,
+    double* out_progress,
+    UpdateStatus* out_update_status,
+    string* out_new_version,
+    int64_t* out_new_size) const {
+  // Android has no /run, so the daemon doesn't publish a status page there.
+  return false;
+}
+
+bool BinderUpdateEngineClient::GetPerformance(
+    UpdateEnginePerformance* out_performance) const {
+  ParcelableUpdateEnginePerformance performance;
+
+  if (!service_->GetPerformance(&performance).isOk())
+    return false;
+
+  *out_performance = performance.ToUpdateEnginePerformance();
+  return true;
+}
+
 bool BinderUpdateEngineClient::SetCohortHint(const string& in_cohort_hint) {
   return service_->SetCohortHint(String16{in_cohort_hint.c_str()}).isOk();
 }
@@ -251,5 +274,15 @@ bool BinderUpdateEngineClient::GetEolStatus(int32_t* eol_status) const {
   return true;
 }
 
+bool BinderUpdateEngineClient::GetPolicyEvaluationTrace(string* trace) const {
+  String16 out_as_string16;
+
+  if (!service_->GetPolicyEvaluationTrace(&out_as_string16).isOk())
+    return false;
+
+  *trace = String8{out_as_string16}.string();
+  return true;
+}
+
 }  // namespace internal
 }  // namespace update_engine
@@ -53,6 +53,14 @@ class BinderUpdateEngineClient : public UpdateEngineClient {
                  std::string* out_new_version,
                  int64_t* out_new_size) const override;
 
+  bool GetStatusFromPage(int64_t* out_last_checked_time,
+                         double* out_progress,
+                         UpdateStatus* out_update_status,
+                         std::string* out_new_version,
+                         int64_t* out_new_size) const override;
+
+  bool GetPerformance(UpdateEnginePerformance* out_performance) const override;
+
   bool SetCohortHint(const std::string& in_cohort_hint) override;
   bool GetCohortHint(std::string* out_cohort_hint) const override;
 
@@ -86,6 +94,8 @@ class BinderUpdateEngineClient : public UpdateEngineClient {
 
   bool GetEolStatus(int32_t* eol_status) const override;
 
+  bool GetPolicyEvaluationTrace(std::string* trace) const override;
+
  private:
   class StatusUpdateCallback :
       public android::brillo::BnUpdateEngineStatusCallback {
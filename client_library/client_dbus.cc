@@ -16,6 +16,8 @@
 
 #include "update_engine/client_library/client_dbus.h"
 
+#include <utility>
+
 #include <base/message_loop/message_loop.h>
 
 #include <dbus/bus.h>
@@ -23,6 +25,8 @@
 
 #include "update_engine/update_status_utils.h"
 
+using chromeos_update_engine::kStatusPagePath;
+using chromeos_update_engine::StatusPageReader;
 using chromeos_update_engine::StringToUpdateStatus;
 using dbus::Bus;
 using org::chromium::UpdateEngineInterfaceProxy;
@@ -74,6 +78,39 @@ bool DBusUpdateEngineClient::GetStatus(int64_t* out_last_checked_time,
   return StringToUpdateStatus(status_as_string, out_update_status);
 }
 
+bool DBusUpdateEngineClient::GetStatusFromPage(int64_t* out_last_checked_time,
+                                               double* out_progress,
+                                               UpdateStatus* out_update_status,
+                                               string* out_new_version,
+                                               int64_t* out_new_size) const {
+  if (!status_page_) {
+    std::unique_ptr<StatusPageReader> status_page(new StatusPageReader());
+    if (!status_page->Init(kStatusPagePath))
+      return false;
+    status_page_ = std::move(status_page);
+  }
+  UpdateEngineStatus status;
+  if (!status_page_->Read(&status))
+    return false;
+  *out_last_checked_time = status.last_checked_time;
+  *out_progress = status.progress;
+  *out_update_status = status.status;
+  *out_new_version = status.new_version;
+  *out_new_size = status.new_size_bytes;
+  return true;
+}
+
+bool DBusUpdateEngineClient::GetPerformance(
+    UpdateEnginePerformance* out_performance) const {
+  return proxy_->GetPerformance(&out_performance->download_bytes_per_second,
+                                &out_performance->apply_bytes_per_second,
+                                &out_performance->disk_write_bytes_per_second,
+                                &out_performance->eta_seconds,
+                                &out_performance->current_operation_type,
+                                &out_performance->current_operation_index,
+                                nullptr);
+}
+
 bool DBusUpdateEngineClient::SetCohortHint(const string& cohort_hint) {
   return proxy_->SetCohortHint(cohort_hint, nullptr);
 }
@@ -241,5 +278,9 @@ bool DBusUpdateEngineClient::GetEolStatus(int32_t* eol_status) const {
   return proxy_->GetEolStatus(eol_status, nullptr);
 }
 
+bool DBusUpdateEngineClient::GetPolicyEvaluationTrace(string* trace) const {
+  return proxy_->GetPolicyEvaluationTrace(trace, nullptr);
+}
+
 }  // namespace internal
 }  // namespace update_engine
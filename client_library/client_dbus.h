@@ -26,6 +26,7 @@
 
 #include "update_engine/client_library/include/update_engine/client.h"
 #include "update_engine/dbus-proxies.h"
+#include "update_engine/status_page.h"
 
 namespace update_engine {
 namespace internal {
@@ -47,6 +48,14 @@ class DBusUpdateEngineClient : public UpdateEngineClient {
                  std::string* out_new_version,
                  int64_t* out_new_size) const override;
 
+  bool GetStatusFromPage(int64_t* out_last_checked_time,
+                         double* out_progress,
+                         UpdateStatus* out_update_status,
+                         std::string* out_new_version,
+                         int64_t* out_new_size) const override;
+
+  bool GetPerformance(UpdateEnginePerformance* out_performance) const override;
+
   bool SetCohortHint(const std::string& cohort_hint) override;
   bool GetCohortHint(std::string* cohort_hint) const override;
 
@@ -80,6 +89,8 @@ class DBusUpdateEngineClient : public UpdateEngineClient {
 
   bool GetEolStatus(int32_t* eol_status) const override;
 
+  bool GetPolicyEvaluationTrace(std::string* trace) const override;
+
  private:
   void DBusStatusHandlersRegistered(const std::string& interface,
                                     const std::string& signal_name,
@@ -99,6 +110,10 @@ class DBusUpdateEngineClient : public UpdateEngineClient {
   std::unique_ptr<org::chromium::UpdateEngineInterfaceProxy> proxy_;
   std::vector<update_engine::StatusUpdateHandler*> handlers_;
   bool dbus_handler_registered_{false};
+  // The status page, mapped by the first GetStatusFromPage() call which
+  // finds it.
+  mutable std::unique_ptr<chromeos_update_engine::StatusPageReader>
+      status_page_;
 
   DISALLOW_COPY_AND_ASSIGN(DBusUpdateEngineClient);
 };  // class DBusUpdateEngineClient
@@ -67,6 +67,24 @@ class UpdateEngineClient {
                          std::string* out_new_version,
                          int64_t* out_new_size) const = 0;
 
+  // Returns the same status as GetStatus(), read from the shared memory page
+  // published by the update_engine instead of asking it, so it can be polled
+  // at a high frequency by any number of processes without waking up the
+  // daemon. The progress is also updated more often than it is signaled to the
+  // status update handlers. Returns false if no status is published, in which
+  // case GetStatus() should be used.
+  virtual bool GetStatusFromPage(int64_t* out_last_checked_time,
+                                 double* out_progress,
+                                 UpdateStatus* out_update_status,
+                                 std::string* out_new_version,
+                                 int64_t* out_new_size) const = 0;
+
+  // Returns the current throughput of the update in progress, the estimated
+  // time left to download it and the install operation being applied. See
+  // update_status.h.
+  virtual bool GetPerformance(
+      UpdateEnginePerformance* out_performance) const = 0;
+
   // Getter and setter for the cohort hint.
   virtual bool SetCohortHint(const std::string& cohort_hint) = 0;
   virtual bool GetCohortHint(std::string* cohort_hint) const = 0;
@@ -122,6 +140,10 @@ class UpdateEngineClient {
   // Get the current end-of-life status code. See EolStatus enum for details.
   virtual bool GetEolStatus(int32_t* eol_status) const = 0;
 
+  // Get the last policy evaluations made by the update engine as JSON, to
+  // debug how often and why the policies are evaluated.
+  virtual bool GetPolicyEvaluationTrace(std::string* trace) const = 0;
+
  protected:
   // Use CreateInstance().
   UpdateEngineClient() = default;
@@ -69,6 +69,24 @@ struct UpdateEngineStatus {
   std::string new_system_version;
 };
 
+struct UpdateEnginePerformance {
+  // The download throughput over the last few seconds (bytes per second).
+  int64_t download_bytes_per_second;
+  // The payload data applied over the same period (bytes per second).
+  int64_t apply_bytes_per_second;
+  // The data written to the target partitions over the same period (bytes per
+  // second).
+  int64_t disk_write_bytes_per_second;
+  // The estimated time left to download the payload (seconds), or -1 if it
+  // isn't known.
+  int64_t eta_seconds;
+  // The type of the install operation being applied, such as "SOURCE_BSDIFF",
+  // or empty if none is.
+  std::string current_operation_type;
+  // The index of that operation in the payload, or -1 if none is applied.
+  int64_t current_operation_index;
+};
+
 }  // namespace update_engine
 
 #endif  // UPDATE_ENGINE_CLIENT_LIBRARY_INCLUDE_UPDATE_ENGINE_UPDATE_STATUS_H_
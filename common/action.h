@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 
 #include <base/logging.h>
 #include <base/macros.h>
@@ -110,11 +111,12 @@ class AbstractAction {
     processor_ = processor;
   }
 
-  // Returns true iff the action is the current action of its ActionProcessor.
+  // Returns true iff the action is the current action of its ActionProcessor
+  // or one of the actions running concurrently with it.
   bool IsRunning() const {
     if (!processor_)
       return false;
-    return processor_->current_action() == this;
+    return processor_->IsActionRunning(this);
   }
 
   // Called on asynchronous actions if canceled. Actions may implement if
@@ -191,6 +193,13 @@ class Action : public AbstractAction {
     return in_pipe_->contents();
   }
 
+  // Moves the object out of the input pipe, for the Actions keeping their own
+  // copy of it. GetInputObject() returns an unspecified object afterwards.
+  typename ActionTraits<SubClass>::InputObjectType TakeInputObject() {
+    CHECK(HasInputObject());
+    return in_pipe_->TakeContents();
+  }
+
   // Returns true iff there's an output pipe.
   bool HasOutputPipe() const {
     return out_pipe_.get();
@@ -205,6 +214,14 @@ class Action : public AbstractAction {
     out_pipe_->set_contents(out_obj);
   }
 
+  // Same as above, moving the passed object to the output pipe, for the
+  // Actions done with it.
+  void SetOutputObject(
+      typename ActionTraits<SubClass>::OutputObjectType&& out_obj) {
+    CHECK(HasOutputPipe());
+    out_pipe_->set_contents(std::move(out_obj));
+  }
+
   // Returns a reference to the object sitting in the output pipe.
   const typename ActionTraits<SubClass>::OutputObjectType& GetOutputObject() {
     CHECK(HasOutputPipe());
@@ -18,6 +18,7 @@
 
 #include <gtest/gtest.h>
 #include <string>
+#include <utility>
 #include "update_engine/common/action.h"
 
 using std::string;
@@ -57,4 +58,14 @@ TEST(ActionPipeTest, SimpleTest) {
   EXPECT_EQ("foo", b.in_pipe()->contents());
 }
 
+// The contents can be moved through the pipe instead of copied.
+TEST(ActionPipeTest, MoveTest) {
+  ActionPipeTestAction a, b;
+  BondActions(&a, &b);
+  string contents(100, 'x');
+  a.out_pipe()->set_contents(std::move(contents));
+  EXPECT_EQ(string(100, 'x'), b.in_pipe()->contents());
+  EXPECT_EQ(string(100, 'x'), b.in_pipe()->TakeContents());
+}
+
 }  // namespace chromeos_update_engine
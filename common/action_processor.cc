@@ -16,12 +16,14 @@
 
 #include "update_engine/common/action_processor.h"
 
+#include <algorithm>
 #include <string>
 
 #include <base/logging.h>
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/error_code_utils.h"
+#include "update_engine/common/hot_path_log.h"
 
 using std::string;
 
@@ -30,8 +32,14 @@ namespace chromeos_update_engine {
 ActionProcessor::~ActionProcessor() {
   if (IsRunning())
     StopProcessing();
-  for (auto action : actions_)
-    action->SetProcessor(nullptr);
+  ClearPendingActions();
+}
+
+bool ActionProcessor::IsActionRunning(const AbstractAction* action) const {
+  return action == current_action_ ||
+         std::find(concurrent_actions_.begin(),
+                   concurrent_actions_.end(),
+                   action) != concurrent_actions_.end();
 }
 
 void ActionProcessor::EnqueueAction(AbstractAction* action) {
@@ -39,14 +47,17 @@ void ActionProcessor::EnqueueAction(AbstractAction* action) {
   action->SetProcessor(this);
 }
 
+void ActionProcessor::EnqueueConcurrentAction(AbstractAction* action) {
+  CHECK(!actions_.empty());
+  pending_concurrent_actions_[actions_.back()].push_back(action);
+  action->SetProcessor(this);
+}
+
 void ActionProcessor::StartProcessing() {
   CHECK(!IsRunning());
-  if (!actions_.empty()) {
-    current_action_ = actions_.front();
-    LOG(INFO) << "ActionProcessor: starting " << current_action_->Type();
-    actions_.pop_front();
-    current_action_->PerformAction();
-  }
+  action_resource_usages_.clear();
+  if (!actions_.empty())
+    StartNextAction();
 }
 
 void ActionProcessor::StopProcessing() {
@@ -55,23 +66,29 @@ void ActionProcessor::StopProcessing() {
     current_action_->TerminateProcessing();
     current_action_->SetProcessor(nullptr);
   }
+  for (auto action : concurrent_actions_) {
+    action->TerminateProcessing();
+    action->SetProcessor(nullptr);
+  }
   LOG(INFO) << "ActionProcessor: aborted "
             << (current_action_ ? current_action_->Type() : "")
+            << (concurrent_actions_.empty() ? "" : " and concurrent actions")
             << (suspended_ ? " while suspended" : "");
   current_action_ = nullptr;
+  concurrent_actions_.clear();
+  action_start_usages_.clear();
+  starting_stage_ = false;
   suspended_ = false;
   // Delete all the actions before calling the delegate.
-  for (auto action : actions_)
-    action->SetProcessor(nullptr);
-  actions_.clear();
+  ClearPendingActions();
   if (delegate_)
     delegate_->ProcessingStopped(this);
 }
 
 void ActionProcessor::SuspendProcessing() {
-  // No current_action_ when not suspended means that the action processor was
+  // No running action when not suspended means that the action processor was
   // never started or already finished.
-  if (suspended_ || !current_action_) {
+  if (suspended_ || (!current_action_ && concurrent_actions_.empty())) {
     LOG(WARNING) << "Called SuspendProcessing while not processing.";
     return;
   }
@@ -79,8 +96,20 @@ void ActionProcessor::SuspendProcessing() {
 
   // If there's a current action we should notify it that it should suspend, but
   // the action can ignore that and terminate at any point.
-  LOG(INFO) << "ActionProcessor: suspending " << current_action_->Type();
-  current_action_->SuspendAction();
+  if (current_action_) {
+    LOG(INFO) << "ActionProcessor: suspending " << current_action_->Type();
+    current_action_->SuspendAction();
+  }
+  // Copy the list since an action may complete while suspending.
+  std::vector<AbstractAction*> concurrent_actions = concurrent_actions_;
+  for (auto action : concurrent_actions) {
+    if (!suspended_)
+      break;
+    if (IsActionRunning(action)) {
+      LOG(INFO) << "ActionProcessor: suspending " << action->Type();
+      action->SuspendAction();
+    }
+  }
 }
 
 void ActionProcessor::ResumeProcessing() {
@@ -89,11 +118,20 @@ void ActionProcessor::ResumeProcessing() {
     return;
   }
   suspended_ = false;
-  if (current_action_) {
-    // The current_action_ did not call ActionComplete while suspended, so we
-    // should notify it of the resume operation.
-    LOG(INFO) << "ActionProcessor: resuming " << current_action_->Type();
-    current_action_->ResumeAction();
+  if (current_action_ || !concurrent_actions_.empty()) {
+    // The running actions did not call ActionComplete while suspended, so we
+    // should notify them of the resume operation.
+    std::vector<AbstractAction*> running_actions = concurrent_actions_;
+    if (current_action_)
+      running_actions.insert(running_actions.begin(), current_action_);
+    for (auto action : running_actions) {
+      if (suspended_)
+        break;
+      if (IsActionRunning(action)) {
+        LOG(INFO) << "ActionProcessor: resuming " << action->Type();
+        action->ResumeAction();
+      }
+    }
   } else {
     // The last action called ActionComplete while suspended, so there is
     // already a log message with the type of the finished action. We simply
@@ -106,25 +144,47 @@ void ActionProcessor::ResumeProcessing() {
 
 void ActionProcessor::ActionComplete(AbstractAction* actionptr,
                                      ErrorCode code) {
-  CHECK_EQ(actionptr, current_action_);
+  auto concurrent_action = std::find(
+      concurrent_actions_.begin(), concurrent_actions_.end(), actionptr);
+  CHECK(actionptr == current_action_ ||
+        concurrent_action != concurrent_actions_.end());
+  auto start_usage = action_start_usages_.find(actionptr);
+  if (start_usage != action_start_usages_.end()) {
+    action_resource_usages_.push_back(
+        {actionptr->Type(), GetResourceUsageSince(start_usage->second)});
+    action_start_usages_.erase(start_usage);
+  }
   if (delegate_)
     delegate_->ActionCompleted(this, actionptr, code);
-  string old_type = current_action_->Type();
-  current_action_->ActionCompleted(code);
-  current_action_->SetProcessor(nullptr);
-  current_action_ = nullptr;
+  string old_type = actionptr->Type();
+  actionptr->ActionCompleted(code);
+  actionptr->SetProcessor(nullptr);
+  if (actionptr == current_action_)
+    current_action_ = nullptr;
+  else
+    concurrent_actions_.erase(concurrent_action);
+  bool stage_running =
+      current_action_ || !concurrent_actions_.empty() || starting_stage_;
   LOG(INFO) << "ActionProcessor: finished "
-            << (actions_.empty() ? "last action " : "") << old_type
-            << (suspended_ ? " while suspended" : "")
+            << (actions_.empty() && !stage_running ? "last action " : "")
+            << old_type << (suspended_ ? " while suspended" : "")
             << " with code " << utils::ErrorCodeToString(code);
+  if (stage_error_code_ == ErrorCode::kSuccess)
+    stage_error_code_ = code;
+  if (!stage_running)
+    CompleteStage();
+}
+
+void ActionProcessor::CompleteStage() {
+  ErrorCode code = stage_error_code_;
   if (!actions_.empty() && code != ErrorCode::kSuccess) {
     LOG(INFO) << "ActionProcessor: Aborting processing due to failure.";
-    actions_.clear();
+    ClearPendingActions();
   }
   if (suspended_) {
     // If an action finished while suspended we don't start the next action (or
     // terminate the processing) until the processor is resumed. This condition
-    // will be flagged by a nullptr current_action_ while suspended_ is true.
+    // will be flagged by no running action while suspended_ is true.
     suspended_error_code_ = code;
     return;
   }
@@ -133,15 +193,69 @@ void ActionProcessor::ActionComplete(AbstractAction* actionptr,
 
 void ActionProcessor::StartNextActionOrFinish(ErrorCode code) {
   if (actions_.empty()) {
+    // Write the messages of the hot paths of the actions before their
+    // summary.
+    HotPathLogger::Get()->Flush();
+    if (!action_resource_usages_.empty()) {
+      LOG(INFO) << "ActionProcessor: resources used by each action:";
+      for (const auto& action_usage : action_resource_usages_) {
+        LOG(INFO) << "  " << action_usage.type << ": "
+                  << action_usage.usage.ToString();
+      }
+    }
     if (delegate_) {
       delegate_->ProcessingDone(this, code);
     }
     return;
   }
+  StartNextAction();
+}
+
+void ActionProcessor::StartNextAction() {
   current_action_ = actions_.front();
   actions_.pop_front();
+  stage_error_code_ = ErrorCode::kSuccess;
+  auto pending = pending_concurrent_actions_.find(current_action_);
+  if (pending != pending_concurrent_actions_.end()) {
+    concurrent_actions_ = std::move(pending->second);
+    pending_concurrent_actions_.erase(pending);
+  }
+  // The concurrent actions are started after the current one, and any of them
+  // may complete or stop the processing while starting.
+  std::vector<AbstractAction*> concurrent_actions = concurrent_actions_;
+  starting_stage_ = true;
   LOG(INFO) << "ActionProcessor: starting " << current_action_->Type();
-  current_action_->PerformAction();
+  PerformAction(current_action_);
+  for (auto action : concurrent_actions) {
+    if (!starting_stage_ || !IsActionRunning(action))
+      return;
+    LOG(INFO) << "ActionProcessor: starting " << action->Type()
+              << " concurrently";
+    PerformAction(action);
+    if (suspended_ && IsActionRunning(action))
+      action->SuspendAction();
+  }
+  if (!starting_stage_)
+    return;
+  starting_stage_ = false;
+  if (!current_action_ && concurrent_actions_.empty())
+    CompleteStage();
+}
+
+void ActionProcessor::PerformAction(AbstractAction* action) {
+  action_start_usages_[action] = GetResourceUsage();
+  action->PerformAction();
+}
+
+void ActionProcessor::ClearPendingActions() {
+  for (auto action : actions_)
+    action->SetProcessor(nullptr);
+  actions_.clear();
+  for (auto& pending : pending_concurrent_actions_) {
+    for (auto action : pending.second)
+      action->SetProcessor(nullptr);
+  }
+  pending_concurrent_actions_.clear();
 }
 
 }  // namespace chromeos_update_engine
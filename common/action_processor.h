@@ -18,11 +18,15 @@
 #define UPDATE_ENGINE_COMMON_ACTION_PROCESSOR_H_
 
 #include <deque>
+#include <map>
+#include <string>
+#include <vector>
 
 #include <base/macros.h>
 #include <brillo/errors/error.h>
 
 #include "update_engine/common/error_code.h"
+#include "update_engine/common/resource_usage.h"
 
 // The structure of these classes (Action, ActionPipe, ActionProcessor, etc.)
 // is based on the KSAction* classes from the Google Update Engine code at
@@ -33,6 +37,15 @@
 // See action.h for an overview of this class and other Action* classes.
 
 // An ActionProcessor keeps a queue of Actions and processes them in order.
+// Actions independent from the rest of the queue can be enqueued to run
+// concurrently with one of the queued actions, forming a stage of actions
+// that all run at the same time. The next action only starts once the whole
+// stage completed, so the ActionPipes between actions of different stages
+// work as they do for a linear queue.
+//
+// The resources used by each action, from its start until it completes, are
+// accounted and logged in a summary once the processing is done. The actions
+// of a stage run on the same thread, so their times overlap.
 
 namespace chromeos_update_engine {
 
@@ -69,22 +82,46 @@ class ActionProcessor {
 
   // Returns true iff the processing was started but not yet completed nor
   // stopped.
-  bool IsRunning() const { return current_action_ != nullptr || suspended_; }
+  bool IsRunning() const {
+    return current_action_ != nullptr || !concurrent_actions_.empty() ||
+           suspended_;
+  }
+
+  // Returns whether |action| is the current action or one of the actions
+  // running concurrently with it.
+  bool IsActionRunning(const AbstractAction* action) const;
 
   // Adds another Action to the end of the queue.
   virtual void EnqueueAction(AbstractAction* action);
 
+  // Adds an Action that runs concurrently with the last Action enqueued with
+  // EnqueueAction(), which must not have started yet. It starts right after
+  // that action and the action after them only starts once both completed.
+  // The concurrent action can take its input from the actions before it, but
+  // must not be piped to the action it runs with. When any action of a stage
+  // fails, the other ones still run to completion and the processing is then
+  // aborted with the error code of the first failure.
+  virtual void EnqueueConcurrentAction(AbstractAction* action);
+
   // Sets/gets the current delegate. Set to null to remove a delegate.
   ActionProcessorDelegate* delegate() const { return delegate_; }
   void set_delegate(ActionProcessorDelegate *delegate) {
     delegate_ = delegate;
   }
 
-  // Returns a pointer to the current Action that's processing.
+  // Returns a pointer to the current Action that's processing. The actions
+  // running concurrently with it aren't reported, and this is null once it
+  // completed even if they are still running.
   AbstractAction* current_action() const {
     return current_action_;
   }
 
+  // Returns the resources used by the actions completed since the processing
+  // started, in the order they completed.
+  const std::vector<ActionResourceUsage>& action_resource_usages() const {
+    return action_resource_usages_;
+  }
+
   // Called by an action to notify processor that it's done. Caller passes self.
   void ActionComplete(AbstractAction* actionptr, ErrorCode code);
 
@@ -94,13 +131,48 @@ class ActionProcessor {
   // processing will terminate.
   void StartNextActionOrFinish(ErrorCode code);
 
+  // Starts the first action of the queue and the actions enqueued to run
+  // concurrently with it.
+  void StartNextAction();
+
+  // Called once the current action and all the actions running concurrently
+  // with it completed.
+  void CompleteStage();
+
+  // Removes all the actions not started yet.
+  void ClearPendingActions();
+
+  // Calls PerformAction() on |action|, recording the resources used so far.
+  void PerformAction(AbstractAction* action);
+
   // Actions that have not yet begun processing, in the order in which
   // they'll be processed.
   std::deque<AbstractAction*> actions_;
 
+  // The actions to start along with each action of |actions_|.
+  std::map<AbstractAction*, std::vector<AbstractAction*>>
+      pending_concurrent_actions_;
+
   // A pointer to the currently processing Action, if any.
   AbstractAction* current_action_{nullptr};
 
+  // The actions started with the current action that didn't complete yet.
+  std::vector<AbstractAction*> concurrent_actions_;
+
+  // The resources used when each running action started.
+  std::map<AbstractAction*, ResourceUsage> action_start_usages_;
+
+  // The resources used by each completed action.
+  std::vector<ActionResourceUsage> action_resource_usages_;
+
+  // Whether the actions of a stage are being started, so the stage doesn't
+  // complete before all of them started.
+  bool starting_stage_{false};
+
+  // The error code of the first action of the current stage that failed, or
+  // kSuccess.
+  ErrorCode stage_error_code_{ErrorCode::kSuccess};
+
   // The ErrorCode reported by an action that was suspended but finished while
   // being suspended. This error code is stored here to be reported back to the
   // delegate once the processor is resumed.
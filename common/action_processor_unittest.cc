@@ -164,6 +164,31 @@ TEST_F(ActionProcessorTest, ChainActionsTest) {
   EXPECT_FALSE(action_processor_.IsRunning());
 }
 
+TEST_F(ActionProcessorTest, ActionResourceUsagesTest) {
+  action_processor_.set_delegate(nullptr);
+
+  ActionProcessorTestAction action1, action2;
+  action_processor_.EnqueueAction(&action1);
+  action_processor_.EnqueueAction(&action2);
+  action_processor_.StartProcessing();
+  EXPECT_TRUE(action_processor_.action_resource_usages().empty());
+  action1.CompleteAction();
+  ASSERT_EQ(1U, action_processor_.action_resource_usages().size());
+  action2.CompleteAction();
+  ASSERT_EQ(2U, action_processor_.action_resource_usages().size());
+  for (const auto& action_usage : action_processor_.action_resource_usages()) {
+    EXPECT_EQ("ActionProcessorTestAction", action_usage.type);
+    EXPECT_LE(base::TimeDelta(), action_usage.usage.wall_time);
+  }
+
+  // The usages are cleared when the processing starts again.
+  action_processor_.EnqueueAction(&action1);
+  action_processor_.StartProcessing();
+  EXPECT_TRUE(action_processor_.action_resource_usages().empty());
+  action_processor_.StopProcessing();
+  EXPECT_TRUE(action_processor_.action_resource_usages().empty());
+}
+
 TEST_F(ActionProcessorTest, DtorTest) {
   ActionProcessorTestAction action1, action2;
   {
@@ -261,4 +286,70 @@ TEST_F(ActionProcessorTest, StoppedWhileSuspendedTest) {
   EXPECT_EQ(nullptr, action_processor_.current_action());
 }
 
+TEST_F(ActionProcessorTest, ConcurrentActionsTest) {
+  action_processor_.set_delegate(nullptr);
+
+  ActionProcessorTestAction action1, action2, action3;
+  action_processor_.EnqueueAction(&action1);
+  action_processor_.EnqueueConcurrentAction(&action2);
+  action_processor_.EnqueueAction(&action3);
+  action_processor_.StartProcessing();
+  EXPECT_EQ(&action1, action_processor_.current_action());
+  EXPECT_TRUE(action1.IsRunning());
+  EXPECT_TRUE(action2.IsRunning());
+  EXPECT_FALSE(action3.IsRunning());
+
+  // The next action waits for the concurrent one.
+  action1.CompleteAction();
+  EXPECT_EQ(nullptr, action_processor_.current_action());
+  EXPECT_TRUE(action_processor_.IsRunning());
+  EXPECT_TRUE(action2.IsRunning());
+  EXPECT_FALSE(action3.IsRunning());
+
+  action2.CompleteAction();
+  EXPECT_EQ(&action3, action_processor_.current_action());
+  action3.CompleteAction();
+  EXPECT_FALSE(action_processor_.IsRunning());
+}
+
+TEST_F(ActionProcessorTest, ConcurrentActionFailureTest) {
+  action_processor_.set_delegate(nullptr);
+
+  ActionProcessorTestAction action1, action2, action3;
+  action_processor_.EnqueueAction(&action1);
+  action_processor_.EnqueueConcurrentAction(&action2);
+  action_processor_.EnqueueAction(&action3);
+  action_processor_.StartProcessing();
+
+  // The other actions of the stage still run after a failure, then the
+  // processing is aborted.
+  action_processor_.ActionComplete(&action2, ErrorCode::kError);
+  EXPECT_TRUE(action1.IsRunning());
+  action1.CompleteAction();
+  EXPECT_FALSE(action_processor_.IsRunning());
+  EXPECT_EQ(nullptr, action3.processor());
+}
+
+TEST_F(ActionProcessorTest, ConcurrentActionSuspendStopTest) {
+  action_processor_.EnqueueAction(&action_);
+  action_processor_.EnqueueConcurrentAction(&mock_action_);
+
+  testing::InSequence s;
+  EXPECT_CALL(mock_action_, PerformAction());
+  action_processor_.StartProcessing();
+  action_.CompleteAction();
+  EXPECT_TRUE(action_processor_.IsRunning());
+
+  EXPECT_CALL(mock_action_, SuspendAction());
+  action_processor_.SuspendProcessing();
+  EXPECT_CALL(mock_action_, ResumeAction());
+  action_processor_.ResumeProcessing();
+
+  EXPECT_CALL(mock_action_, TerminateProcessing());
+  action_processor_.StopProcessing();
+  EXPECT_TRUE(delegate_.processing_stopped_called_);
+  EXPECT_FALSE(delegate_.processing_done_called_);
+  EXPECT_FALSE(action_processor_.IsRunning());
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/bandwidth_limiter.h"
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+const base::TimeDelta BandwidthLimiter::kBurstDuration =
+    base::TimeDelta::FromSeconds(5);
+
+void BandwidthLimiter::SetRate(uint64_t rate) {
+  if (rate == rate_)
+    return;
+  // Account the time elapsed so far at the previous rate.
+  Refill();
+  if (rate_ == 0) {
+    // Start with an empty bucket, since nothing was saved up while unlimited.
+    tokens_ = 0;
+  }
+  rate_ = rate;
+  if (rate_ > 0) {
+    tokens_ = std::min<int64_t>(tokens_,
+                                rate_ * kBurstDuration.InSeconds());
+  }
+  if (rate_)
+    LOG(INFO) << "Limiting the download rate to " << rate_ << " bytes/s.";
+  else
+    LOG(INFO) << "Not limiting the download rate anymore.";
+}
+
+base::TimeDelta BandwidthLimiter::ConsumeBytes(size_t bytes) {
+  if (rate_ == 0)
+    return base::TimeDelta();
+  Refill();
+  tokens_ -= bytes;
+  if (tokens_ >= 0)
+    return base::TimeDelta();
+  // Wait until the bucket would be back to empty.
+  return base::TimeDelta::FromMicroseconds(
+      -tokens_ * base::Time::kMicrosecondsPerSecond / rate_);
+}
+
+void BandwidthLimiter::Refill() {
+  base::Time now = clock_->GetMonotonicTime();
+  if (rate_ > 0 && !last_refill_.is_null() && now > last_refill_) {
+    // Bound the elapsed time so the product below can't overflow; the bucket
+    // is full long before anyway.
+    base::TimeDelta elapsed =
+        std::min(now - last_refill_, base::TimeDelta::FromHours(1));
+    int64_t earned = elapsed.InMicroseconds() * rate_ /
+                     base::Time::kMicrosecondsPerSecond;
+    tokens_ = std::min<int64_t>(tokens_ + earned,
+                                rate_ * kBurstDuration.InSeconds());
+  }
+  last_refill_ = now;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,73 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_BANDWIDTH_LIMITER_H_
+#define UPDATE_ENGINE_COMMON_BANDWIDTH_LIMITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+#include "update_engine/common/clock.h"
+#include "update_engine/common/clock_interface.h"
+
+namespace chromeos_update_engine {
+
+// Caps the rate of the bytes received by the fetchers sharing it with a token
+// bucket. The bucket fills at the rate limit up to |kBurstDuration| worth of
+// it, so the capacity left unused while the transfer was slower than the cap
+// can be spent in a burst afterwards. The limit can be changed at any time and
+// applies right away to the transfers in progress. It is meant to be used from
+// the main loop only.
+class BandwidthLimiter {
+ public:
+  // How long the bucket takes to fill up, at the rate limit.
+  static const base::TimeDelta kBurstDuration;
+
+  BandwidthLimiter() : clock_(&default_clock_) {}
+  // Used for testing. The |clock| must outlive the limiter.
+  explicit BandwidthLimiter(ClockInterface* clock) : clock_(clock) {}
+
+  // Limits the transfers to |rate| bytes per second. A |rate| of zero removes
+  // the limit.
+  void SetRate(uint64_t rate);
+  uint64_t rate() const { return rate_; }
+
+  // Accounts |bytes| just received against the rate limit. Returns how long
+  // the transfer should wait before receiving more, or zero if it can go on.
+  base::TimeDelta ConsumeBytes(size_t bytes);
+
+ private:
+  // Adds the tokens earned since the last refill to the bucket.
+  void Refill();
+
+  Clock default_clock_;
+  ClockInterface* clock_;
+
+  uint64_t rate_{0};
+  // The bytes that can be received right away. It is negative while the
+  // transfers are ahead of the rate limit.
+  int64_t tokens_{0};
+  base::Time last_refill_;
+
+  DISALLOW_COPY_AND_ASSIGN(BandwidthLimiter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_BANDWIDTH_LIMITER_H_
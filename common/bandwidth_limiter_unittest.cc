@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/bandwidth_limiter.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_clock.h"
+
+namespace chromeos_update_engine {
+
+class BandwidthLimiterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    clock_.SetMonotonicTime(base::Time::FromInternalValue(1000000));
+  }
+
+  void Advance(base::TimeDelta delta) {
+    clock_.SetMonotonicTime(clock_.GetMonotonicTime() + delta);
+  }
+
+  FakeClock clock_;
+  BandwidthLimiter limiter_{&clock_};
+};
+
+TEST_F(BandwidthLimiterTest, UnlimitedTest) {
+  EXPECT_EQ(0U, limiter_.rate());
+  EXPECT_EQ(base::TimeDelta(), limiter_.ConsumeBytes(1024 * 1024 * 1024));
+}
+
+TEST_F(BandwidthLimiterTest, RateLimitTest) {
+  limiter_.SetRate(1000);
+  // The bucket starts empty, so the bytes received wait for their share.
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(500),
+            limiter_.ConsumeBytes(500));
+  Advance(base::TimeDelta::FromMilliseconds(500));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(2), limiter_.ConsumeBytes(2000));
+  Advance(base::TimeDelta::FromSeconds(2));
+  EXPECT_EQ(base::TimeDelta(), limiter_.ConsumeBytes(0));
+}
+
+TEST_F(BandwidthLimiterTest, BurstTest) {
+  limiter_.SetRate(1000);
+  limiter_.ConsumeBytes(0);
+  // The capacity saved up while idle is capped to the burst duration.
+  Advance(BandwidthLimiter::kBurstDuration * 2);
+  size_t burst = 1000 * BandwidthLimiter::kBurstDuration.InSeconds();
+  EXPECT_EQ(base::TimeDelta(), limiter_.ConsumeBytes(burst));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(1), limiter_.ConsumeBytes(1000));
+}
+
+TEST_F(BandwidthLimiterTest, ChangeRateTest) {
+  limiter_.SetRate(1000);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(4), limiter_.ConsumeBytes(4000));
+  // The bytes still owed are paid at the new rate.
+  limiter_.SetRate(4000);
+  EXPECT_EQ(4000U, limiter_.rate());
+  EXPECT_EQ(base::TimeDelta::FromSeconds(2), limiter_.ConsumeBytes(4000));
+
+  limiter_.SetRate(0);
+  EXPECT_EQ(base::TimeDelta(), limiter_.ConsumeBytes(4000));
+  // A new limit doesn't carry the debt from before it was removed.
+  limiter_.SetRate(1000);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(1), limiter_.ConsumeBytes(1000));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/blob_pool.h"
+
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+const size_t BlobPool::kMinClassSize = 4 * 1024;
+const size_t BlobPool::kMaxClassSize = 16 * 1024 * 1024;
+const size_t BlobPool::kMaxIdleBytes = 64 * 1024 * 1024;
+
+// static
+BlobPool* BlobPool::Get() {
+  // Never destroyed, so the buffers can be released at any time.
+  static BlobPool* const pool = new BlobPool();
+  return pool;
+}
+
+// static
+int BlobPool::ClassIndex(size_t size) {
+  if (size > kMaxClassSize)
+    return -1;
+  int index = 0;
+  for (size_t class_size = kMinClassSize; class_size < size; class_size *= 2)
+    index++;
+  return index;
+}
+
+brillo::Blob BlobPool::Take(size_t size) {
+  int index = ClassIndex(size);
+  if (index < 0) {
+    misses_++;
+    return brillo::Blob(size);
+  }
+  {
+    base::AutoLock auto_lock(lock_);
+    if (static_cast<size_t>(index) < idle_blobs_.size() &&
+        !idle_blobs_[index].empty()) {
+      brillo::Blob blob = std::move(idle_blobs_[index].back());
+      idle_blobs_[index].pop_back();
+      idle_bytes_ -= blob.size();
+      hits_++;
+      return blob;
+    }
+  }
+  misses_++;
+  return brillo::Blob(kMinClassSize << index);
+}
+
+void BlobPool::Put(brillo::Blob&& blob) {
+  int index = ClassIndex(blob.size());
+  // Only the buffers of a class size, as returned by Take(), are kept.
+  if (index < 0 || blob.size() != kMinClassSize << index)
+    return;
+  base::AutoLock auto_lock(lock_);
+  if (idle_bytes_ + blob.size() > kMaxIdleBytes)
+    return;
+  if (idle_blobs_.size() <= static_cast<size_t>(index))
+    idle_blobs_.resize(index + 1);
+  idle_bytes_ += blob.size();
+  idle_blobs_[index].push_back(std::move(blob));
+}
+
+void BlobPool::Clear() {
+  base::AutoLock auto_lock(lock_);
+  idle_blobs_.clear();
+  idle_bytes_ = 0;
+}
+
+void PooledBlob::Reset(size_t size) {
+  if (!blob_.empty())
+    pool_->Put(std::move(blob_));
+  blob_ = size ? pool_->Take(size) : brillo::Blob();
+  size_ = size;
+}
+
+}  // namespace chromeos_update_engine
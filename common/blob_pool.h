@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_BLOB_POOL_H_
+#define UPDATE_ENGINE_COMMON_BLOB_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+namespace chromeos_update_engine {
+
+// Keeps the large temporary buffers released by the code applying and
+// verifying the payloads, so the next operations reuse them instead of
+// allocating new ones and page faulting them in again. The buffers are
+// grouped in size classes of the powers of two from kMinClassSize to
+// kMaxClassSize, and up to kMaxIdleBytes of them are kept. The larger buffers
+// are allocated and freed as usual. All the methods are thread safe.
+class BlobPool {
+ public:
+  static const size_t kMinClassSize;
+  static const size_t kMaxClassSize;
+  static const size_t kMaxIdleBytes;
+
+  BlobPool() = default;
+
+  // The pool shared by the whole process.
+  static BlobPool* Get();
+
+  // Returns a buffer of at least |size| bytes, with the size of its class.
+  // Its contents are undefined.
+  brillo::Blob Take(size_t size);
+
+  // Keeps the |blob| returned by Take() for a later one, or frees it if the
+  // pool is full.
+  void Put(brillo::Blob&& blob);
+
+  // Frees all the idle buffers.
+  void Clear();
+
+  // The number of Take() calls served and not served by an idle buffer.
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+ private:
+  // Returns the index of the class of the buffers of |size| bytes, or -1 if
+  // they aren't pooled.
+  static int ClassIndex(size_t size);
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+
+  base::Lock lock_;
+  // The idle buffers of each size class.
+  std::vector<std::vector<brillo::Blob>> idle_blobs_;
+  size_t idle_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(BlobPool);
+};
+
+// A buffer of |size()| bytes taken from a BlobPool, and returned to it when
+// destroyed or reset. Its contents are undefined when taken.
+class PooledBlob {
+ public:
+  explicit PooledBlob(BlobPool* pool = BlobPool::Get()) : pool_(pool) {}
+  explicit PooledBlob(size_t size, BlobPool* pool = BlobPool::Get())
+      : pool_(pool) {
+    Reset(size);
+  }
+  ~PooledBlob() { Reset(0); }
+
+  // Replaces the buffer with one of |size| bytes. The data isn't kept. A
+  // |size| of zero only releases it.
+  void Reset(size_t size);
+
+  uint8_t* data() { return blob_.data(); }
+  const uint8_t* data() const { return blob_.data(); }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  BlobPool* pool_;
+  brillo::Blob blob_;
+  size_t size_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(PooledBlob);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_BLOB_POOL_H_
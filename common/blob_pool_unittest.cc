@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/blob_pool.h"
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class BlobPoolTest : public ::testing::Test {
+ protected:
+  BlobPool pool_;
+};
+
+TEST_F(BlobPoolTest, ClassSizeTest) {
+  PooledBlob blob(1, &pool_);
+  EXPECT_EQ(1U, blob.size());
+  EXPECT_FALSE(blob.empty());
+  brillo::Blob taken = pool_.Take(BlobPool::kMinClassSize + 1);
+  EXPECT_EQ(2 * BlobPool::kMinClassSize, taken.size());
+  EXPECT_EQ(0U, pool_.hits());
+  EXPECT_EQ(2U, pool_.misses());
+}
+
+TEST_F(BlobPoolTest, ReuseTest) {
+  const uint8_t* data;
+  {
+    PooledBlob blob(100 * 1024, &pool_);
+    data = blob.data();
+  }
+  // A buffer of the same class is served by the released one.
+  PooledBlob blob(120 * 1024, &pool_);
+  EXPECT_EQ(data, blob.data());
+  EXPECT_EQ(120U * 1024, blob.size());
+  EXPECT_EQ(1U, pool_.hits());
+  EXPECT_EQ(1U, pool_.misses());
+
+  // Not by a buffer of another class.
+  blob.Reset(200 * 1024);
+  EXPECT_EQ(1U, pool_.hits());
+  blob.Reset(0);
+  EXPECT_TRUE(blob.empty());
+}
+
+TEST_F(BlobPoolTest, BlobsNotTakenAreNotKeptTest) {
+  // A buffer without the size of its class isn't kept.
+  pool_.Put(brillo::Blob(BlobPool::kMinClassSize + 1));
+  pool_.Take(2 * BlobPool::kMinClassSize);
+  EXPECT_EQ(0U, pool_.hits());
+}
+
+TEST_F(BlobPoolTest, LargeBlobsNotPooledTest) {
+  {
+    PooledBlob blob(BlobPool::kMaxClassSize + 1, &pool_);
+    EXPECT_EQ(BlobPool::kMaxClassSize + 1, blob.size());
+  }
+  PooledBlob blob(BlobPool::kMaxClassSize + 1, &pool_);
+  EXPECT_EQ(0U, pool_.hits());
+  EXPECT_EQ(2U, pool_.misses());
+}
+
+TEST_F(BlobPoolTest, MaxIdleBytesTest) {
+  const size_t num_blobs = BlobPool::kMaxIdleBytes / BlobPool::kMaxClassSize;
+  for (size_t i = 0; i <= num_blobs; i++)
+    pool_.Put(brillo::Blob(BlobPool::kMaxClassSize));
+  // Only the buffers fitting in kMaxIdleBytes were kept.
+  for (size_t i = 0; i <= num_blobs; i++)
+    pool_.Take(BlobPool::kMaxClassSize);
+  EXPECT_EQ(num_blobs, pool_.hits());
+  EXPECT_EQ(1U, pool_.misses());
+}
+
+TEST_F(BlobPoolTest, ClearTest) {
+  pool_.Put(brillo::Blob(BlobPool::kMinClassSize));
+  pool_.Clear();
+  pool_.Take(BlobPool::kMinClassSize);
+  EXPECT_EQ(0U, pool_.hits());
+  // The cleared pool keeps the buffers put again.
+  pool_.Put(brillo::Blob(BlobPool::kMinClassSize));
+  pool_.Take(BlobPool::kMinClassSize);
+  EXPECT_EQ(1U, pool_.hits());
+}
+
+}  // namespace chromeos_update_engine
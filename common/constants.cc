@@ -37,35 +37,47 @@ const char kPrefsCurrentUrlIndex[] = "current-url-index";
 const char kPrefsDailyMetricsLastReportedAt[] =
     "daily-metrics-last-reported-at";
 const char kPrefsDeltaUpdateFailures[] = "delta-update-failures";
+const char kPrefsDownloadRateLimit[] = "download-rate-limit";
 const char kPrefsFullPayloadAttemptNumber[] = "full-payload-attempt-number";
 const char kPrefsInstallDateDays[] = "install-date-days";
 const char kPrefsLastActivePingDay[] = "last-active-ping-day";
 const char kPrefsLastRollCallPingDay[] = "last-roll-call-ping-day";
 const char kPrefsManifestMetadataSize[] = "manifest-metadata-size";
 const char kPrefsManifestSignatureSize[] = "manifest-signature-size";
+const char kPrefsMeteredDownloadRateLimit[] = "metered-download-rate-limit";
 const char kPrefsMetricsAttemptLastReportingTime[] =
     "metrics-attempt-last-reporting-time";
 const char kPrefsMetricsCheckLastReportingTime[] =
     "metrics-check-last-reporting-time";
 const char kPrefsNumReboots[] = "num-reboots";
 const char kPrefsNumResponsesSeen[] = "num-responses-seen";
+const char kPrefsOffPeakDownloadEndHour[] = "off-peak-download-end-hour";
+const char kPrefsOffPeakDownloadStartHour[] = "off-peak-download-start-hour";
 const char kPrefsOmahaCohort[] = "omaha-cohort";
 const char kPrefsOmahaCohortHint[] = "omaha-cohort-hint";
 const char kPrefsOmahaCohortName[] = "omaha-cohort-name";
 const char kPrefsOmahaEolStatus[] = "omaha-eol-status";
+const char kPrefsOmahaPendingEvents[] = "omaha-pending-events";
+const char kPrefsOmahaRequestEncoding[] = "omaha-request-encoding";
+const char kPrefsOmahaResponse[] = "omaha-response";
+const char kPrefsOmahaResponseCacheKey[] = "omaha-response-cache-key";
+const char kPrefsOmahaResponseETag[] = "omaha-response-etag";
 const char kPrefsP2PEnabled[] = "p2p-enabled";
 const char kPrefsP2PFirstAttemptTimestamp[] = "p2p-first-attempt-timestamp";
 const char kPrefsP2PNumAttempts[] = "p2p-num-attempts";
 const char kPrefsPayloadAttemptNumber[] = "payload-attempt-number";
+const char kPrefsPeakDownloadRateLimit[] = "peak-download-rate-limit";
 const char kPrefsPostInstallSucceeded[] = "post-install-succeeded";
 const char kPrefsPreviousVersion[] = "previous-version";
 const char kPrefsResumedUpdateFailures[] = "resumed-update-failures";
 const char kPrefsRollbackVersion[] = "rollback-version";
+const char kPrefsRoundTripTimeEstimate[] = "round-trip-time-estimate";
 const char kPrefsChannelOnSlotPrefix[] = "channel-on-slot-";
 const char kPrefsSystemUpdatedMarker[] = "system-updated-marker";
 const char kPrefsTargetVersionAttempt[] = "target-version-attempt";
 const char kPrefsTargetVersionInstalledFrom[] = "target-version-installed-from";
 const char kPrefsTargetVersionUniqueId[] = "target-version-unique-id";
+const char kPrefsThroughputEstimate[] = "throughput-estimate";
 const char kPrefsTotalBytesDownloaded[] = "total-bytes-downloaded";
 const char kPrefsUpdateCheckCount[] = "update-check-count";
 const char kPrefsUpdateCheckResponseHash[] = "update-check-response-hash";
@@ -76,15 +88,23 @@ const char kPrefsUpdateFirstSeenAt[] = "update-first-seen-at";
 const char kPrefsUpdateOverCellularPermission[] =
     "update-over-cellular-permission";
 const char kPrefsUpdateServerCertificate[] = "update-server-cert";
+const char kPrefsUpdateStateMetadata[] = "update-state-metadata";
+const char kPrefsUpdateStateMetadataPayloadHash[] =
+    "update-state-metadata-payload-hash";
 const char kPrefsUpdateStateNextDataLength[] = "update-state-next-data-length";
 const char kPrefsUpdateStateNextDataOffset[] = "update-state-next-data-offset";
 const char kPrefsUpdateStateNextOperation[] = "update-state-next-operation";
+const char kPrefsUpdateStateOperationDataOffset[] =
+    "update-state-operation-data-offset";
+const char kPrefsUpdateStateOperationSHA256Context[] =
+    "update-state-operation-sha-256-context";
 const char kPrefsUpdateStatePayloadIndex[] = "update-state-payload-index";
 const char kPrefsUpdateStateSHA256Context[] = "update-state-sha-256-context";
 const char kPrefsUpdateStateSignatureBlob[] = "update-state-signature-blob";
 const char kPrefsUpdateStateSignedSHA256Context[] =
     "update-state-signed-sha-256-context";
 const char kPrefsUpdateTimestampStart[] = "update-timestamp-start";
+const char kPrefsUrlHostThroughputPrefix[] = "url-host-throughput-";
 const char kPrefsUrlSwitchCount[] = "url-switch-count";
 const char kPrefsWallClockWaitPeriod[] = "wall-clock-wait-period";
 
@@ -111,5 +131,51 @@ const char kPayloadPropertySwitchSlotOnReboot[] = "SWITCH_SLOT_ON_REBOOT";
 // honored if we're resuming an update and post install has already succeeded.
 // The default is 1 (always run post install).
 const char kPayloadPropertyRunPostInstall[] = "RUN_POST_INSTALL";
+// Set "PIPELINED_APPLY=1" to apply the payload operations on a worker thread
+// while the download continues. The default is 0 (apply synchronously).
+const char kPayloadPropertyPipelinedApply[] = "PIPELINED_APPLY";
+// The number of worker threads applying the independent payload operations in
+// parallel, for example "APPLY_THREADS=4". Implies "PIPELINED_APPLY=1" when
+// greater than 1. The default is 1.
+const char kPayloadPropertyApplyThreads[] = "APPLY_THREADS";
+// Set "ASYNC_WRITES=1" to queue the writes to the target partitions as
+// asynchronous I/O requests submitted in batches. The default is 0.
+const char kPayloadPropertyAsyncWrites[] = "ASYNC_WRITES";
+// Set "DIRECT_IO=1" to write the target partitions with O_DIRECT, bypassing
+// the page cache. Ignored if "ASYNC_WRITES=1". The default is 0.
+const char kPayloadPropertyDirectIo[] = "DIRECT_IO";
+// Set "VERIFY_SOURCE_ONCE=1" to verify the hash of each whole source partition
+// before applying its operations and skip the per-operation source hash checks
+// when it matches. The default is 0.
+const char kPayloadPropertyVerifySourceOnce[] = "VERIFY_SOURCE_ONCE";
+// Set "MMAP_SOURCE=1" to map the source partitions in memory and read the
+// source data of SOURCE_BSDIFF, BROTLI_BSDIFF and PUFFDIFF operations from the
+// mapping. The default is 0.
+const char kPayloadPropertyMmapSource[] = "MMAP_SOURCE";
+// Set "TRACE_APPLY=1" to write a trace of the time spent in each phase of every
+// operation to apply_trace.json in the non-volatile directory, which can be
+// loaded in chrome://tracing. The default is 0.
+const char kPayloadPropertyTraceApply[] = "TRACE_APPLY";
+// Set "TRACE_IO=1" to write a binary trace of every read, write, ioctl and
+// flush of the partitions to io_trace.bin in the non-volatile directory, which
+// can be replayed on a device with io_trace_replay. The default is 0.
+const char kPayloadPropertyTraceIo[] = "TRACE_IO";
+// Set "CLONE_SOURCE_COPY=1" to apply the SOURCE_COPY operations with
+// FICLONERANGE or copy_file_range() when the partitions are image files, so the
+// copied data is shared with the source or copied by the kernel. The default is
+// 0.
+const char kPayloadPropertyCloneSourceCopy[] = "CLONE_SOURCE_COPY";
+// Set "VERIFY_WRITTEN_HASH=1" to compute the hash of the target partitions from
+// the data written while applying the payload, so only a sample of each
+// partition is read back to verify it. The default is 0.
+const char kPayloadPropertyVerifyWrittenHash[] = "VERIFY_WRITTEN_HASH";
+// Set "WRITE_VERITY=1" to build the dm-verity hash tree described in the
+// payload while verifying the target partitions, instead of leaving it to be
+// built on the first boot. The default is 0.
+const char kPayloadPropertyWriteVerity[] = "WRITE_VERITY";
+// The number of HTTP connections downloading chunks of the payload in
+// parallel, for example "DOWNLOAD_CONNECTIONS=4". Only used when the payload
+// size is known. The default is 1.
+const char kPayloadPropertyDownloadConnections[] = "DOWNLOAD_CONNECTIONS";
 
 }  // namespace chromeos_update_engine
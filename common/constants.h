@@ -41,33 +41,45 @@ extern const char kPrefsCurrentUrlFailureCount[];
 extern const char kPrefsCurrentUrlIndex[];
 extern const char kPrefsDailyMetricsLastReportedAt[];
 extern const char kPrefsDeltaUpdateFailures[];
+extern const char kPrefsDownloadRateLimit[];
 extern const char kPrefsFullPayloadAttemptNumber[];
 extern const char kPrefsInstallDateDays[];
 extern const char kPrefsLastActivePingDay[];
 extern const char kPrefsLastRollCallPingDay[];
 extern const char kPrefsManifestMetadataSize[];
 extern const char kPrefsManifestSignatureSize[];
+extern const char kPrefsMeteredDownloadRateLimit[];
 extern const char kPrefsMetricsAttemptLastReportingTime[];
 extern const char kPrefsMetricsCheckLastReportingTime[];
 extern const char kPrefsNumReboots[];
 extern const char kPrefsNumResponsesSeen[];
+extern const char kPrefsOffPeakDownloadEndHour[];
+extern const char kPrefsOffPeakDownloadStartHour[];
 extern const char kPrefsOmahaCohort[];
 extern const char kPrefsOmahaCohortHint[];
 extern const char kPrefsOmahaCohortName[];
 extern const char kPrefsOmahaEolStatus[];
+extern const char kPrefsOmahaPendingEvents[];
+extern const char kPrefsOmahaRequestEncoding[];
+extern const char kPrefsOmahaResponse[];
+extern const char kPrefsOmahaResponseCacheKey[];
+extern const char kPrefsOmahaResponseETag[];
 extern const char kPrefsP2PEnabled[];
 extern const char kPrefsP2PFirstAttemptTimestamp[];
 extern const char kPrefsP2PNumAttempts[];
 extern const char kPrefsPayloadAttemptNumber[];
+extern const char kPrefsPeakDownloadRateLimit[];
 extern const char kPrefsPostInstallSucceeded[];
 extern const char kPrefsPreviousVersion[];
 extern const char kPrefsResumedUpdateFailures[];
 extern const char kPrefsRollbackVersion[];
+extern const char kPrefsRoundTripTimeEstimate[];
 extern const char kPrefsChannelOnSlotPrefix[];
 extern const char kPrefsSystemUpdatedMarker[];
 extern const char kPrefsTargetVersionAttempt[];
 extern const char kPrefsTargetVersionInstalledFrom[];
 extern const char kPrefsTargetVersionUniqueId[];
+extern const char kPrefsThroughputEstimate[];
 extern const char kPrefsTotalBytesDownloaded[];
 extern const char kPrefsUpdateCheckCount[];
 extern const char kPrefsUpdateCheckResponseHash[];
@@ -77,14 +89,19 @@ extern const char kPrefsUpdateDurationUptime[];
 extern const char kPrefsUpdateFirstSeenAt[];
 extern const char kPrefsUpdateOverCellularPermission[];
 extern const char kPrefsUpdateServerCertificate[];
+extern const char kPrefsUpdateStateMetadata[];
+extern const char kPrefsUpdateStateMetadataPayloadHash[];
 extern const char kPrefsUpdateStateNextDataLength[];
 extern const char kPrefsUpdateStateNextDataOffset[];
 extern const char kPrefsUpdateStateNextOperation[];
+extern const char kPrefsUpdateStateOperationDataOffset[];
+extern const char kPrefsUpdateStateOperationSHA256Context[];
 extern const char kPrefsUpdateStatePayloadIndex[];
 extern const char kPrefsUpdateStateSHA256Context[];
 extern const char kPrefsUpdateStateSignatureBlob[];
 extern const char kPrefsUpdateStateSignedSHA256Context[];
 extern const char kPrefsUpdateTimestampStart[];
+extern const char kPrefsUrlHostThroughputPrefix[];
 extern const char kPrefsUrlSwitchCount[];
 extern const char kPrefsWallClockWaitPeriod[];
 
@@ -99,6 +116,18 @@ extern const char kPayloadPropertyPowerwash[];
 extern const char kPayloadPropertyNetworkId[];
 extern const char kPayloadPropertySwitchSlotOnReboot[];
 extern const char kPayloadPropertyRunPostInstall[];
+extern const char kPayloadPropertyPipelinedApply[];
+extern const char kPayloadPropertyApplyThreads[];
+extern const char kPayloadPropertyAsyncWrites[];
+extern const char kPayloadPropertyDirectIo[];
+extern const char kPayloadPropertyVerifySourceOnce[];
+extern const char kPayloadPropertyMmapSource[];
+extern const char kPayloadPropertyTraceApply[];
+extern const char kPayloadPropertyTraceIo[];
+extern const char kPayloadPropertyCloneSourceCopy[];
+extern const char kPayloadPropertyVerifyWrittenHash[];
+extern const char kPayloadPropertyWriteVerity[];
+extern const char kPayloadPropertyDownloadConnections[];
 
 // A download source is any combination of protocol and server (that's of
 // interest to us when looking at UMA metrics) using which we may download
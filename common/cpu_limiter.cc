@@ -16,11 +16,19 @@
 
 #include "update_engine/common/cpu_limiter.h"
 
+#include <errno.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <map>
 #include <string>
 
 #include <base/bind.h>
+#include <base/files/file_enumerator.h>
+#include <base/files/file_util.h>
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
 #include <base/time/time.h>
 
 #include "update_engine/common/utils.h"
@@ -31,10 +39,79 @@ namespace {
 // /etc/init/update-engine.conf.
 const char kCGroupSharesPath[] = "/sys/fs/cgroup/cpu/update-engine/cpu.shares";
 
+// Reads the sysfs attribute |name| of the directory |dir| as an integer.
+bool ReadUint64Attribute(const base::FilePath& dir,
+                         const std::string& name,
+                         uint64_t* value) {
+  std::string str;
+  if (!base::ReadFileToString(dir.Append(name), &str))
+    return false;
+  base::TrimWhitespaceASCII(str, base::TRIM_ALL, &str);
+  return base::StringToUint64(str, value);
+}
+
 }  // namespace
 
 namespace chromeos_update_engine {
 
+bool ReadCoreTopology(const base::FilePath& cpu_dir, CoreTopology* topology) {
+  *topology = CoreTopology();
+  std::map<int, uint64_t> capacities;
+  base::FileEnumerator cores(
+      cpu_dir, false, base::FileEnumerator::DIRECTORIES, "cpu*");
+  for (base::FilePath core = cores.Next(); !core.empty(); core = cores.Next()) {
+    // Skips the cpufreq and cpuidle directories.
+    int index;
+    if (!base::StringToInt(core.BaseName().value().substr(3), &index))
+      continue;
+    uint64_t capacity;
+    if (!ReadUint64Attribute(core, "cpu_capacity", &capacity) &&
+        !ReadUint64Attribute(core, "cpufreq/cpuinfo_max_freq", &capacity)) {
+      LOG(WARNING) << "Unable to read the capacity of " << core.value();
+      return false;
+    }
+    capacities[index] = capacity;
+  }
+  if (capacities.empty())
+    return false;
+
+  uint64_t min_capacity = capacities.begin()->second;
+  for (const auto& core_capacity : capacities)
+    min_capacity = std::min(min_capacity, core_capacity.second);
+  for (const auto& core_capacity : capacities) {
+    if (core_capacity.second == min_capacity)
+      topology->efficiency_cores.push_back(core_capacity.first);
+    else
+      topology->performance_cores.push_back(core_capacity.first);
+  }
+  return true;
+}
+
+bool SetCorePlacement(base::PlatformThreadId thread,
+                      const CoreTopology& topology,
+                      CorePlacement placement) {
+  if (!topology.IsHeterogeneous())
+    return true;
+  cpu_set_t cores;
+  CPU_ZERO(&cores);
+  if (placement != CorePlacement::kPerformance) {
+    for (int core : topology.efficiency_cores)
+      CPU_SET(core, &cores);
+  }
+  if (placement != CorePlacement::kEfficiency) {
+    for (int core : topology.performance_cores)
+      CPU_SET(core, &cores);
+  }
+  if (sched_setaffinity(thread, sizeof(cores), &cores) == 0)
+    return true;
+  // The cpuset of the process may not have any of these cores, like the
+  // background cpuset on Android, so all the cores are allowed instead.
+  if (errno == EINVAL && placement != CorePlacement::kAny)
+    return SetCorePlacement(thread, topology, CorePlacement::kAny);
+  PLOG(ERROR) << "Failed to set the cores of thread " << thread;
+  return false;
+}
+
 CPULimiter::~CPULimiter() {
   // Set everything back to normal on destruction.
   CPULimiter::SetCpuShares(CpuShares::kNormal);
@@ -17,6 +17,10 @@
 #ifndef UPDATE_ENGINE_COMMON_CPU_LIMITER_H_
 #define UPDATE_ENGINE_COMMON_CPU_LIMITER_H_
 
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/threading/platform_thread.h>
 #include <brillo/message_loops/message_loop.h>
 
 namespace chromeos_update_engine {
@@ -34,6 +38,40 @@ enum class CpuShares : int {
 // success, false otherwise.
 bool SetCpuShares(CpuShares shares);
 
+// The cores of the CPU grouped by their capacity, on the SoCs with cores of
+// different types like big.LITTLE. The cores with the lowest capacity are the
+// efficiency cores, and the others the big and prime cores.
+struct CoreTopology {
+  std::vector<int> efficiency_cores;
+  std::vector<int> performance_cores;
+
+  // Whether the CPU has cores of different types, so placing the threads on
+  // some of them makes a difference.
+  bool IsHeterogeneous() const {
+    return !efficiency_cores.empty() && !performance_cores.empty();
+  }
+};
+
+// Reads the CoreTopology from the capacity of the cpuN directories under
+// |cpu_dir|, normally /sys/devices/system/cpu: their cpu_capacity, or else
+// their cpufreq/cpuinfo_max_freq. Returns false if the capacity of a core
+// can't be read.
+bool ReadCoreTopology(const base::FilePath& cpu_dir, CoreTopology* topology);
+
+// The cores the update threads run on.
+enum class CorePlacement {
+  kAny,
+  kEfficiency,
+  kPerformance,
+};
+
+// Restricts the thread |thread| to the cores of |topology| for |placement|.
+// All the cores are allowed when the topology isn't heterogeneous. Returns
+// true on success, false otherwise.
+bool SetCorePlacement(base::PlatformThreadId thread,
+                      const CoreTopology& topology,
+                      CorePlacement placement);
+
 class CPULimiter {
  public:
   CPULimiter() = default;
@@ -16,6 +16,11 @@
 
 #include "update_engine/common/cpu_limiter.h"
 
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
 #include <gtest/gtest.h>
 
 namespace chromeos_update_engine {
@@ -23,6 +28,18 @@ namespace chromeos_update_engine {
 class CPULimiterTest : public ::testing::Test {};
 
 namespace {
+// Writes the sysfs attribute |name| of the core |core| under |cpu_dir|.
+void WriteCoreAttribute(const base::FilePath& cpu_dir,
+                        int core,
+                        const std::string& name,
+                        const std::string& value) {
+  base::FilePath path =
+      cpu_dir.Append("cpu" + std::to_string(core)).Append(name);
+  ASSERT_TRUE(base::CreateDirectory(path.DirName()));
+  ASSERT_EQ(static_cast<int>(value.size()),
+            base::WriteFile(path, value.data(), value.size()));
+}
+
 // Compares cpu shares and returns an integer that is less
 // than, equal to or greater than 0 if |shares_lhs| is,
 // respectively, lower than, same as or higher than |shares_rhs|.
@@ -39,4 +56,45 @@ TEST(CPULimiterTest, CompareCpuSharesTest) {
   EXPECT_GT(CompareCpuShares(CpuShares::kHigh, CpuShares::kNormal), 0);
 }
 
+TEST(CPULimiterTest, ReadCoreTopologyTest) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  const base::FilePath& cpu_dir = temp_dir.GetPath();
+  // Four little cores, three big ones and a prime one.
+  for (int core = 0; core < 8; core++) {
+    WriteCoreAttribute(cpu_dir,
+                       core,
+                       "cpu_capacity",
+                       core < 4 ? "378\n" : core < 7 ? "871\n" : "1024\n");
+  }
+  ASSERT_TRUE(base::CreateDirectory(cpu_dir.Append("cpufreq")));
+
+  CoreTopology topology;
+  EXPECT_TRUE(ReadCoreTopology(cpu_dir, &topology));
+  EXPECT_TRUE(topology.IsHeterogeneous());
+  EXPECT_EQ((std::vector<int>{0, 1, 2, 3}), topology.efficiency_cores);
+  EXPECT_EQ((std::vector<int>{4, 5, 6, 7}), topology.performance_cores);
+}
+
+TEST(CPULimiterTest, ReadHomogeneousCoreTopologyTest) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  const base::FilePath& cpu_dir = temp_dir.GetPath();
+  // Without a cpu_capacity, the maximum frequency is used.
+  WriteCoreAttribute(cpu_dir, 0, "cpufreq/cpuinfo_max_freq", "2000000\n");
+  WriteCoreAttribute(cpu_dir, 1, "cpufreq/cpuinfo_max_freq", "2000000\n");
+
+  CoreTopology topology;
+  EXPECT_TRUE(ReadCoreTopology(cpu_dir, &topology));
+  EXPECT_FALSE(topology.IsHeterogeneous());
+  EXPECT_EQ(2U, topology.efficiency_cores.size());
+  // The threads aren't placed on the cores of a homogeneous CPU.
+  EXPECT_TRUE(SetCorePlacement(
+      base::PlatformThread::CurrentId(), topology, CorePlacement::kEfficiency));
+
+  // A core without a capacity makes the topology unknown.
+  ASSERT_TRUE(base::CreateDirectory(cpu_dir.Append("cpu2")));
+  EXPECT_FALSE(ReadCoreTopology(cpu_dir, &topology));
+}
+
 }  // namespace chromeos_update_engine
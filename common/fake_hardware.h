@@ -91,6 +91,11 @@ class FakeHardware : public HardwareInterface {
     first_active_omaha_ping_sent_ = true;
   }
 
+  bool GetDeviceActivity(DeviceActivity* activity) const override {
+    *activity = device_activity_;
+    return true;
+  }
+
   // Setters
   void SetIsOfficialBuild(bool is_official_build) {
     is_official_build_ = is_official_build;
@@ -139,6 +144,10 @@ class FakeHardware : public HardwareInterface {
     build_timestamp_ = build_timestamp;
   }
 
+  void SetDeviceActivity(const DeviceActivity& device_activity) {
+    device_activity_ = device_activity;
+  }
+
  private:
   bool is_official_build_{true};
   bool is_normal_boot_mode_{true};
@@ -153,6 +162,7 @@ class FakeHardware : public HardwareInterface {
   bool powerwash_scheduled_{false};
   int64_t build_timestamp_{0};
   bool first_active_omaha_ping_sent_{false};
+  DeviceActivity device_activity_;
 
   DISALLOW_COPY_AND_ASSIGN(FakeHardware);
 };
@@ -105,6 +105,30 @@ bool FakePrefs::Delete(const string& key) {
   return true;
 }
 
+bool FakePrefs::StartTransaction() {
+  if (in_transaction_)
+    return false;
+  in_transaction_ = true;
+  transaction_start_values_ = values_;
+  return true;
+}
+
+void FakePrefs::CancelTransaction() {
+  if (!in_transaction_)
+    return;
+  in_transaction_ = false;
+  values_.swap(transaction_start_values_);
+  transaction_start_values_.clear();
+}
+
+bool FakePrefs::SubmitTransaction() {
+  if (!in_transaction_)
+    return false;
+  in_transaction_ = false;
+  transaction_start_values_.clear();
+  return true;
+}
+
 string FakePrefs::GetTypeName(PrefType type) {
   switch (type) {
     case PrefType::kString:
@@ -49,6 +49,10 @@ class FakePrefs : public PrefsInterface {
   bool Exists(const std::string& key) const override;
   bool Delete(const std::string& key) override;
 
+  bool StartTransaction() override;
+  void CancelTransaction() override;
+  bool SubmitTransaction() override;
+
   void AddObserver(const std::string& key,
                    ObserverInterface* observer) override;
   void RemoveObserver(const std::string& key,
@@ -102,6 +106,11 @@ class FakePrefs : public PrefsInterface {
   // Container for all the key/value pairs.
   std::map<std::string, PrefTypeValue> values_;
 
+  // The copy of |values_| restored by CancelTransaction(), if
+  // |in_transaction_|.
+  bool in_transaction_{false};
+  std::map<std::string, PrefTypeValue> transaction_start_values_;
+
   // The registered observers watching for changes.
   std::map<std::string, std::vector<ObserverInterface*>> observers_;
 
@@ -16,13 +16,21 @@
 
 #include "update_engine/common/file_fetcher.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <limits>
 #include <string>
 
 #include <base/bind.h>
 #include <base/format_macros.h>
 #include <base/location.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <brillo/streams/file_stream.h>
@@ -32,13 +40,27 @@
 
 using std::string;
 
+namespace chromeos_update_engine {
+
 namespace {
 
-size_t kReadBufferSize = 16 * 1024;
+// Returns whether the file |fd| can't be truncated while it is mapped, which
+// would make the reads of the mapping past its new end fail with SIGBUS: a
+// memfd sealed against shrinking, or a file on a read-only file system.
+bool CanNotShrink(int fd) {
+#ifdef F_GET_SEALS
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals >= 0 && (seals & F_SEAL_SHRINK))
+    return true;
+#endif  // F_GET_SEALS
+  struct statvfs stvfsbuf;
+  return fstatvfs(fd, &stvfsbuf) == 0 && (stvfsbuf.f_flag & ST_RDONLY);
+}
 
 }  // namespace
 
-namespace chromeos_update_engine {
+const size_t FileFetcher::kDefaultChunkSize = 2 * 1024 * 1024;
+const size_t FileFetcher::kDefaultReadaheadChunks = 4;
 
 // static
 bool FileFetcher::SupportedUrl(const string& url) {
@@ -68,29 +90,91 @@ void FileFetcher::BeginTransfer(const string& url) {
   }
 
   string file_path = url.substr(strlen("file://"));
-  stream_ =
-      brillo::FileStream::Open(base::FilePath(file_path),
-                               brillo::Stream::AccessMode::READ,
-                               brillo::FileStream::Disposition::OPEN_EXISTING,
-                               nullptr);
-
-  if (!stream_) {
-    LOG(ERROR) << "Couldn't open " << file_path;
-    http_response_code_ = kHttpResponseNotFound;
-    CleanUp();
-    if (delegate_)
-      delegate_->TransferComplete(this, false);
-    return;
+  if (!MapFile(file_path)) {
+    if (!OpenStream(file_path)) {
+      LOG(ERROR) << "Couldn't open " << file_path;
+      http_response_code_ = kHttpResponseNotFound;
+      CleanUp();
+      if (delegate_)
+        delegate_->TransferComplete(this, false);
+      return;
+    }
+    if (offset_)
+      stream_->SetPosition(offset_, nullptr);
   }
   http_response_code_ = kHttpResponseOk;
 
-  if (offset_)
-    stream_->SetPosition(offset_, nullptr);
   bytes_copied_ = 0;
+  readahead_end_ = 0;
   transfer_in_progress_ = true;
   ScheduleRead();
 }
 
+bool FileFetcher::MapFile(const string& file_path) {
+  int fd = HANDLE_EINTR(open(file_path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return false;
+  struct stat stbuf;
+  if (fstat(fd, &stbuf) != 0 || !S_ISREG(stbuf.st_mode) ||
+      stbuf.st_size <= 0 ||
+      static_cast<uint64_t>(stbuf.st_size) >
+          std::numeric_limits<size_t>::max() ||
+      !CanNotShrink(fd)) {
+    IGNORE_EINTR(close(fd));
+    return false;
+  }
+  size_t size = static_cast<size_t>(stbuf.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid once the file is closed.
+  IGNORE_EINTR(close(fd));
+  if (data == MAP_FAILED) {
+    PLOG(WARNING) << "Unable to map " << file_path << ", reading it instead";
+    return false;
+  }
+  if (madvise(data, size, MADV_SEQUENTIAL) != 0)
+    PLOG(WARNING) << "Unable to advise the sequential reads of " << file_path;
+  mapped_data_ = static_cast<const uint8_t*>(data);
+  mapped_size_ = size;
+  return true;
+}
+
+bool FileFetcher::OpenStream(const string& file_path) {
+  int fd = HANDLE_EINTR(open(file_path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return false;
+  // This doubles the readahead of the kernel, and fails on pipes, which can't
+  // be read ahead.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  stream_ = brillo::FileStream::FromFileDescriptor(fd, true, nullptr);
+  if (!stream_) {
+    IGNORE_EINTR(close(fd));
+    return false;
+  }
+  stream_fd_ = fd;
+  return true;
+}
+
+void FileFetcher::Readahead(uint64_t position) {
+  uint64_t end = position + static_cast<uint64_t>(chunk_size_) *
+                                readahead_chunks_;
+  if (data_length_ >= 0)
+    end = std::min(end, offset_ + static_cast<uint64_t>(data_length_));
+  if (mapped_data_)
+    end = std::min<uint64_t>(end, mapped_size_);
+  const uint64_t start = std::max(position, readahead_end_);
+  if (end <= start)
+    return;
+  readahead_end_ = end;
+  if (mapped_data_) {
+    const uint64_t aligned_start = start - start % getpagesize();
+    madvise(const_cast<uint8_t*>(mapped_data_) + aligned_start,
+            end - aligned_start,
+            MADV_WILLNEED);
+  } else {
+    posix_fadvise(stream_fd_, start, end - start, POSIX_FADV_WILLNEED);
+  }
+}
+
 void FileFetcher::TerminateTransfer() {
   CleanUp();
   if (delegate_) {
@@ -103,7 +187,16 @@ void FileFetcher::ScheduleRead() {
   if (transfer_paused_ || ongoing_read_ || !transfer_in_progress_)
     return;
 
-  buffer_.resize(kReadBufferSize);
+  if (mapped_data_) {
+    ongoing_read_ = true;
+    mapped_chunk_task_ = brillo::MessageLoop::current()->PostTask(
+        FROM_HERE,
+        base::Bind(&FileFetcher::OnMappedChunkCallback,
+                   base::Unretained(this)));
+    return;
+  }
+
+  buffer_.resize(chunk_size_);
   size_t bytes_to_read = buffer_.size();
   if (data_length_ >= 0) {
     bytes_to_read = std::min(static_cast<uint64_t>(bytes_to_read),
@@ -114,6 +207,7 @@ void FileFetcher::ScheduleRead() {
     OnReadDoneCallback(0);
     return;
   }
+  Readahead(offset_ + bytes_copied_ + bytes_to_read);
 
   ongoing_read_ = stream_->ReadAsync(
       buffer_.data(),
@@ -131,15 +225,34 @@ void FileFetcher::ScheduleRead() {
 }
 
 void FileFetcher::OnReadDoneCallback(size_t bytes_read) {
+  OnBytesRead(buffer_.data(), bytes_read);
+}
+
+void FileFetcher::OnMappedChunkCallback() {
+  mapped_chunk_task_ = brillo::MessageLoop::kTaskIdNull;
+  const uint64_t start =
+      std::min<uint64_t>(offset_ + bytes_copied_, mapped_size_);
+  uint64_t length = std::min<uint64_t>(chunk_size_, mapped_size_ - start);
+  if (data_length_ >= 0) {
+    length = std::min(length,
+                      static_cast<uint64_t>(data_length_) - bytes_copied_);
+  }
+  // The next chunks are read from the disk while the delegate processes this
+  // one.
+  Readahead(start + length);
+  OnBytesRead(mapped_data_ + start, length);
+}
+
+void FileFetcher::OnBytesRead(const void* bytes, size_t length) {
   ongoing_read_ = false;
-  if (bytes_read == 0) {
+  if (length == 0) {
     CleanUp();
     if (delegate_)
       delegate_->TransferComplete(this, true);
   } else {
-    bytes_copied_ += bytes_read;
+    bytes_copied_ += length;
     if (delegate_)
-      delegate_->ReceivedBytes(this, buffer_.data(), bytes_read);
+      delegate_->ReceivedBytes(this, bytes, length);
     ScheduleRead();
   }
 }
@@ -174,6 +287,16 @@ void FileFetcher::CleanUp() {
     stream_->CloseBlocking(nullptr);
     stream_.reset();
   }
+  stream_fd_ = -1;
+  if (mapped_chunk_task_ != brillo::MessageLoop::kTaskIdNull) {
+    brillo::MessageLoop::current()->CancelTask(mapped_chunk_task_);
+    mapped_chunk_task_ = brillo::MessageLoop::kTaskIdNull;
+  }
+  if (mapped_data_) {
+    munmap(const_cast<uint8_t*>(mapped_data_), mapped_size_);
+    mapped_data_ = nullptr;
+    mapped_size_ = 0;
+  }
   // Destroying the |stream_| releases the callback, so we don't have any
   // ongoing read at this point.
   ongoing_read_ = false;
@@ -29,7 +29,13 @@
 #include "update_engine/common/http_fetcher.h"
 
 // This is a concrete implementation of HttpFetcher that reads files
-// asynchronously.
+// asynchronously. The regular files which can't shrink, the memfds sealed
+// against it and the files of read-only file systems, are mapped in memory and
+// passed to the delegate in large chunks pointing into the mapping, without
+// copying them to a read buffer. The other files, whose truncation would crash
+// the reads of a mapping with SIGBUS, are read through a stream. In both cases
+// the kernel is asked to read the next chunks in the background while the
+// delegate processes one, so slow storage is kept busy.
 
 namespace chromeos_update_engine {
 
@@ -38,6 +44,12 @@ class FileFetcher : public HttpFetcher {
   // Returns whether the passed url is supported.
   static bool SupportedUrl(const std::string& url);
 
+  // The default size of the chunks passed to the delegate, which is also the
+  // size of the reads of a streamed file, and the default number of chunks
+  // read ahead.
+  static const size_t kDefaultChunkSize;
+  static const size_t kDefaultReadaheadChunks;
+
   FileFetcher() : HttpFetcher(nullptr) {}
 
   // Cleans up all internal state. Does not notify delegate.
@@ -69,6 +81,14 @@ class FileFetcher : public HttpFetcher {
     return static_cast<size_t>(bytes_copied_);
   }
 
+  // Sets the size of the chunks passed to the delegate and the number of
+  // chunks after the current one read in the background. Must be called
+  // before BeginTransfer().
+  void set_chunk_size(size_t chunk_size) { chunk_size_ = chunk_size; }
+  void set_readahead_chunks(size_t readahead_chunks) {
+    readahead_chunks_ = readahead_chunks;
+  }
+
   // Ignore all the time limits for files.
   void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {}
   void set_connect_timeout(int connect_timeout_seconds) override {}
@@ -78,6 +98,18 @@ class FileFetcher : public HttpFetcher {
   // Cleans up the fetcher, resetting its status to a newly constructed one.
   void CleanUp();
 
+  // Maps the file at |file_path| in memory if it is a non-empty regular file
+  // which can't shrink while it is mapped. Returns whether it was mapped.
+  bool MapFile(const std::string& file_path);
+
+  // Opens the |stream_| reading the file at |file_path| sequentially. Returns
+  // whether it succeeded.
+  bool OpenStream(const std::string& file_path);
+
+  // Asks the kernel to read the |readahead_chunks_| chunks from the file
+  // offset |position| on in the background, unless it already was.
+  void Readahead(uint64_t position);
+
   // Schedule a new asynchronous read if the stream is not paused and no other
   // read is in process. This method can be called at any point.
   void ScheduleRead();
@@ -87,6 +119,13 @@ class FileFetcher : public HttpFetcher {
   void OnReadDoneCallback(size_t bytes_read);
   void OnReadErrorCallback(const brillo::Error* error);
 
+  // Called from the main loop to pass the next chunk of the mapped file.
+  void OnMappedChunkCallback();
+
+  // Passes the |length| bytes read at |bytes| to the delegate, completing the
+  // transfer if there are none, and schedules the next read.
+  void OnBytesRead(const void* bytes, size_t length);
+
   // Whether the transfer was started and didn't finish yet.
   bool transfer_in_progress_{false};
 
@@ -94,7 +133,8 @@ class FileFetcher : public HttpFetcher {
   bool transfer_paused_{false};
 
   // Whether there's an ongoing asynchronous read. When this value is true, the
-  // the |buffer_| is being used by the |stream_|.
+  // the |buffer_| is being used by the |stream_|, or the next chunk of the
+  // mapped file is scheduled to be passed by |mapped_chunk_task_|.
   bool ongoing_read_{false};
 
   // Total number of bytes copied.
@@ -107,10 +147,25 @@ class FileFetcher : public HttpFetcher {
   int64_t data_length_{-1};
 
   brillo::StreamPtr stream_;
+  // The file descriptor of the |stream_|, owned by it.
+  int stream_fd_{-1};
+
+  size_t chunk_size_{kDefaultChunkSize};
+  size_t readahead_chunks_{kDefaultReadaheadChunks};
+
+  // The file offset up to which the kernel was asked to read ahead.
+  uint64_t readahead_end_{0};
 
   // The buffer used for reading from the stream.
   brillo::Blob buffer_;
 
+  // The whole file mapped in memory, used instead of the |stream_| if not
+  // null.
+  const uint8_t* mapped_data_{nullptr};
+  size_t mapped_size_{0};
+  brillo::MessageLoop::TaskId mapped_chunk_task_{
+      brillo::MessageLoop::kTaskIdNull};
+
   DISALLOW_COPY_AND_ASSIGN(FileFetcher);
 };
 
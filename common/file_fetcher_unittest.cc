@@ -16,15 +16,60 @@
 
 #include "update_engine/common/file_fetcher.h"
 
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include <string>
 
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
 
 namespace chromeos_update_engine {
 
-class FileFetcherUnitTest : public ::testing::Test {};
+class FileFetcherUnitTest : public ::testing::Test {
+ protected:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  void TearDown() override {
+    EXPECT_EQ(0, brillo::MessageLoopRunMaxIterations(&loop_, 1));
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+};
+
+namespace {
+
+// Collects the bytes received by a fetcher.
+class CollectingDelegate : public HttpFetcherDelegate {
+ public:
+  void ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    const char* chars = static_cast<const char*>(bytes);
+    data_.append(chars, length);
+    num_chunks_++;
+  }
+
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    completed_ = true;
+    successful_ = successful;
+  }
+
+  string data_;
+  size_t num_chunks_{0};
+  bool completed_{false};
+  bool successful_{false};
+};
+
+}  // namespace
 
 TEST_F(FileFetcherUnitTest, SupporterUrlsTest) {
   EXPECT_TRUE(FileFetcher::SupportedUrl("file:///path/to/somewhere.bin"));
@@ -34,4 +79,69 @@ TEST_F(FileFetcherUnitTest, SupporterUrlsTest) {
   EXPECT_FALSE(FileFetcher::SupportedUrl("http:///no_http_here"));
 }
 
+TEST_F(FileFetcherUnitTest, MappedFileTest) {
+  // Only the files which can't shrink are mapped, such as a sealed memfd.
+  int fd = syscall(__NR_memfd_create, "FileFetcherUnitTest", MFD_ALLOW_SEALING);
+  ASSERT_GE(fd, 0);
+  ScopedFdCloser fd_closer(&fd);
+  string contents;
+  for (size_t i = 0; contents.size() < 2 * FileFetcher::kDefaultChunkSize; i++)
+    contents += std::to_string(i) + ",";
+  ASSERT_TRUE(utils::WriteAll(fd, contents.data(), contents.size()));
+  ASSERT_EQ(0,
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE));
+
+  // The mapped file is passed in a few large chunks, starting at the offset.
+  FileFetcher fetcher;
+  CollectingDelegate delegate;
+  fetcher.set_delegate(&delegate);
+  fetcher.SetOffset(10);
+  fetcher.SetLength(FileFetcher::kDefaultChunkSize + 20);
+  fetcher.BeginTransfer("file:///proc/self/fd/" + std::to_string(fd));
+  while (!delegate.completed_ && loop_.RunOnce(false)) {
+  }
+  EXPECT_TRUE(delegate.completed_);
+  EXPECT_TRUE(delegate.successful_);
+  EXPECT_EQ(2U, delegate.num_chunks_);
+  EXPECT_EQ(contents.substr(10, FileFetcher::kDefaultChunkSize + 20),
+            delegate.data_);
+  EXPECT_EQ(FileFetcher::kDefaultChunkSize + 20, fetcher.GetBytesDownloaded());
+}
+
+TEST_F(FileFetcherUnitTest, TruncatedFileTest) {
+  test_utils::ScopedTempFile file("FileFetcherUnitTest-file.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileString(
+      file.path(), string(2 * FileFetcher::kDefaultChunkSize, 'x')));
+
+  // A file which can be truncated is read instead of mapped, so truncating it
+  // only ends the transfer early instead of crashing it.
+  FileFetcher fetcher;
+  CollectingDelegate delegate;
+  fetcher.set_delegate(&delegate);
+  fetcher.BeginTransfer("file://" + file.path());
+  ASSERT_EQ(0, truncate(file.path().c_str(), FileFetcher::kDefaultChunkSize));
+  while (!delegate.completed_ && loop_.RunOnce(false)) {
+  }
+  EXPECT_TRUE(delegate.successful_);
+  EXPECT_EQ(string(FileFetcher::kDefaultChunkSize, 'x'), delegate.data_);
+}
+
+TEST_F(FileFetcherUnitTest, ChunkSizeTest) {
+  test_utils::ScopedTempFile file("FileFetcherUnitTest-file.XXXXXX");
+  const string contents(10000, 'x');
+  ASSERT_TRUE(test_utils::WriteFileString(file.path(), contents));
+
+  FileFetcher fetcher;
+  CollectingDelegate delegate;
+  fetcher.set_delegate(&delegate);
+  fetcher.set_chunk_size(4096);
+  fetcher.set_readahead_chunks(0);
+  fetcher.BeginTransfer("file://" + file.path());
+  while (!delegate.completed_ && loop_.RunOnce(false)) {
+  }
+  EXPECT_TRUE(delegate.successful_);
+  EXPECT_EQ(3U, delegate.num_chunks_);
+  EXPECT_EQ(contents, delegate.data_);
+}
+
 }  // namespace chromeos_update_engine
@@ -27,6 +27,17 @@
 
 namespace chromeos_update_engine {
 
+// The state of the device that tells whether it is in use, used to decide how
+// much of its resources the update can take.
+struct DeviceActivity {
+  // Whether a charger is connected.
+  bool on_ac_power{false};
+  bool screen_on{true};
+  // Whether the CPU or other components are being cooled down by limiting
+  // their performance.
+  bool thermal_throttled{false};
+};
+
 // The hardware interface allows access to the crossystem exposed properties,
 // such as the firmware version, hwid, verified boot mode.
 // These stateless functions are tied together in this interface to facilitate
@@ -103,6 +114,10 @@ class HardwareInterface {
   // Persist the fact that first active ping was sent to omaha. It bails out if
   // it fails.
   virtual void SetFirstActiveOmahaPingSent() = 0;
+
+  // Stores in |activity| the current power, screen and thermal state of the
+  // device. Returns false if it can't be determined.
+  virtual bool GetDeviceActivity(DeviceActivity* activity) const = 0;
 };
 
 }  // namespace chromeos_update_engine
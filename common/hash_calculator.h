@@ -44,6 +44,14 @@ class HashCalculator {
   // Returns true on success.
   bool Update(const void* data, size_t length);
 
+  // Updates each one of |calculators| with the same |length| bytes of |data|.
+  // The data is processed in chunks small enough to stay in the CPU cache
+  // while all the calculators go through them, instead of streaming all of
+  // |data| from memory once per calculator. Returns true on success.
+  static bool UpdateMultiple(const std::vector<HashCalculator*>& calculators,
+                             const void* data,
+                             size_t length);
+
   // Updates the hash with up to |length| bytes of data from |file|. If |length|
   // is negative, reads in and updates with the whole file. Returns the number
   // of bytes that the hash was updated with, or -1 on error.
@@ -67,6 +67,30 @@ TEST_F(HashCalculatorTest, MultiUpdateTest) {
   EXPECT_TRUE(raw_hash == calc.raw_hash());
 }
 
+TEST_F(HashCalculatorTest, UpdateMultipleTest) {
+  // Several chunks of data, the last one partial.
+  brillo::Blob data(100 * 1024);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = i * 7;
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(data, &expected_hash));
+
+  HashCalculator calc1, calc2;
+  // |calc2| already contains some data.
+  calc2.Update("hi", 2);
+  EXPECT_TRUE(
+      HashCalculator::UpdateMultiple({&calc1, &calc2}, data.data(), data.size()));
+  EXPECT_TRUE(calc1.Finalize());
+  EXPECT_TRUE(calc2.Finalize());
+  EXPECT_EQ(expected_hash, calc1.raw_hash());
+
+  HashCalculator calc3;
+  calc3.Update("hi", 2);
+  calc3.Update(data.data(), data.size());
+  calc3.Finalize();
+  EXPECT_EQ(calc3.raw_hash(), calc2.raw_hash());
+}
+
 TEST_F(HashCalculatorTest, ContextTest) {
   HashCalculator calc;
   calc.Update("h", 1);
@@ -0,0 +1,260 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/hot_path_log.h"
+
+#include <inttypes.h>
+
+#include <utility>
+
+#include <base/strings/stringprintf.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+// The signals the process crashes with, and their handlers before
+// HotPathLogger::InstallCrashHandler().
+const int kCrashSignals[] = {SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV};
+struct sigaction previous_crash_actions[arraysize(kCrashSignals)];
+}  // namespace
+
+const int HotPathLogger::kMaxMessagesPerSecond = 5;
+const size_t HotPathLogger::kMaxPendingMessages = 1024;
+
+HotPathLogSite::HotPathLogSite(const char* file, int line)
+    : file_(file), line_(line) {
+  HotPathLogger::Get()->AddSite(this);
+}
+
+bool HotPathLogSite::ShouldLog(bool verbose) {
+  if (verbose || HotPathLogger::Get()->full_verbosity())
+    return true;
+  base::TimeTicks now = base::TimeTicks::Now();
+  base::AutoLock auto_lock(lock_);
+  if (window_start_.is_null() ||
+      now - window_start_ >= base::TimeDelta::FromSeconds(1)) {
+    window_start_ = now;
+    window_messages_ = 0;
+  }
+  if (window_messages_ < HotPathLogger::kMaxMessagesPerSecond) {
+    window_messages_++;
+    return true;
+  }
+  suppressed_++;
+  flush_suppressed_++;
+  return false;
+}
+
+uint64_t HotPathLogSite::TakeSuppressed() {
+  base::AutoLock auto_lock(lock_);
+  return std::exchange(suppressed_, 0);
+}
+
+uint64_t HotPathLogSite::TakeFlushSuppressed() {
+  base::AutoLock auto_lock(lock_);
+  return std::exchange(flush_suppressed_, 0);
+}
+
+HotPathLogger::HotPathLogger() : ring_(kMaxPendingMessages) {}
+
+HotPathLogger* HotPathLogger::Get() {
+  static HotPathLogger* const logger = new HotPathLogger();
+  return logger;
+}
+
+void HotPathLogger::InstallCrashHandler() {
+  // The previous handlers would be this one if installed twice.
+  static bool installed = false;
+  if (installed)
+    return;
+  installed = true;
+  struct sigaction action = {};
+  action.sa_sigaction = &HotPathLogger::HandleCrashSignal;
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  for (size_t i = 0; i < arraysize(kCrashSignals); i++) {
+    if (sigaction(kCrashSignals[i], &action, &previous_crash_actions[i]) != 0)
+      PLOG(ERROR) << "Unable to handle the signal " << kCrashSignals[i];
+  }
+}
+
+void HotPathLogger::HandleCrashSignal(int sig,
+                                      siginfo_t* info,
+                                      void* context) {
+  Get()->WritePendingMessages(true);
+  for (size_t i = 0; i < arraysize(kCrashSignals); i++) {
+    if (kCrashSignals[i] == sig)
+      sigaction(sig, &previous_crash_actions[i], nullptr);
+  }
+  // A fault happens again once this returns, and is passed to the previous
+  // handler with its details. The signals sent by a process, such as the one
+  // of abort(), are sent again.
+  if (info->si_code <= 0)
+    raise(sig);
+}
+
+void HotPathLogger::SetFullVerbosity(bool full_verbosity) {
+  base::AutoLock auto_lock(lock_);
+  full_verbosity_ = full_verbosity;
+}
+
+bool HotPathLogger::full_verbosity() const {
+  base::AutoLock auto_lock(lock_);
+  return full_verbosity_;
+}
+
+void HotPathLogger::AddSite(HotPathLogSite* site) {
+  base::AutoLock auto_lock(lock_);
+  sites_.push_back(site);
+}
+
+void HotPathLogger::Log(HotPathLogSite* site,
+                        logging::LogSeverity severity,
+                        const string& message,
+                        bool synchronous) {
+  base::Time now = base::Time::Now();
+  bool error = severity >= logging::LOG_ERROR;
+  uint64_t suppressed = site->TakeSuppressed();
+  string full_message =
+      suppressed == 0
+          ? message
+          : message + base::StringPrintf(
+                          " (%" PRIu64 " similar messages suppressed)",
+                          suppressed);
+  {
+    base::AutoLock auto_lock(lock_);
+    if (!synchronous && !full_verbosity_ && !error) {
+      if (ring_size_ == ring_.size()) {
+        dropped_messages_++;
+        flush_dropped_messages_++;
+        return;
+      }
+      // The thread is started with the first message, so it isn't lost if
+      // the process forks to run as a daemon.
+      if (!thread_started_) {
+        thread_started_ = base::PlatformThread::CreateNonJoinable(0, this);
+        if (!thread_started_)
+          LOG(ERROR) << "Unable to start the hot path logging thread.";
+      }
+      if (thread_started_) {
+        ring_[(ring_head_ + ring_size_) % ring_.size()] = {
+            site->file(), site->line(), severity, std::move(full_message),
+            now};
+        ring_size_++;
+        pending_cond_.Signal();
+        return;
+      }
+    }
+  }
+  // The errors are written after the messages logged before them, and before
+  // a FATAL one aborts.
+  if (error)
+    WritePendingMessages(false);
+  logging::LogMessage(site->file(), site->line(), severity).stream()
+      << full_message;
+}
+
+void HotPathLogger::WriteMessage(const PendingMessage& pending) {
+  base::Time::Exploded logged;
+  pending.time.LocalExplode(&logged);
+  logging::LogMessage(pending.file, pending.line, pending.severity).stream()
+      << pending.message
+      << base::StringPrintf(" (queued at %02d%02d/%02d%02d%02d.%03d)",
+                            logged.month,
+                            logged.day_of_month,
+                            logged.hour,
+                            logged.minute,
+                            logged.second,
+                            logged.millisecond);
+}
+
+void HotPathLogger::WritePendingMessages(bool crashing) {
+  if (crashing) {
+    // The thread which crashed might hold the lock. The message taken by the
+    // background thread, if any, is lost.
+    if (!lock_.Try())
+      return;
+  } else {
+    lock_.Acquire();
+    while (writing_)
+      drained_cond_.Wait();
+  }
+  // The lock is held while writing, so the messages logged meanwhile are
+  // written after these ones.
+  for (; ring_size_ > 0; ring_size_--) {
+    WriteMessage(ring_[ring_head_]);
+    ring_head_ = (ring_head_ + 1) % ring_.size();
+  }
+  drained_cond_.Broadcast();
+  lock_.Release();
+}
+
+void HotPathLogger::Flush() {
+  string summary;
+  {
+    base::AutoLock auto_lock(lock_);
+    while (ring_size_ > 0 || writing_)
+      drained_cond_.Wait();
+    for (HotPathLogSite* site : sites_) {
+      uint64_t suppressed = site->TakeFlushSuppressed();
+      if (suppressed > 0) {
+        summary += base::StringPrintf("\n  %s:%d: %" PRIu64 " suppressed",
+                                      site->file(),
+                                      site->line(),
+                                      suppressed);
+      }
+    }
+    if (flush_dropped_messages_ > 0) {
+      summary += base::StringPrintf("\n  %" PRIu64 " dropped, queue full",
+                                    flush_dropped_messages_);
+      flush_dropped_messages_ = 0;
+    }
+  }
+  if (!summary.empty())
+    LOG(INFO) << "Hot path log messages not written:" << summary;
+}
+
+uint64_t HotPathLogger::dropped_messages() const {
+  base::AutoLock auto_lock(lock_);
+  return dropped_messages_;
+}
+
+void HotPathLogger::ThreadMain() {
+  base::PlatformThread::SetName("hot_path_log");
+  base::AutoLock auto_lock(lock_);
+  while (true) {
+    while (ring_size_ == 0)
+      pending_cond_.Wait();
+    PendingMessage pending = std::move(ring_[ring_head_]);
+    ring_head_ = (ring_head_ + 1) % ring_.size();
+    ring_size_--;
+    writing_ = true;
+    {
+      base::AutoUnlock auto_unlock(lock_);
+      WriteMessage(pending);
+    }
+    writing_ = false;
+    drained_cond_.Broadcast();
+  }
+}
+
+HotPathLogMessage::~HotPathLogMessage() {
+  HotPathLogger::Get()->Log(site_, severity_, stream_.str(), synchronous_);
+}
+
+}  // namespace chromeos_update_engine
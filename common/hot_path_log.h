@@ -0,0 +1,207 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_HOT_PATH_LOG_H_
+#define UPDATE_ENGINE_COMMON_HOT_PATH_LOG_H_
+
+#include <signal.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+
+// Logs a message from a hot path, such as the code run for each operation
+// of a payload or each transfer, where writing to the log sink synchronously
+// would slow down the work:
+//
+//   HOT_PATH_LOG(INFO) << "Applied operation " << operation_num;
+//
+// Each call site logs at most HotPathLogger::kMaxMessagesPerSecond messages
+// per second, the later ones are counted and reported with the next message
+// logged and in the summary of the next HotPathLogger::Flush(). The messages
+// are formatted on the calling thread but written to the log by a background
+// thread, with the time they were logged at. With the full verbosity, or a
+// --v level of 1 or more for the file, every message is logged synchronously.
+// The ERROR and FATAL messages are never suppressed, and are logged
+// synchronously once the queued messages are written.
+#define HOT_PATH_LOG(severity)                                                \
+  for (::chromeos_update_engine::HotPathLogSite* hot_path_log_site = []() {   \
+         static ::chromeos_update_engine::HotPathLogSite site(__FILE__,       \
+                                                              __LINE__);      \
+         return &site;                                                        \
+       }();                                                                   \
+       hot_path_log_site &&                                                   \
+       hot_path_log_site->ShouldLog(                                          \
+           VLOG_IS_ON(1) || logging::LOG_##severity >= logging::LOG_ERROR);   \
+       hot_path_log_site = nullptr)                                           \
+  ::chromeos_update_engine::HotPathLogMessage(                                \
+      hot_path_log_site, logging::LOG_##severity, VLOG_IS_ON(1))              \
+      .stream()
+
+namespace chromeos_update_engine {
+
+// A call site of HOT_PATH_LOG(), counting the messages it logged recently to
+// limit their rate.
+class HotPathLogSite {
+ public:
+  HotPathLogSite(const char* file, int line);
+
+  // Returns whether a message of this site can be logged now, always true if
+  // |verbose|. The messages that can't are counted as suppressed.
+  bool ShouldLog(bool verbose);
+
+  // Returns the number of messages suppressed since the last call, reported
+  // with the next message logged.
+  uint64_t TakeSuppressed();
+
+  // Returns the number of messages suppressed since the last call, reported
+  // in the summary of a flush.
+  uint64_t TakeFlushSuppressed();
+
+  const char* file() const { return file_; }
+  int line() const { return line_; }
+
+ private:
+  const char* const file_;
+  const int line_;
+
+  base::Lock lock_;
+  base::TimeTicks window_start_;
+  int window_messages_{0};
+  uint64_t suppressed_{0};
+  uint64_t flush_suppressed_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(HotPathLogSite);
+};
+
+// Writes the messages of the hot paths to the log on a background thread.
+// The messages waiting to be written are kept in a ring buffer; when it is
+// full, the new messages are dropped instead of blocking the caller.
+class HotPathLogger : public base::PlatformThread::Delegate {
+ public:
+  // The number of messages logged by a call site per second.
+  static const int kMaxMessagesPerSecond;
+
+  // The number of messages waiting to be written.
+  static const size_t kMaxPendingMessages;
+
+  // Returns the logger of the process, which is never destroyed.
+  static HotPathLogger* Get();
+
+  // Installs the handler of the signals the process crashes with, which
+  // writes the queued messages before running the previous handler.
+  static void InstallCrashHandler();
+
+  // Whether every message is logged synchronously and without a rate limit,
+  // to debug the hot paths.
+  void SetFullVerbosity(bool full_verbosity);
+  bool full_verbosity() const;
+
+  // Adds a call site, reported in the summary of Flush().
+  void AddSite(HotPathLogSite* site);
+
+  // Logs |message| from |site|, synchronously if |synchronous|, with the full
+  // verbosity or for an ERROR or FATAL |severity|.
+  void Log(HotPathLogSite* site,
+           logging::LogSeverity severity,
+           const std::string& message,
+           bool synchronous);
+
+  // Waits until the messages queued are written, then logs a summary of the
+  // messages suppressed and dropped since the previous flush.
+  void Flush();
+
+  // The number of messages dropped because the ring buffer was full.
+  uint64_t dropped_messages() const;
+
+  // Overrides base::PlatformThread::Delegate.
+  void ThreadMain() override;
+
+ private:
+  struct PendingMessage {
+    const char* file;
+    int line;
+    logging::LogSeverity severity;
+    std::string message;
+    // When the message was logged, not when it is written.
+    base::Time time;
+  };
+
+  HotPathLogger();
+  ~HotPathLogger() override = default;
+
+  // Writes |pending| to the log, with the time it was logged at.
+  static void WriteMessage(const PendingMessage& pending);
+
+  // Writes the queued messages on the calling thread, after the one the
+  // background thread is writing, if any. When |crashing|, nothing is waited
+  // for, and nothing is written if another thread holds the lock.
+  void WritePendingMessages(bool crashing);
+
+  static void HandleCrashSignal(int sig, siginfo_t* info, void* context);
+
+  mutable base::Lock lock_;
+  // Signaled when a message is queued.
+  base::ConditionVariable pending_cond_{&lock_};
+  // Signaled when a message taken from the ring is written, and when the ring
+  // is emptied by WritePendingMessages().
+  base::ConditionVariable drained_cond_{&lock_};
+
+  bool full_verbosity_{false};
+  bool thread_started_{false};
+  // Whether the background thread is writing a message taken from the ring.
+  bool writing_{false};
+  std::vector<PendingMessage> ring_;
+  size_t ring_head_{0};
+  size_t ring_size_{0};
+  uint64_t dropped_messages_{0};
+  uint64_t flush_dropped_messages_{0};
+  std::vector<HotPathLogSite*> sites_;
+
+  DISALLOW_COPY_AND_ASSIGN(HotPathLogger);
+};
+
+// The stream of a HOT_PATH_LOG() message, passed to the HotPathLogger when
+// destroyed.
+class HotPathLogMessage {
+ public:
+  HotPathLogMessage(HotPathLogSite* site,
+                    logging::LogSeverity severity,
+                    bool synchronous)
+      : site_(site), severity_(severity), synchronous_(synchronous) {}
+  ~HotPathLogMessage();
+
+  std::ostream& stream() { return stream_; }
+
+ private:
+  HotPathLogSite* site_;
+  logging::LogSeverity severity_;
+  bool synchronous_;
+  std::ostringstream stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(HotPathLogMessage);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_HOT_PATH_LOG_H_
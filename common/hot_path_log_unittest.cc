@@ -0,0 +1,155 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/hot_path_log.h"
+
+#include <signal.h>
+
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <base/synchronization/lock.h>
+#include <gtest/gtest.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+// The messages logged while a test runs, written from the logging thread.
+base::Lock messages_lock;
+vector<string>* messages = nullptr;
+
+bool RecordMessage(int severity,
+                   const char* file,
+                   int line,
+                   size_t message_start,
+                   const string& str) {
+  base::AutoLock auto_lock(messages_lock);
+  if (messages)
+    messages->push_back(str.substr(message_start));
+  return true;
+}
+}  // namespace
+
+class HotPathLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    HotPathLogger::Get()->Flush();
+    base::AutoLock auto_lock(messages_lock);
+    messages = &messages_;
+    logging::SetLogMessageHandler(&RecordMessage);
+  }
+
+  void TearDown() override {
+    HotPathLogger::Get()->SetFullVerbosity(false);
+    HotPathLogger::Get()->Flush();
+    logging::SetLogMessageHandler(nullptr);
+    base::AutoLock auto_lock(messages_lock);
+    messages = nullptr;
+  }
+
+  // Returns the number of messages recorded that start with |prefix|.
+  size_t CountMessages(const string& prefix) {
+    base::AutoLock auto_lock(messages_lock);
+    size_t count = 0;
+    for (const string& message : messages_)
+      count += message.compare(0, prefix.size(), prefix) == 0;
+    return count;
+  }
+
+  vector<string> messages_;
+};
+
+TEST_F(HotPathLogTest, RateLimitTest) {
+  for (int i = 0; i < 20; i++)
+    HOT_PATH_LOG(INFO) << "rate limited " << i;
+  HotPathLogger::Get()->Flush();
+  // Only the first messages of the second are logged, followed by the
+  // summary of the suppressed ones.
+  EXPECT_EQ(static_cast<size_t>(HotPathLogger::kMaxMessagesPerSecond),
+            CountMessages("rate limited "));
+  EXPECT_EQ(1U, CountMessages("Hot path log messages not written:"));
+
+  // The summary is only logged once.
+  HotPathLogger::Get()->Flush();
+  EXPECT_EQ(1U, CountMessages("Hot path log messages not written:"));
+}
+
+TEST_F(HotPathLogTest, FullVerbosityTest) {
+  HotPathLogger::Get()->SetFullVerbosity(true);
+  for (int i = 0; i < 20; i++)
+    HOT_PATH_LOG(WARNING) << "verbose " << i;
+  // The messages are logged synchronously.
+  EXPECT_EQ(20U, CountMessages("verbose "));
+  HotPathLogger::Get()->Flush();
+  EXPECT_EQ(0U, CountMessages("Hot path log messages not written:"));
+}
+
+TEST_F(HotPathLogTest, QueuedTimeTest) {
+  HOT_PATH_LOG(INFO) << "queued message";
+  HotPathLogger::Get()->Flush();
+  // The message written by the background thread has the time it was logged.
+  base::AutoLock auto_lock(messages_lock);
+  ASSERT_EQ(1U, messages_.size());
+  EXPECT_NE(string::npos, messages_[0].find("queued message (queued at "));
+}
+
+TEST_F(HotPathLogTest, ErrorWritesQueuedMessagesTest) {
+  for (int i = 0; i < 3; i++)
+    HOT_PATH_LOG(INFO) << "before error " << i;
+  for (int i = 0; i < 10; i++)
+    HOT_PATH_LOG(ERROR) << "error " << i;
+  // The errors are written synchronously, after the messages queued before
+  // them, and never suppressed.
+  EXPECT_EQ(10U, CountMessages("error "));
+  base::AutoLock auto_lock(messages_lock);
+  ASSERT_EQ(13U, messages_.size());
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(0U, messages_[i].find("before error "));
+}
+
+TEST_F(HotPathLogTest, CrashHandlerTest) {
+  // The background thread is started here, so it doesn't run in the child
+  // process of the death test, where only the crash handler writes the
+  // message.
+  HOT_PATH_LOG(INFO) << "started";
+  HotPathLogger::Get()->Flush();
+  EXPECT_DEATH(
+      {
+        logging::SetLogMessageHandler(nullptr);
+        HotPathLogger::InstallCrashHandler();
+        HOT_PATH_LOG(INFO) << "logged before the crash";
+        raise(SIGSEGV);
+      },
+      "logged before the crash");
+}
+
+TEST_F(HotPathLogTest, ElseTest) {
+  // The macro doesn't take the else of an enclosing if.
+  bool logged = false;
+  if (logged)
+    HOT_PATH_LOG(INFO) << "not logged";
+  else
+    logged = true;
+  EXPECT_TRUE(logged);
+  HotPathLogger::Get()->Flush();
+  EXPECT_EQ(0U, CountMessages("not logged"));
+}
+
+}  // namespace chromeos_update_engine
@@ -18,15 +18,20 @@
 #define UPDATE_ENGINE_COMMON_HTTP_FETCHER_H_
 
 #include <deque>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <base/callback.h>
 #include <base/logging.h>
 #include <base/macros.h>
 #include <brillo/message_loops/message_loop.h>
+#include <brillo/secure_blob.h>
 
+#include "update_engine/common/bandwidth_limiter.h"
 #include "update_engine/common/http_common.h"
+#include "update_engine/common/throughput_estimator.h"
 #include "update_engine/proxy_resolver.h"
 
 // This class is a simple wrapper around an HTTP library (libcurl). We can
@@ -85,6 +90,17 @@ class HttpFetcher {
   virtual void SetLength(size_t length) = 0;
   virtual void UnsetLength() = 0;
 
+  // Requests all the |ranges|, given as offset and length, in the next
+  // transfer instead of the one set by SetOffset() and SetLength(). The server
+  // answers with a "multipart/byteranges" body, or with a single range if it
+  // merged them, and the delegate receives the body as is. An empty |ranges|
+  // goes back to a single range. Returns false if the fetcher doesn't support
+  // it.
+  virtual bool SetMultipleRanges(
+      const std::vector<std::pair<off_t, size_t>>& ranges) {
+    return false;
+  }
+
   // Begins the transfer to the specified URL. This fetcher instance should not
   // be destroyed until either TransferComplete, or TransferTerminated is
   // called.
@@ -100,6 +116,17 @@ class HttpFetcher {
   virtual void SetHeader(const std::string& header_name,
                          const std::string& header_value) = 0;
 
+  // Returns the value of the header |header_name| of the last response
+  // received, or the empty string if it had no such header.
+  virtual std::string GetResponseHeader(const std::string& header_name) const {
+    return "";
+  }
+
+  // Whether to accept a compressed response, advertising the content codings
+  // supported with the Accept-Encoding header. The delegate receives the
+  // decompressed body as it arrives.
+  virtual void set_accept_encoding(bool accept_encoding) {}
+
   // If data is coming in too quickly, you can call Pause() to pause the
   // transfer. The delegate will not have ReceivedBytes() called while
   // an HttpFetcher is paused.
@@ -127,6 +154,20 @@ class HttpFetcher {
   // Sets the number of allowed retries.
   virtual void set_max_retry_count(int max_retry_count) = 0;
 
+  // Caps the rate of the bytes received to the one of |limiter|, which may be
+  // shared with other fetchers. Only the fetchers reading from the network
+  // honor it. Doesn't take ownership of |limiter|.
+  virtual void set_bandwidth_limiter(BandwidthLimiter* limiter) {
+    bandwidth_limiter_ = limiter;
+  }
+
+  // Feeds the bytes received to |estimator|, which may be shared with other
+  // fetchers, and tunes the timeouts from its estimates unless they were set
+  // explicitly. Doesn't take ownership of |estimator|.
+  virtual void set_throughput_estimator(ThroughputEstimator* estimator) {
+    throughput_estimator_ = estimator;
+  }
+
   // Get the total number of bytes downloaded by fetcher.
   virtual size_t GetBytesDownloaded() = 0;
 
@@ -154,6 +195,12 @@ class HttpFetcher {
   // The delegate; may be null.
   HttpFetcherDelegate* delegate_;
 
+  // The limiter of the receive rate; may be null.
+  BandwidthLimiter* bandwidth_limiter_{nullptr};
+
+  // The estimator of the throughput and round trip time; may be null.
+  ThroughputEstimator* throughput_estimator_{nullptr};
+
   // Proxy servers
   std::deque<std::string> proxies_;
 
@@ -191,6 +238,14 @@ class HttpFetcherDelegate {
                              const void* bytes,
                              size_t length) = 0;
 
+  // Like ReceivedBytes(), but for bytes the fetcher already holds in a
+  // |chunk| it won't modify anymore. The delegate may keep a reference to it
+  // instead of copying the bytes it needs later.
+  virtual void ReceivedChunk(HttpFetcher* fetcher,
+                             const std::shared_ptr<const brillo::Blob>& chunk) {
+    ReceivedBytes(fetcher, chunk->data(), chunk->size());
+  }
+
   // Called if the fetcher seeks to a particular offset.
   virtual void SeekToOffset(off_t offset) {}
 
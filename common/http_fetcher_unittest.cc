@@ -1215,6 +1215,130 @@ TYPED_TEST(HttpFetcherTest, MultiHttpFetcherInsufficientTest) {
   }
 }
 
+TYPED_TEST(HttpFetcherTest, MultiHttpFetcherParallelTest) {
+  if (!this->test_.IsMulti())
+    return;
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  vector<pair<off_t, off_t>> ranges;
+  ranges.push_back(make_pair(0, 25));
+  ranges.push_back(make_pair(99, 1000));
+  // The ranges are downloaded in small chunks over three connections, and
+  // still received in order.
+  HttpFetcher* fetcher = this->test_.NewLargeFetcher();
+  MultiRangeHttpFetcher* multi_fetcher =
+      static_cast<MultiRangeHttpFetcher*>(fetcher);
+  for (int i = 0; i < 2; i++) {
+    multi_fetcher->AddParallelFetcher(new LibcurlHttpFetcher(
+        fetcher->proxy_resolver(), this->test_.fake_hardware()));
+  }
+  multi_fetcher->set_parallel_chunk_size(10);
+  multi_fetcher->set_idle_seconds(1);
+  multi_fetcher->set_retry_seconds(1);
+  MultiTest(fetcher,
+            this->test_.fake_hardware(),
+            this->test_.BigUrl(server->GetPort()),
+            ranges,
+            "abcdefghijabcdefghijabcdejabcdefghijabcdef",
+            1025,
+            kHttpResponsePartialContent);
+}
+
+TYPED_TEST(HttpFetcherTest, MultiHttpFetcherParallelMirrorTest) {
+  if (!this->test_.IsMulti())
+    return;
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  vector<pair<off_t, off_t>> ranges;
+  ranges.push_back(make_pair(0, 25));
+  ranges.push_back(make_pair(99, 1000));
+  // The chunks of the broken mirror are downloaded from the URL of the
+  // transfer and the working mirror instead.
+  HttpFetcher* fetcher = this->test_.NewLargeFetcher();
+  MultiRangeHttpFetcher* multi_fetcher =
+      static_cast<MultiRangeHttpFetcher*>(fetcher);
+  multi_fetcher->AddParallelFetcher(
+      new LibcurlHttpFetcher(fetcher->proxy_resolver(),
+                             this->test_.fake_hardware()),
+      this->test_.ErrorUrl(server->GetPort()));
+  multi_fetcher->AddParallelFetcher(
+      new LibcurlHttpFetcher(fetcher->proxy_resolver(),
+                             this->test_.fake_hardware()),
+      this->test_.BigUrl(server->GetPort()));
+  multi_fetcher->set_parallel_chunk_size(10);
+  multi_fetcher->set_idle_seconds(1);
+  multi_fetcher->set_retry_seconds(1);
+  MultiTest(fetcher,
+            this->test_.fake_hardware(),
+            this->test_.BigUrl(server->GetPort()),
+            ranges,
+            "abcdefghijabcdefghijabcdejabcdefghijabcdef",
+            1025,
+            kHttpResponsePartialContent);
+}
+
+TYPED_TEST(HttpFetcherTest, MultiHttpFetcherBatchFallbackTest) {
+  if (!this->test_.IsMulti())
+    return;
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  vector<pair<off_t, off_t>> ranges;
+  ranges.push_back(make_pair(0, 25));
+  ranges.push_back(make_pair(99, 1000));
+  // The test server only answers with the first of the ranges requested at
+  // once, so the second one is requested on its own.
+  HttpFetcher* fetcher = this->test_.NewLargeFetcher();
+  MultiRangeHttpFetcher* multi_fetcher =
+      static_cast<MultiRangeHttpFetcher*>(fetcher);
+  multi_fetcher->set_batch_ranges(true);
+  MultiTest(fetcher,
+            this->test_.fake_hardware(),
+            this->test_.BigUrl(server->GetPort()),
+            ranges,
+            "abcdefghijabcdefghijabcdejabcdefghijabcdef",
+            1025,
+            kHttpResponsePartialContent);
+}
+
+TYPED_TEST(HttpFetcherTest, MultiHttpFetcherParallelInsufficientTest) {
+  if (!this->test_.IsMulti())
+    return;
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  MultiHttpFetcherTestDelegate delegate(kHttpResponseUndefined);
+  HttpFetcher* fetcher = this->test_.NewLargeFetcher();
+  delegate.fetcher_.reset(fetcher);
+  MultiRangeHttpFetcher* multi_fetcher =
+      static_cast<MultiRangeHttpFetcher*>(fetcher);
+  multi_fetcher->AddParallelFetcher(new LibcurlHttpFetcher(
+      fetcher->proxy_resolver(), this->test_.fake_hardware()));
+  multi_fetcher->set_idle_seconds(1);
+  multi_fetcher->set_retry_seconds(1);
+  multi_fetcher->ClearRanges();
+  multi_fetcher->AddRange(0, 5);
+  multi_fetcher->AddRange(kBigLength - 2, 4);
+  multi_fetcher->set_delegate(&delegate);
+
+  MessageLoop::current()->PostTask(
+      FROM_HERE,
+      base::Bind(StartTransfer,
+                 multi_fetcher,
+                 this->test_.BigUrl(server->GetPort())));
+  MessageLoop::current()->Run();
+  // The second range is truncated, which fails the whole transfer once
+  // detected. The data passed until then is still in order.
+  EXPECT_TRUE(base::StartsWith(
+      "abcdeij", delegate.data, base::CompareCase::SENSITIVE));
+}
+
 // Issue #18143: when a fetch of a secondary chunk out of a chain, then it
 // should retry with other proxies listed before giving up.
 //
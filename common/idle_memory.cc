@@ -0,0 +1,73 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/idle_memory.h"
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+
+#include "update_engine/common/blob_pool.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+const char kStatmPath[] = "/proc/self/statm";
+}  // namespace
+
+int64_t GetResidentMemory() {
+  string statm;
+  if (!base::ReadFileToString(base::FilePath(kStatmPath), &statm))
+    return -1;
+  // The second field is the resident memory, in pages.
+  std::vector<string> fields = base::SplitString(
+      statm, " ", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  int64_t pages;
+  if (fields.size() < 2 || !base::StringToInt64(fields[1], &pages))
+    return -1;
+  return pages * getpagesize();
+}
+
+bool ReleaseIdleMemory(int64_t* resident_before, int64_t* resident_after) {
+  *resident_before = GetResidentMemory();
+  BlobPool::Get()->Clear();
+#if defined(__GLIBC__)
+  malloc_trim(0);
+#elif defined(M_PURGE)
+  mallopt(M_PURGE, 0);
+#endif
+  *resident_after = GetResidentMemory();
+  if (*resident_before < 0 || *resident_after < 0) {
+    LOG(WARNING) << "Unable to read the resident memory from " << kStatmPath;
+    return false;
+  }
+  LOG(INFO) << "Released " << (*resident_before - *resident_after)
+            << " bytes of idle memory, " << *resident_after
+            << " bytes resident.";
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,38 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_IDLE_MEMORY_H_
+#define UPDATE_ENGINE_COMMON_IDLE_MEMORY_H_
+
+#include <stdint.h>
+
+namespace chromeos_update_engine {
+
+// Returns the resident memory of this process in bytes, read from
+// /proc/self/statm, or -1 if it can't be read.
+int64_t GetResidentMemory();
+
+// Releases the memory kept after an update attempt finished: the idle
+// buffers of the process BlobPool and the free memory of the allocator
+// arenas, returned to the system. It must be called once the actions of the
+// attempt are destroyed. Sets |resident_before| and |resident_after| to the
+// resident memory before and after releasing it, and returns whether they
+// could be read.
+bool ReleaseIdleMemory(int64_t* resident_before, int64_t* resident_after);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_IDLE_MEMORY_H_
@@ -0,0 +1,41 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/idle_memory.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/blob_pool.h"
+
+namespace chromeos_update_engine {
+
+class IdleMemoryTest : public ::testing::Test {};
+
+TEST_F(IdleMemoryTest, ReleaseIdleMemoryTest) {
+  EXPECT_LT(0, GetResidentMemory());
+
+  BlobPool::Get()->Put(brillo::Blob(BlobPool::kMinClassSize));
+  int64_t resident_before, resident_after;
+  EXPECT_TRUE(ReleaseIdleMemory(&resident_before, &resident_after));
+  EXPECT_LT(0, resident_before);
+  EXPECT_LT(0, resident_after);
+  // The idle buffer was freed.
+  uint64_t hits = BlobPool::Get()->hits();
+  BlobPool::Get()->Take(BlobPool::kMinClassSize);
+  EXPECT_EQ(hits, BlobPool::Get()->hits());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,152 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/io_limiter.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+namespace {
+
+// The ioprio_set(2) arguments, from the kernel's include/linux/ioprio.h which
+// isn't available to userspace everywhere.
+const int kIoprioWhoProcess = 1;
+const int kIoprioClassShift = 13;
+const int kIoprioClassBestEffort = 2;
+const int kIoprioNormalLevel = 4;
+const int kIoprioLowLevel = 7;
+
+const uint64_t kMiB = 1024 * 1024;
+
+}  // namespace
+
+namespace chromeos_update_engine {
+
+const base::TimeDelta IOLimiter::kTargetReadLatency =
+    base::TimeDelta::FromMilliseconds(50);
+const uint64_t IOLimiter::kInitialReadRate = 32 * kMiB;
+const uint64_t IOLimiter::kMinReadRate = 4 * kMiB;
+const uint64_t IOLimiter::kMaxReadRate = 2048 * kMiB;
+const uint64_t IOLimiter::kReadRateStep = 4 * kMiB;
+
+bool SetIoPriority(base::PlatformThreadId thread, IoPriority priority) {
+  const int level =
+      priority == IoPriority::kLow ? kIoprioLowLevel : kIoprioNormalLevel;
+  if (syscall(SYS_ioprio_set,
+              kIoprioWhoProcess,
+              thread,
+              kIoprioClassBestEffort << kIoprioClassShift | level) < 0) {
+    PLOG(ERROR) << "Failed to set the I/O priority of thread " << thread
+                << " to level " << level;
+    return false;
+  }
+  return true;
+}
+
+void IOLimiter::SetPerformanceMode(bool enable) {
+  base::AutoLock auto_lock(lock_);
+  if (performance_mode_ == enable)
+    return;
+  LOG(INFO) << (enable ? "Disabling" : "Enabling") << " the I/O limiter.";
+  performance_mode_ = enable;
+  for (base::PlatformThreadId thread : threads_)
+    ApplyToThread(thread);
+  // The reads done at full speed don't count against the paced rate.
+  next_read_time_ = clock_->GetMonotonicTime();
+}
+
+bool IOLimiter::performance_mode() const {
+  base::AutoLock auto_lock(lock_);
+  return performance_mode_;
+}
+
+void IOLimiter::SetCoreTopology(const CoreTopology& topology) {
+  base::AutoLock auto_lock(lock_);
+  if (topology.IsHeterogeneous()) {
+    LOG(INFO) << "Placing the update threads on the "
+              << topology.efficiency_cores.size() << " efficiency cores or the "
+              << topology.performance_cores.size() << " performance cores.";
+  }
+  core_topology_ = topology;
+  for (base::PlatformThreadId thread : threads_)
+    ApplyToThread(thread);
+}
+
+void IOLimiter::RegisterCurrentThread() {
+  base::AutoLock auto_lock(lock_);
+  base::PlatformThreadId thread = base::PlatformThread::CurrentId();
+  threads_.insert(thread);
+  ApplyToThread(thread);
+}
+
+void IOLimiter::ApplyToThread(base::PlatformThreadId thread) const {
+  SetIoPriority(thread,
+                performance_mode_ ? IoPriority::kNormal : IoPriority::kLow);
+  SetCorePlacement(thread,
+                   core_topology_,
+                   performance_mode_ ? CorePlacement::kPerformance
+                                     : CorePlacement::kEfficiency);
+}
+
+void IOLimiter::UnregisterCurrentThread() {
+  base::AutoLock auto_lock(lock_);
+  threads_.erase(base::PlatformThread::CurrentId());
+}
+
+base::TimeDelta IOLimiter::GetReadDelay() const {
+  base::AutoLock auto_lock(lock_);
+  if (performance_mode_)
+    return base::TimeDelta();
+  return std::max(next_read_time_ - clock_->GetMonotonicTime(),
+                  base::TimeDelta());
+}
+
+base::Time IOLimiter::StartRead(size_t bytes) {
+  base::AutoLock auto_lock(lock_);
+  base::Time now = clock_->GetMonotonicTime();
+  if (!performance_mode_) {
+    next_read_time_ =
+        std::max(next_read_time_, now) +
+        base::TimeDelta::FromMicroseconds(
+            bytes * base::Time::kMicrosecondsPerSecond / read_rate_);
+  }
+  return now;
+}
+
+void IOLimiter::FinishRead(base::Time start) {
+  base::AutoLock auto_lock(lock_);
+  if (performance_mode_)
+    return;
+  if (clock_->GetMonotonicTime() - start <= kTargetReadLatency) {
+    read_rate_ = std::min(read_rate_ + kReadRateStep, kMaxReadRate);
+  } else if (start >= last_rate_decrease_) {
+    read_rate_ = std::max(read_rate_ / 2, kMinReadRate);
+    last_rate_decrease_ = clock_->GetMonotonicTime();
+    LOG(INFO) << "Reads slowed down by other I/O, pacing them at "
+              << read_rate_ / kMiB << " MiB/s.";
+  }
+}
+
+uint64_t IOLimiter::read_rate() const {
+  base::AutoLock auto_lock(lock_);
+  return read_rate_;
+}
+
+}  // namespace chromeos_update_engine
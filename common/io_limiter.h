@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_IO_LIMITER_H_
+#define UPDATE_ENGINE_COMMON_IO_LIMITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <set>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+
+#include "update_engine/common/clock.h"
+#include "update_engine/common/clock_interface.h"
+#include "update_engine/common/cpu_limiter.h"
+
+namespace chromeos_update_engine {
+
+// The I/O scheduling priorities the update threads run with.
+enum class IoPriority {
+  // The default best-effort priority of a process.
+  kNormal,
+  // The lowest best-effort priority. The idle class isn't used since it may
+  // starve the update forever on a busy device.
+  kLow,
+};
+
+// Sets the I/O priority of the thread |thread| to |priority|. Returns true on
+// success, false otherwise.
+bool SetIoPriority(base::PlatformThreadId thread, IoPriority priority);
+
+// Keeps the I/O of the update from competing with the foreground I/O of the
+// device while it is in use. In the background mode, the default, the
+// registered threads get the low I/O priority and the reads done to verify the
+// update are paced at a rate adapted to their latency: reads slower than
+// |kTargetReadLatency| mean other I/O is competing for the disk, so the rate is
+// halved, and it grows again while they are fast. In the performance mode the
+// threads get the normal priority and the reads aren't paced. On the SoCs with
+// cores of different types, set with SetCoreTopology(), the registered threads
+// also run on the efficiency cores in the background mode and on the big and
+// prime cores in the performance mode. All the methods are thread safe.
+class IOLimiter {
+ public:
+  // The read latency over which the reads are considered to be slowed down by
+  // other I/O, and the bounds of the paced read rate, in bytes per second.
+  static const base::TimeDelta kTargetReadLatency;
+  static const uint64_t kInitialReadRate;
+  static const uint64_t kMinReadRate;
+  static const uint64_t kMaxReadRate;
+  // The read rate grows by this for every read faster than the target.
+  static const uint64_t kReadRateStep;
+
+  IOLimiter() : clock_(&default_clock_) {}
+  // Used for testing. The |clock| must outlive the limiter.
+  explicit IOLimiter(ClockInterface* clock) : clock_(clock) {}
+
+  // Switches between the performance and the background modes, updating the
+  // priority of all the registered threads.
+  void SetPerformanceMode(bool enable);
+  bool performance_mode() const;
+
+  // Places the registered threads on the cores of |topology| for the mode.
+  void SetCoreTopology(const CoreTopology& topology);
+
+  // Adds the calling thread to the ones whose I/O priority follows the mode,
+  // setting its priority right away, and removes it.
+  void RegisterCurrentThread();
+  void UnregisterCurrentThread();
+
+  // Returns how long to wait before the next read to stay within the current
+  // read rate, or zero if it can start now.
+  base::TimeDelta GetReadDelay() const;
+
+  // Accounts a read of |bytes| starting now against the read rate. Returns the
+  // start time of the read, to pass to FinishRead() once it completes.
+  base::Time StartRead(size_t bytes);
+
+  // Adapts the read rate to the latency of a read started at |start|.
+  void FinishRead(base::Time start);
+
+  uint64_t read_rate() const;
+
+ private:
+  // Sets the I/O priority and the cores of |thread| for the current mode.
+  void ApplyToThread(base::PlatformThreadId thread) const;
+
+  Clock default_clock_;
+  ClockInterface* clock_;
+
+  mutable base::Lock lock_;
+  bool performance_mode_{false};
+  std::set<base::PlatformThreadId> threads_;
+  CoreTopology core_topology_;
+
+  // The current read rate, the time from which the next read can start, and
+  // the time the rate was last halved. Only the reads started after the rate
+  // was halved can halve it again, so a burst of slow reads halves it once.
+  uint64_t read_rate_{kInitialReadRate};
+  base::Time next_read_time_;
+  base::Time last_rate_decrease_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOLimiter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_IO_LIMITER_H_
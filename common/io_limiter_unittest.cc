@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/io_limiter.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_clock.h"
+
+namespace chromeos_update_engine {
+
+class IOLimiterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    clock_.SetMonotonicTime(base::Time::FromInternalValue(1000000));
+  }
+
+  void Advance(base::TimeDelta delta) {
+    clock_.SetMonotonicTime(clock_.GetMonotonicTime() + delta);
+  }
+
+  // Starts a read of |bytes| which completes after |latency|.
+  void Read(size_t bytes, base::TimeDelta latency) {
+    base::Time start = limiter_.StartRead(bytes);
+    Advance(latency);
+    limiter_.FinishRead(start);
+  }
+
+  FakeClock clock_;
+  IOLimiter limiter_{&clock_};
+};
+
+TEST_F(IOLimiterTest, PacingTest) {
+  EXPECT_FALSE(limiter_.performance_mode());
+  EXPECT_EQ(base::TimeDelta(), limiter_.GetReadDelay());
+  // A read of a second worth of data at the initial rate delays the next one
+  // by a second.
+  limiter_.StartRead(IOLimiter::kInitialReadRate);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(1), limiter_.GetReadDelay());
+  Advance(base::TimeDelta::FromMilliseconds(600));
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(400), limiter_.GetReadDelay());
+  Advance(base::TimeDelta::FromSeconds(1));
+  EXPECT_EQ(base::TimeDelta(), limiter_.GetReadDelay());
+}
+
+TEST_F(IOLimiterTest, AdaptRateTest) {
+  const base::TimeDelta kFast = IOLimiter::kTargetReadLatency / 2;
+  const base::TimeDelta kSlow = IOLimiter::kTargetReadLatency * 2;
+  Read(4096, kFast);
+  EXPECT_EQ(IOLimiter::kInitialReadRate + IOLimiter::kReadRateStep,
+            limiter_.read_rate());
+
+  // A burst of concurrent slow reads halves the rate only once.
+  base::Time start1 = limiter_.StartRead(4096);
+  base::Time start2 = limiter_.StartRead(4096);
+  Advance(kSlow);
+  limiter_.FinishRead(start1);
+  limiter_.FinishRead(start2);
+  const uint64_t halved_rate =
+      (IOLimiter::kInitialReadRate + IOLimiter::kReadRateStep) / 2;
+  EXPECT_EQ(halved_rate, limiter_.read_rate());
+  Read(4096, kSlow);
+  EXPECT_EQ(halved_rate / 2, limiter_.read_rate());
+
+  // The rate stays within the bounds.
+  for (int i = 0; i < 10; i++)
+    Read(4096, kSlow);
+  EXPECT_EQ(IOLimiter::kMinReadRate, limiter_.read_rate());
+  for (int i = 0; i < 1000; i++)
+    Read(4096, kFast);
+  EXPECT_EQ(IOLimiter::kMaxReadRate, limiter_.read_rate());
+}
+
+TEST_F(IOLimiterTest, PerformanceModeTest) {
+  limiter_.SetPerformanceMode(true);
+  EXPECT_TRUE(limiter_.performance_mode());
+  // The reads aren't paced and don't change the rate.
+  Read(IOLimiter::kInitialReadRate, IOLimiter::kTargetReadLatency * 2);
+  EXPECT_EQ(base::TimeDelta(), limiter_.GetReadDelay());
+  EXPECT_EQ(IOLimiter::kInitialReadRate, limiter_.read_rate());
+
+  // Going back to the background mode doesn't count the earlier reads.
+  limiter_.SetPerformanceMode(false);
+  EXPECT_EQ(base::TimeDelta(), limiter_.GetReadDelay());
+  limiter_.StartRead(IOLimiter::kInitialReadRate);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(1), limiter_.GetReadDelay());
+}
+
+}  // namespace chromeos_update_engine
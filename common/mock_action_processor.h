@@ -27,6 +27,7 @@ class MockActionProcessor : public ActionProcessor {
  public:
   MOCK_METHOD0(StartProcessing, void());
   MOCK_METHOD1(EnqueueAction, void(AbstractAction* action));
+  MOCK_METHOD1(EnqueueConcurrentAction, void(AbstractAction* action));
 };
 
 }  // namespace chromeos_update_engine
@@ -69,6 +69,9 @@ class MockHardware : public HardwareInterface {
     ON_CALL(*this, SetFirstActiveOmahaPingSent())
       .WillByDefault(testing::Invoke(&fake_,
             &FakeHardware::SetFirstActiveOmahaPingSent()));
+    ON_CALL(*this, GetDeviceActivity(testing::_))
+      .WillByDefault(testing::Invoke(&fake_,
+            &FakeHardware::GetDeviceActivity));
   }
 
   ~MockHardware() override = default;
@@ -85,6 +88,7 @@ class MockHardware : public HardwareInterface {
   MOCK_CONST_METHOD1(GetNonVolatileDirectory, bool(base::FilePath*));
   MOCK_CONST_METHOD1(GetPowerwashSafeDirectory, bool(base::FilePath*));
   MOCK_CONST_METHOD0(GetFirstActiveOmahaPingSent, bool());
+  MOCK_CONST_METHOD1(GetDeviceActivity, bool(DeviceActivity*));
 
   // Returns a reference to the underlying FakeHardware.
   FakeHardware& fake() {
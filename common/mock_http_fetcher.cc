@@ -130,6 +130,19 @@ std::string MockHttpFetcher::GetHeader(const std::string& header_name) const {
   return it->second;
 }
 
+void MockHttpFetcher::SetResponseHeader(const std::string& header_name,
+                                        const std::string& header_value) {
+  response_headers_[base::ToLowerASCII(header_name)] = header_value;
+}
+
+std::string MockHttpFetcher::GetResponseHeader(
+    const std::string& header_name) const {
+  const auto it = response_headers_.find(base::ToLowerASCII(header_name));
+  if (it == response_headers_.end())
+    return "";
+  return it->second;
+}
+
 void MockHttpFetcher::Pause() {
   CHECK(!paused_);
   paused_ = true;
@@ -95,6 +95,13 @@ class MockHttpFetcher : public HttpFetcher {
   // set.
   std::string GetHeader(const std::string& header_name) const;
 
+  // Sets the header |header_name| of the mock response.
+  void SetResponseHeader(const std::string& header_name,
+                         const std::string& header_value);
+
+  std::string GetResponseHeader(
+      const std::string& header_name) const override;
+
   // Suspend the mock transfer.
   void Pause() override;
 
@@ -136,6 +143,9 @@ class MockHttpFetcher : public HttpFetcher {
   // The extra headers set.
   std::map<std::string, std::string> extra_headers_;
 
+  // The headers of the mock response.
+  std::map<std::string, std::string> response_headers_;
+
   // The TaskId of the timeout callback. After each chunk of data sent, we
   // time out for 0s just to make sure that run loop services other clients.
   brillo::MessageLoop::TaskId timeout_id_;
@@ -21,10 +21,13 @@
 #include <algorithm>
 #include <string>
 
+#include "update_engine/common/http_common.h"
 #include "update_engine/common/utils.h"
 
 namespace chromeos_update_engine {
 
+const size_t MultiRangeHttpFetcher::kDefaultParallelChunkSize = 4 * 1024 * 1024;
+
 // Begins the transfer to the specified URL.
 // State change: Stopped -> Downloading
 // (corner case: Stopped -> Stopped for an empty request)
@@ -40,15 +43,43 @@ void MultiRangeHttpFetcher::BeginTransfer(const std::string& url) {
     return;
   }
   url_ = url;
+  if (!parallel_fetchers_.empty() &&
+      std::all_of(ranges_.begin(), ranges_.end(), [](const Range& range) {
+        return range.HasLength();
+      })) {
+    StartParallelTransfer();
+    return;
+  }
   current_index_ = 0;
   bytes_received_this_range_ = 0;
-  LOG(INFO) << "starting first transfer";
   base_fetcher_->set_delegate(this);
+  if (batch_ranges_ && ranges_.size() > 1 &&
+      std::all_of(ranges_.begin(), ranges_.end(), [](const Range& range) {
+        return range.HasLength();
+      }) &&
+      StartBatchTransfer()) {
+    return;
+  }
+  LOG(INFO) << "starting first transfer";
   StartTransfer();
 }
 
 // State change: Downloading -> Pending transfer ended
 void MultiRangeHttpFetcher::TerminateTransfer() {
+  if (parallel_active_) {
+    terminating_ = true;
+    TerminateConnections();
+    // The transfers may all have ended meanwhile.
+    for (const Connection& connection : connections_) {
+      if (connection.active)
+        return;
+    }
+    Reset();
+    // Note that after the callback returns this object may be destroyed.
+    if (delegate_)
+      delegate_->TransferTerminated(this);
+    return;
+  }
   if (!base_fetcher_active_) {
     LOG(INFO) << "Called TerminateTransfer but not active.";
     // Note that after the callback returns this object may be destroyed.
@@ -73,13 +104,14 @@ void MultiRangeHttpFetcher::StartTransfer() {
   Range range = ranges_[current_index_];
   LOG(INFO) << "starting transfer of range " << range.ToString();
 
-  bytes_received_this_range_ = 0;
-  base_fetcher_->SetOffset(range.offset());
+  // The range may have been partially received in batch mode.
+  const size_t received = bytes_received_this_range_;
+  base_fetcher_->SetOffset(range.offset() + received);
   if (range.HasLength())
-    base_fetcher_->SetLength(range.length());
+    base_fetcher_->SetLength(range.length() - received);
   else
     base_fetcher_->UnsetLength();
-  if (delegate_)
+  if (received == 0 && delegate_)
     delegate_->SeekToOffset(range.offset());
   base_fetcher_active_ = true;
   base_fetcher_->BeginTransfer(url_);
@@ -89,6 +121,16 @@ void MultiRangeHttpFetcher::StartTransfer() {
 void MultiRangeHttpFetcher::ReceivedBytes(HttpFetcher* fetcher,
                                           const void* bytes,
                                           size_t length) {
+  if (parallel_active_) {
+    Connection* connection = FindConnection(fetcher);
+    CHECK(connection);
+    ParallelReceivedBytes(connection, bytes, length);
+    return;
+  }
+  if (batch_active_) {
+    BatchReceivedBytes(bytes, length);
+    return;
+  }
   CHECK_LT(current_index_, ranges_.size());
   CHECK_EQ(fetcher, base_fetcher_.get());
   CHECK(!pending_transfer_ended_);
@@ -117,11 +159,23 @@ void MultiRangeHttpFetcher::ReceivedBytes(HttpFetcher* fetcher,
 // State change: Downloading or Pending transfer ended -> Stopped
 void MultiRangeHttpFetcher::TransferEnded(HttpFetcher* fetcher,
                                           bool successful) {
+  if (parallel_active_) {
+    Connection* connection = FindConnection(fetcher);
+    CHECK(connection);
+    ParallelTransferEnded(connection);
+    return;
+  }
   CHECK(base_fetcher_active_) << "Transfer ended unexpectedly.";
   CHECK_EQ(fetcher, base_fetcher_.get());
   pending_transfer_ended_ = false;
   http_response_code_ = fetcher->http_response_code();
   LOG(INFO) << "TransferEnded w/ code " << http_response_code_;
+  const bool batch = batch_active_;
+  if (batch_active_) {
+    batch_active_ = false;
+    batch_parser_.reset();
+    base_fetcher_->SetMultipleRanges({});
+  }
   if (terminating_) {
     LOG(INFO) << "Terminating.";
     Reset();
@@ -131,6 +185,22 @@ void MultiRangeHttpFetcher::TransferEnded(HttpFetcher* fetcher,
     return;
   }
 
+  if (batch) {
+    if (current_index_ == ranges_.size()) {
+      LOG(INFO) << "Done w/ all transfers";
+      Reset();
+      // Note that after the callback returns this object may be destroyed.
+      if (delegate_)
+        delegate_->TransferComplete(this, true);
+      return;
+    }
+    LOG(INFO) << "Didn't get all the ranges in one transfer, requesting the "
+              << ranges_.size() - current_index_ << " remaining ones "
+              << "one by one.";
+    StartTransfer();
+    return;
+  }
+
   // If we didn't get enough bytes, it's failure
   Range range = ranges_[current_index_];
   if (range.HasLength()) {
@@ -150,6 +220,7 @@ void MultiRangeHttpFetcher::TransferEnded(HttpFetcher* fetcher,
   // If we have another transfer, do that.
   if (current_index_ + 1 < ranges_.size()) {
     current_index_++;
+    bytes_received_this_range_ = 0;
     LOG(INFO) << "Starting next transfer (" << current_index_ << ").";
     StartTransfer();
     return;
@@ -177,6 +248,332 @@ void MultiRangeHttpFetcher::Reset() {
   base_fetcher_active_ = pending_transfer_ended_ = terminating_ = false;
   current_index_ = 0;
   bytes_received_this_range_ = 0;
+  parallel_active_ = parallel_failed_ = false;
+  chunks_.clear();
+  connections_.clear();
+  retry_chunks_.clear();
+  next_chunk_ = delivered_chunk_ = delivered_bytes_ = 0;
+  batch_active_ = batch_response_checked_ = false;
+  batch_parser_.reset();
+}
+
+bool MultiRangeHttpFetcher::StartBatchTransfer() {
+  std::vector<std::pair<off_t, size_t>> ranges;
+  for (const Range& range : ranges_)
+    ranges.emplace_back(range.offset(), range.length());
+  if (!base_fetcher_->SetMultipleRanges(ranges))
+    return false;
+  LOG(INFO) << "Requesting " << ranges_.size() << " ranges in one transfer.";
+  batch_active_ = true;
+  batch_response_checked_ = false;
+  base_fetcher_active_ = true;
+  base_fetcher_->BeginTransfer(url_);
+  return true;
+}
+
+void MultiRangeHttpFetcher::BatchReceivedBytes(const void* bytes,
+                                               size_t length) {
+  // Ignore anything received after the transfer was terminated.
+  if (pending_transfer_ended_)
+    return;
+  bool success = true;
+  std::vector<MultipartByterangesParser::Piece> pieces;
+  if (!batch_response_checked_) {
+    batch_response_checked_ = true;
+    success = CheckBatchResponse();
+  }
+  if (success && batch_parser_) {
+    success = batch_parser_->Parse(bytes, length, &pieces);
+  } else if (success) {
+    pieces.push_back(
+        {batch_offset_, static_cast<const uint8_t*>(bytes), length});
+    batch_offset_ += length;
+  }
+  for (const auto& piece : pieces) {
+    if (!success)
+      break;
+    success = DeliverBatchPiece(piece);
+    if (terminating_)
+      return;
+  }
+  // Stop once all the ranges were received, or to request the missing ones
+  // one by one.
+  if (!success || current_index_ == ranges_.size()) {
+    pending_transfer_ended_ = true;
+    base_fetcher_->TerminateTransfer();
+  }
+}
+
+bool MultiRangeHttpFetcher::CheckBatchResponse() {
+  if (base_fetcher_->http_response_code() != kHttpResponsePartialContent) {
+    LOG(INFO) << "The server didn't answer with the requested ranges ("
+              << base_fetcher_->http_response_code() << ").";
+    return false;
+  }
+  std::string boundary;
+  if (MultipartByterangesParser::GetBoundary(
+          base_fetcher_->GetResponseHeader("Content-Type"), &boundary)) {
+    batch_parser_.reset(new MultipartByterangesParser(boundary));
+    return true;
+  }
+  // The server may merge the ranges in a single one, with the bytes between
+  // them.
+  size_t length;
+  return MultipartByterangesParser::ParseContentRange(
+      base_fetcher_->GetResponseHeader("Content-Range"),
+      &batch_offset_,
+      &length);
+}
+
+bool MultiRangeHttpFetcher::DeliverBatchPiece(
+    const MultipartByterangesParser::Piece& piece) {
+  off_t offset = piece.offset;
+  const uint8_t* data = piece.data;
+  size_t length = piece.length;
+  while (length > 0 && current_index_ < ranges_.size()) {
+    const Range& range = ranges_[current_index_];
+    const off_t next_offset =
+        range.offset() + static_cast<off_t>(bytes_received_this_range_);
+    if (offset > next_offset) {
+      LOG(INFO) << "Missing " << offset - next_offset << " bytes of range "
+                << range.ToString() << " in the response.";
+      return false;
+    }
+    // Skip the bytes between the ranges, and any already received.
+    size_t skip = std::min(static_cast<size_t>(next_offset - offset), length);
+    offset += skip;
+    data += skip;
+    length -= skip;
+    if (length == 0)
+      break;
+
+    size_t next_size =
+        std::min(length, range.length() - bytes_received_this_range_);
+    if (bytes_received_this_range_ == 0 && delegate_)
+      delegate_->SeekToOffset(range.offset());
+    if (delegate_)
+      delegate_->ReceivedBytes(this, data, next_size);
+    if (terminating_)
+      return true;
+    bytes_received_this_range_ += next_size;
+    offset += next_size;
+    data += next_size;
+    length -= next_size;
+    if (bytes_received_this_range_ == range.length()) {
+      current_index_++;
+      bytes_received_this_range_ = 0;
+    }
+  }
+  return true;
+}
+
+size_t MultiRangeHttpFetcher::GetBytesDownloaded() {
+  size_t bytes_downloaded = 0;
+  for (HttpFetcher* fetcher : AllFetchers())
+    bytes_downloaded += fetcher->GetBytesDownloaded();
+  return bytes_downloaded;
+}
+
+std::vector<HttpFetcher*> MultiRangeHttpFetcher::AllFetchers() const {
+  std::vector<HttpFetcher*> fetchers = {base_fetcher_.get()};
+  for (const auto& fetcher : parallel_fetchers_)
+    fetchers.push_back(fetcher.get());
+  return fetchers;
+}
+
+void MultiRangeHttpFetcher::StartParallelTransfer() {
+  for (const Range& range : ranges_) {
+    for (size_t done = 0; done < range.length(); done += parallel_chunk_size_) {
+      chunks_.push_back({range.offset() + static_cast<off_t>(done),
+                         std::min(parallel_chunk_size_, range.length() - done),
+                         done == 0,
+                         0,
+                         brillo::Blob()});
+    }
+  }
+  base_fetcher_->set_delegate(this);
+  connections_.push_back({base_fetcher_.get(), "", 0, false, false, false});
+  for (size_t i = 0; i < parallel_fetchers_.size(); i++) {
+    parallel_fetchers_[i]->set_delegate(this);
+    connections_.push_back({parallel_fetchers_[i].get(),
+                            parallel_fetcher_urls_[i],
+                            0,
+                            false,
+                            false,
+                            false});
+  }
+  LOG(INFO) << "Downloading " << ranges_.size() << " ranges in "
+            << chunks_.size() << " chunks over " << connections_.size()
+            << " connections.";
+  parallel_active_ = true;
+  StartIdleConnections();
+}
+
+void MultiRangeHttpFetcher::StartIdleConnections() {
+  size_t num_active = 0;
+  for (const Connection& connection : connections_) {
+    if (connection.active)
+      num_active++;
+  }
+  for (Connection& connection : connections_) {
+    if (connection.active || connection.dropped)
+      continue;
+    if (max_active_connections_ > 0 && num_active >= max_active_connections_)
+      return;
+    if (!retry_chunks_.empty()) {
+      connection.chunk = retry_chunks_.front();
+      retry_chunks_.pop_front();
+    } else if (next_chunk_ == chunks_.size() ||
+               next_chunk_ >= delivered_chunk_ + connections_.size()) {
+      // Every connection is at most one chunk ahead of the delegate.
+      return;
+    } else {
+      connection.chunk = next_chunk_++;
+    }
+    connection.active = true;
+    connection.ending = false;
+    num_active++;
+    // Resume the chunks left incomplete by a dropped connection.
+    const Chunk& chunk = chunks_[connection.chunk];
+    connection.fetcher->SetOffset(chunk.offset + chunk.received);
+    connection.fetcher->SetLength(chunk.length - chunk.received);
+    connection.fetcher->BeginTransfer(connection.url.empty() ? url_
+                                                             : connection.url);
+    if (!parallel_active_)
+      return;
+  }
+}
+
+void MultiRangeHttpFetcher::ParallelReceivedBytes(Connection* connection,
+                                                  const void* bytes,
+                                                  size_t length) {
+  CHECK(connection->active);
+  // Ignore anything received after the chunk was complete.
+  if (connection->ending)
+    return;
+  Chunk& chunk = chunks_[connection->chunk];
+  size_t next_size = std::min(length, chunk.length - chunk.received);
+  chunk.received += next_size;
+  const bool chunk_complete = chunk.received == chunk.length;
+  if (connection->chunk == delivered_chunk_) {
+    DeliverBytes(bytes, next_size);
+  } else {
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    chunk.data.insert(chunk.data.end(), data, data + next_size);
+  }
+  if (terminating_)
+    return;
+  if (chunk_complete) {
+    // As in the single connection case, wait for the transfer to be
+    // terminated before starting the next chunk on this connection.
+    connection->ending = true;
+    connection->fetcher->TerminateTransfer();
+  }
+  // The delegate may have moved past the chunks other connections wait for.
+  StartIdleConnections();
+}
+
+void MultiRangeHttpFetcher::DeliverBytes(const void* bytes, size_t length) {
+  std::shared_ptr<const brillo::Blob> buffered;
+  while (true) {
+    const Chunk& chunk = chunks_[delivered_chunk_];
+    if (delivered_bytes_ == 0 && chunk.range_start && delegate_)
+      delegate_->SeekToOffset(chunk.offset);
+    if (delegate_) {
+      // The buffered bytes are handed over, so the delegate doesn't need to
+      // copy them again.
+      if (buffered)
+        delegate_->ReceivedChunk(this, buffered);
+      else
+        delegate_->ReceivedBytes(this, bytes, length);
+    }
+    if (terminating_)
+      return;
+    delivered_bytes_ += length;
+    if (delivered_bytes_ < chunk.length)
+      return;
+
+    // Move to the next chunk, passing what was already buffered of it.
+    delivered_chunk_++;
+    delivered_bytes_ = 0;
+    if (delivered_chunk_ == chunks_.size())
+      return;
+    brillo::Blob* data = &chunks_[delivered_chunk_].data;
+    if (data->empty())
+      return;
+    auto next = std::make_shared<brillo::Blob>();
+    next->swap(*data);
+    length = next->size();
+    buffered = std::move(next);
+  }
+}
+
+void MultiRangeHttpFetcher::ParallelTransferEnded(Connection* connection) {
+  CHECK(connection->active) << "Transfer ended unexpectedly.";
+  connection->active = false;
+  http_response_code_ = connection->fetcher->http_response_code();
+  if (terminating_connections_)
+    return;
+
+  const Chunk& chunk = chunks_[connection->chunk];
+  if (!terminating_ && !parallel_failed_ && chunk.received < chunk.length) {
+    if (!connection->url.empty()) {
+      // Fall back to the other connections for the rest of the chunk.
+      LOG(INFO) << "Didn't get enough bytes of chunk " << connection->chunk
+                << " at offset " << chunk.offset << " from "
+                << connection->url << ". Not using it anymore.";
+      connection->dropped = true;
+      retry_chunks_.push_back(connection->chunk);
+    } else {
+      LOG(INFO) << "Didn't get enough bytes of chunk " << connection->chunk
+                << " at offset " << chunk.offset << ". Ending w/ failure.";
+      parallel_failed_ = true;
+      TerminateConnections();
+    }
+  }
+  if (!terminating_ && !parallel_failed_) {
+    StartIdleConnections();
+    if (!parallel_active_)
+      return;
+  }
+  for (const Connection& other : connections_) {
+    if (other.active)
+      return;
+  }
+
+  const bool terminated = terminating_;
+  const bool successful =
+      !parallel_failed_ && delivered_chunk_ == chunks_.size();
+  LOG(INFO) << "Done w/ all parallel transfers, code "
+            << http_response_code_;
+  Reset();
+  // Note that after the callback returns this object may be destroyed.
+  if (!delegate_)
+    return;
+  if (terminated)
+    delegate_->TransferTerminated(this);
+  else
+    delegate_->TransferComplete(this, successful);
+}
+
+void MultiRangeHttpFetcher::TerminateConnections() {
+  terminating_connections_ = true;
+  for (Connection& connection : connections_) {
+    if (connection.active && !connection.ending) {
+      connection.ending = true;
+      connection.fetcher->TerminateTransfer();
+    }
+  }
+  terminating_connections_ = false;
+}
+
+MultiRangeHttpFetcher::Connection* MultiRangeHttpFetcher::FindConnection(
+    HttpFetcher* fetcher) {
+  for (Connection& connection : connections_) {
+    if (connection.fetcher == fetcher)
+      return &connection;
+  }
+  return nullptr;
 }
 
 std::string MultiRangeHttpFetcher::Range::ToString() const {
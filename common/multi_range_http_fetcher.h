@@ -23,7 +23,10 @@
 #include <utility>
 #include <vector>
 
+#include <brillo/secure_blob.h>
+
 #include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/multipart_byteranges_parser.h"
 
 // This class is a simple wrapper around an HttpFetcher. The client
 // specifies a vector of byte ranges. MultiRangeHttpFetcher will fetch bytes
@@ -32,6 +35,10 @@
 // as a length to specify unlimited length. It really only would make sense
 // for the last range specified to have unlimited length, tho it is legal for
 // other entries to have unlimited length.
+//
+// Additional fetchers can be added to download the ranges over several
+// connections in parallel, see AddParallelFetcher(). Otherwise the ranges
+// can all be requested at once, see set_batch_ranges().
 
 // There are three states a MultiRangeHttpFetcher object will be in:
 // - Stopped (start state)
@@ -44,6 +51,9 @@ namespace chromeos_update_engine {
 
 class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
  public:
+  // The default size of the chunks downloaded in parallel.
+  static const size_t kDefaultParallelChunkSize;
+
   // Takes ownership of the passed in fetcher.
   explicit MultiRangeHttpFetcher(HttpFetcher* base_fetcher)
       : HttpFetcher(base_fetcher->proxy_resolver()),
@@ -66,6 +76,47 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
     ranges_.push_back(Range(offset));
   }
 
+  // Takes ownership of |fetcher|, used for an additional connection to the
+  // same URL. When there is more than one connection and all the ranges have a
+  // length, the ranges are split in chunks of |parallel_chunk_size_| bytes
+  // downloaded concurrently over all the connections, and passed to the
+  // delegate in order. The chunks received ahead of the one being passed are
+  // buffered, at most one per connection. The fetchers must be added before
+  // setting any header or option, which are applied to all of them.
+  void AddParallelFetcher(HttpFetcher* fetcher) {
+    AddParallelFetcher(fetcher, "");
+  }
+
+  // Like above, but the connection downloads its chunks from the mirror |url|,
+  // e.g. a peer, instead of the URL of the transfer. When a chunk can't be
+  // fully downloaded from a mirror, the connection isn't used anymore and the
+  // rest of the chunk is downloaded by the other connections. An empty |url|
+  // uses the URL of the transfer.
+  void AddParallelFetcher(HttpFetcher* fetcher, const std::string& url) {
+    parallel_fetchers_.emplace_back(fetcher);
+    parallel_fetcher_urls_.push_back(url);
+  }
+
+  // Limits the number of connections downloading chunks at the same time to
+  // |max_connections|, or none if 0, the default. It can be changed during the
+  // transfer, taking effect as the next bytes are received: once lowered, the
+  // connections over the limit stop after their current chunk.
+  void set_max_active_connections(size_t max_connections) {
+    max_active_connections_ = max_connections;
+  }
+
+  // When |batch| and all the ranges have a length, requests them in a single
+  // transfer, if the base fetcher supports it, instead of one per range. The
+  // ranges not received in full that way, e.g. when the server doesn't
+  // support multiple ranges, are then requested one by one. It doesn't apply
+  // to the parallel mode.
+  void set_batch_ranges(bool batch) { batch_ranges_ = batch; }
+
+  void set_parallel_chunk_size(size_t size) {
+    CHECK_GT(size, static_cast<size_t>(0));
+    parallel_chunk_size_ = size;
+  }
+
   // HttpFetcher overrides.
   void SetOffset(off_t offset) override;
 
@@ -82,40 +133,61 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
 
   void SetHeader(const std::string& header_name,
                  const std::string& header_value) override {
-    base_fetcher_->SetHeader(header_name, header_value);
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->SetHeader(header_name, header_value);
   }
 
-  void Pause() override { base_fetcher_->Pause(); }
+  void Pause() override {
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->Pause();
+  }
 
-  void Unpause() override { base_fetcher_->Unpause(); }
+  void Unpause() override {
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->Unpause();
+  }
 
   // These functions are overloaded in LibcurlHttp fetcher for testing purposes.
   void set_idle_seconds(int seconds) override {
-    base_fetcher_->set_idle_seconds(seconds);
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->set_idle_seconds(seconds);
   }
   void set_retry_seconds(int seconds) override {
-    base_fetcher_->set_retry_seconds(seconds);
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->set_retry_seconds(seconds);
   }
   // TODO(deymo): Determine if this method should be virtual in HttpFetcher so
   // this call is sent to the base_fetcher_.
   virtual void SetProxies(const std::deque<std::string>& proxies) {
-    base_fetcher_->SetProxies(proxies);
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->SetProxies(proxies);
   }
 
-  inline size_t GetBytesDownloaded() override {
-    return base_fetcher_->GetBytesDownloaded();
-  }
+  size_t GetBytesDownloaded() override;
 
   void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {
-    base_fetcher_->set_low_speed_limit(low_speed_bps, low_speed_sec);
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->set_low_speed_limit(low_speed_bps, low_speed_sec);
+  }
+
+  void set_bandwidth_limiter(BandwidthLimiter* limiter) override {
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->set_bandwidth_limiter(limiter);
+  }
+
+  void set_throughput_estimator(ThroughputEstimator* estimator) override {
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->set_throughput_estimator(estimator);
   }
 
   void set_connect_timeout(int connect_timeout_seconds) override {
-    base_fetcher_->set_connect_timeout(connect_timeout_seconds);
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->set_connect_timeout(connect_timeout_seconds);
   }
 
   void set_max_retry_count(int max_retry_count) override {
-    base_fetcher_->set_max_retry_count(max_retry_count);
+    for (HttpFetcher* fetcher : AllFetchers())
+      fetcher->set_max_retry_count(max_retry_count);
   }
 
  private:
@@ -141,6 +213,34 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
 
   typedef std::vector<Range> RangesVect;
 
+  // A chunk of a range downloaded in parallel mode. The first chunk of every
+  // range starts at the range offset.
+  struct Chunk {
+    off_t offset;
+    size_t length;
+    bool range_start;
+    // The bytes received so far, and the ones buffered until the chunk is
+    // passed to the delegate.
+    size_t received;
+    brillo::Blob data;
+  };
+
+  // A connection of the parallel mode, downloading the chunk |chunk| while
+  // |active|. It is |ending| once its transfer was terminated. The connections
+  // to a mirror |url| are |dropped| after failing to download a chunk.
+  struct Connection {
+    HttpFetcher* fetcher;
+    std::string url;
+    size_t chunk;
+    bool active;
+    bool ending;
+    bool dropped;
+  };
+
+  // Returns |base_fetcher_| followed by the |parallel_fetchers_|.
+  std::vector<HttpFetcher*> AllFetchers() const;
+
+  // Starts the transfer of the current range from the bytes not received yet.
   // State change: Stopped or Downloading -> Downloading
   void StartTransfer();
 
@@ -158,6 +258,43 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
 
   void Reset();
 
+  // The batch mode counterparts of StartTransfer() and ReceivedBytes().
+  // StartBatchTransfer() returns false if the base fetcher doesn't support
+  // it.
+  bool StartBatchTransfer();
+  void BatchReceivedBytes(const void* bytes, size_t length);
+
+  // Checks that the first bytes received in batch mode are the requested
+  // ranges, setting up their parsing.
+  bool CheckBatchResponse();
+
+  // Passes the bytes of |piece| which are in the ranges to the delegate,
+  // moving to the next ranges as they are complete. Returns false if a part
+  // of a range is missing.
+  bool DeliverBatchPiece(const MultipartByterangesParser::Piece& piece);
+
+  // The parallel mode counterparts of BeginTransfer(), ReceivedBytes() and
+  // TransferEnded().
+  void StartParallelTransfer();
+  void ParallelReceivedBytes(Connection* connection,
+                             const void* bytes,
+                             size_t length);
+  void ParallelTransferEnded(Connection* connection);
+
+  // Starts downloading the next chunks on the idle connections, as long as the
+  // chunks downloaded ahead of the delegate fit in the reorder buffer.
+  void StartIdleConnections();
+
+  // Passes the |length| |bytes| of the current chunk to the delegate, then
+  // moves to the next chunks as long as they were all buffered.
+  void DeliverBytes(const void* bytes, size_t length);
+
+  // Terminates the transfer of all the active connections not ending yet.
+  void TerminateConnections();
+
+  // Returns the connection using |fetcher|, or nullptr if none does.
+  Connection* FindConnection(HttpFetcher* fetcher);
+
   std::unique_ptr<HttpFetcher> base_fetcher_;
 
   // If true, do not send any more data or TransferComplete to the delegate.
@@ -176,6 +313,39 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
   RangesVect::size_type current_index_;  // index into ranges_
   size_t bytes_received_this_range_;
 
+  std::vector<std::unique_ptr<HttpFetcher>> parallel_fetchers_;
+  // The mirror URL of each of the |parallel_fetchers_|, or an empty string.
+  std::vector<std::string> parallel_fetcher_urls_;
+  size_t parallel_chunk_size_{kDefaultParallelChunkSize};
+  size_t max_active_connections_{0};
+
+  // The state of the batch mode, used while |batch_active_|. A multipart body
+  // is parsed by |batch_parser_|; a single range, when the server merged the
+  // requested ones, starts at |batch_offset_|.
+  bool batch_ranges_{false};
+  bool batch_active_{false};
+  bool batch_response_checked_{false};
+  std::unique_ptr<MultipartByterangesParser> batch_parser_;
+  off_t batch_offset_{0};
+
+  // The state of the parallel mode, used while |parallel_active_|. The chunks
+  // before |next_chunk_| were assigned to a connection; the ones before
+  // |delivered_chunk_| were passed to the delegate, as well as
+  // |delivered_bytes_| of the |delivered_chunk_|.
+  bool parallel_active_{false};
+  bool parallel_failed_{false};
+  std::vector<Chunk> chunks_;
+  std::vector<Connection> connections_;
+  size_t next_chunk_{0};
+  size_t delivered_chunk_{0};
+  size_t delivered_bytes_{0};
+  // The chunks left incomplete by a dropped connection, downloaded again
+  // before the ones after |next_chunk_|.
+  std::deque<size_t> retry_chunks_;
+  // Set while terminating the connections, so the transfers ending meanwhile
+  // don't complete the whole transfer.
+  bool terminating_connections_{false};
+
   DISALLOW_COPY_AND_ASSIGN(MultiRangeHttpFetcher);
 };
 
@@ -0,0 +1,210 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/multipart_byteranges_parser.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The maximum size of the delimiter and the headers of a part, to not buffer
+// a whole malformed response.
+const size_t kMaxBufferSize = 8 * 1024;
+
+const char kMediaType[] = "multipart/byteranges";
+const char kBoundaryParameter[] = "boundary=";
+const char kLineEnd[] = "\r\n";
+const char kHeadersEnd[] = "\r\n\r\n";
+const char kContentRangeHeader[] = "content-range";
+
+}  // namespace
+
+bool MultipartByterangesParser::Parse(const void* data,
+                                      size_t length,
+                                      vector<Piece>* pieces) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  while (length > 0 && state_ != State::kError) {
+    if (state_ == State::kDone) {
+      // Ignore the epilogue after the closing delimiter.
+      return true;
+    }
+    if (state_ == State::kData) {
+      size_t piece_length = std::min(length, data_left_);
+      pieces->push_back({data_offset_, bytes, piece_length});
+      data_offset_ += piece_length;
+      data_left_ -= piece_length;
+      bytes += piece_length;
+      length -= piece_length;
+      if (data_left_ == 0)
+        state_ = State::kDelimiter;
+      continue;
+    }
+
+    // The delimiters and headers are parsed from |buffer_|, so the bytes after
+    // them are dropped from it and parsed again from |data|.
+    size_t buffered = buffer_.size();
+    buffer_.append(reinterpret_cast<const char*>(bytes), length);
+    size_t consumed = 0;
+    bool success = state_ == State::kDelimiter ? ParseDelimiter(&consumed)
+                                               : ParseHeaders(&consumed);
+    if (!success) {
+      state_ = State::kError;
+      break;
+    }
+    if (consumed == 0) {
+      if (buffer_.size() > kMaxBufferSize) {
+        LOG(ERROR) << "Multipart response part headers too large.";
+        state_ = State::kError;
+        break;
+      }
+      return true;
+    }
+    // The parsed bytes end in the ones just appended, otherwise they would
+    // have been parsed by the previous call.
+    DCHECK_GT(consumed, buffered);
+    bytes += consumed - buffered;
+    length -= consumed - buffered;
+    buffer_.clear();
+  }
+  return state_ != State::kError;
+}
+
+bool MultipartByterangesParser::ParseDelimiter(size_t* consumed) {
+  // The delimiter is on its own line, so it is only preceded by the line end
+  // after the previous part data, or by the preamble ignored before the first
+  // part.
+  size_t pos = buffer_.find(delimiter_);
+  if (pos == string::npos)
+    return true;
+  pos += delimiter_.size();
+  if (buffer_.size() < pos + 2)
+    return true;
+  if (buffer_.compare(pos, 2, "--") == 0) {
+    state_ = State::kDone;
+    *consumed = pos + 2;
+    return true;
+  }
+  // Skip the optional whitespace padding up to the end of the line.
+  size_t line_end = buffer_.find(kLineEnd, pos);
+  if (line_end == string::npos)
+    return true;
+  state_ = State::kHeaders;
+  *consumed = line_end + strlen(kLineEnd);
+  return true;
+}
+
+bool MultipartByterangesParser::ParseHeaders(size_t* consumed) {
+  // The empty line ending the headers comes right after the delimiter line
+  // when a part has no headers.
+  size_t end;
+  if (buffer_.compare(0, strlen(kLineEnd), kLineEnd) == 0) {
+    end = 0;
+  } else {
+    end = buffer_.find(kHeadersEnd);
+    if (end == string::npos)
+      return true;
+    end += strlen(kLineEnd);
+  }
+
+  bool has_content_range = false;
+  size_t line_start = 0;
+  while (line_start < end) {
+    size_t line_end = buffer_.find(kLineEnd, line_start);
+    string line = buffer_.substr(line_start, line_end - line_start);
+    line_start = line_end + strlen(kLineEnd);
+    size_t colon = line.find(':');
+    if (colon == string::npos)
+      continue;
+    string name;
+    base::TrimWhitespaceASCII(line.substr(0, colon), base::TRIM_ALL, &name);
+    if (base::ToLowerASCII(name) != kContentRangeHeader)
+      continue;
+    string value;
+    base::TrimWhitespaceASCII(line.substr(colon + 1), base::TRIM_ALL, &value);
+    TEST_AND_RETURN_FALSE(ParseContentRange(value, &data_offset_, &data_left_));
+    has_content_range = true;
+  }
+  if (!has_content_range) {
+    LOG(ERROR) << "Multipart response part without a Content-Range.";
+    return false;
+  }
+  state_ = State::kData;
+  *consumed = end + strlen(kLineEnd);
+  return true;
+}
+
+// static
+bool MultipartByterangesParser::GetBoundary(const string& content_type,
+                                            string* boundary) {
+  string type = base::ToLowerASCII(content_type);
+  if (!base::StartsWith(type, kMediaType, base::CompareCase::SENSITIVE))
+    return false;
+  size_t pos = type.find(kBoundaryParameter, strlen(kMediaType));
+  if (pos == string::npos)
+    return false;
+  // The boundary is case sensitive, so it is taken from |content_type|.
+  pos += strlen(kBoundaryParameter);
+  string value = content_type.substr(pos, content_type.find(';', pos) - pos);
+  base::TrimWhitespaceASCII(value, base::TRIM_ALL, &value);
+  if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+    value = value.substr(1, value.size() - 2);
+  if (value.empty())
+    return false;
+  *boundary = value;
+  return true;
+}
+
+// static
+bool MultipartByterangesParser::ParseContentRange(const string& content_range,
+                                                  off_t* offset,
+                                                  size_t* length) {
+  const char kUnit[] = "bytes ";
+  if (!base::StartsWith(
+          content_range, kUnit, base::CompareCase::INSENSITIVE_ASCII)) {
+    LOG(ERROR) << "Invalid Content-Range: " << content_range;
+    return false;
+  }
+  size_t dash = content_range.find('-', strlen(kUnit));
+  size_t slash = content_range.find('/', strlen(kUnit));
+  int64_t first, last;
+  if (dash == string::npos || slash == string::npos || dash > slash ||
+      !base::StringToInt64(
+          content_range.substr(strlen(kUnit), dash - strlen(kUnit)), &first) ||
+      !base::StringToInt64(content_range.substr(dash + 1, slash - dash - 1),
+                           &last) ||
+      first < 0 || last < first) {
+    LOG(ERROR) << "Invalid Content-Range: " << content_range;
+    return false;
+  }
+  *offset = first;
+  *length = last - first + 1;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
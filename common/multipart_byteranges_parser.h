@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_MULTIPART_BYTERANGES_PARSER_H_
+#define UPDATE_ENGINE_COMMON_MULTIPART_BYTERANGES_PARSER_H_
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// Parses the body of a "multipart/byteranges" HTTP response, the answer to a
+// request of several byte ranges at once, as it is received. Each part of the
+// body has its own headers, with the Content-Range of the bytes that follow
+// them, so the data of every part is returned along with its offset in the
+// requested resource.
+class MultipartByterangesParser {
+ public:
+  // A piece of the data of a part, pointing to the bytes passed to Parse().
+  struct Piece {
+    off_t offset;
+    const uint8_t* data;
+    size_t length;
+  };
+
+  explicit MultipartByterangesParser(const std::string& boundary)
+      : delimiter_("--" + boundary) {}
+
+  // Parses the next |length| bytes of the body at |data|, storing in |pieces|
+  // the part data in them, in order. Returns false if the body is malformed,
+  // in which case the parser can't be used anymore.
+  bool Parse(const void* data, size_t length, std::vector<Piece>* pieces);
+
+  // Whether the closing delimiter, after the last part, was parsed.
+  bool done() const { return state_ == State::kDone; }
+
+  // Stores in |boundary| the boundary of the "multipart/byteranges" media
+  // type |content_type|, e.g. "multipart/byteranges; boundary=XYZ". Returns
+  // false if it is another media type.
+  static bool GetBoundary(const std::string& content_type,
+                          std::string* boundary);
+
+  // Parses the value of a Content-Range header, "bytes <first>-<last>/<size>"
+  // with an unknown <size> written as "*", storing the range it describes in
+  // |offset| and |length|. Returns false if it is invalid.
+  static bool ParseContentRange(const std::string& content_range,
+                                off_t* offset,
+                                size_t* length);
+
+ private:
+  enum class State {
+    // Looking for the delimiter before the next part, or the closing one.
+    kDelimiter,
+    // Reading the headers of a part, up to the empty line ending them.
+    kHeaders,
+    // Reading the data of a part.
+    kData,
+    kDone,
+    kError,
+  };
+
+  // Parse the delimiter line or the headers at the start of |buffer_|, in the
+  // kDelimiter or kHeaders state, storing in |consumed| the number of bytes
+  // parsed, which is left unchanged if more bytes are needed. Return false if
+  // they are malformed.
+  bool ParseDelimiter(size_t* consumed);
+  bool ParseHeaders(size_t* consumed);
+
+  const std::string delimiter_;
+  State state_{State::kDelimiter};
+  // The bytes not parsed yet outside of the part data, e.g. a header line
+  // split between two calls to Parse().
+  std::string buffer_;
+  // The offset of the next data byte of the current part, and how many of
+  // them are left.
+  off_t data_offset_{0};
+  size_t data_left_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(MultipartByterangesParser);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_MULTIPART_BYTERANGES_PARSER_H_
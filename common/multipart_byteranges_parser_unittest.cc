@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/multipart_byteranges_parser.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const char kBody[] =
+    "preamble\r\n"
+    "--XYZ\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "content-range: bytes 10-14/100\r\n"
+    "\r\n"
+    "abcde\r\n"
+    "--XYZ\r\n"
+    "Content-Range: bytes 50-52/*\r\n"
+    "\r\n"
+    "fgh\r\n"
+    "--XYZ--\r\n";
+
+// Parses |body| passed in chunks of |chunk_size| bytes, returning the data of
+// each byte offset as "<offset>:<data>" entries, merged when contiguous.
+bool ParseInChunks(const string& body,
+                   size_t chunk_size,
+                   vector<string>* parts) {
+  MultipartByterangesParser parser("XYZ");
+  off_t next_offset = -1;
+  for (size_t pos = 0; pos < body.size(); pos += chunk_size) {
+    vector<MultipartByterangesParser::Piece> pieces;
+    if (!parser.Parse(body.data() + pos,
+                      std::min(chunk_size, body.size() - pos),
+                      &pieces)) {
+      return false;
+    }
+    for (const auto& piece : pieces) {
+      if (piece.offset != next_offset)
+        parts->push_back(std::to_string(piece.offset) + ":");
+      parts->back().append(reinterpret_cast<const char*>(piece.data),
+                           piece.length);
+      next_offset = piece.offset + piece.length;
+    }
+  }
+  return parser.done();
+}
+
+}  // namespace
+
+TEST(MultipartByterangesParserTest, ParseTest) {
+  const string body = kBody;
+  // The delimiters and headers may be split anywhere.
+  for (size_t chunk_size = 1; chunk_size <= body.size(); chunk_size++) {
+    vector<string> parts;
+    EXPECT_TRUE(ParseInChunks(body, chunk_size, &parts)) << chunk_size;
+    EXPECT_EQ((vector<string>{"10:abcde", "50:fgh"}), parts) << chunk_size;
+  }
+}
+
+TEST(MultipartByterangesParserTest, MalformedTest) {
+  vector<string> parts;
+  // A part without a Content-Range.
+  EXPECT_FALSE(ParseInChunks(
+      "--XYZ\r\nContent-Type: text/plain\r\n\r\nabc\r\n--XYZ--", 7, &parts));
+  EXPECT_FALSE(ParseInChunks(
+      "--XYZ\r\nContent-Range: bytes 5-2/9\r\n\r\nabc\r\n--XYZ--", 7, &parts));
+  // The headers are too large.
+  EXPECT_FALSE(ParseInChunks(
+      "--XYZ\r\nX-Header: " + string(16 * 1024, 'a'), 1024, &parts));
+  // The body ends before the closing delimiter.
+  EXPECT_FALSE(ParseInChunks(
+      "--XYZ\r\nContent-Range: bytes 0-2/9\r\n\r\nabc", 7, &parts));
+}
+
+TEST(MultipartByterangesParserTest, GetBoundaryTest) {
+  string boundary;
+  EXPECT_TRUE(MultipartByterangesParser::GetBoundary(
+      "multipart/byteranges; boundary=3d6b6a416f9b5", &boundary));
+  EXPECT_EQ("3d6b6a416f9b5", boundary);
+  EXPECT_TRUE(MultipartByterangesParser::GetBoundary(
+      "Multipart/Byteranges; Boundary=\"AbC\"; charset=x", &boundary));
+  EXPECT_EQ("AbC", boundary);
+  EXPECT_FALSE(MultipartByterangesParser::GetBoundary(
+      "application/octet-stream", &boundary));
+  EXPECT_FALSE(MultipartByterangesParser::GetBoundary("multipart/byteranges",
+                                                      &boundary));
+}
+
+TEST(MultipartByterangesParserTest, ParseContentRangeTest) {
+  off_t offset;
+  size_t length;
+  EXPECT_TRUE(MultipartByterangesParser::ParseContentRange(
+      "bytes 100-199/1000", &offset, &length));
+  EXPECT_EQ(100, offset);
+  EXPECT_EQ(100U, length);
+  EXPECT_TRUE(MultipartByterangesParser::ParseContentRange(
+      "bytes 0-0/*", &offset, &length));
+  EXPECT_EQ(0, offset);
+  EXPECT_EQ(1U, length);
+  EXPECT_FALSE(MultipartByterangesParser::ParseContentRange(
+      "bytes */1000", &offset, &length));
+  EXPECT_FALSE(MultipartByterangesParser::ParseContentRange(
+      "items 0-9/10", &offset, &length));
+  EXPECT_FALSE(MultipartByterangesParser::ParseContentRange(
+      "bytes 9-0/10", &offset, &length));
+}
+
+}  // namespace chromeos_update_engine
@@ -16,10 +16,17 @@
 
 #include "update_engine/common/prefs.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
 
+#include <base/bind.h>
+#include <base/files/file_enumerator.h>
 #include <base/files/file_util.h>
+#include <base/location.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 
@@ -29,18 +36,138 @@ using std::string;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The name of the file holding the changes being committed by
+// FileStorage::CommitChanges(). The '.' makes it an invalid key name.
+const char kJournalFileName[] = "transaction.journal";
+
+// The name of the LogStorage log file, and of the new log written by its
+// compaction.
+const char kLogFileName[] = "prefs.log";
+const char kNewLogFileName[] = "prefs.log.new";
+
+// The LogStorage log isn't compacted below this size.
+const uint64_t kMinLogCompactionSize = 64 * 1024;
+
+// Returns whether |key| is a valid key: non-empty and only containing
+// [A-Za-z0-9_-].
+bool IsValidKey(const string& key) {
+  if (key.empty())
+    return false;
+  for (char c : key) {
+    if (!base::IsAsciiAlpha(c) && !base::IsAsciiDigit(c) && c != '_' &&
+        c != '-')
+      return false;
+  }
+  return true;
+}
+
+// Flushes the file or directory at |path| to disk. Returns whether it was.
+bool SyncPath(const base::FilePath& path) {
+  int fd = HANDLE_EINTR(open(path.value().c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  TEST_AND_RETURN_FALSE_ERRNO(fsync(fd) == 0);
+  return true;
+}
+
+// Serializes |changes| in the format read by ParseChanges(): a "D <key>" line
+// per deleted key, a "S <key> <size>" line followed by the value and a new
+// line per set key, and a "E" line ending them.
+string SerializeChanges(const Prefs::StorageInterface::KeyChanges& changes) {
+  string data;
+  for (const auto& key_change : changes) {
+    if (key_change.second.deleted) {
+      data += "D " + key_change.first + "\n";
+    } else {
+      data += "S " + key_change.first + " " +
+              base::Uint64ToString(key_change.second.value.size()) + "\n" +
+              key_change.second.value + "\n";
+    }
+  }
+  return data + "E\n";
+}
+
+// Parses the changes serialized by SerializeChanges() starting at |*pos| in
+// |data| into |changes|, and moves |*pos| past them. Returns false if they are
+// malformed or incomplete.
+bool ParseChanges(const string& data,
+                  size_t* pos,
+                  Prefs::StorageInterface::KeyChanges* changes) {
+  while (*pos < data.size()) {
+    size_t eol = data.find('\n', *pos);
+    TEST_AND_RETURN_FALSE(eol != string::npos);
+    string line = data.substr(*pos, eol - *pos);
+    *pos = eol + 1;
+    if (line == "E")
+      return true;
+    TEST_AND_RETURN_FALSE(line.size() > 2 && line[1] == ' ');
+    if (line[0] == 'D') {
+      (*changes)[line.substr(2)].deleted = true;
+      continue;
+    }
+    TEST_AND_RETURN_FALSE(line[0] == 'S');
+    size_t space = line.rfind(' ');
+    TEST_AND_RETURN_FALSE(space > 2);
+    uint64_t size;
+    TEST_AND_RETURN_FALSE(base::StringToUint64(line.substr(space + 1), &size));
+    TEST_AND_RETURN_FALSE(size < data.size() - *pos &&
+                          data[*pos + size] == '\n');
+    Prefs::StorageInterface::KeyChange& change =
+        (*changes)[line.substr(2, space - 2)];
+    change.deleted = false;
+    change.value = data.substr(*pos, size);
+    *pos += size + 1;
+  }
+  // The end marker is missing, the changes weren't completely written.
+  return false;
+}
+
+// Parses the |journal| written by FileStorage::CommitChanges() into |changes|.
+// Returns false if it is malformed or incomplete.
+bool ParseJournal(const string& journal,
+                  Prefs::StorageInterface::KeyChanges* changes) {
+  size_t pos = 0;
+  return ParseChanges(journal, &pos, changes) && pos == journal.size();
+}
+
+}  // namespace
+
+bool PrefsBase::StorageInterface::CommitChanges(const KeyChanges& changes) {
+  bool success = true;
+  for (const auto& key_change : changes) {
+    const string& key = key_change.first;
+    if (!key_change.second.deleted)
+      success = SetKey(key, key_change.second.value) && success;
+    else if (KeyExists(key))
+      success = DeleteKey(key) && success;
+  }
+  return success;
+}
+
 bool PrefsBase::GetString(const string& key, string* value) const {
+  if (in_transaction_) {
+    const auto change = transaction_.find(key);
+    if (change != transaction_.end()) {
+      if (change->second.deleted)
+        return false;
+      *value = change->second.value;
+      return true;
+    }
+  }
   return storage_->GetKey(key, value);
 }
 
 bool PrefsBase::SetString(const string& key, const string& value) {
-  TEST_AND_RETURN_FALSE(storage_->SetKey(key, value));
-  const auto observers_for_key = observers_.find(key);
-  if (observers_for_key != observers_.end()) {
-    std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
-    for (ObserverInterface* observer : copy_observers)
-      observer->OnPrefSet(key);
+  if (in_transaction_) {
+    StorageInterface::KeyChange& change = transaction_[key];
+    change.deleted = false;
+    change.value = value;
+    return true;
   }
+  TEST_AND_RETURN_FALSE(storage_->SetKey(key, value));
+  NotifyObservers(key, false);
   return true;
 }
 
@@ -78,17 +205,45 @@ bool PrefsBase::SetBoolean(const string& key, const bool value) {
 }
 
 bool PrefsBase::Exists(const string& key) const {
+  if (in_transaction_) {
+    const auto change = transaction_.find(key);
+    if (change != transaction_.end())
+      return !change->second.deleted;
+  }
   return storage_->KeyExists(key);
 }
 
 bool PrefsBase::Delete(const string& key) {
-  TEST_AND_RETURN_FALSE(storage_->DeleteKey(key));
-  const auto observers_for_key = observers_.find(key);
-  if (observers_for_key != observers_.end()) {
-    std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
-    for (ObserverInterface* observer : copy_observers)
-      observer->OnPrefDeleted(key);
+  if (in_transaction_) {
+    StorageInterface::KeyChange& change = transaction_[key];
+    change.deleted = true;
+    change.value.clear();
+    return true;
   }
+  TEST_AND_RETURN_FALSE(storage_->DeleteKey(key));
+  NotifyObservers(key, true);
+  return true;
+}
+
+bool PrefsBase::StartTransaction() {
+  TEST_AND_RETURN_FALSE(!in_transaction_);
+  in_transaction_ = true;
+  return true;
+}
+
+void PrefsBase::CancelTransaction() {
+  in_transaction_ = false;
+  transaction_.clear();
+}
+
+bool PrefsBase::SubmitTransaction() {
+  TEST_AND_RETURN_FALSE(in_transaction_);
+  StorageInterface::KeyChanges changes;
+  changes.swap(transaction_);
+  in_transaction_ = false;
+  TEST_AND_RETURN_FALSE(storage_->CommitChanges(changes));
+  for (const auto& key_change : changes)
+    NotifyObservers(key_change.first, key_change.second.deleted);
   return true;
 }
 
@@ -104,6 +259,58 @@ void PrefsBase::RemoveObserver(const string& key, ObserverInterface* observer) {
     observers_for_key.erase(observer_it);
 }
 
+PrefsBase::~PrefsBase() {
+  if (notify_task_ != brillo::MessageLoop::kTaskIdNull &&
+      brillo::MessageLoop::current())
+    brillo::MessageLoop::current()->CancelTask(notify_task_);
+}
+
+void PrefsBase::NotifyObservers(const string& key, bool deleted) {
+  const auto observers_for_key = observers_.find(key);
+  if (observers_for_key == observers_.end() ||
+      observers_for_key->second.empty())
+    return;
+
+  if (brillo::MessageLoop::current()) {
+    pending_keys_.insert(key);
+    if (notify_task_ == brillo::MessageLoop::kTaskIdNull) {
+      notify_task_ = brillo::MessageLoop::current()->PostTask(
+          FROM_HERE,
+          base::Bind(&PrefsBase::DispatchNotifications,
+                     base::Unretained(this)));
+    }
+    return;
+  }
+
+  std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
+  for (ObserverInterface* observer : copy_observers) {
+    if (deleted)
+      observer->OnPrefDeleted(key);
+    else
+      observer->OnPrefSet(key);
+  }
+}
+
+void PrefsBase::DispatchNotifications() {
+  notify_task_ = brillo::MessageLoop::kTaskIdNull;
+  std::set<string> keys;
+  keys.swap(pending_keys_);
+  for (const string& key : keys) {
+    const auto observers_for_key = observers_.find(key);
+    if (observers_for_key == observers_.end())
+      continue;
+    // Report the committed state, ignoring a transaction in progress.
+    bool deleted = !storage_->KeyExists(key);
+    std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
+    for (ObserverInterface* observer : copy_observers) {
+      if (deleted)
+        observer->OnPrefDeleted(key);
+      else
+        observer->OnPrefSet(key);
+    }
+  }
+}
+
 // Prefs
 
 bool Prefs::Init(const base::FilePath& prefs_dir) {
@@ -112,6 +319,7 @@ bool Prefs::Init(const base::FilePath& prefs_dir) {
 
 bool Prefs::FileStorage::Init(const base::FilePath& prefs_dir) {
   prefs_dir_ = prefs_dir;
+  ReplayJournal();
   return true;
 }
 
@@ -151,19 +359,246 @@ bool Prefs::FileStorage::DeleteKey(const string& key) {
   return true;
 }
 
+bool Prefs::FileStorage::CommitChanges(const KeyChanges& changes) {
+  for (const auto& key_change : changes) {
+    base::FilePath filename;
+    TEST_AND_RETURN_FALSE(GetFileNameForKey(key_change.first, &filename));
+  }
+  string journal = SerializeChanges(changes);
+
+  // Persist all the changes in the journal before applying them, so a crash
+  // while applying them is recovered by ReplayJournal() on the next Init().
+  base::FilePath journal_file = GetJournalFileName();
+  if (!base::DirectoryExists(prefs_dir_))
+    TEST_AND_RETURN_FALSE(base::CreateDirectory(prefs_dir_));
+  int fd = HANDLE_EINTR(
+      open(journal_file.value().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  TEST_AND_RETURN_FALSE(utils::WriteAll(fd, journal.data(), journal.size()));
+  TEST_AND_RETURN_FALSE_ERRNO(fsync(fd) == 0);
+  TEST_AND_RETURN_FALSE(SyncPath(prefs_dir_));
+
+  // The journal is only removed once the changes are on disk.
+  TEST_AND_RETURN_FALSE(StorageInterface::CommitChanges(changes));
+  TEST_AND_RETURN_FALSE(SyncChanges(changes));
+  TEST_AND_RETURN_FALSE(base::DeleteFile(journal_file, false));
+  return true;
+}
+
+bool Prefs::FileStorage::SyncChanges(const KeyChanges& changes) const {
+  for (const auto& key_change : changes) {
+    if (key_change.second.deleted)
+      continue;
+    base::FilePath filename;
+    TEST_AND_RETURN_FALSE(GetFileNameForKey(key_change.first, &filename));
+    TEST_AND_RETURN_FALSE(SyncPath(filename));
+  }
+  // Persists the creation and the deletion of the key files.
+  return SyncPath(prefs_dir_);
+}
+
+void Prefs::FileStorage::ReplayJournal() {
+  base::FilePath journal_file = GetJournalFileName();
+  string journal;
+  if (!base::ReadFileToString(journal_file, &journal))
+    return;
+  KeyChanges changes;
+  if (ParseJournal(journal, &changes)) {
+    LOG(INFO) << "Replaying " << changes.size()
+              << " pref changes from an interrupted transaction.";
+    if (!StorageInterface::CommitChanges(changes) || !SyncChanges(changes))
+      LOG(ERROR) << "Failed to replay the interrupted transaction.";
+  } else {
+    LOG(WARNING) << "Discarding an incomplete pref transaction.";
+  }
+  base::DeleteFile(journal_file, false);
+}
+
+base::FilePath Prefs::FileStorage::GetJournalFileName() const {
+  return prefs_dir_.Append(kJournalFileName);
+}
+
 bool Prefs::FileStorage::GetFileNameForKey(const string& key,
                                            base::FilePath* filename) const {
-  // Allows only non-empty keys containing [A-Za-z0-9_-].
-  TEST_AND_RETURN_FALSE(!key.empty());
-  for (size_t i = 0; i < key.size(); ++i) {
-    char c = key.at(i);
-    TEST_AND_RETURN_FALSE(base::IsAsciiAlpha(c) || base::IsAsciiDigit(c) ||
-                          c == '_' || c == '-');
-  }
+  TEST_AND_RETURN_FALSE(IsValidKey(key));
   *filename = prefs_dir_.Append(key);
   return true;
 }
 
+// LogPrefs
+
+bool LogPrefs::Init(const base::FilePath& prefs_dir) {
+  return log_storage_.Init(prefs_dir);
+}
+
+LogPrefs::LogStorage::~LogStorage() {
+  if (log_fd_ >= 0)
+    IGNORE_EINTR(close(log_fd_));
+}
+
+bool LogPrefs::LogStorage::Init(const base::FilePath& prefs_dir) {
+  log_file_ = prefs_dir.Append(kLogFileName);
+  if (base::PathExists(log_file_))
+    return ReadLog();
+
+  // Move the keys from the layout used by Prefs. The files are only removed
+  // once the log holding them is written, so a crash in between only leaves
+  // unused files behind.
+  if (!base::DirectoryExists(prefs_dir))
+    TEST_AND_RETURN_FALSE(base::CreateDirectory(prefs_dir));
+  MigrateKeyFiles(prefs_dir);
+  TEST_AND_RETURN_FALSE(Compact());
+  for (const auto& key_value : values_)
+    base::DeleteFile(prefs_dir.Append(key_value.first), false);
+  if (!values_.empty())
+    LOG(INFO) << "Moved " << values_.size() << " prefs to "
+              << log_file_.value();
+  return true;
+}
+
+bool LogPrefs::LogStorage::ReadLog() {
+  string log;
+  TEST_AND_RETURN_FALSE(base::ReadFileToString(log_file_, &log));
+  size_t pos = 0;
+  while (pos < log.size()) {
+    KeyChanges changes;
+    size_t end = pos;
+    if (!ParseChanges(log, &end, &changes)) {
+      LOG(WARNING) << "Discarding " << log.size() - pos
+                   << " bytes of incomplete pref changes.";
+      break;
+    }
+    for (const auto& key_change : changes) {
+      if (key_change.second.deleted)
+        values_.erase(key_change.first);
+      else
+        values_[key_change.first] = key_change.second.value;
+    }
+    pos = end;
+  }
+
+  log_fd_ = HANDLE_EINTR(open(log_file_.value().c_str(), O_WRONLY | O_APPEND));
+  TEST_AND_RETURN_FALSE_ERRNO(log_fd_ >= 0);
+  // Drop the incomplete changes, if any, so the next ones can be read back.
+  if (pos < log.size())
+    TEST_AND_RETURN_FALSE_ERRNO(HANDLE_EINTR(ftruncate(log_fd_, pos)) == 0);
+  log_size_ = pos;
+  compaction_size_ = std::max(kMinLogCompactionSize, 2 * log_size_);
+  return true;
+}
+
+void LogPrefs::LogStorage::MigrateKeyFiles(const base::FilePath& prefs_dir) {
+  // Reading the keys through Prefs also applies its interrupted transaction,
+  // if any.
+  Prefs file_prefs;
+  file_prefs.Init(prefs_dir);
+  base::FileEnumerator files(prefs_dir, false, base::FileEnumerator::FILES);
+  for (base::FilePath file = files.Next(); !file.empty(); file = files.Next()) {
+    string key = file.BaseName().value();
+    string value;
+    if (IsValidKey(key) && file_prefs.GetString(key, &value))
+      values_[key] = value;
+  }
+}
+
+bool LogPrefs::LogStorage::GetKey(const string& key, string* value) const {
+  auto it = values_.find(key);
+  if (it == values_.end())
+    return false;
+  *value = it->second;
+  return true;
+}
+
+bool LogPrefs::LogStorage::SetKey(const string& key, const string& value) {
+  KeyChanges changes;
+  changes[key].value = value;
+  return CommitChanges(changes);
+}
+
+bool LogPrefs::LogStorage::KeyExists(const string& key) const {
+  return values_.find(key) != values_.end();
+}
+
+bool LogPrefs::LogStorage::DeleteKey(const string& key) {
+  if (values_.find(key) == values_.end())
+    return true;
+  KeyChanges changes;
+  changes[key].deleted = true;
+  return CommitChanges(changes);
+}
+
+bool LogPrefs::LogStorage::CommitChanges(const KeyChanges& changes) {
+  for (const auto& key_change : changes)
+    TEST_AND_RETURN_FALSE(IsValidKey(key_change.first));
+  return AppendChanges(changes);
+}
+
+bool LogPrefs::LogStorage::AppendChanges(const KeyChanges& changes) {
+  TEST_AND_RETURN_FALSE(log_fd_ >= 0);
+  string data = SerializeChanges(changes);
+  if (!utils::WriteAll(log_fd_, data.data(), data.size()) ||
+      fsync(log_fd_) != 0) {
+    PLOG(ERROR) << "Failed to append to " << log_file_.value();
+    // Drop what was written, so the next changes can be read back.
+    if (HANDLE_EINTR(ftruncate(log_fd_, log_size_)) != 0)
+      PLOG(ERROR) << "Failed to truncate " << log_file_.value();
+    return false;
+  }
+  log_size_ += data.size();
+
+  for (const auto& key_change : changes) {
+    if (key_change.second.deleted)
+      values_.erase(key_change.first);
+    else
+      values_[key_change.first] = key_change.second.value;
+  }
+
+  // The changes are already persisted, so a failed compaction is only logged.
+  if (log_size_ >= compaction_size_ && !Compact())
+    LOG(ERROR) << "Failed to compact " << log_file_.value();
+  return true;
+}
+
+bool LogPrefs::LogStorage::Compact() {
+  KeyChanges changes;
+  for (const auto& key_value : values_)
+    changes[key_value.first].value = key_value.second;
+  string data = SerializeChanges(changes);
+
+  base::FilePath new_log_file = log_file_.DirName().Append(kNewLogFileName);
+  int fd = HANDLE_EINTR(open(new_log_file.value().c_str(),
+                             O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                             0600));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  if (!utils::WriteAll(fd, data.data(), data.size()) || fsync(fd) != 0) {
+    PLOG(ERROR) << "Failed to write " << new_log_file.value();
+    IGNORE_EINTR(close(fd));
+    base::DeleteFile(new_log_file, false);
+    return false;
+  }
+  if (rename(new_log_file.value().c_str(), log_file_.value().c_str()) != 0) {
+    PLOG(ERROR) << "Failed to replace " << log_file_.value();
+    IGNORE_EINTR(close(fd));
+    base::DeleteFile(new_log_file, false);
+    return false;
+  }
+  // Persist the rename, so the changes appended to the new log aren't lost.
+  int dir_fd = HANDLE_EINTR(
+      open(log_file_.DirName().value().c_str(), O_RDONLY | O_DIRECTORY));
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    IGNORE_EINTR(close(dir_fd));
+  }
+
+  if (log_fd_ >= 0)
+    IGNORE_EINTR(close(log_fd_));
+  log_fd_ = fd;
+  log_size_ = data.size();
+  compaction_size_ = std::max(kMinLogCompactionSize, 2 * log_size_);
+  return true;
+}
+
 // MemoryPrefs
 
 bool MemoryPrefs::MemoryStorage::GetKey(const string& key,
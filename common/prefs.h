@@ -18,10 +18,12 @@
 #define UPDATE_ENGINE_COMMON_PREFS_H_
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 #include <base/files/file_path.h>
+#include <brillo/message_loops/message_loop.h>
 
 #include "gtest/gtest_prod.h"  // for FRIEND_TEST
 #include "update_engine/common/prefs_interface.h"
@@ -30,6 +32,12 @@ namespace chromeos_update_engine {
 
 // Implements a preference store by storing the value associated with a key
 // in a given storage passed during construction.
+//
+// When there's a current MessageLoop, the observers are notified from a task
+// posted on it rather than from the call changing the key, so a slow observer
+// doesn't hold up the writer. The notifications of a key changed several
+// times before the task runs are merged into one, reporting its current state,
+// so the observers always read the latest value.
 class PrefsBase : public PrefsInterface {
  public:
   // Storage interface used to set and retrieve keys.
@@ -53,11 +61,24 @@ class PrefsBase : public PrefsInterface {
     // key was deleted.
     virtual bool DeleteKey(const std::string& key) = 0;
 
+    // A change of a key made in a transaction: either its new |value| or, if
+    // |deleted|, its deletion.
+    struct KeyChange {
+      bool deleted{false};
+      std::string value;
+    };
+    using KeyChanges = std::map<std::string, KeyChange>;
+
+    // Applies all the |changes| atomically. The default implementation applies
+    // them one after the other. Returns whether all of them were applied.
+    virtual bool CommitChanges(const KeyChanges& changes);
+
    private:
     DISALLOW_COPY_AND_ASSIGN(StorageInterface);
   };
 
   explicit PrefsBase(StorageInterface* storage) : storage_(storage) {}
+  ~PrefsBase() override;
 
   // PrefsInterface methods.
   bool GetString(const std::string& key, std::string* value) const override;
@@ -70,15 +91,36 @@ class PrefsBase : public PrefsInterface {
   bool Exists(const std::string& key) const override;
   bool Delete(const std::string& key) override;
 
+  bool StartTransaction() override;
+  void CancelTransaction() override;
+  bool SubmitTransaction() override;
+
   void AddObserver(const std::string& key,
                    ObserverInterface* observer) override;
   void RemoveObserver(const std::string& key,
                       ObserverInterface* observer) override;
 
  private:
+  // Calls the OnPrefSet() or OnPrefDeleted() methods of the observers of
+  // |key|.
+  void NotifyObservers(const std::string& key, bool deleted);
+
+  // Notifies the observers of the keys in |pending_keys_| of their current
+  // state.
+  void DispatchNotifications();
+
   // The registered observers watching for changes.
   std::map<std::string, std::vector<ObserverInterface*>> observers_;
 
+  // The keys changed since the observers were last notified, and the task
+  // notifying them.
+  std::set<std::string> pending_keys_;
+  brillo::MessageLoop::TaskId notify_task_{brillo::MessageLoop::kTaskIdNull};
+
+  // The changes made in the transaction in progress, if |in_transaction_|.
+  bool in_transaction_{false};
+  StorageInterface::KeyChanges transaction_;
+
   // The concrete implementation of the storage used for the keys.
   StorageInterface* storage_;
 
@@ -114,6 +156,7 @@ class Prefs : public PrefsBase {
     bool SetKey(const std::string& key, const std::string& value) override;
     bool KeyExists(const std::string& key) const override;
     bool DeleteKey(const std::string& key) override;
+    bool CommitChanges(const KeyChanges& changes) override;
 
    private:
     FRIEND_TEST(PrefsTest, GetFileNameForKey);
@@ -125,6 +168,18 @@ class Prefs : public PrefsBase {
     bool GetFileNameForKey(const std::string& key,
                            base::FilePath* filename) const;
 
+    // Applies the changes recorded in the journal file left by a
+    // CommitChanges() call interrupted after writing it, if any, and removes
+    // the journal.
+    void ReplayJournal();
+
+    // Flushes the files of the keys set by |changes| and the prefs directory
+    // to disk. Returns whether all of them were flushed.
+    bool SyncChanges(const KeyChanges& changes) const;
+
+    // Returns the path of the journal file. Its name isn't a valid key.
+    base::FilePath GetJournalFileName() const;
+
     // Preference store directory.
     base::FilePath prefs_dir_;
   };
@@ -135,6 +190,73 @@ class Prefs : public PrefsBase {
   DISALLOW_COPY_AND_ASSIGN(Prefs);
 };
 
+// Implements a preference store by appending the changes of the keys to a
+// single log file under a preference store directory, and keeping all the
+// values in memory. Each change, or all the changes submitted in a transaction
+// together, take a single append and fsync(). The log is rewritten with only
+// the current values once it doubled in size since the last rewrite. A change
+// interrupted by a crash is discarded when the log is read back.
+
+class LogPrefs : public PrefsBase {
+ public:
+  LogPrefs() : PrefsBase(&log_storage_) {}
+
+  // Initializes the store from the log file in |prefs_dir|. If there's no log
+  // yet, the keys stored one file each by Prefs in |prefs_dir| are moved to a
+  // new log. Returns true on success, false otherwise.
+  bool Init(const base::FilePath& prefs_dir);
+
+ private:
+  class LogStorage : public PrefsBase::StorageInterface {
+   public:
+    LogStorage() = default;
+    ~LogStorage() override;
+
+    bool Init(const base::FilePath& prefs_dir);
+
+    // PrefsBase::StorageInterface overrides.
+    bool GetKey(const std::string& key, std::string* value) const override;
+    bool SetKey(const std::string& key, const std::string& value) override;
+    bool KeyExists(const std::string& key) const override;
+    bool DeleteKey(const std::string& key) override;
+    bool CommitChanges(const KeyChanges& changes) override;
+
+   private:
+    // Reads the log file into |values_|, truncating the partially written
+    // changes at its end, if any.
+    bool ReadLog();
+
+    // Moves the keys stored in separate files in |prefs_dir| to |values_|.
+    void MigrateKeyFiles(const base::FilePath& prefs_dir);
+
+    // Appends |changes| to the log and applies them to |values_|, compacting
+    // the log when it grew enough.
+    bool AppendChanges(const KeyChanges& changes);
+
+    // Atomically replaces the log with one holding only |values_|, and opens
+    // it for appending.
+    bool Compact();
+
+    // The log file, in the preference store directory.
+    base::FilePath log_file_;
+
+    // The log file opened for appending, or -1.
+    int log_fd_{-1};
+
+    // The size of the log, and the size it will be compacted at.
+    uint64_t log_size_{0};
+    uint64_t compaction_size_{0};
+
+    // The current values of the keys.
+    std::map<std::string, std::string> values_;
+  };
+
+  // The concrete log storage implementation.
+  LogStorage log_storage_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogPrefs);
+};
+
 // Implements a preference store in memory. The stored values are lost when the
 // object is destroyed.
 
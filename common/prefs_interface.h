@@ -79,6 +79,21 @@ class PrefsInterface {
   // this key. Calling with non-existent keys does nothing.
   virtual bool Delete(const std::string& key) = 0;
 
+  // Starts a transaction: the changes made by the following Set*() and
+  // Delete() calls are only persisted, all at once, by SubmitTransaction(), or
+  // dropped by CancelTransaction(). The Get*() and Exists() calls already see
+  // them. Returns false if a transaction is already in progress or if
+  // transactions aren't supported, in which case the changes are persisted as
+  // they are made.
+  virtual bool StartTransaction() = 0;
+
+  // Drops the changes made since StartTransaction().
+  virtual void CancelTransaction() = 0;
+
+  // Persists the changes made since StartTransaction() atomically: after a
+  // crash either all or none of them are persisted. Returns true on success.
+  virtual bool SubmitTransaction() = 0;
+
   // Add an observer to watch whenever the given |key| is modified. The
   // OnPrefSet() and OnPrefDelete() methods will be called whenever any of the
   // Set*() methods or the Delete() method are called on the given key,
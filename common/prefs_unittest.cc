@@ -24,8 +24,11 @@
 #include <base/files/file_util.h>
 #include <base/files/scoped_temp_dir.h>
 #include <base/macros.h>
+#include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -325,6 +328,34 @@ TEST_F(PrefsTest, RemovedObserversNotCalled) {
   EXPECT_TRUE(prefs_.SetString(kKey, "yet another value"));
 }
 
+TEST_F(PrefsTest, ObserversCalledFromMessageLoop) {
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  MockPrefsObserver mock_obserser;
+  prefs_.AddObserver(kKey, &mock_obserser);
+
+  // The changes made before the observers run are merged into one call
+  // reporting the current state.
+  EXPECT_CALL(mock_obserser, OnPrefSet(_)).Times(0);
+  EXPECT_CALL(mock_obserser, OnPrefDeleted(_)).Times(0);
+  EXPECT_TRUE(prefs_.SetString(kKey, "value"));
+  EXPECT_TRUE(prefs_.Delete(kKey));
+  EXPECT_TRUE(prefs_.SetString(kKey, "other value"));
+  testing::Mock::VerifyAndClearExpectations(&mock_obserser);
+
+  EXPECT_CALL(mock_obserser, OnPrefSet(Eq(kKey)));
+  EXPECT_CALL(mock_obserser, OnPrefDeleted(_)).Times(0);
+  brillo::MessageLoopRunMaxIterations(&loop, 10);
+  testing::Mock::VerifyAndClearExpectations(&mock_obserser);
+
+  // Removed observers aren't called, even for earlier changes.
+  EXPECT_TRUE(prefs_.Delete(kKey));
+  prefs_.RemoveObserver(kKey, &mock_obserser);
+  EXPECT_CALL(mock_obserser, OnPrefDeleted(_)).Times(0);
+  brillo::MessageLoopRunMaxIterations(&loop, 10);
+  EXPECT_FALSE(loop.PendingTasks());
+}
+
 TEST_F(PrefsTest, UnsuccessfulCallsNotObserved) {
   MockPrefsObserver mock_obserser;
   const char kInvalidKey[] = "no spaces or .";
@@ -338,6 +369,204 @@ TEST_F(PrefsTest, UnsuccessfulCallsNotObserved) {
   prefs_.RemoveObserver(kInvalidKey, &mock_obserser);
 }
 
+TEST_F(PrefsTest, SubmitTransactionTest) {
+  const char kOtherKey[] = "other-key";
+  ASSERT_TRUE(prefs_.SetInt64(kOtherKey, 1));
+  MockPrefsObserver mock_obserser;
+  prefs_.AddObserver(kKey, &mock_obserser);
+
+  EXPECT_TRUE(prefs_.StartTransaction());
+  EXPECT_FALSE(prefs_.StartTransaction());
+  EXPECT_CALL(mock_obserser, OnPrefSet(_)).Times(0);
+  EXPECT_TRUE(prefs_.SetString(kKey, "value"));
+  EXPECT_TRUE(prefs_.Delete(kOtherKey));
+  // The changes are visible but not persisted yet.
+  string value;
+  EXPECT_TRUE(prefs_.GetString(kKey, &value));
+  EXPECT_EQ("value", value);
+  EXPECT_FALSE(prefs_.Exists(kOtherKey));
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append(kKey)));
+  EXPECT_TRUE(base::PathExists(prefs_dir_.Append(kOtherKey)));
+  testing::Mock::VerifyAndClearExpectations(&mock_obserser);
+
+  EXPECT_CALL(mock_obserser, OnPrefSet(Eq(kKey)));
+  EXPECT_TRUE(prefs_.SubmitTransaction());
+  EXPECT_TRUE(base::ReadFileToString(prefs_dir_.Append(kKey), &value));
+  EXPECT_EQ("value", value);
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append(kOtherKey)));
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append("transaction.journal")));
+  EXPECT_FALSE(prefs_.SubmitTransaction());
+
+  prefs_.RemoveObserver(kKey, &mock_obserser);
+}
+
+TEST_F(PrefsTest, CancelTransactionTest) {
+  ASSERT_TRUE(prefs_.SetInt64(kKey, 1));
+  EXPECT_TRUE(prefs_.StartTransaction());
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 2));
+  prefs_.CancelTransaction();
+
+  int64_t value = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kKey, &value));
+  EXPECT_EQ(1, value);
+  // A new transaction can be started after Cancel.
+  EXPECT_TRUE(prefs_.StartTransaction());
+  prefs_.CancelTransaction();
+}
+
+TEST_F(PrefsTest, ReplaysJournalOnInitTest) {
+  const char kOtherKey[] = "other-key";
+  ASSERT_TRUE(SetValue(kOtherKey, "old"));
+  // A journal left by a transaction interrupted while applying its changes.
+  const string journal = string("S ") + kKey + " 5\nab\ncd\nD " + kOtherKey +
+                         "\nE\n";
+  ASSERT_TRUE(SetValue("transaction.journal", journal));
+
+  Prefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kKey, &value));
+  EXPECT_EQ("ab\ncd", value);
+  EXPECT_FALSE(prefs.Exists(kOtherKey));
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append("transaction.journal")));
+}
+
+TEST_F(PrefsTest, DiscardsIncompleteJournalOnInitTest) {
+  ASSERT_TRUE(SetValue(kKey, "old"));
+  ASSERT_TRUE(SetValue("transaction.journal", string("S ") + kKey + " 3\nnew"));
+
+  Prefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kKey, &value));
+  EXPECT_EQ("old", value);
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append("transaction.journal")));
+}
+
+class LogPrefsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    prefs_dir_ = temp_dir_.GetPath();
+    log_file_ = prefs_dir_.Append("prefs.log");
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath prefs_dir_;
+  base::FilePath log_file_;
+};
+
+TEST_F(LogPrefsTest, BasicTest) {
+  const char kOtherKey[] = "other-key";
+  {
+    LogPrefs prefs;
+    ASSERT_TRUE(prefs.Init(prefs_dir_));
+    EXPECT_TRUE(prefs.SetString(kKey, "ab\ncd"));
+    EXPECT_TRUE(prefs.SetInt64(kOtherKey, 1));
+    EXPECT_TRUE(prefs.SetInt64(kOtherKey, 2));
+    EXPECT_TRUE(prefs.Delete(kKey));
+    EXPECT_FALSE(prefs.Exists(kKey));
+    EXPECT_TRUE(prefs.SetString(kKey, "ab\ncd"));
+    EXPECT_FALSE(prefs.SetString("bad.key", "value"));
+  }
+  // The keys are only stored in the log.
+  EXPECT_TRUE(base::PathExists(log_file_));
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append(kKey)));
+
+  LogPrefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kKey, &value));
+  EXPECT_EQ("ab\ncd", value);
+  int64_t int_value = 0;
+  EXPECT_TRUE(prefs.GetInt64(kOtherKey, &int_value));
+  EXPECT_EQ(2, int_value);
+}
+
+TEST_F(LogPrefsTest, MigratesKeyFilesTest) {
+  {
+    Prefs file_prefs;
+    ASSERT_TRUE(file_prefs.Init(prefs_dir_));
+    ASSERT_TRUE(file_prefs.SetInt64(kKey, 1234));
+  }
+
+  LogPrefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  int64_t value = 0;
+  EXPECT_TRUE(prefs.GetInt64(kKey, &value));
+  EXPECT_EQ(1234, value);
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append(kKey)));
+  EXPECT_TRUE(base::PathExists(log_file_));
+}
+
+TEST_F(LogPrefsTest, DiscardsIncompleteChangesTest) {
+  {
+    LogPrefs prefs;
+    ASSERT_TRUE(prefs.Init(prefs_dir_));
+    ASSERT_TRUE(prefs.SetString(kKey, "old"));
+  }
+  // Changes interrupted while being appended.
+  const string partial = string("S ") + kKey + " 3\nne";
+  ASSERT_TRUE(base::AppendToFile(log_file_, partial.data(), partial.size()));
+
+  const char kOtherKey[] = "other-key";
+  {
+    LogPrefs prefs;
+    ASSERT_TRUE(prefs.Init(prefs_dir_));
+    string value;
+    EXPECT_TRUE(prefs.GetString(kKey, &value));
+    EXPECT_EQ("old", value);
+    EXPECT_TRUE(prefs.SetString(kOtherKey, "new"));
+  }
+  // The changes made after the discarded ones are read back.
+  LogPrefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kOtherKey, &value));
+  EXPECT_EQ("new", value);
+}
+
+TEST_F(LogPrefsTest, TransactionTest) {
+  const char kOtherKey[] = "other-key";
+  {
+    LogPrefs prefs;
+    ASSERT_TRUE(prefs.Init(prefs_dir_));
+    ASSERT_TRUE(prefs.SetString(kKey, "old"));
+    EXPECT_TRUE(prefs.StartTransaction());
+    EXPECT_TRUE(prefs.Delete(kKey));
+    EXPECT_TRUE(prefs.SetString(kOtherKey, "new"));
+    EXPECT_TRUE(prefs.SubmitTransaction());
+  }
+
+  LogPrefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  EXPECT_FALSE(prefs.Exists(kKey));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kOtherKey, &value));
+  EXPECT_EQ("new", value);
+}
+
+TEST_F(LogPrefsTest, CompactionTest) {
+  const string kValue(1024, 'x');
+  {
+    LogPrefs prefs;
+    ASSERT_TRUE(prefs.Init(prefs_dir_));
+    for (int i = 0; i < 200; i++)
+      ASSERT_TRUE(prefs.SetString(kKey, kValue + base::IntToString(i)));
+  }
+  // The log was rewritten with only the last value.
+  int64_t log_size = 0;
+  EXPECT_TRUE(base::GetFileSize(log_file_, &log_size));
+  EXPECT_GT(100 * kValue.size(), static_cast<uint64_t>(log_size));
+  EXPECT_FALSE(base::PathExists(prefs_dir_.Append("prefs.log.new")));
+
+  LogPrefs prefs;
+  ASSERT_TRUE(prefs.Init(prefs_dir_));
+  string value;
+  EXPECT_TRUE(prefs.GetString(kKey, &value));
+  EXPECT_EQ(kValue + "199", value);
+}
+
 class MemoryPrefsTest : public ::testing::Test {
  protected:
   MemoryPrefs prefs_;
@@ -358,4 +587,20 @@ TEST_F(MemoryPrefsTest, BasicTest) {
   EXPECT_FALSE(prefs_.Delete(kKey));
 }
 
+TEST_F(MemoryPrefsTest, TransactionTest) {
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 1));
+  EXPECT_TRUE(prefs_.StartTransaction());
+  EXPECT_TRUE(prefs_.Delete(kKey));
+  EXPECT_FALSE(prefs_.Exists(kKey));
+  prefs_.CancelTransaction();
+  EXPECT_TRUE(prefs_.Exists(kKey));
+
+  EXPECT_TRUE(prefs_.StartTransaction());
+  EXPECT_TRUE(prefs_.SetInt64(kKey, 2));
+  EXPECT_TRUE(prefs_.SubmitTransaction());
+  int64_t value = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kKey, &value));
+  EXPECT_EQ(2, value);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,81 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/progress_sampler.h"
+
+#include <base/bind.h>
+#include <base/location.h>
+
+using brillo::MessageLoop;
+
+namespace chromeos_update_engine {
+
+ProgressSampler::~ProgressSampler() {
+  if (sample_task_ != MessageLoop::kTaskIdNull)
+    MessageLoop::current()->CancelTask(sample_task_);
+}
+
+void ProgressSampler::Add(uint64_t units) {
+  progressed_.fetch_add(units, std::memory_order_relaxed);
+  done_.fetch_add(units, std::memory_order_relaxed);
+  changed_.store(true, std::memory_order_release);
+  if (interval_.is_zero())
+    Sample();
+}
+
+void ProgressSampler::Update(uint64_t units, uint64_t done, uint64_t total) {
+  progressed_.fetch_add(units, std::memory_order_relaxed);
+  done_.store(done, std::memory_order_relaxed);
+  total_.store(total, std::memory_order_relaxed);
+  changed_.store(true, std::memory_order_release);
+  if (interval_.is_zero())
+    Sample();
+}
+
+void ProgressSampler::Start() {
+  if (interval_.is_zero() || sample_task_ != MessageLoop::kTaskIdNull)
+    return;
+  sample_task_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ProgressSampler::OnSampleTimeout, base::Unretained(this)),
+      interval_);
+}
+
+void ProgressSampler::Stop() {
+  if (sample_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(sample_task_);
+    sample_task_ = MessageLoop::kTaskIdNull;
+  }
+  Sample();
+}
+
+void ProgressSampler::Sample() {
+  if (!changed_.exchange(false, std::memory_order_acquire))
+    return;
+  callback_.Run(progressed_.exchange(0, std::memory_order_relaxed),
+                done_.load(std::memory_order_relaxed),
+                total_.load(std::memory_order_relaxed));
+}
+
+void ProgressSampler::OnSampleTimeout() {
+  sample_task_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ProgressSampler::OnSampleTimeout, base::Unretained(this)),
+      interval_);
+  Sample();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,89 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_PROGRESS_SAMPLER_H_
+#define UPDATE_ENGINE_COMMON_PROGRESS_SAMPLER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+namespace chromeos_update_engine {
+
+// Collects the progress of a task in atomic counters, which any thread can
+// update without a lock, and reports it from the main loop every |interval|,
+// so the producers of progress don't post a task or notify the observers for
+// every chunk they process. The progress is made of the units processed since
+// the last report and the position of the task, |done| of |total| units.
+// With a zero |interval|, every update is reported right away, on the thread
+// calling it.
+class ProgressSampler {
+ public:
+  // Called with the units processed since the last report and the position.
+  using Callback =
+      base::Callback<void(uint64_t progressed, uint64_t done, uint64_t total)>;
+
+  ProgressSampler(base::TimeDelta interval, const Callback& callback)
+      : interval_(interval), callback_(callback) {}
+  ~ProgressSampler();
+
+  // Records that |units| more units were processed, moving the position by
+  // as many. Can be called from any thread.
+  void Add(uint64_t units);
+
+  // Records that |units| more units were processed, at the position |done| of
+  // |total|, for a task which may jump to another position, like a download
+  // resumed at an offset. Can be called from any thread, but the position of
+  // the last call wins.
+  void Update(uint64_t units, uint64_t done, uint64_t total);
+
+  // Starts reporting the progress from the current message loop. Does
+  // nothing if already started or reporting every update.
+  void Start();
+
+  // Reports the progress not reported yet, if any, and stops the reports
+  // until started again.
+  void Stop();
+
+  // Reports the progress not reported yet, if any.
+  void Sample();
+
+ private:
+  // Reports the progress and schedules the next report.
+  void OnSampleTimeout();
+
+  const base::TimeDelta interval_;
+  const Callback callback_;
+
+  std::atomic<uint64_t> progressed_{0};
+  std::atomic<uint64_t> done_{0};
+  std::atomic<uint64_t> total_{0};
+  // Set by the updates and cleared by the reports.
+  std::atomic<bool> changed_{false};
+
+  brillo::MessageLoop::TaskId sample_task_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(ProgressSampler);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_PROGRESS_SAMPLER_H_
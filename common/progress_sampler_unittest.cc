@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/progress_sampler.h"
+
+#include <thread>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/test/simple_test_clock.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+using base::TimeDelta;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+const TimeDelta kInterval = TimeDelta::FromMilliseconds(100);
+}  // namespace
+
+class ProgressSamplerTest : public ::testing::Test {
+ protected:
+  struct Report {
+    uint64_t progressed;
+    uint64_t done;
+    uint64_t total;
+  };
+
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  ProgressSampler::Callback ReportCallback() {
+    return base::Bind(&ProgressSamplerTest::OnReport, base::Unretained(this));
+  }
+
+  void OnReport(uint64_t progressed, uint64_t done, uint64_t total) {
+    reports_.push_back({progressed, done, total});
+  }
+
+  // Advances the loop clock by |delta| and runs the tasks due.
+  void Advance(TimeDelta delta) {
+    test_clock_.Advance(delta);
+    brillo::MessageLoopRunMaxIterations(&loop_, 10);
+  }
+
+  base::SimpleTestClock test_clock_;
+  brillo::FakeMessageLoop loop_{&test_clock_};
+  vector<Report> reports_;
+};
+
+TEST_F(ProgressSamplerTest, ReportsEveryUpdateWithoutIntervalTest) {
+  ProgressSampler sampler(TimeDelta(), ReportCallback());
+  sampler.Start();
+  EXPECT_FALSE(loop_.PendingTasks());
+  sampler.Update(10, 10, 100);
+  sampler.Update(5, 40, 100);
+  ASSERT_EQ(2U, reports_.size());
+  EXPECT_EQ(5U, reports_[1].progressed);
+  EXPECT_EQ(40U, reports_[1].done);
+  EXPECT_EQ(100U, reports_[1].total);
+  // Nothing is left to report.
+  sampler.Stop();
+  EXPECT_EQ(2U, reports_.size());
+}
+
+TEST_F(ProgressSamplerTest, ReportsOncePerIntervalTest) {
+  ProgressSampler sampler(kInterval, ReportCallback());
+  sampler.Start();
+  sampler.Update(10, 10, 100);
+  sampler.Update(20, 30, 100);
+  EXPECT_TRUE(reports_.empty());
+
+  Advance(kInterval);
+  ASSERT_EQ(1U, reports_.size());
+  EXPECT_EQ(30U, reports_[0].progressed);
+  EXPECT_EQ(30U, reports_[0].done);
+  EXPECT_EQ(100U, reports_[0].total);
+  // Without progress, nothing is reported.
+  Advance(kInterval);
+  EXPECT_EQ(1U, reports_.size());
+
+  // Stopping reports the last progress right away.
+  sampler.Update(70, 100, 100);
+  sampler.Stop();
+  ASSERT_EQ(2U, reports_.size());
+  EXPECT_EQ(70U, reports_[1].progressed);
+  EXPECT_EQ(100U, reports_[1].done);
+}
+
+TEST_F(ProgressSamplerTest, AddFromThreadsTest) {
+  ProgressSampler sampler(kInterval, ReportCallback());
+  sampler.Start();
+  vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&sampler] {
+      for (int j = 0; j < 1000; j++)
+        sampler.Add(1);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  Advance(kInterval);
+  ASSERT_EQ(1U, reports_.size());
+  EXPECT_EQ(4000U, reports_[0].progressed);
+  EXPECT_EQ(4000U, reports_[0].done);
+  sampler.Stop();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,249 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/resource_scheduler.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+
+#include <base/bind.h>
+#include <base/files/file_enumerator.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
+
+using base::FilePath;
+using brillo::MessageLoop;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The nice values of the postinstall processes. The processes started by
+// update_engine otherwise inherit its default priority.
+const int kIdleNice = 0;
+const int kBackgroundNice = 10;
+const int kThrottledNice = 19;
+
+// Reads the sysfs attribute |name| of the device |dir| into |value|, without
+// the trailing newline.
+bool ReadAttribute(const FilePath& dir, const string& name, string* value) {
+  if (!base::ReadFileToString(dir.Append(name), value))
+    return false;
+  base::TrimWhitespaceASCII(*value, base::TRIM_ALL, value);
+  return true;
+}
+
+// Reads the sysfs attribute |name| of the device |dir| as an integer.
+bool ReadIntAttribute(const FilePath& dir, const string& name, int* value) {
+  string str;
+  return ReadAttribute(dir, name, &str) && base::StringToInt(str, value);
+}
+
+}  // namespace
+
+bool ReadSysfsDeviceActivity(const FilePath& sysfs_class_dir,
+                             DeviceActivity* activity) {
+  *activity = DeviceActivity();
+  bool found = false;
+
+  const FilePath power_supply_dir = sysfs_class_dir.Append("power_supply");
+  if (base::DirectoryExists(power_supply_dir)) {
+    found = true;
+    base::FileEnumerator supplies(
+        power_supply_dir,
+        false,
+        base::FileEnumerator::FILES | base::FileEnumerator::DIRECTORIES);
+    for (FilePath supply = supplies.Next(); !supply.empty();
+         supply = supplies.Next()) {
+      string type;
+      int online;
+      if (!ReadAttribute(supply, "type", &type) ||
+          !ReadIntAttribute(supply, "online", &online) || online == 0) {
+        continue;
+      }
+      // The USB supplies have types like USB, USB_DCP or USB_PD.
+      if (type == "Mains" || type == "Wireless" ||
+          base::StartsWith(type, "USB", base::CompareCase::SENSITIVE)) {
+        activity->on_ac_power = true;
+      }
+    }
+  }
+
+  const FilePath backlight_dir = sysfs_class_dir.Append("backlight");
+  if (base::DirectoryExists(backlight_dir)) {
+    found = true;
+    bool has_backlight = false;
+    bool any_on = false;
+    base::FileEnumerator backlights(
+        backlight_dir,
+        false,
+        base::FileEnumerator::FILES | base::FileEnumerator::DIRECTORIES);
+    for (FilePath backlight = backlights.Next(); !backlight.empty();
+         backlight = backlights.Next()) {
+      int brightness;
+      if (!ReadIntAttribute(backlight, "brightness", &brightness))
+        continue;
+      has_backlight = true;
+      if (brightness > 0)
+        any_on = true;
+    }
+    // Without a backlight to tell, the screen is assumed to be in use.
+    activity->screen_on = !has_backlight || any_on;
+  }
+
+  const FilePath thermal_dir = sysfs_class_dir.Append("thermal");
+  if (base::DirectoryExists(thermal_dir)) {
+    found = true;
+    base::FileEnumerator devices(
+        thermal_dir,
+        false,
+        base::FileEnumerator::FILES | base::FileEnumerator::DIRECTORIES);
+    for (FilePath device = devices.Next(); !device.empty();
+         device = devices.Next()) {
+      if (!base::StartsWith(device.BaseName().value(),
+                            "cooling_device",
+                            base::CompareCase::SENSITIVE)) {
+        continue;
+      }
+      // A spinning fan is not a sign of throttling, unlike the CPU and GPU
+      // frequency limits.
+      string type;
+      if (ReadAttribute(device, "type", &type) &&
+          base::ToLowerASCII(type).find("fan") != string::npos) {
+        continue;
+      }
+      int cur_state;
+      if (ReadIntAttribute(device, "cur_state", &cur_state) && cur_state > 0)
+        activity->thermal_throttled = true;
+    }
+  }
+  return found;
+}
+
+bool ResourceBudget::operator==(const ResourceBudget& other) const {
+  return cpu_shares == other.cpu_shares && io_priority == other.io_priority &&
+         postinstall_nice == other.postinstall_nice &&
+         max_apply_threads == other.max_apply_threads;
+}
+
+const base::TimeDelta ResourceScheduler::kPollInterval =
+    base::TimeDelta::FromSeconds(60);
+
+ResourceScheduler::~ResourceScheduler() {
+  Stop();
+}
+
+ResourceBudget ResourceScheduler::BudgetForActivity(
+    const DeviceActivity& activity) {
+  if (activity.thermal_throttled)
+    return {CpuShares::kLow, IoPriority::kLow, kThrottledNice, 1};
+  if (activity.on_ac_power && !activity.screen_on) {
+    return {CpuShares::kNormal,
+            IoPriority::kNormal,
+            kIdleNice,
+            std::numeric_limits<uint32_t>::max()};
+  }
+  return {CpuShares::kLow, IoPriority::kLow, kBackgroundNice, 1};
+}
+
+void ResourceScheduler::Start() {
+  if (poll_task_ != MessageLoop::kTaskIdNull)
+    return;
+  UpdateBudget(true);
+  poll_task_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ResourceScheduler::OnPollTimeout, base::Unretained(this)),
+      kPollInterval);
+}
+
+void ResourceScheduler::Stop() {
+  if (poll_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(poll_task_);
+    poll_task_ = MessageLoop::kTaskIdNull;
+  }
+}
+
+void ResourceScheduler::SetPerformanceMode(bool enable) {
+  if (performance_mode_ == enable)
+    return;
+  performance_mode_ = enable;
+  UpdateBudget(true);
+}
+
+void ResourceScheduler::RegisterProcess(pid_t pid) {
+  processes_.insert(pid);
+  ApplyToProcess(pid);
+}
+
+void ResourceScheduler::UnregisterProcess(pid_t pid) {
+  processes_.erase(pid);
+}
+
+uint32_t ResourceScheduler::LimitApplyThreads(uint32_t requested) const {
+  return std::min(requested, budget_.max_apply_threads);
+}
+
+void ResourceScheduler::UpdateBudget(bool force) {
+  DeviceActivity activity;
+  if (performance_mode_) {
+    activity.on_ac_power = true;
+    activity.screen_on = false;
+  } else if (!hardware_->GetDeviceActivity(&activity)) {
+    // Assume the device is in use when its state is unknown.
+    activity = DeviceActivity();
+  }
+
+  const ResourceBudget budget = BudgetForActivity(activity);
+  if (!force && budget == budget_)
+    return;
+  LOG(INFO) << "Device activity: on AC power=" << activity.on_ac_power
+            << ", screen on=" << activity.screen_on
+            << ", thermal throttled=" << activity.thermal_throttled
+            << "; update CPU shares=" << static_cast<int>(budget.cpu_shares)
+            << ", postinstall nice=" << budget.postinstall_nice;
+  budget_ = budget;
+
+  if (cpu_limiter_)
+    cpu_limiter_->SetCpuShares(budget_.cpu_shares);
+  if (io_limiter_)
+    io_limiter_->SetPerformanceMode(budget_.io_priority == IoPriority::kNormal);
+  for (pid_t pid : processes_)
+    ApplyToProcess(pid);
+}
+
+void ResourceScheduler::ApplyToProcess(pid_t pid) const {
+  if (setpriority(PRIO_PROCESS, pid, budget_.postinstall_nice) != 0) {
+    PLOG(WARNING) << "Failed to set the nice value of process " << pid
+                  << " to " << budget_.postinstall_nice;
+  }
+  SetIoPriority(pid, budget_.io_priority);
+}
+
+void ResourceScheduler::OnPollTimeout() {
+  poll_task_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ResourceScheduler::OnPollTimeout, base::Unretained(this)),
+      kPollInterval);
+  UpdateBudget(false);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_RESOURCE_SCHEDULER_H_
+#define UPDATE_ENGINE_COMMON_RESOURCE_SCHEDULER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <set>
+
+#include <base/files/file_path.h>
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+#include "update_engine/common/cpu_limiter.h"
+#include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/io_limiter.h"
+
+namespace chromeos_update_engine {
+
+// Reads the DeviceActivity from the power_supply, backlight and thermal
+// classes under |sysfs_class_dir|, normally /sys/class. The device is
+// considered on AC power if any mains, USB or wireless supply is online, its
+// screen off if it has backlights and all of them are off, and throttled if any
+// cooling device is active. Returns false if none of the classes is present.
+bool ReadSysfsDeviceActivity(const base::FilePath& sysfs_class_dir,
+                             DeviceActivity* activity);
+
+// The share of the device resources the update is allowed to use.
+struct ResourceBudget {
+  CpuShares cpu_shares;
+  IoPriority io_priority;
+  // The nice value of the postinstall processes.
+  int postinstall_nice;
+  // The maximum number of threads applying the payload operations.
+  uint32_t max_apply_threads;
+
+  bool operator==(const ResourceBudget& other) const;
+  bool operator!=(const ResourceBudget& other) const {
+    return !(*this == other);
+  }
+};
+
+// Shifts the resources used by the update, the postinstall processes and the
+// payload apply workers to the times the device is idle. While running, it
+// polls the DeviceActivity reported by the HardwareInterface and, when the
+// budget changes, applies it to the CPULimiter cgroup shares, the IOLimiter
+// mode and the priority of the registered processes. The update gets the
+// full resources while the device is charging with the screen off, or in
+// performance mode, and the least while the device is thermally throttled.
+class ResourceScheduler {
+ public:
+  // How often the device activity is polled while running.
+  static const base::TimeDelta kPollInterval;
+
+  // The |cpu_limiter| and |io_limiter| are not owned and may be null, in
+  // which case the matching part of the budget isn't applied.
+  ResourceScheduler(HardwareInterface* hardware,
+                    CPULimiter* cpu_limiter,
+                    IOLimiter* io_limiter)
+      : hardware_(hardware),
+        cpu_limiter_(cpu_limiter),
+        io_limiter_(io_limiter) {}
+  ~ResourceScheduler();
+
+  // Returns the budget for a device in the state |activity|.
+  static ResourceBudget BudgetForActivity(const DeviceActivity& activity);
+
+  // Applies the budget for the current device activity and polls it every
+  // kPollInterval until Stop() is called.
+  void Start();
+  void Stop();
+
+  // Forces the full budget while |enable| is set, regardless of the device
+  // activity.
+  void SetPerformanceMode(bool enable);
+
+  // Adds the process |pid| to the ones whose CPU and I/O priority follow the
+  // budget, setting them right away, and removes it. A process must be
+  // removed before it is reaped, so its pid isn't reused.
+  void RegisterProcess(pid_t pid);
+  void UnregisterProcess(pid_t pid);
+
+  // Returns |requested| capped to the number of apply threads of the budget.
+  uint32_t LimitApplyThreads(uint32_t requested) const;
+
+  const ResourceBudget& budget() const { return budget_; }
+
+ private:
+  // Reads the device activity and applies the resulting budget if it
+  // changed, or if |force| is set.
+  void UpdateBudget(bool force);
+
+  // Sets the priorities of the process |pid| to the ones in the budget.
+  void ApplyToProcess(pid_t pid) const;
+
+  // Polls the device activity and schedules the next poll.
+  void OnPollTimeout();
+
+  HardwareInterface* hardware_;
+  CPULimiter* cpu_limiter_;
+  IOLimiter* io_limiter_;
+
+  bool performance_mode_{false};
+  ResourceBudget budget_ = BudgetForActivity(DeviceActivity());
+  std::set<pid_t> processes_;
+
+  brillo::MessageLoop::TaskId poll_task_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(ResourceScheduler);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_RESOURCE_SCHEDULER_H_
@@ -0,0 +1,166 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/resource_scheduler.h"
+
+#include <string>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <base/test/simple_test_clock.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/test_utils.h"
+
+using base::FilePath;
+using brillo::MessageLoop;
+using std::string;
+
+namespace chromeos_update_engine {
+
+class ResourceSchedulerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+  }
+
+  void TearDown() override {
+    scheduler_.Stop();
+    EXPECT_FALSE(loop_.PendingTasks());
+  }
+
+  // Writes the sysfs attribute |name| with |value| under the |device| path
+  // relative to the temporary sysfs class directory.
+  void WriteAttribute(const string& device,
+                      const string& name,
+                      const string& value) {
+    const FilePath dir = temp_dir_.GetPath().Append(device);
+    ASSERT_TRUE(base::CreateDirectory(dir));
+    ASSERT_TRUE(
+        test_utils::WriteFileString(dir.Append(name).value(), value + "\n"));
+  }
+
+  // Advances the loop clock by |delta| and runs the tasks due.
+  void Advance(base::TimeDelta delta) {
+    test_clock_.Advance(delta);
+    brillo::MessageLoopRunMaxIterations(&loop_, 10);
+  }
+
+  base::SimpleTestClock test_clock_;
+  brillo::FakeMessageLoop loop_{&test_clock_};
+  base::ScopedTempDir temp_dir_;
+  FakeHardware fake_hardware_;
+  IOLimiter io_limiter_;
+  ResourceScheduler scheduler_{&fake_hardware_, nullptr, &io_limiter_};
+};
+
+TEST_F(ResourceSchedulerTest, ReadSysfsDeviceActivityTest) {
+  DeviceActivity activity;
+  EXPECT_FALSE(ReadSysfsDeviceActivity(temp_dir_.GetPath(), &activity));
+
+  WriteAttribute("power_supply/battery", "type", "Battery");
+  WriteAttribute("power_supply/battery", "online", "1");
+  WriteAttribute("power_supply/usb", "type", "USB_DCP");
+  WriteAttribute("power_supply/usb", "online", "0");
+  WriteAttribute("backlight/panel0", "brightness", "120");
+  WriteAttribute("thermal/cooling_device0", "type", "Fan");
+  WriteAttribute("thermal/cooling_device0", "cur_state", "2");
+  WriteAttribute("thermal/cooling_device1", "type", "thermal-cpufreq-0");
+  WriteAttribute("thermal/cooling_device1", "cur_state", "0");
+  WriteAttribute("thermal/thermal_zone0", "cur_state", "1");
+  EXPECT_TRUE(ReadSysfsDeviceActivity(temp_dir_.GetPath(), &activity));
+  EXPECT_FALSE(activity.on_ac_power);
+  EXPECT_TRUE(activity.screen_on);
+  // Neither the fan nor the thermal zones count as throttling.
+  EXPECT_FALSE(activity.thermal_throttled);
+
+  WriteAttribute("power_supply/usb", "online", "1");
+  WriteAttribute("backlight/panel0", "brightness", "0");
+  WriteAttribute("thermal/cooling_device1", "cur_state", "3");
+  EXPECT_TRUE(ReadSysfsDeviceActivity(temp_dir_.GetPath(), &activity));
+  EXPECT_TRUE(activity.on_ac_power);
+  EXPECT_FALSE(activity.screen_on);
+  EXPECT_TRUE(activity.thermal_throttled);
+}
+
+TEST_F(ResourceSchedulerTest, BudgetForActivityTest) {
+  DeviceActivity activity;
+  ResourceBudget budget = ResourceScheduler::BudgetForActivity(activity);
+  EXPECT_EQ(CpuShares::kLow, budget.cpu_shares);
+  EXPECT_EQ(IoPriority::kLow, budget.io_priority);
+  EXPECT_EQ(1U, budget.max_apply_threads);
+
+  // Charging but in use.
+  activity.on_ac_power = true;
+  EXPECT_EQ(budget, ResourceScheduler::BudgetForActivity(activity));
+
+  // Idle on a charger.
+  activity.screen_on = false;
+  ResourceBudget idle_budget = ResourceScheduler::BudgetForActivity(activity);
+  EXPECT_EQ(CpuShares::kNormal, idle_budget.cpu_shares);
+  EXPECT_EQ(IoPriority::kNormal, idle_budget.io_priority);
+  EXPECT_LT(idle_budget.postinstall_nice, budget.postinstall_nice);
+  EXPECT_LT(1U, idle_budget.max_apply_threads);
+
+  // Throttling takes precedence.
+  activity.thermal_throttled = true;
+  ResourceBudget throttled_budget =
+      ResourceScheduler::BudgetForActivity(activity);
+  EXPECT_EQ(CpuShares::kLow, throttled_budget.cpu_shares);
+  EXPECT_GT(throttled_budget.postinstall_nice, budget.postinstall_nice);
+  EXPECT_EQ(1U, throttled_budget.max_apply_threads);
+}
+
+TEST_F(ResourceSchedulerTest, FollowsDeviceActivityTest) {
+  scheduler_.Start();
+  EXPECT_FALSE(io_limiter_.performance_mode());
+  EXPECT_EQ(1U, scheduler_.LimitApplyThreads(4));
+
+  DeviceActivity idle;
+  idle.on_ac_power = true;
+  idle.screen_on = false;
+  fake_hardware_.SetDeviceActivity(idle);
+  // The change is only seen on the next poll.
+  Advance(ResourceScheduler::kPollInterval / 2);
+  EXPECT_FALSE(io_limiter_.performance_mode());
+  Advance(ResourceScheduler::kPollInterval / 2);
+  EXPECT_TRUE(io_limiter_.performance_mode());
+  EXPECT_EQ(4U, scheduler_.LimitApplyThreads(4));
+
+  fake_hardware_.SetDeviceActivity(DeviceActivity());
+  Advance(ResourceScheduler::kPollInterval);
+  EXPECT_FALSE(io_limiter_.performance_mode());
+
+  // No more polls once stopped.
+  scheduler_.Stop();
+  EXPECT_FALSE(loop_.PendingTasks());
+}
+
+TEST_F(ResourceSchedulerTest, PerformanceModeTest) {
+  scheduler_.SetPerformanceMode(true);
+  EXPECT_TRUE(io_limiter_.performance_mode());
+  EXPECT_EQ(CpuShares::kNormal, scheduler_.budget().cpu_shares);
+
+  scheduler_.SetPerformanceMode(false);
+  EXPECT_FALSE(io_limiter_.performance_mode());
+  EXPECT_EQ(CpuShares::kLow, scheduler_.budget().cpu_shares);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/resource_usage.h"
+
+#include <inttypes.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+const char kProcIoPath[] = "/proc/self/io";
+
+base::TimeDelta CpuTime(const struct rusage& usage) {
+  return base::TimeDelta::FromSeconds(usage.ru_utime.tv_sec +
+                                      usage.ru_stime.tv_sec) +
+         base::TimeDelta::FromMicroseconds(usage.ru_utime.tv_usec +
+                                           usage.ru_stime.tv_usec);
+}
+}  // namespace
+
+string ResourceUsage::ToString() const {
+  return base::StringPrintf(
+      "%s wall, %s cpu, %s children cpu, %" PRId64 " bytes read, %" PRId64
+      " bytes written, %+" PRId64 " KiB peak rss, %" PRId64
+      " minor and %" PRId64 " major page faults",
+      utils::FormatTimeDelta(wall_time).c_str(),
+      utils::FormatTimeDelta(thread_cpu_time).c_str(),
+      utils::FormatTimeDelta(children_cpu_time).c_str(),
+      read_bytes,
+      written_bytes,
+      peak_resident_kib,
+      minor_page_faults,
+      major_page_faults);
+}
+
+ResourceUsage GetResourceUsage() {
+  ResourceUsage result;
+  result.wall_time = base::TimeTicks::Now() - base::TimeTicks();
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    result.thread_cpu_time = CpuTime(usage);
+  if (getrusage(RUSAGE_CHILDREN, &usage) == 0)
+    result.children_cpu_time = CpuTime(usage);
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    result.peak_resident_kib = usage.ru_maxrss;
+    result.minor_page_faults = usage.ru_minflt;
+    result.major_page_faults = usage.ru_majflt;
+  }
+  string io;
+  // The I/O accounting is missing from kernels built without it.
+  if (base::ReadFileToString(base::FilePath(kProcIoPath), &io))
+    ParseProcIo(io, &result.read_bytes, &result.written_bytes);
+  return result;
+}
+
+ResourceUsage GetResourceUsageSince(const ResourceUsage& start) {
+  ResourceUsage end = GetResourceUsage();
+  ResourceUsage result;
+  result.wall_time = end.wall_time - start.wall_time;
+  result.thread_cpu_time = end.thread_cpu_time - start.thread_cpu_time;
+  result.children_cpu_time = end.children_cpu_time - start.children_cpu_time;
+  result.read_bytes = end.read_bytes - start.read_bytes;
+  result.written_bytes = end.written_bytes - start.written_bytes;
+  result.peak_resident_kib = end.peak_resident_kib - start.peak_resident_kib;
+  result.minor_page_faults = end.minor_page_faults - start.minor_page_faults;
+  result.major_page_faults = end.major_page_faults - start.major_page_faults;
+  return result;
+}
+
+bool ParseProcIo(const string& contents,
+                 int64_t* read_bytes,
+                 int64_t* written_bytes) {
+  bool found_read = false, found_written = false;
+  for (const string& line : base::SplitString(
+           contents, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    std::vector<string> fields = base::SplitString(
+        line, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    if (fields.size() != 2)
+      continue;
+    // The rchar and wchar fields also count the reads and writes served by
+    // the page cache.
+    if (fields[0] == "read_bytes")
+      found_read = base::StringToInt64(fields[1], read_bytes);
+    else if (fields[0] == "write_bytes")
+      found_written = base::StringToInt64(fields[1], written_bytes);
+  }
+  return found_read && found_written;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_RESOURCE_USAGE_H_
+#define UPDATE_ENGINE_COMMON_RESOURCE_USAGE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// The resources used by this process: the times are those of the calling
+// thread and of the children waited for, and the I/O and memory figures are
+// those of the whole process. A ResourceUsage returned by
+// GetResourceUsageSince() holds the resources used over an interval, where
+// |peak_resident_kib| is the increase of the peak resident memory.
+struct ResourceUsage {
+  base::TimeDelta wall_time;
+  base::TimeDelta thread_cpu_time;
+  base::TimeDelta children_cpu_time;
+  // The bytes read from and written to the storage, from /proc/self/io.
+  int64_t read_bytes{0};
+  int64_t written_bytes{0};
+  int64_t peak_resident_kib{0};
+  int64_t minor_page_faults{0};
+  int64_t major_page_faults{0};
+
+  std::string ToString() const;
+};
+
+// The resources used by an action run by an ActionProcessor, of type |type|.
+struct ActionResourceUsage {
+  std::string type;
+  ResourceUsage usage;
+};
+
+// Returns the resources used by the process until now. The figures that
+// can't be read are left to zero.
+ResourceUsage GetResourceUsage();
+
+// Returns the resources used since |start| was returned by
+// GetResourceUsage(), on the same thread.
+ResourceUsage GetResourceUsageSince(const ResourceUsage& start);
+
+// Parses the |contents| of a /proc/<pid>/io file into the bytes read from and
+// written to the storage. Returns whether both were found.
+bool ParseProcIo(const std::string& contents,
+                 int64_t* read_bytes,
+                 int64_t* written_bytes);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_RESOURCE_USAGE_H_
@@ -0,0 +1,66 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/resource_usage.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class ResourceUsageTest : public ::testing::Test {};
+
+TEST_F(ResourceUsageTest, GetResourceUsageSinceTest) {
+  ResourceUsage start = GetResourceUsage();
+  EXPECT_LT(0, start.peak_resident_kib);
+
+  // Touch some memory and burn some CPU time.
+  std::vector<int> values(1024 * 1024, 1);
+  int64_t sum = 0;
+  for (int i = 0; i < 100; i++) {
+    for (int value : values)
+      sum += value;
+  }
+  EXPECT_EQ(100 * 1024 * 1024, sum);
+
+  ResourceUsage usage = GetResourceUsageSince(start);
+  EXPECT_LE(base::TimeDelta(), usage.wall_time);
+  EXPECT_LE(base::TimeDelta(), usage.thread_cpu_time);
+  EXPECT_GE(usage.wall_time + base::TimeDelta::FromMilliseconds(10),
+            usage.thread_cpu_time);
+  EXPECT_LE(0, usage.peak_resident_kib);
+  EXPECT_LE(0, usage.minor_page_faults);
+  EXPECT_FALSE(usage.ToString().empty());
+}
+
+TEST_F(ResourceUsageTest, ParseProcIoTest) {
+  int64_t read_bytes, written_bytes;
+  EXPECT_TRUE(ParseProcIo(
+      "rchar: 4000\nwchar: 3000\nsyscr: 5\nsyscw: 4\n"
+      "read_bytes: 8192\nwrite_bytes: 4096\ncancelled_write_bytes: 0\n",
+      &read_bytes,
+      &written_bytes));
+  EXPECT_EQ(8192, read_bytes);
+  EXPECT_EQ(4096, written_bytes);
+
+  EXPECT_FALSE(ParseProcIo(
+      "rchar: 4000\nwchar: 3000\n", &read_bytes, &written_bytes));
+  EXPECT_FALSE(ParseProcIo(
+      "read_bytes: none\nwrite_bytes: 0\n", &read_bytes, &written_bytes));
+}
+
+}  // namespace chromeos_update_engine
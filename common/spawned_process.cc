@@ -0,0 +1,276 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/spawned_process.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_split.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The PATH searched when the environment has none, as done by execvp().
+const char kDefaultSearchPath[] = "/bin:/usr/bin";
+
+// Bounds the file descriptors closed in the child when the limit is very
+// large.
+const int kMaxClosedFd = 65536;
+
+// Everything the child needs between vfork() and execve(), prepared by the
+// parent since the child can't allocate memory.
+struct ChildSetup {
+  const char* path;
+  char* const* argv;
+  char* const* envp;
+  // The file descriptors of the parent to duplicate onto the ones of the
+  // child. The source ones are all above the target ones.
+  const std::pair<int, int>* fds;
+  size_t num_fds;
+  bool redirect_stderr_to_stdout;
+  // The target file descriptors are all below |min_source_fd|, and the
+  // |is_target| entries tell which ones are.
+  int min_source_fd;
+  const char* is_target;
+  int max_fd;
+  const sigset_t* signal_mask;
+};
+
+// Runs in the child created by vfork(), sharing the memory of the parent, so
+// it only makes async-signal-safe system calls and never returns.
+void ExecChild(const ChildSetup& setup) {
+  // The handlers of the parent must not run in the child before execve(),
+  // which resets them anyway.
+  for (int sig = 1; sig < NSIG; sig++) {
+    struct sigaction action;
+    if (sigaction(sig, nullptr, &action) != 0 ||
+        action.sa_handler == SIG_IGN || action.sa_handler == SIG_DFL) {
+      continue;
+    }
+    action.sa_handler = SIG_DFL;
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    sigaction(sig, &action, nullptr);
+  }
+
+  for (size_t i = 0; i < setup.num_fds; i++) {
+    if (dup2(setup.fds[i].first, setup.fds[i].second) != setup.fds[i].second)
+      _exit(SpawnedProcess::kErrorExitStatus);
+  }
+  if (setup.redirect_stderr_to_stdout &&
+      dup2(STDOUT_FILENO, STDERR_FILENO) != STDERR_FILENO) {
+    _exit(SpawnedProcess::kErrorExitStatus);
+  }
+  for (int fd = STDERR_FILENO + 1; fd < setup.max_fd; fd++) {
+    if (fd >= setup.min_source_fd || !setup.is_target[fd])
+      close(fd);
+  }
+
+  sigprocmask(SIG_SETMASK, setup.signal_mask, nullptr);
+  execve(setup.path, setup.argv, setup.envp);
+  _exit(SpawnedProcess::kErrorExitStatus);
+}
+
+// Duplicates |fd| to a file descriptor not lower than |min_fd|, closing |fd|.
+// Returns the new one, or -1 on error.
+int MoveFdAbove(int fd, int min_fd) {
+  if (fd < 0)
+    return -1;
+  int moved = fcntl(fd, F_DUPFD_CLOEXEC, min_fd);
+  IGNORE_EINTR(close(fd));
+  return moved;
+}
+
+}  // namespace
+
+const int SpawnedProcess::kErrorExitStatus = 127;
+
+SpawnedProcess::~SpawnedProcess() {
+  Reset();
+}
+
+void SpawnedProcess::RedirectUsingPipe(int child_fd) {
+  pipes_[child_fd] = -1;
+}
+
+int SpawnedProcess::GetPipe(int child_fd) const {
+  auto pipe = pipes_.find(child_fd);
+  return pipe == pipes_.end() ? -1 : pipe->second;
+}
+
+string SpawnedProcess::FindProgram() const {
+  const string& program = args_[0];
+  if (!search_path_ || program.find('/') != string::npos)
+    return program;
+  auto path = env_.find("PATH");
+  for (const string& dir :
+       base::SplitString(path != env_.end() ? path->second : kDefaultSearchPath,
+                         ":",
+                         base::KEEP_WHITESPACE,
+                         base::SPLIT_WANT_NONEMPTY)) {
+    string candidate = dir + "/" + program;
+    if (access(candidate.c_str(), X_OK) == 0)
+      return candidate;
+  }
+  return program;
+}
+
+bool SpawnedProcess::Start() {
+  CHECK(!args_.empty());
+  CHECK_EQ(pid_, 0);
+
+  const string path = FindProgram();
+  vector<char*> argv;
+  for (string& arg : args_)
+    argv.push_back(&arg[0]);
+  argv.push_back(nullptr);
+  vector<string> env_strings;
+  for (const auto& key_value : env_)
+    env_strings.push_back(key_value.first + "=" + key_value.second);
+  vector<char*> envp;
+  for (string& env_string : env_strings)
+    envp.push_back(&env_string[0]);
+  envp.push_back(nullptr);
+
+  // The sources of the file descriptors of the child are moved above all of
+  // them, so duplicating one in the child never overwrites another.
+  int min_source_fd = STDERR_FILENO + 1;
+  if (!pipes_.empty())
+    min_source_fd = std::max(min_source_fd, pipes_.rbegin()->first + 1);
+  vector<char> is_target(min_source_fd, 0);
+  vector<std::pair<int, int>> fds;
+  bool success = true;
+
+  int dev_null = MoveFdAbove(HANDLE_EINTR(open("/dev/null", O_RDONLY)),
+                             min_source_fd);
+  if (dev_null < 0) {
+    PLOG(ERROR) << "Unable to open /dev/null";
+    success = false;
+  } else {
+    fds.emplace_back(dev_null, STDIN_FILENO);
+  }
+  for (auto& pipe : pipes_) {
+    int pipe_fds[2];
+    if (!success || pipe2(pipe_fds, O_CLOEXEC) != 0) {
+      PLOG_IF(ERROR, success) << "Unable to create a pipe";
+      success = false;
+      break;
+    }
+    pipe.second = pipe_fds[0];
+    int writer = MoveFdAbove(pipe_fds[1], min_source_fd);
+    if (writer < 0) {
+      PLOG(ERROR) << "Unable to move the pipe writer";
+      success = false;
+      break;
+    }
+    fds.emplace_back(writer, pipe.first);
+    is_target[pipe.first] = 1;
+  }
+
+  if (success) {
+    struct rlimit limit;
+    int max_fd = kMaxClosedFd;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < static_cast<rlim_t>(kMaxClosedFd)) {
+      max_fd = static_cast<int>(limit.rlim_cur);
+    }
+
+    // No signal handler runs while the child shares the memory of this
+    // process; the child restores the current mask before executing.
+    sigset_t all_signals;
+    sigset_t signal_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &signal_mask);
+    const ChildSetup setup = {path.c_str(),
+                              argv.data(),
+                              envp.data(),
+                              fds.data(),
+                              fds.size(),
+                              redirect_stderr_to_stdout_,
+                              min_source_fd,
+                              is_target.data(),
+                              max_fd,
+                              &signal_mask};
+    pid_t pid = vfork();
+    if (pid == 0)
+      ExecChild(setup);
+    int vfork_errno = errno;
+    pthread_sigmask(SIG_SETMASK, &signal_mask, nullptr);
+    if (pid < 0) {
+      errno = vfork_errno;
+      PLOG(ERROR) << "Unable to create the process for " << path;
+      success = false;
+    } else {
+      pid_ = pid;
+    }
+  }
+
+  // The child has its own copy of the writer ends.
+  for (const auto& fd : fds)
+    IGNORE_EINTR(close(fd.first));
+  if (!success) {
+    for (auto& pipe : pipes_) {
+      if (pipe.second >= 0)
+        IGNORE_EINTR(close(pipe.second));
+      pipe.second = -1;
+    }
+  }
+  return success;
+}
+
+int SpawnedProcess::Wait() {
+  if (pid_ == 0)
+    return -1;
+  int status;
+  const pid_t child_pid = pid_;
+  pid_ = 0;
+  if (HANDLE_EINTR(waitpid(child_pid, &status, 0)) < 0) {
+    PLOG(ERROR) << "Unable to wait for process " << child_pid;
+    return -1;
+  }
+  if (!WIFEXITED(status)) {
+    LOG(ERROR) << "Process " << child_pid << " didn't exit normally: "
+               << status;
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+void SpawnedProcess::Reset() {
+  if (pid_ != 0 && kill(pid_, SIGKILL) != 0)
+    PLOG(WARNING) << "Unable to kill process " << pid_;
+  pid_ = 0;
+  for (auto& pipe : pipes_) {
+    if (pipe.second >= 0)
+      IGNORE_EINTR(close(pipe.second));
+  }
+  pipes_.clear();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,106 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_SPAWNED_PROCESS_H_
+#define UPDATE_ENGINE_COMMON_SPAWNED_PROCESS_H_
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// A child process started with vfork() and execve(). Unlike fork(), vfork()
+// doesn't copy the page tables of update_engine nor makes its pages
+// copy-on-write while the child starts, so the cost of launching a helper
+// doesn't grow with the memory used by the daemon. The child only runs
+// async-signal-safe system calls, prepared by the parent, until it execs.
+//
+// Only stdin, redirected from /dev/null, stdout, stderr and the file
+// descriptors redirected to pipes are open in the child.
+class SpawnedProcess {
+ public:
+  // The exit status of the child when the program couldn't be executed.
+  static const int kErrorExitStatus;
+
+  SpawnedProcess() = default;
+  // Kills the process with SIGKILL unless it was released, and closes the
+  // parent end of the pipes.
+  ~SpawnedProcess();
+
+  void AddArg(const std::string& arg) { args_.push_back(arg); }
+
+  // Looks for the program in the PATH of the environment when its name has no
+  // slash.
+  void SetSearchPath(bool search_path) { search_path_ = search_path; }
+
+  // Sets the environment of the child, empty by default.
+  void SetEnvironment(const std::map<std::string, std::string>& env) {
+    env_ = env;
+  }
+
+  void SetRedirectStderrToStdout(bool redirect) {
+    redirect_stderr_to_stdout_ = redirect;
+  }
+
+  // Makes |child_fd| the writer end of a pipe in the child. The reader end is
+  // returned by GetPipe() once started.
+  void RedirectUsingPipe(int child_fd);
+
+  // Starts the process. Returns whether it was created; the program may still
+  // fail to execute, in which case it exits with kErrorExitStatus.
+  bool Start();
+
+  // Returns the parent end of the pipe redirected to |child_fd|, or -1.
+  int GetPipe(int child_fd) const;
+
+  pid_t pid() const { return pid_; }
+
+  // Waits for the process to exit and returns its exit status, or -1 if it was
+  // killed by a signal or couldn't be waited for.
+  int Wait();
+
+  // Forgets about the process, so it isn't killed when destroyed.
+  void Release() { pid_ = 0; }
+
+  // Kills the process unless released and closes the pipes.
+  void Reset();
+
+ private:
+  // Returns the path of the program to execute.
+  std::string FindProgram() const;
+
+  std::vector<std::string> args_;
+  bool search_path_{false};
+  std::map<std::string, std::string> env_;
+  bool redirect_stderr_to_stdout_{false};
+
+  // The parent end of the pipe redirected to each file descriptor of the
+  // child, or -1 before starting.
+  std::map<int, int> pipes_;
+
+  pid_t pid_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SpawnedProcess);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_SPAWNED_PROCESS_H_
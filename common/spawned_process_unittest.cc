@@ -0,0 +1,143 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/spawned_process.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/stringprintf.h>
+#include <gtest/gtest.h>
+
+using std::string;
+
+namespace {
+
+#ifdef __ANDROID__
+#define kBinPath "/system/bin"
+#else
+#define kBinPath "/bin"
+#endif  // __ANDROID__
+
+}  // namespace
+
+namespace chromeos_update_engine {
+
+class SpawnedProcessTest : public ::testing::Test {
+ protected:
+  // Starts a shell running |command| in |process_|.
+  void StartShell(const string& command) {
+    process_.AddArg(kBinPath "/sh");
+    process_.AddArg("-c");
+    process_.AddArg(command);
+    ASSERT_TRUE(process_.Start());
+    EXPECT_NE(0, process_.pid());
+  }
+
+  // Returns everything written to the pipe redirected to |child_fd|.
+  string ReadPipe(int child_fd) {
+    int fd = process_.GetPipe(child_fd);
+    EXPECT_LE(0, fd);
+    string output;
+    char buf[1024];
+    ssize_t bytes_read;
+    while ((bytes_read = HANDLE_EINTR(read(fd, buf, sizeof(buf)))) > 0)
+      output.append(buf, bytes_read);
+    return output;
+  }
+
+  SpawnedProcess process_;
+};
+
+TEST_F(SpawnedProcessTest, ExitStatusTest) {
+  StartShell("exit 3");
+  EXPECT_EQ(3, process_.Wait());
+  EXPECT_EQ(0, process_.pid());
+}
+
+TEST_F(SpawnedProcessTest, MissingProgramTest) {
+  process_.AddArg("/non/existent/program");
+  ASSERT_TRUE(process_.Start());
+  EXPECT_EQ(SpawnedProcess::kErrorExitStatus, process_.Wait());
+}
+
+TEST_F(SpawnedProcessTest, SearchPathTest) {
+  process_.AddArg("sh");
+  process_.AddArg("-c");
+  process_.AddArg("exit 0");
+  process_.SetEnvironment({{"PATH", kBinPath}});
+  process_.SetSearchPath(true);
+  ASSERT_TRUE(process_.Start());
+  EXPECT_EQ(0, process_.Wait());
+}
+
+TEST_F(SpawnedProcessTest, EnvironmentTest) {
+  process_.SetEnvironment({{"FOO", "bar"}});
+  process_.RedirectUsingPipe(STDOUT_FILENO);
+  StartShell("echo \"$FOO\"; echo \"${HOME:-unset}\"");
+  EXPECT_EQ("bar\nunset\n", ReadPipe(STDOUT_FILENO));
+  EXPECT_EQ(0, process_.Wait());
+}
+
+TEST_F(SpawnedProcessTest, PipeRedirectionTest) {
+  process_.RedirectUsingPipe(STDOUT_FILENO);
+  process_.RedirectUsingPipe(3);
+  process_.SetRedirectStderrToStdout(true);
+  StartShell("echo out; echo err >&2; echo three >&3; read line || exit 5");
+  EXPECT_EQ("three\n", ReadPipe(3));
+  EXPECT_EQ("out\nerr\n", ReadPipe(STDOUT_FILENO));
+  // stdin is /dev/null, so the read fails.
+  EXPECT_EQ(5, process_.Wait());
+}
+
+TEST_F(SpawnedProcessTest, UnusedFdClosedTest) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  process_.RedirectUsingPipe(STDOUT_FILENO);
+  StartShell(base::StringPrintf("echo x >&%d || echo closed", fds[1]));
+  EXPECT_EQ("closed\n", ReadPipe(STDOUT_FILENO));
+  EXPECT_EQ(0, process_.Wait());
+  IGNORE_EINTR(close(fds[0]));
+  IGNORE_EINTR(close(fds[1]));
+}
+
+TEST_F(SpawnedProcessTest, KilledBySignalTest) {
+  StartShell("kill -9 $$");
+  EXPECT_EQ(-1, process_.Wait());
+}
+
+TEST_F(SpawnedProcessTest, NoPipeBeforeStartTest) {
+  process_.RedirectUsingPipe(STDOUT_FILENO);
+  EXPECT_EQ(-1, process_.GetPipe(STDOUT_FILENO));
+  EXPECT_EQ(-1, process_.GetPipe(3));
+}
+
+TEST_F(SpawnedProcessTest, ResetKillsProcessTest) {
+  process_.RedirectUsingPipe(STDOUT_FILENO);
+  StartShell("sleep 60");
+  pid_t pid = process_.pid();
+  process_.Reset();
+  EXPECT_EQ(0, process_.pid());
+  EXPECT_EQ(-1, process_.GetPipe(STDOUT_FILENO));
+  int status;
+  EXPECT_EQ(pid, HANDLE_EINTR(waitpid(pid, &status, 0)));
+  EXPECT_TRUE(WIFSIGNALED(status));
+}
+
+}  // namespace chromeos_update_engine
@@ -30,7 +30,6 @@
 #include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
-#include <brillo/process.h>
 #include <brillo/secure_blob.h>
 
 #include "update_engine/common/utils.h"
@@ -44,28 +43,6 @@ namespace chromeos_update_engine {
 
 namespace {
 
-bool SetupChild(const std::map<string, string>& env, uint32_t flags) {
-  // Setup the environment variables.
-  clearenv();
-  for (const auto& key_value : env) {
-    setenv(key_value.first.c_str(), key_value.second.c_str(), 0);
-  }
-
-  if ((flags & Subprocess::kRedirectStderrToStdout) != 0) {
-    if (HANDLE_EINTR(dup2(STDOUT_FILENO, STDERR_FILENO)) != STDERR_FILENO)
-      return false;
-  }
-
-  int fd = HANDLE_EINTR(open("/dev/null", O_RDONLY));
-  if (fd < 0)
-    return false;
-  if (HANDLE_EINTR(dup2(fd, STDIN_FILENO)) != STDIN_FILENO)
-    return false;
-  IGNORE_EINTR(close(fd));
-
-  return true;
-}
-
 // Helper function to launch a process with the given Subprocess::Flags.
 // This function only sets up and starts the process according to the |flags|.
 // The caller is responsible for watching the termination of the subprocess.
@@ -74,7 +51,7 @@ bool SetupChild(const std::map<string, string>& env, uint32_t flags) {
 bool LaunchProcess(const vector<string>& cmd,
                    uint32_t flags,
                    const vector<int>& output_pipes,
-                   brillo::Process* proc) {
+                   SpawnedProcess* proc) {
   for (const string& arg : cmd)
     proc->AddArg(arg);
   proc->SetSearchPath((flags & Subprocess::kSearchPath) != 0);
@@ -87,12 +64,14 @@ bool LaunchProcess(const vector<string>& cmd,
       env.emplace(key, value);
   }
 
+  proc->SetEnvironment(env);
+  proc->SetRedirectStderrToStdout(
+      (flags & Subprocess::kRedirectStderrToStdout) != 0);
+
   for (const int fd : output_pipes) {
-    proc->RedirectUsingPipe(fd, false);
+    proc->RedirectUsingPipe(fd);
   }
-  proc->SetCloseUnusedFileDescriptors(true);
-  proc->RedirectUsingPipe(STDOUT_FILENO, false);
-  proc->SetPreExecCallback(base::Bind(&SetupChild, env, flags));
+  proc->RedirectUsingPipe(STDOUT_FILENO);
 
   return proc->Start();
 }
@@ -160,10 +139,10 @@ void Subprocess::ChildExitedCallback(const siginfo_t& info) {
   }
   // Release and close all the pipes after calling the callback so our
   // redirected pipes are still alive. Releasing the process first makes
-  // Reset(0) not attempt to kill the process, which is already a zombie at this
+  // Reset() not attempt to kill the process, which is already a zombie at this
   // point.
   record->proc.Release();
-  record->proc.Reset(0);
+  record->proc.Reset();
 
   subprocess_records_.erase(pid_record);
 }
@@ -246,7 +225,7 @@ bool Subprocess::SynchronousExecFlags(const vector<string>& cmd,
                                       uint32_t flags,
                                       int* return_code,
                                       string* stdout) {
-  brillo::ProcessImpl proc;
+  SpawnedProcess proc;
   // It doesn't make sense to redirect some pipes in the synchronous case
   // because we won't be reading on our end, so we don't expose the output_pipes
   // in this case.
@@ -278,7 +257,7 @@ bool Subprocess::SynchronousExecFlags(const vector<string>& cmd,
   int proc_return_code = proc.Wait();
   if (return_code)
     *return_code = proc_return_code;
-  return proc_return_code != brillo::Process::kErrorExitStatus;
+  return proc_return_code != SpawnedProcess::kErrorExitStatus;
 }
 
 bool Subprocess::SubprocessInFlight() {
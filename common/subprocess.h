@@ -29,10 +29,11 @@
 #include <base/macros.h>
 #include <brillo/asynchronous_signal_handler_interface.h>
 #include <brillo/message_loops/message_loop.h>
-#include <brillo/process.h>
 #include <brillo/process_reaper.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
+#include "update_engine/common/spawned_process.h"
+
 // The Subprocess class is a singleton. It's used to spawn off a subprocess
 // and get notified when the subprocess exits. The result of Exec() can
 // be saved and used to cancel the callback request and kill your process. If
@@ -114,9 +115,9 @@ class Subprocess {
     // The callback supplied by the caller.
     ExecCallback callback;
 
-    // The ProcessImpl instance managing the child process. Destroying this
+    // The SpawnedProcess instance managing the child process. Destroying this
     // will close our end of the pipes we have open.
-    brillo::ProcessImpl proc;
+    SpawnedProcess proc;
 
     // These are used to monitor the stdout of the running process, including
     // the stderr if it was redirected.
@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/throughput_estimator.h"
+
+#include <algorithm>
+
+#include "update_engine/common/constants.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The weight of a new sample in the moving averages, as in the TCP smoothed
+// round trip time.
+const int64_t kSampleWeightDivisor = 8;
+
+// The stall limit is this fraction of the throughput, so it stays below the
+// rate of every parallel connection.
+const int64_t kLowSpeedLimitDivisor = 32;
+const int kMaxLowSpeedLimitBps = 64 * 1024;
+
+// The throughput at which the default low speed time is used. The time scales
+// inversely with the throughput, within the bounds below.
+const int64_t kReferenceThroughput = 256 * 1024;
+const int kMinLowSpeedTimeSeconds = 30;
+const int kMaxLowSpeedTimeSeconds = 180;
+
+// The connect timeout, in round trip times.
+const int64_t kConnectRoundTrips = 20;
+const int kMinConnectTimeoutSeconds = 10;
+const int kMaxConnectTimeoutSeconds = 60;
+
+// Returns the moving average of |average| with the new |sample|.
+int64_t Smooth(int64_t average, int64_t sample) {
+  if (average == 0)
+    return sample;
+  return average + (sample - average) / kSampleWeightDivisor;
+}
+
+}  // namespace
+
+const base::TimeDelta ThroughputEstimator::kSampleInterval =
+    base::TimeDelta::FromSeconds(1);
+const base::TimeDelta ThroughputEstimator::kMaxSampleInterval =
+    base::TimeDelta::FromSeconds(30);
+
+void ThroughputEstimator::SetEstimates(int64_t throughput,
+                                       base::TimeDelta round_trip_time) {
+  throughput_ = std::max<int64_t>(throughput, 0);
+  round_trip_time_ = std::max(round_trip_time, base::TimeDelta());
+}
+
+void ThroughputEstimator::AddBytes(size_t bytes) {
+  base::Time now = clock_->GetMonotonicTime();
+  if (sample_start_.is_null() || now < sample_start_) {
+    sample_start_ = now;
+    sample_bytes_ = 0;
+  }
+  sample_bytes_ += bytes;
+  base::TimeDelta elapsed = now - sample_start_;
+  if (elapsed < kSampleInterval)
+    return;
+  if (elapsed <= kMaxSampleInterval) {
+    throughput_ = Smooth(throughput_,
+                         sample_bytes_ * base::Time::kMicrosecondsPerSecond /
+                             elapsed.InMicroseconds());
+  }
+  sample_start_ = now;
+  sample_bytes_ = 0;
+}
+
+void ThroughputEstimator::AddRoundTripTime(base::TimeDelta round_trip_time) {
+  if (round_trip_time <= base::TimeDelta())
+    return;
+  round_trip_time_ = base::TimeDelta::FromMicroseconds(
+      Smooth(round_trip_time_.InMicroseconds(),
+             round_trip_time.InMicroseconds()));
+}
+
+int ThroughputEstimator::GetLowSpeedLimitBps() const {
+  if (throughput_ == 0)
+    return kDownloadLowSpeedLimitBps;
+  return std::min<int64_t>(
+      std::max<int64_t>(throughput_ / kLowSpeedLimitDivisor,
+                        kDownloadLowSpeedLimitBps),
+      kMaxLowSpeedLimitBps);
+}
+
+int ThroughputEstimator::GetLowSpeedTimeSeconds() const {
+  if (throughput_ == 0)
+    return kDownloadLowSpeedTimeSeconds;
+  // Bound the throughput first so the product below can't overflow.
+  int64_t throughput = std::min<int64_t>(throughput_, kReferenceThroughput * 8);
+  return std::min<int64_t>(
+      std::max<int64_t>(
+          kDownloadLowSpeedTimeSeconds * kReferenceThroughput / throughput,
+          kMinLowSpeedTimeSeconds),
+      kMaxLowSpeedTimeSeconds);
+}
+
+int ThroughputEstimator::GetConnectTimeoutSeconds() const {
+  if (round_trip_time_.is_zero())
+    return kDownloadConnectTimeoutSeconds;
+  // Bound the round trip time first so the product below can't overflow.
+  base::TimeDelta round_trip_time =
+      std::min(round_trip_time_, base::TimeDelta::FromSeconds(60));
+  return std::min<int64_t>(
+      std::max<int64_t>((round_trip_time * kConnectRoundTrips).InSeconds(),
+                        kMinConnectTimeoutSeconds),
+      kMaxConnectTimeoutSeconds);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,92 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_THROUGHPUT_ESTIMATOR_H_
+#define UPDATE_ENGINE_COMMON_THROUGHPUT_ESTIMATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+#include "update_engine/common/clock.h"
+#include "update_engine/common/clock_interface.h"
+
+namespace chromeos_update_engine {
+
+// Keeps a rolling estimate of the download throughput and of the round trip
+// time to the server, from which the stall detection and connect timeouts of
+// the fetchers are derived. Until something is measured, or seeded with
+// SetEstimates(), the timeouts are the default ones in constants.h. When
+// shared by parallel fetchers, the throughput is the one of all of them. It is
+// meant to be used from the main loop only.
+class ThroughputEstimator {
+ public:
+  // The bytes received are sampled over at least this long.
+  static const base::TimeDelta kSampleInterval;
+  // Samples spanning longer than this, e.g. across a suspend, are dropped.
+  static const base::TimeDelta kMaxSampleInterval;
+
+  ThroughputEstimator() : clock_(&default_clock_) {}
+  // Used for testing. The |clock| must outlive the estimator.
+  explicit ThroughputEstimator(ClockInterface* clock) : clock_(clock) {}
+
+  // Replaces the estimates with the ones saved from a previous attempt. A
+  // zero value leaves that estimate unknown.
+  void SetEstimates(int64_t throughput, base::TimeDelta round_trip_time);
+
+  // Accounts |bytes| just received.
+  void AddBytes(size_t bytes);
+
+  // Accounts a round trip time measured when connecting to the server.
+  void AddRoundTripTime(base::TimeDelta round_trip_time);
+
+  // The estimated throughput in bytes per second, or zero if unknown.
+  int64_t throughput() const { return throughput_; }
+  // The estimated round trip time, or zero if unknown.
+  base::TimeDelta round_trip_time() const { return round_trip_time_; }
+
+  // The transfer rate, in bytes per second, under which a connection is
+  // considered stalled. It is a small fraction of the estimated throughput so
+  // each of the parallel connections stays well above it.
+  int GetLowSpeedLimitBps() const;
+
+  // How long a connection can stay under GetLowSpeedLimitBps() before it is
+  // dropped. Fast links detect a stall sooner, slow ones get more slack.
+  int GetLowSpeedTimeSeconds() const;
+
+  // The time allowed to connect to the server, a multiple of the estimated
+  // round trip time to leave room for the TLS handshake.
+  int GetConnectTimeoutSeconds() const;
+
+ private:
+  Clock default_clock_;
+  ClockInterface* clock_;
+
+  int64_t throughput_{0};
+  base::TimeDelta round_trip_time_;
+
+  // The bytes received since |sample_start_|.
+  uint64_t sample_bytes_{0};
+  base::Time sample_start_;
+
+  DISALLOW_COPY_AND_ASSIGN(ThroughputEstimator);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_THROUGHPUT_ESTIMATOR_H_
@@ -0,0 +1,95 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/throughput_estimator.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/constants.h"
+#include "update_engine/common/fake_clock.h"
+
+namespace chromeos_update_engine {
+
+class ThroughputEstimatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    clock_.SetMonotonicTime(base::Time::FromInternalValue(1000000));
+  }
+
+  void Advance(base::TimeDelta delta) {
+    clock_.SetMonotonicTime(clock_.GetMonotonicTime() + delta);
+  }
+
+  FakeClock clock_;
+  ThroughputEstimator estimator_{&clock_};
+};
+
+TEST_F(ThroughputEstimatorTest, DefaultsTest) {
+  EXPECT_EQ(0, estimator_.throughput());
+  EXPECT_EQ(kDownloadLowSpeedLimitBps, estimator_.GetLowSpeedLimitBps());
+  EXPECT_EQ(kDownloadLowSpeedTimeSeconds, estimator_.GetLowSpeedTimeSeconds());
+  EXPECT_EQ(kDownloadConnectTimeoutSeconds,
+            estimator_.GetConnectTimeoutSeconds());
+}
+
+TEST_F(ThroughputEstimatorTest, ThroughputTest) {
+  estimator_.AddBytes(0);
+  Advance(base::TimeDelta::FromMilliseconds(500));
+  estimator_.AddBytes(512 * 1024);
+  // Nothing is sampled before the sample interval.
+  EXPECT_EQ(0, estimator_.throughput());
+  Advance(base::TimeDelta::FromMilliseconds(500));
+  estimator_.AddBytes(512 * 1024);
+  EXPECT_EQ(1024 * 1024, estimator_.throughput());
+  EXPECT_EQ(32 * 1024, estimator_.GetLowSpeedLimitBps());
+  EXPECT_EQ(30, estimator_.GetLowSpeedTimeSeconds());
+
+  // The later samples are averaged in.
+  Advance(base::TimeDelta::FromSeconds(1));
+  estimator_.AddBytes(0);
+  EXPECT_EQ(1024 * 1024 * 7 / 8, estimator_.throughput());
+
+  // A sample spanning a suspend is dropped.
+  Advance(base::TimeDelta::FromHours(1));
+  estimator_.AddBytes(1);
+  EXPECT_EQ(1024 * 1024 * 7 / 8, estimator_.throughput());
+}
+
+TEST_F(ThroughputEstimatorTest, SlowLinkTest) {
+  estimator_.SetEstimates(16 * 1024, base::TimeDelta::FromSeconds(2));
+  EXPECT_EQ(512, estimator_.GetLowSpeedLimitBps());
+  EXPECT_EQ(180, estimator_.GetLowSpeedTimeSeconds());
+  EXPECT_EQ(40, estimator_.GetConnectTimeoutSeconds());
+
+  estimator_.SetEstimates(10, base::TimeDelta::FromMinutes(5));
+  EXPECT_EQ(kDownloadLowSpeedLimitBps, estimator_.GetLowSpeedLimitBps());
+  EXPECT_EQ(60, estimator_.GetConnectTimeoutSeconds());
+}
+
+TEST_F(ThroughputEstimatorTest, RoundTripTimeTest) {
+  // The round trip times of reused connections aren't measured.
+  estimator_.AddRoundTripTime(base::TimeDelta());
+  EXPECT_EQ(base::TimeDelta(), estimator_.round_trip_time());
+  estimator_.AddRoundTripTime(base::TimeDelta::FromMilliseconds(80));
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(80),
+            estimator_.round_trip_time());
+  estimator_.AddRoundTripTime(base::TimeDelta::FromMilliseconds(160));
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(90),
+            estimator_.round_trip_time());
+  EXPECT_EQ(10, estimator_.GetConnectTimeoutSeconds());
+}
+
+}  // namespace chromeos_update_engine
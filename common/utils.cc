@@ -29,6 +29,7 @@
 #include <sys/mount.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -58,6 +59,11 @@
 #include "update_engine/common/subprocess.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 
+// Not defined by older kernel headers.
+#ifndef BLKIOOPT
+#define BLKIOOPT _IO(0x12, 121)
+#endif
+
 using base::Time;
 using base::TimeDelta;
 using std::min;
@@ -274,6 +280,27 @@ bool PWriteAll(const FileDescriptorPtr& fd,
   return WriteAll(fd, buf, count);
 }
 
+bool IsZeroBuffer(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  const size_t kWordsPerStep = 8;
+  const size_t kStepSize = kWordsPerStep * sizeof(uint64_t);
+  for (; size >= kStepSize; bytes += kStepSize, size -= kStepSize) {
+    // The words are copied since the data may not be aligned.
+    uint64_t words[kWordsPerStep];
+    memcpy(words, bytes, kStepSize);
+    uint64_t bits = 0;
+    for (size_t i = 0; i < kWordsPerStep; i++)
+      bits |= words[i];
+    if (bits)
+      return false;
+  }
+  for (; size > 0; bytes++, size--) {
+    if (*bytes)
+      return false;
+  }
+  return true;
+}
+
 bool PReadAll(int fd, void* buf, size_t count, off_t offset,
               ssize_t* out_bytes_read) {
   char* c_buf = static_cast<char*>(buf);
@@ -654,6 +681,44 @@ bool SetBlockDeviceReadOnly(const string& device, bool read_only) {
   return true;
 }
 
+uint32_t GetBlockDeviceOptimalIoSize(const string& device) {
+  int fd = HANDLE_EINTR(open(device.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return 0;
+  ScopedFdCloser fd_closer(&fd);
+  struct stat stbuf;
+  if (fstat(fd, &stbuf) != 0 || !S_ISBLK(stbuf.st_mode))
+    return 0;
+  unsigned int io_opt = 0;
+  if (ioctl(fd, BLKIOOPT, &io_opt) != 0) {
+    PLOG(WARNING) << "Error running ioctl(BLKIOOPT) on " << device;
+    return 0;
+  }
+  return io_opt;
+}
+
+uint32_t GetBlockDeviceMaxRequestSize(const string& device) {
+  struct stat stbuf;
+  if (stat(device.c_str(), &stbuf) != 0 || !S_ISBLK(stbuf.st_mode))
+    return 0;
+  // Partitions don't have a queue directory, their parent disk does.
+  string sysfs_dir = base::StringPrintf(
+      "/sys/dev/block/%u:%u", major(stbuf.st_rdev), minor(stbuf.st_rdev));
+  for (const char* queue_dir : {"/queue", "/../queue"}) {
+    string max_sectors_kb;
+    unsigned int value = 0;
+    if (base::ReadFileToString(
+            base::FilePath(sysfs_dir + queue_dir + "/max_sectors_kb"),
+            &max_sectors_kb) &&
+        base::StringToUint(
+            base::TrimWhitespaceASCII(max_sectors_kb, base::TRIM_ALL),
+            &value)) {
+      return value * 1024;
+    }
+  }
+  return 0;
+}
+
 bool MountFilesystem(const string& device,
                      const string& mountpoint,
                      unsigned long mountflags,  // NOLINT(runtime/int)
@@ -1043,20 +1108,29 @@ bool ReadExtents(const string& path, const vector<Extent>& extents,
   TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
   ScopedFdCloser fd_closer(&fd);
 
-  for (const Extent& extent : extents) {
+  for (size_t i = 0; i < extents.size();) {
+    // Read the runs of extents that follow each other in the file in a
+    // single call, since fragmented files have many of them.
+    uint64_t start_block = extents[i].start_block();
+    uint64_t num_blocks = extents[i].num_blocks();
+    for (i++; i < extents.size() &&
+              extents[i].start_block() == start_block + num_blocks;
+         i++) {
+      num_blocks += extents[i].num_blocks();
+    }
     ssize_t bytes_read_this_iteration = 0;
-    ssize_t bytes = extent.num_blocks() * block_size;
+    ssize_t bytes = num_blocks * block_size;
     TEST_AND_RETURN_FALSE(bytes_read + bytes <= out_data_size);
     TEST_AND_RETURN_FALSE(utils::PReadAll(fd,
-                                          &data[bytes_read],
+                                          data.data() + bytes_read,
                                           bytes,
-                                          extent.start_block() * block_size,
+                                          start_block * block_size,
                                           &bytes_read_this_iteration));
     TEST_AND_RETURN_FALSE(bytes_read_this_iteration == bytes);
     bytes_read += bytes_read_this_iteration;
   }
   TEST_AND_RETURN_FALSE(out_data_size == bytes_read);
-  *out_data = data;
+  out_data->swap(data);
   return true;
 }
 
@@ -181,6 +181,15 @@ std::string MakePartitionNameForMount(const std::string& part_name);
 // in |read_only|. Return whether the operation succeeded.
 bool SetBlockDeviceReadOnly(const std::string& device, bool read_only);
 
+// Returns the optimal I/O size reported by the kernel for the block device
+// |device|, or 0 if |device| isn't a block device or doesn't report one.
+uint32_t GetBlockDeviceOptimalIoSize(const std::string& device);
+
+// Returns the size in bytes of the largest request the queue of the block
+// device |device| accepts, or 0 if |device| isn't a block device or the size
+// can't be read from sysfs. A partition reports the size of its disk's queue.
+uint32_t GetBlockDeviceMaxRequestSize(const std::string& device);
+
 // Synchronously mount or unmount a filesystem. Return true on success.
 // When mounting, it will attempt to mount the device as the passed filesystem
 // type |type|, with the passed |flags| options. If |type| is empty, "ext2",
@@ -256,6 +265,10 @@ bool VectorIndexOf(const std::vector<T>& vect, const T& value,
   }
 }
 
+// Returns whether the |size| bytes at |data| are all zeros. The data is checked
+// 64 bytes at a time without branches, which the compiler vectorizes.
+bool IsZeroBuffer(const void* data, size_t size);
+
 // Return the total number of blocks in the passed |extents| collection.
 template <class T>
 uint64_t BlocksInExtents(const T& extents) {
@@ -93,6 +93,48 @@ TEST(UtilsTest, ReadFileChunk) {
               in_data);
 }
 
+TEST(UtilsTest, ReadExtentsTest) {
+  test_utils::ScopedTempFile file;
+  brillo::Blob file_data(5 * 4096);
+  for (size_t i = 0; i < file_data.size(); i++)
+    file_data[i] = i / 4096;
+  EXPECT_TRUE(test_utils::WriteFileVector(file.path(), file_data));
+
+  // The first two extents follow each other in the file, the last one is
+  // before them.
+  vector<Extent> extents(3);
+  extents[0].set_start_block(2);
+  extents[0].set_num_blocks(1);
+  extents[1].set_start_block(3);
+  extents[1].set_num_blocks(2);
+  extents[2].set_start_block(0);
+  extents[2].set_num_blocks(1);
+  brillo::Blob data;
+  EXPECT_TRUE(utils::ReadExtents(file.path(), extents, &data, 4 * 4096, 4096));
+  brillo::Blob expected(file_data.begin() + 2 * 4096, file_data.end());
+  expected.insert(expected.end(), file_data.begin(), file_data.begin() + 4096);
+  EXPECT_EQ(expected, data);
+
+  // Reading less than the size of the extents fails.
+  EXPECT_FALSE(utils::ReadExtents(file.path(), extents, &data, 4096, 4096));
+}
+
+TEST(UtilsTest, IsZeroBufferTest) {
+  brillo::Blob data(1000);
+  EXPECT_TRUE(utils::IsZeroBuffer(data.data(), data.size()));
+  EXPECT_TRUE(utils::IsZeroBuffer(data.data(), 0));
+  // A non-zero byte is found anywhere, including in the unaligned head and
+  // the tail after the last 64 bytes.
+  for (size_t pos : {0, 1, 63, 64, 500, 959, 960, 999}) {
+    data[pos] = 1;
+    EXPECT_FALSE(utils::IsZeroBuffer(data.data(), data.size())) << pos;
+    EXPECT_FALSE(utils::IsZeroBuffer(data.data() + pos, data.size() - pos));
+    EXPECT_TRUE(utils::IsZeroBuffer(data.data() + pos + 1,
+                                    data.size() - pos - 1));
+    data[pos] = 0;
+  }
+}
+
 TEST(UtilsTest, ErrnoNumberAsStringTest) {
   EXPECT_EQ("No such file or directory", utils::ErrnoNumberAsString(ENOENT));
 }
@@ -110,6 +152,13 @@ TEST(UtilsTest, IsSymlinkTest) {
   EXPECT_FALSE(utils::IsSymlink("/non/existent/path"));
 }
 
+TEST(UtilsTest, GetBlockDeviceMaxRequestSizeTest) {
+  test_utils::ScopedTempFile temp_file;
+  // Only block devices have a request queue.
+  EXPECT_EQ(0U, utils::GetBlockDeviceMaxRequestSize(temp_file.path()));
+  EXPECT_EQ(0U, utils::GetBlockDeviceMaxRequestSize("/non/existent/path"));
+}
+
 TEST(UtilsTest, SplitPartitionNameTest) {
   string disk;
   int part_num;
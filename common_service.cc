@@ -37,6 +37,7 @@
 #include "update_engine/p2p_manager.h"
 #include "update_engine/payload_state_interface.h"
 #include "update_engine/update_attempter.h"
+#include "update_engine/update_manager/update_manager.h"
 
 using base::StringPrintf;
 using brillo::ErrorPtr;
@@ -44,6 +45,7 @@ using brillo::string_utils::ToString;
 using std::set;
 using std::string;
 using update_engine::UpdateAttemptFlags;
+using update_engine::UpdateEnginePerformance;
 using update_engine::UpdateEngineStatus;
 
 namespace chromeos_update_engine {
@@ -142,6 +144,15 @@ bool UpdateEngineService::GetStatus(ErrorPtr* error,
   return true;
 }
 
+bool UpdateEngineService::GetPerformance(
+    ErrorPtr* error, UpdateEnginePerformance* out_performance) {
+  if (!system_state_->update_attempter()->GetPerformance(out_performance)) {
+    LogAndSetError(error, FROM_HERE, "GetPerformance failed.");
+    return false;
+  }
+  return true;
+}
+
 bool UpdateEngineService::RebootIfNeeded(ErrorPtr* error) {
   if (!system_state_->update_attempter()->RebootIfNeeded()) {
     // TODO(dgarrett): Give a more specific error code/reason.
@@ -381,4 +392,11 @@ bool UpdateEngineService::GetEolStatus(ErrorPtr* error,
   return true;
 }
 
+bool UpdateEngineService::GetPolicyEvaluationTrace(
+    ErrorPtr* /* error */, string* out_policy_evaluation_trace) {
+  *out_policy_evaluation_trace =
+      system_state_->update_manager()->DumpPolicyTrace();
+  return true;
+}
+
 }  // namespace chromeos_update_engine
@@ -68,6 +68,11 @@ class UpdateEngineService {
   bool GetStatus(brillo::ErrorPtr* error,
                  update_engine::UpdateEngineStatus* out_status);
 
+  // Returns the current throughput of the update in progress, the estimated
+  // time left to download it and the install operation being applied.
+  bool GetPerformance(brillo::ErrorPtr* error,
+                      update_engine::UpdateEnginePerformance* out_performance);
+
   // Reboots the device if an update is applied and a reboot is required.
   bool RebootIfNeeded(brillo::ErrorPtr* error);
 
@@ -143,6 +148,11 @@ class UpdateEngineService {
   // on every update check and persisted on disk across reboots.
   bool GetEolStatus(brillo::ErrorPtr* error, int32_t* out_eol_status);
 
+  // Returns the last policy evaluations made by the update manager as JSON,
+  // with the time spent and the variables read by each one.
+  bool GetPolicyEvaluationTrace(brillo::ErrorPtr* error,
+                                std::string* out_policy_evaluation_trace);
+
  private:
   SystemState* system_state_;
 };
@@ -32,6 +32,7 @@ using testing::_;
 using testing::Return;
 using testing::SetArgPointee;
 using update_engine::UpdateAttemptFlags;
+using update_engine::UpdateEnginePerformance;
 
 namespace chromeos_update_engine {
 
@@ -153,6 +154,16 @@ TEST_F(UpdateEngineServiceTest, ResetStatusFails) {
                                UpdateEngineService::kErrorFailed));
 }
 
+TEST_F(UpdateEngineServiceTest, GetPerformanceFails) {
+  EXPECT_CALL(*mock_update_attempter_, GetPerformance(_))
+      .WillOnce(Return(false));
+  UpdateEnginePerformance performance;
+  EXPECT_FALSE(common_service_.GetPerformance(&error_, &performance));
+  ASSERT_NE(nullptr, error_);
+  EXPECT_TRUE(error_->HasError(UpdateEngineService::kErrorDomain,
+                               UpdateEngineService::kErrorFailed));
+}
+
 TEST_F(UpdateEngineServiceTest, GetEolStatusTest) {
   FakePrefs fake_prefs;
   fake_system_state_.set_prefs(&fake_prefs);
@@ -168,4 +179,11 @@ TEST_F(UpdateEngineServiceTest, GetEolStatusTest) {
   EXPECT_EQ(EolStatus::kSecurityOnly, static_cast<EolStatus>(eol_status));
 }
 
+TEST_F(UpdateEngineServiceTest, GetPolicyEvaluationTraceTest) {
+  string trace;
+  EXPECT_TRUE(common_service_.GetPolicyEvaluationTrace(&error_, &trace));
+  EXPECT_EQ(nullptr, error_);
+  EXPECT_NE(string::npos, trace.find("\"evaluations\""));
+}
+
 }  // namespace chromeos_update_engine
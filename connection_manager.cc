@@ -134,6 +134,19 @@ bool ConnectionManager::GetConnectionProperties(
   return true;
 }
 
+bool ConnectionManager::GetConnectionQuality(ConnectionQuality* out_quality) {
+  dbus::ObjectPath default_service_path;
+  TEST_AND_RETURN_FALSE(GetDefaultServicePath(&default_service_path));
+  if (!default_service_path.IsValid())
+    return false;
+  // Shill uses the "/" service path to indicate that it is not connected.
+  if (default_service_path.value() == "/")
+    return false;
+  TEST_AND_RETURN_FALSE(
+      GetServicePathQuality(default_service_path, out_quality));
+  return true;
+}
+
 bool ConnectionManager::GetDefaultServicePath(dbus::ObjectPath* out_path) {
   brillo::VariantDictionary properties;
   brillo::ErrorPtr error;
@@ -202,4 +215,43 @@ bool ConnectionManager::GetServicePathProperties(
   return true;
 }
 
+bool ConnectionManager::GetServicePathQuality(const dbus::ObjectPath& path,
+                                              ConnectionQuality* out_quality) {
+  std::unique_ptr<ServiceProxyInterface> service =
+      shill_proxy_->GetServiceForPath(path);
+
+  brillo::VariantDictionary properties;
+  brillo::ErrorPtr error;
+  TEST_AND_RETURN_FALSE(service->GetProperties(&properties, &error));
+
+  string type_str;
+  const auto& prop_type = properties.find(shill::kTypeProperty);
+  if (prop_type != properties.end())
+    type_str = prop_type->second.TryGet<string>();
+
+  const auto& prop_metered = properties.find(shill::kMeteredProperty);
+  if (prop_metered != properties.end()) {
+    out_quality->metered = prop_metered->second.TryGet<bool>();
+  } else {
+    // Without a user setting, the cellular and tethered networks are the
+    // metered ones.
+    const auto& prop_tethering = properties.find(shill::kTetheringProperty);
+    out_quality->metered =
+        type_str == shill::kTypeCellular ||
+        (prop_tethering != properties.end() &&
+         prop_tethering->second.TryGet<string>() ==
+             shill::kTetheringConfirmedState);
+  }
+
+  // The other services report a fixed strength.
+  out_quality->signal_strength = -1;
+  const auto& prop_strength = properties.find(shill::kStrengthProperty);
+  if (prop_strength != properties.end() &&
+      (type_str == shill::kTypeWifi || type_str == shill::kTypeCellular ||
+       type_str == shill::kTypeWimax)) {
+    out_quality->signal_strength = prop_strength->second.TryGet<uint8_t>();
+  }
+  return true;
+}
+
 }  // namespace chromeos_update_engine
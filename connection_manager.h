@@ -43,6 +43,7 @@ class ConnectionManager : public ConnectionManagerInterface {
                                ConnectionTethering* out_tethering) override;
   bool IsUpdateAllowedOver(ConnectionType type,
                            ConnectionTethering tethering) const override;
+  bool GetConnectionQuality(ConnectionQuality* out_quality) override;
 
  private:
   // Returns (via out_path) the default network path, or empty string if
@@ -53,6 +54,9 @@ class ConnectionManager : public ConnectionManagerInterface {
                                 ConnectionType* out_type,
                                 ConnectionTethering* out_tethering);
 
+  bool GetServicePathQuality(const dbus::ObjectPath& path,
+                             ConnectionQuality* out_quality);
+
   // The mockable interface to access the shill DBus proxies.
   std::unique_ptr<ShillProxyInterface> shill_proxy_;
 
@@ -34,5 +34,9 @@ bool ConnectionManagerAndroid::IsUpdateAllowedOver(
     ConnectionType type, ConnectionTethering tethering) const {
   return true;
 }
+bool ConnectionManagerAndroid::GetConnectionQuality(
+    ConnectionQuality* out_quality) {
+  return false;
+}
 
 }  // namespace chromeos_update_engine
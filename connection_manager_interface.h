@@ -46,6 +46,10 @@ class ConnectionManagerInterface {
   virtual bool IsUpdateAllowedOver(ConnectionType type,
                                    ConnectionTethering tethering) const = 0;
 
+  // Populates |out_quality| with the quality of the network connection that
+  // we are currently connected to. Returns whether it is known.
+  virtual bool GetConnectionQuality(ConnectionQuality* out_quality) = 0;
+
  protected:
   ConnectionManagerInterface() = default;
 
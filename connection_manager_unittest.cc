@@ -69,6 +69,10 @@ class ConnectionManagerTest : public ::testing::Test {
                        const char* physical_technology,
                        const char* service_tethering);
 
+  // Sets the properties of the mocked service |service_path| to |reply_dict|.
+  void SetServiceReplyDict(const string& service_path,
+                           const brillo::VariantDictionary& reply_dict);
+
   void TestWithServiceType(
       const char* service_type,
       const char* physical_technology,
@@ -125,6 +129,11 @@ void ConnectionManagerTest::SetServiceReply(const string& service_path,
   if (service_tethering)
     reply_dict[shill::kTetheringProperty] = string(service_tethering);
 
+  SetServiceReplyDict(service_path, reply_dict);
+}
+
+void ConnectionManagerTest::SetServiceReplyDict(
+    const string& service_path, const brillo::VariantDictionary& reply_dict) {
   std::unique_ptr<ServiceProxyMock> service_proxy_mock(new ServiceProxyMock());
 
   // Plumb return value into mock object.
@@ -392,4 +401,45 @@ TEST_F(ConnectionManagerTest, MalformedServiceList) {
   EXPECT_FALSE(cmut_.GetConnectionProperties(&type, &tethering));
 }
 
+TEST_F(ConnectionManagerTest, ConnectionQualityTest) {
+  brillo::VariantDictionary reply_dict;
+  reply_dict[shill::kTypeProperty] = string(shill::kTypeWifi);
+  reply_dict[shill::kMeteredProperty] = true;
+  reply_dict[shill::kStrengthProperty] = static_cast<uint8_t>(25);
+  SetManagerReply("/service/guest/network", true);
+  SetServiceReplyDict("/service/guest/network", reply_dict);
+
+  ConnectionQuality quality;
+  EXPECT_TRUE(cmut_.GetConnectionQuality(&quality));
+  EXPECT_TRUE(quality.metered);
+  EXPECT_EQ(25, quality.signal_strength);
+}
+
+TEST_F(ConnectionManagerTest, ConnectionQualityDefaultsTest) {
+  // Without a Metered property, the cellular networks are metered.
+  SetManagerReply("/service/guest/network", true);
+  SetServiceReply("/service/guest/network", shill::kTypeCellular, nullptr,
+                  nullptr);
+  ConnectionQuality quality;
+  EXPECT_TRUE(cmut_.GetConnectionQuality(&quality));
+  EXPECT_TRUE(quality.metered);
+  EXPECT_EQ(-1, quality.signal_strength);
+
+  // The strength of the wired networks isn't used.
+  brillo::VariantDictionary reply_dict;
+  reply_dict[shill::kTypeProperty] = string(shill::kTypeEthernet);
+  reply_dict[shill::kStrengthProperty] = static_cast<uint8_t>(100);
+  SetManagerReply("/service/guest/network", true);
+  SetServiceReplyDict("/service/guest/network", reply_dict);
+  EXPECT_TRUE(cmut_.GetConnectionQuality(&quality));
+  EXPECT_FALSE(quality.metered);
+  EXPECT_EQ(-1, quality.signal_strength);
+}
+
+TEST_F(ConnectionManagerTest, ConnectionQualityNotConnectedTest) {
+  SetManagerReply("/", true);
+  ConnectionQuality quality;
+  EXPECT_FALSE(cmut_.GetConnectionQuality(&quality));
+}
+
 }  // namespace chromeos_update_engine
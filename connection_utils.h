@@ -37,6 +37,16 @@ enum class ConnectionTethering {
   kUnknown,
 };
 
+// The quality of a network link, used to plan how to download over it.
+struct ConnectionQuality {
+  // Whether the data sent over the network is metered, as set by the user or
+  // guessed from its type.
+  bool metered{false};
+  // The signal strength of a wireless network, from 0 to 100, or -1 if not
+  // known or not wireless.
+  int signal_strength{-1};
+};
+
 namespace connection_utils {
 // Helper methods for converting shill strings into symbolic values.
 ConnectionType ParseConnectionType(const std::string& type_str);
@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/connection_warmer.h"
+
+#include <set>
+
+#include <base/logging.h>
+#include <base/strings/string_util.h>
+
+#include "update_engine/libcurl_http_fetcher.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns the scheme, the host and the port of the HTTP(S) |url|, or an empty
+// string for the other URLs.
+string GetHttpOrigin(const string& url) {
+  if (!base::StartsWith(url, "http://", base::CompareCase::INSENSITIVE_ASCII) &&
+      !base::StartsWith(
+          url, "https://", base::CompareCase::INSENSITIVE_ASCII)) {
+    return "";
+  }
+  size_t host_start = url.find("://") + 3;
+  return base::ToLowerASCII(
+      url.substr(0, url.find_first_of("/?#", host_start)));
+}
+
+}  // namespace
+
+const size_t ConnectionWarmer::kMaxHosts = 2;
+
+ConnectionWarmer::ConnectionWarmer(ProxyResolver* proxy_resolver,
+                                   HardwareInterface* hardware)
+    : proxy_resolver_(proxy_resolver), hardware_(hardware) {}
+
+ConnectionWarmer::~ConnectionWarmer() {
+  Stop();
+}
+
+void ConnectionWarmer::Start(const vector<string>& urls) {
+  Stop();
+  connections_.clear();
+  for (const string& url : GetWarmUpUrls(urls, kMaxHosts)) {
+    LOG(INFO) << "Warming up the connection to " << GetHttpOrigin(url);
+    LibcurlHttpFetcher* fetcher =
+        new LibcurlHttpFetcher(proxy_resolver_, hardware_);
+    fetcher->set_server_to_check(ServerToCheck::kDownload);
+    // A failure is left to the download, which retries it.
+    fetcher->set_no_network_max_retries(0);
+    fetcher->set_max_retry_count(0);
+    fetcher->set_delegate(this);
+    fetcher->SetOffset(0);
+    fetcher->SetLength(1);
+    connections_.push_back({std::unique_ptr<HttpFetcher>(fetcher), url, true});
+  }
+  // The fetchers may complete right away, so they are only started once the
+  // connections don't move anymore.
+  for (Connection& connection : connections_)
+    connection.fetcher->BeginTransfer(connection.url);
+}
+
+void ConnectionWarmer::Stop() {
+  for (Connection& connection : connections_) {
+    if (connection.active)
+      connection.fetcher->TerminateTransfer();
+  }
+}
+
+// static
+vector<string> ConnectionWarmer::GetWarmUpUrls(const vector<string>& urls,
+                                               size_t max_hosts) {
+  vector<string> warm_up_urls;
+  std::set<string> origins;
+  for (const string& url : urls) {
+    if (warm_up_urls.size() >= max_hosts)
+      break;
+    string origin = GetHttpOrigin(url);
+    if (!origin.empty() && origins.insert(origin).second)
+      warm_up_urls.push_back(url);
+  }
+  return warm_up_urls;
+}
+
+void ConnectionWarmer::TransferComplete(HttpFetcher* fetcher,
+                                        bool successful) {
+  Connection* connection = FindConnection(fetcher);
+  if (!connection)
+    return;
+  connection->active = false;
+  LOG(INFO) << "The connection to " << GetHttpOrigin(connection->url)
+            << (successful ? " is warm." : " couldn't be warmed up.");
+}
+
+void ConnectionWarmer::TransferTerminated(HttpFetcher* fetcher) {
+  Connection* connection = FindConnection(fetcher);
+  if (connection)
+    connection->active = false;
+}
+
+ConnectionWarmer::Connection* ConnectionWarmer::FindConnection(
+    HttpFetcher* fetcher) {
+  for (Connection& connection : connections_) {
+    if (connection.fetcher.get() == fetcher)
+      return &connection;
+  }
+  return nullptr;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,88 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_CONNECTION_WARMER_H_
+#define UPDATE_ENGINE_CONNECTION_WARMER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/http_fetcher.h"
+#include "update_engine/proxy_resolver.h"
+
+namespace chromeos_update_engine {
+
+// Connects to the hosts of the payload URLs of an Omaha response while the
+// response is handled and the policy checked, so the download starts on a
+// warm connection. Each host is sent a request for a single byte of its
+// payload URL: it resolves the host, connects and negotiates TLS, and leaves
+// the connection, the DNS entry and the TLS session in the cache shared by
+// all the LibcurlHttpFetchers, where the download fetchers pick them up. A
+// connect-only transfer would be cheaper, but libcurl never reuses those
+// connections for other transfers.
+class ConnectionWarmer : public HttpFetcherDelegate {
+ public:
+  // The number of hosts connected to, the most likely used first.
+  static const size_t kMaxHosts;
+
+  ConnectionWarmer(ProxyResolver* proxy_resolver, HardwareInterface* hardware);
+  ~ConnectionWarmer() override;
+
+  // Connects to the hosts of the first |urls|, canceling the connections in
+  // progress, if any.
+  void Start(const std::vector<std::string>& urls);
+
+  // Cancels the connections in progress, if any.
+  void Stop();
+
+  // Returns the first URL of each of the first |max_hosts| HTTP(S) hosts in
+  // |urls|, in order.
+  static std::vector<std::string> GetWarmUpUrls(
+      const std::vector<std::string>& urls, size_t max_hosts);
+
+  // HttpFetcherDelegate overrides.
+  void ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {}
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+  void TransferTerminated(HttpFetcher* fetcher) override;
+
+ private:
+  // A request to one of the hosts, |active| until it completes.
+  struct Connection {
+    std::unique_ptr<HttpFetcher> fetcher;
+    std::string url;
+    bool active;
+  };
+
+  // Returns the connection using |fetcher|, or nullptr if none does.
+  Connection* FindConnection(HttpFetcher* fetcher);
+
+  ProxyResolver* proxy_resolver_;
+  HardwareInterface* hardware_;
+
+  std::vector<Connection> connections_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConnectionWarmer);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_CONNECTION_WARMER_H_
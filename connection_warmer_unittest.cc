@@ -0,0 +1,49 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/connection_warmer.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+TEST(ConnectionWarmerTest, GetWarmUpUrlsTest) {
+  vector<string> urls = {
+      "file:///data/payload.bin",
+      "https://cdn1.example.com/a/payload.bin",
+      "HTTPS://CDN1.example.com/b/payload.bin",
+      "http://cdn1.example.com/a/payload.bin",
+      "https://cdn2.example.com:8443/payload.bin",
+  };
+  // The non HTTP URLs are skipped, and the hosts only counted once per
+  // scheme and port.
+  EXPECT_EQ((vector<string>{"https://cdn1.example.com/a/payload.bin",
+                            "http://cdn1.example.com/a/payload.bin"}),
+            ConnectionWarmer::GetWarmUpUrls(urls, 2));
+  EXPECT_EQ((vector<string>{"https://cdn1.example.com/a/payload.bin",
+                            "http://cdn1.example.com/a/payload.bin",
+                            "https://cdn2.example.com:8443/payload.bin"}),
+            ConnectionWarmer::GetWarmUpUrls(urls, 5));
+  EXPECT_TRUE(ConnectionWarmer::GetWarmUpUrls({}, 2).empty());
+}
+
+}  // namespace chromeos_update_engine
@@ -110,6 +110,8 @@ void UpdateEngineDaemon::OnDBusRegistered(bool succeeded) {
     QuitWithExitCode(1);
     return;
   }
+  // The method calls are only dispatched once this returns, so the objects
+  // initialized when starting the updater are available to all of them.
   daemon_state_->StartUpdater();
 }
 #endif  // USE_DBUS
@@ -25,6 +25,7 @@ namespace chromeos_update_engine {
 using brillo::ErrorPtr;
 using chromeos_update_engine::UpdateEngineService;
 using std::string;
+using update_engine::UpdateEnginePerformance;
 using update_engine::UpdateEngineStatus;
 
 DBusUpdateEngineService::DBusUpdateEngineService(SystemState* system_state)
@@ -92,6 +93,27 @@ bool DBusUpdateEngineService::GetStatus(ErrorPtr* error,
   return true;
 }
 
+bool DBusUpdateEngineService::GetPerformance(
+    ErrorPtr* error,
+    int64_t* out_download_bytes_per_second,
+    int64_t* out_apply_bytes_per_second,
+    int64_t* out_disk_write_bytes_per_second,
+    int64_t* out_eta_seconds,
+    string* out_current_operation_type,
+    int64_t* out_current_operation_index) {
+  UpdateEnginePerformance performance;
+  if (!common_->GetPerformance(error, &performance)) {
+    return false;
+  }
+  *out_download_bytes_per_second = performance.download_bytes_per_second;
+  *out_apply_bytes_per_second = performance.apply_bytes_per_second;
+  *out_disk_write_bytes_per_second = performance.disk_write_bytes_per_second;
+  *out_eta_seconds = performance.eta_seconds;
+  *out_current_operation_type = performance.current_operation_type;
+  *out_current_operation_index = performance.current_operation_index;
+  return true;
+}
+
 bool DBusUpdateEngineService::RebootIfNeeded(ErrorPtr* error) {
   return common_->RebootIfNeeded(error);
 }
@@ -163,6 +185,11 @@ bool DBusUpdateEngineService::GetEolStatus(ErrorPtr* error,
   return common_->GetEolStatus(error, out_eol_status);
 }
 
+bool DBusUpdateEngineService::GetPolicyEvaluationTrace(
+    ErrorPtr* error, string* out_policy_evaluation_trace) {
+  return common_->GetPolicyEvaluationTrace(error, out_policy_evaluation_trace);
+}
+
 UpdateEngineAdaptor::UpdateEngineAdaptor(SystemState* system_state)
     : org::chromium::UpdateEngineInterfaceAdaptor(&dbus_service_),
       bus_(DBusConnection::Get()->GetDBus()),
@@ -69,6 +69,16 @@ class DBusUpdateEngineService
                  std::string* out_new_version,
                  int64_t* out_new_size) override;
 
+  // Returns the current throughput of the update in progress, the estimated
+  // time left to download it and the install operation being applied.
+  bool GetPerformance(brillo::ErrorPtr* error,
+                      int64_t* out_download_bytes_per_second,
+                      int64_t* out_apply_bytes_per_second,
+                      int64_t* out_disk_write_bytes_per_second,
+                      int64_t* out_eta_seconds,
+                      std::string* out_current_operation_type,
+                      int64_t* out_current_operation_index) override;
+
   // Reboots the device if an update is applied and a reboot is required.
   bool RebootIfNeeded(brillo::ErrorPtr* error) override;
 
@@ -144,6 +154,11 @@ class DBusUpdateEngineService
   // Returns the current end-of-life status of the device in |out_eol_status|.
   bool GetEolStatus(brillo::ErrorPtr* error, int32_t* out_eol_status) override;
 
+  // Returns the last policy evaluations of the update manager as JSON.
+  bool GetPolicyEvaluationTrace(
+      brillo::ErrorPtr* error,
+      std::string* out_policy_evaluation_trace) override;
+
  private:
   std::unique_ptr<UpdateEngineService> common_;
 };
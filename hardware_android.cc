@@ -31,6 +31,7 @@
 
 #include "update_engine/common/hardware.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/common/resource_scheduler.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/utils_android.h"
 
@@ -59,6 +60,9 @@ const char kPropBootHardwareSKU[] = "ro.boot.hardware.sku";
 const char kPropBootRevision[] = "ro.boot.revision";
 const char kPropBuildDateUTC[] = "ro.build.date.utc";
 
+// The sysfs directory with the power supply, backlight and thermal devices.
+const char kSysfsClassDir[] = "/sys/class";
+
 // Write a recovery command line |message| to the BCB. The arguments to recovery
 // must be separated by '\n'. An empty string will erase the BCB.
 bool WriteBootloaderRecoveryMessage(const string& message) {
@@ -210,4 +214,8 @@ void HardwareAndroid::SetFirstActiveOmahaPingSent() {
   return;
 }
 
+bool HardwareAndroid::GetDeviceActivity(DeviceActivity* activity) const {
+  return ReadSysfsDeviceActivity(base::FilePath(kSysfsClassDir), activity);
+}
+
 }  // namespace chromeos_update_engine
@@ -33,6 +33,7 @@ extern "C" {
 #include "update_engine/common/hardware.h"
 #include "update_engine/common/hwid_override.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/common/resource_scheduler.h"
 #include "update_engine/common/subprocess.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/dbus_connection.h"
@@ -70,6 +71,9 @@ const char* kConfigOptsIsOOBEEnabled = "is_oobe_enabled";
 
 const char* kActivePingKey = "first_active_omaha_ping_sent";
 
+// The sysfs directory with the power supply, backlight and thermal devices.
+const char kSysfsClassDir[] = "/sys/class";
+
 }  // namespace
 
 namespace chromeos_update_engine {
@@ -299,4 +303,8 @@ void HardwareChromeOS::SetFirstActiveOmahaPingSent() {
   }
 }
 
+bool HardwareChromeOS::GetDeviceActivity(DeviceActivity* activity) const {
+  return ReadSysfsDeviceActivity(base::FilePath(kSysfsClassDir), activity);
+}
+
 }  // namespace chromeos_update_engine
@@ -54,6 +54,7 @@ class HardwareChromeOS final : public HardwareInterface {
   int64_t GetBuildTimestamp() const override;
   bool GetFirstActiveOmahaPingSent() const override;
   void SetFirstActiveOmahaPingSent() override;
+  bool GetDeviceActivity(DeviceActivity* activity) const override;
 
  private:
   friend class HardwareChromeOSTest;
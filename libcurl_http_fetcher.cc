@@ -20,6 +20,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <set>
 #include <string>
 
 #include <base/bind.h>
@@ -36,11 +37,13 @@
 
 #include "update_engine/certificate_checker.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/hot_path_log.h"
 #include "update_engine/common/platform_constants.h"
 
 using base::TimeDelta;
 using brillo::MessageLoop;
 using std::max;
+using std::min;
 using std::string;
 
 // This is a concrete implementation of HttpFetcher that uses libcurl to do the
@@ -67,27 +70,50 @@ int LibcurlSockoptCallback(void* /* clientp */,
   return CURL_SOCKOPT_OK;
 }
 
+// Returns the curl share handle used by all the fetchers of the process. It
+// keeps the open connections, the DNS cache and the TLS sessions across the
+// transfers, so the update checks, the payload ranges and the retries reuse
+// the connection to a server instead of connecting and negotiating TLS again.
+// The fetchers only run on the main loop thread, so the share needs no lock
+// callbacks.
+CURLSH* GetCurlShare() {
+  static CURLSH* share = [] {
+    CURLSH* share = curl_share_init();
+    CHECK(share);
+    CHECK_EQ(curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS),
+             CURLSHE_OK);
+    CHECK_EQ(
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION),
+        CURLSHE_OK);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    // The connection cache can only be shared since libcurl 7.57.0.
+    CHECK_EQ(curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT),
+             CURLSHE_OK);
+#endif  // LIBCURL_VERSION_NUM >= 0x073900
+    return share;
+  }();
+  return share;
+}
+
+// The fetchers alive in the process, never freed.
+std::set<LibcurlHttpFetcher*>* GetFetchers() {
+  static std::set<LibcurlHttpFetcher*>* fetchers =
+      new std::set<LibcurlHttpFetcher*>();
+  return fetchers;
+}
+
 }  // namespace
 
 // static
-int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* clientp,
+int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* /* clientp */,
                                                    curl_socket_t item) {
 #ifdef __ANDROID__
   qtaguid_untagSocket(item);
 #endif  // __ANDROID__
-  LibcurlHttpFetcher* fetcher = static_cast<LibcurlHttpFetcher*>(clientp);
-  // Stop watching the socket before closing it.
-  for (size_t t = 0; t < arraysize(fetcher->fd_task_maps_); ++t) {
-    const auto fd_task_pair = fetcher->fd_task_maps_[t].find(item);
-    if (fd_task_pair != fetcher->fd_task_maps_[t].end()) {
-      if (!MessageLoop::current()->CancelTask(fd_task_pair->second)) {
-        LOG(WARNING) << "Error canceling the watch task "
-                     << fd_task_pair->second << " for "
-                     << (t ? "writing" : "reading") << " the fd " << item;
-      }
-      fetcher->fd_task_maps_[t].erase(item);
-    }
-  }
+  // Stop watching the socket before closing it. The fetcher which opened it
+  // may be gone already.
+  for (LibcurlHttpFetcher* fetcher : *GetFetchers())
+    fetcher->StopWatchingFd(item);
 
   // Documentation for this callback says to return 0 on success or 1 on error.
   if (!IGNORE_EINTR(close(item)))
@@ -100,10 +126,13 @@ LibcurlHttpFetcher::LibcurlHttpFetcher(ProxyResolver* proxy_resolver,
     : HttpFetcher(proxy_resolver), hardware_(hardware) {
   // Dev users want a longer timeout (180 seconds) because they may
   // be waiting on the dev server to build an image.
-  if (!hardware_->IsOfficialBuild())
+  if (!hardware_->IsOfficialBuild()) {
     low_speed_time_seconds_ = kDownloadDevModeLowSpeedTimeSeconds;
+    tune_timeouts_ = false;
+  }
   if (hardware_->IsOOBEEnabled() && !hardware_->IsOOBEComplete(nullptr))
     max_retry_count_ = kDownloadMaxRetryCountOobeNotComplete;
+  GetFetchers()->insert(this);
 }
 
 LibcurlHttpFetcher::~LibcurlHttpFetcher() {
@@ -111,6 +140,21 @@ LibcurlHttpFetcher::~LibcurlHttpFetcher() {
       << "Destroying the fetcher while a transfer is in progress.";
   CancelProxyResolution();
   CleanUp();
+  GetFetchers()->erase(this);
+}
+
+void LibcurlHttpFetcher::StopWatchingFd(int fd) {
+  for (size_t t = 0; t < arraysize(fd_task_maps_); ++t) {
+    const auto fd_task_pair = fd_task_maps_[t].find(fd);
+    if (fd_task_pair != fd_task_maps_[t].end()) {
+      if (!MessageLoop::current()->CancelTask(fd_task_pair->second)) {
+        LOG(WARNING) << "Error canceling the watch task "
+                     << fd_task_pair->second << " for "
+                     << (t ? "writing" : "reading") << " the fd " << fd;
+      }
+      fd_task_maps_[t].erase(fd_task_pair);
+    }
+  }
 }
 
 bool LibcurlHttpFetcher::GetProxyType(const string& proxy,
@@ -143,7 +187,7 @@ bool LibcurlHttpFetcher::GetProxyType(const string& proxy,
 }
 
 void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
-  LOG(INFO) << "Starting/Resuming transfer";
+  HOT_PATH_LOG(INFO) << "Starting/Resuming transfer";
   CHECK(!transfer_in_progress_);
   url_ = url;
   curl_multi_handle_ = curl_multi_init();
@@ -152,6 +196,16 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   curl_handle_ = curl_easy_init();
   CHECK(curl_handle_);
   ignore_failure_ = false;
+  round_trip_time_measured_ = false;
+
+  CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_SHARE, GetCurlShare()),
+           CURLE_OK);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+  // Negotiate HTTP/2 on the TLS connections, falling back to HTTP/1.1. This
+  // fails harmlessly when libcurl was built without HTTP/2 support.
+  curl_easy_setopt(
+      curl_handle_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif  // LIBCURL_VERSION_NUM >= 0x072f00
 
   // Tag and untag the socket for network usage stats.
   curl_easy_setopt(
@@ -162,7 +216,7 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
 
   CHECK(HasProxy());
   bool is_direct = (GetCurrentProxy() == kNoProxy);
-  LOG(INFO) << "Using proxy: " << (is_direct ? "no" : "yes");
+  HOT_PATH_LOG(INFO) << "Using proxy: " << (is_direct ? "no" : "yes");
   if (is_direct) {
     CHECK_EQ(curl_easy_setopt(curl_handle_,
                               CURLOPT_PROXY,
@@ -214,8 +268,19 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   CHECK_EQ(
       curl_easy_setopt(curl_handle_, CURLOPT_HTTPHEADER, curl_http_headers_),
       CURLE_OK);
+  // An empty string advertises all the codings libcurl can decode.
+  CHECK_EQ(curl_easy_setopt(curl_handle_,
+                            CURLOPT_ACCEPT_ENCODING,
+                            accept_encoding_ ? "" : nullptr),
+           CURLE_OK);
 
-  if (bytes_downloaded_ > 0 || download_length_) {
+  if (!multiple_ranges_.empty()) {
+    // The body doesn't map to a single offset, so it can't be resumed.
+    resume_offset_ = 0;
+    CHECK_EQ(curl_easy_setopt(
+                 curl_handle_, CURLOPT_RANGE, multiple_ranges_.c_str()),
+             CURLE_OK);
+  } else if (bytes_downloaded_ > 0 || download_length_) {
     // Resume from where we left off.
     resume_offset_ = bytes_downloaded_;
     CHECK_GE(resume_offset_, 0);
@@ -240,20 +305,45 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_WRITEDATA, this), CURLE_OK);
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_WRITEFUNCTION,
                             StaticLibcurlWrite), CURLE_OK);
+  response_headers_.clear();
+  CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_HEADERDATA, this), CURLE_OK);
+  CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_HEADERFUNCTION,
+                            StaticLibcurlHeader), CURLE_OK);
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_URL, url_.c_str()),
            CURLE_OK);
 
-  // If the connection drops under |low_speed_limit_bps_| (10
-  // bytes/sec by default) for |low_speed_time_seconds_| (90 seconds,
-  // 180 on non-official builds), reconnect.
+  // If the connection drops under |low_speed_limit_bps_| (1
+  // byte/sec by default) for |low_speed_time_seconds_| (90 seconds,
+  // 180 on non-official builds), reconnect. Unless set explicitly, these
+  // and the connect timeout follow the throughput observed so far.
+  int low_speed_limit_bps = low_speed_limit_bps_;
+  int low_speed_time_seconds = low_speed_time_seconds_;
+  int connect_timeout_seconds = connect_timeout_seconds_;
+  if (throughput_estimator_ && tune_timeouts_) {
+    low_speed_limit_bps = throughput_estimator_->GetLowSpeedLimitBps();
+    low_speed_time_seconds = throughput_estimator_->GetLowSpeedTimeSeconds();
+    connect_timeout_seconds =
+        throughput_estimator_->GetConnectTimeoutSeconds();
+    // Don't mistake a download capped by the rate limit for a stall.
+    if (bandwidth_limiter_ && bandwidth_limiter_->rate() > 0) {
+      low_speed_limit_bps = min<int64_t>(
+          low_speed_limit_bps,
+          max<int64_t>(bandwidth_limiter_->rate() / 32,
+                       kDownloadLowSpeedLimitBps));
+    }
+    LOG(INFO) << "Tuned the timeouts to a low speed limit of "
+              << low_speed_limit_bps << " bytes/s for "
+              << low_speed_time_seconds << " seconds and a connect timeout of "
+              << connect_timeout_seconds << " seconds.";
+  }
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_LOW_SPEED_LIMIT,
-                            low_speed_limit_bps_),
+                            low_speed_limit_bps),
            CURLE_OK);
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_LOW_SPEED_TIME,
-                            low_speed_time_seconds_),
+                            low_speed_time_seconds),
            CURLE_OK);
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_CONNECTTIMEOUT,
-                            connect_timeout_seconds_),
+                            connect_timeout_seconds),
            CURLE_OK);
 
   // By default, libcurl doesn't follow redirections. Allow up to
@@ -293,7 +383,7 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
 
 // Lock down only the protocol in case of HTTP.
 void LibcurlHttpFetcher::SetCurlOptionsForHttp() {
-  LOG(INFO) << "Setting up curl options for HTTP";
+  HOT_PATH_LOG(INFO) << "Setting up curl options for HTTP";
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_PROTOCOLS, CURLPROTO_HTTP),
            CURLE_OK);
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_REDIR_PROTOCOLS,
@@ -305,7 +395,7 @@ void LibcurlHttpFetcher::SetCurlOptionsForHttp() {
 // verification is enabled, restricts the set of trusted certificates,
 // restricts protocols to HTTPS, restricts ciphers to HIGH.
 void LibcurlHttpFetcher::SetCurlOptionsForHttps() {
-  LOG(INFO) << "Setting up curl options for HTTPS";
+  HOT_PATH_LOG(INFO) << "Setting up curl options for HTTPS";
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_SSL_VERIFYPEER, 1),
            CURLE_OK);
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_SSL_VERIFYHOST, 2),
@@ -332,7 +422,7 @@ void LibcurlHttpFetcher::SetCurlOptionsForHttps() {
 
 // Lock down only the protocol in case of a local file.
 void LibcurlHttpFetcher::SetCurlOptionsForFile() {
-  LOG(INFO) << "Setting up curl options for FILE";
+  HOT_PATH_LOG(INFO) << "Setting up curl options for FILE";
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_PROTOCOLS, CURLPROTO_FILE),
            CURLE_OK);
   CHECK_EQ(
@@ -395,6 +485,50 @@ void LibcurlHttpFetcher::SetHeader(const string& header_name,
   extra_headers_[base::ToLowerASCII(header_name)] = header_line;
 }
 
+bool LibcurlHttpFetcher::SetMultipleRanges(
+    const std::vector<std::pair<off_t, size_t>>& ranges) {
+  multiple_ranges_.clear();
+  for (const auto& range : ranges) {
+    CHECK_GT(range.second, 0U);
+    if (!multiple_ranges_.empty())
+      multiple_ranges_ += ",";
+    multiple_ranges_ += base::StringPrintf(
+        "%" PRIu64 "-%" PRIu64,
+        static_cast<uint64_t>(range.first),
+        static_cast<uint64_t>(range.first) + range.second - 1);
+  }
+  // The ranges of the whole body are passed to the delegate.
+  bytes_downloaded_ = 0;
+  download_length_ = 0;
+  return true;
+}
+
+string LibcurlHttpFetcher::GetResponseHeader(const string& header_name) const {
+  const auto it = response_headers_.find(base::ToLowerASCII(header_name));
+  if (it == response_headers_.end())
+    return "";
+  return it->second;
+}
+
+size_t LibcurlHttpFetcher::LibcurlHeader(char* buffer,
+                                         size_t size,
+                                         size_t nitems) {
+  const size_t length = size * nitems;
+  string line(buffer, length);
+  // A status line starts a new response, for example after a redirect.
+  if (base::StartsWith(line, "HTTP/", base::CompareCase::SENSITIVE)) {
+    response_headers_.clear();
+    return length;
+  }
+  size_t colon = line.find(':');
+  if (colon != string::npos) {
+    string value;
+    base::TrimWhitespaceASCII(line.substr(colon + 1), base::TRIM_ALL, &value);
+    response_headers_[base::ToLowerASCII(line.substr(0, colon))] = value;
+  }
+  return length;
+}
+
 void LibcurlHttpFetcher::CurlPerformOnce() {
   CHECK(transfer_in_progress_);
   int running_handles = 0;
@@ -430,7 +564,7 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
 
   GetHttpResponseCode();
   if (http_response_code_) {
-    LOG(INFO) << "HTTP response code: " << http_response_code_;
+    HOT_PATH_LOG(INFO) << "HTTP response code: " << http_response_code_;
     no_network_retry_count_ = 0;
   } else {
     LOG(ERROR) << "Unable to get http response code.";
@@ -468,6 +602,10 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
     LOG(INFO) << "Transfer resulted in an error (" << http_response_code_
               << "), " << bytes_downloaded_ << " bytes downloaded";
 
+    // The next transfers try the proxies which couldn't be connected to
+    // last, so they don't wait for them to time out again.
+    if (http_response_code_ == 0 && proxy_resolver())
+      proxy_resolver()->ReportProxyFailure(url_, GetCurrentProxy());
     PopProxy();  // Delete the proxy we just gave up on.
 
     if (HasProxy()) {
@@ -484,6 +622,15 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
         delegate_->TransferComplete(this, false);  // signal fail
       return;
     }
+  } else if ((transfer_size_ >= 0) && (bytes_downloaded_ < transfer_size_) &&
+             !multiple_ranges_.empty()) {
+    // Restarting would send the parts already received again, so leave it to
+    // the delegate to request the missing ranges.
+    LOG(INFO) << "Transfer of multiple ranges interrupted after downloading "
+              << bytes_downloaded_ << " of " << transfer_size_ << " bytes.";
+    if (delegate_)
+      delegate_->TransferComplete(this, false);  // signal fail
+    return;
   } else if ((transfer_size_ >= 0) && (bytes_downloaded_ < transfer_size_)) {
     if (!ignore_failure_)
       retry_count_++;
@@ -506,8 +653,8 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
                    base::Unretained(this)),
         TimeDelta::FromSeconds(retry_seconds_));
   } else {
-    LOG(INFO) << "Transfer completed (" << http_response_code_
-              << "), " << bytes_downloaded_ << " bytes downloaded";
+    HOT_PATH_LOG(INFO) << "Transfer completed (" << http_response_code_
+                       << "), " << bytes_downloaded_ << " bytes downloaded";
     if (delegate_) {
       bool success = IsHttpResponseSuccess();
       delegate_->TransferComplete(this, success);
@@ -539,18 +686,68 @@ size_t LibcurlHttpFetcher::LibcurlWrite(void *ptr, size_t size, size_t nmemb) {
                                CURLINFO_CONTENT_LENGTH_DOWNLOAD,
                                &transfer_size_double), CURLE_OK);
     off_t new_transfer_size = static_cast<off_t>(transfer_size_double);
-    if (new_transfer_size > 0) {
+    // The length of a compressed body doesn't match the decompressed bytes
+    // passed to the delegate.
+    if (new_transfer_size > 0 &&
+        GetResponseHeader("Content-Encoding").empty()) {
       transfer_size_ = resume_offset_ + new_transfer_size;
     }
   }
   bytes_downloaded_ += payload_size;
+  if (throughput_estimator_) {
+    throughput_estimator_->AddBytes(payload_size);
+    if (!round_trip_time_measured_) {
+      // The TCP handshake takes one round trip. It isn't measured when the
+      // connection is reused, which leaves the connect time at zero.
+      round_trip_time_measured_ = true;
+      double connect_time, namelookup_time;
+      if (curl_easy_getinfo(curl_handle_, CURLINFO_CONNECT_TIME,
+                            &connect_time) == CURLE_OK &&
+          curl_easy_getinfo(curl_handle_, CURLINFO_NAMELOOKUP_TIME,
+                            &namelookup_time) == CURLE_OK) {
+        throughput_estimator_->AddRoundTripTime(
+            TimeDelta::FromMicroseconds(static_cast<int64_t>(
+                (connect_time - namelookup_time) *
+                base::Time::kMicrosecondsPerSecond)));
+      }
+    }
+  }
   in_write_callback_ = true;
   if (delegate_)
     delegate_->ReceivedBytes(this, ptr, payload_size);
   in_write_callback_ = false;
+  if (bandwidth_limiter_)
+    ThrottleTransfer(bandwidth_limiter_->ConsumeBytes(payload_size));
   return payload_size;
 }
 
+void LibcurlHttpFetcher::ThrottleTransfer(TimeDelta delay) {
+  if (delay.is_zero() || !transfer_in_progress_ ||
+      throttle_task_id_ != MessageLoop::kTaskIdNull) {
+    return;
+  }
+  // Only the receiving is stopped, unless the transfer is paused as well.
+  CHECK(curl_handle_);
+  CHECK_EQ(curl_easy_pause(curl_handle_,
+                           transfer_paused_ ? CURLPAUSE_ALL : CURLPAUSE_RECV),
+           CURLE_OK);
+  throttle_task_id_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&LibcurlHttpFetcher::ThrottleTimeoutCallback,
+                 base::Unretained(this)),
+      delay);
+}
+
+void LibcurlHttpFetcher::ThrottleTimeoutCallback() {
+  throttle_task_id_ = MessageLoop::kTaskIdNull;
+  // A paused transfer continues receiving once unpaused.
+  if (transfer_paused_ || !transfer_in_progress_)
+    return;
+  CHECK(curl_handle_);
+  CHECK_EQ(curl_easy_pause(curl_handle_, CURLPAUSE_CONT), CURLE_OK);
+  CurlPerformOnce();
+}
+
 void LibcurlHttpFetcher::Pause() {
   if (transfer_paused_) {
     LOG(ERROR) << "Fetcher already paused.";
@@ -584,7 +781,12 @@ void LibcurlHttpFetcher::Unpause() {
     return;
   }
   CHECK(curl_handle_);
-  CHECK_EQ(curl_easy_pause(curl_handle_, CURLPAUSE_CONT), CURLE_OK);
+  // Keep the receiving stopped while throttled.
+  CHECK_EQ(curl_easy_pause(curl_handle_,
+                           throttle_task_id_ == MessageLoop::kTaskIdNull
+                               ? CURLPAUSE_CONT
+                               : CURLPAUSE_RECV),
+           CURLE_OK);
   // Since the transfer is in progress, we need to dispatch a CurlPerformOnce()
   // now to let the connection continue, otherwise it would be called by the
   // TimeoutCallback but with a delay.
@@ -661,7 +863,7 @@ void LibcurlHttpFetcher::SetupMessageLoopSources() {
       static int io_counter = 0;
       io_counter++;
       if (io_counter % 50 == 0) {
-        LOG(INFO) << "io_counter = " << io_counter;
+        HOT_PATH_LOG(INFO) << "io_counter = " << io_counter;
       }
     }
   }
@@ -709,6 +911,9 @@ void LibcurlHttpFetcher::CleanUp() {
   MessageLoop::current()->CancelTask(timeout_id_);
   timeout_id_ = MessageLoop::kTaskIdNull;
 
+  MessageLoop::current()->CancelTask(throttle_task_id_);
+  throttle_task_id_ = MessageLoop::kTaskIdNull;
+
   for (size_t t = 0; t < arraysize(fd_task_maps_); ++t) {
     for (const auto& fd_taks_pair : fd_task_maps_[t]) {
       if (!MessageLoop::current()->CancelTask(fd_taks_pair.second)) {
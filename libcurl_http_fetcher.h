@@ -21,6 +21,7 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <curl/curl.h>
 
@@ -50,6 +51,9 @@ class LibcurlHttpFetcher : public HttpFetcher {
   void SetLength(size_t length) override { download_length_ = length; }
   void UnsetLength() override { SetLength(0); }
 
+  bool SetMultipleRanges(
+      const std::vector<std::pair<off_t, size_t>>& ranges) override;
+
   // Begins the transfer if it hasn't already begun.
   void BeginTransfer(const std::string& url) override;
 
@@ -61,6 +65,9 @@ class LibcurlHttpFetcher : public HttpFetcher {
   void SetHeader(const std::string& header_name,
                  const std::string& header_value) override;
 
+  std::string GetResponseHeader(
+      const std::string& header_name) const override;
+
   // Suspend the transfer by calling curl_easy_pause(CURLPAUSE_ALL).
   void Pause() override;
 
@@ -81,6 +88,10 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Sets the retry timeout. Useful for testing.
   void set_retry_seconds(int seconds) override { retry_seconds_ = seconds; }
 
+  void set_accept_encoding(bool accept_encoding) override {
+    accept_encoding_ = accept_encoding;
+  }
+
   void set_no_network_max_retries(int retries) {
     no_network_max_retries_ = retries;
   }
@@ -96,10 +107,12 @@ class LibcurlHttpFetcher : public HttpFetcher {
   void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {
     low_speed_limit_bps_ = low_speed_bps;
     low_speed_time_seconds_ = low_speed_sec;
+    tune_timeouts_ = false;
   }
 
   void set_connect_timeout(int connect_timeout_seconds) override {
     connect_timeout_seconds_ = connect_timeout_seconds;
+    tune_timeouts_ = false;
   }
 
   void set_max_retry_count(int max_retry_count) override {
@@ -109,8 +122,13 @@ class LibcurlHttpFetcher : public HttpFetcher {
  private:
   // libcurl's CURLOPT_CLOSESOCKETFUNCTION callback function. Called when
   // closing a socket created with the CURLOPT_OPENSOCKETFUNCTION callback.
+  // The connections are shared by all the fetchers, so the socket may be
+  // closed by a different fetcher than the one which opened it.
   static int LibcurlCloseSocketCallback(void* clientp, curl_socket_t item);
 
+  // Stops watching the file descriptor |fd|, if watched.
+  void StopWatchingFd(int fd);
+
   // Callback for when proxy resolution has completed. This begins the
   // transfer.
   void ProxiesResolved();
@@ -158,8 +176,21 @@ class LibcurlHttpFetcher : public HttpFetcher {
         LibcurlWrite(ptr, size, nmemb);
   }
 
+  // Callback called by libcurl for each header line of the response.
+  size_t LibcurlHeader(char* buffer, size_t size, size_t nitems);
+  static size_t StaticLibcurlHeader(char* buffer, size_t size,
+                                    size_t nitems, void* userdata) {
+    return reinterpret_cast<LibcurlHttpFetcher*>(userdata)->
+        LibcurlHeader(buffer, size, nitems);
+  }
+
+  // Stops receiving for |delay|, if not zero, to stay within the rate of the
+  // |bandwidth_limiter_|.
+  void ThrottleTransfer(base::TimeDelta delay);
+  void ThrottleTimeoutCallback();
+
   // Cleans up the following if they are non-null:
-  // curl(m) handles, fd_task_maps_, timeout_id_.
+  // curl(m) handles, fd_task_maps_, timeout_id_, throttle_task_id_.
   void CleanUp();
 
   // Force terminate the transfer. This will invoke the delegate's (if any)
@@ -192,6 +223,9 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // The extra headers that will be sent on each request.
   std::map<std::string, std::string> extra_headers_;
 
+  // The headers of the last response received, by lower case name.
+  std::map<std::string, std::string> response_headers_;
+
   // Lists of all read(0)/write(1) file descriptors that we're waiting on from
   // the message loop. libcurl may open/close descriptors and switch their
   // directions so maintain two separate lists so that watch conditions can be
@@ -224,6 +258,13 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // unspecified length.
   size_t download_length_{0};
 
+  // Whether libcurl decompresses the response, see set_accept_encoding().
+  bool accept_encoding_{false};
+
+  // The value of the Range header requesting several ranges, or empty when a
+  // single one is requested.
+  std::string multiple_ranges_;
+
   // If we resumed an earlier transfer, data offset that we used for the
   // new connection.  0 otherwise.
   // In this class, resume refers to resuming a dropped HTTP connection,
@@ -240,6 +281,10 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // When waiting for a retry, the task id of the retry callback.
   brillo::MessageLoop::TaskId retry_task_id_{brillo::MessageLoop::kTaskIdNull};
 
+  // While the receiving is throttled, the task id of the callback resuming it.
+  brillo::MessageLoop::TaskId throttle_task_id_{
+      brillo::MessageLoop::kTaskIdNull};
+
   // Number of resumes due to no network (e.g., HTTP response code 0).
   int no_network_retry_count_{0};
   int no_network_max_retries_{0};
@@ -267,6 +312,13 @@ class LibcurlHttpFetcher : public HttpFetcher {
   int low_speed_time_seconds_{kDownloadLowSpeedTimeSeconds};
   int connect_timeout_seconds_{kDownloadConnectTimeoutSeconds};
 
+  // Whether the timeouts above are replaced by the ones derived from the
+  // |throughput_estimator_|, if any. Cleared when they are set explicitly.
+  bool tune_timeouts_{true};
+
+  // Whether the round trip time of the current connection was measured.
+  bool round_trip_time_measured_{false};
+
   DISALLOW_COPY_AND_ASSIGN(LibcurlHttpFetcher);
 };
 
@@ -33,6 +33,7 @@
 #include <base/strings/stringprintf.h>
 #include <brillo/flag_helper.h>
 
+#include "update_engine/common/hot_path_log.h"
 #include "update_engine/common/terminator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/daemon.h"
@@ -164,6 +165,10 @@ int main(int argc, char** argv) {
               "Write logs to stderr instead of to a file in log_dir.");
   DEFINE_bool(foreground, false,
               "Don't daemon()ize; run in foreground.");
+  DEFINE_bool(full_hot_path_logs, false,
+              "Log every message of the hot paths, such as the ones of each "
+              "payload operation or transfer, synchronously instead of "
+              "limiting their rate and writing them on a background thread.");
 
   chromeos_update_engine::Terminator::Init();
   brillo::FlagHelper::Init(argc, argv, "Chromium OS Update Engine");
@@ -176,6 +181,9 @@ int main(int argc, char** argv) {
   bool log_to_system = FLAGS_logtostderr;
   bool log_to_file = FLAGS_logtofile || !FLAGS_logtostderr;
   chromeos_update_engine::SetupLogging(log_to_system, log_to_file);
+  chromeos_update_engine::HotPathLogger::Get()->SetFullVerbosity(
+      FLAGS_full_hot_path_logs);
+  chromeos_update_engine::HotPathLogger::InstallCrashHandler();
   if (!FLAGS_foreground)
     PLOG_IF(FATAL, daemon(0, 0) == 1) << "daemon() failed";
 
@@ -194,6 +202,7 @@ int main(int argc, char** argv) {
   chromeos_update_engine::UpdateEngineDaemon update_engine_daemon;
   int exit_code = update_engine_daemon.Run();
 
+  chromeos_update_engine::HotPathLogger::Get()->Flush();
   LOG(INFO) << "Chrome OS Update Engine terminating with exit code "
             << exit_code;
   return exit_code;
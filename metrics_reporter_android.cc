@@ -16,12 +16,15 @@
 
 #include "update_engine/metrics_reporter_android.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 
+#include <base/strings/string_util.h>
 #include <metricslogger/metrics_logger.h>
 
 #include "update_engine/common/constants.h"
+#include "update_engine/payload_consumer/apply_stats.h"
 
 namespace {
 void LogHistogram(const std::string& metrics, int value) {
@@ -69,6 +72,56 @@ constexpr char
     kMetricsUpdateEngineSuccessfulUpdateDownloadOverheadPercentage[] =
         "ota_update_engine_successful_update_download_overhead_percentage";
 
+constexpr char kMetricsUpdateEngineApplyWaitForDataSeconds[] =
+    "ota_update_engine_apply_wait_for_data_seconds";
+constexpr char kMetricsUpdateEngineApplyApplySeconds[] =
+    "ota_update_engine_apply_apply_seconds";
+constexpr char kMetricsUpdateEngineApplyHashSeconds[] =
+    "ota_update_engine_apply_hash_seconds";
+constexpr char kMetricsUpdateEngineApplyFlushSeconds[] =
+    "ota_update_engine_apply_flush_seconds";
+constexpr char kMetricsUpdateEngineApplyCheckpointSeconds[] =
+    "ota_update_engine_apply_checkpoint_seconds";
+constexpr char kMetricsUpdateEngineApplyOperationWaitForDataMillisP50[] =
+    "ota_update_engine_apply_operation_wait_for_data_millis_p50";
+constexpr char kMetricsUpdateEngineApplyOperationWaitForDataMillisP99[] =
+    "ota_update_engine_apply_operation_wait_for_data_millis_p99";
+constexpr char kMetricsUpdateEngineApplyOperationApplyMillisP50[] =
+    "ota_update_engine_apply_operation_apply_millis_p50";
+constexpr char kMetricsUpdateEngineApplyOperationApplyMillisP99[] =
+    "ota_update_engine_apply_operation_apply_millis_p99";
+constexpr char kMetricsUpdateEngineApplyOperationHashMillisP50[] =
+    "ota_update_engine_apply_operation_hash_millis_p50";
+constexpr char kMetricsUpdateEngineApplyOperationHashMillisP99[] =
+    "ota_update_engine_apply_operation_hash_millis_p99";
+constexpr char kMetricsUpdateEngineApplyOperationFlushMillisP50[] =
+    "ota_update_engine_apply_operation_flush_millis_p50";
+constexpr char kMetricsUpdateEngineApplyOperationFlushMillisP99[] =
+    "ota_update_engine_apply_operation_flush_millis_p99";
+constexpr char kMetricsUpdateEngineApplyOperationCheckpointMillisP50[] =
+    "ota_update_engine_apply_operation_checkpoint_millis_p50";
+constexpr char kMetricsUpdateEngineApplyOperationCheckpointMillisP99[] =
+    "ota_update_engine_apply_operation_checkpoint_millis_p99";
+
+constexpr char kMetricsUpdateEngineIdleResidentMemoryMiB[] =
+    "ota_update_engine_idle_resident_memory_mib";
+constexpr char kMetricsUpdateEngineIdleReleasedMemoryMiB[] =
+    "ota_update_engine_idle_released_memory_mib";
+
+// The action metrics, suffixed with the lowercase action type.
+constexpr char kMetricsUpdateEngineActionWallTimeSeconds[] =
+    "ota_update_engine_action_wall_time_seconds_";
+constexpr char kMetricsUpdateEngineActionCpuTimeSeconds[] =
+    "ota_update_engine_action_cpu_time_seconds_";
+constexpr char kMetricsUpdateEngineActionReadMiB[] =
+    "ota_update_engine_action_read_mib_";
+constexpr char kMetricsUpdateEngineActionWrittenMiB[] =
+    "ota_update_engine_action_written_mib_";
+constexpr char kMetricsUpdateEngineActionPeakResidentMemoryIncreaseMiB[] =
+    "ota_update_engine_action_peak_resident_memory_increase_mib_";
+constexpr char kMetricsUpdateEngineActionMajorPageFaults[] =
+    "ota_update_engine_action_major_page_faults_";
+
 std::unique_ptr<MetricsReporterInterface> CreateMetricsReporter() {
   return std::make_unique<MetricsReporterAndroid>();
 }
@@ -155,4 +208,86 @@ void MetricsReporterAndroid::ReportAbnormallyTerminatedUpdateAttemptMetrics() {
   LogHistogram(metrics::kMetricsUpdateEngineAttemptResult, attempt_result);
 }
 
+void MetricsReporterAndroid::ReportApplyMetrics(const ApplyStats& apply_stats) {
+  LogHistogram(
+      metrics::kMetricsUpdateEngineApplyWaitForDataSeconds,
+      apply_stats.GetPhaseTotals(ApplyStats::Phase::kWaitForData)
+          .duration.InSeconds());
+  LogHistogram(metrics::kMetricsUpdateEngineApplyApplySeconds,
+               apply_stats.GetPhaseTotals(ApplyStats::Phase::kApply)
+                   .duration.InSeconds());
+  LogHistogram(metrics::kMetricsUpdateEngineApplyHashSeconds,
+               apply_stats.GetPhaseTotals(ApplyStats::Phase::kHash)
+                   .duration.InSeconds());
+  LogHistogram(metrics::kMetricsUpdateEngineApplyFlushSeconds,
+               apply_stats.GetPhaseTotals(ApplyStats::Phase::kFlush)
+                   .duration.InSeconds());
+  LogHistogram(metrics::kMetricsUpdateEngineApplyCheckpointSeconds,
+               apply_stats.GetPhaseTotals(ApplyStats::Phase::kCheckpoint)
+                   .duration.InSeconds());
+
+  const struct {
+    ApplyStats::Phase phase;
+    const char* p50_metric;
+    const char* p99_metric;
+  } kPhaseMetrics[] = {
+      {ApplyStats::Phase::kWaitForData,
+       metrics::kMetricsUpdateEngineApplyOperationWaitForDataMillisP50,
+       metrics::kMetricsUpdateEngineApplyOperationWaitForDataMillisP99},
+      {ApplyStats::Phase::kApply,
+       metrics::kMetricsUpdateEngineApplyOperationApplyMillisP50,
+       metrics::kMetricsUpdateEngineApplyOperationApplyMillisP99},
+      {ApplyStats::Phase::kHash,
+       metrics::kMetricsUpdateEngineApplyOperationHashMillisP50,
+       metrics::kMetricsUpdateEngineApplyOperationHashMillisP99},
+      {ApplyStats::Phase::kFlush,
+       metrics::kMetricsUpdateEngineApplyOperationFlushMillisP50,
+       metrics::kMetricsUpdateEngineApplyOperationFlushMillisP99},
+      {ApplyStats::Phase::kCheckpoint,
+       metrics::kMetricsUpdateEngineApplyOperationCheckpointMillisP50,
+       metrics::kMetricsUpdateEngineApplyOperationCheckpointMillisP99},
+  };
+  for (const auto& phase_metric : kPhaseMetrics) {
+    const LatencyHistogram& histogram =
+        apply_stats.GetPhaseHistogram(phase_metric.phase);
+    if (histogram.count() == 0)
+      continue;
+    LogHistogram(phase_metric.p50_metric,
+                 histogram.GetPercentile(50).InMilliseconds());
+    LogHistogram(phase_metric.p99_metric,
+                 histogram.GetPercentile(99).InMilliseconds());
+  }
+}
+
+void MetricsReporterAndroid::ReportIdleMemoryMetrics(int64_t resident_bytes,
+                                                     int64_t released_bytes) {
+  LogHistogram(metrics::kMetricsUpdateEngineIdleResidentMemoryMiB,
+               resident_bytes / kNumBytesInOneMiB);
+  LogHistogram(metrics::kMetricsUpdateEngineIdleReleasedMemoryMiB,
+               std::max<int64_t>(released_bytes, 0) / kNumBytesInOneMiB);
+}
+
+void MetricsReporterAndroid::ReportActionResourceMetrics(
+    const std::vector<ActionResourceUsage>& action_usages) {
+  for (const auto& action_usage : action_usages) {
+    const ResourceUsage& usage = action_usage.usage;
+    std::string type = base::ToLowerASCII(action_usage.type);
+    LogHistogram(metrics::kMetricsUpdateEngineActionWallTimeSeconds + type,
+                 usage.wall_time.InSeconds());
+    LogHistogram(
+        metrics::kMetricsUpdateEngineActionCpuTimeSeconds + type,
+        (usage.thread_cpu_time + usage.children_cpu_time).InSeconds());
+    LogHistogram(metrics::kMetricsUpdateEngineActionReadMiB + type,
+                 usage.read_bytes / kNumBytesInOneMiB);
+    LogHistogram(metrics::kMetricsUpdateEngineActionWrittenMiB + type,
+                 usage.written_bytes / kNumBytesInOneMiB);
+    LogHistogram(
+        metrics::kMetricsUpdateEngineActionPeakResidentMemoryIncreaseMiB +
+            type,
+        usage.peak_resident_kib / 1024);
+    LogHistogram(metrics::kMetricsUpdateEngineActionMajorPageFaults + type,
+                 usage.major_page_faults);
+  }
+}
+
 };  // namespace chromeos_update_engine
@@ -17,6 +17,8 @@
 #ifndef UPDATE_ENGINE_METRICS_REPORTER_ANDROID_H_
 #define UPDATE_ENGINE_METRICS_REPORTER_ANDROID_H_
 
+#include <vector>
+
 #include "update_engine/common/error_code.h"
 #include "update_engine/metrics_constants.h"
 #include "update_engine/metrics_reporter_interface.h"
@@ -79,6 +81,14 @@ class MetricsReporterAndroid : public MetricsReporterInterface {
 
   void ReportInstallDateProvisioningSource(int source, int max) override {}
 
+  void ReportApplyMetrics(const ApplyStats& apply_stats) override;
+
+  void ReportIdleMemoryMetrics(int64_t resident_bytes,
+                               int64_t released_bytes) override;
+
+  void ReportActionResourceMetrics(
+      const std::vector<ActionResourceUsage>& action_usages) override;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(MetricsReporterAndroid);
 };
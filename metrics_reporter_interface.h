@@ -18,16 +18,19 @@
 #define UPDATE_ENGINE_METRICS_REPORTER_INTERFACE_H_
 
 #include <memory>
+#include <vector>
 
 #include <base/time/time.h>
 
 #include "update_engine/common/constants.h"
 #include "update_engine/common/error_code.h"
+#include "update_engine/common/resource_usage.h"
 #include "update_engine/metrics_constants.h"
 #include "update_engine/system_state.h"
 
 namespace chromeos_update_engine {
 
+class ApplyStats;
 enum class ServerToCheck;
 enum class CertificateCheckResult;
 
@@ -193,6 +196,53 @@ class MetricsReporterInterface {
   //
   // |kMetricInstallDateProvisioningSource|
   virtual void ReportInstallDateProvisioningSource(int source, int max) = 0;
+
+  // Helper function to report the time spent in each phase of applying the
+  // payload operations, from |apply_stats|. The following metrics are
+  // reported:
+  //
+  //  |kMetricApplyWaitForDataSeconds|
+  //  |kMetricApplyApplySeconds|
+  //  |kMetricApplyHashSeconds|
+  //  |kMetricApplyFlushSeconds|
+  //  |kMetricApplyCheckpointSeconds|
+  //
+  // and the 50th and 99th percentiles of the time spent in each phase by a
+  // single operation, for the phases with operations recorded:
+  //
+  //  |kMetricApplyOperationWaitForDataMillisP50|
+  //  |kMetricApplyOperationWaitForDataMillisP99|
+  //  |kMetricApplyOperationApplyMillisP50|
+  //  |kMetricApplyOperationApplyMillisP99|
+  //  |kMetricApplyOperationHashMillisP50|
+  //  |kMetricApplyOperationHashMillisP99|
+  //  |kMetricApplyOperationFlushMillisP50|
+  //  |kMetricApplyOperationFlushMillisP99|
+  //  |kMetricApplyOperationCheckpointMillisP50|
+  //  |kMetricApplyOperationCheckpointMillisP99|
+  virtual void ReportApplyMetrics(const ApplyStats& apply_stats) = 0;
+
+  // Helper function to report the resident memory of the idle daemon, in
+  // |resident_bytes|, and the |released_bytes| released once an update
+  // attempt finished. The following metrics are reported:
+  //
+  //  |kMetricIdleResidentMemoryMiB|
+  //  |kMetricIdleReleasedMemoryMiB|
+  virtual void ReportIdleMemoryMetrics(int64_t resident_bytes,
+                                       int64_t released_bytes) = 0;
+
+  // Helper function to report the resources used by each action of an
+  // update attempt, in |action_usages|. The following metrics are reported
+  // for each action, suffixed with its type:
+  //
+  //  |kMetricActionWallTimeSeconds|
+  //  |kMetricActionCpuTimeSeconds|
+  //  |kMetricActionReadMiB|
+  //  |kMetricActionWrittenMiB|
+  //  |kMetricActionPeakResidentMemoryIncreaseMiB|
+  //  |kMetricActionMajorPageFaults|
+  virtual void ReportActionResourceMetrics(
+      const std::vector<ActionResourceUsage>& action_usages) = 0;
 };
 
 }  // namespace chromeos_update_engine
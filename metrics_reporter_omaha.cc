@@ -16,6 +16,7 @@
 
 #include "update_engine/metrics_reporter_omaha.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 
@@ -27,6 +28,7 @@
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/metrics_utils.h"
+#include "update_engine/payload_consumer/apply_stats.h"
 #include "update_engine/system_state.h"
 
 using std::string;
@@ -112,6 +114,53 @@ const char kMetricInstallDateProvisioningSource[] =
     "UpdateEngine.InstallDateProvisioningSource";
 const char kMetricTimeToRebootMinutes[] = "UpdateEngine.TimeToRebootMinutes";
 
+// UpdateEngine.Apply.* metrics.
+const char kMetricApplyWaitForDataSeconds[] =
+    "UpdateEngine.Apply.WaitForDataSeconds";
+const char kMetricApplyApplySeconds[] = "UpdateEngine.Apply.ApplySeconds";
+const char kMetricApplyHashSeconds[] = "UpdateEngine.Apply.HashSeconds";
+const char kMetricApplyFlushSeconds[] = "UpdateEngine.Apply.FlushSeconds";
+const char kMetricApplyCheckpointSeconds[] =
+    "UpdateEngine.Apply.CheckpointSeconds";
+const char kMetricApplyOperationWaitForDataMillisP50[] =
+    "UpdateEngine.Apply.Operation.WaitForDataMillisP50";
+const char kMetricApplyOperationWaitForDataMillisP99[] =
+    "UpdateEngine.Apply.Operation.WaitForDataMillisP99";
+const char kMetricApplyOperationApplyMillisP50[] =
+    "UpdateEngine.Apply.Operation.ApplyMillisP50";
+const char kMetricApplyOperationApplyMillisP99[] =
+    "UpdateEngine.Apply.Operation.ApplyMillisP99";
+const char kMetricApplyOperationHashMillisP50[] =
+    "UpdateEngine.Apply.Operation.HashMillisP50";
+const char kMetricApplyOperationHashMillisP99[] =
+    "UpdateEngine.Apply.Operation.HashMillisP99";
+const char kMetricApplyOperationFlushMillisP50[] =
+    "UpdateEngine.Apply.Operation.FlushMillisP50";
+const char kMetricApplyOperationFlushMillisP99[] =
+    "UpdateEngine.Apply.Operation.FlushMillisP99";
+const char kMetricApplyOperationCheckpointMillisP50[] =
+    "UpdateEngine.Apply.Operation.CheckpointMillisP50";
+const char kMetricApplyOperationCheckpointMillisP99[] =
+    "UpdateEngine.Apply.Operation.CheckpointMillisP99";
+
+// UpdateEngine.Idle.* metrics.
+const char kMetricIdleResidentMemoryMiB[] =
+    "UpdateEngine.Idle.ResidentMemoryMiB";
+const char kMetricIdleReleasedMemoryMiB[] =
+    "UpdateEngine.Idle.ReleasedMemoryMiB";
+
+// UpdateEngine.Action.* metrics, suffixed with the action type.
+const char kMetricActionWallTimeSeconds[] =
+    "UpdateEngine.Action.WallTimeSeconds";
+const char kMetricActionCpuTimeSeconds[] =
+    "UpdateEngine.Action.CpuTimeSeconds";
+const char kMetricActionReadMiB[] = "UpdateEngine.Action.ReadMiB";
+const char kMetricActionWrittenMiB[] = "UpdateEngine.Action.WrittenMiB";
+const char kMetricActionPeakResidentMemoryIncreaseMiB[] =
+    "UpdateEngine.Action.PeakResidentMemoryIncreaseMiB";
+const char kMetricActionMajorPageFaults[] =
+    "UpdateEngine.Action.MajorPageFaults";
+
 std::unique_ptr<MetricsReporterInterface> CreateMetricsReporter() {
   return std::make_unique<MetricsReporterOmaha>();
 }
@@ -535,4 +584,133 @@ void MetricsReporterOmaha::ReportInstallDateProvisioningSource(int source,
                               max);
 }
 
+void MetricsReporterOmaha::ReportApplyMetrics(const ApplyStats& apply_stats) {
+  const struct {
+    ApplyStats::Phase phase;
+    const char* metric;
+    const char* p50_metric;
+    const char* p99_metric;
+  } kPhaseMetrics[] = {
+      {ApplyStats::Phase::kWaitForData,
+       metrics::kMetricApplyWaitForDataSeconds,
+       metrics::kMetricApplyOperationWaitForDataMillisP50,
+       metrics::kMetricApplyOperationWaitForDataMillisP99},
+      {ApplyStats::Phase::kApply,
+       metrics::kMetricApplyApplySeconds,
+       metrics::kMetricApplyOperationApplyMillisP50,
+       metrics::kMetricApplyOperationApplyMillisP99},
+      {ApplyStats::Phase::kHash,
+       metrics::kMetricApplyHashSeconds,
+       metrics::kMetricApplyOperationHashMillisP50,
+       metrics::kMetricApplyOperationHashMillisP99},
+      {ApplyStats::Phase::kFlush,
+       metrics::kMetricApplyFlushSeconds,
+       metrics::kMetricApplyOperationFlushMillisP50,
+       metrics::kMetricApplyOperationFlushMillisP99},
+      {ApplyStats::Phase::kCheckpoint,
+       metrics::kMetricApplyCheckpointSeconds,
+       metrics::kMetricApplyOperationCheckpointMillisP50,
+       metrics::kMetricApplyOperationCheckpointMillisP99},
+  };
+  for (const auto& phase_metric : kPhaseMetrics) {
+    base::TimeDelta duration =
+        apply_stats.GetPhaseTotals(phase_metric.phase).duration;
+    LOG(INFO) << "Uploading " << utils::FormatTimeDelta(duration)
+              << " for metric " << phase_metric.metric;
+    metrics_lib_->SendToUMA(phase_metric.metric,
+                            static_cast<int>(duration.InSeconds()),
+                            0,            // min: 0 seconds
+                            4 * 60 * 60,  // max: 4 hours
+                            50);          // num_buckets
+
+    // The distribution of the per operation times, which the totals above
+    // hide: a few slow fsyncs or checkpoints only show in the tail.
+    const LatencyHistogram& histogram =
+        apply_stats.GetPhaseHistogram(phase_metric.phase);
+    if (histogram.count() == 0)
+      continue;
+    const struct {
+      double percentile;
+      const char* metric;
+    } kPercentileMetrics[] = {
+        {50, phase_metric.p50_metric},
+        {99, phase_metric.p99_metric},
+    };
+    for (const auto& percentile_metric : kPercentileMetrics) {
+      base::TimeDelta value =
+          histogram.GetPercentile(percentile_metric.percentile);
+      LOG(INFO) << "Uploading " << utils::FormatTimeDelta(value)
+                << " for metric " << percentile_metric.metric;
+      metrics_lib_->SendToUMA(percentile_metric.metric,
+                              static_cast<int>(value.InMilliseconds()),
+                              0,               // min: 0 ms
+                              10 * 60 * 1000,  // max: 10 minutes
+                              50);             // num_buckets
+    }
+  }
+}
+
+void MetricsReporterOmaha::ReportIdleMemoryMetrics(int64_t resident_bytes,
+                                                   int64_t released_bytes) {
+  const struct {
+    const char* metric;
+    int64_t bytes;
+  } kMemoryMetrics[] = {
+      {metrics::kMetricIdleResidentMemoryMiB, resident_bytes},
+      {metrics::kMetricIdleReleasedMemoryMiB, released_bytes},
+  };
+  for (const auto& memory_metric : kMemoryMetrics) {
+    // The memory released can be negative if other threads allocated.
+    int mib = static_cast<int>(std::max<int64_t>(memory_metric.bytes, 0) /
+                               kNumBytesInOneMiB);
+    LOG(INFO) << "Uploading " << mib << " for metric " << memory_metric.metric;
+    metrics_lib_->SendToUMA(memory_metric.metric,
+                            mib,
+                            0,     // min: 0 MiB
+                            1024,  // max: 1 GiB
+                            50);   // num_buckets
+  }
+}
+
+void MetricsReporterOmaha::ReportActionResourceMetrics(
+    const std::vector<ActionResourceUsage>& action_usages) {
+  for (const auto& action_usage : action_usages) {
+    const ResourceUsage& usage = action_usage.usage;
+    const struct {
+      const char* metric;
+      int64_t value;
+      int max;
+    } kActionMetrics[] = {
+        {metrics::kMetricActionWallTimeSeconds,
+         usage.wall_time.InSeconds(),
+         4 * 60 * 60},  // 4 hours
+        {metrics::kMetricActionCpuTimeSeconds,
+         (usage.thread_cpu_time + usage.children_cpu_time).InSeconds(),
+         4 * 60 * 60},  // 4 hours
+        {metrics::kMetricActionReadMiB,
+         usage.read_bytes / kNumBytesInOneMiB,
+         10 * 1024},  // 10 GiB
+        {metrics::kMetricActionWrittenMiB,
+         usage.written_bytes / kNumBytesInOneMiB,
+         10 * 1024},  // 10 GiB
+        {metrics::kMetricActionPeakResidentMemoryIncreaseMiB,
+         usage.peak_resident_kib / 1024,
+         1024},  // 1 GiB
+        {metrics::kMetricActionMajorPageFaults,
+         usage.major_page_faults,
+         1000000},
+    };
+    for (const auto& action_metric : kActionMetrics) {
+      string metric = string(action_metric.metric) + "." + action_usage.type;
+      int value = static_cast<int>(std::max<int64_t>(action_metric.value, 0));
+      LOG(INFO) << "Uploading " << value << " for metric " << metric;
+      metrics_lib_->SendToUMA(metric,
+                              value,
+                              0,  // min
+                              action_metric.max,
+                              50);  // num_buckets
+    }
+  }
+}
+
 }  // namespace chromeos_update_engine
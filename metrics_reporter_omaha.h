@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_METRICS_REPORTER_OMAHA_H_
 
 #include <memory>
+#include <vector>
 
 #include <base/time/time.h>
 #include <metrics/metrics_library.h>
@@ -85,6 +86,35 @@ extern const char kMetricFailedUpdateCount[];
 extern const char kMetricInstallDateProvisioningSource[];
 extern const char kMetricTimeToRebootMinutes[];
 
+// UpdateEngine.Apply.* metrics.
+extern const char kMetricApplyWaitForDataSeconds[];
+extern const char kMetricApplyApplySeconds[];
+extern const char kMetricApplyHashSeconds[];
+extern const char kMetricApplyFlushSeconds[];
+extern const char kMetricApplyCheckpointSeconds[];
+extern const char kMetricApplyOperationWaitForDataMillisP50[];
+extern const char kMetricApplyOperationWaitForDataMillisP99[];
+extern const char kMetricApplyOperationApplyMillisP50[];
+extern const char kMetricApplyOperationApplyMillisP99[];
+extern const char kMetricApplyOperationHashMillisP50[];
+extern const char kMetricApplyOperationHashMillisP99[];
+extern const char kMetricApplyOperationFlushMillisP50[];
+extern const char kMetricApplyOperationFlushMillisP99[];
+extern const char kMetricApplyOperationCheckpointMillisP50[];
+extern const char kMetricApplyOperationCheckpointMillisP99[];
+
+// UpdateEngine.Idle.* metrics.
+extern const char kMetricIdleResidentMemoryMiB[];
+extern const char kMetricIdleReleasedMemoryMiB[];
+
+// UpdateEngine.Action.* metrics, suffixed with the action type.
+extern const char kMetricActionWallTimeSeconds[];
+extern const char kMetricActionCpuTimeSeconds[];
+extern const char kMetricActionReadMiB[];
+extern const char kMetricActionWrittenMiB[];
+extern const char kMetricActionPeakResidentMemoryIncreaseMiB[];
+extern const char kMetricActionMajorPageFaults[];
+
 }  // namespace metrics
 
 class MetricsReporterOmaha : public MetricsReporterInterface {
@@ -143,6 +173,14 @@ class MetricsReporterOmaha : public MetricsReporterInterface {
 
   void ReportInstallDateProvisioningSource(int source, int max) override;
 
+  void ReportApplyMetrics(const ApplyStats& apply_stats) override;
+
+  void ReportIdleMemoryMetrics(int64_t resident_bytes,
+                               int64_t released_bytes) override;
+
+  void ReportActionResourceMetrics(
+      const std::vector<ActionResourceUsage>& action_usages) override;
+
  private:
   friend class MetricsReporterOmahaTest;
 
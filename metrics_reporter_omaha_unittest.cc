@@ -27,9 +27,14 @@
 #include "update_engine/common/fake_clock.h"
 #include "update_engine/common/fake_prefs.h"
 #include "update_engine/fake_system_state.h"
+#include "update_engine/payload_consumer/apply_stats.h"
 
 using base::TimeDelta;
+using std::string;
+using testing::AllOf;
 using testing::AnyNumber;
+using testing::Ge;
+using testing::Le;
 using testing::_;
 
 namespace chromeos_update_engine {
@@ -391,4 +396,128 @@ TEST_F(MetricsReporterOmahaTest, ReportInstallDateProvisioningSource) {
   reporter_.ReportInstallDateProvisioningSource(source, max);
 }
 
+TEST_F(MetricsReporterOmahaTest, ReportApplyMetrics) {
+  ApplyStats apply_stats;
+  apply_stats.Record(ApplyStats::Phase::kApply,
+                     InstallOperation::REPLACE,
+                     0,
+                     base::TimeTicks::Now() - TimeDelta::FromSeconds(10),
+                     4096);
+
+  apply_stats.Record(ApplyStats::Phase::kApply,
+                     InstallOperation::REPLACE,
+                     1,
+                     base::TimeTicks::Now() - TimeDelta::FromMilliseconds(200),
+                     4096);
+
+  EXPECT_CALL(*mock_metrics_lib_, SendToUMA(_, _, _, _, _))
+      .Times(AnyNumber());
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricApplyApplySeconds, 10, _, _, _))
+      .Times(1);
+  // The median is the 200 ms operation and the 99th percentile the 10 s one,
+  // up to the 12.5% precision of the histogram.
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricApplyOperationApplyMillisP50,
+                        AllOf(Ge(200), Le(225)),
+                        _,
+                        _,
+                        _))
+      .Times(1);
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricApplyOperationApplyMillisP99,
+                        AllOf(Ge(10000), Le(11250)),
+                        _,
+                        _,
+                        _))
+      .Times(1);
+  // No flush was recorded, so only its total is reported.
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(
+                  metrics::kMetricApplyOperationFlushMillisP50, _, _, _, _))
+      .Times(0);
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricApplyWaitForDataSeconds, 0, _, _, _))
+      .Times(1);
+
+  reporter_.ReportApplyMetrics(apply_stats);
+}
+
+TEST_F(MetricsReporterOmahaTest, ReportIdleMemoryMetrics) {
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricIdleResidentMemoryMiB, 20, _, _, _))
+      .Times(1);
+  // The memory allocated meanwhile by other threads isn't reported as
+  // released.
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(metrics::kMetricIdleReleasedMemoryMiB, 0, _, _, _))
+      .Times(1);
+
+  reporter_.ReportIdleMemoryMetrics(20 * kNumBytesInOneMiB, -4096);
+}
+
+TEST_F(MetricsReporterOmahaTest, ReportActionResourceMetrics) {
+  ActionResourceUsage action_usage;
+  action_usage.type = "DownloadAction";
+  action_usage.usage.wall_time = base::TimeDelta::FromSeconds(120);
+  action_usage.usage.thread_cpu_time = base::TimeDelta::FromSeconds(30);
+  action_usage.usage.children_cpu_time = base::TimeDelta::FromSeconds(5);
+  action_usage.usage.read_bytes = 3 * kNumBytesInOneMiB;
+  action_usage.usage.written_bytes = 500 * kNumBytesInOneMiB;
+  action_usage.usage.peak_resident_kib = 8 * 1024;
+  action_usage.usage.major_page_faults = 12;
+
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(string(metrics::kMetricActionWallTimeSeconds) +
+                            ".DownloadAction",
+                        120,
+                        _,
+                        _,
+                        _))
+      .Times(1);
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(string(metrics::kMetricActionCpuTimeSeconds) +
+                            ".DownloadAction",
+                        35,
+                        _,
+                        _,
+                        _))
+      .Times(1);
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(string(metrics::kMetricActionReadMiB) + ".DownloadAction",
+                3,
+                _,
+                _,
+                _))
+      .Times(1);
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(string(metrics::kMetricActionWrittenMiB) + ".DownloadAction",
+                500,
+                _,
+                _,
+                _))
+      .Times(1);
+  EXPECT_CALL(
+      *mock_metrics_lib_,
+      SendToUMA(string(metrics::kMetricActionPeakResidentMemoryIncreaseMiB) +
+                    ".DownloadAction",
+                8,
+                _,
+                _,
+                _))
+      .Times(1);
+  EXPECT_CALL(*mock_metrics_lib_,
+              SendToUMA(string(metrics::kMetricActionMajorPageFaults) +
+                            ".DownloadAction",
+                        12,
+                        _,
+                        _,
+                        _))
+      .Times(1);
+
+  reporter_.ReportActionResourceMetrics({action_usage});
+}
+
 }  // namespace chromeos_update_engine
@@ -79,6 +79,14 @@ class MetricsReporterStub : public MetricsReporterInterface {
 
   void ReportInstallDateProvisioningSource(int source, int max) override {}
 
+  void ReportApplyMetrics(const ApplyStats& apply_stats) override {}
+
+  void ReportIdleMemoryMetrics(int64_t resident_bytes,
+                               int64_t released_bytes) override {}
+
+  void ReportActionResourceMetrics(
+      const std::vector<ActionResourceUsage>& action_usages) override {}
+
  private:
   DISALLOW_COPY_AND_ASSIGN(MetricsReporterStub);
 };
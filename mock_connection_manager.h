@@ -36,6 +36,8 @@ class MockConnectionManager : public ConnectionManagerInterface {
 
   MOCK_CONST_METHOD2(IsUpdateAllowedOver,
                      bool(ConnectionType type, ConnectionTethering tethering));
+
+  MOCK_METHOD1(GetConnectionQuality, bool(ConnectionQuality* out_quality));
 };
 
 }  // namespace chromeos_update_engine
@@ -76,6 +76,14 @@ class MockMetricsReporter : public MetricsReporterInterface {
   MOCK_METHOD1(ReportTimeToReboot, void(int time_to_reboot_minutes));
 
   MOCK_METHOD2(ReportInstallDateProvisioningSource, void(int source, int max));
+
+  MOCK_METHOD1(ReportApplyMetrics, void(const ApplyStats& apply_stats));
+
+  MOCK_METHOD2(ReportIdleMemoryMetrics,
+               void(int64_t resident_bytes, int64_t released_bytes));
+
+  MOCK_METHOD1(ReportActionResourceMetrics,
+               void(const std::vector<ActionResourceUsage>& action_usages));
 };
 
 }  // namespace chromeos_update_engine
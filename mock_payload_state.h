@@ -51,6 +51,7 @@ class MockPayloadState: public PayloadStateInterface {
   MOCK_METHOD1(SetUsingP2PForDownloading, void(bool value));
   MOCK_METHOD1(SetUsingP2PForSharing, void(bool value));
   MOCK_METHOD1(SetScatteringWaitPeriod, void(base::TimeDelta));
+  MOCK_METHOD2(SetNetworkEstimates, void(int64_t, base::TimeDelta));
   MOCK_METHOD1(SetP2PUrl, void(const std::string&));
   MOCK_METHOD0(NextPayload, bool());
 
@@ -59,6 +60,7 @@ class MockPayloadState: public PayloadStateInterface {
   MOCK_METHOD0(GetPayloadAttemptNumber, int());
   MOCK_METHOD0(GetFullPayloadAttemptNumber, int());
   MOCK_METHOD0(GetCurrentUrl, std::string());
+  MOCK_METHOD1(GetPayloadUrl, std::string(size_t payload_index));
   MOCK_METHOD0(GetUrlFailureCount, uint32_t());
   MOCK_METHOD0(GetUrlSwitchCount, uint32_t());
   MOCK_METHOD0(GetNumResponsesSeen, int());
@@ -74,6 +76,8 @@ class MockPayloadState: public PayloadStateInterface {
   MOCK_CONST_METHOD0(GetUsingP2PForDownloading, bool());
   MOCK_CONST_METHOD0(GetUsingP2PForSharing, bool());
   MOCK_METHOD0(GetScatteringWaitPeriod, base::TimeDelta());
+  MOCK_CONST_METHOD0(GetThroughputEstimate, int64_t());
+  MOCK_CONST_METHOD0(GetRoundTripTimeEstimate, base::TimeDelta());
   MOCK_CONST_METHOD0(GetP2PUrl, std::string());
   MOCK_CONST_METHOD0(GetAttemptErrorCode, ErrorCode());
 };
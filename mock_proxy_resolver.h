@@ -31,6 +31,8 @@ class MockProxyResolver : public ProxyResolver {
                ProxyRequestId(const std::string& url,
                               const ProxiesResolvedFn& callback));
   MOCK_METHOD1(CancelProxyRequest, bool(ProxyRequestId request));
+  MOCK_METHOD2(ReportProxyFailure,
+               void(const std::string& url, const std::string& proxy));
 };
 
 }  // namespace chromeos_update_engine
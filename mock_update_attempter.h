@@ -38,6 +38,9 @@ class MockUpdateAttempter : public UpdateAttempter {
 
   MOCK_METHOD1(GetStatus, bool(update_engine::UpdateEngineStatus* out_status));
 
+  MOCK_METHOD1(GetPerformance,
+               bool(update_engine::UpdateEnginePerformance* out_performance));
+
   MOCK_METHOD1(GetBootTimeAtUpdate, bool(base::Time* out_boot_time));
 
   MOCK_METHOD0(ResetStatus, bool(void));
@@ -55,6 +58,8 @@ class MockUpdateAttempter : public UpdateAttempter {
 
   MOCK_CONST_METHOD0(server_dictated_poll_interval, unsigned int(void));
 
+  MOCK_CONST_METHOD0(server_load, unsigned int(void));
+
   MOCK_METHOD0(IsAnyUpdateSourceAllowed, bool(void));
 };
 
@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 #include <string>
@@ -35,6 +36,7 @@
 #include <brillo/key_value_store.h>
 #include <expat.h>
 #include <metrics/metrics_library.h>
+#include <zlib.h>
 
 #include "update_engine/common/action_pipe.h"
 #include "update_engine/common/constants.h"
@@ -84,8 +86,18 @@ static const char* kXGoogleUpdateInteractivity = "X-GoogleUpdate-Interactivity";
 static const char* kXGoogleUpdateAppId = "X-GoogleUpdate-AppId";
 static const char* kXGoogleUpdateUpdater = "X-GoogleUpdate-Updater";
 
+// Headers used to revalidate the cached response.
+static const char* kETag = "ETag";
+static const char* kIfNoneMatch = "If-None-Match";
+
+// Headers used to compress the request, and the only coding supported.
+static const char* kAcceptEncoding = "Accept-Encoding";
+static const char* kContentEncoding = "Content-Encoding";
+static const char* kGzipEncoding = "gzip";
+
 // updatecheck attributes (without the underscore prefix).
 static const char* kEolAttr = "eol";
+static const char* kServerLoadAttr = "server_load";
 
 namespace {
 
@@ -111,6 +123,91 @@ string GetPingXml(int ping_active_days, int ping_roll_call_days) {
   return "";
 }
 
+// The maximum number of events waiting to be sent to Omaha. The oldest ones
+// are dropped when more are deferred.
+const size_t kMaxPendingEvents = 16;
+
+// Compresses |data| in the gzip format into |out|. Returns whether it
+// succeeded.
+bool GzipCompress(const string& data, brillo::Blob* out) {
+  z_stream stream = {};
+  // The window bits above 15 select the gzip wrapper.
+  if (deflateInit2(&stream,
+                   Z_BEST_COMPRESSION,
+                   Z_DEFLATED,
+                   15 + 16,
+                   8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out->resize(deflateBound(&stream, data.size()));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = out->data();
+  stream.avail_out = out->size();
+  int result = deflate(&stream, Z_FINISH);
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+// Returns the <event> node reporting |event|.
+string GetEventXml(const OmahaEvent& event) {
+  // The error code is an optional attribute so append it only if the result
+  // is not success.
+  string error_code;
+  if (event.result != OmahaEvent::kResultSuccess) {
+    error_code = base::StringPrintf(" errorcode=\"%d\"",
+                                    static_cast<int>(event.error_code));
+  }
+  return base::StringPrintf(
+      "        <event eventtype=\"%d\" eventresult=\"%d\"%s></event>\n",
+      event.type, event.result, error_code.c_str());
+}
+
+// Returns the events waiting to be sent to Omaha, oldest first.
+vector<OmahaEvent> LoadPendingEvents(PrefsInterface* prefs) {
+  vector<OmahaEvent> events;
+  string value;
+  if (!prefs->GetString(kPrefsOmahaPendingEvents, &value))
+    return events;
+  // Each event is stored on its own line as "type,result,error_code".
+  for (const string& line : base::SplitString(
+           value, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    vector<string> fields = base::SplitString(
+        line, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+    int type, result, error_code;
+    if (fields.size() != 3 || !base::StringToInt(fields[0], &type) ||
+        !base::StringToInt(fields[1], &result) ||
+        !base::StringToInt(fields[2], &error_code)) {
+      LOG(WARNING) << "Ignoring invalid pending Omaha event: " << line;
+      continue;
+    }
+    events.emplace_back(static_cast<OmahaEvent::Type>(type),
+                        static_cast<OmahaEvent::Result>(result),
+                        static_cast<ErrorCode>(error_code));
+  }
+  return events;
+}
+
+// Persists the |events| waiting to be sent to Omaha.
+void StorePendingEvents(PrefsInterface* prefs,
+                        const vector<OmahaEvent>& events) {
+  if (events.empty()) {
+    prefs->Delete(kPrefsOmahaPendingEvents);
+    return;
+  }
+  string value;
+  for (const OmahaEvent& event : events) {
+    value += base::StringPrintf("%d,%d,%d\n",
+                                event.type,
+                                event.result,
+                                static_cast<int>(event.error_code));
+  }
+  LOG_IF(WARNING, !prefs->SetString(kPrefsOmahaPendingEvents, value))
+      << "Unable to persist the pending Omaha events.";
+}
+
 // Returns an XML that goes into the body of the <app> element of the Omaha
 // request based on the given parameters.
 string GetAppBody(const OmahaEvent* event,
@@ -157,16 +254,7 @@ string GetAppBody(const OmahaEvent* event,
       }
     }
   } else {
-    // The error code is an optional attribute so append it only if the result
-    // is not success.
-    string error_code;
-    if (event->result != OmahaEvent::kResultSuccess) {
-      error_code = base::StringPrintf(" errorcode=\"%d\"",
-                                      static_cast<int>(event->error_code));
-    }
-    app_body = base::StringPrintf(
-        "        <event eventtype=\"%d\" eventresult=\"%d\"%s></event>\n",
-        event->type, event->result, error_code.c_str());
+    app_body = GetEventXml(*event);
   }
 
   return app_body;
@@ -220,40 +308,27 @@ bool IsValidComponentID(const string& id) {
   return true;
 }
 
-// Returns an XML that corresponds to the entire <app> node of the Omaha
-// request based on the given parameters.
-string GetAppXml(const OmahaEvent* event,
-                 OmahaRequestParams* params,
-                 const OmahaAppData& app_data,
-                 bool ping_only,
-                 bool include_ping,
-                 int ping_active_days,
-                 int ping_roll_call_days,
-                 int install_date_in_days,
-                 SystemState* system_state) {
-  string app_body = GetAppBody(event, params, ping_only, include_ping,
-                               ping_active_days, ping_roll_call_days,
-                               system_state->prefs());
-  string app_versions;
+// The attributes of the <app> nodes which are the same for all the apps of a
+// request, in the order they are in <app>. They are built once per request,
+// not for every app.
+struct OmahaAppSharedXml {
+  string cohort_args;
+  string channel_args;
+  string device_args;
+};
 
-  // If we are downgrading to a more stable channel and we are allowed to do
-  // powerwash, then pass 0.0.0.0 as the version. This is needed to get the
-  // highest-versioned payload on the destination channel.
-  if (params->ShouldPowerwash()) {
-    LOG(INFO) << "Passing OS version as 0.0.0.0 as we are set to powerwash "
-              << "on downgrading to the version in the more stable channel";
-    app_versions = "version=\"0.0.0.0\" from_version=\"" +
-                   XmlEncodeWithDefault(app_data.version, "0.0.0.0") + "\" ";
-  } else {
-    app_versions = "version=\"" +
-                   XmlEncodeWithDefault(app_data.version, "0.0.0.0") + "\" ";
-  }
+// Returns the attributes of the <app> nodes shared by all the apps of the
+// Omaha request based on the given parameters.
+OmahaAppSharedXml GetAppSharedXml(OmahaRequestParams* params,
+                                  int install_date_in_days,
+                                  SystemState* system_state) {
+  OmahaAppSharedXml shared;
 
   string download_channel = params->download_channel();
-  string app_channels =
+  shared.channel_args =
       "track=\"" + XmlEncodeWithDefault(download_channel, "") + "\" ";
   if (params->current_channel() != download_channel) {
-    app_channels += "from_track=\"" + XmlEncodeWithDefault(
+    shared.channel_args += "from_track=\"" + XmlEncodeWithDefault(
         params->current_channel(), "") + "\" ";
   }
 
@@ -267,13 +342,12 @@ string GetAppXml(const OmahaEvent* event,
                                                   install_date_in_days);
   }
 
-  string app_cohort_args;
-  app_cohort_args += GetCohortArgXml(system_state->prefs(),
-                                     "cohort", kPrefsOmahaCohort);
-  app_cohort_args += GetCohortArgXml(system_state->prefs(),
-                                     "cohorthint", kPrefsOmahaCohortHint);
-  app_cohort_args += GetCohortArgXml(system_state->prefs(),
-                                     "cohortname", kPrefsOmahaCohortName);
+  shared.cohort_args += GetCohortArgXml(system_state->prefs(),
+                                        "cohort", kPrefsOmahaCohort);
+  shared.cohort_args += GetCohortArgXml(system_state->prefs(),
+                                        "cohorthint", kPrefsOmahaCohortHint);
+  shared.cohort_args += GetCohortArgXml(system_state->prefs(),
+                                        "cohortname", kPrefsOmahaCohortName);
 
   string fingerprint_arg;
   if (!params->os_build_fingerprint().empty()) {
@@ -288,6 +362,43 @@ string GetAppXml(const OmahaEvent* event,
                     XmlEncodeWithDefault(params->os_build_type(), "") + "\" ";
   }
 
+  // clang-format off
+  shared.device_args =
+      fingerprint_arg +
+      buildtype_arg +
+      "lang=\"" + XmlEncodeWithDefault(params->app_lang(), "en-US") + "\" " +
+      "board=\"" + XmlEncodeWithDefault(params->os_board(), "") + "\" " +
+      "hardware_class=\"" + XmlEncodeWithDefault(params->hwid(), "") + "\" " +
+      "delta_okay=\"" + delta_okay_str + "\" "
+      "fw_version=\"" + XmlEncodeWithDefault(params->fw_version(), "") + "\" " +
+      "ec_version=\"" + XmlEncodeWithDefault(params->ec_version(), "") + "\" " +
+      install_date_in_days_str;
+  // clang-format on
+  return shared;
+}
+
+// Returns an XML that corresponds to the entire <app> node of the Omaha
+// request for |app_data|, made of the |shared| attributes, the app's own and
+// the |app_body|.
+string GetAppXml(OmahaRequestParams* params,
+                 const OmahaAppData& app_data,
+                 const string& app_body,
+                 const OmahaAppSharedXml& shared) {
+  string app_versions;
+
+  // If we are downgrading to a more stable channel and we are allowed to do
+  // powerwash, then pass 0.0.0.0 as the version. This is needed to get the
+  // highest-versioned payload on the destination channel.
+  if (params->ShouldPowerwash()) {
+    LOG(INFO) << "Passing OS version as 0.0.0.0 as we are set to powerwash "
+              << "on downgrading to the version in the more stable channel";
+    app_versions = "version=\"0.0.0.0\" from_version=\"" +
+                   XmlEncodeWithDefault(app_data.version, "0.0.0.0") + "\" ";
+  } else {
+    app_versions = "version=\"" +
+                   XmlEncodeWithDefault(app_data.version, "0.0.0.0") + "\" ";
+  }
+
   string product_components_args;
   if (!params->ShouldPowerwash() && !app_data.product_components.empty()) {
     brillo::KeyValueStore store;
@@ -317,19 +428,11 @@ string GetAppXml(const OmahaEvent* event,
   // clang-format off
   string app_xml = "    <app "
       "appid=\"" + XmlEncodeWithDefault(app_data.id, "") + "\" " +
-      app_cohort_args +
+      shared.cohort_args +
       app_versions +
-      app_channels +
+      shared.channel_args +
       product_components_args +
-      fingerprint_arg +
-      buildtype_arg +
-      "lang=\"" + XmlEncodeWithDefault(params->app_lang(), "en-US") + "\" " +
-      "board=\"" + XmlEncodeWithDefault(params->os_board(), "") + "\" " +
-      "hardware_class=\"" + XmlEncodeWithDefault(params->hwid(), "") + "\" " +
-      "delta_okay=\"" + delta_okay_str + "\" "
-      "fw_version=\"" + XmlEncodeWithDefault(params->fw_version(), "") + "\" " +
-      "ec_version=\"" + XmlEncodeWithDefault(params->ec_version(), "") + "\" " +
-      install_date_in_days_str +
+      shared.device_args +
       ">\n" +
          app_body +
       "    </app>\n";
@@ -349,8 +452,10 @@ string GetOsXml(OmahaRequestParams* params) {
 }
 
 // Returns an XML that corresponds to the entire Omaha request based on the
-// given parameters.
+// given parameters. The |pending_events| deferred by earlier requests are
+// reported first, in the product app.
 string GetRequestXml(const OmahaEvent* event,
+                     const vector<OmahaEvent>& pending_events,
                      OmahaRequestParams* params,
                      bool ping_only,
                      bool include_ping,
@@ -359,31 +464,34 @@ string GetRequestXml(const OmahaEvent* event,
                      int install_date_in_days,
                      SystemState* system_state) {
   string os_xml = GetOsXml(params);
+  OmahaAppSharedXml shared =
+      GetAppSharedXml(params, install_date_in_days, system_state);
+  // The body is built for each app since the previous version event is only
+  // reported in the first one.
+  auto get_app_body = [&]() {
+    return GetAppBody(event, params, ping_only, include_ping,
+                      ping_active_days, ping_roll_call_days,
+                      system_state->prefs());
+  };
+  string pending_events_xml;
+  for (const OmahaEvent& pending_event : pending_events)
+    pending_events_xml += GetEventXml(pending_event);
   OmahaAppData product_app = {
       .id = params->GetAppId(),
       .version = params->app_version(),
       .product_components = params->product_components()};
-  string app_xml = GetAppXml(event,
-                             params,
-                             product_app,
-                             ping_only,
-                             include_ping,
-                             ping_active_days,
-                             ping_roll_call_days,
-                             install_date_in_days,
-                             system_state);
+  string app_xml = GetAppXml(
+      params, product_app, pending_events_xml + get_app_body(), shared);
   if (!params->system_app_id().empty()) {
     OmahaAppData system_app = {.id = params->system_app_id(),
                                .version = params->system_version()};
-    app_xml += GetAppXml(event,
-                         params,
-                         system_app,
-                         ping_only,
-                         include_ping,
-                         ping_active_days,
-                         ping_roll_call_days,
-                         install_date_in_days,
-                         system_state);
+    app_xml += GetAppXml(params, system_app, get_app_body(), shared);
+  }
+  // The DLC modules are checked in the same request, sharing its round trip.
+  for (const string& dlc_module_id : params->dlc_module_ids()) {
+    OmahaAppData dlc_app = {.id = params->GetDlcAppId(dlc_module_id),
+                            .version = params->app_version()};
+    app_xml += GetAppXml(params, dlc_app, get_app_body(), shared);
   }
 
   string install_source = base::StringPrintf("installsource=\"%s\" ",
@@ -409,9 +517,15 @@ string GetRequestXml(const OmahaEvent* event,
 
 }  // namespace
 
-// Struct used for holding data obtained when parsing the XML.
+// Struct used for holding data obtained when parsing the XML. It owns the
+// expat parser filling it, which can be fed the XML in several parts.
 struct OmahaParserData {
-  explicit OmahaParserData(XML_Parser _xml_parser) : xml_parser(_xml_parser) {}
+  OmahaParserData();
+  ~OmahaParserData() { XML_ParserFree(xml_parser); }
+
+  // Parses the next |length| bytes of the XML, the last ones if |is_final|.
+  // Returns whether the XML parsed so far is valid.
+  bool Parse(const void* bytes, size_t length, bool is_final);
 
   // Pointer to the expat XML_Parser object.
   XML_Parser xml_parser;
@@ -448,6 +562,9 @@ struct OmahaParserData {
     vector<Package> packages;
   };
   vector<App> apps;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(OmahaParserData);
 };
 
 namespace {
@@ -571,6 +688,24 @@ void ParserHandlerEntityDecl(void *user_data,
 
 }  // namespace
 
+OmahaParserData::OmahaParserData() : xml_parser(XML_ParserCreate(nullptr)) {
+  XML_SetUserData(xml_parser, this);
+  XML_SetElementHandler(xml_parser, ParserHandlerStart, ParserHandlerEnd);
+  XML_SetEntityDeclHandler(xml_parser, ParserHandlerEntityDecl);
+}
+
+bool OmahaParserData::Parse(const void* bytes, size_t length, bool is_final) {
+  if (failed)
+    return false;
+  if (XML_Parse(xml_parser,
+                reinterpret_cast<const char*>(bytes),
+                length,
+                is_final ? XML_TRUE : XML_FALSE) != XML_STATUS_OK) {
+    failed = true;
+  }
+  return !failed;
+}
+
 bool XmlEncode(const string& input, string* output) {
   if (std::find_if(input.begin(), input.end(),
                    [](const char c){return c & 0x80;}) != input.end()) {
@@ -753,7 +888,28 @@ void OmahaRequestAction::PerformAction() {
     return;
   }
 
+  // Events are best effort, so they aren't worth waking up a metered
+  // connection for. They are sent with the next request instead, for example
+  // the next update check.
+  PrefsInterface* prefs = system_state_->prefs();
+  vector<OmahaEvent> pending_events = LoadPendingEvents(prefs);
+  if (IsEvent() && IsConnectionMetered()) {
+    LOG(INFO) << "Deferring the Omaha event " << event_->type
+              << " over the metered connection.";
+    pending_events.push_back(*event_);
+    if (pending_events.size() > kMaxPendingEvents) {
+      pending_events.erase(
+          pending_events.begin(),
+          pending_events.end() - kMaxPendingEvents);
+    }
+    StorePendingEvents(prefs, pending_events);
+    processor_->ActionComplete(this, ErrorCode::kSuccess);
+    return;
+  }
+  pending_events_sent_ = pending_events.size();
+
   string request_post(GetRequestXml(event_.get(),
+                                    pending_events,
                                     params_,
                                     ping_only_,
                                     ShouldPing(),  // include_ping
@@ -771,10 +927,29 @@ void OmahaRequestAction::PerformAction() {
       base::StringPrintf(
           "%s-%s", constants::kOmahaUpdaterID, kOmahaUpdaterVersion));
 
-  http_fetcher_->SetPostData(request_post.data(), request_post.size(),
-                             kHttpContentTypeTextXml);
+  // Ask the server to only send the response if it changed since the one
+  // cached for the same request.
+  if (!IsEvent() && !ping_only_) {
+    response_cache_key_ = GetResponseCacheKey();
+    PrefsInterface* prefs = system_state_->prefs();
+    string cache_key, etag;
+    if (prefs->GetString(kPrefsOmahaResponseCacheKey, &cache_key) &&
+        cache_key == response_cache_key_ &&
+        prefs->GetString(kPrefsOmahaResponseETag, &etag) && !etag.empty() &&
+        prefs->Exists(kPrefsOmahaResponse)) {
+      http_fetcher_->SetHeader(kIfNoneMatch, etag);
+    }
+  }
+
+  // The request is only compressed once the server said it accepts it.
+  string request_encoding;
+  request_post_ = std::move(request_post);
+  SetRequestPostData(
+      prefs->GetString(kPrefsOmahaRequestEncoding, &request_encoding) &&
+      request_encoding == kGzipEncoding);
+  http_fetcher_->set_accept_encoding(true);
   LOG(INFO) << "Posting an Omaha request to " << params_->update_url();
-  LOG(INFO) << "Request: " << request_post;
+  LOG(INFO) << "Request: " << request_post_;
   http_fetcher_->BeginTransfer(params_->update_url());
 }
 
@@ -782,13 +957,20 @@ void OmahaRequestAction::TerminateProcessing() {
   http_fetcher_->TerminateTransfer();
 }
 
-// We just store the response in the buffer. Once we've received all bytes,
-// we'll look in the buffer and decide what to do.
+// We parse the response as it arrives, and store it in the buffer for
+// logging. Once we've received all bytes, we'll look at the parsed values
+// and decide what to do.
 void OmahaRequestAction::ReceivedBytes(HttpFetcher *fetcher,
                                        const void* bytes,
                                        size_t length) {
   const uint8_t* byte_ptr = reinterpret_cast<const uint8_t*>(bytes);
   response_buffer_.insert(response_buffer_.end(), byte_ptr, byte_ptr + length);
+  // Events don't look at the response.
+  if (!IsEvent()) {
+    if (!parser_data_)
+      parser_data_.reset(new OmahaParserData());
+    parser_data_->Parse(bytes, length, false);
+  }
 }
 
 namespace {
@@ -878,6 +1060,7 @@ bool ParsePackage(OmahaParserData::App* app,
     LOG(INFO) << "Found package " << package.name;
 
     OmahaResponse::Package out_package;
+    out_package.app_id = app->id;
     for (const string& codebase : app->url_codebase) {
       if (codebase.empty()) {
         LOG(ERROR) << "Omaha Response URL has empty codebase";
@@ -950,6 +1133,18 @@ bool OmahaRequestAction::ParseResponse(OmahaParserData* parser_data,
   base::StringToInt(parser_data->updatecheck_poll_interval,
                     &output_object->poll_interval);
 
+  // The server can report its load, in percent, to spread the next update
+  // checks of the fleet. Like the PollInterval, it is not persisted.
+  auto server_load_attr = parser_data->updatecheck_attrs.find(kServerLoadAttr);
+  if (server_load_attr != parser_data->updatecheck_attrs.end() &&
+      base::StringToInt(server_load_attr->second,
+                        &output_object->server_load)) {
+    output_object->server_load =
+        std::min(std::max(output_object->server_load, 0), 100);
+  } else {
+    output_object->server_load = 0;
+  }
+
   // Check for the "elapsed_days" attribute in the "daystart"
   // element. This is the number of days since Jan 1 2007, 0:00
   // PST. If we don't have a persisted value of the Omaha InstallDate,
@@ -1098,6 +1293,34 @@ void OmahaRequestAction::TransferComplete(HttpFetcher *fetcher,
   string current_response(response_buffer_.begin(), response_buffer_.end());
   LOG(INFO) << "Omaha request response: " << current_response;
 
+  // The deferred events were delivered with the request.
+  if (successful && pending_events_sent_ > 0) {
+    PrefsInterface* prefs = system_state_->prefs();
+    vector<OmahaEvent> pending_events = LoadPendingEvents(prefs);
+    pending_events.erase(
+        pending_events.begin(),
+        pending_events.begin() +
+            std::min(pending_events_sent_, pending_events.size()));
+    StorePendingEvents(prefs, pending_events);
+    pending_events_sent_ = 0;
+  }
+  StoreRequestEncoding(successful);
+
+  // The server rejected the compressed request, so it is sent again without
+  // compression, only once since it isn't compressed anymore.
+  if (!successful && request_compressed_ &&
+      GetHTTPResponseCode() == kHttpResponseUnsupportedMedia) {
+    LOG(WARNING) << "The compressed Omaha request was rejected, sending it "
+                 << "uncompressed.";
+    completer.set_should_complete(false);
+    response_buffer_.clear();
+    parser_data_.reset();
+    http_fetcher_->SetHeader(kContentEncoding, "");
+    SetRequestPostData(false);
+    http_fetcher_->BeginTransfer(params_->update_url());
+    return;
+  }
+
   PayloadStateInterface* const payload_state = system_state_->payload_state();
 
   // Events are best effort transactions -- assume they always succeed.
@@ -1107,7 +1330,16 @@ void OmahaRequestAction::TransferComplete(HttpFetcher *fetcher,
     return;
   }
 
-  if (!successful) {
+  bool response_cached = false;
+  if (!successful && GetHTTPResponseCode() == kHttpResponseNotModified &&
+      LoadCachedResponse()) {
+    LOG(INFO) << "Omaha response not modified, using the cached response: "
+              << string(response_buffer_.begin(), response_buffer_.end());
+    response_cached = true;
+    // The cached response is parsed as a whole below.
+    parser_data_.reset(new OmahaParserData());
+    parser_data_->Parse(response_buffer_.data(), response_buffer_.size(), false);
+  } else if (!successful) {
     LOG(ERROR) << "Omaha request network transfer failed.";
     int code = GetHTTPResponseCode();
     // Makes sure we send sane error values.
@@ -1119,19 +1351,12 @@ void OmahaRequestAction::TransferComplete(HttpFetcher *fetcher,
     return;
   }
 
-  XML_Parser parser = XML_ParserCreate(nullptr);
-  OmahaParserData parser_data(parser);
-  XML_SetUserData(parser, &parser_data);
-  XML_SetElementHandler(parser, ParserHandlerStart, ParserHandlerEnd);
-  XML_SetEntityDeclHandler(parser, ParserHandlerEntityDecl);
-  XML_Status res = XML_Parse(
-      parser,
-      reinterpret_cast<const char*>(response_buffer_.data()),
-      response_buffer_.size(),
-      XML_TRUE);
-  XML_ParserFree(parser);
-
-  if (res != XML_STATUS_OK || parser_data.failed) {
+  // The response was parsed as it was received, only its end is left.
+  if (!parser_data_)
+    parser_data_.reset(new OmahaParserData());
+  OmahaParserData& parser_data = *parser_data_;
+  if (!parser_data.Parse(nullptr, 0, true)) {
+    XML_Parser parser = parser_data.xml_parser;
     LOG(ERROR) << "Omaha response not valid XML: "
                << XML_ErrorString(XML_GetErrorCode(parser))
                << " at line " << XML_GetCurrentLineNumber(parser)
@@ -1148,9 +1373,15 @@ void OmahaRequestAction::TransferComplete(HttpFetcher *fetcher,
 
   // Update the last ping day preferences based on the server daystart response
   // even if we didn't send a ping. Omaha always includes the daystart in the
-  // response, but log the error if it didn't.
-  LOG_IF(ERROR, !UpdateLastPingDays(&parser_data, system_state_->prefs()))
-      << "Failed to update the last ping day preferences!";
+  // response, but log the error if it didn't. The daystart of a cached
+  // response is stale, so the ping is sent again instead.
+  if (response_cached) {
+    LOG(INFO) << "Not updating the last ping days from the cached response.";
+  } else {
+    LOG_IF(ERROR, !UpdateLastPingDays(&parser_data, system_state_->prefs()))
+        << "Failed to update the last ping day preferences!";
+    CacheResponse();
+  }
 
   // Sets first_active_omaha_ping_sent to true (vpd in CrOS). We only do this if
   // we have got a response from omaha and if its value has never been set to
@@ -1228,6 +1459,110 @@ void OmahaRequestAction::TransferComplete(HttpFetcher *fetcher,
   }
 }
 
+string OmahaRequestAction::GetResponseCacheKey() const {
+  string key_data = base::JoinString({params_->update_url(),
+                                      params_->GetAppId(),
+                                      params_->app_version(),
+                                      params_->system_version(),
+                                      params_->product_components(),
+                                      params_->os_platform(),
+                                      params_->os_version(),
+                                      params_->os_board(),
+                                      params_->app_lang(),
+                                      params_->hwid(),
+                                      params_->fw_version(),
+                                      params_->ec_version(),
+                                      params_->current_channel(),
+                                      params_->target_channel(),
+                                      params_->delta_okay() ? "1" : "0",
+                                      params_->target_version_prefix(),
+                                      base::JoinString(
+                                          params_->dlc_module_ids(), ",")},
+                                     "\n");
+  brillo::Blob hash;
+  if (!HashCalculator::RawHashOfBytes(key_data.data(), key_data.size(), &hash))
+    return "";
+  return base::HexEncode(hash.data(), hash.size());
+}
+
+bool OmahaRequestAction::LoadCachedResponse() {
+  if (response_cache_key_.empty())
+    return false;
+  PrefsInterface* prefs = system_state_->prefs();
+  string cache_key, response;
+  if (!prefs->GetString(kPrefsOmahaResponseCacheKey, &cache_key) ||
+      cache_key != response_cache_key_ ||
+      !prefs->GetString(kPrefsOmahaResponse, &response) || response.empty()) {
+    return false;
+  }
+  response_buffer_.assign(response.begin(), response.end());
+  return true;
+}
+
+void OmahaRequestAction::CacheResponse() {
+  if (response_cache_key_.empty())
+    return;
+  PrefsInterface* prefs = system_state_->prefs();
+  string etag = http_fetcher_->GetResponseHeader(kETag);
+  if (etag.empty() || etag.find('\n') != string::npos) {
+    prefs->Delete(kPrefsOmahaResponseETag);
+    prefs->Delete(kPrefsOmahaResponseCacheKey);
+    prefs->Delete(kPrefsOmahaResponse);
+    return;
+  }
+  LOG_IF(WARNING,
+         !prefs->SetString(kPrefsOmahaResponse,
+                           string(response_buffer_.begin(),
+                                  response_buffer_.end())) ||
+             !prefs->SetString(kPrefsOmahaResponseCacheKey,
+                               response_cache_key_) ||
+             !prefs->SetString(kPrefsOmahaResponseETag, etag))
+      << "Unable to cache the Omaha response.";
+}
+
+void OmahaRequestAction::StoreRequestEncoding(bool successful) {
+  // Only the responses of the server itself say which codings it accepts.
+  int code = GetHTTPResponseCode();
+  if (!successful && code != kHttpResponseNotModified &&
+      code != kHttpResponseUnsupportedMedia) {
+    return;
+  }
+  bool accepts_gzip = false;
+  for (const string& coding :
+       base::SplitString(http_fetcher_->GetResponseHeader(kAcceptEncoding),
+                         ",",
+                         base::TRIM_WHITESPACE,
+                         base::SPLIT_WANT_NONEMPTY)) {
+    string name;
+    base::TrimWhitespaceASCII(
+        coding.substr(0, coding.find(';')), base::TRIM_ALL, &name);
+    if (base::ToLowerASCII(name) == kGzipEncoding)
+      accepts_gzip = true;
+  }
+  PrefsInterface* prefs = system_state_->prefs();
+  if (accepts_gzip)
+    prefs->SetString(kPrefsOmahaRequestEncoding, kGzipEncoding);
+  else
+    prefs->Delete(kPrefsOmahaRequestEncoding);
+}
+
+void OmahaRequestAction::SetRequestPostData(bool compress) {
+  brillo::Blob compressed_post;
+  request_compressed_ =
+      compress && GzipCompress(request_post_, &compressed_post);
+  if (request_compressed_) {
+    http_fetcher_->SetHeader(kContentEncoding, kGzipEncoding);
+    http_fetcher_->SetPostData(compressed_post.data(),
+                               compressed_post.size(),
+                               kHttpContentTypeTextXml);
+    LOG(INFO) << "Compressed the Omaha request from " << request_post_.size()
+              << " to " << compressed_post.size() << " bytes.";
+  } else {
+    http_fetcher_->SetPostData(request_post_.data(), request_post_.size(),
+                               kHttpContentTypeTextXml);
+  }
+}
+
 void OmahaRequestAction::CompleteProcessing() {
   ScopedActionCompleter completer(processor_, this);
   OmahaResponse& output_object = const_cast<OmahaResponse&>(GetOutputObject());
@@ -1698,6 +2033,17 @@ bool OmahaRequestAction::ShouldIgnoreUpdate(
   return false;
 }
 
+bool OmahaRequestAction::IsConnectionMetered() const {
+  ConnectionType type;
+  ConnectionTethering tethering;
+  if (!system_state_->connection_manager()->GetConnectionProperties(
+          &type, &tethering)) {
+    return false;
+  }
+  return type == ConnectionType::kCellular ||
+         tethering == ConnectionTethering::kConfirmed;
+}
+
 bool OmahaRequestAction::IsUpdateAllowedOverCurrentConnection() const {
   ConnectionType type;
   ConnectionTethering tethering;
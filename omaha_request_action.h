@@ -281,6 +281,26 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
                    OmahaResponse* output_object,
                    ScopedActionCompleter* completer);
 
+  // Returns a hash of the request parameters the update check response
+  // depends on, used to find a cached response matching the request.
+  std::string GetResponseCacheKey() const;
+
+  // Replaces |response_buffer_| with the response cached for the request.
+  // Returns false if there is no cached response matching the request.
+  bool LoadCachedResponse();
+
+  // Caches the response in |response_buffer_|, if the server sent it with an
+  // ETag to revalidate it with. Otherwise, drops any cached response.
+  void CacheResponse();
+
+  // Stores whether the next requests can be compressed, as advertised by the
+  // server with the Accept-Encoding header of its response (RFC 7694).
+  void StoreRequestEncoding(bool successful);
+
+  // Sets |request_post_| as the post data of the request, compressed if
+  // |compress| and it could be compressed.
+  void SetRequestPostData(bool compress);
+
   // Called by TransferComplete() to complete processing, either
   // asynchronously after looking up resources via p2p or directly.
   void CompleteProcessing();
@@ -298,6 +318,9 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
   // False otherwise.
   bool IsUpdateAllowedOverCurrentConnection() const;
 
+  // Returns true if the current connection is metered: cellular or tethered.
+  bool IsConnectionMetered() const;
+
   // Global system context.
   SystemState* system_state_;
 
@@ -316,6 +339,24 @@ class OmahaRequestAction : public Action<OmahaRequestAction>,
   // Stores the response from the omaha server
   brillo::Blob response_buffer_;
 
+  // The values parsed from the response so far. The response is parsed as
+  // it is received.
+  std::unique_ptr<OmahaParserData> parser_data_;
+
+  // The key of the response cached for this update check, see
+  // GetResponseCacheKey(). Empty if responses aren't cached for this request.
+  std::string response_cache_key_;
+
+  // The number of deferred events sent with this request, removed from the
+  // pending events once it is delivered.
+  size_t pending_events_sent_{0};
+
+  // The uncompressed body of the request, and whether it was posted
+  // compressed. It is posted again uncompressed if the server rejects the
+  // compressed one.
+  std::string request_post_;
+  bool request_compressed_{false};
+
   // Initialized by InitPingDays to values that may be sent to Omaha
   // as part of a ping message. Note that only positive values and -1
   // are sent to Omaha.
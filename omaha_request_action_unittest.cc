@@ -565,6 +565,178 @@ TEST_F(OmahaRequestActionTest, ValidUpdateTest) {
   EXPECT_FALSE(fake_prefs_.Exists(kPrefsOmahaCohortName));
 }
 
+// The response is parsed as it's received, here in two chunks split inside
+// the <app> element.
+TEST_F(OmahaRequestActionTest, ValidUpdateInChunksTest) {
+  string http_response = fake_update_response_.GetUpdateResponse();
+  size_t app_pos = http_response.find("<app ");
+  ASSERT_NE(string::npos, app_pos);
+  ASSERT_LT(app_pos + 20, kMockHttpFetcherChunkSize);
+  string padding = "<!--" +
+                   string(kMockHttpFetcherChunkSize - app_pos - 10, ' ') +
+                   "-->";
+  http_response.insert(app_pos, padding);
+  ASSERT_LT(kMockHttpFetcherChunkSize, http_response.size());
+
+  OmahaResponse response;
+  ASSERT_TRUE(TestUpdateCheck(nullptr,  // request_params
+                              http_response,
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kUpdateAvailable,
+                              metrics::CheckReaction::kUpdating,
+                              metrics::DownloadErrorCode::kUnset,
+                              &response,
+                              nullptr));
+  EXPECT_TRUE(response.update_exists);
+  EXPECT_EQ(fake_update_response_.version, response.version);
+  EXPECT_EQ(fake_update_response_.GetPayloadUrl(),
+            response.packages[0].payload_urls[0]);
+  EXPECT_EQ(fake_update_response_.hash, response.packages[0].hash);
+}
+
+// A response sent with an ETag is cached, and used when the server replies
+// that it's not modified.
+TEST_F(OmahaRequestActionTest, CachedResponseTest) {
+  // Runs an update check answered with |http_response| and |etag|, or with
+  // "304 Not Modified" if |http_response| is empty. Returns the If-None-Match
+  // header of the request.
+  auto update_check = [this](const string& http_response,
+                             const string& etag,
+                             OmahaResponse* out_response) {
+    brillo::FakeMessageLoop loop(nullptr);
+    loop.SetAsCurrent();
+    MockHttpFetcher* fetcher = new MockHttpFetcher(
+        http_response.data(), http_response.size(), nullptr);
+    if (http_response.empty())
+      fetcher->FailTransfer(kHttpResponseNotModified);
+    fetcher->SetResponseHeader("ETag", etag);
+    OmahaRequestAction action(&fake_system_state_,
+                              nullptr,
+                              base::WrapUnique(fetcher),
+                              false);  // ping_only
+    OmahaRequestActionTestProcessorDelegate delegate;
+    ActionProcessor processor;
+    processor.set_delegate(&delegate);
+    processor.EnqueueAction(&action);
+    OutputObjectCollectorAction collector_action;
+    BondActions(&action, &collector_action);
+    processor.EnqueueAction(&collector_action);
+    loop.PostTask(base::Bind(
+        [](ActionProcessor* processor) { processor->StartProcessing(); },
+        base::Unretained(&processor)));
+    loop.Run();
+    EXPECT_TRUE(collector_action.has_input_object_);
+    *out_response = collector_action.omaha_response_;
+    return fetcher->GetHeader("If-None-Match");
+  };
+
+  OmahaResponse response;
+  EXPECT_EQ("",
+            update_check(fake_update_response_.GetUpdateResponse(),
+                         "\"etag1\"",
+                         &response));
+  EXPECT_TRUE(response.update_exists);
+  EXPECT_TRUE(fake_prefs_.Exists(kPrefsOmahaResponse));
+
+  response = OmahaResponse();
+  EXPECT_EQ("\"etag1\"", update_check("", "", &response));
+  EXPECT_TRUE(response.update_exists);
+  EXPECT_EQ(fake_update_response_.version, response.version);
+  EXPECT_EQ(fake_update_response_.hash, response.packages[0].hash);
+
+  // A response without an ETag drops the cached one.
+  EXPECT_EQ("\"etag1\"",
+            update_check(fake_update_response_.GetNoUpdateResponse(),
+                         "",
+                         &response));
+  EXPECT_FALSE(response.update_exists);
+  EXPECT_FALSE(fake_prefs_.Exists(kPrefsOmahaResponse));
+  EXPECT_EQ("",
+            update_check(fake_update_response_.GetNoUpdateResponse(),
+                         "",
+                         &response));
+}
+
+// The request is compressed once the server said it accepts gzip.
+TEST_F(OmahaRequestActionTest, CompressedRequestTest) {
+  // Runs an update check answered with the |accept_encoding| header. Returns
+  // the body of the request and stores its Content-Encoding header in
+  // |content_encoding|.
+  auto update_check = [this](const string& accept_encoding,
+                             string* content_encoding) {
+    brillo::FakeMessageLoop loop(nullptr);
+    loop.SetAsCurrent();
+    string http_response = fake_update_response_.GetNoUpdateResponse();
+    MockHttpFetcher* fetcher = new MockHttpFetcher(
+        http_response.data(), http_response.size(), nullptr);
+    fetcher->SetResponseHeader("Accept-Encoding", accept_encoding);
+    OmahaRequestAction action(&fake_system_state_,
+                              nullptr,
+                              base::WrapUnique(fetcher),
+                              false);  // ping_only
+    OmahaRequestActionTestProcessorDelegate delegate;
+    ActionProcessor processor;
+    processor.set_delegate(&delegate);
+    processor.EnqueueAction(&action);
+    loop.PostTask(base::Bind(
+        [](ActionProcessor* processor) { processor->StartProcessing(); },
+        base::Unretained(&processor)));
+    loop.Run();
+    *content_encoding = fetcher->GetHeader("Content-Encoding");
+    return string(fetcher->post_data().begin(), fetcher->post_data().end());
+  };
+
+  string content_encoding;
+  string post = update_check("br;q=1.0, GZIP", &content_encoding);
+  EXPECT_EQ(0U, post.find("<?xml"));
+  EXPECT_EQ("", content_encoding);
+  EXPECT_TRUE(fake_prefs_.Exists(kPrefsOmahaRequestEncoding));
+
+  // The gzip magic number.
+  post = update_check("", &content_encoding);
+  EXPECT_EQ(0U, post.find("\x1f\x8b"));
+  EXPECT_EQ("gzip", content_encoding);
+  EXPECT_FALSE(fake_prefs_.Exists(kPrefsOmahaRequestEncoding));
+
+  post = update_check("", &content_encoding);
+  EXPECT_EQ(0U, post.find("<?xml"));
+  EXPECT_EQ("", content_encoding);
+}
+
+// A compressed request rejected with 415 is sent again uncompressed, once.
+TEST_F(OmahaRequestActionTest, RejectedCompressedRequestTest) {
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  fake_prefs_.SetString(kPrefsOmahaRequestEncoding, "gzip");
+  string http_response = fake_update_response_.GetNoUpdateResponse();
+  MockHttpFetcher* fetcher = new MockHttpFetcher(
+      http_response.data(), http_response.size(), nullptr);
+  // The retry fails the same way, and isn't retried again.
+  fetcher->FailTransfer(415);
+  OmahaRequestAction action(&fake_system_state_,
+                            nullptr,
+                            base::WrapUnique(fetcher),
+                            false);  // ping_only
+  OmahaRequestActionTestProcessorDelegate delegate;
+  delegate.expected_code_ = static_cast<ErrorCode>(
+      static_cast<int>(ErrorCode::kOmahaRequestHTTPResponseBase) + 415);
+  ActionProcessor processor;
+  processor.set_delegate(&delegate);
+  processor.EnqueueAction(&action);
+  loop.PostTask(base::Bind(
+      [](ActionProcessor* processor) { processor->StartProcessing(); },
+      base::Unretained(&processor)));
+  loop.Run();
+  EXPECT_FALSE(loop.PendingTasks());
+
+  string post(fetcher->post_data().begin(), fetcher->post_data().end());
+  EXPECT_EQ(0U, post.find("<?xml"));
+  EXPECT_EQ("", fetcher->GetHeader("Content-Encoding"));
+  EXPECT_FALSE(fake_prefs_.Exists(kPrefsOmahaRequestEncoding));
+}
+
 TEST_F(OmahaRequestActionTest, MultiPackageUpdateTest) {
   OmahaResponse response;
   fake_update_response_.multi_package = true;
@@ -623,6 +795,9 @@ TEST_F(OmahaRequestActionTest, MultiAppUpdateTest) {
   EXPECT_EQ(333u, response.packages[1].size);
   EXPECT_EQ(33u, response.packages[1].metadata_size);
   EXPECT_EQ(false, response.packages[1].is_delta);
+  // Each package is attributed to its <app>.
+  EXPECT_EQ(fake_update_response_.app_id, response.packages[0].app_id);
+  EXPECT_EQ(fake_update_response_.app_id2, response.packages[1].app_id);
 }
 
 TEST_F(OmahaRequestActionTest, MultiAppAndSystemUpdateTest) {
@@ -659,6 +834,40 @@ TEST_F(OmahaRequestActionTest, MultiAppAndSystemUpdateTest) {
   EXPECT_EQ(false, response.packages[1].is_delta);
 }
 
+// The DLC modules are checked in the same request as the OS.
+TEST_F(OmahaRequestActionTest, DlcModulesRequestTest) {
+  brillo::Blob post_data;
+  request_params_.set_dlc_module_ids({"dlc_a", "dlc_b"});
+  ASSERT_FALSE(TestUpdateCheck(nullptr,  // request_params
+                               "invalid xml>",
+                               -1,
+                               false,  // ping_only
+                               ErrorCode::kOmahaRequestXMLParseError,
+                               metrics::CheckResult::kParsingError,
+                               metrics::CheckReaction::kUnset,
+                               metrics::DownloadErrorCode::kUnset,
+                               nullptr,  // response
+                               &post_data));
+  string post_str(post_data.begin(), post_data.end());
+  size_t os_app = post_str.find("appid=\"" + request_params_.GetAppId() + "\"");
+  size_t dlc_a =
+      post_str.find("appid=\"" + request_params_.GetAppId() + "_dlc_a\"");
+  size_t dlc_b =
+      post_str.find("appid=\"" + request_params_.GetAppId() + "_dlc_b\"");
+  EXPECT_NE(string::npos, os_app);
+  EXPECT_NE(string::npos, dlc_a);
+  EXPECT_NE(string::npos, dlc_b);
+  EXPECT_LT(os_app, dlc_a);
+  EXPECT_LT(dlc_a, dlc_b);
+  // The attributes shared by the apps are in each of them, but the previous
+  // version is only reported once.
+  EXPECT_NE(post_str.find("hardware_class=", dlc_b), string::npos);
+  size_t previous_version = post_str.find("previousversion=");
+  EXPECT_NE(string::npos, previous_version);
+  EXPECT_LT(previous_version, dlc_a);
+  EXPECT_EQ(previous_version, post_str.rfind("previousversion="));
+}
+
 TEST_F(OmahaRequestActionTest, MultiAppPartialUpdateTest) {
   OmahaResponse response;
   fake_update_response_.multi_app = true;
@@ -1603,6 +1812,65 @@ TEST_F(OmahaRequestActionTest, FormatErrorEventOutputTest) {
   EXPECT_EQ(post_str.find("updatecheck"), string::npos);
 }
 
+// Events aren't sent over a metered connection, but with the next request.
+TEST_F(OmahaRequestActionTest, EventDeferredOverMeteredConnectionTest) {
+  MockConnectionManager mock_cm;
+  fake_system_state_.set_connection_manager(&mock_cm);
+  EXPECT_CALL(mock_cm, GetConnectionProperties(_, _))
+      .WillRepeatedly(DoAll(SetArgPointee<0>(ConnectionType::kCellular),
+                            SetArgPointee<1>(ConnectionTethering::kUnknown),
+                            Return(true)));
+  EXPECT_CALL(mock_cm, IsUpdateAllowedOver(_, _)).WillRepeatedly(Return(true));
+
+  for (OmahaEvent::Type type : {OmahaEvent::kTypeUpdateDownloadStarted,
+                                OmahaEvent::kTypeUpdateDownloadFinished}) {
+    brillo::FakeMessageLoop loop(nullptr);
+    loop.SetAsCurrent();
+    MockHttpFetcher* fetcher = new MockHttpFetcher("", 0, nullptr);
+    fetcher->set_never_use(true);
+    OmahaRequestAction action(&fake_system_state_,
+                              new OmahaEvent(type),
+                              base::WrapUnique(fetcher),
+                              false);  // ping_only
+    OmahaRequestActionTestProcessorDelegate delegate;
+    ActionProcessor processor;
+    processor.set_delegate(&delegate);
+    processor.EnqueueAction(&action);
+    loop.PostTask(base::Bind(
+        [](ActionProcessor* processor) { processor->StartProcessing(); },
+        base::Unretained(&processor)));
+    loop.Run();
+  }
+  EXPECT_TRUE(fake_prefs_.Exists(kPrefsOmahaPendingEvents));
+
+  // The deferred events are sent in order with the update check.
+  brillo::Blob post_data;
+  ASSERT_TRUE(TestUpdateCheck(nullptr,  // request_params
+                              fake_update_response_.GetNoUpdateResponse(),
+                              -1,
+                              false,  // ping_only
+                              ErrorCode::kSuccess,
+                              metrics::CheckResult::kNoUpdateAvailable,
+                              metrics::CheckReaction::kUnset,
+                              metrics::DownloadErrorCode::kUnset,
+                              nullptr,
+                              &post_data));
+  string post_str(post_data.begin(), post_data.end());
+  size_t started = post_str.find(base::StringPrintf(
+      "<event eventtype=\"%d\" eventresult=\"%d\"></event>",
+      OmahaEvent::kTypeUpdateDownloadStarted,
+      OmahaEvent::kResultSuccess));
+  size_t finished = post_str.find(base::StringPrintf(
+      "<event eventtype=\"%d\" eventresult=\"%d\"></event>",
+      OmahaEvent::kTypeUpdateDownloadFinished,
+      OmahaEvent::kResultSuccess));
+  EXPECT_NE(string::npos, started);
+  EXPECT_NE(string::npos, finished);
+  EXPECT_LT(started, finished);
+  EXPECT_NE(string::npos, post_str.find("<updatecheck"));
+  EXPECT_FALSE(fake_prefs_.Exists(kPrefsOmahaPendingEvents));
+}
+
 TEST_F(OmahaRequestActionTest, IsEventTest) {
   string http_response("doesn't matter");
   // Create a copy of the OmahaRequestParams to reuse it later.
@@ -2047,6 +2315,26 @@ TEST_F(OmahaRequestActionTest, ParseUpdateCheckAttributesTest) {
   EXPECT_EQ("security-only", eol_pref);
 }
 
+TEST_F(OmahaRequestActionTest, ParseServerLoadTest) {
+  OmahaResponse response;
+  ASSERT_TRUE(
+      TestUpdateCheck(nullptr,  // request_params
+                      "<?xml version=\"1.0\" encoding=\"UTF-8\"?><response "
+                      "protocol=\"3.0\"><app appid=\"foo\" status=\"ok\">"
+                      "<ping status=\"ok\"/><updatecheck status=\"noupdate\" "
+                      "_server_load=\"150\"/></app></response>",
+                      -1,
+                      false,  // ping_only
+                      ErrorCode::kSuccess,
+                      metrics::CheckResult::kNoUpdateAvailable,
+                      metrics::CheckReaction::kUnset,
+                      metrics::DownloadErrorCode::kUnset,
+                      &response,
+                      nullptr));
+  // The load is capped at 100%.
+  EXPECT_EQ(100, response.server_load);
+}
+
 TEST_F(OmahaRequestActionTest, NoUniqueIDTest) {
   brillo::Blob post_data;
   ASSERT_FALSE(TestUpdateCheck(nullptr,  // request_params
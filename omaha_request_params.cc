@@ -245,4 +245,8 @@ string OmahaRequestParams::GetAppId() const {
                                                : image_props_.product_id;
 }
 
+string OmahaRequestParams::GetDlcAppId(const string& dlc_module_id) const {
+  return GetAppId() + "_" + dlc_module_id;
+}
+
 }  // namespace chromeos_update_engine
@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 #include <base/macros.h>
 #include <base/time/time.h>
@@ -164,6 +165,15 @@ class OmahaRequestParams {
     return target_version_prefix_;
   }
 
+  // The ids of the auxiliary modules (DLCs) checked for updates in the same
+  // request as the OS, each as its own <app>.
+  inline void set_dlc_module_ids(const std::vector<std::string>& ids) {
+    dlc_module_ids_ = ids;
+  }
+  inline std::vector<std::string> dlc_module_ids() const {
+    return dlc_module_ids_;
+  }
+
   inline void set_wall_clock_based_wait_enabled(bool enabled) {
     wall_clock_based_wait_enabled_ = enabled;
   }
@@ -202,6 +212,9 @@ class OmahaRequestParams {
   // download channel.
   virtual std::string GetAppId() const;
 
+  // Returns the app id of the module |dlc_module_id|, derived from GetAppId().
+  std::string GetDlcAppId(const std::string& dlc_module_id) const;
+
   // Suggested defaults
   static const char kOsVersion[];
   static const char kIsPowerwashAllowedKey[];
@@ -337,6 +350,9 @@ class OmahaRequestParams {
   // to be pinned to. It's empty otherwise.
   std::string target_version_prefix_;
 
+  // The ids of the DLC modules to check for updates along with the OS.
+  std::vector<std::string> dlc_module_ids_;
+
   // True if scattering is enabled, in which case waiting_period_ specifies the
   // amount of absolute time that we've to wait for before sending a request to
   // Omaha.
@@ -35,6 +35,9 @@ struct OmahaResponse {
   // If non-zero, server-dictated poll interval in seconds.
   int poll_interval = 0;
 
+  // The load of the server, in percent, if it reported one; zero otherwise.
+  int server_load = 0;
+
   // These are only valid if update_exists is true:
   std::string version;
   std::string system_version;
@@ -50,6 +53,8 @@ struct OmahaResponse {
     // True if the payload described in this response is a delta payload.
     // False if it's a full payload.
     bool is_delta = false;
+    // The id of the <app> this package was sent for, the OS or a DLC module.
+    std::string app_id;
   };
   std::vector<Package> packages;
 
@@ -82,6 +82,10 @@ const char kDefaultP2PDir[] = "/var/cache/p2p";
 // p2p ddoc for details.
 const char kCrosP2PFileSizeXAttrName[] = "user.cros-p2p-filesize";
 
+// How long the URL found by a lookup is reused for the next lookups of the
+// same file.
+const TimeDelta kLookupCacheTtl = TimeDelta::FromMinutes(5);
+
 }  // namespace
 
 // The default P2PManager::Configuration implementation.
@@ -172,6 +176,13 @@ class P2PManagerImpl : public P2PManager {
   // An async callback used by the above.
   void OnEnabledStatusChange(EvalStatus status, const bool& result);
 
+  // Called with the |url| found by the p2p-client lookup of
+  // |file_id_with_ext| with |minimum_size|, or an empty string if none.
+  // Runs the callbacks waiting for it.
+  void OnLookupDone(const string& file_id_with_ext,
+                    size_t minimum_size,
+                    const string& url);
+
   // The device policy being used or null if no policy is being used.
   const policy::DevicePolicy* device_policy_ = nullptr;
 
@@ -211,6 +222,15 @@ class P2PManagerImpl : public P2PManager {
   bool is_enabled_;
   bool waiting_for_enabled_status_change_ = false;
 
+  // The URLs found by the recent lookups, by file and minimum size, with the
+  // monotonic time of the lookup. The failed lookups aren't kept since a peer
+  // may show up at any time.
+  map<pair<string, size_t>, pair<string, Time>> lookup_cache_;
+
+  // The callbacks waiting for the lookups in progress, by file and minimum
+  // size, so a single p2p-client runs for concurrent lookups of a file.
+  map<pair<string, size_t>, vector<LookupCallback>> pending_lookups_;
+
   DISALLOW_COPY_AND_ASSIGN(P2PManagerImpl);
 };
 
@@ -494,13 +514,55 @@ void P2PManagerImpl::LookupUrlForFile(const string& file_id,
                                       size_t minimum_size,
                                       TimeDelta max_time_to_wait,
                                       LookupCallback callback) {
-  LookupData *lookup_data = new LookupData(callback);
   string file_id_with_ext = file_id + "." + file_extension_;
+  pair<string, size_t> key(file_id_with_ext, minimum_size);
+  auto cached = lookup_cache_.find(key);
+  if (cached != lookup_cache_.end()) {
+    if (clock_->GetMonotonicTime() - cached->second.second < kLookupCacheTtl) {
+      LOG(INFO) << "Reusing the p2p URL " << cached->second.first
+                << " found recently for " << file_id_with_ext;
+      // The callback is always called from the message loop.
+      if (!callback.is_null()) {
+        MessageLoop::current()->PostTask(
+            FROM_HERE, Bind(callback, cached->second.first));
+      }
+      return;
+    }
+    lookup_cache_.erase(cached);
+  }
+
+  vector<LookupCallback>& callbacks = pending_lookups_[key];
+  callbacks.push_back(callback);
+  if (callbacks.size() > 1) {
+    LOG(INFO) << "Waiting for the p2p lookup of " << file_id_with_ext
+              << " in progress.";
+    return;
+  }
+  LookupData *lookup_data = new LookupData(Bind(&P2PManagerImpl::OnLookupDone,
+                                                base::Unretained(this),
+                                                file_id_with_ext,
+                                                minimum_size));
   vector<string> args = configuration_->GetP2PClientArgs(file_id_with_ext,
                                                          minimum_size);
   lookup_data->InitiateLookup(args, max_time_to_wait);
 }
 
+void P2PManagerImpl::OnLookupDone(const string& file_id_with_ext,
+                                  size_t minimum_size,
+                                  const string& url) {
+  pair<string, size_t> key(file_id_with_ext, minimum_size);
+  if (!url.empty())
+    lookup_cache_[key] = std::make_pair(url, clock_->GetMonotonicTime());
+  // Take the callbacks out first, a callback may start a new lookup.
+  vector<LookupCallback> callbacks;
+  callbacks.swap(pending_lookups_[key]);
+  pending_lookups_.erase(key);
+  for (const LookupCallback& callback : callbacks) {
+    if (!callback.is_null())
+      callback.Run(url);
+  }
+}
+
 bool P2PManagerImpl::FileShare(const string& file_id,
                                size_t expected_size) {
   // Check if file already exist.
@@ -99,6 +99,10 @@ class P2PManager {
   //
   // If the file is not available on the LAN (or if mDNS/DNS-SD is
   // filtered), this is guaranteed to not take longer than 5 seconds.
+  //
+  // A URL found is reused for the lookups of the same file in the next
+  // few minutes, and the concurrent lookups of a file share the first
+  // one, including its |max_time_to_wait|.
   virtual void LookupUrlForFile(const std::string& file_id,
                                 size_t minimum_size,
                                 base::TimeDelta max_time_to_wait,
@@ -523,4 +523,49 @@ TEST_F(P2PManagerTest, LookupURL) {
   loop_.Run();
 }
 
+static void ExpectUrlAndCount(const string& expected_url,
+                              int* num_calls,
+                              const string& url) {
+  EXPECT_EQ(expected_url, url);
+  if (--*num_calls == 0)
+    MessageLoop::current()->BreakLoop();
+}
+
+// Check that the URLs found are reused and that concurrent lookups of a file
+// run p2p-client once.
+TEST_F(P2PManagerTest, LookupURLCache) {
+  base::FilePath runs_path = test_conf_->GetP2PDir().Append("runs");
+  test_conf_->SetP2PClientCommand({
+      "sh", "-c",
+      "echo run >> " + runs_path.value() + "; echo http://1.2.3.4/{file_id}"});
+  int num_calls = 2;
+  manager_->LookupUrlForFile(
+      "fooX", 42, TimeDelta(),
+      base::Bind(ExpectUrlAndCount, "http://1.2.3.4/fooX.cros_au", &num_calls));
+  manager_->LookupUrlForFile(
+      "fooX", 42, TimeDelta(),
+      base::Bind(ExpectUrlAndCount, "http://1.2.3.4/fooX.cros_au", &num_calls));
+  loop_.Run();
+  string runs;
+  EXPECT_TRUE(base::ReadFileToString(runs_path, &runs));
+  EXPECT_EQ("run\n", runs);
+
+  // The URL found is reused, even if p2p-client would fail now.
+  test_conf_->SetP2PClientCommand({"false"});
+  manager_->LookupUrlForFile("fooX", 42, TimeDelta(),
+                             base::Bind(ExpectUrl,
+                                        "http://1.2.3.4/fooX.cros_au"));
+  loop_.Run();
+
+  // ... but not for another minimum size or after a while.
+  manager_->LookupUrlForFile("fooX", 43, TimeDelta(),
+                             base::Bind(ExpectUrl, ""));
+  loop_.Run();
+  fake_clock_.SetMonotonicTime(fake_clock_.GetMonotonicTime() +
+                               TimeDelta::FromMinutes(10));
+  manager_->LookupUrlForFile("fooX", 42, TimeDelta(),
+                             base::Bind(ExpectUrl, ""));
+  loop_.Run();
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,115 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/parcelable_update_engine_performance.h"
+
+#include <binder/Parcel.h>
+#include <utils/String8.h>
+
+using update_engine::UpdateEnginePerformance;
+
+namespace android {
+namespace brillo {
+
+ParcelableUpdateEnginePerformance::ParcelableUpdateEnginePerformance(
+    const UpdateEnginePerformance& performance)
+    : download_bytes_per_second_(performance.download_bytes_per_second),
+      apply_bytes_per_second_(performance.apply_bytes_per_second),
+      disk_write_bytes_per_second_(performance.disk_write_bytes_per_second),
+      eta_seconds_(performance.eta_seconds),
+      current_operation_type_(
+          String16{performance.current_operation_type.c_str()}),
+      current_operation_index_(performance.current_operation_index) {}
+
+UpdateEnginePerformance
+ParcelableUpdateEnginePerformance::ToUpdateEnginePerformance() const {
+  UpdateEnginePerformance performance;
+  performance.download_bytes_per_second = download_bytes_per_second_;
+  performance.apply_bytes_per_second = apply_bytes_per_second_;
+  performance.disk_write_bytes_per_second = disk_write_bytes_per_second_;
+  performance.eta_seconds = eta_seconds_;
+  performance.current_operation_type =
+      String8{current_operation_type_}.string();
+  performance.current_operation_index = current_operation_index_;
+  return performance;
+}
+
+status_t ParcelableUpdateEnginePerformance::writeToParcel(
+    Parcel* parcel) const {
+  status_t status;
+
+  status = parcel->writeInt64(download_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->writeInt64(apply_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->writeInt64(disk_write_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->writeInt64(eta_seconds_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->writeString16(current_operation_type_);
+  if (status != OK) {
+    return status;
+  }
+
+  return parcel->writeInt64(current_operation_index_);
+}
+
+status_t ParcelableUpdateEnginePerformance::readFromParcel(
+    const Parcel* parcel) {
+  status_t status;
+
+  status = parcel->readInt64(&download_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->readInt64(&apply_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->readInt64(&disk_write_bytes_per_second_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->readInt64(&eta_seconds_);
+  if (status != OK) {
+    return status;
+  }
+
+  status = parcel->readString16(&current_operation_type_);
+  if (status != OK) {
+    return status;
+  }
+
+  return parcel->readInt64(&current_operation_index_);
+}
+
+}  // namespace brillo
+}  // namespace android
@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PARCELABLE_UPDATE_ENGINE_PERFORMANCE_H_
+#define UPDATE_ENGINE_PARCELABLE_UPDATE_ENGINE_PERFORMANCE_H_
+
+#include <binder/Parcelable.h>
+#include <utils/String16.h>
+
+#include "update_engine/client_library/include/update_engine/update_status.h"
+
+namespace android {
+namespace brillo {
+
+// Parcelable object containing the throughput and position of the update in
+// progress, to be sent over binder to clients from the server.
+class ParcelableUpdateEnginePerformance : public Parcelable {
+ public:
+  ParcelableUpdateEnginePerformance() = default;
+  explicit ParcelableUpdateEnginePerformance(
+      const update_engine::UpdateEnginePerformance& performance);
+  virtual ~ParcelableUpdateEnginePerformance() = default;
+
+  status_t writeToParcel(Parcel* parcel) const override;
+  status_t readFromParcel(const Parcel* parcel) override;
+
+  // Returns the values in the client library type.
+  update_engine::UpdateEnginePerformance ToUpdateEnginePerformance() const;
+
+  // This list is kept in the Parcelable serialization order.
+
+  // The download throughput (bytes per second).
+  int64_t download_bytes_per_second_;
+  // The payload data applied (bytes per second).
+  int64_t apply_bytes_per_second_;
+  // The data written to the target partitions (bytes per second).
+  int64_t disk_write_bytes_per_second_;
+  // The estimated time left to download the payload (seconds), or -1.
+  int64_t eta_seconds_;
+  // The type of the install operation being applied, if any.
+  android::String16 current_operation_type_;
+  // The index of that operation in the payload, or -1.
+  int64_t current_operation_index_;
+};
+
+}  // namespace brillo
+}  // namespace android
+
+#endif  // UPDATE_ENGINE_PARCELABLE_UPDATE_ENGINE_PERFORMANCE_H_
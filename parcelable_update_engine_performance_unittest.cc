@@ -0,0 +1,70 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/parcelable_update_engine_performance.h"
+
+#include <binder/Parcel.h>
+#include <gtest/gtest.h>
+
+using android::Parcel;
+using android::String16;
+using android::brillo::ParcelableUpdateEnginePerformance;
+using android::status_t;
+using update_engine::UpdateEnginePerformance;
+
+namespace {
+const UpdateEnginePerformance kPerformance = {
+    1024 * 1024, 512 * 1024, 4 * 1024 * 1024, 120, "SOURCE_BSDIFF", 42};
+}  // namespace
+
+TEST(ParcelableUpdateEnginePerformanceTest, TestConversions) {
+  ParcelableUpdateEnginePerformance parcelable(kPerformance);
+  EXPECT_EQ(kPerformance.download_bytes_per_second,
+            parcelable.download_bytes_per_second_);
+  EXPECT_EQ(kPerformance.apply_bytes_per_second,
+            parcelable.apply_bytes_per_second_);
+  EXPECT_EQ(kPerformance.disk_write_bytes_per_second,
+            parcelable.disk_write_bytes_per_second_);
+  EXPECT_EQ(kPerformance.eta_seconds, parcelable.eta_seconds_);
+  EXPECT_EQ(String16{"SOURCE_BSDIFF"}, parcelable.current_operation_type_);
+  EXPECT_EQ(kPerformance.current_operation_index,
+            parcelable.current_operation_index_);
+
+  UpdateEnginePerformance performance = parcelable.ToUpdateEnginePerformance();
+  EXPECT_EQ(kPerformance.eta_seconds, performance.eta_seconds);
+  EXPECT_EQ(kPerformance.current_operation_type,
+            performance.current_operation_type);
+}
+
+TEST(ParcelableUpdateEnginePerformanceTest, TestParceling) {
+  ParcelableUpdateEnginePerformance source(kPerformance);
+  Parcel parcel_source, parcel_target;
+  EXPECT_EQ(::android::OK, source.writeToParcel(&parcel_source));
+  status_t status =
+      parcel_target.setData(parcel_source.data(), parcel_source.dataSize());
+  EXPECT_EQ(::android::OK, status);
+  ParcelableUpdateEnginePerformance target;
+  EXPECT_EQ(::android::OK, target.readFromParcel(&parcel_target));
+
+  EXPECT_EQ(source.download_bytes_per_second_,
+            target.download_bytes_per_second_);
+  EXPECT_EQ(source.apply_bytes_per_second_, target.apply_bytes_per_second_);
+  EXPECT_EQ(source.disk_write_bytes_per_second_,
+            target.disk_write_bytes_per_second_);
+  EXPECT_EQ(source.eta_seconds_, target.eta_seconds_);
+  EXPECT_EQ(source.current_operation_type_, target.current_operation_type_);
+  EXPECT_EQ(source.current_operation_index_, target.current_operation_index_);
+}
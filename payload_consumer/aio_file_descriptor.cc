@@ -0,0 +1,336 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/aio_file_descriptor.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+using std::min;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The C library doesn't provide wrappers for the native AIO system calls.
+int IoSetup(unsigned nr_events, aio_context_t* ctx) {
+  return syscall(__NR_io_setup, nr_events, ctx);
+}
+
+int IoDestroy(aio_context_t ctx) {
+  return syscall(__NR_io_destroy, ctx);
+}
+
+long IoSubmit(aio_context_t ctx, long nr, struct iocb** iocbs) {  // NOLINT
+  return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+long IoGetEvents(aio_context_t ctx,  // NOLINT
+                 long min_nr,        // NOLINT
+                 long nr,            // NOLINT
+                 struct io_event* events) {
+  return syscall(__NR_io_getevents, ctx, min_nr, nr, events, nullptr);
+}
+
+}  // namespace
+
+const size_t AioFileDescriptor::kDefaultQueueDepth = 32;
+const size_t AioFileDescriptor::kDefaultMaxBatchSize = 8;
+
+AioFileDescriptor::AioFileDescriptor(size_t queue_depth, size_t max_batch_size)
+    : queue_depth_(queue_depth), max_batch_size_(max_batch_size) {
+  CHECK_GT(queue_depth_, 0U);
+  CHECK_GT(max_batch_size_, 0U);
+}
+
+AioFileDescriptor::~AioFileDescriptor() {
+  // io_destroy() blocks until the requests in flight completed, so their
+  // buffers can be released afterwards.
+  if (ctx_)
+    IoDestroy(ctx_);
+}
+
+bool AioFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  if (!EintrSafeFileDescriptor::Open(path, flags, mode))
+    return false;
+  SetupContext();
+  return true;
+}
+
+bool AioFileDescriptor::Open(const char* path, int flags) {
+  if (!EintrSafeFileDescriptor::Open(path, flags))
+    return false;
+  SetupContext();
+  return true;
+}
+
+void AioFileDescriptor::SetupContext() {
+  offset_ = 0;
+  write_failed_ = false;
+  write_errno_ = 0;
+  ctx_ = 0;
+  if (IoSetup(queue_depth_, &ctx_) != 0) {
+    PLOG(WARNING) << "Unable to set up an AIO context, using synchronous "
+                  << "writes";
+    ctx_ = 0;
+  }
+}
+
+ssize_t AioFileDescriptor::Read(void* buf, size_t count) {
+  if (!IsAsync())
+    return EintrSafeFileDescriptor::Read(buf, count);
+  CHECK_GE(fd_, 0);
+  if (!WaitAll())
+    return -1;
+  ssize_t ret = HANDLE_EINTR(pread64(fd_, buf, count, offset_));
+  if (ret > 0)
+    offset_ += ret;
+  return ret;
+}
+
+ssize_t AioFileDescriptor::Write(const void* buf, size_t count) {
+  if (!IsAsync())
+    return EintrSafeFileDescriptor::Write(buf, count);
+  CHECK_GE(fd_, 0);
+  if (write_failed_) {
+    errno = write_errno_;
+    return -1;
+  }
+  if (count == 0)
+    return 0;
+
+  // Requests in flight may complete in any order, so a write to a range still
+  // being written must wait for it.
+  if (OverlapsQueuedWrite(offset_, count) && !WaitAll())
+    return -1;
+
+  std::unique_ptr<Request> request(new Request());
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(buf);
+  request->data.assign(bytes, bytes + count);
+  memset(&request->cb, 0, sizeof(request->cb));
+  request->cb.aio_data = next_request_id_++;
+  request->cb.aio_lio_opcode = IOCB_CMD_PWRITE;
+  request->cb.aio_fildes = fd_;
+  request->cb.aio_buf = reinterpret_cast<uintptr_t>(request->data.data());
+  request->cb.aio_nbytes = count;
+  request->cb.aio_offset = offset_;
+  pending_.push_back(std::move(request));
+  offset_ += count;
+
+  if (pending_.size() >= max_batch_size_ && !Submit())
+    return -1;
+  return count;
+}
+
+off64_t AioFileDescriptor::Seek(off64_t offset, int whence) {
+  if (!IsAsync())
+    return EintrSafeFileDescriptor::Seek(offset, whence);
+  CHECK_GE(fd_, 0);
+  off64_t new_offset;
+  switch (whence) {
+    case SEEK_SET:
+      new_offset = offset;
+      break;
+    case SEEK_CUR:
+      new_offset = offset_ + offset;
+      break;
+    default:
+      // Let the kernel resolve the other cases once the file size is final.
+      if (!WaitAll())
+        return -1;
+      new_offset = lseek64(fd_, offset, whence);
+      if (new_offset < 0)
+        return -1;
+  }
+  if (new_offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  offset_ = new_offset;
+  return offset_;
+}
+
+bool AioFileDescriptor::BlkIoctl(int request,
+                                 uint64_t start,
+                                 uint64_t length,
+                                 int* result) {
+  if (IsAsync() && !WaitAll())
+    return false;
+  return EintrSafeFileDescriptor::BlkIoctl(request, start, length, result);
+}
+
+bool AioFileDescriptor::CopyRangeFrom(FileDescriptor* source,
+                                      uint64_t source_offset,
+                                      uint64_t offset,
+                                      uint64_t length) {
+  if (IsAsync() && !WaitAll())
+    return false;
+  return EintrSafeFileDescriptor::CopyRangeFrom(
+      source, source_offset, offset, length);
+}
+
+int AioFileDescriptor::GetNativeFd() {
+  if (IsAsync() && !WaitAll())
+    return -1;
+  return EintrSafeFileDescriptor::GetNativeFd();
+}
+
+bool AioFileDescriptor::Flush() {
+  if (IsAsync() && !WaitAll())
+    return false;
+  return EintrSafeFileDescriptor::Flush();
+}
+
+bool AioFileDescriptor::Close() {
+  bool success = true;
+  if (IsAsync()) {
+    success = WaitAll();
+    IoDestroy(ctx_);
+    ctx_ = 0;
+    pending_.clear();
+    in_flight_.clear();
+  }
+  return EintrSafeFileDescriptor::Close() && success;
+}
+
+bool AioFileDescriptor::Submit() {
+  while (!pending_.empty()) {
+    if (write_failed_) {
+      pending_.clear();
+      break;
+    }
+    if (in_flight_.size() >= queue_depth_) {
+      if (!Reap(1)) {
+        pending_.clear();
+        break;
+      }
+      continue;
+    }
+
+    size_t num_requests = min(queue_depth_ - in_flight_.size(),
+                              pending_.size());
+    vector<struct iocb*> cbs;
+    for (size_t i = 0; i < num_requests; i++)
+      cbs.push_back(&pending_[i]->cb);
+    long ret = IoSubmit(ctx_, num_requests, cbs.data());  // NOLINT
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0 && errno == EAGAIN && !in_flight_.empty()) {
+      if (!Reap(1)) {
+        pending_.clear();
+        break;
+      }
+      continue;
+    }
+    if (ret <= 0) {
+      PLOG(ERROR) << "Unable to submit " << num_requests << " writes";
+      write_failed_ = true;
+      write_errno_ = ret < 0 ? errno : EIO;
+      pending_.clear();
+      break;
+    }
+
+    for (long i = 0; i < ret; i++) {  // NOLINT
+      uint64_t id = pending_[i]->cb.aio_data;
+      in_flight_[id] = std::move(pending_[i]);
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + ret);
+  }
+  if (write_failed_)
+    errno = write_errno_;
+  return !write_failed_;
+}
+
+bool AioFileDescriptor::Reap(size_t min_requests) {
+  vector<struct io_event> events(queue_depth_);
+  long ret;  // NOLINT
+  do {
+    ret = IoGetEvents(ctx_, min_requests, events.size(), events.data());
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    PLOG(ERROR) << "Unable to wait for the queued writes";
+    write_failed_ = true;
+    write_errno_ = errno;
+    return false;
+  }
+
+  for (long i = 0; i < ret; i++) {  // NOLINT
+    auto it = in_flight_.find(events[i].data);
+    CHECK(it != in_flight_.end());
+    const Request& request = *it->second;
+    if (events[i].res < 0) {
+      errno = -events[i].res;
+      PLOG(ERROR) << "Failed to write " << request.data.size()
+                  << " bytes at offset " << request.cb.aio_offset;
+      if (!write_failed_) {
+        write_failed_ = true;
+        write_errno_ = -events[i].res;
+      }
+    } else if (static_cast<uint64_t>(events[i].res) < request.data.size()) {
+      // Finish short writes synchronously.
+      size_t written = events[i].res;
+      if (!utils::PWriteAll(fd_,
+                            request.data.data() + written,
+                            request.data.size() - written,
+                            request.cb.aio_offset + written) &&
+          !write_failed_) {
+        write_failed_ = true;
+        write_errno_ = errno;
+      }
+    }
+    in_flight_.erase(it);
+  }
+  return true;
+}
+
+bool AioFileDescriptor::WaitAll() {
+  Submit();
+  while (!in_flight_.empty() && Reap(in_flight_.size())) {
+  }
+  if (write_failed_)
+    errno = write_errno_;
+  return !write_failed_ && in_flight_.empty();
+}
+
+bool AioFileDescriptor::OverlapsQueuedWrite(off64_t offset,
+                                            size_t count) const {
+  auto overlaps = [offset, count](const Request& request) {
+    uint64_t start = request.cb.aio_offset;
+    uint64_t end = start + request.cb.aio_nbytes;
+    return static_cast<uint64_t>(offset) < end && start < offset + count;
+  };
+  for (const auto& request : pending_) {
+    if (overlaps(*request))
+      return true;
+  }
+  for (const auto& it : in_flight_) {
+    if (overlaps(*it.second))
+      return true;
+  }
+  return false;
+}
+
+}  // namespace chromeos_update_engine
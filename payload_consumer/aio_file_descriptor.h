@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_AIO_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_AIO_FILE_DESCRIPTOR_H_
+
+#include <linux/aio_abi.h>
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A file descriptor queuing its writes as Linux native asynchronous I/O
+// requests. Write() copies the data and returns right away; the requests are
+// submitted to the kernel in batches of up to |max_batch_size| with a single
+// io_submit() call, keeping up to |queue_depth| of them in flight. Flush(),
+// Close(), Read(), BlkIoctl(), CopyRangeFrom() and GetNativeFd() wait for all
+// the queued writes to complete, so callers only block at the points where
+// they need the data to be on disk.
+//
+// Write errors are reported asynchronously: once a queued write fails, the
+// following Write() calls fail and Flush() returns false. If the kernel
+// doesn't support AIO, this behaves like an EintrSafeFileDescriptor.
+class AioFileDescriptor : public EintrSafeFileDescriptor {
+ public:
+  static const size_t kDefaultQueueDepth;
+  static const size_t kDefaultMaxBatchSize;
+
+  AioFileDescriptor()
+      : AioFileDescriptor(kDefaultQueueDepth, kDefaultMaxBatchSize) {}
+  AioFileDescriptor(size_t queue_depth, size_t max_batch_size);
+  ~AioFileDescriptor() override;
+
+  // Interface methods.
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override;
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override;
+  int GetNativeFd() override;
+  bool Flush() override;
+  bool Close() override;
+
+  // Returns whether the writes are queued as asynchronous requests, which is
+  // only known once the file is open.
+  bool IsAsync() const { return ctx_ != 0; }
+
+ private:
+  // A queued write and the buffer holding its data.
+  struct Request {
+    struct iocb cb;
+    brillo::Blob data;
+  };
+
+  // Sets up the AIO context once the file was opened, falling back to
+  // synchronous writes on failure.
+  void SetupContext();
+
+  // Submits the requests in |pending_| to the kernel, waiting for the ones
+  // in flight to complete when the queue is full.
+  bool Submit();
+
+  // Waits for at least |min_requests| of the requests in flight to complete.
+  bool Reap(size_t min_requests);
+
+  // Submits all the queued requests and waits for them to complete. Returns
+  // whether all the writes so far succeeded.
+  bool WaitAll();
+
+  // Returns whether the range [offset, offset + count) overlaps any queued
+  // write.
+  bool OverlapsQueuedWrite(off64_t offset, size_t count) const;
+
+  const size_t queue_depth_;
+  const size_t max_batch_size_;
+
+  aio_context_t ctx_{0};
+  // The offset of the next Write() or Read() in AIO mode.
+  off64_t offset_{0};
+  // Whether any write failed, and the errno of the first failure.
+  bool write_failed_{false};
+  int write_errno_{0};
+
+  // Requests not submitted to the kernel yet, in write order.
+  std::vector<std::unique_ptr<Request>> pending_;
+  // Requests submitted to the kernel, indexed by their |aio_data|.
+  std::map<uint64_t, std::unique_ptr<Request>> in_flight_;
+  uint64_t next_request_id_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(AioFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_AIO_FILE_DESCRIPTOR_H_
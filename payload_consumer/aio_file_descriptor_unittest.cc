@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/aio_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const size_t kFileSize = 64 * 1024;
+const size_t kRandomIterations = 500;
+}  // namespace
+
+class AioFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    brillo::Blob zero_blob(kFileSize, 0);
+    EXPECT_TRUE(utils::WriteFile(
+        temp_file_.path().c_str(), zero_blob.data(), zero_blob.size()));
+    EXPECT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+  }
+
+  void TearDown() override {
+    EXPECT_TRUE(fd_->Close());
+    EXPECT_FALSE(fd_->IsOpen());
+  }
+
+  // A small queue so the tests fill it.
+  std::shared_ptr<AioFileDescriptor> fd_{new AioFileDescriptor(4, 2)};
+  test_utils::ScopedTempFile temp_file_{"AioFileDescriptor-file.XXXXXX"};
+};
+
+TEST_F(AioFileDescriptorTest, SequentialWriteTest) {
+  brillo::Blob blob_in(kFileSize);
+  for (size_t i = 0; i < blob_in.size(); i++)
+    blob_in[i] = i % 251;
+  EXPECT_EQ(0, fd_->Seek(0, SEEK_SET));
+  for (size_t offset = 0; offset < blob_in.size(); offset += 4096)
+    EXPECT_TRUE(utils::WriteAll(fd_, blob_in.data() + offset, 4096));
+  EXPECT_TRUE(fd_->Flush());
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(AioFileDescriptorTest, OverlappingWritesTest) {
+  brillo::Blob blob_in(kFileSize, 0);
+  unsigned int rand_seed = 1;
+  for (size_t idx = 0; idx < kRandomIterations; idx++) {
+    size_t start = rand_r(&rand_seed) % blob_in.size();
+    size_t size = rand_r(&rand_seed) % (blob_in.size() - start);
+    std::fill_n(&blob_in[start], size, idx % 256);
+    EXPECT_EQ(static_cast<off64_t>(start), fd_->Seek(start, SEEK_SET));
+    EXPECT_TRUE(utils::WriteAll(fd_, &blob_in[start], size));
+  }
+  EXPECT_TRUE(fd_->Flush());
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(AioFileDescriptorTest, ReadWaitsForWritesTest) {
+  brillo::Blob blob_in(4096, 0x5a);
+  EXPECT_EQ(8192, fd_->Seek(8192, SEEK_SET));
+  EXPECT_TRUE(utils::WriteAll(fd_, blob_in.data(), blob_in.size()));
+
+  brillo::Blob blob_out(blob_in.size());
+  EXPECT_EQ(8192, fd_->Seek(-4096, SEEK_CUR));
+  EXPECT_EQ(static_cast<ssize_t>(blob_out.size()),
+            fd_->Read(blob_out.data(), blob_out.size()));
+  EXPECT_EQ(blob_in, blob_out);
+  EXPECT_EQ(static_cast<off64_t>(kFileSize), fd_->Seek(0, SEEK_END));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,265 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/apply_stats.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <base/logging.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+// The values below 2^kLinearBits each have their own bucket, and every larger
+// power of two is split in 2^kSubBucketBits buckets.
+const int kLinearBits = 4;
+const int kSubBucketBits = 3;
+// The values are in microseconds, so the largest bucket ends at 2^38
+// microseconds, a bit more than three days.
+const int kMaxBits = 38;
+}  // namespace
+
+const size_t LatencyHistogram::kNumBuckets =
+    (1 << kLinearBits) + (kMaxBits - kLinearBits) * (1 << kSubBucketBits);
+
+LatencyHistogram::LatencyHistogram()
+    : buckets_(new std::atomic<uint64_t>[kNumBuckets]) {
+  for (size_t i = 0; i < kNumBuckets; i++)
+    buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Add(base::TimeDelta duration) {
+  int64_t value = duration.InMicroseconds();
+  size_t index = BucketIndex(value < 0 ? 0 : value);
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+base::TimeDelta LatencyHistogram::GetPercentile(double percentile) const {
+  // The buckets may be updated while they are read, so the total is computed
+  // from the same bucket values used to find the percentile.
+  vector<uint64_t> counts(kNumBuckets);
+  uint64_t total = 0;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0)
+    return base::TimeDelta();
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(total * percentile / 100)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return base::TimeDelta::FromMicroseconds(
+          static_cast<int64_t>(BucketMaxValue(i)));
+    }
+  }
+  return base::TimeDelta::FromMicroseconds(
+      static_cast<int64_t>(BucketMaxValue(kNumBuckets - 1)));
+}
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) {
+  if (value < (1U << kLinearBits))
+    return value;
+  int bits = 63 - __builtin_clzll(value);
+  if (bits >= kMaxBits)
+    return kNumBuckets - 1;
+  size_t sub_bucket =
+      (value >> (bits - kSubBucketBits)) & ((1 << kSubBucketBits) - 1);
+  return (1 << kLinearBits) + (bits - kLinearBits) * (1 << kSubBucketBits) +
+         sub_bucket;
+}
+
+uint64_t LatencyHistogram::BucketMaxValue(size_t index) {
+  if (index < (1U << kLinearBits))
+    return index;
+  size_t offset = index - (1 << kLinearBits);
+  int bits = kLinearBits + offset / (1 << kSubBucketBits);
+  uint64_t sub_bucket = offset % (1 << kSubBucketBits);
+  uint64_t width = uint64_t{1} << (bits - kSubBucketBits);
+  return (((uint64_t{1} << kSubBucketBits) + sub_bucket + 1) * width) - 1;
+}
+
+const size_t ApplyStats::kMaxTraceEvents = 100000;
+
+void ApplyStats::EnableTrace() {
+  base::AutoLock auto_lock(lock_);
+  trace_enabled_ = true;
+}
+
+void ApplyStats::Record(Phase phase,
+                        InstallOperation::Type type,
+                        size_t operation_num,
+                        base::TimeTicks start,
+                        uint64_t bytes) {
+  base::TimeDelta duration = base::TimeTicks::Now() - start;
+  histograms_[static_cast<size_t>(phase)].Add(duration);
+  base::AutoLock auto_lock(lock_);
+  Totals& totals = totals_[std::make_pair(phase, type)];
+  totals.duration += duration;
+  totals.bytes += bytes;
+  totals.count++;
+  has_current_operation_ = true;
+  current_type_ = type;
+  current_operation_num_ = operation_num;
+
+  if (!trace_enabled_)
+    return;
+  if (events_.size() >= kMaxTraceEvents) {
+    dropped_events_++;
+    return;
+  }
+  events_.push_back({phase,
+                     type,
+                     operation_num,
+                     start,
+                     duration,
+                     bytes,
+                     base::PlatformThread::CurrentId()});
+}
+
+void ApplyStats::RecordApplied(uint64_t data_bytes, uint64_t written_bytes) {
+  applied_bytes_.fetch_add(data_bytes, std::memory_order_relaxed);
+  written_bytes_.fetch_add(written_bytes, std::memory_order_relaxed);
+}
+
+uint64_t ApplyStats::applied_bytes() const {
+  return applied_bytes_.load(std::memory_order_relaxed);
+}
+
+uint64_t ApplyStats::written_bytes() const {
+  return written_bytes_.load(std::memory_order_relaxed);
+}
+
+bool ApplyStats::GetCurrentOperation(InstallOperation::Type* type,
+                                     size_t* operation_num) const {
+  base::AutoLock auto_lock(lock_);
+  if (!has_current_operation_)
+    return false;
+  *type = current_type_;
+  *operation_num = current_operation_num_;
+  return true;
+}
+
+ApplyStats::Totals ApplyStats::GetPhaseTotals(Phase phase) const {
+  base::AutoLock auto_lock(lock_);
+  Totals result;
+  for (const auto& entry : totals_) {
+    if (entry.first.first != phase)
+      continue;
+    result.duration += entry.second.duration;
+    result.bytes += entry.second.bytes;
+    result.count += entry.second.count;
+  }
+  return result;
+}
+
+ApplyStats::Totals ApplyStats::GetTotals(Phase phase,
+                                         InstallOperation::Type type) const {
+  base::AutoLock auto_lock(lock_);
+  const auto it = totals_.find(std::make_pair(phase, type));
+  return it == totals_.end() ? Totals() : it->second;
+}
+
+const LatencyHistogram& ApplyStats::GetPhaseHistogram(Phase phase) const {
+  return histograms_[static_cast<size_t>(phase)];
+}
+
+string ApplyStats::ToString() const {
+  base::AutoLock auto_lock(lock_);
+  string result;
+  for (const auto& entry : totals_) {
+    result += base::StringPrintf(
+        "%s %s: %" PRIu64 " operations, %s, %" PRIu64 " bytes\n",
+        PhaseName(entry.first.first),
+        InstallOperationTypeName(entry.first.second),
+        entry.second.count,
+        utils::FormatTimeDelta(entry.second.duration).c_str(),
+        entry.second.bytes);
+  }
+  return result;
+}
+
+bool ApplyStats::WriteTrace(const string& path) const {
+  base::AutoLock auto_lock(lock_);
+  TEST_AND_RETURN_FALSE(trace_enabled_);
+  // The timestamps are relative to the first recorded phase.
+  base::TimeTicks origin;
+  for (const TraceEvent& event : events_) {
+    if (origin.is_null() || event.start < origin)
+      origin = event.start;
+  }
+
+  string trace = "{\"traceEvents\":[";
+  for (size_t i = 0; i < events_.size(); i++) {
+    const TraceEvent& event = events_[i];
+    trace += base::StringPrintf(
+        "%s{\"name\":\"%s %s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64
+        ",\"dur\":%" PRId64 ",\"pid\":0,\"tid\":%" PRId64
+        ",\"args\":{\"operation\":%zu,\"bytes\":%" PRIu64 "}}",
+        i ? "," : "",
+        PhaseName(event.phase),
+        InstallOperationTypeName(event.type),
+        PhaseName(event.phase),
+        (event.start - origin).InMicroseconds(),
+        event.duration.InMicroseconds(),
+        static_cast<int64_t>(event.thread),
+        event.operation_num,
+        event.bytes);
+  }
+  trace += base::StringPrintf(
+      "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%zu}}\n",
+      dropped_events_);
+  TEST_AND_RETURN_FALSE(utils::WriteFile(path.c_str(), trace.data(),
+                                         trace.size()));
+  LOG(INFO) << "Wrote " << events_.size() << " apply trace events to " << path;
+  return true;
+}
+
+const char* ApplyStats::PhaseName(Phase phase) {
+  switch (phase) {
+    case Phase::kWaitForData:
+      return "wait_for_data";
+    case Phase::kApply:
+      return "apply";
+    case Phase::kHash:
+      return "hash";
+    case Phase::kFlush:
+      return "flush";
+    case Phase::kCheckpoint:
+      return "checkpoint";
+  }
+  return "unknown";
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,183 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_STATS_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_STATS_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A histogram of durations with log-linear buckets, in the style of the HDR
+// histograms: the values below 16 microseconds have their own bucket and
+// every larger power of two is split in 8 buckets, so a percentile is within
+// 12.5% of the recorded value for durations of up to about three days, with a
+// fixed amount of memory. Recording a value only increments an atomic
+// counter, so the histogram can be updated from any thread without a lock.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  // Adds a value of |duration| to the histogram. Negative durations are
+  // recorded as zero and the durations above the largest bucket are recorded
+  // in that bucket.
+  void Add(base::TimeDelta duration);
+
+  // Returns the number of values added.
+  uint64_t count() const;
+
+  // Returns the smallest duration such that at least |percentile| percent of
+  // the values added are not larger, up to the precision of the buckets, or
+  // zero when the histogram is empty.
+  base::TimeDelta GetPercentile(double percentile) const;
+
+ private:
+  static size_t BucketIndex(uint64_t value);
+  static uint64_t BucketMaxValue(size_t index);
+
+  static const size_t kNumBuckets;
+
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<uint64_t> count_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+// Collects the time spent and the bytes processed in each phase of applying
+// the install operations of a payload, per operation type. It can also keep
+// a trace of every recorded phase, written out in the Chrome trace event
+// format viewed by chrome://tracing and Perfetto. All the methods are thread
+// safe, so the operations applied by the pipeline workers can be recorded.
+// The distribution of the duration of each phase is also kept in a
+// LatencyHistogram, to report the percentiles of the per operation times.
+class ApplyStats {
+ public:
+  enum class Phase {
+    // Waiting for the operation data to be downloaded. The replace operations
+    // streamed to disk as their data arrives are also applied in this phase.
+    kWaitForData,
+    // Applying the operation: decompressing or patching its data and writing
+    // the result, which are done in a single streamed pass.
+    kApply,
+    // Checking the hash of the operation data.
+    kHash,
+    // Flushing the target partition writes to disk.
+    kFlush,
+    // Persisting the update progress.
+    kCheckpoint,
+  };
+
+  // The number of values of Phase.
+  static const size_t kNumPhases = 5;
+
+  // The maximum number of trace events recorded, to bound the memory used by
+  // payloads with many operations. The later events are dropped.
+  static const size_t kMaxTraceEvents;
+
+  struct Totals {
+    base::TimeDelta duration;
+    uint64_t bytes{0};
+    uint64_t count{0};
+  };
+
+  ApplyStats() = default;
+
+  // Starts recording a trace event for each Record() call.
+  void EnableTrace();
+
+  // Records that the operation number |operation_num|, of type |type|, spent
+  // the time from |start| until now in |phase|, processing |bytes| bytes.
+  void Record(Phase phase,
+              InstallOperation::Type type,
+              size_t operation_num,
+              base::TimeTicks start,
+              uint64_t bytes);
+
+  // Records that an operation was applied, consuming |data_bytes| bytes of
+  // payload data and writing |written_bytes| bytes to the target partition.
+  void RecordApplied(uint64_t data_bytes, uint64_t written_bytes);
+
+  // The sums of the bytes passed to RecordApplied().
+  uint64_t applied_bytes() const;
+  uint64_t written_bytes() const;
+
+  // Sets |type| and |operation_num| to the last operation recorded in any
+  // phase, which is the one being applied while the update is in progress.
+  // Returns false if nothing was recorded yet.
+  bool GetCurrentOperation(InstallOperation::Type* type,
+                           size_t* operation_num) const;
+
+  // Returns the totals of |phase| for all the operation types.
+  Totals GetPhaseTotals(Phase phase) const;
+
+  // Returns the totals of |phase| for the operations of type |type|.
+  Totals GetTotals(Phase phase, InstallOperation::Type type) const;
+
+  // Returns the distribution of the durations recorded for |phase|.
+  const LatencyHistogram& GetPhaseHistogram(Phase phase) const;
+
+  // Returns a human readable summary of the totals, one line per phase and
+  // operation type.
+  std::string ToString() const;
+
+  // Writes the trace events, if enabled, to the file |path| as JSON. Returns
+  // whether it succeeded.
+  bool WriteTrace(const std::string& path) const;
+
+  static const char* PhaseName(Phase phase);
+
+ private:
+  struct TraceEvent {
+    Phase phase;
+    InstallOperation::Type type;
+    size_t operation_num;
+    base::TimeTicks start;
+    base::TimeDelta duration;
+    uint64_t bytes;
+    base::PlatformThreadId thread;
+  };
+
+  LatencyHistogram histograms_[kNumPhases];
+  std::atomic<uint64_t> applied_bytes_{0};
+  std::atomic<uint64_t> written_bytes_{0};
+
+  mutable base::Lock lock_;
+  std::map<std::pair<Phase, InstallOperation::Type>, Totals> totals_;
+  bool has_current_operation_{false};
+  InstallOperation::Type current_type_{InstallOperation::REPLACE};
+  size_t current_operation_num_{0};
+  bool trace_enabled_{false};
+  std::vector<TraceEvent> events_;
+  size_t dropped_events_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ApplyStats);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_STATS_H_
@@ -0,0 +1,165 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/apply_stats.h"
+
+#include <string>
+
+#include <base/files/file_util.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class ApplyStatsTest : public ::testing::Test {
+ protected:
+  // Records |phase| of an operation of |type| which started |duration| ago.
+  void Record(ApplyStats::Phase phase,
+              InstallOperation::Type type,
+              base::TimeDelta duration,
+              uint64_t bytes) {
+    stats_.Record(phase, type, 0, base::TimeTicks::Now() - duration, bytes);
+  }
+
+  ApplyStats stats_;
+};
+
+TEST_F(ApplyStatsTest, TotalsTest) {
+  Record(ApplyStats::Phase::kApply,
+         InstallOperation::REPLACE,
+         base::TimeDelta::FromSeconds(1),
+         100);
+  Record(ApplyStats::Phase::kApply,
+         InstallOperation::REPLACE,
+         base::TimeDelta::FromSeconds(2),
+         50);
+  Record(ApplyStats::Phase::kApply,
+         InstallOperation::SOURCE_COPY,
+         base::TimeDelta::FromSeconds(4),
+         0);
+  Record(ApplyStats::Phase::kHash,
+         InstallOperation::REPLACE,
+         base::TimeDelta::FromSeconds(8),
+         150);
+
+  ApplyStats::Totals totals = stats_.GetTotals(ApplyStats::Phase::kApply,
+                                               InstallOperation::REPLACE);
+  EXPECT_EQ(2U, totals.count);
+  EXPECT_EQ(150U, totals.bytes);
+  EXPECT_LE(base::TimeDelta::FromSeconds(3), totals.duration);
+  EXPECT_GT(base::TimeDelta::FromSeconds(4), totals.duration);
+
+  totals = stats_.GetPhaseTotals(ApplyStats::Phase::kApply);
+  EXPECT_EQ(3U, totals.count);
+  EXPECT_LE(base::TimeDelta::FromSeconds(7), totals.duration);
+  EXPECT_GT(base::TimeDelta::FromSeconds(8), totals.duration);
+
+  totals = stats_.GetPhaseTotals(ApplyStats::Phase::kFlush);
+  EXPECT_EQ(0U, totals.count);
+  EXPECT_EQ(base::TimeDelta(), totals.duration);
+  EXPECT_FALSE(stats_.ToString().empty());
+}
+
+TEST_F(ApplyStatsTest, ProgressTest) {
+  InstallOperation::Type type;
+  size_t operation_num;
+  EXPECT_FALSE(stats_.GetCurrentOperation(&type, &operation_num));
+
+  stats_.Record(ApplyStats::Phase::kWaitForData,
+                InstallOperation::SOURCE_BSDIFF,
+                7,
+                base::TimeTicks::Now(),
+                100);
+  stats_.RecordApplied(100, 4096);
+  stats_.RecordApplied(50, 8192);
+  EXPECT_EQ(150U, stats_.applied_bytes());
+  EXPECT_EQ(12288U, stats_.written_bytes());
+  EXPECT_TRUE(stats_.GetCurrentOperation(&type, &operation_num));
+  EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, type);
+  EXPECT_EQ(7U, operation_num);
+}
+
+TEST_F(ApplyStatsTest, WriteTraceTest) {
+  test_utils::ScopedTempFile trace_file("ApplyStatsTest-trace.XXXXXX");
+  Record(ApplyStats::Phase::kApply,
+         InstallOperation::REPLACE,
+         base::TimeDelta::FromSeconds(1),
+         100);
+  // The trace is only written when enabled.
+  EXPECT_FALSE(stats_.WriteTrace(trace_file.path()));
+
+  stats_.EnableTrace();
+  Record(ApplyStats::Phase::kCheckpoint,
+         InstallOperation::ZERO,
+         base::TimeDelta::FromMilliseconds(5),
+         0);
+  EXPECT_TRUE(stats_.WriteTrace(trace_file.path()));
+  string trace;
+  EXPECT_TRUE(base::ReadFileToString(base::FilePath(trace_file.path()), &trace));
+  EXPECT_EQ(0U, trace.find("{\"traceEvents\":[{\"name\":\"checkpoint ZERO\""));
+  // Only the event recorded with the trace enabled is in the trace.
+  EXPECT_EQ(string::npos, trace.find("REPLACE"));
+  EXPECT_NE(string::npos, trace.find("\"dropped_events\":0"));
+}
+
+TEST_F(ApplyStatsTest, PhaseHistogramTest) {
+  for (int i = 0; i < 99; i++) {
+    Record(ApplyStats::Phase::kFlush,
+           InstallOperation::REPLACE,
+           base::TimeDelta::FromMilliseconds(1),
+           0);
+  }
+  Record(ApplyStats::Phase::kFlush,
+         InstallOperation::REPLACE,
+         base::TimeDelta::FromSeconds(2),
+         0);
+
+  const LatencyHistogram& histogram =
+      stats_.GetPhaseHistogram(ApplyStats::Phase::kFlush);
+  EXPECT_EQ(100U, histogram.count());
+  // The percentiles are within the 12.5% precision of the buckets, which is
+  // enough to tell the single slow flush apart.
+  EXPECT_LE(base::TimeDelta::FromMilliseconds(1), histogram.GetPercentile(50));
+  EXPECT_GT(base::TimeDelta::FromMicroseconds(1125),
+            histogram.GetPercentile(99));
+  EXPECT_LE(base::TimeDelta::FromSeconds(2), histogram.GetPercentile(100));
+  EXPECT_GT(base::TimeDelta::FromMilliseconds(2250),
+            histogram.GetPercentile(100));
+
+  EXPECT_EQ(0U, stats_.GetPhaseHistogram(ApplyStats::Phase::kHash).count());
+  EXPECT_EQ(base::TimeDelta(),
+            stats_.GetPhaseHistogram(ApplyStats::Phase::kHash)
+                .GetPercentile(50));
+}
+
+TEST_F(ApplyStatsTest, LatencyHistogramBucketsTest) {
+  LatencyHistogram histogram;
+  // The small values are exact.
+  histogram.Add(base::TimeDelta::FromMicroseconds(7));
+  EXPECT_EQ(base::TimeDelta::FromMicroseconds(7), histogram.GetPercentile(50));
+  // Negative and very large values are clamped to the first and last buckets.
+  histogram.Add(base::TimeDelta::FromMicroseconds(-5));
+  histogram.Add(base::TimeDelta::FromDays(30));
+  EXPECT_EQ(3U, histogram.count());
+  EXPECT_EQ(base::TimeDelta(), histogram.GetPercentile(0));
+  EXPECT_LT(base::TimeDelta::FromDays(3), histogram.GetPercentile(100));
+  EXPECT_GT(base::TimeDelta::FromDays(4), histogram.GetPercentile(100));
+}
+
+}  // namespace chromeos_update_engine
@@ -16,16 +16,21 @@
 
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 
-using google::protobuf::RepeatedPtrField;
-
 namespace chromeos_update_engine {
 
 namespace {
 const brillo::Blob::size_type kOutputBufferLength = 16 * 1024;
 }
 
+BzipExtentWriter::~BzipExtentWriter() {
+  // Release the buffers of a stream that didn't end, which may belong to the
+  // pool.
+  if (stream_.state)
+    BZ2_bzDecompressEnd(&stream_);
+}
+
 bool BzipExtentWriter::Init(FileDescriptorPtr fd,
-                            const RepeatedPtrField<Extent>& extents,
+                            ExtentSpan extents,
                             uint32_t block_size) {
   // Init bzip2 stream
   int rc = BZ2_bzDecompressInit(&stream_,
@@ -24,6 +24,7 @@
 #include <brillo/secure_blob.h>
 
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/decoder_pool.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 
 // BzipExtentWriter is a concrete ExtentWriter subclass that bzip-decompresses
@@ -34,14 +35,22 @@ namespace chromeos_update_engine {
 
 class BzipExtentWriter : public ExtentWriter {
  public:
-  explicit BzipExtentWriter(std::unique_ptr<ExtentWriter> next)
+  // The buffers of the stream are allocated from the |pool|, if not null,
+  // which must outlive the writer.
+  explicit BzipExtentWriter(std::unique_ptr<ExtentWriter> next,
+                            DecoderPool* pool = nullptr)
       : next_(std::move(next)) {
     memset(&stream_, 0, sizeof(stream_));
+    if (pool) {
+      stream_.bzalloc = &DecoderPool::BzipAlloc;
+      stream_.bzfree = &DecoderPool::BzipFree;
+      stream_.opaque = pool;
+    }
   }
-  ~BzipExtentWriter() override = default;
+  ~BzipExtentWriter() override;
 
   bool Init(FileDescriptorPtr fd,
-            const google::protobuf::RepeatedPtrField<Extent>& extents,
+            ExtentSpan extents,
             uint32_t block_size) override;
   bool Write(const void* bytes, size_t count) override;
   bool EndImpl() override;
@@ -69,8 +69,7 @@ TEST_F(BzipExtentWriterTest, SimpleTest) {
   };
 
   BzipExtentWriter bzip_writer(std::make_unique<DirectExtentWriter>());
-  EXPECT_TRUE(
-      bzip_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(bzip_writer.Init(fd_, extents, kBlockSize));
   EXPECT_TRUE(bzip_writer.Write(test, sizeof(test)));
   EXPECT_TRUE(bzip_writer.End());
 
@@ -80,6 +79,36 @@ TEST_F(BzipExtentWriterTest, SimpleTest) {
   EXPECT_EQ(string(buf.begin(), buf.end()), string(test_uncompressed));
 }
 
+TEST_F(BzipExtentWriterTest, PooledStreamsTest) {
+  vector<Extent> extents = {ExtentForRange(0, 1)};
+  // 'echo test | bzip2 | hexdump' yields:
+  static const uint8_t test[] = {
+    0x42, 0x5a, 0x68, 0x39, 0x31, 0x41, 0x59, 0x26, 0x53, 0x59, 0xcc, 0xc3,
+    0x71, 0xd4, 0x00, 0x00, 0x02, 0x41, 0x80, 0x00, 0x10, 0x02, 0x00, 0x0c,
+    0x00, 0x20, 0x00, 0x21, 0x9a, 0x68, 0x33, 0x4d, 0x19, 0x97, 0x8b, 0xb9,
+    0x22, 0x9c, 0x28, 0x48, 0x66, 0x61, 0xb8, 0xea, 0x00,
+  };
+
+  // The second stream decodes with the buffers released by the first one,
+  // and the one abandoned before its end returns them too.
+  DecoderPool pool;
+  for (int i = 0; i < 3; i++) {
+    BzipExtentWriter bzip_writer(std::make_unique<DirectExtentWriter>(),
+                                 &pool);
+    EXPECT_TRUE(bzip_writer.Init(fd_, extents, kBlockSize));
+    if (i == 2) {
+      EXPECT_TRUE(bzip_writer.Write(test, sizeof(test) / 2));
+      break;
+    }
+    EXPECT_TRUE(bzip_writer.Write(test, sizeof(test)));
+    EXPECT_TRUE(bzip_writer.End());
+  }
+
+  brillo::Blob buf;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &buf));
+  EXPECT_EQ("test\n", string(buf.begin(), buf.end()));
+}
+
 TEST_F(BzipExtentWriterTest, ChunkedTest) {
   // Generated with:
   //   yes "ABC" | head -c 819200 | bzip2 -9 |
@@ -104,8 +133,7 @@ TEST_F(BzipExtentWriterTest, ChunkedTest) {
       ExtentForRange(0, (kDecompressedLength + kBlockSize - 1) / kBlockSize)};
 
   BzipExtentWriter bzip_writer(std::make_unique<DirectExtentWriter>());
-  EXPECT_TRUE(
-      bzip_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(bzip_writer.Init(fd_, extents, kBlockSize));
 
   brillo::Blob original_compressed_data = compressed_data;
   for (brillo::Blob::size_type i = 0; i < compressed_data.size();
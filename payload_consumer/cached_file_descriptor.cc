@@ -16,6 +16,7 @@
 
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
 
+#include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -32,36 +33,56 @@ off64_t CachedFileDescriptor::Seek(off64_t offset, int whence) {
   // underlying file descriptor each time and it may not be a very good idea.
   CHECK(whence == SEEK_SET || whence == SEEK_CUR);
   off64_t next_offset = whence == SEEK_SET ? offset : offset_ + offset;
-
-  if (next_offset != offset_) {
-    // We sought somewhere other than what we are now. So we have to flush and
-    // move to the new offset.
-    if (!FlushCache()) {
-      return -1;
-    }
-    // Then we have to seek there.
-    if (fd_->Seek(next_offset, SEEK_SET) < 0) {
-      return -1;
-    }
-    offset_ = next_offset;
+  if (next_offset < 0) {
+    errno = EINVAL;
+    return -1;
   }
+
+  // The cache is only flushed when seeking somewhere else if it can't hold
+  // another run. The underlying file descriptor is moved when flushing it.
+  if (next_offset != offset_ && runs_.size() >= max_runs_ && !FlushCache())
+    return -1;
+  offset_ = next_offset;
   return offset_;
 }
 
+ssize_t CachedFileDescriptor::Read(void* buf, size_t count) {
+  if (!FlushCache() || fd_->Seek(offset_, SEEK_SET) < 0)
+    return -1;
+  ssize_t bytes_read = fd_->Read(buf, count);
+  if (bytes_read > 0)
+    offset_ += bytes_read;
+  return bytes_read;
+}
+
 ssize_t CachedFileDescriptor::Write(const void* buf, size_t count) {
   auto bytes = static_cast<const uint8_t*>(buf);
   size_t total_bytes_wrote = 0;
+  uint64_t flushes = stats_.flushes;
+  // The bytes written again replace the cached ones once these are flushed.
+  if (IsCached(offset_, count) && !FlushCache())
+    return -1;
   while (total_bytes_wrote < count) {
+    off64_t offset = offset_ + total_bytes_wrote;
+    bool extends_last_run =
+        last_run_ != runs_.end() &&
+        last_run_->first + static_cast<off64_t>(last_run_->second.length) ==
+            offset;
+    if (!extends_last_run && runs_.size() >= max_runs_ && !FlushCache())
+      return -1;
     auto bytes_to_cache =
-        std::min(count - total_bytes_wrote, cache_.size() - bytes_cached_);
+        std::min(count - total_bytes_wrote, cache_size_ - bytes_cached_);
     if (bytes_to_cache > 0) {  // Which means |cache_| is still have some space.
+      if (!extends_last_run)
+        last_run_ = runs_.emplace(offset, Run{bytes_cached_, 0}).first;
       memcpy(cache_.data() + bytes_cached_,
              bytes + total_bytes_wrote,
              bytes_to_cache);
       total_bytes_wrote += bytes_to_cache;
       bytes_cached_ += bytes_to_cache;
+      last_run_->second.length += bytes_to_cache;
     }
-    if (bytes_cached_ == cache_.size()) {
+    if (bytes_cached_ == cache_size_) {
       // Cache is full; write it to the |fd_| as long as you can.
       if (!FlushCache()) {
         return -1;
@@ -69,6 +90,10 @@ ssize_t CachedFileDescriptor::Write(const void* buf, size_t count) {
     }
   }
   offset_ += total_bytes_wrote;
+  stats_.writes++;
+  stats_.bytes_written += total_bytes_wrote;
+  if (stats_.flushes == flushes)
+    stats_.cache_hits++;
   return total_bytes_wrote;
 }
 
@@ -78,21 +103,76 @@ bool CachedFileDescriptor::Flush() {
 
 bool CachedFileDescriptor::Close() {
   offset_ = 0;
-  return FlushCache() && fd_->Close();
+  if (!FlushCache())
+    return false;
+  if (stats_.writes > 0) {
+    LOG(INFO) << "Write cache of " << cache_size_ << " bytes: "
+              << stats_.writes << " writes of " << stats_.bytes_written
+              << " bytes, " << stats_.cache_hits << " cache hits, "
+              << stats_.flushes << " flushes in " << stats_.flushed_runs
+              << " writes.";
+  }
+  return fd_->Close();
+}
+
+bool CachedFileDescriptor::SetCacheSize(size_t cache_size) {
+  if (cache_size == cache_size_)
+    return true;
+  if (cache_size == 0 || !FlushCache() || !cache_.Reallocate(cache_size))
+    return false;
+  cache_size_ = cache_size;
+  return true;
 }
 
 bool CachedFileDescriptor::FlushCache() {
-  size_t begin = 0;
-  while (begin < bytes_cached_) {
-    auto bytes_wrote = fd_->Write(cache_.data() + begin, bytes_cached_ - begin);
-    if (bytes_wrote < 0) {
-      PLOG(ERROR) << "Failed to flush cached data!";
+  // The runs are written in the order of their offset, and the ones that are
+  // also contiguous in |cache_| are merged in a single write.
+  auto run = runs_.begin();
+  while (run != runs_.end()) {
+    const off64_t offset = run->first;
+    const size_t position = run->second.position;
+    size_t length = run->second.length;
+    for (run++; run != runs_.end() &&
+                run->first == offset + static_cast<off64_t>(length) &&
+                run->second.position == position + length;
+         run++) {
+      length += run->second.length;
+    }
+    if (fd_->Seek(offset, SEEK_SET) < 0) {
+      PLOG(ERROR) << "Failed to seek to the cached data!";
       return false;
     }
-    begin += bytes_wrote;
+    size_t begin = 0;
+    while (begin < length) {
+      auto bytes_wrote =
+          fd_->Write(cache_.data() + position + begin, length - begin);
+      if (bytes_wrote < 0) {
+        PLOG(ERROR) << "Failed to flush cached data!";
+        return false;
+      }
+      begin += bytes_wrote;
+    }
+    stats_.flushed_runs++;
   }
+  if (bytes_cached_ > 0)
+    stats_.flushes++;
+  runs_.clear();
+  last_run_ = runs_.end();
   bytes_cached_ = 0;
   return true;
 }
 
+bool CachedFileDescriptor::IsCached(off64_t offset, size_t count) const {
+  if (runs_.empty() || count == 0)
+    return false;
+  const off64_t end = offset + static_cast<off64_t>(count);
+  // The first run starting at or past |end| and the ones after it don't
+  // overlap, so only the one before it is checked.
+  auto run = runs_.lower_bound(end);
+  if (run == runs_.begin())
+    return false;
+  run--;
+  return run->first + static_cast<off64_t>(run->second.length) > offset;
+}
+
 }  // namespace chromeos_update_engine
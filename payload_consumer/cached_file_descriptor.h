@@ -20,19 +20,46 @@
 #include <errno.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <vector>
 
-#include <brillo/secure_blob.h>
-
+#include "update_engine/payload_consumer/direct_file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 
 namespace chromeos_update_engine {
 
+// A FileDescriptor caching the writes to |fd| in a buffer of |cache_size|
+// bytes. The buffer holds up to |max_runs| runs of contiguous bytes at once,
+// one by default, so the fragmented writes of the operations to nearby
+// offsets are written together, sorted by offset and merged, when it is full
+// or flushed. Reading or changing the file any other way flushes it first.
 class CachedFileDescriptor : public FileDescriptor {
  public:
-  CachedFileDescriptor(FileDescriptorPtr fd, size_t cache_size) : fd_(fd) {
-    cache_.resize(cache_size);
+  // Counters of how well the cache coalesces the writes.
+  struct Stats {
+    // The number of Write() calls and the bytes they were passed.
+    uint64_t writes{0};
+    uint64_t bytes_written{0};
+    // The number of Write() calls fully absorbed by the cache, without
+    // flushing it.
+    uint64_t cache_hits{0};
+    // The number of times a non-empty cache was written to the underlying
+    // file descriptor.
+    uint64_t flushes{0};
+    // The number of writes to the underlying file descriptor the flushes were
+    // split in, one per run of contiguous bytes.
+    uint64_t flushed_runs{0};
+  };
+
+  CachedFileDescriptor(FileDescriptorPtr fd,
+                       size_t cache_size,
+                       size_t max_runs = 1)
+      : fd_(fd), max_runs_(std::max(max_runs, static_cast<size_t>(1))) {
+    bool allocated = cache_.Reserve(cache_size);
+    CHECK(allocated) << "Unable to allocate the cache";
+    cache_size_ = cache_size;
   }
   ~CachedFileDescriptor() override = default;
 
@@ -42,9 +69,7 @@ class CachedFileDescriptor : public FileDescriptor {
   bool Open(const char* path, int flags) override {
     return fd_->Open(path, flags);
   }
-  ssize_t Read(void* buf, size_t count) override {
-    return fd_->Read(buf, count);
-  }
+  ssize_t Read(void* buf, size_t count) override;
   ssize_t Write(const void* buf, size_t count) override;
   off64_t Seek(off64_t offset, int whence) override;
   uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
@@ -52,21 +77,62 @@ class CachedFileDescriptor : public FileDescriptor {
                 uint64_t start,
                 uint64_t length,
                 int* result) override {
-    return fd_->BlkIoctl(request, start, length, result);
+    return FlushCache() && fd_->BlkIoctl(request, start, length, result);
+  }
+  bool Readahead(uint64_t offset, uint64_t length) override {
+    return fd_->Readahead(offset, length);
+  }
+  bool DropCache(uint64_t offset, uint64_t length) override {
+    return fd_->DropCache(offset, length);
   }
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override {
+    return FlushCache() &&
+           fd_->CopyRangeFrom(source, source_offset, offset, length);
+  }
+  // The cached writes aren't in the underlying file yet.
+  int GetNativeFd() override { return -1; }
   bool Flush() override;
   bool Close() override;
   bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
   bool IsOpen() override { return fd_->IsOpen(); }
 
+  // Writes the cached bytes and changes the size of the cache to
+  // |cache_size| bytes, reallocating it so a smaller cache also uses less
+  // memory. Returns false, keeping the previous cache, on failure.
+  bool SetCacheSize(size_t cache_size);
+
+  size_t cache_size() const { return cache_size_; }
+  size_t max_runs() const { return max_runs_; }
+  const Stats& stats() const { return stats_; }
+
  private:
+  // A run of contiguous bytes cached at |position| of |cache_|.
+  struct Run {
+    size_t position;
+    size_t length;
+  };
+
   // Internal flush without the need to call |fd_->Flush()|.
   bool FlushCache();
 
+  // Returns whether the |count| bytes at |offset| overlap the cached runs.
+  bool IsCached(off64_t offset, size_t count) const;
+
   FileDescriptorPtr fd_;
-  brillo::Blob cache_;
+  // Aligned so flushing it to a DirectFileDescriptor doesn't need a copy.
+  AlignedBuffer cache_{DirectFileDescriptor::kAlignment};
+  size_t cache_size_{0};
   size_t bytes_cached_{0};
   off64_t offset_{0};
+  // The cached runs, by file offset. The last one written to is
+  // |last_run_|, at the end of |cache_|, so writing past its end extends it.
+  const size_t max_runs_;
+  std::map<off64_t, Run> runs_;
+  std::map<off64_t, Run>::iterator last_run_{runs_.end()};
+  Stats stats_;
 
   DISALLOW_COPY_AND_ASSIGN(CachedFileDescriptor);
 };
@@ -42,8 +42,8 @@ const size_t kRandomIterations = 1000;
 
 class CachedFileDescriptorTest : public ::testing::Test {
  public:
-  void Open() {
-    cfd_.reset(new CachedFileDescriptor(fd_, kCacheSize));
+  void Open(size_t max_runs = 1) {
+    cfd_.reset(new CachedFileDescriptor(fd_, kCacheSize, max_runs));
     EXPECT_TRUE(cfd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
   }
 
@@ -201,4 +201,89 @@ TEST_F(CachedFileDescriptorTest, SeekAfterWriteTest) {
   EXPECT_EQ(blob_in, blob_out);
 }
 
+TEST_F(CachedFileDescriptorTest, StatsTest) {
+  auto cfd = static_cast<CachedFileDescriptor*>(cfd_.get());
+  EXPECT_EQ(kCacheSize, cfd->cache_size());
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  brillo::Blob blob_in(kFileSize, value_);
+  // Two writes filling the cache exactly once.
+  Write(blob_in.data(), kCacheSize / 2);
+  Write(blob_in.data() + kCacheSize / 2, kCacheSize / 2);
+  // Seeking elsewhere flushes nothing since the cache is empty.
+  off64_t seek = 2 * kCacheSize;
+  EXPECT_EQ(cfd_->Seek(seek, SEEK_SET), seek);
+  Write(blob_in.data(), 1);
+  EXPECT_TRUE(cfd_->Flush());
+
+  const CachedFileDescriptor::Stats& stats = cfd->stats();
+  EXPECT_EQ(3U, stats.writes);
+  EXPECT_EQ(kCacheSize + 1, stats.bytes_written);
+  EXPECT_EQ(2U, stats.cache_hits);
+  EXPECT_EQ(2U, stats.flushes);
+}
+
+TEST_F(CachedFileDescriptorTest, SetCacheSizeTest) {
+  auto cfd = static_cast<CachedFileDescriptor*>(cfd_.get());
+  brillo::Blob blob_in(kFileSize, 0);
+  std::fill_n(blob_in.begin(), kCacheSize / 2, value_);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  Write(blob_in.data(), kCacheSize / 2);
+
+  // The cached bytes are written before resizing the cache.
+  EXPECT_TRUE(cfd->SetCacheSize(kCacheSize / 4));
+  EXPECT_EQ(kCacheSize / 4, cfd->cache_size());
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+  EXPECT_FALSE(cfd->SetCacheSize(0));
+  EXPECT_EQ(kCacheSize / 4, cfd->cache_size());
+
+  // The smaller cache is flushed when full.
+  std::fill_n(blob_in.begin() + kCacheSize / 2, kCacheSize / 4, value_ + 1);
+  Write(blob_in.data() + kCacheSize / 2, kCacheSize / 4);
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, ReorderedWritesTest) {
+  Close();
+  Open(4);
+  auto cfd = static_cast<CachedFileDescriptor*>(cfd_.get());
+  brillo::Blob blob_in(kFileSize, 0);
+  std::fill_n(&blob_in[20], 60, value_);
+  // Seeking elsewhere starts another run, without flushing the cache.
+  EXPECT_EQ(cfd_->Seek(60, SEEK_SET), 60);
+  Write(&blob_in[60], 20);
+  EXPECT_EQ(cfd_->Seek(20, SEEK_SET), 20);
+  Write(&blob_in[20], 20);
+  EXPECT_EQ(cfd_->Seek(40, SEEK_SET), 40);
+  Write(&blob_in[40], 20);
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(brillo::Blob(kFileSize, 0), blob_out);
+
+  // The run written after the first one is written first, merged with the
+  // bytes that extended it.
+  EXPECT_TRUE(cfd_->Flush());
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+  EXPECT_EQ(1U, cfd->stats().flushes);
+  EXPECT_EQ(2U, cfd->stats().flushed_runs);
+
+  // Writing the cached bytes again replaces them.
+  std::fill_n(&blob_in[10], 10, value_ + 1);
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  Write(&blob_in[20], 10);
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  Write(&blob_in[10], 10);
+  // Reading flushes the cache.
+  brillo::Blob read_out(10);
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  EXPECT_EQ(10, cfd_->Read(read_out.data(), read_out.size()));
+  EXPECT_EQ(brillo::Blob(10, value_ + 1), read_out);
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,146 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/decoder_pool.h"
+
+#include <stdlib.h>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+const size_t DecoderPool::kBzipBuffersPerStream = 2;
+
+DecoderPool::~DecoderPool() {
+  for (xz_dec* decoder : xz_decoders_)
+    xz_dec_end(decoder);
+  for (ZSTD_DCtx* context : zstd_contexts_)
+    ZSTD_freeDCtx(context);
+  for (const auto& size_and_buffer : bzip_buffers_)
+    free(size_and_buffer.second);
+  // The writers must release their streams before the pool is destroyed.
+  DCHECK(bzip_buffers_in_use_.empty());
+}
+
+size_t DecoderPool::max_idle() const {
+  base::AutoLock auto_lock(lock_);
+  return max_idle_;
+}
+
+void DecoderPool::set_max_idle(size_t max_idle) {
+  base::AutoLock auto_lock(lock_);
+  max_idle_ = max_idle;
+  while (xz_decoders_.size() > max_idle_) {
+    xz_dec_end(xz_decoders_.back());
+    xz_decoders_.pop_back();
+  }
+  while (zstd_contexts_.size() > max_idle_) {
+    ZSTD_freeDCtx(zstd_contexts_.back());
+    zstd_contexts_.pop_back();
+  }
+  while (bzip_buffers_.size() > max_idle_ * kBzipBuffersPerStream) {
+    // Drop the smallest buffers first, the large ones cost more to allocate.
+    free(bzip_buffers_.begin()->second);
+    bzip_buffers_.erase(bzip_buffers_.begin());
+  }
+}
+
+xz_dec* DecoderPool::TakeXzDecoder() {
+  base::AutoLock auto_lock(lock_);
+  if (xz_decoders_.empty())
+    return nullptr;
+  xz_dec* decoder = xz_decoders_.back();
+  xz_decoders_.pop_back();
+  return decoder;
+}
+
+void DecoderPool::PutXzDecoder(xz_dec* decoder) {
+  if (!decoder)
+    return;
+  // Resetting keeps the dictionary allocated for the previous streams.
+  xz_dec_reset(decoder);
+  {
+    base::AutoLock auto_lock(lock_);
+    if (xz_decoders_.size() < max_idle_) {
+      xz_decoders_.push_back(decoder);
+      return;
+    }
+  }
+  xz_dec_end(decoder);
+}
+
+ZSTD_DCtx* DecoderPool::TakeZstdContext() {
+  base::AutoLock auto_lock(lock_);
+  if (zstd_contexts_.empty())
+    return nullptr;
+  ZSTD_DCtx* context = zstd_contexts_.back();
+  zstd_contexts_.pop_back();
+  return context;
+}
+
+void DecoderPool::PutZstdContext(ZSTD_DCtx* context) {
+  if (!context)
+    return;
+  // The buffers of the context are kept by the reset.
+  if (!ZSTD_isError(
+          ZSTD_DCtx_reset(context, ZSTD_reset_session_and_parameters))) {
+    base::AutoLock auto_lock(lock_);
+    if (zstd_contexts_.size() < max_idle_) {
+      zstd_contexts_.push_back(context);
+      return;
+    }
+  }
+  ZSTD_freeDCtx(context);
+}
+
+// static
+void* DecoderPool::BzipAlloc(void* opaque, int items, int size) {
+  DecoderPool* pool = static_cast<DecoderPool*>(opaque);
+  size_t length = static_cast<size_t>(items) * size;
+  base::AutoLock auto_lock(pool->lock_);
+  void* buffer;
+  auto it = pool->bzip_buffers_.find(length);
+  if (it != pool->bzip_buffers_.end()) {
+    buffer = it->second;
+    pool->bzip_buffers_.erase(it);
+  } else {
+    buffer = malloc(length);
+    if (!buffer)
+      return nullptr;
+  }
+  pool->bzip_buffers_in_use_[buffer] = length;
+  return buffer;
+}
+
+// static
+void DecoderPool::BzipFree(void* opaque, void* address) {
+  if (!address)
+    return;
+  DecoderPool* pool = static_cast<DecoderPool*>(opaque);
+  base::AutoLock auto_lock(pool->lock_);
+  auto it = pool->bzip_buffers_in_use_.find(address);
+  CHECK(it != pool->bzip_buffers_in_use_.end());
+  size_t length = it->second;
+  pool->bzip_buffers_in_use_.erase(it);
+  if (pool->bzip_buffers_.size() >=
+      pool->max_idle_ * kBzipBuffersPerStream) {
+    free(address);
+    return;
+  }
+  pool->bzip_buffers_.emplace(length, address);
+}
+
+}  // namespace chromeos_update_engine
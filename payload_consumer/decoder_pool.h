@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_DECODER_POOL_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_DECODER_POOL_H_
+
+#include <xz.h>
+#include <zstd.h>
+
+#include <map>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+
+namespace chromeos_update_engine {
+
+// Keeps the decompression states released by the REPLACE_BZ, REPLACE_XZ and
+// REPLACE_ZSTD operations, so the next operations reuse them instead of
+// allocating and initializing new ones. The xz decoders grow their dictionary
+// to the largest one used by the payload and keep it when reset, and the zstd
+// contexts keep their window buffers. bzip2 can't reset a stream, so its
+// allocations are recycled through the allocator hooks of bz_stream instead.
+// At most max_idle() states of each kind are kept. All the methods are thread
+// safe, so the pipeline workers share a single pool.
+class DecoderPool {
+ public:
+  DecoderPool() = default;
+  ~DecoderPool();
+
+  // The number of idle states of each kind kept, which should be the number
+  // of operations decoded concurrently. Defaults to 1.
+  size_t max_idle() const;
+  void set_max_idle(size_t max_idle);
+
+  // Returns an idle xz decoder, ready to decode a new stream, or nullptr if
+  // there is none.
+  xz_dec* TakeXzDecoder();
+  // Keeps the |decoder| returned by TakeXzDecoder() or xz_dec_init() for a
+  // later stream, or frees it if enough decoders are idle.
+  void PutXzDecoder(xz_dec* decoder);
+
+  // Same as TakeXzDecoder() and PutXzDecoder() for the zstd contexts. The
+  // contexts are returned without their parameters or dictionary.
+  ZSTD_DCtx* TakeZstdContext();
+  void PutZstdContext(ZSTD_DCtx* context);
+
+  // The allocator hooks of a bz_stream, whose |opaque| is the pool.
+  static void* BzipAlloc(void* opaque, int items, int size);
+  static void BzipFree(void* opaque, void* address);
+
+ private:
+  // The number of buffers allocated by a bzip2 stream decompressing in the
+  // fast mode: its state and the block being decoded.
+  static const size_t kBzipBuffersPerStream;
+
+  mutable base::Lock lock_;
+  size_t max_idle_{1};
+  std::vector<xz_dec*> xz_decoders_;
+  std::vector<ZSTD_DCtx*> zstd_contexts_;
+  // The idle bzip2 buffers by size, and the size of the ones in use.
+  std::multimap<size_t, void*> bzip_buffers_;
+  std::map<void*, size_t> bzip_buffers_in_use_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecoderPool);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_DECODER_POOL_H_
@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/decoder_pool.h"
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class DecoderPoolTest : public ::testing::Test {
+ protected:
+  DecoderPool pool_;
+};
+
+TEST_F(DecoderPoolTest, XzDecoderReusedTest) {
+  EXPECT_EQ(nullptr, pool_.TakeXzDecoder());
+  xz_dec* decoder = xz_dec_init(XZ_DYNALLOC, 1024 * 1024);
+  ASSERT_NE(nullptr, decoder);
+  pool_.PutXzDecoder(decoder);
+  EXPECT_EQ(decoder, pool_.TakeXzDecoder());
+  EXPECT_EQ(nullptr, pool_.TakeXzDecoder());
+  // The decoder left in the pool is freed with it.
+  pool_.PutXzDecoder(decoder);
+}
+
+TEST_F(DecoderPoolTest, MaxIdleTest) {
+  pool_.set_max_idle(2);
+  EXPECT_EQ(2U, pool_.max_idle());
+  ZSTD_DCtx* contexts[] = {
+      ZSTD_createDCtx(), ZSTD_createDCtx(), ZSTD_createDCtx()};
+  for (ZSTD_DCtx* context : contexts) {
+    ASSERT_NE(nullptr, context);
+    pool_.PutZstdContext(context);
+  }
+  // The last context put was freed.
+  ZSTD_DCtx* context = pool_.TakeZstdContext();
+  EXPECT_EQ(contexts[1], context);
+  EXPECT_EQ(contexts[0], pool_.TakeZstdContext());
+  EXPECT_EQ(nullptr, pool_.TakeZstdContext());
+  pool_.PutZstdContext(contexts[0]);
+
+  // Lowering the limit frees the extra idle contexts.
+  pool_.set_max_idle(0);
+  EXPECT_EQ(nullptr, pool_.TakeZstdContext());
+  ZSTD_freeDCtx(context);
+}
+
+TEST_F(DecoderPoolTest, BzipBuffersReusedTest) {
+  void* buffer = DecoderPool::BzipAlloc(&pool_, 16, 64);
+  ASSERT_NE(nullptr, buffer);
+  DecoderPool::BzipFree(&pool_, buffer);
+  // Only a buffer of the same size is reused.
+  void* other_buffer = DecoderPool::BzipAlloc(&pool_, 16, 32);
+  ASSERT_NE(nullptr, other_buffer);
+  EXPECT_NE(buffer, other_buffer);
+  EXPECT_EQ(buffer, DecoderPool::BzipAlloc(&pool_, 64, 16));
+  DecoderPool::BzipFree(&pool_, other_buffer);
+  DecoderPool::BzipFree(&pool_, buffer);
+  DecoderPool::BzipFree(&pool_, nullptr);
+}
+
+}  // namespace chromeos_update_engine
@@ -17,7 +17,9 @@
 #include "update_engine/payload_consumer/delta_performer.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/fs.h>
+#include <sys/mman.h>
 
 #include <algorithm>
 #include <cstring>
@@ -26,36 +28,46 @@
 #include <utility>
 #include <vector>
 
+#include <base/bind.h>
 #include <base/files/file_util.h>
 #include <base/format_macros.h>
 #include <base/metrics/histogram_macros.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/sys_info.h>
 #include <base/time/time.h>
 #include <brillo/data_encoding.h>
 #include <bsdiff/bspatch.h>
 #include <google/protobuf/repeated_field.h>
 #include <puffin/puffpatch.h>
 
+#include "update_engine/common/blob_pool.h"
 #include "update_engine/common/constants.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/hot_path_log.h"
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/subprocess.h"
 #include "update_engine/common/terminator.h"
+#include "update_engine/payload_consumer/aio_file_descriptor.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
+#include "update_engine/payload_consumer/direct_file_descriptor.h"
 #include "update_engine/payload_consumer/download_action.h"
 #include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
+#include "update_engine/payload_consumer/hashing_file_descriptor.h"
 #include "update_engine/payload_consumer/mount_history.h"
 #if USE_MTD
 #include "update_engine/payload_consumer/mtd_file_descriptor.h"
 #endif
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
+#include "update_engine/payload_consumer/writeback_file_descriptor.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
 
 using google::protobuf::RepeatedPtrField;
 using std::min;
@@ -65,12 +77,28 @@ using std::vector;
 namespace chromeos_update_engine {
 
 const uint64_t DeltaPerformer::kSupportedMajorPayloadVersion = 2;
-const uint32_t DeltaPerformer::kSupportedMinorPayloadVersion = 5;
+const uint32_t DeltaPerformer::kSupportedMinorPayloadVersion = 7;
 
 const unsigned DeltaPerformer::kProgressLogMaxChunks = 10;
 const unsigned DeltaPerformer::kProgressLogTimeoutSeconds = 30;
 const unsigned DeltaPerformer::kProgressDownloadWeight = 50;
 const unsigned DeltaPerformer::kProgressOperationsWeight = 50;
+const size_t DeltaPerformer::kPipelineMaxPendingOperations = 8;
+const size_t DeltaPerformer::kPipelineMaxPendingBytes = 16 * 1024 * 1024;
+const size_t DeltaPerformer::kMaxPerformanceApplyWorkers = 8;
+const uint64_t DeltaPerformer::kMinStreamedOperationSize = 1024 * 1024;
+const uint64_t DeltaPerformer::kStreamedOperationCheckpointSize =
+    4 * 1024 * 1024;
+const size_t DeltaPerformer::kSourcePrefetchOperations = 16;
+const uint64_t DeltaPerformer::kSourcePrefetchMaxBytes = 32 * 1024 * 1024;
+const unsigned DeltaPerformer::kCheckpointMinIntervalSeconds = 1;
+const uint64_t DeltaPerformer::kCheckpointMaxDataBytes = 16 * 1024 * 1024;
+const size_t DeltaPerformer::kMaxZeroOrDiscardBatchSize = 1024;
+const uint64_t DeltaPerformer::kMaxSourceCopyBatchBytes = 16 * 1024 * 1024;
+const size_t DeltaPerformer::kZeroBufferSize = 256 * 1024;
+const size_t DeltaPerformer::kMinSharedDataSize = 64 * 1024;
+const size_t DeltaPerformer::kManifestArenaStartBlockSize = 64 * 1024;
+const size_t DeltaPerformer::kManifestArenaMaxBlockSize = 4 * 1024 * 1024;
 
 namespace {
 const int kUpdateStateOperationInvalid = -1;
@@ -79,9 +107,44 @@ const int kMaxResumedUpdateFailures = 10;
 const int kUbiVolumeAttachTimeout = 5 * 60;
 #endif
 
-const uint64_t kCacheSize = 1024 * 1024;  // 1MB
+// Bounds of the write cache of each target partition file descriptor, sized
+// at runtime as a small fraction of the available memory.
+const size_t kMinCacheSize = 256 * 1024;       // 256KiB
+const size_t kMaxCacheSize = 16 * 1024 * 1024;  // 16MiB
+const int64_t kCacheMemoryFraction = 128;
+// The fraction used in performance mode, when the update may take more of the
+// memory of the device.
+const int64_t kPerformanceCacheMemoryFraction = 32;
+
+// The fraction of the available memory the operations applied at the same
+// time may use, as estimated by the max_apply_memory of the manifest.
+const int64_t kApplyMemoryFraction = 4;
+
+// The runs of contiguous bytes the write cache of a target partition holds,
+// so the fragmented destination extents of the operations are written to the
+// device sorted and merged.
+const size_t kMaxCacheRuns = 256;
+
+// The bytes written to a target partition opened without O_DSYNC after which
+// their writeback is started, see WritebackFileDescriptor.
+const uint64_t kWritebackWindowSize = 8 * 1024 * 1024;  // 8MiB
+
+// Bounds of the cache of the inflated source data of each PUFFDIFF operation,
+// sized at runtime like the write cache, so the source deflates read more
+// than once by big patches are inflated again less often.
+const size_t kMinPuffCacheSize = 5 * 1024 * 1024;   // 5MiB
+const size_t kMaxPuffCacheSize = 64 * 1024 * 1024;  // 64MiB
+
+// How the data is written to a partition.
+enum class FileIoMode {
+  kBuffered,
+  // Asynchronous writes, see AioFileDescriptor.
+  kAsync,
+  // Writes bypassing the page cache, see DirectFileDescriptor.
+  kDirect,
+};
 
-FileDescriptorPtr CreateFileDescriptor(const char* path) {
+FileDescriptorPtr CreateFileDescriptor(const char* path, FileIoMode io_mode) {
   FileDescriptorPtr ret;
 #if USE_MTD
   if (strstr(path, "/dev/ubi") == path) {
@@ -102,28 +165,105 @@ FileDescriptorPtr CreateFileDescriptor(const char* path) {
   } else {
     LOG(INFO) << path << " is not an MTD nor a UBI device.";
 #endif
-    ret.reset(new EintrSafeFileDescriptor);
+    switch (io_mode) {
+      case FileIoMode::kAsync:
+        ret.reset(new AioFileDescriptor);
+        break;
+      case FileIoMode::kDirect:
+        ret.reset(new DirectFileDescriptor);
+        break;
+      case FileIoMode::kBuffered:
+        ret.reset(new EintrSafeFileDescriptor);
+        break;
+    }
 #if USE_MTD
   }
 #endif
   return ret;
 }
 
+// Returns the size of the write cache of each one of the |num_fds| file
+// descriptors writing to the target partition |path| of |partition_size|
+// bytes. The cache is a multiple of the optimal I/O size of the device, if
+// known, so the flushes go to the device in whole requests. It is larger in
+// |performance_mode|.
+size_t GetWriteCacheSize(const string& path,
+                         uint64_t partition_size,
+                         size_t num_fds,
+                         bool performance_mode) {
+  int64_t available = base::SysInfo::AmountOfAvailablePhysicalMemory();
+  size_t cache_size = kMinCacheSize;
+  if (available > 0) {
+    const int64_t fraction = performance_mode ? kPerformanceCacheMemoryFraction
+                                              : kCacheMemoryFraction;
+    cache_size = static_cast<size_t>(
+        std::min<int64_t>(available / fraction / num_fds, kMaxCacheSize));
+    cache_size = std::max(cache_size, kMinCacheSize);
+  }
+  // No point in caching more than the whole partition.
+  if (partition_size > 0 && partition_size < cache_size)
+    cache_size = std::max<size_t>(partition_size, kMinCacheSize);
+
+  size_t unit = DirectFileDescriptor::kAlignment;
+  uint32_t io_opt = utils::GetBlockDeviceOptimalIoSize(path);
+  if (io_opt > unit && io_opt % unit == 0 && io_opt <= kMaxCacheSize)
+    unit = io_opt;
+  return std::max(cache_size / unit, static_cast<size_t>(1)) * unit;
+}
+
+// Returns the size of the puffin cache of each one of the |num_workers|
+// operations applied at the same time. It is larger in |performance_mode|.
+size_t GetPuffCacheSize(size_t num_workers, bool performance_mode) {
+  int64_t available = base::SysInfo::AmountOfAvailablePhysicalMemory();
+  if (available <= 0)
+    return kMinPuffCacheSize;
+  const int64_t fraction = performance_mode ? kPerformanceCacheMemoryFraction
+                                            : kCacheMemoryFraction;
+  size_t cache_size = static_cast<size_t>(
+      std::min<int64_t>(available / fraction / num_workers, kMaxPuffCacheSize));
+  return std::max(cache_size, kMinPuffCacheSize);
+}
+
 // Opens path for read/write. On success returns an open FileDescriptor
 // and sets *err to 0. On failure, sets *err to errno and returns nullptr.
+// Writable files are accessed as specified by |io_mode| and their writes are
+// cached in |cache_size| bytes, unless 0, holding up to |cache_runs| runs of
+// contiguous bytes. The buffered writes without O_DSYNC are written back
+// incrementally. The calls reaching the file are recorded in |io_trace|, if
+// not null. The write cache is returned in |cached_fd|, if not null, or
+// nullptr if there is none.
 FileDescriptorPtr OpenFile(const char* path,
                            int mode,
-                           bool cache_writes,
-                           int* err) {
+                           size_t cache_size,
+                           size_t cache_runs,
+                           FileIoMode io_mode,
+                           IOTrace* io_trace,
+                           int* err,
+                           CachedFileDescriptor** cached_fd = nullptr) {
   // Try to mark the block device read-only based on the mode. Ignore any
   // failure since this won't work when passing regular files.
   bool read_only = (mode & O_ACCMODE) == O_RDONLY;
   utils::SetBlockDeviceReadOnly(path, read_only);
 
-  FileDescriptorPtr fd = CreateFileDescriptor(path);
-  if (cache_writes && !read_only) {
-    fd = FileDescriptorPtr(new CachedFileDescriptor(fd, kCacheSize));
-    LOG(INFO) << "Caching writes.";
+  FileDescriptorPtr fd =
+      CreateFileDescriptor(path, read_only ? FileIoMode::kBuffered : io_mode);
+  if (io_trace)
+    fd = FileDescriptorPtr(new TracingFileDescriptor(fd, io_trace));
+  // Otherwise the whole partition could stay dirty in the page cache until
+  // flushed, and then stall the device while it is written back at once.
+  if (!read_only && io_mode == FileIoMode::kBuffered && !(mode & O_DSYNC))
+    fd = FileDescriptorPtr(
+        new WritebackFileDescriptor(fd, kWritebackWindowSize));
+  if (cached_fd)
+    *cached_fd = nullptr;
+  if (cache_size > 0 && !read_only) {
+    CachedFileDescriptor* cache =
+        new CachedFileDescriptor(fd, cache_size, cache_runs);
+    fd = FileDescriptorPtr(cache);
+    if (cached_fd)
+      *cached_fd = cache;
+    LOG(INFO) << "Caching writes in " << cache_size << " bytes, "
+              << cache_runs << " runs.";
   }
 #if USE_MTD
   // On NAND devices, we can either read, or write, but not both. So here we
@@ -141,6 +281,95 @@ FileDescriptorPtr OpenFile(const char* path,
   return fd;
 }
 
+// Returns how the target partitions of |install_plan| should be written for a
+// payload with |block_size| bytes blocks.
+FileIoMode GetTargetIoMode(const InstallPlan* install_plan,
+                           uint32_t block_size) {
+  if (install_plan->async_writes)
+    return FileIoMode::kAsync;
+  // Operations on blocks not aligned for O_DIRECT would make it fall back to
+  // buffered I/O right away.
+  if (install_plan->direct_io &&
+      DirectFileDescriptor::IsAligned(block_size)) {
+    return FileIoMode::kDirect;
+  }
+  return FileIoMode::kBuffered;
+}
+
+// Returns the number of bytes |operation| reads from the source partition. A
+// PARTITION_COPY reads the source of another partition instead.
+uint64_t GetSourceBytes(const InstallOperation& operation,
+                        uint32_t block_size) {
+  if (operation.type() == InstallOperation::PARTITION_COPY)
+    return 0;
+  return utils::BlocksInExtents(operation.src_extents()) * block_size;
+}
+
+// Returns the ExtentWriter stack applying the REPLACE, REPLACE_BZ, REPLACE_XZ
+// or REPLACE_ZSTD |operation|, decoding the xz data with up to |xz_threads|
+// threads and the zstd data with the payload |zstd_dictionary|, if any. The
+// decompression states are reused from the |decoder_pool|. The runs of zero
+// blocks are zeroed with the BLKZEROOUT ioctl while |*zero_ioctl_supported|,
+// unless |zero_ioctl_supported| is null.
+std::unique_ptr<ExtentWriter> CreateReplaceWriter(
+    const InstallOperation& operation,
+    size_t xz_threads,
+    const ZstdDecompressionDictionary* zstd_dictionary,
+    DecoderPool* decoder_pool,
+    std::atomic<bool>* zero_ioctl_supported) {
+  std::unique_ptr<DirectExtentWriter> direct_writer =
+      std::make_unique<DirectExtentWriter>();
+  direct_writer->set_zero_out(zero_ioctl_supported);
+  std::unique_ptr<ExtentWriter> writer =
+      std::make_unique<ZeroPadExtentWriter>(std::move(direct_writer));
+
+  if (operation.type() == InstallOperation::REPLACE_BZ) {
+    writer.reset(new BzipExtentWriter(std::move(writer), decoder_pool));
+  } else if (operation.type() == InstallOperation::REPLACE_XZ) {
+    writer.reset(
+        new XzExtentWriter(std::move(writer), xz_threads, decoder_pool));
+  } else if (operation.type() == InstallOperation::REPLACE_ZSTD) {
+    writer.reset(new ZstdExtentWriter(
+        std::move(writer), zstd_dictionary, decoder_pool));
+  }
+  return writer;
+}
+
+// Returns the |extents| without their first |num_blocks| blocks.
+RepeatedPtrField<Extent> SkipExtentBlocks(
+    const RepeatedPtrField<Extent>& extents, uint64_t num_blocks) {
+  RepeatedPtrField<Extent> result;
+  for (const Extent& extent : extents) {
+    if (num_blocks >= extent.num_blocks()) {
+      num_blocks -= extent.num_blocks();
+      continue;
+    }
+    Extent* remaining = result.Add();
+    remaining->set_start_block(extent.start_block() == kSparseHole
+                                   ? kSparseHole
+                                   : extent.start_block() + num_blocks);
+    remaining->set_num_blocks(extent.num_blocks() - num_blocks);
+    num_blocks = 0;
+  }
+  return result;
+}
+
+// Updates each one of |calculators| with the first |length| bytes stored in
+// |buffer|. Returns whether the hashes were updated.
+bool UpdateHashWithBuffer(const SegmentedBuffer& buffer,
+                          size_t length,
+                          const vector<HashCalculator*>& calculators) {
+  for (const SegmentedBuffer::Segment& segment : buffer.segments()) {
+    if (length == 0)
+      break;
+    size_t chunk = min(length, segment.size());
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::UpdateMultiple(calculators, segment.data(), chunk));
+    length -= chunk;
+  }
+  return length == 0;
+}
+
 // Discard the tail of the block device referenced by |fd|, from the offset
 // |data_size| until the end of the block device. Returns whether the data was
 // discarded.
@@ -207,12 +436,12 @@ void DeltaPerformer::LogProgress(const char* message_prefix) {
                            IntRatio(total_bytes_received_, payload_size, 100));
   }
 
-  LOG(INFO) << (message_prefix ? message_prefix : "") << next_operation_num_
-            << "/" << total_operations_str << " operations"
-            << completed_percentage_str << ", " << total_bytes_received_
-            << "/" << payload_size_str << " bytes downloaded"
-            << downloaded_percentage_str << ", overall progress "
-            << overall_progress_ << "%";
+  HOT_PATH_LOG(INFO) << (message_prefix ? message_prefix : "")
+                     << next_operation_num_ << "/" << total_operations_str
+                     << " operations" << completed_percentage_str << ", "
+                     << total_bytes_received_ << "/" << payload_size_str
+                     << " bytes downloaded" << downloaded_percentage_str
+                     << ", overall progress " << overall_progress_ << "%";
 }
 
 void DeltaPerformer::UpdateOverallProgress(bool force_log,
@@ -272,16 +501,35 @@ void DeltaPerformer::UpdateOverallProgress(bool force_log,
 }
 
 
-size_t DeltaPerformer::CopyDataToBuffer(const char** bytes_p, size_t* count_p,
-                                        size_t max) {
+size_t DeltaPerformer::CopyDataToBuffer(const char** bytes_p,
+                                        size_t* count_p,
+                                        size_t max,
+                                        bool contiguous) {
   const size_t count = *count_p;
   if (!count)
     return 0;  // Special case shortcut.
   size_t read_len = min(count, max - buffer_.size());
   const char* bytes_start = *bytes_p;
   const char* bytes_end = bytes_start + read_len;
-  buffer_.reserve(max);
-  buffer_.insert(buffer_.end(), bytes_start, bytes_end);
+  if (contiguous)
+    buffer_.ReserveContiguous(max);
+  else
+    buffer_.Reserve(max);
+  // Keep a reference to the bytes of a shared chunk instead of copying them,
+  // unless they must be merged with the rest of the data anyway.
+  const uint8_t* chunk_start =
+      shared_chunk_ ? shared_chunk_->data() : nullptr;
+  if (!contiguous && chunk_start && read_len >= kMinSharedDataSize &&
+      reinterpret_cast<const uint8_t*>(bytes_start) >= chunk_start &&
+      reinterpret_cast<const uint8_t*>(bytes_end) <=
+          chunk_start + shared_chunk_->size()) {
+    buffer_.AppendShared(
+        shared_chunk_,
+        reinterpret_cast<const uint8_t*>(bytes_start) - chunk_start,
+        read_len);
+  } else {
+    buffer_.Append(bytes_start, read_len);
+  }
   *bytes_p = bytes_end;
   *count_p = count - read_len;
   return read_len;
@@ -289,23 +537,34 @@ size_t DeltaPerformer::CopyDataToBuffer(const char** bytes_p, size_t* count_p,
 
 
 bool DeltaPerformer::HandleOpResult(bool op_result, const char* op_type_name,
-                                    ErrorCode* error) {
+                                    size_t op_num, ErrorCode* error) {
   if (op_result)
     return true;
 
   size_t partition_first_op_num =
       current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
   LOG(ERROR) << "Failed to perform " << op_type_name << " operation "
-             << next_operation_num_ << ", which is the operation "
-             << next_operation_num_ - partition_first_op_num
+             << op_num << ", which is the operation "
+             << op_num - partition_first_op_num
              << " in partition \""
-             << partitions_[current_partition_].partition_name() << "\"";
+             << manifest_.partitions(current_partition_).partition_name()
+             << "\"";
   if (*error == ErrorCode::kSuccess)
     *error = ErrorCode::kDownloadOperationExecutionError;
   return false;
 }
 
 int DeltaPerformer::Close() {
+  // Stop applying operations before closing the partitions. Any operation not
+  // yet applied wasn't checkpointed and will be applied again when resuming.
+  if (pipeline_) {
+    pipeline_->Stop();
+    pipeline_.reset();
+    pending_checkpoints_.clear();
+  }
+  // An operation streamed only partially will be applied again when resuming.
+  streamed_op_writer_.reset();
+  streamed_op_hash_calculator_.reset();
   int err = -CloseCurrentPartition();
   LOG_IF(ERROR, !payload_hash_calculator_.Finalize() ||
                 !signed_hash_calculator_.Finalize())
@@ -328,6 +587,11 @@ int DeltaPerformer::CloseCurrentPartition() {
   }
   source_fd_.reset();
   source_path_.clear();
+  if (source_mmap_) {
+    munmap(const_cast<uint8_t*>(source_mmap_), source_mmap_size_);
+    source_mmap_ = nullptr;
+    source_mmap_size_ = 0;
+  }
 
   if (target_fd_ && !target_fd_->Close()) {
     err = errno;
@@ -337,16 +601,68 @@ int DeltaPerformer::CloseCurrentPartition() {
   }
   target_fd_.reset();
   target_path_.clear();
+
+  // The extra file descriptors of the pipeline workers.
+  for (size_t i = 1; i < worker_fds_.size(); i++) {
+    if (worker_fds_[i].source && !worker_fds_[i].source->Close()) {
+      err = errno;
+      PLOG(ERROR) << "Error closing source partition";
+      if (!err)
+        err = 1;
+    }
+    if (worker_fds_[i].target && !worker_fds_[i].target->Close()) {
+      err = errno;
+      PLOG(ERROR) << "Error closing target partition";
+      if (!err)
+        err = 1;
+    }
+  }
+  worker_fds_.clear();
+
+  // Only the data of a target partition closed successfully is known to be
+  // written, and the hash covers it only if all of it was written in order.
+  if (write_hasher_ && !err) {
+    size_t num_previous_partitions =
+        install_plan_->partitions.size() - manifest_.partitions_size();
+    InstallPlan::Partition& install_part =
+        install_plan_->partitions[num_previous_partitions + current_partition_];
+    if (write_hasher_->GetHashes(&install_part.target_written_hash,
+                                 &install_part.target_written_sample_hashes)) {
+      LOG(INFO) << "Computed the hash of partition " << install_part.name
+                << " from the data written to it.";
+    }
+  }
+  write_hasher_.reset();
   return -err;
 }
 
+void DeltaPerformer::NotifyPartitionWritten(size_t partition) {
+  if (!partition_write_observer_)
+    return;
+  size_t num_previous_partitions =
+      install_plan_->partitions.size() - manifest_.partitions_size();
+  partition_write_observer_->PartitionWritten(
+      *install_plan_, num_previous_partitions + partition);
+}
+
+void DeltaPerformer::ReleasePartitionOperations(size_t partition) {
+  if (partition >= operation_arenas_.size() || !operation_arenas_[partition])
+    return;
+  // The operations are taken out of the manifest without being deleted, as
+  // the arena holding them is freed at once.
+  RepeatedPtrField<InstallOperation>* operations =
+      manifest_.mutable_partitions(partition)->mutable_operations();
+  operations->UnsafeArenaExtractSubrange(0, operations->size(), nullptr);
+  operation_arenas_[partition].reset();
+}
+
 bool DeltaPerformer::OpenCurrentPartition() {
-  if (current_partition_ >= partitions_.size())
+  if (current_partition_ >= static_cast<size_t>(manifest_.partitions_size()))
     return false;
 
-  const PartitionUpdate& partition = partitions_[current_partition_];
+  const PartitionUpdate& partition = manifest_.partitions(current_partition_);
   size_t num_previous_partitions =
-      install_plan_->partitions.size() - partitions_.size();
+      install_plan_->partitions.size() - manifest_.partitions_size();
   const InstallPlan::Partition& install_part =
       install_plan_->partitions[num_previous_partitions + current_partition_];
   // Open source fds if we have a delta payload with minor version >= 2.
@@ -354,7 +670,13 @@ bool DeltaPerformer::OpenCurrentPartition() {
       GetMinorVersion() != kInPlaceMinorPayloadVersion) {
     source_path_ = install_part.source_path;
     int err;
-    source_fd_ = OpenFile(source_path_.c_str(), O_RDONLY, false, &err);
+    source_fd_ = OpenFile(source_path_.c_str(),
+                          O_RDONLY,
+                          0,
+                          1,
+                          FileIoMode::kBuffered,
+                          io_trace_,
+                          &err);
     if (!source_fd_) {
       LOG(ERROR) << "Unable to open source partition "
                  << partition.partition_name() << " on slot "
@@ -362,9 +684,21 @@ bool DeltaPerformer::OpenCurrentPartition() {
                  << ", file " << source_path_;
       return false;
     }
+    if (install_plan_->mmap_source && !MapSourcePartition()) {
+      LOG(WARNING) << "Unable to map the source partition " << source_path_
+                   << ", reading it instead.";
+    }
   }
 
+  source_prefetch_next_op_ = 0;
+  source_verified_ = false;
+  if (source_fd_ && install_plan_->verify_source_once)
+    source_verified_ = VerifySourcePartition(install_part);
+
   target_path_ = install_part.target_path;
+  zero_ioctl_supported_ = true;
+  discard_ioctl_supported_ = true;
+  copy_range_supported_ = true;
   int err;
 
   int flags = O_RDWR;
@@ -374,7 +708,22 @@ bool DeltaPerformer::OpenCurrentPartition() {
   LOG(INFO) << "Opening " << target_path_ << " partition with"
             << (is_interactive_ ? "out" : "") << " O_DSYNC";
 
-  target_fd_ = OpenFile(target_path_.c_str(), flags, true, &err);
+  target_size_ = install_part.target_size;
+  UpdateCacheSizes();
+  const size_t cache_size = write_cache_size_;
+  // The in-place operations read the blocks written by the previous ones, so
+  // their writes are flushed in order.
+  const size_t cache_runs =
+      GetMinorVersion() == kInPlaceMinorPayloadVersion ? 1 : kMaxCacheRuns;
+  CachedFileDescriptor* target_cache = nullptr;
+  target_fd_ = OpenFile(target_path_.c_str(),
+                        flags,
+                        cache_size,
+                        cache_runs,
+                        GetTargetIoMode(install_plan_, block_size_),
+                        io_trace_,
+                        &err,
+                        &target_cache);
   if (!target_fd_) {
     LOG(ERROR) << "Unable to open target partition "
                << partition.partition_name() << " on slot "
@@ -382,6 +731,19 @@ bool DeltaPerformer::OpenCurrentPartition() {
                << ", file " << target_path_;
     return false;
   }
+  if (install_plan_->verify_written_hash) {
+    write_hasher_ =
+        std::make_shared<WrittenDataHasher>(install_part.target_size);
+    target_fd_ = FileDescriptorPtr(
+        new HashingFileDescriptor(target_fd_, write_hasher_));
+  }
+
+  worker_fds_ = {{source_fd_, target_fd_, target_cache}};
+  if (pipeline_ && !OpenWorkerFds(flags, cache_size, cache_runs)) {
+    LOG(ERROR) << "Unable to open partition " << partition.partition_name()
+               << " for the apply workers";
+    return false;
+  }
 
   LOG(INFO) << "Applying " << partition.operations().size()
             << " operations to partition \"" << partition.partition_name()
@@ -393,6 +755,41 @@ bool DeltaPerformer::OpenCurrentPartition() {
   return true;
 }
 
+bool DeltaPerformer::OpenWorkerFds(int target_flags,
+                                   size_t cache_size,
+                                   size_t cache_runs) {
+  for (size_t i = 1; i < pipeline_->num_workers(); i++) {
+    PartitionFds fds;
+    int err;
+    if (source_fd_) {
+      fds.source = OpenFile(source_path_.c_str(),
+                            O_RDONLY,
+                            0,
+                            1,
+                            FileIoMode::kBuffered,
+                            io_trace_,
+                            &err);
+      TEST_AND_RETURN_FALSE(fds.source);
+    }
+    fds.target = OpenFile(target_path_.c_str(),
+                          target_flags,
+                          cache_size,
+                          cache_runs,
+                          GetTargetIoMode(install_plan_, block_size_),
+                          io_trace_,
+                          &err,
+                          &fds.target_cache);
+    if (fds.target && write_hasher_) {
+      fds.target = FileDescriptorPtr(
+          new HashingFileDescriptor(fds.target, write_hasher_));
+    }
+    // Add them before checking the target so they are closed on failure.
+    worker_fds_.push_back(fds);
+    TEST_AND_RETURN_FALSE(fds.target);
+  }
+  return true;
+}
+
 namespace {
 
 void LogPartitionInfoHash(const PartitionInfo& info, const string& tag) {
@@ -401,7 +798,8 @@ void LogPartitionInfoHash(const PartitionInfo& info, const string& tag) {
             << " size: " << info.size();
 }
 
-void LogPartitionInfo(const vector<PartitionUpdate>& partitions) {
+void LogPartitionInfo(
+    const google::protobuf::RepeatedPtrField<PartitionUpdate>& partitions) {
   for (const PartitionUpdate& partition : partitions) {
     if (partition.has_old_partition_info()) {
       LogPartitionInfoHash(partition.old_partition_info(),
@@ -457,6 +855,9 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
     }
   }
 
+  // Hash the metadata received so far while the rest is downloaded.
+  payload_metadata_.UpdateMetadataHash(payload);
+
   // Now that we have validated the metadata size, we should wait for the full
   // metadata and its signature (if exist) to be read in before we can parse it.
   if (payload.size() < metadata_size_ + metadata_signature_size_)
@@ -477,19 +878,14 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
                  << "Trusting metadata size in payload = " << metadata_size_;
   }
 
-  // See if we should use the public RSA key in the Omaha response.
-  base::FilePath path_to_public_key(public_key_path_);
-  base::FilePath tmp_key;
-  if (GetPublicKeyFromResponse(&tmp_key))
-    path_to_public_key = tmp_key;
-  ScopedPathUnlinker tmp_key_remover(tmp_key.value());
-  if (tmp_key.empty())
-    tmp_key_remover.set_should_remove(false);
+  // A missing key fails the verification below.
+  std::shared_ptr<const PublicKey> public_key;
+  GetPublicKey(&public_key);
 
   // We have the full metadata in |payload|. Verify its integrity
   // and authenticity based on the information we have in Omaha response.
   *error = payload_metadata_.ValidateMetadataSignature(
-      payload, payload_->metadata_signature, path_to_public_key);
+      payload, payload_->metadata_signature, public_key.get());
   if (*error != ErrorCode::kSuccess) {
     if (install_plan_->hash_checks_mandatory) {
       // The autoupdate_CatchBadSignatures test checks for this string
@@ -504,7 +900,8 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
   }
 
   // The payload metadata is deemed valid, it's safe to parse the protobuf.
-  if (!payload_metadata_.GetManifest(payload, &manifest_)) {
+  if (!payload_metadata_.GetManifest(
+          payload, ManifestArenaOptions(), &manifest_, &operation_arenas_)) {
     LOG(ERROR) << "Unable to parse manifest in update file.";
     *error = ErrorCode::kDownloadManifestParseError;
     return MetadataParseResult::kError;
@@ -523,6 +920,14 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
         base::TimeDelta::FromMinutes(5),                  \
         20);
 
+bool DeltaPerformer::WriteChunk(
+    const std::shared_ptr<const brillo::Blob>& chunk, ErrorCode* error) {
+  shared_chunk_ = chunk;
+  bool result = Write(chunk->data(), chunk->size(), error);
+  shared_chunk_.reset();
+  return result;
+}
+
 // Wrapper around write. Returns true if all requested bytes
 // were written, or false on any error, regardless of progress
 // and stores an action exit code in |error|.
@@ -540,9 +945,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
     const bool do_read_header = !IsHeaderParsed();
     CopyDataToBuffer(&c_bytes, &count,
                      (do_read_header ? kMaxPayloadHeaderSize :
-                      metadata_size_ + metadata_signature_size_));
+                      metadata_size_ + metadata_signature_size_),
+                     false);
 
-    MetadataParseResult result = ParsePayloadMetadata(buffer_, error);
+    MetadataParseResult result = ParsePayloadMetadata(buffer_.Flatten(), error);
     if (result == MetadataParseResult::kError)
       return false;
     if (result == MetadataParseResult::kInsufficientData) {
@@ -558,22 +964,37 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
       return false;
     manifest_valid_ = true;
 
+    // The zstd dictionary is prepared once for all the operations using it.
+    if (manifest_.has_zstd_dictionary()) {
+      zstd_dictionary_ =
+          ZstdDecompressionDictionary::Create(manifest_.zstd_dictionary());
+      if (!zstd_dictionary_) {
+        *error = ErrorCode::kDownloadManifestParseError;
+        return false;
+      }
+    }
+
+    StoreMetadata();
+
     // Clear the download buffer.
     DiscardBuffer(false, metadata_size_);
 
-    // This populates |partitions_| and the |install_plan.partitions| with the
-    // list of partitions from the manifest.
+    // This populates the |install_plan.partitions| with the list of partitions
+    // from the manifest.
     if (!ParseManifestPartitions(error))
       return false;
 
     // |install_plan.partitions| was filled in, nothing need to be done here if
     // the payload was already applied, returns false to terminate http fetcher,
     // but keep |error| as ErrorCode::kSuccess.
-    if (payload_->already_applied)
+    if (payload_->already_applied) {
+      for (int i = 0; i < manifest_.partitions_size(); i++)
+        NotifyPartitionWritten(i);
       return false;
+    }
 
     num_total_operations_ = 0;
-    for (const auto& partition : partitions_) {
+    for (const auto& partition : manifest_.partitions()) {
       num_total_operations_ += partition.operations_size();
       acc_num_operations_.push_back(num_total_operations_);
     }
@@ -591,6 +1012,45 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
       return false;
     }
 
+    // The pipeline must exist before opening the partition so the file
+    // descriptors of all the workers are opened.
+    if (install_plan_->pipelined_apply || install_plan_->apply_threads > 1) {
+      size_t num_workers = std::max<size_t>(install_plan_->apply_threads, 1);
+      // The spare workers only run in performance mode, which can be enabled
+      // at any time through the IOLimiter.
+      if (io_limiter_) {
+        num_workers = std::max(
+            num_workers,
+            std::min(
+                static_cast<size_t>(base::SysInfo::NumberOfProcessors()),
+                kMaxPerformanceApplyWorkers));
+      }
+      // Don't run more workers than the operations fitting in memory.
+      if (manifest_.max_apply_memory() > 0) {
+        const int64_t available =
+            base::SysInfo::AmountOfAvailablePhysicalMemory();
+        const size_t max_workers = std::max<size_t>(
+            available / kApplyMemoryFraction / manifest_.max_apply_memory(),
+            1);
+        if (max_workers < num_workers) {
+          LOG(INFO) << "Limiting the worker threads to " << max_workers
+                    << " for the " << manifest_.max_apply_memory()
+                    << " bytes needed by an operation.";
+          num_workers = max_workers;
+        }
+      }
+      LOG(INFO) << "Applying the operations in pipelined mode with "
+                << num_workers << " worker threads.";
+      pipeline_.reset(new OperationPipeline(num_workers,
+                                            kPipelineMaxPendingOperations,
+                                            kPipelineMaxPendingBytes));
+      pipeline_->set_io_limiter(io_limiter_);
+      // Every worker and the streamed operation can decode at the same time.
+      decoder_pool_.set_max_idle(num_workers + 1);
+      UpdatePipelineWorkers();
+      pipeline_->Start();
+    }
+
     if (!OpenCurrentPartition()) {
       *error = ErrorCode::kInstallDeviceOpenError;
       return false;
@@ -608,10 +1068,22 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
     if (download_delegate_ && download_delegate_->ShouldCancel(error))
       return false;
 
+    // Persist the progress of the operations applied in the background and
+    // stop if any of them failed.
+    if (pipeline_ && !CommitPipelineCheckpoints(error, false))
+      return false;
+    if (pipeline_)
+      UpdatePipelineWorkers();
+
     // We know there are more operations to perform because we didn't reach the
     // |num_total_operations_| limit yet.
     while (next_operation_num_ >= acc_num_operations_[current_partition_]) {
-      CloseCurrentPartition();
+      // The queued operations write to the current partition.
+      if (pipeline_ && !DrainPipeline(error))
+        return false;
+      if (CloseCurrentPartition() == 0)
+        NotifyPartitionWritten(current_partition_);
+      ReleasePartitionOperations(current_partition_);
       current_partition_++;
       if (!OpenCurrentPartition()) {
         *error = ErrorCode::kInstallDeviceOpenError;
@@ -621,35 +1093,73 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
     const size_t partition_operation_num = next_operation_num_ - (
         current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0);
 
-    const InstallOperation& op =
-        partitions_[current_partition_].operations(partition_operation_num);
+    const InstallOperation& op = manifest_.partitions(current_partition_)
+                                     .operations(partition_operation_num);
 
-    CopyDataToBuffer(&c_bytes, &count, op.data_length());
+    // Read the source blocks of the next operations from disk while the data
+    // of this one is downloaded.
+    PrefetchSourceExtents(partition_operation_num);
 
-    // Check whether we received all of the next operation's data payload.
-    if (!CanPerformInstallOperation(op))
-      return true;
+    if (data_wait_operation_num_ != next_operation_num_) {
+      data_wait_operation_num_ = next_operation_num_;
+      data_wait_start_time_ = base::TimeTicks::Now();
+    }
 
-    // Validate the operation only if the metadata signature is present.
-    // Otherwise, keep the old behavior. This serves as a knob to disable
-    // the validation logic in case we find some regression after rollout.
-    // NOTE: If hash checks are mandatory and if metadata_signature is empty,
-    // we would have already failed in ParsePayloadMetadata method and thus not
-    // even be here. So no need to handle that case again here.
-    if (!payload_->metadata_signature.empty()) {
-      // Note: Validate must be called only if CanPerformInstallOperation is
-      // called. Otherwise, we might be failing operations before even if there
-      // isn't sufficient data to compute the proper hash.
-      *error = ValidateOperationHash(op);
-      if (*error != ErrorCode::kSuccess) {
-        if (install_plan_->hash_checks_mandatory) {
-          LOG(ERROR) << "Mandatory operation hash check failed";
-          return false;
+    // Large replace operations are applied as their data arrives, so their
+    // blob is never held in memory as a whole.
+    const bool streamed = IsStreamedOperation(op);
+    if (streamed) {
+      bool done = false;
+      if (!StreamReplaceOperation(op, &c_bytes, &count, &done, error))
+        return false;
+      if (!done)
+        return true;
+      RecordApplyPhase(ApplyStats::Phase::kWaitForData,
+                       op,
+                       next_operation_num_,
+                       data_wait_start_time_,
+                       op.data_length());
+      RecordOperationApplied(op);
+    } else {
+      CopyDataToBuffer(
+          &c_bytes, &count, op.data_length(), NeedsContiguousData(op));
+
+      // Check whether we received all of the next operation's data payload.
+      if (!CanPerformInstallOperation(op))
+        return true;
+      RecordApplyPhase(ApplyStats::Phase::kWaitForData,
+                       op,
+                       next_operation_num_,
+                       data_wait_start_time_,
+                       op.data_length());
+
+      // Validate the operation only if the metadata signature is present.
+      // Otherwise, keep the old behavior. This serves as a knob to disable
+      // the validation logic in case we find some regression after rollout.
+      // NOTE: If hash checks are mandatory and if metadata_signature is empty,
+      // we would have already failed in ParsePayloadMetadata method and thus
+      // not even be here. So no need to handle that case again here.
+      if (!payload_->metadata_signature.empty()) {
+        // Note: Validate must be called only if CanPerformInstallOperation is
+        // called. Otherwise, we might be failing operations before even if
+        // there isn't sufficient data to compute the proper hash.
+        base::TimeTicks hash_start_time = base::TimeTicks::Now();
+        *error = ValidateOperationHash(op);
+        RecordApplyPhase(ApplyStats::Phase::kHash,
+                         op,
+                         next_operation_num_,
+                         hash_start_time,
+                         op.data_length());
+        if (*error != ErrorCode::kSuccess) {
+          if (install_plan_->hash_checks_mandatory) {
+            LOG(ERROR) << "Mandatory operation hash check failed";
+            return false;
+          }
+
+          // For non-mandatory cases, just send a UMA stat.
+          LOG(WARNING) << "Ignoring operation validation errors";
+          *error = ErrorCode::kSuccess;
         }
-
-        // For non-mandatory cases, just send a UMA stat.
-        LOG(WARNING) << "Ignoring operation validation errors";
-        *error = ErrorCode::kSuccess;
       }
     }
 
@@ -657,54 +1167,121 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
     ScopedTerminatorExitUnblocker exit_unblocker =
         ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
 
-    base::TimeTicks op_start_time = base::TimeTicks::Now();
+    // Since we delete data off the beginning of the buffer as we use it, the
+    // data we need should be exactly at the beginning of the buffer.
+    if (!HandleOpResult(streamed || !op.data_length() ||
+                            buffer_offset_ == op.data_offset(),
+                        InstallOperationTypeName(op.type()),
+                        next_operation_num_,
+                        error)) {
+      return false;
+    }
 
-    bool op_result;
-    switch (op.type()) {
-      case InstallOperation::REPLACE:
-      case InstallOperation::REPLACE_BZ:
-      case InstallOperation::REPLACE_XZ:
-        op_result = PerformReplaceOperation(op);
-        OP_DURATION_HISTOGRAM("REPLACE", op_start_time);
-        break;
-      case InstallOperation::ZERO:
-      case InstallOperation::DISCARD:
-        op_result = PerformZeroOrDiscardOperation(op);
-        OP_DURATION_HISTOGRAM("ZERO_OR_DISCARD", op_start_time);
-        break;
-      case InstallOperation::MOVE:
-        op_result = PerformMoveOperation(op);
-        OP_DURATION_HISTOGRAM("MOVE", op_start_time);
-        break;
-      case InstallOperation::BSDIFF:
-        op_result = PerformBsdiffOperation(op);
-        OP_DURATION_HISTOGRAM("BSDIFF", op_start_time);
-        break;
-      case InstallOperation::SOURCE_COPY:
-        op_result = PerformSourceCopyOperation(op, error);
-        OP_DURATION_HISTOGRAM("SOURCE_COPY", op_start_time);
-        break;
-      case InstallOperation::SOURCE_BSDIFF:
-      case InstallOperation::BROTLI_BSDIFF:
-        op_result = PerformSourceBsdiffOperation(op, error);
-        OP_DURATION_HISTOGRAM("SOURCE_BSDIFF", op_start_time);
-        break;
-      case InstallOperation::PUFFDIFF:
-        op_result = PerformPuffDiffOperation(op, error);
-        OP_DURATION_HISTOGRAM("PUFFDIFF", op_start_time);
-        break;
-      default:
-        op_result = false;
+    // The data of a skipped operation is still hashed, so the payload hash
+    // can be verified.
+    if (check_applied_operations_ && !streamed) {
+      if (IsOperationApplied(op)) {
+        HOT_PATH_LOG(INFO) << "Operation " << next_operation_num_
+                           << " was applied before resuming, skipping it.";
+        DiscardBuffer(true, buffer_.size());
+        next_operation_num_++;
+        UpdateOverallProgress(false, "Skipped ");
+        continue;
+      }
+      check_applied_operations_ = false;
     }
-    if (!HandleOpResult(op_result, InstallOperationTypeName(op.type()), error))
-      return false;
 
-    if (!target_fd_->Flush()) {
-      return false;
+    // A run of ZERO or DISCARD operations, or of SOURCE_COPY operations
+    // following each other, is applied at once, as a single operation with
+    // the extents of all of them.
+    size_t num_ops = 1;
+    const vector<const InstallOperation*>* batched_operations = nullptr;
+    const InstallOperation& apply_op =
+        streamed ? op
+                 : op.type() == InstallOperation::SOURCE_COPY
+                       ? BatchSourceCopyOperations(partition_operation_num,
+                                                   &num_ops,
+                                                   &batched_operations)
+                       : BatchZeroOrDiscardOperations(partition_operation_num,
+                                                      &num_ops);
+
+    if (streamed) {
+      // Already applied by StreamReplaceOperation().
+    } else if (ExtractSignatureMessageFromOperation(op)) {
+      // If this is dummy replace operation, we ignore it after extracting the
+      // signature.
+      DiscardBuffer(true, 0);
+    } else if (pipeline_) {
+      if (!QueueInstallOperation(
+              apply_op, batched_operations, next_operation_num_, error)) {
+        return false;
+      }
+    } else {
+      base::TimeTicks apply_start_time = base::TimeTicks::Now();
+      bool op_result = PerformInstallOperation(
+          apply_op, batched_operations, &buffer_, worker_fds_[0], error);
+      RecordApplyPhase(ApplyStats::Phase::kApply,
+                       apply_op,
+                       next_operation_num_,
+                       apply_start_time,
+                       apply_op.data_length());
+      if (op_result)
+        RecordOperationApplied(apply_op);
+      if (!HandleOpResult(op_result,
+                          InstallOperationTypeName(apply_op.type()),
+                          next_operation_num_,
+                          error))
+        return false;
+
+      DiscardBuffer(true, buffer_.size());
     }
 
-    next_operation_num_++;
+    next_operation_num_ += num_ops - 1;
+    const size_t op_num = next_operation_num_++;
     UpdateOverallProgress(false, "Completed ");
+    if (pipeline_) {
+      Checkpoint checkpoint = MakeCheckpoint();
+      checkpoint.required_tasks = pipeline_pushed_tasks_;
+      pending_checkpoints_.push_back(std::move(checkpoint));
+      base::TimeTicks checkpoint_start_time = base::TimeTicks::Now();
+      if (!CommitPipelineCheckpoints(error, false))
+        return false;
+      RecordApplyPhase(ApplyStats::Phase::kCheckpoint,
+                       op,
+                       op_num,
+                       checkpoint_start_time,
+                       0);
+    } else if (IsCheckpointDue()) {
+      // The data written so far must be on disk before it is checkpointed.
+      base::TimeTicks flush_start_time = base::TimeTicks::Now();
+      if (!target_fd_->Flush())
+        return false;
+      RecordApplyPhase(
+          ApplyStats::Phase::kFlush, op, op_num, flush_start_time, 0);
+      base::TimeTicks checkpoint_start_time = base::TimeTicks::Now();
+      CheckpointUpdateProgress();
+      RecordApplyPhase(ApplyStats::Phase::kCheckpoint,
+                       op,
+                       op_num,
+                       checkpoint_start_time,
+                       0);
+    }
+  }
+
+  // All the operations were queued, wait for them to be applied before moving
+  // on to the signature.
+  if (pipeline_) {
+    ScopedTerminatorExitUnblocker exit_unblocker =
+        ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+    if (!DrainPipeline(error))
+      return false;
+  } else if (last_updated_next_operation_num_ != next_operation_num_) {
+    // Persist the progress of the operations applied since the last
+    // checkpoint.
+    ScopedTerminatorExitUnblocker exit_unblocker =
+        ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+    if (!target_fd_->Flush())
+      return false;
     CheckpointUpdateProgress();
   }
 
@@ -721,7 +1298,7 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
       *error = ErrorCode::kDownloadPayloadVerificationError;
       return false;
     }
-    CopyDataToBuffer(&c_bytes, &count, manifest_.signatures_size());
+    CopyDataToBuffer(&c_bytes, &count, manifest_.signatures_size(), false);
     // Needs more data to cover entire signature.
     if (buffer_.size() < manifest_.signatures_size())
       return true;
@@ -740,60 +1317,675 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode *error) {
   return true;
 }
 
+bool DeltaPerformer::PerformInstallOperation(
+    const InstallOperation& op,
+    const vector<const InstallOperation*>* batched_operations,
+    SegmentedBuffer* data,
+    const PartitionFds& fds,
+    ErrorCode* error) {
+  base::TimeTicks op_start_time = base::TimeTicks::Now();
+
+  // The write caches are resized by the thread using them, once their size
+  // changed with the number of workers running.
+  if (fds.target_cache && fds.target_cache->cache_size() != write_cache_size_ &&
+      !fds.target_cache->SetCacheSize(write_cache_size_)) {
+    LOG(WARNING) << "Unable to resize the write cache to " << write_cache_size_
+                 << " bytes.";
+  }
+
+  bool op_result;
+  switch (op.type()) {
+    case InstallOperation::REPLACE:
+    case InstallOperation::REPLACE_BZ:
+    case InstallOperation::REPLACE_XZ:
+    case InstallOperation::REPLACE_ZSTD:
+      op_result = PerformReplaceOperation(op, *data, fds);
+      OP_DURATION_HISTOGRAM("REPLACE", op_start_time);
+      break;
+    case InstallOperation::ZERO:
+    case InstallOperation::DISCARD:
+      op_result = PerformZeroOrDiscardOperation(op, fds);
+      OP_DURATION_HISTOGRAM("ZERO_OR_DISCARD", op_start_time);
+      break;
+    case InstallOperation::MOVE:
+      op_result = PerformMoveOperation(op, fds);
+      OP_DURATION_HISTOGRAM("MOVE", op_start_time);
+      break;
+    case InstallOperation::BSDIFF:
+      op_result = PerformBsdiffOperation(op, data->Flatten(), fds);
+      OP_DURATION_HISTOGRAM("BSDIFF", op_start_time);
+      break;
+    case InstallOperation::SOURCE_COPY:
+      op_result =
+          PerformSourceCopyOperation(op, batched_operations, fds, error);
+      OP_DURATION_HISTOGRAM("SOURCE_COPY", op_start_time);
+      break;
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+      op_result = PerformSourceBsdiffOperation(op, data->Flatten(), fds, error);
+      OP_DURATION_HISTOGRAM("SOURCE_BSDIFF", op_start_time);
+      break;
+    case InstallOperation::PUFFDIFF:
+      op_result = PerformPuffDiffOperation(op, data->Flatten(), fds, error);
+      OP_DURATION_HISTOGRAM("PUFFDIFF", op_start_time);
+      break;
+    case InstallOperation::PARTITION_COPY:
+      op_result = PerformPartitionCopyOperation(op, fds, error);
+      OP_DURATION_HISTOGRAM("PARTITION_COPY", op_start_time);
+      break;
+    default:
+      op_result = false;
+  }
+
+  // The source blocks are rarely read again by the later operations, so they
+  // are dropped from the page cache instead of the data of the rest of the
+  // system. A mapped source stays in memory until unmapped anyway.
+  if (op_result && fds.source && !source_mmap_ &&
+      op.type() != InstallOperation::PARTITION_COPY) {
+    const vector<const InstallOperation*> operations =
+        batched_operations ? *batched_operations
+                           : vector<const InstallOperation*>{&op};
+    for (const InstallOperation* operation : operations) {
+      fd_utils::DropExtentsCache(
+          fds.source, operation->src_extents(), block_size_);
+    }
+  }
+  return op_result;
+}
+
+bool DeltaPerformer::VerifySourcePartition(
+    const InstallPlan::Partition& install_part) {
+  if (install_part.source_hash.empty() || install_part.source_size == 0)
+    return false;
+  base::TimeTicks start_time = base::TimeTicks::Now();
+  brillo::Blob source_hash;
+  if (!fd_utils::ReadAndHashFile(
+          source_fd_, install_part.source_size, &source_hash)) {
+    LOG(WARNING) << "Unable to hash the source partition " << install_part.name
+                 << ", checking the source of each operation.";
+    return false;
+  }
+  if (source_hash != install_part.source_hash) {
+    LOG(WARNING) << "The source partition " << install_part.name
+                 << " doesn't match the expected hash, checking the source of "
+                 << "each operation.";
+    return false;
+  }
+  LOG(INFO) << "Verified the source partition " << install_part.name << " in "
+            << utils::FormatTimeDelta(base::TimeTicks::Now() - start_time)
+            << ", skipping the source hash checks of its operations.";
+  return true;
+}
+
+bool DeltaPerformer::MapSourcePartition() {
+  int fd = HANDLE_EINTR(open(source_path_.c_str(), O_RDONLY | O_CLOEXEC));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  off_t size = utils::FileSize(fd);
+  TEST_AND_RETURN_FALSE(size > 0);
+  // The mapping stays valid after closing the file descriptor.
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  TEST_AND_RETURN_FALSE_ERRNO(data != MAP_FAILED);
+  source_mmap_ = static_cast<const uint8_t*>(data);
+  source_mmap_size_ = size;
+  return true;
+}
+
+std::unique_ptr<ExtentReader> DeltaPerformer::CreateSourceReader() const {
+  if (source_mmap_)
+    return std::make_unique<MmapExtentReader>(source_mmap_, source_mmap_size_);
+  return std::make_unique<DirectExtentReader>();
+}
+
+void DeltaPerformer::PrefetchSourceExtents(size_t partition_operation_num) {
+  if (!source_fd_)
+    return;
+  const PartitionUpdate& partition = manifest_.partitions(current_partition_);
+  const size_t end =
+      std::min<size_t>(partition_operation_num + kSourcePrefetchOperations,
+                       partition.operations_size());
+  source_prefetch_next_op_ =
+      std::max(source_prefetch_next_op_, partition_operation_num);
+
+  // The bytes already prefetched for the operations not applied yet.
+  uint64_t window_bytes = 0;
+  for (size_t i = partition_operation_num; i < source_prefetch_next_op_; i++)
+    window_bytes += GetSourceBytes(partition.operations(i), block_size_);
+
+  // The page cache is shared by all the file descriptors of the source
+  // partition, so prefetching with |source_fd_| serves every worker.
+  while (source_prefetch_next_op_ < end &&
+         window_bytes < kSourcePrefetchMaxBytes) {
+    const InstallOperation& operation =
+        partition.operations(source_prefetch_next_op_);
+    for (const Extent& extent : operation.src_extents()) {
+      if (extent.start_block() == kSparseHole ||
+          operation.type() == InstallOperation::PARTITION_COPY) {
+        continue;
+      }
+      if (!source_fd_->Readahead(extent.start_block() * block_size_,
+                                 extent.num_blocks() * block_size_)) {
+        LOG(INFO) << "Source partition read-ahead not supported, disabled.";
+        source_prefetch_next_op_ = partition.operations_size();
+        return;
+      }
+    }
+    window_bytes += GetSourceBytes(operation, block_size_);
+    source_prefetch_next_op_++;
+  }
+}
+
+const InstallOperation& DeltaPerformer::BatchZeroOrDiscardOperations(
+    size_t partition_operation_num, size_t* num_ops) {
+  const PartitionUpdate& partition = manifest_.partitions(current_partition_);
+  const InstallOperation& operation =
+      partition.operations(partition_operation_num);
+  *num_ops = 1;
+  if (operation.type() != InstallOperation::ZERO &&
+      operation.type() != InstallOperation::DISCARD) {
+    return operation;
+  }
+  // Only the following operations of the same type, without data, are
+  // batched. The other ones are left to fail on their own.
+  const size_t end =
+      std::min<size_t>(partition_operation_num + kMaxZeroOrDiscardBatchSize,
+                       partition.operations_size());
+  while (partition_operation_num + *num_ops < end) {
+    const InstallOperation& next_operation =
+        partition.operations(partition_operation_num + *num_ops);
+    if (next_operation.type() != operation.type() ||
+        next_operation.has_data_offset() || next_operation.has_data_length()) {
+      break;
+    }
+    (*num_ops)++;
+  }
+  if (*num_ops == 1)
+    return operation;
+
+  vector<Extent> extents;
+  for (size_t i = 0; i < *num_ops; i++) {
+    const InstallOperation& batched_operation =
+        partition.operations(partition_operation_num + i);
+    extents.insert(extents.end(),
+                   batched_operation.dst_extents().begin(),
+                   batched_operation.dst_extents().end());
+  }
+  std::sort(extents.begin(),
+            extents.end(),
+            [](const Extent& a, const Extent& b) {
+              return a.start_block() < b.start_block();
+            });
+
+  // The batch lives in the manifest arena, so it stays valid while queued in
+  // the |pipeline_|.
+  InstallOperation* batch =
+      google::protobuf::Arena::CreateMessage<InstallOperation>(
+          &manifest_arena_);
+  batch->set_type(operation.type());
+  for (const Extent& extent : extents) {
+    const int last = batch->dst_extents_size() - 1;
+    if (last >= 0 && batch->dst_extents(last).start_block() +
+                             batch->dst_extents(last).num_blocks() ==
+                         extent.start_block()) {
+      Extent* last_extent = batch->mutable_dst_extents(last);
+      last_extent->set_num_blocks(last_extent->num_blocks() +
+                                  extent.num_blocks());
+    } else {
+      *batch->add_dst_extents() = extent;
+    }
+  }
+  return *batch;
+}
+
+const InstallOperation& DeltaPerformer::BatchSourceCopyOperations(
+    size_t partition_operation_num,
+    size_t* num_ops,
+    const vector<const InstallOperation*>** batched_operations) {
+  const PartitionUpdate& partition = manifest_.partitions(current_partition_);
+  const InstallOperation& operation =
+      partition.operations(partition_operation_num);
+  *num_ops = 1;
+  *batched_operations = nullptr;
+  if (operation.type() != InstallOperation::SOURCE_COPY ||
+      operation.src_extents_size() == 0 || operation.dst_extents_size() == 0) {
+    return operation;
+  }
+
+  // Returns whether the |extents| start right after the |last| extent.
+  auto continues = [](const Extent& last,
+                      const RepeatedPtrField<Extent>& extents) {
+    return extents.size() > 0 && last.start_block() != kSparseHole &&
+           extents.Get(0).start_block() ==
+               last.start_block() + last.num_blocks();
+  };
+  const Extent* last_src = &operation.src_extents(
+      operation.src_extents_size() - 1);
+  const Extent* last_dst = &operation.dst_extents(
+      operation.dst_extents_size() - 1);
+  uint64_t batch_bytes = GetSourceBytes(operation, block_size_);
+  while (partition_operation_num + *num_ops <
+         static_cast<size_t>(partition.operations_size())) {
+    const InstallOperation& next_operation =
+        partition.operations(partition_operation_num + *num_ops);
+    uint64_t next_bytes = GetSourceBytes(next_operation, block_size_);
+    if (next_operation.type() != InstallOperation::SOURCE_COPY ||
+        next_operation.has_data_offset() || next_operation.has_data_length() ||
+        batch_bytes + next_bytes > kMaxSourceCopyBatchBytes ||
+        !continues(*last_src, next_operation.src_extents()) ||
+        !continues(*last_dst, next_operation.dst_extents())) {
+      break;
+    }
+    last_src =
+        &next_operation.src_extents(next_operation.src_extents_size() - 1);
+    last_dst =
+        &next_operation.dst_extents(next_operation.dst_extents_size() - 1);
+    batch_bytes += next_bytes;
+    (*num_ops)++;
+  }
+  if (*num_ops == 1)
+    return operation;
+
+  // Merges the |extent| into the last one of |extents| when it follows it.
+  auto append_extent = [](const Extent& extent,
+                          RepeatedPtrField<Extent>* extents) {
+    const int last = extents->size() - 1;
+    if (last >= 0 && extents->Get(last).start_block() +
+                             extents->Get(last).num_blocks() ==
+                         extent.start_block()) {
+      Extent* last_extent = extents->Mutable(last);
+      last_extent->set_num_blocks(last_extent->num_blocks() +
+                                  extent.num_blocks());
+    } else {
+      *extents->Add() = extent;
+    }
+  };
+  InstallOperation* batch =
+      google::protobuf::Arena::CreateMessage<InstallOperation>(
+          &manifest_arena_);
+  vector<const InstallOperation*>* operations =
+      google::protobuf::Arena::Create<vector<const InstallOperation*>>(
+          &manifest_arena_);
+  batch->set_type(InstallOperation::SOURCE_COPY);
+  for (size_t i = 0; i < *num_ops; i++) {
+    const InstallOperation& batched_operation =
+        partition.operations(partition_operation_num + i);
+    operations->push_back(&batched_operation);
+    for (const Extent& extent : batched_operation.src_extents())
+      append_extent(extent, batch->mutable_src_extents());
+    for (const Extent& extent : batched_operation.dst_extents())
+      append_extent(extent, batch->mutable_dst_extents());
+  }
+  *batched_operations = operations;
+  return *batch;
+}
+
+bool DeltaPerformer::QueueInstallOperation(
+    const InstallOperation& operation,
+    const vector<const InstallOperation*>* batched_operations,
+    size_t op_num,
+    ErrorCode* error) {
+  // The payload hashes are updated here, in download order; the worker threads
+  // only need the operation data.
+  std::unique_ptr<SegmentedBuffer> data(new SegmentedBuffer());
+  TakeBuffer(data.get());
+  size_t data_size = data->size();
+  OperationPipeline::Task task =
+      base::Bind(&DeltaPerformer::RunQueuedOperation,
+                 base::Unretained(this),
+                 base::Unretained(&operation),
+                 base::Unretained(batched_operations),
+                 base::Owned(data.release()),
+                 op_num);
+  if (!pipeline_->Push(task,
+                       data_size,
+                       operation.dst_extents(),
+                       IsExclusiveOperation(operation))) {
+    if (!pipeline_->HasFailed(error))
+      *error = ErrorCode::kDownloadOperationExecutionError;
+    return false;
+  }
+  pipeline_pushed_tasks_++;
+  return true;
+}
+
+bool DeltaPerformer::RunQueuedOperation(
+    const InstallOperation* operation,
+    const vector<const InstallOperation*>* batched_operations,
+    SegmentedBuffer* data,
+    size_t op_num,
+    size_t worker,
+    ErrorCode* error) {
+  const PartitionFds& fds = worker_fds_[worker];
+  base::TimeTicks apply_start_time = base::TimeTicks::Now();
+  bool op_result =
+      PerformInstallOperation(*operation, batched_operations, data, fds, error);
+  RecordApplyPhase(ApplyStats::Phase::kApply,
+                   *operation,
+                   op_num,
+                   apply_start_time,
+                   operation->data_length());
+  if (op_result)
+    RecordOperationApplied(*operation);
+  TEST_AND_RETURN_FALSE(HandleOpResult(
+      op_result, InstallOperationTypeName(operation->type()), op_num, error));
+  base::TimeTicks flush_start_time = base::TimeTicks::Now();
+  TEST_AND_RETURN_FALSE(fds.target->Flush());
+  RecordApplyPhase(
+      ApplyStats::Phase::kFlush, *operation, op_num, flush_start_time, 0);
+  return true;
+}
+
+void DeltaPerformer::RecordOperationApplied(
+    const InstallOperation& operation) {
+  if (apply_stats_) {
+    apply_stats_->RecordApplied(
+        operation.data_length(),
+        utils::BlocksInExtents(operation.dst_extents()) * block_size_);
+  }
+}
+
+void DeltaPerformer::RecordApplyPhase(ApplyStats::Phase phase,
+                                      const InstallOperation& operation,
+                                      size_t op_num,
+                                      base::TimeTicks start_time,
+                                      uint64_t bytes) {
+  if (apply_stats_)
+    apply_stats_->Record(phase, operation.type(), op_num, start_time, bytes);
+}
+
+bool DeltaPerformer::IsStreamedOperation(
+    const InstallOperation& operation) const {
+  if (operation.type() != InstallOperation::REPLACE &&
+      operation.type() != InstallOperation::REPLACE_BZ &&
+      operation.type() != InstallOperation::REPLACE_XZ &&
+      operation.type() != InstallOperation::REPLACE_ZSTD) {
+    return false;
+  }
+  // The signature blob is extracted from the dummy signature operation, so it
+  // must be buffered.
+  if (manifest_.has_signatures_offset() &&
+      manifest_.signatures_offset() == operation.data_offset()) {
+    return false;
+  }
+  return operation.data_length() >= kMinStreamedOperationSize;
+}
+
+bool DeltaPerformer::StreamReplaceOperation(const InstallOperation& operation,
+                                            const char** bytes_p,
+                                            size_t* count_p,
+                                            bool* done,
+                                            ErrorCode* error) {
+  *done = false;
+  const char* op_type_name = InstallOperationTypeName(operation.type());
+  if (!streamed_op_writer_) {
+    // The operations queued before it write to the same partition and must be
+    // applied first.
+    if (pipeline_ && !DrainPipeline(error))
+      return false;
+    // The pipeline workers are idle while the operation is streamed, so it
+    // can be decoded with as many threads.
+    streamed_op_writer_ = CreateReplaceWriter(
+        operation,
+        install_plan_->apply_threads,
+        zstd_dictionary_.get(),
+        &decoder_pool_,
+        // The runs of zeros are only zeroed once they end, so the operations
+        // checkpointed while streamed write them as they come.
+        operation.type() == InstallOperation::REPLACE ? nullptr
+                                                      : &zero_ioctl_supported_);
+    streamed_op_hash_calculator_.reset(new HashCalculator());
+    // When resuming in the middle of the operation, only the blocks after the
+    // checkpoint are written. Only uncompressed data can be resumed, since the
+    // decompressors state isn't persisted.
+    streamed_op_bytes_ = resumed_op_data_offset_;
+    resumed_op_data_offset_ = 0;
+    if (streamed_op_bytes_ > 0) {
+      LOG(INFO) << "Resuming operation " << next_operation_num_ << " after "
+                << streamed_op_bytes_ << " bytes.";
+      TEST_AND_RETURN_FALSE(HandleOpResult(
+          operation.type() == InstallOperation::REPLACE &&
+              streamed_op_bytes_ < operation.data_length() &&
+              streamed_op_bytes_ % block_size_ == 0 &&
+              streamed_op_hash_calculator_->SetContext(
+                  resumed_op_sha256_context_),
+          op_type_name,
+          next_operation_num_,
+          error));
+    }
+    TEST_AND_RETURN_FALSE(HandleOpResult(
+        buffer_.empty() &&
+            buffer_offset_ == operation.data_offset() + streamed_op_bytes_,
+        op_type_name,
+        next_operation_num_,
+        error));
+    streamed_op_extents_ = SkipExtentBlocks(operation.dst_extents(),
+                                            streamed_op_bytes_ / block_size_);
+    TEST_AND_RETURN_FALSE(HandleOpResult(
+        streamed_op_writer_->Init(
+            worker_fds_[0].target, streamed_op_extents_, block_size_),
+        op_type_name,
+        next_operation_num_,
+        error));
+  }
+
+  // Checkpoints are only taken for uncompressed operations, at block
+  // boundaries.
+  const bool checkpointed = operation.type() == InstallOperation::REPLACE &&
+                            kStreamedOperationCheckpointSize % block_size_ == 0;
+  while (*count_p > 0 && streamed_op_bytes_ < operation.data_length()) {
+    uint64_t read_len =
+        min<uint64_t>(*count_p, operation.data_length() - streamed_op_bytes_);
+    // Stop at the next checkpoint.
+    if (checkpointed) {
+      read_len = min<uint64_t>(
+          read_len,
+          kStreamedOperationCheckpointSize -
+              streamed_op_bytes_ % kStreamedOperationCheckpointSize);
+    }
+    TEST_AND_RETURN_FALSE(HandleOpResult(
+        streamed_op_writer_->Write(*bytes_p, read_len),
+        op_type_name,
+        next_operation_num_,
+        error));
+    HashCalculator::UpdateMultiple({streamed_op_hash_calculator_.get(),
+                                    &payload_hash_calculator_,
+                                    &signed_hash_calculator_},
+                                   *bytes_p,
+                                   read_len);
+    buffer_offset_ += read_len;
+    streamed_op_bytes_ += read_len;
+    *bytes_p += read_len;
+    *count_p -= read_len;
+    if (checkpointed && streamed_op_bytes_ < operation.data_length() &&
+        streamed_op_bytes_ % kStreamedOperationCheckpointSize == 0) {
+      TEST_AND_RETURN_FALSE(CheckpointStreamedOperation(operation));
+    }
+  }
+  if (streamed_op_bytes_ < operation.data_length())
+    return true;
+
+  std::unique_ptr<ExtentWriter> writer = std::move(streamed_op_writer_);
+  std::unique_ptr<HashCalculator> op_hash_calculator =
+      std::move(streamed_op_hash_calculator_);
+  TEST_AND_RETURN_FALSE(HandleOpResult(
+      writer->End(), op_type_name, next_operation_num_, error));
+  base::TimeTicks flush_start_time = base::TimeTicks::Now();
+  TEST_AND_RETURN_FALSE(worker_fds_[0].target->Flush());
+  RecordApplyPhase(ApplyStats::Phase::kFlush,
+                   operation,
+                   next_operation_num_,
+                   flush_start_time,
+                   0);
+
+  // The data was written as it arrived, so the hash can only be checked now.
+  // On mismatch the update fails before the operation is checkpointed, and the
+  // target partition is left as unbootable as with any other failed update.
+  if (!payload_->metadata_signature.empty()) {
+    base::TimeTicks hash_start_time = base::TimeTicks::Now();
+    *error = ValidateOperationHash(operation, op_hash_calculator.get());
+    RecordApplyPhase(ApplyStats::Phase::kHash,
+                     operation,
+                     next_operation_num_,
+                     hash_start_time,
+                     0);
+    if (*error != ErrorCode::kSuccess) {
+      if (install_plan_->hash_checks_mandatory) {
+        LOG(ERROR) << "Mandatory operation hash check failed";
+        return false;
+      }
+
+      // For non-mandatory cases, just send a UMA stat.
+      LOG(WARNING) << "Ignoring operation validation errors";
+      *error = ErrorCode::kSuccess;
+    }
+  }
+  *done = true;
+  return true;
+}
+
+bool DeltaPerformer::CheckpointStreamedOperation(
+    const InstallOperation& operation) {
+  // The data written so far must be on disk before it is checkpointed.
+  TEST_AND_RETURN_FALSE(worker_fds_[0].target->Flush());
+  Checkpoint checkpoint = MakeCheckpoint();
+  checkpoint.next_data_length = operation.data_length() - streamed_op_bytes_;
+  checkpoint.operation_data_offset = streamed_op_bytes_;
+  checkpoint.operation_sha256_context =
+      streamed_op_hash_calculator_->GetContext();
+
+  ScopedTerminatorExitUnblocker exit_unblocker =
+      ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+  Terminator::set_exit_blocked(true);
+  return WriteCheckpoint(checkpoint);
+}
+
+bool DeltaPerformer::IsExclusiveOperation(const InstallOperation& operation) {
+  // MOVE and BSDIFF read their source blocks from the target partition, which
+  // other operations may be writing to.
+  return operation.type() == InstallOperation::MOVE ||
+         operation.type() == InstallOperation::BSDIFF;
+}
+
+bool DeltaPerformer::NeedsContiguousData(const InstallOperation& operation) {
+  return operation.type() == InstallOperation::BSDIFF ||
+         operation.type() == InstallOperation::SOURCE_BSDIFF ||
+         operation.type() == InstallOperation::BROTLI_BSDIFF ||
+         operation.type() == InstallOperation::PUFFDIFF;
+}
+
+google::protobuf::ArenaOptions DeltaPerformer::ManifestArenaOptions() {
+  google::protobuf::ArenaOptions options;
+  options.start_block_size = kManifestArenaStartBlockSize;
+  options.max_block_size = kManifestArenaMaxBlockSize;
+  return options;
+}
+
+bool DeltaPerformer::CommitPipelineCheckpoints(ErrorCode* error, bool force) {
+  if (pipeline_->HasFailed(error))
+    return false;
+  if (!force && !IsCheckpointDue())
+    return true;
+
+  // Only the latest checkpoint whose operations were all applied needs to be
+  // persisted.
+  size_t num_completed = pipeline_->num_completed();
+  bool has_checkpoint = false;
+  Checkpoint checkpoint;
+  while (!pending_checkpoints_.empty() &&
+         pending_checkpoints_.front().required_tasks <= num_completed) {
+    checkpoint = std::move(pending_checkpoints_.front());
+    pending_checkpoints_.pop_front();
+    has_checkpoint = true;
+  }
+  if (has_checkpoint) {
+    Terminator::set_exit_blocked(true);
+    WriteCheckpoint(checkpoint);
+  }
+  return true;
+}
+
+bool DeltaPerformer::DrainPipeline(ErrorCode* error) {
+  if (!pipeline_->Drain(error))
+    return false;
+  return CommitPipelineCheckpoints(error, true);
+}
+
+void DeltaPerformer::UpdatePipelineWorkers() {
+  if (!io_limiter_)
+    return;
+  pipeline_->SetMaxActiveWorkers(GetActiveApplyWorkers());
+  // The caches are split between the workers running, which change with the
+  // performance mode.
+  if (target_fd_ && io_limiter_->performance_mode() != cache_performance_mode_)
+    UpdateCacheSizes();
+}
+
+size_t DeltaPerformer::GetActiveApplyWorkers() const {
+  if (!pipeline_)
+    return 1;
+  if (!io_limiter_ || io_limiter_->performance_mode())
+    return pipeline_->num_workers();
+  return std::min(std::max<size_t>(install_plan_->apply_threads, 1),
+                  pipeline_->num_workers());
+}
+
+void DeltaPerformer::UpdateCacheSizes() {
+  cache_performance_mode_ = io_limiter_ && io_limiter_->performance_mode();
+  const size_t active_workers = GetActiveApplyWorkers();
+  write_cache_size_ = GetWriteCacheSize(
+      target_path_, target_size_, active_workers, cache_performance_mode_);
+  puff_cache_size_ = GetPuffCacheSize(active_workers, cache_performance_mode_);
+}
+
 bool DeltaPerformer::IsManifestValid() {
   return manifest_valid_;
 }
 
 bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
-  if (major_payload_version_ == kBrilloMajorPayloadVersion) {
-    partitions_.clear();
-    for (const PartitionUpdate& partition : manifest_.partitions()) {
-      partitions_.push_back(partition);
-    }
-    manifest_.clear_partitions();
-  } else if (major_payload_version_ == kChromeOSMajorPayloadVersion) {
+  // The partitions of a major version 2 manifest are used in place.
+  if (major_payload_version_ == kChromeOSMajorPayloadVersion) {
     LOG(INFO) << "Converting update information from old format.";
-    PartitionUpdate root_part;
-    root_part.set_partition_name(kLegacyPartitionNameRoot);
+    // The new partitions are allocated in the same arena as the manifest, so
+    // the operations are moved over without copying them.
+    PartitionUpdate* root_part = manifest_.add_partitions();
+    root_part->set_partition_name(kLegacyPartitionNameRoot);
 #ifdef __ANDROID__
     LOG(WARNING) << "Legacy payload major version provided to an Android "
                     "build. Assuming no post-install. Please use major version "
                     "2 or newer.";
-    root_part.set_run_postinstall(false);
+    root_part->set_run_postinstall(false);
 #else
-    root_part.set_run_postinstall(true);
+    root_part->set_run_postinstall(true);
 #endif  // __ANDROID__
     if (manifest_.has_old_rootfs_info()) {
-      *root_part.mutable_old_partition_info() = manifest_.old_rootfs_info();
+      *root_part->mutable_old_partition_info() = manifest_.old_rootfs_info();
       manifest_.clear_old_rootfs_info();
     }
     if (manifest_.has_new_rootfs_info()) {
-      *root_part.mutable_new_partition_info() = manifest_.new_rootfs_info();
+      *root_part->mutable_new_partition_info() = manifest_.new_rootfs_info();
       manifest_.clear_new_rootfs_info();
     }
-    *root_part.mutable_operations() = manifest_.install_operations();
-    manifest_.clear_install_operations();
-    partitions_.push_back(std::move(root_part));
+    root_part->mutable_operations()->Swap(
+        manifest_.mutable_install_operations());
 
-    PartitionUpdate kern_part;
-    kern_part.set_partition_name(kLegacyPartitionNameKernel);
-    kern_part.set_run_postinstall(false);
+    PartitionUpdate* kern_part = manifest_.add_partitions();
+    kern_part->set_partition_name(kLegacyPartitionNameKernel);
+    kern_part->set_run_postinstall(false);
     if (manifest_.has_old_kernel_info()) {
-      *kern_part.mutable_old_partition_info() = manifest_.old_kernel_info();
+      *kern_part->mutable_old_partition_info() = manifest_.old_kernel_info();
       manifest_.clear_old_kernel_info();
     }
     if (manifest_.has_new_kernel_info()) {
-      *kern_part.mutable_new_partition_info() = manifest_.new_kernel_info();
+      *kern_part->mutable_new_partition_info() = manifest_.new_kernel_info();
       manifest_.clear_new_kernel_info();
     }
-    *kern_part.mutable_operations() = manifest_.kernel_install_operations();
-    manifest_.clear_kernel_install_operations();
-    partitions_.push_back(std::move(kern_part));
+    kern_part->mutable_operations()->Swap(
+        manifest_.mutable_kernel_install_operations());
   }
 
   // Fill in the InstallPlan::partitions based on the partitions from the
   // payload.
-  for (const auto& partition : partitions_) {
+  for (const auto& partition : manifest_.partitions()) {
     InstallPlan::Partition install_part;
     install_part.name = partition.partition_name();
     install_part.run_postinstall =
@@ -804,6 +1996,7 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
                                             : kPostinstallDefaultScript);
       install_part.filesystem_type = partition.filesystem_type();
       install_part.postinstall_optional = partition.postinstall_optional();
+      install_part.postinstall_parallel = partition.postinstall_parallel();
     }
 
     if (partition.has_old_partition_info()) {
@@ -822,6 +2015,35 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
     install_part.target_size = info.size();
     install_part.target_hash.assign(info.hash().begin(), info.hash().end());
 
+    install_part.block_size = manifest_.block_size();
+    if (partition.has_hash_tree_extent()) {
+      const Extent& data_extent = partition.hash_tree_data_extent();
+      const Extent& tree_extent = partition.hash_tree_extent();
+      install_part.hash_tree_data_offset =
+          data_extent.start_block() * install_part.block_size;
+      install_part.hash_tree_data_size =
+          data_extent.num_blocks() * install_part.block_size;
+      install_part.hash_tree_offset =
+          tree_extent.start_block() * install_part.block_size;
+      install_part.hash_tree_size =
+          tree_extent.num_blocks() * install_part.block_size;
+      install_part.hash_tree_algorithm = partition.hash_tree_algorithm();
+      install_part.hash_tree_salt.assign(partition.hash_tree_salt().begin(),
+                                         partition.hash_tree_salt().end());
+    }
+    if (partition.has_fec_extent()) {
+      const Extent& data_extent = partition.fec_data_extent();
+      const Extent& fec_extent = partition.fec_extent();
+      install_part.fec_data_offset =
+          data_extent.start_block() * install_part.block_size;
+      install_part.fec_data_size =
+          data_extent.num_blocks() * install_part.block_size;
+      install_part.fec_offset =
+          fec_extent.start_block() * install_part.block_size;
+      install_part.fec_size = fec_extent.num_blocks() * install_part.block_size;
+      install_part.fec_roots = partition.fec_roots();
+    }
+
     install_plan_->partitions.push_back(install_part);
   }
 
@@ -830,10 +2052,29 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
     *error = ErrorCode::kInstallDeviceOpenError;
     return false;
   }
-  LogPartitionInfo(partitions_);
+  LogPartitionInfo(manifest_.partitions());
   return true;
 }
 
+bool DeltaPerformer::IsOperationApplied(const InstallOperation& operation) {
+  if (!operation.has_dst_sha256_hash() || IsExclusiveOperation(operation))
+    return false;
+  base::TimeTicks hash_start_time = base::TimeTicks::Now();
+  brillo::Blob dst_hash;
+  if (!fd_utils::ReadAndHashExtents(
+          target_fd_, operation.dst_extents(), block_size_, &dst_hash)) {
+    return false;
+  }
+  RecordApplyPhase(ApplyStats::Phase::kHash,
+                   operation,
+                   next_operation_num_,
+                   hash_start_time,
+                   0);
+  brillo::Blob expected_dst_hash(operation.dst_sha256_hash().begin(),
+                                 operation.dst_sha256_hash().end());
+  return dst_hash == expected_dst_hash;
+}
+
 bool DeltaPerformer::CanPerformInstallOperation(
     const chromeos_update_engine::InstallOperation& operation) {
   // If we don't have a data blob we can apply it right away.
@@ -851,46 +2092,40 @@ bool DeltaPerformer::CanPerformInstallOperation(
 }
 
 bool DeltaPerformer::PerformReplaceOperation(
-    const InstallOperation& operation) {
+    const InstallOperation& operation,
+    const SegmentedBuffer& data,
+    const PartitionFds& fds) {
   CHECK(operation.type() == InstallOperation::REPLACE ||
         operation.type() == InstallOperation::REPLACE_BZ ||
-        operation.type() == InstallOperation::REPLACE_XZ);
-
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+        operation.type() == InstallOperation::REPLACE_XZ ||
+        operation.type() == InstallOperation::REPLACE_ZSTD);
 
-  // Extract the signature message if it's in this operation.
-  if (ExtractSignatureMessageFromOperation(operation)) {
-    // If this is dummy replace operation, we ignore it after extracting the
-    // signature.
-    DiscardBuffer(true, 0);
-    return true;
-  }
+  TEST_AND_RETURN_FALSE(data.size() >= operation.data_length());
 
   // Setup the ExtentWriter stack based on the operation type.
-  std::unique_ptr<ExtentWriter> writer = std::make_unique<ZeroPadExtentWriter>(
-      std::make_unique<DirectExtentWriter>());
-
-  if (operation.type() == InstallOperation::REPLACE_BZ) {
-    writer.reset(new BzipExtentWriter(std::move(writer)));
-  } else if (operation.type() == InstallOperation::REPLACE_XZ) {
-    writer.reset(new XzExtentWriter(std::move(writer)));
-  }
-
+  std::unique_ptr<ExtentWriter> writer =
+      CreateReplaceWriter(operation,
+                          1,
+                          zstd_dictionary_.get(),
+                          &decoder_pool_,
+                          &zero_ioctl_supported_);
   TEST_AND_RETURN_FALSE(
-      writer->Init(target_fd_, operation.dst_extents(), block_size_));
-  TEST_AND_RETURN_FALSE(writer->Write(buffer_.data(), operation.data_length()));
+      writer->Init(fds.target, operation.dst_extents(), block_size_));
+  // The writers stream the data, so feed them the segments as they are.
+  uint64_t remaining = operation.data_length();
+  for (const SegmentedBuffer::Segment& segment : data.segments()) {
+    if (remaining == 0)
+      break;
+    size_t chunk = min<uint64_t>(remaining, segment.size());
+    TEST_AND_RETURN_FALSE(writer->Write(segment.data(), chunk));
+    remaining -= chunk;
+  }
   TEST_AND_RETURN_FALSE(writer->End());
-
-  // Update buffer
-  DiscardBuffer(true, buffer_.size());
   return true;
 }
 
 bool DeltaPerformer::PerformZeroOrDiscardOperation(
-    const InstallOperation& operation) {
+    const InstallOperation& operation, const PartitionFds& fds) {
   CHECK(operation.type() == InstallOperation::DISCARD ||
         operation.type() == InstallOperation::ZERO);
 
@@ -898,38 +2133,46 @@ bool DeltaPerformer::PerformZeroOrDiscardOperation(
   TEST_AND_RETURN_FALSE(!operation.has_data_offset());
   TEST_AND_RETURN_FALSE(!operation.has_data_length());
 
+  // Whether the target partition supports the ioctl is found out by the first
+  // operation trying it, and remembered until the partition is closed.
+  std::atomic<bool>* ioctl_supported =
+      (operation.type() == InstallOperation::ZERO ? &zero_ioctl_supported_
+                                                  : &discard_ioctl_supported_);
 #ifdef BLKZEROOUT
-  bool attempt_ioctl = true;
   int request =
       (operation.type() == InstallOperation::ZERO ? BLKZEROOUT : BLKDISCARD);
 #else  // !defined(BLKZEROOUT)
-  bool attempt_ioctl = false;
+  *ioctl_supported = false;
   int request = 0;
 #endif  // !defined(BLKZEROOUT)
 
-  brillo::Blob zeros;
+  // The zero buffer of the fallback is shared by all the operations.
+  static const brillo::Blob* const zeros = new brillo::Blob(kZeroBufferSize);
   for (const Extent& extent : operation.dst_extents()) {
     const uint64_t start = extent.start_block() * block_size_;
     const uint64_t length = extent.num_blocks() * block_size_;
-    if (attempt_ioctl) {
+    if (*ioctl_supported) {
       int result = 0;
-      if (target_fd_->BlkIoctl(request, start, length, &result) && result == 0)
+      if (fds.target->BlkIoctl(request, start, length, &result) && result == 0)
         continue;
-      attempt_ioctl = false;
+      LOG(INFO) << "Target partition doesn't support "
+                << InstallOperationTypeName(operation.type())
+                << " ioctl, writing zeros instead.";
+      *ioctl_supported = false;
     }
     // In case of failure, we fall back to writing 0 to the selected region.
-    zeros.resize(16 * block_size_);
-    for (uint64_t offset = 0; offset < length; offset += zeros.size()) {
+    for (uint64_t offset = 0; offset < length; offset += zeros->size()) {
       uint64_t chunk_length = min(length - offset,
-                                  static_cast<uint64_t>(zeros.size()));
+                                  static_cast<uint64_t>(zeros->size()));
       TEST_AND_RETURN_FALSE(utils::PWriteAll(
-          target_fd_, zeros.data(), chunk_length, start + offset));
+          fds.target, zeros->data(), chunk_length, start + offset));
     }
   }
   return true;
 }
 
-bool DeltaPerformer::PerformMoveOperation(const InstallOperation& operation) {
+bool DeltaPerformer::PerformMoveOperation(const InstallOperation& operation,
+                                          const PartitionFds& fds) {
   // Calculate buffer size. Note, this function doesn't do a sliding
   // window to copy in case the source and destination blocks overlap.
   // If we wanted to do a sliding window, we could program the server
@@ -944,7 +2187,7 @@ bool DeltaPerformer::PerformMoveOperation(const InstallOperation& operation) {
     blocks_to_write += operation.dst_extents(i).num_blocks();
 
   DCHECK_EQ(blocks_to_write, blocks_to_read);
-  brillo::Blob buf(blocks_to_write * block_size_);
+  PooledBlob buf(blocks_to_write * block_size_);
 
   // Read in bytes.
   ssize_t bytes_read = 0;
@@ -953,8 +2196,8 @@ bool DeltaPerformer::PerformMoveOperation(const InstallOperation& operation) {
     const Extent& extent = operation.src_extents(i);
     const size_t bytes = extent.num_blocks() * block_size_;
     TEST_AND_RETURN_FALSE(extent.start_block() != kSparseHole);
-    TEST_AND_RETURN_FALSE(utils::PReadAll(target_fd_,
-                                          &buf[bytes_read],
+    TEST_AND_RETURN_FALSE(utils::PReadAll(fds.target,
+                                          buf.data() + bytes_read,
                                           bytes,
                                           extent.start_block() * block_size_,
                                           &bytes_read_this_iteration));
@@ -969,8 +2212,8 @@ bool DeltaPerformer::PerformMoveOperation(const InstallOperation& operation) {
     const Extent& extent = operation.dst_extents(i);
     const size_t bytes = extent.num_blocks() * block_size_;
     TEST_AND_RETURN_FALSE(extent.start_block() != kSparseHole);
-    TEST_AND_RETURN_FALSE(utils::PWriteAll(target_fd_,
-                                           &buf[bytes_written],
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(fds.target,
+                                           buf.data() + bytes_written,
                                            bytes,
                                            extent.start_block() * block_size_));
     bytes_written += bytes;
@@ -1019,30 +2262,127 @@ bool DeltaPerformer::ValidateSourceHash(const brillo::Blob& calculated_hash,
 }
 
 bool DeltaPerformer::PerformSourceCopyOperation(
-    const InstallOperation& operation, ErrorCode* error) {
-  if (operation.has_src_length())
-    TEST_AND_RETURN_FALSE(operation.src_length() % block_size_ == 0);
-  if (operation.has_dst_length())
-    TEST_AND_RETURN_FALSE(operation.dst_length() % block_size_ == 0);
-
-  brillo::Blob source_hash;
-  TEST_AND_RETURN_FALSE(fd_utils::CopyAndHashExtents(source_fd_,
-                                                     operation.src_extents(),
-                                                     target_fd_,
-                                                     operation.dst_extents(),
-                                                     block_size_,
-                                                     &source_hash));
-
-  if (operation.has_src_sha256_hash()) {
-    TEST_AND_RETURN_FALSE(
-        ValidateSourceHash(source_hash, operation, source_fd_, error));
+    const InstallOperation& operation,
+    const vector<const InstallOperation*>* batched_operations,
+    const PartitionFds& fds,
+    ErrorCode* error) {
+  // A batch is copied at once, but each of its operations is checked over its
+  // own source blocks.
+  const vector<const InstallOperation*> operations =
+      batched_operations ? *batched_operations
+                         : vector<const InstallOperation*>{&operation};
+  // The source data isn't hashed if it doesn't need to be checked.
+  bool check_source = false;
+  for (const InstallOperation* op : operations) {
+    if (op->has_src_length())
+      TEST_AND_RETURN_FALSE(op->src_length() % block_size_ == 0);
+    if (op->has_dst_length())
+      TEST_AND_RETURN_FALSE(op->dst_length() % block_size_ == 0);
+    check_source |= op->has_src_sha256_hash() && !source_verified_;
+  }
+  vector<brillo::Blob> source_hashes;
+
+  if (install_plan_->clone_source_copy && copy_range_supported_) {
+    // The source is checked before it is copied, since the kernel copies the
+    // data without reading it here.
+    if (check_source) {
+      for (const InstallOperation* op : operations) {
+        if (!op->has_src_sha256_hash())
+          continue;
+        brillo::Blob source_hash;
+        TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
+            fds.source, op->src_extents(), block_size_, &source_hash));
+        TEST_AND_RETURN_FALSE(
+            ValidateSourceHash(source_hash, *op, fds.source, error));
+      }
+    }
+    if (fd_utils::CopyExtentsRange(fds.source,
+                                   operation.src_extents(),
+                                   fds.target,
+                                   operation.dst_extents(),
+                                   block_size_)) {
+      return true;
+    }
+    LOG(INFO) << "The partitions don't support copying ranges, copying the "
+              << "SOURCE_COPY data instead.";
+    copy_range_supported_ = false;
+  }
+  vector<uint64_t> run_blocks;
+  if (check_source) {
+    for (const InstallOperation* op : operations)
+      run_blocks.push_back(utils::BlocksInExtents(op->src_extents()));
+  }
+  TEST_AND_RETURN_FALSE(
+      fd_utils::CopyAndHashExtentRuns(fds.source,
+                                      operation.src_extents(),
+                                      fds.target,
+                                      operation.dst_extents(),
+                                      block_size_,
+                                      run_blocks,
+                                      &source_hashes));
+
+  if (check_source) {
+    for (size_t i = 0; i < operations.size(); i++) {
+      if (!operations[i]->has_src_sha256_hash())
+        continue;
+      TEST_AND_RETURN_FALSE(ValidateSourceHash(
+          source_hashes[i], *operations[i], fds.source, error));
+    }
   }
 
   return true;
 }
 
+bool DeltaPerformer::PerformPartitionCopyOperation(
+    const InstallOperation& operation,
+    const PartitionFds& fds,
+    ErrorCode* error) {
+  const InstallPlan::Partition* source_part = nullptr;
+  for (const InstallPlan::Partition& install_part : install_plan_->partitions) {
+    if (install_part.name == operation.src_partition_name())
+      source_part = &install_part;
+  }
+  if (!source_part || source_part->source_path.empty()) {
+    LOG(ERROR) << "The source partition " << operation.src_partition_name()
+               << " of the PARTITION_COPY operation isn't updated.";
+    return false;
+  }
+  // The hash of the whole source partition checked by VerifySourcePartition()
+  // doesn't cover another partition, so its source is always checked.
+  if (!operation.has_src_sha256_hash()) {
+    LOG(ERROR) << "The PARTITION_COPY operation from "
+               << operation.src_partition_name() << " has no source hash.";
+    *error = ErrorCode::kDownloadOperationHashMissingError;
+    return false;
+  }
+
+  // The source partitions are never written while updating, so the source of
+  // any partition can be read while the others are written. It is opened by
+  // each operation since it may be applied by any pipeline worker.
+  int err;
+  FileDescriptorPtr source_fd = OpenFile(source_part->source_path.c_str(),
+                                         O_RDONLY,
+                                         0,
+                                         1,
+                                         FileIoMode::kBuffered,
+                                         io_trace_,
+                                         &err);
+  TEST_AND_RETURN_FALSE(source_fd);
+  brillo::Blob source_hash;
+  bool result = fd_utils::CopyAndHashExtents(source_fd,
+                                             operation.src_extents(),
+                                             fds.target,
+                                             operation.dst_extents(),
+                                             block_size_,
+                                             &source_hash);
+  if (result)
+    result = ValidateSourceHash(source_hash, operation, source_fd, error);
+  source_fd->Close();
+  return result;
+}
+
 bool DeltaPerformer::ExtentsToBsdiffPositionsString(
-    const RepeatedPtrField<Extent>& extents,
+    ExtentSpan extents,
     uint64_t block_size,
     uint64_t full_length,
     string* positions_string) {
@@ -1063,11 +2403,10 @@ bool DeltaPerformer::ExtentsToBsdiffPositionsString(
   return true;
 }
 
-bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation) {
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation,
+                                            const brillo::Blob& data,
+                                            const PartitionFds& fds) {
+  TEST_AND_RETURN_FALSE(data.size() >= operation.data_length());
 
   string input_positions;
   TEST_AND_RETURN_FALSE(ExtentsToBsdiffPositionsString(operation.src_extents(),
@@ -1080,13 +2419,19 @@ bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation) {
                                                        operation.dst_length(),
                                                        &output_positions));
 
+  // bspatch writes to the partition without going through |fds.target|.
+  if (write_hasher_) {
+    for (const Extent& extent : operation.dst_extents()) {
+      write_hasher_->InvalidateRange(extent.start_block() * block_size_,
+                                     extent.num_blocks() * block_size_);
+    }
+  }
   TEST_AND_RETURN_FALSE(bsdiff::bspatch(target_path_.c_str(),
                                         target_path_.c_str(),
-                                        buffer_.data(),
-                                        buffer_.size(),
+                                        data.data(),
+                                        data.size(),
                                         input_positions.c_str(),
                                         output_positions.c_str()) == 0);
-  DiscardBuffer(true, buffer_.size());
 
   if (operation.dst_length() % block_size_) {
     // Zero out rest of final block.
@@ -1099,7 +2444,7 @@ bool DeltaPerformer::PerformBsdiffOperation(const InstallOperation& operation) {
         end_byte - (block_size_ - operation.dst_length() % block_size_);
     brillo::Blob zeros(end_byte - begin_byte);
     TEST_AND_RETURN_FALSE(utils::PWriteAll(
-        target_fd_, zeros.data(), end_byte - begin_byte, begin_byte));
+        fds.target, zeros.data(), end_byte - begin_byte, begin_byte));
   }
   return true;
 }
@@ -1173,50 +2518,49 @@ class BsdiffExtentFile : public bsdiff::FileInterface {
 }  // namespace
 
 bool DeltaPerformer::PerformSourceBsdiffOperation(
-    const InstallOperation& operation, ErrorCode* error) {
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+    const InstallOperation& operation,
+    const brillo::Blob& data,
+    const PartitionFds& fds,
+    ErrorCode* error) {
+  TEST_AND_RETURN_FALSE(data.size() >= operation.data_length());
   if (operation.has_src_length())
     TEST_AND_RETURN_FALSE(operation.src_length() % block_size_ == 0);
   if (operation.has_dst_length())
     TEST_AND_RETURN_FALSE(operation.dst_length() % block_size_ == 0);
 
-  if (operation.has_src_sha256_hash()) {
+  if (operation.has_src_sha256_hash() && !source_verified_) {
     brillo::Blob source_hash;
     TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
-        source_fd_, operation.src_extents(), block_size_, &source_hash));
+        fds.source, operation.src_extents(), block_size_, &source_hash));
     TEST_AND_RETURN_FALSE(
-        ValidateSourceHash(source_hash, operation, source_fd_, error));
+        ValidateSourceHash(source_hash, operation, fds.source, error));
   }
 
-  auto reader = std::make_unique<DirectExtentReader>();
+  std::unique_ptr<ExtentReader> reader = CreateSourceReader();
   TEST_AND_RETURN_FALSE(
-      reader->Init(source_fd_, operation.src_extents(), block_size_));
+      reader->Init(fds.source, operation.src_extents(), block_size_));
   auto src_file = std::make_unique<BsdiffExtentFile>(
       std::move(reader),
       utils::BlocksInExtents(operation.src_extents()) * block_size_);
 
   auto writer = std::make_unique<DirectExtentWriter>();
   TEST_AND_RETURN_FALSE(
-      writer->Init(target_fd_, operation.dst_extents(), block_size_));
+      writer->Init(fds.target, operation.dst_extents(), block_size_));
   auto dst_file = std::make_unique<BsdiffExtentFile>(
       std::move(writer),
       utils::BlocksInExtents(operation.dst_extents()) * block_size_);
 
   TEST_AND_RETURN_FALSE(bsdiff::bspatch(std::move(src_file),
                                         std::move(dst_file),
-                                        buffer_.data(),
-                                        buffer_.size()) == 0);
-  DiscardBuffer(true, buffer_.size());
+                                        data.data(),
+                                        data.size()) == 0);
   return true;
 }
 
 namespace {
 
-// A class to be passed to |puffpatch| for reading from |source_fd_| and writing
-// into |target_fd_|.
+// A class to be passed to |puffpatch| for reading from the source partition and
+// writing into the target partition.
 class PuffinExtentStream : public puffin::StreamInterface {
  public:
   // Constructor for creating a stream for reading from an |ExtentReader|.
@@ -1294,41 +2638,38 @@ class PuffinExtentStream : public puffin::StreamInterface {
 }  // namespace
 
 bool DeltaPerformer::PerformPuffDiffOperation(const InstallOperation& operation,
+                                              const brillo::Blob& data,
+                                              const PartitionFds& fds,
                                               ErrorCode* error) {
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+  TEST_AND_RETURN_FALSE(data.size() >= operation.data_length());
 
-  if (operation.has_src_sha256_hash()) {
+  if (operation.has_src_sha256_hash() && !source_verified_) {
     brillo::Blob source_hash;
     TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
-        source_fd_, operation.src_extents(), block_size_, &source_hash));
+        fds.source, operation.src_extents(), block_size_, &source_hash));
     TEST_AND_RETURN_FALSE(
-        ValidateSourceHash(source_hash, operation, source_fd_, error));
+        ValidateSourceHash(source_hash, operation, fds.source, error));
   }
 
-  auto reader = std::make_unique<DirectExtentReader>();
+  std::unique_ptr<ExtentReader> reader = CreateSourceReader();
   TEST_AND_RETURN_FALSE(
-      reader->Init(source_fd_, operation.src_extents(), block_size_));
+      reader->Init(fds.source, operation.src_extents(), block_size_));
   puffin::UniqueStreamPtr src_stream(new PuffinExtentStream(
       std::move(reader),
       utils::BlocksInExtents(operation.src_extents()) * block_size_));
 
   auto writer = std::make_unique<DirectExtentWriter>();
   TEST_AND_RETURN_FALSE(
-      writer->Init(target_fd_, operation.dst_extents(), block_size_));
+      writer->Init(fds.target, operation.dst_extents(), block_size_));
   puffin::UniqueStreamPtr dst_stream(new PuffinExtentStream(
       std::move(writer),
       utils::BlocksInExtents(operation.dst_extents()) * block_size_));
 
-  const size_t kMaxCacheSize = 5 * 1024 * 1024;  // Total 5MB cache.
   TEST_AND_RETURN_FALSE(puffin::PuffPatch(std::move(src_stream),
                                           std::move(dst_stream),
-                                          buffer_.data(),
-                                          buffer_.size(),
-                                          kMaxCacheSize));
-  DiscardBuffer(true, buffer_.size());
+                                          data.data(),
+                                          data.size(),
+                                          puff_cache_size_));
   return true;
 }
 
@@ -1349,9 +2690,9 @@ bool DeltaPerformer::ExtractSignatureMessage() {
   TEST_AND_RETURN_FALSE(signatures_message_data_.empty());
   TEST_AND_RETURN_FALSE(buffer_offset_ == manifest_.signatures_offset());
   TEST_AND_RETURN_FALSE(buffer_.size() >= manifest_.signatures_size());
-  signatures_message_data_.assign(
-      buffer_.begin(),
-      buffer_.begin() + manifest_.signatures_size());
+  const brillo::Blob& data = buffer_.Flatten();
+  signatures_message_data_.assign(data.begin(),
+                                  data.begin() + manifest_.signatures_size());
 
   // Save the signature blob because if the update is interrupted after the
   // download phase we don't go through this path anymore. Some alternatives to
@@ -1373,16 +2714,37 @@ bool DeltaPerformer::ExtractSignatureMessage() {
   return true;
 }
 
-bool DeltaPerformer::GetPublicKeyFromResponse(base::FilePath *out_tmp_key) {
+bool DeltaPerformer::GetPublicKeyFromResponse(
+    std::shared_ptr<const PublicKey>* out_public_key) {
   if (hardware_->IsOfficialBuild() ||
       utils::FileExists(public_key_path_.c_str()) ||
       install_plan_->public_key_rsa.empty())
     return false;
 
-  if (!utils::DecodeAndStoreBase64String(install_plan_->public_key_rsa,
-                                         out_tmp_key))
+  string pem;
+  if (!brillo::data_encoding::Base64Decode(install_plan_->public_key_rsa,
+                                           &pem)) {
+    LOG(ERROR) << "Unable to decode base64 public key: "
+               << install_plan_->public_key_rsa;
     return false;
+  }
+  *out_public_key = public_key_cache_->GetKeyFromPem(pem);
+  return true;
+}
 
+bool DeltaPerformer::GetPublicKey(
+    std::shared_ptr<const PublicKey>* out_public_key) {
+  // See if we should use the public RSA key in the Omaha response.
+  if (GetPublicKeyFromResponse(out_public_key)) {
+    LOG(INFO) << "Using the public key from the Omaha response.";
+    return true;
+  }
+  LOG(INFO) << "Using public key: " << public_key_path_;
+  if (!utils::FileExists(public_key_path_.c_str())) {
+    out_public_key->reset();
+    return false;
+  }
+  *out_public_key = public_key_cache_->GetKeyFromFile(public_key_path_);
   return true;
 }
 
@@ -1456,6 +2818,24 @@ ErrorCode DeltaPerformer::ValidateManifest() {
     return ErrorCode::kPayloadTimestampError;
   }
 
+  // The data of every operation of a split payload partition is in the range
+  // of the partition data file.
+  for (const PartitionUpdate& partition : manifest_.partitions()) {
+    if (!partition.has_data_sha256_hash())
+      continue;
+    for (const InstallOperation& op : partition.operations()) {
+      if (op.data_length() > 0 &&
+          (op.data_offset() < partition.data_offset() ||
+           op.data_offset() + op.data_length() >
+               partition.data_offset() + partition.data_length())) {
+        LOG(ERROR) << "The data of an operation of partition "
+                   << partition.partition_name()
+                   << " is outside of the partition data range.";
+        return ErrorCode::kDownloadManifestParseError;
+      }
+    }
+  }
+
   // TODO(garnold) we should be adding more and more manifest checks, such as
   // partition boundaries etc (see chromium-os:37661).
 
@@ -1464,6 +2844,19 @@ ErrorCode DeltaPerformer::ValidateManifest() {
 
 ErrorCode DeltaPerformer::ValidateOperationHash(
     const InstallOperation& operation) {
+  HashCalculator op_hash_calculator;
+  if (operation.data_sha256_hash().size() &&
+      !UpdateHashWithBuffer(
+          buffer_, operation.data_length(), {&op_hash_calculator})) {
+    LOG(ERROR) << "Unable to compute actual hash of operation "
+               << next_operation_num_;
+    return ErrorCode::kDownloadOperationHashVerificationError;
+  }
+  return ValidateOperationHash(operation, &op_hash_calculator);
+}
+
+ErrorCode DeltaPerformer::ValidateOperationHash(
+    const InstallOperation& operation, HashCalculator* op_hash_calculator) {
   if (!operation.data_sha256_hash().size()) {
     if (!operation.data_length()) {
       // Operations that do not have any data blob won't have any operation hash
@@ -1504,13 +2897,12 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
                           (operation.data_sha256_hash().data() +
                            operation.data_sha256_hash().size()));
 
-  brillo::Blob calculated_op_hash;
-  if (!HashCalculator::RawHashOfBytes(
-          buffer_.data(), operation.data_length(), &calculated_op_hash)) {
+  if (!op_hash_calculator->Finalize()) {
     LOG(ERROR) << "Unable to compute actual hash of operation "
                << next_operation_num_;
     return ErrorCode::kDownloadOperationHashVerificationError;
   }
+  const brillo::Blob& calculated_op_hash = op_hash_calculator->raw_hash();
 
   if (calculated_op_hash != expected_op_hash) {
     LOG(ERROR) << "Hash verification failed for operation "
@@ -1537,17 +2929,8 @@ ErrorCode DeltaPerformer::VerifyPayload(
     const brillo::Blob& update_check_response_hash,
     const uint64_t update_check_response_size) {
 
-  // See if we should use the public RSA key in the Omaha response.
-  base::FilePath path_to_public_key(public_key_path_);
-  base::FilePath tmp_key;
-  if (GetPublicKeyFromResponse(&tmp_key))
-    path_to_public_key = tmp_key;
-  ScopedPathUnlinker tmp_key_remover(tmp_key.value());
-  if (tmp_key.empty())
-    tmp_key_remover.set_should_remove(false);
-
-  LOG(INFO) << "Verifying payload using public key: "
-            << path_to_public_key.value();
+  std::shared_ptr<const PublicKey> public_key;
+  const bool has_public_key = GetPublicKey(&public_key);
 
   // Verifies the download size.
   TEST_AND_RETURN_VAL(ErrorCode::kPayloadSizeMismatchError,
@@ -1563,7 +2946,7 @@ ErrorCode DeltaPerformer::VerifyPayload(
       payload_hash_calculator_.raw_hash() == update_check_response_hash);
 
   // Verifies the signed payload hash.
-  if (!utils::FileExists(path_to_public_key.value().c_str())) {
+  if (!has_public_key) {
     LOG(WARNING) << "Not verifying signed delta payload -- missing public key.";
     return ErrorCode::kSuccess;
   }
@@ -1575,8 +2958,9 @@ ErrorCode DeltaPerformer::VerifyPayload(
   TEST_AND_RETURN_VAL(ErrorCode::kDownloadPayloadPubKeyVerificationError,
                       !hash_data.empty());
 
-  if (!PayloadVerifier::VerifySignature(
-      signatures_message_data_, path_to_public_key.value(), hash_data)) {
+  if (!public_key ||
+      !PayloadVerifier::VerifySignature(
+          signatures_message_data_, *public_key, hash_data)) {
     // The autoupdate_CatchBadSignatures test checks for this string
     // in log-files. Keep in sync.
     LOG(ERROR) << "Public key verification failed, thus update failed.";
@@ -1603,12 +2987,28 @@ void DeltaPerformer::DiscardBuffer(bool do_advance_offset,
   if (do_advance_offset)
     buffer_offset_ += buffer_.size();
 
-  // Hash the content.
-  payload_hash_calculator_.Update(buffer_.data(), buffer_.size());
-  signed_hash_calculator_.Update(buffer_.data(), signed_hash_buffer_size);
+  // Hash the content, in a single pass if the signed hash covers all of it.
+  if (signed_hash_buffer_size == buffer_.size()) {
+    UpdateHashWithBuffer(
+        buffer_,
+        buffer_.size(),
+        {&payload_hash_calculator_, &signed_hash_calculator_});
+  } else {
+    UpdateHashWithBuffer(buffer_, buffer_.size(), {&payload_hash_calculator_});
+    UpdateHashWithBuffer(
+        buffer_, signed_hash_buffer_size, {&signed_hash_calculator_});
+  }
+
+  buffer_.Clear();
+}
 
-  // Swap content with an empty vector to ensure that all memory is released.
-  brillo::Blob().swap(buffer_);
+void DeltaPerformer::TakeBuffer(SegmentedBuffer* data) {
+  buffer_offset_ += buffer_.size();
+  UpdateHashWithBuffer(buffer_,
+                       buffer_.size(),
+                       {&payload_hash_calculator_, &signed_hash_calculator_});
+  data->Clear();
+  data->Swap(&buffer_);
 }
 
 bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
@@ -1616,7 +3016,14 @@ bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
   int64_t next_operation = kUpdateStateOperationInvalid;
   if (!(prefs->GetInt64(kPrefsUpdateStateNextOperation, &next_operation) &&
         next_operation != kUpdateStateOperationInvalid &&
-        next_operation > 0))
+        next_operation >= 0))
+    return false;
+  // Nothing was applied yet unless the first operation was partially applied.
+  int64_t operation_data_offset = 0;
+  if (next_operation == 0 &&
+      !(prefs->GetInt64(kPrefsUpdateStateOperationDataOffset,
+                        &operation_data_offset) &&
+        operation_data_offset > 0))
     return false;
 
   string interrupted_hash;
@@ -1665,9 +3072,13 @@ bool DeltaPerformer::ResetUpdateProgress(PrefsInterface* prefs, bool quick) {
     prefs->SetInt64(kPrefsUpdateStateNextDataLength, 0);
     prefs->SetString(kPrefsUpdateStateSHA256Context, "");
     prefs->SetString(kPrefsUpdateStateSignedSHA256Context, "");
+    prefs->SetInt64(kPrefsUpdateStateOperationDataOffset, 0);
+    prefs->SetString(kPrefsUpdateStateOperationSHA256Context, "");
     prefs->SetString(kPrefsUpdateStateSignatureBlob, "");
     prefs->SetInt64(kPrefsManifestMetadataSize, -1);
     prefs->SetInt64(kPrefsManifestSignatureSize, -1);
+    prefs->Delete(kPrefsUpdateStateMetadata);
+    prefs->Delete(kPrefsUpdateStateMetadataPayloadHash);
     prefs->SetInt64(kPrefsResumedUpdateFailures, 0);
     prefs->Delete(kPrefsPostInstallSucceeded);
   }
@@ -1676,39 +3087,133 @@ bool DeltaPerformer::ResetUpdateProgress(PrefsInterface* prefs, bool quick) {
 
 bool DeltaPerformer::CheckpointUpdateProgress() {
   Terminator::set_exit_blocked(true);
-  if (last_updated_buffer_offset_ != buffer_offset_) {
+  return WriteCheckpoint(MakeCheckpoint());
+}
+
+DeltaPerformer::Checkpoint DeltaPerformer::MakeCheckpoint() const {
+  Checkpoint checkpoint;
+  checkpoint.next_operation_num = next_operation_num_;
+  checkpoint.next_data_offset = buffer_offset_;
+  checkpoint.sha256_context = payload_hash_calculator_.GetContext();
+  checkpoint.signed_sha256_context = signed_hash_calculator_.GetContext();
+  if (next_operation_num_ < num_total_operations_) {
+    size_t partition_index = current_partition_;
+    while (next_operation_num_ >= acc_num_operations_[partition_index])
+      partition_index++;
+    const size_t partition_operation_num = next_operation_num_ - (
+        partition_index ? acc_num_operations_[partition_index - 1] : 0);
+    const InstallOperation& op = manifest_.partitions(partition_index)
+                                     .operations(partition_operation_num);
+    checkpoint.next_data_length = op.data_length();
+  }
+  return checkpoint;
+}
+
+bool DeltaPerformer::WriteCheckpoint(const Checkpoint& checkpoint) {
+  // All the keys are written at once, with a single sync to disk.
+  const bool transaction = prefs_->StartTransaction();
+  const uint64_t last_updated_buffer_offset = last_updated_buffer_offset_;
+  const uint64_t last_updated_operation_data_offset =
+      last_updated_operation_data_offset_;
+  bool success = WriteCheckpointKeys(checkpoint);
+  if (transaction) {
+    if (success) {
+      success = prefs_->SubmitTransaction();
+    } else {
+      prefs_->CancelTransaction();
+    }
+  }
+  if (transaction && !success) {
+    // None of the keys were written.
+    last_updated_buffer_offset_ = last_updated_buffer_offset;
+    last_updated_operation_data_offset_ = last_updated_operation_data_offset;
+    return false;
+  }
+  last_checkpoint_time_ = base::TimeTicks::Now();
+  last_updated_next_operation_num_ = checkpoint.next_operation_num;
+  return success;
+}
+
+bool DeltaPerformer::IsCheckpointDue() const {
+  // Operations reading the partition they write to can't be applied twice.
+  if (GetMinorVersion() == kInPlaceMinorPayloadVersion ||
+      last_updated_buffer_offset_ == std::numeric_limits<uint64_t>::max()) {
+    return true;
+  }
+  if (buffer_offset_ - last_updated_buffer_offset_ >= kCheckpointMaxDataBytes)
+    return true;
+  return base::TimeTicks::Now() - last_checkpoint_time_ >=
+         base::TimeDelta::FromSeconds(kCheckpointMinIntervalSeconds);
+}
+
+bool DeltaPerformer::WriteCheckpointKeys(const Checkpoint& checkpoint) {
+  if (last_updated_buffer_offset_ != checkpoint.next_data_offset) {
     // Resets the progress in case we die in the middle of the state update.
     ResetUpdateProgress(prefs_, true);
     TEST_AND_RETURN_FALSE(
         prefs_->SetString(kPrefsUpdateStateSHA256Context,
-                          payload_hash_calculator_.GetContext()));
+                          checkpoint.sha256_context));
     TEST_AND_RETURN_FALSE(
         prefs_->SetString(kPrefsUpdateStateSignedSHA256Context,
-                          signed_hash_calculator_.GetContext()));
+                          checkpoint.signed_sha256_context));
     TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataOffset,
-                                           buffer_offset_));
-    last_updated_buffer_offset_ = buffer_offset_;
-
-    if (next_operation_num_ < num_total_operations_) {
-      size_t partition_index = current_partition_;
-      while (next_operation_num_ >= acc_num_operations_[partition_index])
-        partition_index++;
-      const size_t partition_operation_num = next_operation_num_ - (
-          partition_index ? acc_num_operations_[partition_index - 1] : 0);
-      const InstallOperation& op =
-          partitions_[partition_index].operations(partition_operation_num);
-      TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataLength,
-                                             op.data_length()));
-    } else {
-      TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataLength,
-                                             0));
+                                           checkpoint.next_data_offset));
+    last_updated_buffer_offset_ = checkpoint.next_data_offset;
+    TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataLength,
+                                           checkpoint.next_data_length));
+    // Only written while and right after streaming an operation.
+    if (last_updated_operation_data_offset_ !=
+        checkpoint.operation_data_offset) {
+      TEST_AND_RETURN_FALSE(
+          prefs_->SetString(kPrefsUpdateStateOperationSHA256Context,
+                            checkpoint.operation_sha256_context));
+      TEST_AND_RETURN_FALSE(
+          prefs_->SetInt64(kPrefsUpdateStateOperationDataOffset,
+                           checkpoint.operation_data_offset));
+      last_updated_operation_data_offset_ = checkpoint.operation_data_offset;
     }
   }
   TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextOperation,
-                                         next_operation_num_));
+                                         checkpoint.next_operation_num));
   return true;
 }
 
+// static
+bool DeltaPerformer::GetStoredMetadata(PrefsInterface* prefs,
+                                       const InstallPlan::Payload& payload,
+                                       uint64_t size,
+                                       string* out_metadata) {
+  // Without a hash there is nothing to tell two payloads apart.
+  string payload_hash;
+  if (size == 0 || payload.hash.empty() ||
+      !prefs->GetString(kPrefsUpdateStateMetadataPayloadHash, &payload_hash) ||
+      payload_hash != base::HexEncode(payload.hash.data(), payload.hash.size()))
+    return false;
+  return prefs->GetString(kPrefsUpdateStateMetadata, out_metadata) &&
+         out_metadata->size() == size;
+}
+
+void DeltaPerformer::StoreMetadata() {
+  if (payload_->hash.empty())
+    return;
+  const string payload_hash =
+      base::HexEncode(payload_->hash.data(), payload_->hash.size());
+  string stored_hash;
+  if (prefs_->GetString(kPrefsUpdateStateMetadataPayloadHash, &stored_hash) &&
+      stored_hash == payload_hash) {
+    return;
+  }
+  // The hash is written last, so the metadata is only used once complete.
+  const brillo::Blob& metadata = buffer_.Flatten();
+  prefs_->Delete(kPrefsUpdateStateMetadataPayloadHash);
+  if (!prefs_->SetString(kPrefsUpdateStateMetadata,
+                         string(metadata.begin(), metadata.end())) ||
+      !prefs_->SetString(kPrefsUpdateStateMetadataPayloadHash, payload_hash)) {
+    LOG(WARNING) << "Unable to store the payload metadata, a resumed update "
+                 << "will download it again.";
+  }
+}
+
 bool DeltaPerformer::PrimeUpdateState() {
   CHECK(manifest_valid_);
   block_size_ = manifest_.block_size();
@@ -1716,11 +3221,30 @@ bool DeltaPerformer::PrimeUpdateState() {
   int64_t next_operation = kUpdateStateOperationInvalid;
   if (!prefs_->GetInt64(kPrefsUpdateStateNextOperation, &next_operation) ||
       next_operation == kUpdateStateOperationInvalid ||
-      next_operation <= 0) {
+      next_operation < 0) {
+    // Initiating a new update, no more state needs to be initialized.
+    return true;
+  }
+  // The progress within the next operation, if it was being streamed.
+  int64_t operation_data_offset = 0;
+  if (!prefs_->GetInt64(kPrefsUpdateStateOperationDataOffset,
+                        &operation_data_offset) ||
+      operation_data_offset < 0) {
+    operation_data_offset = 0;
+  }
+  if (next_operation == 0 && operation_data_offset == 0) {
     // Initiating a new update, no more state needs to be initialized.
     return true;
   }
   next_operation_num_ = next_operation;
+  check_applied_operations_ = true;
+  if (operation_data_offset > 0) {
+    TEST_AND_RETURN_FALSE(
+        prefs_->GetString(kPrefsUpdateStateOperationSHA256Context,
+                          &resumed_op_sha256_context_));
+    resumed_op_data_offset_ = operation_data_offset;
+  }
+  last_updated_operation_data_offset_ = operation_data_offset;
 
   // Resuming an update -- load the rest of the update state.
   int64_t next_data_offset = -1;
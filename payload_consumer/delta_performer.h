@@ -19,25 +19,41 @@
 
 #include <inttypes.h>
 
+#include <atomic>
+#include <deque>
 #include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <base/time/time.h>
 #include <brillo/secure_blob.h>
+#include <google/protobuf/arena.h>
 #include <google/protobuf/repeated_field.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/io_limiter.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/payload_consumer/apply_stats.h"
+#include "update_engine/payload_consumer/decoder_pool.h"
+#include "update_engine/payload_consumer/extent_reader.h"
+#include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/file_writer.h"
+#include "update_engine/payload_consumer/hashing_file_descriptor.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/io_trace.h"
+#include "update_engine/payload_consumer/operation_pipeline.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_consumer/public_key_cache.h"
+#include "update_engine/payload_consumer/segmented_buffer.h"
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
 
+class CachedFileDescriptor;
 class DownloadActionDelegate;
 class BootControlInterface;
 class HardwareInterface;
@@ -63,6 +79,51 @@ class DeltaPerformer : public FileWriter {
   // operations. They must add up to one hundred (100).
   static const unsigned kProgressDownloadWeight;
   static const unsigned kProgressOperationsWeight;
+  // The maximum number of operations and the maximum amount of operation data
+  // in bytes queued for the worker thread when applying the payload in
+  // pipelined mode.
+  static const size_t kPipelineMaxPendingOperations;
+  static const size_t kPipelineMaxPendingBytes;
+  // The maximum number of workers of the pipeline in performance mode. The
+  // workers in excess of the apply threads of the install plan are only used
+  // in performance mode.
+  static const size_t kMaxPerformanceApplyWorkers;
+  // The REPLACE, REPLACE_BZ, REPLACE_XZ and REPLACE_ZSTD operations with at
+  // least this many bytes of data are applied as the data is received instead
+  // of buffering the whole blob.
+  static const uint64_t kMinStreamedOperationSize;
+  // The progress of a streamed REPLACE operation is checkpointed every time
+  // this many bytes of its data are written, so an interrupted update resumes
+  // from there instead of from the beginning of the operation.
+  static const uint64_t kStreamedOperationCheckpointSize;
+  // The source partition blocks read by up to this many operations ahead of
+  // the current one, and up to this many bytes, are prefetched.
+  static const size_t kSourcePrefetchOperations;
+  static const uint64_t kSourcePrefetchMaxBytes;
+  // Unless the payload updates the partitions in place, the progress is
+  // checkpointed only once this many seconds passed or this many bytes of
+  // payload data were applied since the previous checkpoint. Re-applying the
+  // operations completed after the last checkpoint is harmless in that case.
+  static const unsigned kCheckpointMinIntervalSeconds;
+  static const uint64_t kCheckpointMaxDataBytes;
+  // Up to this many consecutive ZERO or DISCARD operations are applied at once,
+  // merging their adjacent extents.
+  static const size_t kMaxZeroOrDiscardBatchSize;
+  // Consecutive SOURCE_COPY operations whose source and target blocks follow
+  // those of the previous one are copied at once, up to this many blocks.
+  static const uint64_t kMaxSourceCopyBatchBytes;
+  // The size of the zero buffer written when the target partition doesn't
+  // support the BLKZEROOUT or BLKDISCARD ioctls.
+  static const size_t kZeroBufferSize;
+  // The operation data found in a chunk passed to WriteChunk() is kept by
+  // reference when it has at least this many bytes. Smaller pieces are cheaper
+  // to copy than to keep the whole chunk alive for.
+  static const size_t kMinSharedDataSize;
+  // The manifest is parsed into an arena starting with a block of this many
+  // bytes. Each new block doubles in size up to the maximum, so large
+  // manifests need only a few allocations.
+  static const size_t kManifestArenaStartBlockSize;
+  static const size_t kManifestArenaMaxBlockSize;
 
   DeltaPerformer(PrefsInterface* prefs,
                  BootControlInterface* boot_control,
@@ -90,6 +151,12 @@ class DeltaPerformer : public FileWriter {
   // in case of failures in Write operation.
   bool Write(const void* bytes, size_t count, ErrorCode *error) override;
 
+  // Like Write(), for the bytes of a shared |chunk|. The operation data found
+  // in it is kept by reference instead of being copied, unless it's small or
+  // needed contiguous.
+  bool WriteChunk(const std::shared_ptr<const brillo::Blob>& chunk,
+                  ErrorCode* error);
+
   // Wrapper around close. Returns 0 on success or -errno on error.
   // Closes both 'path' given to Open() and the kernel path.
   int Close() override;
@@ -103,6 +170,15 @@ class DeltaPerformer : public FileWriter {
   // or -errno on error.
   int CloseCurrentPartition();
 
+  // Reports the |partition| of the manifest, entirely written, to the
+  // PartitionWriteObserver if any.
+  void NotifyPartitionWritten(size_t partition);
+
+  // Frees the operations of the |partition| of the manifest, and their arena in
+  // |operation_arenas_|, which aren't used once it is entirely written, so the
+  // memory used by big manifests shrinks as the update progresses.
+  void ReleasePartitionOperations(size_t partition);
+
   // Returns |true| only if the manifest has been processed and it's valid.
   bool IsManifestValid();
 
@@ -126,7 +202,7 @@ class DeltaPerformer : public FileWriter {
   // {0, 1}, block_size is 4096, and full_length is 5 * block_size - 13,
   // the resulting string will be: "4096:4096,16384:8192,-1:4096,0:4083"
   static bool ExtentsToBsdiffPositionsString(
-      const google::protobuf::RepeatedPtrField<Extent>& extents,
+      ExtentSpan extents,
       uint64_t block_size,
       uint64_t full_length,
       std::string* positions_string);
@@ -142,6 +218,15 @@ class DeltaPerformer : public FileWriter {
   // success, false otherwise.
   static bool ResetUpdateProgress(PrefsInterface* prefs, bool quick);
 
+  // Returns in |out_metadata| the metadata and metadata signature of
+  // |payload| stored in |prefs| when they were first parsed, if they are
+  // |size| bytes long. A resumed update can pass them to Write() instead of
+  // downloading them again, as they are verified like the downloaded ones.
+  static bool GetStoredMetadata(PrefsInterface* prefs,
+                                const InstallPlan::Payload& payload,
+                                uint64_t size,
+                                std::string* out_metadata);
+
   // Attempts to parse the update metadata starting from the beginning of
   // |payload|. On success, returns kMetadataParseSuccess. Returns
   // kMetadataParseInsufficientData if more data is needed to parse the complete
@@ -154,6 +239,33 @@ class DeltaPerformer : public FileWriter {
     public_key_path_ = public_key_path;
   }
 
+  // Sets the cache the public keys are loaded from, so they are only parsed
+  // once for all the update attempts. The |public_key_cache| object is not
+  // owned and must outlive this performer. By default the keys are only kept
+  // for this performer.
+  void set_public_key_cache(PublicKeyCache* public_key_cache) {
+    public_key_cache_ = public_key_cache;
+  }
+
+  // Sets the stats where the time spent applying each operation is recorded.
+  // The |apply_stats| object is not owned and must outlive this performer.
+  void set_apply_stats(ApplyStats* apply_stats) { apply_stats_ = apply_stats; }
+
+  // Sets the trace where the I/O calls made to the partitions are recorded.
+  // The |io_trace| object is not owned and must outlive this performer.
+  void set_io_trace(IOTrace* io_trace) { io_trace_ = io_trace; }
+
+  // Sets the limiter the I/O priority of the pipeline workers follows. The
+  // |io_limiter| object is not owned and must outlive this performer.
+  void set_io_limiter(IOLimiter* io_limiter) { io_limiter_ = io_limiter; }
+
+  // Sets the observer of the target partitions written before the end of the
+  // payload; the last partition is only closed by Close(). The |observer| is
+  // not owned and must outlive this performer.
+  void set_partition_write_observer(PartitionWriteObserver* observer) {
+    partition_write_observer_ = observer;
+  }
+
   // Return true if header parsing is finished and no errors occurred.
   bool IsHeaderParsed() const;
 
@@ -175,21 +287,56 @@ class DeltaPerformer : public FileWriter {
   FRIEND_TEST(DeltaPerformerTest, BrilloMetadataSignatureSizeTest);
   FRIEND_TEST(DeltaPerformerTest, BrilloParsePayloadMetadataTest);
   FRIEND_TEST(DeltaPerformerTest, UsePublicKeyFromResponse);
-
-  // Parse and move the update instructions of all partitions into our local
-  // |partitions_| variable based on the version of the payload. Requires the
-  // manifest to be parsed and valid.
+  FRIEND_TEST(DeltaPerformerTest, ReleasePartitionOperationsTest);
+
+  // The source and target partition file descriptors used to apply an
+  // operation.
+  struct PartitionFds {
+    FileDescriptorPtr source;
+    FileDescriptorPtr target;
+    // The write cache of |target|, owned by it, or nullptr if there is none.
+    CachedFileDescriptor* target_cache{nullptr};
+  };
+
+  // The persisted update progress, as saved by CheckpointUpdateProgress().
+  struct Checkpoint {
+    // The number of tasks pushed to the |pipeline_| that must be completed
+    // before this checkpoint can be persisted. Only used in pipelined mode.
+    size_t required_tasks{0};
+
+    size_t next_operation_num{0};
+    uint64_t next_data_offset{0};
+    uint64_t next_data_length{0};
+    std::string sha256_context;
+    std::string signed_sha256_context;
+
+    // The bytes of the data of the operation |next_operation_num| already
+    // applied and the hash context of that data. Only set while streaming a
+    // REPLACE operation.
+    uint64_t operation_data_offset{0};
+    std::string operation_sha256_context;
+  };
+
+  // Fill in the |install_plan_| partitions from the update instructions of all
+  // partitions in the manifest. An older manifest format is converted in place
+  // to the list of partitions of the major version 2. Requires the manifest to
+  // be parsed and valid.
   bool ParseManifestPartitions(ErrorCode* error);
 
   // Appends up to |*count_p| bytes from |*bytes_p| to |buffer_|, but only to
   // the extent that the size of |buffer_| does not exceed |max|. Advances
   // |*cbytes_p| and decreases |*count_p| by the actual number of bytes copied,
-  // and returns this number.
-  size_t CopyDataToBuffer(const char** bytes_p, size_t* count_p, size_t max);
-
-  // If |op_result| is false, emits an error message using |op_type_name| and
-  // sets |*error| accordingly. Otherwise does nothing. Returns |op_result|.
-  bool HandleOpResult(bool op_result, const char* op_type_name,
+  // and returns this number. If |contiguous|, the data is stored in a single
+  // allocation of |max| bytes.
+  size_t CopyDataToBuffer(const char** bytes_p,
+                          size_t* count_p,
+                          size_t max,
+                          bool contiguous);
+
+  // If |op_result| is false, emits an error message about the operation number
+  // |op_num| using |op_type_name| and sets |*error| accordingly. Otherwise does
+  // nothing. Returns |op_result|.
+  bool HandleOpResult(bool op_result, const char* op_type_name, size_t op_num,
                       ErrorCode* error);
 
   // Logs the progress of downloading/applying an update.
@@ -211,23 +358,191 @@ class DeltaPerformer : public FileWriter {
   // Returns ErrorCode::kSuccess on match or a suitable error code otherwise.
   ErrorCode ValidateOperationHash(const InstallOperation& operation);
 
-  // Returns true on success.
-  bool PerformInstallOperation(const InstallOperation& operation);
+  // Like ValidateOperationHash(), but checks the hash of the operation data
+  // already passed to |op_hash_calculator|, which is finalized.
+  ErrorCode ValidateOperationHash(const InstallOperation& operation,
+                                  HashCalculator* op_hash_calculator);
+
+  // Applies |operation| to the current partition through the file descriptors
+  // in |fds|, using the operation data blob in |data|, which is ignored for
+  // operations without a blob. The operations that can't process the blob in
+  // pieces flatten |data| first. The |batched_operations|, if not null, are
+  // the operations of the manifest merged in |operation|. The source blocks
+  // applied are dropped from the page cache. Only accesses state that doesn't
+  // change while applying the operations of a partition, so it is safe to call
+  // it from the |pipeline_| worker threads. Returns true on success.
+  bool PerformInstallOperation(
+      const InstallOperation& operation,
+      const std::vector<const InstallOperation*>* batched_operations,
+      SegmentedBuffer* data,
+      const PartitionFds& fds,
+      ErrorCode* error);
 
   // These perform a specific type of operation and return true on success.
   // |error| will be set if source hash mismatch, otherwise |error| might not be
   // set even if it fails.
-  bool PerformReplaceOperation(const InstallOperation& operation);
-  bool PerformZeroOrDiscardOperation(const InstallOperation& operation);
-  bool PerformMoveOperation(const InstallOperation& operation);
-  bool PerformBsdiffOperation(const InstallOperation& operation);
-  bool PerformSourceCopyOperation(const InstallOperation& operation,
-                                  ErrorCode* error);
+  bool PerformReplaceOperation(const InstallOperation& operation,
+                               const SegmentedBuffer& data,
+                               const PartitionFds& fds);
+  bool PerformZeroOrDiscardOperation(const InstallOperation& operation,
+                                     const PartitionFds& fds);
+  bool PerformMoveOperation(const InstallOperation& operation,
+                            const PartitionFds& fds);
+  bool PerformBsdiffOperation(const InstallOperation& operation,
+                              const brillo::Blob& data,
+                              const PartitionFds& fds);
+  bool PerformSourceCopyOperation(
+      const InstallOperation& operation,
+      const std::vector<const InstallOperation*>* batched_operations,
+      const PartitionFds& fds,
+      ErrorCode* error);
+  // Copies the source extents of the PARTITION_COPY |operation| from the
+  // source of the partition named in it, checking their hash.
+  bool PerformPartitionCopyOperation(const InstallOperation& operation,
+                                     const PartitionFds& fds,
+                                     ErrorCode* error);
   bool PerformSourceBsdiffOperation(const InstallOperation& operation,
+                                    const brillo::Blob& data,
+                                    const PartitionFds& fds,
                                     ErrorCode* error);
   bool PerformPuffDiffOperation(const InstallOperation& operation,
+                                const brillo::Blob& data,
+                                const PartitionFds& fds,
                                 ErrorCode* error);
 
+  // Returns whether the source partition |install_part|, open in |source_fd_|,
+  // matches its expected hash.
+  bool VerifySourcePartition(const InstallPlan::Partition& install_part);
+
+  // Maps the source partition |source_path_| in memory. Returns whether it was
+  // mapped.
+  bool MapSourcePartition();
+
+  // Returns a reader of the source partition, reading from its mapping if
+  // available.
+  std::unique_ptr<ExtentReader> CreateSourceReader() const;
+
+  // Hints the kernel to read ahead the source blocks of the operations
+  // following the operation number |partition_operation_num| of the current
+  // partition, so they are in the page cache by the time they are applied.
+  void PrefetchSourceExtents(size_t partition_operation_num);
+
+  // Returns whether |operation| is applied by StreamReplaceOperation(), as its
+  // data is received.
+  bool IsStreamedOperation(const InstallOperation& operation) const;
+
+  // Writes the data of the streamed replace |operation| available in
+  // |*bytes_p| and |*count_p| to the target partition, advancing them past the
+  // consumed data. Sets |*done| once all the operation data was written and
+  // its hash validated. Returns false and sets |error| on failure.
+  bool StreamReplaceOperation(const InstallOperation& operation,
+                              const char** bytes_p,
+                              size_t* count_p,
+                              bool* done,
+                              ErrorCode* error);
+
+  // Persists the progress of the streamed |operation| in the middle of its
+  // data. Returns whether the checkpoint was written.
+  bool CheckpointStreamedOperation(const InstallOperation& operation);
+
+  // Returns whether |operation| must not be applied concurrently with any other
+  // operation, which is the case of the in-place operations reading from the
+  // target partition.
+  static bool IsExclusiveOperation(const InstallOperation& operation);
+
+  // Returns whether the blocks written by |operation| to the current target
+  // partition already match its destination hash, so it doesn't need to be
+  // applied again after resuming.
+  bool IsOperationApplied(const InstallOperation& operation);
+
+  // Returns whether |operation| needs its whole data in a contiguous buffer,
+  // which is the case of the operations applied by bspatch and puffpatch.
+  static bool NeedsContiguousData(const InstallOperation& operation);
+
+  // Returns the operation to apply for the operation number
+  // |partition_operation_num| of the current partition. If it is a ZERO or
+  // DISCARD operation followed by more of the same type, it is a single one
+  // with the merged extents of all of them, and |num_ops| is set to the number
+  // of operations batched. Otherwise, it is the operation itself and |num_ops|
+  // is 1.
+  const InstallOperation& BatchZeroOrDiscardOperations(
+      size_t partition_operation_num, size_t* num_ops);
+
+  // Same as BatchZeroOrDiscardOperations() for the SOURCE_COPY operations
+  // continuing the source and target blocks of the previous one, so they are
+  // copied sequentially. The batched operations are stored in
+  // |batched_operations|, or nullptr if nothing was batched, so their source
+  // hashes are still checked one by one. Both live in |manifest_arena_|.
+  const InstallOperation& BatchSourceCopyOperations(
+      size_t partition_operation_num,
+      size_t* num_ops,
+      const std::vector<const InstallOperation*>** batched_operations);
+
+  // Returns the options of |manifest_arena_|.
+  static google::protobuf::ArenaOptions ManifestArenaOptions();
+
+  // Opens one extra set of partition file descriptors for each |pipeline_|
+  // worker other than the first one, which uses |source_fd_| and |target_fd_|.
+  // The target ones cache |cache_size| bytes of writes in up to |cache_runs|
+  // runs. Returns whether all of them were opened.
+  bool OpenWorkerFds(int target_flags, size_t cache_size, size_t cache_runs);
+
+  // Pipelined mode only. Hands the operation |op_num| and its data, currently
+  // in |buffer_|, over to the |pipeline_| worker thread and records the
+  // checkpoint to persist once it is applied. Returns false if the operation
+  // couldn't be queued because a previous operation failed.
+  bool QueueInstallOperation(
+      const InstallOperation& operation,
+      const std::vector<const InstallOperation*>* batched_operations,
+      size_t op_num,
+      ErrorCode* error);
+
+  // The |pipeline_| task applying |operation| with the blob |data| on the
+  // worker number |worker| and flushing the target partition.
+  bool RunQueuedOperation(
+      const InstallOperation* operation,
+      const std::vector<const InstallOperation*>* batched_operations,
+      SegmentedBuffer* data,
+      size_t op_num,
+      size_t worker,
+      ErrorCode* error);
+
+  // Records in |apply_stats_|, if set, that |operation| was applied.
+  void RecordOperationApplied(const InstallOperation& operation);
+
+  // Records in |apply_stats_|, if set, that the operation number |op_num|
+  // spent the time since |start_time| in |phase|, processing |bytes| bytes.
+  void RecordApplyPhase(ApplyStats::Phase phase,
+                        const InstallOperation& operation,
+                        size_t op_num,
+                        base::TimeTicks start_time,
+                        uint64_t bytes);
+
+  // Pipelined mode only. Persists the latest checkpoint whose operations were
+  // all applied, if any. Returns false and sets |error| if an operation failed
+  // in the worker thread.
+  // Unless |force|, the checkpoint is only persisted if IsCheckpointDue().
+  bool CommitPipelineCheckpoints(ErrorCode* error, bool force);
+
+  // Pipelined mode only. Waits for all the queued operations to be applied and
+  // persists the checkpoints. Returns false and sets |error| on failure.
+  bool DrainPipeline(ErrorCode* error);
+
+  // Pipelined mode only. Runs all the workers of the pipeline while the
+  // IOLimiter is in performance mode, and the number of apply threads of the
+  // install plan otherwise.
+  void UpdatePipelineWorkers();
+
+  // Returns the number of operations applied at the same time: the workers
+  // UpdatePipelineWorkers() lets run, or one without a pipeline.
+  size_t GetActiveApplyWorkers() const;
+
+  // Sizes the write cache of each target file descriptor and the puffin cache
+  // of each operation of the current partition, splitting the memory between
+  // the GetActiveApplyWorkers() workers. The write caches are resized when
+  // their workers apply their next operation.
+  void UpdateCacheSizes();
+
   // Extracts the payload signature message from the blob on the |operation| if
   // the offset matches the one specified by the manifest. Returns whether the
   // signature was extracted.
@@ -245,22 +560,49 @@ class DeltaPerformer : public FileWriter {
   // accordingly.
   void DiscardBuffer(bool do_advance_offset, size_t signed_hash_buffer_size);
 
+  // Like DiscardBuffer(true, buffer_.size()), but moves the content of
+  // |buffer_| to |data| instead of releasing it.
+  void TakeBuffer(SegmentedBuffer* data);
+
   // Checkpoints the update progress into persistent storage to allow this
   // update attempt to be resumed after reboot.
   bool CheckpointUpdateProgress();
 
+  // Returns the checkpoint describing the current update progress.
+  Checkpoint MakeCheckpoint() const;
+
+  // Persists the passed |checkpoint| in a single prefs transaction, when
+  // supported. Returns true on success.
+  bool WriteCheckpoint(const Checkpoint& checkpoint);
+
+  // Sets the prefs keys of the passed |checkpoint|.
+  bool WriteCheckpointKeys(const Checkpoint& checkpoint);
+
+  // Returns whether the progress must be checkpointed after applying the
+  // current operation. See kCheckpointMinIntervalSeconds.
+  bool IsCheckpointDue() const;
+
   // Primes the required update state. Returns true if the update state was
   // successfully initialized to a saved resume state or if the update is a new
   // update. Returns false otherwise.
   bool PrimeUpdateState();
 
+  // Stores the metadata and metadata signature in |buffer_| in the prefs,
+  // unless they are already, so a resumed update doesn't download them.
+  void StoreMetadata();
+
   // If the Omaha response contains a public RSA key and we're allowed
-  // to use it (e.g. if we're in developer mode), extract the key from
-  // the response and store it in a temporary file and return true. In
-  // the affirmative the path to the temporary file is stored in
-  // |out_tmp_key| and it is the responsibility of the caller to clean
-  // it up.
-  bool GetPublicKeyFromResponse(base::FilePath *out_tmp_key);
+  // to use it (e.g. if we're in developer mode), sets |out_public_key| to the
+  // key parsed from the response, or to nullptr if it isn't a valid key, and
+  // returns true.
+  bool GetPublicKeyFromResponse(
+      std::shared_ptr<const PublicKey>* out_public_key);
+
+  // Sets |out_public_key| to the key the payload is verified with: the one in
+  // the Omaha response if GetPublicKeyFromResponse() allows it, else the one
+  // at |public_key_path_|, or nullptr if it can't be loaded. Returns false if
+  // there is no key at all, in the response or at |public_key_path_|.
+  bool GetPublicKey(std::shared_ptr<const PublicKey>* out_public_key);
 
   // Update Engine preference store.
   PrefsInterface* prefs_;
@@ -283,19 +625,106 @@ class DeltaPerformer : public FileWriter {
   // partition when using a delta payload.
   FileDescriptorPtr source_fd_{nullptr};
 
+  // The source partition mapped in memory, if |install_plan_->mmap_source|.
+  // Only set while updating a partition when using a delta payload.
+  const uint8_t* source_mmap_{nullptr};
+  uint64_t source_mmap_size_{0};
+
   // File descriptor of the target partition. Only set while performing the
   // operations of a given partition.
   FileDescriptorPtr target_fd_{nullptr};
 
+  // The zstd dictionary of the manifest used by the REPLACE_ZSTD operations,
+  // or nullptr if it has none.
+  std::unique_ptr<ZstdDecompressionDictionary> zstd_dictionary_;
+
+  // The decompression states reused by the replace operations. It must
+  // outlive the writers of the operations and the pipeline.
+  DecoderPool decoder_pool_;
+
+  // The writer of the operation being applied by StreamReplaceOperation(), or
+  // nullptr if none is in progress, and the hash of the operation data written
+  // to it so far.
+  std::unique_ptr<ExtentWriter> streamed_op_writer_;
+  std::unique_ptr<HashCalculator> streamed_op_hash_calculator_;
+  uint64_t streamed_op_bytes_{0};
+  // The extents |streamed_op_writer_| writes to, which skip the blocks written
+  // before resuming.
+  google::protobuf::RepeatedPtrField<Extent> streamed_op_extents_;
+
+  // The progress within the operation |next_operation_num_| loaded from the
+  // checkpoint when resuming an update, applied when that operation starts.
+  uint64_t resumed_op_data_offset_{0};
+  std::string resumed_op_sha256_context_;
+
+  // Whether the operations following the checkpoint of a resumed update are
+  // checked against their destination hash, until one doesn't match. The
+  // ones that match were applied before the update was interrupted.
+  bool check_applied_operations_{false};
+
+  // The file descriptors of the current partition used by each |pipeline_|
+  // worker. The first worker uses |source_fd_| and |target_fd_|, the others
+  // have their own file descriptors so they can seek independently.
+  std::vector<PartitionFds> worker_fds_;
+
+  // The first operation of the current partition whose source blocks weren't
+  // prefetched yet.
+  size_t source_prefetch_next_op_{0};
+
+  // The size of the cache of the inflated source data used by each PUFFDIFF
+  // operation of the current partition, and of the write cache of each target
+  // file descriptor, sized from the available memory by UpdateCacheSizes().
+  // Read by the |pipeline_| workers.
+  std::atomic<size_t> puff_cache_size_{0};
+  std::atomic<size_t> write_cache_size_{0};
+
+  // The size of the current target partition.
+  uint64_t target_size_{0};
+
+  // Whether the cache sizes were computed in performance mode.
+  bool cache_performance_mode_{false};
+
+  // Whether the whole current source partition matched its expected hash, so
+  // the source data of each operation doesn't need to be checked.
+  bool source_verified_{false};
+
+  // Whether the current target partition supports the BLKZEROOUT and the
+  // BLKDISCARD ioctls, until an operation finds it doesn't. Accessed by the
+  // |pipeline_| workers.
+  std::atomic<bool> zero_ioctl_supported_{true};
+  std::atomic<bool> discard_ioctl_supported_{true};
+
+  // Whether the current source and target partitions support copying ranges
+  // inside the kernel, when |install_plan_->clone_source_copy|, until a
+  // SOURCE_COPY operation finds they don't.
+  std::atomic<bool> copy_range_supported_{true};
+
+  // The hash of the data written to the current target partition, computed
+  // when |install_plan_->verify_written_hash|. It is shared by |target_fd_| and
+  // the target file descriptors of the |pipeline_| workers.
+  std::shared_ptr<WrittenDataHasher> write_hasher_;
+
   // Paths the |source_fd_| and |target_fd_| refer to.
   std::string source_path_;
   std::string target_path_;
 
   PayloadMetadata payload_metadata_;
 
-  // Parsed manifest. Set after enough bytes to parse the manifest were
-  // downloaded.
-  DeltaArchiveManifest manifest_;
+  // The arena holding the parsed manifest and all its messages and strings,
+  // freed at once with the performer.
+  google::protobuf::Arena manifest_arena_{ManifestArenaOptions()};
+
+  // Parsed manifest, allocated in |manifest_arena_|. Set after enough bytes to
+  // parse the manifest were downloaded. Its partitions are the list of
+  // partitions to update: when parsing an older manifest format, the
+  // information is converted over to the major version 2 format.
+  DeltaArchiveManifest& manifest_{
+      *google::protobuf::Arena::CreateMessage<DeltaArchiveManifest>(
+          &manifest_arena_)};
+  // The arenas holding the operations of each partition of |manifest_|, in
+  // the order of its partitions, so they can be freed once applied. The
+  // operations are only referenced by the repeated fields of |manifest_|.
+  std::vector<std::unique_ptr<google::protobuf::Arena>> operation_arenas_;
   bool manifest_parsed_{false};
   bool manifest_valid_{false};
   uint64_t metadata_size_{0};
@@ -311,13 +740,8 @@ class DeltaPerformer : public FileWriter {
   // otherwise 0.
   size_t num_total_operations_{0};
 
-  // The list of partitions to update as found in the manifest major version 2.
-  // When parsing an older manifest format, the information is converted over to
-  // this format instead.
-  std::vector<PartitionUpdate> partitions_;
-
-  // Index in the list of partitions (|partitions_| member) of the current
-  // partition being processed.
+  // Index in the list of partitions of |manifest_| of the current partition
+  // being processed.
   size_t current_partition_{0};
 
   // Index of the next operation to perform in the manifest. The index is linear
@@ -326,13 +750,35 @@ class DeltaPerformer : public FileWriter {
 
   // A buffer used for accumulating downloaded data. Initially, it stores the
   // payload metadata; once that's downloaded and parsed, it stores data for the
-  // next update operation.
-  brillo::Blob buffer_;
+  // next update operation. It is stored in segments so large operation blobs
+  // don't need to be reallocated and copied as they are downloaded.
+  SegmentedBuffer buffer_;
+  // The chunk passed to WriteChunk() while it's being written, if any.
+  std::shared_ptr<const brillo::Blob> shared_chunk_;
   // Offset of buffer_ in the binary blobs section of the update.
   uint64_t buffer_offset_{0};
 
   // Last |buffer_offset_| value updated as part of the progress update.
   uint64_t last_updated_buffer_offset_{std::numeric_limits<uint64_t>::max()};
+  // Last Checkpoint::operation_data_offset value updated as part of the
+  // progress update.
+  uint64_t last_updated_operation_data_offset_{
+      std::numeric_limits<uint64_t>::max()};
+  // The time and the next operation of the last persisted checkpoint.
+  base::TimeTicks last_checkpoint_time_;
+  size_t last_updated_next_operation_num_{0};
+
+  // The stats of the applied operations, not owned. May be null.
+  ApplyStats* apply_stats_{nullptr};
+  // The trace of the partition I/O, not owned. May be null.
+  IOTrace* io_trace_{nullptr};
+  // The limiter of the I/O of the pipeline workers, not owned. May be null.
+  IOLimiter* io_limiter_{nullptr};
+  // Notified of the partitions written, not owned. May be null.
+  PartitionWriteObserver* partition_write_observer_{nullptr};
+  // The operation whose data is being waited for, and since when.
+  size_t data_wait_operation_num_{std::numeric_limits<size_t>::max()};
+  base::TimeTicks data_wait_start_time_;
 
   // The block size (parsed from the manifest).
   uint32_t block_size_{0};
@@ -352,6 +798,10 @@ class DeltaPerformer : public FileWriter {
   // override with test keys.
   std::string public_key_path_{constants::kUpdatePayloadPublicKeyPath};
 
+  // The parsed public keys, shared by all the attempts when a cache is set.
+  PublicKeyCache default_public_key_cache_;
+  PublicKeyCache* public_key_cache_{&default_public_key_cache_};
+
   // The number of bytes received so far, used for progress tracking.
   size_t total_bytes_received_{0};
 
@@ -377,6 +827,20 @@ class DeltaPerformer : public FileWriter {
   // The delta minor payload version supported by DeltaPerformer.
   uint32_t supported_minor_version_{kSupportedMinorPayloadVersion};
 
+  // The checkpoints of the operations queued in the |pipeline_| that weren't
+  // persisted yet, in order.
+  std::deque<Checkpoint> pending_checkpoints_;
+
+  // The number of tasks pushed to the |pipeline_|.
+  size_t pipeline_pushed_tasks_{0};
+
+  // The worker threads applying the operations when
+  // |install_plan_->pipelined_apply| is set or |install_plan_->apply_threads|
+  // is greater than one, or nullptr otherwise. Declared last so it is
+  // destroyed, and the worker threads joined, before any of the state used by
+  // the queued operations.
+  std::unique_ptr<OperationPipeline> pipeline_;
+
   DISALLOW_COPY_AND_ASSIGN(DeltaPerformer);
 };
 
@@ -0,0 +1,570 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks the throughput of applying each type of install operation. For
+// each benchmarked type, a synthetic delta payload whose operations are all of
+// that type is generated, and then applied with DeltaPerformer to a file in
+// --work_dir, usually on a tmpfs, or to the --target_device block device.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <xz.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/callback.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_split.h>
+#include <base/strings/stringprintf.h>
+#include <base/time/time.h>
+#include <brillo/flag_helper.h>
+#include <bsdiff/bsdiff.h>
+#include <bsdiff/patch_writer_factory.h>
+#include <puffin/puffdiff.h>
+#include <puffin/utils.h>
+
+#include "update_engine/common/fake_boot_control.h"
+#include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/prefs.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/apply_stats.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/xz.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const uint64_t kBlockSize = 4096;
+
+// The name of the partition updated by the benchmark payloads.
+const char kPartitionName[] = "system";
+
+// The operation types that can be benchmarked.
+const InstallOperation::Type kOperationTypes[] = {
+    InstallOperation::REPLACE_XZ,
+    InstallOperation::SOURCE_COPY,
+    InstallOperation::SOURCE_BSDIFF,
+    InstallOperation::PUFFDIFF,
+    InstallOperation::ZERO,
+};
+
+// One in every |kMutationInterval| bytes of the source is changed in the
+// target of the diff operations.
+const size_t kMutationInterval = 512;
+
+// The size of the text compressed in each zlib stream of the PUFFDIFF
+// partitions.
+const size_t kZlibStreamTextSize = 16 * 1024;
+
+// The size of the chunks the payload is passed to DeltaPerformer in, like the
+// chunks received from the network.
+const size_t kPayloadChunkSize = 1024 * 1024;
+
+// The files of the payload benchmarking an operation type.
+struct BenchmarkFiles {
+  string source_path;
+  // The expected content of the target partition.
+  string expected_path;
+  string payload_path;
+  // The target partition the payload is applied to.
+  string target_path;
+};
+
+// Returns in |type| the operation type named |name|.
+bool ParseOperationType(const string& name, InstallOperation::Type* type) {
+  for (InstallOperation::Type candidate : kOperationTypes) {
+    if (name == InstallOperationTypeName(candidate)) {
+      *type = candidate;
+      return true;
+    }
+  }
+  LOG(ERROR) << "Operation type " << name << " can't be benchmarked.";
+  return false;
+}
+
+// Fills the |size| bytes at |data| with pseudo-random text from a small
+// alphabet, which compresses roughly like the files of a system image.
+void FillText(std::minstd_rand* rng, uint8_t* data, size_t size) {
+  static const char kAlphabet[] = "etaoinshrdlucmfwyp \n";
+  std::uniform_int_distribution<size_t> dist(0, sizeof(kAlphabet) - 2);
+  for (size_t i = 0; i < size; i++)
+    data[i] = kAlphabet[dist(*rng)];
+}
+
+// Changes one in every |kMutationInterval| of the |size| bytes at |data|, like
+// the small edits between two versions of a file.
+void Mutate(std::minstd_rand* rng, uint8_t* data, size_t size) {
+  std::uniform_int_distribution<size_t> dist(0, kMutationInterval - 1);
+  for (size_t i = 0; i + kMutationInterval <= size; i += kMutationInterval)
+    data[i + dist(*rng)] ^= 0x20;
+}
+
+bool ZlibCompress(const brillo::Blob& in, brillo::Blob* out) {
+  uLongf out_size = compressBound(in.size());
+  out->resize(out_size);
+  TEST_AND_RETURN_FALSE(
+      compress2(out->data(), &out_size, in.data(), in.size(), Z_BEST_SPEED) ==
+      Z_OK);
+  out->resize(out_size);
+  return true;
+}
+
+// Fills the |size| bytes at |offset| in |source| and |target| with zlib
+// streams of text, where each target stream compresses a mutated copy of the
+// text of a source stream. The location of the streams is appended to
+// |source_zlibs| and |target_zlibs|.
+bool FillZlibStreams(std::minstd_rand* rng,
+                     uint64_t offset,
+                     uint64_t size,
+                     brillo::Blob* source,
+                     brillo::Blob* target,
+                     vector<puffin::ByteExtent>* source_zlibs,
+                     vector<puffin::ByteExtent>* target_zlibs) {
+  brillo::Blob text(kZlibStreamTextSize), source_stream, target_stream;
+  uint64_t source_pos = offset, target_pos = offset;
+  while (true) {
+    FillText(rng, text.data(), text.size());
+    TEST_AND_RETURN_FALSE(ZlibCompress(text, &source_stream));
+    Mutate(rng, text.data(), text.size());
+    TEST_AND_RETURN_FALSE(ZlibCompress(text, &target_stream));
+    if (source_pos + source_stream.size() > offset + size ||
+        target_pos + target_stream.size() > offset + size) {
+      return true;
+    }
+    std::copy(source_stream.begin(),
+              source_stream.end(),
+              source->begin() + source_pos);
+    std::copy(target_stream.begin(),
+              target_stream.end(),
+              target->begin() + target_pos);
+    source_zlibs->emplace_back(source_pos, source_stream.size());
+    target_zlibs->emplace_back(target_pos, target_stream.size());
+    source_pos += source_stream.size();
+    target_pos += target_stream.size();
+  }
+}
+
+// Returns the deflates in |deflates| which are within the |size| bytes at
+// |offset|, relative to |offset|.
+vector<puffin::BitExtent> DeflatesInRange(
+    const vector<puffin::BitExtent>& deflates, uint64_t offset, uint64_t size) {
+  vector<puffin::BitExtent> result;
+  for (const puffin::BitExtent& deflate : deflates) {
+    if (deflate.offset >= offset * 8 &&
+        deflate.offset + deflate.length <= (offset + size) * 8) {
+      result.emplace_back(deflate.offset - offset * 8, deflate.length);
+    }
+  }
+  return result;
+}
+
+bool GenerateBsdiff(const brillo::Blob& old_data,
+                    const brillo::Blob& new_data,
+                    brillo::Blob* patch) {
+  string patch_path;
+  TEST_AND_RETURN_FALSE(
+      utils::MakeTempFile("bsdiff-patch.XXXXXX", &patch_path, nullptr));
+  ScopedPathUnlinker patch_unlinker(patch_path);
+  std::unique_ptr<bsdiff::PatchWriterInterface> patch_writer =
+      bsdiff::CreateBsdiffPatchWriter(patch_path);
+  TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data.data(),
+                                            old_data.size(),
+                                            new_data.data(),
+                                            new_data.size(),
+                                            patch_writer.get(),
+                                            nullptr));
+  return utils::ReadFile(patch_path, patch);
+}
+
+// Generates in |aop| the operation of type |type| writing |num_blocks| blocks
+// of |target| from |start_block|, reading the same blocks of |source|. Its
+// data is appended to |blobs|.
+bool GenerateOperation(InstallOperation::Type type,
+                       const brillo::Blob& source,
+                       const brillo::Blob& target,
+                       const vector<puffin::BitExtent>& source_deflates,
+                       const vector<puffin::BitExtent>& target_deflates,
+                       uint64_t start_block,
+                       uint64_t num_blocks,
+                       AnnotatedOperation* aop,
+                       brillo::Blob* blobs) {
+  aop->name = base::StringPrintf(
+      "%s-%" PRIu64, InstallOperationTypeName(type), start_block);
+  aop->op.set_type(type);
+  *aop->op.add_dst_extents() = ExtentForRange(start_block, num_blocks);
+  if (type == InstallOperation::ZERO)
+    return true;
+
+  uint64_t offset = start_block * kBlockSize;
+  uint64_t size = num_blocks * kBlockSize;
+  brillo::Blob new_data(target.begin() + offset,
+                        target.begin() + offset + size);
+  brillo::Blob data;
+  if (type == InstallOperation::REPLACE_XZ) {
+    TEST_AND_RETURN_FALSE(XzCompress(new_data, &data));
+  } else {
+    brillo::Blob old_data(source.begin() + offset,
+                          source.begin() + offset + size);
+    *aop->op.add_src_extents() = ExtentForRange(start_block, num_blocks);
+    brillo::Blob src_hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(old_data, &src_hash));
+    aop->op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+    if (type == InstallOperation::SOURCE_BSDIFF) {
+      TEST_AND_RETURN_FALSE(GenerateBsdiff(old_data, new_data, &data));
+    } else if (type == InstallOperation::PUFFDIFF) {
+      string patch_path;
+      TEST_AND_RETURN_FALSE(
+          utils::MakeTempFile("puffdiff-patch.XXXXXX", &patch_path, nullptr));
+      ScopedPathUnlinker patch_unlinker(patch_path);
+      TEST_AND_RETURN_FALSE(
+          puffin::PuffDiff(old_data,
+                           new_data,
+                           DeflatesInRange(source_deflates, offset, size),
+                           DeflatesInRange(target_deflates, offset, size),
+                           patch_path,
+                           &data));
+    }
+  }
+  if (!data.empty()) {
+    aop->op.set_data_offset(blobs->size());
+    aop->op.set_data_length(data.size());
+    blobs->insert(blobs->end(), data.begin(), data.end());
+  }
+  return true;
+}
+
+// Generates the source and expected target partitions of |files|, of
+// |partition_size| bytes, and the payload updating them with operations of
+// type |type| writing |operation_size| bytes each.
+bool GenerateBenchmarkPayload(InstallOperation::Type type,
+                              uint64_t partition_size,
+                              uint64_t operation_size,
+                              const BenchmarkFiles& files) {
+  std::minstd_rand rng(type);
+  brillo::Blob source(partition_size), target(partition_size);
+  vector<puffin::ByteExtent> source_zlibs, target_zlibs;
+  if (type == InstallOperation::PUFFDIFF) {
+    for (uint64_t offset = 0; offset < partition_size;
+         offset += operation_size) {
+      TEST_AND_RETURN_FALSE(
+          FillZlibStreams(&rng,
+                          offset,
+                          std::min(operation_size, partition_size - offset),
+                          &source,
+                          &target,
+                          &source_zlibs,
+                          &target_zlibs));
+    }
+  } else {
+    FillText(&rng, source.data(), source.size());
+    if (type == InstallOperation::REPLACE_XZ) {
+      FillText(&rng, target.data(), target.size());
+    } else if (type != InstallOperation::ZERO) {
+      target = source;
+      if (type == InstallOperation::SOURCE_BSDIFF)
+        Mutate(&rng, target.data(), target.size());
+    }
+  }
+  TEST_AND_RETURN_FALSE(utils::WriteFile(
+      files.source_path.c_str(), source.data(), source.size()));
+  TEST_AND_RETURN_FALSE(utils::WriteFile(
+      files.expected_path.c_str(), target.data(), target.size()));
+
+  vector<puffin::BitExtent> source_deflates, target_deflates;
+  if (type == InstallOperation::PUFFDIFF) {
+    TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInZlibBlocks(
+        files.source_path, source_zlibs, &source_deflates));
+    TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInZlibBlocks(
+        files.expected_path, target_zlibs, &target_deflates));
+  }
+
+  vector<AnnotatedOperation> aops;
+  brillo::Blob blobs;
+  uint64_t partition_blocks = partition_size / kBlockSize;
+  uint64_t operation_blocks = operation_size / kBlockSize;
+  for (uint64_t block = 0; block < partition_blocks;
+       block += operation_blocks) {
+    aops.emplace_back();
+    TEST_AND_RETURN_FALSE(
+        GenerateOperation(type,
+                          source,
+                          target,
+                          source_deflates,
+                          target_deflates,
+                          block,
+                          std::min(operation_blocks, partition_blocks - block),
+                          &aops.back(),
+                          &blobs));
+  }
+
+  string blob_path;
+  TEST_AND_RETURN_FALSE(
+      utils::MakeTempFile("BenchmarkBlobs.XXXXXX", &blob_path, nullptr));
+  ScopedPathUnlinker blob_unlinker(blob_path);
+  TEST_AND_RETURN_FALSE(
+      utils::WriteFile(blob_path.c_str(), blobs.data(), blobs.size()));
+
+  PayloadGenerationConfig config;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.version.minor = DeltaPerformer::kSupportedMinorPayloadVersion;
+  PartitionConfig old_part(kPartitionName);
+  old_part.path = files.source_path;
+  old_part.size = partition_size;
+  PartitionConfig new_part(kPartitionName);
+  new_part.path = files.expected_path;
+  new_part.size = partition_size;
+
+  PayloadFile payload;
+  TEST_AND_RETURN_FALSE(payload.Init(config));
+  TEST_AND_RETURN_FALSE(payload.AddPartition(old_part, new_part, aops));
+  uint64_t metadata_size;
+  return payload.WritePayload(
+      files.payload_path, blob_path, "", &metadata_size);
+}
+
+// Applies the payload in |payload_data| from the source to the target
+// partition of |files|, recording the time spent in |apply_stats|.
+bool ApplyBenchmarkPayload(const brillo::Blob& payload_data,
+                           const BenchmarkFiles& files,
+                           ApplyStats* apply_stats) {
+  FakeBootControl fake_boot_control;
+  FakeHardware fake_hardware;
+  MemoryPrefs prefs;
+  InstallPlan install_plan;
+  InstallPlan::Payload payload;
+  install_plan.source_slot = 0;
+  install_plan.target_slot = 1;
+  payload.type = InstallPayloadType::kDelta;
+  fake_boot_control.SetPartitionDevice(
+      kPartitionName, install_plan.source_slot, files.source_path);
+  fake_boot_control.SetPartitionDevice(
+      kPartitionName, install_plan.target_slot, files.target_path);
+
+  DeltaPerformer performer(&prefs,
+                           &fake_boot_control,
+                           &fake_hardware,
+                           nullptr,
+                           &install_plan,
+                           &payload,
+                           true);  // is_interactive
+  performer.set_apply_stats(apply_stats);
+  for (size_t offset = 0; offset < payload_data.size();
+       offset += kPayloadChunkSize) {
+    TEST_AND_RETURN_FALSE(performer.Write(
+        payload_data.data() + offset,
+        std::min(kPayloadChunkSize, payload_data.size() - offset)));
+  }
+  TEST_AND_RETURN_FALSE(performer.Close() == 0);
+  return true;
+}
+
+base::TimeDelta CpuTime(const struct rusage& usage) {
+  return base::TimeDelta::FromSeconds(usage.ru_utime.tv_sec +
+                                      usage.ru_stime.tv_sec) +
+         base::TimeDelta::FromMicroseconds(usage.ru_utime.tv_usec +
+                                           usage.ru_stime.tv_usec);
+}
+
+// Applies the payload of |files| |iterations| times and prints the
+// throughput, the CPU time and the peak RSS of the process.
+bool RunApplyBenchmark(InstallOperation::Type type,
+                       uint64_t partition_size,
+                       uint64_t num_operations,
+                       int iterations,
+                       const BenchmarkFiles& files) {
+  brillo::Blob payload_data;
+  TEST_AND_RETURN_FALSE(utils::ReadFile(files.payload_path, &payload_data));
+  xz_crc32_init();
+
+  ApplyStats apply_stats;
+  struct rusage start_usage, end_usage;
+  TEST_AND_RETURN_FALSE(getrusage(RUSAGE_SELF, &start_usage) == 0);
+  base::TimeTicks start = base::TimeTicks::Now();
+  for (int i = 0; i < iterations; i++) {
+    TEST_AND_RETURN_FALSE(
+        ApplyBenchmarkPayload(payload_data, files, &apply_stats));
+  }
+  double seconds = (base::TimeTicks::Now() - start).InSecondsF();
+  TEST_AND_RETURN_FALSE(getrusage(RUSAGE_SELF, &end_usage) == 0);
+
+  brillo::Blob expected, target;
+  TEST_AND_RETURN_FALSE(utils::ReadFile(files.expected_path, &expected));
+  TEST_AND_RETURN_FALSE(
+      utils::ReadFileChunk(files.target_path, 0, expected.size(), &target));
+  TEST_AND_RETURN_FALSE(expected == target);
+
+  // The process applies only this payload, so its maximum RSS is the peak
+  // memory used to apply it.
+  printf("%-14s %10.1f %12.1f %12.3f %14ld\n",
+         InstallOperationTypeName(type),
+         partition_size * iterations / seconds / (1024 * 1024),
+         num_operations * iterations / seconds,
+         (CpuTime(end_usage) - CpuTime(start_usage)).InSecondsF() / iterations,
+         end_usage.ru_maxrss);
+  LOG(INFO) << "Apply stats of " << InstallOperationTypeName(type) << ":\n"
+            << apply_stats.ToString();
+  return true;
+}
+
+// Runs |task| in a child process and returns whether it succeeded. Each
+// payload is generated and applied in its own process, so that the resource
+// usage measured while applying a payload doesn't include the memory used by
+// the generation or by the other payloads.
+bool RunInChildProcess(const base::Callback<bool()>& task) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    PLOG(ERROR) << "Failed to fork";
+    return false;
+  }
+  if (pid == 0) {
+    bool success = task.Run();
+    fflush(stdout);
+    _exit(success ? 0 : 1);
+  }
+  int status;
+  TEST_AND_RETURN_FALSE_ERRNO(HANDLE_EINTR(waitpid(pid, &status, 0)) == pid);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int Main(int argc, char** argv) {
+  DEFINE_string(op_types,
+                "REPLACE_XZ,SOURCE_COPY,SOURCE_BSDIFF,PUFFDIFF,ZERO",
+                "Comma separated list of the operation types to benchmark.");
+  DEFINE_int32(partition_size_mb, 64, "Size of the updated partition in MiB.");
+  DEFINE_int32(operation_size_kb,
+               1024,
+               "Size written by each operation in KiB, a multiple of 4.");
+  DEFINE_int32(iterations, 3, "Number of times each payload is applied.");
+  DEFINE_string(work_dir,
+                "/tmp",
+                "Directory where the payloads and the partitions are written. "
+                "Use a tmpfs to measure the apply without the storage.");
+  DEFINE_string(target_device,
+                "",
+                "Block device where the target partition is written instead "
+                "of a file in --work_dir. Its content is overwritten.");
+
+  brillo::FlagHelper::Init(argc, argv,
+      "Benchmarks the throughput of applying each type of install operation.");
+  logging::LoggingSettings log_settings;
+  log_settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(log_settings);
+  XzCompressInit();
+
+  uint64_t partition_size =
+      static_cast<uint64_t>(FLAGS_partition_size_mb) * 1024 * 1024;
+  uint64_t operation_size =
+      static_cast<uint64_t>(FLAGS_operation_size_kb) * 1024;
+  if (partition_size == 0 || operation_size == 0 ||
+      operation_size % kBlockSize != 0 || FLAGS_iterations <= 0) {
+    LOG(ERROR) << "Invalid partition size, operation size or iterations.";
+    return 1;
+  }
+  uint64_t num_operations =
+      (partition_size + operation_size - 1) / operation_size;
+
+  vector<InstallOperation::Type> types;
+  for (const string& name : base::SplitString(FLAGS_op_types,
+                                              ",",
+                                              base::TRIM_WHITESPACE,
+                                              base::SPLIT_WANT_NONEMPTY)) {
+    InstallOperation::Type type;
+    if (!ParseOperationType(name, &type))
+      return 1;
+    types.push_back(type);
+  }
+
+  printf("%-14s %10s %12s %12s %14s\n",
+         "operation",
+         "MiB/s",
+         "ops/s",
+         "CPU s/apply",
+         "peak RSS KiB");
+  for (InstallOperation::Type type : types) {
+    string prefix = FLAGS_work_dir + "/benchmark-" +
+                    InstallOperationTypeName(type);
+    BenchmarkFiles files;
+    files.source_path = prefix + ".source.img";
+    files.expected_path = prefix + ".expected.img";
+    files.payload_path = prefix + ".payload";
+    files.target_path = FLAGS_target_device;
+    ScopedPathUnlinker source_unlinker(files.source_path);
+    ScopedPathUnlinker expected_unlinker(files.expected_path);
+    ScopedPathUnlinker payload_unlinker(files.payload_path);
+    std::unique_ptr<ScopedPathUnlinker> target_unlinker;
+    if (files.target_path.empty()) {
+      files.target_path = prefix + ".target.img";
+      target_unlinker.reset(new ScopedPathUnlinker(files.target_path));
+      brillo::Blob zeros(partition_size);
+      if (!utils::WriteFile(
+              files.target_path.c_str(), zeros.data(), zeros.size())) {
+        return 1;
+      }
+    }
+
+    if (!RunInChildProcess(base::Bind(&GenerateBenchmarkPayload,
+                                      type,
+                                      partition_size,
+                                      operation_size,
+                                      files))) {
+      LOG(ERROR) << "Failed to generate the "
+                 << InstallOperationTypeName(type) << " payload.";
+      return 1;
+    }
+    if (!RunInChildProcess(base::Bind(&RunApplyBenchmark,
+                                      type,
+                                      partition_size,
+                                      num_operations,
+                                      FLAGS_iterations,
+                                      files))) {
+      LOG(ERROR) << "Failed to apply the " << InstallOperationTypeName(type)
+                 << " payload.";
+      return 1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  return chromeos_update_engine::Main(argc, argv);
+}
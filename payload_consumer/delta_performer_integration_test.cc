@@ -697,6 +697,10 @@ static void ApplyDeltaFile(bool full_kernel, bool full_rootfs, bool noop,
                               state->metadata_size)).WillOnce(Return(true));
   EXPECT_CALL(prefs, SetInt64(kPrefsManifestSignatureSize, 0))
       .WillOnce(Return(true));
+  EXPECT_CALL(prefs, SetString(kPrefsUpdateStateMetadata, _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(prefs, SetString(kPrefsUpdateStateMetadataPayloadHash, _))
+      .WillOnce(Return(true));
   EXPECT_CALL(prefs, SetInt64(kPrefsUpdateStateNextOperation, _))
       .WillRepeatedly(Return(true));
   EXPECT_CALL(prefs, GetInt64(kPrefsUpdateStateNextOperation, _))
@@ -709,6 +713,12 @@ static void ApplyDeltaFile(bool full_kernel, bool full_rootfs, bool noop,
       .WillRepeatedly(Return(true));
   EXPECT_CALL(prefs, SetString(kPrefsUpdateStateSignedSHA256Context, _))
       .WillRepeatedly(Return(true));
+  EXPECT_CALL(prefs, SetInt64(kPrefsUpdateStateOperationDataOffset, _))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(prefs, SetString(kPrefsUpdateStateOperationSHA256Context, _))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(prefs, StartTransaction()).WillRepeatedly(Return(true));
+  EXPECT_CALL(prefs, SubmitTransaction()).WillRepeatedly(Return(true));
   if (op_hash_test == kValidOperationData && signature_test != kSignatureNone) {
     EXPECT_CALL(prefs, SetString(kPrefsUpdateStateSignatureBlob, _))
         .WillOnce(Return(true));
@@ -17,8 +17,11 @@
 #include "update_engine/payload_consumer/delta_performer.h"
 
 #include <endian.h>
+#include <fcntl.h>
 #include <inttypes.h>
 
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -226,6 +229,22 @@ class DeltaPerformerTest : public ::testing::Test {
     return payload_data;
   }
 
+  // Makes the rootfs partition use the |target_path| and |source_path| files.
+  void SetPartitionDevices(const string& target_path,
+                           const string& source_path) {
+    // We installed the operations only in the rootfs partition, but the
+    // delta performer needs to access all the partitions.
+    fake_boot_control_.SetPartitionDevice(
+        kLegacyPartitionNameRoot, install_plan_.target_slot, target_path);
+    fake_boot_control_.SetPartitionDevice(
+        kLegacyPartitionNameRoot, install_plan_.source_slot, source_path);
+    fake_boot_control_.SetPartitionDevice(
+        kLegacyPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+    fake_boot_control_.SetPartitionDevice(kLegacyPartitionNameKernel,
+                                          install_plan_.source_slot,
+                                          kernel_source_path_);
+  }
+
   // Apply |payload_data| on partition specified in |source_path|.
   // Expect result of performer_.Write() to be |expect_success|.
   // Returns the result of the payload application.
@@ -251,19 +270,27 @@ class DeltaPerformerTest : public ::testing::Test {
     EXPECT_TRUE(utils::WriteFile(new_part.c_str(), target_data.data(),
                                  target_data.size()));
 
-    // We installed the operations only in the rootfs partition, but the
-    // delta performer needs to access all the partitions.
-    fake_boot_control_.SetPartitionDevice(
-        kLegacyPartitionNameRoot, install_plan_.target_slot, new_part);
-    fake_boot_control_.SetPartitionDevice(
-        kLegacyPartitionNameRoot, install_plan_.source_slot, source_path);
-    fake_boot_control_.SetPartitionDevice(
-        kLegacyPartitionNameKernel, install_plan_.target_slot, "/dev/null");
-    fake_boot_control_.SetPartitionDevice(
-        kLegacyPartitionNameKernel, install_plan_.source_slot, "/dev/null");
-
-    EXPECT_EQ(expect_success,
-              performer_.Write(payload_data.data(), payload_data.size()));
+    SetPartitionDevices(new_part, source_path);
+
+    // Feed the payload in chunks of |write_chunk_size_| bytes, if set, like the
+    // fetcher would do.
+    size_t chunk_size =
+        write_chunk_size_ ? write_chunk_size_ : payload_data.size();
+    bool result = true;
+    for (size_t offset = 0; result && offset < payload_data.size();
+         offset += chunk_size) {
+      const uint8_t* chunk_data = payload_data.data() + offset;
+      size_t chunk_length = std::min(chunk_size, payload_data.size() - offset);
+      if (write_shared_chunks_) {
+        auto chunk = std::make_shared<const brillo::Blob>(
+            chunk_data, chunk_data + chunk_length);
+        ErrorCode error;
+        result = performer_.WriteChunk(chunk, &error);
+      } else {
+        result = performer_.Write(chunk_data, chunk_length);
+      }
+    }
+    EXPECT_EQ(expect_success, result);
     EXPECT_EQ(0, performer_.Close());
 
     brillo::Blob partition_data;
@@ -271,6 +298,18 @@ class DeltaPerformerTest : public ::testing::Test {
     return partition_data;
   }
 
+  // Checks the whole source partition |install_part| as DeltaPerformer does
+  // when InstallPlan::verify_source_once is set.
+  bool VerifySourcePartition(const InstallPlan::Partition& install_part) {
+    performer_.source_fd_.reset(new EintrSafeFileDescriptor());
+    EXPECT_TRUE(
+        performer_.source_fd_->Open(install_part.source_path.c_str(), O_RDONLY));
+    bool result = performer_.VerifySourcePartition(install_part);
+    EXPECT_TRUE(performer_.source_fd_->Close());
+    performer_.source_fd_.reset();
+    return result;
+  }
+
   // Calls delta performer's Write method by pretending to pass in bytes from a
   // delta file whose metadata size is actual_metadata_size and tests if all
   // checks are correctly performed if the install plan contains
@@ -362,6 +401,17 @@ class DeltaPerformerTest : public ::testing::Test {
     EXPECT_TRUE(utils::FileExists(public_key_path.c_str()));
     performer_.set_public_key_path(public_key_path);
 
+    // Pass the beginning of the payload in |write_chunk_size_| increments, as
+    // if it was being downloaded, until the whole metadata is there.
+    for (size_t size = write_chunk_size_;
+         write_chunk_size_ && size < payload_.metadata_size;
+         size += write_chunk_size_) {
+      brillo::Blob partial_payload(payload.begin(), payload.begin() + size);
+      EXPECT_EQ(MetadataParseResult::kInsufficientData,
+                performer_.ParsePayloadMetadata(partial_payload,
+                                                &actual_error));
+    }
+
     // Init actual_error with an invalid value so that we make sure
     // ParsePayloadMetadata properly populates it in all cases.
     actual_error = ErrorCode::kUmaReportedMax;
@@ -378,6 +428,15 @@ class DeltaPerformerTest : public ::testing::Test {
   void SetSupportedMajorVersion(uint64_t major_version) {
     performer_.supported_major_version_ = major_version;
   }
+
+  // The size of the chunks ApplyPayload() passes to the performer, or 0 to
+  // pass the whole payload at once.
+  size_t write_chunk_size_{0};
+  // Whether ApplyPayload() passes the chunks with WriteChunk().
+  bool write_shared_chunks_{false};
+  // The source partition of the kernel used by SetPartitionDevices().
+  string kernel_source_path_{"/dev/null"};
+
   FakePrefs prefs_;
   InstallPlan install_plan_;
   InstallPlan::Payload payload_;
@@ -437,6 +496,114 @@ TEST_F(DeltaPerformerTest, ShouldCancelTest) {
   ApplyPayload(payload_data, "/dev/null", false);
 }
 
+TEST_F(DeltaPerformerTest, StoredMetadataTest) {
+  brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
+                                            std::end(kRandomString));
+  expected_data.resize(4096);  // block size
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false,
+      kChromeOSMajorPayloadVersion, kFullPayloadMinorVersion);
+  payload_.hash = {4, 5, 6};
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+
+  // The metadata and its signature were stored once parsed.
+  int64_t manifest_metadata_size, manifest_signature_size;
+  EXPECT_TRUE(
+      prefs_.GetInt64(kPrefsManifestMetadataSize, &manifest_metadata_size));
+  EXPECT_TRUE(
+      prefs_.GetInt64(kPrefsManifestSignatureSize, &manifest_signature_size));
+  const uint64_t metadata_size =
+      manifest_metadata_size + manifest_signature_size;
+  string metadata;
+  EXPECT_TRUE(DeltaPerformer::GetStoredMetadata(
+      &prefs_, payload_, metadata_size, &metadata));
+  EXPECT_EQ(string(payload_data.begin(), payload_data.begin() + metadata_size),
+            metadata);
+
+  // They are only used for the same payload and size.
+  EXPECT_FALSE(DeltaPerformer::GetStoredMetadata(
+      &prefs_, payload_, metadata_size + 1, &metadata));
+  InstallPlan::Payload other_payload = payload_;
+  other_payload.hash = {1, 2, 3};
+  EXPECT_FALSE(DeltaPerformer::GetStoredMetadata(
+      &prefs_, other_payload, metadata_size, &metadata));
+  other_payload.hash.clear();
+  EXPECT_FALSE(DeltaPerformer::GetStoredMetadata(
+      &prefs_, other_payload, metadata_size, &metadata));
+
+  EXPECT_TRUE(DeltaPerformer::ResetUpdateProgress(&prefs_, false));
+  EXPECT_FALSE(DeltaPerformer::GetStoredMetadata(
+      &prefs_, payload_, metadata_size, &metadata));
+}
+
+TEST_F(DeltaPerformerTest, StoredMetadataWithoutHashTest) {
+  brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
+                                            std::end(kRandomString));
+  expected_data.resize(4096);  // block size
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false,
+      kChromeOSMajorPayloadVersion, kFullPayloadMinorVersion);
+  EXPECT_TRUE(payload_.hash.empty());
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+
+  // Nothing is stored for a payload that can't be told apart from others.
+  EXPECT_FALSE(prefs_.Exists(kPrefsUpdateStateMetadata));
+  EXPECT_FALSE(prefs_.Exists(kPrefsUpdateStateMetadataPayloadHash));
+  string metadata;
+  EXPECT_FALSE(DeltaPerformer::GetStoredMetadata(
+      &prefs_, payload_, payload_data.size(), &metadata));
+}
+
+TEST_F(DeltaPerformerTest, ReleasePartitionOperationsTest) {
+  brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
+                                            std::end(kRandomString));
+  expected_data.resize(4096);  // block size
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  string target_path;
+  EXPECT_TRUE(utils::MakeTempFile("Partition-XXXXXX", &target_path, nullptr));
+  ScopedPathUnlinker target_unlinker(target_path);
+  SetPartitionDevices(target_path, "/dev/null");
+
+  // Only the metadata is written, so the operations are parsed, each partition
+  // in its own arena, but not applied.
+  EXPECT_TRUE(performer_.Write(payload_data.data(), payload_.metadata_size));
+  ASSERT_TRUE(performer_.IsManifestValid());
+  ASSERT_EQ(2, performer_.manifest_.partitions_size());
+  ASSERT_LE(2u, performer_.operation_arenas_.size());
+  ASSERT_TRUE(performer_.operation_arenas_[0]);
+  EXPECT_LT(0u, performer_.operation_arenas_[0]->SpaceUsed());
+  EXPECT_EQ(1, performer_.manifest_.partitions(0).operations_size());
+
+  // Releasing the rootfs operations frees their arena.
+  performer_.ReleasePartitionOperations(0);
+  EXPECT_FALSE(performer_.operation_arenas_[0]);
+  EXPECT_EQ(0, performer_.manifest_.partitions(0).operations_size());
+  EXPECT_TRUE(performer_.operation_arenas_[1]);
+  EXPECT_EQ(0, performer_.Close());
+}
+
 TEST_F(DeltaPerformerTest, ReplaceOperationTest) {
   brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
                                             std::end(kRandomString));
@@ -454,6 +621,208 @@ TEST_F(DeltaPerformerTest, ReplaceOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, WrittenHashTest) {
+  install_plan_.verify_written_hash = true;
+  brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
+                                            std::end(kRandomString));
+  expected_data.resize(4096);  // block size
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, {aop}, false);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  ASSERT_EQ(2U, install_plan_.partitions.size());
+  // The hash only covers the partition size, smaller than the block written.
+  const InstallPlan::Partition& install_part = install_plan_.partitions[0];
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+      expected_data.data(), install_part.target_size, &expected_hash));
+  EXPECT_EQ(expected_hash, install_part.target_written_hash);
+  EXPECT_EQ(1U, install_part.target_written_sample_hashes.size());
+}
+
+TEST_F(DeltaPerformerTest, PipelinedReplaceOperationsTest) {
+  install_plan_.pipelined_apply = true;
+  brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
+                                            std::end(kRandomString));
+  expected_data.resize(4096 * 3);  // 3 blocks
+  vector<AnnotatedOperation> aops;
+  for (uint64_t block = 0; block < 3; block++) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(block, 1);
+    aop.op.set_data_offset(block * 4096);
+    aop.op.set_data_length(4096);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+  }
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  // All the operations were applied before the progress was checkpointed.
+  int64_t next_operation = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation));
+  EXPECT_EQ(3, next_operation);
+}
+
+TEST_F(DeltaPerformerTest, ParallelReplaceOperationsTest) {
+  install_plan_.apply_threads = 3;
+  brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
+                                            std::end(kRandomString));
+  expected_data.resize(4096 * 6);  // 6 blocks
+  vector<AnnotatedOperation> aops;
+  // Write the blocks out of order, one at a time, so the operations writing to
+  // disjoint blocks are applied concurrently.
+  for (uint64_t block : {5, 0, 3, 1, 4, 2}) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(block, 1);
+    aop.op.set_data_offset(aops.size() * 4096);
+    aop.op.set_data_length(4096);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+  }
+  brillo::Blob blob_data;
+  for (const AnnotatedOperation& aop : aops) {
+    uint64_t offset = aop.op.dst_extents(0).start_block() * 4096;
+    blob_data.insert(blob_data.end(),
+                     expected_data.begin() + offset,
+                     expected_data.begin() + offset + 4096);
+  }
+
+  brillo::Blob payload_data = GeneratePayload(blob_data, aops, false);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  int64_t next_operation = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation));
+  EXPECT_EQ(6, next_operation);
+}
+
+TEST_F(DeltaPerformerTest, SharedChunkReplaceOperationsTest) {
+  install_plan_.pipelined_apply = true;
+  // Big enough for the data to be kept by reference.
+  const size_t op_size = DeltaPerformer::kMinSharedDataSize;
+  brillo::Blob expected_data(op_size * 3);
+  for (size_t i = 0; i < expected_data.size(); i++)
+    expected_data[i] = kRandomString[i % sizeof(kRandomString)];
+  vector<AnnotatedOperation> aops;
+  for (uint64_t i = 0; i < 3; i++) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) =
+        ExtentForRange(i * op_size / 4096, op_size / 4096);
+    aop.op.set_data_offset(i * op_size);
+    aop.op.set_data_length(op_size);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+  }
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  // The chunks don't line up with the operations, so their data is split
+  // between chunks.
+  write_chunk_size_ = op_size + 1000;
+  write_shared_chunks_ = true;
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  int64_t next_operation = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation));
+  EXPECT_EQ(3, next_operation);
+}
+
+TEST_F(DeltaPerformerTest, StreamedReplaceOperationTest) {
+  // Big enough to be applied as the data is received.
+  brillo::Blob expected_data(DeltaPerformer::kMinStreamedOperationSize + 4096);
+  for (size_t i = 0; i < expected_data.size(); i++)
+    expected_data[i] = kRandomString[i % sizeof(kRandomString)];
+
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) =
+      ExtentForRange(0, expected_data.size() / 4096);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  write_chunk_size_ = 64 * 1024;
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  int64_t next_operation = 0;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation));
+  EXPECT_EQ(1, next_operation);
+}
+
+TEST_F(DeltaPerformerTest, StreamedOperationResumeTest) {
+  brillo::Blob expected_data(2 *
+                             DeltaPerformer::kStreamedOperationCheckpointSize);
+  for (size_t i = 0; i < expected_data.size(); i++)
+    expected_data[i] = kRandomString[i % sizeof(kRandomString)];
+
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) =
+      ExtentForRange(0, expected_data.size() / 4096);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  string new_part;
+  EXPECT_TRUE(utils::MakeTempFile("Partition-XXXXXX", &new_part, nullptr));
+  ScopedPathUnlinker partition_unlinker(new_part);
+  SetPartitionDevices(new_part, "/dev/null");
+
+  // Interrupt the update a bit after the first checkpoint of the operation.
+  EXPECT_TRUE(performer_.Write(
+      payload_data.data(),
+      payload_.metadata_size +
+          DeltaPerformer::kStreamedOperationCheckpointSize + 4096));
+  EXPECT_EQ(0, performer_.Close());
+
+  int64_t next_operation = -1;
+  int64_t next_data_offset = -1;
+  int64_t operation_data_offset = -1;
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation));
+  EXPECT_TRUE(
+      prefs_.GetInt64(kPrefsUpdateStateNextDataOffset, &next_data_offset));
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateOperationDataOffset,
+                              &operation_data_offset));
+  EXPECT_EQ(0, next_operation);
+  EXPECT_EQ(DeltaPerformer::kStreamedOperationCheckpointSize,
+            static_cast<uint64_t>(next_data_offset));
+  EXPECT_EQ(DeltaPerformer::kStreamedOperationCheckpointSize,
+            static_cast<uint64_t>(operation_data_offset));
+
+  // Resume with the metadata and the data after the checkpoint only.
+  DeltaPerformer resumed_performer{&prefs_,
+                                   &fake_boot_control_,
+                                   &fake_hardware_,
+                                   &mock_delegate_,
+                                   &install_plan_,
+                                   &payload_,
+                                   false /* is_interactive*/};
+  EXPECT_TRUE(
+      resumed_performer.Write(payload_data.data(), payload_.metadata_size));
+  size_t resume_offset = payload_.metadata_size + next_data_offset;
+  EXPECT_TRUE(resumed_performer.Write(payload_data.data() + resume_offset,
+                                      payload_data.size() - resume_offset));
+  EXPECT_EQ(0, resumed_performer.Close());
+
+  brillo::Blob partition_data;
+  EXPECT_TRUE(utils::ReadFile(new_part, &partition_data));
+  EXPECT_EQ(expected_data, partition_data);
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation));
+  EXPECT_EQ(1, next_operation);
+  EXPECT_TRUE(prefs_.GetInt64(kPrefsUpdateStateOperationDataOffset,
+                              &operation_data_offset));
+  EXPECT_EQ(0, operation_data_offset);
+}
+
 TEST_F(DeltaPerformerTest, ReplaceBzOperationTest) {
   brillo::Blob expected_data = brillo::Blob(std::begin(kRandomString),
                                             std::end(kRandomString));
@@ -516,6 +885,36 @@ TEST_F(DeltaPerformerTest, ZeroOperationTest) {
             ApplyPayloadToData(payload_data, "/dev/null", existing_data, true));
 }
 
+TEST_F(DeltaPerformerTest, ZeroOperationBatchTest) {
+  brillo::Blob existing_data = brillo::Blob(4096 * 10, 'a');
+  brillo::Blob expected_data = existing_data;
+  // Blocks 1 to 3, 5 and 8 should have zeros instead of 'a' after the
+  // operations are applied.
+  std::fill(expected_data.data() + 4096 * 1, expected_data.data() + 4096 * 4,
+            0);
+  std::fill(expected_data.data() + 4096 * 5, expected_data.data() + 4096 * 6,
+            0);
+  std::fill(expected_data.data() + 4096 * 8, expected_data.data() + 4096 * 9,
+            0);
+
+  // The consecutive ZERO and DISCARD operations are batched separately.
+  vector<AnnotatedOperation> aops(4);
+  *(aops[0].op.add_dst_extents()) = ExtentForRange(3, 1);
+  aops[0].op.set_type(InstallOperation::ZERO);
+  *(aops[1].op.add_dst_extents()) = ExtentForRange(8, 1);
+  *(aops[1].op.add_dst_extents()) = ExtentForRange(1, 2);
+  aops[1].op.set_type(InstallOperation::ZERO);
+  *(aops[2].op.add_dst_extents()) = ExtentForRange(5, 1);
+  aops[2].op.set_type(InstallOperation::DISCARD);
+  *(aops[3].op.add_dst_extents()) = ExtentForRange(8, 1);
+  aops[3].op.set_type(InstallOperation::ZERO);
+
+  brillo::Blob payload_data = GeneratePayload(brillo::Blob(), aops, false);
+
+  EXPECT_EQ(expected_data,
+            ApplyPayloadToData(payload_data, "/dev/null", existing_data, true));
+}
+
 TEST_F(DeltaPerformerTest, SourceCopyOperationTest) {
   brillo::Blob expected_data(std::begin(kRandomString),
                              std::end(kRandomString));
@@ -541,6 +940,177 @@ TEST_F(DeltaPerformerTest, SourceCopyOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, source_path, true));
 }
 
+// Returns the SOURCE_COPY operations used by the batch tests, copying the
+// blocks 0 to 3 of the |source_data| to the same blocks of the target and its
+// block 5 to the block 4. The first three follow each other in both
+// partitions and are batched.
+namespace {
+vector<AnnotatedOperation> GetSourceCopyBatchOperations(
+    const brillo::Blob& source_data) {
+  const std::pair<uint64_t, uint64_t> kSourceAndTarget[][2] = {
+      {{0, 1}, {0, 1}}, {{1, 2}, {1, 2}}, {{3, 1}, {3, 1}}, {{5, 1}, {4, 1}}};
+  vector<AnnotatedOperation> aops;
+  for (const auto& ranges : kSourceAndTarget) {
+    AnnotatedOperation aop;
+    aop.op.set_type(InstallOperation::SOURCE_COPY);
+    *(aop.op.add_src_extents()) =
+        ExtentForRange(ranges[0].first, ranges[0].second);
+    *(aop.op.add_dst_extents()) =
+        ExtentForRange(ranges[1].first, ranges[1].second);
+    brillo::Blob src_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        source_data.data() + ranges[0].first * 4096,
+        ranges[0].second * 4096,
+        &src_hash));
+    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    aops.push_back(aop);
+  }
+  return aops;
+}
+}  // namespace
+
+TEST_F(DeltaPerformerTest, SourceCopyOperationBatchTest) {
+  brillo::Blob source_data;
+  for (char c = 'a'; c < 'g'; c++)
+    source_data.insert(source_data.end(), 4096, c);
+  brillo::Blob expected_data(source_data.begin(),
+                             source_data.begin() + 4096 * 4);
+  expected_data.insert(expected_data.end(), 4096, 'f');
+
+  brillo::Blob payload_data = GeneratePayload(
+      brillo::Blob(), GetSourceCopyBatchOperations(source_data), false);
+
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  EXPECT_TRUE(utils::WriteFile(
+      source_path.c_str(), source_data.data(), source_data.size()));
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, source_path, true));
+}
+
+TEST_F(DeltaPerformerTest, SourceCopyOperationBatchHashMismatchTest) {
+  brillo::Blob source_data;
+  for (char c = 'a'; c < 'g'; c++)
+    source_data.insert(source_data.end(), 4096, c);
+  vector<AnnotatedOperation> aops = GetSourceCopyBatchOperations(source_data);
+
+  // The source of the operation in the middle of the batch was modified,
+  // which the hash of the whole batch would miss.
+  source_data[4096 * 2] = 'z';
+  brillo::Blob payload_data = GeneratePayload(brillo::Blob(), aops, false);
+
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  EXPECT_TRUE(utils::WriteFile(
+      source_path.c_str(), source_data.data(), source_data.size()));
+
+  ApplyPayload(payload_data, source_path, false);
+}
+
+TEST_F(DeltaPerformerTest, PartitionCopyOperationTest) {
+  brillo::Blob kernel_data(4096, 'a');
+  kernel_data.insert(kernel_data.end(), 4096, 'b');
+  AnnotatedOperation aop;
+  aop.op.set_type(InstallOperation::PARTITION_COPY);
+  aop.op.set_src_partition_name(kLegacyPartitionNameKernel);
+  *(aop.op.add_src_extents()) = ExtentForRange(1, 1);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  brillo::Blob expected_data(4096, 'b');
+  brillo::Blob src_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(expected_data, &src_hash));
+  aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  brillo::Blob payload_data = GeneratePayload(brillo::Blob(), {aop}, false);
+
+  EXPECT_TRUE(
+      utils::MakeTempFile("Kernel-XXXXXX", &kernel_source_path_, nullptr));
+  ScopedPathUnlinker kernel_unlinker(kernel_source_path_);
+  EXPECT_TRUE(utils::WriteFile(
+      kernel_source_path_.c_str(), kernel_data.data(), kernel_data.size()));
+  // The rootfs source has other data, which would fail the source hash check.
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  brillo::Blob source_data(4096 * 2, 'z');
+  EXPECT_TRUE(utils::WriteFile(
+      source_path.c_str(), source_data.data(), source_data.size()));
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, source_path, true));
+}
+
+TEST_F(DeltaPerformerTest, PartitionCopyMissingSourceHashTest) {
+  brillo::Blob kernel_data(4096, 'a');
+  AnnotatedOperation aop;
+  aop.op.set_type(InstallOperation::PARTITION_COPY);
+  aop.op.set_src_partition_name(kLegacyPartitionNameKernel);
+  *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+
+  brillo::Blob payload_data = GeneratePayload(brillo::Blob(), {aop}, false);
+
+  EXPECT_TRUE(
+      utils::MakeTempFile("Kernel-XXXXXX", &kernel_source_path_, nullptr));
+  ScopedPathUnlinker kernel_unlinker(kernel_source_path_);
+  EXPECT_TRUE(utils::WriteFile(
+      kernel_source_path_.c_str(), kernel_data.data(), kernel_data.size()));
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  EXPECT_TRUE(utils::WriteFile(
+      source_path.c_str(), kernel_data.data(), kernel_data.size()));
+
+  // The source of another partition isn't covered by any other check, so the
+  // operation is rejected.
+  ApplyPayload(payload_data, source_path, false);
+}
+
+TEST_F(DeltaPerformerTest, PartitionCopyUnknownPartitionTest) {
+  AnnotatedOperation aop;
+  aop.op.set_type(InstallOperation::PARTITION_COPY);
+  aop.op.set_src_partition_name("vendor");
+  *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+
+  brillo::Blob payload_data = GeneratePayload(brillo::Blob(), {aop}, false);
+
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  brillo::Blob source_data(4096, 'a');
+  EXPECT_TRUE(utils::WriteFile(
+      source_path.c_str(), source_data.data(), source_data.size()));
+
+  ApplyPayload(payload_data, source_path, false);
+}
+
+TEST_F(DeltaPerformerTest, CloneSourceCopyOperationTest) {
+  install_plan_.clone_source_copy = true;
+  brillo::Blob expected_data(std::begin(kRandomString),
+                             std::end(kRandomString));
+  expected_data.resize(4096 * 2);  // two blocks
+  AnnotatedOperation aop;
+  *(aop.op.add_src_extents()) = ExtentForRange(0, 2);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 2);
+  aop.op.set_type(InstallOperation::SOURCE_COPY);
+  brillo::Blob src_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(expected_data, &src_hash));
+  aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  brillo::Blob payload_data = GeneratePayload(brillo::Blob(), {aop}, false);
+
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  EXPECT_TRUE(utils::WriteFile(source_path.c_str(),
+                               expected_data.data(),
+                               expected_data.size()));
+
+  // The data is copied by the kernel if supported, through a buffer otherwise.
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, source_path, true));
+}
+
 TEST_F(DeltaPerformerTest, PuffdiffOperationTest) {
   AnnotatedOperation aop;
   *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
@@ -567,6 +1137,30 @@ TEST_F(DeltaPerformerTest, PuffdiffOperationTest) {
   EXPECT_EQ(dst, ApplyPayload(payload_data, source_path, true));
 }
 
+TEST_F(DeltaPerformerTest, MmapSourcePuffdiffOperationTest) {
+  install_plan_.mmap_source = true;
+  AnnotatedOperation aop;
+  *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  brillo::Blob puffdiff_payload(std::begin(puffdiff_patch),
+                                std::end(puffdiff_patch));
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(puffdiff_payload.size());
+  aop.op.set_type(InstallOperation::PUFFDIFF);
+  brillo::Blob src(std::begin(src_deflates), std::end(src_deflates));
+  src.resize(4096);  // block size
+
+  brillo::Blob payload_data = GeneratePayload(puffdiff_payload, {aop}, false);
+
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  EXPECT_TRUE(utils::WriteFile(source_path.c_str(), src.data(), src.size()));
+
+  brillo::Blob dst(std::begin(dst_deflates), std::end(dst_deflates));
+  EXPECT_EQ(dst, ApplyPayload(payload_data, source_path, true));
+}
+
 TEST_F(DeltaPerformerTest, SourceHashMismatchTest) {
   brillo::Blob expected_data = {'f', 'o', 'o'};
   brillo::Blob actual_data = {'b', 'a', 'r'};
@@ -592,6 +1186,29 @@ TEST_F(DeltaPerformerTest, SourceHashMismatchTest) {
   EXPECT_EQ(actual_data, ApplyPayload(payload_data, source_path, false));
 }
 
+TEST_F(DeltaPerformerTest, VerifySourcePartitionTest) {
+  brillo::Blob source_data(3 * 4096, 'x');
+  string source_path;
+  EXPECT_TRUE(utils::MakeTempFile("Source-XXXXXX", &source_path, nullptr));
+  ScopedPathUnlinker path_unlinker(source_path);
+  EXPECT_TRUE(utils::WriteFile(source_path.c_str(), source_data.data(),
+                               source_data.size()));
+
+  InstallPlan::Partition install_part;
+  install_part.name = kLegacyPartitionNameRoot;
+  install_part.source_path = source_path;
+  install_part.source_size = source_data.size();
+  // No expected hash to check against.
+  EXPECT_FALSE(VerifySourcePartition(install_part));
+
+  EXPECT_TRUE(
+      HashCalculator::RawHashOfData(source_data, &install_part.source_hash));
+  EXPECT_TRUE(VerifySourcePartition(install_part));
+
+  install_part.source_hash[0] ^= 1;
+  EXPECT_FALSE(VerifySourcePartition(install_part));
+}
+
 TEST_F(DeltaPerformerTest, ExtentsToByteStringTest) {
   uint64_t test[] = {1, 1, 4, 2, 0, 1};
   static_assert(arraysize(test) % 2 == 0, "Array size uneven");
@@ -735,6 +1352,31 @@ TEST_F(DeltaPerformerTest, ValidateManifestDowngrade) {
                         ErrorCode::kPayloadTimestampError);
 }
 
+TEST_F(DeltaPerformerTest, ValidateManifestSplitPartitionDataTest) {
+  // The Manifest we are validating.
+  DeltaArchiveManifest manifest;
+  manifest.set_minor_version(kFullPayloadMinorVersion);
+  PartitionUpdate* partition = manifest.add_partitions();
+  partition->set_data_offset(100);
+  partition->set_data_length(50);
+  partition->set_data_sha256_hash("hash");
+  InstallOperation* op = partition->add_operations();
+  op->set_data_offset(100);
+  op->set_data_length(50);
+
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kFull,
+                        ErrorCode::kSuccess);
+
+  // The data of the operation ends after the partition data.
+  op->set_data_length(51);
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kFull,
+                        ErrorCode::kDownloadManifestParseError);
+}
+
 TEST_F(DeltaPerformerTest, BrilloMetadataSignatureSizeTest) {
   EXPECT_TRUE(performer_.Write(kDeltaMagic, sizeof(kDeltaMagic)));
 
@@ -823,8 +1465,18 @@ TEST_F(DeltaPerformerTest, NonMandatoryValidMetadataSignatureTest) {
   DoMetadataSignatureTest(kValidMetadataSignature, true, false);
 }
 
+TEST_F(DeltaPerformerTest, MandatoryValidMetadataSignatureInChunksTest) {
+  write_chunk_size_ = 7;
+  DoMetadataSignatureTest(kValidMetadataSignature, true, true);
+}
+
+TEST_F(DeltaPerformerTest, MandatoryInvalidMetadataSignatureInChunksTest) {
+  write_chunk_size_ = 7;
+  DoMetadataSignatureTest(kInvalidMetadataSignature, true, true);
+}
+
 TEST_F(DeltaPerformerTest, UsePublicKeyFromResponse) {
-  base::FilePath key_path;
+  std::shared_ptr<const PublicKey> public_key;
 
   // The result of the GetPublicKeyResponse() method is based on three things
   //
@@ -849,47 +1501,47 @@ TEST_F(DeltaPerformerTest, UsePublicKeyFromResponse) {
   performer_.public_key_path_ = non_existing_file;
   // result of 'echo "Test" | base64'
   install_plan_.public_key_rsa = "VGVzdAo=";
-  EXPECT_TRUE(performer_.GetPublicKeyFromResponse(&key_path));
-  EXPECT_FALSE(key_path.empty());
-  EXPECT_EQ(unlink(key_path.value().c_str()), 0);
+  EXPECT_TRUE(performer_.GetPublicKeyFromResponse(&public_key));
+  // The key is parsed in memory, and this one isn't a valid key.
+  EXPECT_FALSE(public_key);
   // Same with official build -> false
   fake_hardware_.SetIsOfficialBuild(true);
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
 
   // Non-official build, existing public-key, key in response -> false
   fake_hardware_.SetIsOfficialBuild(false);
   performer_.public_key_path_ = existing_file;
   // result of 'echo "Test" | base64'
   install_plan_.public_key_rsa = "VGVzdAo=";
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
   // Same with official build -> false
   fake_hardware_.SetIsOfficialBuild(true);
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
 
   // Non-official build, non-existing public-key, no key in response -> false
   fake_hardware_.SetIsOfficialBuild(false);
   performer_.public_key_path_ = non_existing_file;
   install_plan_.public_key_rsa = "";
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
   // Same with official build -> false
   fake_hardware_.SetIsOfficialBuild(true);
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
 
   // Non-official build, existing public-key, no key in response -> false
   fake_hardware_.SetIsOfficialBuild(false);
   performer_.public_key_path_ = existing_file;
   install_plan_.public_key_rsa = "";
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
   // Same with official build -> false
   fake_hardware_.SetIsOfficialBuild(true);
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
 
   // Non-official build, non-existing public-key, key in response
   // but invalid base64 -> false
   fake_hardware_.SetIsOfficialBuild(false);
   performer_.public_key_path_ = non_existing_file;
   install_plan_.public_key_rsa = "not-valid-base64";
-  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&key_path));
+  EXPECT_FALSE(performer_.GetPublicKeyFromResponse(&public_key));
 }
 
 TEST_F(DeltaPerformerTest, ConfVersionsMatch) {
@@ -0,0 +1,176 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/direct_file_descriptor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+namespace chromeos_update_engine {
+
+bool AlignedBuffer::Reserve(size_t size) {
+  if (size <= size_)
+    return true;
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, alignment_, size) != 0)
+    return false;
+  data_.reset(static_cast<uint8_t*>(ptr));
+  size_ = size;
+  return true;
+}
+
+bool AlignedBuffer::Reallocate(size_t size) {
+  if (size == size_)
+    return true;
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, alignment_, size) != 0)
+    return false;
+  data_.reset(static_cast<uint8_t*>(ptr));
+  size_ = size;
+  return true;
+}
+
+const size_t DirectFileDescriptor::kAlignment = 4096;
+
+bool DirectFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  if (EintrSafeFileDescriptor::Open(path, flags | O_DIRECT, mode)) {
+    OnOpened(true);
+    return true;
+  }
+  // Not all the file systems support O_DIRECT.
+  if (errno != EINVAL || !EintrSafeFileDescriptor::Open(path, flags, mode))
+    return false;
+  OnOpened(false);
+  return true;
+}
+
+bool DirectFileDescriptor::Open(const char* path, int flags) {
+  if (EintrSafeFileDescriptor::Open(path, flags | O_DIRECT)) {
+    OnOpened(true);
+    return true;
+  }
+  if (errno != EINVAL || !EintrSafeFileDescriptor::Open(path, flags))
+    return false;
+  OnOpened(false);
+  return true;
+}
+
+void DirectFileDescriptor::OnOpened(bool direct) {
+  direct_ = direct;
+  offset_ = 0;
+  LOG_IF(INFO, !direct_) << "O_DIRECT not supported, using buffered I/O.";
+}
+
+ssize_t DirectFileDescriptor::Read(void* buf, size_t count) {
+  CHECK_GE(fd_, 0);
+  ssize_t ret;
+  if (!direct_ || (IsAligned(offset_) && IsAligned(count) &&
+                   IsAligned(reinterpret_cast<uintptr_t>(buf)))) {
+    ret = HANDLE_EINTR(pread64(fd_, buf, count, offset_));
+  } else {
+    // Read the aligned range of blocks covering the requested one.
+    off64_t begin = offset_ - offset_ % kAlignment;
+    size_t end = offset_ + count;
+    end += (kAlignment - end % kAlignment) % kAlignment;
+    if (!bounce_buffer_.Reserve(end - begin)) {
+      errno = ENOMEM;
+      return -1;
+    }
+    ret = HANDLE_EINTR(
+        pread64(fd_, bounce_buffer_.data(), end - begin, begin));
+    if (ret >= 0) {
+      // The read may end before the requested range at the end of the file.
+      ssize_t skip = offset_ - begin;
+      ret = std::max<ssize_t>(
+          0, std::min<ssize_t>(ret - skip, static_cast<ssize_t>(count)));
+      memcpy(buf, bounce_buffer_.data() + skip, ret);
+    }
+  }
+  if (ret > 0)
+    offset_ += ret;
+  return ret;
+}
+
+ssize_t DirectFileDescriptor::Write(const void* buf, size_t count) {
+  CHECK_GE(fd_, 0);
+  if (direct_ && !(IsAligned(offset_) && IsAligned(count)) &&
+      !DisableDirectIo()) {
+    return -1;
+  }
+
+  const void* src = buf;
+  if (direct_ && !IsAligned(reinterpret_cast<uintptr_t>(buf))) {
+    if (!bounce_buffer_.Reserve(count)) {
+      errno = ENOMEM;
+      return -1;
+    }
+    memcpy(bounce_buffer_.data(), buf, count);
+    src = bounce_buffer_.data();
+  }
+  ssize_t ret = HANDLE_EINTR(pwrite64(fd_, src, count, offset_));
+  if (ret > 0)
+    offset_ += ret;
+  return ret;
+}
+
+off64_t DirectFileDescriptor::Seek(off64_t offset, int whence) {
+  CHECK_GE(fd_, 0);
+  off64_t new_offset;
+  switch (whence) {
+    case SEEK_SET:
+      new_offset = offset;
+      break;
+    case SEEK_CUR:
+      new_offset = offset_ + offset;
+      break;
+    default:
+      new_offset = lseek64(fd_, offset, whence);
+      if (new_offset < 0)
+        return -1;
+  }
+  if (new_offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  offset_ = new_offset;
+  return offset_;
+}
+
+bool DirectFileDescriptor::Close() {
+  direct_ = false;
+  return EintrSafeFileDescriptor::Close();
+}
+
+bool DirectFileDescriptor::DisableDirectIo() {
+  LOG(WARNING) << "Unaligned write at offset " << offset_
+               << ", switching to buffered I/O.";
+  int flags = fcntl(fd_, F_GETFL);
+  if (flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0) {
+    PLOG(ERROR) << "Unable to disable O_DIRECT";
+    return false;
+  }
+  direct_ = false;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
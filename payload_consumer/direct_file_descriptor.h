@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_DIRECT_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_DIRECT_FILE_DESCRIPTOR_H_
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <memory>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A heap buffer whose address is aligned to |alignment| bytes, as required by
+// the I/O on files opened with O_DIRECT.
+class AlignedBuffer {
+ public:
+  explicit AlignedBuffer(size_t alignment) : alignment_(alignment) {}
+
+  // Resizes the buffer to at least |size| bytes. The previous contents are
+  // discarded when it grows. Returns false if the allocation failed.
+  bool Reserve(size_t size);
+
+  // Replaces the buffer with one of exactly |size| bytes, which can also
+  // shrink it. The previous contents are discarded. Returns false, keeping
+  // the previous buffer, if the allocation failed.
+  bool Reallocate(size_t size);
+
+  uint8_t* data() { return data_.get(); }
+  size_t size() const { return size_; }
+
+ private:
+  struct FreeDeleter {
+    void operator()(void* ptr) const { free(ptr); }
+  };
+
+  const size_t alignment_;
+  std::unique_ptr<uint8_t, FreeDeleter> data_;
+  size_t size_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(AlignedBuffer);
+};
+
+// A file descriptor bypassing the page cache with O_DIRECT, so writing a whole
+// partition doesn't evict the working set of the rest of the system. Buffers
+// not aligned to |kAlignment| are copied to an aligned bounce buffer first,
+// and unaligned reads are served from an aligned read of the blocks around
+// them.
+//
+// The file falls back to regular buffered I/O if it doesn't support O_DIRECT,
+// or on the first write not aligned to |kAlignment|, which O_DIRECT can't do.
+class DirectFileDescriptor : public EintrSafeFileDescriptor {
+ public:
+  // The alignment of the offsets, sizes and buffers of the O_DIRECT I/O,
+  // which covers the logical block size of the storage devices.
+  static const size_t kAlignment;
+
+  DirectFileDescriptor() = default;
+  ~DirectFileDescriptor() override = default;
+
+  // Interface methods.
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  bool Close() override;
+
+  // Returns whether the file is currently accessed with O_DIRECT.
+  bool IsDirect() const { return direct_; }
+
+  static bool IsAligned(uint64_t value) { return value % kAlignment == 0; }
+
+ private:
+  // Called after opening the file with |flags|, which included O_DIRECT if
+  // |direct|.
+  void OnOpened(bool direct);
+
+  // Switches the file to buffered I/O. Returns whether it succeeded.
+  bool DisableDirectIo();
+
+  bool direct_{false};
+  // The offset of the next Read() or Write().
+  off64_t offset_{0};
+  // The bounce buffer for the unaligned reads and writes.
+  AlignedBuffer bounce_buffer_{kAlignment};
+
+  DISALLOW_COPY_AND_ASSIGN(DirectFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_DIRECT_FILE_DESCRIPTOR_H_
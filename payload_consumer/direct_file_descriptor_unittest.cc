@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/direct_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const size_t kFileSize = 16 * 4096;
+}  // namespace
+
+// The temporary file system may not support O_DIRECT, in which case these
+// tests check the buffered fallback.
+class DirectFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    brillo::Blob zero_blob(kFileSize, 0);
+    EXPECT_TRUE(utils::WriteFile(
+        temp_file_.path().c_str(), zero_blob.data(), zero_blob.size()));
+    EXPECT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+  }
+
+  void TearDown() override { EXPECT_TRUE(fd_->Close()); }
+
+  std::shared_ptr<DirectFileDescriptor> fd_{new DirectFileDescriptor()};
+  test_utils::ScopedTempFile temp_file_{"DirectFileDescriptor-file.XXXXXX"};
+};
+
+TEST_F(DirectFileDescriptorTest, AlignedWriteTest) {
+  bool was_direct = fd_->IsDirect();
+  brillo::Blob blob_in(kFileSize);
+  for (size_t i = 0; i < blob_in.size(); i++)
+    blob_in[i] = i % 251;
+  EXPECT_EQ(0, fd_->Seek(0, SEEK_SET));
+  // An unaligned buffer address is copied to the bounce buffer.
+  EXPECT_TRUE(utils::WriteAll(fd_, blob_in.data(), 4096));
+  EXPECT_TRUE(utils::WriteAll(fd_, blob_in.data() + 4096, kFileSize - 4096));
+  EXPECT_TRUE(fd_->Flush());
+  EXPECT_EQ(was_direct, fd_->IsDirect());
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(DirectFileDescriptorTest, UnalignedWriteFallsBackTest) {
+  brillo::Blob blob_in(10, 0x5a);
+  EXPECT_EQ(100, fd_->Seek(100, SEEK_SET));
+  EXPECT_TRUE(utils::WriteAll(fd_, blob_in.data(), blob_in.size()));
+  EXPECT_FALSE(fd_->IsDirect());
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  ASSERT_EQ(kFileSize, blob_out.size());
+  EXPECT_EQ(blob_in, brillo::Blob(blob_out.begin() + 100,
+                                  blob_out.begin() + 110));
+}
+
+TEST_F(DirectFileDescriptorTest, UnalignedReadTest) {
+  brillo::Blob blob_in(4096, 0x33);
+  EXPECT_EQ(4096, fd_->Seek(4096, SEEK_SET));
+  EXPECT_TRUE(utils::WriteAll(fd_, blob_in.data(), blob_in.size()));
+
+  brillo::Blob blob_out(100);
+  EXPECT_EQ(4000, fd_->Seek(4000, SEEK_SET));
+  EXPECT_EQ(100, fd_->Read(blob_out.data(), blob_out.size()));
+  EXPECT_EQ(4100, fd_->Seek(0, SEEK_CUR));
+  brillo::Blob expected(96, 0);
+  expected.insert(expected.end(), 4, 0x33);
+  EXPECT_EQ(expected, blob_out);
+}
+
+}  // namespace chromeos_update_engine
@@ -17,19 +17,26 @@
 #include "update_engine/payload_consumer/download_action.h"
 
 #include <errno.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <memory>
 #include <string>
+#include <utility>
 
+#include <base/bind.h>
 #include <base/files/file_path.h>
 #include <base/metrics/statistics_recorder.h>
 #include <base/strings/stringprintf.h>
 
 #include "update_engine/common/action_pipe.h"
+#include "update_engine/common/blob_pool.h"
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/error_code_utils.h"
+#include "update_engine/common/file_fetcher.h"
 #include "update_engine/common/multi_range_http_fetcher.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/connection_manager_interface.h"
 #include "update_engine/omaha_request_params.h"
 #include "update_engine/p2p_manager.h"
 #include "update_engine/payload_state_interface.h"
@@ -39,6 +46,36 @@ using std::string;
 
 namespace chromeos_update_engine {
 
+namespace {
+// The file in the non-volatile directory where the apply trace is written.
+const char kApplyTraceFileName[] = "apply_trace.json";
+// The file in the non-volatile directory where the I/O trace is written.
+const char kIOTraceFileName[] = "io_trace.bin";
+
+// The payload bytes queued for the p2p file at most, before the download
+// waits for them to be written.
+const size_t kP2PMaxPendingBytes = 16 * 1024 * 1024;
+
+// The largest payload written to an invisible p2p file when it isn't shared,
+// as a cache for the next attempts. P2PManager::FileShare() also requires
+// twice its size to be free.
+const uint64_t kMaxCachedPayloadSize = 2ULL * 1024 * 1024 * 1024;
+
+// The bytes requested after the metadata of an already applied payload, for
+// its metadata signature, which isn't included in the metadata size.
+const uint64_t kMetadataSignatureAllowance = 64 * 1024;
+
+// How often the quality of the network link is checked during the download.
+const int kConnectionQualityCheckSeconds = 30;
+
+// The wireless signal strength under which the link is considered weak. The
+// parallel connections of a weak link mostly compete for the same airtime,
+// and its stalls are less costly with smaller chunks.
+const int kWeakSignalStrength = 40;
+const size_t kWeakLinkConnections = 2;
+const size_t kWeakLinkChunkSize = 1024 * 1024;
+}  // namespace
+
 DownloadAction::DownloadAction(PrefsInterface* prefs,
                                BootControlInterface* boot_control,
                                HardwareInterface* hardware,
@@ -56,12 +93,16 @@ DownloadAction::DownloadAction(PrefsInterface* prefs,
       delegate_(nullptr),
       p2p_sharing_fd_(-1),
       p2p_visible_(true) {
+  http_fetcher_->set_throughput_estimator(&throughput_estimator_);
+  set_progress_interval(base::TimeDelta());
   base::StatisticsRecorder::Initialize();
 }
 
 DownloadAction::~DownloadAction() {}
 
 void DownloadAction::CloseP2PSharingFd(bool delete_p2p_file) {
+  // The writes still queued are done first, unless the writer gave up.
+  p2p_writer_.reset();
   if (p2p_sharing_fd_ != -1) {
     if (close(p2p_sharing_fd_) != 0) {
       PLOG(ERROR) << "Error closing p2p sharing fd";
@@ -113,15 +154,32 @@ bool DownloadAction::SetupP2PSharingFd() {
     return false;
   }
 
+  // Check that the file is at least as long as the data written so far when
+  // resuming. See WriteToP2PFile().
+  p2p_file_size_ = utils::FileSize(p2p_sharing_fd_);
+  if (p2p_file_size_ < 0) {
+    PLOG(ERROR) << "Error getting file status for p2p file";
+    CloseP2PSharingFd(true);  // Delete p2p file.
+    return false;
+  }
+
+  // Slow storage doesn't slow down the download: the writer thread gives up
+  // on the p2p file instead if it falls too far behind.
+  p2p_writer_.reset(new P2PFileWriter(p2p_sharing_fd_, kP2PMaxPendingBytes));
+  p2p_writer_->set_io_limiter(io_limiter_);
+  p2p_writer_->Start();
+
   // All good.
   LOG(INFO) << "Writing payload contents to " << path.value();
   p2p_manager->FileGetVisible(p2p_file_id_, &p2p_visible_);
   return true;
 }
 
-void DownloadAction::WriteToP2PFile(const void* data,
-                                    size_t length,
-                                    off_t file_offset) {
+void DownloadAction::WriteToP2PFile(
+    const void* data,
+    size_t length,
+    off_t file_offset,
+    const std::shared_ptr<const brillo::Blob>& chunk) {
   if (p2p_sharing_fd_ == -1) {
     if (!SetupP2PSharingFd())
       return;
@@ -137,35 +195,31 @@ void DownloadAction::WriteToP2PFile(const void* data,
   //  1. the p2p file didn't get properly synced to stable storage; or
   //  2. the file was deleted at bootup (it's in /var/cache after all); or
   //  3. other reasons
-  off_t p2p_size = utils::FileSize(p2p_sharing_fd_);
-  if (p2p_size < 0) {
-    PLOG(ERROR) << "Error getting file status for p2p file";
-    CloseP2PSharingFd(true);  // Delete p2p file.
-    return;
-  }
-  if (p2p_size < file_offset) {
+  //
+  // The file size is tracked here since the writes are done asynchronously.
+  if (p2p_file_size_ < file_offset) {
     LOG(ERROR) << "Wanting to write to file offset " << file_offset
-               << " but existing p2p file is only " << p2p_size
+               << " but existing p2p file is only " << p2p_file_size_
                << " bytes.";
     CloseP2PSharingFd(true);  // Delete p2p file.
     return;
   }
 
-  off_t cur_file_offset = lseek(p2p_sharing_fd_, file_offset, SEEK_SET);
-  if (cur_file_offset != static_cast<off_t>(file_offset)) {
-    PLOG(ERROR) << "Error seeking to position "
-                << file_offset << " in p2p file";
+  // The peers serve the file up to its size, so it must only grow by
+  // appending. The bytes are received in order even when downloaded over
+  // parallel connections, since the MultiRangeHttpFetcher reorders them.
+  std::shared_ptr<const brillo::Blob> write_data = chunk;
+  if (!write_data) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    write_data = std::make_shared<brillo::Blob>(bytes, bytes + length);
+  }
+  if (!p2p_writer_->Write(std::move(write_data), file_offset)) {
+    LOG(ERROR) << "Error writing " << length << " bytes at file offset "
+               << file_offset << " in p2p file, not sharing it anymore.";
     CloseP2PSharingFd(true);  // Delete p2p file.
-  } else {
-    // OK, seeking worked, now write the data
-    ssize_t bytes_written = write(p2p_sharing_fd_, data, length);
-    if (bytes_written != static_cast<ssize_t>(length)) {
-      PLOG(ERROR) << "Error writing "
-                  << length << " bytes at file offset "
-                  << file_offset << " in p2p file";
-      CloseP2PSharingFd(true);  // Delete p2p file.
-    }
+    return;
   }
+  p2p_file_size_ = std::max<off_t>(p2p_file_size_, file_offset + length);
 }
 
 void DownloadAction::PerformAction() {
@@ -173,7 +227,7 @@ void DownloadAction::PerformAction() {
 
   // Get the InstallPlan and read it
   CHECK(HasInputObject());
-  install_plan_ = GetInputObject();
+  install_plan_ = TakeInputObject();
   install_plan_.Dump();
 
   bytes_received_ = 0;
@@ -182,6 +236,13 @@ void DownloadAction::PerformAction() {
   for (const auto& payload : install_plan_.payloads)
     bytes_total_ += payload.size;
 
+  if (system_state_ != nullptr) {
+    const PayloadStateInterface* payload_state = system_state_->payload_state();
+    throughput_estimator_.SetEstimates(
+        payload_state->GetThroughputEstimate(),
+        payload_state->GetRoundTripTimeEstimate());
+  }
+
   if (install_plan_.is_resume) {
     int64_t payload_index = 0;
     if (prefs_->GetInt64(kPrefsUpdateStatePayloadIndex, &payload_index) &&
@@ -207,18 +268,47 @@ void DownloadAction::PerformAction() {
   StartDownloading();
 }
 
+void DownloadAction::set_progress_interval(base::TimeDelta interval) {
+  progress_sampler_.reset(new ProgressSampler(
+      interval,
+      base::Bind(&DownloadAction::ReportProgress, base::Unretained(this))));
+}
+
+void DownloadAction::ReportProgress(uint64_t bytes_progressed,
+                                    uint64_t bytes_received,
+                                    uint64_t total) {
+  if (delegate_)
+    delegate_->BytesReceived(bytes_progressed, bytes_received, total);
+}
+
 void DownloadAction::StartDownloading() {
   download_active_ = true;
+  progress_sampler_->Start();
+  CreateDeltaPerformer();
+  StartPayloadCacheDownloads();
+  // The payload is read from the p2p file of a previous attempt if complete.
+  // The file only contains the payload, not the rest of the download URL.
+  string cache_url;
+  UsePayloadCache(GetPayloadCacheUrl(&cache_url));
+  const int64_t base_offset = reading_payload_cache_ ? 0 : base_offset_;
+  brillo::Blob prefetched_data;
   http_fetcher_->ClearRanges();
   if (install_plan_.is_resume &&
       payload_ == &install_plan_.payloads[resume_payload_index_]) {
-    // Resuming an update so fetch the update manifest metadata first.
+    // Resuming an update so fetch the update manifest metadata first, unless
+    // it was stored when first parsed.
+    // The metadata and the remaining data are requested at once, saving a
+    // round trip, when the server supports it.
+    http_fetcher_->set_batch_ranges(true);
     int64_t manifest_metadata_size = 0;
     int64_t manifest_signature_size = 0;
     prefs_->GetInt64(kPrefsManifestMetadataSize, &manifest_metadata_size);
     prefs_->GetInt64(kPrefsManifestSignatureSize, &manifest_signature_size);
-    http_fetcher_->AddRange(base_offset_,
-                            manifest_metadata_size + manifest_signature_size);
+    if (!WriteStoredMetadata(manifest_metadata_size +
+                             manifest_signature_size)) {
+      http_fetcher_->AddRange(base_offset,
+                              manifest_metadata_size + manifest_signature_size);
+    }
     // If there're remaining unprocessed data blobs, fetch them. Be careful not
     // to request data beyond the end of the payload to avoid 416 HTTP response
     // error codes.
@@ -227,41 +317,52 @@ void DownloadAction::StartDownloading() {
     uint64_t resume_offset =
         manifest_metadata_size + manifest_signature_size + next_data_offset;
     if (!payload_->size) {
-      http_fetcher_->AddRange(base_offset_ + resume_offset);
+      http_fetcher_->AddRange(base_offset + resume_offset);
     } else if (resume_offset < payload_->size) {
-      http_fetcher_->AddRange(base_offset_ + resume_offset,
+      http_fetcher_->AddRange(base_offset + resume_offset,
                               payload_->size - resume_offset);
     }
   } else {
-    if (payload_->size) {
-      http_fetcher_->AddRange(base_offset_, payload_->size);
+    // Only the manifest range is needed when the rest of the payload isn't
+    // in its first bytes, so it is requested on its own.
+    http_fetcher_->set_batch_ranges(false);
+    uint64_t manifest_range_size = GetManifestRangeSize(*payload_);
+    if (WritePrefetchedMetadata(base_offset, &prefetched_data)) {
+      http_fetcher_->AddRange(base_offset + prefetched_data.size(),
+                              payload_->size - prefetched_data.size());
+    } else if (manifest_range_size) {
+      // The transfer is terminated once the manifest is parsed, so the rest
+      // of the payload is only requested if it wasn't in the first bytes.
+      http_fetcher_->AddRange(base_offset, manifest_range_size);
+      http_fetcher_->AddRange(base_offset + manifest_range_size,
+                              payload_->size - manifest_range_size);
+    } else if (payload_->size) {
+      http_fetcher_->AddRange(base_offset, payload_->size);
     } else {
       // If no payload size is passed we assume we read until the end of the
       // stream.
-      http_fetcher_->AddRange(base_offset_);
+      http_fetcher_->AddRange(base_offset);
     }
   }
 
-  if (writer_ && writer_ != delta_performer_.get()) {
-    LOG(INFO) << "Using writer for test.";
-  } else {
-    delta_performer_.reset(new DeltaPerformer(prefs_,
-                                              boot_control_,
-                                              hardware_,
-                                              delegate_,
-                                              &install_plan_,
-                                              payload_,
-                                              is_interactive_));
-    writer_ = delta_performer_.get();
-  }
+  p2p_cache_only_ = false;
   if (system_state_ != nullptr) {
     const PayloadStateInterface* payload_state = system_state_->payload_state();
     string file_id = utils::CalculateP2PFileId(payload_->hash, payload_->size);
-    if (payload_state->GetUsingP2PForSharing()) {
+    if (reading_payload_cache_) {
+      // The p2p file is complete, it is only made visible once verified.
+      LOG(INFO) << "Reading the payload from the p2p file " << cache_url;
+    } else if (payload_state->GetUsingP2PForSharing()) {
       // If we're sharing the update, store the file_id to convey
       // that we should write to the file.
       p2p_file_id_ = file_id;
       LOG(INFO) << "p2p file id: " << p2p_file_id_;
+    } else if (CanCachePayload(*payload_, file_id)) {
+      // Still write the p2p file, but never make it visible, so the next
+      // attempts can read the payload from it.
+      p2p_file_id_ = file_id;
+      p2p_cache_only_ = true;
+      LOG(INFO) << "Caching the payload in the p2p file id: " << p2p_file_id_;
     } else {
       // Even if we're not sharing the update, it could be that
       // there's a partial file from a previous attempt with the same
@@ -291,15 +392,317 @@ void DownloadAction::StartDownloading() {
     }
   }
 
-  http_fetcher_->BeginTransfer(install_plan_.download_url);
+  // The prefetched bytes are shared and reported like the downloaded ones.
+  if (!prefetched_data.empty()) {
+    if (!p2p_file_id_.empty()) {
+      WriteToP2PFile(
+          prefetched_data.data(), prefetched_data.size(), 0, nullptr);
+    }
+    bytes_received_ = prefetched_data.size();
+    if (delegate_) {
+      progress_sampler_->Update(prefetched_data.size(),
+                                bytes_received_previous_payloads_ +
+                                    bytes_received_,
+                                bytes_total_);
+    }
+  }
+
+  // The chunks are only split when the transfer begins.
+  next_connection_quality_check_ = base::TimeTicks();
+  CheckConnectionQuality();
+  http_fetcher_->set_parallel_chunk_size(GetLinkChunkSize(link_quality_));
+  UpdateActiveConnections();
+  http_fetcher_->BeginTransfer(
+      reading_payload_cache_ ? cache_url : install_plan_.download_url);
+}
+
+bool DownloadAction::GetPayloadCacheUrl(string* url) {
+  if (system_state_ == nullptr || !payload_->size)
+    return false;
+  P2PManager* p2p_manager = system_state_->p2p_manager();
+  string file_id = utils::CalculateP2PFileId(payload_->hash, payload_->size);
+  FilePath path = p2p_manager->FileGetPath(file_id);
+  if (path.empty() ||
+      p2p_manager->FileGetSize(file_id) !=
+          static_cast<ssize_t>(payload_->size)) {
+    return false;
+  }
+  *url = "file://" + path.value();
+  return true;
+}
+
+void DownloadAction::UsePayloadCache(bool use_cache) {
+  if (use_cache == reading_payload_cache_)
+    return;
+  if (!idle_fetcher_) {
+    idle_fetcher_.reset(new MultiRangeHttpFetcher(new FileFetcher()));
+    idle_fetcher_->set_delegate(this);
+  }
+  // The fetchers are never destroyed here, since this is called from their
+  // TransferComplete() callback for the next payload.
+  std::swap(http_fetcher_, idle_fetcher_);
+  reading_payload_cache_ = use_cache;
+}
+
+bool DownloadAction::CanCachePayload(const InstallPlan::Payload& payload,
+                                     const string& file_id) {
+  P2PManager* p2p_manager = system_state_->p2p_manager();
+  // The invisible p2p files are only removed by the housekeeping done while
+  // p2p is enabled.
+  if (!payload.size || payload.size > kMaxCachedPayloadSize ||
+      !p2p_manager->IsP2PEnabled()) {
+    return false;
+  }
+  // A partial file shared by a previous attempt must not stay visible, since
+  // the peers downloading it would time out.
+  bool visible = false;
+  return p2p_manager->FileGetPath(file_id).empty() ||
+         (p2p_manager->FileGetVisible(file_id, &visible) && !visible);
+}
+
+void DownloadAction::AddPayloadCacheFetcher(HttpFetcher* http_fetcher) {
+  CHECK(system_state_);
+  payload_cache_downloaders_.emplace_back(
+      new PayloadCacheDownloader(system_state_->p2p_manager(), http_fetcher));
+}
+
+void DownloadAction::StartPayloadCacheDownloads() {
+  if (payload_cache_downloaders_.empty())
+    return;
+  // The current payload is downloaded by |http_fetcher_| from now on, even
+  // if only part of it is in its p2p file.
+  string current_file_id =
+      utils::CalculateP2PFileId(payload_->hash, payload_->size);
+  for (const auto& downloader : payload_cache_downloaders_) {
+    if (downloader->active() && downloader->file_id() == current_file_id)
+      downloader->Stop();
+  }
+
+  P2PManager* p2p_manager = system_state_->p2p_manager();
+  PayloadStateInterface* payload_state = system_state_->payload_state();
+  auto idle_downloader = payload_cache_downloaders_.begin();
+  for (size_t i = payload_ - install_plan_.payloads.data() + 1;
+       i < install_plan_.payloads.size();
+       i++) {
+    const InstallPlan::Payload& payload = install_plan_.payloads[i];
+    string file_id = utils::CalculateP2PFileId(payload.hash, payload.size);
+    if (payload.already_applied || !CanCachePayload(payload, file_id) ||
+        p2p_manager->FileGetSize(file_id) ==
+            static_cast<ssize_t>(payload.size) ||
+        std::any_of(payload_cache_downloaders_.begin(),
+                    payload_cache_downloaders_.end(),
+                    [&file_id](const auto& downloader) {
+                      return downloader->active() &&
+                             downloader->file_id() == file_id;
+                    })) {
+      continue;
+    }
+    string url = payload_state->GetPayloadUrl(i);
+    if (url.empty())
+      continue;
+    while (idle_downloader != payload_cache_downloaders_.end() &&
+           (*idle_downloader)->active()) {
+      idle_downloader++;
+    }
+    if (idle_downloader == payload_cache_downloaders_.end())
+      return;
+    (*idle_downloader)->set_io_limiter(io_limiter_);
+    (*idle_downloader)->Start(file_id, payload.size, url);
+  }
+}
+
+void DownloadAction::StopPayloadCacheDownloads() {
+  for (const auto& downloader : payload_cache_downloaders_)
+    downloader->Stop();
+}
+
+void DownloadAction::DiscardPayloadCache() {
+  if (!reading_payload_cache_)
+    return;
+  string file_id = utils::CalculateP2PFileId(payload_->hash, payload_->size);
+  FilePath path = system_state_->p2p_manager()->FileGetPath(file_id);
+  if (path.empty())
+    return;
+  if (unlink(path.value().c_str()) != 0) {
+    PLOG(ERROR) << "Error deleting p2p file " << path.value();
+  } else {
+    LOG(INFO) << "Deleted p2p file " << path.value()
+              << " since the payload read from it couldn't be applied.";
+  }
+}
+
+void DownloadAction::CreateDeltaPerformer() {
+  if (writer_ && writer_ != delta_performer_.get()) {
+    LOG(INFO) << "Using writer for test.";
+  } else {
+    delta_performer_.reset(new DeltaPerformer(prefs_,
+                                              boot_control_,
+                                              hardware_,
+                                              delegate_,
+                                              &install_plan_,
+                                              payload_,
+                                              is_interactive_));
+    if (install_plan_.trace_apply)
+      apply_stats_.EnableTrace();
+    delta_performer_->set_apply_stats(&apply_stats_);
+    if (install_plan_.trace_io)
+      delta_performer_->set_io_trace(&io_trace_);
+    delta_performer_->set_io_limiter(io_limiter_);
+    delta_performer_->set_partition_write_observer(partition_write_observer_);
+    if (public_key_cache_)
+      delta_performer_->set_public_key_cache(public_key_cache_);
+    writer_ = delta_performer_.get();
+  }
+}
+
+bool DownloadAction::WriteStoredMetadata(uint64_t size) {
+  string metadata;
+  if (writer_ != delta_performer_.get() ||
+      !DeltaPerformer::GetStoredMetadata(prefs_, *payload_, size, &metadata)) {
+    return false;
+  }
+  LOG(INFO) << "Resuming with the " << size
+            << " bytes of payload metadata stored when first downloaded.";
+  if (delta_performer_->Write(metadata.data(), metadata.size(), &code_) &&
+      delta_performer_->IsManifestValid()) {
+    return true;
+  }
+  // The DeltaPerformer verified the stored metadata like the downloaded one.
+  LOG(WARNING) << "The stored payload metadata couldn't be used, downloading "
+               << "it again.";
+  prefs_->Delete(kPrefsUpdateStateMetadataPayloadHash);
+  code_ = ErrorCode::kSuccess;
+  delta_performer_->Close();
+  CreateDeltaPerformer();
+  return false;
+}
+
+bool DownloadAction::WritePrefetchedMetadata(int64_t base_offset,
+                                             brillo::Blob* data) {
+  // Only the first payload of an update not resumed is prefetched.
+  uint64_t size = GetMetadataRangeSize(*payload_);
+  if (!metadata_prefetcher_ || !size || reading_payload_cache_ ||
+      writer_ != delta_performer_.get() ||
+      payload_ != &install_plan_.payloads[0] || payload_->already_applied ||
+      !metadata_prefetcher_->TakeData(
+          install_plan_.download_url, base_offset, size, data)) {
+    return false;
+  }
+  LOG(INFO) << "Starting with the " << size
+            << " bytes of payload prefetched after the update check.";
+  if (delta_performer_->Write(data->data(), data->size(), &code_) &&
+      delta_performer_->IsManifestValid()) {
+    return true;
+  }
+  // The DeltaPerformer verified the prefetched metadata like the downloaded
+  // one.
+  LOG(WARNING) << "The prefetched payload metadata couldn't be used, "
+               << "downloading it again.";
+  data->clear();
+  code_ = ErrorCode::kSuccess;
+  delta_performer_->Close();
+  CreateDeltaPerformer();
+  return false;
+}
+
+// static
+size_t DownloadAction::GetLinkConnections(const ConnectionQuality& quality) {
+  // The extra connections only add overhead to the data paid for.
+  if (quality.metered)
+    return 1;
+  if (quality.signal_strength >= 0 &&
+      quality.signal_strength < kWeakSignalStrength) {
+    return kWeakLinkConnections;
+  }
+  return 0;
+}
+
+// static
+size_t DownloadAction::GetLinkChunkSize(const ConnectionQuality& quality) {
+  if (quality.signal_strength >= 0 &&
+      quality.signal_strength < kWeakSignalStrength) {
+    return kWeakLinkChunkSize;
+  }
+  return MultiRangeHttpFetcher::kDefaultParallelChunkSize;
+}
+
+// static
+uint64_t DownloadAction::GetManifestRangeSize(
+    const InstallPlan::Payload& payload) {
+  // Only the manifest of an already applied payload is parsed, to fill in
+  // its partitions.
+  if (!payload.already_applied)
+    return 0;
+  return GetMetadataRangeSize(payload);
+}
+
+// static
+uint64_t DownloadAction::GetMetadataRangeSize(
+    const InstallPlan::Payload& payload) {
+  if (!payload.metadata_size)
+    return 0;
+  uint64_t size = payload.metadata_size + kMetadataSignatureAllowance;
+  return size < payload.size ? size : 0;
+}
+
+void DownloadAction::UpdateActiveConnections() {
+  CheckConnectionQuality();
+  size_t connections = io_limiter_ && io_limiter_->performance_mode()
+                           ? 0
+                           : background_connections_;
+  size_t link_connections = GetLinkConnections(link_quality_);
+  // The chunks of an already applied payload past its manifest are never
+  // used, so none are downloaded ahead.
+  if (payload_ && payload_->already_applied)
+    link_connections = 1;
+  if (link_connections > 0 &&
+      (connections == 0 || link_connections < connections)) {
+    connections = link_connections;
+  }
+  http_fetcher_->set_max_active_connections(connections);
+}
+
+void DownloadAction::CheckConnectionQuality() {
+  if (system_state_ == nullptr ||
+      system_state_->connection_manager() == nullptr) {
+    return;
+  }
+  base::TimeTicks now = base::TimeTicks::Now();
+  if (now < next_connection_quality_check_)
+    return;
+  next_connection_quality_check_ =
+      now + base::TimeDelta::FromSeconds(kConnectionQualityCheckSeconds);
+
+  ConnectionQuality quality;
+  if (!system_state_->connection_manager()->GetConnectionQuality(&quality))
+    return;
+  if (quality.metered != link_quality_.metered ||
+      GetLinkConnections(quality) != GetLinkConnections(link_quality_)) {
+    LOG(INFO) << "Downloading over a " << (quality.metered ? "" : "not ")
+              << "metered link, with a signal strength of "
+              << quality.signal_strength << ".";
+  }
+  link_quality_ = quality;
+}
+
+void DownloadAction::SaveNetworkEstimates() {
+  if (system_state_ == nullptr || throughput_estimator_.throughput() == 0)
+    return;
+  system_state_->payload_state()->SetNetworkEstimates(
+      throughput_estimator_.throughput(),
+      throughput_estimator_.round_trip_time());
 }
 
 void DownloadAction::SuspendAction() {
   http_fetcher_->Pause();
+  for (const auto& downloader : payload_cache_downloaders_)
+    downloader->Pause();
 }
 
 void DownloadAction::ResumeAction() {
   http_fetcher_->Unpause();
+  for (const auto& downloader : payload_cache_downloaders_)
+    downloader->Unpause();
 }
 
 void DownloadAction::TerminateProcessing() {
@@ -308,7 +711,11 @@ void DownloadAction::TerminateProcessing() {
     writer_ = nullptr;
   }
   download_active_ = false;
+  progress_sampler_->Stop();
   CloseP2PSharingFd(false);  // Keep p2p file.
+  StopPayloadCacheDownloads();
+  if (partition_write_observer_)
+    partition_write_observer_->PartitionWritesAborted();
   // Terminates the transfer. The action is terminated, if necessary, when the
   // TransferTerminated callback is received.
   http_fetcher_->TerminateTransfer();
@@ -321,18 +728,39 @@ void DownloadAction::SeekToOffset(off_t offset) {
 void DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
                                    const void* bytes,
                                    size_t length) {
+  UpdateActiveConnections();
+  ProcessReceivedBytes(bytes, length, nullptr);
+}
+
+void DownloadAction::ReceivedChunk(
+    HttpFetcher* fetcher, const std::shared_ptr<const brillo::Blob>& chunk) {
+  UpdateActiveConnections();
+  ProcessReceivedBytes(chunk->data(), chunk->size(), chunk);
+}
+
+void DownloadAction::ProcessReceivedBytes(
+    const void* bytes,
+    size_t length,
+    const std::shared_ptr<const brillo::Blob>& chunk) {
   // Note that bytes_received_ is the current offset.
   if (!p2p_file_id_.empty()) {
-    WriteToP2PFile(bytes, length, bytes_received_);
+    WriteToP2PFile(bytes, length, bytes_received_, chunk);
   }
 
   bytes_received_ += length;
   uint64_t bytes_downloaded_total =
       bytes_received_previous_payloads_ + bytes_received_;
-  if (delegate_ && download_active_) {
-    delegate_->BytesReceived(length, bytes_downloaded_total, bytes_total_);
+  if (delegate_ && download_active_)
+    progress_sampler_->Update(length, bytes_downloaded_total, bytes_total_);
+  // The p2p file writer keeps a reference to the chunk too, so the bytes are
+  // never copied more than once.
+  bool written = true;
+  if (writer_) {
+    written = chunk && writer_ == delta_performer_.get()
+                  ? delta_performer_->WriteChunk(chunk, &code_)
+                  : writer_->Write(bytes, length, &code_);
   }
-  if (writer_ && !writer_->Write(bytes, length, &code_)) {
+  if (!written) {
     if (code_ != ErrorCode::kSuccess) {
       LOG(ERROR) << "Error " << utils::ErrorCodeToString(code_) << " (" << code_
                  << ") in DeltaPerformer's Write method when "
@@ -341,6 +769,7 @@ void DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
     // Delete p2p file, if applicable.
     if (!p2p_file_id_.empty())
       CloseP2PSharingFd(true);
+    DiscardPayloadCache();
     // Don't tell the action processor that the action is complete until we get
     // the TransferTerminated callback. Otherwise, this and the HTTP fetcher
     // objects may get destroyed before all callbacks are complete.
@@ -350,7 +779,8 @@ void DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
 
   // Call p2p_manager_->FileMakeVisible() when we've successfully
   // verified the manifest!
-  if (!p2p_visible_ && system_state_ && delta_performer_.get() &&
+  if (!p2p_visible_ && !p2p_cache_only_ && system_state_ &&
+      delta_performer_.get() &&
       delta_performer_->IsManifestValid()) {
     LOG(INFO) << "Manifest has been validated. Making p2p file visible.";
     system_state_->p2p_manager()->FileMakeVisible(p2p_file_id_);
@@ -367,11 +797,30 @@ void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
     }
   }
   download_active_ = false;
+  // The delegate gets all the bytes received before the download completes.
+  progress_sampler_->Stop();
+  SaveNetworkEstimates();
+  // Finish writing the p2p file before it is used.
+  if (p2p_writer_ && !p2p_writer_->Flush()) {
+    LOG(ERROR) << "Error writing the p2p file, not sharing it anymore.";
+    CloseP2PSharingFd(true);  // Delete p2p file.
+  }
   ErrorCode code =
       successful ? ErrorCode::kSuccess : ErrorCode::kDownloadTransferError;
   if (code == ErrorCode::kSuccess) {
     if (delta_performer_ && !payload_->already_applied)
       code = delta_performer_->VerifyPayload(payload_->hash, payload_->size);
+    if (code == ErrorCode::kSuccess && reading_payload_cache_ &&
+        system_state_->payload_state()->GetUsingP2PForSharing()) {
+      string file_id =
+          utils::CalculateP2PFileId(payload_->hash, payload_->size);
+      bool visible = false;
+      if (system_state_->p2p_manager()->FileGetVisible(file_id, &visible) &&
+          !visible) {
+        LOG(INFO) << "Payload verified. Making p2p file visible.";
+        system_state_->p2p_manager()->FileMakeVisible(file_id);
+      }
+    }
     if (code == ErrorCode::kSuccess) {
       if (payload_ < &install_plan_.payloads.back() &&
                  system_state_->payload_state()->NextPayload()) {
@@ -393,6 +842,20 @@ void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
       base::StatisticsRecorder::WriteGraph(
           "UpdateEngine.DownloadAction.", &histogram_output);
       LOG(INFO) << histogram_output;
+      LOG(INFO) << "Time spent applying the payload operations:\n"
+                << apply_stats_.ToString();
+      LOG(INFO) << "Buffer pool hits: " << BlobPool::Get()->hits()
+                << ", misses: " << BlobPool::Get()->misses();
+      FilePath non_volatile_path;
+      if ((install_plan_.trace_apply || install_plan_.trace_io) &&
+          hardware_->GetNonVolatileDirectory(&non_volatile_path)) {
+        if (install_plan_.trace_apply) {
+          apply_stats_.WriteTrace(
+              non_volatile_path.Append(kApplyTraceFileName).value());
+        }
+        if (install_plan_.trace_io)
+          io_trace_.WriteTo(non_volatile_path.Append(kIOTraceFileName).value());
+      }
     } else {
       LOG(ERROR) << "Download of " << install_plan_.download_url
                  << " failed due to payload verification error.";
@@ -401,15 +864,23 @@ void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
         CloseP2PSharingFd(true);
     }
   }
+  if (code != ErrorCode::kSuccess)
+    DiscardPayloadCache();
+  StopPayloadCacheDownloads();
 
   // Write the path to the output pipe if we're successful.
   if (code == ErrorCode::kSuccess && HasOutputPipe())
     SetOutputObject(install_plan_);
+  if (code != ErrorCode::kSuccess && partition_write_observer_)
+    partition_write_observer_->PartitionWritesAborted();
   processor_->ActionComplete(this, code);
 }
 
 void DownloadAction::TransferTerminated(HttpFetcher* fetcher) {
+  SaveNetworkEstimates();
   if (code_ != ErrorCode::kSuccess) {
+    if (partition_write_observer_)
+      partition_write_observer_->PartitionWritesAborted();
     processor_->ActionComplete(this, code_);
   } else if (payload_->already_applied) {
     LOG(INFO) << "TransferTerminated with ErrorCode::kSuccess when the current "
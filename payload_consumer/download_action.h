@@ -23,13 +23,23 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/io_limiter.h"
 #include "update_engine/common/multi_range_http_fetcher.h"
+#include "update_engine/common/progress_sampler.h"
+#include "update_engine/common/throughput_estimator.h"
+#include "update_engine/connection_utils.h"
+#include "update_engine/payload_consumer/apply_stats.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/io_trace.h"
+#include "update_engine/payload_consumer/metadata_prefetcher.h"
+#include "update_engine/payload_consumer/p2p_file_writer.h"
+#include "update_engine/payload_consumer/payload_cache_downloader.h"
 #include "update_engine/system_state.h"
 
 // The Download Action downloads a specified url to disk. The url should point
@@ -64,6 +74,18 @@ class DownloadActionDelegate {
 
 class PrefsInterface;
 
+// Downloads and applies the payloads of the InstallPlan one after the other,
+// in their order, even when they update disjoint partitions: the resume state
+// stored in the prefs, the payload index and the next operation and data
+// offset in it, describes a single payload being applied. The download of
+// each payload is spread over the connections added with
+// AddDownloadConnection(), and the partitions written are verified while the
+// next ones are downloaded.
+//
+// The payloads after the current one are downloaded concurrently over the
+// fetchers added with AddPayloadCacheFetcher(), into their invisible p2p
+// files, whose size is their own resume state. Once complete, a payload is
+// read from its file when it is applied, and verified like any other one.
 class DownloadAction : public InstallPlanAction,
                        public HttpFetcherDelegate {
  public:
@@ -99,6 +121,8 @@ class DownloadAction : public InstallPlanAction,
   // HttpFetcherDelegate methods (see http_fetcher.h)
   void ReceivedBytes(HttpFetcher* fetcher,
                      const void* bytes, size_t length) override;
+  void ReceivedChunk(HttpFetcher* fetcher,
+                     const std::shared_ptr<const brillo::Blob>& chunk) override;
   void SeekToOffset(off_t offset) override;
   void TransferComplete(HttpFetcher* fetcher, bool successful) override;
   void TransferTerminated(HttpFetcher* fetcher) override;
@@ -110,12 +134,76 @@ class DownloadAction : public InstallPlanAction,
 
   void set_base_offset(int64_t base_offset) { base_offset_ = base_offset; }
 
+  // Reports the bytes received to the delegate at most once every |interval|
+  // instead of for every chunk, summing up the bytes received since the last
+  // report. It is reported for every chunk by default.
+  void set_progress_interval(base::TimeDelta interval);
+
+  // Takes ownership of |http_fetcher|, used as an additional connection to
+  // download the payload in parallel. See
+  // MultiRangeHttpFetcher::AddParallelFetcher().
+  void AddDownloadConnection(HttpFetcher* http_fetcher) {
+    http_fetcher->set_throughput_estimator(&throughput_estimator_);
+    http_fetcher_->AddParallelFetcher(http_fetcher);
+  }
+
+  // Takes ownership of |http_fetcher|, used to download one of the payloads
+  // after the current one into its p2p file while p2p is enabled.
+  void AddPayloadCacheFetcher(HttpFetcher* http_fetcher);
+
+  // Sets the limiter passed to the DeltaPerformer, not owned. All the download
+  // connections are used while it is in performance mode.
+  void set_io_limiter(IOLimiter* io_limiter) { io_limiter_ = io_limiter; }
+
+  // Reports the target partitions written while downloading to |observer|,
+  // which is not owned and must outlive this action.
+  void set_partition_write_observer(PartitionWriteObserver* observer) {
+    partition_write_observer_ = observer;
+  }
+
+  // Sets the prefetcher of the first bytes of the first payload, not owned.
+  // They are downloaded again if they weren't prefetched when the download
+  // starts.
+  void set_metadata_prefetcher(MetadataPrefetcher* metadata_prefetcher) {
+    metadata_prefetcher_ = metadata_prefetcher;
+  }
+
+  // Sets the cache of the public keys passed to the DeltaPerformer, not owned.
+  void set_public_key_cache(PublicKeyCache* public_key_cache) {
+    public_key_cache_ = public_key_cache;
+  }
+
+  // Downloads over at most |connections| connections, or all of them if 0,
+  // while the IOLimiter isn't in performance mode.
+  void set_background_connections(size_t connections) {
+    background_connections_ = connections;
+  }
+
+  // The number of connections worth downloading over a link of |quality|,
+  // or 0 if it doesn't limit them, and the size of the chunks they download.
+  static size_t GetLinkConnections(const ConnectionQuality& quality);
+  static size_t GetLinkChunkSize(const ConnectionQuality& quality);
+
+  // Returns the size of the first bytes of |payload| requested on their own,
+  // enough for its manifest when only that is needed, or 0 if the whole
+  // payload is requested at once.
+  static uint64_t GetManifestRangeSize(const InstallPlan::Payload& payload);
+
+  // Returns the size of the first bytes of |payload| holding its metadata and
+  // metadata signature, or 0 if they aren't smaller than the payload or the
+  // metadata size isn't known.
+  static uint64_t GetMetadataRangeSize(const InstallPlan::Payload& payload);
+
   HttpFetcher* http_fetcher() { return http_fetcher_.get(); }
 
   // Returns the p2p file id for the file being written or the empty
   // string if we're not writing to a p2p file.
   std::string p2p_file_id() { return p2p_file_id_; }
 
+  // Returns the time spent applying the operations of all the payloads
+  // downloaded so far.
+  const ApplyStats& apply_stats() const { return apply_stats_; }
+
  private:
   // Closes the file descriptor for the p2p file being written and
   // clears |p2p_file_id_| to indicate that we're no longer sharing
@@ -127,17 +215,88 @@ class DownloadAction : public InstallPlanAction,
   // WriteToP2PFile(). Returns True if this worked.
   bool SetupP2PSharingFd();
 
-  // Writes |length| bytes of payload from |data| into |file_offset|
-  // of the p2p file. Also does sanity checks; for example ensures we
-  // don't end up with a file with holes in it.
+  // Queues the write of |length| bytes of payload from |data| into
+  // |file_offset| of the p2p file, done by the |p2p_writer_| thread. If the
+  // bytes are stored in a shared |chunk|, they aren't copied. Also does
+  // sanity checks; for example ensures we don't end up with a file with
+  // holes in it.
   //
   // This method does nothing if SetupP2PSharingFd() hasn't been
   // called or if CloseP2PSharingFd() has been called.
-  void WriteToP2PFile(const void* data, size_t length, off_t file_offset);
+  void WriteToP2PFile(const void* data,
+                      size_t length,
+                      off_t file_offset,
+                      const std::shared_ptr<const brillo::Blob>& chunk);
 
   // Start downloading the current payload using delta_performer.
   void StartDownloading();
 
+  // Returns whether the current payload is completely stored in the p2p file
+  // of a previous attempt, setting |url| to the file:// url of the file.
+  bool GetPayloadCacheUrl(std::string* url);
+
+  // Switches |http_fetcher_| to the one reading the p2p file if |use_cache|,
+  // or back to the one downloading the payload.
+  void UsePayloadCache(bool use_cache);
+
+  // Returns whether |payload| can be written to the p2p file |file_id| when it
+  // isn't shared, so it can be read from there later.
+  bool CanCachePayload(const InstallPlan::Payload& payload,
+                       const std::string& file_id);
+
+  // Stops downloading the current payload into its p2p file, and starts the
+  // idle |payload_cache_downloaders_| on the next payloads not in their p2p
+  // file yet.
+  void StartPayloadCacheDownloads();
+
+  // Stops all the |payload_cache_downloaders_|, keeping what they wrote.
+  void StopPayloadCacheDownloads();
+
+  // Deletes the p2p file from which the current payload is read, if any, so
+  // the next attempt downloads it again.
+  void DiscardPayloadCache();
+
+  // Creates the |delta_performer_| of the current payload, unless a writer
+  // was set by a test.
+  void CreateDeltaPerformer();
+
+  // Passes the |size| bytes of metadata of the resumed payload stored in the
+  // prefs to the |delta_performer_|, instead of downloading them. Returns
+  // false if they must be downloaded, recreating the |delta_performer_| if
+  // they couldn't be used.
+  bool WriteStoredMetadata(uint64_t size);
+
+  // Passes the first bytes of the current payload, at |base_offset| of the
+  // download URL, prefetched by the |metadata_prefetcher_| to the
+  // |delta_performer_| and moves them to |data|. Returns false if they must
+  // be downloaded, recreating the |delta_performer_| if they couldn't be
+  // used.
+  bool WritePrefetchedMetadata(int64_t base_offset, brillo::Blob* data);
+
+  // Passes the progress sampled by |progress_sampler_| to the delegate.
+  void ReportProgress(uint64_t bytes_progressed,
+                      uint64_t bytes_received,
+                      uint64_t total);
+
+  // Limits the download connections to the ones of the current IOLimiter
+  // mode and network link.
+  void UpdateActiveConnections();
+
+  // Updates |link_quality_| from the connection manager, if it wasn't in the
+  // last kConnectionQualityCheckSeconds, so the download is planned again
+  // when the network changes.
+  void CheckConnectionQuality();
+
+  // Stores the estimates of the |throughput_estimator_| in the PayloadState,
+  // so the next attempts start with timeouts suited to the network.
+  void SaveNetworkEstimates();
+
+  // Handles the |length| received |bytes|. If the bytes are stored in a
+  // shared |chunk|, they are passed to the delta_performer without a copy.
+  void ProcessReceivedBytes(const void* bytes,
+                            size_t length,
+                            const std::shared_ptr<const brillo::Blob>& chunk);
+
   // The InstallPlan passed in
   InstallPlan install_plan_;
 
@@ -155,6 +314,21 @@ class DownloadAction : public InstallPlanAction,
   // Pointer to the MultiRangeHttpFetcher that does the http work.
   std::unique_ptr<MultiRangeHttpFetcher> http_fetcher_;
 
+  // The other fetcher, not used for the current payload: the one reading the
+  // payload from a p2p file while downloading it, and vice versa. Created when
+  // first needed.
+  std::unique_ptr<MultiRangeHttpFetcher> idle_fetcher_;
+
+  // Whether |http_fetcher_| reads the payload from a complete p2p file.
+  bool reading_payload_cache_{false};
+
+  // Download the next payloads into their p2p files.
+  std::vector<std::unique_ptr<PayloadCacheDownloader>>
+      payload_cache_downloaders_;
+
+  // Measures the network for all the connections of |http_fetcher_|.
+  ThroughputEstimator throughput_estimator_;
+
   // If |true|, the update is user initiated (vs. periodic update checks). Hence
   // the |delta_performer_| can decide not to use O_DSYNC flag for faster
   // update.
@@ -166,6 +340,23 @@ class DownloadAction : public InstallPlanAction,
 
   std::unique_ptr<DeltaPerformer> delta_performer_;
 
+  // The stats recorded by |delta_performer_| for all the payloads.
+  ApplyStats apply_stats_;
+
+  // The I/O calls made to the partitions by |delta_performer_| for all the
+  // payloads, recorded when |install_plan_.trace_io| is set.
+  IOTrace io_trace_;
+
+  IOLimiter* io_limiter_{nullptr};
+  PartitionWriteObserver* partition_write_observer_{nullptr};
+  PublicKeyCache* public_key_cache_{nullptr};
+  MetadataPrefetcher* metadata_prefetcher_{nullptr};
+  size_t background_connections_{0};
+
+  // The quality of the network link, and when it is checked next.
+  ConnectionQuality link_quality_;
+  base::TimeTicks next_connection_quality_check_;
+
   // Used by TransferTerminated to figure if this action terminated itself or
   // was terminated by the action processor.
   ErrorCode code_;
@@ -176,6 +367,8 @@ class DownloadAction : public InstallPlanAction,
   uint64_t bytes_received_previous_payloads_{0};
   uint64_t bytes_total_{0};
   bool download_active_{false};
+  // Samples the bytes received for the delegate while downloading.
+  std::unique_ptr<ProgressSampler> progress_sampler_;
 
   // The file-id for the file we're sharing or the empty string
   // if we're not using p2p to share.
@@ -185,9 +378,19 @@ class DownloadAction : public InstallPlanAction,
   // if we're not using p2p to share.
   int p2p_sharing_fd_;
 
+  // Writes to |p2p_sharing_fd_| off the download path, while it is open.
+  std::unique_ptr<P2PFileWriter> p2p_writer_;
+
+  // The size of the p2p file once the queued writes are done.
+  off_t p2p_file_size_{0};
+
   // Set to |false| if p2p file is not visible.
   bool p2p_visible_;
 
+  // Whether the p2p file is only written as a cache of the payload for the
+  // next attempts, and never made visible.
+  bool p2p_cache_only_{false};
+
   // Loaded from prefs before downloading any payload.
   size_t resume_payload_index_{0};
 
@@ -41,6 +41,7 @@
 #include "update_engine/fake_p2p_manager_configuration.h"
 #include "update_engine/fake_system_state.h"
 #include "update_engine/mock_file_writer.h"
+#include "update_engine/mock_p2p_manager.h"
 #include "update_engine/payload_consumer/mock_download_action.h"
 #include "update_engine/update_manager/fake_update_manager.h"
 
@@ -54,6 +55,8 @@ using std::unique_ptr;
 using test_utils::ScopedTempFile;
 using testing::AtLeast;
 using testing::InSequence;
+using testing::Invoke;
+using testing::NiceMock;
 using testing::Return;
 using testing::SetArgPointee;
 using testing::_;
@@ -451,6 +454,46 @@ class PassObjectOutTestProcessorDelegate : public ActionProcessorDelegate {
 
 }  // namespace
 
+TEST(DownloadActionTest, LinkConnectionsTest) {
+  ConnectionQuality quality;
+  EXPECT_EQ(0U, DownloadAction::GetLinkConnections(quality));
+  EXPECT_EQ(MultiRangeHttpFetcher::kDefaultParallelChunkSize,
+            DownloadAction::GetLinkChunkSize(quality));
+
+  quality.signal_strength = 90;
+  EXPECT_EQ(0U, DownloadAction::GetLinkConnections(quality));
+
+  // A weak link uses fewer connections and smaller chunks.
+  quality.signal_strength = 10;
+  EXPECT_EQ(2U, DownloadAction::GetLinkConnections(quality));
+  EXPECT_GT(MultiRangeHttpFetcher::kDefaultParallelChunkSize,
+            DownloadAction::GetLinkChunkSize(quality));
+
+  quality.metered = true;
+  EXPECT_EQ(1U, DownloadAction::GetLinkConnections(quality));
+}
+
+TEST(DownloadActionTest, ManifestRangeSizeTest) {
+  InstallPlan::Payload payload;
+  payload.size = 10 * 1024 * 1024;
+  payload.metadata_size = 1000;
+  // The whole payload is needed unless it was already applied.
+  EXPECT_EQ(0U, DownloadAction::GetManifestRangeSize(payload));
+
+  payload.already_applied = true;
+  uint64_t size = DownloadAction::GetManifestRangeSize(payload);
+  EXPECT_LT(payload.metadata_size, size);
+  EXPECT_GT(payload.size, size);
+
+  // Without a known metadata size, or for a small payload, it is requested
+  // at once.
+  payload.metadata_size = 0;
+  EXPECT_EQ(0U, DownloadAction::GetManifestRangeSize(payload));
+  payload.metadata_size = 1000;
+  payload.size = 2000;
+  EXPECT_EQ(0U, DownloadAction::GetManifestRangeSize(payload));
+}
+
 TEST(DownloadActionTest, PassObjectOutTest) {
   brillo::FakeMessageLoop loop(nullptr);
   loop.SetAsCurrent();
@@ -550,6 +593,10 @@ class P2PDownloadActionTest : public testing::Test {
     install_plan.payloads.push_back(
         {.size = data_.length(),
          .hash = {'1', '2', '3', '4', 'h', 'a', 's', 'h'}});
+    if (!next_payload_data_.empty()) {
+      install_plan.payloads.push_back(
+          {.size = next_payload_data_.length(), .hash = {'n', 'e', 'x', 't'}});
+    }
     ObjectFeederAction<InstallPlan> feeder_action;
     feeder_action.set_obj(install_plan);
     MockPrefs prefs;
@@ -564,6 +611,12 @@ class P2PDownloadActionTest : public testing::Test {
                                               http_fetcher_,
                                               false /* is_interactive */));
     download_action_->SetTestFileWriter(&writer);
+    if (!next_payload_data_.empty()) {
+      download_action_->AddPayloadCacheFetcher(
+          new MockHttpFetcher(next_payload_data_.c_str(),
+                              next_payload_data_.length(),
+                              nullptr));
+    }
     BondActions(&feeder_action, download_action_.get());
     DownloadActionTestProcessorDelegate delegate(ErrorCode::kSuccess);
     delegate.expected_data_ = brillo::Blob(data_.begin() + start_at_offset_,
@@ -600,6 +653,10 @@ class P2PDownloadActionTest : public testing::Test {
   // The data being downloaded.
   string data_;
 
+  // The data of the second payload, if not empty, only downloaded into its
+  // p2p file since the first one is the last one applied.
+  string next_payload_data_;
+
  private:
   // Callback used in StartDownload() method.
   void StartProcessorInRunLoopForP2P() {
@@ -721,4 +778,75 @@ TEST_F(P2PDownloadActionTest, DeletePartialP2PFileIfResumingWithoutP2P) {
   EXPECT_EQ(0, p2p_manager_->CountSharedFiles());
 }
 
+TEST_F(P2PDownloadActionTest, ReadsCompleteP2PFile) {
+  if (!test_utils::IsXAttrSupported(FilePath("/tmp"))) {
+    LOG(WARNING) << "Skipping test because /tmp does not support xattr. "
+                 << "Please update your system to support this feature.";
+    return;
+  }
+
+  SetupDownload(0);  // starting_offset
+
+  // Prepare the complete file left by a previous attempt.
+  string file_id = utils::CalculateP2PFileId(
+      {'1', '2', '3', '4', 'h', 'a', 's', 'h'}, data_.length());
+  ASSERT_TRUE(p2p_manager_->FileShare(file_id, data_.length()));
+  ASSERT_EQ(WriteFile(p2p_manager_->FileGetPath(file_id), data_.c_str(),
+                      data_.length()), static_cast<int>(data_.length()));
+
+  StartDownload(false);  // use_p2p_to_share
+
+  // The payload was read from the p2p file, which is kept but not written to.
+  EXPECT_EQ(0U, http_fetcher_->GetBytesDownloaded());
+  EXPECT_EQ(download_action_->p2p_file_id(), "");
+  EXPECT_EQ(static_cast<ssize_t>(data_.length()),
+            p2p_manager_->FileGetSize(file_id));
+  bool visible = true;
+  EXPECT_TRUE(p2p_manager_->FileGetVisible(file_id, &visible));
+  EXPECT_FALSE(visible);
+}
+
+TEST_F(P2PDownloadActionTest, DownloadsNextPayloadIntoP2PFile) {
+  if (!test_utils::IsXAttrSupported(FilePath("/tmp"))) {
+    LOG(WARNING) << "Skipping test because /tmp does not support xattr. "
+                 << "Please update your system to support this feature.";
+    return;
+  }
+
+  SetupDownload(0);  // starting_offset
+  next_payload_data_ = string(1000, 'n');
+
+  // The P2PManager is enabled without querying the policy, which it does
+  // asynchronously.
+  P2PManager* p2p_manager = p2p_manager_.get();
+  NiceMock<MockP2PManager> mock_p2p_manager;
+  ON_CALL(mock_p2p_manager, IsP2PEnabled()).WillByDefault(Return(true));
+  ON_CALL(mock_p2p_manager, FileShare(_, _))
+      .WillByDefault(Invoke(p2p_manager, &P2PManager::FileShare));
+  ON_CALL(mock_p2p_manager, FileGetPath(_))
+      .WillByDefault(Invoke(p2p_manager, &P2PManager::FileGetPath));
+  ON_CALL(mock_p2p_manager, FileGetSize(_))
+      .WillByDefault(Invoke(p2p_manager, &P2PManager::FileGetSize));
+  ON_CALL(mock_p2p_manager, FileGetVisible(_, _))
+      .WillByDefault(Invoke(p2p_manager, &P2PManager::FileGetVisible));
+  fake_system_state_.set_p2p_manager(&mock_p2p_manager);
+  EXPECT_CALL(*fake_system_state_.mock_payload_state(), GetPayloadUrl(1))
+      .WillRepeatedly(Return("http://example.com/next"));
+
+  StartDownload(false);  // use_p2p_to_share
+
+  // The second payload was downloaded while the first one was applied, and
+  // stays invisible.
+  string file_id = utils::CalculateP2PFileId({'n', 'e', 'x', 't'},
+                                             next_payload_data_.length());
+  string p2p_file_contents;
+  EXPECT_TRUE(ReadFileToString(p2p_manager->FileGetPath(file_id),
+                               &p2p_file_contents));
+  EXPECT_EQ(next_payload_data_, p2p_file_contents);
+  bool visible = true;
+  EXPECT_TRUE(p2p_manager->FileGetVisible(file_id, &visible));
+  EXPECT_FALSE(visible);
+  fake_system_state_.set_p2p_manager(p2p_manager);
+}
+
 }  // namespace chromeos_update_engine
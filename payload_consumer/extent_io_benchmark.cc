@@ -0,0 +1,510 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks the ExtentWriter and ExtentReader stacks and the
+// CachedFileDescriptor under them. Each benchmark moves --size_mb of data
+// through extents of each of the --extent_blocks sizes, separated by gaps so
+// they can't be merged, in calls of each of the --write_sizes_kb sizes, with
+// each of the --cache_sizes_kb write caches. The target is either a file in
+// --work_dir, a memory sink, which discards the data to measure only the
+// cost of the stack, or a simulated storage device, whose virtual time is
+// reported to compare the access patterns deterministically. Besides the time
+// per byte, the number of calls reaching the file descriptor, each a system
+// call on a real file, is reported per MiB.
+// The best rates measured can be saved as a device profile for the
+// delta_generator --device_profile_file apply time estimate.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/stringprintf.h>
+#include <base/time/time.h>
+#include <brillo/flag_helper.h>
+#include <brillo/key_value_store.h>
+#include <xz.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/bzip_extent_writer.h"
+#include "update_engine/payload_consumer/cached_file_descriptor.h"
+#include "update_engine/payload_consumer/extent_reader.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/fake_file_descriptor.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/xz.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const uint32_t kBlockSize = 4096;
+
+// The benchmarks that can be run.
+const char* const kBenchmarks[] = {
+    "direct_writer",
+    "xz_writer",
+    "bzip_writer",
+    "direct_reader",
+};
+
+// A FileDescriptor counting the calls that reach it, which are forwarded to
+// the wrapped |fd|. Without one, it is a memory sink: the writes are
+// discarded and the reads return zeros.
+class CountingFileDescriptor : public FileDescriptor {
+ public:
+  explicit CountingFileDescriptor(FileDescriptorPtr fd) : fd_(fd) {}
+  ~CountingFileDescriptor() override = default;
+
+  bool Open(const char* path, int flags, mode_t mode) override {
+    return fd_ ? fd_->Open(path, flags, mode) : (open_ = true);
+  }
+  bool Open(const char* path, int flags) override {
+    return fd_ ? fd_->Open(path, flags) : (open_ = true);
+  }
+  ssize_t Read(void* buf, size_t count) override {
+    calls_++;
+    if (fd_)
+      return fd_->Read(buf, count);
+    memset(buf, 0, count);
+    offset_ += count;
+    return count;
+  }
+  ssize_t Write(const void* buf, size_t count) override {
+    calls_++;
+    if (fd_)
+      return fd_->Write(buf, count);
+    offset_ += count;
+    return count;
+  }
+  off64_t Seek(off64_t offset, int whence) override {
+    calls_++;
+    if (fd_)
+      return fd_->Seek(offset, whence);
+    offset_ = (whence == SEEK_CUR ? offset_ : 0) + offset;
+    return offset_;
+  }
+  uint64_t BlockDevSize() override { return fd_ ? fd_->BlockDevSize() : 0; }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    calls_++;
+    return fd_ && fd_->BlkIoctl(request, start, length, result);
+  }
+  bool Readahead(uint64_t offset, uint64_t length) override {
+    return fd_ && fd_->Readahead(offset, length);
+  }
+  bool DropCache(uint64_t offset, uint64_t length) override {
+    return fd_ && fd_->DropCache(offset, length);
+  }
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override {
+    return false;
+  }
+  int GetNativeFd() override { return -1; }
+  bool Flush() override {
+    calls_++;
+    return fd_ ? fd_->Flush() : true;
+  }
+  bool Close() override {
+    if (fd_)
+      return fd_->Close();
+    open_ = false;
+    return true;
+  }
+  bool IsSettingErrno() override { return fd_ && fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_ ? fd_->IsOpen() : open_; }
+
+  uint64_t calls() const { return calls_; }
+
+ private:
+  FileDescriptorPtr fd_;
+  bool open_{false};
+  off64_t offset_{0};
+  uint64_t calls_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(CountingFileDescriptor);
+};
+
+// The parameters of one benchmark run.
+struct BenchmarkRun {
+  string benchmark;
+  // The file written or read, or empty for the memory sink.
+  string target_path;
+  uint64_t extent_blocks;
+  size_t write_size;
+  // The size of the CachedFileDescriptor under the writers, or 0 for none.
+  size_t cache_size;
+  // Whether the target is a simulated storage device, when |target_path| is
+  // empty.
+  bool simulated;
+};
+
+// Parses the comma separated list of sizes in |flag|, in units of |unit|
+// bytes, into |sizes|.
+bool ParseSizes(const string& flag, uint64_t unit, vector<uint64_t>* sizes) {
+  for (const string& str : base::SplitString(
+           flag, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    uint64_t size;
+    if (!base::StringToUint64(str, &size)) {
+      LOG(ERROR) << "Invalid size: " << str;
+      return false;
+    }
+    sizes->push_back(size * unit);
+  }
+  return !sizes->empty();
+}
+
+// Fills |data| with pseudo-random text from a small alphabet, which
+// compresses roughly like the files of a system image.
+void FillText(brillo::Blob* data) {
+  static const char kAlphabet[] = "etaoinshrdlucmfwyp \n";
+  std::minstd_rand rng(1);
+  std::uniform_int_distribution<size_t> dist(0, sizeof(kAlphabet) - 2);
+  for (uint8_t& byte : *data)
+    byte = kAlphabet[dist(rng)];
+}
+
+// Returns the extents of |extent_blocks| blocks covering |num_blocks| blocks,
+// each followed by a gap of the same size.
+vector<Extent> FragmentedExtents(uint64_t num_blocks, uint64_t extent_blocks) {
+  vector<Extent> extents;
+  for (uint64_t block = 0; block < num_blocks; block += extent_blocks) {
+    extents.push_back(ExtentForRange(
+        block * 2, std::min(extent_blocks, num_blocks - block)));
+  }
+  return extents;
+}
+
+// Returns the FileDescriptor counting the calls to the target of |run| in
+// |counting_fd|, and the simulated device of the target in |storage|.
+FileDescriptorPtr OpenTarget(const BenchmarkRun& run,
+                             CountingFileDescriptor** counting_fd,
+                             std::shared_ptr<SimulatedStorage>* storage) {
+  FileDescriptorPtr target_fd;
+  if (!run.target_path.empty()) {
+    target_fd.reset(new EintrSafeFileDescriptor());
+  } else if (run.simulated) {
+    storage->reset(new SimulatedStorage(SimulatedStorage::Model()));
+    FakeFileDescriptor* fake_fd = new FakeFileDescriptor();
+    fake_fd->SetStorage(*storage);
+    target_fd.reset(fake_fd);
+  }
+  *counting_fd = new CountingFileDescriptor(target_fd);
+  FileDescriptorPtr fd(*counting_fd);
+  if (!fd->Open(run.target_path.c_str(), O_RDWR | O_CREAT, 0644)) {
+    PLOG(ERROR) << "Unable to open " << run.target_path;
+    return nullptr;
+  }
+  return fd;
+}
+
+// Passes |input| to the writer of |run| in calls of |run.write_size| bytes,
+// which writes the |output_size| bytes it produces to |extents|. Returns the
+// duration in |duration| and the number of calls to the target in |calls|.
+bool RunWriterBenchmark(const BenchmarkRun& run,
+                        const brillo::Blob& input,
+                        const vector<Extent>& extents,
+                        base::TimeDelta* duration,
+                        uint64_t* calls) {
+  CountingFileDescriptor* counting_fd;
+  std::shared_ptr<SimulatedStorage> storage;
+  FileDescriptorPtr fd = OpenTarget(run, &counting_fd, &storage);
+  TEST_AND_RETURN_FALSE(fd);
+
+  base::TimeTicks start = base::TimeTicks::Now();
+  if (run.cache_size > 0)
+    fd.reset(new CachedFileDescriptor(fd, run.cache_size));
+  std::unique_ptr<ExtentWriter> writer(new DirectExtentWriter());
+  if (run.benchmark == "xz_writer") {
+    writer.reset(new XzExtentWriter(std::move(writer)));
+  } else if (run.benchmark == "bzip_writer") {
+    writer.reset(new BzipExtentWriter(std::move(writer)));
+  }
+  TEST_AND_RETURN_FALSE(writer->Init(fd, extents, kBlockSize));
+  for (size_t offset = 0; offset < input.size(); offset += run.write_size) {
+    TEST_AND_RETURN_FALSE(
+        writer->Write(input.data() + offset,
+                      std::min(run.write_size, input.size() - offset)));
+  }
+  TEST_AND_RETURN_FALSE(writer->End());
+  TEST_AND_RETURN_FALSE(fd->Flush());
+  *duration = storage ? storage->now() : base::TimeTicks::Now() - start;
+  *calls = counting_fd->calls();
+  TEST_AND_RETURN_FALSE(fd->Close());
+  return true;
+}
+
+// Reads |size| bytes from |extents| of the target of |run| in calls of
+// |run.write_size| bytes.
+bool RunReaderBenchmark(const BenchmarkRun& run,
+                        uint64_t size,
+                        const vector<Extent>& extents,
+                        base::TimeDelta* duration,
+                        uint64_t* calls) {
+  CountingFileDescriptor* counting_fd;
+  std::shared_ptr<SimulatedStorage> storage;
+  FileDescriptorPtr fd = OpenTarget(run, &counting_fd, &storage);
+  TEST_AND_RETURN_FALSE(fd);
+
+  brillo::Blob buffer(run.write_size);
+  base::TimeTicks start = base::TimeTicks::Now();
+  DirectExtentReader reader;
+  TEST_AND_RETURN_FALSE(reader.Init(fd, extents, kBlockSize));
+  for (uint64_t offset = 0; offset < size; offset += buffer.size()) {
+    TEST_AND_RETURN_FALSE(reader.Read(
+        buffer.data(), std::min<uint64_t>(buffer.size(), size - offset)));
+  }
+  *duration = storage ? storage->now() : base::TimeTicks::Now() - start;
+  *calls = counting_fd->calls();
+  TEST_AND_RETURN_FALSE(fd->Close());
+  return true;
+}
+
+void PrintResult(const BenchmarkRun& run,
+                 uint64_t size,
+                 base::TimeDelta duration,
+                 uint64_t calls) {
+  double mib = static_cast<double>(size) / (1024 * 1024);
+  printf("%-14s %-7s %10" PRIu64 " %9zu %9zu %9.3f %9.1f %11.1f\n",
+         run.benchmark.c_str(),
+         !run.target_path.empty() ? "file"
+                                  : run.simulated ? "sim" : "memory",
+         run.extent_blocks * kBlockSize / 1024,
+         run.write_size / 1024,
+         run.cache_size / 1024,
+         duration.InMicroseconds() * 1000.0 / size,
+         mib / duration.InSecondsF(),
+         calls / mib);
+}
+
+// Keeps in |profile| the best rate of |run| for the device profile keys: the
+// file writes and reads of the largest extents give the write and read rates,
+// the reads of single block extents the random read IOPS and the memory
+// writers the decode rates of their operation types.
+void UpdateProfile(const BenchmarkRun& run,
+                   uint64_t size,
+                   base::TimeDelta duration,
+                   uint64_t max_extent_blocks,
+                   std::map<string, double>* profile) {
+  double mbps = static_cast<double>(size) / (1024 * 1024) /
+                std::max(duration.InSecondsF(), 1e-9);
+  // The simulated device doesn't measure this device.
+  if (run.simulated)
+    return;
+  bool is_file = !run.target_path.empty();
+  vector<std::pair<string, double>> values;
+  if (run.benchmark == "direct_writer" && is_file &&
+      run.extent_blocks == max_extent_blocks) {
+    values.emplace_back("write_mbps", mbps);
+  } else if (run.benchmark == "direct_reader" && is_file) {
+    if (run.extent_blocks == max_extent_blocks)
+      values.emplace_back("read_mbps", mbps);
+    if (run.extent_blocks == 1)
+      values.emplace_back("random_read_iops", mbps * 1024 * 1024 / kBlockSize);
+  } else if (run.benchmark == "xz_writer" && !is_file) {
+    values.emplace_back("replace_xz_mbps", mbps);
+  } else if (run.benchmark == "bzip_writer" && !is_file) {
+    values.emplace_back("replace_bz_mbps", mbps);
+  }
+  for (const auto& key_value : values) {
+    double& best = (*profile)[key_value.first];
+    best = std::max(best, key_value.second);
+  }
+}
+
+int Main(int argc, char** argv) {
+  DEFINE_string(benchmarks,
+                "direct_writer,xz_writer,bzip_writer,direct_reader",
+                "Comma separated list of the benchmarks to run.");
+  DEFINE_int32(size_mb, 32, "The size of the data written or read, in MiB.");
+  DEFINE_string(extent_blocks,
+                "1,16,256",
+                "Comma separated list of the sizes of the extents, in blocks.");
+  DEFINE_string(write_sizes_kb,
+                "4,64,1024",
+                "Comma separated list of the sizes passed to each Write() or "
+                "Read() call, in KiB.");
+  DEFINE_string(cache_sizes_kb,
+                "0,256,1024",
+                "Comma separated list of the sizes of the CachedFileDescriptor "
+                "under the writers, in KiB, where 0 benchmarks without one.");
+  DEFINE_string(targets,
+                "memory,file",
+                "Comma separated list of the targets: \"memory\" discards the "
+                "data, \"file\" uses a file in --work_dir and \"simulated\" "
+                "a simulated eMMC-like device, reporting its virtual time.");
+  DEFINE_string(work_dir,
+                "/tmp",
+                "Directory where the target file is written. Use a tmpfs to "
+                "measure the stacks without the storage.");
+  DEFINE_string(out_profile_file,
+                "",
+                "If set, the best rates measured are written to this file as "
+                "a device profile of key=value pairs for the delta_generator "
+                "--device_profile_file apply time estimate.");
+
+  brillo::FlagHelper::Init(
+      argc, argv, "Benchmarks the extent writers, readers and write cache.");
+  logging::LoggingSettings log_settings;
+  log_settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(log_settings);
+  XzCompressInit();
+  xz_crc32_init();
+
+  vector<uint64_t> extent_blocks, write_sizes, cache_sizes;
+  if (FLAGS_size_mb <= 0 ||
+      !ParseSizes(FLAGS_extent_blocks, 1, &extent_blocks) ||
+      !ParseSizes(FLAGS_write_sizes_kb, 1024, &write_sizes) ||
+      !ParseSizes(FLAGS_cache_sizes_kb, 1024, &cache_sizes) ||
+      std::count(extent_blocks.begin(), extent_blocks.end(), 0) > 0 ||
+      std::count(write_sizes.begin(), write_sizes.end(), 0) > 0) {
+    LOG(ERROR) << "Invalid size, extent sizes, write sizes or cache sizes.";
+    return 1;
+  }
+  vector<string> benchmarks = base::SplitString(
+      FLAGS_benchmarks, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  for (const string& benchmark : benchmarks) {
+    if (std::find(std::begin(kBenchmarks), std::end(kBenchmarks), benchmark) ==
+        std::end(kBenchmarks)) {
+      LOG(ERROR) << "Unknown benchmark " << benchmark;
+      return 1;
+    }
+  }
+  // The path of each target, and whether it is simulated.
+  vector<std::pair<string, bool>> targets;
+  string target_file = FLAGS_work_dir + "/extent_io_benchmark.img";
+  ScopedPathUnlinker target_unlinker(target_file);
+  for (const string& target : base::SplitString(
+           FLAGS_targets, ",", base::TRIM_WHITESPACE,
+           base::SPLIT_WANT_NONEMPTY)) {
+    if (target != "memory" && target != "file" && target != "simulated") {
+      LOG(ERROR) << "Unknown target " << target;
+      return 1;
+    }
+    targets.emplace_back(target == "file" ? target_file : "",
+                         target == "simulated");
+  }
+
+  uint64_t size = static_cast<uint64_t>(FLAGS_size_mb) * 1024 * 1024;
+  brillo::Blob data(size), xz_data, bzip_data;
+  FillText(&data);
+  // The file covers the extents and their gaps, so the reads have data.
+  brillo::Blob file_data(data);
+  file_data.insert(file_data.end(), data.begin(), data.end());
+  if (!utils::WriteFile(
+          target_file.c_str(), file_data.data(), file_data.size())) {
+    return 1;
+  }
+  file_data.clear();
+
+  const uint64_t max_extent_blocks =
+      *std::max_element(extent_blocks.begin(), extent_blocks.end());
+  std::map<string, double> profile;
+  printf("%-14s %-7s %10s %9s %9s %9s %9s %11s\n",
+         "benchmark",
+         "target",
+         "extent KiB",
+         "write KiB",
+         "cache KiB",
+         "ns/byte",
+         "MiB/s",
+         "calls/MiB");
+  for (const string& benchmark : benchmarks) {
+    const brillo::Blob* input = &data;
+    if (benchmark == "xz_writer") {
+      if (xz_data.empty() && !XzCompress(data, &xz_data))
+        return 1;
+      input = &xz_data;
+    } else if (benchmark == "bzip_writer") {
+      if (bzip_data.empty() && !BzipCompress(data, &bzip_data))
+        return 1;
+      input = &bzip_data;
+    }
+    bool is_reader = benchmark == "direct_reader";
+    for (const auto& target : targets) {
+      for (uint64_t blocks : extent_blocks) {
+        vector<Extent> extents = FragmentedExtents(size / kBlockSize, blocks);
+        for (uint64_t write_size : write_sizes) {
+          // The readers don't go through the write cache.
+          for (uint64_t cache_size : cache_sizes) {
+            if (is_reader && cache_size != cache_sizes.front())
+              break;
+            BenchmarkRun run{benchmark,
+                             target.first,
+                             blocks,
+                             static_cast<size_t>(write_size),
+                             is_reader ? 0 : static_cast<size_t>(cache_size),
+                             target.second};
+            base::TimeDelta duration;
+            uint64_t calls;
+            if (is_reader
+                    ? !RunReaderBenchmark(run, size, extents, &duration, &calls)
+                    : !RunWriterBenchmark(
+                          run, *input, extents, &duration, &calls)) {
+              LOG(ERROR) << "Failed to run the " << benchmark << " benchmark.";
+              return 1;
+            }
+            PrintResult(run, size, duration, calls);
+            UpdateProfile(run, size, duration, max_extent_blocks, &profile);
+          }
+        }
+      }
+    }
+  }
+
+  if (!FLAGS_out_profile_file.empty()) {
+    brillo::KeyValueStore store;
+    for (const auto& key_value : profile)
+      store.SetString(key_value.first,
+                      base::StringPrintf("%.1f", key_value.second));
+    if (!store.Save(base::FilePath(FLAGS_out_profile_file))) {
+      LOG(ERROR) << "Unable to write the profile to " << FLAGS_out_profile_file;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  return chromeos_update_engine::Main(argc, argv);
+}
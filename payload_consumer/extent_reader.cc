@@ -19,15 +19,16 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
+
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 
-using google::protobuf::RepeatedPtrField;
-
 namespace chromeos_update_engine {
 
 bool DirectExtentReader::Init(FileDescriptorPtr fd,
-                              const RepeatedPtrField<Extent>& extents,
+                              ExtentSpan extents,
                               uint32_t block_size) {
   fd_ = fd;
   extents_ = extents;
@@ -55,7 +56,7 @@ bool DirectExtentReader::Seek(uint64_t offset) {
   auto extent_idx = std::upper_bound(
       extents_upper_bounds_.begin(), extents_upper_bounds_.end(), offset) -
       extents_upper_bounds_.begin() - 1;
-  cur_extent_ = std::next(extents_.begin(), extent_idx);
+  cur_extent_ = extents_.begin() + extent_idx;
   offset_ = offset;
   cur_extent_bytes_read_ = offset_ - extents_upper_bounds_[extent_idx];
   return true;
@@ -95,4 +96,63 @@ bool DirectExtentReader::Read(void* buffer, size_t count) {
   return true;
 }
 
+bool MmapExtentReader::Init(FileDescriptorPtr fd,
+                            ExtentSpan extents,
+                            uint32_t block_size) {
+  extents_ = extents;
+  block_size_ = block_size;
+  cur_extent_ = 0;
+
+  extents_upper_bounds_.reserve(extents_.size() + 1);
+  extents_upper_bounds_.emplace_back(0);
+  for (const auto& extent : extents_) {
+    // Reading past the end of the mapping would crash.
+    TEST_AND_RETURN_FALSE(extent.start_block() != kSparseHole);
+    TEST_AND_RETURN_FALSE(
+        (extent.start_block() + extent.num_blocks()) * block_size_ <= size_);
+    total_size_ += extent.num_blocks() * block_size_;
+    extents_upper_bounds_.emplace_back(total_size_);
+  }
+  return true;
+}
+
+bool MmapExtentReader::Seek(uint64_t offset) {
+  TEST_AND_RETURN_FALSE(offset <= total_size_);
+  if (offset_ == offset) {
+    return true;
+  }
+  cur_extent_ = std::upper_bound(extents_upper_bounds_.begin(),
+                                 extents_upper_bounds_.end(),
+                                 offset) -
+                extents_upper_bounds_.begin() - 1;
+  offset_ = offset;
+  cur_extent_bytes_read_ = offset_ - extents_upper_bounds_[cur_extent_];
+  return true;
+}
+
+bool MmapExtentReader::Read(void* buffer, size_t count) {
+  TEST_AND_RETURN_FALSE(count <= total_size_ - offset_);
+  auto bytes = reinterpret_cast<uint8_t*>(buffer);
+  uint64_t bytes_read = 0;
+  while (bytes_read < count) {
+    const Extent& extent = extents_[cur_extent_];
+    uint64_t cur_extent_bytes_left =
+        extent.num_blocks() * block_size_ - cur_extent_bytes_read_;
+    uint64_t bytes_to_read =
+        std::min(count - bytes_read, cur_extent_bytes_left);
+    memcpy(bytes + bytes_read,
+           data_ + extent.start_block() * block_size_ + cur_extent_bytes_read_,
+           bytes_to_read);
+
+    bytes_read += bytes_to_read;
+    cur_extent_bytes_read_ += bytes_to_read;
+    offset_ += bytes_to_read;
+    if (cur_extent_bytes_read_ == extent.num_blocks() * block_size_) {
+      cur_extent_++;
+      cur_extent_bytes_read_ = 0;
+    }
+  }
+  return true;
+}
+
 }  // namespace chromeos_update_engine
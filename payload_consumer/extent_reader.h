@@ -19,6 +19,7 @@
 
 #include <vector>
 
+#include "update_engine/payload_consumer/extent_span.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -30,9 +31,9 @@ class ExtentReader {
  public:
   virtual ~ExtentReader() = default;
 
-  // Initializes |ExtentReader|
+  // Initializes |ExtentReader|. The |extents| must outlive the reader.
   virtual bool Init(FileDescriptorPtr fd,
-                    const google::protobuf::RepeatedPtrField<Extent>& extents,
+                    ExtentSpan extents,
                     uint32_t block_size) = 0;
 
   // Seeks to the given |offset| assuming all extents are concatenated together.
@@ -50,18 +51,18 @@ class DirectExtentReader : public ExtentReader {
   ~DirectExtentReader() override = default;
 
   bool Init(FileDescriptorPtr fd,
-            const google::protobuf::RepeatedPtrField<Extent>& extents,
+            ExtentSpan extents,
             uint32_t block_size) override;
   bool Seek(uint64_t offset) override;
   bool Read(void* bytes, size_t count) override;
 
  private:
   FileDescriptorPtr fd_{nullptr};
-  google::protobuf::RepeatedPtrField<Extent> extents_;
+  ExtentSpan extents_;
   size_t block_size_{0};
 
   // Current extent being read from |fd_|.
-  google::protobuf::RepeatedPtrField<Extent>::iterator cur_extent_;
+  ExtentSpan::const_iterator cur_extent_;
 
   // Bytes read from |cur_extent_| thus far.
   uint64_t cur_extent_bytes_read_{0};
@@ -77,6 +78,43 @@ class DirectExtentReader : public ExtentReader {
   DISALLOW_COPY_AND_ASSIGN(DirectExtentReader);
 };
 
+// MmapExtentReader reads the extents from a file already mapped in memory, so
+// no read() call is needed and the kernel pages the data in on demand. The |fd|
+// passed to Init() isn't used.
+class MmapExtentReader : public ExtentReader {
+ public:
+  // The first |size| bytes of the file are mapped at |data|, which must stay
+  // mapped for the lifetime of this reader.
+  MmapExtentReader(const uint8_t* data, uint64_t size)
+      : data_(data), size_(size) {}
+  ~MmapExtentReader() override = default;
+
+  bool Init(FileDescriptorPtr fd,
+            ExtentSpan extents,
+            uint32_t block_size) override;
+  bool Seek(uint64_t offset) override;
+  bool Read(void* bytes, size_t count) override;
+
+ private:
+  const uint8_t* data_;
+  uint64_t size_;
+
+  ExtentSpan extents_;
+  size_t block_size_{0};
+
+  // The index in |extents_| of the extent holding |offset_| and the offset
+  // within the concatenated extents.
+  size_t cur_extent_{0};
+  uint64_t cur_extent_bytes_read_{0};
+  uint64_t offset_{0};
+
+  // The upper bounds of |extents_|, like in DirectExtentReader.
+  std::vector<uint64_t> extents_upper_bounds_;
+  uint64_t total_size_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(MmapExtentReader);
+};
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_READER_H_
@@ -79,7 +79,7 @@ class ExtentReaderTest : public ::testing::Test {
 TEST_F(ExtentReaderTest, SimpleTest) {
   vector<Extent> extents = {ExtentForRange(1, 1)};
   DirectExtentReader reader;
-  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
   EXPECT_TRUE(reader.Seek(0));
   brillo::Blob blob1(utils::BlocksInExtents(extents) * kBlockSize);
   EXPECT_TRUE(reader.Read(blob1.data(), blob1.size()));
@@ -91,7 +91,7 @@ TEST_F(ExtentReaderTest, SimpleTest) {
 TEST_F(ExtentReaderTest, ZeroExtentLengthTest) {
   vector<Extent> extents = {ExtentForRange(1, 0)};
   DirectExtentReader reader;
-  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
   EXPECT_TRUE(reader.Seek(0));
   brillo::Blob blob(1);
   EXPECT_TRUE(reader.Read(blob.data(), 0));
@@ -110,7 +110,7 @@ TEST_F(ExtentReaderTest, NoExtentTest) {
 TEST_F(ExtentReaderTest, OverflowExtentTest) {
   vector<Extent> extents = {ExtentForRange(1, 1)};
   DirectExtentReader reader;
-  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
   EXPECT_TRUE(reader.Seek(0));
   brillo::Blob blob(utils::BlocksInExtents(extents) * kBlockSize + 1);
   EXPECT_FALSE(reader.Read(blob.data(), blob.size()));
@@ -119,7 +119,7 @@ TEST_F(ExtentReaderTest, OverflowExtentTest) {
 TEST_F(ExtentReaderTest, SeekOverflow1Test) {
   vector<Extent> extents = {ExtentForRange(1, 0)};
   DirectExtentReader reader;
-  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
   EXPECT_TRUE(reader.Seek(0));
   EXPECT_FALSE(reader.Seek(1));
 }
@@ -134,7 +134,7 @@ TEST_F(ExtentReaderTest, SeekOverflow2Test) {
 TEST_F(ExtentReaderTest, SeekOverflow3Test) {
   vector<Extent> extents = {ExtentForRange(1, 1)};
   DirectExtentReader reader;
-  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
   // Seek to the end of the extents should be fine as long as nothing is read.
   EXPECT_TRUE(reader.Seek(kBlockSize));
   EXPECT_FALSE(reader.Seek(kBlockSize + 1));
@@ -147,7 +147,7 @@ TEST_F(ExtentReaderTest, RandomReadTest) {
                             ExtentForRange(4, 2),
                             ExtentForRange(7, 1)};
   DirectExtentReader reader;
-  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
 
   brillo::Blob result;
   ReadExtents(extents, &result);
@@ -167,4 +167,48 @@ TEST_F(ExtentReaderTest, RandomReadTest) {
   }
 }
 
+TEST_F(ExtentReaderTest, MmapRandomReadTest) {
+  vector<Extent> extents = {ExtentForRange(0, 0),
+                            ExtentForRange(1, 1),
+                            ExtentForRange(3, 0),
+                            ExtentForRange(4, 2),
+                            ExtentForRange(7, 1)};
+  MmapExtentReader reader(sample_.data(), sample_.size());
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
+
+  brillo::Blob result;
+  ReadExtents(extents, &result);
+
+  brillo::Blob blob(utils::BlocksInExtents(extents) * kBlockSize);
+  srand(time(nullptr));
+  uint32_t rand_seed;
+  for (size_t idx = 0; idx < kRandomIterations; idx++) {
+    size_t start = rand_r(&rand_seed) % blob.size();
+    size_t size = rand_r(&rand_seed) % (blob.size() - start);
+    EXPECT_TRUE(reader.Seek(start));
+    EXPECT_TRUE(reader.Read(blob.data(), size));
+    for (size_t i = 0; i < size; i++) {
+      ASSERT_EQ(blob[i], result[start + i]);
+    }
+  }
+}
+
+TEST_F(ExtentReaderTest, MmapOverflowTest) {
+  vector<Extent> extents = {ExtentForRange(1, 1)};
+  MmapExtentReader reader(sample_.data(), sample_.size());
+  EXPECT_TRUE(reader.Init(fd_, extents, kBlockSize));
+  EXPECT_TRUE(reader.Seek(0));
+  brillo::Blob blob(utils::BlocksInExtents(extents) * kBlockSize + 1);
+  EXPECT_FALSE(reader.Read(blob.data(), blob.size()));
+  EXPECT_TRUE(reader.Seek(kBlockSize));
+  EXPECT_FALSE(reader.Seek(kBlockSize + 1));
+}
+
+TEST_F(ExtentReaderTest, MmapExtentOutsideTheMappingTest) {
+  // The extents must be within the mapped data.
+  vector<Extent> extents = {ExtentForRange(sample_.size() / kBlockSize, 1)};
+  MmapExtentReader reader(sample_.data(), sample_.size());
+  EXPECT_FALSE(reader.Init(fd_, extents, kBlockSize));
+}
+
 }  // namespace chromeos_update_engine
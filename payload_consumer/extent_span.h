@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_SPAN_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_SPAN_H_
+
+#include <stddef.h>
+
+#include <iterator>
+#include <vector>
+
+#include <google/protobuf/repeated_field.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// ExtentSpan is a non-owning view of a list of extents, stored either in a
+// repeated Extent field of a protobuf message or in a vector. It is cheap to
+// copy and lets the extents of an operation be passed around without copying
+// every Extent message. The viewed extents must outlive the span.
+class ExtentSpan {
+ public:
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Extent;
+    using difference_type = ptrdiff_t;
+    using pointer = const Extent*;
+    using reference = const Extent&;
+
+    const_iterator() = default;
+
+    reference operator*() const {
+      return extent_ptrs_ ? *extent_ptrs_[index_] : extents_[index_];
+    }
+    pointer operator->() const { return &**this; }
+
+    const_iterator& operator++() {
+      index_++;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator result = *this;
+      index_++;
+      return result;
+    }
+
+    // Returns the iterator |n| extents after this one.
+    const_iterator operator+(size_t n) const {
+      const_iterator result = *this;
+      result.index_ += n;
+      return result;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return index_ != other.index_;
+    }
+
+   private:
+    friend class ExtentSpan;
+
+    const_iterator(const Extent* const* extent_ptrs,
+                   const Extent* extents,
+                   size_t index)
+        : extent_ptrs_(extent_ptrs), extents_(extents), index_(index) {}
+
+    const Extent* const* extent_ptrs_{nullptr};
+    const Extent* extents_{nullptr};
+    size_t index_{0};
+  };
+
+  // An empty list of extents.
+  ExtentSpan() = default;
+
+  // Views the |extents| of a protobuf message, usually an InstallOperation.
+  ExtentSpan(  // NOLINT(runtime/explicit)
+      const google::protobuf::RepeatedPtrField<Extent>& extents)
+      : extent_ptrs_(extents.data()), size_(extents.size()) {}
+
+  // Views the |extents| stored in a vector.
+  ExtentSpan(const std::vector<Extent>& extents)  // NOLINT(runtime/explicit)
+      : extents_(extents.data()), size_(extents.size()) {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const Extent& operator[](size_t index) const {
+    return extent_ptrs_ ? *extent_ptrs_[index] : extents_[index];
+  }
+
+  const_iterator begin() const {
+    return const_iterator(extent_ptrs_, extents_, 0);
+  }
+  const_iterator end() const {
+    return const_iterator(extent_ptrs_, extents_, size_);
+  }
+
+ private:
+  // Only one of |extent_ptrs_| and |extents_| is set, depending on the
+  // storage viewed.
+  const Extent* const* extent_ptrs_{nullptr};
+  const Extent* extents_{nullptr};
+  size_t size_{0};
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_SPAN_H_
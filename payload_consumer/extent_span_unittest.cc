@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/extent_span.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class ExtentSpanTest : public ::testing::Test {
+ protected:
+  // Checks that |span| views the extents in |expected|.
+  void ExpectExtents(const vector<Extent>& expected, ExtentSpan span) {
+    ASSERT_EQ(expected.size(), span.size());
+    EXPECT_EQ(expected.empty(), span.empty());
+    size_t i = 0;
+    for (const Extent& extent : span) {
+      EXPECT_EQ(expected[i], extent);
+      EXPECT_EQ(&span[i], &extent);
+      i++;
+    }
+    EXPECT_EQ(expected.size(), i);
+  }
+};
+
+TEST_F(ExtentSpanTest, EmptyTest) {
+  ExpectExtents({}, ExtentSpan());
+  ExpectExtents({}, google::protobuf::RepeatedPtrField<Extent>());
+  EXPECT_EQ(0U, utils::BlocksInExtents(ExtentSpan()));
+}
+
+TEST_F(ExtentSpanTest, RepeatedFieldTest) {
+  InstallOperation operation;
+  *operation.add_dst_extents() = ExtentForRange(10, 2);
+  *operation.add_dst_extents() = ExtentForRange(1, 3);
+  ExtentSpan span = operation.dst_extents();
+  ExpectExtents({ExtentForRange(10, 2), ExtentForRange(1, 3)}, span);
+  // The span doesn't copy the extents.
+  EXPECT_EQ(&operation.dst_extents(1), &span[1]);
+  EXPECT_EQ(5U, utils::BlocksInExtents(span));
+  EXPECT_EQ(3U, (span.begin() + 1)->num_blocks());
+  EXPECT_TRUE(span.begin() + 2 == span.end());
+}
+
+TEST_F(ExtentSpanTest, VectorTest) {
+  vector<Extent> extents = {ExtentForRange(7, 1), ExtentForRange(0, 4)};
+  ExtentSpan span = extents;
+  ExpectExtents(extents, span);
+  EXPECT_EQ(&extents[0], &span[0]);
+  EXPECT_EQ(5U, utils::BlocksInExtents(span));
+}
+
+}  // namespace chromeos_update_engine
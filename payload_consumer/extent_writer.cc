@@ -17,6 +17,7 @@
 #include "update_engine/payload_consumer/extent_writer.h"
 
 #include <errno.h>
+#include <linux/fs.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -29,6 +30,15 @@ using std::min;
 
 namespace chromeos_update_engine {
 
+namespace {
+// The size of the zero buffer written when the target doesn't support the
+// BLKZEROOUT ioctl.
+const size_t kZeroBufferSize = 256 * 1024;
+}  // namespace
+
+// Below this size, issuing the ioctl costs more than writing the zeros.
+const uint64_t DirectExtentWriter::kMinZeroOutBytes = 64 * 1024;
+
 bool DirectExtentWriter::Write(const void* bytes, size_t count) {
   if (count == 0)
     return true;
@@ -45,12 +55,10 @@ bool DirectExtentWriter::Write(const void* bytes, size_t count) {
     TEST_AND_RETURN_FALSE(bytes_to_write > 0);
 
     if (cur_extent_->start_block() != kSparseHole) {
-      const off64_t offset =
+      const uint64_t offset =
           cur_extent_->start_block() * block_size_ + extent_bytes_written_;
-      TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset, SEEK_SET) !=
-                                  static_cast<off64_t>(-1));
       TEST_AND_RETURN_FALSE(
-          utils::WriteAll(fd_, c_bytes + bytes_written, bytes_to_write));
+          WriteExtentData(c_bytes + bytes_written, bytes_to_write, offset));
     }
     bytes_written += bytes_to_write;
     extent_bytes_written_ += bytes_to_write;
@@ -65,4 +73,87 @@ bool DirectExtentWriter::Write(const void* bytes, size_t count) {
   return true;
 }
 
+bool DirectExtentWriter::WriteExtentData(const char* data,
+                                         size_t size,
+                                         uint64_t offset) {
+  if (!zero_ioctl_supported_ || !*zero_ioctl_supported_) {
+    TEST_AND_RETURN_FALSE(FlushZeroRun());
+    return WriteAt(data, size, offset);
+  }
+  // Only the whole blocks are checked. The other data between the zero blocks
+  // is written at once.
+  size_t data_start = 0;
+  size_t pos = 0;
+  while (pos < size) {
+    const uint64_t block_offset = (offset + pos) % block_size_;
+    const size_t length = static_cast<size_t>(
+        min<uint64_t>(size - pos, block_size_ - block_offset));
+    if (block_offset == 0 && length == block_size_ &&
+        utils::IsZeroBuffer(data + pos, length)) {
+      if (data_start < pos) {
+        TEST_AND_RETURN_FALSE(FlushZeroRun());
+        TEST_AND_RETURN_FALSE(
+            WriteAt(data + data_start, pos - data_start, offset + data_start));
+      }
+      TEST_AND_RETURN_FALSE(AddZeroRun(offset + pos, length));
+      data_start = pos + length;
+    }
+    pos += length;
+  }
+  if (data_start < size) {
+    TEST_AND_RETURN_FALSE(FlushZeroRun());
+    TEST_AND_RETURN_FALSE(
+        WriteAt(data + data_start, size - data_start, offset + data_start));
+  }
+  return true;
+}
+
+bool DirectExtentWriter::WriteAt(const char* data,
+                                 size_t size,
+                                 uint64_t offset) {
+  TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset, SEEK_SET) !=
+                              static_cast<off64_t>(-1));
+  return utils::WriteAll(fd_, data, size);
+}
+
+bool DirectExtentWriter::AddZeroRun(uint64_t offset, uint64_t length) {
+  if (zero_run_length_ > 0 && zero_run_offset_ + zero_run_length_ == offset) {
+    zero_run_length_ += length;
+    return true;
+  }
+  TEST_AND_RETURN_FALSE(FlushZeroRun());
+  zero_run_offset_ = offset;
+  zero_run_length_ = length;
+  return true;
+}
+
+bool DirectExtentWriter::FlushZeroRun() {
+  const uint64_t offset = zero_run_offset_;
+  const uint64_t length = zero_run_length_;
+  zero_run_length_ = 0;
+  if (length == 0)
+    return true;
+#ifdef BLKZEROOUT
+  if (length >= kMinZeroOutBytes && *zero_ioctl_supported_) {
+    int result = 0;
+    if (fd_->BlkIoctl(BLKZEROOUT, offset, length, &result) && result == 0)
+      return true;
+    LOG(INFO) << "Target partition doesn't support BLKZEROOUT ioctl, writing "
+              << "zeros instead.";
+    *zero_ioctl_supported_ = false;
+  }
+#endif  // defined(BLKZEROOUT)
+  // The zero buffer is shared by all the writers.
+  static const brillo::Blob* const zeros = new brillo::Blob(kZeroBufferSize);
+  for (uint64_t done = 0; done < length; done += zeros->size()) {
+    const size_t chunk_length =
+        static_cast<size_t>(min<uint64_t>(length - done, zeros->size()));
+    TEST_AND_RETURN_FALSE(
+        WriteAt(reinterpret_cast<const char*>(zeros->data()),
+                chunk_length,
+                offset + done));
+  }
+  return true;
+}
+
 }  // namespace chromeos_update_engine
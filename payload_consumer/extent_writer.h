@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_WRITER_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_WRITER_H_
 
+#include <atomic>
 #include <memory>
 #include <utility>
 
@@ -24,6 +25,7 @@
 #include <brillo/secure_blob.h>
 
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/extent_span.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -39,9 +41,9 @@ class ExtentWriter {
     LOG_IF(ERROR, !end_called_) << "End() not called on ExtentWriter.";
   }
 
-  // Returns true on success.
+  // Returns true on success. The |extents| must outlive the writer.
   virtual bool Init(FileDescriptorPtr fd,
-                    const google::protobuf::RepeatedPtrField<Extent>& extents,
+                    ExtentSpan extents,
                     uint32_t block_size) = 0;
 
   // Returns true on success.
@@ -63,11 +65,24 @@ class ExtentWriter {
 
 class DirectExtentWriter : public ExtentWriter {
  public:
+  // The shortest run of zero blocks written with the BLKZEROOUT ioctl.
+  static const uint64_t kMinZeroOutBytes;
+
   DirectExtentWriter() = default;
   ~DirectExtentWriter() override = default;
 
+  // Zeroes the runs of at least kMinZeroOutBytes of whole zero blocks written
+  // with the BLKZEROOUT ioctl, instead of writing the zeros, while
+  // |*zero_ioctl_supported| is set. It is cleared if the ioctl fails, and the
+  // zeros are written instead. As a run may continue in the next Write(), it
+  // is only zeroed once followed by other data or on End(), so the data isn't
+  // all in the target before End(). Must be called before Init().
+  void set_zero_out(std::atomic<bool>* zero_ioctl_supported) {
+    zero_ioctl_supported_ = zero_ioctl_supported;
+  }
+
   bool Init(FileDescriptorPtr fd,
-            const google::protobuf::RepeatedPtrField<Extent>& extents,
+            ExtentSpan extents,
             uint32_t block_size) override {
     fd_ = fd;
     block_size_ = block_size;
@@ -76,17 +91,35 @@ class DirectExtentWriter : public ExtentWriter {
     return true;
   }
   bool Write(const void* bytes, size_t count) override;
-  bool EndImpl() override { return true; }
+  bool EndImpl() override { return FlushZeroRun(); }
 
  private:
+  // Writes the |size| bytes of |data| at |offset| in the target, looking for
+  // the zero blocks to zero out if enabled.
+  bool WriteExtentData(const char* data, size_t size, uint64_t offset);
+
+  // Writes the |size| bytes of |data| at |offset| in the target.
+  bool WriteAt(const char* data, size_t size, uint64_t offset);
+
+  // Adds the |length| zero bytes at |offset| to the run of zeros to zero out,
+  // first zeroing the current one if they don't follow it.
+  bool AddZeroRun(uint64_t offset, uint64_t length);
+
+  // Zeroes the current run of zeros, if any.
+  bool FlushZeroRun();
+
   FileDescriptorPtr fd_{nullptr};
+  std::atomic<bool>* zero_ioctl_supported_{nullptr};
+  // The run of zeros not written yet to the target.
+  uint64_t zero_run_offset_{0};
+  uint64_t zero_run_length_{0};
 
   size_t block_size_{0};
   // Bytes written into |cur_extent_| thus far.
   uint64_t extent_bytes_written_{0};
-  google::protobuf::RepeatedPtrField<Extent> extents_;
+  ExtentSpan extents_;
   // The next call to write should correspond to |cur_extents_|.
-  google::protobuf::RepeatedPtrField<Extent>::iterator cur_extent_;
+  ExtentSpan::const_iterator cur_extent_;
 };
 
 // Takes an underlying ExtentWriter to which all operations are delegated.
@@ -102,7 +135,7 @@ class ZeroPadExtentWriter : public ExtentWriter {
   ~ZeroPadExtentWriter() override = default;
 
   bool Init(FileDescriptorPtr fd,
-            const google::protobuf::RepeatedPtrField<Extent>& extents,
+            ExtentSpan extents,
             uint32_t block_size) override {
     block_size_ = block_size;
     return underlying_extent_writer_->Init(fd, extents, block_size);
@@ -19,6 +19,7 @@
 #include <fcntl.h>
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -42,7 +43,34 @@ static_assert(sizeof(off_t) == 8, "off_t not 64 bit");
 
 namespace {
 const size_t kBlockSize = 4096;
+
+// A file descriptor recording the BLKZEROOUT requests instead of zeroing the
+// file, as if it was a block device supporting them.
+class ZeroOutFileDescriptor : public EintrSafeFileDescriptor {
+ public:
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    zero_out_ranges_.emplace_back(start, length);
+    *result = 0;
+    return true;
+  }
+
+  vector<std::pair<uint64_t, uint64_t>> zero_out_ranges_;
+};
+
+// Returns 40 blocks of data, with 32 zero blocks from the block 1 and 2 zero
+// blocks from the block 34.
+brillo::Blob GetZeroRunsData() {
+  brillo::Blob data(40 * kBlockSize);
+  test_utils::FillWithData(&data);
+  std::fill(data.begin() + kBlockSize, data.begin() + 33 * kBlockSize, 0);
+  std::fill(
+      data.begin() + 34 * kBlockSize, data.begin() + 36 * kBlockSize, 0);
+  return data;
 }
+}  // namespace
 
 class ExtentWriterTest : public ::testing::Test {
  protected:
@@ -69,8 +97,7 @@ TEST_F(ExtentWriterTest, SimpleTest) {
   vector<Extent> extents = {ExtentForRange(1, 1)};
   const string bytes = "1234";
   DirectExtentWriter direct_writer;
-  EXPECT_TRUE(
-      direct_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(direct_writer.Init(fd_, extents, kBlockSize));
   EXPECT_TRUE(direct_writer.Write(bytes.data(), bytes.size()));
   EXPECT_TRUE(direct_writer.End());
 
@@ -89,8 +116,7 @@ TEST_F(ExtentWriterTest, SimpleTest) {
 TEST_F(ExtentWriterTest, ZeroLengthTest) {
   vector<Extent> extents = {ExtentForRange(1, 1)};
   DirectExtentWriter direct_writer;
-  EXPECT_TRUE(
-      direct_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(direct_writer.Init(fd_, extents, kBlockSize));
   EXPECT_TRUE(direct_writer.Write(nullptr, 0));
   EXPECT_TRUE(direct_writer.End());
 }
@@ -115,8 +141,7 @@ void ExtentWriterTest::WriteAlignedExtents(size_t chunk_size,
   test_utils::FillWithData(&data);
 
   DirectExtentWriter direct_writer;
-  EXPECT_TRUE(
-      direct_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(direct_writer.Init(fd_, extents, kBlockSize));
 
   size_t bytes_written = 0;
   while (bytes_written < data.size()) {
@@ -161,8 +186,7 @@ void ExtentWriterTest::TestZeroPad(bool aligned_size) {
 
   ZeroPadExtentWriter zero_pad_writer(std::make_unique<DirectExtentWriter>());
 
-  EXPECT_TRUE(
-      zero_pad_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(zero_pad_writer.Init(fd_, extents, kBlockSize));
   size_t bytes_to_write = data.size();
   const size_t missing_bytes = (aligned_size ? 0 : 9);
   bytes_to_write -= missing_bytes;
@@ -201,8 +225,7 @@ TEST_F(ExtentWriterTest, SparseFileTest) {
   test_utils::FillWithData(&data);
 
   DirectExtentWriter direct_writer;
-  EXPECT_TRUE(
-      direct_writer.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(direct_writer.Init(fd_, extents, kBlockSize));
 
   size_t bytes_written = 0;
   while (bytes_written < (block_count * kBlockSize)) {
@@ -231,4 +254,56 @@ TEST_F(ExtentWriterTest, SparseFileTest) {
   ExpectVectorsEq(expected_data, resultant_data);
 }
 
+TEST_F(ExtentWriterTest, ZeroOutTest) {
+  auto zero_out_fd = std::make_shared<ZeroOutFileDescriptor>();
+  ASSERT_TRUE(zero_out_fd->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+  vector<Extent> extents = {ExtentForRange(0, 40)};
+  brillo::Blob data = GetZeroRunsData();
+
+  std::atomic<bool> zero_ioctl_supported{true};
+  DirectExtentWriter direct_writer;
+  direct_writer.set_zero_out(&zero_ioctl_supported);
+  EXPECT_TRUE(direct_writer.Init(zero_out_fd, extents, kBlockSize));
+  // The long run of zeros spans many writes, like the output of the
+  // decompressors, but is zeroed at once. The short one is written.
+  const size_t kChunkSize = 16 * 1024;
+  for (size_t pos = 0; pos < data.size(); pos += kChunkSize) {
+    EXPECT_TRUE(direct_writer.Write(data.data() + pos,
+                                    min(kChunkSize, data.size() - pos)));
+  }
+  EXPECT_TRUE(direct_writer.End());
+  EXPECT_TRUE(zero_ioctl_supported);
+  const vector<std::pair<uint64_t, uint64_t>> kExpectedRanges = {
+      {kBlockSize, 32 * kBlockSize}};
+  EXPECT_EQ(kExpectedRanges, zero_out_fd->zero_out_ranges_);
+  zero_out_fd->Close();
+
+  // The zeroed-out blocks are a hole in the file.
+  brillo::Blob result;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result));
+  ExpectVectorsEq(data, result);
+}
+
+TEST_F(ExtentWriterTest, ZeroOutUnsupportedTest) {
+  vector<Extent> extents = {ExtentForRange(0, 40)};
+  brillo::Blob data = GetZeroRunsData();
+  // Leave garbage in the blocks to zero.
+  brillo::Blob garbage(data.size(), 'a');
+  EXPECT_TRUE(utils::WriteFile(
+      temp_file_.path().c_str(), garbage.data(), garbage.size()));
+
+  // A regular file doesn't support the ioctl, so the zeros are written.
+  std::atomic<bool> zero_ioctl_supported{true};
+  DirectExtentWriter direct_writer;
+  direct_writer.set_zero_out(&zero_ioctl_supported);
+  EXPECT_TRUE(direct_writer.Init(fd_, extents, kBlockSize));
+  EXPECT_TRUE(direct_writer.Write(data.data(), data.size()));
+  EXPECT_TRUE(direct_writer.End());
+  EXPECT_FALSE(zero_ioctl_supported);
+
+  brillo::Blob result;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result));
+  ExpectVectorsEq(data, result);
+}
+
 }  // namespace chromeos_update_engine
@@ -34,7 +34,7 @@ class FakeExtentWriter : public ExtentWriter {
 
   // ExtentWriter overrides.
   bool Init(FileDescriptorPtr /* fd */,
-            const google::protobuf::RepeatedPtrField<Extent>& /* extents */,
+            ExtentSpan /* extents */,
             uint32_t /* block_size */) override {
     init_called_ = true;
     return true;
@@ -18,6 +18,71 @@
 
 namespace chromeos_update_engine {
 
+SimulatedStorage::SimulatedStorage(const Model& model)
+    : model_(model), slots_free_(std::max<size_t>(model.queue_depth, 1)) {}
+
+void SimulatedStorage::Read(uint64_t offset, uint64_t length) {
+  base::AutoLock auto_lock(lock_);
+  for (const CachedRange& range : cached_ranges_) {
+    if (range.offset <= offset &&
+        offset + length <= range.offset + range.length) {
+      now_ = std::max(now_, range.ready);
+      return;
+    }
+  }
+  now_ = Schedule(offset, length);
+}
+
+void SimulatedStorage::Write(uint64_t offset, uint64_t length) {
+  base::AutoLock auto_lock(lock_);
+  now_ = Schedule(offset, length);
+}
+
+void SimulatedStorage::Readahead(uint64_t offset, uint64_t length) {
+  base::AutoLock auto_lock(lock_);
+  cached_ranges_.push_back({offset, length, Schedule(offset, length)});
+}
+
+void SimulatedStorage::DropCache(uint64_t offset, uint64_t length) {
+  base::AutoLock auto_lock(lock_);
+  cached_ranges_.erase(
+      std::remove_if(cached_ranges_.begin(),
+                     cached_ranges_.end(),
+                     [offset, length](const CachedRange& range) {
+                       return range.offset < offset + length &&
+                              offset < range.offset + range.length;
+                     }),
+      cached_ranges_.end());
+}
+
+void SimulatedStorage::Flush() {
+  base::AutoLock auto_lock(lock_);
+  for (base::TimeDelta slot_free : slots_free_)
+    now_ = std::max(now_, slot_free);
+  now_ = now_ + model_.flush_time;
+}
+
+base::TimeDelta SimulatedStorage::now() const {
+  base::AutoLock auto_lock(lock_);
+  return now_;
+}
+
+base::TimeDelta SimulatedStorage::Schedule(uint64_t offset, uint64_t length) {
+  base::TimeDelta service;
+  uint64_t bytes_per_second = model_.sequential_bytes_per_second;
+  if (offset != next_offset_) {
+    service = model_.seek_time;
+    bytes_per_second = model_.random_bytes_per_second;
+  }
+  next_offset_ = offset + length;
+  service = service + base::TimeDelta::FromMicroseconds(
+                          length * base::Time::kMicrosecondsPerSecond /
+                          std::max<uint64_t>(bytes_per_second, 1));
+  auto slot = std::min_element(slots_free_.begin(), slots_free_.end());
+  *slot = std::max(now_, *slot) + service;
+  return *slot;
+}
+
 ssize_t FakeFileDescriptor::Read(void* buf, size_t count) {
   // Record the read operation so it can later be inspected.
   read_ops_.emplace_back(offset_, count);
@@ -49,6 +114,20 @@ ssize_t FakeFileDescriptor::Read(void* buf, size_t count) {
     offset_++;
   }
 
+  if (storage_)
+    storage_->Read(offset_ - count, count);
+  return count;
+}
+
+ssize_t FakeFileDescriptor::Write(const void* buf, size_t count) {
+  if (!storage_) {
+    // Read-only block device.
+    errno = EROFS;
+    return -1;
+  }
+  write_ops_.emplace_back(offset_, count);
+  storage_->Write(offset_, count);
+  offset_ += count;
   return count;
 }
 
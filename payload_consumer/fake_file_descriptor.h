@@ -19,18 +19,91 @@
 
 #include <algorithm>
 #include <limits>
+#include <memory>
 #include <utility>
 #include <vector>
 
+#include <base/synchronization/lock.h>
+#include <base/time/time.h>
+
 #include "update_engine/payload_consumer/file_descriptor.h"
 
 namespace chromeos_update_engine {
 
+// A time model of a block device, shared by the FakeFileDescriptors opened on
+// it, to evaluate the storage performance of the code using them without
+// real hardware and deterministically. The device keeps a virtual time,
+// advanced by the time each synchronous request takes: a request not
+// following the previous one pays a seek and transfers at the random
+// throughput, the others at the sequential throughput. The readaheads are
+// serviced in the background, up to the queue depth at the same time, and the
+// reads of their ranges only wait for them to complete. The synchronous
+// requests of concurrent callers are serialized.
+class SimulatedStorage {
+ public:
+  struct Model {
+    base::TimeDelta seek_time = base::TimeDelta::FromMicroseconds(200);
+    uint64_t sequential_bytes_per_second = 200 * 1024 * 1024;
+    uint64_t random_bytes_per_second = 50 * 1024 * 1024;
+    // The number of requests serviced at the same time.
+    size_t queue_depth = 1;
+    // The time to flush the written data to the device.
+    base::TimeDelta flush_time = base::TimeDelta::FromMilliseconds(5);
+  };
+
+  explicit SimulatedStorage(const Model& model);
+
+  // Reads or writes |length| bytes at |offset|, advancing the virtual time
+  // until the request completed.
+  void Read(uint64_t offset, uint64_t length);
+  void Write(uint64_t offset, uint64_t length);
+
+  // Starts reading |length| bytes at |offset| in the background, into the
+  // cache.
+  void Readahead(uint64_t offset, uint64_t length);
+
+  // Drops the ranges read ahead overlapping |length| bytes at |offset|.
+  void DropCache(uint64_t offset, uint64_t length);
+
+  // Waits for all the requests to complete, then flushes the device.
+  void Flush();
+
+  // The virtual time elapsed since the device was created.
+  base::TimeDelta now() const;
+
+ private:
+  struct CachedRange {
+    uint64_t offset;
+    uint64_t length;
+    // When the readahead of the range completes.
+    base::TimeDelta ready;
+  };
+
+  // Schedules a request of |length| bytes at |offset| on the first free slot
+  // of the queue, no earlier than the current time, and returns its
+  // completion time.
+  base::TimeDelta Schedule(uint64_t offset, uint64_t length);
+
+  const Model model_;
+
+  mutable base::Lock lock_;
+  base::TimeDelta now_;
+  // The time at which each slot of the queue is free.
+  std::vector<base::TimeDelta> slots_free_;
+  // The offset following the last request, which is sequential to it.
+  uint64_t next_offset_{std::numeric_limits<uint64_t>::max()};
+  std::vector<CachedRange> cached_ranges_;
+
+  DISALLOW_COPY_AND_ASSIGN(SimulatedStorage);
+};
+
 // A fake file descriptor with configurable errors. The file descriptor always
 // reads a fixed sequence of bytes, consisting of the concatenation of the
 // numbers 0, 1, 2... each one encoded in 4 bytes as the big-endian 16-bit
 // number encoded in hexadecimal. For example, the beginning of the stream in
 // ASCII is 0000000100020003... which corresponds to the numbers 0, 1, 2 and 3.
+// With a SimulatedStorage, the time of the requests is modeled and the writes
+// are accepted and discarded.
 class FakeFileDescriptor : public FileDescriptor {
  public:
   FakeFileDescriptor() = default;
@@ -50,11 +123,7 @@ class FakeFileDescriptor : public FileDescriptor {
 
   ssize_t Read(void* buf, size_t count) override;
 
-  ssize_t Write(const void* buf, size_t count) override {
-    // Read-only block device.
-    errno = EROFS;
-    return -1;
-  }
+  ssize_t Write(const void* buf, size_t count) override;
 
   off64_t Seek(off64_t offset, int whence) override;
 
@@ -67,7 +136,32 @@ class FakeFileDescriptor : public FileDescriptor {
     return false;
   }
 
+  bool Readahead(uint64_t offset, uint64_t length) override {
+    if (!storage_)
+      return false;
+    storage_->Readahead(offset, length);
+    return true;
+  }
+
+  bool DropCache(uint64_t offset, uint64_t length) override {
+    if (!storage_)
+      return false;
+    storage_->DropCache(offset, length);
+    return true;
+  }
+
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override {
+    return false;
+  }
+
+  int GetNativeFd() override { return -1; }
+
   bool Flush() override {
+    if (open_ && storage_)
+      storage_->Flush();
     return open_;
   }
 
@@ -101,6 +195,17 @@ class FakeFileDescriptor : public FileDescriptor {
     return read_ops_;
   }
 
+  // Models the time of the requests with |storage|, which also makes the
+  // file writable.
+  void SetStorage(std::shared_ptr<SimulatedStorage> storage) {
+    storage_ = storage;
+  }
+
+  // Return the list of ranges of bytes written as (offset, length).
+  std::vector<std::pair<uint64_t, uint64_t>> GetWriteOps() const {
+    return write_ops_;
+  }
+
  private:
   // Whether the fake file is open.
   bool open_{false};
@@ -118,6 +223,12 @@ class FakeFileDescriptor : public FileDescriptor {
   // List of reads performed as (offset, length) of the read request.
   std::vector<std::pair<uint64_t, uint64_t>> read_ops_;
 
+  // List of writes performed as (offset, length).
+  std::vector<std::pair<uint64_t, uint64_t>> write_ops_;
+
+  // The device modeling the time of the requests, if any.
+  std::shared_ptr<SimulatedStorage> storage_;
+
   DISALLOW_COPY_AND_ASSIGN(FakeFileDescriptor);
 };
 
@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/fake_file_descriptor.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class FakeFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // The round numbers make the time of a 4 KiB request a whole number of
+    // microseconds: 4 ms sequential and 8 ms random, plus the seek.
+    SimulatedStorage::Model model;
+    model.seek_time = base::TimeDelta::FromMilliseconds(10);
+    model.sequential_bytes_per_second = 1024000;
+    model.random_bytes_per_second = 512000;
+    model.queue_depth = 2;
+    model.flush_time = base::TimeDelta::FromMilliseconds(5);
+    storage_ = std::make_shared<SimulatedStorage>(model);
+    fake_fd_.SetStorage(storage_);
+    EXPECT_TRUE(fake_fd_.Open("/dev/fake", O_RDWR));
+  }
+
+  void ReadAt(uint64_t offset) {
+    EXPECT_EQ(static_cast<off64_t>(offset), fake_fd_.Seek(offset, SEEK_SET));
+    EXPECT_EQ(static_cast<ssize_t>(buf_.size()),
+              fake_fd_.Read(buf_.data(), buf_.size()));
+  }
+
+  std::shared_ptr<SimulatedStorage> storage_;
+  FakeFileDescriptor fake_fd_;
+  brillo::Blob buf_ = brillo::Blob(4096);
+};
+
+TEST_F(FakeFileDescriptorTest, SequentialAndRandomReadsTest) {
+  ReadAt(0);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(18), storage_->now());
+  // The next read is sequential.
+  ReadAt(4096);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(22), storage_->now());
+  ReadAt(100000);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(40), storage_->now());
+}
+
+TEST_F(FakeFileDescriptorTest, ReadaheadTest) {
+  // The two readaheads are serviced at the same time, so the reads only wait
+  // for the first one to complete.
+  EXPECT_TRUE(fake_fd_.Readahead(0, 4096));
+  EXPECT_TRUE(fake_fd_.Readahead(100000, 4096));
+  EXPECT_EQ(base::TimeDelta(), storage_->now());
+  ReadAt(0);
+  ReadAt(100000);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(18), storage_->now());
+
+  // Once dropped, the range is read again.
+  EXPECT_TRUE(fake_fd_.DropCache(0, 4096));
+  ReadAt(0);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(36), storage_->now());
+}
+
+TEST_F(FakeFileDescriptorTest, WriteAndFlushTest) {
+  EXPECT_EQ(static_cast<ssize_t>(buf_.size()),
+            fake_fd_.Write(buf_.data(), buf_.size()));
+  EXPECT_EQ(static_cast<ssize_t>(buf_.size()),
+            fake_fd_.Write(buf_.data(), buf_.size()));
+  EXPECT_EQ(
+      (std::vector<std::pair<uint64_t, uint64_t>>{{0, 4096}, {4096, 4096}}),
+      fake_fd_.GetWriteOps());
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(22), storage_->now());
+  EXPECT_TRUE(fake_fd_.Flush());
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(27), storage_->now());
+}
+
+TEST_F(FakeFileDescriptorTest, ReadOnlyWithoutStorageTest) {
+  FakeFileDescriptor fake_fd;
+  EXPECT_TRUE(fake_fd.Open("/dev/fake", O_RDWR));
+  EXPECT_EQ(-1, fake_fd.Write(buf_.data(), buf_.size()));
+  EXPECT_FALSE(fake_fd.Readahead(0, 4096));
+}
+
+}  // namespace chromeos_update_engine
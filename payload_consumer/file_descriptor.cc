@@ -20,7 +20,9 @@
 #include <linux/fs.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <base/posix/eintr_wrapper.h>
 
@@ -123,6 +125,70 @@ bool EintrSafeFileDescriptor::BlkIoctl(int request,
 #endif  // defined(BLKZEROOUT)
 }
 
+bool EintrSafeFileDescriptor::Readahead(uint64_t offset, uint64_t length) {
+  CHECK_GE(fd_, 0);
+  // Unlike the other calls, posix_fadvise() returns the error code.
+  return posix_fadvise(fd_, offset, length, POSIX_FADV_WILLNEED) == 0;
+}
+
+bool EintrSafeFileDescriptor::DropCache(uint64_t offset, uint64_t length) {
+  CHECK_GE(fd_, 0);
+  // Only the clean pages are dropped, so this doesn't lose any write.
+  return posix_fadvise(fd_, offset, length, POSIX_FADV_DONTNEED) == 0;
+}
+
+bool EintrSafeFileDescriptor::CopyRangeFrom(FileDescriptor* source,
+                                            uint64_t source_offset,
+                                            uint64_t offset,
+                                            uint64_t length) {
+  CHECK_GE(fd_, 0);
+  int source_fd = source->GetNativeFd();
+  if (source_fd < 0)
+    return false;
+
+  bool copied = false;
+#ifdef FICLONERANGE
+  // Share the data blocks on the file systems supporting it, like btrfs and
+  // xfs.
+  struct file_clone_range range;
+  range.src_fd = source_fd;
+  range.src_offset = source_offset;
+  range.src_length = length;
+  range.dest_offset = offset;
+  copied = ioctl(fd_, FICLONERANGE, &range) == 0;
+#endif  // defined(FICLONERANGE)
+
+#ifdef __NR_copy_file_range
+  // Otherwise copy the data inside the kernel, which may still share the
+  // blocks on some file systems.
+  if (!copied) {
+    loff_t in_offset = source_offset;
+    loff_t out_offset = offset;
+    while (length > 0) {
+      ssize_t ret = HANDLE_EINTR(syscall(__NR_copy_file_range,
+                                         source_fd,
+                                         &in_offset,
+                                         fd_,
+                                         &out_offset,
+                                         length,
+                                         0));
+      if (ret <= 0)
+        return false;
+      length -= ret;
+    }
+    copied = true;
+  }
+#endif  // defined(__NR_copy_file_range)
+  if (!copied)
+    return false;
+
+  // Neither call is guaranteed to honor O_DSYNC like write() does.
+  int flags = fcntl(fd_, F_GETFL, 0);
+  if (flags == -1)
+    return false;
+  return (flags & O_DSYNC) == 0 || HANDLE_EINTR(fdatasync(fd_)) == 0;
+}
+
 bool EintrSafeFileDescriptor::Flush() {
   CHECK_GE(fd_, 0);
   return true;
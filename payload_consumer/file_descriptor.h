@@ -87,6 +87,33 @@ class FileDescriptor {
                         uint64_t length,
                         int* result) = 0;
 
+  // Hints that the |length| bytes starting at |offset| will be read soon, so
+  // the implementation may start fetching them in the background. Returns
+  // whether the hint is supported. The descriptor must be open prior to this
+  // call.
+  virtual bool Readahead(uint64_t offset, uint64_t length) = 0;
+
+  // Hints that the |length| bytes starting at |offset| won't be read again
+  // soon, so the implementation may drop them from the page cache instead of
+  // the data of the rest of the system. Returns whether the hint is
+  // supported. The descriptor must be open prior to this call.
+  virtual bool DropCache(uint64_t offset, uint64_t length) = 0;
+
+  // Copies the |length| bytes starting at |source_offset| in |source| to
+  // |offset| in this descriptor inside the kernel, sharing the data blocks of
+  // the source when the file system supports it. Returns whether the copy is
+  // supported and succeeded; on failure the range may be partially written.
+  // Both descriptors must be open prior to this call.
+  virtual bool CopyRangeFrom(FileDescriptor* source,
+                             uint64_t source_offset,
+                             uint64_t offset,
+                             uint64_t length) = 0;
+
+  // Returns the number of the underlying open file descriptor, used as the
+  // source of CopyRangeFrom(), or -1 if the data of the file may not be all
+  // there.
+  virtual int GetNativeFd() = 0;
+
   // Flushes any cached data. The descriptor must be opened prior to this
   // call. Returns false if it fails to write data. Implementations may set
   // errno accrodingly.
@@ -123,6 +150,13 @@ class EintrSafeFileDescriptor : public FileDescriptor {
                 uint64_t start,
                 uint64_t length,
                 int* result) override;
+  bool Readahead(uint64_t offset, uint64_t length) override;
+  bool DropCache(uint64_t offset, uint64_t length) override;
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override;
+  int GetNativeFd() override { return fd_; }
   bool Flush() override;
   bool Close() override;
   bool IsSettingErrno() override {
@@ -17,16 +17,20 @@
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
 
 #include <algorithm>
+#include <memory>
+#include <vector>
 
 #include <base/logging.h>
 
+#include "update_engine/common/blob_pool.h"
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/payload_constants.h"
 
-using google::protobuf::RepeatedPtrField;
 using std::min;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -35,28 +39,55 @@ namespace {
 // Size of the buffer used to copy blocks.
 const uint64_t kMaxCopyBufferSize = 1024 * 1024;
 
+// How far ahead of the data being hashed ReadAndHashFile() prefetches.
+const uint64_t kHashReadaheadSize = 8 * kMaxCopyBufferSize;
+
+// Reads the |src_extents| of |source|, writing them to the |writer| if not
+// null. The hash of each run of |run_blocks| blocks read, in order, is stored
+// in |hashes_out|. No hash is calculated if |run_blocks| is empty.
 bool CommonHashExtents(FileDescriptorPtr source,
-                       const RepeatedPtrField<Extent>& src_extents,
+                       ExtentSpan src_extents,
                        DirectExtentWriter* writer,
                        uint64_t block_size,
-                       brillo::Blob* hash_out) {
+                       const vector<uint64_t>& run_blocks,
+                       vector<brillo::Blob>* hashes_out) {
   auto total_blocks = utils::BlocksInExtents(src_extents);
+  uint64_t hashed_blocks = 0;
+  for (uint64_t blocks : run_blocks)
+    hashed_blocks += blocks;
+  TEST_AND_RETURN_FALSE(run_blocks.empty() || hashed_blocks == total_blocks);
   auto buffer_blocks = kMaxCopyBufferSize / block_size;
   // Ensure we copy at least one block at a time.
   if (buffer_blocks < 1)
     buffer_blocks = 1;
-  brillo::Blob buf(buffer_blocks * block_size);
+  PooledBlob buf(buffer_blocks * block_size);
 
   DirectExtentReader reader;
   TEST_AND_RETURN_FALSE(reader.Init(source, src_extents, block_size));
 
-  HashCalculator source_hasher;
+  if (hashes_out)
+    hashes_out->clear();
+  auto run = run_blocks.begin();
+  // The blocks of the current |run| hashed so far.
+  uint64_t run_done = 0;
+  std::unique_ptr<HashCalculator> source_hasher(new HashCalculator());
   while (total_blocks > 0) {
     auto read_blocks = std::min(total_blocks, buffer_blocks);
     TEST_AND_RETURN_FALSE(reader.Read(buf.data(), read_blocks * block_size));
-    if (hash_out != nullptr) {
-      TEST_AND_RETURN_FALSE(
-          source_hasher.Update(buf.data(), read_blocks * block_size));
+    uint64_t buf_blocks = 0;
+    while (run != run_blocks.end() && buf_blocks < read_blocks) {
+      uint64_t blocks = std::min(*run - run_done, read_blocks - buf_blocks);
+      TEST_AND_RETURN_FALSE(source_hasher->Update(
+          buf.data() + buf_blocks * block_size, blocks * block_size));
+      buf_blocks += blocks;
+      run_done += blocks;
+      if (run_done == *run) {
+        TEST_AND_RETURN_FALSE(source_hasher->Finalize());
+        hashes_out->push_back(source_hasher->raw_hash());
+        source_hasher.reset(new HashCalculator());
+        ++run;
+        run_done = 0;
+      }
     }
     if (writer) {
       TEST_AND_RETURN_FALSE(
@@ -64,22 +95,41 @@ bool CommonHashExtents(FileDescriptorPtr source,
     }
     total_blocks -= read_blocks;
   }
-
-  if (hash_out != nullptr) {
-    TEST_AND_RETURN_FALSE(source_hasher.Finalize());
-    *hash_out = source_hasher.raw_hash();
+  // The empty runs left at the end.
+  for (; run != run_blocks.end(); ++run) {
+    TEST_AND_RETURN_FALSE(source_hasher->Finalize());
+    hashes_out->push_back(source_hasher->raw_hash());
+    source_hasher.reset(new HashCalculator());
   }
   return true;
 }
 
+// Same as CommonHashExtents(), storing the hash of all the blocks read in
+// |hash_out| if not null.
+bool CommonHashExtents(FileDescriptorPtr source,
+                       ExtentSpan src_extents,
+                       DirectExtentWriter* writer,
+                       uint64_t block_size,
+                       brillo::Blob* hash_out) {
+  vector<uint64_t> run_blocks;
+  if (hash_out)
+    run_blocks.push_back(utils::BlocksInExtents(src_extents));
+  vector<brillo::Blob> hashes;
+  TEST_AND_RETURN_FALSE(CommonHashExtents(
+      source, src_extents, writer, block_size, run_blocks, &hashes));
+  if (hash_out)
+    *hash_out = hashes[0];
+  return true;
+}
+
 }  // namespace
 
 namespace fd_utils {
 
 bool CopyAndHashExtents(FileDescriptorPtr source,
-                        const RepeatedPtrField<Extent>& src_extents,
+                        ExtentSpan src_extents,
                         FileDescriptorPtr target,
-                        const RepeatedPtrField<Extent>& tgt_extents,
+                        ExtentSpan tgt_extents,
                         uint64_t block_size,
                         brillo::Blob* hash_out) {
   DirectExtentWriter writer;
@@ -92,8 +142,64 @@ bool CopyAndHashExtents(FileDescriptorPtr source,
   return true;
 }
 
+bool CopyAndHashExtentRuns(FileDescriptorPtr source,
+                           ExtentSpan src_extents,
+                           FileDescriptorPtr target,
+                           ExtentSpan tgt_extents,
+                           uint64_t block_size,
+                           const vector<uint64_t>& run_blocks,
+                           vector<brillo::Blob>* hashes_out) {
+  TEST_AND_RETURN_FALSE(hashes_out != nullptr);
+  DirectExtentWriter writer;
+  TEST_AND_RETURN_FALSE(writer.Init(target, tgt_extents, block_size));
+  TEST_AND_RETURN_FALSE(utils::BlocksInExtents(src_extents) ==
+                        utils::BlocksInExtents(tgt_extents));
+  TEST_AND_RETURN_FALSE(CommonHashExtents(
+      source, src_extents, &writer, block_size, run_blocks, hashes_out));
+  TEST_AND_RETURN_FALSE(writer.End());
+  return true;
+}
+
+bool CopyExtentsRange(FileDescriptorPtr source,
+                      ExtentSpan src_extents,
+                      FileDescriptorPtr target,
+                      ExtentSpan tgt_extents,
+                      uint64_t block_size) {
+  TEST_AND_RETURN_FALSE(utils::BlocksInExtents(src_extents) ==
+                        utils::BlocksInExtents(tgt_extents));
+  auto src_it = src_extents.begin();
+  auto tgt_it = tgt_extents.begin();
+  // The blocks of the current source and target extents already copied.
+  uint64_t src_done = 0;
+  uint64_t tgt_done = 0;
+  while (src_it != src_extents.end() && tgt_it != tgt_extents.end()) {
+    if (src_it->start_block() == kSparseHole)
+      return false;
+    uint64_t blocks = min(src_it->num_blocks() - src_done,
+                          tgt_it->num_blocks() - tgt_done);
+    if (blocks > 0 &&
+        !target->CopyRangeFrom(source.get(),
+                               (src_it->start_block() + src_done) * block_size,
+                               (tgt_it->start_block() + tgt_done) * block_size,
+                               blocks * block_size)) {
+      return false;
+    }
+    src_done += blocks;
+    tgt_done += blocks;
+    if (src_done == src_it->num_blocks()) {
+      ++src_it;
+      src_done = 0;
+    }
+    if (tgt_done == tgt_it->num_blocks()) {
+      ++tgt_it;
+      tgt_done = 0;
+    }
+  }
+  return true;
+}
+
 bool ReadAndHashExtents(FileDescriptorPtr source,
-                        const RepeatedPtrField<Extent>& extents,
+                        ExtentSpan extents,
                         uint64_t block_size,
                         brillo::Blob* hash_out) {
   TEST_AND_RETURN_FALSE(hash_out != nullptr);
@@ -102,6 +208,46 @@ bool ReadAndHashExtents(FileDescriptorPtr source,
   return true;
 }
 
+bool ReadAndHashFile(FileDescriptorPtr source,
+                     uint64_t size,
+                     brillo::Blob* hash_out) {
+  TEST_AND_RETURN_FALSE(hash_out != nullptr);
+  PooledBlob buf(min(size, kMaxCopyBufferSize));
+  HashCalculator hasher;
+  bool readahead = source->Readahead(0, min(size, kHashReadaheadSize));
+  for (uint64_t offset = 0; offset < size; offset += buf.size()) {
+    size_t bytes = min(size - offset, static_cast<uint64_t>(buf.size()));
+    // Keep |kHashReadaheadSize| bytes ahead of |offset| prefetched.
+    uint64_t readahead_offset = offset + kHashReadaheadSize;
+    if (readahead && readahead_offset < size) {
+      source->Readahead(readahead_offset,
+                        min(size - readahead_offset, kMaxCopyBufferSize));
+    }
+    ssize_t bytes_read;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(source, buf.data(), bytes, offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(bytes));
+    TEST_AND_RETURN_FALSE(hasher.Update(buf.data(), bytes));
+  }
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+  *hash_out = hasher.raw_hash();
+  return true;
+}
+
+bool DropExtentsCache(FileDescriptorPtr fd,
+                      ExtentSpan extents,
+                      uint64_t block_size) {
+  for (const Extent& extent : extents) {
+    if (extent.start_block() == kSparseHole)
+      continue;
+    if (!fd->DropCache(extent.start_block() * block_size,
+                       extent.num_blocks() * block_size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace fd_utils
 
 }  // namespace chromeos_update_engine
@@ -17,8 +17,11 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_FILE_DESCRIPTOR_UTILS_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_FILE_DESCRIPTOR_UTILS_H_
 
+#include <vector>
+
 #include <brillo/secure_blob.h>
 
+#include "update_engine/payload_consumer/extent_span.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -34,23 +37,62 @@ namespace fd_utils {
 // false and the value pointed by |hash_out| is undefined.
 // The |source| and |target| files must be different, or otherwise |src_extents|
 // and |tgt_extents| must not overlap.
-bool CopyAndHashExtents(
-    FileDescriptorPtr source,
-    const google::protobuf::RepeatedPtrField<Extent>& src_extents,
-    FileDescriptorPtr target,
-    const google::protobuf::RepeatedPtrField<Extent>& tgt_extents,
-    uint64_t block_size,
-    brillo::Blob* hash_out);
+bool CopyAndHashExtents(FileDescriptorPtr source,
+                        ExtentSpan src_extents,
+                        FileDescriptorPtr target,
+                        ExtentSpan tgt_extents,
+                        uint64_t block_size,
+                        brillo::Blob* hash_out);
+
+// Same as CopyAndHashExtents(), but calculates a separate hash of each run of
+// |run_blocks| blocks copied, in the order of the |src_extents|, storing them
+// in |hashes_out|. The runs must add up to the number of blocks copied. This
+// lets a single copy of the blocks of several operations check the source of
+// each one.
+bool CopyAndHashExtentRuns(FileDescriptorPtr source,
+                           ExtentSpan src_extents,
+                           FileDescriptorPtr target,
+                           ExtentSpan tgt_extents,
+                           uint64_t block_size,
+                           const std::vector<uint64_t>& run_blocks,
+                           std::vector<brillo::Blob>* hashes_out);
+
+// Copies blocks from the |source| file to the |target| file inside the kernel
+// with FileDescriptor::CopyRangeFrom(), sharing the data blocks when the file
+// system supports it. The blocks are specified as in CopyAndHashExtents(). The
+// runs of blocks contiguous in both files are copied at once. Returns false if
+// the copy isn't supported or fails, leaving the blocks partially copied.
+bool CopyExtentsRange(FileDescriptorPtr source,
+                      ExtentSpan src_extents,
+                      FileDescriptorPtr target,
+                      ExtentSpan tgt_extents,
+                      uint64_t block_size);
 
 // Reads blocks from |source| and caculates the hash. The blocks to read are
 // specified by |extents|. Stores the hash in |hash_out| if it is not null. The
 // block sizes are passed as |block_size|. In case of error reading, it returns
 // false and the value pointed by |hash_out| is undefined.
-bool ReadAndHashExtents(
-    FileDescriptorPtr source,
-    const google::protobuf::RepeatedPtrField<Extent>& extents,
-    uint64_t block_size,
-    brillo::Blob* hash_out);
+bool ReadAndHashExtents(FileDescriptorPtr source,
+                        ExtentSpan extents,
+                        uint64_t block_size,
+                        brillo::Blob* hash_out);
+
+// Reads the first |size| bytes of |source| sequentially and calculates their
+// hash, storing it in |hash_out|. The data ahead of the one being hashed is
+// prefetched with FileDescriptor::Readahead(), if supported, so the disk reads
+// overlap with the hash calculation. In case of error reading, it returns
+// false and the value pointed by |hash_out| is undefined.
+bool ReadAndHashFile(FileDescriptorPtr source,
+                     uint64_t size,
+                     brillo::Blob* hash_out);
+
+// Drops the blocks of |fd| specified by |extents| from the page cache with
+// FileDescriptor::DropCache(), once they were read for the last time, so
+// streaming a partition doesn't evict the data of the rest of the system. The
+// sparse holes are skipped. Returns false if dropping isn't supported.
+bool DropExtentsCache(FileDescriptorPtr fd,
+                      ExtentSpan extents,
+                      uint64_t block_size);
 
 }  // namespace fd_utils
 }  // namespace chromeos_update_engine
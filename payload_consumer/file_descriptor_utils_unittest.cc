@@ -30,6 +30,7 @@
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/fake_file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
 using google::protobuf::RepeatedPtrField;
@@ -119,6 +120,30 @@ TEST_F(FileDescriptorUtilsTest, CopyAndHashExtentsWithoutHashingTest) {
   ExpectTarget("00000001000200030004");
 }
 
+TEST_F(FileDescriptorUtilsTest, CopyAndHashExtentRunsTest) {
+  auto src_extents = CreateExtentList({{1, 2}, {4, 1}});
+  auto tgt_extents = CreateExtentList({{0, 3}});
+
+  // Each run is hashed on its own, even when it ends in the middle of an
+  // extent. The empty run has the hash of no data.
+  std::vector<brillo::Blob> hashes;
+  EXPECT_TRUE(fd_utils::CopyAndHashExtentRuns(
+      source_, src_extents, target_, tgt_extents, 4, {1, 0, 2}, &hashes));
+  ExpectTarget("000100020004");
+  ASSERT_EQ(3U, hashes.size());
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes("0001", 4, &expected_hash));
+  EXPECT_EQ(expected_hash, hashes[0]);
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes("", 0, &expected_hash));
+  EXPECT_EQ(expected_hash, hashes[1]);
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes("00020004", 8, &expected_hash));
+  EXPECT_EQ(expected_hash, hashes[2]);
+
+  // The runs must cover all the blocks copied.
+  EXPECT_FALSE(fd_utils::CopyAndHashExtentRuns(
+      source_, src_extents, target_, tgt_extents, 4, {1, 1}, &hashes));
+}
+
 // CopyAndHash() can take different number of extents in the source and target
 // files, as long as the number of blocks is the same. Test that it handles it
 // properly.
@@ -167,6 +192,33 @@ TEST_F(FileDescriptorUtilsTest, CopyAndHashExtentsManyToManyTest) {
   EXPECT_EQ(expected_hash, hash_out);
 }
 
+// Copying ranges needs the source to be a real file.
+TEST_F(FileDescriptorUtilsTest, CopyExtentsRangeUnsupportedTest) {
+  auto extents = CreateExtentList({{0, 5}});
+
+  EXPECT_FALSE(
+      fd_utils::CopyExtentsRange(source_, extents, target_, extents, 4));
+}
+
+TEST_F(FileDescriptorUtilsTest, CopyExtentsRangeManyToManyTest) {
+  test_utils::ScopedTempFile source_file("fd_src.XXXXXX");
+  const char kSourceData[] = "00000001000200030004";
+  EXPECT_TRUE(utils::WriteFile(
+      source_file.path().c_str(), kSourceData, strlen(kSourceData)));
+  FileDescriptorPtr source(new EintrSafeFileDescriptor());
+  EXPECT_TRUE(source->Open(source_file.path().c_str(), O_RDONLY));
+
+  auto src_extents = CreateExtentList({{1, 1}, {4, 1}, {2, 2}, {0, 1}});
+  auto tgt_extents = CreateExtentList({{2, 3}, {0, 2}});
+  if (!fd_utils::CopyExtentsRange(
+          source, src_extents, target_, tgt_extents, 4)) {
+    LOG(WARNING) << "Copying ranges isn't supported here, skipping.";
+    return;
+  }
+  // The same result as CopyAndHashExtentsManyToManyTest.
+  ExpectTarget("00030000000100040002");
+}
+
 // Failing to read from the source should fail the hash calculation.
 TEST_F(FileDescriptorUtilsTest, ReadAndHashExtentsReadFailureTest) {
   auto extents = CreateExtentList({{0, 5}});
@@ -195,4 +247,33 @@ TEST_F(FileDescriptorUtilsTest, ReadAndHashExtentsTest) {
   EXPECT_EQ(expected_hash, hash_out);
 }
 
+// Tests that it hashes the requested beginning of the file.
+TEST_F(FileDescriptorUtilsTest, ReadAndHashFileTest) {
+  brillo::Blob hash_out;
+  EXPECT_TRUE(fd_utils::ReadAndHashFile(source_, 16, &hash_out));
+
+  const char kExpectedResult[] = "0000000100020003";
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+      kExpectedResult, strlen(kExpectedResult), &expected_hash));
+  EXPECT_EQ(expected_hash, hash_out);
+}
+
+// Failing to read from the source should fail the hash calculation.
+TEST_F(FileDescriptorUtilsTest, ReadAndHashFileReadFailureTest) {
+  fake_source_->AddFailureRange(10, 5);
+  brillo::Blob hash_out;
+  EXPECT_FALSE(fd_utils::ReadAndHashFile(source_, 20, &hash_out));
+}
+
+TEST_F(FileDescriptorUtilsTest, DropExtentsCacheTest) {
+  auto extents = CreateExtentList({{1, 2}, {kSparseHole, 1}, {0, 1}});
+  // The fake source doesn't support it.
+  EXPECT_FALSE(fd_utils::DropExtentsCache(source_, extents, 4));
+  EXPECT_TRUE(utils::WriteFile(tgt_path_.c_str(), "0000000100020003", 16));
+  EXPECT_TRUE(fd_utils::DropExtentsCache(target_, extents, 4));
+  // The data is still there once dropped from the page cache.
+  ExpectTarget("0000000100020003");
+}
+
 }  // namespace chromeos_update_engine
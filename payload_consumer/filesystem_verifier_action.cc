@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <string>
+#include <utility>
 
 #include <base/bind.h>
 #include <brillo/data_encoding.h>
@@ -32,17 +33,65 @@
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/hashing_file_descriptor.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 
 using brillo::data_encoding::Base64Encode;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
 namespace {
-const off_t kReadFileBufferSize = 128 * 1024;
+// The size of the reads of a partition is the largest request its device
+// queue accepts, within these bounds, so each read is a single request. It is
+// |kReadFileBufferSize| when the device doesn't report it.
+const size_t kReadFileBufferSize = 128 * 1024;
+const size_t kMinReadBufferSize = 64 * 1024;
+const size_t kMaxReadBufferSize = 1024 * 1024;
+
+// The number of reads in flight for a single partition, and the bytes read in
+// flight for all of them together. Every partition gets at least
+// |kMinReadsPerPartition| reads so the next ones are in flight while one is
+// hashed, so the memory used is bounded by the larger of |kMaxBytesInFlight|
+// and the number of partitions times |kMinReadsPerPartition| times
+// |kMaxReadBufferSize|.
+const size_t kMinReadsPerPartition = 2;
+const size_t kMaxReadsPerPartition = 8;
+const size_t kMaxBytesInFlight = 8 * 1024 * 1024;
+
+// The deeper read queue used while the IOLimiter is in performance mode.
+const size_t kMaxPerformanceReadsPerPartition = 32;
+const size_t kMaxPerformanceBytesInFlight = 32 * 1024 * 1024;
+
+// Returns the number of reads in flight for a partition read in chunks of
+// |buffer_size| bytes, sharing |max_partition_bytes| and at most |max_reads|.
+size_t GetMaxReads(size_t max_partition_bytes,
+                   size_t buffer_size,
+                   size_t max_reads) {
+  return std::min(
+      std::max(max_partition_bytes / buffer_size, kMinReadsPerPartition),
+      max_reads);
+}
+
+// Returns the size of the reads of the partition at |path|.
+size_t GetReadBufferSize(const string& path) {
+  size_t size = utils::GetBlockDeviceMaxRequestSize(path);
+  if (size == 0)
+    return kReadFileBufferSize;
+  size = std::min(std::max(size, kMinReadBufferSize), kMaxReadBufferSize);
+  // Keep the reads of the whole partition aligned.
+  return size - size % kMinReadBufferSize;
+}
 }  // namespace
 
+FilesystemVerifierAction::PartitionHashing::~PartitionHashing() {
+  if (throttle_task_id != brillo::MessageLoop::kTaskIdNull)
+    brillo::MessageLoop::current()->CancelTask(throttle_task_id);
+  if (cache_fd)
+    cache_fd->Close();
+}
+
 void FilesystemVerifierAction::PerformAction() {
   // Will tell the ActionProcessor we've failed if we return.
   ScopedActionCompleter abort_action_completer(processor_, this);
@@ -51,18 +100,81 @@ void FilesystemVerifierAction::PerformAction() {
     LOG(ERROR) << "FilesystemVerifierAction missing input object.";
     return;
   }
-  install_plan_ = GetInputObject();
+  install_plan_ = TakeInputObject();
+  performing_ = true;
 
   if (install_plan_.partitions.empty()) {
     LOG(INFO) << "No partitions to verify.";
+    hashings_.clear();
     if (HasOutputPipe())
-      SetOutputObject(install_plan_);
+      SetOutputObject(std::move(install_plan_));
     abort_action_completer.set_code(ErrorCode::kSuccess);
     return;
   }
 
-  StartPartitionHashing();
+  // Keep the partitions hashed while the payload was downloaded, unless the
+  // final install plan describes them differently.
+  vector<std::unique_ptr<PartitionHashing>> early_hashings;
+  early_hashings.swap(hashings_);
+  remaining_partitions_ = 0;
+  vector<size_t> partition_indexes;
+  for (size_t i = 0; i < install_plan_.partitions.size(); i++) {
+    auto early_hashing = std::find_if(
+        early_hashings.begin(),
+        early_hashings.end(),
+        [this, i](const std::unique_ptr<PartitionHashing>& hashing) {
+          return hashing && hashing->partition_index == i &&
+                 hashing->partition == install_plan_.partitions[i];
+        });
+    if (early_hashing == early_hashings.end()) {
+      partition_indexes.push_back(i);
+      continue;
+    }
+    LOG(INFO) << "Partition " << i << " (" << install_plan_.partitions[i].name
+              << ") was " << ((*early_hashing)->verified ? "" : "partly ")
+              << "hashed while the payload was downloaded.";
+    if (!(*early_hashing)->verified)
+      remaining_partitions_++;
+    hashings_.push_back(std::move(*early_hashing));
+  }
+  // This stops the reads of the early hashings not kept.
+  early_hashings.clear();
+
   abort_action_completer.set_should_complete(false);
+  if (remaining_partitions_ == 0 && partition_indexes.empty())
+    return Cleanup(ErrorCode::kSuccess);
+
+  const size_t first_new_hashing = hashings_.size();
+  for (size_t partition_index : partition_indexes) {
+    if (!AddPartitionHashing(
+            install_plan_, partition_index, install_plan_.partitions.size()))
+      return;
+  }
+  for (size_t i = first_new_hashing; i < hashings_.size(); i++) {
+    if (!ContinuePartitionHashing(hashings_[i].get()))
+      return;
+  }
+}
+
+void FilesystemVerifierAction::PartitionWritten(const InstallPlan& install_plan,
+                                                size_t partition_index) {
+  if (performing_)
+    return;
+  for (const auto& hashing : hashings_) {
+    if (hashing->partition_index == partition_index)
+      return;
+  }
+  if (!AddPartitionHashing(
+          install_plan, partition_index, install_plan.partitions.size()))
+    return;
+  ContinuePartitionHashing(hashings_.back().get());
+}
+
+void FilesystemVerifierAction::PartitionWritesAborted() {
+  if (performing_)
+    return;
+  hashings_.clear();
+  remaining_partitions_ = 0;
 }
 
 void FilesystemVerifierAction::TerminateProcessing() {
@@ -71,154 +183,410 @@ void FilesystemVerifierAction::TerminateProcessing() {
 }
 
 bool FilesystemVerifierAction::IsCleanupPending() const {
-  return src_stream_ != nullptr;
+  return !hashings_.empty();
 }
 
 void FilesystemVerifierAction::Cleanup(ErrorCode code) {
-  src_stream_.reset();
-  // This memory is not used anymore.
-  buffer_.clear();
+  // This closes the streams and frees the buffers of all the reads.
+  hashings_.clear();
+  remaining_partitions_ = 0;
 
   if (cancelled_)
     return;
+  if (!performing_) {
+    LOG(INFO) << "Not using the partitions hashed while the payload was "
+              << "downloaded, they will be hashed again.";
+    return;
+  }
+  // The action is done with the install plan, the partitions hashed keep
+  // their own copy.
   if (code == ErrorCode::kSuccess && HasOutputPipe())
-    SetOutputObject(install_plan_);
+    SetOutputObject(std::move(install_plan_));
   processor_->ActionComplete(this, code);
 }
 
-void FilesystemVerifierAction::StartPartitionHashing() {
-  if (partition_index_ == install_plan_.partitions.size()) {
-    Cleanup(ErrorCode::kSuccess);
-    return;
+void FilesystemVerifierAction::StartHashing(
+    VerifierStep step, const vector<size_t>& partition_indexes) {
+  verifier_step_ = step;
+  hashings_.clear();
+  remaining_partitions_ = 0;
+
+  for (size_t partition_index : partition_indexes) {
+    if (!AddPartitionHashing(
+            install_plan_, partition_index, partition_indexes.size()))
+      return;
+  }
+
+  // Start the first reads of every partition.
+  for (size_t i = 0; i < hashings_.size(); i++) {
+    if (!ContinuePartitionHashing(hashings_[i].get()))
+      return;
   }
-  InstallPlan::Partition& partition =
-      install_plan_.partitions[partition_index_];
+}
+
+bool FilesystemVerifierAction::AddPartitionHashing(
+    const InstallPlan& install_plan,
+    size_t partition_index,
+    size_t num_partitions) {
+  std::unique_ptr<PartitionHashing> hashing(new PartitionHashing());
+  hashing->partition_index = partition_index;
+  hashing->partition = install_plan.partitions[partition_index];
+  const InstallPlan::Partition& partition = hashing->partition;
 
   string part_path;
   switch (verifier_step_) {
     case VerifierStep::kVerifySourceHash:
       part_path = partition.source_path;
-      remaining_size_ = partition.source_size;
+      hashing->size = partition.source_size;
       break;
     case VerifierStep::kVerifyTargetHash:
       part_path = partition.target_path;
-      remaining_size_ = partition.target_size;
+      hashing->size = partition.target_size;
+      if (install_plan.write_verity && partition.hash_tree_size > 0) {
+        if (partition.fec_size > 0) {
+          LOG(ERROR) << "Building the FEC data of partition "
+                     << partition.name << " is not supported.";
+          Cleanup(ErrorCode::kFilesystemVerifierError);
+          return false;
+        }
+        hashing->verity_writer.reset(new VerityWriter());
+        if (partition.hash_tree_offset + partition.hash_tree_size >
+                partition.target_size ||
+            !hashing->verity_writer->Init(partition)) {
+          LOG(ERROR) << "Invalid hash tree of partition " << partition.name;
+          Cleanup(ErrorCode::kFilesystemVerifierError);
+          return false;
+        }
+      } else if (!partition.target_written_hash.empty() &&
+          partition.target_written_hash == partition.target_hash) {
+        hashing->sample_hashes = &partition.target_written_sample_hashes;
+        hashing->next_sample = hashing->sample_hashes->begin();
+      }
       break;
   }
-  LOG(INFO) << "Hashing partition " << partition_index_ << " ("
-            << partition.name << ") on device " << part_path;
-  if (part_path.empty())
-    return Cleanup(ErrorCode::kFilesystemVerifierError);
+  if (hashing->sample_hashes) {
+    LOG(INFO) << "Checking " << hashing->sample_hashes->size()
+              << " samples of partition " << partition_index << " ("
+              << partition.name << ") on device " << part_path
+              << ", hashed while written";
+  } else {
+    LOG(INFO) << "Hashing partition " << partition_index << " ("
+              << partition.name << ") on device " << part_path;
+  }
+  if (part_path.empty()) {
+    Cleanup(ErrorCode::kFilesystemVerifierError);
+    return false;
+  }
 
-  brillo::ErrorPtr error;
-  src_stream_ = brillo::FileStream::Open(
-      base::FilePath(part_path),
-      brillo::Stream::AccessMode::READ,
-      brillo::FileStream::Disposition::OPEN_EXISTING,
-      &error);
+  // The samples are smaller than any read of the whole partition.
+  const size_t buffer_size = hashing->sample_hashes
+                                 ? WrittenDataHasher::kSampleSize
+                                 : GetReadBufferSize(part_path);
+  // Only open as many streams as there are chunks to read, but at least one
+  // to check that the partition exists. The extra streams of the
+  // performance mode get their buffer when first used.
+  const int64_t num_chunks =
+      hashing->sample_hashes
+          ? static_cast<int64_t>(hashing->sample_hashes->size())
+          : (hashing->size + buffer_size - 1) / buffer_size;
+  size_t max_reads = GetMaxReads(
+      kMaxBytesInFlight / num_partitions, buffer_size, kMaxReadsPerPartition);
+  hashing->buffer_size = buffer_size;
+  hashing->background_reads = std::max(
+      std::min(max_reads, static_cast<size_t>(num_chunks)),
+      static_cast<size_t>(1));
+  if (io_limiter_) {
+    max_reads = GetMaxReads(kMaxPerformanceBytesInFlight / num_partitions,
+                            buffer_size,
+                            kMaxPerformanceReadsPerPartition);
+  }
+  const size_t num_reads = std::max(
+      std::min(max_reads, static_cast<size_t>(num_chunks)),
+      static_cast<size_t>(1));
+  LOG(INFO) << "Reading it with " << hashing->background_reads << " reads of "
+            << buffer_size << " bytes in flight, " << num_reads
+            << " in performance mode.";
+  for (size_t i = 0; i < num_reads; i++) {
+    std::unique_ptr<PartitionRead> read(new PartitionRead());
+    brillo::ErrorPtr error;
+    read->stream = brillo::FileStream::Open(
+        base::FilePath(part_path),
+        brillo::Stream::AccessMode::READ,
+        brillo::FileStream::Disposition::OPEN_EXISTING,
+        &error);
+    if (!read->stream) {
+      LOG(ERROR) << "Unable to open " << part_path << " for reading";
+      Cleanup(ErrorCode::kFilesystemVerifierError);
+      return false;
+    }
+    if (i < hashing->background_reads)
+      read->buffer.Reset(buffer_size);
+    hashing->idle_reads.push_back(read.get());
+    hashing->reads.push_back(std::move(read));
+  }
+  // The page cache is shared by all the file descriptors of the partition.
+  hashing->cache_fd.reset(new EintrSafeFileDescriptor());
+  if (!hashing->cache_fd->Open(part_path.c_str(), O_RDONLY)) {
+    PLOG(WARNING) << "Unable to open " << part_path
+                  << ", keeping the data hashed in the page cache.";
+    hashing->cache_fd.reset();
+  }
+  hashings_.push_back(std::move(hashing));
+  remaining_partitions_++;
+  return true;
+}
 
-  if (!src_stream_) {
-    LOG(ERROR) << "Unable to open " << part_path << " for reading";
-    return Cleanup(ErrorCode::kFilesystemVerifierError);
+bool FilesystemVerifierAction::ContinuePartitionHashing(
+    PartitionHashing* hashing) {
+  // Hash the chunks in order, as far as their reads are complete.
+  while (!hashing->scheduled_reads.empty()) {
+    PartitionRead* read = hashing->scheduled_reads.front();
+    if (read->bytes_read < read->size)
+      break;
+    if (hashing->sample_hashes) {
+      brillo::Blob sample_hash;
+      if (!HashCalculator::RawHashOfBytes(
+              read->buffer.data(), read->size, &sample_hash)) {
+        LOG(ERROR) << "Unable to hash the sample.";
+        Cleanup(ErrorCode::kError);
+        return false;
+      }
+      if (sample_hash != hashing->sample_hashes->at(read->offset)) {
+        LOG(ERROR) << "The data at offset " << read->offset << " of partition "
+                   << hashing->partition.name
+                   << " doesn't match the data written.";
+        hashing->sample_mismatch = true;
+      }
+    } else if (!hashing->hasher.Update(read->buffer.data(), read->size)) {
+      LOG(ERROR) << "Unable to update the hash.";
+      Cleanup(ErrorCode::kError);
+      return false;
+    }
+    if (hashing->verity_writer &&
+        !hashing->verity_writer->Update(
+            read->offset, read->buffer.data(), read->size)) {
+      LOG(ERROR) << "Unable to update the hash tree.";
+      Cleanup(ErrorCode::kFilesystemVerifierError);
+      return false;
+    }
+    // Each chunk is read once, so it doesn't need to evict the data of the
+    // rest of the system from the page cache.
+    if (hashing->cache_fd)
+      hashing->cache_fd->DropCache(read->offset, read->size);
+    hashing->hashed_size += read->size;
+    hashing->scheduled_reads.pop_front();
+    hashing->idle_reads.push_back(read);
+  }
+
+  if (hashing->verity_writer &&
+      hashing->hashed_size ==
+          static_cast<int64_t>(hashing->verity_writer->data_end()) &&
+      !WriteVerity(hashing)) {
+    Cleanup(ErrorCode::kFilesystemVerifierError);
+    return false;
   }
 
-  buffer_.resize(kReadFileBufferSize);
-  read_done_ = false;
-  hasher_.reset(new HashCalculator());
+  while (!hashing->idle_reads.empty() && !ReadDepthReached(hashing) &&
+         !ThrottleReads(hashing) &&
+         NextChunk(hashing, hashing->idle_reads.back())) {
+    PartitionRead* read = hashing->idle_reads.back();
+    hashing->idle_reads.pop_back();
+    hashing->scheduled_reads.push_back(read);
+    if (io_limiter_)
+      read->start_time = io_limiter_->StartRead(read->size);
+    if (!read->stream->SetPosition(read->offset, nullptr)) {
+      LOG(ERROR) << "Unable to seek to " << read->offset << " in partition "
+                 << hashing->partition.name;
+      Cleanup(ErrorCode::kError);
+      return false;
+    }
+    if (!ScheduleRead(hashing, read))
+      return false;
+  }
 
-  // Start the first read.
-  ScheduleRead();
+  // A throttled partition may still have chunks to read.
+  if (hashing->scheduled_reads.empty() &&
+      hashing->throttle_task_id == brillo::MessageLoop::kTaskIdNull) {
+    return FinishPartitionHashing(hashing);
+  }
+  return true;
 }
 
-void FilesystemVerifierAction::ScheduleRead() {
-  size_t bytes_to_read = std::min(static_cast<int64_t>(buffer_.size()),
-                                  remaining_size_);
-  if (!bytes_to_read) {
-    OnReadDoneCallback(0);
-    return;
+bool FilesystemVerifierAction::ReadDepthReached(
+    const PartitionHashing* hashing) const {
+  if (io_limiter_ && io_limiter_->performance_mode())
+    return false;
+  return hashing->scheduled_reads.size() >= hashing->background_reads;
+}
+
+bool FilesystemVerifierAction::ThrottleReads(PartitionHashing* hashing) {
+  if (!io_limiter_)
+    return false;
+  if (hashing->throttle_task_id != brillo::MessageLoop::kTaskIdNull)
+    return true;
+  base::TimeDelta delay = io_limiter_->GetReadDelay();
+  if (delay <= base::TimeDelta())
+    return false;
+  hashing->throttle_task_id = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&FilesystemVerifierAction::OnThrottleTimeout,
+                 base::Unretained(this),
+                 base::Unretained(hashing)),
+      delay);
+  return true;
+}
+
+void FilesystemVerifierAction::OnThrottleTimeout(PartitionHashing* hashing) {
+  hashing->throttle_task_id = brillo::MessageLoop::kTaskIdNull;
+  ContinuePartitionHashing(hashing);
+}
+
+bool FilesystemVerifierAction::WriteVerity(PartitionHashing* hashing) {
+  const InstallPlan::Partition& partition =
+      hashing->partition;
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+  if (!fd->Open(partition.target_path.c_str(), O_RDWR)) {
+    PLOG(ERROR) << "Unable to open " << partition.target_path
+                << " to write the hash tree";
+    return false;
+  }
+  bool result = hashing->verity_writer->Finalize(fd);
+  result = fd->Close() && result;
+  if (result) {
+    LOG(INFO) << "Wrote the hash tree of partition " << partition.name
+              << ", root hash: "
+              << Base64Encode(hashing->verity_writer->root_hash());
   }
+  // The rest of the partition, including the tree, can be read now.
+  hashing->verity_writer.reset();
+  return result;
+}
 
-  bool read_async_ok = src_stream_->ReadAsync(
-    buffer_.data(),
-    bytes_to_read,
+bool FilesystemVerifierAction::NextChunk(PartitionHashing* hashing,
+                                         PartitionRead* read) {
+  if (read->buffer.empty())
+    read->buffer.Reset(hashing->buffer_size);
+  if (hashing->sample_hashes) {
+    if (hashing->next_sample == hashing->sample_hashes->end())
+      return false;
+    read->offset = hashing->next_sample->first;
+    read->size = std::min(static_cast<int64_t>(WrittenDataHasher::kSampleSize),
+                          hashing->size - read->offset);
+    hashing->next_sample++;
+  } else {
+    int64_t end = hashing->size;
+    if (hashing->verity_writer) {
+      end = std::min(end,
+                     static_cast<int64_t>(hashing->verity_writer->data_end()));
+    }
+    if (hashing->next_read_offset >= end)
+      return false;
+    read->offset = hashing->next_read_offset;
+    read->size = std::min(static_cast<int64_t>(read->buffer.size()),
+                          end - read->offset);
+    hashing->next_read_offset += read->size;
+  }
+  read->bytes_read = 0;
+  return true;
+}
+
+bool FilesystemVerifierAction::ScheduleRead(PartitionHashing* hashing,
+                                            PartitionRead* read) {
+  bool read_async_ok = read->stream->ReadAsync(
+    read->buffer.data() + read->bytes_read,
+    read->size - read->bytes_read,
     base::Bind(&FilesystemVerifierAction::OnReadDoneCallback,
-               base::Unretained(this)),
+               base::Unretained(this),
+               base::Unretained(hashing),
+               base::Unretained(read)),
     base::Bind(&FilesystemVerifierAction::OnReadErrorCallback,
-               base::Unretained(this)),
+               base::Unretained(this),
+               base::Unretained(hashing),
+               base::Unretained(read)),
     nullptr);
 
   if (!read_async_ok) {
     LOG(ERROR) << "Unable to schedule an asynchronous read from the stream.";
     Cleanup(ErrorCode::kError);
+    return false;
   }
+  return true;
 }
 
-void FilesystemVerifierAction::OnReadDoneCallback(size_t bytes_read) {
-  if (bytes_read == 0) {
-    read_done_ = true;
-  } else {
-    remaining_size_ -= bytes_read;
-    CHECK(!read_done_);
-    if (!hasher_->Update(buffer_.data(), bytes_read)) {
-      LOG(ERROR) << "Unable to update the hash.";
-      Cleanup(ErrorCode::kError);
-      return;
-    }
-  }
-
-  // We either terminate the current partition or have more data to read.
+void FilesystemVerifierAction::OnReadDoneCallback(PartitionHashing* hashing,
+                                                  PartitionRead* read,
+                                                  size_t bytes_read) {
   if (cancelled_)
     return Cleanup(ErrorCode::kError);
 
-  if (read_done_ || remaining_size_ == 0) {
-    if (remaining_size_ != 0) {
-      LOG(ERROR) << "Failed to read the remaining " << remaining_size_
-                 << " bytes from partition "
-                 << install_plan_.partitions[partition_index_].name;
-      return Cleanup(ErrorCode::kFilesystemVerifierError);
-    }
-    return FinishPartitionHashing();
+  if (bytes_read == 0) {
+    // Reached EOF before the end of the chunk.
+    LOG(ERROR) << "Failed to read the remaining "
+               << hashing->size - read->offset - read->bytes_read
+               << " bytes from partition "
+               << hashing->partition.name;
+    return Cleanup(ErrorCode::kFilesystemVerifierError);
+  }
+  read->bytes_read += bytes_read;
+  if (read->bytes_read < read->size) {
+    ScheduleRead(hashing, read);
+    return;
   }
-  ScheduleRead();
+  if (io_limiter_)
+    io_limiter_->FinishRead(read->start_time);
+  ContinuePartitionHashing(hashing);
 }
 
 void FilesystemVerifierAction::OnReadErrorCallback(
+      PartitionHashing* hashing,
+      PartitionRead* read,
       const brillo::Error* error) {
   // TODO(deymo): Transform the read-error into an specific ErrorCode.
   LOG(ERROR) << "Asynchronous read failed.";
   Cleanup(ErrorCode::kError);
 }
 
-void FilesystemVerifierAction::FinishPartitionHashing() {
-  if (!hasher_->Finalize()) {
+bool FilesystemVerifierAction::FinishPartitionHashing(
+    PartitionHashing* hashing) {
+  const size_t partition_index = hashing->partition_index;
+  const InstallPlan::Partition& partition = hashing->partition;
+  // The data samples match the whole data written, whose hash is known.
+  if (!hashing->sample_hashes && !hashing->hasher.Finalize()) {
     LOG(ERROR) << "Unable to finalize the hash.";
-    return Cleanup(ErrorCode::kError);
+    Cleanup(ErrorCode::kError);
+    return false;
   }
-  InstallPlan::Partition& partition =
-      install_plan_.partitions[partition_index_];
-  LOG(INFO) << "Hash of " << partition.name << ": "
-            << Base64Encode(hasher_->raw_hash());
+  const brillo::Blob& raw_hash = hashing->sample_hashes
+                                     ? partition.target_written_hash
+                                     : hashing->hasher.raw_hash();
+  LOG(INFO) << "Hash of " << partition.name << ": " << Base64Encode(raw_hash);
 
   switch (verifier_step_) {
     case VerifierStep::kVerifyTargetHash:
-      if (partition.target_hash != hasher_->raw_hash()) {
+      if (partition.target_hash != raw_hash || hashing->sample_mismatch) {
         LOG(ERROR) << "New '" << partition.name
                    << "' partition verification failed.";
+        if (!performing_) {
+          // The source partition is checked once the action starts.
+          Cleanup(ErrorCode::kNewRootfsVerificationError);
+          return false;
+        }
         if (partition.source_hash.empty()) {
           // No need to verify source if it is a full payload.
-          return Cleanup(ErrorCode::kNewRootfsVerificationError);
+          Cleanup(ErrorCode::kNewRootfsVerificationError);
+          return false;
         }
         // If we have not verified source partition yet, now that the target
         // partition does not match, and it's not a full payload, we need to
         // switch to kVerifySourceHash step to check if it's because the source
-        // partition does not match either.
-        verifier_step_ = VerifierStep::kVerifySourceHash;
-      } else {
-        partition_index_++;
+        // partition does not match either. This stops the hashing of the other
+        // target partitions.
+        StartHashing(VerifierStep::kVerifySourceHash, {partition_index});
+        return false;
       }
       break;
     case VerifierStep::kVerifySourceHash:
-      if (partition.source_hash != hasher_->raw_hash()) {
+      if (partition.source_hash != raw_hash) {
         LOG(ERROR) << "Old '" << partition.name
                    << "' partition verification failed.";
         LOG(ERROR) << "This is a server-side error due to mismatched delta"
@@ -231,7 +599,7 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
                       " means that the delta I've been given doesn't match my"
                       " existing system. The "
                    << partition.name << " partition I have has hash: "
-                   << Base64Encode(hasher_->raw_hash())
+                   << Base64Encode(raw_hash)
                    << " but the update expected me to have "
                    << Base64Encode(partition.source_hash) << " .";
         LOG(INFO) << "To get the checksum of the " << partition.name
@@ -242,7 +610,8 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
                      "-binary | openssl base64";
         LOG(INFO) << "To get the checksum of partitions in a bin file, "
                   << "run: .../src/scripts/sha256_partitions.sh .../file.bin";
-        return Cleanup(ErrorCode::kDownloadStateInitializationError);
+        Cleanup(ErrorCode::kDownloadStateInitializationError);
+        return false;
       }
       // The action will skip kVerifySourceHash step if target partition hash
       // matches, if we are in this step, it means target hash does not match,
@@ -250,13 +619,20 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
       // code to reflect the error in target partition.
       // We only need to verify the source partition which the target hash does
       // not match, the rest of the partitions don't matter.
-      return Cleanup(ErrorCode::kNewRootfsVerificationError);
+      Cleanup(ErrorCode::kNewRootfsVerificationError);
+      return false;
+  }
+  // The hash matched; the other partitions may still be hashing. The reads of
+  // this one are not needed anymore.
+  hashing->scheduled_reads.clear();
+  hashing->idle_reads.clear();
+  hashing->reads.clear();
+  hashing->verified = true;
+  if (--remaining_partitions_ == 0 && performing_) {
+    Cleanup(ErrorCode::kSuccess);
+    return false;
   }
-  // Start hashing the next partition, if any.
-  hasher_.reset();
-  buffer_.clear();
-  src_stream_->CloseBlocking(nullptr);
-  StartPartitionHashing();
+  return true;
 }
 
 }  // namespace chromeos_update_engine
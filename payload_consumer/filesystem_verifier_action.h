@@ -20,17 +20,30 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
 #include <brillo/streams/stream.h>
 
 #include "update_engine/common/action.h"
+#include "update_engine/common/blob_pool.h"
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/io_limiter.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/verity_writer.h"
 
 // This action will hash all the partitions of the target slot involved in the
-// update. The hashes are then verified against the ones in the InstallPlan.
+// update, all of them concurrently. The hashes are then verified against the
+// ones in the InstallPlan. The partitions reported as written by the
+// DownloadAction are hashed right away, while the rest of the payload is
+// downloaded, and only the ones not verified yet are hashed once the action
+// starts.
 // If the target hash does not match, the action will fail. In case of failure,
 // the error code will depend on whether the source slot hashes are provided and
 // match.
@@ -47,72 +60,187 @@ enum class VerifierStep {
   kVerifySourceHash,
 };
 
-class FilesystemVerifierAction : public InstallPlanAction {
+class FilesystemVerifierAction : public InstallPlanAction,
+                                 public PartitionWriteObserver {
  public:
   FilesystemVerifierAction() = default;
 
   void PerformAction() override;
   void TerminateProcessing() override;
 
+  // PartitionWriteObserver overrides. The target hash of a partition written
+  // is checked before the action starts; a mismatch or an error only drops
+  // these early results, and the partitions are hashed again by the action.
+  void PartitionWritten(const InstallPlan& install_plan,
+                        size_t partition_index) override;
+  void PartitionWritesAborted() override;
+
   // Used for testing. Return true if Cleanup() has not yet been called due
   // to a callback upon the completion or cancellation of the verifier action.
   // A test should wait until IsCleanupPending() returns false before
   // terminating the main loop.
   bool IsCleanupPending() const;
 
+  // Paces the reads of the partitions with |io_limiter|, if not null, which
+  // must outlive the action.
+  void set_io_limiter(IOLimiter* io_limiter) { io_limiter_ = io_limiter; }
+
   // Debugging/logging
   static std::string StaticType() { return "FilesystemVerifierAction"; }
   std::string Type() const override { return StaticType(); }
 
  private:
-  // Starts the hashing of the current partition. If there aren't any partitions
-  // remaining to be hashed, it finishes the action.
-  void StartPartitionHashing();
-
-  // Schedules the asynchronous read of the filesystem.
-  void ScheduleRead();
-
-  // Called from the main loop when a single read from |src_stream_| succeeds or
-  // fails, calling OnReadDoneCallback() and OnReadErrorCallback() respectively.
-  void OnReadDoneCallback(size_t bytes_read);
-  void OnReadErrorCallback(const brillo::Error* error);
-
-  // When the read is done, finalize the hash checking of the current partition
-  // and continue checking the next one.
-  void FinishPartitionHashing();
+  // A read of a chunk of a partition. Every read has its own stream, since a
+  // stream supports a single pending asynchronous read at a time.
+  struct PartitionRead {
+    brillo::StreamPtr stream;
+    // Taken from the BlobPool, as the hashing of each partition allocates a
+    // few megabytes of buffers.
+    PooledBlob buffer;
+    // The chunk of the partition read, and how much of it was read so far.
+    int64_t offset{0};
+    size_t size{0};
+    size_t bytes_read{0};
+    // When the read of the chunk started, as returned by the IOLimiter.
+    base::Time start_time;
+  };
+
+  // The hashing state of a single partition.
+  struct PartitionHashing {
+    ~PartitionHashing();
+
+    // The index in the install_plan_.partitions vector of the partition, and
+    // a copy of it, since it may be hashed before the action receives the
+    // install plan.
+    size_t partition_index{0};
+    InstallPlan::Partition partition;
+
+    // Whether all of the partition was hashed and its hash matched.
+    bool verified{false};
+
+    // Reads and hashes this many bytes from the head of the partition. This
+    // field is initialized from the corresponding InstallPlan::Partition size.
+    int64_t size{0};
+
+    // The offset of the next read to schedule, and the number of bytes hashed
+    // so far. The chunks are hashed in order as their reads complete.
+    int64_t next_read_offset{0};
+    int64_t hashed_size{0};
+
+    HashCalculator hasher;
+
+    // If not null, the hashes of the data samples to check, indexed by their
+    // offset, when the target hash was computed while writing the partition.
+    // Only these samples are read, instead of hashing the whole partition.
+    // Points to the samples of |partition|.
+    const std::map<uint64_t, brillo::Blob>* sample_hashes{nullptr};
+    std::map<uint64_t, brillo::Blob>::const_iterator next_sample;
+    bool sample_mismatch{false};
+
+    // If not null, builds the hash tree of the partition from the data hashed.
+    // The data after the hash tree data isn't read until the tree is written.
+    std::unique_ptr<VerityWriter> verity_writer;
+
+    // All the reads of the partition, the ones scheduled in the order of their
+    // offset and the ones available to read the next chunks.
+    std::vector<std::unique_ptr<PartitionRead>> reads;
+    std::deque<PartitionRead*> scheduled_reads;
+    std::vector<PartitionRead*> idle_reads;
+
+    // A file descriptor of the partition only used to drop the chunks hashed
+    // from the page cache, which the streams can't do. Null if it couldn't be
+    // opened.
+    FileDescriptorPtr cache_fd;
+
+    // The size of the reads, and how many of them are in flight while the
+    // IOLimiter isn't in performance mode.
+    size_t buffer_size{0};
+    size_t background_reads{0};
+
+    // The task scheduling the next reads once the IOLimiter allows them.
+    brillo::MessageLoop::TaskId throttle_task_id{
+        brillo::MessageLoop::kTaskIdNull};
+  };
+
+  // Starts the hashing of the partitions at |partition_indexes| in
+  // install_plan_.partitions for the |step|, all of them concurrently.
+  void StartHashing(VerifierStep step,
+                    const std::vector<size_t>& partition_indexes);
+
+  // Adds the hashing of the partition at |partition_index| in |install_plan|
+  // for the current step to |hashings_|, sharing the memory for the reads
+  // with |num_partitions| partitions. The reads are started by
+  // ContinuePartitionHashing(). Returns false if it failed and the action was
+  // cleaned up.
+  bool AddPartitionHashing(const InstallPlan& install_plan,
+                           size_t partition_index,
+                           size_t num_partitions);
+
+  // Hashes the completed reads of |hashing| in order and schedules the reads of
+  // the next chunks, finishing the partition once it is all hashed. Returns
+  // false if the hashing of all the partitions was stopped or restarted, in
+  // which case |hashing| is no longer valid.
+  bool ContinuePartitionHashing(PartitionHashing* hashing);
+
+  // Writes the hash tree built by the |hashing| verity writer to the partition
+  // once all the data it covers is hashed. Returns whether it succeeded.
+  bool WriteVerity(PartitionHashing* hashing);
+
+  // Returns whether |hashing| has as many reads in flight as allowed: all of
+  // its reads in performance mode, and |background_reads| otherwise.
+  bool ReadDepthReached(const PartitionHashing* hashing) const;
+
+  // Returns whether the next reads of |hashing| must wait for the IOLimiter,
+  // in which case a task continues the hashing once they can start.
+  bool ThrottleReads(PartitionHashing* hashing);
+  void OnThrottleTimeout(PartitionHashing* hashing);
+
+  // Sets the chunk of the partition |read| reads next. Returns false if there
+  // aren't any chunks left to read.
+  bool NextChunk(PartitionHashing* hashing, PartitionRead* read);
+
+  // Schedules the asynchronous read of the remaining bytes of |read|. Returns
+  // false if it failed and the action was cleaned up.
+  bool ScheduleRead(PartitionHashing* hashing, PartitionRead* read);
+
+  // Called from the main loop when a single read of |read| succeeds or fails,
+  // calling OnReadDoneCallback() and OnReadErrorCallback() respectively.
+  void OnReadDoneCallback(PartitionHashing* hashing,
+                          PartitionRead* read,
+                          size_t bytes_read);
+  void OnReadErrorCallback(PartitionHashing* hashing,
+                           PartitionRead* read,
+                           const brillo::Error* error);
+
+  // When all of a partition is hashed, finalize the hash checking of it. The
+  // action completes once all the partitions were checked. Returns false in
+  // the same cases as ContinuePartitionHashing().
+  bool FinishPartitionHashing(PartitionHashing* hashing);
 
   // Cleans up all the variables we use for async operations and tells the
   // ActionProcessor we're done w/ |code| as passed in. |cancelled_| should be
-  // true if TerminateProcessing() was called.
+  // true if TerminateProcessing() was called. Before the action starts, only
+  // the partitions hashed early are dropped.
   void Cleanup(ErrorCode code);
 
   // The type of the partition that we are verifying.
   VerifierStep verifier_step_ = VerifierStep::kVerifyTargetHash;
 
-  // The index in the install_plan_.partitions vector of the partition currently
-  // being hashed.
-  size_t partition_index_{0};
+  // The partitions being hashed, and the number of them not finished yet.
+  std::vector<std::unique_ptr<PartitionHashing>> hashings_;
+  size_t remaining_partitions_{0};
 
-  // If not null, the FileStream used to read from the device.
-  brillo::StreamPtr src_stream_;
+  bool cancelled_{false};  // true if the action has been cancelled.
 
-  // Buffer for storing data we read.
-  brillo::Blob buffer_;
+  // Whether PerformAction() was called. Until then only the partitions
+  // reported by PartitionWritten() are hashed.
+  bool performing_{false};
 
-  bool read_done_{false};  // true if reached EOF on the input stream.
-  bool cancelled_{false};  // true if the action has been cancelled.
+  IOLimiter* io_limiter_{nullptr};
 
   // The install plan we're passed in via the input pipe.
   InstallPlan install_plan_;
 
-  // Calculates the hash of the data.
-  std::unique_ptr<HashCalculator> hasher_;
-
-  // Reads and hashes this many bytes from the head of the input stream. This
-  // field is initialized from the corresponding InstallPlan::Partition size,
-  // when the partition starts to be hashed.
-  int64_t remaining_size_{0};
-
   DISALLOW_COPY_AND_ASSIGN(FilesystemVerifierAction);
 };
 
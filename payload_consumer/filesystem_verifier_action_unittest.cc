@@ -18,6 +18,7 @@
 
 #include <fcntl.h>
 
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -34,6 +35,7 @@
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/hashing_file_descriptor.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 
 using brillo::MessageLoop;
@@ -56,6 +58,21 @@ class FilesystemVerifierActionTest : public ::testing::Test {
   // Returns true iff test has completed successfully.
   bool DoTest(bool terminate_early, bool hash_fail);
 
+  // Adds to |install_plan| a partition of |size| bytes of random data, stored
+  // in a new temporary file. The target hash is corrupted if |hash_fail|.
+  void AddPartition(InstallPlan* install_plan, size_t size, bool hash_fail);
+
+  // Runs the verifier action on |install_plan|, pacing its reads with
+  // |io_limiter| if not null, and returns the error code it completed with.
+  // If |written_install_plan| is not null, all its partitions are reported
+  // as written before the action starts.
+  ErrorCode RunVerifierAction(
+      const InstallPlan& install_plan,
+      IOLimiter* io_limiter = nullptr,
+      const InstallPlan* written_install_plan = nullptr);
+
+  vector<std::unique_ptr<test_utils::ScopedTempFile>> partition_files_;
+
   brillo::FakeMessageLoop loop_{nullptr};
 };
 
@@ -233,6 +250,181 @@ class FilesystemVerifierActionTest2Delegate : public ActionProcessorDelegate {
   ErrorCode code_;
 };
 
+void FilesystemVerifierActionTest::AddPartition(InstallPlan* install_plan,
+                                                size_t size,
+                                                bool hash_fail) {
+  partition_files_.emplace_back(
+      new test_utils::ScopedTempFile("FilesystemVerifierActionTest.XXXXXX"));
+  brillo::Blob data(size);
+  test_utils::FillWithData(&data);
+  ASSERT_TRUE(test_utils::WriteFileVector(partition_files_.back()->path(),
+                                          data));
+
+  InstallPlan::Partition part;
+  part.name = "part" + std::to_string(install_plan->partitions.size());
+  part.target_path = partition_files_.back()->path();
+  part.target_size = size;
+  if (hash_fail)
+    data.push_back(0);
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data, &part.target_hash));
+  install_plan->partitions.push_back(part);
+}
+
+ErrorCode FilesystemVerifierActionTest::RunVerifierAction(
+    const InstallPlan& install_plan,
+    IOLimiter* io_limiter,
+    const InstallPlan* written_install_plan) {
+  ActionProcessor processor;
+  ObjectFeederAction<InstallPlan> feeder_action;
+  FilesystemVerifierAction verifier_action;
+  verifier_action.set_io_limiter(io_limiter);
+  ObjectCollectorAction<InstallPlan> collector_action;
+  BondActions(&feeder_action, &verifier_action);
+  BondActions(&verifier_action, &collector_action);
+
+  FilesystemVerifierActionTestDelegate delegate(&verifier_action);
+  processor.set_delegate(&delegate);
+  processor.EnqueueAction(&feeder_action);
+  processor.EnqueueAction(&verifier_action);
+  processor.EnqueueAction(&collector_action);
+  feeder_action.set_obj(install_plan);
+  if (written_install_plan) {
+    for (size_t i = 0; i < written_install_plan->partitions.size(); i++)
+      verifier_action.PartitionWritten(*written_install_plan, i);
+  }
+
+  loop_.PostTask(FROM_HERE, base::Bind(&StartProcessorInRunLoop,
+                                       &processor,
+                                       &verifier_action,
+                                       false));
+  loop_.Run();
+  EXPECT_TRUE(delegate.ran());
+  if (delegate.code() == ErrorCode::kSuccess)
+    EXPECT_TRUE(collector_action.object() == install_plan);
+  return delegate.code();
+}
+
+TEST_F(FilesystemVerifierActionTest, MultiplePartitionsTest) {
+  InstallPlan install_plan;
+  // Partitions with no data, smaller than a read, and with many reads and a
+  // partial last one are all hashed concurrently.
+  AddPartition(&install_plan, 0, false);
+  AddPartition(&install_plan, 1000, false);
+  AddPartition(&install_plan, 5 * 1024 * 1024 + 512, false);
+  AddPartition(&install_plan, 3 * 128 * 1024, false);
+  EXPECT_EQ(ErrorCode::kSuccess, RunVerifierAction(install_plan));
+}
+
+TEST_F(FilesystemVerifierActionTest, MultiplePartitionsHashFailTest) {
+  InstallPlan install_plan;
+  AddPartition(&install_plan, 2 * 1024 * 1024, false);
+  AddPartition(&install_plan, 1024 * 1024 + 1, true);
+  AddPartition(&install_plan, 4096, false);
+  // Without source hashes this is a full payload.
+  EXPECT_EQ(ErrorCode::kNewRootfsVerificationError,
+            RunVerifierAction(install_plan));
+}
+
+TEST_F(FilesystemVerifierActionTest, IOLimiterTest) {
+  InstallPlan install_plan;
+  AddPartition(&install_plan, 1024 * 1024 + 10, false);
+  AddPartition(&install_plan, 4096, false);
+  IOLimiter io_limiter;
+  // The paced reads still hash all the data, in both modes.
+  EXPECT_EQ(ErrorCode::kSuccess, RunVerifierAction(install_plan, &io_limiter));
+  io_limiter.SetPerformanceMode(true);
+  EXPECT_EQ(ErrorCode::kSuccess, RunVerifierAction(install_plan, &io_limiter));
+  EXPECT_EQ(base::TimeDelta(), io_limiter.GetReadDelay());
+
+  install_plan.partitions[1].target_hash[0] ^= 1;
+  io_limiter.SetPerformanceMode(false);
+  EXPECT_EQ(ErrorCode::kNewRootfsVerificationError,
+            RunVerifierAction(install_plan, &io_limiter));
+}
+
+TEST_F(FilesystemVerifierActionTest, PartitionWrittenTest) {
+  InstallPlan install_plan;
+  AddPartition(&install_plan, 2 * 1024 * 1024, false);
+  AddPartition(&install_plan, 4096, false);
+  // The partitions hashed while the payload was downloaded are kept.
+  EXPECT_EQ(ErrorCode::kSuccess,
+            RunVerifierAction(install_plan, nullptr, &install_plan));
+
+  // A partition reported with a different hash is hashed again, and the
+  // early mismatch doesn't fail the action.
+  InstallPlan written_install_plan = install_plan;
+  written_install_plan.partitions[1].target_hash[0] ^= 1;
+  EXPECT_EQ(ErrorCode::kSuccess,
+            RunVerifierAction(install_plan, nullptr, &written_install_plan));
+  EXPECT_EQ(ErrorCode::kNewRootfsVerificationError,
+            RunVerifierAction(
+                written_install_plan, nullptr, &written_install_plan));
+}
+
+TEST_F(FilesystemVerifierActionTest, WrittenHashTest) {
+  InstallPlan install_plan;
+  AddPartition(&install_plan, 3 * 1024 * 1024 + 100, false);
+  InstallPlan::Partition& part = install_plan.partitions[0];
+  brillo::Blob data;
+  ASSERT_TRUE(utils::ReadFile(part.target_path, &data));
+  WrittenDataHasher hasher(data.size());
+  hasher.HashWrite(0, data.data(), data.size());
+  ASSERT_TRUE(hasher.GetHashes(&part.target_written_hash,
+                               &part.target_written_sample_hashes));
+  EXPECT_EQ(ErrorCode::kSuccess, RunVerifierAction(install_plan));
+
+  // Only the samples of the data are read back.
+  data[WrittenDataHasher::kSampleSize] ^= 1;
+  ASSERT_TRUE(test_utils::WriteFileVector(part.target_path, data));
+  EXPECT_EQ(ErrorCode::kSuccess, RunVerifierAction(install_plan));
+
+  data[WrittenDataHasher::kSampleInterval + 10] ^= 1;
+  ASSERT_TRUE(test_utils::WriteFileVector(part.target_path, data));
+  EXPECT_EQ(ErrorCode::kNewRootfsVerificationError,
+            RunVerifierAction(install_plan));
+}
+
+TEST_F(FilesystemVerifierActionTest, WriteVerityTest) {
+  const size_t kBlockSize = 4096;
+  InstallPlan install_plan;
+  install_plan.write_verity = true;
+  // Five blocks of data followed by their hash tree, of a single block.
+  AddPartition(&install_plan, 6 * kBlockSize, false);
+  InstallPlan::Partition& part = install_plan.partitions[0];
+  part.block_size = kBlockSize;
+  part.hash_tree_data_size = 5 * kBlockSize;
+  part.hash_tree_offset = 5 * kBlockSize;
+  part.hash_tree_size = kBlockSize;
+  part.hash_tree_algorithm = "sha256";
+  part.hash_tree_salt = {1, 2, 3};
+
+  brillo::Blob data;
+  ASSERT_TRUE(utils::ReadFile(part.target_path, &data));
+  brillo::Blob expected_data(data.begin(), data.begin() + 5 * kBlockSize);
+  for (size_t i = 0; i < 5; i++) {
+    brillo::Blob block = part.hash_tree_salt;
+    block.insert(block.end(),
+                 data.begin() + i * kBlockSize,
+                 data.begin() + (i + 1) * kBlockSize);
+    brillo::Blob hash;
+    ASSERT_TRUE(HashCalculator::RawHashOfData(block, &hash));
+    expected_data.insert(expected_data.end(), hash.begin(), hash.end());
+  }
+  expected_data.resize(data.size());
+  ASSERT_TRUE(HashCalculator::RawHashOfData(expected_data, &part.target_hash));
+
+  // The partition hash covers the tree written.
+  EXPECT_EQ(ErrorCode::kSuccess, RunVerifierAction(install_plan));
+  ASSERT_TRUE(utils::ReadFile(part.target_path, &data));
+  EXPECT_EQ(expected_data, data);
+
+  // Building the FEC data is not supported.
+  part.fec_data_size = 5 * kBlockSize;
+  part.fec_size = kBlockSize;
+  EXPECT_EQ(ErrorCode::kFilesystemVerifierError,
+            RunVerifierAction(install_plan));
+}
+
 TEST_F(FilesystemVerifierActionTest, MissingInputObjectTest) {
   ActionProcessor processor;
   FilesystemVerifierActionTest2Delegate delegate;
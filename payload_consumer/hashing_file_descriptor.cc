@@ -0,0 +1,180 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/hashing_file_descriptor.h"
+
+#include <linux/fs.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const size_t kZeroBufferSize = 64 * 1024;
+}  // namespace
+
+const uint64_t WrittenDataHasher::kSampleSize = 4096;
+const uint64_t WrittenDataHasher::kSampleInterval = 1024 * 1024;
+
+void WrittenDataHasher::HashWrite(uint64_t offset,
+                                  const void* data,
+                                  size_t count) {
+  base::AutoLock auto_lock(lock_);
+  if (CanHashAt(offset))
+    HashData(static_cast<const uint8_t*>(data), count);
+}
+
+void WrittenDataHasher::HashZeros(uint64_t offset, uint64_t length) {
+  static const brillo::Blob* const zeros = new brillo::Blob(kZeroBufferSize);
+  base::AutoLock auto_lock(lock_);
+  while (length > 0 && CanHashAt(offset)) {
+    size_t count = std::min(length, static_cast<uint64_t>(zeros->size()));
+    HashData(zeros->data(), count);
+    offset += count;
+    length -= count;
+  }
+}
+
+void WrittenDataHasher::InvalidateRange(uint64_t offset, uint64_t length) {
+  base::AutoLock auto_lock(lock_);
+  // Changing the data not hashed yet is fine as long as it is written later.
+  if (valid_ && length > 0 && offset < hashed_size_) {
+    LOG(INFO) << "Hashed data changed at offset " << offset
+              << ", the partition needs to be read back to be verified.";
+    valid_ = false;
+  }
+}
+
+bool WrittenDataHasher::GetHashes(
+    brillo::Blob* hash, std::map<uint64_t, brillo::Blob>* sample_hashes) {
+  base::AutoLock auto_lock(lock_);
+  if (!valid_ || hashed_size_ != size_)
+    return false;
+  valid_ = false;
+  TEST_AND_RETURN_FALSE(hasher_.Finalize());
+  *hash = hasher_.raw_hash();
+  *sample_hashes = std::move(sample_hashes_);
+  return true;
+}
+
+bool WrittenDataHasher::CanHashAt(uint64_t offset) {
+  lock_.AssertAcquired();
+  if (!valid_ || offset >= size_)
+    return false;
+  if (offset != hashed_size_) {
+    // Either a gap or a rewrite of hashed data.
+    LOG(INFO) << "Data written out of order at offset " << offset
+              << " instead of " << hashed_size_
+              << ", the partition needs to be read back to be verified.";
+    valid_ = false;
+    return false;
+  }
+  return true;
+}
+
+void WrittenDataHasher::HashData(const uint8_t* data, size_t count) {
+  count = std::min(static_cast<uint64_t>(count), size_ - hashed_size_);
+  if (!hasher_.Update(data, count)) {
+    valid_ = false;
+    return;
+  }
+  while (count > 0) {
+    uint64_t sample_offset = hashed_size_ - hashed_size_ % kSampleInterval;
+    uint64_t sample_end = std::min(sample_offset + kSampleSize, size_);
+    size_t piece;
+    if (hashed_size_ < sample_end) {
+      piece = std::min(static_cast<uint64_t>(count), sample_end - hashed_size_);
+      sample_data_.insert(sample_data_.end(), data, data + piece);
+      if (hashed_size_ + piece == sample_end) {
+        if (!HashCalculator::RawHashOfData(sample_data_,
+                                           &sample_hashes_[sample_offset])) {
+          valid_ = false;
+          return;
+        }
+        sample_data_.clear();
+      }
+    } else {
+      piece = std::min(static_cast<uint64_t>(count),
+                       sample_offset + kSampleInterval - hashed_size_);
+    }
+    data += piece;
+    count -= piece;
+    hashed_size_ += piece;
+  }
+}
+
+bool HashingFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  offset_ = 0;
+  return fd_->Open(path, flags, mode);
+}
+
+bool HashingFileDescriptor::Open(const char* path, int flags) {
+  offset_ = 0;
+  return fd_->Open(path, flags);
+}
+
+ssize_t HashingFileDescriptor::Read(void* buf, size_t count) {
+  ssize_t bytes_read = fd_->Read(buf, count);
+  if (bytes_read > 0)
+    offset_ += bytes_read;
+  return bytes_read;
+}
+
+ssize_t HashingFileDescriptor::Write(const void* buf, size_t count) {
+  ssize_t bytes_written = fd_->Write(buf, count);
+  if (bytes_written > 0) {
+    hasher_->HashWrite(offset_, buf, bytes_written);
+    offset_ += bytes_written;
+  }
+  return bytes_written;
+}
+
+off64_t HashingFileDescriptor::Seek(off64_t offset, int whence) {
+  off64_t result = fd_->Seek(offset, whence);
+  if (result >= 0)
+    offset_ = result;
+  return result;
+}
+
+bool HashingFileDescriptor::BlkIoctl(int request,
+                                     uint64_t start,
+                                     uint64_t length,
+                                     int* result) {
+  if (!fd_->BlkIoctl(request, start, length, result))
+    return false;
+  if (request == BLKZEROOUT && *result == 0)
+    hasher_->HashZeros(start, length);
+  else
+    hasher_->InvalidateRange(start, length);
+  return true;
+}
+
+bool HashingFileDescriptor::CopyRangeFrom(FileDescriptor* source,
+                                          uint64_t source_offset,
+                                          uint64_t offset,
+                                          uint64_t length) {
+  // The copied data doesn't go through memory, and may be partially written
+  // on failure.
+  hasher_->InvalidateRange(offset, length);
+  return fd_->CopyRangeFrom(source, source_offset, offset, length);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_HASHING_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_HASHING_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// Computes the hash of the first |size| bytes of a partition from the data
+// written to it, as long as it is written in order from the beginning, so the
+// partition doesn't need to be read back to be verified. It also keeps the
+// hash of a sample of the data, |kSampleSize| bytes every |kSampleInterval|
+// bytes, used to check that the data did reach the disk. It is shared by all
+// the HashingFileDescriptor writing to the partition, and is thread safe.
+class WrittenDataHasher {
+ public:
+  static const uint64_t kSampleSize;
+  static const uint64_t kSampleInterval;
+
+  explicit WrittenDataHasher(uint64_t size) : size_(size) {}
+
+  // Records that the |count| bytes of |data| were written at |offset|.
+  void HashWrite(uint64_t offset, const void* data, size_t count);
+
+  // Records that |length| zero bytes were written at |offset|.
+  void HashZeros(uint64_t offset, uint64_t length);
+
+  // Records that the |length| bytes at |offset| were changed without passing
+  // their data, e.g. discarded.
+  void InvalidateRange(uint64_t offset, uint64_t length);
+
+  // Stores in |hash| the hash of the whole data and in |sample_hashes| the
+  // hashes of the samples, indexed by their offset. Returns false if not all
+  // the data was written in order. It can only be called once.
+  bool GetHashes(brillo::Blob* hash,
+                 std::map<uint64_t, brillo::Blob>* sample_hashes);
+
+ private:
+  // Returns whether the data written at |offset| can be hashed.
+  bool CanHashAt(uint64_t offset);
+
+  // Hashes the next |count| bytes of |data|, ignoring those past |size_|.
+  void HashData(const uint8_t* data, size_t count);
+
+  base::Lock lock_;
+  const uint64_t size_;
+  // False once the data is not written in order.
+  bool valid_{true};
+  uint64_t hashed_size_{0};
+  HashCalculator hasher_;
+
+  // The data of the sample being written and the hashes of the written ones.
+  brillo::Blob sample_data_;
+  std::map<uint64_t, brillo::Blob> sample_hashes_;
+
+  DISALLOW_COPY_AND_ASSIGN(WrittenDataHasher);
+};
+
+// A FileDescriptor which forwards all the calls to |fd| and records the data
+// written with them in a WrittenDataHasher.
+class HashingFileDescriptor : public FileDescriptor {
+ public:
+  HashingFileDescriptor(FileDescriptorPtr fd,
+                        std::shared_ptr<WrittenDataHasher> hasher)
+      : fd_(fd), hasher_(hasher) {}
+  ~HashingFileDescriptor() override = default;
+
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override;
+  bool Readahead(uint64_t offset, uint64_t length) override {
+    return fd_->Readahead(offset, length);
+  }
+  bool DropCache(uint64_t offset, uint64_t length) override {
+    return fd_->DropCache(offset, length);
+  }
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override;
+  int GetNativeFd() override { return fd_->GetNativeFd(); }
+  bool Flush() override { return fd_->Flush(); }
+  bool Close() override { return fd_->Close(); }
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_->IsOpen(); }
+
+ private:
+  FileDescriptorPtr fd_;
+  std::shared_ptr<WrittenDataHasher> hasher_;
+  // The offset of the next Read() or Write() of |fd_|.
+  off64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(HashingFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_HASHING_FILE_DESCRIPTOR_H_
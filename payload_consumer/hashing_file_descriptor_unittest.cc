@@ -0,0 +1,128 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/hashing_file_descriptor.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+
+#include <map>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::map;
+
+namespace chromeos_update_engine {
+
+class HashingFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(3 * WrittenDataHasher::kSampleInterval + 100);
+    test_utils::FillWithData(&data_);
+    FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+    ASSERT_TRUE(fd->Open(temp_file_.path().c_str(), O_RDWR));
+    hasher_.reset(new WrittenDataHasher(data_.size()));
+    fd_.reset(new HashingFileDescriptor(fd, hasher_));
+  }
+
+  void TearDown() override { EXPECT_TRUE(fd_->Close()); }
+
+  // Writes the |count| bytes of |data_| at |offset| in chunks of |chunk_size|.
+  void WriteData(uint64_t offset, size_t count, size_t chunk_size) {
+    ASSERT_EQ(static_cast<off64_t>(offset), fd_->Seek(offset, SEEK_SET));
+    for (size_t i = 0; i < count; i += chunk_size) {
+      ASSERT_TRUE(utils::WriteAll(
+          fd_, data_.data() + offset + i, std::min(chunk_size, count - i)));
+    }
+  }
+
+  test_utils::ScopedTempFile temp_file_{"HashingFileDescriptorTest.XXXXXX"};
+  brillo::Blob data_;
+  std::shared_ptr<WrittenDataHasher> hasher_;
+  FileDescriptorPtr fd_;
+};
+
+TEST_F(HashingFileDescriptorTest, InOrderWritesTest) {
+  WriteData(0, 1000, 1000);
+  WriteData(1000, data_.size() - 1000, 12345);
+
+  brillo::Blob hash;
+  map<uint64_t, brillo::Blob> sample_hashes;
+  ASSERT_TRUE(hasher_->GetHashes(&hash, &sample_hashes));
+  brillo::Blob expected_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data_, &expected_hash));
+  EXPECT_EQ(expected_hash, hash);
+
+  // The last sample is shorter, cut at the end of the data.
+  ASSERT_EQ(4U, sample_hashes.size());
+  for (const auto& sample : sample_hashes) {
+    EXPECT_EQ(0U, sample.first % WrittenDataHasher::kSampleInterval);
+    uint64_t size =
+        std::min(WrittenDataHasher::kSampleSize,
+                 static_cast<uint64_t>(data_.size()) - sample.first);
+    ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+        data_.data() + sample.first, size, &expected_hash));
+    EXPECT_EQ(expected_hash, sample.second);
+  }
+  // The hashes can only be taken once.
+  EXPECT_FALSE(hasher_->GetHashes(&hash, &sample_hashes));
+}
+
+TEST_F(HashingFileDescriptorTest, OutOfOrderWritesTest) {
+  WriteData(4096, data_.size() - 4096, 4096);
+  WriteData(0, 4096, 4096);
+  brillo::Blob hash;
+  map<uint64_t, brillo::Blob> sample_hashes;
+  EXPECT_FALSE(hasher_->GetHashes(&hash, &sample_hashes));
+}
+
+TEST_F(HashingFileDescriptorTest, RewriteTest) {
+  WriteData(0, data_.size(), 4096);
+  WriteData(0, 4096, 4096);
+  brillo::Blob hash;
+  map<uint64_t, brillo::Blob> sample_hashes;
+  EXPECT_FALSE(hasher_->GetHashes(&hash, &sample_hashes));
+}
+
+TEST_F(HashingFileDescriptorTest, ZerosAndDiscardsTest) {
+  // Discarding the data not written yet, or past the size, is fine.
+  hasher_->InvalidateRange(0, data_.size() + 4096);
+  std::fill(data_.begin(), data_.begin() + 8192, 0);
+  hasher_->HashZeros(0, 8192);
+  WriteData(8192, data_.size() - 8192, 4096);
+  hasher_->InvalidateRange(data_.size(), 4096);
+
+  brillo::Blob hash;
+  map<uint64_t, brillo::Blob> sample_hashes;
+  ASSERT_TRUE(hasher_->GetHashes(&hash, &sample_hashes));
+  brillo::Blob expected_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data_, &expected_hash));
+  EXPECT_EQ(expected_hash, hash);
+}
+
+TEST_F(HashingFileDescriptorTest, DiscardHashedDataTest) {
+  WriteData(0, data_.size(), 4096);
+  hasher_->InvalidateRange(4096, 4096);
+  brillo::Blob hash;
+  map<uint64_t, brillo::Blob> sample_hashes;
+  EXPECT_FALSE(hasher_->GetHashes(&hash, &sample_hashes));
+}
+
+}  // namespace chromeos_update_engine
@@ -66,12 +66,13 @@ void InstallPlan::Dump() const {
   for (const auto& payload : payloads) {
     payloads_str += base::StringPrintf(
         ", payload: (size: %" PRIu64 ", metadata_size: %" PRIu64
-        ", metadata signature: %s, hash: %s, payload type: %s)",
+        ", metadata signature: %s, hash: %s, payload type: %s, app id: %s)",
         payload.size,
         payload.metadata_size,
         payload.metadata_signature.c_str(),
         base::HexEncode(payload.hash.data(), payload.hash.size()).c_str(),
-        InstallPayloadTypeToString(payload.type).c_str());
+        InstallPayloadTypeToString(payload.type).c_str(),
+        payload.app_id.c_str());
   }
 
   string version_str = base::StringPrintf(", version: %s", version.c_str());
@@ -90,7 +91,20 @@ void InstallPlan::Dump() const {
             << ", powerwash_required: " << utils::ToString(powerwash_required)
             << ", switch_slot_on_reboot: "
             << utils::ToString(switch_slot_on_reboot)
-            << ", run_post_install: " << utils::ToString(run_post_install);
+            << ", run_post_install: " << utils::ToString(run_post_install)
+            << ", pipelined_apply: " << utils::ToString(pipelined_apply)
+            << ", apply_threads: " << apply_threads
+            << ", async_writes: " << utils::ToString(async_writes)
+            << ", direct_io: " << utils::ToString(direct_io)
+            << ", verify_source_once: " << utils::ToString(verify_source_once)
+            << ", mmap_source: " << utils::ToString(mmap_source)
+            << ", trace_apply: " << utils::ToString(trace_apply)
+            << ", trace_io: " << utils::ToString(trace_io)
+            << ", clone_source_copy: " << utils::ToString(clone_source_copy)
+            << ", verify_written_hash: "
+            << utils::ToString(verify_written_hash)
+            << ", write_verity: " << utils::ToString(write_verity)
+            << ", download_connections: " << download_connections;
 }
 
 bool InstallPlan::LoadPartitionsFromSlots(BootControlInterface* boot_control) {
@@ -122,10 +136,25 @@ bool InstallPlan::Partition::operator==(
           target_path == that.target_path &&
           target_size == that.target_size &&
           target_hash == that.target_hash &&
+          target_written_hash == that.target_written_hash &&
+          target_written_sample_hashes == that.target_written_sample_hashes &&
           run_postinstall == that.run_postinstall &&
           postinstall_path == that.postinstall_path &&
           filesystem_type == that.filesystem_type &&
-          postinstall_optional == that.postinstall_optional);
+          postinstall_optional == that.postinstall_optional &&
+          postinstall_parallel == that.postinstall_parallel &&
+          block_size == that.block_size &&
+          hash_tree_data_offset == that.hash_tree_data_offset &&
+          hash_tree_data_size == that.hash_tree_data_size &&
+          hash_tree_offset == that.hash_tree_offset &&
+          hash_tree_size == that.hash_tree_size &&
+          hash_tree_algorithm == that.hash_tree_algorithm &&
+          hash_tree_salt == that.hash_tree_salt &&
+          fec_data_offset == that.fec_data_offset &&
+          fec_data_size == that.fec_data_size &&
+          fec_offset == that.fec_offset &&
+          fec_size == that.fec_size &&
+          fec_roots == that.fec_roots);
 }
 
 }  // namespace chromeos_update_engine
@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_INSTALL_PLAN_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_INSTALL_PLAN_H_
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -67,12 +68,15 @@ struct InstallPlan {
     // apply the payload if true. Will be set by DownloadAction when resuming
     // multi-payload.
     bool already_applied = false;
+    // The Omaha app id the payload was sent for, the OS or a DLC module.
+    std::string app_id;
 
     bool operator==(const Payload& that) const {
       return size == that.size && metadata_size == that.metadata_size &&
              metadata_signature == that.metadata_signature &&
              hash == that.hash && type == that.type &&
-             already_applied == that.already_applied;
+             already_applied == that.already_applied &&
+             app_id == that.app_id;
     }
   };
   std::vector<Payload> payloads;
@@ -102,12 +106,39 @@ struct InstallPlan {
     uint64_t target_size{0};
     brillo::Blob target_hash;
 
+    // The hash of the target partition computed by DownloadAction from the
+    // data written to it, and the hashes of a sample of that data indexed by
+    // their offset, as computed by WrittenDataHasher. Empty unless
+    // |verify_written_hash| is set and the partition was written in order.
+    brillo::Blob target_written_hash;
+    std::map<uint64_t, brillo::Blob> target_written_sample_hashes;
+
     // Whether we should run the postinstall script from this partition and the
     // postinstall parameters.
     bool run_postinstall{false};
     std::string postinstall_path;
     std::string filesystem_type;
     bool postinstall_optional{false};
+    // Whether the postinstall step may run concurrently with the postinstall
+    // steps of the adjacent partitions that also set it.
+    bool postinstall_parallel{false};
+
+    // The dm-verity hash tree and the forward error correction data to build
+    // on the target partition, as described in the payload, in bytes. Nothing
+    // is built when the sizes are 0.
+    uint64_t block_size{0};
+    uint64_t hash_tree_data_offset{0};
+    uint64_t hash_tree_data_size{0};
+    uint64_t hash_tree_offset{0};
+    uint64_t hash_tree_size{0};
+    std::string hash_tree_algorithm;
+    brillo::Blob hash_tree_salt;
+
+    uint64_t fec_data_offset{0};
+    uint64_t fec_data_size{0};
+    uint64_t fec_offset{0};
+    uint64_t fec_size{0};
+    uint32_t fec_roots{0};
   };
   std::vector<Partition> partitions;
 
@@ -127,6 +158,69 @@ struct InstallPlan {
   // False otherwise.
   bool run_post_install{true};
 
+  // True if the payload operations should be applied on a worker thread while
+  // the rest of the payload is downloaded. False applies each operation
+  // synchronously as soon as its data is received.
+  bool pipelined_apply{false};
+
+  // The number of worker threads applying the payload operations. When greater
+  // than one, the operations writing to disjoint blocks are applied in
+  // parallel, which implies |pipelined_apply|.
+  uint32_t apply_threads{1};
+
+  // True if the writes to the target partitions should be queued as
+  // asynchronous I/O requests, only waiting for them to complete once each
+  // operation is applied.
+  bool async_writes{false};
+
+  // True if the target partitions should be accessed with O_DIRECT so the
+  // update doesn't fill the page cache. Ignored if |async_writes| is set.
+  bool direct_io{false};
+
+  // True if the hash of each source partition should be checked once, before
+  // applying its operations, instead of checking the source data of every
+  // operation. The per-operation checks are still done if the source partition
+  // doesn't match.
+  bool verify_source_once{false};
+
+  // True if the source partitions should be mapped in memory, so the diff
+  // operations read their source data from the page cache on demand instead of
+  // copying it with read() calls. An I/O error reading the source partition
+  // then terminates the process with SIGBUS instead of failing the operation.
+  bool mmap_source{false};
+
+  // True if a trace of the time spent applying each operation should be
+  // written to the non-volatile directory at the end of the download, in the
+  // Chrome trace event format.
+  bool trace_apply{false};
+
+  // True if a trace of the I/O calls made to the partitions should be written
+  // to the non-volatile directory at the end of the download, to be replayed
+  // by io_trace_replay.
+  bool trace_io{false};
+
+  // True if the SOURCE_COPY operations should copy their data inside the
+  // kernel, sharing the data blocks of the source when the file system
+  // supports it. Only image files support it; the operations on other targets
+  // fall back to copying the data through a buffer.
+  bool clone_source_copy{false};
+
+  // True if the hash of each target partition should be computed from the
+  // data written while applying the payload. FilesystemVerifierAction then
+  // only reads back a sample of the partitions whose data was all written in
+  // order, instead of reading them whole.
+  bool verify_written_hash{false};
+
+  // True if FilesystemVerifierAction should build the dm-verity hash tree of
+  // the target partitions which describe one, while hashing them, instead of
+  // leaving it to be built later.
+  bool write_verity{false};
+
+  // The number of HTTP connections downloading the payload. When greater than
+  // one, the payload is downloaded in chunks fetched concurrently over all the
+  // connections.
+  uint32_t download_connections{1};
+
   // If not blank, a base-64 encoded representation of the PEM-encoded
   // public key in the response.
   std::string public_key_rsa;
@@ -173,6 +267,25 @@ class InstallPlanAction : public Action<InstallPlanAction> {
   DISALLOW_COPY_AND_ASSIGN(InstallPlanAction);
 };
 
+// An object notified of the target partitions of an InstallPlan written while
+// the payload is applied, so they can be used before the whole payload is
+// downloaded.
+class PartitionWriteObserver {
+ public:
+  virtual ~PartitionWriteObserver() = default;
+
+  // Called once the partition at |partition_index| in the partitions of
+  // |install_plan| is entirely written. The partitions before it in the same
+  // payload are reported first. The rest of the install plan may still
+  // change until the download completes.
+  virtual void PartitionWritten(const InstallPlan& install_plan,
+                                size_t partition_index) = 0;
+
+  // Called when the download failed or was stopped, after which the reported
+  // partitions may be written again.
+  virtual void PartitionWritesAborted() = 0;
+};
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_INSTALL_PLAN_H_
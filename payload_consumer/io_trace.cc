@@ -0,0 +1,269 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/io_trace.h"
+
+#include <string.h>
+
+#include <base/files/file_util.h>
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Appends the |size| low bytes of |value| to |data|, in little endian.
+void AppendValue(uint64_t value, size_t size, string* data) {
+  for (size_t i = 0; i < size; i++)
+    data->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+// Reads the |size| bytes at |*pos| of |data| in |value|, in little endian,
+// and moves |*pos| past them. Returns false if |data| is too short.
+bool ReadValue(const string& data, size_t size, size_t* pos, uint64_t* value) {
+  TEST_AND_RETURN_FALSE(*pos + size <= data.size());
+  *value = 0;
+  for (size_t i = 0; i < size; i++) {
+    *value |= static_cast<uint64_t>(static_cast<uint8_t>(data[*pos + i]))
+              << (8 * i);
+  }
+  *pos += size;
+  return true;
+}
+
+}  // namespace
+
+const char IOTrace::kMagic[] = "UEIOTRC1";
+const size_t IOTrace::kEventSize = 44;
+const size_t IOTrace::kMaxEvents = 1000000;
+
+IOTrace::IOTrace() : origin_(base::TimeTicks::Now()) {}
+
+uint16_t IOTrace::AddFile(const string& path, int flags) {
+  base::AutoLock auto_lock(lock_);
+  for (size_t i = 0; i < files_.size(); i++) {
+    if (files_[i].path == path)
+      return i;
+  }
+  files_.push_back({path, flags});
+  return files_.size() - 1;
+}
+
+void IOTrace::Record(Call call,
+                     uint16_t file,
+                     uint32_t request,
+                     uint64_t offset,
+                     uint64_t length,
+                     int64_t result,
+                     base::TimeTicks start) {
+  base::TimeTicks now = base::TimeTicks::Now();
+  base::AutoLock auto_lock(lock_);
+  if (events_.size() >= kMaxEvents) {
+    dropped_events_++;
+    return;
+  }
+  Event event;
+  event.start = start - origin_;
+  event.duration = now - start;
+  event.file = file;
+  event.call = call;
+  event.request = request;
+  event.offset = offset;
+  event.length = length;
+  event.result = result;
+  events_.push_back(event);
+}
+
+bool IOTrace::WriteTo(const string& path) const {
+  base::AutoLock auto_lock(lock_);
+  string data(kMagic, strlen(kMagic));
+  AppendValue(files_.size(), 4, &data);
+  for (const File& file : files_) {
+    AppendValue(file.flags, 4, &data);
+    AppendValue(file.path.size(), 4, &data);
+    data += file.path;
+  }
+  AppendValue(events_.size(), 8, &data);
+  for (const Event& event : events_) {
+    AppendValue(event.start.InMicroseconds(), 8, &data);
+    AppendValue(event.duration.InMicroseconds(), 4, &data);
+    AppendValue(event.file, 2, &data);
+    AppendValue(static_cast<uint8_t>(event.call), 1, &data);
+    AppendValue(0, 1, &data);
+    AppendValue(event.request, 4, &data);
+    AppendValue(event.offset, 8, &data);
+    AppendValue(event.length, 8, &data);
+    AppendValue(event.result, 8, &data);
+  }
+  TEST_AND_RETURN_FALSE(utils::WriteFile(path.c_str(), data.data(),
+                                         data.size()));
+  LOG(INFO) << "Wrote " << events_.size() << " I/O trace events to " << path
+            << ", " << dropped_events_ << " dropped.";
+  return true;
+}
+
+bool IOTrace::ReadFrom(const string& path,
+                       vector<File>* files,
+                       vector<Event>* events) {
+  string data;
+  TEST_AND_RETURN_FALSE(base::ReadFileToString(base::FilePath(path), &data));
+  TEST_AND_RETURN_FALSE(data.compare(0, strlen(kMagic), kMagic) == 0);
+  size_t pos = strlen(kMagic);
+  uint64_t num_files;
+  TEST_AND_RETURN_FALSE(ReadValue(data, 4, &pos, &num_files));
+  files->clear();
+  for (uint64_t i = 0; i < num_files; i++) {
+    uint64_t flags, path_size;
+    TEST_AND_RETURN_FALSE(ReadValue(data, 4, &pos, &flags));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 4, &pos, &path_size));
+    TEST_AND_RETURN_FALSE(pos + path_size <= data.size());
+    files->push_back({data.substr(pos, path_size), static_cast<int>(flags)});
+    pos += path_size;
+  }
+  uint64_t num_events;
+  TEST_AND_RETURN_FALSE(ReadValue(data, 8, &pos, &num_events));
+  TEST_AND_RETURN_FALSE(num_events <= (data.size() - pos) / kEventSize);
+  events->clear();
+  for (uint64_t i = 0; i < num_events; i++) {
+    uint64_t start, duration, file, call, padding, request, result;
+    Event event;
+    TEST_AND_RETURN_FALSE(ReadValue(data, 8, &pos, &start));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 4, &pos, &duration));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 2, &pos, &file));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 1, &pos, &call));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 1, &pos, &padding));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 4, &pos, &request));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 8, &pos, &event.offset));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 8, &pos, &event.length));
+    TEST_AND_RETURN_FALSE(ReadValue(data, 8, &pos, &result));
+    TEST_AND_RETURN_FALSE(file < files->size());
+    TEST_AND_RETURN_FALSE(call <= static_cast<uint8_t>(Call::kCopyRange));
+    event.start = base::TimeDelta::FromMicroseconds(start);
+    event.duration = base::TimeDelta::FromMicroseconds(duration);
+    event.file = file;
+    event.call = static_cast<Call>(call);
+    event.request = request;
+    event.result = static_cast<int64_t>(result);
+    events->push_back(event);
+  }
+  return true;
+}
+
+const char* IOTrace::CallName(Call call) {
+  switch (call) {
+    case Call::kRead:
+      return "read";
+    case Call::kWrite:
+      return "write";
+    case Call::kSeek:
+      return "seek";
+    case Call::kBlkIoctl:
+      return "ioctl";
+    case Call::kFlush:
+      return "flush";
+    case Call::kCopyRange:
+      return "copy_range";
+  }
+  return "unknown";
+}
+
+bool TracingFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  offset_ = 0;
+  file_ = trace_->AddFile(path, flags);
+  return fd_->Open(path, flags, mode);
+}
+
+bool TracingFileDescriptor::Open(const char* path, int flags) {
+  offset_ = 0;
+  file_ = trace_->AddFile(path, flags);
+  return fd_->Open(path, flags);
+}
+
+ssize_t TracingFileDescriptor::Read(void* buf, size_t count) {
+  base::TimeTicks start = base::TimeTicks::Now();
+  ssize_t bytes_read = fd_->Read(buf, count);
+  trace_->Record(
+      IOTrace::Call::kRead, file_, 0, offset_, count, bytes_read, start);
+  if (bytes_read > 0)
+    offset_ += bytes_read;
+  return bytes_read;
+}
+
+ssize_t TracingFileDescriptor::Write(const void* buf, size_t count) {
+  base::TimeTicks start = base::TimeTicks::Now();
+  ssize_t bytes_written = fd_->Write(buf, count);
+  trace_->Record(
+      IOTrace::Call::kWrite, file_, 0, offset_, count, bytes_written, start);
+  if (bytes_written > 0)
+    offset_ += bytes_written;
+  return bytes_written;
+}
+
+off64_t TracingFileDescriptor::Seek(off64_t offset, int whence) {
+  base::TimeTicks start = base::TimeTicks::Now();
+  off64_t result = fd_->Seek(offset, whence);
+  trace_->Record(IOTrace::Call::kSeek, file_, whence, offset, 0, result, start);
+  if (result >= 0)
+    offset_ = result;
+  return result;
+}
+
+bool TracingFileDescriptor::BlkIoctl(int request,
+                                     uint64_t start,
+                                     uint64_t length,
+                                     int* result) {
+  base::TimeTicks start_time = base::TimeTicks::Now();
+  bool success = fd_->BlkIoctl(request, start, length, result);
+  trace_->Record(IOTrace::Call::kBlkIoctl,
+                 file_,
+                 request,
+                 start,
+                 length,
+                 success ? *result : -1,
+                 start_time);
+  return success;
+}
+
+bool TracingFileDescriptor::CopyRangeFrom(FileDescriptor* source,
+                                          uint64_t source_offset,
+                                          uint64_t offset,
+                                          uint64_t length) {
+  base::TimeTicks start = base::TimeTicks::Now();
+  bool success = fd_->CopyRangeFrom(source, source_offset, offset, length);
+  trace_->Record(IOTrace::Call::kCopyRange,
+                 file_,
+                 0,
+                 offset,
+                 length,
+                 success ? 0 : -1,
+                 start);
+  return success;
+}
+
+bool TracingFileDescriptor::Flush() {
+  base::TimeTicks start = base::TimeTicks::Now();
+  bool success = fd_->Flush();
+  trace_->Record(
+      IOTrace::Call::kFlush, file_, 0, 0, 0, success ? 0 : -1, start);
+  return success;
+}
+
+}  // namespace chromeos_update_engine
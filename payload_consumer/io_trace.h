@@ -0,0 +1,174 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_IO_TRACE_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_IO_TRACE_H_
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/time/time.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// Records the calls made to the FileDescriptor of the partitions, with their
+// start time, duration and size, and writes them to a compact binary trace
+// which the io_trace_replay tool re-issues against a block device to time
+// them again, e.g. with another kernel or I/O scheduler. It is shared by all
+// the TracingFileDescriptor of an update, and is thread safe.
+//
+// The trace starts with the 8 bytes of |kMagic|, followed by the number of
+// files as a 32-bit value and, for each of them, its open flags, the 32-bit
+// length of its path and the path. Then come the 64-bit number of events and
+// the events of |kEventSize| bytes each, in the order they started. All the
+// numbers are little endian.
+class IOTrace {
+ public:
+  enum class Call : uint8_t {
+    kRead,
+    kWrite,
+    kSeek,
+    kBlkIoctl,
+    kFlush,
+    kCopyRange,
+  };
+
+  struct Event {
+    // The time since the trace was created.
+    base::TimeDelta start;
+    base::TimeDelta duration;
+    // The index of the file in files().
+    uint16_t file{0};
+    Call call{Call::kRead};
+    // The ioctl request of a kBlkIoctl and the whence of a kSeek.
+    uint32_t request{0};
+    // The offset and length of the data read, written, copied or passed to
+    // the ioctl. The offset passed to a kSeek.
+    uint64_t offset{0};
+    uint64_t length{0};
+    // The value returned by the call, or -1 on failure.
+    int64_t result{0};
+  };
+
+  struct File {
+    std::string path;
+    int flags{0};
+  };
+
+  static const char kMagic[];
+  static const size_t kEventSize;
+  // The maximum number of events recorded, to bound the memory used by the
+  // trace. The later events are dropped.
+  static const size_t kMaxEvents;
+
+  IOTrace();
+
+  // Returns the index of the file |path|, adding it to the trace with its
+  // open |flags| the first time.
+  uint16_t AddFile(const std::string& path, int flags);
+
+  // Records a |call| to |file| which started at |start| and returned
+  // |result|.
+  void Record(Call call,
+              uint16_t file,
+              uint32_t request,
+              uint64_t offset,
+              uint64_t length,
+              int64_t result,
+              base::TimeTicks start);
+
+  // The recorded files and events, which must not be read while recording.
+  const std::vector<File>& files() const { return files_; }
+  const std::vector<Event>& events() const { return events_; }
+  size_t dropped_events() const { return dropped_events_; }
+
+  // Writes the trace to the file |path|. Returns whether it succeeded.
+  bool WriteTo(const std::string& path) const;
+
+  // Reads the trace written by WriteTo() to the file |path| in |files| and
+  // |events|. Returns false if it can't be read or isn't a valid trace.
+  static bool ReadFrom(const std::string& path,
+                       std::vector<File>* files,
+                       std::vector<Event>* events);
+
+  static const char* CallName(Call call);
+
+ private:
+  const base::TimeTicks origin_;
+
+  mutable base::Lock lock_;
+  std::vector<File> files_;
+  std::vector<Event> events_;
+  size_t dropped_events_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(IOTrace);
+};
+
+// A FileDescriptor which forwards all the calls to |fd| and records the
+// Read(), Write(), Seek(), BlkIoctl(), CopyRangeFrom() and Flush() calls in
+// an IOTrace, which must outlive it.
+class TracingFileDescriptor : public FileDescriptor {
+ public:
+  TracingFileDescriptor(FileDescriptorPtr fd, IOTrace* trace)
+      : fd_(fd), trace_(trace) {}
+  ~TracingFileDescriptor() override = default;
+
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override;
+  bool Readahead(uint64_t offset, uint64_t length) override {
+    return fd_->Readahead(offset, length);
+  }
+  bool DropCache(uint64_t offset, uint64_t length) override {
+    return fd_->DropCache(offset, length);
+  }
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override;
+  int GetNativeFd() override { return fd_->GetNativeFd(); }
+  bool Flush() override;
+  bool Close() override { return fd_->Close(); }
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_->IsOpen(); }
+
+ private:
+  FileDescriptorPtr fd_;
+  IOTrace* trace_;
+  // The index of the opened file in |trace_|.
+  uint16_t file_{0};
+  // The offset of the next Read() or Write() of |fd_|.
+  off64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(TracingFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_IO_TRACE_H_
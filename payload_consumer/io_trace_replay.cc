@@ -0,0 +1,213 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Replays an I/O trace recorded by the IOTrace of an update, re-issuing its
+// reads, writes, block device ioctls and flushes to the same offsets of the
+// recorded files, or of the ones passed in --files, to time them on another
+// device, kernel or I/O scheduler. The calls are issued one at a time in the
+// order they started, as fast as possible or, with --keep_timing, no sooner
+// than they started in the trace. The recorded seeks are not replayed since
+// each read and write seeks to its recorded offset, and the copied ranges are
+// written instead. The written data is a fixed pattern, so the files are
+// overwritten: pass --read_only to only replay the reads. For each kind of
+// call, the number of calls, the bytes and the total time in the trace and in
+// the replay are reported.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <base/strings/string_split.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+#include <brillo/flag_helper.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/io_trace.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+struct CallTotals {
+  uint64_t count{0};
+  uint64_t bytes{0};
+  uint64_t errors{0};
+  base::TimeDelta recorded;
+  base::TimeDelta replayed;
+};
+
+// Re-issues the recorded |event| to |fd|, using |buffer| for the data.
+// Returns whether the call succeeded.
+bool ReplayEvent(const IOTrace::Event& event,
+                 FileDescriptor* fd,
+                 brillo::Blob* buffer) {
+  switch (event.call) {
+    case IOTrace::Call::kRead:
+    case IOTrace::Call::kWrite:
+    case IOTrace::Call::kCopyRange:
+      if (fd->Seek(event.offset, SEEK_SET) !=
+          static_cast<off64_t>(event.offset))
+        return false;
+      // Like the recorded calls, a single read or write is issued, and the
+      // reads may be short at the end of the file.
+      if (event.call == IOTrace::Call::kRead)
+        return fd->Read(buffer->data(), event.length) >= 0;
+      return fd->Write(buffer->data(), event.length) ==
+             static_cast<ssize_t>(event.length);
+    case IOTrace::Call::kBlkIoctl: {
+      int result;
+      return fd->BlkIoctl(event.request, event.offset, event.length, &result) &&
+             result == 0;
+    }
+    case IOTrace::Call::kFlush:
+      return fd->Flush();
+    case IOTrace::Call::kSeek:
+      break;
+  }
+  return true;
+}
+
+int Main(int argc, char** argv) {
+  DEFINE_string(trace, "", "The I/O trace to replay.");
+  DEFINE_string(files,
+                "",
+                "Comma separated list of the files to replay the trace on, "
+                "replacing the recorded ones in order. Empty entries keep the "
+                "recorded file.");
+  DEFINE_bool(keep_timing,
+              false,
+              "Issue each call no sooner than it started in the trace, "
+              "instead of as fast as possible.");
+  DEFINE_bool(read_only,
+              false,
+              "Only replay the reads, opening the files read-only.");
+
+  brillo::FlagHelper::Init(argc, argv, "Replays an update I/O trace.");
+  logging::LoggingSettings log_settings;
+  log_settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(log_settings);
+
+  vector<IOTrace::File> files;
+  vector<IOTrace::Event> events;
+  if (FLAGS_trace.empty() ||
+      !IOTrace::ReadFrom(FLAGS_trace, &files, &events)) {
+    LOG(ERROR) << "Unable to read the I/O trace " << FLAGS_trace;
+    return 1;
+  }
+  vector<string> paths = base::SplitString(
+      FLAGS_files, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+  if (paths.size() > files.size()) {
+    LOG(ERROR) << "The trace only has " << files.size() << " files.";
+    return 1;
+  }
+
+  vector<FileDescriptorPtr> fds;
+  for (size_t i = 0; i < files.size(); i++) {
+    string path = i < paths.size() && !paths[i].empty() ? paths[i]
+                                                        : files[i].path;
+    // The files are replayed as they were opened, without creating them.
+    int flags = files[i].flags & ~(O_CREAT | O_TRUNC | O_EXCL);
+    if (FLAGS_read_only)
+      flags = (flags & ~O_ACCMODE) | O_RDONLY;
+    FileDescriptorPtr fd(new EintrSafeFileDescriptor);
+    if (!fd->Open(path.c_str(), flags)) {
+      PLOG(ERROR) << "Unable to open " << path;
+      return 1;
+    }
+    printf("file %zu: %s\n", i, path.c_str());
+    fds.push_back(fd);
+  }
+
+  uint64_t buffer_size = 0;
+  for (const IOTrace::Event& event : events) {
+    if (event.call != IOTrace::Call::kBlkIoctl)
+      buffer_size = std::max(buffer_size, event.length);
+  }
+  brillo::Blob buffer(buffer_size, 0xa5);
+
+  map<IOTrace::Call, CallTotals> totals;
+  base::TimeTicks replay_start = base::TimeTicks::Now();
+  for (const IOTrace::Event& event : events) {
+    if (event.call == IOTrace::Call::kSeek ||
+        (FLAGS_read_only && event.call != IOTrace::Call::kRead)) {
+      continue;
+    }
+    if (FLAGS_keep_timing) {
+      base::TimeDelta wait =
+          replay_start + event.start - base::TimeTicks::Now();
+      if (wait > base::TimeDelta())
+        base::PlatformThread::Sleep(wait);
+    }
+    base::TimeTicks start = base::TimeTicks::Now();
+    bool success = ReplayEvent(event, fds[event.file].get(), &buffer);
+    CallTotals& call_totals = totals[event.call];
+    call_totals.replayed += base::TimeTicks::Now() - start;
+    call_totals.recorded += event.duration;
+    call_totals.count++;
+    call_totals.bytes += event.call == IOTrace::Call::kFlush ? 0 : event.length;
+    if (!success)
+      call_totals.errors++;
+  }
+  base::TimeDelta replay_duration = base::TimeTicks::Now() - replay_start;
+  for (const FileDescriptorPtr& fd : fds)
+    fd->Close();
+
+  printf("%-10s %9s %14s %7s %12s %12s\n",
+         "call",
+         "count",
+         "bytes",
+         "errors",
+         "recorded ms",
+         "replayed ms");
+  for (const auto& entry : totals) {
+    printf("%-10s %9" PRIu64 " %14" PRIu64 " %7" PRIu64 " %12" PRId64
+           " %12" PRId64 "\n",
+           IOTrace::CallName(entry.first),
+           entry.second.count,
+           entry.second.bytes,
+           entry.second.errors,
+           entry.second.recorded.InMilliseconds(),
+           entry.second.replayed.InMilliseconds());
+  }
+  base::TimeDelta trace_duration;
+  if (!events.empty())
+    trace_duration = events.back().start + events.back().duration;
+  printf("trace: %" PRId64 " ms, replay: %" PRId64 " ms\n",
+         trace_duration.InMilliseconds(),
+         replay_duration.InMilliseconds());
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  return chromeos_update_engine::Main(argc, argv);
+}
@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/io_trace.h"
+
+#include <fcntl.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class IOTraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fd_.reset(new TracingFileDescriptor(
+        FileDescriptorPtr(new EintrSafeFileDescriptor), &trace_));
+    ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR));
+  }
+
+  IOTrace trace_;
+  test_utils::ScopedTempFile temp_file_{"IOTraceTest-file.XXXXXX"};
+  FileDescriptorPtr fd_;
+};
+
+TEST_F(IOTraceTest, RecordCallsTest) {
+  const string data = "some data";
+  EXPECT_EQ(static_cast<ssize_t>(data.size()),
+            fd_->Write(data.data(), data.size()));
+  EXPECT_EQ(2, fd_->Seek(2, SEEK_SET));
+  char buf[16];
+  EXPECT_EQ(static_cast<ssize_t>(data.size() - 2), fd_->Read(buf, sizeof(buf)));
+  EXPECT_TRUE(fd_->Flush());
+  EXPECT_TRUE(fd_->Close());
+
+  ASSERT_EQ(1U, trace_.files().size());
+  EXPECT_EQ(temp_file_.path(), trace_.files()[0].path);
+  EXPECT_EQ(O_RDWR, trace_.files()[0].flags);
+  const vector<IOTrace::Event>& events = trace_.events();
+  ASSERT_EQ(4U, events.size());
+  EXPECT_EQ(IOTrace::Call::kWrite, events[0].call);
+  EXPECT_EQ(0U, events[0].offset);
+  EXPECT_EQ(data.size(), events[0].length);
+  EXPECT_EQ(static_cast<int64_t>(data.size()), events[0].result);
+  EXPECT_EQ(IOTrace::Call::kSeek, events[1].call);
+  EXPECT_EQ(static_cast<uint32_t>(SEEK_SET), events[1].request);
+  EXPECT_EQ(2U, events[1].offset);
+  // The read starts at the offset set by the seek.
+  EXPECT_EQ(IOTrace::Call::kRead, events[2].call);
+  EXPECT_EQ(2U, events[2].offset);
+  EXPECT_EQ(sizeof(buf), events[2].length);
+  EXPECT_EQ(static_cast<int64_t>(data.size() - 2), events[2].result);
+  EXPECT_EQ(IOTrace::Call::kFlush, events[3].call);
+  EXPECT_LE(events[0].start, events[3].start);
+}
+
+TEST_F(IOTraceTest, WriteAndReadTest) {
+  const string data = "data";
+  EXPECT_EQ(static_cast<ssize_t>(data.size()),
+            fd_->Write(data.data(), data.size()));
+  // Opening the same file again reuses its index.
+  EXPECT_EQ(0U, trace_.AddFile(temp_file_.path(), O_RDWR));
+  EXPECT_EQ(1U, trace_.AddFile("/dev/other", O_RDONLY));
+
+  test_utils::ScopedTempFile trace_file("IOTraceTest-trace.XXXXXX");
+  EXPECT_TRUE(trace_.WriteTo(trace_file.path()));
+  vector<IOTrace::File> files;
+  vector<IOTrace::Event> events;
+  EXPECT_TRUE(IOTrace::ReadFrom(trace_file.path(), &files, &events));
+  ASSERT_EQ(2U, files.size());
+  EXPECT_EQ(temp_file_.path(), files[0].path);
+  EXPECT_EQ("/dev/other", files[1].path);
+  EXPECT_EQ(O_RDONLY, files[1].flags);
+  ASSERT_EQ(1U, events.size());
+  EXPECT_EQ(IOTrace::Call::kWrite, events[0].call);
+  EXPECT_EQ(0U, events[0].file);
+  EXPECT_EQ(data.size(), events[0].length);
+  EXPECT_EQ(trace_.events()[0].start, events[0].start);
+  EXPECT_EQ(trace_.events()[0].duration, events[0].duration);
+
+  // A file which isn't a trace is rejected.
+  EXPECT_FALSE(IOTrace::ReadFrom(temp_file_.path(), &files, &events));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/metadata_prefetcher.h"
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+MetadataPrefetcher::MetadataPrefetcher(HttpFetcher* http_fetcher)
+    : http_fetcher_(http_fetcher) {
+  http_fetcher_->set_delegate(this);
+}
+
+MetadataPrefetcher::~MetadataPrefetcher() {
+  Cancel();
+}
+
+void MetadataPrefetcher::Start(const string& url, off_t offset, size_t size) {
+  Cancel();
+  LOG(INFO) << "Prefetching the first " << size << " bytes of the payload.";
+  url_ = url;
+  offset_ = offset;
+  size_ = size;
+  data_.reserve(size);
+  active_ = true;
+  http_fetcher_->SetOffset(offset);
+  http_fetcher_->SetLength(size);
+  http_fetcher_->BeginTransfer(url);
+}
+
+void MetadataPrefetcher::Cancel() {
+  if (active_) {
+    active_ = false;
+    http_fetcher_->TerminateTransfer();
+  }
+  complete_ = false;
+  data_.clear();
+}
+
+bool MetadataPrefetcher::TakeData(const string& url,
+                                  off_t offset,
+                                  size_t size,
+                                  brillo::Blob* data) {
+  bool usable = complete_ && url == url_ && offset == offset_ && size == size_;
+  if (usable) {
+    *data = std::move(data_);
+  } else if (active_) {
+    LOG(INFO) << "The payload prefetch isn't complete, downloading it again.";
+  }
+  Cancel();
+  return usable;
+}
+
+void MetadataPrefetcher::ReceivedBytes(HttpFetcher* fetcher,
+                                       const void* bytes,
+                                       size_t length) {
+  if (!active_)
+    return;
+  // The fetchers not supporting a length send the rest of the file, which is
+  // dropped and no longer downloaded once the prefetched range is complete.
+  length = std::min(length, size_ - data_.size());
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  data_.insert(data_.end(), data, data + length);
+  if (data_.size() == size_) {
+    active_ = false;
+    complete_ = true;
+    http_fetcher_->TerminateTransfer();
+  }
+}
+
+void MetadataPrefetcher::TransferComplete(HttpFetcher* fetcher,
+                                          bool successful) {
+  if (!active_)
+    return;
+  active_ = false;
+  complete_ = successful && data_.size() == size_;
+  if (!complete_) {
+    LOG(WARNING) << "The payload prefetch failed after " << data_.size()
+                 << " bytes.";
+    data_.clear();
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,84 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_METADATA_PREFETCHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_METADATA_PREFETCHER_H_
+
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/http_fetcher.h"
+
+namespace chromeos_update_engine {
+
+// Downloads the first bytes of a payload, holding its metadata, as soon as
+// the Omaha response is handled, while the download started event is sent
+// and the DownloadAction waits to run. The DownloadAction then passes them to
+// its DeltaPerformer, which parses and verifies the manifest right away, and
+// only downloads the rest of the payload.
+class MetadataPrefetcher : public HttpFetcherDelegate {
+ public:
+  // Takes ownership of |http_fetcher|.
+  explicit MetadataPrefetcher(HttpFetcher* http_fetcher);
+  ~MetadataPrefetcher() override;
+
+  // Starts downloading the |size| bytes at |offset| of |url|, canceling the
+  // prefetch in progress, if any.
+  void Start(const std::string& url, off_t offset, size_t size);
+
+  // Stops the prefetch in progress, if any, and drops its bytes.
+  void Cancel();
+
+  // Moves the prefetched bytes to |data| and returns true if all the |size|
+  // bytes at |offset| of |url| were downloaded. The prefetch is canceled and
+  // false returned otherwise, including while it is in progress: it is only
+  // useful when its bytes are there before the DownloadAction needs them.
+  bool TakeData(const std::string& url,
+                off_t offset,
+                size_t size,
+                brillo::Blob* data);
+
+  // HttpFetcherDelegate overrides.
+  void ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override;
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+
+ private:
+  std::unique_ptr<HttpFetcher> http_fetcher_;
+
+  // The range prefetched, and the bytes received so far.
+  std::string url_;
+  off_t offset_{0};
+  size_t size_{0};
+  brillo::Blob data_;
+
+  // Whether the transfer is in progress, and whether all the bytes were
+  // received once it isn't.
+  bool active_{false};
+  bool complete_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(MetadataPrefetcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_METADATA_PREFETCHER_H_
@@ -0,0 +1,106 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/metadata_prefetcher.h"
+
+#include <string>
+#include <vector>
+
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/mock_http_fetcher.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+const char kUrl[] = "http://example.com/payload";
+const char kPayload[] = "0123456789abcdef";
+}  // namespace
+
+class MetadataPrefetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  MockHttpFetcher* fetcher_ =
+      new MockHttpFetcher(kPayload, sizeof(kPayload) - 1, nullptr);
+  MetadataPrefetcher prefetcher_{fetcher_};
+};
+
+TEST_F(MetadataPrefetcherTest, PrefetchTest) {
+  prefetcher_.Start(kUrl, 2, 5);
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+
+  // Only the requested bytes are kept, and they are only taken once.
+  brillo::Blob data;
+  EXPECT_TRUE(prefetcher_.TakeData(kUrl, 2, 5, &data));
+  EXPECT_EQ("23456", string(data.begin(), data.end()));
+  EXPECT_FALSE(prefetcher_.TakeData(kUrl, 2, 5, &data));
+}
+
+TEST_F(MetadataPrefetcherTest, FetcherIgnoringLengthTest) {
+  // The mock fetcher ignores the length, and sends this payload in three
+  // chunks.
+  vector<char> payload(kMockHttpFetcherChunkSize * 3, 'x');
+  MockHttpFetcher* fetcher =
+      new MockHttpFetcher(payload.data(), payload.size(), nullptr);
+  MetadataPrefetcher prefetcher(fetcher);
+  prefetcher.Start(kUrl, 0, 5);
+  brillo::MessageLoopRunMaxIterations(&loop_, 1);
+
+  // The transfer is terminated once the first chunk holds the range.
+  EXPECT_FALSE(loop_.PendingTasks());
+  brillo::Blob data;
+  EXPECT_TRUE(prefetcher.TakeData(kUrl, 0, 5, &data));
+  EXPECT_EQ(brillo::Blob(5, 'x'), data);
+}
+
+TEST_F(MetadataPrefetcherTest, OtherRangeTest) {
+  prefetcher_.Start(kUrl, 0, 5);
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+
+  brillo::Blob data;
+  EXPECT_FALSE(prefetcher_.TakeData(kUrl, 0, 6, &data));
+  EXPECT_TRUE(data.empty());
+}
+
+TEST_F(MetadataPrefetcherTest, FailedTransferTest) {
+  fetcher_->FailTransfer(404);
+  prefetcher_.Start(kUrl, 0, 5);
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+
+  brillo::Blob data;
+  EXPECT_FALSE(prefetcher_.TakeData(kUrl, 0, 5, &data));
+}
+
+TEST_F(MetadataPrefetcherTest, TakeDataInProgressTest) {
+  prefetcher_.Start(kUrl, 0, 5);
+
+  // The transfer is terminated instead of waited for.
+  brillo::Blob data;
+  EXPECT_FALSE(prefetcher_.TakeData(kUrl, 0, 5, &data));
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+  EXPECT_FALSE(prefetcher_.TakeData(kUrl, 0, 5, &data));
+}
+
+}  // namespace chromeos_update_engine
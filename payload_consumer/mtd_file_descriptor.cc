@@ -22,6 +22,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 
@@ -179,6 +180,7 @@ bool UbiFileDescriptor::Open(const char* path, int flags, mode_t mode) {
   if (!info) {
     return false;
   }
+  TEST_AND_RETURN_FALSE(info->eraseblock_size > 0);
 
   // This File Descriptor does not support read and write.
   TEST_AND_RETURN_FALSE((flags & O_ACCMODE) != O_RDWR);
@@ -201,6 +203,8 @@ bool UbiFileDescriptor::Open(const char* path, int flags, mode_t mode) {
     }
     mode_ = kWriteOnly;
     nr_written_ = 0;
+    write_buffer_.clear();
+    write_buffer_.reserve(eraseblock_size_);
   } else {
     mode_ = kReadOnly;
   }
@@ -221,11 +225,54 @@ ssize_t UbiFileDescriptor::Read(void* buf, size_t count) {
 
 ssize_t UbiFileDescriptor::Write(const void* buf, size_t count) {
   CHECK(mode_ == kWriteOnly);
-  ssize_t nr_chunk = EintrSafeFileDescriptor::Write(buf, count);
-  if (nr_chunk >= 0) {
-    nr_written_ += nr_chunk;
+  const uint8_t* bytes = static_cast<const uint8_t*>(buf);
+  size_t remaining = count;
+  while (remaining > 0) {
+    if (write_buffer_.empty() && remaining >= eraseblock_size_) {
+      // The whole eraseblocks are written without copying them.
+      size_t length = remaining - remaining % eraseblock_size_;
+      if (!WriteToVolume(bytes, length))
+        return -1;
+      bytes += length;
+      remaining -= length;
+      continue;
+    }
+    size_t length =
+        std::min<uint64_t>(remaining, eraseblock_size_ - write_buffer_.size());
+    write_buffer_.insert(write_buffer_.end(), bytes, bytes + length);
+    bytes += length;
+    remaining -= length;
+    if (write_buffer_.size() == eraseblock_size_ && !FlushWriteBuffer())
+      return -1;
+  }
+  nr_written_ += count;
+  return count;
+}
+
+bool UbiFileDescriptor::WriteToVolume(const void* buf, size_t count) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(buf);
+  while (count > 0) {
+    ssize_t nr_chunk = EintrSafeFileDescriptor::Write(bytes, count);
+    if (nr_chunk < 0) {
+      PLOG(ERROR) << "Cannot write to the UBI volume";
+      return false;
+    }
+    bytes += nr_chunk;
+    count -= nr_chunk;
   }
-  return nr_chunk;
+  return true;
+}
+
+bool UbiFileDescriptor::FlushWriteBuffer() {
+  bool result = WriteToVolume(write_buffer_.data(), write_buffer_.size());
+  write_buffer_.clear();
+  return result;
+}
+
+bool UbiFileDescriptor::Flush() {
+  if (mode_ == kWriteOnly && !FlushWriteBuffer())
+    return false;
+  return EintrSafeFileDescriptor::Flush();
 }
 
 off64_t UbiFileDescriptor::Seek(off64_t offset, int whence) {
@@ -239,25 +286,26 @@ off64_t UbiFileDescriptor::Seek(off64_t offset, int whence) {
 bool UbiFileDescriptor::Close() {
   bool pad_ok = true;
   if (IsOpen() && mode_ == kWriteOnly) {
-    char buf[1024];
-    memset(buf, 0xFF, sizeof(buf));
-    while (nr_written_ < volume_size_) {
-      // We have written less than the whole volume. In order for us to clear
-      // the update marker, we need to fill the rest. It is recommended to fill
-      // UBI writes with 0xFF.
-      uint64_t to_write = volume_size_ - nr_written_;
-      if (to_write > sizeof(buf)) {
-        to_write = sizeof(buf);
-      }
-      ssize_t nr_chunk = EintrSafeFileDescriptor::Write(buf, to_write);
-      if (nr_chunk < 0) {
+    // We have written less than the whole volume. In order for us to clear
+    // the update marker, we need to fill the rest. It is recommended to fill
+    // UBI writes with 0xFF. The padding completes the buffered eraseblock
+    // first, then fills whole eraseblocks.
+    brillo::Blob padding(eraseblock_size_, 0xFF);
+    while (pad_ok && nr_written_ < volume_size_) {
+      uint64_t to_write = std::min<uint64_t>(
+          volume_size_ - nr_written_,
+          eraseblock_size_ - write_buffer_.size());
+      if (Write(padding.data(), to_write) < 0) {
         LOG(ERROR) << "Cannot 0xFF-pad before closing.";
         // There is an error, but we can't really do any meaningful thing here.
         pad_ok = false;
-        break;
       }
-      nr_written_ += nr_chunk;
     }
+    if (pad_ok && !FlushWriteBuffer()) {
+      LOG(ERROR) << "Cannot 0xFF-pad before closing.";
+      pad_ok = false;
+    }
+    write_buffer_ = brillo::Blob();
   }
   return EintrSafeFileDescriptor::Close() && pad_ok;
 }
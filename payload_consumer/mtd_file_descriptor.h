@@ -22,6 +22,8 @@
 
 #include <mtdutils.h>
 
+#include <brillo/secure_blob.h>
+
 #include "update_engine/payload_consumer/file_descriptor.h"
 
 namespace chromeos_update_engine {
@@ -47,6 +49,13 @@ class MtdFileDescriptor : public EintrSafeFileDescriptor {
                 int* result) override {
     return false;
   }
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override {
+    return false;
+  }
+  int GetNativeFd() override { return -1; }
   bool Close() override;
 
  private:
@@ -65,7 +74,9 @@ struct UbiVolumeInfo {
 // A file descriptor to update a UBI volume, similar to MtdFileDescriptor.
 // Once the file descriptor is opened for write, the volume is marked as being
 // updated. The volume will not be usable until an update is completed. See
-// UBI_IOCVOLUP ioctl operation.
+// UBI_IOCVOLUP ioctl operation. The writes are buffered and passed to the
+// volume in whole eraseblocks, which UBI writes at once, instead of in the
+// sizes of the extents written.
 class UbiFileDescriptor : public EintrSafeFileDescriptor {
  public:
   // Perform some queries about |path| to see if it is a UBI volume.
@@ -83,6 +94,14 @@ class UbiFileDescriptor : public EintrSafeFileDescriptor {
                 int* result) override {
     return false;
   }
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override {
+    return false;
+  }
+  int GetNativeFd() override { return -1; }
+  bool Flush() override;
   bool Close() override;
 
  private:
@@ -97,6 +116,17 @@ class UbiFileDescriptor : public EintrSafeFileDescriptor {
   uint64_t nr_written_;
 
   Mode mode_;
+
+  // Writes the |count| bytes at |buf| to the volume, which UBI accepts in
+  // any size. Returns whether it succeeded.
+  bool WriteToVolume(const void* buf, size_t count);
+
+  // Writes the bytes in |write_buffer_| to the volume and clears it. Returns
+  // whether it succeeded.
+  bool FlushWriteBuffer();
+
+  // The written bytes not passed to the volume yet, less than an eraseblock.
+  brillo::Blob write_buffer_;
 };
 
 }  // namespace chromeos_update_engine
@@ -0,0 +1,235 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_pipeline.h"
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+
+namespace chromeos_update_engine {
+
+// The thread delegate running the main loop of one of the workers.
+class OperationPipeline::Worker : public base::DelegateSimpleThread::Delegate {
+ public:
+  Worker(OperationPipeline* pipeline, size_t index)
+      : pipeline_(pipeline), index_(index) {}
+  ~Worker() override = default;
+
+  // DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    if (pipeline_->io_limiter_)
+      pipeline_->io_limiter_->RegisterCurrentThread();
+    pipeline_->RunWorker(index_);
+    if (pipeline_->io_limiter_)
+      pipeline_->io_limiter_->UnregisterCurrentThread();
+  }
+
+ private:
+  OperationPipeline* pipeline_;
+  size_t index_;
+
+  DISALLOW_COPY_AND_ASSIGN(Worker);
+};
+
+OperationPipeline::OperationPipeline(size_t num_workers,
+                                     size_t max_pending_tasks,
+                                     size_t max_pending_bytes)
+    : num_workers_(num_workers),
+      max_pending_tasks_(max_pending_tasks),
+      max_pending_bytes_(max_pending_bytes),
+      max_active_workers_(num_workers) {
+  CHECK_GT(num_workers_, 0U);
+  CHECK_GT(max_pending_tasks_, 0U);
+}
+
+OperationPipeline::~OperationPipeline() {
+  Stop();
+}
+
+void OperationPipeline::Start() {
+  CHECK(threads_.empty());
+  for (size_t i = 0; i < num_workers_; i++) {
+    workers_.emplace_back(new Worker(this, i));
+    threads_.emplace_back(new base::DelegateSimpleThread(
+        workers_.back().get(), base::StringPrintf("apply-worker-%zu", i)));
+    threads_.back()->Start();
+  }
+}
+
+bool OperationPipeline::Push(const Task& task,
+                             size_t size,
+                             ExtentSpan dst_extents,
+                             bool exclusive) {
+  base::AutoLock auto_lock(lock_);
+  while (!failed_ && !stopping_ && !queue_.empty() &&
+         (queue_.size() >= max_pending_tasks_ ||
+          pending_bytes_ + size > max_pending_bytes_)) {
+    cond_.Wait();
+  }
+  if (failed_ || stopping_)
+    return false;
+  queue_.push_back({task, size, dst_extents, exclusive, TaskState::kQueued});
+  pending_bytes_ += size;
+  cond_.Broadcast();
+  return true;
+}
+
+bool OperationPipeline::Drain(ErrorCode* error) {
+  base::AutoLock auto_lock(lock_);
+  while (!stopping_ && (failed_ ? num_running_ > 0 : !queue_.empty()))
+    cond_.Wait();
+  if (failed_) {
+    *error = error_;
+    return false;
+  }
+  return true;
+}
+
+void OperationPipeline::Stop() {
+  {
+    base::AutoLock auto_lock(lock_);
+    stopping_ = true;
+    cond_.Broadcast();
+  }
+  // The workers finish their running task, if any, before exiting.
+  for (auto& thread : threads_)
+    thread->Join();
+  threads_.clear();
+  workers_.clear();
+
+  base::AutoLock auto_lock(lock_);
+  if (!queue_.empty()) {
+    LOG(INFO) << "Discarding " << queue_.size() << " pending operations.";
+    queue_.clear();
+    pending_bytes_ = 0;
+  }
+}
+
+bool OperationPipeline::HasFailed(ErrorCode* error) const {
+  base::AutoLock auto_lock(lock_);
+  if (failed_)
+    *error = error_;
+  return failed_;
+}
+
+void OperationPipeline::SetMaxActiveWorkers(size_t max_workers) {
+  max_workers = std::min(std::max<size_t>(max_workers, 1), num_workers_);
+  base::AutoLock auto_lock(lock_);
+  if (max_active_workers_ == max_workers)
+    return;
+  max_active_workers_ = max_workers;
+  cond_.Broadcast();
+}
+
+size_t OperationPipeline::num_completed() const {
+  base::AutoLock auto_lock(lock_);
+  return num_completed_;
+}
+
+bool OperationPipeline::TasksOverlap(const PendingTask& a,
+                                     const PendingTask& b) {
+  for (const Extent& ext_a : a.dst_extents) {
+    if (ext_a.start_block() == kSparseHole)
+      continue;
+    for (const Extent& ext_b : b.dst_extents) {
+      if (ext_b.start_block() == kSparseHole)
+        continue;
+      if (ext_a.start_block() < ext_b.start_block() + ext_b.num_blocks() &&
+          ext_b.start_block() < ext_a.start_block() + ext_a.num_blocks()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t OperationPipeline::FindRunnableTask() const {
+  for (size_t i = 0; i < queue_.size(); i++) {
+    const PendingTask& candidate = queue_[i];
+    if (candidate.state != TaskState::kQueued)
+      continue;
+    bool runnable = true;
+    for (size_t j = 0; j < i && runnable; j++) {
+      const PendingTask& earlier = queue_[j];
+      if (earlier.state == TaskState::kDone)
+        continue;
+      runnable = !candidate.exclusive && !earlier.exclusive &&
+                 !TasksOverlap(candidate, earlier);
+    }
+    if (runnable)
+      return i;
+    // No later task can run ahead of an exclusive one.
+    if (candidate.exclusive)
+      break;
+  }
+  return queue_.size();
+}
+
+void OperationPipeline::RunWorker(size_t worker) {
+  base::AutoLock auto_lock(lock_);
+  while (true) {
+    size_t index = queue_.size();
+    while (!stopping_ && !failed_ &&
+           (num_running_ >= max_active_workers_ ||
+            (index = FindRunnableTask()) == queue_.size())) {
+      cond_.Wait();
+    }
+    if (stopping_ || failed_)
+      return;
+
+    queue_[index].state = TaskState::kRunning;
+    num_running_++;
+    // Copy the task since |queue_| may be modified while the lock is released.
+    // Tasks are only removed from the front of the queue, each one of them
+    // incrementing |num_completed_|, so |sequence| identifies this task.
+    Task task = queue_[index].task;
+    queue_[index].task.Reset();
+    size_t size = queue_[index].size;
+    size_t sequence = num_completed_ + index;
+
+    ErrorCode error = ErrorCode::kSuccess;
+    bool result;
+    {
+      base::AutoUnlock auto_unlock(lock_);
+      result = task.Run(worker, &error);
+      // Release the task, and with it the bound operation data, outside the
+      // lock.
+      task.Reset();
+    }
+
+    num_running_--;
+    pending_bytes_ -= size;
+    if (result) {
+      queue_[sequence - num_completed_].state = TaskState::kDone;
+      while (!queue_.empty() && queue_.front().state == TaskState::kDone) {
+        queue_.pop_front();
+        num_completed_++;
+      }
+    } else if (!failed_) {
+      failed_ = true;
+      error_ = (error == ErrorCode::kSuccess
+                    ? ErrorCode::kDownloadOperationExecutionError
+                    : error);
+    }
+    cond_.Broadcast();
+  }
+}
+
+}  // namespace chromeos_update_engine
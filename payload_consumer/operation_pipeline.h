@@ -0,0 +1,161 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_PIPELINE_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_PIPELINE_H_
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+
+#include "update_engine/common/error_code.h"
+#include "update_engine/common/io_limiter.h"
+#include "update_engine/payload_consumer/extent_span.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A bounded queue of tasks executed by a pool of worker threads. The
+// DeltaPerformer uses it to apply install operations while the download keeps
+// feeding new data: the producer blocks in Push() once the queue holds either
+// |max_pending_tasks| unfinished tasks or |max_pending_bytes| bytes of payload
+// data, which bounds the amount of memory held by queued operation blobs.
+//
+// A task only starts once every earlier task writing to any of the same blocks
+// finished, so with more than one worker the tasks writing to disjoint blocks
+// run concurrently. Tasks flagged as exclusive never run concurrently with any
+// other task. Once a task fails, the remaining queued tasks are discarded and
+// no new tasks are accepted.
+class OperationPipeline {
+ public:
+  // A unit of work run on the worker thread number |worker|, in the range
+  // [0, num_workers). Returns whether it succeeded and may set |error| to a
+  // specific error code on failure.
+  using Task = base::Callback<bool(size_t worker, ErrorCode* error)>;
+
+  OperationPipeline(size_t num_workers,
+                    size_t max_pending_tasks,
+                    size_t max_pending_bytes);
+  ~OperationPipeline();
+
+  // Registers the worker threads with |io_limiter|, not owned, so their I/O
+  // priority follows its mode. Must be called before Start().
+  void set_io_limiter(IOLimiter* io_limiter) { io_limiter_ = io_limiter; }
+
+  // Starts the worker threads. Must be called once before Push().
+  void Start();
+
+  // Queues |task|, which holds |size| bytes of payload data and writes to the
+  // blocks in |dst_extents|, blocking while the queue is full. A task is always
+  // accepted by an empty queue, regardless of its size. The |dst_extents| must
+  // stay valid until the task finished. If |exclusive|, the
+  // task waits for all the earlier tasks and the later tasks wait for it.
+  // Returns false without queuing the task if a previous task failed or the
+  // pipeline was stopped.
+  bool Push(const Task& task,
+            size_t size,
+            ExtentSpan dst_extents,
+            bool exclusive);
+
+  // Blocks until all the queued tasks finished. Returns whether all of them
+  // succeeded, storing the error code of the failed task in |error| otherwise.
+  bool Drain(ErrorCode* error);
+
+  // Discards the queued tasks which didn't start yet, waits for the running
+  // ones, if any, and joins the worker threads. Calling Stop() more than once
+  // is allowed.
+  void Stop();
+
+  // Returns whether a task failed, storing its error code in |error|.
+  bool HasFailed(ErrorCode* error) const;
+
+  // Returns the number of tasks that completed successfully, counting only
+  // from the first pushed task up to the first one not finished yet. Tasks that
+  // finished ahead of an unfinished earlier task aren't counted until that one
+  // finishes too.
+  size_t num_completed() const;
+
+  size_t num_workers() const { return num_workers_; }
+
+  // Limits the number of tasks running at the same time to |max_workers|,
+  // between 1 and num_workers(), which is the initial limit. It can be changed
+  // at any time: once lowered, the running tasks finish and no more than
+  // |max_workers| start again.
+  void SetMaxActiveWorkers(size_t max_workers);
+
+ private:
+  class Worker;
+
+  enum class TaskState {
+    kQueued,
+    kRunning,
+    kDone,
+  };
+
+  struct PendingTask {
+    Task task;
+    size_t size;
+    ExtentSpan dst_extents;
+    bool exclusive;
+    TaskState state;
+  };
+
+  // The main loop of the worker thread number |worker|.
+  void RunWorker(size_t worker);
+
+  // Returns the index in |queue_| of the first queued task that can start now,
+  // or |queue_.size()| if there is none. Must be called with |lock_| held.
+  size_t FindRunnableTask() const;
+
+  // Returns whether the tasks |a| and |b| write to a common block.
+  static bool TasksOverlap(const PendingTask& a, const PendingTask& b);
+
+  const size_t num_workers_;
+  const size_t max_pending_tasks_;
+  const size_t max_pending_bytes_;
+  IOLimiter* io_limiter_{nullptr};
+
+  // All the members below are protected by |lock_|. |cond_| is signaled every
+  // time one of them changes.
+  mutable base::Lock lock_;
+  base::ConditionVariable cond_{&lock_};
+
+  // The unfinished tasks in push order, plus the finished ones waiting for an
+  // earlier task to finish.
+  std::deque<PendingTask> queue_;
+  size_t pending_bytes_{0};
+  size_t num_running_{0};
+  size_t max_active_workers_;
+  bool stopping_{false};
+  bool failed_{false};
+  ErrorCode error_{ErrorCode::kSuccess};
+  size_t num_completed_{0};
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(OperationPipeline);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_PIPELINE_H_
@@ -0,0 +1,254 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_pipeline.h"
+
+#include <deque>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/synchronization/waitable_event.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+#include <gtest/gtest.h>
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+bool RecordTask(vector<int>* order, int id, size_t worker, ErrorCode* error) {
+  order->push_back(id);
+  return true;
+}
+
+bool FailTask(size_t worker, ErrorCode* error) {
+  *error = ErrorCode::kDownloadStateInitializationError;
+  return false;
+}
+
+bool BlockingTask(base::WaitableEvent* started,
+                  base::WaitableEvent* release,
+                  size_t worker,
+                  ErrorCode* error) {
+  started->Signal();
+  release->Wait();
+  return true;
+}
+
+}  // namespace
+
+class OperationPipelineTestBase : public ::testing::Test {
+ protected:
+  // Returns the extents of |num_blocks| blocks from |start_block|. They are
+  // kept until the test ends, since the pipeline doesn't copy them.
+  const vector<Extent>& Blocks(uint64_t start_block, uint64_t num_blocks) {
+    Extent extent;
+    extent.set_start_block(start_block);
+    extent.set_num_blocks(num_blocks);
+    extents_.push_back({extent});
+    return extents_.back();
+  }
+
+ private:
+  std::deque<vector<Extent>> extents_;
+};
+
+class OperationPipelineTest : public OperationPipelineTestBase {
+ protected:
+  // Queues |task| writing to the block |block| on |pipeline_|.
+  bool Push(const OperationPipeline::Task& task, size_t size, uint64_t block) {
+    return pipeline_.Push(task, size, Blocks(block, 1), false);
+  }
+
+  // A single worker, so the tasks run in push order.
+  OperationPipeline pipeline_{1, 4, 100};
+};
+
+TEST_F(OperationPipelineTest, RunsTasksInOrderTest) {
+  vector<int> order;
+  pipeline_.Start();
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(Push(base::Bind(&RecordTask, &order, i), 10 /* size */, i));
+  }
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(pipeline_.Drain(&error));
+  EXPECT_EQ(ErrorCode::kSuccess, error);
+  EXPECT_EQ(10U, pipeline_.num_completed());
+  EXPECT_EQ((vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}), order);
+}
+
+TEST_F(OperationPipelineTest, AcceptsBigTaskWhenEmptyTest) {
+  vector<int> order;
+  pipeline_.Start();
+  // A task bigger than the byte limit is still accepted by an empty queue.
+  EXPECT_TRUE(Push(base::Bind(&RecordTask, &order, 1), 1000, 1));
+  EXPECT_TRUE(Push(base::Bind(&RecordTask, &order, 2), 1000, 2));
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(pipeline_.Drain(&error));
+  EXPECT_EQ((vector<int>{1, 2}), order);
+}
+
+TEST_F(OperationPipelineTest, FailureStopsPipelineTest) {
+  vector<int> order;
+  base::WaitableEvent started(base::WaitableEvent::ResetPolicy::AUTOMATIC,
+                              base::WaitableEvent::InitialState::NOT_SIGNALED);
+  base::WaitableEvent release(base::WaitableEvent::ResetPolicy::AUTOMATIC,
+                              base::WaitableEvent::InitialState::NOT_SIGNALED);
+  pipeline_.Start();
+  // Hold the worker so the failing task and the one after it are queued
+  // together.
+  EXPECT_TRUE(Push(base::Bind(&BlockingTask, &started, &release), 0, 0));
+  started.Wait();
+  EXPECT_TRUE(Push(base::Bind(&FailTask), 0, 1));
+  EXPECT_TRUE(Push(base::Bind(&RecordTask, &order, 1), 0, 2));
+  release.Signal();
+
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_FALSE(pipeline_.Drain(&error));
+  EXPECT_EQ(ErrorCode::kDownloadStateInitializationError, error);
+  EXPECT_TRUE(pipeline_.HasFailed(&error));
+  EXPECT_EQ(1U, pipeline_.num_completed());
+  // The task after the failed one never runs and new tasks are rejected.
+  EXPECT_TRUE(order.empty());
+  EXPECT_FALSE(Push(base::Bind(&RecordTask, &order, 2), 0, 3));
+}
+
+TEST_F(OperationPipelineTest, StopDiscardsPendingTasksTest) {
+  vector<int> order;
+  base::WaitableEvent started(base::WaitableEvent::ResetPolicy::AUTOMATIC,
+                              base::WaitableEvent::InitialState::NOT_SIGNALED);
+  base::WaitableEvent release(base::WaitableEvent::ResetPolicy::AUTOMATIC,
+                              base::WaitableEvent::InitialState::NOT_SIGNALED);
+  pipeline_.Start();
+  EXPECT_TRUE(Push(base::Bind(&BlockingTask, &started, &release), 0, 0));
+  started.Wait();
+  EXPECT_TRUE(Push(base::Bind(&RecordTask, &order, 1), 0, 2));
+  // Let the running task finish once Stop() discarded the queued one.
+  release.Signal();
+  pipeline_.Stop();
+  EXPECT_LE(pipeline_.num_completed(), 2U);
+  EXPECT_FALSE(Push(base::Bind(&RecordTask, &order, 2), 0, 3));
+}
+
+class ParallelOperationPipelineTest : public OperationPipelineTestBase {
+ protected:
+  ParallelOperationPipelineTest()
+      : started_(base::WaitableEvent::ResetPolicy::MANUAL,
+                 base::WaitableEvent::InitialState::NOT_SIGNALED),
+        release_(base::WaitableEvent::ResetPolicy::MANUAL,
+                 base::WaitableEvent::InitialState::NOT_SIGNALED) {}
+
+  // Queues a task writing to |blocks| that blocks until |release_| is
+  // signaled.
+  void PushBlockingTask(const vector<Extent>& blocks, bool exclusive) {
+    EXPECT_TRUE(pipeline_.Push(
+        base::Bind(&BlockingTask, &started_, &release_), 0, blocks, exclusive));
+  }
+
+  base::WaitableEvent started_;
+  base::WaitableEvent release_;
+  OperationPipeline pipeline_{2, 4, 100};
+};
+
+TEST_F(ParallelOperationPipelineTest, DisjointTasksRunConcurrentlyTest) {
+  base::WaitableEvent second_started(
+      base::WaitableEvent::ResetPolicy::MANUAL,
+      base::WaitableEvent::InitialState::NOT_SIGNALED);
+  pipeline_.Start();
+  PushBlockingTask(Blocks(0, 10), false);
+  started_.Wait();
+  // The second task writes to other blocks, so it starts while the first one
+  // is still running.
+  EXPECT_TRUE(pipeline_.Push(
+      base::Bind(&BlockingTask, &second_started, &release_),
+      0,
+      Blocks(10, 10),
+      false));
+  second_started.Wait();
+  EXPECT_EQ(0U, pipeline_.num_completed());
+  release_.Signal();
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(pipeline_.Drain(&error));
+  EXPECT_EQ(2U, pipeline_.num_completed());
+}
+
+TEST_F(ParallelOperationPipelineTest, MaxActiveWorkersTest) {
+  base::WaitableEvent second_started(
+      base::WaitableEvent::ResetPolicy::MANUAL,
+      base::WaitableEvent::InitialState::NOT_SIGNALED);
+  pipeline_.SetMaxActiveWorkers(1);
+  pipeline_.Start();
+  PushBlockingTask(Blocks(0, 10), false);
+  started_.Wait();
+  // The second task doesn't overlap the first one, but only one task can run
+  // at a time.
+  EXPECT_TRUE(pipeline_.Push(
+      base::Bind(&BlockingTask, &second_started, &release_),
+      0,
+      Blocks(10, 10),
+      false));
+  EXPECT_FALSE(
+      second_started.TimedWait(base::TimeDelta::FromMilliseconds(50)));
+  // Raising the limit lets it start while the first one is still running.
+  pipeline_.SetMaxActiveWorkers(2);
+  second_started.Wait();
+  EXPECT_EQ(0U, pipeline_.num_completed());
+  release_.Signal();
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(pipeline_.Drain(&error));
+  EXPECT_EQ(2U, pipeline_.num_completed());
+}
+
+TEST_F(ParallelOperationPipelineTest, OverlappingTasksWaitTest) {
+  vector<int> order;
+  pipeline_.Start();
+  PushBlockingTask(Blocks(0, 10), false);
+  started_.Wait();
+  EXPECT_TRUE(pipeline_.Push(
+      base::Bind(&RecordTask, &order, 1), 0, Blocks(9, 1), false));
+  base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(50));
+  // The second task writes to a block of the first one, which is still
+  // running.
+  EXPECT_TRUE(order.empty());
+  release_.Signal();
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(pipeline_.Drain(&error));
+  EXPECT_EQ((vector<int>{1}), order);
+}
+
+TEST_F(ParallelOperationPipelineTest, ExclusiveTaskWaitsTest) {
+  vector<int> order;
+  pipeline_.Start();
+  PushBlockingTask(Blocks(0, 10), false);
+  started_.Wait();
+  EXPECT_TRUE(pipeline_.Push(
+      base::Bind(&RecordTask, &order, 1), 0, Blocks(20, 1), true));
+  // This one doesn't overlap any other task, but can't run ahead of the
+  // exclusive one.
+  EXPECT_TRUE(pipeline_.Push(
+      base::Bind(&RecordTask, &order, 2), 0, Blocks(30, 1), false));
+  base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(50));
+  EXPECT_TRUE(order.empty());
+  release_.Signal();
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(pipeline_.Drain(&error));
+  EXPECT_EQ((vector<int>{1, 2}), order);
+  EXPECT_EQ(3U, pipeline_.num_completed());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,128 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/p2p_file_writer.h"
+
+#include <unistd.h>
+
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+const base::TimeDelta P2PFileWriter::kMaxWriteWait =
+    base::TimeDelta::FromSeconds(2);
+
+P2PFileWriter::P2PFileWriter(int fd, size_t max_pending_bytes)
+    : fd_(fd), max_pending_bytes_(max_pending_bytes) {}
+
+P2PFileWriter::~P2PFileWriter() {
+  Stop();
+}
+
+void P2PFileWriter::Start() {
+  CHECK(!thread_);
+  thread_.reset(new base::DelegateSimpleThread(this, "p2p-writer"));
+  thread_->Start();
+}
+
+bool P2PFileWriter::Write(std::shared_ptr<const brillo::Blob> data,
+                          off_t offset) {
+  base::AutoLock auto_lock(lock_);
+  base::TimeTicks deadline = base::TimeTicks::Now() + kMaxWriteWait;
+  while (!failed_ && !stopping_ && !queue_.empty() &&
+         pending_bytes_ + data->size() > max_pending_bytes_) {
+    base::TimeDelta wait = deadline - base::TimeTicks::Now();
+    if (wait <= base::TimeDelta()) {
+      LOG(WARNING) << "The p2p file writes are " << pending_bytes_
+                   << " bytes behind, giving up on them.";
+      failed_ = true;
+      queue_.clear();
+      pending_bytes_ = 0;
+      cond_.Broadcast();
+      break;
+    }
+    cond_.TimedWait(wait);
+  }
+  if (failed_ || stopping_)
+    return false;
+  pending_bytes_ += data->size();
+  queue_.push_back({std::move(data), offset});
+  cond_.Broadcast();
+  return true;
+}
+
+bool P2PFileWriter::Flush() {
+  base::AutoLock auto_lock(lock_);
+  while (!failed_ && !queue_.empty())
+    cond_.Wait();
+  return !failed_;
+}
+
+void P2PFileWriter::Stop() {
+  {
+    base::AutoLock auto_lock(lock_);
+    stopping_ = true;
+    cond_.Broadcast();
+  }
+  if (thread_) {
+    thread_->Join();
+    thread_.reset();
+  }
+}
+
+void P2PFileWriter::Run() {
+  if (io_limiter_)
+    io_limiter_->RegisterCurrentThread();
+  base::AutoLock auto_lock(lock_);
+  while (true) {
+    while (!failed_ && !stopping_ && queue_.empty())
+      cond_.Wait();
+    // The writes queued before stopping are still done.
+    if (failed_ || queue_.empty())
+      break;
+
+    // Copy the write since the queue may be cleared while the lock is
+    // released. The front write stays queued until done, so Flush() waits for
+    // it.
+    PendingWrite write = queue_.front();
+    ssize_t written;
+    {
+      base::AutoUnlock auto_unlock(lock_);
+      written = pwrite(fd_, write.data->data(), write.data->size(),
+                       write.offset);
+    }
+    if (failed_)
+      break;
+    if (written != static_cast<ssize_t>(write.data->size())) {
+      PLOG(ERROR) << "Error writing " << write.data->size()
+                  << " bytes at file offset " << write.offset
+                  << " in p2p file";
+      failed_ = true;
+      queue_.clear();
+      pending_bytes_ = 0;
+    } else {
+      pending_bytes_ -= write.data->size();
+      queue_.pop_front();
+    }
+    cond_.Broadcast();
+  }
+  if (io_limiter_)
+    io_limiter_->UnregisterCurrentThread();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_P2P_FILE_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_P2P_FILE_WRITER_H_
+
+#include <sys/types.h>
+
+#include <deque>
+#include <memory>
+
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+#include <base/time/time.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/io_limiter.h"
+
+namespace chromeos_update_engine {
+
+// Writes the payload to the file shared via p2p on a dedicated thread, so
+// slow storage doesn't stall the download. The writes are queued up to
+// |max_pending_bytes|; once the queue is full, Write() waits for the writer
+// to catch up for at most |kMaxWriteWait|. If it doesn't, or a write fails,
+// the writer gives up: the queued writes are discarded and all the later
+// calls fail, so the file can be dropped from sharing.
+class P2PFileWriter : public base::DelegateSimpleThread::Delegate {
+ public:
+  // How long Write() waits for room in a full queue.
+  static const base::TimeDelta kMaxWriteWait;
+
+  // Writes to |fd|, which must stay open until Stop() returns.
+  P2PFileWriter(int fd, size_t max_pending_bytes);
+  ~P2PFileWriter() override;
+
+  // Registers the writer thread with |io_limiter|, not owned, so its I/O
+  // priority follows its mode. Must be called before Start().
+  void set_io_limiter(IOLimiter* io_limiter) { io_limiter_ = io_limiter; }
+
+  // Starts the writer thread. Must be called once before Write().
+  void Start();
+
+  // Queues the write of |data| at the file offset |offset|. The writes are
+  // done in order. A write is always accepted by an empty queue, regardless of
+  // its size. Returns false if the writer gave up.
+  bool Write(std::shared_ptr<const brillo::Blob> data, off_t offset);
+
+  // Blocks until all the queued writes are done. Returns whether all of them
+  // succeeded.
+  bool Flush();
+
+  // Finishes the queued writes, unless the writer gave up, and joins the
+  // writer thread. Calling Stop() more than once is allowed.
+  void Stop();
+
+  // DelegateSimpleThread::Delegate overrides.
+  void Run() override;
+
+ private:
+  struct PendingWrite {
+    std::shared_ptr<const brillo::Blob> data;
+    off_t offset;
+  };
+
+  const int fd_;
+  const size_t max_pending_bytes_;
+  IOLimiter* io_limiter_{nullptr};
+
+  // All the members below are protected by |lock_|. |cond_| is signaled every
+  // time one of them changes.
+  base::Lock lock_;
+  base::ConditionVariable cond_{&lock_};
+
+  // The writes not done yet, including the one in progress.
+  std::deque<PendingWrite> queue_;
+  size_t pending_bytes_{0};
+  bool stopping_{false};
+  bool failed_{false};
+
+  std::unique_ptr<base::DelegateSimpleThread> thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(P2PFileWriter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_P2P_FILE_WRITER_H_
@@ -0,0 +1,95 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/p2p_file_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class P2PFileWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fd_ = open(temp_file_.path().c_str(), O_RDWR);
+    ASSERT_GE(fd_, 0);
+  }
+
+  void TearDown() override { close(fd_); }
+
+  static std::shared_ptr<const brillo::Blob> MakeData(const string& data) {
+    return std::make_shared<brillo::Blob>(data.begin(), data.end());
+  }
+
+  string ReadFile() {
+    char buffer[64];
+    ssize_t size = pread(fd_, buffer, sizeof(buffer), 0);
+    EXPECT_GE(size, 0);
+    return string(buffer, size);
+  }
+
+  test_utils::ScopedTempFile temp_file_{"P2PFileWriterTest.XXXXXX"};
+  int fd_{-1};
+};
+
+TEST_F(P2PFileWriterTest, WriteTest) {
+  P2PFileWriter writer(fd_, 4);
+  writer.Start();
+  EXPECT_TRUE(writer.Write(MakeData("abc"), 0));
+  // The queue is full, so this write waits for the first one.
+  EXPECT_TRUE(writer.Write(MakeData("defg"), 3));
+  // A write larger than the queue is accepted once the queue is empty.
+  EXPECT_TRUE(writer.Write(MakeData("hijklmnop"), 7));
+  EXPECT_TRUE(writer.Flush());
+  EXPECT_EQ("abcdefghijklmnop", ReadFile());
+}
+
+TEST_F(P2PFileWriterTest, StopFinishesWritesTest) {
+  P2PFileWriter writer(fd_, 1024);
+  writer.Start();
+  EXPECT_TRUE(writer.Write(MakeData("abc"), 0));
+  EXPECT_TRUE(writer.Write(MakeData("X"), 1));
+  writer.Stop();
+  writer.Stop();
+  EXPECT_EQ("aXc", ReadFile());
+  // Nothing is written once stopped.
+  EXPECT_FALSE(writer.Write(MakeData("d"), 3));
+}
+
+TEST_F(P2PFileWriterTest, WriteFailureTest) {
+  int read_only_fd = open(temp_file_.path().c_str(), O_RDONLY);
+  ASSERT_GE(read_only_fd, 0);
+  P2PFileWriter writer(read_only_fd, 1024);
+  writer.Start();
+  // The failure is only reported by the calls after the write.
+  EXPECT_TRUE(writer.Write(MakeData("abc"), 0));
+  EXPECT_FALSE(writer.Flush());
+  EXPECT_FALSE(writer.Write(MakeData("def"), 3));
+  writer.Stop();
+  close(read_only_fd);
+  EXPECT_EQ("", ReadFile());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,168 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_cache_downloader.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/files/file_path.h>
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+using base::FilePath;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+// The bytes queued for the p2p file at most, before the writes wait for the
+// writer thread. The download is throttled by the writes, not the reverse.
+const size_t kMaxPendingBytes = 4 * 1024 * 1024;
+}  // namespace
+
+PayloadCacheDownloader::PayloadCacheDownloader(P2PManager* p2p_manager,
+                                               HttpFetcher* http_fetcher)
+    : p2p_manager_(p2p_manager), http_fetcher_(http_fetcher) {
+  http_fetcher_->set_delegate(this);
+}
+
+PayloadCacheDownloader::~PayloadCacheDownloader() {
+  Stop();
+}
+
+bool PayloadCacheDownloader::Start(const string& file_id,
+                                   uint64_t size,
+                                   const string& url) {
+  Stop();
+  file_id_ = file_id;
+  size_ = size;
+  if (!p2p_manager_->FileShare(file_id, size)) {
+    LOG(ERROR) << "Unable to create the p2p file " << file_id;
+    return false;
+  }
+  FilePath path = p2p_manager_->FileGetPath(file_id);
+  fd_ = open(path.value().c_str(), O_WRONLY);
+  if (fd_ == -1) {
+    PLOG(ERROR) << "Error opening file " << path.value();
+    return false;
+  }
+  // The file is made visible once the DownloadAction verified the payload
+  // when p2p is used for sharing, so it must be readable by p2p-http-server.
+  if (fchmod(fd_, 0644) != 0) {
+    PLOG(ERROR) << "Error setting mode 0644 on " << path.value();
+    CloseFile();
+    return false;
+  }
+  off_t file_size = utils::FileSize(fd_);
+  if (file_size < 0 || static_cast<uint64_t>(file_size) >= size) {
+    LOG_IF(ERROR, file_size < 0) << "Error getting the size of the p2p file";
+    CloseFile();
+    return false;
+  }
+  file_size_ = file_size;
+
+  writer_.reset(new P2PFileWriter(fd_, kMaxPendingBytes));
+  writer_->set_io_limiter(io_limiter_);
+  writer_->Start();
+  LOG(INFO) << "Downloading the payload " << url << " into " << path.value()
+            << " from offset " << file_size_ << ".";
+  active_ = true;
+  http_fetcher_->SetOffset(file_size_);
+  http_fetcher_->SetLength(size_ - file_size_);
+  http_fetcher_->BeginTransfer(url);
+  return true;
+}
+
+void PayloadCacheDownloader::Stop() {
+  if (active_) {
+    // The TransferTerminated() callback is ignored once inactive.
+    active_ = false;
+    http_fetcher_->TerminateTransfer();
+    LOG(INFO) << "Stopped the download into the p2p file " << file_id_
+              << " at offset " << file_size_ << ".";
+  }
+  CloseFile();
+}
+
+void PayloadCacheDownloader::Pause() {
+  if (active_)
+    http_fetcher_->Pause();
+}
+
+void PayloadCacheDownloader::Unpause() {
+  if (active_)
+    http_fetcher_->Unpause();
+}
+
+void PayloadCacheDownloader::CloseFile() {
+  if (writer_) {
+    LOG_IF(ERROR, !writer_->Flush())
+        << "Error writing the p2p file " << file_id_;
+    writer_.reset();
+  }
+  if (fd_ != -1) {
+    if (close(fd_) != 0)
+      PLOG(ERROR) << "Error closing the p2p file " << file_id_;
+    fd_ = -1;
+  }
+}
+
+void PayloadCacheDownloader::ReceivedBytes(HttpFetcher* fetcher,
+                                           const void* bytes,
+                                           size_t length) {
+  if (!active_)
+    return;
+  // The bytes past the payload sent by the fetchers not supporting a length
+  // are dropped.
+  length = std::min<uint64_t>(length, size_ - file_size_);
+  if (!length)
+    return;
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  if (!writer_->Write(std::make_shared<brillo::Blob>(data, data + length),
+                      file_size_)) {
+    // The bytes written so far are still resumed from.
+    LOG(ERROR) << "Error writing the p2p file " << file_id_
+               << ", stopping its download.";
+    Stop();
+    return;
+  }
+  file_size_ += length;
+}
+
+void PayloadCacheDownloader::TransferComplete(HttpFetcher* fetcher,
+                                              bool successful) {
+  if (!active_)
+    return;
+  active_ = false;
+  CloseFile();
+  if (file_size_ == size_) {
+    LOG(INFO) << "Downloaded the payload into the p2p file " << file_id_;
+  } else {
+    LOG(WARNING) << "The download into the p2p file " << file_id_
+                 << " failed at offset " << file_size_ << ".";
+  }
+}
+
+void PayloadCacheDownloader::TransferTerminated(HttpFetcher* fetcher) {
+  TransferComplete(fetcher, false);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_CACHE_DOWNLOADER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_CACHE_DOWNLOADER_H_
+
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+
+#include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/io_limiter.h"
+#include "update_engine/p2p_manager.h"
+#include "update_engine/payload_consumer/p2p_file_writer.h"
+
+namespace chromeos_update_engine {
+
+// Downloads a payload into its p2p file, which stays invisible, while the
+// DownloadAction downloads and applies the payloads before it. The
+// DownloadAction then reads the payload from the complete file, like the one
+// cached by a previous attempt. The size of the file is the resume state of
+// the payload: a download stopped before it is complete continues from there
+// when started again, in this attempt or the next one.
+class PayloadCacheDownloader : public HttpFetcherDelegate {
+ public:
+  // Takes ownership of |http_fetcher|. The |p2p_manager| is not owned.
+  PayloadCacheDownloader(P2PManager* p2p_manager, HttpFetcher* http_fetcher);
+  ~PayloadCacheDownloader() override;
+
+  // Registers the thread writing the p2p file with |io_limiter|, not owned.
+  void set_io_limiter(IOLimiter* io_limiter) { io_limiter_ = io_limiter; }
+
+  // Starts downloading the payload of |size| bytes at |url| into the p2p file
+  // |file_id|, from the end of the bytes already in the file. Returns false if
+  // the file can't be written, or is already complete.
+  bool Start(const std::string& file_id,
+             uint64_t size,
+             const std::string& url);
+
+  // Stops the download in progress, if any, keeping the bytes written.
+  void Stop();
+
+  // Pauses and resumes the download in progress.
+  void Pause();
+  void Unpause();
+
+  // Whether a download is in progress, and the p2p file it writes.
+  bool active() const { return active_; }
+  const std::string& file_id() const { return file_id_; }
+
+  // HttpFetcherDelegate overrides.
+  void ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override;
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+  void TransferTerminated(HttpFetcher* fetcher) override;
+
+ private:
+  // Finishes the queued writes and closes the p2p file.
+  void CloseFile();
+
+  P2PManager* p2p_manager_;
+  std::unique_ptr<HttpFetcher> http_fetcher_;
+  IOLimiter* io_limiter_{nullptr};
+
+  // The p2p file written, its expected size and the size of the bytes in it
+  // once the queued writes are done.
+  std::string file_id_;
+  uint64_t size_{0};
+  uint64_t file_size_{0};
+  int fd_{-1};
+  std::unique_ptr<P2PFileWriter> writer_;
+
+  bool active_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadCacheDownloader);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_CACHE_DOWNLOADER_H_
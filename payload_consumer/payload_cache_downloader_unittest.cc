@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_cache_downloader.h"
+
+#include <memory>
+#include <string>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_clock.h"
+#include "update_engine/common/mock_http_fetcher.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/fake_p2p_manager_configuration.h"
+#include "update_engine/update_manager/fake_update_manager.h"
+
+using base::FilePath;
+using std::string;
+using std::unique_ptr;
+
+namespace chromeos_update_engine {
+
+namespace {
+const char kUrl[] = "http://example.com/payload";
+const char kFileId[] = "cros_update_size_1234_hash_abcd";
+}  // namespace
+
+class PayloadCacheDownloaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    if (!test_utils::IsXAttrSupported(FilePath("/tmp")))
+      return;
+    p2p_manager_.reset(P2PManager::Construct(new FakeP2PManagerConfiguration(),
+                                             nullptr,
+                                             &fake_um_,
+                                             "cros_au",
+                                             3,
+                                             base::TimeDelta::FromDays(5)));
+    // Three chunks of the mock fetcher.
+    for (size_t i = 0; i < kMockHttpFetcherChunkSize * 3; i++)
+      data_ += 'a' + (i % 25);
+  }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  // Returns a downloader of |data_|, whose fetcher is set in |fetcher_|.
+  unique_ptr<PayloadCacheDownloader> CreateDownloader() {
+    fetcher_ = new MockHttpFetcher(data_.data(), data_.size(), nullptr);
+    return std::make_unique<PayloadCacheDownloader>(p2p_manager_.get(),
+                                                    fetcher_);
+  }
+
+  string ReadFile() {
+    string contents;
+    EXPECT_TRUE(base::ReadFileToString(p2p_manager_->FileGetPath(kFileId),
+                                       &contents));
+    return contents;
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  FakeClock fake_clock_;
+  chromeos_update_manager::FakeUpdateManager fake_um_{&fake_clock_};
+  unique_ptr<P2PManager> p2p_manager_;
+  MockHttpFetcher* fetcher_{nullptr};
+  string data_;
+};
+
+TEST_F(PayloadCacheDownloaderTest, DownloadsIntoInvisibleFileTest) {
+  if (!p2p_manager_) {
+    LOG(WARNING) << "Skipping test because /tmp does not support xattr.";
+    return;
+  }
+  auto downloader = CreateDownloader();
+  EXPECT_TRUE(downloader->Start(kFileId, data_.size(), kUrl));
+  EXPECT_TRUE(downloader->active());
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+  EXPECT_FALSE(downloader->active());
+
+  EXPECT_EQ(data_, ReadFile());
+  bool visible = true;
+  EXPECT_TRUE(p2p_manager_->FileGetVisible(kFileId, &visible));
+  EXPECT_FALSE(visible);
+
+  // A complete file isn't downloaded again.
+  EXPECT_FALSE(CreateDownloader()->Start(kFileId, data_.size(), kUrl));
+}
+
+TEST_F(PayloadCacheDownloaderTest, ResumesFromFileSizeTest) {
+  if (!p2p_manager_) {
+    LOG(WARNING) << "Skipping test because /tmp does not support xattr.";
+    return;
+  }
+  auto downloader = CreateDownloader();
+  EXPECT_TRUE(downloader->Start(kFileId, data_.size(), kUrl));
+  brillo::MessageLoopRunMaxIterations(&loop_, 1);
+  downloader->Stop();
+  EXPECT_FALSE(downloader->active());
+  EXPECT_EQ(data_.substr(0, kMockHttpFetcherChunkSize), ReadFile());
+
+  // The next download starts at the end of the bytes in the file.
+  downloader = CreateDownloader();
+  EXPECT_TRUE(downloader->Start(kFileId, data_.size(), kUrl));
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+  EXPECT_FALSE(downloader->active());
+  EXPECT_EQ(data_, ReadFile());
+}
+
+TEST_F(PayloadCacheDownloaderTest, DropsBytesPastThePayloadTest) {
+  if (!p2p_manager_) {
+    LOG(WARNING) << "Skipping test because /tmp does not support xattr.";
+    return;
+  }
+  // The mock fetcher ignores the length, and sends the whole |data_|.
+  auto downloader = CreateDownloader();
+  EXPECT_TRUE(downloader->Start(kFileId, 100, kUrl));
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+  EXPECT_FALSE(downloader->active());
+  EXPECT_EQ(data_.substr(0, 100), ReadFile());
+}
+
+}  // namespace chromeos_update_engine
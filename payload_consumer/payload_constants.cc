@@ -27,6 +27,8 @@ const uint32_t kSourceMinorPayloadVersion = 2;
 const uint32_t kOpSrcHashMinorPayloadVersion = 3;
 const uint32_t kBrotliBsdiffMinorPayloadVersion = 4;
 const uint32_t kPuffdiffMinorPayloadVersion = 5;
+const uint32_t kZstdMinorPayloadVersion = 6;
+const uint32_t kPartitionCopyMinorPayloadVersion = 7;
 
 const uint64_t kMaxPayloadHeaderSize = 24;
 
@@ -59,6 +61,10 @@ const char* InstallOperationTypeName(InstallOperation_Type op_type) {
       return "PUFFDIFF";
     case InstallOperation::BROTLI_BSDIFF:
       return "BROTLI_BSDIFF";
+    case InstallOperation::REPLACE_ZSTD:
+      return "REPLACE_ZSTD";
+    case InstallOperation::PARTITION_COPY:
+      return "PARTITION_COPY";
   }
   return "<unknown_op>";
 }
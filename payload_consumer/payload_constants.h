@@ -49,6 +49,12 @@ extern const uint32_t kBrotliBsdiffMinorPayloadVersion;
 // The minor version that allows PUFFDIFF operation.
 extern const uint32_t kPuffdiffMinorPayloadVersion;
 
+// The minor version that allows REPLACE_ZSTD operation.
+extern const uint32_t kZstdMinorPayloadVersion;
+
+// The minor version that allows PARTITION_COPY operation.
+extern const uint32_t kPartitionCopyMinorPayloadVersion;
+
 // The maximum size of the payload header (anything before the protobuf).
 extern const uint64_t kMaxPayloadHeaderSize;
 
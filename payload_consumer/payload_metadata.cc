@@ -18,15 +18,131 @@
 
 #include <endian.h>
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <brillo/data_encoding.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
 
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
 namespace chromeos_update_engine {
 
+namespace {
+
+// A field of a serialized message.
+struct RawField {
+  // The field number, 0 at the end of the message.
+  int number;
+  // The bytes of the whole field, tag included.
+  const uint8_t* begin;
+  size_t size;
+  // The bytes of its value if it is length-delimited, nullptr otherwise.
+  const uint8_t* value;
+  size_t value_size;
+};
+
+// The operations of a repeated field, parsed in their own arena.
+struct ParsedOperations {
+  unique_ptr<Arena> arena;
+  vector<InstallOperation*> operations;
+};
+
+// Reads the next field of |input|, reading the |size| bytes message at |data|,
+// into |field|. Returns false if the message can't be parsed.
+bool ReadField(CodedInputStream* input,
+               const uint8_t* data,
+               size_t size,
+               RawField* field) {
+  const int begin = input->CurrentPosition();
+  const uint32_t tag = input->ReadTag();
+  field->number = WireFormatLite::GetTagFieldNumber(tag);
+  field->value = nullptr;
+  field->value_size = 0;
+  if (tag == 0)
+    return static_cast<size_t>(input->CurrentPosition()) == size;
+  if (WireFormatLite::GetTagWireType(tag) ==
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+    uint32_t length;
+    if (!input->ReadVarint32(&length))
+      return false;
+    field->value = data + input->CurrentPosition();
+    field->value_size = length;
+    if (!input->Skip(length))
+      return false;
+  } else if (!WireFormatLite::SkipField(input, tag)) {
+    return false;
+  }
+  field->begin = data + begin;
+  field->size = input->CurrentPosition() - begin;
+  return true;
+}
+
+void AppendField(const RawField& field, string* out_message) {
+  out_message->append(reinterpret_cast<const char*>(field.begin), field.size);
+}
+
+// Parses the operation serialized in the value of |field| in the arena of
+// |parsed|.
+bool ParseOperation(const RawField& field, ParsedOperations* parsed) {
+  InstallOperation* op =
+      Arena::CreateMessage<InstallOperation>(parsed->arena.get());
+  if (!op->ParseFromArray(field.value, field.value_size))
+    return false;
+  parsed->operations.push_back(op);
+  return true;
+}
+
+// Appends the fields of the PartitionUpdate serialized in the value of
+// |partition| to |out_partition|, except for its operations, which are parsed
+// in |out_operations|.
+bool SplitPartitionOperations(const RawField& partition,
+                              string* out_partition,
+                              ParsedOperations* out_operations) {
+  CodedInputStream input(partition.value, partition.value_size);
+  RawField field;
+  while (ReadField(&input, partition.value, partition.value_size, &field)) {
+    if (field.number == 0)
+      return true;
+    if (field.number == PartitionUpdate::kOperationsFieldNumber &&
+        field.value) {
+      if (!ParseOperation(field, out_operations))
+        return false;
+    } else {
+      AppendField(field, out_partition);
+    }
+  }
+  return false;
+}
+
+// Adds the |parsed| operations to |operations| without copying them, and moves
+// their arena to |out_arenas|.
+void AddParsedOperations(
+    ParsedOperations* parsed,
+    google::protobuf::RepeatedPtrField<InstallOperation>* operations,
+    vector<unique_ptr<Arena>>* out_arenas) {
+  for (InstallOperation* op : parsed->operations)
+    operations->UnsafeArenaAddAllocated(op);
+  out_arenas->push_back(std::move(parsed->arena));
+}
+
+}  // namespace
+
 const uint64_t PayloadMetadata::kDeltaVersionOffset = sizeof(kDeltaMagic);
 const uint64_t PayloadMetadata::kDeltaVersionSize = 8;
 const uint64_t PayloadMetadata::kDeltaManifestSizeOffset =
@@ -150,10 +266,108 @@ bool PayloadMetadata::GetManifest(const brillo::Blob& payload,
                                       manifest_size_);
 }
 
+bool PayloadMetadata::GetManifest(
+    const brillo::Blob& payload,
+    const ArenaOptions& arena_options,
+    DeltaArchiveManifest* out_manifest,
+    vector<unique_ptr<Arena>>* out_operation_arenas) const {
+  uint64_t manifest_offset;
+  if (!GetManifestOffset(&manifest_offset))
+    return false;
+  CHECK_GE(payload.size(), manifest_offset + manifest_size_);
+  const uint8_t* manifest = &payload[manifest_offset];
+
+  // The manifest is parsed from a copy of its fields without the operations,
+  // which are parsed on their own.
+  string stripped_manifest;
+  vector<ParsedOperations> partitions;
+  ParsedOperations rootfs, kernel;
+  rootfs.arena.reset(new Arena(arena_options));
+  kernel.arena.reset(new Arena(arena_options));
+  CodedInputStream input(manifest, manifest_size_);
+  RawField field;
+  for (;;) {
+    if (!ReadField(&input, manifest, manifest_size_, &field))
+      return false;
+    if (field.number == 0)
+      break;
+    if (!field.value) {
+      AppendField(field, &stripped_manifest);
+    } else if (field.number ==
+               DeltaArchiveManifest::kInstallOperationsFieldNumber) {
+      if (!ParseOperation(field, &rootfs))
+        return false;
+    } else if (field.number ==
+               DeltaArchiveManifest::kKernelInstallOperationsFieldNumber) {
+      if (!ParseOperation(field, &kernel))
+        return false;
+    } else if (field.number == DeltaArchiveManifest::kPartitionsFieldNumber) {
+      partitions.emplace_back();
+      partitions.back().arena.reset(new Arena(arena_options));
+      string partition;
+      if (!SplitPartitionOperations(field, &partition, &partitions.back()))
+        return false;
+      // Room for the tag and the length, both varints of up to 5 bytes.
+      uint8_t header[10];
+      uint8_t* header_end = CodedOutputStream::WriteTagToArray(
+          WireFormatLite::MakeTag(DeltaArchiveManifest::kPartitionsFieldNumber,
+                                  WireFormatLite::WIRETYPE_LENGTH_DELIMITED),
+          header);
+      header_end =
+          CodedOutputStream::WriteVarint32ToArray(partition.size(), header_end);
+      stripped_manifest.append(reinterpret_cast<const char*>(header),
+                               header_end - header);
+      stripped_manifest.append(partition);
+    } else {
+      AppendField(field, &stripped_manifest);
+    }
+  }
+  if (!out_manifest->ParseFromString(stripped_manifest))
+    return false;
+  CHECK_EQ(static_cast<size_t>(out_manifest->partitions_size()),
+           partitions.size());
+
+  out_operation_arenas->clear();
+  for (size_t i = 0; i < partitions.size(); i++) {
+    AddParsedOperations(
+        &partitions[i],
+        out_manifest->mutable_partitions(i)->mutable_operations(),
+        out_operation_arenas);
+  }
+  AddParsedOperations(&rootfs,
+                      out_manifest->mutable_install_operations(),
+                      out_operation_arenas);
+  AddParsedOperations(&kernel,
+                      out_manifest->mutable_kernel_install_operations(),
+                      out_operation_arenas);
+  return true;
+}
+
+void PayloadMetadata::UpdateMetadataHash(const brillo::Blob& payload) {
+  const uint64_t end = std::min<uint64_t>(payload.size(), metadata_size_);
+  if (end <= metadata_hashed_size_)
+    return;
+  metadata_hash_calculator_.Update(payload.data() + metadata_hashed_size_,
+                                   end - metadata_hashed_size_);
+  metadata_hashed_size_ = end;
+}
+
 ErrorCode PayloadMetadata::ValidateMetadataSignature(
     const brillo::Blob& payload,
     std::string metadata_signature,
     base::FilePath path_to_public_key) const {
+  LOG(INFO) << "Verifying metadata hash signature using public key: "
+            << path_to_public_key.value();
+  std::unique_ptr<PublicKey> public_key =
+      PublicKey::FromPemFile(path_to_public_key.value());
+  return ValidateMetadataSignature(
+      payload, metadata_signature, public_key.get());
+}
+
+ErrorCode PayloadMetadata::ValidateMetadataSignature(
+    const brillo::Blob& payload,
+    const std::string& metadata_signature,
+    const PublicKey* public_key) const {
   if (payload.size() < metadata_size_ + metadata_signature_size_)
     return ErrorCode::kDownloadMetadataSignatureError;
 
@@ -179,12 +393,18 @@ ErrorCode PayloadMetadata::ValidateMetadataSignature(
     return ErrorCode::kDownloadMetadataSignatureMissingError;
   }
 
-  LOG(INFO) << "Verifying metadata hash signature using public key: "
-            << path_to_public_key.value();
-
   brillo::Blob calculated_metadata_hash;
-  if (!HashCalculator::RawHashOfBytes(
-          payload.data(), metadata_size_, &calculated_metadata_hash)) {
+  if (metadata_hashed_size_ == metadata_size_) {
+    // Finalize a copy of the hash, so this method can be called again.
+    HashCalculator hash_calculator;
+    if (!hash_calculator.SetContext(metadata_hash_calculator_.GetContext()) ||
+        !hash_calculator.Finalize()) {
+      LOG(ERROR) << "Unable to compute actual hash of manifest";
+      return ErrorCode::kDownloadMetadataSignatureVerificationError;
+    }
+    calculated_metadata_hash = hash_calculator.raw_hash();
+  } else if (!HashCalculator::RawHashOfBytes(
+                 payload.data(), metadata_size_, &calculated_metadata_hash)) {
     LOG(ERROR) << "Unable to compute actual hash of manifest";
     return ErrorCode::kDownloadMetadataSignatureVerificationError;
   }
@@ -197,8 +417,9 @@ ErrorCode PayloadMetadata::ValidateMetadataSignature(
 
   if (!metadata_signature_blob.empty()) {
     brillo::Blob expected_metadata_hash;
-    if (!PayloadVerifier::GetRawHashFromSignature(metadata_signature_blob,
-                                                  path_to_public_key.value(),
+    if (!public_key ||
+        !PayloadVerifier::GetRawHashFromSignature(metadata_signature_blob,
+                                                  *public_key,
                                                   &expected_metadata_hash)) {
       LOG(ERROR) << "Unable to compute expected hash from metadata signature";
       return ErrorCode::kDownloadMetadataSignatureError;
@@ -211,8 +432,9 @@ ErrorCode PayloadMetadata::ValidateMetadataSignature(
       return ErrorCode::kDownloadMetadataSignatureMismatch;
     }
   } else {
-    if (!PayloadVerifier::VerifySignature(metadata_signature_protobuf_blob,
-                                          path_to_public_key.value(),
+    if (!public_key ||
+        !PayloadVerifier::VerifySignature(metadata_signature_protobuf_blob,
+                                          *public_key,
                                           calculated_metadata_hash)) {
       LOG(ERROR) << "Manifest hash verification failed.";
       return ErrorCode::kDownloadMetadataSignatureMismatch;
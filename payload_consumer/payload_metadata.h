@@ -19,14 +19,18 @@
 
 #include <inttypes.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <base/files/file_path.h>
 #include <brillo/secure_blob.h>
+#include <google/protobuf/arena.h>
 
 #include "update_engine/common/error_code.h"
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/payload_consumer/payload_verifier.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -57,10 +61,17 @@ class PayloadMetadata {
                                          uint64_t supported_major_version,
                                          ErrorCode* error);
 
+  // Hashes the metadata bytes in |payload| not hashed by a previous call, so
+  // the metadata can be hashed as it is downloaded instead of all at once when
+  // it is complete. |payload| holds the beginning of the payload, and must
+  // extend the one of the previous calls. Requires the header to be parsed.
+  void UpdateMetadataHash(const brillo::Blob& payload);
+
   // Given the |payload|, verifies that the signed hash of its metadata matches
   // |metadata_signature| (if present) or the metadata signature in payload
-  // itself (if present). Returns ErrorCode::kSuccess on match or a suitable
-  // error code otherwise. This method must be called before any part of the
+  // itself (if present). The hash computed by UpdateMetadataHash() is used if
+  // it covers the whole metadata. Returns ErrorCode::kSuccess on match or a
+  // suitable error code otherwise. This method must be called before any part of the
   // metadata is parsed so that a man-in-the-middle attack on the SSL connection
   // to the payload server doesn't exploit any vulnerability in the code that
   // parses the protocol buffer.
@@ -68,6 +79,12 @@ class PayloadMetadata {
                                       std::string metadata_signature,
                                       base::FilePath path_to_public_key) const;
 
+  // Same as above, using the already parsed |public_key|. A null
+  // |public_key|, when the key couldn't be loaded, fails the verification.
+  ErrorCode ValidateMetadataSignature(const brillo::Blob& payload,
+                                      const std::string& metadata_signature,
+                                      const PublicKey* public_key) const;
+
   // Returns the major payload version. If the version was not yet parsed,
   // returns zero.
   uint64_t GetMajorVersion() const { return major_payload_version_; }
@@ -85,6 +102,21 @@ class PayloadMetadata {
   bool GetManifest(const brillo::Blob& payload,
                    DeltaArchiveManifest* out_manifest) const;
 
+  // Same as above, except that the operations of each partition are parsed in
+  // their own arena, created with |arena_options| and stored in
+  // |out_operation_arenas|, so they can be freed once the partition is applied
+  // regardless of the arena of |out_manifest|. The arenas of the partitions are
+  // followed by the ones of the major version 1 rootfs and kernel operations.
+  // The operations aren't owned by their repeated fields, so they must be
+  // extracted with UnsafeArenaExtractSubrange() before their arena is freed.
+  // |out_manifest| must not hold operations parsed this way already.
+  bool GetManifest(
+      const brillo::Blob& payload,
+      const google::protobuf::ArenaOptions& arena_options,
+      DeltaArchiveManifest* out_manifest,
+      std::vector<std::unique_ptr<google::protobuf::Arena>>*
+          out_operation_arenas) const;
+
  private:
   // Set |*out_offset| to the byte offset at which the manifest protobuf begins
   // in a payload. Return true on success, false if the offset is unknown.
@@ -100,6 +132,10 @@ class PayloadMetadata {
   uint32_t metadata_signature_size_{0};
   uint64_t major_payload_version_{0};
 
+  // The hash of the first |metadata_hashed_size_| bytes of the metadata.
+  HashCalculator metadata_hash_calculator_;
+  uint64_t metadata_hashed_size_{0};
+
   DISALLOW_COPY_AND_ASSIGN(PayloadMetadata);
 };
 
@@ -0,0 +1,55 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// libFuzzer target of the parsing of the payload metadata: the header and the
+// manifest are parsed from the untrusted bytes at the beginning of every
+// payload. The manifest is only parsed once the whole metadata is available,
+// like DeltaPerformer does. libFuzzer reports the parses per second, and the
+// allocations per parse can be limited with its -malloc_limit_mb flag.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/error_code.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+void FuzzPayloadMetadata(const uint8_t* data, size_t size) {
+  brillo::Blob payload(data, data + size);
+  PayloadMetadata metadata;
+  ErrorCode error;
+  if (metadata.ParsePayloadHeader(payload,
+                                  DeltaPerformer::kSupportedMajorPayloadVersion,
+                                  &error) != MetadataParseResult::kSuccess ||
+      payload.size() < metadata.GetMetadataSize()) {
+    return;
+  }
+  metadata.UpdateMetadataHash(payload);
+  DeltaArchiveManifest manifest;
+  metadata.GetManifest(payload, &manifest);
+}
+
+}  // namespace chromeos_update_engine
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  chromeos_update_engine::FuzzPayloadMetadata(data, size);
+  return 0;
+}
@@ -17,6 +17,7 @@
 #include "update_engine/payload_consumer/payload_verifier.h"
 
 #include <base/logging.h>
+#include <openssl/bio.h>
 #include <openssl/pem.h>
 
 #include "update_engine/common/hash_calculator.h"
@@ -84,11 +85,48 @@ const uint8_t kRSA2048SHA256Padding[] = {
 
 }  // namespace
 
+PublicKey::~PublicKey() {
+  RSA_free(rsa_);
+}
+
+std::unique_ptr<PublicKey> PublicKey::FromPem(const string& pem) {
+  BIO* bio = BIO_new_mem_buf(pem.data(), static_cast<int>(pem.size()));
+  if (!bio) {
+    LOG(ERROR) << "Unable to allocate the public key buffer.";
+    return nullptr;
+  }
+  char dummy_password[] = { ' ', 0 };  // Ensure no password is read from stdin.
+  RSA* rsa = PEM_read_bio_RSA_PUBKEY(bio, nullptr, nullptr, dummy_password);
+  BIO_free(bio);
+  if (!rsa) {
+    LOG(ERROR) << "Unable to parse the public key.";
+    return nullptr;
+  }
+  return std::unique_ptr<PublicKey>(new PublicKey(rsa));
+}
+
+std::unique_ptr<PublicKey> PublicKey::FromPemFile(const string& path) {
+  string pem;
+  if (!utils::ReadFile(path, &pem)) {
+    LOG(ERROR) << "Unable to read public key file: " << path;
+    return nullptr;
+  }
+  return FromPem(pem);
+}
+
 bool PayloadVerifier::VerifySignature(const brillo::Blob& signature_blob,
                                       const string& public_key_path,
                                       const brillo::Blob& hash_data) {
   TEST_AND_RETURN_FALSE(!public_key_path.empty());
+  std::unique_ptr<PublicKey> public_key =
+      PublicKey::FromPemFile(public_key_path);
+  TEST_AND_RETURN_FALSE(public_key);
+  return VerifySignature(signature_blob, *public_key, hash_data);
+}
 
+bool PayloadVerifier::VerifySignature(const brillo::Blob& signature_blob,
+                                      const PublicKey& public_key,
+                                      const brillo::Blob& hash_data) {
   Signatures signatures;
   LOG(INFO) << "signature blob size = " <<  signature_blob.size();
   TEST_AND_RETURN_FALSE(signatures.ParseFromArray(signature_blob.data(),
@@ -105,7 +143,7 @@ bool PayloadVerifier::VerifySignature(const brillo::Blob& signature_blob,
     const Signatures_Signature& signature = signatures.signatures(i);
     brillo::Blob sig_data(signature.data().begin(), signature.data().end());
     brillo::Blob sig_hash_data;
-    if (!GetRawHashFromSignature(sig_data, public_key_path, &sig_hash_data))
+    if (!GetRawHashFromSignature(sig_data, public_key, &sig_hash_data))
       continue;
 
     if (hash_data == sig_hash_data) {
@@ -131,27 +169,23 @@ bool PayloadVerifier::GetRawHashFromSignature(
     const string& public_key_path,
     brillo::Blob* out_hash_data) {
   TEST_AND_RETURN_FALSE(!public_key_path.empty());
+  std::unique_ptr<PublicKey> public_key =
+      PublicKey::FromPemFile(public_key_path);
+  TEST_AND_RETURN_FALSE(public_key);
+  return GetRawHashFromSignature(sig_data, *public_key, out_hash_data);
+}
 
+bool PayloadVerifier::GetRawHashFromSignature(const brillo::Blob& sig_data,
+                                              const PublicKey& public_key,
+                                              brillo::Blob* out_hash_data) {
   // The code below executes the equivalent of:
   //
-  // openssl rsautl -verify -pubin -inkey |public_key_path|
+  // openssl rsautl -verify -pubin -inkey |public_key|
   //   -in |sig_data| -out |out_hash_data|
-
-  // Loads the public key.
-  FILE* fpubkey = fopen(public_key_path.c_str(), "rb");
-  if (!fpubkey) {
-    LOG(ERROR) << "Unable to open public key file: " << public_key_path;
-    return false;
-  }
-
-  char dummy_password[] = { ' ', 0 };  // Ensure no password is read from stdin.
-  RSA* rsa = PEM_read_RSA_PUBKEY(fpubkey, nullptr, nullptr, dummy_password);
-  fclose(fpubkey);
-  TEST_AND_RETURN_FALSE(rsa != nullptr);
+  RSA* rsa = public_key.rsa();
   unsigned int keysize = RSA_size(rsa);
   if (sig_data.size() > 2 * keysize) {
     LOG(ERROR) << "Signature size is too big for public key size.";
-    RSA_free(rsa);
     return false;
   }
 
@@ -162,7 +196,6 @@ bool PayloadVerifier::GetRawHashFromSignature(
                                         hash_data.data(),
                                         rsa,
                                         RSA_NO_PADDING);
-  RSA_free(rsa);
   TEST_AND_RETURN_FALSE(decrypt_size > 0 &&
                         decrypt_size <= static_cast<int>(hash_data.size()));
   hash_data.resize(decrypt_size);
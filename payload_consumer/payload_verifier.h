@@ -17,10 +17,12 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_VERIFIER_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_VERIFIER_H_
 
+#include <memory>
 #include <string>
 
 #include <base/macros.h>
 #include <brillo/secure_blob.h>
+#include <openssl/rsa.h>
 
 #include "update_engine/update_metadata.pb.h"
 
@@ -29,6 +31,31 @@
 
 namespace chromeos_update_engine {
 
+// A public RSA key parsed from its PEM encoding, so several signatures can be
+// verified with it without reading and parsing the key again.
+class PublicKey {
+ public:
+  ~PublicKey();
+
+  // Parses the key in |pem|. Returns nullptr if it isn't a valid key.
+  static std::unique_ptr<PublicKey> FromPem(const std::string& pem);
+
+  // Reads and parses the key in the PEM file at |path|. Returns nullptr if the
+  // file can't be read or isn't a valid key.
+  static std::unique_ptr<PublicKey> FromPemFile(const std::string& path);
+
+  // The key itself, which is only used for public key operations, so it can be
+  // used from several threads.
+  RSA* rsa() const { return rsa_; }
+
+ private:
+  explicit PublicKey(RSA* rsa) : rsa_(rsa) {}
+
+  RSA* rsa_;
+
+  DISALLOW_COPY_AND_ASSIGN(PublicKey);
+};
+
 class PayloadVerifier {
  public:
   // Interprets |signature_blob| as a protocol buffer containing the Signatures
@@ -40,6 +67,11 @@ class PayloadVerifier {
                               const std::string& public_key_path,
                               const brillo::Blob& hash_data);
 
+  // Same as above, using the already parsed |public_key|.
+  static bool VerifySignature(const brillo::Blob& signature_blob,
+                              const PublicKey& public_key,
+                              const brillo::Blob& hash_data);
+
   // Decrypts sig_data with the given public_key_path and populates
   // out_hash_data with the decoded raw hash. Returns true if successful,
   // false otherwise.
@@ -47,6 +79,11 @@ class PayloadVerifier {
                                       const std::string& public_key_path,
                                       brillo::Blob* out_hash_data);
 
+  // Same as above, using the already parsed |public_key|.
+  static bool GetRawHashFromSignature(const brillo::Blob& sig_data,
+                                      const PublicKey& public_key,
+                                      brillo::Blob* out_hash_data);
+
   // Pads a SHA256 hash so that it may be encrypted/signed with RSA2048
   // using the PKCS#1 v1.5 scheme.
   // hash should be a pointer to vector of exactly 256 bits. The vector
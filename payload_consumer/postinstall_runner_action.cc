@@ -25,6 +25,7 @@
 #include <unistd.h>
 
 #include <cmath>
+#include <utility>
 
 #include <base/files/file_path.h>
 #include <base/files/file_util.h>
@@ -56,7 +57,7 @@ using std::vector;
 
 void PostinstallRunnerAction::PerformAction() {
   CHECK(HasInputObject());
-  install_plan_ = GetInputObject();
+  install_plan_ = TakeInputObject();
 
   if (install_plan_.powerwash_required) {
     if (hardware_->SchedulePowerwash()) {
@@ -77,7 +78,7 @@ void PostinstallRunnerAction::PerformAction() {
     total_weight_ += partition_weight_[i];
   }
   accumulated_weight_ = 0;
-  ReportProgress(0);
+  ReportProgress();
 
   PerformPartitionPostinstall();
 }
@@ -103,32 +104,85 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
   if (current_partition_ == install_plan_.partitions.size())
     return CompletePostinstall(ErrorCode::kSuccess);
 
+  // The adjacent partitions which may run in parallel are started together,
+  // and the ones after them wait for all of them to finish.
+  next_partition_ = current_partition_ + 1;
+  if (install_plan_.partitions[current_partition_].postinstall_parallel) {
+    while (next_partition_ < install_plan_.partitions.size()) {
+      const InstallPlan::Partition& partition =
+          install_plan_.partitions[next_partition_];
+      if (partition.run_postinstall && !partition.postinstall_parallel)
+        break;
+      next_partition_++;
+    }
+  }
+
+  for (size_t i = current_partition_; i < next_partition_; i++) {
+    if (!install_plan_.partitions[i].run_postinstall)
+      continue;
+    std::unique_ptr<PartitionTask> task(new PartitionTask());
+    task->partition = i;
+    bool ignorable = false;
+    if (!StartPartitionPostinstall(task.get(), &ignorable)) {
+      Cleanup(task.get());
+      if (!ignorable || !install_plan_.partitions[i].postinstall_optional)
+        return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+      LOG(INFO) << "Ignoring postinstall failure since it is optional";
+      accumulated_weight_ += partition_weight_[i];
+      continue;
+    }
+    tasks_.push_back(std::move(task));
+  }
+
+  if (tasks_.empty()) {
+    current_partition_ = next_partition_;
+    ReportProgress();
+    PerformPartitionPostinstall();
+  }
+}
+
+bool PostinstallRunnerAction::StartPartitionPostinstall(PartitionTask* task,
+                                                        bool* ignorable) {
   const InstallPlan::Partition& partition =
-      install_plan_.partitions[current_partition_];
+      install_plan_.partitions[task->partition];
+  *ignorable = false;
 
   const string mountable_device =
       utils::MakePartitionNameForMount(partition.target_path);
   if (mountable_device.empty()) {
     LOG(ERROR) << "Cannot make mountable device from " << partition.target_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
-  // Perform post-install for the current_partition_ partition. At this point we
-  // need to call CompletePartitionPostinstall to complete the operation and
-  // cleanup.
+  // Perform post-install for the partition of |task|. At this point we need to
+  // call CompletePartitionPostinstall to complete the operation and cleanup.
 #ifdef __ANDROID__
-  fs_mount_dir_ = "/postinstall";
-#else   // __ANDROID__
-  base::FilePath temp_dir;
-  TEST_AND_RETURN(base::CreateNewTempDirectory("au_postint_mount", &temp_dir));
-  fs_mount_dir_ = temp_dir.value();
+  // Only one filesystem can be mounted at the fixed mountpoint, so the other
+  // partitions running in parallel are mounted in a temporary directory.
+  bool postinstall_dir_used = false;
+  for (const auto& running_task : tasks_) {
+    if (!running_task->temp_mount_dir)
+      postinstall_dir_used = true;
+  }
+  if (!postinstall_dir_used) {
+    task->fs_mount_dir = "/postinstall";
+  } else {
+#endif  // __ANDROID__
+    base::FilePath temp_dir;
+    TEST_AND_RETURN_FALSE(
+        base::CreateNewTempDirectory("au_postint_mount", &temp_dir));
+    task->fs_mount_dir = temp_dir.value();
+    task->temp_mount_dir = true;
+#ifdef __ANDROID__
+  }
 #endif  // __ANDROID__
+  const string& fs_mount_dir = task->fs_mount_dir;
 
   // Double check that the fs_mount_dir is not busy with a previous mounted
   // filesystem from a previous crashed postinstall step.
-  if (utils::IsMountpoint(fs_mount_dir_)) {
-    LOG(INFO) << "Found previously mounted filesystem at " << fs_mount_dir_;
-    utils::UnmountFilesystem(fs_mount_dir_);
+  if (utils::IsMountpoint(fs_mount_dir)) {
+    LOG(INFO) << "Found previously mounted filesystem at " << fs_mount_dir;
+    utils::UnmountFilesystem(fs_mount_dir);
   }
 
   base::FilePath postinstall_path(partition.postinstall_path);
@@ -136,18 +190,21 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
     LOG(ERROR) << "Invalid absolute path passed to postinstall, use a relative"
                   "path instead: "
                << partition.postinstall_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
   string abs_path =
-      base::FilePath(fs_mount_dir_).Append(postinstall_path).value();
+      base::FilePath(fs_mount_dir).Append(postinstall_path).value();
   if (!base::StartsWith(
-          abs_path, fs_mount_dir_, base::CompareCase::SENSITIVE)) {
+          abs_path, fs_mount_dir, base::CompareCase::SENSITIVE)) {
     LOG(ERROR) << "Invalid relative postinstall path: "
                << partition.postinstall_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
+  // The failures from here on are failures of the postinstall step itself.
+  *ignorable = true;
+
 #ifdef __ANDROID__
   // Check the currently installed /system partition to see if it's ever
   // been mounted R/W. If it has, we'll run backuptool scripts for it
@@ -177,17 +234,19 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
   if (mount_count > 0) {
     // Mount the target partition R/W
     LOG(INFO) << "Running backuptool scripts";
-    utils::MountFilesystem(mountable_device, fs_mount_dir_, MS_NOATIME | MS_NODEV | MS_NODIRATIME,
+    utils::MountFilesystem(mountable_device, fs_mount_dir, MS_NOATIME | MS_NODEV | MS_NODIRATIME,
                            partition.filesystem_type, "seclabel");
 
     // Switch to a permissive domain
     if (setexeccon("u:r:backuptool:s0")) {
       LOG(ERROR) << "Failed to set backuptool context";
-      return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+      *ignorable = false;
+      return false;
     }
 
     // Run backuptool script
-    int ret = system("/postinstall/system/bin/backuptool_postinstall.sh");
+    string backuptool = fs_mount_dir + "/system/bin/backuptool_postinstall.sh";
+    int ret = system(backuptool.c_str());
     if (ret == -1 || WEXITSTATUS(ret) != 0) {
       LOG(ERROR) << "Backuptool postinstall step failed. ret=" << ret;
     }
@@ -195,13 +254,14 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
     // Switch back to update_engine domain
     if (setexeccon(nullptr)) {
       LOG(ERROR) << "Failed to set update_engine context";
-      return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+      *ignorable = false;
+      return false;
     }
   } else {
     LOG(INFO) << "Skipping backuptool scripts";
   }
 
-  utils::UnmountFilesystem(fs_mount_dir_);
+  utils::UnmountFilesystem(fs_mount_dir);
 
   // In Chromium OS, the postinstall step is allowed to write to the block
   // device on the target image, so we don't mark it as read-only and should
@@ -209,18 +269,19 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
 
   // Mark the block device as read-only before mounting for post-install.
   if (!utils::SetBlockDeviceReadOnly(mountable_device, true)) {
-    return CompletePartitionPostinstall(
-        1, "Error marking the device " + mountable_device + " read only.");
+    LOG(ERROR) << "Error marking the device " << mountable_device
+               << " read only.";
+    return false;
   }
 #endif  // __ANDROID__
 
   if (!utils::MountFilesystem(mountable_device,
-                              fs_mount_dir_,
+                              fs_mount_dir,
                               MS_RDONLY,
                               partition.filesystem_type,
                               constants::kPostinstallMountOptions)) {
-    return CompletePartitionPostinstall(
-        1, "Error mounting the device " + mountable_device);
+    LOG(ERROR) << "Error mounting the device " << mountable_device;
+    return false;
   }
 
   LOG(INFO) << "Performing postinst (" << partition.postinstall_path << " at "
@@ -245,118 +306,166 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
   command.push_back(partition.target_path);
 #endif  // __ANDROID__
 
-  current_command_ = Subprocess::Get().ExecFlags(
+  // The task is owned by |tasks_| until the callback or TerminateTasks(),
+  // which discards the callback, runs.
+  task->command = Subprocess::Get().ExecFlags(
       command,
       Subprocess::kRedirectStderrToStdout,
       {kPostinstallStatusFd},
       base::Bind(&PostinstallRunnerAction::CompletePartitionPostinstall,
-                 base::Unretained(this)));
+                 base::Unretained(this),
+                 base::Unretained(task)));
   // Subprocess::Exec should never return a negative process id.
-  CHECK_GE(current_command_, 0);
+  CHECK_GE(task->command, 0);
 
-  if (!current_command_) {
-    CompletePartitionPostinstall(1, "Postinstall didn't launch");
-    return;
+  if (!task->command) {
+    LOG(ERROR) << "Postinstall didn't launch";
+    return false;
   }
+  if (resource_scheduler_)
+    resource_scheduler_->RegisterProcess(task->command);
 
   // Monitor the status file descriptor.
-  progress_fd_ =
-      Subprocess::Get().GetPipeFd(current_command_, kPostinstallStatusFd);
-  int fd_flags = fcntl(progress_fd_, F_GETFL, 0) | O_NONBLOCK;
-  if (HANDLE_EINTR(fcntl(progress_fd_, F_SETFL, fd_flags)) < 0) {
-    PLOG(ERROR) << "Unable to set non-blocking I/O mode on fd " << progress_fd_;
+  task->progress_fd =
+      Subprocess::Get().GetPipeFd(task->command, kPostinstallStatusFd);
+  int fd_flags = fcntl(task->progress_fd, F_GETFL, 0) | O_NONBLOCK;
+  if (HANDLE_EINTR(fcntl(task->progress_fd, F_SETFL, fd_flags)) < 0) {
+    PLOG(ERROR) << "Unable to set non-blocking I/O mode on fd "
+                << task->progress_fd;
   }
 
-  progress_task_ = MessageLoop::current()->WatchFileDescriptor(
+  task->progress_task = MessageLoop::current()->WatchFileDescriptor(
       FROM_HERE,
-      progress_fd_,
+      task->progress_fd,
       MessageLoop::WatchMode::kWatchRead,
       true,
       base::Bind(&PostinstallRunnerAction::OnProgressFdReady,
-                 base::Unretained(this)));
+                 base::Unretained(this),
+                 base::Unretained(task)));
+  return true;
 }
 
-void PostinstallRunnerAction::OnProgressFdReady() {
+void PostinstallRunnerAction::OnProgressFdReady(PartitionTask* task) {
   char buf[1024];
   size_t bytes_read;
   do {
     bytes_read = 0;
     bool eof;
-    bool ok =
-        utils::ReadAll(progress_fd_, buf, arraysize(buf), &bytes_read, &eof);
-    progress_buffer_.append(buf, bytes_read);
+    bool ok = utils::ReadAll(
+        task->progress_fd, buf, arraysize(buf), &bytes_read, &eof);
+    task->progress_buffer.append(buf, bytes_read);
     // Process every line.
-    vector<string> lines = base::SplitString(
-        progress_buffer_, "\n", base::KEEP_WHITESPACE, base::SPLIT_WANT_ALL);
+    vector<string> lines = base::SplitString(task->progress_buffer,
+                                             "\n",
+                                             base::KEEP_WHITESPACE,
+                                             base::SPLIT_WANT_ALL);
     if (!lines.empty()) {
-      progress_buffer_ = lines.back();
+      task->progress_buffer = lines.back();
       lines.pop_back();
       for (const auto& line : lines) {
-        ProcessProgressLine(line);
+        ProcessProgressLine(task, line);
       }
     }
     if (!ok || eof) {
       // There was either an error or an EOF condition, so we are done watching
       // the file descriptor.
-      MessageLoop::current()->CancelTask(progress_task_);
-      progress_task_ = MessageLoop::kTaskIdNull;
+      MessageLoop::current()->CancelTask(task->progress_task);
+      task->progress_task = MessageLoop::kTaskIdNull;
       return;
     }
   } while (bytes_read);
 }
 
-bool PostinstallRunnerAction::ProcessProgressLine(const string& line) {
+bool PostinstallRunnerAction::ProcessProgressLine(PartitionTask* task,
+                                                  const string& line) {
   double frac = 0;
   if (sscanf(line.c_str(), "global_progress %lf", &frac) == 1 &&
       !std::isnan(frac)) {
-    ReportProgress(frac);
+    if (!std::isfinite(frac) || frac < 0)
+      frac = 0;
+    if (frac > 1)
+      frac = 1;
+    task->progress = frac;
+    ReportProgress();
     return true;
   }
 
   return false;
 }
 
-void PostinstallRunnerAction::ReportProgress(double frac) {
+void PostinstallRunnerAction::ReportProgress() {
   if (!delegate_)
     return;
   if (current_partition_ >= partition_weight_.size()) {
     delegate_->ProgressUpdate(1.);
     return;
   }
-  if (!std::isfinite(frac) || frac < 0)
-    frac = 0;
-  if (frac > 1)
-    frac = 1;
-  double postinst_action_progress =
-      (accumulated_weight_ + partition_weight_[current_partition_] * frac) /
-      total_weight_;
-  delegate_->ProgressUpdate(postinst_action_progress);
+  // The partitions running in parallel all contribute their progress.
+  double weight = accumulated_weight_;
+  for (const auto& task : tasks_)
+    weight += partition_weight_[task->partition] * task->progress;
+  delegate_->ProgressUpdate(weight / total_weight_);
 }
 
-void PostinstallRunnerAction::Cleanup() {
-  utils::UnmountFilesystem(fs_mount_dir_);
-#ifndef __ANDROID__
-  if (!base::DeleteFile(base::FilePath(fs_mount_dir_), false)) {
-    PLOG(WARNING) << "Not removing temporary mountpoint " << fs_mount_dir_;
+void PostinstallRunnerAction::Cleanup(PartitionTask* task) {
+  if (!task->fs_mount_dir.empty()) {
+    utils::UnmountFilesystem(task->fs_mount_dir);
+    if (task->temp_mount_dir &&
+        !base::DeleteFile(base::FilePath(task->fs_mount_dir), false)) {
+      PLOG(WARNING) << "Not removing temporary mountpoint "
+                    << task->fs_mount_dir;
+    }
   }
-#endif  // !__ANDROID__
-  fs_mount_dir_.clear();
+  task->fs_mount_dir.clear();
 
-  progress_fd_ = -1;
-  if (progress_task_ != MessageLoop::kTaskIdNull) {
-    MessageLoop::current()->CancelTask(progress_task_);
-    progress_task_ = MessageLoop::kTaskIdNull;
+  task->progress_fd = -1;
+  if (task->progress_task != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(task->progress_task);
+    task->progress_task = MessageLoop::kTaskIdNull;
   }
-  progress_buffer_.clear();
+  task->progress_buffer.clear();
+}
+
+void PostinstallRunnerAction::TerminateTasks() {
+  for (const auto& task : tasks_) {
+    if (task->command) {
+      if (resource_scheduler_)
+        resource_scheduler_->UnregisterProcess(task->command);
+      // Calling KillExec() will discard the callback we registered and
+      // therefore the unretained references to this object and the task.
+      Subprocess::Get().KillExec(task->command);
+
+      // If the command has been suspended, resume it after KillExec() so that
+      // the process can process the SIGTERM sent by KillExec().
+      if (task->is_command_suspended &&
+          kill(task->command, SIGCONT) != 0) {
+        PLOG(ERROR) << "Couldn't resume child process " << task->command;
+      }
+      task->command = 0;
+    }
+    Cleanup(task.get());
+  }
+  tasks_.clear();
 }
 
 void PostinstallRunnerAction::CompletePartitionPostinstall(
-    int return_code, const string& output) {
-  current_command_ = 0;
-  Cleanup();
+    PartitionTask* task, int return_code, const string& output) {
+  if (resource_scheduler_)
+    resource_scheduler_->UnregisterProcess(task->command);
+  task->command = 0;
+  Cleanup(task);
+  const size_t partition = task->partition;
+  for (auto it = tasks_.begin(); it != tasks_.end(); ++it) {
+    if (it->get() == task) {
+      tasks_.erase(it);
+      break;
+    }
+  }
 
   if (return_code != 0) {
-    LOG(ERROR) << "Postinst command failed with code: " << return_code;
+    LOG(ERROR) << "Postinst command for partition "
+               << install_plan_.partitions[partition].name
+               << " failed with code: " << return_code;
     ErrorCode error_code = ErrorCode::kPostinstallRunnerError;
 
     if (return_code == 3) {
@@ -375,20 +484,29 @@ void PostinstallRunnerAction::CompletePartitionPostinstall(
 
     // If postinstall script for this partition is optional we can ignore the
     // result.
-    if (install_plan_.partitions[current_partition_].postinstall_optional) {
+    if (install_plan_.partitions[partition].postinstall_optional) {
       LOG(INFO) << "Ignoring postinstall failure since it is optional";
     } else {
       return CompletePostinstall(error_code);
     }
   }
-  accumulated_weight_ += partition_weight_[current_partition_];
-  current_partition_++;
-  ReportProgress(0);
+  accumulated_weight_ += partition_weight_[partition];
+
+  // Wait for the other partitions running in parallel.
+  if (!tasks_.empty())
+    return ReportProgress();
+
+  current_partition_ = next_partition_;
+  ReportProgress();
 
   PerformPartitionPostinstall();
 }
 
 void PostinstallRunnerAction::CompletePostinstall(ErrorCode error_code) {
+  // The postinstall steps still running in parallel with a failed one are
+  // stopped.
+  TerminateTasks();
+
   // We only attempt to mark the new slot as active if all the postinstall
   // steps succeeded.
   if (error_code == ErrorCode::kSuccess) {
@@ -416,46 +534,38 @@ void PostinstallRunnerAction::CompletePostinstall(ErrorCode error_code) {
   }
 
   LOG(INFO) << "All post-install commands succeeded";
+  // The action is done with the install plan.
   if (HasOutputPipe()) {
-    SetOutputObject(install_plan_);
+    SetOutputObject(std::move(install_plan_));
   }
 }
 
 void PostinstallRunnerAction::SuspendAction() {
-  if (!current_command_)
-    return;
-  if (kill(current_command_, SIGSTOP) != 0) {
-    PLOG(ERROR) << "Couldn't pause child process " << current_command_;
-  } else {
-    is_current_command_suspended_ = true;
+  for (const auto& task : tasks_) {
+    if (!task->command)
+      continue;
+    if (kill(task->command, SIGSTOP) != 0) {
+      PLOG(ERROR) << "Couldn't pause child process " << task->command;
+    } else {
+      task->is_command_suspended = true;
+    }
   }
 }
 
 void PostinstallRunnerAction::ResumeAction() {
-  if (!current_command_)
-    return;
-  if (kill(current_command_, SIGCONT) != 0) {
-    PLOG(ERROR) << "Couldn't resume child process " << current_command_;
-  } else {
-    is_current_command_suspended_ = false;
+  for (const auto& task : tasks_) {
+    if (!task->command)
+      continue;
+    if (kill(task->command, SIGCONT) != 0) {
+      PLOG(ERROR) << "Couldn't resume child process " << task->command;
+    } else {
+      task->is_command_suspended = false;
+    }
   }
 }
 
 void PostinstallRunnerAction::TerminateProcessing() {
-  if (!current_command_)
-    return;
-  // Calling KillExec() will discard the callback we registered and therefore
-  // the unretained reference to this object.
-  Subprocess::Get().KillExec(current_command_);
-
-  // If the command has been suspended, resume it after KillExec() so that the
-  // process can process the SIGTERM sent by KillExec().
-  if (is_current_command_suspended_) {
-    ResumeAction();
-  }
-
-  current_command_ = 0;
-  Cleanup();
+  TerminateTasks();
 }
 
 }  // namespace chromeos_update_engine
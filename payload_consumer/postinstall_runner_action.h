@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_POSTINSTALL_RUNNER_ACTION_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_POSTINSTALL_RUNNER_ACTION_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -26,10 +27,13 @@
 #include "update_engine/common/action.h"
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/resource_scheduler.h"
 #include "update_engine/payload_consumer/install_plan.h"
 
 // The Postinstall Runner Action is responsible for running the postinstall
-// script of a successfully downloaded update.
+// script of a successfully downloaded update. The postinstall steps run one
+// partition at a time, except for the runs of adjacent partitions that set
+// |postinstall_parallel|, whose steps run concurrently.
 
 namespace chromeos_update_engine {
 
@@ -58,6 +62,12 @@ class PostinstallRunnerAction : public InstallPlanAction {
 
   void set_delegate(DelegateInterface* delegate) { delegate_ = delegate; }
 
+  // Registers the postinstall processes with |resource_scheduler|, not owned,
+  // so their CPU and I/O priority follow the device activity.
+  void set_resource_scheduler(ResourceScheduler* resource_scheduler) {
+    resource_scheduler_ = resource_scheduler;
+  }
+
   // Debugging/logging
   static std::string StaticType() { return "PostinstallRunnerAction"; }
   std::string Type() const override { return StaticType(); }
@@ -65,31 +75,71 @@ class PostinstallRunnerAction : public InstallPlanAction {
  private:
   friend class PostinstallRunnerActionTest;
   FRIEND_TEST(PostinstallRunnerActionTest, ProcessProgressLineTest);
+  FRIEND_TEST(PostinstallRunnerActionTest, ProcessParallelProgressLineTest);
+
+  // The postinstall step of a partition while it runs.
+  struct PartitionTask {
+    // The index of the partition in the InstallPlan.
+    size_t partition{0};
+
+    // The path where the filesystem is mounted, and whether it is a temporary
+    // directory to remove once unmounted.
+    std::string fs_mount_dir;
+    bool temp_mount_dir{false};
+
+    // Postinstall command running, or 0 if no program running.
+    pid_t command{0};
+
+    // True if |command| has been suspended by SuspendAction().
+    bool is_command_suspended{false};
+
+    // The parent progress file descriptor used to watch for progress reports
+    // from the postinstall program and the task watching for them.
+    int progress_fd{-1};
+    brillo::MessageLoop::TaskId progress_task{
+        brillo::MessageLoop::kTaskIdNull};
+
+    // A buffer of a partial read line from the progress file descriptor.
+    std::string progress_buffer;
+
+    // The last progress reported by the program, between 0 and 1.
+    double progress{0};
+  };
 
+  // Starts the postinstall steps of the next partitions: the next one with a
+  // postinstall step, and the adjacent ones that may run with it.
   void PerformPartitionPostinstall();
 
-  // Called whenever the |progress_fd_| has data available to read.
-  void OnProgressFdReady();
+  // Mounts the partition of |task| and launches its postinstall program.
+  // Returns false on failure, in which case |ignorable| tells whether the
+  // failure may be ignored when the partition postinstall is optional.
+  bool StartPartitionPostinstall(PartitionTask* task, bool* ignorable);
+
+  // Called whenever the |progress_fd| of |task| has data available to read.
+  void OnProgressFdReady(PartitionTask* task);
 
   // Updates the action progress according to the |line| passed from the
-  // postinstall program. Valid lines are:
+  // postinstall program of |task|. Valid lines are:
   //     global_progress <frac>
   //         <frac> should be between 0.0 and 1.0; sets the progress to the
   //         <frac> value.
-  bool ProcessProgressLine(const std::string& line);
+  bool ProcessProgressLine(PartitionTask* task, const std::string& line);
+
+  // Report the progress to the delegate, from the partitions done and the
+  // progress of the ones running.
+  void ReportProgress();
 
-  // Report the progress to the delegate given that the postinstall operation
-  // for |current_partition_| has a current progress of |frac|, a value between
-  // 0 and 1 for that step.
-  void ReportProgress(double frac);
+  // Cleanup the setup made when running postinstall for the partition of
+  // |task|. Unmount and remove the mountpoint directory if needed and cleanup
+  // the status file descriptor and message loop task watching for it.
+  void Cleanup(PartitionTask* task);
 
-  // Cleanup the setup made when running postinstall for a given partition.
-  // Unmount and remove the mountpoint directory if needed and cleanup the
-  // status file descriptor and message loop task watching for it.
-  void Cleanup();
+  // Kills the postinstall programs still running and cleans them up.
+  void TerminateTasks();
 
-  // Subprocess::Exec callback.
-  void CompletePartitionPostinstall(int return_code,
+  // Subprocess::Exec callback for the program of |task|.
+  void CompletePartitionPostinstall(PartitionTask* task,
+                                    int return_code,
                                     const std::string& output);
 
   // Complete the Action with the passed |error_code| and mark the new slot as
@@ -98,12 +148,15 @@ class PostinstallRunnerAction : public InstallPlanAction {
 
   InstallPlan install_plan_;
 
-  // The path where the filesystem will be mounted during post-install.
-  std::string fs_mount_dir_;
-
-  // The partition being processed on the list of partitions specified in the
-  // InstallPlan.
+  // The first partition being processed on the list of partitions specified
+  // in the InstallPlan, and the one after the last partition processed with
+  // it.
   size_t current_partition_{0};
+  size_t next_partition_{0};
+
+  // The postinstall steps running, of the partitions from
+  // |current_partition_| to |next_partition_|.
+  std::vector<std::unique_ptr<PartitionTask>> tasks_;
 
   // A non-negative value representing the estimated weight of each partition
   // passed in the install plan. The weight is used to predict the overall
@@ -114,8 +167,7 @@ class PostinstallRunnerAction : public InstallPlanAction {
   // The sum of all the weights in |partition_weight_|.
   double total_weight_{0};
 
-  // The sum of all the weights in |partition_weight_| up to but not including
-  // the |current_partition_|.
+  // The sum of the weights in |partition_weight_| of the partitions done.
   double accumulated_weight_{0};
 
   // The delegate used to notify of progress updates, if any.
@@ -127,24 +179,13 @@ class PostinstallRunnerAction : public InstallPlanAction {
   // HardwareInterface used to signal powerwash.
   HardwareInterface* hardware_;
 
+  // The scheduler setting the priority of the postinstall processes, if any.
+  ResourceScheduler* resource_scheduler_{nullptr};
+
   // Whether the Powerwash was scheduled before invoking post-install script.
   // Used for cleaning up if post-install fails.
   bool powerwash_scheduled_{false};
 
-  // Postinstall command currently running, or 0 if no program running.
-  pid_t current_command_{0};
-
-  // True if |current_command_| has been suspended by SuspendAction().
-  bool is_current_command_suspended_{false};
-
-  // The parent progress file descriptor used to watch for progress reports from
-  // the postinstall program and the task watching for them.
-  int progress_fd_{-1};
-  brillo::MessageLoop::TaskId progress_task_{brillo::MessageLoop::kTaskIdNull};
-
-  // A buffer of a partial read line from the progress file descriptor.
-  std::string progress_buffer_;
-
   DISALLOW_COPY_AND_ASSIGN(PostinstallRunnerAction);
 };
 
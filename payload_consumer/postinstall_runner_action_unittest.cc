@@ -42,6 +42,7 @@
 using brillo::MessageLoop;
 using chromeos_update_engine::test_utils::ScopedLoopbackDeviceBinder;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -98,17 +99,43 @@ class PostinstallRunnerActionTest : public ::testing::Test {
                            const string& postinstall_program,
                            bool powerwash_required);
 
+  // Setup an action processor and run the PostinstallRunnerAction with the
+  // passed |partitions|.
+  void RunPostinstallActionWithPartitions(
+      const vector<InstallPlan::Partition>& partitions,
+      bool powerwash_required);
+
+  // Returns a partition |device_path| running the |postinstall_program| in
+  // parallel with the other ones.
+  InstallPlan::Partition ParallelPartition(const string& name,
+                                           const string& device_path,
+                                           const string& postinstall_program) {
+    InstallPlan::Partition part;
+    part.name = name;
+    part.target_path = device_path;
+    part.run_postinstall = true;
+    part.postinstall_path = postinstall_program;
+    part.postinstall_parallel = true;
+    return part;
+  }
+
  public:
+  // Returns the pid of the first postinstall command running, or 0 if none.
+  pid_t RunningCommand() {
+    if (!postinstall_action_ || postinstall_action_->tasks_.empty())
+      return 0;
+    return postinstall_action_->tasks_[0]->command;
+  }
+
   void ResumeRunningAction() {
     ASSERT_NE(nullptr, postinstall_action_);
     postinstall_action_->ResumeAction();
   }
 
   void SuspendRunningAction() {
-    if (!postinstall_action_ || !postinstall_action_->current_command_ ||
+    if (!RunningCommand() ||
         test_utils::Readlink(base::StringPrintf(
-            "/proc/%d/fd/0", postinstall_action_->current_command_)) !=
-            "/dev/zero") {
+            "/proc/%d/fd/0", RunningCommand())) != "/dev/zero") {
       // We need to wait for the postinstall command to start and flag that it
       // is ready by redirecting its input to /dev/zero.
       loop_.PostDelayedTask(
@@ -128,7 +155,7 @@ class PostinstallRunnerActionTest : public ::testing::Test {
   }
 
   void CancelWhenStarted() {
-    if (!postinstall_action_ || !postinstall_action_->current_command_) {
+    if (!RunningCommand()) {
       // Wait for the postinstall command to run.
       loop_.PostDelayedTask(
           FROM_HERE,
@@ -166,16 +193,22 @@ void PostinstallRunnerActionTest::RunPosinstallAction(
     const string& device_path,
     const string& postinstall_program,
     bool powerwash_required) {
-  ActionProcessor processor;
-  processor_ = &processor;
-  ObjectFeederAction<InstallPlan> feeder_action;
   InstallPlan::Partition part;
   part.name = "part";
   part.target_path = device_path;
   part.run_postinstall = true;
   part.postinstall_path = postinstall_program;
+  RunPostinstallActionWithPartitions({part}, powerwash_required);
+}
+
+void PostinstallRunnerActionTest::RunPostinstallActionWithPartitions(
+    const vector<InstallPlan::Partition>& partitions,
+    bool powerwash_required) {
+  ActionProcessor processor;
+  processor_ = &processor;
+  ObjectFeederAction<InstallPlan> feeder_action;
   InstallPlan install_plan;
-  install_plan.partitions = {part};
+  install_plan.partitions = partitions;
   install_plan.download_url = "http://127.0.0.1:8080/update";
   install_plan.powerwash_required = powerwash_required;
   feeder_action.set_obj(install_plan);
@@ -216,24 +249,53 @@ TEST_F(PostinstallRunnerActionTest, ProcessProgressLineTest) {
   action.partition_weight_ = {1, 2, 5};
   action.accumulated_weight_ = 1;
   action.total_weight_ = 8;
+  action.tasks_.emplace_back(new PostinstallRunnerAction::PartitionTask());
+  PostinstallRunnerAction::PartitionTask* task = action.tasks_[0].get();
+  task->partition = 1;
 
   // 50% of the second action is 2/8 = 0.25 of the total.
   EXPECT_CALL(mock_delegate_, ProgressUpdate(0.25));
-  action.ProcessProgressLine("global_progress 0.5");
+  action.ProcessProgressLine(task, "global_progress 0.5");
   testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
 
   // 1.5 should be read as 100%, to catch rounding error cases like 1.000001.
   // 100% of the second is 3/8 of the total.
   EXPECT_CALL(mock_delegate_, ProgressUpdate(0.375));
-  action.ProcessProgressLine("global_progress 1.5");
+  action.ProcessProgressLine(task, "global_progress 1.5");
   testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
 
   // None of these should trigger a progress update.
-  action.ProcessProgressLine("foo_bar");
-  action.ProcessProgressLine("global_progress");
-  action.ProcessProgressLine("global_progress ");
-  action.ProcessProgressLine("global_progress NaN");
-  action.ProcessProgressLine("global_progress Exception in ... :)");
+  action.ProcessProgressLine(task, "foo_bar");
+  action.ProcessProgressLine(task, "global_progress");
+  action.ProcessProgressLine(task, "global_progress ");
+  action.ProcessProgressLine(task, "global_progress NaN");
+  action.ProcessProgressLine(task, "global_progress Exception in ... :)");
+}
+
+TEST_F(PostinstallRunnerActionTest, ProcessParallelProgressLineTest) {
+  PostinstallRunnerAction action(&fake_boot_control_, &fake_hardware_);
+  testing::StrictMock<MockPostinstallRunnerActionDelegate> mock_delegate_;
+  action.set_delegate(&mock_delegate_);
+
+  // The second and third partitions run in parallel.
+  action.current_partition_ = 1;
+  action.partition_weight_ = {1, 2, 5};
+  action.accumulated_weight_ = 1;
+  action.total_weight_ = 8;
+  for (size_t partition : {1, 2}) {
+    action.tasks_.emplace_back(new PostinstallRunnerAction::PartitionTask());
+    action.tasks_.back()->partition = partition;
+  }
+
+  // The first partition is done and 50% of the second adds 1/8 of the total.
+  EXPECT_CALL(mock_delegate_, ProgressUpdate(0.25));
+  action.ProcessProgressLine(action.tasks_[0].get(), "global_progress 0.5");
+  testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
+
+  // 20% of the third, running at the same time, adds another 1/8.
+  EXPECT_CALL(mock_delegate_, ProgressUpdate(0.375));
+  action.ProcessProgressLine(action.tasks_[1].get(), "global_progress 0.2");
+  testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
 }
 
 // Test that postinstall succeeds in the simple case of running the default
@@ -336,6 +398,33 @@ TEST_F(PostinstallRunnerActionTest, RunAsRootCancelPostinstallActionTest) {
   EXPECT_TRUE(processor_delegate_.processing_stopped_called_);
 }
 
+// Test that the postinstall steps of the partitions marked as parallel all
+// run.
+TEST_F(PostinstallRunnerActionTest, RunAsRootParallelTest) {
+  ScopedLoopbackDeviceBinder loop_a(postinstall_image_, false, nullptr);
+  ScopedLoopbackDeviceBinder loop_b(postinstall_image_, false, nullptr);
+  RunPostinstallActionWithPartitions(
+      {ParallelPartition("a", loop_a.dev(), kPostinstallDefaultScript),
+       ParallelPartition("b", loop_b.dev(), "bin/postinst_progress")},
+      false);
+  EXPECT_EQ(ErrorCode::kSuccess, processor_delegate_.code_);
+  EXPECT_TRUE(processor_delegate_.processing_done_called_);
+}
+
+// Test that a failing postinstall step stops the ones running in parallel.
+// The postinst_suspend program runs for minutes unless it is killed, so this
+// only finishes quickly if both programs run at the same time.
+TEST_F(PostinstallRunnerActionTest, RunAsRootParallelFailureTest) {
+  ScopedLoopbackDeviceBinder loop_a(postinstall_image_, false, nullptr);
+  ScopedLoopbackDeviceBinder loop_b(postinstall_image_, false, nullptr);
+  RunPostinstallActionWithPartitions(
+      {ParallelPartition("a", loop_a.dev(), "bin/postinst_suspend"),
+       ParallelPartition("b", loop_b.dev(), "bin/postinst_fail1")},
+      false);
+  EXPECT_EQ(ErrorCode::kPostinstallRunnerError, processor_delegate_.code_);
+  EXPECT_TRUE(processor_delegate_.processing_done_called_);
+}
+
 // Test that we parse and process the progress reports from the progress
 // file descriptor.
 TEST_F(PostinstallRunnerActionTest, RunAsRootProgressUpdatesTest) {
@@ -0,0 +1,70 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/public_key_cache.h"
+
+#include <sys/stat.h>
+
+#include <base/logging.h>
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+std::shared_ptr<const PublicKey> PublicKeyCache::GetKeyFromFile(
+    const string& path) {
+  struct stat stbuf;
+  if (stat(path.c_str(), &stbuf) != 0) {
+    PLOG(ERROR) << "Unable to stat public key file: " << path;
+    return nullptr;
+  }
+
+  base::AutoLock auto_lock(lock_);
+  auto it = file_keys_.find(path);
+  if (it != file_keys_.end() && it->second.size == stbuf.st_size &&
+      it->second.mtime.tv_sec == stbuf.st_mtim.tv_sec &&
+      it->second.mtime.tv_nsec == stbuf.st_mtim.tv_nsec) {
+    return it->second.key;
+  }
+
+  std::shared_ptr<const PublicKey> key = PublicKey::FromPemFile(path);
+  if (!key) {
+    file_keys_.erase(path);
+    return nullptr;
+  }
+  LOG(INFO) << "Loaded public key " << path;
+  FileKey& file_key = file_keys_[path];
+  file_key.key = key;
+  file_key.size = stbuf.st_size;
+  file_key.mtime = stbuf.st_mtim;
+  return key;
+}
+
+std::shared_ptr<const PublicKey> PublicKeyCache::GetKeyFromPem(
+    const string& pem) {
+  base::AutoLock auto_lock(lock_);
+  if (pem_key_ && pem == pem_)
+    return pem_key_;
+
+  std::shared_ptr<const PublicKey> key = PublicKey::FromPem(pem);
+  if (!key)
+    return nullptr;
+  pem_ = pem;
+  pem_key_ = key;
+  return key;
+}
+
+}  // namespace chromeos_update_engine
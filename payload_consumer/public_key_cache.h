@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PUBLIC_KEY_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PUBLIC_KEY_CACHE_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+
+#include "update_engine/payload_consumer/payload_verifier.h"
+
+namespace chromeos_update_engine {
+
+// Keeps the public keys used to verify the payloads parsed for the lifetime of
+// the daemon, so each update attempt, including the resumed ones, verifies the
+// metadata signature as soon as it is downloaded instead of reading and
+// parsing the key first. The keys in files are read again if the file changes.
+// All the methods are thread safe.
+class PublicKeyCache {
+ public:
+  PublicKeyCache() = default;
+
+  // Returns the key in the PEM file at |path|, or nullptr if the file can't be
+  // read or isn't a valid key.
+  std::shared_ptr<const PublicKey> GetKeyFromFile(const std::string& path);
+
+  // Returns the key in |pem|, as sent in the Omaha response, or nullptr if it
+  // isn't a valid key.
+  std::shared_ptr<const PublicKey> GetKeyFromPem(const std::string& pem);
+
+ private:
+  // A key parsed from a file, with the size and modification time of the file
+  // when it was read.
+  struct FileKey {
+    std::shared_ptr<const PublicKey> key;
+    off_t size{0};
+    struct timespec mtime{0, 0};
+  };
+
+  base::Lock lock_;
+  std::map<std::string, FileKey> file_keys_;
+  // The last key from a response. These keys are only used by test images,
+  // and rarely change.
+  std::string pem_;
+  std::shared_ptr<const PublicKey> pem_key_;
+
+  DISALLOW_COPY_AND_ASSIGN(PublicKeyCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PUBLIC_KEY_CACHE_H_
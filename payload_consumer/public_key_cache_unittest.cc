@@ -0,0 +1,87 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/public_key_cache.h"
+
+#include <string>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/time/time.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using chromeos_update_engine::test_utils::GetBuildArtifactsPath;
+using std::string;
+
+namespace chromeos_update_engine {
+
+extern const char* kUnittestPublicKeyPath;
+extern const char* kUnittestPublicKey2Path;
+
+class PublicKeyCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(utils::ReadFile(GetBuildArtifactsPath(kUnittestPublicKeyPath),
+                                &pem_));
+    ASSERT_TRUE(utils::ReadFile(GetBuildArtifactsPath(kUnittestPublicKey2Path),
+                                &pem2_));
+  }
+
+  PublicKeyCache cache_;
+  string pem_;
+  string pem2_;
+};
+
+TEST_F(PublicKeyCacheTest, FileKeyTest) {
+  test_utils::ScopedTempFile key_file("PublicKeyCacheTest-key.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileString(key_file.path(), pem_));
+  std::shared_ptr<const PublicKey> key = cache_.GetKeyFromFile(key_file.path());
+  ASSERT_TRUE(key);
+  // The key is only parsed once.
+  EXPECT_EQ(key, cache_.GetKeyFromFile(key_file.path()));
+
+  // A changed file is read again.
+  ASSERT_TRUE(test_utils::WriteFileString(key_file.path(), pem2_));
+  base::Time mtime = base::Time::Now() + base::TimeDelta::FromMinutes(1);
+  ASSERT_TRUE(base::TouchFile(base::FilePath(key_file.path()), mtime, mtime));
+  std::shared_ptr<const PublicKey> key2 =
+      cache_.GetKeyFromFile(key_file.path());
+  ASSERT_TRUE(key2);
+  EXPECT_NE(key, key2);
+  EXPECT_EQ(key2, cache_.GetKeyFromFile(key_file.path()));
+
+  ASSERT_TRUE(test_utils::WriteFileString(key_file.path(), "not a key"));
+  EXPECT_FALSE(cache_.GetKeyFromFile(key_file.path()));
+  EXPECT_FALSE(cache_.GetKeyFromFile("/non/existent/key.pem"));
+}
+
+TEST_F(PublicKeyCacheTest, PemKeyTest) {
+  std::shared_ptr<const PublicKey> key = cache_.GetKeyFromPem(pem_);
+  ASSERT_TRUE(key);
+  EXPECT_EQ(key, cache_.GetKeyFromPem(pem_));
+
+  std::shared_ptr<const PublicKey> key2 = cache_.GetKeyFromPem(pem2_);
+  ASSERT_TRUE(key2);
+  EXPECT_NE(key, key2);
+  EXPECT_FALSE(cache_.GetKeyFromPem("not a key"));
+  // A key that failed to parse doesn't replace the cached one.
+  EXPECT_EQ(key2, cache_.GetKeyFromPem(pem2_));
+}
+
+}  // namespace chromeos_update_engine
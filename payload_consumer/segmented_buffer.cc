@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/segmented_buffer.h"
+
+#include <algorithm>
+#include <utility>
+
+using std::max;
+using std::min;
+
+namespace chromeos_update_engine {
+
+const size_t SegmentedBuffer::kSegmentSize = 1024 * 1024;  // 1 MiB
+
+void SegmentedBuffer::Append(const void* data, size_t size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  while (size > 0) {
+    // The shared segments are never appended to.
+    if (segments_.empty() || segments_.back().shared_ ||
+        segments_.back().owned_.size() ==
+            segments_.back().owned_.capacity()) {
+      // Size the new segment for the rest of the expected data, if known.
+      size_t capacity = kSegmentSize;
+      if (reserved_size_ > size_) {
+        capacity = reserved_contiguous_ ? reserved_size_ - size_
+                                        : min(capacity, reserved_size_ - size_);
+      }
+      segments_.emplace_back();
+      segments_.back().owned_.reserve(max(capacity, min(size, kSegmentSize)));
+    }
+    brillo::Blob* segment = &segments_.back().owned_;
+    size_t chunk = min(size, segment->capacity() - segment->size());
+    segment->insert(segment->end(), bytes, bytes + chunk);
+    bytes += chunk;
+    size -= chunk;
+    size_ += chunk;
+  }
+}
+
+void SegmentedBuffer::AppendShared(std::shared_ptr<const brillo::Blob> blob,
+                                   size_t offset,
+                                   size_t size) {
+  if (size == 0)
+    return;
+  segments_.emplace_back();
+  Segment* segment = &segments_.back();
+  segment->shared_ = std::move(blob);
+  segment->shared_offset_ = offset;
+  segment->shared_size_ = size;
+  size_ += size;
+}
+
+void SegmentedBuffer::Reserve(size_t size) {
+  reserved_size_ = size;
+  reserved_contiguous_ = false;
+}
+
+void SegmentedBuffer::ReserveContiguous(size_t size) {
+  reserved_size_ = size;
+  reserved_contiguous_ = true;
+}
+
+const brillo::Blob& SegmentedBuffer::Flatten() {
+  if (segments_.size() == 1) {
+    const Segment& segment = segments_.front();
+    if (!segment.shared_)
+      return segment.owned_;
+    // A view of a whole shared blob doesn't need a copy either.
+    if (segment.shared_offset_ == 0 &&
+        segment.shared_size_ == segment.shared_->size()) {
+      return *segment.shared_;
+    }
+  }
+  Segment merged;
+  // Leave room for the rest of the expected data so the buffer stays in a
+  // single segment.
+  merged.owned_.reserve(max(size_, reserved_size_));
+  for (Segment& segment : segments_) {
+    merged.owned_.insert(
+        merged.owned_.end(), segment.data(), segment.data() + segment.size());
+    segment = Segment();
+  }
+  segments_.clear();
+  segments_.push_back(std::move(merged));
+  return segments_.front().owned_;
+}
+
+void SegmentedBuffer::Clear() {
+  // Swap with an empty vector to ensure that all memory is released.
+  std::vector<Segment>().swap(segments_);
+  size_ = 0;
+  reserved_size_ = 0;
+  reserved_contiguous_ = false;
+}
+
+void SegmentedBuffer::Swap(SegmentedBuffer* other) {
+  segments_.swap(other->segments_);
+  std::swap(size_, other->size_);
+  std::swap(reserved_size_, other->reserved_size_);
+  std::swap(reserved_contiguous_, other->reserved_contiguous_);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SEGMENTED_BUFFER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SEGMENTED_BUFFER_H_
+
+#include <memory>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+namespace chromeos_update_engine {
+
+// A byte buffer stored as a list of segments of up to |kSegmentSize| bytes.
+// Appending to it never moves the data already stored, so a large buffer
+// grows without reallocating and copying its contents. Consumers able to
+// process the data in pieces iterate over segments(); the rest can request a
+// contiguous copy with Flatten(). Data already held in a shared blob can be
+// added without copying it with AppendShared().
+class SegmentedBuffer {
+ public:
+  // A piece of the buffer data, either owned by the segment or viewing a
+  // range of a shared blob kept alive by the segment.
+  class Segment {
+   public:
+    Segment() = default;
+    Segment(Segment&&) = default;
+    Segment& operator=(Segment&&) = default;
+
+    const uint8_t* data() const {
+      return shared_ ? shared_->data() + shared_offset_ : owned_.data();
+    }
+    size_t size() const { return shared_ ? shared_size_ : owned_.size(); }
+
+   private:
+    friend class SegmentedBuffer;
+
+    brillo::Blob owned_;
+    std::shared_ptr<const brillo::Blob> shared_;
+    size_t shared_offset_{0};
+    size_t shared_size_{0};
+
+    DISALLOW_COPY_AND_ASSIGN(Segment);
+  };
+
+  static const size_t kSegmentSize;
+
+  SegmentedBuffer() = default;
+
+  // Appends |size| bytes from |data| to the buffer.
+  void Append(const void* data, size_t size);
+
+  // Appends the |size| bytes at |offset| in |blob| to the buffer without
+  // copying them. The buffer keeps a reference to |blob|, which must not be
+  // modified anymore.
+  void AppendShared(std::shared_ptr<const brillo::Blob> blob,
+                    size_t offset,
+                    size_t size);
+
+  // Hints that the buffer will grow up to |size| bytes, so the segments
+  // allocated by the next calls to Append() aren't bigger than needed.
+  void Reserve(size_t size);
+
+  // Like Reserve(), but the data appended until the buffer holds |size| bytes
+  // is stored in a single segment, so Flatten() doesn't need to copy it.
+  void ReserveContiguous(size_t size);
+
+  // Returns the buffer data as a single contiguous blob, merging the segments
+  // first if there is more than one of them. This copies the data at most once
+  // per Append() call spilling over a new segment. The merged segments are
+  // released as they are copied, so the peak memory use stays close to the
+  // buffer size.
+  const brillo::Blob& Flatten();
+
+  // Releases all the memory held by the buffer.
+  void Clear();
+
+  // Exchanges the contents of this buffer with |other|.
+  void Swap(SegmentedBuffer* other);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const std::vector<Segment>& segments() const { return segments_; }
+
+ private:
+  std::vector<Segment> segments_;
+  size_t size_{0};
+  size_t reserved_size_{0};
+  bool reserved_contiguous_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentedBuffer);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SEGMENTED_BUFFER_H_
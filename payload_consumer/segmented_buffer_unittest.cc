@@ -0,0 +1,131 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/segmented_buffer.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+brillo::Blob PatternBlob(size_t size) {
+  brillo::Blob data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = static_cast<uint8_t>(i * 7);
+  return data;
+}
+
+}  // namespace
+
+class SegmentedBufferTest : public ::testing::Test {
+ protected:
+  SegmentedBuffer buffer_;
+};
+
+TEST_F(SegmentedBufferTest, EmptyTest) {
+  EXPECT_TRUE(buffer_.empty());
+  EXPECT_EQ(0U, buffer_.size());
+  EXPECT_TRUE(buffer_.segments().empty());
+  EXPECT_TRUE(buffer_.Flatten().empty());
+}
+
+TEST_F(SegmentedBufferTest, SmallAppendsShareSegmentTest) {
+  brillo::Blob data = PatternBlob(1000);
+  buffer_.Reserve(data.size());
+  for (size_t i = 0; i < data.size(); i += 100)
+    buffer_.Append(data.data() + i, 100);
+  EXPECT_EQ(data.size(), buffer_.size());
+  EXPECT_EQ(1U, buffer_.segments().size());
+  EXPECT_EQ(data, buffer_.Flatten());
+}
+
+TEST_F(SegmentedBufferTest, LargeAppendSplitsInSegmentsTest) {
+  brillo::Blob data = PatternBlob(SegmentedBuffer::kSegmentSize * 2 + 10);
+  buffer_.Reserve(data.size());
+  buffer_.Append(data.data(), data.size());
+  EXPECT_EQ(data.size(), buffer_.size());
+  ASSERT_EQ(3U, buffer_.segments().size());
+  EXPECT_EQ(SegmentedBuffer::kSegmentSize, buffer_.segments()[0].size());
+  EXPECT_EQ(10U, buffer_.segments()[2].size());
+
+  EXPECT_EQ(data, buffer_.Flatten());
+  EXPECT_EQ(1U, buffer_.segments().size());
+}
+
+TEST_F(SegmentedBufferTest, AppendAfterFlattenTest) {
+  brillo::Blob data = PatternBlob(SegmentedBuffer::kSegmentSize + 20);
+  buffer_.Reserve(data.size() + 20);
+  buffer_.Append(data.data(), data.size());
+  buffer_.Flatten();
+  brillo::Blob more = PatternBlob(20);
+  buffer_.Append(more.data(), more.size());
+  // The flattened segment has room for the reserved size.
+  EXPECT_EQ(1U, buffer_.segments().size());
+  data.insert(data.end(), more.begin(), more.end());
+  EXPECT_EQ(data, buffer_.Flatten());
+}
+
+TEST_F(SegmentedBufferTest, ReserveContiguousTest) {
+  brillo::Blob data = PatternBlob(SegmentedBuffer::kSegmentSize * 2 + 10);
+  buffer_.ReserveContiguous(data.size());
+  for (size_t i = 0; i < data.size(); i += 1000) {
+    buffer_.Append(data.data() + i, std::min<size_t>(1000, data.size() - i));
+  }
+  EXPECT_EQ(data.size(), buffer_.size());
+  ASSERT_EQ(1U, buffer_.segments().size());
+  const uint8_t* segment_data = buffer_.segments()[0].data();
+  // No copy is needed.
+  EXPECT_EQ(segment_data, buffer_.Flatten().data());
+  EXPECT_EQ(data, buffer_.Flatten());
+}
+
+TEST_F(SegmentedBufferTest, AppendSharedTest) {
+  auto shared = std::make_shared<const brillo::Blob>(PatternBlob(100));
+  buffer_.Append(shared->data(), 10);
+  buffer_.AppendShared(shared, 10, 80);
+  buffer_.Append(shared->data() + 90, 10);
+  EXPECT_EQ(100U, buffer_.size());
+  ASSERT_EQ(3U, buffer_.segments().size());
+  // The shared bytes aren't copied.
+  EXPECT_EQ(shared->data() + 10, buffer_.segments()[1].data());
+  EXPECT_EQ(80U, buffer_.segments()[1].size());
+  EXPECT_EQ(*shared, buffer_.Flatten());
+  EXPECT_EQ(1U, buffer_.segments().size());
+  EXPECT_TRUE(shared.unique());
+
+  // A buffer viewing a whole shared blob is flattened without a copy.
+  SegmentedBuffer other;
+  other.AppendShared(shared, 0, shared->size());
+  EXPECT_EQ(shared->data(), other.Flatten().data());
+}
+
+TEST_F(SegmentedBufferTest, ClearAndSwapTest) {
+  brillo::Blob data = PatternBlob(100);
+  buffer_.Append(data.data(), data.size());
+  SegmentedBuffer other;
+  other.Swap(&buffer_);
+  EXPECT_TRUE(buffer_.empty());
+  EXPECT_EQ(data, other.Flatten());
+  other.Clear();
+  EXPECT_TRUE(other.empty());
+  EXPECT_TRUE(other.segments().empty());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,153 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/verity_writer.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const char kHashTreeAlgorithm[] = "sha256";
+const uint64_t kDigestSize = 32;
+
+uint64_t DivRoundUp(uint64_t value, uint64_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+}  // namespace
+
+uint64_t VerityWriter::HashTreeSize(uint64_t data_size, uint64_t block_size) {
+  uint64_t hashes_per_block = block_size / kDigestSize;
+  uint64_t level_blocks = DivRoundUp(data_size, block_size);
+  uint64_t tree_blocks = 0;
+  do {
+    level_blocks = DivRoundUp(level_blocks, hashes_per_block);
+    tree_blocks += level_blocks;
+  } while (level_blocks > 1);
+  return tree_blocks * block_size;
+}
+
+bool VerityWriter::Init(const InstallPlan::Partition& partition) {
+  if (partition.hash_tree_algorithm != kHashTreeAlgorithm) {
+    LOG(ERROR) << "Unsupported hash tree algorithm \""
+               << partition.hash_tree_algorithm << "\" for partition "
+               << partition.name;
+    return false;
+  }
+  block_size_ = partition.block_size;
+  data_offset_ = partition.hash_tree_data_offset;
+  data_size_ = partition.hash_tree_data_size;
+  tree_offset_ = partition.hash_tree_offset;
+  tree_size_ = partition.hash_tree_size;
+  salt_ = partition.hash_tree_salt;
+  TEST_AND_RETURN_FALSE(block_size_ >= kDigestSize &&
+                        block_size_ % kDigestSize == 0);
+  TEST_AND_RETURN_FALSE(data_size_ > 0 && data_size_ % block_size_ == 0);
+  // The tree comes after the data it covers.
+  TEST_AND_RETURN_FALSE(tree_offset_ >= data_end());
+  if (tree_size_ != HashTreeSize(data_size_, block_size_)) {
+    LOG(ERROR) << "The hash tree of partition " << partition.name << " takes "
+               << HashTreeSize(data_size_, block_size_) << " bytes, not "
+               << tree_size_;
+    return false;
+  }
+
+  hashed_size_ = 0;
+  partial_block_.clear();
+  levels_.assign(1, brillo::Blob());
+  levels_[0].reserve(data_size_ / block_size_ * kDigestSize);
+  root_hash_.clear();
+  return true;
+}
+
+bool VerityWriter::Update(uint64_t offset, const uint8_t* data, size_t size) {
+  // Skip the bytes before and after the hash tree data.
+  uint64_t end = std::min(offset + size, data_end());
+  if (offset < data_offset_) {
+    data += std::min(data_offset_ - offset, static_cast<uint64_t>(size));
+    offset = data_offset_;
+  }
+  if (offset >= end)
+    return true;
+  TEST_AND_RETURN_FALSE(offset == data_offset_ + hashed_size_);
+  size = end - offset;
+  hashed_size_ += size;
+
+  if (!partial_block_.empty()) {
+    size_t count = std::min(
+        static_cast<size_t>(block_size_ - partial_block_.size()), size);
+    partial_block_.insert(partial_block_.end(), data, data + count);
+    data += count;
+    size -= count;
+    if (partial_block_.size() < block_size_)
+      return true;
+    TEST_AND_RETURN_FALSE(HashBlock(partial_block_.data(), &levels_[0]));
+    partial_block_.clear();
+  }
+  for (; size >= block_size_; data += block_size_, size -= block_size_)
+    TEST_AND_RETURN_FALSE(HashBlock(data, &levels_[0]));
+  partial_block_.assign(data, data + size);
+  return true;
+}
+
+bool VerityWriter::Finalize(const FileDescriptorPtr& fd) {
+  TEST_AND_RETURN_FALSE(hashed_size_ == data_size_);
+  // Every level is padded to whole blocks and hashed into the next one, up to
+  // a level of a single block.
+  while (true) {
+    brillo::Blob& level = levels_.back();
+    level.resize(DivRoundUp(level.size(), block_size_) * block_size_);
+    if (level.size() == block_size_)
+      break;
+    brillo::Blob next_level;
+    next_level.reserve(level.size() / block_size_ * kDigestSize);
+    for (uint64_t i = 0; i < level.size(); i += block_size_)
+      TEST_AND_RETURN_FALSE(HashBlock(level.data() + i, &next_level));
+    levels_.push_back(std::move(next_level));
+  }
+  brillo::Blob root_hash;
+  TEST_AND_RETURN_FALSE(HashBlock(levels_.back().data(), &root_hash));
+
+  uint64_t offset = tree_offset_;
+  for (auto level = levels_.rbegin(); level != levels_.rend(); level++) {
+    TEST_AND_RETURN_FALSE(
+        utils::PWriteAll(fd, level->data(), level->size(), offset));
+    offset += level->size();
+  }
+  TEST_AND_RETURN_FALSE(offset == tree_offset_ + tree_size_);
+  TEST_AND_RETURN_FALSE(fd->Flush());
+  levels_.clear();
+  root_hash_ = root_hash;
+  return true;
+}
+
+bool VerityWriter::HashBlock(const uint8_t* block, brillo::Blob* level) {
+  HashCalculator hasher;
+  TEST_AND_RETURN_FALSE(hasher.Update(salt_.data(), salt_.size()));
+  TEST_AND_RETURN_FALSE(hasher.Update(block, block_size_));
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+  const brillo::Blob& hash = hasher.raw_hash();
+  level->insert(level->end(), hash.begin(), hash.end());
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,88 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_VERITY_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_VERITY_WRITER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/install_plan.h"
+
+namespace chromeos_update_engine {
+
+// Builds the dm-verity hash tree of a partition from its data, passed in
+// order, and writes it to the partition. The tree has the format of the
+// version 1 of dm-verity: every block, of data or of hashes, is hashed with the
+// salt prepended, and the levels of the tree are stored from the top one down.
+class VerityWriter {
+ public:
+  VerityWriter() = default;
+
+  // Returns the size of the hash tree of |data_size| bytes of data.
+  static uint64_t HashTreeSize(uint64_t data_size, uint64_t block_size);
+
+  // Starts building the hash tree described in |partition|. Returns false if
+  // the description isn't valid or supported. Only the "sha256" algorithm is
+  // supported.
+  bool Init(const InstallPlan::Partition& partition);
+
+  // Adds the |size| bytes of |data| at |offset| in the partition. The data
+  // must be passed in order; the bytes outside the hash tree data are ignored.
+  bool Update(uint64_t offset, const uint8_t* data, size_t size);
+
+  // Returns the offset in the partition after the hash tree data, once all the
+  // data up to it is needed to write the tree.
+  uint64_t data_end() const { return data_offset_ + data_size_; }
+
+  // Builds the hash tree from all the data passed and writes it to |fd|, open
+  // on the partition.
+  bool Finalize(const FileDescriptorPtr& fd);
+
+  // The hash of the top level of the tree, set by Finalize().
+  const brillo::Blob& root_hash() const { return root_hash_; }
+
+ private:
+  // Appends the hash of the |block_size_| bytes of |block| to |level|.
+  bool HashBlock(const uint8_t* block, brillo::Blob* level);
+
+  uint64_t block_size_{0};
+  uint64_t data_offset_{0};
+  uint64_t data_size_{0};
+  uint64_t tree_offset_{0};
+  uint64_t tree_size_{0};
+  brillo::Blob salt_;
+
+  // The bytes of data passed so far, and those of the last block until it is
+  // complete.
+  uint64_t hashed_size_{0};
+  brillo::Blob partial_block_;
+
+  // The levels of the tree, the hashes of the data blocks first.
+  std::vector<brillo::Blob> levels_;
+  brillo::Blob root_hash_;
+
+  DISALLOW_COPY_AND_ASSIGN(VerityWriter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_VERITY_WRITER_H_
@@ -0,0 +1,160 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/verity_writer.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+class VerityWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    partition_.name = "system";
+    partition_.block_size = 4096;
+    partition_.hash_tree_algorithm = "sha256";
+    partition_.hash_tree_salt = {'s', 'a', 'l', 't'};
+  }
+
+  // Sets the hash tree of |partition_| to cover |num_blocks| blocks from the
+  // beginning, followed by the tree, and fills |data_| with them.
+  void SetDataBlocks(uint64_t num_blocks) {
+    partition_.hash_tree_data_size = num_blocks * partition_.block_size;
+    partition_.hash_tree_offset = partition_.hash_tree_data_size;
+    partition_.hash_tree_size = VerityWriter::HashTreeSize(
+        partition_.hash_tree_data_size, partition_.block_size);
+    data_.resize(partition_.hash_tree_data_size);
+    test_utils::FillWithData(&data_);
+  }
+
+  // Returns the hashes of the blocks in |blocks|, padded to whole blocks.
+  brillo::Blob HashBlocks(const brillo::Blob& blocks) {
+    brillo::Blob result;
+    for (size_t i = 0; i < blocks.size(); i += partition_.block_size) {
+      brillo::Blob block = partition_.hash_tree_salt;
+      block.insert(block.end(),
+                   blocks.begin() + i,
+                   blocks.begin() + i + partition_.block_size);
+      brillo::Blob hash;
+      EXPECT_TRUE(HashCalculator::RawHashOfData(block, &hash));
+      result.insert(result.end(), hash.begin(), hash.end());
+    }
+    result.resize((result.size() + partition_.block_size - 1) /
+                  partition_.block_size * partition_.block_size);
+    return result;
+  }
+
+  // Passes |data_| to |verity_writer_| in chunks of |chunk_size| bytes and
+  // returns the hash tree written.
+  brillo::Blob WriteHashTree(size_t chunk_size) {
+    EXPECT_TRUE(verity_writer_.Init(partition_));
+    for (size_t i = 0; i < data_.size(); i += chunk_size) {
+      EXPECT_TRUE(verity_writer_.Update(
+          i, data_.data() + i, std::min(chunk_size, data_.size() - i)));
+    }
+    FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+    EXPECT_TRUE(fd->Open(temp_file_.path().c_str(), O_RDWR));
+    EXPECT_TRUE(verity_writer_.Finalize(fd));
+    EXPECT_TRUE(fd->Close());
+
+    brillo::Blob partition_data;
+    EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &partition_data));
+    EXPECT_EQ(partition_.hash_tree_offset + partition_.hash_tree_size,
+              partition_data.size());
+    return brillo::Blob(partition_data.begin() + partition_.hash_tree_offset,
+                        partition_data.end());
+  }
+
+  InstallPlan::Partition partition_;
+  brillo::Blob data_;
+  test_utils::ScopedTempFile temp_file_{"VerityWriterTest.XXXXXX"};
+  VerityWriter verity_writer_;
+};
+
+TEST_F(VerityWriterTest, HashTreeSizeTest) {
+  EXPECT_EQ(4096U, VerityWriter::HashTreeSize(4096, 4096));
+  EXPECT_EQ(4096U, VerityWriter::HashTreeSize(128 * 4096, 4096));
+  EXPECT_EQ(3 * 4096U, VerityWriter::HashTreeSize(129 * 4096, 4096));
+  EXPECT_EQ(129 * 4096U, VerityWriter::HashTreeSize(128 * 128 * 4096, 4096));
+}
+
+TEST_F(VerityWriterTest, SingleLevelTest) {
+  SetDataBlocks(3);
+  brillo::Blob level0 = HashBlocks(data_);
+  EXPECT_EQ(level0, WriteHashTree(1000));
+  brillo::Blob root_hash = HashBlocks(level0);
+  root_hash.resize(32);
+  EXPECT_EQ(root_hash, verity_writer_.root_hash());
+}
+
+TEST_F(VerityWriterTest, TwoLevelsTest) {
+  SetDataBlocks(129);
+  brillo::Blob level0 = HashBlocks(data_);
+  brillo::Blob level1 = HashBlocks(level0);
+  // The top level is written first.
+  brillo::Blob expected_tree = level1;
+  expected_tree.insert(expected_tree.end(), level0.begin(), level0.end());
+  EXPECT_EQ(expected_tree, WriteHashTree(3 * 4096 + 7));
+  brillo::Blob root_hash = HashBlocks(level1);
+  root_hash.resize(32);
+  EXPECT_EQ(root_hash, verity_writer_.root_hash());
+}
+
+TEST_F(VerityWriterTest, DataOffsetTest) {
+  // The data before and after the hash tree data are ignored.
+  SetDataBlocks(2);
+  partition_.hash_tree_data_offset = 4096;
+  partition_.hash_tree_data_size = 4096;
+  partition_.hash_tree_size = 4096;
+  ASSERT_TRUE(verity_writer_.Init(partition_));
+  EXPECT_TRUE(verity_writer_.Update(0, data_.data(), data_.size()));
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+  ASSERT_TRUE(fd->Open(temp_file_.path().c_str(), O_RDWR));
+  EXPECT_TRUE(verity_writer_.Finalize(fd));
+  EXPECT_TRUE(fd->Close());
+  brillo::Blob root_hash = HashBlocks(
+      HashBlocks(brillo::Blob(data_.begin() + 4096, data_.end())));
+  root_hash.resize(32);
+  EXPECT_EQ(root_hash, verity_writer_.root_hash());
+}
+
+TEST_F(VerityWriterTest, InvalidPartitionTest) {
+  SetDataBlocks(3);
+  partition_.hash_tree_algorithm = "sha1";
+  EXPECT_FALSE(verity_writer_.Init(partition_));
+  partition_.hash_tree_algorithm = "sha256";
+  partition_.hash_tree_size += 4096;
+  EXPECT_FALSE(verity_writer_.Init(partition_));
+  partition_.hash_tree_size -= 4096;
+  partition_.hash_tree_offset = 0;
+  EXPECT_FALSE(verity_writer_.Init(partition_));
+}
+
+TEST_F(VerityWriterTest, OutOfOrderDataTest) {
+  SetDataBlocks(3);
+  ASSERT_TRUE(verity_writer_.Init(partition_));
+  EXPECT_FALSE(verity_writer_.Update(4096, data_.data() + 4096, 4096));
+}
+
+}  // namespace chromeos_update_engine
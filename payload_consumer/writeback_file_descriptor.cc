@@ -0,0 +1,167 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/writeback_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+namespace chromeos_update_engine {
+
+bool WritebackFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  Reset();
+  return fd_->Open(path, flags, mode);
+}
+
+bool WritebackFileDescriptor::Open(const char* path, int flags) {
+  Reset();
+  return fd_->Open(path, flags);
+}
+
+ssize_t WritebackFileDescriptor::Read(void* buf, size_t count) {
+  ssize_t bytes_read = fd_->Read(buf, count);
+  if (bytes_read > 0)
+    offset_ += bytes_read;
+  return bytes_read;
+}
+
+ssize_t WritebackFileDescriptor::Write(const void* buf, size_t count) {
+  ssize_t bytes_written = fd_->Write(buf, count);
+  if (bytes_written > 0) {
+    AddDirtyRange(offset_, bytes_written);
+    offset_ += bytes_written;
+  }
+  return bytes_written;
+}
+
+off64_t WritebackFileDescriptor::Seek(off64_t offset, int whence) {
+  off64_t result = fd_->Seek(offset, whence);
+  if (result >= 0)
+    offset_ = result;
+  return result;
+}
+
+bool WritebackFileDescriptor::CopyRangeFrom(FileDescriptor* source,
+                                            uint64_t source_offset,
+                                            uint64_t offset,
+                                            uint64_t length) {
+  if (!fd_->CopyRangeFrom(source, source_offset, offset, length))
+    return false;
+  AddDirtyRange(offset, length);
+  return true;
+}
+
+bool WritebackFileDescriptor::Flush() {
+  // Start the writeback of the last writes and wait for all of it, so only
+  // the data written since the last window is written back now.
+  if (enabled_ && !failed_) {
+    if (!StartWriteback() || !WaitForWriteback(writeback_))
+      failed_ = true;
+    writeback_ = Range();
+  }
+  if (failed_) {
+    LOG(ERROR) << "The writeback of fd " << fd_->GetNativeFd() << " failed.";
+    return false;
+  }
+  return fd_->Flush();
+}
+
+bool WritebackFileDescriptor::Close() {
+  Reset();
+  return fd_->Close();
+}
+
+void WritebackFileDescriptor::AddDirtyRange(off64_t offset, uint64_t length) {
+  if (!enabled_ || length == 0)
+    return;
+  off64_t end = offset + length;
+  if (dirty_bytes_ == 0) {
+    dirty_ = {offset, end};
+  } else {
+    dirty_.start = std::min(dirty_.start, offset);
+    dirty_.end = std::max(dirty_.end, end);
+  }
+  dirty_bytes_ += length;
+  if (dirty_bytes_ >= window_size_ && !StartWriteback())
+    failed_ = true;
+}
+
+bool WritebackFileDescriptor::StartWriteback() {
+  int fd = fd_->GetNativeFd();
+  if (fd < 0) {
+    enabled_ = false;
+    dirty_ = Range();
+    dirty_bytes_ = 0;
+    writeback_ = Range();
+    return true;
+  }
+  if (dirty_bytes_ > 0) {
+    // Only queues the dirty pages for writing, without waiting for them.
+    if (sync_file_range(fd,
+                        dirty_.start,
+                        dirty_.end - dirty_.start,
+                        SYNC_FILE_RANGE_WRITE) != 0) {
+      PLOG(WARNING) << "Unable to start the writeback of fd " << fd
+                    << ", leaving it to the kernel.";
+      enabled_ = false;
+    } else {
+      stats_.writebacks++;
+      stats_.bytes_written_back += dirty_bytes_;
+    }
+  }
+  Range previous = writeback_;
+  writeback_ = enabled_ ? dirty_ : Range();
+  dirty_ = Range();
+  dirty_bytes_ = 0;
+  // The previous window had the time of writing this one to reach the disk,
+  // so waiting for it rarely blocks.
+  return WaitForWriteback(previous);
+}
+
+bool WritebackFileDescriptor::WaitForWriteback(const Range& range) {
+  if (range.start == range.end)
+    return true;
+  int fd = fd_->GetNativeFd();
+  if (HANDLE_EINTR(sync_file_range(fd,
+                                   range.start,
+                                   range.end - range.start,
+                                   SYNC_FILE_RANGE_WAIT_BEFORE |
+                                       SYNC_FILE_RANGE_WRITE |
+                                       SYNC_FILE_RANGE_WAIT_AFTER)) != 0) {
+    PLOG(ERROR) << "Unable to write back " << range.end - range.start
+                << " bytes at offset " << range.start << " of fd " << fd;
+    return false;
+  }
+  // The data is now clean, so it doesn't need to stay in the page cache and
+  // evict the pages of the rest of the system. Failing to drop it is fine.
+  fd_->DropCache(range.start, range.end - range.start);
+  return true;
+}
+
+void WritebackFileDescriptor::Reset() {
+  enabled_ = true;
+  failed_ = false;
+  offset_ = 0;
+  dirty_ = Range();
+  dirty_bytes_ = 0;
+  writeback_ = Range();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITEBACK_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITEBACK_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A FileDescriptor forwarding all the calls to |fd| which starts the
+// writeback of the data written through it every |window_size| bytes, with
+// sync_file_range(), instead of leaving it all dirty in the page cache until
+// it is flushed. When a window is started, the previous one is waited for and
+// dropped from the page cache, so at most two windows of data are dirty or
+// under writeback at once and flushing the file only waits for those. The
+// writes not made through the native file descriptor of |fd|, e.g. those of a
+// CachedFileDescriptor, are passed through unchanged.
+class WritebackFileDescriptor : public FileDescriptor {
+ public:
+  // Counters of the writebacks started.
+  struct Stats {
+    // The number of ranges whose writeback was started and the bytes written
+    // to them since the previous one.
+    uint64_t writebacks{0};
+    uint64_t bytes_written_back{0};
+  };
+
+  WritebackFileDescriptor(FileDescriptorPtr fd, uint64_t window_size)
+      : fd_(fd), window_size_(window_size) {}
+  ~WritebackFileDescriptor() override = default;
+
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    return fd_->BlkIoctl(request, start, length, result);
+  }
+  bool Readahead(uint64_t offset, uint64_t length) override {
+    return fd_->Readahead(offset, length);
+  }
+  bool DropCache(uint64_t offset, uint64_t length) override {
+    return fd_->DropCache(offset, length);
+  }
+  bool CopyRangeFrom(FileDescriptor* source,
+                     uint64_t source_offset,
+                     uint64_t offset,
+                     uint64_t length) override;
+  int GetNativeFd() override { return fd_->GetNativeFd(); }
+  bool Flush() override;
+  bool Close() override;
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_->IsOpen(); }
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  // A range of bytes of the file, empty when |start| == |end|.
+  struct Range {
+    off64_t start{0};
+    off64_t end{0};
+  };
+
+  // Records that the |length| bytes at |offset| were written and starts their
+  // writeback once a whole window is dirty.
+  void AddDirtyRange(off64_t offset, uint64_t length);
+
+  // Starts the writeback of the |dirty_| range, then waits for the one of the
+  // |writeback_| range, started before, and drops it from the page cache.
+  // Returns false if waiting for the previous writeback failed.
+  bool StartWriteback();
+
+  // Waits for the writeback of |range| to complete and drops it from the
+  // page cache. Returns false if the writeback failed.
+  bool WaitForWriteback(const Range& range);
+
+  // Resets the ranges tracked, e.g. when the file is opened again.
+  void Reset();
+
+  FileDescriptorPtr fd_;
+  const uint64_t window_size_;
+  // False once sync_file_range() isn't supported by the file.
+  bool enabled_{true};
+  // True once the writeback of a range failed, so the next Flush() fails.
+  bool failed_{false};
+  // The offset of the next Read() or Write() of |fd_|.
+  off64_t offset_{0};
+  // The range spanning the writes not written back yet, and how many bytes
+  // were written to it.
+  Range dirty_;
+  uint64_t dirty_bytes_{0};
+  // The range whose writeback was started last.
+  Range writeback_;
+  Stats stats_;
+
+  DISALLOW_COPY_AND_ASSIGN(WritebackFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITEBACK_FILE_DESCRIPTOR_H_
@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/writeback_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/cached_file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+const uint64_t kWindowSize = 64 * 1024;
+}  // namespace
+
+class WritebackFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(200 * 1024);
+    test_utils::FillWithData(&data_);
+  }
+
+  // Opens |fd_| writing back the writes to the temp file made through |fd|.
+  void Open(FileDescriptorPtr fd) {
+    fd_.reset(new WritebackFileDescriptor(fd, kWindowSize));
+    ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR));
+  }
+
+  // Writes the |count| bytes of |data_| at |offset| in chunks of |chunk_size|.
+  void WriteData(uint64_t offset, size_t count, size_t chunk_size) {
+    ASSERT_EQ(static_cast<off64_t>(offset), fd_->Seek(offset, SEEK_SET));
+    for (size_t i = 0; i < count; i += chunk_size) {
+      ASSERT_TRUE(utils::WriteAll(
+          fd_, data_.data() + offset + i, std::min(chunk_size, count - i)));
+    }
+  }
+
+  // Checks that the temp file has the contents of |data_|.
+  void ExpectFileData() {
+    brillo::Blob file_data;
+    EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &file_data));
+    EXPECT_EQ(data_, file_data);
+  }
+
+  test_utils::ScopedTempFile temp_file_{"WritebackFileDescriptorTest.XXXXXX"};
+  brillo::Blob data_;
+  std::shared_ptr<WritebackFileDescriptor> fd_;
+};
+
+TEST_F(WritebackFileDescriptorTest, WindowsTest) {
+  Open(FileDescriptorPtr(new EintrSafeFileDescriptor()));
+  WriteData(0, data_.size(), 16 * 1024);
+  // A writeback is started for each whole window written.
+  EXPECT_EQ(3U, fd_->stats().writebacks);
+  EXPECT_EQ(3 * kWindowSize, fd_->stats().bytes_written_back);
+
+  // Flushing writes back the rest.
+  EXPECT_TRUE(fd_->Flush());
+  EXPECT_EQ(4U, fd_->stats().writebacks);
+  EXPECT_EQ(data_.size(), fd_->stats().bytes_written_back);
+  EXPECT_TRUE(fd_->Close());
+  ExpectFileData();
+}
+
+TEST_F(WritebackFileDescriptorTest, OutOfOrderWritesTest) {
+  Open(FileDescriptorPtr(new EintrSafeFileDescriptor()));
+  // The windows count the bytes written, wherever they are.
+  WriteData(100 * 1024, data_.size() - 100 * 1024, 32 * 1024);
+  WriteData(0, 100 * 1024, 32 * 1024);
+  EXPECT_EQ(3U, fd_->stats().writebacks);
+  EXPECT_TRUE(fd_->Flush());
+  EXPECT_EQ(data_.size(), fd_->stats().bytes_written_back);
+  EXPECT_TRUE(fd_->Close());
+  ExpectFileData();
+}
+
+TEST_F(WritebackFileDescriptorTest, NoNativeFdTest) {
+  // The cached writes aren't in the file, so they can't be written back.
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+  Open(FileDescriptorPtr(new CachedFileDescriptor(fd, 4096)));
+  WriteData(0, data_.size(), 16 * 1024);
+  EXPECT_TRUE(fd_->Flush());
+  EXPECT_EQ(0U, fd_->stats().writebacks);
+  EXPECT_TRUE(fd_->Close());
+  ExpectFileData();
+}
+
+}  // namespace chromeos_update_engine
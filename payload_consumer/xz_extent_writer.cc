@@ -16,13 +16,29 @@
 
 #include "update_engine/payload_consumer/xz_extent_writer.h"
 
-using google::protobuf::RepeatedPtrField;
+#include <string.h>
+
+#include <base/threading/simple_thread.h>
 
 namespace chromeos_update_engine {
 
 namespace {
 const brillo::Blob::size_type kOutputBufferLength = 16 * 1024;
 
+// The xz container format constants used when splitting a stream.
+const uint8_t kXzMagic[] = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+const uint8_t kXzFooterMagic[] = {'Y', 'Z'};
+const size_t kXzStreamHeaderSize = 12;
+const uint8_t kXzCheckNone = 0;
+const uint8_t kXzLzma2FilterId = 0x21;
+
+// The maximum uncompressed size of the first segment of a stream decoded in
+// parallel, which is buffered before the first dictionary reset is found. It
+// fits the blocks compressed in parallel by the generator, four times the
+// dictionary size of its "level 6". Streams without a reset within this size
+// are decoded serially instead.
+const uint64_t kMaxFirstSegmentSize = 32 * 1024 * 1024;
+
 // xz uses a variable dictionary size which impacts on the compression ratio
 // and is required to be reconstructed in RAM during decompression. While we
 // control the required memory from the compressor side, the decompressor allows
@@ -48,21 +64,232 @@ const char* XzErrorString(enum xz_ret error) {
   }
   #undef __XZ_ERROR_STRING_CASE
 }
+
+uint32_t ReadLE32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 |
+         static_cast<uint32_t>(data[3]) << 24;
+}
+
+void AppendLE32(uint32_t value, brillo::Blob* out) {
+  for (int i = 0; i < 4; i++)
+    out->push_back((value >> (8 * i)) & 0xff);
+}
+
+// Appends |value| to |out| as an xz variable length integer.
+void AppendVarint(uint64_t value, brillo::Blob* out) {
+  while (value >= 0x80) {
+    out->push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out->push_back(value);
+}
+
+// Reads an xz variable length integer from the |size| bytes at |data| into
+// |value|, advancing |pos|. Returns whether it succeeded.
+bool ReadVarint(const uint8_t* data, size_t size, size_t* pos, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 63 && *pos < size; shift += 7) {
+    uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return byte != 0 || shift == 0;
+  }
+  return false;
+}
+
+// Pads |out| with zeros up to a multiple of four bytes.
+void PadToFourBytes(brillo::Blob* out) {
+  out->resize((out->size() + 3) & ~static_cast<size_t>(3), 0);
+}
+
+// Parses the |size| bytes block header at |header|. Returns whether it is a
+// valid block header using only the LZMA2 filter, storing its property byte
+// in |dict_size_props|.
+bool ParseBlockHeader(const uint8_t* header,
+                      size_t size,
+                      uint8_t* dict_size_props) {
+  if (xz_crc32(header, size - 4, 0) != ReadLE32(header + size - 4))
+    return false;
+  uint8_t flags = header[1];
+  // A single filter, and no reserved bits set.
+  if (flags & 0x3f)
+    return false;
+  size_t pos = 2;
+  uint64_t value;
+  // The optional compressed and uncompressed sizes.
+  if ((flags & 0x40) && !ReadVarint(header, size - 4, &pos, &value))
+    return false;
+  if ((flags & 0x80) && !ReadVarint(header, size - 4, &pos, &value))
+    return false;
+  if (!ReadVarint(header, size - 4, &pos, &value) || value != kXzLzma2FilterId)
+    return false;
+  if (!ReadVarint(header, size - 4, &pos, &value) || value != 1 ||
+      pos >= size - 4) {
+    return false;
+  }
+  *dict_size_props = header[pos++];
+  for (; pos < size - 4; pos++) {
+    if (header[pos] != 0)
+      return false;
+  }
+  return true;
+}
+
+// Returns a complete xz stream, without integrity check, holding a single
+// block with the |size| bytes of LZMA2 chunks at |chunks|, which must start by
+// resetting the dictionary and decode to |uncompressed_size| bytes.
+brillo::Blob BuildXzStream(uint8_t dict_size_props,
+                           const uint8_t* chunks,
+                           size_t size,
+                           uint64_t uncompressed_size) {
+  brillo::Blob stream(std::begin(kXzMagic), std::end(kXzMagic));
+  stream.push_back(0);
+  stream.push_back(kXzCheckNone);
+  AppendLE32(xz_crc32(stream.data() + sizeof(kXzMagic), 2, 0), &stream);
+
+  // The block header with only the LZMA2 filter.
+  size_t block_start = stream.size();
+  const uint8_t block_header[] = {
+      0x02, 0x00, kXzLzma2FilterId, 0x01, dict_size_props, 0x00, 0x00, 0x00};
+  stream.insert(
+      stream.end(), std::begin(block_header), std::end(block_header));
+  AppendLE32(xz_crc32(block_header, sizeof(block_header), 0), &stream);
+  stream.insert(stream.end(), chunks, chunks + size);
+  // The end of the LZMA2 data.
+  stream.push_back(0x00);
+  uint64_t unpadded_size = stream.size() - block_start;
+  PadToFourBytes(&stream);
+
+  // The index, with a single record.
+  size_t index_start = stream.size();
+  stream.push_back(0x00);
+  AppendVarint(1, &stream);
+  AppendVarint(unpadded_size, &stream);
+  AppendVarint(uncompressed_size, &stream);
+  PadToFourBytes(&stream);
+  AppendLE32(xz_crc32(stream.data() + index_start,
+                      stream.size() - index_start,
+                      0),
+             &stream);
+  uint32_t backward_size = (stream.size() - index_start) / 4 - 1;
+
+  brillo::Blob footer_fields;
+  AppendLE32(backward_size, &footer_fields);
+  footer_fields.push_back(0);
+  footer_fields.push_back(kXzCheckNone);
+  AppendLE32(xz_crc32(footer_fields.data(), footer_fields.size(), 0), &stream);
+  stream.insert(stream.end(), footer_fields.begin(), footer_fields.end());
+  stream.insert(
+      stream.end(), std::begin(kXzFooterMagic), std::end(kXzFooterMagic));
+  return stream;
+}
+
 }  // namespace
 
+// Decodes a segment of the stream on its own thread, into a buffer.
+class XzExtentWriter::SegmentDecoder
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  SegmentDecoder(brillo::Blob stream, uint64_t uncompressed_size)
+      : stream_(std::move(stream)), output_(uncompressed_size) {}
+
+  ~SegmentDecoder() override { Wait(); }
+
+  void Start() {
+    thread_.reset(new base::DelegateSimpleThread(this, "xz-decoder"));
+    thread_->Start();
+  }
+
+  // Waits for the segment to be decoded and returns whether it succeeded.
+  bool Wait() {
+    if (thread_) {
+      thread_->Join();
+      thread_.reset();
+    }
+    return result_;
+  }
+
+  const brillo::Blob& output() const { return output_; }
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    // The whole segment is in memory, so it is decoded in a single call
+    // straight into |output_|, without a dictionary buffer.
+    xz_dec* decoder = xz_dec_init(XZ_SINGLE, 0);
+    if (decoder == nullptr)
+      return;
+    xz_buf request;
+    request.in = stream_.data();
+    request.in_pos = 0;
+    request.in_size = stream_.size();
+    request.out = output_.data();
+    request.out_pos = 0;
+    request.out_size = output_.size();
+    xz_ret ret = xz_dec_run(decoder, &request);
+    xz_dec_end(decoder);
+    if (ret != XZ_STREAM_END) {
+      LOG(ERROR) << "xz_dec_run returned " << XzErrorString(ret)
+                 << " decoding a segment of " << output_.size() << " bytes.";
+    } else {
+      result_ = request.out_pos == output_.size();
+    }
+    stream_.clear();
+    stream_.shrink_to_fit();
+  }
+
+ private:
+  brillo::Blob stream_;
+  brillo::Blob output_;
+  std::unique_ptr<base::DelegateSimpleThread> thread_;
+  bool result_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentDecoder);
+};
+
+XzExtentWriter::XzExtentWriter(std::unique_ptr<ExtentWriter> underlying_writer,
+                               size_t num_threads,
+                               DecoderPool* pool)
+    : underlying_writer_(std::move(underlying_writer)),
+      pool_(pool),
+      num_threads_(num_threads),
+      state_(num_threads > 1 ? State::kStreamHeader : State::kSerial) {}
+
 XzExtentWriter::~XzExtentWriter() {
-  xz_dec_end(stream_);
+  if (pool_)
+    pool_->PutXzDecoder(stream_);
+  else
+    xz_dec_end(stream_);
 }
 
 bool XzExtentWriter::Init(FileDescriptorPtr fd,
-                          const RepeatedPtrField<Extent>& extents,
+                          ExtentSpan extents,
                           uint32_t block_size) {
-  stream_ = xz_dec_init(XZ_DYNALLOC, kXzMaxDictSize);
+  if (pool_)
+    stream_ = pool_->TakeXzDecoder();
+  if (!stream_)
+    stream_ = xz_dec_init(XZ_DYNALLOC, kXzMaxDictSize);
   TEST_AND_RETURN_FALSE(stream_ != nullptr);
   return underlying_writer_->Init(fd, extents, block_size);
 }
 
 bool XzExtentWriter::Write(const void* bytes, size_t count) {
+  if (state_ == State::kSerial)
+    return DecodeSerial(bytes, count);
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(bytes);
+  input_buffer_.insert(input_buffer_.end(), input, input + count);
+  TEST_AND_RETURN_FALSE(ParseInput());
+  // Drop the consumed data, which is only kept until the first segment started
+  // in case the stream has to be decoded serially.
+  if (segment_started_ && segment_start_ > 0) {
+    input_buffer_.erase(input_buffer_.begin(),
+                        input_buffer_.begin() + segment_start_);
+    parse_pos_ -= segment_start_;
+    segment_start_ = 0;
+  }
+  return true;
+}
+
+bool XzExtentWriter::DecodeSerial(const void* bytes, size_t count) {
   // Copy the input data into |input_buffer_| only if |input_buffer_| already
   // contains unconsumed data. Otherwise, process the data directly from the
   // source.
@@ -110,7 +337,180 @@ bool XzExtentWriter::Write(const void* bytes, size_t count) {
   return true;
 }
 
+bool XzExtentWriter::ParseInput() {
+  for (;;) {
+    const uint8_t* data = input_buffer_.data() + parse_pos_;
+    size_t available = input_buffer_.size() - parse_pos_;
+    switch (state_) {
+      case State::kStreamHeader:
+        if (available < kXzStreamHeaderSize)
+          return true;
+        // Streams with an integrity check are verified by the serial decoder.
+        if (memcmp(data, kXzMagic, sizeof(kXzMagic)) != 0 ||
+            data[6] != 0 || data[7] != kXzCheckNone ||
+            xz_crc32(data + 6, 2, 0) != ReadLE32(data + 8)) {
+          return SwitchToSerial();
+        }
+        parse_pos_ += kXzStreamHeaderSize;
+        state_ = State::kBlockHeader;
+        break;
+
+      case State::kBlockHeader: {
+        if (available < 1)
+          return true;
+        // A zero header size byte is the index indicator.
+        if (data[0] == 0) {
+          state_ = State::kIndex;
+          break;
+        }
+        size_t header_size = (data[0] + 1) * 4;
+        if (available < header_size)
+          return true;
+        if (!ParseBlockHeader(data, header_size, &dict_size_props_)) {
+          if (!segment_started_)
+            return SwitchToSerial();
+          LOG(ERROR) << "Unsupported xz block header.";
+          return false;
+        }
+        parse_pos_ += header_size;
+        segment_start_ = parse_pos_;
+        segment_size_ = 0;
+        block_data_size_ = 0;
+        state_ = State::kChunks;
+        break;
+      }
+
+      case State::kChunks:
+        TEST_AND_RETURN_FALSE(ParseChunks());
+        if (state_ == State::kChunks)
+          return true;
+        break;
+
+      case State::kBlockPadding: {
+        // The LZMA2 data is padded to a multiple of four bytes, followed by no
+        // check.
+        size_t padding = (4 - block_data_size_ % 4) % 4;
+        if (available < padding)
+          return true;
+        for (size_t i = 0; i < padding; i++)
+          TEST_AND_RETURN_FALSE(data[i] == 0);
+        parse_pos_ += padding;
+        state_ = State::kBlockHeader;
+        break;
+      }
+
+      case State::kIndex:
+        // The index and footer only describe the blocks already decoded, and
+        // the payload verifies the hash of the whole blob.
+        parse_pos_ = input_buffer_.size();
+        if (segment_started_)
+          segment_start_ = parse_pos_;
+        return true;
+
+      case State::kSerial:
+        return true;
+    }
+  }
+}
+
+bool XzExtentWriter::ParseChunks() {
+  for (;;) {
+    const uint8_t* data = input_buffer_.data() + parse_pos_;
+    size_t available = input_buffer_.size() - parse_pos_;
+    if (available < 1)
+      return true;
+    uint8_t control = data[0];
+    if (control == 0x00) {
+      // The end of the LZMA2 data of the block.
+      TEST_AND_RETURN_FALSE(StartSegment(parse_pos_));
+      parse_pos_++;
+      block_data_size_++;
+      segment_start_ = parse_pos_;
+      state_ = State::kBlockPadding;
+      return true;
+    }
+
+    size_t header_size;
+    uint64_t uncompressed_size;
+    size_t compressed_size;
+    if (control >= 0x80) {
+      // An LZMA chunk, with the properties if they are reset.
+      header_size = control >= 0xc0 ? 6 : 5;
+      if (available < header_size)
+        return true;
+      uncompressed_size =
+          ((control & 0x1f) << 16 | data[1] << 8 | data[2]) + 1;
+      compressed_size = (data[3] << 8 | data[4]) + 1;
+    } else if (control <= 0x02) {
+      // An uncompressed chunk.
+      header_size = 3;
+      if (available < header_size)
+        return true;
+      uncompressed_size = (data[1] << 8 | data[2]) + 1;
+      compressed_size = uncompressed_size;
+    } else {
+      LOG(ERROR) << "Invalid LZMA2 chunk control byte " << +control;
+      return false;
+    }
+    size_t chunk_size = header_size + compressed_size;
+    if (available < chunk_size)
+      return true;
+
+    // An LZMA chunk resetting the dictionary, the state and the properties
+    // starts a segment which can be decoded on its own.
+    if (control >= 0xe0)
+      TEST_AND_RETURN_FALSE(StartSegment(parse_pos_));
+    parse_pos_ += chunk_size;
+    block_data_size_ += chunk_size;
+    segment_size_ += uncompressed_size;
+    if (!segment_started_ && segment_size_ > kMaxFirstSegmentSize)
+      return SwitchToSerial();
+  }
+}
+
+bool XzExtentWriter::StartSegment(size_t segment_end) {
+  if (segment_end == segment_start_)
+    return true;
+  TEST_AND_RETURN_FALSE(WriteDecodedSegments(num_threads_ - 1));
+  brillo::Blob stream = BuildXzStream(dict_size_props_,
+                                      input_buffer_.data() + segment_start_,
+                                      segment_end - segment_start_,
+                                      segment_size_);
+  segments_.emplace_back(new SegmentDecoder(std::move(stream), segment_size_));
+  segments_.back()->Start();
+  segment_started_ = true;
+  segment_start_ = segment_end;
+  segment_size_ = 0;
+  return true;
+}
+
+bool XzExtentWriter::WriteDecodedSegments(size_t max_pending) {
+  while (segments_.size() > max_pending) {
+    std::unique_ptr<SegmentDecoder> segment = std::move(segments_.front());
+    segments_.pop_front();
+    TEST_AND_RETURN_FALSE(segment->Wait());
+    TEST_AND_RETURN_FALSE(underlying_writer_->Write(segment->output().data(),
+                                                    segment->output().size()));
+  }
+  return true;
+}
+
+bool XzExtentWriter::SwitchToSerial() {
+  CHECK(!segment_started_);
+  state_ = State::kSerial;
+  brillo::Blob buffered;
+  buffered.swap(input_buffer_);
+  parse_pos_ = 0;
+  segment_start_ = 0;
+  return DecodeSerial(buffered.data(), buffered.size());
+}
+
 bool XzExtentWriter::EndImpl() {
+  if (state_ != State::kSerial) {
+    TEST_AND_RETURN_FALSE(state_ == State::kIndex);
+    TEST_AND_RETURN_FALSE(WriteDecodedSegments(0));
+    return underlying_writer_->End();
+  }
   TEST_AND_RETURN_FALSE(input_buffer_.empty());
   return underlying_writer_->End();
 }
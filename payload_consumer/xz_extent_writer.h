@@ -19,39 +19,109 @@
 
 #include <xz.h>
 
+#include <deque>
 #include <memory>
 #include <utility>
 
 #include <brillo/secure_blob.h>
 
+#include "update_engine/payload_consumer/decoder_pool.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 
 // XzExtentWriter is a concrete ExtentWriter subclass that xz-decompresses
 // what it's given in Write using xz-embedded. Note that xz-embedded only
 // supports files with either no CRC or CRC-32. It passes the decompressed data
 // to an underlying ExtentWriter.
+//
+// With more than one thread, the LZMA2 data is split at the chunks resetting
+// the dictionary, like the ones starting each block compressed in parallel by
+// the generator or each block of a multi-block xz stream. These segments are
+// independent, so they are decoded concurrently and written in order. Streams
+// with an integrity check or which don't reset the dictionary early enough are
+// decoded serially.
 
 namespace chromeos_update_engine {
 
 class XzExtentWriter : public ExtentWriter {
  public:
-  explicit XzExtentWriter(std::unique_ptr<ExtentWriter> underlying_writer)
-      : underlying_writer_(std::move(underlying_writer)) {}
+  // Decodes with up to |num_threads| threads, besides the calling one. The
+  // serial decoder is taken from and returned to the |pool|, if not null,
+  // which must outlive the writer.
+  explicit XzExtentWriter(std::unique_ptr<ExtentWriter> underlying_writer,
+                          size_t num_threads = 1,
+                          DecoderPool* pool = nullptr);
   ~XzExtentWriter() override;
 
   bool Init(FileDescriptorPtr fd,
-            const google::protobuf::RepeatedPtrField<Extent>& extents,
+            ExtentSpan extents,
             uint32_t block_size) override;
   bool Write(const void* bytes, size_t count) override;
   bool EndImpl() override;
 
  private:
+  class SegmentDecoder;
+
+  // The part of the xz stream parsed next when decoding in parallel.
+  enum class State {
+    kStreamHeader,
+    kBlockHeader,
+    kChunks,
+    kBlockPadding,
+    kIndex,
+    // The whole stream is decoded by |stream_| on the calling thread.
+    kSerial,
+  };
+
+  // Decodes |count| more |bytes| with |stream_|.
+  bool DecodeSerial(const void* bytes, size_t count);
+
+  // Parses the data in |input_buffer_| from |parse_pos_|, starting the decoding
+  // of every complete segment.
+  bool ParseInput();
+
+  // Parses the LZMA2 chunks of the current block from |parse_pos_|.
+  bool ParseChunks();
+
+  // Starts decoding the segment of |input_buffer_| from |segment_start_| up to
+  // |segment_end|, if not empty, writing out the oldest decoded segments to
+  // keep at most |num_threads_| of them in flight.
+  bool StartSegment(size_t segment_end);
+
+  // Writes out, in order, the decoded segments until at most |max_pending| of
+  // them remain in flight.
+  bool WriteDecodedSegments(size_t max_pending);
+
+  // Decodes the buffered stream, and the data written later, serially. Only
+  // allowed before the first segment started.
+  bool SwitchToSerial();
+
   // The underlying ExtentWriter.
   std::unique_ptr<ExtentWriter> underlying_writer_;
+  DecoderPool* pool_;
   // The opaque xz decompressor struct.
   xz_dec* stream_{nullptr};
+  // The unconsumed input. When decoding in parallel, it holds the data from the
+  // beginning of the stream until the first segment started and from the start
+  // of the current segment afterwards.
   brillo::Blob input_buffer_;
 
+  const size_t num_threads_;
+  State state_;
+  // The offset in |input_buffer_| of the next data to parse and of the start of
+  // the current segment.
+  size_t parse_pos_{0};
+  size_t segment_start_{0};
+  // The uncompressed size of the current segment.
+  uint64_t segment_size_{0};
+  // The size of the LZMA2 data parsed in the current block.
+  uint64_t block_data_size_{0};
+  // The LZMA2 filter property byte, encoding the dictionary size, of the
+  // current block.
+  uint8_t dict_size_props_{0};
+  // The segments being decoded, in stream order.
+  std::deque<std::unique_ptr<SegmentDecoder>> segments_;
+  bool segment_started_{false};
+
   DISALLOW_COPY_AND_ASSIGN(XzExtentWriter);
 };
 
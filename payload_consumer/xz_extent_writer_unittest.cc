@@ -77,6 +77,57 @@ const uint8_t kCompressed30KiBofA[] = {
     0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x59, 0x5a,
 };
 
+// Three blocks of 10 KiB of 'a', 'b' and 'c' without checksum, generated with:
+// (for c in a b c; do dd if=/dev/zero bs=10K count=1 | tr '\0' $c; done) |
+// xz -9 -T2 --block-size=10240 --check=none |
+// hexdump -v -e '"    " 12/1 "0x%02x, " "\n"'
+const uint8_t kCompressedMultiBlock[] = {
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x00, 0xff, 0x12, 0xd9, 0x41,
+    0x03, 0xc0, 0x34, 0x80, 0x50, 0x21, 0x01, 0x1c, 0x00, 0x00, 0x00, 0x00,
+    0x2a, 0x72, 0x0f, 0xf8, 0xe0, 0x27, 0xff, 0x00, 0x2c, 0x5d, 0x00, 0x30,
+    0xef, 0xfb, 0xbf, 0xfe, 0xa3, 0xb1, 0x5e, 0xe5, 0xf8, 0x3f, 0xb2, 0xaa,
+    0x26, 0x55, 0xf8, 0x68, 0x70, 0x41, 0x70, 0x15, 0x0f, 0x8d, 0xfd, 0x1e,
+    0x4c, 0x1b, 0x8a, 0x42, 0xb7, 0x19, 0xf4, 0x69, 0x18, 0x71, 0xae, 0x66,
+    0x23, 0x8a, 0x5c, 0x32, 0x1b, 0x64, 0x00, 0x00, 0x03, 0xc0, 0x34, 0x80,
+    0x50, 0x21, 0x01, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x2a, 0x72, 0x0f, 0xf8,
+    0xe0, 0x27, 0xff, 0x00, 0x2c, 0x5d, 0x00, 0x31, 0x6f, 0xfb, 0xbf, 0xfe,
+    0xa3, 0xb1, 0x5e, 0xe5, 0xf8, 0x3f, 0xb2, 0xaa, 0x26, 0x55, 0xf8, 0x68,
+    0x70, 0x41, 0x70, 0x15, 0x0f, 0x8d, 0xfd, 0x1e, 0x4c, 0x1b, 0x8a, 0x42,
+    0xb7, 0x19, 0xf4, 0x69, 0x18, 0x71, 0xae, 0x66, 0x23, 0x8a, 0x5c, 0x32,
+    0x1b, 0x64, 0x00, 0x00, 0x03, 0xc0, 0x34, 0x80, 0x50, 0x21, 0x01, 0x1c,
+    0x00, 0x00, 0x00, 0x00, 0x2a, 0x72, 0x0f, 0xf8, 0xe0, 0x27, 0xff, 0x00,
+    0x2c, 0x5d, 0x00, 0x31, 0xef, 0xfb, 0xbf, 0xfe, 0xa3, 0xb1, 0x5e, 0xe5,
+    0xf8, 0x3f, 0xb2, 0xaa, 0x26, 0x55, 0xf8, 0x68, 0x70, 0x41, 0x70, 0x15,
+    0x0f, 0x8d, 0xfd, 0x1e, 0x4c, 0x1b, 0x8a, 0x42, 0xb7, 0x19, 0xf4, 0x69,
+    0x18, 0x71, 0xae, 0x66, 0x23, 0x8a, 0x5c, 0x32, 0x1b, 0x64, 0x00, 0x00,
+    0x00, 0x03, 0x44, 0x80, 0x50, 0x44, 0x80, 0x50, 0x44, 0x80, 0x50, 0x00,
+    0xfa, 0xf7, 0x0a, 0x9f, 0x0d, 0xd3, 0x56, 0x37, 0x03, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x59, 0x5a,
+};
+
+// The same data in a single block, with the LZMA2 data of each 10 KiB part
+// compressed on its own by liblzma, so that each part starts by resetting the
+// dictionary like the blocks compressed in parallel by the generator.
+const uint8_t kCompressedDictionaryResets[] = {
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x00, 0xff, 0x12, 0xd9, 0x41,
+    0x02, 0x00, 0x21, 0x01, 0x1c, 0x00, 0x00, 0x00, 0x10, 0xcf, 0x58, 0xcc,
+    0xe0, 0x27, 0xff, 0x00, 0x2c, 0x5d, 0x00, 0x30, 0xef, 0xfb, 0xbf, 0xfe,
+    0xa3, 0xb1, 0x5e, 0xe5, 0xf8, 0x3f, 0xb2, 0xaa, 0x26, 0x55, 0xf8, 0x68,
+    0x70, 0x41, 0x70, 0x15, 0x0f, 0x8d, 0xfd, 0x1e, 0x4c, 0x1b, 0x8a, 0x42,
+    0xb7, 0x19, 0xf4, 0x69, 0x18, 0x71, 0xae, 0x66, 0x23, 0x8a, 0x5c, 0x32,
+    0x1b, 0x64, 0x00, 0xe0, 0x27, 0xff, 0x00, 0x2c, 0x5d, 0x00, 0x31, 0x6f,
+    0xfb, 0xbf, 0xfe, 0xa3, 0xb1, 0x5e, 0xe5, 0xf8, 0x3f, 0xb2, 0xaa, 0x26,
+    0x55, 0xf8, 0x68, 0x70, 0x41, 0x70, 0x15, 0x0f, 0x8d, 0xfd, 0x1e, 0x4c,
+    0x1b, 0x8a, 0x42, 0xb7, 0x19, 0xf4, 0x69, 0x18, 0x71, 0xae, 0x66, 0x23,
+    0x8a, 0x5c, 0x32, 0x1b, 0x64, 0x00, 0xe0, 0x27, 0xff, 0x00, 0x2c, 0x5d,
+    0x00, 0x31, 0xef, 0xfb, 0xbf, 0xfe, 0xa3, 0xb1, 0x5e, 0xe5, 0xf8, 0x3f,
+    0xb2, 0xaa, 0x26, 0x55, 0xf8, 0x68, 0x70, 0x41, 0x70, 0x15, 0x0f, 0x8d,
+    0xfd, 0x1e, 0x4c, 0x1b, 0x8a, 0x42, 0xb7, 0x19, 0xf4, 0x69, 0x18, 0x71,
+    0xae, 0x66, 0x23, 0x8a, 0x5c, 0x32, 0x1b, 0x64, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0xa6, 0x01, 0x80, 0xf0, 0x01, 0x00, 0x34, 0xfb, 0xf6, 0x70,
+    0xa8, 0x00, 0x0a, 0xfc, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x59, 0x5a,
+};
+
 }  // namespace
 
 class XzExtentWriterTest : public ::testing::Test {
@@ -86,6 +137,22 @@ class XzExtentWriterTest : public ::testing::Test {
     xz_writer_.reset(new XzExtentWriter(base::WrapUnique(fake_extent_writer_)));
   }
 
+  // Replaces |xz_writer_| with one decoding with |num_threads| threads.
+  void UseThreads(size_t num_threads) {
+    fake_extent_writer_ = new FakeExtentWriter();
+    xz_writer_.reset(new XzExtentWriter(base::WrapUnique(fake_extent_writer_),
+                                        num_threads));
+  }
+
+  // Returns 10 KiB of 'a', 'b' and 'c', the data of the multi-segment
+  // streams.
+  brillo::Blob SegmentsData() {
+    brillo::Blob data;
+    for (char c : {'a', 'b', 'c'})
+      data.insert(data.end(), 10 * 1024, c);
+    return data;
+  }
+
   void WriteAll(const brillo::Blob& compressed) {
     EXPECT_TRUE(xz_writer_->Init(fd_, {}, 1024));
     EXPECT_TRUE(xz_writer_->Write(compressed.data(), compressed.size()));
@@ -156,4 +223,44 @@ TEST_F(XzExtentWriterTest, PartialDataIsKept) {
   EXPECT_EQ(expected_data, fake_extent_writer_->WrittenData());
 }
 
+TEST_F(XzExtentWriterTest, ParallelMultiBlockStream) {
+  UseThreads(2);
+  WriteAll(brillo::Blob(std::begin(kCompressedMultiBlock),
+                        std::end(kCompressedMultiBlock)));
+  EXPECT_EQ(SegmentsData(), fake_extent_writer_->WrittenData());
+}
+
+TEST_F(XzExtentWriterTest, ParallelDictionaryResetsPartialData) {
+  UseThreads(3);
+  brillo::Blob compressed(std::begin(kCompressedDictionaryResets),
+                          std::end(kCompressedDictionaryResets));
+  EXPECT_TRUE(xz_writer_->Init(fd_, {}, 1024));
+  for (uint8_t byte : compressed) {
+    EXPECT_TRUE(xz_writer_->Write(&byte, 1));
+  }
+  EXPECT_TRUE(xz_writer_->End());
+  EXPECT_EQ(SegmentsData(), fake_extent_writer_->WrittenData());
+}
+
+TEST_F(XzExtentWriterTest, ParallelFallsBackToSerial) {
+  // The streams with a CRC-32 check are decoded serially.
+  UseThreads(2);
+  WriteAll(brillo::Blob(std::begin(kCompressedDataCRC32),
+                        std::end(kCompressedDataCRC32)));
+  EXPECT_EQ(sample_data_, fake_extent_writer_->WrittenData());
+
+  UseThreads(2);
+  WriteAll(brillo::Blob(std::begin(kCompressed30KiBofA),
+                        std::end(kCompressed30KiBofA)));
+  EXPECT_EQ(brillo::Blob(30 * 1024, 'a'), fake_extent_writer_->WrittenData());
+}
+
+TEST_F(XzExtentWriterTest, ParallelTruncatedStreamRejected) {
+  UseThreads(2);
+  EXPECT_TRUE(xz_writer_->Init(fd_, {}, 1024));
+  // Stop in the middle of the second block.
+  EXPECT_TRUE(xz_writer_->Write(kCompressedMultiBlock, 100));
+  EXPECT_FALSE(xz_writer_->End());
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,183 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
+
+// ZSTD_getFrameHeader() is only declared in the static linking API.
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+#include <algorithm>
+
+namespace chromeos_update_engine {
+
+namespace {
+// The largest window accepted, which bounds the memory used to decompress.
+// "zstd -19", used by the generator, needs up to 8 MiB, so a 64 MiB limit
+// also accepts frames compressed with the long distance matching of
+// "zstd --long".
+const int kZstdMaxWindowLog = 26;
+}  // namespace
+
+std::unique_ptr<ZstdDecompressionDictionary>
+ZstdDecompressionDictionary::Create(const std::string& content) {
+  uint32_t id = ZSTD_getDictID_fromDict(content.data(), content.size());
+  if (id == 0) {
+    LOG(ERROR) << "Invalid zstd dictionary of " << content.size() << " bytes.";
+    return nullptr;
+  }
+  ZSTD_DDict* ddict = ZSTD_createDDict(content.data(), content.size());
+  if (!ddict) {
+    LOG(ERROR) << "ZSTD_createDDict failed.";
+    return nullptr;
+  }
+  return std::unique_ptr<ZstdDecompressionDictionary>(
+      new ZstdDecompressionDictionary(id, ddict));
+}
+
+ZstdDecompressionDictionary::~ZstdDecompressionDictionary() {
+  ZSTD_freeDDict(ddict_);
+}
+
+ZstdExtentWriter::~ZstdExtentWriter() {
+  if (pool_)
+    pool_->PutZstdContext(stream_);
+  else
+    ZSTD_freeDCtx(stream_);
+}
+
+bool ZstdExtentWriter::Init(FileDescriptorPtr fd,
+                            ExtentSpan extents,
+                            uint32_t block_size) {
+  if (pool_)
+    stream_ = pool_->TakeZstdContext();
+  if (!stream_)
+    stream_ = ZSTD_createDCtx();
+  TEST_AND_RETURN_FALSE(stream_ != nullptr);
+  TEST_AND_RETURN_FALSE(!ZSTD_isError(ZSTD_DCtx_setParameter(
+      stream_, ZSTD_d_windowLogMax, kZstdMaxWindowLog)));
+  output_buffer_.resize(ZSTD_DStreamOutSize());
+  return underlying_writer_->Init(fd, extents, block_size);
+}
+
+bool ZstdExtentWriter::Write(const void* bytes, size_t count) {
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  while (count > 0) {
+    size_t used;
+    if (in_frame_) {
+      TEST_AND_RETURN_FALSE(DecompressFrame(data, count, &used));
+    } else {
+      TEST_AND_RETURN_FALSE(ReadFrameHeader(data, count, &used));
+    }
+    data += used;
+    count -= used;
+  }
+  return true;
+}
+
+bool ZstdExtentWriter::ReadFrameHeader(const uint8_t* data,
+                                       size_t size,
+                                       size_t* used) {
+  // Only the bytes of the header are taken, since the dictionary must be
+  // selected before the rest of the frame is decoded. ZSTD_getFrameHeader()
+  // returns the size of the header when it needs more of it.
+  *used = 0;
+  ZSTD_frameHeader header;
+  for (;;) {
+    size_t ret = ZSTD_getFrameHeader(
+        &header, header_buffer_.data(), header_buffer_.size());
+    if (ZSTD_isError(ret) || (ret > 0 && ret <= header_buffer_.size())) {
+      LOG(ERROR) << "Invalid zstd frame header: "
+                 << (ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "truncated");
+      header_buffer_.clear();
+      return false;
+    }
+    if (ret == 0)
+      break;
+    if (*used == size)
+      return true;
+    size_t header_size = std::min(ret - header_buffer_.size(), size - *used);
+    header_buffer_.insert(
+        header_buffer_.end(), data + *used, data + *used + header_size);
+    *used += header_size;
+  }
+
+  // A frame without a dictionary ID is decoded without dictionary, as the
+  // initial state of the dictionary would corrupt it.
+  const ZSTD_DDict* ddict = nullptr;
+  if (header.dictID != 0) {
+    if (!dictionary_ || dictionary_->id() != header.dictID) {
+      LOG(ERROR) << "The zstd frame needs the unknown dictionary "
+                 << header.dictID;
+      return false;
+    }
+    ddict = dictionary_->ddict();
+  }
+  size_t ret = ZSTD_DCtx_refDDict(stream_, ddict);
+  if (ZSTD_isError(ret)) {
+    LOG(ERROR) << "ZSTD_DCtx_refDDict failed: " << ZSTD_getErrorName(ret);
+    return false;
+  }
+
+  in_frame_ = true;
+  brillo::Blob header_data;
+  header_data.swap(header_buffer_);
+  size_t header_used;
+  TEST_AND_RETURN_FALSE(
+      DecompressFrame(header_data.data(), header_data.size(), &header_used));
+  TEST_AND_RETURN_FALSE(header_used == header_data.size());
+  return true;
+}
+
+bool ZstdExtentWriter::DecompressFrame(const uint8_t* data,
+                                       size_t size,
+                                       size_t* used) {
+  // zstd keeps the partial input data it needs in its own buffers, so all the
+  // input up to the end of the frame is always consumed.
+  ZSTD_inBuffer input = {data, size, 0};
+  for (;;) {
+    ZSTD_outBuffer output = {output_buffer_.data(), output_buffer_.size(), 0};
+    size_t ret = ZSTD_decompressStream(stream_, &output, &input);
+    if (ZSTD_isError(ret)) {
+      LOG(ERROR) << "ZSTD_decompressStream failed: " << ZSTD_getErrorName(ret);
+      return false;
+    }
+    if (output.pos > 0) {
+      TEST_AND_RETURN_FALSE(
+          underlying_writer_->Write(output_buffer_.data(), output.pos));
+    }
+    // A zero return value means that the frame was fully decoded and flushed.
+    if (ret == 0) {
+      in_frame_ = false;
+      break;
+    }
+    // A full output buffer may leave decoded data to flush.
+    if (input.pos == input.size && output.pos < output.size)
+      break;
+  }
+  *used = input.pos;
+  return true;
+}
+
+bool ZstdExtentWriter::EndImpl() {
+  if (in_frame_ || !header_buffer_.empty()) {
+    LOG(ERROR) << "The zstd data ended in the middle of a frame.";
+    return false;
+  }
+  return underlying_writer_->End();
+}
+
+}  // namespace chromeos_update_engine
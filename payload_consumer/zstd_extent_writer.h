@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
+
+#include <stdint.h>
+#include <zstd.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/decoder_pool.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+
+// ZstdExtentWriter is a concrete ExtentWriter subclass that decompresses the
+// zstd frames it's given in Write, streaming the decompressed data to an
+// underlying ExtentWriter. The frames can reference the dictionary shipped in
+// the manifest of the payload.
+
+namespace chromeos_update_engine {
+
+// A zstd dictionary prepared once to decompress the frames referencing it,
+// from any thread.
+class ZstdDecompressionDictionary {
+ public:
+  // Returns the dictionary of |content|, or nullptr if |content| isn't a zstd
+  // dictionary with an ID.
+  static std::unique_ptr<ZstdDecompressionDictionary> Create(
+      const std::string& content);
+  ~ZstdDecompressionDictionary();
+
+  // The ID stored in the frames compressed with the dictionary.
+  uint32_t id() const { return id_; }
+  const ZSTD_DDict* ddict() const { return ddict_; }
+
+ private:
+  ZstdDecompressionDictionary(uint32_t id, ZSTD_DDict* ddict)
+      : id_(id), ddict_(ddict) {}
+
+  uint32_t id_;
+  ZSTD_DDict* ddict_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZstdDecompressionDictionary);
+};
+
+class ZstdExtentWriter : public ExtentWriter {
+ public:
+  // The frames referencing the |dictionary|, if not null, are decompressed
+  // with it. The context is taken from and returned to the |pool|, if not
+  // null. Both must outlive the writer.
+  explicit ZstdExtentWriter(
+      std::unique_ptr<ExtentWriter> underlying_writer,
+      const ZstdDecompressionDictionary* dictionary = nullptr,
+      DecoderPool* pool = nullptr)
+      : underlying_writer_(std::move(underlying_writer)),
+        dictionary_(dictionary),
+        pool_(pool) {}
+  ~ZstdExtentWriter() override;
+
+  bool Init(FileDescriptorPtr fd,
+            ExtentSpan extents,
+            uint32_t block_size) override;
+  bool Write(const void* bytes, size_t count) override;
+  bool EndImpl() override;
+
+ private:
+  // Collects from the |size| bytes of |data| the header of the next frame,
+  // storing in |used| the number of bytes taken. Once the header is complete,
+  // it selects the dictionary referenced by the frame and starts decoding it.
+  bool ReadFrameHeader(const uint8_t* data, size_t size, size_t* used);
+
+  // Decompresses the |size| bytes of |data| in the current frame, stopping at
+  // the end of the frame. The number of bytes consumed is stored in |used|.
+  bool DecompressFrame(const uint8_t* data, size_t size, size_t* used);
+
+  // The underlying ExtentWriter.
+  std::unique_ptr<ExtentWriter> underlying_writer_;
+  // The dictionary of the payload, or nullptr if it has none.
+  const ZstdDecompressionDictionary* dictionary_;
+  DecoderPool* pool_;
+  // The zstd decompression context.
+  ZSTD_DCtx* stream_{nullptr};
+  // Whether a frame is being decoded, after its header was read.
+  bool in_frame_{false};
+  // The part of the header of the next frame written so far.
+  brillo::Blob header_buffer_;
+  brillo::Blob output_buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZstdExtentWriter);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
+
+#include <string.h>
+
+#include <memory>
+
+#include <base/memory/ptr_util.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/fake_extent_writer.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const char kSampleData[] = "Redundaaaaaaaaaaaaaant\n";
+
+// Compressed data with checksum, generated with:
+// echo "Redundaaaaaaaaaaaaaant" | zstd -19 |
+// hexdump -v -e '"    " 12/1 "0x%02x, " "\n"'
+const uint8_t kCompressedSampleData[] = {
+    0x28, 0xb5, 0x2f, 0xfd, 0x04, 0x68, 0x85, 0x00, 0x00, 0x50, 0x52, 0x65,
+    0x64, 0x75, 0x6e, 0x64, 0x61, 0x6e, 0x74, 0x0a, 0x01, 0x00, 0x07, 0x30,
+    0x02, 0xeb, 0x10, 0x71, 0x5f,
+};
+
+// Highly redundant data bigger than the output buffer, generated with:
+// dd if=/dev/zero bs=30K count=1 | tr '\0' 'a' | zstd -19 |
+// hexdump -v -e '"    " 12/1 "0x%02x, " "\n"'
+const uint8_t kCompressed30KiBofA[] = {
+    0x28, 0xb5, 0x2f, 0xfd, 0x04, 0x68, 0x45, 0x00, 0x00, 0x08, 0x61, 0x01,
+    0x00, 0xfc, 0xf7, 0x0e, 0x84, 0x8c, 0x53, 0xb8, 0x48,
+};
+
+}  // namespace
+
+class ZstdExtentWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fake_extent_writer_ = new FakeExtentWriter();
+    zstd_writer_.reset(
+        new ZstdExtentWriter(base::WrapUnique(fake_extent_writer_)));
+  }
+
+  // Owned by |zstd_writer_|. This object is invalidated after |zstd_writer_|
+  // is deleted.
+  FakeExtentWriter* fake_extent_writer_{nullptr};
+  std::unique_ptr<ZstdExtentWriter> zstd_writer_;
+  FileDescriptorPtr fd_;
+};
+
+TEST_F(ZstdExtentWriterTest, CompressedSampleData) {
+  EXPECT_TRUE(zstd_writer_->Init(fd_, {}, 1024));
+  EXPECT_TRUE(zstd_writer_->Write(kCompressedSampleData,
+                                  sizeof(kCompressedSampleData)));
+  EXPECT_TRUE(zstd_writer_->End());
+  EXPECT_EQ(brillo::Blob(std::begin(kSampleData),
+                         std::begin(kSampleData) + strlen(kSampleData)),
+            fake_extent_writer_->WrittenData());
+  EXPECT_TRUE(fake_extent_writer_->EndCalled());
+}
+
+TEST_F(ZstdExtentWriterTest, PartialDataIsKept) {
+  // The data is decompressed even when written one byte at a time, and the
+  // output is bigger than the internal buffer.
+  EXPECT_TRUE(zstd_writer_->Init(fd_, {}, 1024));
+  for (uint8_t byte : kCompressed30KiBofA) {
+    EXPECT_TRUE(zstd_writer_->Write(&byte, 1));
+  }
+  EXPECT_TRUE(zstd_writer_->End());
+  EXPECT_EQ(brillo::Blob(30 * 1024, 'a'), fake_extent_writer_->WrittenData());
+}
+
+TEST_F(ZstdExtentWriterTest, TruncatedDataRejected) {
+  EXPECT_TRUE(zstd_writer_->Init(fd_, {}, 1024));
+  EXPECT_TRUE(zstd_writer_->Write(kCompressedSampleData,
+                                  sizeof(kCompressedSampleData) - 1));
+  EXPECT_FALSE(zstd_writer_->End());
+  EXPECT_FALSE(fake_extent_writer_->EndCalled());
+}
+
+TEST_F(ZstdExtentWriterTest, GarbageDataRejected) {
+  EXPECT_TRUE(zstd_writer_->Init(fd_, {}, 1024));
+  // The kSampleData is an uncompressed string.
+  EXPECT_FALSE(zstd_writer_->Write(kSampleData, strlen(kSampleData)));
+  EXPECT_TRUE(zstd_writer_->End());
+}
+
+}  // namespace chromeos_update_engine
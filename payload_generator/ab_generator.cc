@@ -17,9 +17,11 @@
 #include "update_engine/payload_generator/ab_generator.h"
 
 #include <algorithm>
+#include <memory>
 #include <utility>
 
 #include <base/strings/stringprintf.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
@@ -28,6 +30,7 @@
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/partition_reader.h"
 
 using chromeos_update_engine::diff_utils::IsAReplaceOperation;
 using std::string;
@@ -35,6 +38,150 @@ using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// Regenerates the blob of a REPLACE operation merged by MergeOperations() from
+// the data of its destination extents, on one of the threads of a pool.
+class MergedReplaceProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  MergedReplaceProcessor(const PayloadVersion& version,
+                         const string& target_part_path,
+                         BlobFileWriter* blob_file,
+                         AnnotatedOperation* aop)
+      : version_(version),
+        target_part_path_(target_part_path),
+        blob_file_(blob_file),
+        aop_(aop) {}
+  MergedReplaceProcessor(MergedReplaceProcessor&&) = default;
+  ~MergedReplaceProcessor() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    diff_utils::ScopedThreadReservation thread_reservation;
+    success_ = ABGenerator::AddDataAndSetType(
+        aop_, version_, target_part_path_, blob_file_);
+    LOG_IF(ERROR, !success_) << "Failed to regenerate the blob of the merged "
+                             << "operation " << aop_->name;
+  }
+
+  bool success() const { return success_; }
+
+ private:
+  const PayloadVersion& version_;
+  const string& target_part_path_;
+  BlobFileWriter* blob_file_;
+  AnnotatedOperation* aop_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(MergedReplaceProcessor);
+};
+
+// The size of the reads of the source data hashed by SourceHashProcessor.
+const size_t kSourceHashBufferSize = 1024 * 1024;  // 1 MiB
+
+// Sets the hash of the source data of an operation, read from |source|, on
+// one of the threads of a pool.
+class SourceHashProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  SourceHashProcessor(const PartitionReader* source, AnnotatedOperation* aop)
+      : source_(source), aop_(aop) {}
+  SourceHashProcessor(SourceHashProcessor&&) = default;
+  ~SourceHashProcessor() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    diff_utils::ScopedThreadReservation thread_reservation;
+    success_ = HashSource();
+    LOG_IF(ERROR, !success_) << "Failed to hash the source of the operation "
+                             << aop_->name;
+  }
+
+  bool success() const { return success_; }
+
+ private:
+  // Hashes the source extents of the operation as they are read, so the
+  // source data is never held in memory at once.
+  bool HashSource() {
+    uint64_t src_length =
+        aop_->op.has_src_length()
+            ? aop_->op.src_length()
+            : utils::BlocksInExtents(aop_->op.src_extents()) * kBlockSize;
+    HashCalculator hasher;
+    brillo::Blob buf;
+    uint64_t total_read = 0;
+    for (const Extent& extent : aop_->op.src_extents()) {
+      uint64_t offset = extent.start_block() * kBlockSize;
+      uint64_t remaining = extent.num_blocks() * kBlockSize;
+      TEST_AND_RETURN_FALSE(total_read + remaining <= src_length);
+      while (remaining > 0) {
+        buf.resize(std::min(remaining,
+                            static_cast<uint64_t>(kSourceHashBufferSize)));
+        TEST_AND_RETURN_FALSE(source_->Read(buf.data(), buf.size(), offset));
+        TEST_AND_RETURN_FALSE(hasher.Update(buf.data(), buf.size()));
+        offset += buf.size();
+        remaining -= buf.size();
+        total_read += buf.size();
+      }
+    }
+    TEST_AND_RETURN_FALSE(total_read == src_length);
+    TEST_AND_RETURN_FALSE(hasher.Finalize());
+    const brillo::Blob& src_hash = hasher.raw_hash();
+    aop_->op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    return true;
+  }
+
+  const PartitionReader* source_;
+  AnnotatedOperation* aop_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(SourceHashProcessor);
+};
+
+// The number of bits of each coordinate of the Hilbert curve of
+// SortOperationsByLocality().
+const int kHilbertOrder = 16;
+
+// Returns the distance of the cell (|x|, |y|) along a Hilbert curve covering
+// a square of 2^kHilbertOrder cells per side.
+uint64_t HilbertIndex(uint32_t x, uint32_t y) {
+  const uint32_t n = 1U << kHilbertOrder;
+  uint64_t index = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    index += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant so the curve in it starts and ends next to the
+    // adjacent quadrants.
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return index;
+}
+
+// Runs the |processors| on a pool of up to GetMaxThreads() threads named
+// |name_prefix| and returns whether all of them succeeded.
+template <typename Processor>
+bool RunProcessors(const string& name_prefix, vector<Processor>* processors) {
+  if (processors->empty())
+    return true;
+  base::DelegateSimpleThreadPool thread_pool(
+      name_prefix, std::min(diff_utils::GetMaxThreads(), processors->size()));
+  thread_pool.Start();
+  for (Processor& processor : *processors)
+    thread_pool.AddWork(&processor);
+  thread_pool.JoinAll();
+  for (const Processor& processor : *processors)
+    TEST_AND_RETURN_FALSE(processor.success());
+  return true;
+}
+
+}  // namespace
+
 bool ABGenerator::GenerateOperations(
     const PayloadGenerationConfig& config,
     const PartitionConfig& old_part,
@@ -56,6 +203,9 @@ bool ABGenerator::GenerateOperations(
                                                        config.version,
                                                        blob_file));
   LOG(INFO) << "done reading " << new_part.name;
+  // The operations of a work shard are only generated for the diff cache.
+  if (diff_utils::IsWorkSharded())
+    return true;
 
   TEST_AND_RETURN_FALSE(
       FragmentOperations(config.version, aops, new_part.path, blob_file));
@@ -75,6 +225,9 @@ bool ABGenerator::GenerateOperations(
   if (config.version.minor >= kOpSrcHashMinorPayloadVersion)
     TEST_AND_RETURN_FALSE(AddSourceHash(aops, old_part.path));
 
+  if (config.locality_ordering)
+    SortOperationsByLocality(aops);
+
   return true;
 }
 
@@ -83,6 +236,44 @@ void ABGenerator::SortOperationsByDestination(
   sort(aops->begin(), aops->end(), diff_utils::CompareAopsByDestination);
 }
 
+void ABGenerator::SortOperationsByLocality(vector<AnnotatedOperation>* aops) {
+  SortOperationsByDestination(aops);
+  // The source and destination positions of the operations with destination
+  // extents, which are the first ones.
+  vector<std::pair<uint64_t, uint64_t>> positions;
+  uint64_t src_block = 0, max_block = 0;
+  for (const AnnotatedOperation& aop : *aops) {
+    if (aop.op.dst_extents_size() == 0)
+      break;
+    if (aop.op.src_extents_size() > 0)
+      src_block = aop.op.src_extents(0).start_block();
+    uint64_t dst_block = aop.op.dst_extents(0).start_block();
+    positions.emplace_back(src_block, dst_block);
+    max_block = std::max({max_block, src_block, dst_block});
+  }
+  // Scale the positions down to the cells of the curve.
+  int shift = 0;
+  while ((max_block >> shift) >= (1ULL << kHilbertOrder))
+    shift++;
+  // The ties are kept in destination order.
+  vector<std::pair<uint64_t, size_t>> keys;
+  keys.reserve(positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    keys.emplace_back(HilbertIndex(positions[i].second >> shift,
+                                   positions[i].first >> shift),
+                      i);
+  }
+  sort(keys.begin(), keys.end());
+
+  vector<AnnotatedOperation> sorted_aops;
+  sorted_aops.reserve(aops->size());
+  for (const auto& key : keys)
+    sorted_aops.push_back(std::move((*aops)[key.second]));
+  for (size_t i = positions.size(); i < aops->size(); i++)
+    sorted_aops.push_back(std::move((*aops)[i]));
+  *aops = std::move(sorted_aops);
+}
+
 bool ABGenerator::FragmentOperations(const PayloadVersion& version,
                                      vector<AnnotatedOperation>* aops,
                                      const string& target_part_path,
@@ -198,10 +389,12 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
                                   size_t chunk_blocks,
                                   const string& target_part_path,
                                   BlobFileWriter* blob_file) {
+  // The operations are merged first, and then the blob of each merged REPLACE
+  // operation is regenerated once for all the operations merged into it.
   vector<AnnotatedOperation> new_aops;
-  for (const AnnotatedOperation& curr_aop : *aops) {
+  for (AnnotatedOperation& curr_aop : *aops) {
     if (new_aops.empty()) {
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
       continue;
     }
     AnnotatedOperation& last_aop = new_aops.back();
@@ -209,7 +402,7 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
 
     if (last_aop.op.dst_extents_size() <= 0 ||
         curr_aop.op.dst_extents_size() <= 0) {
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
       continue;
     }
     uint32_t last_dst_idx = last_aop.op.dst_extents_size() - 1;
@@ -231,9 +424,8 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
       // merge), are contiguous, are fragmented to have one destination extent,
       // and their combined block count would be less than chunk size, merge
       // them.
-      last_aop.name = base::StringPrintf("%s,%s",
-                                         last_aop.name.c_str(),
-                                         curr_aop.name.c_str());
+      last_aop.name += ',';
+      last_aop.name += curr_aop.name;
 
       if (is_delta_op) {
         ExtendExtents(last_aop.op.mutable_src_extents(),
@@ -246,21 +438,23 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
         last_aop.op.set_data_length(0);
     } else {
       // Otherwise just include the extent as is.
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
     }
   }
 
   // Set the blobs for REPLACE/REPLACE_BZ/REPLACE_XZ operations that have been
-  // merged.
+  // merged, reading and compressing the data of each one in parallel.
+  vector<MergedReplaceProcessor> processors;
+  processors.reserve(new_aops.size());
   for (AnnotatedOperation& curr_aop : new_aops) {
     if (curr_aop.op.data_length() == 0 &&
         IsAReplaceOperation(curr_aop.op.type())) {
-      TEST_AND_RETURN_FALSE(
-          AddDataAndSetType(&curr_aop, version, target_part_path, blob_file));
+      processors.emplace_back(version, target_part_path, blob_file, &curr_aop);
     }
   }
+  TEST_AND_RETURN_FALSE(RunProcessors("merge-operations", &processors));
 
-  *aops = new_aops;
+  *aops = std::move(new_aops);
   return true;
 }
 
@@ -273,16 +467,16 @@ bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
   vector<Extent> dst_extents;
   ExtentsToVector(aop->op.dst_extents(), &dst_extents);
   brillo::Blob data(utils::BlocksInExtents(dst_extents) * kBlockSize);
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(target_part_path,
-                                           dst_extents,
-                                           &data,
-                                           data.size(),
-                                           kBlockSize));
+  TEST_AND_RETURN_FALSE(ReadPartitionExtents(target_part_path,
+                                             dst_extents,
+                                             &data,
+                                             data.size(),
+                                             kBlockSize));
 
   brillo::Blob blob;
   InstallOperation_Type op_type;
-  TEST_AND_RETURN_FALSE(
-      diff_utils::GenerateBestFullOperation(data, version, &blob, &op_type));
+  TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
+      std::move(data), version, &blob, &op_type, nullptr));
 
   // If the operation doesn't point to a data blob or points to a data blob of
   // a different type then we add it.
@@ -296,23 +490,32 @@ bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
 
 bool ABGenerator::AddSourceHash(vector<AnnotatedOperation>* aops,
                                 const string& source_part_path) {
+  // The PARTITION_COPY operations read another partition and were hashed when
+  // generated.
+  vector<AnnotatedOperation*> source_aops;
   for (AnnotatedOperation& aop : *aops) {
-    if (aop.op.src_extents_size() == 0)
-      continue;
-
-    vector<Extent> src_extents;
-    ExtentsToVector(aop.op.src_extents(), &src_extents);
-    brillo::Blob src_data, src_hash;
-    uint64_t src_length =
-        aop.op.has_src_length()
-            ? aop.op.src_length()
-            : utils::BlocksInExtents(aop.op.src_extents()) * kBlockSize;
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(
-        source_part_path, src_extents, &src_data, src_length, kBlockSize));
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(src_data, &src_hash));
-    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    if (aop.op.src_extents_size() > 0 &&
+        aop.op.type() != InstallOperation::PARTITION_COPY) {
+      source_aops.push_back(&aop);
+    }
   }
-  return true;
+  if (source_aops.empty())
+    return true;
+
+  // The operations are hashed in parallel, reading the source partition
+  // through its mapping if it is mapped, or else the same file descriptor.
+  std::unique_ptr<PartitionReader> source_file;
+  const PartitionReader* source = GetMappedPartition(source_part_path);
+  if (!source) {
+    source_file = PartitionReader::CreateFromFile(source_part_path);
+    TEST_AND_RETURN_FALSE(source_file != nullptr);
+    source = source_file.get();
+  }
+  vector<SourceHashProcessor> processors;
+  processors.reserve(source_aops.size());
+  for (AnnotatedOperation* aop : source_aops)
+    processors.emplace_back(source, aop);
+  return RunProcessors("source-hash", &processors);
 }
 
 }  // namespace chromeos_update_engine
@@ -73,6 +73,16 @@ class ABGenerator : public OperationsGenerator {
   static void SortOperationsByDestination(
       std::vector<AnnotatedOperation>* aops);
 
+  // Takes a vector of AnnotatedOperations |aops| and sorts them along a
+  // Hilbert curve over the start blocks of their first source and destination
+  // extents, so the consecutive operations read nearby source blocks and write
+  // nearby destination blocks. The operations without source extents take
+  // the source position of the previous operation by destination, to stay
+  // next to their destination neighbors, and the ones without destination
+  // extents are kept at the end. It must be called once the operations are
+  // merged, which needs them sorted by destination.
+  static void SortOperationsByLocality(std::vector<AnnotatedOperation>* aops);
+
   // Takes an SOURCE_COPY install operation, |aop|, and adds one operation for
   // each dst extent in |aop| to |ops|. The new operations added to |ops| will
   // have only one dst extent. The src extents are split so the number of blocks
@@ -115,19 +125,21 @@ class ABGenerator : public OperationsGenerator {
   static bool AddSourceHash(std::vector<AnnotatedOperation>* aops,
                             const std::string& source_part_path);
 
- private:
   // Adds the data payload for a REPLACE/REPLACE_BZ/REPLACE_XZ operation |aop|
   // by reading its output extents from |target_part_path| and appending a
   // corresponding data blob to |blob_file|. The blob will be compressed if this
   // is smaller than the uncompressed form, and the operation type will be set
   // accordingly. |*blob_file| will be updated as well. If the operation happens
   // to have the right type and already points to a data blob, nothing is
-  // written. Caller should only set type and data blob if it's valid.
+  // written. Caller should only set type and data blob if it's valid. It can
+  // be called for several operations at the same time.
   static bool AddDataAndSetType(AnnotatedOperation* aop,
                                 const PayloadVersion& version,
                                 const std::string& target_part_path,
                                 BlobFileWriter* blob_file);
 
+ private:
+
   DISALLOW_COPY_AND_ASSIGN(ABGenerator);
 };
 
@@ -24,6 +24,7 @@
 #include <string>
 #include <vector>
 
+#include <base/strings/stringprintf.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/hash_calculator.h"
@@ -32,6 +33,7 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 
@@ -441,6 +443,41 @@ TEST_F(ABGeneratorTest, SortOperationsByDestinationTest) {
   EXPECT_EQ(second_aop.name, aops[2].name);
 }
 
+TEST_F(ABGeneratorTest, SortOperationsByLocalityTest) {
+  const struct {
+    const char* name;
+    InstallOperation::Type type;
+    int64_t src_block;  // -1 for no source extent.
+    int64_t dst_block;  // -1 for no destination extent.
+  } kOperations[] = {
+      {"e", InstallOperation::SOURCE_COPY, 60001, 60001},
+      {"f", InstallOperation::REPLACE, -1, -1},
+      {"d", InstallOperation::REPLACE, -1, 5},
+      {"c", InstallOperation::SOURCE_BSDIFF, 1, 4},
+      {"b", InstallOperation::SOURCE_COPY, 60000, 1},
+      {"a", InstallOperation::SOURCE_COPY, 0, 0},
+  };
+  vector<AnnotatedOperation> aops;
+  for (const auto& operation : kOperations) {
+    AnnotatedOperation aop;
+    aop.name = operation.name;
+    aop.op.set_type(operation.type);
+    if (operation.src_block >= 0)
+      *(aop.op.add_src_extents()) = ExtentForRange(operation.src_block, 1);
+    if (operation.dst_block >= 0)
+      *(aop.op.add_dst_extents()) = ExtentForRange(operation.dst_block, 1);
+    aops.push_back(aop);
+  }
+
+  ABGenerator::SortOperationsByLocality(&aops);
+  // The operation reading far in the source partition is moved next to the
+  // other one, and the REPLACE operation stays after its source neighbor.
+  vector<string> names;
+  for (const AnnotatedOperation& aop : aops)
+    names.push_back(aop.name);
+  EXPECT_EQ((vector<string>{"a", "c", "d", "b", "e", "f"}), names);
+}
+
 TEST_F(ABGeneratorTest, MergeSourceCopyOperationsTest) {
   vector<AnnotatedOperation> aops;
   InstallOperation first_op;
@@ -508,6 +545,69 @@ TEST_F(ABGeneratorTest, MergeReplaceBzOperationsToReplaceTest) {
   TestMergeReplaceOrReplaceBzOperations(InstallOperation::REPLACE_BZ, false);
 }
 
+TEST_F(ABGeneratorTest, MergeSeveralReplaceOperationsTest) {
+  // Six REPLACE operations of one block are merged into three operations of
+  // two blocks, whose blobs are regenerated in parallel.
+  const size_t num_ops = 6;
+  string part_path;
+  EXPECT_TRUE(utils::MakeTempFile(
+      "MergeSeveralReplaceTest_part.XXXXXX", &part_path, nullptr));
+  ScopedPathUnlinker part_path_unlinker(part_path);
+  brillo::Blob part_data(num_ops * kBlockSize);
+  test_utils::FillWithData(&part_data);
+  ASSERT_TRUE(
+      utils::WriteFile(part_path.c_str(), part_data.data(), part_data.size()));
+
+  vector<AnnotatedOperation> aops;
+  for (size_t i = 0; i < num_ops; i++) {
+    AnnotatedOperation aop;
+    aop.name = base::StringPrintf("op%zu", i);
+    aop.op.set_type(InstallOperation::REPLACE);
+    *(aop.op.add_dst_extents()) = ExtentForRange(i, 1);
+    aop.op.set_data_offset(i * kBlockSize);
+    aop.op.set_data_length(kBlockSize);
+    aops.push_back(aop);
+  }
+
+  test_utils::ScopedTempFile data_file("MergeSeveralReplaceTest_data.XXXXXX");
+  int data_fd = open(data_file.path().c_str(), O_RDWR, 000);
+  EXPECT_GE(data_fd, 0);
+  ScopedFdCloser data_fd_closer(&data_fd);
+  off_t data_file_size = 0;
+  BlobFileWriter blob_file(data_fd, &data_file_size);
+
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  EXPECT_TRUE(
+      ABGenerator::MergeOperations(&aops, version, 2, part_path, &blob_file));
+
+  ASSERT_EQ(3U, aops.size());
+  for (size_t i = 0; i < aops.size(); i++) {
+    EXPECT_EQ(base::StringPrintf("op%zu,op%zu", 2 * i, 2 * i + 1),
+              aops[i].name);
+    ASSERT_EQ(1, aops[i].op.dst_extents().size());
+    EXPECT_TRUE(ExtentEquals(aops[i].op.dst_extents(0), 2 * i, 2));
+
+    // Each blob is the best full operation of the merged data.
+    brillo::Blob merged_data(part_data.begin() + 2 * i * kBlockSize,
+                             part_data.begin() + (2 * i + 2) * kBlockSize);
+    brillo::Blob expected_blob;
+    InstallOperation_Type expected_type;
+    ASSERT_TRUE(diff_utils::GenerateBestFullOperation(
+        merged_data, version, &expected_blob, &expected_type));
+    EXPECT_EQ(expected_type, aops[i].op.type());
+    brillo::Blob blob(aops[i].op.data_length());
+    ssize_t bytes_read;
+    ASSERT_TRUE(utils::PReadAll(data_fd,
+                                blob.data(),
+                                blob.size(),
+                                aops[i].op.data_offset(),
+                                &bytes_read));
+    ASSERT_EQ(static_cast<ssize_t>(blob.size()), bytes_read);
+    EXPECT_EQ(expected_blob, blob);
+  }
+}
+
 TEST_F(ABGeneratorTest, NoMergeOperationsTest) {
   // Test to make sure we don't merge operations that shouldn't be merged.
   vector<AnnotatedOperation> aops;
@@ -590,4 +690,39 @@ TEST_F(ABGeneratorTest, AddSourceHashTest) {
   EXPECT_EQ(expected_hash, result_hash);
 }
 
+TEST_F(ABGeneratorTest, AddSourceHashSeveralOperationsTest) {
+  // Each operation reads two blocks of the source, from both halves of it.
+  const size_t num_ops = 8;
+  test_utils::ScopedTempFile src_part("AddSourceHashTest_src_part.XXXXXX");
+  brillo::Blob src_data(2 * num_ops * kBlockSize);
+  test_utils::FillWithData(&src_data);
+  ASSERT_TRUE(utils::WriteFile(
+      src_part.path().c_str(), src_data.data(), src_data.size()));
+
+  vector<AnnotatedOperation> aops(num_ops);
+  for (size_t i = 0; i < num_ops; i++) {
+    aops[i].op.set_type(InstallOperation::SOURCE_COPY);
+    *(aops[i].op.add_src_extents()) = ExtentForRange(num_ops + i, 1);
+    *(aops[i].op.add_src_extents()) = ExtentForRange(i, 1);
+  }
+  EXPECT_TRUE(ABGenerator::AddSourceHash(&aops, src_part.path()));
+
+  for (size_t i = 0; i < num_ops; i++) {
+    brillo::Blob op_data(src_data.begin() + (num_ops + i) * kBlockSize,
+                         src_data.begin() + (num_ops + i + 1) * kBlockSize);
+    op_data.insert(op_data.end(),
+                   src_data.begin() + i * kBlockSize,
+                   src_data.begin() + (i + 1) * kBlockSize);
+    brillo::Blob expected_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfData(op_data, &expected_hash));
+    brillo::Blob result_hash(aops[i].op.src_sha256_hash().begin(),
+                             aops[i].op.src_sha256_hash().end());
+    EXPECT_EQ(expected_hash, result_hash);
+  }
+
+  // The source length must match the source extents.
+  aops[0].op.set_src_length(kBlockSize);
+  EXPECT_FALSE(ABGenerator::AddSourceHash(&aops, src_part.path()));
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,214 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/apply_time_estimator.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using base::StringPrintf;
+using base::TimeDelta;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns the key of the decode rate of the operations of |type|.
+string DecodeRateKey(InstallOperation::Type type) {
+  return base::ToLowerASCII(InstallOperationTypeName(type)) + "_mbps";
+}
+
+// An operation and the partition it is in.
+using PartitionOperation =
+    std::pair<const PartitionEstimate*, const OperationEstimate*>;
+
+double Seconds(TimeDelta delta) {
+  return delta.InMicroseconds() / 1e6;
+}
+
+}  // namespace
+
+bool DeviceProfile::Load(const brillo::KeyValueStore& store) {
+  for (const string& key : store.GetKeys()) {
+    string value_str;
+    double value = 0;
+    store.GetString(key, &value_str);
+    if (!base::StringToDouble(value_str, &value) || value <= 0) {
+      LOG(ERROR) << "Invalid device profile value " << key << "=" << value_str;
+      return false;
+    }
+    if (key == "download_mbps") {
+      download_mbps = value;
+    } else if (key == "read_mbps") {
+      read_mbps = value;
+    } else if (key == "random_read_iops") {
+      random_read_iops = value;
+    } else if (key == "write_mbps") {
+      write_mbps = value;
+    } else if (key == "hash_mbps") {
+      hash_mbps = value;
+    } else {
+      bool found = false;
+      for (int i = 0; i <= InstallOperation::Type_MAX && !found; i++) {
+        if (!InstallOperation::Type_IsValid(i))
+          continue;
+        InstallOperation::Type type = static_cast<InstallOperation::Type>(i);
+        if (key == DecodeRateKey(type)) {
+          decode_mbps[type] = value;
+          found = true;
+        }
+      }
+      if (!found) {
+        LOG(ERROR) << "Unknown device profile key " << key;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+OperationEstimate ApplyTimeEstimator::EstimateOperation(
+    const InstallOperation& op, size_t index) const {
+  OperationEstimate estimate{index, op.type(), TimeDelta(), TimeDelta()};
+  estimate.download = BytesTime(op.data_length(), profile_.download_mbps);
+  // The discarded blocks aren't written.
+  if (op.type() == InstallOperation::DISCARD)
+    return estimate;
+
+  uint64_t src_bytes = utils::BlocksInExtents(op.src_extents()) * block_size_;
+  uint64_t dst_bytes = utils::BlocksInExtents(op.dst_extents()) * block_size_;
+  TimeDelta read = BytesTime(src_bytes, profile_.read_mbps);
+  if (op.src_extents_size() > 0) {
+    read += TimeDelta::FromMicroseconds(static_cast<int64_t>(
+        op.src_extents_size() * 1e6 / profile_.random_read_iops));
+  }
+  TimeDelta decode;
+  const auto rate = profile_.decode_mbps.find(op.type());
+  if (rate != profile_.decode_mbps.end())
+    decode = BytesTime(dst_bytes, rate->second);
+  estimate.apply = read + decode + BytesTime(dst_bytes, profile_.write_mbps);
+  return estimate;
+}
+
+PartitionEstimate ApplyTimeEstimator::EstimatePartition(
+    const PartitionUpdate& partition) const {
+  PartitionEstimate estimate;
+  estimate.name = partition.partition_name();
+  for (int i = 0; i < partition.operations_size(); i++) {
+    estimate.operations.push_back(
+        EstimateOperation(partition.operations(i), i));
+    estimate.download += estimate.operations.back().download;
+    estimate.apply += estimate.operations.back().apply;
+  }
+  // The target partition is read and hashed at the rate of the slower one.
+  estimate.verify =
+      BytesTime(partition.new_partition_info().size(),
+                std::min(profile_.read_mbps, profile_.hash_mbps));
+  return estimate;
+}
+
+// static
+TimeDelta ApplyTimeEstimator::GetTotalTime(
+    const vector<PartitionEstimate>& partitions) {
+  TimeDelta download, apply, verify;
+  for (const PartitionEstimate& partition : partitions) {
+    download += partition.download;
+    apply += partition.apply;
+    verify += partition.verify;
+  }
+  return std::max(download, apply) + verify;
+}
+
+string ApplyTimeEstimator::Report(const DeltaArchiveManifest& manifest,
+                                  size_t max_dominant_ops) const {
+  vector<PartitionEstimate> partitions;
+  for (const PartitionUpdate& partition : manifest.partitions())
+    partitions.push_back(EstimatePartition(partition));
+
+  const char kRowFormat[] = "%-16s %12.1f %12.1f %12.1f %12.1f\n";
+  string report = StringPrintf("%-16s %12s %12s %12s %12s\n",
+                               "partition",
+                               "download s",
+                               "apply s",
+                               "verify s",
+                               "total s");
+  PartitionEstimate payload;
+  payload.name = "<payload>";
+  vector<PartitionOperation> ops;
+  for (const PartitionEstimate& partition : partitions) {
+    report += StringPrintf(kRowFormat,
+                           partition.name.c_str(),
+                           Seconds(partition.download),
+                           Seconds(partition.apply),
+                           Seconds(partition.verify),
+                           Seconds(GetTotalTime({partition})));
+    payload.download += partition.download;
+    payload.apply += partition.apply;
+    payload.verify += partition.verify;
+    for (const OperationEstimate& op : partition.operations)
+      ops.emplace_back(&partition, &op);
+  }
+  report += StringPrintf(kRowFormat,
+                         payload.name.c_str(),
+                         Seconds(payload.download),
+                         Seconds(payload.apply),
+                         Seconds(payload.verify),
+                         Seconds(GetTotalTime(partitions)));
+
+  size_t num_dominant_ops = std::min(max_dominant_ops, ops.size());
+  std::partial_sort(
+      ops.begin(),
+      ops.begin() + num_dominant_ops,
+      ops.end(),
+      [](const PartitionOperation& a, const PartitionOperation& b) {
+        return a.second->apply > b.second->apply;
+      });
+  if (num_dominant_ops > 0)
+    report += "Operations taking the longest to apply:\n";
+  for (size_t i = 0; i < num_dominant_ops; i++) {
+    const PartitionEstimate& partition = *ops[i].first;
+    const OperationEstimate& op = *ops[i].second;
+    report += StringPrintf(
+        "  %s operation %zu %s: %.2f s, %.0f%% of the partition apply time\n",
+        partition.name.c_str(),
+        op.index,
+        InstallOperationTypeName(op.type),
+        Seconds(op.apply),
+        partition.apply.is_zero()
+            ? 0.
+            : 100. * op.apply.InMicroseconds() /
+                  partition.apply.InMicroseconds());
+  }
+  return report;
+}
+
+// static
+TimeDelta ApplyTimeEstimator::BytesTime(uint64_t bytes, double mbps) {
+  return TimeDelta::FromMicroseconds(
+      static_cast<int64_t>(bytes * 1e6 / (mbps * 1024 * 1024)));
+}
+
+}  // namespace chromeos_update_engine
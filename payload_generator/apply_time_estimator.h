@@ -0,0 +1,114 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_APPLY_TIME_ESTIMATOR_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_APPLY_TIME_ESTIMATOR_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/time/time.h>
+#include <brillo/key_value_store.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// The measured speeds of a class of devices, loaded from a key=value file
+// such as the one written by extent_io_benchmark --out_profile_file. The
+// rates are in MiB/s; the decode rate of an operation type, keyed by its
+// lowercase name, e.g. "replace_xz_mbps", is the rate at which it produces
+// the bytes written.
+struct DeviceProfile {
+  double download_mbps = 2;
+  double read_mbps = 100;
+  double random_read_iops = 2000;
+  double write_mbps = 50;
+  double hash_mbps = 200;
+  // The operation types missing have no decoding step, like REPLACE or
+  // SOURCE_COPY.
+  std::map<InstallOperation::Type, double> decode_mbps = {
+      {InstallOperation::REPLACE_BZ, 20},
+      {InstallOperation::REPLACE_XZ, 40},
+      {InstallOperation::REPLACE_ZSTD, 300},
+      {InstallOperation::BSDIFF, 30},
+      {InstallOperation::SOURCE_BSDIFF, 30},
+      {InstallOperation::BROTLI_BSDIFF, 25},
+      {InstallOperation::PUFFDIFF, 10},
+  };
+
+  // Overrides the rates set in |store|. Returns false if a value isn't a
+  // positive number or a key is unknown.
+  bool Load(const brillo::KeyValueStore& store);
+};
+
+// The predicted time of an operation, the number |index| of its partition.
+struct OperationEstimate {
+  size_t index;
+  InstallOperation::Type type;
+  base::TimeDelta download;
+  base::TimeDelta apply;
+};
+
+// The predicted time of a partition: downloading the data of its operations,
+// applying them and verifying the hash of the target partition.
+struct PartitionEstimate {
+  std::string name;
+  base::TimeDelta download;
+  base::TimeDelta apply;
+  base::TimeDelta verify;
+  std::vector<OperationEstimate> operations;
+};
+
+// Predicts how long a payload takes to apply on a device of a DeviceProfile
+// from the types, the data sizes and the extents of its operations. An
+// operation reads its source extents, paying a random read for each extent,
+// decodes or patches its data into the bytes written, then writes them; these
+// steps aren't overlapped. The download is streamed with the apply, so the
+// slower of the two bounds the update.
+class ApplyTimeEstimator {
+ public:
+  ApplyTimeEstimator(const DeviceProfile& profile, uint64_t block_size)
+      : profile_(profile), block_size_(block_size) {}
+
+  OperationEstimate EstimateOperation(const InstallOperation& op,
+                                      size_t index) const;
+
+  PartitionEstimate EstimatePartition(const PartitionUpdate& partition) const;
+
+  // Returns a table of the estimates of each partition of |manifest| and of
+  // the whole payload, followed by the |max_dominant_ops| operations taking
+  // the longest to apply.
+  std::string Report(const DeltaArchiveManifest& manifest,
+                     size_t max_dominant_ops) const;
+
+  // Returns the time to download or apply all the |partitions|, streamed
+  // together, then to verify them.
+  static base::TimeDelta GetTotalTime(
+      const std::vector<PartitionEstimate>& partitions);
+
+ private:
+  // Returns the time to process |bytes| at |mbps| MiB/s.
+  static base::TimeDelta BytesTime(uint64_t bytes, double mbps);
+
+  DeviceProfile profile_;
+  uint64_t block_size_;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_APPLY_TIME_ESTIMATOR_H_
@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/apply_time_estimator.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using base::TimeDelta;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+const uint64_t kBlockSize = 4096;
+// 1 MiB, in blocks.
+const uint64_t kMiBBlocks = 256;
+}  // namespace
+
+class ApplyTimeEstimatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    profile_.download_mbps = 1;
+    profile_.read_mbps = 4;
+    profile_.random_read_iops = 10;
+    profile_.write_mbps = 2;
+    profile_.hash_mbps = 8;
+    profile_.decode_mbps = {{InstallOperation::REPLACE_XZ, 1}};
+  }
+
+  DeviceProfile profile_;
+};
+
+TEST_F(ApplyTimeEstimatorTest, LoadProfileTest) {
+  brillo::KeyValueStore store;
+  store.SetString("write_mbps", "25.5");
+  store.SetString("replace_bz_mbps", "12");
+  EXPECT_TRUE(profile_.Load(store));
+  EXPECT_EQ(25.5, profile_.write_mbps);
+  EXPECT_EQ(12, profile_.decode_mbps[InstallOperation::REPLACE_BZ]);
+  EXPECT_EQ(1, profile_.download_mbps);
+
+  store.SetString("read_mbps", "0");
+  EXPECT_FALSE(profile_.Load(store));
+  brillo::KeyValueStore unknown_store;
+  unknown_store.SetString("unknown_mbps", "1");
+  EXPECT_FALSE(profile_.Load(unknown_store));
+}
+
+TEST_F(ApplyTimeEstimatorTest, EstimateOperationTest) {
+  ApplyTimeEstimator estimator(profile_, kBlockSize);
+  InstallOperation op;
+  op.set_type(InstallOperation::REPLACE_XZ);
+  op.set_data_length(512 * 1024);
+  *op.add_dst_extents() = ExtentForRange(0, kMiBBlocks);
+  OperationEstimate estimate = estimator.EstimateOperation(op, 3);
+  EXPECT_EQ(3U, estimate.index);
+  EXPECT_EQ(TimeDelta::FromMilliseconds(500), estimate.download);
+  // Decoding 1 MiB at 1 MiB/s, then writing it at 2 MiB/s.
+  EXPECT_EQ(TimeDelta::FromMilliseconds(1500), estimate.apply);
+
+  // A copy pays a random read per source extent and reads at 4 MiB/s.
+  op.Clear();
+  op.set_type(InstallOperation::SOURCE_COPY);
+  *op.add_src_extents() = ExtentForRange(0, kMiBBlocks / 2);
+  *op.add_src_extents() = ExtentForRange(kMiBBlocks, kMiBBlocks / 2);
+  *op.add_dst_extents() = ExtentForRange(0, kMiBBlocks);
+  estimate = estimator.EstimateOperation(op, 0);
+  EXPECT_EQ(TimeDelta(), estimate.download);
+  EXPECT_EQ(TimeDelta::FromMilliseconds(200 + 250 + 500), estimate.apply);
+
+  op.set_type(InstallOperation::DISCARD);
+  EXPECT_EQ(TimeDelta(), estimator.EstimateOperation(op, 0).apply);
+}
+
+TEST_F(ApplyTimeEstimatorTest, ReportTest) {
+  ApplyTimeEstimator estimator(profile_, kBlockSize);
+  DeltaArchiveManifest manifest;
+  PartitionUpdate* partition = manifest.add_partitions();
+  partition->set_partition_name("system");
+  partition->mutable_new_partition_info()->set_size(4 * 1024 * 1024);
+  InstallOperation* op = partition->add_operations();
+  op->set_type(InstallOperation::REPLACE);
+  op->set_data_length(4 * 1024 * 1024);
+  *op->add_dst_extents() = ExtentForRange(0, 4 * kMiBBlocks);
+
+  PartitionEstimate estimate = estimator.EstimatePartition(*partition);
+  EXPECT_EQ(TimeDelta::FromSeconds(4), estimate.download);
+  EXPECT_EQ(TimeDelta::FromSeconds(2), estimate.apply);
+  // Read at 4 MiB/s, slower than the hash.
+  EXPECT_EQ(TimeDelta::FromSeconds(1), estimate.verify);
+  // The apply is hidden by the slower download.
+  EXPECT_EQ(TimeDelta::FromSeconds(5),
+            ApplyTimeEstimator::GetTotalTime({estimate}));
+
+  string report = estimator.Report(manifest, 1);
+  EXPECT_NE(string::npos, report.find("system"));
+  EXPECT_NE(string::npos, report.find("system operation 0 REPLACE: 2.00 s"));
+}
+
+}  // namespace chromeos_update_engine
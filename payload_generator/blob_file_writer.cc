@@ -16,17 +16,20 @@
 
 #include "update_engine/payload_generator/blob_file_writer.h"
 
+#include <algorithm>
+
 #include "update_engine/common/utils.h"
 
 namespace chromeos_update_engine {
 
 off_t BlobFileWriter::StoreBlob(const brillo::Blob& blob) {
-  base::AutoLock auto_lock(blob_mutex_);
-  if (!utils::PWriteAll(blob_fd_, blob.data(), blob.size(), *blob_file_size_))
+  off_t result = next_offset_.fetch_add(blob.size());
+  if (!utils::PWriteAll(blob_fd_, blob.data(), blob.size(), result))
     return -1;
 
-  off_t result = *blob_file_size_;
-  *blob_file_size_ += blob.size();
+  base::AutoLock auto_lock(blob_mutex_);
+  *blob_file_size_ =
+      std::max(*blob_file_size_, static_cast<off_t>(result + blob.size()));
 
   stored_blobs_++;
   if (total_blobs_ > 0 &&
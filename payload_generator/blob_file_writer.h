@@ -17,6 +17,8 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOB_FILE_WRITER_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOB_FILE_WRITER_H_
 
+#include <atomic>
+
 #include <base/macros.h>
 
 #include <base/synchronization/lock.h>
@@ -30,10 +32,12 @@ class BlobFileWriter {
   // |blob_fd| in a thread safe way.
   BlobFileWriter(int blob_fd, off_t* blob_file_size)
     : blob_fd_(blob_fd),
-      blob_file_size_(blob_file_size) {}
+      blob_file_size_(blob_file_size),
+      next_offset_(blob_file_size ? *blob_file_size : 0) {}
 
   // Store the passed |blob| in the blob file. Returns the offset at which it
-  // was stored, or -1 in case of failure.
+  // was stored, or -1 in case of failure. The blobs passed from several
+  // threads are written to the file at the same time.
   off_t StoreBlob(const brillo::Blob& blob);
 
   // The number of |total_blobs| is the number of blobs that will be stored but
@@ -45,12 +49,17 @@ class BlobFileWriter {
   size_t total_blobs_{0};
   size_t stored_blobs_{0};
 
-  // The file and its size are protected with the |blob_mutex_|.
   int blob_fd_;
-  off_t* blob_file_size_;
 
+  // The size of the file, including all the blobs written so far, and the
+  // number of blobs stored are protected with the |blob_mutex_|.
+  off_t* blob_file_size_;
   base::Lock blob_mutex_;
 
+  // The offset where the next blob is stored. The space for each blob is
+  // reserved from it before writing the blob, without taking the lock.
+  std::atomic<off_t> next_offset_;
+
   DISALLOW_COPY_AND_ASSIGN(BlobFileWriter);
 };
 
@@ -16,8 +16,11 @@
 
 #include "update_engine/payload_generator/blob_file_writer.h"
 
+#include <memory>
 #include <string>
+#include <vector>
 
+#include <base/threading/simple_thread.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
@@ -25,11 +28,47 @@
 
 using chromeos_update_engine::test_utils::FillWithData;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
 class BlobFileWriterTest : public ::testing::Test {};
 
+namespace {
+
+// Stores |num_blobs| blobs of |blob_size| bytes in a BlobFileWriter, each
+// one filled with a different byte starting from |first_byte|.
+class BlobStorer : public base::DelegateSimpleThread::Delegate {
+ public:
+  BlobStorer(BlobFileWriter* blob_file,
+             uint8_t first_byte,
+             size_t num_blobs,
+             size_t blob_size)
+      : blob_file_(blob_file),
+        first_byte_(first_byte),
+        num_blobs_(num_blobs),
+        blob_size_(blob_size) {}
+
+  void Run() override {
+    for (size_t i = 0; i < num_blobs_; i++) {
+      offsets_.push_back(
+          blob_file_->StoreBlob(brillo::Blob(blob_size_, first_byte_ + i)));
+    }
+  }
+
+  // The offsets where the blobs were stored.
+  const vector<off_t>& offsets() const { return offsets_; }
+
+ private:
+  BlobFileWriter* blob_file_;
+  uint8_t first_byte_;
+  size_t num_blobs_;
+  size_t blob_size_;
+  vector<off_t> offsets_;
+};
+
+}  // namespace
+
 TEST(BlobFileWriterTest, SimpleTest) {
   string blob_path;
   int blob_fd;
@@ -56,4 +95,47 @@ TEST(BlobFileWriterTest, SimpleTest) {
   EXPECT_EQ(blob, stored_blob);
 }
 
+TEST(BlobFileWriterTest, ThreadsTest) {
+  string blob_path;
+  int blob_fd;
+  EXPECT_TRUE(
+      utils::MakeTempFile("BlobFileWriterTest.XXXXXX", &blob_path, &blob_fd));
+  ScopedPathUnlinker blob_path_unlinker(blob_path);
+  ScopedFdCloser blob_fd_closer(&blob_fd);
+  off_t blob_file_size = 0;
+  BlobFileWriter blob_file(blob_fd, &blob_file_size);
+
+  const size_t kNumThreads = 4;
+  const size_t kBlobsPerThread = 16;
+  const size_t kBlobSize = 1000;
+  base::DelegateSimpleThreadPool thread_pool("blob-storer", kNumThreads);
+  vector<std::unique_ptr<BlobStorer>> storers;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    storers.emplace_back(new BlobStorer(
+        &blob_file, i * kBlobsPerThread, kBlobsPerThread, kBlobSize));
+  }
+  thread_pool.Start();
+  for (const auto& storer : storers)
+    thread_pool.AddWork(storer.get());
+  thread_pool.JoinAll();
+
+  // Every blob was stored in its own place in the file.
+  EXPECT_EQ(static_cast<off_t>(kNumThreads * kBlobsPerThread * kBlobSize),
+            blob_file_size);
+  for (size_t i = 0; i < kNumThreads; i++) {
+    ASSERT_EQ(kBlobsPerThread, storers[i]->offsets().size());
+    for (size_t j = 0; j < kBlobsPerThread; j++) {
+      brillo::Blob stored_blob(kBlobSize);
+      ssize_t bytes_read;
+      ASSERT_TRUE(utils::PReadAll(blob_fd,
+                                  stored_blob.data(),
+                                  kBlobSize,
+                                  storers[i]->offsets()[j],
+                                  &bytes_read));
+      EXPECT_EQ(static_cast<ssize_t>(kBlobSize), bytes_read);
+      EXPECT_EQ(brillo::Blob(kBlobSize, i * kBlobsPerThread + j), stored_blob);
+    }
+  }
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,88 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/block_bitmap.h"
+
+#include <algorithm>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+const uint64_t BlockBitmap::kBlocksPerWord;
+
+BlockBitmap::BlockBitmap(uint64_t num_blocks)
+    : num_blocks_(num_blocks),
+      words_((num_blocks + kBlocksPerWord - 1) / kBlocksPerWord, 0) {}
+
+void BlockBitmap::AddExtent(const Extent& extent) {
+  if (extent.start_block() == kSparseHole ||
+      extent.start_block() >= num_blocks_) {
+    return;
+  }
+  uint64_t block = extent.start_block();
+  uint64_t end_block =
+      std::min(num_blocks_, extent.start_block() + extent.num_blocks());
+  // Set the bits one by one up to a word boundary, then whole words.
+  for (; block < end_block && block % kBlocksPerWord != 0; block++)
+    AddBlock(block);
+  for (; block + kBlocksPerWord <= end_block; block += kBlocksPerWord)
+    words_[block / kBlocksPerWord] = ~uint64_t{0};
+  for (; block < end_block; block++)
+    AddBlock(block);
+}
+
+void BlockBitmap::AddRanges(const ExtentRanges& ranges) {
+  for (const Extent& extent : ranges.extent_set())
+    AddExtent(extent);
+}
+
+uint64_t BlockBitmap::blocks() const {
+  uint64_t result = 0;
+  for (uint64_t word : words_)
+    result += __builtin_popcountll(word);
+  return result;
+}
+
+vector<Extent> BlockBitmap::GetExtents() const {
+  vector<Extent> result;
+  uint64_t block = FindNextBlock(0, true);
+  while (block < num_blocks_) {
+    uint64_t end_block = FindNextBlock(block, false);
+    result.push_back(ExtentForRange(block, end_block - block));
+    block = FindNextBlock(end_block, true);
+  }
+  return result;
+}
+
+uint64_t BlockBitmap::FindNextBlock(uint64_t block, bool in_set) const {
+  while (block < num_blocks_) {
+    uint64_t word = words_[block / kBlocksPerWord];
+    if (!in_set)
+      word = ~word;
+    // Ignore the blocks before |block| in this word.
+    word &= ~uint64_t{0} << (block % kBlocksPerWord);
+    uint64_t word_start = block - block % kBlocksPerWord;
+    if (word != 0)
+      return std::min(num_blocks_, word_start + __builtin_ctzll(word));
+    block = word_start + kBlocksPerWord;
+  }
+  return num_blocks_;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,77 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_BITMAP_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_BITMAP_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A set of the blocks of a partition stored as one bit per block. Unlike
+// ExtentRanges, adding a block or checking whether it is in the set takes
+// constant time, which suits the loops visiting every block of a partition.
+// The set is converted to extents once those loops are done.
+class BlockBitmap {
+ public:
+  // Creates an empty set of the blocks [0, |num_blocks|).
+  explicit BlockBitmap(uint64_t num_blocks);
+
+  uint64_t num_blocks() const { return num_blocks_; }
+
+  void AddBlock(uint64_t block) {
+    words_[block / kBlocksPerWord] |= uint64_t{1} << (block % kBlocksPerWord);
+  }
+
+  bool ContainsBlock(uint64_t block) const {
+    return (words_[block / kBlocksPerWord] >> (block % kBlocksPerWord)) & 1;
+  }
+
+  // Adds the blocks of |extent|, or of all the extents in |ranges|. The blocks
+  // past num_blocks() are ignored.
+  void AddExtent(const Extent& extent);
+  void AddRanges(const ExtentRanges& ranges);
+
+  // Returns the number of blocks in the set.
+  uint64_t blocks() const;
+
+  // Returns the blocks in the set as a sorted list of extents.
+  std::vector<Extent> GetExtents() const;
+
+ private:
+  static const uint64_t kBlocksPerWord = 64;
+
+  // Returns the first block from |block| on which is in the set if |in_set|,
+  // or which isn't otherwise. Returns num_blocks() if there is none.
+  uint64_t FindNextBlock(uint64_t block, bool in_set) const;
+
+  uint64_t num_blocks_;
+  // The bits past |num_blocks_| in the last word are always zero.
+  std::vector<uint64_t> words_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockBitmap);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_BITMAP_H_
@@ -0,0 +1,87 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/block_bitmap.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class BlockBitmapTest : public ::testing::Test {};
+
+TEST_F(BlockBitmapTest, EmptyTest) {
+  BlockBitmap bitmap(100);
+  EXPECT_EQ(100U, bitmap.num_blocks());
+  EXPECT_EQ(0U, bitmap.blocks());
+  EXPECT_FALSE(bitmap.ContainsBlock(0));
+  EXPECT_FALSE(bitmap.ContainsBlock(99));
+  EXPECT_EQ(vector<Extent>(), bitmap.GetExtents());
+}
+
+TEST_F(BlockBitmapTest, AddBlockTest) {
+  BlockBitmap bitmap(200);
+  bitmap.AddBlock(0);
+  bitmap.AddBlock(63);
+  bitmap.AddBlock(64);
+  bitmap.AddBlock(199);
+  EXPECT_TRUE(bitmap.ContainsBlock(0));
+  EXPECT_FALSE(bitmap.ContainsBlock(1));
+  EXPECT_TRUE(bitmap.ContainsBlock(63));
+  EXPECT_TRUE(bitmap.ContainsBlock(64));
+  EXPECT_FALSE(bitmap.ContainsBlock(65));
+  EXPECT_TRUE(bitmap.ContainsBlock(199));
+  EXPECT_EQ(4U, bitmap.blocks());
+  EXPECT_EQ((vector<Extent>{ExtentForRange(0, 1),
+                            ExtentForRange(63, 2),
+                            ExtentForRange(199, 1)}),
+            bitmap.GetExtents());
+}
+
+TEST_F(BlockBitmapTest, AddExtentTest) {
+  BlockBitmap bitmap(300);
+  bitmap.AddExtent(ExtentForRange(10, 250));
+  // The blocks past the end of the bitmap and the sparse holes are ignored.
+  bitmap.AddExtent(ExtentForRange(290, 20));
+  bitmap.AddExtent(ExtentForRange(kSparseHole, 5));
+  EXPECT_EQ(260U, bitmap.blocks());
+  EXPECT_FALSE(bitmap.ContainsBlock(9));
+  EXPECT_TRUE(bitmap.ContainsBlock(10));
+  EXPECT_TRUE(bitmap.ContainsBlock(259));
+  EXPECT_FALSE(bitmap.ContainsBlock(260));
+  EXPECT_EQ((vector<Extent>{ExtentForRange(10, 250), ExtentForRange(290, 10)}),
+            bitmap.GetExtents());
+}
+
+TEST_F(BlockBitmapTest, AddRangesTest) {
+  ExtentRanges ranges;
+  ranges.AddExtent(ExtentForRange(5, 100));
+  ranges.AddExtent(ExtentForRange(128, 64));
+  BlockBitmap bitmap(192);
+  bitmap.AddRanges(ranges);
+  EXPECT_EQ(ranges.blocks(), bitmap.blocks());
+  EXPECT_EQ((vector<Extent>{ExtentForRange(5, 100), ExtentForRange(128, 64)}),
+            bitmap.GetExtents());
+}
+
+}  // namespace chromeos_update_engine
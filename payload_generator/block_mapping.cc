@@ -20,28 +20,129 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#include <functional>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <base/macros.h>
+#include <base/threading/simple_thread.h>
+
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 
 using std::string;
 using std::vector;
 
 namespace {
 
-size_t HashValue(const brillo::Blob& blob) {
-  std::hash<string> hash_fn;
-  return hash_fn(string(blob.begin(), blob.end()));
+// The initial number of slots of the hash table.
+const size_t kMinSlots = 1024;
+
+// The number of blocks read at once by AddManyDiskBlocks().
+const size_t kBlocksPerRead = 256;
+
+// The number of contiguous blocks hashed by each BlockHasher.
+const size_t kBlocksPerHasher = 64 * kBlocksPerRead;
+
+// Returns a hash of the |size| bytes of |data|. The 64-bit words are mixed in
+// four independent lanes so they are processed in parallel, and the block is
+// hashed in place.
+uint64_t HashBlock(const uint8_t* data, size_t size) {
+  const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+  uint64_t lanes[4] = {1, 2, 3, 4};
+  size_t pos = 0;
+  for (; pos + sizeof(lanes) <= size; pos += sizeof(lanes)) {
+    for (size_t i = 0; i < 4; i++) {
+      uint64_t word;
+      memcpy(&word, data + pos + i * sizeof(word), sizeof(word));
+      lanes[i] = (lanes[i] ^ word) * kMul;
+      lanes[i] ^= lanes[i] >> 29;
+    }
+  }
+  for (; pos < size; pos++)
+    lanes[0] = (lanes[0] ^ data[pos]) * kMul;
+
+  uint64_t hash = size;
+  for (uint64_t lane : lanes) {
+    hash = (hash ^ lane) * kMul;
+    hash ^= hash >> 32;
+  }
+  return hash;
 }
 
 }  // namespace
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// Reads |num_blocks| contiguous blocks from |fd|, starting at |byte_offset|,
+// and stores the hash of each one of them in |hashes|. The hashers of a
+// partition are run in parallel, each one on its own range of blocks.
+class BlockHasher : public base::DelegateSimpleThread::Delegate {
+ public:
+  BlockHasher(int fd,
+              off_t byte_offset,
+              size_t block_size,
+              size_t num_blocks,
+              uint64_t* hashes)
+      : fd_(fd),
+        byte_offset_(byte_offset),
+        block_size_(block_size),
+        num_blocks_(num_blocks),
+        hashes_(hashes) {}
+  ~BlockHasher() override = default;
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    brillo::Blob buffer(std::min(num_blocks_, kBlocksPerRead) * block_size_);
+    while (blocks_hashed_ < num_blocks_) {
+      size_t count = std::min(num_blocks_ - blocks_hashed_, kBlocksPerRead);
+      ssize_t bytes_read = 0;
+      if (!utils::PReadAll(fd_,
+                           buffer.data(),
+                           count * block_size_,
+                           byte_offset_ + blocks_hashed_ * block_size_,
+                           &bytes_read)) {
+        return;
+      }
+      size_t blocks_read =
+          std::min(count, static_cast<size_t>(bytes_read) / block_size_);
+      for (size_t i = 0; i < blocks_read; i++) {
+        hashes_[blocks_hashed_ + i] =
+            HashBlock(buffer.data() + i * block_size_, block_size_);
+      }
+      blocks_hashed_ += blocks_read;
+      if (blocks_read < count)
+        return;
+    }
+  }
+
+  // The number of blocks, from the first one, hashed by Run(). The rest of
+  // them couldn't be read.
+  size_t blocks_hashed() const { return blocks_hashed_; }
+
+ private:
+  int fd_;
+  off_t byte_offset_;
+  size_t block_size_;
+  size_t num_blocks_;
+  uint64_t* hashes_;
+
+  size_t blocks_hashed_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(BlockHasher);
+};
+
+}  // namespace
+
 BlockMapping::BlockId BlockMapping::AddBlock(const brillo::Blob& block_data) {
-  return AddBlock(-1, 0, block_data);
+  if (block_data.size() != block_size_)
+    return -1;
+  return AddBlock(-1, 0, block_data.data());
 }
 
 BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
@@ -51,79 +152,138 @@ BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
     return -1;
   if (static_cast<size_t>(bytes_read) != block_size_)
     return -1;
-  return AddBlock(fd, byte_offset, blob);
+  return AddBlock(fd, byte_offset, blob.data());
 }
 
 bool BlockMapping::AddManyDiskBlocks(int fd,
                                      off_t initial_byte_offset,
                                      size_t num_blocks,
                                      vector<BlockId>* block_ids) {
+  // The blocks are first read and hashed in parallel, in ranges of
+  // kBlocksPerHasher blocks. Then they are added in order, so the block ids
+  // assigned are the same regardless of the number of threads.
+  vector<uint64_t> hashes(num_blocks);
+  vector<std::unique_ptr<BlockHasher>> hashers;
+  for (size_t first = 0; first < num_blocks; first += kBlocksPerHasher) {
+    hashers.emplace_back(
+        new BlockHasher(fd,
+                        initial_byte_offset + first * block_size_,
+                        block_size_,
+                        std::min(num_blocks - first, kBlocksPerHasher),
+                        hashes.data() + first));
+  }
+  if (num_threads_ > 1 && hashers.size() > 1) {
+    base::DelegateSimpleThreadPool thread_pool(
+        "block-mapping", std::min(num_threads_, hashers.size()));
+    thread_pool.Start();
+    for (const auto& hasher : hashers)
+      thread_pool.AddWork(hasher.get());
+    thread_pool.JoinAll();
+  } else {
+    for (const auto& hasher : hashers)
+      hasher->Run();
+  }
+
   bool ret = true;
   block_ids->resize(num_blocks);
   for (size_t block = 0; block < num_blocks; block++) {
-    (*block_ids)[block] = AddDiskBlock(
-        fd, initial_byte_offset + block * block_size_);
-    ret = ret && (*block_ids)[block] != -1;
+    BlockId block_id = -1;
+    if (block % kBlocksPerHasher <
+        hashers[block / kBlocksPerHasher]->blocks_hashed()) {
+      block_id = AddBlock(
+          fd, initial_byte_offset + block * block_size_, hashes[block], nullptr);
+    }
+    (*block_ids)[block] = block_id;
+    ret = ret && block_id != -1;
   }
   return ret;
 }
 
 BlockMapping::BlockId BlockMapping::AddBlock(int fd,
                                              off_t byte_offset,
-                                             const brillo::Blob& block_data) {
-  if (block_data.size() != block_size_)
-    return -1;
-  size_t h = HashValue(block_data);
-
-  // We either reuse a UniqueBlock or create a new one. If we need a new
-  // UniqueBlock it could also be part of a new or existing bucket (if there is
-  // a hash collision).
-  vector<UniqueBlock> *bucket = nullptr;
+                                             const uint8_t* block_data) {
+  return AddBlock(
+      fd, byte_offset, HashBlock(block_data, block_size_), block_data);
+}
 
-  auto mapping_it = mapping_.find(h);
-  if (mapping_it == mapping_.end()) {
-    bucket = &mapping_[h];
-  } else {
-    for (UniqueBlock& existing_block : mapping_it->second) {
-      bool equals = false;
-      if (!existing_block.CompareData(block_data, &equals))
+BlockMapping::BlockId BlockMapping::AddBlock(int fd,
+                                             off_t byte_offset,
+                                             uint64_t hash,
+                                             const uint8_t* block_data) {
+  brillo::Blob blob;
+  // Look for an existing UniqueBlock with the same data in the slots starting
+  // from the hash.
+  size_t mask = slots_.size() - 1;
+  size_t slot = hash & mask;
+  for (; !slots_.empty() && slots_[slot] != -1; slot = (slot + 1) & mask) {
+    UniqueBlock& existing_block = unique_blocks_[slots_[slot]];
+    if (existing_block.hash != hash)
+      continue;
+    if (!block_data) {
+      blob.resize(block_size_);
+      ssize_t bytes_read = 0;
+      if (!utils::PReadAll(
+              fd, blob.data(), block_size_, byte_offset, &bytes_read) ||
+          static_cast<size_t>(bytes_read) != block_size_) {
         return -1;
-      if (equals)
-        return existing_block.block_id;
+      }
+      block_data = blob.data();
     }
-    bucket = &mapping_it->second;
+    bool equals = false;
+    if (!existing_block.CompareData(block_data, block_size_, &equals))
+      return -1;
+    if (equals)
+      return slots_[slot];
   }
 
   // No existing block was found at this point, so we create and fill in a new
   // one.
-  bucket->emplace_back();
-  UniqueBlock *new_ublock = &bucket->back();
+  BlockId block_id = unique_blocks_.size();
+  unique_blocks_.emplace_back();
+  UniqueBlock* new_ublock = &unique_blocks_.back();
 
+  new_ublock->hash = hash;
   new_ublock->times_read = 1;
   new_ublock->fd = fd;
   new_ublock->byte_offset = byte_offset;
-  new_ublock->block_id = used_block_ids++;
   // We need to cache blocks that are not referencing any disk location.
+  // These are always passed with their data.
   if (fd == -1)
-    new_ublock->block_data = block_data;
+    new_ublock->block_data.assign(block_data, block_data + block_size_);
+
+  if (unique_blocks_.size() * 2 > slots_.size()) {
+    Rehash(std::max(kMinSlots, slots_.size() * 2));
+  } else {
+    slots_[slot] = block_id;
+  }
+  return block_id;
+}
 
-  return new_ublock->block_id;
+void BlockMapping::Rehash(size_t num_slots) {
+  slots_.assign(num_slots, -1);
+  size_t mask = num_slots - 1;
+  for (size_t block_id = 0; block_id < unique_blocks_.size(); block_id++) {
+    size_t slot = unique_blocks_[block_id].hash & mask;
+    while (slots_[slot] != -1)
+      slot = (slot + 1) & mask;
+    slots_[slot] = block_id;
+  }
 }
 
-bool BlockMapping::UniqueBlock::CompareData(const brillo::Blob& other_block,
+bool BlockMapping::UniqueBlock::CompareData(const uint8_t* other_block,
+                                            size_t size,
                                             bool* equals) {
   if (!block_data.empty()) {
-    *equals = block_data == other_block;
+    *equals = memcmp(block_data.data(), other_block, size) == 0;
     return true;
   }
-  const size_t block_size = other_block.size();
-  brillo::Blob blob(block_size);
+  brillo::Blob blob(size);
   ssize_t bytes_read = 0;
-  if (!utils::PReadAll(fd, blob.data(), block_size, byte_offset, &bytes_read))
+  if (!utils::PReadAll(fd, blob.data(), size, byte_offset, &bytes_read))
     return false;
-  if (static_cast<size_t>(bytes_read) != block_size)
+  if (static_cast<size_t>(bytes_read) != size)
     return false;
-  *equals = blob == other_block;
+  *equals = memcmp(blob.data(), other_block, size) == 0;
 
   // We increase the number of times we had to read this block from disk and
   // we cache this block based on that. This caching method is optimized for
@@ -144,6 +304,7 @@ bool MapPartitionBlocks(const string& old_part,
                         vector<BlockMapping::BlockId>* old_block_ids,
                         vector<BlockMapping::BlockId>* new_block_ids) {
   BlockMapping mapping(block_size);
+  mapping.set_num_threads(diff_utils::GetMaxThreads());
   if (mapping.AddBlock(brillo::Blob(block_size, '\0')) != 0)
     return false;
   int old_fd = HANDLE_EINTR(open(old_part.c_str(), O_RDONLY));
@@ -158,4 +319,8 @@ bool MapPartitionBlocks(const string& old_part,
   return true;
 }
 
+uint64_t HashBlockData(const uint8_t* data, size_t size) {
+  return HashBlock(data, size);
+}
+
 }  // namespace chromeos_update_engine
@@ -17,7 +17,6 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
 
-#include <map>
 #include <string>
 #include <vector>
 
@@ -56,25 +55,40 @@ class BlockMapping {
   bool AddManyDiskBlocks(int fd, off_t initial_byte_offset, size_t num_blocks,
                          std::vector<BlockId>* block_ids);
 
+  // Sets the number of threads used by AddManyDiskBlocks() to read and hash
+  // the blocks. The block ids assigned don't depend on it.
+  void set_num_threads(size_t num_threads) { num_threads_ = num_threads; }
+
  private:
   FRIEND_TEST(BlockMappingTest, BlocksAreNotKeptInMemory);
 
-  // Add a single block passed in |block_data|. If |fd| is not -1, the block
-  // can be discarded to save RAM and retrieved later from |fd| at the position
-  // |byte_offset|.
-  BlockId AddBlock(int fd, off_t byte_offset, const brillo::Blob& block_data);
+  // Add a single block of |block_size_| bytes passed in |block_data|. If |fd|
+  // is not -1, the block can be discarded to save RAM and retrieved later from
+  // |fd| at the position |byte_offset|.
+  BlockId AddBlock(int fd, off_t byte_offset, const uint8_t* block_data);
 
-  size_t block_size_;
+  // Same as above, but with the |hash| of the block data already computed.
+  // The |block_data| may be null for a disk block, in which case it is only
+  // read from |fd| if a unique block with the same hash is found.
+  BlockId AddBlock(int fd,
+                   off_t byte_offset,
+                   uint64_t hash,
+                   const uint8_t* block_data);
+
+  // Resizes |slots_| to |num_slots|, a power of two, and re-inserts all the
+  // unique blocks.
+  void Rehash(size_t num_slots);
 
-  BlockId used_block_ids{0};
+  size_t block_size_;
+  size_t num_threads_{1};
 
   // The UniqueBlock represents the data of a block associated to a unique
   // block id.
   struct UniqueBlock {
     brillo::Blob block_data;
 
-    // The block id assigned to this unique block.
-    BlockId block_id;
+    // The hash of the block data.
+    uint64_t hash{0};
 
     // The location on this unique block on disk (if not cached in block_data).
     int fd{-1};
@@ -83,14 +97,19 @@ class BlockMapping {
     // Number of times we have seen this data block. Used for caching.
     uint32_t times_read{0};
 
-    // Compares the UniqueBlock data with the other_block data and stores if
-    // they are equal in |equals|. Returns whether there was an error reading
-    // the block from disk while comparing it.
-    bool CompareData(const brillo::Blob& other_block, bool* equals);
+    // Compares the UniqueBlock data with the |size| bytes of |other_block|
+    // and stores if they are equal in |equals|. Returns whether there was an
+    // error reading the block from disk while comparing it.
+    bool CompareData(const uint8_t* other_block, size_t size, bool* equals);
   };
 
-  // A mapping from hash values to possible block ids.
-  std::map<size_t, std::vector<UniqueBlock>> mapping_;
+  // The unique blocks, indexed by their block id.
+  std::vector<UniqueBlock> unique_blocks_;
+
+  // An open addressing hash table with linear probing of the block ids,
+  // placed by the hash of their data, or -1 for the empty slots. Its size is
+  // a power of two, kept over twice the number of unique blocks.
+  std::vector<BlockId> slots_;
 };
 
 // Maps the blocks of the old and new partitions |old_part| and |new_part| whose
@@ -107,6 +126,10 @@ bool MapPartitionBlocks(const std::string& old_part,
                         std::vector<BlockMapping::BlockId>* old_block_ids,
                         std::vector<BlockMapping::BlockId>* new_block_ids);
 
+// Returns the hash of the |size| bytes of |data| used by BlockMapping to place
+// the blocks, so other indexes of blocks by content can use the same one.
+uint64_t HashBlockData(const uint8_t* data, size_t size);
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
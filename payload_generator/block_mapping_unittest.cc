@@ -80,10 +80,8 @@ TEST_F(BlockMappingTest, BlocksAreNotKeptInMemory) {
 
   // Check that the block_data is not stored on memory if we just used the block
   // once.
-  for (const auto& it : bm_.mapping_) {
-    for (const BlockMapping::UniqueBlock& ublock : it.second) {
-      EXPECT_TRUE(ublock.block_data.empty());
-    }
+  for (const BlockMapping::UniqueBlock& ublock : bm_.unique_blocks_) {
+    EXPECT_TRUE(ublock.block_data.empty());
   }
 
   brillo::Blob block(block_size_, 'a');
@@ -92,16 +90,55 @@ TEST_F(BlockMappingTest, BlocksAreNotKeptInMemory) {
     EXPECT_EQ(0, bm_.AddBlock(block));
   }
 
-  for (const auto& it : bm_.mapping_) {
-    for (const BlockMapping::UniqueBlock& ublock : it.second) {
-      EXPECT_FALSE(ublock.block_data.empty());
-      // The block was loaded from disk only 4 times, and after that the counter
-      // is not updated anymore.
-      EXPECT_EQ(4U, ublock.times_read);
-    }
+  for (const BlockMapping::UniqueBlock& ublock : bm_.unique_blocks_) {
+    EXPECT_FALSE(ublock.block_data.empty());
+    // The block was loaded from disk only 4 times, and after that the counter
+    // is not updated anymore.
+    EXPECT_EQ(4U, ublock.times_read);
   }
 }
 
+TEST_F(BlockMappingTest, ManyBlocksTest) {
+  // Enough blocks to grow the hash table several times.
+  const size_t kNumBlocks = 5000;
+  brillo::Blob blob(block_size_);
+  for (size_t i = 0; i < kNumBlocks; ++i) {
+    blob[i % block_size_] = 1 + i / block_size_;
+    EXPECT_EQ(static_cast<BlockMapping::BlockId>(i), bm_.AddBlock(blob));
+  }
+  // The same blocks are found again.
+  blob.assign(block_size_, 0);
+  for (size_t i = 0; i < kNumBlocks; ++i) {
+    blob[i % block_size_] = 1 + i / block_size_;
+    EXPECT_EQ(static_cast<BlockMapping::BlockId>(i), bm_.AddBlock(blob));
+  }
+}
+
+TEST_F(BlockMappingTest, ThreadsDontChangeBlockIdsTest) {
+  // Enough blocks to be hashed by several threads, with some repeated ones.
+  const size_t kNumBlocks = 20000;
+  string contents(kNumBlocks * block_size_, '\0');
+  for (size_t i = 0; i < contents.size(); ++i)
+    contents[i] = (i / block_size_) % 3000 == i % block_size_ ? 1 : 0;
+  test_utils::WriteFileString(old_part_path_, contents);
+  int fd = HANDLE_EINTR(open(old_part_path_.c_str(), O_RDONLY));
+  ScopedFdCloser fd_closer(&fd);
+
+  vector<BlockMapping::BlockId> expected_ids;
+  EXPECT_TRUE(bm_.AddManyDiskBlocks(fd, 0, kNumBlocks, &expected_ids));
+  EXPECT_EQ(expected_ids[5], expected_ids[3005]);
+  EXPECT_NE(expected_ids[5], expected_ids[6]);
+
+  BlockMapping parallel_mapping(block_size_);
+  parallel_mapping.set_num_threads(4);
+  vector<BlockMapping::BlockId> ids;
+  // The block past the end of the file can't be read.
+  EXPECT_FALSE(parallel_mapping.AddManyDiskBlocks(fd, 0, kNumBlocks + 1, &ids));
+  EXPECT_EQ(-1, ids.back());
+  ids.pop_back();
+  EXPECT_EQ(expected_ids, ids);
+}
+
 TEST_F(BlockMappingTest, MapPartitionBlocks) {
   // A string with 10 blocks where all the blocks are different.
   string old_contents(10 * block_size_, '\0');
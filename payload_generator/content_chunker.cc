@@ -0,0 +1,178 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/content_chunker.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/partition_reader.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The number of blocks read at once by FindContentChunks().
+const uint64_t kContentChunkReadBlocks = 256;
+
+// Returns the random values added to the gear rolling hash for each byte,
+// generated with a fixed seed so the boundaries found don't change between
+// runs.
+const std::array<uint64_t, 256>& GearTable() {
+  static const std::array<uint64_t, 256> table = [] {
+    std::array<uint64_t, 256> values;
+    // splitmix64.
+    uint64_t state = 0x5d588b656c078965;
+    for (uint64_t& value : values) {
+      state += 0x9e3779b97f4a7c15;
+      uint64_t z = state;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      value = z ^ (z >> 31);
+    }
+    return values;
+  }();
+  return table;
+}
+
+}  // namespace
+
+ContentChunker::ContentChunker(size_t block_size, size_t max_chunk_blocks)
+    : block_size_(block_size),
+      max_chunk_blocks_(std::max<size_t>(max_chunk_blocks, 1)),
+      min_chunk_bytes_(max_chunk_blocks_ * block_size / 4) {
+  // A boundary is found on average every 2^bits bytes after the minimum size,
+  // so the chunks are about half of the maximum size. The high bits of the
+  // hash are checked since the low ones only depend on the last few bytes.
+  uint64_t bits = 1;
+  while (bits < 32 && (1ULL << (bits + 1)) <= min_chunk_bytes_)
+    bits++;
+  boundary_mask_ = ((1ULL << bits) - 1) << (64 - bits);
+}
+
+void ContentChunker::Update(const uint8_t* data, size_t size) {
+  const std::array<uint64_t, 256>& gear = GearTable();
+  while (size > 0) {
+    size_t count = std::min<size_t>(size, block_size_ - offset_ % block_size_);
+    uint64_t chunk_bytes = offset_ - chunk_start_block_ * block_size_;
+    for (size_t i = 0; i < count; i++) {
+      hash_ = (hash_ << 1) + gear[data[i]];
+      chunk_bytes++;
+      if (!cut_pending_ && chunk_bytes >= min_chunk_bytes_ &&
+          (hash_ & boundary_mask_) == 0) {
+        cut_pending_ = true;
+        pending_anchor_ = hash_;
+      }
+    }
+    offset_ += count;
+    data += count;
+    size -= count;
+
+    if (offset_ % block_size_ != 0)
+      continue;
+    uint64_t end_block = offset_ / block_size_;
+    if (cut_pending_) {
+      AddChunk(end_block, true, pending_anchor_);
+    } else if (end_block - chunk_start_block_ >= max_chunk_blocks_) {
+      AddChunk(end_block, false, 0);
+    }
+  }
+}
+
+const vector<ContentChunk>& ContentChunker::Finish() {
+  uint64_t end_block = (offset_ + block_size_ - 1) / block_size_;
+  if (end_block > chunk_start_block_)
+    AddChunk(end_block, false, 0);
+  return chunks_;
+}
+
+void ContentChunker::AddChunk(uint64_t end_block,
+                              bool has_anchor,
+                              uint64_t anchor) {
+  chunks_.push_back({chunk_start_block_,
+                     end_block - chunk_start_block_,
+                     has_anchor,
+                     anchor});
+  chunk_start_block_ = end_block;
+  cut_pending_ = false;
+}
+
+bool FindContentChunks(const string& part_path,
+                       const vector<Extent>& extents,
+                       size_t block_size,
+                       size_t max_chunk_blocks,
+                       vector<ContentChunk>* chunks) {
+  ContentChunker chunker(block_size, max_chunk_blocks);
+  uint64_t num_blocks = utils::BlocksInExtents(extents);
+  brillo::Blob data;
+  for (uint64_t block_offset = 0; block_offset < num_blocks;
+       block_offset += kContentChunkReadBlocks) {
+    uint64_t count =
+        std::min(kContentChunkReadBlocks, num_blocks - block_offset);
+    TEST_AND_RETURN_FALSE(
+        ReadPartitionExtents(part_path,
+                             ExtentsSublist(extents, block_offset, count),
+                             &data,
+                             count * block_size,
+                             block_size));
+    chunker.Update(data.data(), data.size());
+  }
+  *chunks = chunker.Finish();
+  return true;
+}
+
+vector<ssize_t> MatchContentChunks(const vector<ContentChunk>& old_chunks,
+                                   const vector<ContentChunk>& new_chunks) {
+  std::map<uint64_t, vector<ssize_t>> old_anchors;
+  for (size_t i = 0; i < old_chunks.size(); i++) {
+    if (old_chunks[i].has_anchor)
+      old_anchors[old_chunks[i].anchor].push_back(i);
+  }
+
+  vector<ssize_t> matches;
+  matches.reserve(new_chunks.size());
+  ssize_t previous = -1;
+  for (const ContentChunk& chunk : new_chunks) {
+    ssize_t match = -1;
+    auto anchor = chunk.has_anchor ? old_anchors.find(chunk.anchor)
+                                   : old_anchors.end();
+    if (anchor != old_anchors.end()) {
+      // The same content can repeat in the file, so the first old chunk with
+      // the anchor after the previous match is preferred.
+      const vector<ssize_t>& indexes = anchor->second;
+      auto next =
+          std::upper_bound(indexes.begin(), indexes.end(), previous);
+      match = next != indexes.end() ? *next : indexes.front();
+    } else if (previous + 1 < static_cast<ssize_t>(old_chunks.size())) {
+      match = previous + 1;
+    }
+    matches.push_back(match);
+    if (match != -1)
+      previous = match;
+  }
+  return matches;
+}
+
+}  // namespace chromeos_update_engine
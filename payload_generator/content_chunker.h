@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_CONTENT_CHUNKER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_CONTENT_CHUNKER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A chunk of a file, in blocks, found by the ContentChunker.
+struct ContentChunk {
+  uint64_t block_offset;
+  uint64_t num_blocks;
+  // Whether the chunk was cut after a content defined boundary, and the
+  // rolling hash of the bytes before the boundary. The chunks cut because they
+  // reached the maximum size, and the last one, don't have an anchor.
+  bool has_anchor;
+  uint64_t anchor;
+};
+
+// Splits a stream of data in chunks of whole blocks whose boundaries depend on
+// the data around them instead of on their offset. A gear rolling hash of the
+// last 64 bytes is computed over the data and a chunk ends at the end of the
+// block where the hash hits a boundary pattern. Inserting or removing data in
+// a file then only moves the boundaries close to the change, so the chunks
+// after it still match the chunks of the old file with the same anchor.
+class ContentChunker {
+ public:
+  // The chunks have at most |max_chunk_blocks| blocks of |block_size| bytes,
+  // and at least a quarter of that unless they are cut at the end of the data.
+  ContentChunker(size_t block_size, size_t max_chunk_blocks);
+
+  // Adds the next |size| bytes of |data| to the stream.
+  void Update(const uint8_t* data, size_t size);
+
+  // Ends the stream and returns all its chunks.
+  const std::vector<ContentChunk>& Finish();
+
+ private:
+  // Adds the chunk from the end of the previous one up to |end_block|.
+  void AddChunk(uint64_t end_block, bool has_anchor, uint64_t anchor);
+
+  const size_t block_size_;
+  const uint64_t max_chunk_blocks_;
+  // The minimum size of a chunk cut after a boundary, in bytes.
+  const uint64_t min_chunk_bytes_;
+  // The bits of the rolling hash that must be zero at a boundary.
+  uint64_t boundary_mask_;
+
+  uint64_t hash_{0};
+  uint64_t offset_{0};
+  uint64_t chunk_start_block_{0};
+  // Whether a boundary was found in the current block, which ends the chunk.
+  bool cut_pending_{false};
+  uint64_t pending_anchor_{0};
+
+  std::vector<ContentChunk> chunks_;
+
+  DISALLOW_COPY_AND_ASSIGN(ContentChunker);
+};
+
+// Splits the file with the blocks |extents| of the image |part_path| with a
+// ContentChunker in |chunks|. Returns whether it could read the file.
+bool FindContentChunks(const std::string& part_path,
+                       const std::vector<Extent>& extents,
+                       size_t block_size,
+                       size_t max_chunk_blocks,
+                       std::vector<ContentChunk>* chunks);
+
+// Pairs each of the |new_chunks| of a file with one of the |old_chunks| of its
+// old version. The chunks are matched by their anchor, in order, and the ones
+// without a matching anchor, usually the changed ones, are paired with the old
+// chunk following the one paired with the previous new chunk. Returns the
+// index of the old chunk of each new chunk, or -1 when there is none left.
+std::vector<ssize_t> MatchContentChunks(
+    const std::vector<ContentChunk>& old_chunks,
+    const std::vector<ContentChunk>& new_chunks);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_CONTENT_CHUNKER_H_
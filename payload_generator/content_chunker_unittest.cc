@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/content_chunker.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const size_t kChunkerBlockSize = 4096;
+const size_t kMaxChunkBlocks = 16;
+
+brillo::Blob RandomData(size_t size, uint32_t seed) {
+  std::mt19937 generator(seed);
+  brillo::Blob data(size);
+  for (uint8_t& byte : data)
+    byte = generator();
+  return data;
+}
+
+vector<ContentChunk> Chunk(const brillo::Blob& data) {
+  ContentChunker chunker(kChunkerBlockSize, kMaxChunkBlocks);
+  // Feed the data in pieces not aligned to the blocks.
+  for (size_t offset = 0; offset < data.size(); offset += 1000) {
+    chunker.Update(data.data() + offset,
+                   std::min<size_t>(1000, data.size() - offset));
+  }
+  return chunker.Finish();
+}
+
+ContentChunk AnchoredChunk(uint64_t anchor) {
+  return {0, 1, true, anchor};
+}
+
+}  // namespace
+
+class ContentChunkerTest : public ::testing::Test {};
+
+TEST_F(ContentChunkerTest, ChunksCoverTheDataTest) {
+  brillo::Blob data = RandomData(256 * kChunkerBlockSize, 1);
+  vector<ContentChunk> chunks = Chunk(data);
+
+  uint64_t next_block = 0;
+  size_t anchored = 0;
+  for (const ContentChunk& chunk : chunks) {
+    EXPECT_EQ(next_block, chunk.block_offset);
+    EXPECT_LE(chunk.num_blocks, kMaxChunkBlocks);
+    if (chunk.has_anchor) {
+      EXPECT_GE(chunk.num_blocks, kMaxChunkBlocks / 4);
+      anchored++;
+    }
+    next_block += chunk.num_blocks;
+  }
+  EXPECT_EQ(256U, next_block);
+  EXPECT_LT(0U, anchored);
+  // The chunks only depend on the data.
+  EXPECT_EQ(chunks.size(), Chunk(data).size());
+}
+
+TEST_F(ContentChunkerTest, PartialLastBlockTest) {
+  vector<ContentChunk> chunks = Chunk(RandomData(kChunkerBlockSize + 1, 2));
+  ASSERT_EQ(1U, chunks.size());
+  EXPECT_EQ(2U, chunks[0].num_blocks);
+  EXPECT_FALSE(chunks[0].has_anchor);
+}
+
+TEST_F(ContentChunkerTest, InsertedDataKeepsTheAnchorsTest) {
+  brillo::Blob old_data = RandomData(512 * kChunkerBlockSize, 3);
+  // Insert a few bytes at the start, which shifts all the blocks after them.
+  brillo::Blob new_data = RandomData(100, 4);
+  new_data.insert(new_data.end(), old_data.begin(), old_data.end());
+
+  vector<ContentChunk> old_chunks = Chunk(old_data);
+  vector<ContentChunk> new_chunks = Chunk(new_data);
+  vector<ssize_t> matches = MatchContentChunks(old_chunks, new_chunks);
+  ASSERT_EQ(new_chunks.size(), matches.size());
+
+  // Past the first chunks, the new chunks end at the same content as the old
+  // ones and are paired with them.
+  size_t anchored = 0;
+  size_t matched = 0;
+  for (size_t i = 0; i < new_chunks.size(); i++) {
+    if (!new_chunks[i].has_anchor)
+      continue;
+    anchored++;
+    ASSERT_NE(-1, matches[i]);
+    if (old_chunks[matches[i]].has_anchor &&
+        old_chunks[matches[i]].anchor == new_chunks[i].anchor)
+      matched++;
+  }
+  EXPECT_LT(10U, anchored);
+  EXPECT_LE(anchored - 2, matched);
+}
+
+TEST_F(ContentChunkerTest, MatchContentChunksTest) {
+  ContentChunk unanchored = {0, 1, false, 0};
+  vector<ContentChunk> old_chunks = {
+      AnchoredChunk(1), AnchoredChunk(2), AnchoredChunk(3), unanchored};
+
+  // The changed chunks are paired with the old chunk after the previous one.
+  EXPECT_EQ((vector<ssize_t>{0, 1, 2, 3}),
+            MatchContentChunks(old_chunks,
+                               {AnchoredChunk(7), AnchoredChunk(2),
+                                AnchoredChunk(3), unanchored}));
+  // A removed chunk is skipped.
+  EXPECT_EQ((vector<ssize_t>{0, 2, 3}),
+            MatchContentChunks(old_chunks,
+                               {AnchoredChunk(1), AnchoredChunk(3),
+                                unanchored}));
+  // The new chunks past the old ones don't have a source.
+  EXPECT_EQ((vector<ssize_t>{2, 3, -1}),
+            MatchContentChunks(old_chunks,
+                               {AnchoredChunk(3), unanchored, unanchored}));
+  EXPECT_EQ((vector<ssize_t>{-1}),
+            MatchContentChunks({}, {AnchoredChunk(1)}));
+}
+
+}  // namespace chromeos_update_engine
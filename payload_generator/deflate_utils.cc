@@ -16,18 +16,28 @@
 
 #include "update_engine/payload_generator/deflate_utils.h"
 
+#include <endian.h>
+#include <string.h>
+
 #include <algorithm>
+#include <iterator>
 #include <string>
 #include <utility>
 
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
+#include <base/threading/simple_thread.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/partition_reader.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -51,7 +61,7 @@ bool CopyExtentsToFile(const string& in_path,
                        size_t block_size) {
   brillo::Blob data(utils::BlocksInExtents(extents) * block_size);
   TEST_AND_RETURN_FALSE(
-      utils::ReadExtents(in_path, extents, &data, data.size(), block_size));
+      ReadPartitionExtents(in_path, extents, &data, data.size(), block_size));
   TEST_AND_RETURN_FALSE(
       utils::WriteFile(out_path.c_str(), data.data(), data.size()));
   return true;
@@ -247,6 +257,161 @@ bool FindAndCompactDeflates(const vector<Extent>& extents,
   return true;
 }
 
+namespace {
+
+// The version of the deflate locations stored in the diff cache. Change it
+// when the way they are located changes.
+const char kDeflatesCacheKeyVersion[] = "deflates-1";
+
+// Locates in |deflates| the deflates of the zip archive |file| of the
+// partition |part_path|, relative to the start of the file. They are stored in
+// the diff cache, if enabled, keyed by the content of the file.
+bool LocateDeflatesInZipFile(const string& part_path,
+                             const FilesystemInterface::File& file,
+                             vector<BitExtent>* deflates) {
+  brillo::Blob data;
+  TEST_AND_RETURN_FALSE(
+      ReadPartitionExtents(part_path,
+                           file.extents,
+                           &data,
+                           kBlockSize * utils::BlocksInExtents(file.extents),
+                           kBlockSize));
+
+  const DiffCache* diff_cache = diff_utils::GetDiffCache();
+  string cache_key;
+  if (diff_cache) {
+    HashCalculator hasher;
+    TEST_AND_RETURN_FALSE(hasher.Update(kDeflatesCacheKeyVersion,
+                                        sizeof(kDeflatesCacheKeyVersion)));
+    TEST_AND_RETURN_FALSE(hasher.Update(data.data(), data.size()));
+    TEST_AND_RETURN_FALSE(hasher.Finalize());
+    cache_key =
+        base::HexEncode(hasher.raw_hash().data(), hasher.raw_hash().size());
+
+    // The entries store the offset and length of each deflate as big endian
+    // 64-bit numbers. Their type is not used.
+    InstallOperation_Type type;
+    brillo::Blob entry;
+    if (diff_cache->Lookup(cache_key, &type, &entry) &&
+        entry.size() % (2 * sizeof(uint64_t)) == 0) {
+      for (size_t i = 0; i < entry.size(); i += 2 * sizeof(uint64_t)) {
+        uint64_t offset, length;
+        memcpy(&offset, entry.data() + i, sizeof(offset));
+        memcpy(&length, entry.data() + i + sizeof(offset), sizeof(length));
+        deflates->emplace_back(be64toh(offset), be64toh(length));
+      }
+      return true;
+    }
+  }
+
+  TEST_AND_RETURN_FALSE(
+      puffin::LocateDeflateSubBlocksInZipArchive(data, deflates));
+
+  if (diff_cache) {
+    brillo::Blob entry;
+    for (const BitExtent& deflate : *deflates) {
+      uint64_t values[] = {htobe64(deflate.offset), htobe64(deflate.length)};
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values);
+      entry.insert(entry.end(), bytes, bytes + sizeof(values));
+    }
+    diff_cache->Store(cache_key, InstallOperation::REPLACE, entry);
+  }
+  return true;
+}
+
+// Preprocesses the file |file| of the partition |part| into |result_files|:
+// the files in it if it is a squashfs image, or the file itself with its
+// deflates otherwise.
+bool PreprocessFile(const PartitionConfig& part,
+                    FilesystemInterface::File file,
+                    bool extract_deflates,
+                    vector<FilesystemInterface::File>* result_files) {
+  if (IsSquashfsImage(part.path, file)) {
+    // Read the image into a file.
+    base::FilePath path;
+    TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
+    ScopedPathUnlinker old_unlinker(path.value());
+    TEST_AND_RETURN_FALSE(
+        CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
+    // Test if it is actually a Squashfs file.
+    auto sqfs =
+        SquashfsFilesystem::CreateFromFile(path.value(), extract_deflates);
+    if (sqfs) {
+      // It is an squashfs file. Get its files to replace with itself.
+      vector<FilesystemInterface::File> files;
+      sqfs->GetFiles(&files);
+
+      // Replace squashfs file with its files only if |files| has at least two
+      // files or if it has some deflates (since it is better to replace it to
+      // take advantage of the deflates.)
+      if (files.size() > 1 ||
+          (files.size() == 1 && !files[0].deflates.empty())) {
+        TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
+        *result_files = std::move(files);
+        return true;
+      }
+    } else {
+      LOG(WARNING) << "We thought file: " << file.name
+                   << " was a Squashfs file, but it was not.";
+    }
+  }
+
+  // Search for deflates if the file is in zip format.
+  bool is_zip =
+      base::EndsWith(file.name, ".apk", base::CompareCase::INSENSITIVE_ASCII) ||
+      base::EndsWith(file.name, ".zip", base::CompareCase::INSENSITIVE_ASCII) ||
+      base::EndsWith(file.name, ".jar", base::CompareCase::INSENSITIVE_ASCII);
+
+  if (is_zip && extract_deflates) {
+    std::vector<puffin::BitExtent> deflates_sub_blocks;
+    TEST_AND_RETURN_FALSE(
+        LocateDeflatesInZipFile(part.path, file, &deflates_sub_blocks));
+    // Shift the deflate's extent to the offset starting from the beginning
+    // of the current partition; and the delta processor will align the
+    // extents in a continuous buffer later.
+    TEST_AND_RETURN_FALSE(
+        ShiftBitExtentsOverExtents(file.extents, &deflates_sub_blocks));
+    file.deflates = std::move(deflates_sub_blocks);
+  }
+
+  result_files->push_back(std::move(file));
+  return true;
+}
+
+// Runs PreprocessFile() on one of the threads of a pool.
+class FilePreprocessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  FilePreprocessor(const PartitionConfig& part,
+                   const FilesystemInterface::File& file,
+                   bool extract_deflates)
+      : part_(part), file_(file), extract_deflates_(extract_deflates) {}
+
+  FilePreprocessor(FilePreprocessor&& processor) = default;
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    if (!PreprocessFile(part_, file_, extract_deflates_, &result_files_)) {
+      LOG(ERROR) << "Failed to preprocess the file " << file_.name;
+      failed_ = true;
+    }
+  }
+
+  bool failed() const { return failed_; }
+  vector<FilesystemInterface::File>* result_files() { return &result_files_; }
+
+ private:
+  const PartitionConfig& part_;
+  FilesystemInterface::File file_;
+  bool extract_deflates_;
+
+  vector<FilesystemInterface::File> result_files_;
+  bool failed_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(FilePreprocessor);
+};
+
+}  // namespace
+
 bool PreprocessParitionFiles(const PartitionConfig& part,
                              vector<FilesystemInterface::File>* result_files,
                              bool extract_deflates) {
@@ -255,65 +420,26 @@ bool PreprocessParitionFiles(const PartitionConfig& part,
   part.fs_interface->GetFiles(&tmp_files);
   result_files->reserve(tmp_files.size());
 
-  for (auto& file : tmp_files) {
-    if (IsSquashfsImage(part.path, file)) {
-      // Read the image into a file.
-      base::FilePath path;
-      TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
-      ScopedPathUnlinker old_unlinker(path.value());
-      TEST_AND_RETURN_FALSE(
-          CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
-      // Test if it is actually a Squashfs file.
-      auto sqfs =
-          SquashfsFilesystem::CreateFromFile(path.value(), extract_deflates);
-      if (sqfs) {
-        // It is an squashfs file. Get its files to replace with itself.
-        vector<FilesystemInterface::File> files;
-        sqfs->GetFiles(&files);
-
-        // Replace squashfs file with its files only if |files| has at least two
-        // files or if it has some deflates (since it is better to replace it to
-        // take advantage of the deflates.)
-        if (files.size() > 1 ||
-            (files.size() == 1 && !files[0].deflates.empty())) {
-          TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
-          result_files->insert(result_files->end(), files.begin(), files.end());
-          continue;
-        }
-      } else {
-        LOG(WARNING) << "We thought file: " << file.name
-                     << " was a Squashfs file, but it was not.";
-      }
-    }
+  // The files are processed in parallel, since reading the zip archives and
+  // squashfs images and locating their deflates takes long, but the results
+  // are kept in the order of the files.
+  vector<FilePreprocessor> processors;
+  processors.reserve(tmp_files.size());
+  for (const auto& file : tmp_files)
+    processors.emplace_back(part, file, extract_deflates);
 
-    // Search for deflates if the file is in zip format.
-    bool is_zip =
-        base::EndsWith(
-            file.name, ".apk", base::CompareCase::INSENSITIVE_ASCII) ||
-        base::EndsWith(
-            file.name, ".zip", base::CompareCase::INSENSITIVE_ASCII) ||
-        base::EndsWith(file.name, ".jar", base::CompareCase::INSENSITIVE_ASCII);
-
-    if (is_zip && extract_deflates) {
-      brillo::Blob data;
-      TEST_AND_RETURN_FALSE(
-          utils::ReadExtents(part.path,
-                             file.extents,
-                             &data,
-                             kBlockSize * utils::BlocksInExtents(file.extents),
-                             kBlockSize));
-      std::vector<puffin::BitExtent> deflates_sub_blocks;
-      TEST_AND_RETURN_FALSE(puffin::LocateDeflateSubBlocksInZipArchive(
-          data, &deflates_sub_blocks));
-      // Shift the deflate's extent to the offset starting from the beginning
-      // of the current partition; and the delta processor will align the
-      // extents in a continuous buffer later.
-      TEST_AND_RETURN_FALSE(
-          ShiftBitExtentsOverExtents(file.extents, &deflates_sub_blocks));
-      file.deflates = std::move(deflates_sub_blocks);
-    }
+  base::DelegateSimpleThreadPool thread_pool("deflate-locator",
+                                             diff_utils::GetMaxThreads());
+  thread_pool.Start();
+  for (auto& processor : processors)
+    thread_pool.AddWork(&processor);
+  thread_pool.JoinAll();
 
-    result_files->push_back(file);
+  for (auto& processor : processors) {
+    TEST_AND_RETURN_FALSE(!processor.failed());
+    std::move(processor.result_files()->begin(),
+              processor.result_files()->end(),
+              std::back_inserter(*result_files));
   }
   return true;
 }
@@ -19,6 +19,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -26,9 +28,12 @@
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/fake_filesystem.h"
 
+using std::string;
 using std::vector;
 using puffin::BitExtent;
 using puffin::ByteExtent;
@@ -186,5 +191,27 @@ TEST(DeflateUtilsTest, CompactBoundaryTest) {
   EXPECT_EQ(out_deflates, expected_out_deflates);
 }
 
+TEST(DeflateUtilsTest, PreprocessKeepsTheFilesOrderTest) {
+  // The files are preprocessed in parallel, but returned in their order.
+  std::unique_ptr<FakeFilesystem> fs(new FakeFilesystem(kBlockSize, 100));
+  vector<string> names;
+  for (uint64_t block = 0; block < 100; block++) {
+    names.push_back("file" + std::to_string(block));
+    fs->AddFile(names.back(), {ExtentForRange(99 - block, 1)});
+  }
+  PartitionConfig part("part");
+  part.path = "/dev/null";
+  part.fs_interface = std::move(fs);
+
+  vector<FilesystemInterface::File> files;
+  EXPECT_TRUE(PreprocessParitionFiles(part, &files, true));
+  vector<string> file_names;
+  for (const FilesystemInterface::File& file : files) {
+    file_names.push_back(file.name);
+    EXPECT_TRUE(file.deflates.empty());
+  }
+  EXPECT_EQ(names, file_names);
+}
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
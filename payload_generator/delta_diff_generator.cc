@@ -29,6 +29,7 @@
 #include <vector>
 
 #include <base/logging.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/delta_performer.h"
@@ -38,7 +39,10 @@
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/full_update_generator.h"
 #include "update_engine/payload_generator/inplace_generator.h"
+#include "update_engine/payload_generator/partition_reader.h"
 #include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/previous_payload.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using std::string;
 using std::unique_ptr;
@@ -50,20 +54,225 @@ namespace chromeos_update_engine {
 const size_t kRootFSPartitionSize = static_cast<size_t>(2) * 1024 * 1024 * 1024;
 const size_t kBlockSize = 4096;  // bytes
 
-bool GenerateUpdatePayloadFile(
-    const PayloadGenerationConfig& config,
-    const string& output_path,
-    const string& private_key_path,
-    uint64_t* metadata_size) {
-  if (!config.version.Validate()) {
-    LOG(ERROR) << "Unsupported major.minor version: " << config.version.major
-               << "." << config.version.minor;
-    return false;
+namespace {
+
+// The zstd dictionary is trained from this many times its size of samples,
+// as recommended by zstd.
+const size_t kZstdDictionarySamplesRatio = 100;
+
+// Trains in |dictionary| a zstd dictionary of up to
+// |config.zstd_dictionary_size| bytes from blocks sampled evenly from the
+// target partitions. The blocks of zeros are skipped, since they are encoded
+// as ZERO operations.
+bool TrainZstdDictionary(const PayloadGenerationConfig& config,
+                         brillo::Blob* dictionary) {
+  uint64_t total_blocks = 0;
+  for (const PartitionConfig& part : config.target.partitions)
+    total_blocks += part.size / config.block_size;
+  uint64_t sample_blocks = std::max<uint64_t>(
+      1,
+      config.zstd_dictionary_size * kZstdDictionarySamplesRatio /
+          config.block_size);
+  uint64_t step = std::max<uint64_t>(1, total_blocks / sample_blocks);
+
+  brillo::Blob samples;
+  vector<size_t> sample_sizes;
+  brillo::Blob block(config.block_size);
+  for (const PartitionConfig& part : config.target.partitions) {
+    int fd = open(part.path.c_str(), O_RDONLY, 0);
+    TEST_AND_RETURN_FALSE(fd >= 0);
+    ScopedFdCloser fd_closer(&fd);
+    for (uint64_t block_num = 0; block_num < part.size / config.block_size;
+         block_num += step) {
+      ssize_t bytes_read;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(fd,
+                                            block.data(),
+                                            block.size(),
+                                            block_num * config.block_size,
+                                            &bytes_read));
+      if (static_cast<size_t>(bytes_read) != block.size() ||
+          utils::IsZeroBuffer(block.data(), block.size()))
+        continue;
+      samples.insert(samples.end(), block.begin(), block.end());
+      sample_sizes.push_back(block.size());
+    }
   }
+  LOG(INFO) << "Training a zstd dictionary from " << sample_sizes.size()
+            << " blocks.";
+  return ZstdTrainDictionary(
+      samples, sample_sizes, config.zstd_dictionary_size, dictionary);
+}
 
+// Sets up the generation of the payloads described by |configs|, which share
+// the generation settings of the first one: the diff cache, the memory budget,
+// the suffix array cache, the apply memory budget, the brotli quality budget,
+// the chunking of the big files, the work shard, the NUMA scheduling and the
+// zstd dictionary, trained once from the target partitions if any payload can
+// use it. The dictionary is returned in |zstd_dictionary|, empty if not used.
+bool PrepareGeneration(const vector<const PayloadGenerationConfig*>& configs,
+                       brillo::Blob* zstd_dictionary) {
+  const PayloadGenerationConfig& config = *configs[0];
+  TEST_AND_RETURN_FALSE(diff_utils::SetDiffCacheDir(config.diff_cache_dir));
+  diff_utils::SetMemoryBudget(config.memory_budget);
+  diff_utils::SetSuffixArrayCacheSize(config.suffix_array_cache_size);
+  diff_utils::SetApplyMemoryBudget(config.apply_memory_budget);
+  diff_utils::SetBrotliQualityBudget(config.brotli_max_quality_size,
+                                     config.brotli_fast_quality);
+  diff_utils::SetContentDefinedChunking(config.content_defined_chunks);
+  diff_utils::SetWorkShard(config.work_shard_index, config.work_shard_count);
+  diff_utils::SetNumaAware(config.numa_aware);
+
+  // The zstd dictionary is used by the operations generated, so it is trained
+  // first. The payload can still be generated without it when the partitions
+  // don't have enough data to train one.
+  zstd_dictionary->clear();
+  diff_utils::SetZstdDictionary(nullptr);
+  bool zstd_allowed = false;
+  for (const PayloadGenerationConfig* payload_config : configs) {
+    zstd_allowed |= payload_config->version.OperationAllowed(
+        InstallOperation::REPLACE_ZSTD);
+  }
+  if (config.zstd_dictionary_size > 0 && zstd_allowed) {
+    if (TrainZstdDictionary(config, zstd_dictionary)) {
+      unique_ptr<ZstdDictionary> dictionary =
+          ZstdDictionary::Create(*zstd_dictionary);
+      TEST_AND_RETURN_FALSE(dictionary != nullptr);
+      LOG(INFO) << "Using the zstd dictionary " << dictionary->id() << " of "
+                << zstd_dictionary->size() << " bytes.";
+      diff_utils::SetZstdDictionary(std::move(dictionary));
+    } else {
+      LOG(WARNING) << "Generating the payload without a zstd dictionary.";
+      zstd_dictionary->clear();
+    }
+  }
+  return true;
+}
+
+// Returns the paths of the source and target partitions of the |configs|,
+// which are mapped once for all the phases of the generation.
+vector<string> PartitionPaths(
+    const vector<const PayloadGenerationConfig*>& configs) {
+  vector<string> paths;
+  for (const PayloadGenerationConfig* config : configs) {
+    for (const PartitionConfig& part : config->source.partitions)
+      paths.push_back(part.path);
+    for (const PartitionConfig& part : config->target.partitions)
+      paths.push_back(part.path);
+  }
+  return paths;
+}
+
+// Generates the operations of one partition of a payload on its own thread.
+class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  PartitionProcessor(const PayloadGenerationConfig& config,
+                     const PartitionConfig& old_part,
+                     const PartitionConfig& new_part,
+                     const PreviousPayload* previous_payload,
+                     const brillo::Blob& zstd_dictionary,
+                     BlobFileWriter* blob_file)
+      : config_(config),
+        old_part_(old_part),
+        new_part_(new_part),
+        previous_payload_(previous_payload),
+        zstd_dictionary_(zstd_dictionary),
+        blob_file_(blob_file) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    LOG(INFO) << "Partition name: " << new_part_.name;
+    LOG(INFO) << "Partition size: " << new_part_.size;
+    LOG(INFO) << "Block count: " << new_part_.size / config_.block_size;
+
+    // The operations of a partition that didn't change since the previous
+    // payload are copied from it.
+    if (previous_payload_) {
+      bool reused;
+      result_ = previous_payload_->ReusePartition(config_.version,
+                                                  config_.block_size,
+                                                  zstd_dictionary_,
+                                                  old_part_,
+                                                  new_part_,
+                                                  blob_file_,
+                                                  &aops_,
+                                                  &reused);
+      if (!result_ || reused)
+        return;
+    }
+
+    // Select payload generation strategy based on the config.
+    unique_ptr<OperationsGenerator> strategy;
+    if (!old_part_.path.empty()) {
+      // Delta update.
+      if (config_.version.minor == kInPlaceMinorPayloadVersion) {
+        LOG(INFO) << "Using generator InplaceGenerator().";
+        strategy.reset(new InplaceGenerator());
+      } else {
+        LOG(INFO) << "Using generator ABGenerator().";
+        strategy.reset(new ABGenerator());
+      }
+    } else {
+      LOG(INFO) << "Using generator FullUpdateGenerator().";
+      strategy.reset(new FullUpdateGenerator());
+    }
+
+    // Generate the operations using the strategy we selected above.
+    result_ = strategy->GenerateOperations(
+        config_, old_part_, new_part_, blob_file_, &aops_);
+    if (!result_) {
+      LOG(ERROR) << "Failed to generate the operations of the partition "
+                 << new_part_.name;
+      return;
+    }
+
+    // Filter the no-operations. OperationsGenerators should not output this
+    // kind of operations normally, but this is an extra step to fix that if
+    // happened.
+    diff_utils::FilterNoopOperations(&aops_);
+  }
+
+  bool result() const { return result_; }
+  const PartitionConfig& old_part() const { return old_part_; }
+  const PartitionConfig& new_part() const { return new_part_; }
+  const vector<AnnotatedOperation>& aops() const { return aops_; }
+
+ private:
+  const PayloadGenerationConfig& config_;
+  const PartitionConfig& old_part_;
+  const PartitionConfig& new_part_;
+  const PreviousPayload* previous_payload_;
+  const brillo::Blob& zstd_dictionary_;
+  BlobFileWriter* blob_file_;
+
+  bool result_{false};
+  vector<AnnotatedOperation> aops_;
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionProcessor);
+};
+
+// Generates the payload described by |config| once the generation is
+// prepared, shipping the |zstd_dictionary| if not empty and the payload can
+// use it.
+bool GeneratePayload(const PayloadGenerationConfig& config,
+                     const brillo::Blob& zstd_dictionary,
+                     const string& output_path,
+                     const string& private_key_path,
+                     uint64_t* metadata_size) {
   // Create empty payload file object.
   PayloadFile payload;
   TEST_AND_RETURN_FALSE(payload.Init(config));
+  brillo::Blob payload_zstd_dictionary;
+  if (!zstd_dictionary.empty() &&
+      config.version.OperationAllowed(InstallOperation::REPLACE_ZSTD)) {
+    payload.SetZstdDictionary(zstd_dictionary);
+    payload_zstd_dictionary = zstd_dictionary;
+  }
+
+  std::unique_ptr<PreviousPayload> previous_payload;
+  if (!config.previous_payload.empty()) {
+    previous_payload.reset(new PreviousPayload());
+    TEST_AND_RETURN_FALSE(previous_payload->Load(config.previous_payload));
+  }
 
   const string kTempFileTemplate("CrAU_temp_data.XXXXXX");
   string temp_file_path;
@@ -81,45 +290,42 @@ bool GenerateUpdatePayloadFile(
       TEST_AND_RETURN_FALSE(config.source.partitions.size() ==
                             config.target.partitions.size());
     }
+    // The operations of the partitions are generated in parallel, since they
+    // are independent until they are added to the payload, in the partitions
+    // order. The partitions share the threads processing their files.
     PartitionConfig empty_part("");
+    vector<unique_ptr<PartitionProcessor>> processors;
+    vector<unique_ptr<base::DelegateSimpleThread>> threads;
     for (size_t i = 0; i < config.target.partitions.size(); i++) {
       const PartitionConfig& old_part =
           config.is_delta ? config.source.partitions[i] : empty_part;
       const PartitionConfig& new_part = config.target.partitions[i];
-      LOG(INFO) << "Partition name: " << new_part.name;
-      LOG(INFO) << "Partition size: " << new_part.size;
-      LOG(INFO) << "Block count: " << new_part.size / config.block_size;
-
-      // Select payload generation strategy based on the config.
-      unique_ptr<OperationsGenerator> strategy;
-      if (!old_part.path.empty()) {
-        // Delta update.
-        if (config.version.minor == kInPlaceMinorPayloadVersion) {
-          LOG(INFO) << "Using generator InplaceGenerator().";
-          strategy.reset(new InplaceGenerator());
-        } else {
-          LOG(INFO) << "Using generator ABGenerator().";
-          strategy.reset(new ABGenerator());
-        }
-      } else {
-        LOG(INFO) << "Using generator FullUpdateGenerator().";
-        strategy.reset(new FullUpdateGenerator());
-      }
-
-      vector<AnnotatedOperation> aops;
-      // Generate the operations using the strategy we selected above.
-      TEST_AND_RETURN_FALSE(strategy->GenerateOperations(config,
-                                                         old_part,
-                                                         new_part,
-                                                         &blob_file,
-                                                         &aops));
-
-      // Filter the no-operations. OperationsGenerators should not output this
-      // kind of operations normally, but this is an extra step to fix that if
-      // happened.
-      diff_utils::FilterNoopOperations(&aops);
-
-      TEST_AND_RETURN_FALSE(payload.AddPartition(old_part, new_part, aops));
+      processors.emplace_back(new PartitionProcessor(config,
+                                                     old_part,
+                                                     new_part,
+                                                     previous_payload.get(),
+                                                     payload_zstd_dictionary,
+                                                     &blob_file));
+      threads.emplace_back(new base::DelegateSimpleThread(
+          processors.back().get(), "partition-" + new_part.name));
+      threads.back()->Start();
+    }
+    for (auto& thread : threads)
+      thread->Join();
+    for (size_t i = 0; i < processors.size(); i++)
+      TEST_AND_RETURN_FALSE(processors[i]->result());
+    // The operations of a work shard are incomplete, only generated to store
+    // them in the diff cache for the process writing the payload.
+    if (diff_utils::IsWorkSharded()) {
+      LOG(INFO) << "Generated the work shard of " << output_path
+                << " in the diff cache.";
+      *metadata_size = 0;
+      return true;
+    }
+    for (size_t i = 0; i < processors.size(); i++) {
+      TEST_AND_RETURN_FALSE(payload.AddPartition(
+          processors[i]->old_part(), processors[i]->new_part(),
+          processors[i]->aops()));
     }
   }
 
@@ -133,4 +339,130 @@ bool GenerateUpdatePayloadFile(
   return true;
 }
 
+// Generates one of the payloads of GenerateUpdatePayloadFiles() on its own
+// thread.
+class PayloadTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  PayloadTask(const PayloadGenerationConfig* config,
+              const brillo::Blob* zstd_dictionary,
+              const string& output_path,
+              const string& private_key_path)
+      : config_(config),
+        zstd_dictionary_(zstd_dictionary),
+        output_path_(output_path),
+        private_key_path_(private_key_path) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    result_ = GeneratePayload(*config_,
+                              *zstd_dictionary_,
+                              output_path_,
+                              private_key_path_,
+                              &metadata_size_);
+    if (!result_)
+      LOG(ERROR) << "Failed to generate the payload " << output_path_;
+  }
+
+  bool result() const { return result_; }
+  uint64_t metadata_size() const { return metadata_size_; }
+
+ private:
+  const PayloadGenerationConfig* config_;
+  const brillo::Blob* zstd_dictionary_;
+  string output_path_;
+  string private_key_path_;
+
+  bool result_{false};
+  uint64_t metadata_size_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadTask);
+};
+
+}  // namespace
+
+bool GenerateUpdatePayloadFile(
+    const PayloadGenerationConfig& config,
+    const string& output_path,
+    const string& private_key_path,
+    uint64_t* metadata_size) {
+  if (!config.version.Validate()) {
+    LOG(ERROR) << "Unsupported major.minor version: " << config.version.major
+               << "." << config.version.minor;
+    return false;
+  }
+
+  ScopedMappedPartitions mapped_partitions(PartitionPaths({&config}));
+  brillo::Blob zstd_dictionary;
+  TEST_AND_RETURN_FALSE(PrepareGeneration({&config}, &zstd_dictionary));
+  return GeneratePayload(
+      config, zstd_dictionary, output_path, private_key_path, metadata_size);
+}
+
+bool GenerateUpdatePayloadFiles(
+    const vector<PayloadGenerationConfig>& configs,
+    const vector<string>& output_paths,
+    const string& private_key_path,
+    vector<uint64_t>* metadata_sizes) {
+  TEST_AND_RETURN_FALSE(!configs.empty());
+  TEST_AND_RETURN_FALSE(configs.size() == output_paths.size());
+  vector<const PayloadGenerationConfig*> config_ptrs;
+  for (const PayloadGenerationConfig& config : configs) {
+    if (!config.version.Validate()) {
+      LOG(ERROR) << "Unsupported major.minor version: " << config.version.major
+                 << "." << config.version.minor;
+      return false;
+    }
+    config_ptrs.push_back(&config);
+  }
+
+  ScopedMappedPartitions mapped_partitions(PartitionPaths(config_ptrs));
+  brillo::Blob zstd_dictionary;
+  TEST_AND_RETURN_FALSE(PrepareGeneration(config_ptrs, &zstd_dictionary));
+
+  // The target partitions are analyzed once for all the payloads, which are
+  // generated in parallel. The payloads share the memory budget and the
+  // threads of the candidate operations, bounded by the number of cores.
+  diff_utils::SetSharedTargetPartitions(configs[0].target.partitions);
+
+  // The blocks can only be copied from the old partitions also updated by the
+  // payload, since the device only knows their location.
+  for (const PayloadGenerationConfig& config : configs) {
+    if (!config.is_delta ||
+        !config.version.OperationAllowed(InstallOperation::PARTITION_COPY)) {
+      continue;
+    }
+    vector<PartitionConfig> copy_sources;
+    for (const PartitionConfig& old_part : config.source.partitions) {
+      for (const PartitionConfig& new_part : config.target.partitions) {
+        if (old_part.name == new_part.name)
+          copy_sources.push_back(old_part);
+      }
+    }
+    if (!diff_utils::AddPartitionCopySources(copy_sources)) {
+      diff_utils::ClearPartitionCopySources();
+      diff_utils::SetSharedTargetPartitions({});
+      return false;
+    }
+  }
+  vector<unique_ptr<PayloadTask>> tasks;
+  vector<unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < configs.size(); i++) {
+    tasks.emplace_back(new PayloadTask(
+        &configs[i], &zstd_dictionary, output_paths[i], private_key_path));
+    threads.emplace_back(
+        new base::DelegateSimpleThread(tasks.back().get(), "payload"));
+    threads.back()->Start();
+  }
+  bool result = true;
+  metadata_sizes->clear();
+  for (size_t i = 0; i < configs.size(); i++) {
+    threads[i]->Join();
+    result &= tasks[i]->result();
+    metadata_sizes->push_back(tasks[i]->metadata_size());
+  }
+  diff_utils::ClearPartitionCopySources();
+  diff_utils::SetSharedTargetPartitions({});
+  return result;
+}
+
 };  // namespace chromeos_update_engine
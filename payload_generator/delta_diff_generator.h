@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_DELTA_DIFF_GENERATOR_H_
 
 #include <string>
+#include <vector>
 
 #include "update_engine/payload_generator/payload_generation_config.h"
 
@@ -41,6 +42,20 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                const std::string& private_key_path,
                                uint64_t* metadata_size);
 
+// Generates in parallel the payloads described by |configs|, such as the
+// delta payloads from several source images to the same target image,
+// writing each one to the path at the same index in |output_paths| and its
+// metadata size to |metadata_sizes|. The configs must share the target
+// partitions, copied from the same PartitionConfigs, which are analyzed once
+// for all the payloads, and the generation settings of the first config, such
+// as the diff cache and the memory budget, are used for all of them. Returns
+// whether all the payloads were generated.
+bool GenerateUpdatePayloadFiles(
+    const std::vector<PayloadGenerationConfig>& configs,
+    const std::vector<std::string>& output_paths,
+    const std::string& private_key_path,
+    std::vector<uint64_t>* metadata_sizes);
+
 
 };  // namespace chromeos_update_engine
 
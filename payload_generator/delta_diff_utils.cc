@@ -29,31 +29,48 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
 #include <map>
 #include <memory>
 #include <utility>
 
+#include <base/bind.h>
+#include <base/callback.h>
 #include <base/files/file_util.h>
 #include <base/format_macros.h>
+#include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/synchronization/lock.h>
 #include <base/threading/simple_thread.h>
+#include <base/time/time.h>
 #include <brillo/data_encoding.h>
 #include <bsdiff/bsdiff.h>
+#include <bsdiff/control_entry.h>
 #include <bsdiff/patch_writer_factory.h>
+#include <bsdiff/patch_writer_interface.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/subprocess.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/block_bitmap.h"
 #include "update_engine/payload_generator/block_mapping.h"
 #include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/content_chunker.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/memory_budget.h"
+#include "update_engine/payload_generator/numa_topology.h"
+#include "update_engine/payload_generator/partition_reader.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 #include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using std::map;
 using std::string;
@@ -74,7 +91,213 @@ const uint64_t kMaxBsdiffDestinationSize = 200 * 1024 * 1024;  // bytes
 // memory intensive, so we limit these operations to 150 MiB.
 const uint64_t kMaxPuffdiffDestinationSize = 150 * 1024 * 1024;  // bytes
 
+// The brotli quality of the BROTLI_BSDIFF patches within the budget set by
+// SetBrotliQualityBudget(), the best one, and of the bigger patches.
 const int kBrotliCompressionQuality = 11;
+uint64_t brotli_max_quality_size = 0;
+int brotli_fast_quality = kBrotliCompressionQuality;
+
+// The number of blocks sampled by IsLikelyIncompressible(), evenly spread over
+// the data.
+const size_t kEntropySampleBlocks = 16;
+
+// The entropy of the sampled bytes, in bits per byte, above which the data is
+// considered incompressible. Already compressed data such as images or zip
+// files is usually above it.
+const double kIncompressibleBitsPerByte = 7.9;
+
+// A REPLACE_ZSTD is preferred over a smaller REPLACE_XZ or REPLACE_BZ unless
+// they save more than 1/kZstdSizeTolerance of its size, since it decompresses
+// several times faster.
+const size_t kZstdSizeTolerance = 16;
+
+// The largest data also compressed with the zstd dictionary, if any. The
+// bigger data has enough matches of its own for the dictionary to not help.
+const size_t kMaxZstdDictionaryDataSize = 256 * 1024;
+
+// The memory used by bzip2 to decode the data compressed with 900 kB blocks,
+// like the generator does.
+const uint64_t kBzip2DecoderMemory = 3700 * 1000;
+
+// The largest dictionary of the xz data, compressed at level 6, and window of
+// the zstd data, compressed at level 19. Both are reduced to the size of the
+// data when smaller.
+const uint64_t kMaxDictionarySize = 8 * 1024 * 1024;  // 8 MiB
+
+// The default window of brotli, used by the bsdiff patches.
+const uint64_t kBrotliWindowSize = 4 * 1024 * 1024;  // 4 MiB
+
+// The number of streams of a bsdiff patch decoded at the same time: the
+// control, diff and extra streams.
+const uint64_t kBsdiffStreams = 3;
+
+// The memory available to apply an operation set by SetApplyMemoryBudget(),
+// or zero if not bounded.
+uint64_t apply_memory_budget = 0;
+
+// The number of times GenerateBestFullOperation() skipped REPLACE_BZ.
+std::atomic<uint64_t> skipped_bzip_count{0};
+
+// The version of the operations generated for the diff cache keys. It must be
+// increased whenever the operations generated for the same data change, such
+// as when an encoder or its settings are updated.
+const char kDiffCacheKeyVersion[] = "1";
+
+// The cache of the operations generated, if enabled by SetDiffCacheDir().
+std::unique_ptr<DiffCache> diff_cache;
+
+// The shard of the work units generated, set by SetWorkShard().
+size_t work_shard_index = 0;
+size_t work_shard_count = 1;
+
+// The memory budget of the bsdiff and puffdiff candidates running at the same
+// time, set by SetMemoryBudget().
+MemoryBudget memory_budget(0);
+
+// The number of threads set by SetMaxThreads(), or zero to use the default.
+size_t max_threads_override = 0;
+
+// The directory listing the NUMA nodes of the machine.
+const char kNumaNodeDir[] = "/sys/devices/system/node";
+
+// The NUMA topology of the machine, loaded by SetNumaAware().
+std::unique_ptr<NumaTopology> numa_topology;
+
+// The dictionary of the REPLACE_ZSTD operations, set by SetZstdDictionary().
+std::unique_ptr<ZstdDictionary> zstd_dictionary;
+
+// The profile of the operations generated, set by SetGenerationProfile().
+GenerationProfile* generation_profile = nullptr;
+
+// Whether the big files are split in content defined chunks, set by
+// SetContentDefinedChunking().
+bool content_defined_chunking = false;
+
+// The files of a target partition shared by several payloads, preprocessed
+// by the first payload needing them, with or without extracting the deflates.
+struct SharedPartitionFiles {
+  base::Lock lock;
+  bool preprocessed[2] = {false, false};
+  vector<FilesystemInterface::File> files[2];
+};
+
+// The target partitions shared by the payloads generated, by filesystem, set
+// by SetSharedTargetPartitions().
+map<const FilesystemInterface*, std::unique_ptr<SharedPartitionFiles>>
+    shared_target_files;
+
+// The indexes of the old partitions whose blocks the other partitions of their
+// payload copy with PARTITION_COPY operations, by the path of each old
+// partition, set by AddPartitionCopySources().
+map<string, std::shared_ptr<const SourceBlockIndex>> partition_copy_indexes;
+
+// Compresses |in| into |out| with zstd, with the zstd dictionary too if |in|
+// is small enough, keeping the smaller frame.
+bool ZstdCompressBest(const brillo::Blob& in, brillo::Blob* out) {
+  TEST_AND_RETURN_FALSE(ZstdCompress(in, out));
+  if (!zstd_dictionary || in.size() > kMaxZstdDictionaryDataSize)
+    return true;
+  brillo::Blob out_dictionary;
+  TEST_AND_RETURN_FALSE(
+      ZstdCompressWithDictionary(in, *zstd_dictionary, &out_dictionary));
+  if (out_dictionary.size() < out->size())
+    *out = std::move(out_dictionary);
+  return true;
+}
+
+// The puffed streams are assumed to be this many times the size of the data
+// puffed, to estimate the memory used by puffdiff.
+const uint64_t kPuffExpansion = 3;
+
+// Returns an estimate of the memory used by bsdiff to diff |new_size| bytes
+// from |old_size| bytes, on top of the data itself: the suffix array of the
+// old data, of 8 bytes per byte, and buffers about as big as the new data.
+uint64_t EstimateBsdiffMemory(uint64_t old_size, uint64_t new_size) {
+  return 8 * old_size + new_size;
+}
+
+// Returns an estimate of the memory used by puffdiff, which holds the puffed
+// old and new data and runs bsdiff on them.
+uint64_t EstimatePuffdiffMemory(uint64_t old_size, uint64_t new_size) {
+  uint64_t puffed_old_size = kPuffExpansion * old_size;
+  uint64_t puffed_new_size = kPuffExpansion * new_size;
+  return puffed_old_size + puffed_new_size +
+         EstimateBsdiffMemory(puffed_old_size, puffed_new_size);
+}
+
+// The smallest old data whose suffix array is cached. The smaller ones are
+// sorted again faster than they are looked up and kept.
+const size_t kMinSuffixArrayCacheDataSize = 256 * 1024;
+
+// The suffix array indexes built by bsdiff for the old data, by hash of the
+// data, so the same old data diffed again against other new data isn't
+// sorted again. That is the case of an old chunk matched by several new
+// chunks, or of a file unchanged between the sources of the payloads
+// generated together. The least recently used ones are dropped to keep the
+// estimated size of the cache under |limit|, set by SetSuffixArrayCacheSize().
+struct SuffixArrayCache {
+  struct Entry {
+    std::shared_ptr<bsdiff::SuffixArrayIndexInterface> index;
+    uint64_t size;
+    uint64_t last_use;
+  };
+
+  base::Lock lock;
+  uint64_t limit = 0;
+  uint64_t size = 0;
+  uint64_t uses = 0;
+  uint64_t hits = 0;
+  map<brillo::Blob, Entry> entries;
+};
+SuffixArrayCache suffix_array_cache;
+
+// Returns the cached suffix array index of |old_data|, or nullptr if there is
+// none, storing in |key| the key to cache it with, empty if it can't be.
+std::shared_ptr<bsdiff::SuffixArrayIndexInterface> FindSuffixArray(
+    const brillo::Blob& old_data, brillo::Blob* key) {
+  key->clear();
+  if (suffix_array_cache.limit == 0 ||
+      old_data.size() < kMinSuffixArrayCacheDataSize ||
+      !HashCalculator::RawHashOfData(old_data, key)) {
+    return nullptr;
+  }
+  base::AutoLock auto_lock(suffix_array_cache.lock);
+  auto it = suffix_array_cache.entries.find(*key);
+  if (it == suffix_array_cache.entries.end())
+    return nullptr;
+  it->second.last_use = ++suffix_array_cache.uses;
+  suffix_array_cache.hits++;
+  return it->second.index;
+}
+
+// Caches the suffix array |index| of |old_size| bytes of old data under |key|,
+// if it fits, dropping the least recently used indexes to make room.
+void CacheSuffixArray(
+    const brillo::Blob& key,
+    uint64_t old_size,
+    std::unique_ptr<bsdiff::SuffixArrayIndexInterface> index) {
+  // The suffix array has 8 bytes per byte of data, as estimated for bsdiff.
+  const uint64_t size = EstimateBsdiffMemory(old_size, 0);
+  base::AutoLock auto_lock(suffix_array_cache.lock);
+  if (size > suffix_array_cache.limit ||
+      suffix_array_cache.entries.count(key) > 0) {
+    return;
+  }
+  auto& entries = suffix_array_cache.entries;
+  while (suffix_array_cache.size + size > suffix_array_cache.limit) {
+    using EntryPair = std::pair<const brillo::Blob, SuffixArrayCache::Entry>;
+    auto oldest = std::min_element(
+        entries.begin(),
+        entries.end(),
+        [](const EntryPair& a, const EntryPair& b) {
+          return a.second.last_use < b.second.last_use;
+        });
+    suffix_array_cache.size -= oldest->second.size;
+    entries.erase(oldest);
+  }
+  suffix_array_cache.size += size;
+  entries[key] = {std::move(index), size, ++suffix_array_cache.uses};
+}
 
 // Process a range of blocks from |range_start| to |range_end| in the extent at
 // position |*idx_p| of |extents|. If |do_remove| is true, this range will be
@@ -171,6 +394,451 @@ size_t RemoveIdenticalBlockRanges(vector<Extent>* src_extents,
   return removed_bytes;
 }
 
+// The number of threads generating operations, either for a file or for one
+// of the candidate operations of a chunk. It is used to only generate the
+// candidates in parallel when some cores would be idle otherwise.
+std::atomic<size_t> busy_threads{0};
+
+// The threads shared by the partitions generated at the same time, reserved
+// by ScopedThreadReservation. The budget counts threads instead of bytes.
+MemoryBudget thread_budget(diff_utils::GetMaxThreads());
+
+// Counts one more busy thread if there are less than GetMaxThreads(). Returns
+// whether it did.
+bool TryAddBusyThread() {
+  size_t busy = busy_threads.load();
+  do {
+    if (busy >= diff_utils::GetMaxThreads())
+      return false;
+  } while (!busy_threads.compare_exchange_weak(busy, busy + 1));
+  return true;
+}
+
+// Generates one of the candidate operations of a chunk, or does other work
+// overlapping with the calling thread, by running |callback| on its own thread
+// if there is an idle core when Start() is called or in Wait() otherwise. The
+// result is the same either way.
+class CandidateTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit CandidateTask(const base::Callback<bool()>& callback)
+      : callback_(callback) {}
+
+  ~CandidateTask() override { Join(); }
+
+  void Start() {
+    if (!TryAddBusyThread())
+      return;
+    thread_.reset(new base::DelegateSimpleThread(this, "candidate-operation"));
+    thread_->Start();
+  }
+
+  // Waits for the candidate to be generated and returns whether it succeeded.
+  bool Wait() {
+    if (thread_)
+      Join();
+    else if (!done_)
+      Run();
+    return result_;
+  }
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    base::TimeTicks start = base::TimeTicks::Now();
+    result_ = callback_.Run();
+    duration_ = base::TimeTicks::Now() - start;
+    done_ = true;
+  }
+
+  // The time spent running the callback, once done.
+  base::TimeDelta duration() const { return duration_; }
+
+ private:
+  void Join() {
+    if (!thread_ || done_joining_)
+      return;
+    thread_->Join();
+    done_joining_ = true;
+    busy_threads--;
+  }
+
+  base::Callback<bool()> callback_;
+  std::unique_ptr<base::DelegateSimpleThread> thread_;
+  bool done_joining_{false};
+  bool done_{false};
+  bool result_{false};
+  base::TimeDelta duration_;
+
+  DISALLOW_COPY_AND_ASSIGN(CandidateTask);
+};
+
+// Preprocesses the files of |old_part|, if it has a filesystem, into
+// |old_files| and the files of |new_part| into |new_files|.
+bool PreprocessPartitionsFiles(const PartitionConfig& old_part,
+                               const PartitionConfig& new_part,
+                               bool extract_deflates,
+                               vector<FilesystemInterface::File>* old_files,
+                               vector<FilesystemInterface::File>* new_files) {
+  if (old_part.fs_interface) {
+    TEST_AND_RETURN_FALSE(deflate_utils::PreprocessParitionFiles(
+        old_part, old_files, extract_deflates));
+  }
+  auto shared_files = shared_target_files.find(new_part.fs_interface.get());
+  if (shared_files == shared_target_files.end()) {
+    return deflate_utils::PreprocessParitionFiles(
+        new_part, new_files, extract_deflates);
+  }
+  // The lock also keeps the payloads from reading the shared filesystem at
+  // the same time.
+  SharedPartitionFiles* shared = shared_files->second.get();
+  base::AutoLock auto_lock(shared->lock);
+  if (!shared->preprocessed[extract_deflates]) {
+    TEST_AND_RETURN_FALSE(deflate_utils::PreprocessParitionFiles(
+        new_part, &shared->files[extract_deflates], extract_deflates));
+    shared->preprocessed[extract_deflates] = true;
+  }
+  *new_files = shared->files[extract_deflates];
+  return true;
+}
+
+// A bsdiff patch writer keeping the patch in memory, uncompressed, to write
+// it again with another patch writer once its size is known.
+class RecordingPatchWriter : public bsdiff::PatchWriterInterface {
+ public:
+  RecordingPatchWriter() = default;
+
+  // bsdiff::PatchWriterInterface overrides.
+  bool Init(size_t new_size) override {
+    new_size_ = new_size;
+    return true;
+  }
+  bool WriteDiffStream(const uint8_t* data, size_t size) override {
+    diff_.insert(diff_.end(), data, data + size);
+    Record(Event::kDiff, size);
+    return true;
+  }
+  bool WriteExtraStream(const uint8_t* data, size_t size) override {
+    extra_.insert(extra_.end(), data, data + size);
+    Record(Event::kExtra, size);
+    return true;
+  }
+  bool AddControlEntry(const bsdiff::ControlEntry& entry) override {
+    control_entries_.push_back(entry);
+    Record(Event::kControl, 1);
+    return true;
+  }
+  bool Close() override { return true; }
+
+  // The size of the streams of the patch, before compression. Each control
+  // entry has three 8 byte fields.
+  uint64_t size() const {
+    return diff_.size() + extra_.size() + 24 * control_entries_.size();
+  }
+
+  // Writes the recorded patch to |writer|, in the same order.
+  bool Replay(bsdiff::PatchWriterInterface* writer) const {
+    TEST_AND_RETURN_FALSE(writer->Init(new_size_));
+    size_t diff_pos = 0, extra_pos = 0, control_pos = 0;
+    for (const auto& event : events_) {
+      switch (event.first) {
+        case Event::kDiff:
+          TEST_AND_RETURN_FALSE(
+              writer->WriteDiffStream(diff_.data() + diff_pos, event.second));
+          diff_pos += event.second;
+          break;
+        case Event::kExtra:
+          TEST_AND_RETURN_FALSE(writer->WriteExtraStream(
+              extra_.data() + extra_pos, event.second));
+          extra_pos += event.second;
+          break;
+        case Event::kControl:
+          for (size_t i = 0; i < event.second; i++) {
+            TEST_AND_RETURN_FALSE(
+                writer->AddControlEntry(control_entries_[control_pos++]));
+          }
+          break;
+      }
+    }
+    return writer->Close();
+  }
+
+ private:
+  enum class Event { kDiff, kExtra, kControl };
+
+  // Appends |count| of |event| to |events_|, merged with the last ones if
+  // they are the same.
+  void Record(Event event, size_t count) {
+    if (!events_.empty() && events_.back().first == event)
+      events_.back().second += count;
+    else
+      events_.emplace_back(event, count);
+  }
+
+  size_t new_size_{0};
+  brillo::Blob diff_;
+  brillo::Blob extra_;
+  vector<bsdiff::ControlEntry> control_entries_;
+  // The sequence of calls, as the bytes or entries added by each.
+  vector<std::pair<Event, size_t>> events_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordingPatchWriter);
+};
+
+// Computes in |key| the key used in the diff cache for the operation
+// generated to encode |new_data| from |old_data|, with the rest of the
+// arguments passed to GenerateBestOperation().
+bool GetDiffCacheKey(const brillo::Blob& old_data,
+                     const brillo::Blob& new_data,
+                     const vector<puffin::BitExtent>& src_deflates,
+                     const vector<puffin::BitExtent>& dst_deflates,
+                     bool bsdiff_allowed,
+                     bool puffdiff_allowed,
+                     const PayloadVersion& version,
+                     string* key) {
+  string settings = base::StringPrintf("%s:%" PRIu64 ":%" PRIu32 ":%d:%d:%d:",
+                                       kDiffCacheKeyVersion,
+                                       version.major,
+                                       version.minor,
+                                       bsdiff_allowed,
+                                       puffdiff_allowed,
+                                       kBrotliCompressionQuality);
+  if (brotli_max_quality_size > 0) {
+    settings += base::StringPrintf(
+        "b%" PRIu64 "+%d:", brotli_max_quality_size, brotli_fast_quality);
+  }
+  if (zstd_dictionary)
+    settings += base::StringPrintf("z%" PRIu32 ":", zstd_dictionary->id());
+  for (const puffin::BitExtent& deflate : src_deflates)
+    settings += base::StringPrintf("s%" PRIu64 "+%" PRIu64,
+                                   deflate.offset, deflate.length);
+  for (const puffin::BitExtent& deflate : dst_deflates)
+    settings += base::StringPrintf("d%" PRIu64 "+%" PRIu64,
+                                   deflate.offset, deflate.length);
+  uint64_t old_size = old_data.size();
+
+  HashCalculator hasher;
+  TEST_AND_RETURN_FALSE(hasher.Update(settings.data(), settings.size()));
+  TEST_AND_RETURN_FALSE(hasher.Update(&old_size, sizeof(old_size)));
+  TEST_AND_RETURN_FALSE(hasher.Update(old_data.data(), old_data.size()));
+  TEST_AND_RETURN_FALSE(hasher.Update(new_data.data(), new_data.size()));
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+  *key = base::HexEncode(hasher.raw_hash().data(), hasher.raw_hash().size());
+  return true;
+}
+
+// Generates in |delta| a bsdiff patch from |old_data| to |new_data| with the
+// best bsdiff operation allowed by |version|, stored in |type|.
+bool GenerateBsdiff(const brillo::Blob& old_data,
+                    const brillo::Blob& new_data,
+                    const PayloadVersion& version,
+                    brillo::Blob* delta,
+                    InstallOperation_Type* type) {
+  base::FilePath patch;
+  TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&patch));
+  ScopedPathUnlinker unlinker(patch.value());
+
+  // The brotli patches are recorded first, to pick their quality from their
+  // size.
+  std::unique_ptr<bsdiff::PatchWriterInterface> bsdiff_patch_writer;
+  *type = InstallOperation::BSDIFF;
+  if (version.OperationAllowed(InstallOperation::BROTLI_BSDIFF)) {
+    bsdiff_patch_writer.reset(new RecordingPatchWriter());
+    *type = InstallOperation::BROTLI_BSDIFF;
+  } else {
+    bsdiff_patch_writer = bsdiff::CreateBsdiffPatchWriter(patch.value());
+    if (version.OperationAllowed(InstallOperation::SOURCE_BSDIFF)) {
+      *type = InstallOperation::SOURCE_BSDIFF;
+    }
+  }
+
+  // The suffix array of the old data is only built when it isn't cached, and
+  // then its memory isn't needed.
+  brillo::Blob cache_key;
+  std::shared_ptr<bsdiff::SuffixArrayIndexInterface> cached_index =
+      FindSuffixArray(old_data, &cache_key);
+  bsdiff::SuffixArrayIndexInterface* index = cached_index.get();
+  std::unique_ptr<bsdiff::SuffixArrayIndexInterface> new_index;
+  {
+    ScopedMemoryReservation reservation(
+        &memory_budget,
+        cached_index ? new_data.size()
+                     : EstimateBsdiffMemory(old_data.size(), new_data.size()));
+    int result = bsdiff::bsdiff(old_data.data(),
+                                old_data.size(),
+                                new_data.data(),
+                                new_data.size(),
+                                bsdiff_patch_writer.get(),
+                                cache_key.empty() ? nullptr : &index);
+    if (!cached_index)
+      new_index.reset(index);
+    TEST_AND_RETURN_FALSE(result == 0);
+  }
+  if (new_index)
+    CacheSuffixArray(cache_key, old_data.size(), std::move(new_index));
+
+  if (*type == InstallOperation::BROTLI_BSDIFF) {
+    // The time brotli takes grows with the size of the patch, much faster at
+    // the best qualities, so only the patches within the budget get it.
+    const RecordingPatchWriter* recording =
+        static_cast<RecordingPatchWriter*>(bsdiff_patch_writer.get());
+    int quality = kBrotliCompressionQuality;
+    if (brotli_max_quality_size > 0 &&
+        recording->size() > brotli_max_quality_size) {
+      quality = brotli_fast_quality;
+    }
+    std::unique_ptr<bsdiff::PatchWriterInterface> brotli_patch_writer =
+        bsdiff::CreateBSDF2PatchWriter(
+            patch.value(), bsdiff::CompressorType::kBrotli, quality);
+    TEST_AND_RETURN_FALSE(recording->Replay(brotli_patch_writer.get()));
+  }
+
+  TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), delta));
+  CHECK_GT(delta->size(), static_cast<brillo::Blob::size_type>(0));
+  return true;
+}
+
+// Generates in |delta| a puffdiff patch from |old_data| to |new_data|, with
+// their deflates |src_deflates| and |dst_deflates| located in the data. The
+// |delta| is left empty when there are no deflates to patch.
+bool GeneratePuffdiff(const brillo::Blob& old_data,
+                      const brillo::Blob& new_data,
+                      vector<puffin::BitExtent> src_deflates,
+                      vector<puffin::BitExtent> dst_deflates,
+                      brillo::Blob* delta) {
+  // Remove equal deflates. TODO(*): We can do a N*N check using
+  // hashing. It will not reduce the payload size, but it will speeds up
+  // the puffing on the client device.
+  auto src = src_deflates.begin();
+  auto dst = dst_deflates.begin();
+  for (; src != src_deflates.end() && dst != dst_deflates.end();) {
+    auto src_in_bytes = deflate_utils::ExpandToByteExtent(*src);
+    auto dst_in_bytes = deflate_utils::ExpandToByteExtent(*dst);
+    if (src_in_bytes.length == dst_in_bytes.length &&
+        !memcmp(old_data.data() + src_in_bytes.offset,
+                new_data.data() + dst_in_bytes.offset,
+                src_in_bytes.length)) {
+      src = src_deflates.erase(src);
+      dst = dst_deflates.erase(dst);
+    } else {
+      src++;
+      dst++;
+    }
+  }
+
+  // Only Puffdiff if both files have at least one deflate left.
+  delta->clear();
+  if (src_deflates.empty() || dst_deflates.empty())
+    return true;
+
+  string temp_file_path;
+  TEST_AND_RETURN_FALSE(
+      utils::MakeTempFile("puffdiff-delta.XXXXXX", &temp_file_path, nullptr));
+  ScopedPathUnlinker temp_file_unlinker(temp_file_path);
+
+  // Perform PuffDiff operation.
+  ScopedMemoryReservation reservation(
+      &memory_budget, EstimatePuffdiffMemory(old_data.size(), new_data.size()));
+  TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data,
+                                         new_data,
+                                         src_deflates,
+                                         dst_deflates,
+                                         temp_file_path,
+                                         delta));
+  TEST_AND_RETURN_FALSE(delta->size() > 0);
+  return true;
+}
+
+// Generates the smallest operation allowed by |version| to encode |new_data|
+// in |data_blob|, storing its type in |type|. The candidates are a full
+// operation and, if |old_data| is not empty, the bsdiff and puffdiff patches
+// from it when allowed by |bsdiff_allowed| and |puffdiff_allowed|. The
+// |src_deflates| and |dst_deflates| are the deflates located in |old_data| and
+// |new_data|. The candidates are generated in parallel when there are idle
+// cores, and then the smallest one is picked in the same order as if they
+// were generated one after another. The encoders tried are appended to
+// |encoders|, if not null.
+bool GenerateBestOperation(const brillo::Blob& old_data,
+                           const brillo::Blob& new_data,
+                           const vector<puffin::BitExtent>& src_deflates,
+                           const vector<puffin::BitExtent>& dst_deflates,
+                           bool bsdiff_allowed,
+                           bool puffdiff_allowed,
+                           const PayloadVersion& version,
+                           brillo::Blob* data_blob,
+                           InstallOperation_Type* type,
+                           vector<GenerationProfile::Encoder>* encoders) {
+  // Try generating a full operation for the given new data, regardless of the
+  // old_data. Its encoders are collected apart, since it can run on another
+  // thread.
+  vector<GenerationProfile::Encoder> full_encoders;
+  bool (*generate_full)(const brillo::Blob&,
+                        const PayloadVersion&,
+                        brillo::Blob*,
+                        InstallOperation_Type*,
+                        vector<GenerationProfile::Encoder>*) =
+      &diff_utils::GenerateBestFullOperation;
+  CandidateTask full_task(base::Bind(generate_full,
+                                     base::ConstRef(new_data),
+                                     version,
+                                     data_blob,
+                                     type,
+                                     encoders ? &full_encoders : nullptr));
+  full_task.Start();
+
+  // A ZERO operation has no data, so no patch can be smaller than it.
+  bool zero_data =
+      version.OperationAllowed(InstallOperation::ZERO) &&
+      utils::IsZeroBuffer(new_data.data(), new_data.size());
+  bool try_bsdiff = !old_data.empty() && bsdiff_allowed && !zero_data;
+  bool try_puffdiff = !old_data.empty() && puffdiff_allowed && !zero_data;
+
+  brillo::Blob bsdiff_delta;
+  InstallOperation_Type bsdiff_type;
+  CandidateTask bsdiff_task(base::Bind(&GenerateBsdiff,
+                                       base::ConstRef(old_data),
+                                       base::ConstRef(new_data),
+                                       version,
+                                       &bsdiff_delta,
+                                       &bsdiff_type));
+  if (try_bsdiff)
+    bsdiff_task.Start();
+
+  brillo::Blob puffdiff_delta;
+  base::TimeDelta puffdiff_duration;
+  if (try_puffdiff) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    TEST_AND_RETURN_FALSE(GeneratePuffdiff(
+        old_data, new_data, src_deflates, dst_deflates, &puffdiff_delta));
+    puffdiff_duration = base::TimeTicks::Now() - start;
+  }
+
+  TEST_AND_RETURN_FALSE(full_task.Wait());
+  if (try_bsdiff)
+    TEST_AND_RETURN_FALSE(bsdiff_task.Wait());
+  if (encoders) {
+    encoders->insert(
+        encoders->end(), full_encoders.begin(), full_encoders.end());
+    if (try_bsdiff) {
+      encoders->push_back(
+          {"bsdiff", bsdiff_task.duration(), bsdiff_delta.size()});
+    }
+    if (!puffdiff_delta.empty()) {
+      encoders->push_back(
+          {"puffdiff", puffdiff_duration, puffdiff_delta.size()});
+    }
+  }
+  if (try_bsdiff) {
+    if (bsdiff_delta.size() < data_blob->size()) {
+      *type = bsdiff_type;
+      *data_blob = std::move(bsdiff_delta);
+    }
+  }
+  if (!puffdiff_delta.empty() && puffdiff_delta.size() < data_blob->size()) {
+    *type = InstallOperation::PUFFDIFF;
+    *data_blob = std::move(puffdiff_delta);
+  }
+  return true;
+}
+
 }  // namespace
 
 namespace diff_utils {
@@ -213,6 +881,14 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   // Merge each file processor's ops list to aops.
   void MergeOperation(vector<AnnotatedOperation>* aops);
 
+  // The number of blocks of the new file, used to estimate the work needed.
+  uint64_t num_blocks() const { return utils::BlocksInExtents(new_extents_); }
+
+  // The first block of the new file, used to pick the NUMA node reading it.
+  uint64_t start_block() const {
+    return new_extents_.empty() ? 0 : new_extents_[0].start_block();
+  }
+
  private:
   const string& old_part_;
   const string& new_part_;
@@ -236,6 +912,8 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
 
 void FileDeltaProcessor::Run() {
   TEST_AND_RETURN(blob_file_ != nullptr);
+  ScopedThreadReservation thread_reservation;
+  busy_threads++;
 
   LOG(INFO) << "Encoding file " << name_ << " ("
             << utils::BlocksInExtents(new_extents_) << " blocks)";
@@ -254,6 +932,7 @@ void FileDeltaProcessor::Run() {
     LOG(ERROR) << "Failed to generate delta for " << name_ << " ("
                << utils::BlocksInExtents(new_extents_) << " blocks)";
   }
+  busy_threads--;
 }
 
 void FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
@@ -271,6 +950,20 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   ExtentRanges old_visited_blocks;
   ExtentRanges new_visited_blocks;
 
+  // The files of the partitions are listed, and their deflates located, while
+  // the blocks of the partitions are mapped.
+  TEST_AND_RETURN_FALSE(new_part.fs_interface);
+  bool puffdiff_allowed = version.OperationAllowed(InstallOperation::PUFFDIFF);
+  vector<FilesystemInterface::File> old_files;
+  vector<FilesystemInterface::File> new_files;
+  CandidateTask preprocess_task(base::Bind(&PreprocessPartitionsFiles,
+                                           base::ConstRef(old_part),
+                                           base::ConstRef(new_part),
+                                           puffdiff_allowed,
+                                           &old_files,
+                                           &new_files));
+  preprocess_task.Start();
+
   TEST_AND_RETURN_FALSE(DeltaMovedAndZeroBlocks(
       aops,
       old_part.path,
@@ -283,20 +976,24 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
       &old_visited_blocks,
       &new_visited_blocks));
 
-  bool puffdiff_allowed = version.OperationAllowed(InstallOperation::PUFFDIFF);
-  map<string, FilesystemInterface::File> old_files_map;
-  if (old_part.fs_interface) {
-    vector<FilesystemInterface::File> old_files;
-    TEST_AND_RETURN_FALSE(deflate_utils::PreprocessParitionFiles(
-        old_part, &old_files, puffdiff_allowed));
-    for (const FilesystemInterface::File& file : old_files)
-      old_files_map[file.name] = file;
+  // The blocks not found in the old partition may be in the old version of
+  // another partition, like the files shipped in several partitions.
+  auto copy_index = partition_copy_indexes.find(old_part.path);
+  if (version.OperationAllowed(InstallOperation::PARTITION_COPY) &&
+      copy_index != partition_copy_indexes.end()) {
+    TEST_AND_RETURN_FALSE(DeltaPartitionCopyBlocks(aops,
+                                                   *copy_index->second,
+                                                   new_part.name,
+                                                   new_part.path,
+                                                   new_part.size / kBlockSize,
+                                                   soft_chunk_blocks,
+                                                   &new_visited_blocks));
   }
 
-  TEST_AND_RETURN_FALSE(new_part.fs_interface);
-  vector<FilesystemInterface::File> new_files;
-  TEST_AND_RETURN_FALSE(deflate_utils::PreprocessParitionFiles(
-      new_part, &new_files, puffdiff_allowed));
+  TEST_AND_RETURN_FALSE(preprocess_task.Wait());
+  map<string, FilesystemInterface::File> old_files_map;
+  for (const FilesystemInterface::File& file : old_files)
+    old_files_map[file.name] = file;
 
   vector<FileDeltaProcessor> file_delta_processors;
 
@@ -332,24 +1029,112 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
         FilterExtentRanges(old_file.extents, old_visited_blocks);
     old_visited_blocks.AddExtents(old_file_extents);
 
-    file_delta_processors.emplace_back(old_part.path,
-                                       new_part.path,
-                                       version,
-                                       std::move(old_file_extents),
-                                       std::move(new_file_extents),
-                                       old_file.deflates,
-                                       new_file.deflates,
-                                       new_file.name,  // operation name
-                                       hard_chunk_blocks,
-                                       blob_file);
+    uint64_t num_blocks = utils::BlocksInExtents(new_file_extents);
+    if (hard_chunk_blocks == -1 ||
+        num_blocks <= static_cast<uint64_t>(hard_chunk_blocks)) {
+      file_delta_processors.emplace_back(old_part.path,
+                                         new_part.path,
+                                         version,
+                                         std::move(old_file_extents),
+                                         std::move(new_file_extents),
+                                         old_file.deflates,
+                                         new_file.deflates,
+                                         new_file.name,  // operation name
+                                         hard_chunk_blocks,
+                                         blob_file);
+      continue;
+    }
+
+    // The chunks of a big file can be cut where its content allows and paired
+    // with the old chunks with the same content boundaries, so the data
+    // inserted or removed in the file doesn't shift all the chunks after it
+    // against the old ones. The in-place deltas don't use them since their
+    // source chunks can overlap.
+    if (content_defined_chunking && !version.InplaceUpdate()) {
+      vector<ContentChunk> old_chunks;
+      vector<ContentChunk> new_chunks;
+      TEST_AND_RETURN_FALSE(FindContentChunks(old_part.path,
+                                              old_file_extents,
+                                              kBlockSize,
+                                              hard_chunk_blocks,
+                                              &old_chunks));
+      TEST_AND_RETURN_FALSE(FindContentChunks(new_part.path,
+                                              new_file_extents,
+                                              kBlockSize,
+                                              hard_chunk_blocks,
+                                              &new_chunks));
+      vector<ssize_t> matches = MatchContentChunks(old_chunks, new_chunks);
+      for (size_t chunk = 0; chunk < new_chunks.size(); chunk++) {
+        vector<Extent> old_chunk_extents;
+        if (matches[chunk] != -1) {
+          const ContentChunk& old_chunk = old_chunks[matches[chunk]];
+          old_chunk_extents = ExtentsSublist(
+              old_file_extents, old_chunk.block_offset, old_chunk.num_blocks);
+        }
+        file_delta_processors.emplace_back(
+            old_part.path,
+            new_part.path,
+            version,
+            std::move(old_chunk_extents),
+            ExtentsSublist(new_file_extents,
+                           new_chunks[chunk].block_offset,
+                           new_chunks[chunk].num_blocks),
+            old_file.deflates,
+            new_file.deflates,
+            base::StringPrintf("%s:%" PRIuS, new_file.name.c_str(), chunk),
+            hard_chunk_blocks,
+            blob_file);
+      }
+      continue;
+    }
+
+    // The files bigger than a chunk are split here in the same chunks as
+    // DeltaReadFile() would, named the same way, so the chunks of a big file
+    // are processed in parallel.
+    for (uint64_t block_offset = 0, chunk = 0; block_offset < num_blocks;
+         block_offset += hard_chunk_blocks, chunk++) {
+      file_delta_processors.emplace_back(
+          old_part.path,
+          new_part.path,
+          version,
+          ExtentsSublist(old_file_extents, block_offset, hard_chunk_blocks),
+          ExtentsSublist(new_file_extents, block_offset, hard_chunk_blocks),
+          old_file.deflates,
+          new_file.deflates,
+          base::StringPrintf("%s:%" PRIu64, new_file.name.c_str(), chunk),
+          hard_chunk_blocks,
+          blob_file);
+    }
   }
 
+  // The biggest files are processed first, so the last ones processed are
+  // small and don't leave a single thread working while the others are idle.
+  // The operations are still merged in the files order.
+  vector<FileDeltaProcessor*> processors_by_size;
+  for (auto& processor : file_delta_processors)
+    processors_by_size.push_back(&processor);
+  std::stable_sort(processors_by_size.begin(),
+                   processors_by_size.end(),
+                   [](const FileDeltaProcessor* a, const FileDeltaProcessor* b) {
+                     return a->num_blocks() > b->num_blocks();
+                   });
+
+  // The processors of a work shard are also assigned in this order, so the
+  // shards get about the same work. Each processor runs on the NUMA node
+  // assigned to the start of its new file, if enabled.
   size_t max_threads = GetMaxThreads();
-  base::DelegateSimpleThreadPool thread_pool("incremental-update-generator",
-                                             max_threads);
+  const NumaTopology* topology = GetNumaTopology();
+  NumaThreadPool thread_pool(
+      "incremental-update-generator", max_threads, topology);
   thread_pool.Start();
-  for (auto& processor : file_delta_processors) {
-    thread_pool.AddWork(&processor);
+  for (size_t i = 0; i < processors_by_size.size(); i++) {
+    if (!IsInWorkShard(i))
+      continue;
+    size_t node =
+        topology ? topology->NodeForBlock(processors_by_size[i]->start_block(),
+                                          new_part.size / kBlockSize)
+                 : 0;
+    thread_pool.AddWork(processors_by_size[i], node);
   }
   thread_pool.JoinAll();
 
@@ -362,7 +1147,7 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   vector<Extent> new_unvisited = {
       ExtentForRange(0, new_part.size / kBlockSize)};
   new_unvisited = FilterExtentRanges(new_unvisited, new_visited_blocks);
-  if (new_unvisited.empty())
+  if (new_unvisited.empty() || !IsInWorkShard(processors_by_size.size()))
     return true;
 
   vector<Extent> old_unvisited;
@@ -412,6 +1197,13 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
                                            &old_block_ids,
                                            &new_block_ids));
 
+  // The loops below look up every block of the partitions, so the visited
+  // blocks are tracked in bitmaps while they run.
+  BlockBitmap old_visited_bitmap(old_num_blocks);
+  BlockBitmap new_visited_bitmap(new_num_blocks);
+  old_visited_bitmap.AddRanges(*old_visited_blocks);
+  new_visited_bitmap.AddRanges(*new_visited_blocks);
+
   // If the update is inplace, we map all the blocks that didn't move,
   // regardless of the contents since they are already copied and no operation
   // is required.
@@ -419,30 +1211,43 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
     uint64_t num_blocks = std::min(old_num_blocks, new_num_blocks);
     for (uint64_t block = 0; block < num_blocks; block++) {
       if (old_block_ids[block] == new_block_ids[block] &&
-          !old_visited_blocks->ContainsBlock(block) &&
-          !new_visited_blocks->ContainsBlock(block)) {
-        old_visited_blocks->AddBlock(block);
-        new_visited_blocks->AddBlock(block);
+          !old_visited_bitmap.ContainsBlock(block) &&
+          !new_visited_bitmap.ContainsBlock(block)) {
+        old_visited_bitmap.AddBlock(block);
+        new_visited_bitmap.AddBlock(block);
       }
     }
+    new_visited_blocks->AddExtents(new_visited_bitmap.GetExtents());
   }
 
   // A mapping from the block_id to the list of block numbers with that block id
   // in the old partition. This is used to lookup where in the old partition
-  // is a block from the new partition.
-  map<BlockMapping::BlockId, vector<uint64_t>> old_blocks_map;
+  // is a block from the new partition. Since the block ids are numbered from 0,
+  // the lists are stored in two flat arrays: |old_first_block| has the lowest
+  // block number with each block id and |old_next_block| the next one with the
+  // same block id after each block, or kNoBlock.
+  const uint64_t kNoBlock = std::numeric_limits<uint64_t>::max();
+  BlockMapping::BlockId max_old_block_id = 0;
+  for (BlockMapping::BlockId block_id : old_block_ids)
+    max_old_block_id = std::max(max_old_block_id, block_id);
+  vector<uint64_t> old_first_block(max_old_block_id + 1, kNoBlock);
+  vector<uint64_t> old_next_block(old_num_blocks, kNoBlock);
 
   for (uint64_t block = old_num_blocks; block-- > 0; ) {
-    if (old_block_ids[block] != 0 && !old_visited_blocks->ContainsBlock(block))
-      old_blocks_map[old_block_ids[block]].push_back(block);
+    if (old_block_ids[block] != 0 &&
+        !old_visited_bitmap.ContainsBlock(block)) {
+      old_next_block[block] = old_first_block[old_block_ids[block]];
+      old_first_block[old_block_ids[block]] = block;
+    }
 
     // Mark all zeroed blocks in the old image as "used" since it doesn't make
     // any sense to spend I/O to read zeros from the source partition and more
     // importantly, these could sometimes be blocks discarded in the SSD which
     // would read non-zero values.
     if (old_block_ids[block] == 0)
-      old_visited_blocks->AddBlock(block);
+      old_visited_bitmap.AddBlock(block);
   }
+  old_visited_blocks->AddExtents(old_visited_bitmap.GetExtents());
 
   // The collection of blocks in the new partition with just zeros. This is a
   // common case for free-space that's also problematic for bsdiff, so we want
@@ -456,26 +1261,25 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
 
   for (uint64_t block = 0; block < new_num_blocks; block++) {
     // Only produce operations for blocks that were not yet visited.
-    if (new_visited_blocks->ContainsBlock(block))
+    if (new_visited_bitmap.ContainsBlock(block))
       continue;
     if (new_block_ids[block] == 0) {
       AppendBlockToExtents(&new_zeros, block);
       continue;
     }
 
-    auto old_blocks_map_it = old_blocks_map.find(new_block_ids[block]);
     // Check if the block exists in the old partition at all.
-    if (old_blocks_map_it == old_blocks_map.end() ||
-        old_blocks_map_it->second.empty())
+    BlockMapping::BlockId block_id = new_block_ids[block];
+    if (block_id > max_old_block_id || old_first_block[block_id] == kNoBlock)
       continue;
 
-    AppendBlockToExtents(&old_identical_blocks,
-                         old_blocks_map_it->second.back());
+    uint64_t old_block = old_first_block[block_id];
+    AppendBlockToExtents(&old_identical_blocks, old_block);
     AppendBlockToExtents(&new_identical_blocks, block);
     // We can't reuse source blocks in minor version 1 because the cycle
     // breaking algorithm used in the in-place update doesn't support that.
     if (version.InplaceUpdate())
-      old_blocks_map_it->second.pop_back();
+      old_first_block[block_id] = old_next_block[old_block];
   }
 
   // Produce operations for the zero blocks split per output extent.
@@ -545,6 +1349,93 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   return true;
 }
 
+bool DeltaPartitionCopyBlocks(vector<AnnotatedOperation>* aops,
+                              const SourceBlockIndex& index,
+                              const string& part_name,
+                              const string& new_part,
+                              size_t new_num_blocks,
+                              ssize_t chunk_blocks,
+                              ExtentRanges* new_visited_blocks) {
+  std::unique_ptr<PartitionReader> new_file;
+  const PartitionReader* reader = GetMappedPartition(new_part);
+  if (!reader) {
+    new_file = PartitionReader::CreateFromFile(new_part);
+    TEST_AND_RETURN_FALSE(new_file != nullptr);
+    reader = new_file.get();
+  }
+  if (chunk_blocks == -1)
+    chunk_blocks = new_num_blocks;
+
+  BlockBitmap new_visited_bitmap(new_num_blocks);
+  new_visited_bitmap.AddRanges(*new_visited_blocks);
+
+  // The operation being built copies the |op_num_blocks| blocks of the new
+  // partition from |op_start_block| on, from the |op_src_extents| of the
+  // partition number |op_partition| of the |index|. Since their data is the
+  // same, the source is hashed from the new blocks.
+  size_t op_partition = 0;
+  uint64_t op_start_block = 0;
+  uint64_t op_num_blocks = 0;
+  vector<Extent> op_src_extents;
+  std::unique_ptr<HashCalculator> op_src_hasher;
+  vector<Extent> copied_blocks;
+  size_t num_ops = aops->size();
+  auto add_operation = [&]() {
+    if (op_num_blocks == 0)
+      return true;
+    aops->emplace_back();
+    AnnotatedOperation* aop = &aops->back();
+    aop->name = "<partition-copy>";
+    aop->op.set_type(InstallOperation::PARTITION_COPY);
+    aop->op.set_src_partition_name(index.partition_name(op_partition));
+    StoreExtents(op_src_extents, aop->op.mutable_src_extents());
+    *aop->op.add_dst_extents() = ExtentForRange(op_start_block, op_num_blocks);
+    TEST_AND_RETURN_FALSE(op_src_hasher->Finalize());
+    const brillo::Blob& src_hash = op_src_hasher->raw_hash();
+    aop->op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    copied_blocks.push_back(ExtentForRange(op_start_block, op_num_blocks));
+    op_src_extents.clear();
+    op_num_blocks = 0;
+    return true;
+  };
+
+  brillo::Blob block_data(kBlockSize);
+  for (uint64_t block = 0; block < new_num_blocks; block++) {
+    if (new_visited_bitmap.ContainsBlock(block))
+      continue;
+    TEST_AND_RETURN_FALSE(
+        reader->Read(block_data.data(), kBlockSize, block * kBlockSize));
+    SourceBlockIndex::Location location;
+    if (!index.FindBlock(block_data.data(), part_name, &location))
+      continue;
+
+    // The operations have a single destination extent, like the other copies,
+    // and copy from a single partition.
+    if (op_num_blocks > 0 &&
+        (location.partition != op_partition ||
+         block != op_start_block + op_num_blocks ||
+         op_num_blocks == static_cast<uint64_t>(chunk_blocks))) {
+      TEST_AND_RETURN_FALSE(add_operation());
+    }
+    if (op_num_blocks == 0) {
+      op_partition = location.partition;
+      op_start_block = block;
+      op_src_hasher.reset(new HashCalculator());
+    }
+    AppendBlockToExtents(&op_src_extents, location.block);
+    TEST_AND_RETURN_FALSE(
+        op_src_hasher->Update(block_data.data(), block_data.size()));
+    op_num_blocks++;
+  }
+  TEST_AND_RETURN_FALSE(add_operation());
+
+  new_visited_blocks->AddExtents(copied_blocks);
+  LOG(INFO) << "Produced " << (aops->size() - num_ops) << " operations for "
+            << utils::BlocksInExtents(copied_blocks)
+            << " blocks copied from other partitions";
+  return true;
+}
+
 bool DeltaReadFile(vector<AnnotatedOperation>* aops,
                    const string& old_part,
                    const string& new_part,
@@ -576,15 +1467,19 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
     NormalizeExtents(&old_extents_chunk);
     NormalizeExtents(&new_extents_chunk);
 
-    TEST_AND_RETURN_FALSE(ReadExtentsToDiff(old_part,
-                                            new_part,
-                                            old_extents_chunk,
-                                            new_extents_chunk,
-                                            old_deflates,
-                                            new_deflates,
-                                            version,
-                                            &data,
-                                            &operation));
+    GenerationProfile::Operation profile;
+    base::TimeTicks start = base::TimeTicks::Now();
+    TEST_AND_RETURN_FALSE(
+        ReadExtentsToDiff(old_part,
+                          new_part,
+                          old_extents_chunk,
+                          new_extents_chunk,
+                          old_deflates,
+                          new_deflates,
+                          version,
+                          &data,
+                          &operation,
+                          generation_profile ? &profile : nullptr));
 
     // Check if the operation writes nothing.
     if (operation.dst_extents_size() == 0) {
@@ -610,6 +1505,12 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
     // Write the data
     TEST_AND_RETURN_FALSE(aop.SetOperationBlob(data, blob_file));
     aops->emplace_back(aop);
+
+    if (generation_profile) {
+      profile.name = aop.name;
+      profile.duration = base::TimeTicks::Now() - start;
+      generation_profile->Add(std::move(profile));
+    }
   }
   return true;
 }
@@ -618,12 +1519,26 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
                                const PayloadVersion& version,
                                brillo::Blob* out_blob,
                                InstallOperation_Type* out_type) {
+  return GenerateBestFullOperation(
+      new_data, version, out_blob, out_type, nullptr);
+}
+
+namespace {
+
+// Implements GenerateBestFullOperation(), except that |out_blob| is left
+// empty when the best operation is a REPLACE of |new_data|, for the caller to
+// copy or move |new_data| there.
+bool GenerateBestCompressedOperation(
+    const brillo::Blob& new_data,
+    const PayloadVersion& version,
+    brillo::Blob* out_blob,
+    InstallOperation_Type* out_type,
+    vector<GenerationProfile::Encoder>* encoders) {
   if (new_data.empty())
     return false;
 
   if (version.OperationAllowed(InstallOperation::ZERO) &&
-      std::all_of(
-          new_data.begin(), new_data.end(), [](uint8_t x) { return x == 0; })) {
+      utils::IsZeroBuffer(new_data.data(), new_data.size())) {
     // The read buffer is all zeros, so produce a ZERO operation. No need to
     // check other types of operations in this case.
     *out_blob = brillo::Blob();
@@ -633,41 +1548,111 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
 
   bool out_blob_set = false;
 
-  // Try compressing |new_data| with xz first.
-  if (version.OperationAllowed(InstallOperation::REPLACE_XZ)) {
-    brillo::Blob new_data_xz;
-    if (XzCompress(new_data, &new_data_xz) && !new_data_xz.empty()) {
-      *out_type = InstallOperation::REPLACE_XZ;
-      *out_blob = std::move(new_data_xz);
-      out_blob_set = true;
+  // The data is compressed with xz, in parallel if there is an idle core,
+  // while it is compressed with bzip2.
+  bool xz_allowed = version.OperationAllowed(InstallOperation::REPLACE_XZ);
+  brillo::Blob new_data_xz;
+  CandidateTask xz_task(
+      base::Bind(&XzCompress, base::ConstRef(new_data), &new_data_xz));
+  if (xz_allowed)
+    xz_task.Start();
+  bool zstd_allowed = version.OperationAllowed(InstallOperation::REPLACE_ZSTD);
+  brillo::Blob new_data_zstd;
+  CandidateTask zstd_task(
+      base::Bind(&ZstdCompressBest, base::ConstRef(new_data), &new_data_zstd));
+  if (zstd_allowed)
+    zstd_task.Start();
+
+  // bzip2 runs on this thread until the xz result is needed. It is not worth
+  // trying when xz is also tried on data that doesn't compress, as neither
+  // of them would be smaller than a REPLACE.
+  bool bz_allowed = version.OperationAllowed(InstallOperation::REPLACE_BZ);
+  if (bz_allowed && xz_allowed && IsLikelyIncompressible(new_data)) {
+    bz_allowed = false;
+    skipped_bzip_count++;
+  }
+  brillo::Blob new_data_bz;
+  base::TimeTicks bz_start = base::TimeTicks::Now();
+  bool bz_result = bz_allowed && BzipCompress(new_data, &new_data_bz);
+  base::TimeDelta bz_duration = base::TimeTicks::Now() - bz_start;
+  bool xz_result = xz_allowed && xz_task.Wait();
+  bool zstd_result = zstd_allowed && zstd_task.Wait();
+  if (encoders) {
+    if (xz_result)
+      encoders->push_back({"xz", xz_task.duration(), new_data_xz.size()});
+    if (bz_result)
+      encoders->push_back({"bzip2", bz_duration, new_data_bz.size()});
+    if (zstd_result) {
+      encoders->push_back(
+          {"zstd", zstd_task.duration(), new_data_zstd.size()});
     }
   }
 
-  // Try compressing it with bzip2.
-  if (version.OperationAllowed(InstallOperation::REPLACE_BZ)) {
-    brillo::Blob new_data_bz;
-    // TODO(deymo): Implement some heuristic to determine if it is worth trying
-    // to compress the blob with bzip2 if we already have a good REPLACE_XZ.
-    if (BzipCompress(new_data, &new_data_bz) && !new_data_bz.empty() &&
-        (!out_blob_set || out_blob->size() > new_data_bz.size())) {
-      // A REPLACE_BZ is better or nothing else was set.
-      *out_type = InstallOperation::REPLACE_BZ;
-      *out_blob = std::move(new_data_bz);
-      out_blob_set = true;
-    }
+  // Try the xz result first.
+  if (xz_result && !new_data_xz.empty()) {
+    *out_type = InstallOperation::REPLACE_XZ;
+    *out_blob = std::move(new_data_xz);
+    out_blob_set = true;
+  }
+
+  // Then the bzip2 result.
+  if (bz_result && !new_data_bz.empty() &&
+      (!out_blob_set || out_blob->size() > new_data_bz.size())) {
+    // A REPLACE_BZ is better or nothing else was set.
+    *out_type = InstallOperation::REPLACE_BZ;
+    *out_blob = std::move(new_data_bz);
+    out_blob_set = true;
+  }
+
+  // Then the zstd result, even if slightly bigger.
+  if (zstd_result && !new_data_zstd.empty() &&
+      (!out_blob_set ||
+       new_data_zstd.size() <=
+           out_blob->size() + out_blob->size() / kZstdSizeTolerance)) {
+    *out_type = InstallOperation::REPLACE_ZSTD;
+    *out_blob = std::move(new_data_zstd);
+    out_blob_set = true;
   }
 
   // If nothing else worked or it was badly compressed we try a REPLACE.
   if (!out_blob_set || out_blob->size() >= new_data.size()) {
     *out_type = InstallOperation::REPLACE;
-    // This needs to make a copy of the data in the case bzip or xz didn't
-    // compress well, which is not the common case so the performance hit is
-    // low.
-    *out_blob = new_data;
+    out_blob->clear();
   }
   return true;
 }
 
+}  // namespace
+
+bool GenerateBestFullOperation(
+    const brillo::Blob& new_data,
+    const PayloadVersion& version,
+    brillo::Blob* out_blob,
+    InstallOperation_Type* out_type,
+    vector<GenerationProfile::Encoder>* encoders) {
+  TEST_AND_RETURN_FALSE(GenerateBestCompressedOperation(
+      new_data, version, out_blob, out_type, encoders));
+  // This needs to make a copy of the data in the case bzip, xz or zstd didn't
+  // compress well, which is not the common case so the performance hit is
+  // low.
+  if (*out_type == InstallOperation::REPLACE)
+    *out_blob = new_data;
+  return true;
+}
+
+bool GenerateBestFullOperation(
+    brillo::Blob&& new_data,
+    const PayloadVersion& version,
+    brillo::Blob* out_blob,
+    InstallOperation_Type* out_type,
+    vector<GenerationProfile::Encoder>* encoders) {
+  TEST_AND_RETURN_FALSE(GenerateBestCompressedOperation(
+      new_data, version, out_blob, out_type, encoders));
+  if (*out_type == InstallOperation::REPLACE)
+    *out_blob = std::move(new_data);
+  return true;
+}
+
 bool ReadExtentsToDiff(const string& old_part,
                        const string& new_part,
                        const vector<Extent>& old_extents,
@@ -677,6 +1662,28 @@ bool ReadExtentsToDiff(const string& old_part,
                        const PayloadVersion& version,
                        brillo::Blob* out_data,
                        InstallOperation* out_op) {
+  return ReadExtentsToDiff(old_part,
+                           new_part,
+                           old_extents,
+                           new_extents,
+                           old_deflates,
+                           new_deflates,
+                           version,
+                           out_data,
+                           out_op,
+                           nullptr);
+}
+
+bool ReadExtentsToDiff(const string& old_part,
+                       const string& new_part,
+                       const vector<Extent>& old_extents,
+                       const vector<Extent>& new_extents,
+                       const vector<puffin::BitExtent>& old_deflates,
+                       const vector<puffin::BitExtent>& new_deflates,
+                       const PayloadVersion& version,
+                       brillo::Blob* out_data,
+                       InstallOperation* out_op,
+                       GenerationProfile::Operation* profile) {
   InstallOperation operation;
 
   // We read blocks from old_extents and write blocks to new_extents.
@@ -708,126 +1715,96 @@ bool ReadExtentsToDiff(const string& old_part,
 
   // Read in bytes from new data.
   brillo::Blob new_data;
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(new_part,
-                                           new_extents,
-                                           &new_data,
-                                           kBlockSize * blocks_to_write,
-                                           kBlockSize));
+  TEST_AND_RETURN_FALSE(ReadPartitionExtents(new_part,
+                                             new_extents,
+                                             &new_data,
+                                             kBlockSize * blocks_to_write,
+                                             kBlockSize));
   TEST_AND_RETURN_FALSE(!new_data.empty());
 
   // Data blob that will be written to delta file.
   brillo::Blob data_blob;
 
-  // Try generating a full operation for the given new data, regardless of the
-  // old_data.
-  InstallOperation_Type op_type;
-  TEST_AND_RETURN_FALSE(
-      GenerateBestFullOperation(new_data, version, &data_blob, &op_type));
-  operation.set_type(op_type);
-
   brillo::Blob old_data;
   if (blocks_to_read > 0) {
     // Read old data.
     TEST_AND_RETURN_FALSE(
-        utils::ReadExtents(old_part, src_extents, &old_data,
-                           kBlockSize * blocks_to_read, kBlockSize));
-    if (old_data == new_data) {
-      // No change in data.
-      operation.set_type(version.OperationAllowed(InstallOperation::SOURCE_COPY)
-                             ? InstallOperation::SOURCE_COPY
-                             : InstallOperation::MOVE);
-      data_blob = brillo::Blob();
-    } else {
-      if (bsdiff_allowed) {
-        base::FilePath patch;
-        TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&patch));
-        ScopedPathUnlinker unlinker(patch.value());
-
-        std::unique_ptr<bsdiff::PatchWriterInterface> bsdiff_patch_writer;
-        InstallOperation_Type operation_type = InstallOperation::BSDIFF;
-        if (version.OperationAllowed(InstallOperation::BROTLI_BSDIFF)) {
-          bsdiff_patch_writer =
-              bsdiff::CreateBSDF2PatchWriter(patch.value(),
-                                             bsdiff::CompressorType::kBrotli,
-                                             kBrotliCompressionQuality);
-          operation_type = InstallOperation::BROTLI_BSDIFF;
-        } else {
-          bsdiff_patch_writer = bsdiff::CreateBsdiffPatchWriter(patch.value());
-          if (version.OperationAllowed(InstallOperation::SOURCE_BSDIFF)) {
-            operation_type = InstallOperation::SOURCE_BSDIFF;
-          }
-        }
+        ReadPartitionExtents(old_part, src_extents, &old_data,
+                             kBlockSize * blocks_to_read, kBlockSize));
+  }
 
-        brillo::Blob bsdiff_delta;
-        TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data.data(),
-                                                  old_data.size(),
-                                                  new_data.data(),
-                                                  new_data.size(),
-                                                  bsdiff_patch_writer.get(),
-                                                  nullptr));
-
-        TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), &bsdiff_delta));
-        CHECK_GT(bsdiff_delta.size(), static_cast<brillo::Blob::size_type>(0));
-        if (bsdiff_delta.size() < data_blob.size()) {
-          operation.set_type(operation_type);
-          data_blob = std::move(bsdiff_delta);
-        }
-      }
-      if (puffdiff_allowed) {
-        // Find all deflate positions inside the given extents and then put all
-        // deflates together because we have already read all the extents into
-        // one buffer.
-        vector<puffin::BitExtent> src_deflates;
-        TEST_AND_RETURN_FALSE(deflate_utils::FindAndCompactDeflates(
-            src_extents, old_deflates, &src_deflates));
-
-        vector<puffin::BitExtent> dst_deflates;
-        TEST_AND_RETURN_FALSE(deflate_utils::FindAndCompactDeflates(
-            dst_extents, new_deflates, &dst_deflates));
-
-        // Remove equal deflates. TODO(*): We can do a N*N check using
-        // hashing. It will not reduce the payload size, but it will speeds up
-        // the puffing on the client device.
-        auto src = src_deflates.begin();
-        auto dst = dst_deflates.begin();
-        for (; src != src_deflates.end() && dst != dst_deflates.end();) {
-          auto src_in_bytes = deflate_utils::ExpandToByteExtent(*src);
-          auto dst_in_bytes = deflate_utils::ExpandToByteExtent(*dst);
-          if (src_in_bytes.length == dst_in_bytes.length &&
-              !memcmp(old_data.data() + src_in_bytes.offset,
-                      new_data.data() + dst_in_bytes.offset,
-                      src_in_bytes.length)) {
-            src = src_deflates.erase(src);
-            dst = dst_deflates.erase(dst);
-          } else {
-            src++;
-            dst++;
-          }
-        }
+  if (blocks_to_read > 0 && old_data == new_data) {
+    // No change in data.
+    operation.set_type(version.OperationAllowed(InstallOperation::SOURCE_COPY)
+                           ? InstallOperation::SOURCE_COPY
+                           : InstallOperation::MOVE);
+  } else {
+    // Find all deflate positions inside the given extents and then put all
+    // deflates together because we have already read all the extents into
+    // one buffer.
+    vector<puffin::BitExtent> src_deflates;
+    vector<puffin::BitExtent> dst_deflates;
+    puffdiff_allowed = puffdiff_allowed && blocks_to_read > 0;
+    if (puffdiff_allowed) {
+      TEST_AND_RETURN_FALSE(deflate_utils::FindAndCompactDeflates(
+          src_extents, old_deflates, &src_deflates));
+      TEST_AND_RETURN_FALSE(deflate_utils::FindAndCompactDeflates(
+          dst_extents, new_deflates, &dst_deflates));
+    }
 
-        // Only Puffdiff if both files have at least one deflate left.
-        if (!src_deflates.empty() && !dst_deflates.empty()) {
-          brillo::Blob puffdiff_delta;
-          string temp_file_path;
-          TEST_AND_RETURN_FALSE(utils::MakeTempFile(
-              "puffdiff-delta.XXXXXX", &temp_file_path, nullptr));
-          ScopedPathUnlinker temp_file_unlinker(temp_file_path);
-
-          // Perform PuffDiff operation.
-          TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data,
-                                                 new_data,
-                                                 src_deflates,
-                                                 dst_deflates,
-                                                 temp_file_path,
-                                                 &puffdiff_delta));
-          TEST_AND_RETURN_FALSE(puffdiff_delta.size() > 0);
-          if (puffdiff_delta.size() < data_blob.size()) {
-            operation.set_type(InstallOperation::PUFFDIFF);
-            data_blob = std::move(puffdiff_delta);
-          }
-        }
+    // The operation is looked up in the diff cache first, if enabled.
+    string cache_key;
+    if (diff_cache) {
+      TEST_AND_RETURN_FALSE(GetDiffCacheKey(old_data,
+                                            new_data,
+                                            src_deflates,
+                                            dst_deflates,
+                                            bsdiff_allowed,
+                                            puffdiff_allowed,
+                                            version,
+                                            &cache_key));
+    }
+    InstallOperation_Type op_type;
+    if (!cache_key.empty() &&
+        diff_cache->Lookup(cache_key, &op_type, &data_blob)) {
+      if (profile)
+        profile->cached = true;
+    } else {
+      TEST_AND_RETURN_FALSE(
+          GenerateBestOperation(old_data,
+                                new_data,
+                                src_deflates,
+                                dst_deflates,
+                                bsdiff_allowed,
+                                puffdiff_allowed,
+                                version,
+                                &data_blob,
+                                &op_type,
+                                profile ? &profile->encoders : nullptr));
+      // A failure to store the operation only makes the next payloads slower
+      // to generate.
+      if (!cache_key.empty())
+        diff_cache->Store(cache_key, op_type, data_blob);
+    }
+
+    // The diff operations needing more memory to apply than the device has
+    // are replaced by the best full operation of the new data, which the
+    // chunk size keeps within the budget.
+    if (apply_memory_budget > 0 && !IsAReplaceOperation(op_type)) {
+      InstallOperation estimate;
+      estimate.set_type(op_type);
+      estimate.set_data_length(data_blob.size());
+      StoreExtents(dst_extents, estimate.mutable_dst_extents());
+      if (EstimateApplyMemory(estimate, kBlockSize) > apply_memory_budget) {
+        TEST_AND_RETURN_FALSE(GenerateBestFullOperation(
+            new_data,
+            version,
+            &data_blob,
+            &op_type,
+            profile ? &profile->encoders : nullptr));
       }
     }
+    operation.set_type(op_type);
   }
 
   // Remove identical src/dst block ranges in MOVE operations.
@@ -859,15 +1836,203 @@ bool ReadExtentsToDiff(const string& old_part,
   // All operations have dst_extents.
   StoreExtents(dst_extents, operation.mutable_dst_extents());
 
+  if (profile) {
+    profile->old_size = old_data.size();
+    profile->new_size = new_data.size();
+    profile->type = operation.type();
+    profile->size = data_blob.size();
+  }
   *out_data = std::move(data_blob);
   *out_op = operation;
   return true;
 }
 
+uint64_t EstimateApplyMemory(const InstallOperation& operation,
+                             uint64_t block_size) {
+  const uint64_t dst_size =
+      utils::BlocksInExtents(operation.dst_extents()) * block_size;
+  uint64_t memory = operation.data_length();
+  switch (operation.type()) {
+    case InstallOperation::REPLACE_BZ:
+      memory += kBzip2DecoderMemory;
+      break;
+    case InstallOperation::REPLACE_XZ:
+    case InstallOperation::REPLACE_ZSTD:
+      memory += std::min(dst_size, kMaxDictionarySize);
+      break;
+    case InstallOperation::BSDIFF:
+    case InstallOperation::SOURCE_BSDIFF:
+      memory += kBsdiffStreams * kBzip2DecoderMemory;
+      break;
+    case InstallOperation::BROTLI_BSDIFF:
+    case InstallOperation::PUFFDIFF:
+      memory += kBsdiffStreams * std::min(dst_size, kBrotliWindowSize);
+      break;
+    case InstallOperation::MOVE:
+      // The source blocks are all read before writing them.
+      memory += dst_size;
+      break;
+    default:
+      // The other operations are applied with buffers of a fixed size.
+      break;
+  }
+  return memory;
+}
+
+bool IsLikelyIncompressible(const brillo::Blob& data) {
+  // The whole data is used when it is small, otherwise a few blocks of it.
+  size_t num_blocks = data.size() / kBlockSize;
+  size_t sample_blocks = std::min(num_blocks, kEntropySampleBlocks);
+  uint64_t counts[256] = {};
+  uint64_t total = 0;
+  if (sample_blocks < kEntropySampleBlocks) {
+    for (uint8_t byte : data)
+      counts[byte]++;
+    total = data.size();
+  } else {
+    for (size_t i = 0; i < sample_blocks; i++) {
+      const uint8_t* block =
+          data.data() + (i * num_blocks / sample_blocks) * kBlockSize;
+      for (size_t j = 0; j < kBlockSize; j++)
+        counts[block[j]]++;
+    }
+    total = sample_blocks * kBlockSize;
+  }
+  if (total == 0)
+    return false;
+
+  double entropy = 0;
+  for (uint64_t count : counts) {
+    if (count == 0)
+      continue;
+    double p = static_cast<double>(count) / total;
+    entropy -= p * std::log2(p);
+  }
+  return entropy > kIncompressibleBitsPerByte;
+}
+
+uint64_t GetSkippedBzipCount() {
+  return skipped_bzip_count.load();
+}
+
+void SetBrotliQualityBudget(uint64_t max_quality_size, int fast_quality) {
+  CHECK_GE(fast_quality, 0);
+  CHECK_LE(fast_quality, kBrotliCompressionQuality);
+  brotli_max_quality_size = max_quality_size;
+  brotli_fast_quality = fast_quality;
+}
+
+void SetApplyMemoryBudget(uint64_t bytes) {
+  apply_memory_budget = bytes;
+}
+
+void SetSuffixArrayCacheSize(uint64_t bytes) {
+  base::AutoLock auto_lock(suffix_array_cache.lock);
+  suffix_array_cache.limit = bytes;
+  suffix_array_cache.size = 0;
+  suffix_array_cache.entries.clear();
+}
+
+uint64_t GetSuffixArrayCacheHits() {
+  base::AutoLock auto_lock(suffix_array_cache.lock);
+  return suffix_array_cache.hits;
+}
+
+bool SetDiffCacheDir(const string& dir) {
+  diff_cache.reset();
+  if (dir.empty())
+    return true;
+  base::FilePath cache_dir(dir);
+  TEST_AND_RETURN_FALSE(base::CreateDirectory(cache_dir));
+  cache_dir = base::MakeAbsoluteFilePath(cache_dir);
+  TEST_AND_RETURN_FALSE(!cache_dir.empty());
+  LOG(INFO) << "Using the diff cache in " << cache_dir.value();
+  diff_cache.reset(new DiffCache(cache_dir.value()));
+  return true;
+}
+
+const DiffCache* GetDiffCache() {
+  return diff_cache.get();
+}
+
+bool GetFullOperationCacheKey(const brillo::Blob& data,
+                              const PayloadVersion& version,
+                              string* key) {
+  return GetDiffCacheKey(brillo::Blob(), data, {}, {}, false, false, version,
+                         key);
+}
+
+void SetWorkShard(size_t index, size_t count) {
+  CHECK(count <= 1 || index < count);
+  work_shard_index = count > 1 ? index : 0;
+  work_shard_count = std::max(count, static_cast<size_t>(1));
+}
+
+bool IsWorkSharded() {
+  return work_shard_count > 1;
+}
+
+bool IsInWorkShard(size_t unit) {
+  return unit % work_shard_count == work_shard_index;
+}
+
+void SetMemoryBudget(uint64_t bytes) {
+  memory_budget.set_limit(bytes);
+}
+
+void SetZstdDictionary(std::unique_ptr<ZstdDictionary> dictionary) {
+  zstd_dictionary = std::move(dictionary);
+}
+
+void SetSharedTargetPartitions(const vector<PartitionConfig>& partitions) {
+  shared_target_files.clear();
+  for (const PartitionConfig& part : partitions) {
+    if (part.fs_interface) {
+      shared_target_files[part.fs_interface.get()].reset(
+          new SharedPartitionFiles());
+    }
+  }
+}
+
+bool AddPartitionCopySources(const vector<PartitionConfig>& partitions) {
+  vector<PartitionConfig> sources;
+  bool indexed = true;
+  for (const PartitionConfig& part : partitions) {
+    if (!part.path.empty()) {
+      sources.push_back(part);
+      indexed &= partition_copy_indexes.count(part.path) > 0;
+    }
+  }
+  if (indexed)
+    return true;
+  std::shared_ptr<SourceBlockIndex> index(new SourceBlockIndex(kBlockSize));
+  TEST_AND_RETURN_FALSE(index->AddPartitions(sources));
+  for (const PartitionConfig& part : sources)
+    partition_copy_indexes.emplace(part.path, index);
+  return true;
+}
+
+void ClearPartitionCopySources() {
+  partition_copy_indexes.clear();
+}
+
+void SetGenerationProfile(GenerationProfile* profile) {
+  generation_profile = profile;
+}
+
+GenerationProfile* GetGenerationProfile() {
+  return generation_profile;
+}
+
+void SetContentDefinedChunking(bool enabled) {
+  content_defined_chunking = enabled;
+}
+
 bool IsAReplaceOperation(InstallOperation_Type op_type) {
   return (op_type == InstallOperation::REPLACE ||
           op_type == InstallOperation::REPLACE_BZ ||
-          op_type == InstallOperation::REPLACE_XZ);
+          op_type == InstallOperation::REPLACE_XZ ||
+          op_type == InstallOperation::REPLACE_ZSTD);
 }
 
 bool IsNoSourceOperation(InstallOperation_Type op_type) {
@@ -953,11 +2118,46 @@ bool IsExtFilesystem(const string& device) {
   return true;
 }
 
-// Return the number of CPUs on the machine, and 4 threads in minimum.
+// Return the number of threads set by SetMaxThreads(), or else the number of
+// CPUs on the machine, and 4 threads in minimum.
 size_t GetMaxThreads() {
+  if (max_threads_override)
+    return max_threads_override;
   return std::max(sysconf(_SC_NPROCESSORS_ONLN), 4L);
 }
 
+void SetMaxThreads(size_t max_threads) {
+  max_threads_override = max_threads;
+  thread_budget.set_limit(GetMaxThreads());
+}
+
+void SetNumaAware(bool enabled) {
+  numa_topology.reset();
+  if (!enabled)
+    return;
+  std::unique_ptr<NumaTopology> topology(new NumaTopology());
+  if (!topology->Load(kNumaNodeDir)) {
+    LOG(WARNING) << "Unable to load the NUMA topology from " << kNumaNodeDir
+                 << ", the threads aren't assigned to NUMA nodes.";
+    return;
+  }
+  LOG(INFO) << "Found " << topology->num_nodes() << " NUMA nodes with "
+            << topology->num_cpus() << " CPUs.";
+  if (topology->num_nodes() > 1)
+    numa_topology = std::move(topology);
+}
+
+const NumaTopology* GetNumaTopology() {
+  return numa_topology.get();
+}
+
+ScopedThreadReservation::ScopedThreadReservation()
+    : reserved_(thread_budget.Reserve(1)) {}
+
+ScopedThreadReservation::~ScopedThreadReservation() {
+  thread_budget.Release(reserved_);
+}
+
 }  // namespace diff_utils
 
 }  // namespace chromeos_update_engine
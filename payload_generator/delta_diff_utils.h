@@ -17,15 +17,22 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_DELTA_DIFF_UTILS_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_DELTA_DIFF_UTILS_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <base/macros.h>
 #include <brillo/secure_blob.h>
 #include <puffin/puffdiff.h>
 
 #include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/generation_profile.h"
+#include "update_engine/payload_generator/numa_topology.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/source_block_index.h"
+#include "update_engine/payload_generator/zstd.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -71,6 +78,21 @@ bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
                              ExtentRanges* old_visited_blocks,
                              ExtentRanges* new_visited_blocks);
 
+// Create PARTITION_COPY operations in |aops| for the blocks of the |new_part|
+// file, of |new_num_blocks| blocks, which are in the old version of another
+// partition than |part_name| indexed in |index|. Only the blocks not in
+// |new_visited_blocks| are looked up, and those copied are added to it. The
+// maximum operation size is |chunk_blocks| blocks, or unlimited if
+// |chunk_blocks| is -1. The source hash of the operations is set, since their
+// source isn't in the old partition of |part_name|.
+bool DeltaPartitionCopyBlocks(std::vector<AnnotatedOperation>* aops,
+                              const SourceBlockIndex& index,
+                              const std::string& part_name,
+                              const std::string& new_part,
+                              size_t new_num_blocks,
+                              ssize_t chunk_blocks,
+                              ExtentRanges* new_visited_blocks);
+
 // For a given file |name| append operations to |aops| to produce it in the
 // |new_part|. The file will be split in chunks of |chunk_blocks| blocks each
 // or treated as a single chunk if |chunk_blocks| is -1. The file data is
@@ -110,15 +132,170 @@ bool ReadExtentsToDiff(const std::string& old_part,
                        brillo::Blob* out_data,
                        InstallOperation* out_op);
 
+// Like the above, also storing the sizes, the operation chosen and the
+// encoders tried in |profile|, if not null.
+bool ReadExtentsToDiff(const std::string& old_part,
+                       const std::string& new_part,
+                       const std::vector<Extent>& old_extents,
+                       const std::vector<Extent>& new_extents,
+                       const std::vector<puffin::BitExtent>& old_deflates,
+                       const std::vector<puffin::BitExtent>& new_deflates,
+                       const PayloadVersion& version,
+                       brillo::Blob* out_data,
+                       InstallOperation* out_op,
+                       GenerationProfile::Operation* profile);
+
 // Generates the best allowed full operation to produce |new_data|. The allowed
 // operations are based on |payload_version|. The operation blob will be stored
 // in |out_blob| and the resulting operation type in |out_type|. Returns whether
-// a valid full operation was generated.
+// a valid full operation was generated. REPLACE_BZ is not tried when REPLACE_XZ
+// is allowed and |new_data| is likely incompressible. REPLACE_ZSTD, when
+// allowed, wins over slightly smaller REPLACE_XZ and REPLACE_BZ operations.
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
                                const PayloadVersion& version,
                                brillo::Blob* out_blob,
                                InstallOperation_Type* out_type);
 
+// Like the above, also appending the encoders tried to |encoders|, if not
+// null.
+bool GenerateBestFullOperation(
+    const brillo::Blob& new_data,
+    const PayloadVersion& version,
+    brillo::Blob* out_blob,
+    InstallOperation_Type* out_type,
+    std::vector<GenerationProfile::Encoder>* encoders);
+
+// Like the above, taking the ownership of |new_data|, which is moved to
+// |out_blob| instead of copied when the best operation is a REPLACE.
+bool GenerateBestFullOperation(
+    brillo::Blob&& new_data,
+    const PayloadVersion& version,
+    brillo::Blob* out_blob,
+    InstallOperation_Type* out_type,
+    std::vector<GenerationProfile::Encoder>* encoders);
+
+// Returns the estimated peak memory in bytes needed to apply |operation|,
+// with |block_size| bytes blocks: its data, held in memory until applied,
+// plus the memory of the decoders of its data with the settings used by the
+// generator.
+uint64_t EstimateApplyMemory(const InstallOperation& operation,
+                             uint64_t block_size);
+
+// Returns whether |data| is likely to not compress, estimated from the entropy
+// of the bytes in a sample of its blocks.
+bool IsLikelyIncompressible(const brillo::Blob& data);
+
+// Returns the number of times GenerateBestFullOperation() didn't try
+// REPLACE_BZ because the data was likely incompressible, in this process.
+uint64_t GetSkippedBzipCount();
+
+// Makes ReadExtentsToDiff() cache the operations it generates in the
+// directory |dir|, created if needed, and reuse them to encode the same data
+// again, even in a later process. An empty |dir| disables the cache. It
+// must not be called while operations are being generated. Returns whether
+// it succeeded.
+bool SetDiffCacheDir(const std::string& dir);
+
+// Returns the diff cache enabled by SetDiffCacheDir(), or nullptr if it is
+// disabled. Other results of the generation computed from the data alone can
+// be stored in it too, with keys that can't match the operation keys.
+const DiffCache* GetDiffCache();
+
+// Computes in |key| the key used in the diff cache for the full operation
+// encoding |data| in a payload of |version|.
+bool GetFullOperationCacheKey(const brillo::Blob& data,
+                              const PayloadVersion& version,
+                              std::string* key);
+
+// Makes DeltaReadPartition() and the FullUpdateGenerator only generate their
+// work units, the files or chunks of files and the full chunks, numbered from
+// zero whose number is |index| modulo |count|, so |count| processes sharing
+// a diff cache can generate the operations of a payload in parallel. The
+// operations generated are then incomplete, only useful for the entries they
+// store in the diff cache: a last process without a shard finds them all
+// there and writes the payload. A |count| of zero or one disables it. It must
+// not be called while operations are being generated.
+void SetWorkShard(size_t index, size_t count);
+
+// Returns whether a shard was set by SetWorkShard().
+bool IsWorkSharded();
+
+// Returns whether the work unit number |unit| is in the shard set by
+// SetWorkShard(), always true if none is set.
+bool IsInWorkShard(size_t unit);
+
+// Makes the BROTLI_BSDIFF operations compress their patch with the best
+// brotli quality only if its data is up to |max_quality_size| bytes, and with
+// |fast_quality| otherwise, since the best quality takes much longer on the
+// big patches for little gain. Zero compresses them all with the best
+// quality. It must not be called while operations are being generated.
+void SetBrotliQualityBudget(uint64_t max_quality_size, int fast_quality);
+
+// Makes ReadExtentsToDiff() replace the diff operations whose estimated apply
+// memory is above |bytes| with full operations, so every operation can be
+// applied by a device with that much memory for it. Zero doesn't bound it.
+// It must not be called while operations are being generated.
+void SetApplyMemoryBudget(uint64_t bytes);
+
+// Makes the bsdiff operations keep the suffix array they build for the old
+// data, up to an estimated |bytes| in total, to reuse it when the same old
+// data is diffed again in this process. Zero disables it. It must not be
+// called while operations are being generated.
+void SetSuffixArrayCacheSize(uint64_t bytes);
+
+// Returns the number of times a bsdiff operation reused a cached suffix array
+// in this process.
+uint64_t GetSuffixArrayCacheHits();
+
+// Bounds the memory used by the bsdiff and puffdiff operations generated at
+// the same time to about |bytes|, estimated from the size of the data diffed.
+// The diffs wait for the memory they need to be released by the others, and
+// the ones needing more than |bytes| run alone. Zero doesn't bound the memory.
+// It must not be called while operations are being generated.
+void SetMemoryBudget(uint64_t bytes);
+
+// Makes GenerateBestFullOperation() also compress the small data with the zstd
+// |dictionary| when REPLACE_ZSTD is allowed, keeping it if it is smaller. The
+// payload must ship the dictionary. A null |dictionary| disables it. It must
+// not be called while operations are being generated.
+void SetZstdDictionary(std::unique_ptr<ZstdDictionary> dictionary);
+
+// Makes DeltaReadPartition() list the files of the target |partitions| and
+// locate their deflates only once for all the payloads generated to them,
+// which share their filesystems, instead of once per payload. The payloads
+// then don't read a shared filesystem at the same time. An empty
+// |partitions| stops sharing them. It must not be called while operations are
+// being generated.
+void SetSharedTargetPartitions(const std::vector<PartitionConfig>& partitions);
+
+// Indexes the blocks of the old |partitions| of a payload, so that
+// DeltaReadPartition() copies the blocks of each of its new partitions which
+// are in the old version of another one with PARTITION_COPY operations, when
+// the payload version allows them. The payloads generated at once add their
+// old partitions in turn, and an old partition already indexed for a previous
+// payload keeps the index of that payload. It must not be called while
+// operations are being generated.
+bool AddPartitionCopySources(const std::vector<PartitionConfig>& partitions);
+
+// Drops the indexes added by AddPartitionCopySources().
+void ClearPartitionCopySources();
+
+// Makes DeltaReadFile() and the FullUpdateGenerator add the cost of each
+// operation they generate to |profile|. A null |profile| disables it. It must
+// not be called while operations are being generated.
+void SetGenerationProfile(GenerationProfile* profile);
+
+// Returns the profile set by SetGenerationProfile(), or nullptr.
+GenerationProfile* GetGenerationProfile();
+
+// Makes DeltaReadPartition() split the files bigger than the hard chunk size
+// in chunks cut where their content allows, with a ContentChunker, and diff
+// each of them against the chunk of the old file with the same boundaries,
+// instead of splitting both files at the same block offsets. Only used by the
+// deltas that aren't in-place. It must not be called while operations are
+// being generated.
+void SetContentDefinedChunking(bool enabled);
+
 // Returns whether |op_type| is one of the REPLACE full operations.
 bool IsAReplaceOperation(InstallOperation_Type op_type);
 
@@ -149,6 +326,38 @@ bool IsExtFilesystem(const std::string& device);
 // Returns the max number of threads to process the files(chunks) in parallel.
 size_t GetMaxThreads();
 
+// Makes GetMaxThreads() return |max_threads| instead of the number of CPUs, to
+// measure how the generation scales with the number of threads. Zero restores
+// the default. It must not be called while operations are being generated.
+void SetMaxThreads(size_t max_threads);
+
+// Makes DeltaReadPartition() and the FullUpdateGenerator process their work
+// units on a NumaThreadPool with the NUMA topology of the machine, each unit
+// on the node assigned to the blocks it reads, when |enabled| and the machine
+// has more than one node. It must not be called while operations are being
+// generated.
+void SetNumaAware(bool enabled);
+
+// Returns the NUMA topology set up by SetNumaAware(), or nullptr if not
+// enabled or the machine has a single node.
+const NumaTopology* GetNumaTopology();
+
+// Reserves one of the GetMaxThreads() threads shared by all the partitions
+// generated at the same time while the object is alive, waiting for one to be
+// free. The threads processing a file or a chunk of a full update hold one, so
+// the partitions generated in parallel don't keep more cores busy together
+// than a single partition does.
+class ScopedThreadReservation {
+ public:
+  ScopedThreadReservation();
+  ~ScopedThreadReservation();
+
+ private:
+  uint64_t reserved_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedThreadReservation);
+};
+
 }  // namespace diff_utils
 
 }  // namespace chromeos_update_engine
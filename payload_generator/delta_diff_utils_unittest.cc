@@ -21,14 +21,18 @@
 #include <string>
 #include <vector>
 
+#include <base/files/file_enumerator.h>
 #include <base/files/scoped_file.h>
+#include <base/files/scoped_temp_dir.h>
 #include <base/format_macros.h>
 #include <base/strings/stringprintf.h>
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/fake_filesystem.h"
@@ -377,6 +381,209 @@ TEST_F(DeltaDiffUtilsTest, ReplaceSmallTest) {
   }
 }
 
+TEST_F(DeltaDiffUtilsTest, ZeroDataIsNotDiffedTest) {
+  // The old block has data and the new one is all zeros, so no patch can be
+  // smaller than a ZERO operation.
+  vector<Extent> old_extents = { ExtentForRange(1, 1) };
+  vector<Extent> new_extents = { ExtentForRange(2, 1) };
+  EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize,
+                           brillo::Blob(kBlockSize, 'a')));
+
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(
+      old_part_.path,
+      new_part_.path,
+      old_extents,
+      new_extents,
+      {},  // old_deflates
+      {},  // new_deflates
+      PayloadVersion(kChromeOSMajorPayloadVersion,
+                     kBrotliBsdiffMinorPayloadVersion),
+      &data,
+      &op));
+  EXPECT_TRUE(data.empty());
+  EXPECT_EQ(InstallOperation::ZERO, op.type());
+  EXPECT_EQ(0, op.src_extents_size());
+  EXPECT_EQ(1, op.dst_extents_size());
+}
+
+TEST_F(DeltaDiffUtilsTest, DiffCacheTest) {
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+  ASSERT_TRUE(diff_utils::SetDiffCacheDir(cache_dir.GetPath().value()));
+
+  vector<Extent> old_extents = { ExtentForRange(1, 1) };
+  vector<Extent> new_extents = { ExtentForRange(2, 1) };
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize,
+                           brillo::Blob(kBlockSize, 1)));
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kInPlaceMinorPayloadVersion);
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                            new_part_.path,
+                                            old_extents,
+                                            new_extents,
+                                            {},  // old_deflates
+                                            {},  // new_deflates
+                                            version,
+                                            &data,
+                                            &op));
+  EXPECT_EQ(InstallOperation::REPLACE_BZ, op.type());
+
+  // The operation generated was stored in the cache, so changing the cache
+  // entry changes the operation generated for the same data.
+  base::FileEnumerator entries(
+      cache_dir.GetPath(), false, base::FileEnumerator::FILES);
+  base::FilePath entry = entries.Next();
+  ASSERT_FALSE(entry.empty());
+  EXPECT_TRUE(entries.Next().empty());
+  DiffCache cache(cache_dir.GetPath().value());
+  EXPECT_TRUE(cache.Store(
+      entry.BaseName().value(), InstallOperation::REPLACE, {1, 2, 3}));
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                            new_part_.path,
+                                            old_extents,
+                                            new_extents,
+                                            {},  // old_deflates
+                                            {},  // new_deflates
+                                            version,
+                                            &data,
+                                            &op));
+  EXPECT_EQ(InstallOperation::REPLACE, op.type());
+  EXPECT_EQ((brillo::Blob{1, 2, 3}), data);
+  EXPECT_EQ(1U, utils::BlocksInExtents(op.dst_extents()));
+
+  EXPECT_TRUE(diff_utils::SetDiffCacheDir(""));
+}
+
+TEST_F(DeltaDiffUtilsTest, SuffixArrayCacheTest) {
+  // The old data is big enough for its suffix array to be cached.
+  const uint64_t kNumBlocks = 96;
+  brillo::Blob old_data(kNumBlocks * kBlockSize);
+  test_utils::FillWithData(&old_data);
+  vector<Extent> extents = { ExtentForRange(0, kNumBlocks) };
+  EXPECT_TRUE(WriteExtents(old_part_.path, extents, kBlockSize, old_data));
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kInPlaceMinorPayloadVersion);
+
+  // Diffs the old data to a copy with the byte at |offset| changed.
+  auto diff = [&](size_t offset, brillo::Blob* data) {
+    brillo::Blob new_data = old_data;
+    new_data[offset]++;
+    EXPECT_TRUE(WriteExtents(new_part_.path, extents, kBlockSize, new_data));
+    InstallOperation op;
+    EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                              new_part_.path,
+                                              extents,
+                                              extents,
+                                              {},  // old_deflates
+                                              {},  // new_deflates
+                                              version,
+                                              data,
+                                              &op));
+  };
+
+  diff_utils::SetSuffixArrayCacheSize(64 * 1024 * 1024);
+  uint64_t hits = diff_utils::GetSuffixArrayCacheHits();
+  brillo::Blob data, cached_data, uncached_data;
+  diff(0, &data);
+  EXPECT_EQ(hits, diff_utils::GetSuffixArrayCacheHits());
+  diff(kBlockSize, &cached_data);
+  EXPECT_EQ(hits + 1, diff_utils::GetSuffixArrayCacheHits());
+
+  // The suffix array reused gives the same patch.
+  diff_utils::SetSuffixArrayCacheSize(0);
+  diff(kBlockSize, &uncached_data);
+  EXPECT_EQ(hits + 1, diff_utils::GetSuffixArrayCacheHits());
+  EXPECT_EQ(uncached_data, cached_data);
+  EXPECT_NE(data, cached_data);
+}
+
+TEST_F(DeltaDiffUtilsTest, BrotliQualityBudgetTest) {
+  // Random data doesn't compress, so the patch is smaller than any full
+  // operation.
+  brillo::Blob old_data;
+  std::mt19937 gen(12345);
+  std::uniform_int_distribution<uint8_t> dis(0, 255);
+  for (uint32_t i = 0; i < 32 * kBlockSize; i++)
+    old_data.push_back(dis(gen));
+  brillo::Blob new_data = old_data;
+  new_data[kBlockSize]++;
+  vector<Extent> extents = { ExtentForRange(0, 32) };
+  EXPECT_TRUE(WriteExtents(old_part_.path, extents, kBlockSize, old_data));
+  EXPECT_TRUE(WriteExtents(new_part_.path, extents, kBlockSize, new_data));
+  PayloadVersion version(kBrilloMajorPayloadVersion,
+                         kBrotliBsdiffMinorPayloadVersion);
+
+  auto diff = [&](brillo::Blob* data) {
+    InstallOperation op;
+    EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                              new_part_.path,
+                                              extents,
+                                              extents,
+                                              {},  // old_deflates
+                                              {},  // new_deflates
+                                              version,
+                                              data,
+                                              &op));
+    EXPECT_EQ(InstallOperation::BROTLI_BSDIFF, op.type());
+  };
+
+  brillo::Blob best_data, fast_data, budget_data;
+  diff(&best_data);
+  // The patch is bigger than the budget, so it uses the fast quality.
+  diff_utils::SetBrotliQualityBudget(1, 0);
+  diff(&fast_data);
+  EXPECT_NE(best_data, fast_data);
+  // It fits in a bigger budget.
+  diff_utils::SetBrotliQualityBudget(1024 * 1024, 0);
+  diff(&budget_data);
+  EXPECT_EQ(best_data, budget_data);
+  diff_utils::SetBrotliQualityBudget(0, 9);
+}
+
+TEST_F(DeltaDiffUtilsTest, ApplyMemoryBudgetTest) {
+  brillo::Blob old_data;
+  std::mt19937 gen(12345);
+  std::uniform_int_distribution<uint8_t> dis(0, 255);
+  for (uint32_t i = 0; i < 32 * kBlockSize; i++)
+    old_data.push_back(dis(gen));
+  brillo::Blob new_data = old_data;
+  new_data[kBlockSize]++;
+  vector<Extent> extents = { ExtentForRange(0, 32) };
+  EXPECT_TRUE(WriteExtents(old_part_.path, extents, kBlockSize, old_data));
+  EXPECT_TRUE(WriteExtents(new_part_.path, extents, kBlockSize, new_data));
+  PayloadVersion version(kBrilloMajorPayloadVersion,
+                         kBrotliBsdiffMinorPayloadVersion);
+
+  auto diff = [&]() {
+    brillo::Blob data;
+    InstallOperation op;
+    EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_part_.path,
+                                              new_part_.path,
+                                              extents,
+                                              extents,
+                                              {},  // old_deflates
+                                              {},  // new_deflates
+                                              version,
+                                              &data,
+                                              &op));
+    op.set_data_length(data.size());
+    return op;
+  };
+
+  EXPECT_EQ(InstallOperation::BROTLI_BSDIFF, diff().type());
+  // The brotli streams of the patch don't fit in the budget, but the
+  // uncompressed new data does.
+  diff_utils::SetApplyMemoryBudget(256 * 1024);
+  InstallOperation op = diff();
+  EXPECT_EQ(InstallOperation::REPLACE, op.type());
+  EXPECT_GE(256U * 1024, diff_utils::EstimateApplyMemory(op, kBlockSize));
+  diff_utils::SetApplyMemoryBudget(0);
+}
+
 TEST_F(DeltaDiffUtilsTest, SourceCopyTest) {
   // Makes sure SOURCE_COPY operations are emitted whenever src_ops_allowed
   // is true. It is the same setup as MoveSmallTest, which checks that
@@ -716,6 +923,310 @@ TEST_F(DeltaDiffUtilsTest, ShuffledBlocksAreTracked) {
   EXPECT_EQ(0, blob_size_);
 }
 
+TEST_F(DeltaDiffUtilsTest, BigFilesAreSplitInChunksTest) {
+  InitializePartitionWithUniqueBlocks(old_part_, block_size_, 42);
+  InitializePartitionWithUniqueBlocks(new_part_, block_size_, 5);
+  FakeFilesystem* new_fs =
+      static_cast<FakeFilesystem*>(new_part_.fs_interface.get());
+  new_fs->AddFile("small", {ExtentForRange(20, 2)});
+  new_fs->AddFile("big", {ExtentForRange(0, 6), ExtentForRange(30, 4)});
+
+  BlobFileWriter blob_file(blob_fd_, &blob_size_);
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  EXPECT_TRUE(diff_utils::DeltaReadPartition(&aops_,
+                                             old_part_,
+                                             new_part_,
+                                             4,     // hard_chunk_blocks
+                                             1024,  // soft_chunk_blocks
+                                             version,
+                                             &blob_file));
+
+  // The chunks of the big file are named as if it was processed at once, and
+  // the operations are kept in the files order.
+  vector<string> names;
+  for (const AnnotatedOperation& aop : aops_)
+    names.push_back(aop.name);
+  EXPECT_EQ((vector<string>{"small", "big:0", "big:1", "big:2",
+                            "<non-file-data>"}),
+            names);
+  vector<Extent> dst_extents;
+  ExtentsToVector(aops_[1].op.dst_extents(), &dst_extents);
+  EXPECT_EQ((vector<Extent>{ExtentForRange(0, 4)}), dst_extents);
+  ExtentsToVector(aops_[2].op.dst_extents(), &dst_extents);
+  EXPECT_EQ((vector<Extent>{ExtentForRange(4, 2), ExtentForRange(30, 2)}),
+            dst_extents);
+  ExtentsToVector(aops_[3].op.dst_extents(), &dst_extents);
+  EXPECT_EQ((vector<Extent>{ExtentForRange(32, 2)}), dst_extents);
+}
+
+TEST_F(DeltaDiffUtilsTest, PartitionCopyBlocksTest) {
+  old_part_.size = kBlockSize * 20;
+  new_part_.size = kBlockSize * 20;
+  PartitionConfig vendor_part("vendor");
+  CreatePartition(&vendor_part,
+                  "DeltaDiffUtilsTest-vendor_part-XXXXXX",
+                  block_size_,
+                  block_size_ * 10);
+  ScopedPathUnlinker vendor_unlinker(vendor_part.path);
+  EXPECT_TRUE(InitializePartitionWithUniqueBlocks(vendor_part, block_size_, 7));
+  EXPECT_TRUE(InitializePartitionWithUniqueBlocks(new_part_, block_size_, 42));
+
+  // The blocks 3 to 8 of the vendor partition are in the new partition from
+  // the block 10 on, and its block 0 in the block 17. They are also in the old
+  // version of the same partition, which isn't used for PARTITION_COPY.
+  brillo::Blob vendor_data;
+  EXPECT_TRUE(utils::ReadFile(vendor_part.path, &vendor_data));
+  brillo::Blob copied_data(vendor_data.begin() + 3 * kBlockSize,
+                           vendor_data.begin() + 9 * kBlockSize);
+  EXPECT_TRUE(WriteExtents(
+      new_part_.path, {ExtentForRange(10, 6)}, kBlockSize, copied_data));
+  EXPECT_TRUE(WriteExtents(
+      old_part_.path, {ExtentForRange(10, 6)}, kBlockSize, copied_data));
+  EXPECT_TRUE(WriteExtents(new_part_.path,
+                           {ExtentForRange(17, 1)},
+                           kBlockSize,
+                           brillo::Blob(vendor_data.begin(),
+                                        vendor_data.begin() + kBlockSize)));
+
+  SourceBlockIndex index(kBlockSize);
+  EXPECT_TRUE(index.AddPartitions({old_part_, vendor_part}));
+  // The block 12 already has an operation.
+  new_visited_blocks_.AddExtent(ExtentForRange(12, 1));
+  EXPECT_TRUE(diff_utils::DeltaPartitionCopyBlocks(&aops_,
+                                                   index,
+                                                   new_part_.name,
+                                                   new_part_.path,
+                                                   20,
+                                                   2,  // chunk_blocks
+                                                   &new_visited_blocks_));
+
+  const std::pair<uint64_t, uint64_t> kExpectedOps[][2] = {
+      {{3, 2}, {10, 2}},
+      {{6, 2}, {13, 2}},
+      {{8, 1}, {15, 1}},
+      {{0, 1}, {17, 1}}};
+  ASSERT_EQ(arraysize(kExpectedOps), aops_.size());
+  for (size_t i = 0; i < aops_.size(); i++) {
+    SCOPED_TRACE(base::StringPrintf("Failed on operation number %" PRIuS, i));
+    const InstallOperation& op = aops_[i].op;
+    EXPECT_EQ(InstallOperation::PARTITION_COPY, op.type());
+    EXPECT_EQ("vendor", op.src_partition_name());
+    ASSERT_EQ(1, op.src_extents_size());
+    EXPECT_EQ(ExtentForRange(kExpectedOps[i][0].first,
+                             kExpectedOps[i][0].second),
+              op.src_extents(0));
+    ASSERT_EQ(1, op.dst_extents_size());
+    EXPECT_EQ(ExtentForRange(kExpectedOps[i][1].first,
+                             kExpectedOps[i][1].second),
+              op.dst_extents(0));
+    brillo::Blob src_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        vendor_data.data() + kExpectedOps[i][0].first * kBlockSize,
+        kExpectedOps[i][0].second * kBlockSize,
+        &src_hash));
+    EXPECT_EQ(string(src_hash.begin(), src_hash.end()), op.src_sha256_hash());
+  }
+
+  ExtentRanges expected_ranges;
+  expected_ranges.AddExtent(ExtentForRange(10, 6));
+  expected_ranges.AddExtent(ExtentForRange(17, 1));
+  EXPECT_EQ(expected_ranges.extent_set(), new_visited_blocks_.extent_set());
+}
+
+TEST_F(DeltaDiffUtilsTest, SharedTargetPartitionsTest) {
+  InitializePartitionWithUniqueBlocks(old_part_, block_size_, 42);
+  InitializePartitionWithUniqueBlocks(new_part_, block_size_, 5);
+  FakeFilesystem* new_fs =
+      static_cast<FakeFilesystem*>(new_part_.fs_interface.get());
+  new_fs->AddFile("file", {ExtentForRange(0, 2)});
+  diff_utils::SetSharedTargetPartitions({new_part_});
+
+  BlobFileWriter blob_file(blob_fd_, &blob_size_);
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  EXPECT_TRUE(diff_utils::DeltaReadPartition(
+      &aops_, old_part_, new_part_, -1, 1024, version, &blob_file));
+
+  // The files of the shared target are only listed once, by the first payload
+  // generated to it.
+  new_fs->AddFile("other", {ExtentForRange(2, 2)});
+  vector<AnnotatedOperation> other_aops;
+  EXPECT_TRUE(diff_utils::DeltaReadPartition(
+      &other_aops, old_part_, new_part_, -1, 1024, version, &blob_file));
+  diff_utils::SetSharedTargetPartitions({});
+
+  vector<string> names;
+  for (const AnnotatedOperation& aop : other_aops)
+    names.push_back(aop.name);
+  EXPECT_EQ((vector<string>{"file", "<non-file-data>"}), names);
+}
+
+TEST_F(DeltaDiffUtilsTest, ContentDefinedChunksTest) {
+  // The new partition has the data of the old one with a few bytes inserted
+  // at the start.
+  brillo::Blob old_data(old_part_.size);
+  std::mt19937 gen(42);
+  for (uint8_t& byte : old_data)
+    byte = gen();
+  brillo::Blob new_data(old_data.begin(), old_data.begin() + 100);
+  new_data.insert(new_data.end(), old_data.begin(), old_data.end() - 100);
+  ASSERT_TRUE(test_utils::WriteFileVector(old_part_.path, old_data));
+  ASSERT_TRUE(test_utils::WriteFileVector(new_part_.path, new_data));
+  static_cast<FakeFilesystem*>(old_part_.fs_interface.get())
+      ->AddFile("big", {ExtentForRange(0, 64)});
+  static_cast<FakeFilesystem*>(new_part_.fs_interface.get())
+      ->AddFile("big", {ExtentForRange(0, 64)});
+
+  diff_utils::SetContentDefinedChunking(true);
+  BlobFileWriter blob_file(blob_fd_, &blob_size_);
+  PayloadVersion version(kChromeOSMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  EXPECT_TRUE(diff_utils::DeltaReadPartition(&aops_,
+                                             old_part_,
+                                             new_part_,
+                                             8,     // hard_chunk_blocks
+                                             1024,  // soft_chunk_blocks
+                                             version,
+                                             &blob_file));
+  diff_utils::SetContentDefinedChunking(false);
+
+  // The chunks of the file are still named in order and write the whole file,
+  // each of them reading the blocks of its old chunk.
+  ASSERT_LT(64U / 8, aops_.size());
+  ExtentRanges dst_blocks;
+  for (size_t i = 0; i + 1 < aops_.size(); i++) {
+    EXPECT_EQ(base::StringPrintf("big:%" PRIuS, i), aops_[i].name);
+    EXPECT_GE(8U, utils::BlocksInExtents(aops_[i].op.dst_extents()));
+    EXPECT_LT(0, aops_[i].op.src_extents_size());
+    dst_blocks.AddRepeatedExtents(aops_[i].op.dst_extents());
+  }
+  EXPECT_EQ("<non-file-data>", aops_.back().name);
+  EXPECT_EQ(64U, dst_blocks.blocks());
+  EXPECT_EQ(vector<Extent>{ExtentForRange(0, 64)},
+            dst_blocks.GetExtentsForBlockCount(64));
+}
+
+TEST_F(DeltaDiffUtilsTest, SetMaxThreadsTest) {
+  size_t default_max_threads = diff_utils::GetMaxThreads();
+  EXPECT_LE(4U, default_max_threads);
+
+  diff_utils::SetMaxThreads(1);
+  EXPECT_EQ(1U, diff_utils::GetMaxThreads());
+  {
+    // The only thread can be reserved.
+    diff_utils::ScopedThreadReservation reservation;
+  }
+  diff_utils::SetMaxThreads(0);
+  EXPECT_EQ(default_max_threads, diff_utils::GetMaxThreads());
+}
+
+TEST_F(DeltaDiffUtilsTest, IncompressibleDataSkipsBzipTest) {
+  brillo::Blob random_data;
+  std::mt19937 gen(12345);
+  std::uniform_int_distribution<uint8_t> dis(0, 255);
+  for (uint32_t i = 0; i < 32 * kBlockSize; i++)
+    random_data.push_back(dis(gen));
+  EXPECT_TRUE(diff_utils::IsLikelyIncompressible(random_data));
+  EXPECT_FALSE(diff_utils::IsLikelyIncompressible(
+      brillo::Blob(32 * kBlockSize, 'a')));
+  EXPECT_FALSE(diff_utils::IsLikelyIncompressible(brillo::Blob()));
+
+  // bzip2 is only skipped when xz is tried.
+  brillo::Blob blob;
+  InstallOperation_Type type;
+  uint64_t skipped_count = diff_utils::GetSkippedBzipCount();
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      random_data,
+      PayloadVersion(kChromeOSMajorPayloadVersion, kInPlaceMinorPayloadVersion),
+      &blob,
+      &type));
+  EXPECT_EQ(InstallOperation::REPLACE, type);
+  EXPECT_EQ(skipped_count, diff_utils::GetSkippedBzipCount());
+
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      random_data,
+      PayloadVersion(kBrilloMajorPayloadVersion,
+                     kBrotliBsdiffMinorPayloadVersion),
+      &blob,
+      &type));
+  EXPECT_EQ(InstallOperation::REPLACE, type);
+  EXPECT_EQ(random_data, blob);
+  EXPECT_EQ(skipped_count + 1, diff_utils::GetSkippedBzipCount());
+}
+
+TEST_F(DeltaDiffUtilsTest, GenerateBestFullOperationMovesReplaceDataTest) {
+  brillo::Blob random_data(32 * kBlockSize);
+  std::mt19937 gen(12345);
+  std::uniform_int_distribution<uint8_t> dis(0, 255);
+  for (uint8_t& byte : random_data)
+    byte = dis(gen);
+  brillo::Blob new_data = random_data;
+  const uint8_t* new_data_buffer = new_data.data();
+
+  // The data of a REPLACE is moved, not copied.
+  brillo::Blob blob;
+  InstallOperation_Type type;
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      std::move(new_data),
+      PayloadVersion(kBrilloMajorPayloadVersion, kZstdMinorPayloadVersion),
+      &blob,
+      &type,
+      nullptr));
+  EXPECT_EQ(InstallOperation::REPLACE, type);
+  EXPECT_EQ(random_data, blob);
+  EXPECT_EQ(new_data_buffer, blob.data());
+
+  // The compressed data is produced as before.
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      brillo::Blob(32 * kBlockSize, 'a'),
+      PayloadVersion(kBrilloMajorPayloadVersion, kZstdMinorPayloadVersion),
+      &blob,
+      &type,
+      nullptr));
+  EXPECT_EQ(InstallOperation::REPLACE_ZSTD, type);
+  EXPECT_LT(blob.size(), 32 * kBlockSize);
+}
+
+TEST_F(DeltaDiffUtilsTest, ZstdOnlyAllowedInNewMinorVersionTest) {
+  brillo::Blob data(32 * kBlockSize, 'a');
+  brillo::Blob blob;
+  InstallOperation_Type type;
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      data,
+      PayloadVersion(kBrilloMajorPayloadVersion, kPuffdiffMinorPayloadVersion),
+      &blob,
+      &type));
+  EXPECT_NE(InstallOperation::REPLACE_ZSTD, type);
+  EXPECT_NE(InstallOperation::REPLACE, type);
+
+  EXPECT_TRUE(diff_utils::GenerateBestFullOperation(
+      data,
+      PayloadVersion(kBrilloMajorPayloadVersion, kZstdMinorPayloadVersion),
+      &blob,
+      &type));
+  EXPECT_EQ(InstallOperation::REPLACE_ZSTD, type);
+  EXPECT_LT(blob.size(), data.size());
+}
+
+TEST_F(DeltaDiffUtilsTest, EstimateApplyMemoryTest) {
+  InstallOperation op;
+  op.set_type(InstallOperation::SOURCE_COPY);
+  *op.add_dst_extents() = ExtentForRange(0, 1024);
+  EXPECT_EQ(0U, diff_utils::EstimateApplyMemory(op, 4096));
+
+  // The dictionary of the small data is smaller.
+  op.set_type(InstallOperation::REPLACE_XZ);
+  op.set_data_length(1000);
+  EXPECT_EQ(1000U + 1024 * 4096, diff_utils::EstimateApplyMemory(op, 4096));
+  *op.add_dst_extents() = ExtentForRange(2048, 2048);
+  EXPECT_EQ(1000U + 8 * 1024 * 1024,
+            diff_utils::EstimateApplyMemory(op, 4096));
+
+  op.set_type(InstallOperation::MOVE);
+  EXPECT_EQ(1000U + 3072 * 4096, diff_utils::EstimateApplyMemory(op, 4096));
+}
+
 TEST_F(DeltaDiffUtilsTest, IsExtFilesystemTest) {
   EXPECT_TRUE(diff_utils::IsExtFilesystem(
       test_utils::GetBuildArtifactsPath("gen/disk_ext2_1k.img")));
@@ -0,0 +1,314 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks how the stages of the payload generation scale with the number
+// of threads returned by diff_utils::GetMaxThreads(). Each stage runs over the
+// --old_image and --new_image partitions with every thread count in
+// --threads, and the time, the speedup over the first thread count and the
+// peak RSS are printed as CSV.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/time/time.h>
+#include <brillo/flag_helper.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/ab_generator.h"
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/block_mapping.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/full_update_generator.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/xz.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The stages of the generation measured, in the order they run.
+enum Stage {
+  kMapPartitionBlocks,
+  kDeltaReadPartition,
+  kFragmentOperations,
+  kMergeOperations,
+  kFullUpdateGenerator,
+  kNumStages,
+};
+
+const char* const kStageNames[kNumStages] = {
+    "MapPartitionBlocks",
+    "DeltaReadPartition",
+    "FragmentOperations",
+    "MergeOperations",
+    "FullUpdateGenerator",
+};
+
+// The result of a benchmark run with one thread count, passed from the child
+// process running it to the parent.
+struct BenchmarkResult {
+  // The fastest time of each stage over the iterations, in microseconds.
+  int64_t stage_us[kNumStages];
+  // The peak RSS of the process running the stages, in KiB.
+  int64_t max_rss_kb;
+};
+
+// Runs every stage once, generating the operations from |old_part| to
+// |new_part| into |blob_file|, and lowers the times in |stage_times| to the
+// time each stage took if it was faster.
+bool RunStages(const PayloadGenerationConfig& config,
+               const PartitionConfig& old_part,
+               const PartitionConfig& new_part,
+               BlobFileWriter* blob_file,
+               base::TimeDelta stage_times[kNumStages]) {
+  base::TimeTicks start;
+  auto end_stage = [&start, stage_times](Stage stage) {
+    base::TimeTicks now = base::TimeTicks::Now();
+    stage_times[stage] = std::min(stage_times[stage], now - start);
+    start = now;
+  };
+
+  start = base::TimeTicks::Now();
+  vector<BlockMapping::BlockId> old_block_ids, new_block_ids;
+  TEST_AND_RETURN_FALSE(MapPartitionBlocks(old_part.path,
+                                           new_part.path,
+                                           old_part.size,
+                                           new_part.size,
+                                           config.block_size,
+                                           &old_block_ids,
+                                           &new_block_ids));
+  end_stage(kMapPartitionBlocks);
+
+  // The same chunk sizes as the ABGenerator.
+  ssize_t hard_chunk_blocks = (config.hard_chunk_size == -1 ? -1 :
+                               config.hard_chunk_size / config.block_size);
+  size_t soft_chunk_blocks = config.soft_chunk_size / config.block_size;
+  vector<AnnotatedOperation> aops;
+  TEST_AND_RETURN_FALSE(diff_utils::DeltaReadPartition(&aops,
+                                                       old_part,
+                                                       new_part,
+                                                       hard_chunk_blocks,
+                                                       soft_chunk_blocks,
+                                                       config.version,
+                                                       blob_file));
+  end_stage(kDeltaReadPartition);
+
+  TEST_AND_RETURN_FALSE(ABGenerator::FragmentOperations(
+      config.version, &aops, new_part.path, blob_file));
+  end_stage(kFragmentOperations);
+
+  ABGenerator::SortOperationsByDestination(&aops);
+  start = base::TimeTicks::Now();
+  TEST_AND_RETURN_FALSE(ABGenerator::MergeOperations(
+      &aops, config.version, soft_chunk_blocks, new_part.path, blob_file));
+  end_stage(kMergeOperations);
+
+  FullUpdateGenerator full_generator;
+  TEST_AND_RETURN_FALSE(
+      full_generator.GenerateOperations(config,
+                                        PartitionConfig(new_part.name),
+                                        new_part,
+                                        blob_file,
+                                        &aops));
+  end_stage(kFullUpdateGenerator);
+  return true;
+}
+
+// Runs the stages |iterations| times with at most |threads| threads and
+// stores in |result| the fastest time of each one.
+bool RunBenchmark(const string& old_image,
+                  const string& new_image,
+                  size_t threads,
+                  int iterations,
+                  BenchmarkResult* result) {
+  diff_utils::SetMaxThreads(threads);
+
+  PayloadGenerationConfig config;
+  config.is_delta = true;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.version.minor = DeltaPerformer::kSupportedMinorPayloadVersion;
+  PartitionConfig old_part(kLegacyPartitionNameRoot);
+  old_part.path = old_image;
+  old_part.size = utils::FileSize(old_image);
+  PartitionConfig new_part(kLegacyPartitionNameRoot);
+  new_part.path = new_image;
+  new_part.size = utils::FileSize(new_image);
+  TEST_AND_RETURN_FALSE(old_part.OpenFilesystem());
+  TEST_AND_RETURN_FALSE(new_part.OpenFilesystem());
+
+  string blob_path;
+  int blob_fd = -1;
+  TEST_AND_RETURN_FALSE(
+      utils::MakeTempFile("GeneratorBlobs.XXXXXX", &blob_path, &blob_fd));
+  ScopedPathUnlinker blob_unlinker(blob_path);
+  ScopedFdCloser blob_fd_closer(&blob_fd);
+
+  base::TimeDelta stage_times[kNumStages];
+  std::fill(std::begin(stage_times),
+            std::end(stage_times),
+            base::TimeDelta::Max());
+  for (int i = 0; i < iterations; i++) {
+    off_t blob_size = 0;
+    BlobFileWriter blob_file(blob_fd, &blob_size);
+    TEST_AND_RETURN_FALSE(
+        RunStages(config, old_part, new_part, &blob_file, stage_times));
+    TEST_AND_RETURN_FALSE_ERRNO(ftruncate(blob_fd, 0) == 0);
+  }
+
+  for (int stage = 0; stage < kNumStages; stage++)
+    result->stage_us[stage] = stage_times[stage].InMicroseconds();
+  struct rusage usage;
+  TEST_AND_RETURN_FALSE_ERRNO(getrusage(RUSAGE_SELF, &usage) == 0);
+  result->max_rss_kb = usage.ru_maxrss;
+  return true;
+}
+
+// Runs RunBenchmark() in a child process, so the peak RSS measured only
+// includes the memory used with |threads| threads, and stores its result in
+// |result|.
+bool RunBenchmarkInChildProcess(const string& old_image,
+                                const string& new_image,
+                                size_t threads,
+                                int iterations,
+                                BenchmarkResult* result) {
+  int pipe_fds[2];
+  TEST_AND_RETURN_FALSE_ERRNO(pipe(pipe_fds) == 0);
+  pid_t pid = fork();
+  if (pid < 0) {
+    PLOG(ERROR) << "Failed to fork";
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(pipe_fds[0]);
+    bool success =
+        RunBenchmark(old_image, new_image, threads, iterations, result) &&
+        utils::WriteAll(pipe_fds[1], result, sizeof(*result));
+    _exit(success ? 0 : 1);
+  }
+  close(pipe_fds[1]);
+  ScopedFdCloser read_fd_closer(&pipe_fds[0]);
+  size_t bytes_read = 0;
+  bool eof = false;
+  bool read_success =
+      utils::ReadAll(pipe_fds[0], result, sizeof(*result), &bytes_read, &eof);
+  int status;
+  TEST_AND_RETURN_FALSE_ERRNO(HANDLE_EINTR(waitpid(pid, &status, 0)) == pid);
+  TEST_AND_RETURN_FALSE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  TEST_AND_RETURN_FALSE(read_success && bytes_read == sizeof(*result));
+  return true;
+}
+
+int Main(int argc, char** argv) {
+  DEFINE_string(old_image,
+                "",
+                "Path to the old partition image, like the images in "
+                "sample_images/sample_images.tar.bz2.");
+  DEFINE_string(new_image, "", "Path to the new partition image.");
+  DEFINE_string(threads,
+                "1,2,4,8",
+                "Comma separated list of the thread counts to benchmark. The "
+                "speedups are relative to the first one.");
+  DEFINE_int32(iterations,
+               1,
+               "Number of times the stages run with each thread count. The "
+               "fastest time is reported.");
+
+  brillo::FlagHelper::Init(argc, argv,
+      "Benchmarks how the stages of the payload generation scale with the "
+      "number of threads.");
+  logging::LoggingSettings log_settings;
+  log_settings.logging_dest = logging::LOG_TO_SYSTEM_DEBUG_LOG;
+  logging::InitLogging(log_settings);
+  XzCompressInit();
+
+  if (FLAGS_old_image.empty() || FLAGS_new_image.empty() ||
+      FLAGS_iterations <= 0) {
+    LOG(ERROR) << "--old_image, --new_image and a positive --iterations are "
+               << "required.";
+    return 1;
+  }
+  vector<size_t> thread_counts;
+  for (const string& count : base::SplitString(FLAGS_threads,
+                                               ",",
+                                               base::TRIM_WHITESPACE,
+                                               base::SPLIT_WANT_NONEMPTY)) {
+    size_t threads;
+    if (!base::StringToSizeT(count, &threads) || threads == 0) {
+      LOG(ERROR) << "Invalid thread count " << count;
+      return 1;
+    }
+    thread_counts.push_back(threads);
+  }
+  if (thread_counts.empty()) {
+    LOG(ERROR) << "No thread count given in --threads.";
+    return 1;
+  }
+
+  vector<BenchmarkResult> results(thread_counts.size());
+  for (size_t i = 0; i < thread_counts.size(); i++) {
+    if (!RunBenchmarkInChildProcess(FLAGS_old_image,
+                                    FLAGS_new_image,
+                                    thread_counts[i],
+                                    FLAGS_iterations,
+                                    &results[i])) {
+      LOG(ERROR) << "The benchmark failed with " << thread_counts[i]
+                 << " threads.";
+      return 1;
+    }
+  }
+
+  printf("stage,threads,seconds,speedup,peak_rss_kib\n");
+  for (int stage = 0; stage < kNumStages; stage++) {
+    for (size_t i = 0; i < thread_counts.size(); i++) {
+      printf("%s,%zu,%.3f,%.2f,%" PRId64 "\n",
+             kStageNames[stage],
+             thread_counts[i],
+             results[i].stage_us[stage] / 1e6,
+             static_cast<double>(results[0].stage_us[stage]) /
+                 std::max(results[i].stage_us[stage], int64_t{1}),
+             results[i].max_rss_kb);
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  return chromeos_update_engine::Main(argc, argv);
+}
@@ -0,0 +1,90 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/diff_cache.h"
+
+#include <endian.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <base/files/file_path.h>
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The entries start with the operation type, as a big endian 32-bit number,
+// followed by the blob.
+const size_t kEntryHeaderSize = sizeof(uint32_t);
+
+}  // namespace
+
+bool DiffCache::Lookup(const string& key,
+                       InstallOperation_Type* type,
+                       brillo::Blob* blob) const {
+  brillo::Blob entry;
+  if (!utils::ReadFile(GetEntryPath(key), &entry))
+    return false;
+  if (entry.size() < kEntryHeaderSize) {
+    LOG(WARNING) << "Ignoring truncated diff cache entry " << key;
+    return false;
+  }
+  uint32_t type_be;
+  memcpy(&type_be, entry.data(), kEntryHeaderSize);
+  uint32_t entry_type = be32toh(type_be);
+  if (!InstallOperation_Type_IsValid(entry_type)) {
+    LOG(WARNING) << "Ignoring diff cache entry " << key
+                 << " with invalid type " << entry_type;
+    return false;
+  }
+  *type = static_cast<InstallOperation_Type>(entry_type);
+  blob->assign(entry.begin() + kEntryHeaderSize, entry.end());
+  return true;
+}
+
+bool DiffCache::Store(const string& key,
+                      InstallOperation_Type type,
+                      const brillo::Blob& blob) const {
+  brillo::Blob entry(kEntryHeaderSize);
+  uint32_t type_be = htobe32(type);
+  memcpy(entry.data(), &type_be, kEntryHeaderSize);
+  entry.insert(entry.end(), blob.begin(), blob.end());
+
+  // The entry is written to a temporary file first and then renamed, so other
+  // processes never read a partially written entry.
+  string temp_path;
+  TEST_AND_RETURN_FALSE(utils::MakeTempFile(
+      GetEntryPath(key) + ".XXXXXX", &temp_path, nullptr));
+  if (!utils::WriteFile(temp_path.c_str(), entry.data(), entry.size()) ||
+      rename(temp_path.c_str(), GetEntryPath(key).c_str()) != 0) {
+    PLOG(ERROR) << "Unable to store the diff cache entry " << key;
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+string DiffCache::GetEntryPath(const string& key) const {
+  return base::FilePath(dir_).Append(key).value();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
+
+#include <string>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// DiffCache stores on disk the operation type and blob chosen to encode some
+// data, so payloads generated later from the same source and target data
+// don't need to diff it again. The entries are stored in a directory, one file
+// per key, and can be shared by several processes generating payloads at the
+// same time. The keys must identify everything the encoding depends on.
+class DiffCache {
+ public:
+  // Creates a cache stored in the directory |dir|, an absolute path which must
+  // exist.
+  explicit DiffCache(const std::string& dir) : dir_(dir) {}
+
+  // Looks up the entry stored with |key|. Returns whether it was found, in
+  // which case its operation type and blob are stored in |type| and |blob|.
+  bool Lookup(const std::string& key,
+              InstallOperation_Type* type,
+              brillo::Blob* blob) const;
+
+  // Stores the operation |type| and |blob| with |key|, replacing any previous
+  // entry. Returns whether it succeeded.
+  bool Store(const std::string& key,
+             InstallOperation_Type type,
+             const brillo::Blob& blob) const;
+
+ private:
+  // Returns the path of the file storing the entry with |key|.
+  std::string GetEntryPath(const std::string& key) const;
+
+  std::string dir_;
+
+  DISALLOW_COPY_AND_ASSIGN(DiffCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/diff_cache.h"
+
+#include <string>
+
+#include <base/files/file_path.h>
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class DiffCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(temp_dir_.CreateUniqueTempDir()); }
+
+  base::ScopedTempDir temp_dir_;
+};
+
+TEST_F(DiffCacheTest, StoreAndLookupTest) {
+  DiffCache cache(temp_dir_.GetPath().value());
+  InstallOperation_Type type;
+  brillo::Blob blob;
+  EXPECT_FALSE(cache.Lookup("key", &type, &blob));
+
+  EXPECT_TRUE(cache.Store("key", InstallOperation::BROTLI_BSDIFF, {1, 2, 3}));
+  EXPECT_TRUE(cache.Lookup("key", &type, &blob));
+  EXPECT_EQ(InstallOperation::BROTLI_BSDIFF, type);
+  EXPECT_EQ((brillo::Blob{1, 2, 3}), blob);
+  EXPECT_FALSE(cache.Lookup("other-key", &type, &blob));
+
+  // A new entry replaces the previous one, and is seen by other caches in the
+  // same directory.
+  EXPECT_TRUE(cache.Store("key", InstallOperation::ZERO, {}));
+  DiffCache other_cache(temp_dir_.GetPath().value());
+  EXPECT_TRUE(other_cache.Lookup("key", &type, &blob));
+  EXPECT_EQ(InstallOperation::ZERO, type);
+  EXPECT_TRUE(blob.empty());
+}
+
+TEST_F(DiffCacheTest, InvalidEntryTest) {
+  DiffCache cache(temp_dir_.GetPath().value());
+  InstallOperation_Type type;
+  brillo::Blob blob;
+  EXPECT_TRUE(test_utils::WriteFileString(
+      temp_dir_.GetPath().Append("truncated").value(), "ab"));
+  EXPECT_FALSE(cache.Lookup("truncated", &type, &blob));
+  EXPECT_TRUE(test_utils::WriteFileString(
+      temp_dir_.GetPath().Append("invalid-type").value(), "\xff\xff\xff\xff"));
+  EXPECT_FALSE(cache.Lookup("invalid-type", &type, &blob));
+}
+
+}  // namespace chromeos_update_engine
@@ -83,6 +83,58 @@ int AddMetadataBlocks(ext2_filsys fs,
   return 0;
 }
 
+// Appends the blocks of the extent-mapped inode |ino| to |extents|, walking its
+// extent tree once and adding a whole leaf extent at a time instead of calling
+// back for every block as ext2fs_block_iterate2() does. The blocks holding the
+// interior nodes of the tree, which are the inode metadata blocks, are added to
+// |metadata_blocks| in the same pass.
+errcode_t ProcessInodeExtents(ext2_filsys fs,
+                              ext2_ino_t ino,
+                              ext2_inode* inode,
+                              vector<Extent>* extents,
+                              set<uint64_t>* metadata_blocks) {
+  ext2_extent_handle_t handle;
+  errcode_t error = ext2fs_extent_open2(fs, ino, inode, &handle);
+  if (error)
+    return error;
+
+  ext2fs_extent extent;
+  int op = EXT2_EXTENT_ROOT;
+  while (true) {
+    error = ext2fs_extent_get(handle, op, &extent);
+    op = EXT2_EXTENT_NEXT;
+    if (error == EXT2_ET_EXTENT_NO_NEXT) {
+      error = 0;
+      break;
+    }
+    if (error)
+      break;
+
+    if (!(extent.e_flags & EXT2_EXTENT_FLAGS_LEAF)) {
+      // An index entry points to the block with the next level of the tree.
+      // Each of them is visited twice, before and after its children.
+      if (!(extent.e_flags & EXT2_EXTENT_FLAGS_SECOND_VISIT))
+        metadata_blocks->insert(extent.e_pblk);
+      continue;
+    }
+    if (extent.e_len == 0)
+      continue;
+
+    // Uninitialized extents are allocated to the file too, so they are
+    // reported like ext2fs_block_iterate2() does.
+    if (!extents->empty() &&
+        extents->back().start_block() + extents->back().num_blocks() ==
+            extent.e_pblk) {
+      extents->back().set_num_blocks(extents->back().num_blocks() +
+                                     extent.e_len);
+    } else {
+      extents->push_back(ExtentForRange(extent.e_pblk, extent.e_len));
+    }
+  }
+  ext2fs_extent_free(handle);
+  return error;
+}
+
 struct UpdateFileAndAppendState {
   std::map<ext2_ino_t, FilesystemInterface::File>* inodes = nullptr;
   set<ext2_ino_t>* used_inodes = nullptr;
@@ -219,6 +271,20 @@ bool Ext2Filesystem::GetFiles(vector<File>* files) const {
     if (!ext2fs_inode_has_valid_blocks(&it_inode))
       continue;
 
+    // The files with an extent tree are processed one extent at a time. The
+    // reserved inodes are left to ext2fs_block_iterate2() below since all
+    // their blocks, including the tree ones, are listed as their data.
+    if (it_ino >= EXT2_GOOD_OLD_FIRST_INO &&
+        (it_inode.i_flags & EXT4_EXTENTS_FL)) {
+      error = ProcessInodeExtents(
+          filsys_, it_ino, &it_inode, &file.extents, &inode_blocks);
+      if (error) {
+        LOG(ERROR) << "Failed to enumerate inode " << it_ino
+                   << " extents (" << error << ")";
+      }
+      continue;
+    }
+
     // Process the inode data and metadata blocks.
     // For normal files, inode blocks are indirect, double indirect
     // and triple indirect blocks (no data blocks). For directories and
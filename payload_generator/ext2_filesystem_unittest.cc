@@ -100,7 +100,8 @@ TEST_F(Ext2FilesystemTest, EmptyFilesystem) {
 TEST_F(Ext2FilesystemTest, ParseGeneratedImages) {
   const vector<string> kGeneratedImages = {
       "disk_ext2_1k.img",
-      "disk_ext2_4k.img" };
+      "disk_ext2_4k.img",
+      "disk_ext4_4k.img" };
   base::FilePath build_path = GetBuildArtifactsPath().Append("gen");
   for (const string& fs_name : kGeneratedImages) {
     LOG(INFO) << "Testing " << fs_name;
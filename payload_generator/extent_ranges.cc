@@ -17,6 +17,7 @@
 #include "update_engine/payload_generator/extent_ranges.h"
 
 #include <algorithm>
+#include <iterator>
 #include <set>
 #include <utility>
 #include <vector>
@@ -81,23 +82,23 @@ void ExtentRanges::AddExtent(Extent extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
-  ExtentSet::iterator begin_del = extent_set_.end();
-  ExtentSet::iterator end_del = extent_set_.end();
+  // The extents in the set don't overlap or touch each other, so only the
+  // extent before the first one starting at or after |extent| and the ones
+  // following it up to the end of |extent| can be merged with it.
+  ExtentSet::iterator begin_del = extent_set_.lower_bound(extent);
+  if (begin_del != extent_set_.begin() &&
+      ExtentsOverlapOrTouch(*std::prev(begin_del), extent)) {
+    --begin_del;
+  }
+  ExtentSet::iterator end_del = begin_del;
   uint64_t del_blocks = 0;
-  for (ExtentSet::iterator it = extent_set_.begin(), e = extent_set_.end();
-       it != e; ++it) {
-    if (ExtentsOverlapOrTouch(*it, extent)) {
-      end_del = it;
-      ++end_del;
-      del_blocks += it->num_blocks();
-      if (begin_del == extent_set_.end())
-        begin_del = it;
-
-      extent = UnionOverlappingExtents(extent, *it);
-    }
+  for (; end_del != extent_set_.end() &&
+         ExtentsOverlapOrTouch(*end_del, extent);
+       ++end_del) {
+    del_blocks += end_del->num_blocks();
+    extent = UnionOverlappingExtents(extent, *end_del);
   }
-  extent_set_.erase(begin_del, end_del);
-  extent_set_.insert(extent);
+  extent_set_.insert(extent_set_.erase(begin_del, end_del), extent);
   blocks_ -= del_blocks;
   blocks_ += extent.num_blocks();
 }
@@ -124,23 +125,21 @@ void ExtentRanges::SubtractExtent(const Extent& extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
-  ExtentSet::iterator begin_del = extent_set_.end();
-  ExtentSet::iterator end_del = extent_set_.end();
+  // Like in AddExtent(), only the extents around |extent| need to be looked
+  // at.
+  ExtentSet::iterator begin_del = extent_set_.lower_bound(extent);
+  if (begin_del != extent_set_.begin() &&
+      ExtentsOverlap(*std::prev(begin_del), extent)) {
+    --begin_del;
+  }
+  ExtentSet::iterator end_del = begin_del;
   uint64_t del_blocks = 0;
   ExtentSet new_extents;
-  for (ExtentSet::iterator it = extent_set_.begin(), e = extent_set_.end();
-       it != e; ++it) {
-    if (!ExtentsOverlap(*it, extent))
-      continue;
+  for (; end_del != extent_set_.end() && ExtentsOverlap(*end_del, extent);
+       ++end_del) {
+    del_blocks += end_del->num_blocks();
 
-    if (begin_del == extent_set_.end())
-      begin_del = it;
-    end_del = it;
-    ++end_del;
-
-    del_blocks += it->num_blocks();
-
-    ExtentSet subtraction = SubtractOverlappingExtents(*it, extent);
+    ExtentSet subtraction = SubtractOverlappingExtents(*end_del, extent);
     for (ExtentSet::iterator jt = subtraction.begin(), je = subtraction.end();
          jt != je; ++jt) {
       new_extents.insert(*jt);
@@ -153,6 +152,11 @@ void ExtentRanges::SubtractExtent(const Extent& extent) {
 }
 
 void ExtentRanges::AddRanges(const ExtentRanges& ranges) {
+  if (extent_set_.empty()) {
+    extent_set_ = ranges.extent_set_;
+    blocks_ = ranges.blocks_;
+    return;
+  }
   for (ExtentSet::const_iterator it = ranges.extent_set_.begin(),
            e = ranges.extent_set_.end(); it != e; ++it) {
     AddExtent(*it);
@@ -195,20 +199,12 @@ void ExtentRanges::SubtractRepeatedExtents(
 }
 
 bool ExtentRanges::ContainsBlock(uint64_t block) const {
-  auto lower = extent_set_.lower_bound(ExtentForRange(block, 1));
-  // The block could be on the extent before the one in |lower|.
-  if (lower != extent_set_.begin())
-    lower--;
-  // Any extent starting at block+1 or later is not interesting, so this is the
-  // upper limit.
-  auto upper = extent_set_.lower_bound(ExtentForRange(block + 1, 0));
-  for (auto iter = lower; iter != upper; ++iter) {
-    if (iter->start_block() <= block &&
-        block < iter->start_block() + iter->num_blocks()) {
-      return true;
-    }
-  }
-  return false;
+  // Only the last extent starting at or before |block| can contain it.
+  auto iter = extent_set_.upper_bound(ExtentForRange(block, 1));
+  if (iter == extent_set_.begin())
+    return false;
+  --iter;
+  return block < iter->start_block() + iter->num_blocks();
 }
 
 void ExtentRanges::Dump() const {
@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_generator/extent_ranges.h"
 
+#include <algorithm>
+#include <iterator>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -287,6 +289,43 @@ TEST(ExtentRangesTest, ContainsBlockTest) {
   EXPECT_FALSE(ranges.ContainsBlock(101));
 }
 
+TEST(ExtentRangesTest, MatchesBlockBitmapTest) {
+  // Adds and subtracts many overlapping extents and compares the result with
+  // the same operations done on a bitmap of blocks.
+  const uint64_t kNumBlocks = 1000;
+  ExtentRanges ranges;
+  vector<bool> bitmap(kNumBlocks, false);
+  uint64_t seed = 1;
+  for (int i = 0; i < 2000; i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint64_t start = (seed >> 33) % kNumBlocks;
+    uint64_t num_blocks = 1 + (seed >> 20) % std::min<uint64_t>(
+                                  20, kNumBlocks - start);
+    bool add = (seed >> 13) % 3 != 0;
+    if (add)
+      ranges.AddExtent(ExtentForRange(start, num_blocks));
+    else
+      ranges.SubtractExtent(ExtentForRange(start, num_blocks));
+    for (uint64_t block = start; block < start + num_blocks; block++)
+      bitmap[block] = add;
+  }
+
+  uint64_t blocks = 0;
+  for (uint64_t block = 0; block < kNumBlocks; block++) {
+    EXPECT_EQ(bitmap[block], ranges.ContainsBlock(block)) << "block " << block;
+    blocks += bitmap[block];
+  }
+  EXPECT_EQ(blocks, ranges.blocks());
+
+  // The extents in the set never overlap or touch.
+  const ExtentRanges::ExtentSet& extent_set = ranges.extent_set();
+  for (auto it = extent_set.begin(); it != extent_set.end(); ++it) {
+    auto next = std::next(it);
+    if (next != extent_set.end())
+      EXPECT_LT(it->start_block() + it->num_blocks(), next->start_block());
+  }
+}
+
 TEST(ExtentRangesTest, FilterExtentRangesEmptyRanges) {
   ExtentRanges ranges;
   EXPECT_EQ(vector<Extent>(),
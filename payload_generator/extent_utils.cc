@@ -56,21 +56,31 @@ void AppendBlockToExtents(vector<Extent>* extents, uint64_t block) {
 void ExtendExtents(
     google::protobuf::RepeatedPtrField<Extent>* extents,
     const google::protobuf::RepeatedPtrField<Extent>& extents_to_add) {
-  vector<Extent> extents_vector;
-  vector<Extent> extents_to_add_vector;
-  ExtentsToVector(*extents, &extents_vector);
-  ExtentsToVector(extents_to_add, &extents_to_add_vector);
-  extents_vector.insert(extents_vector.end(),
-                        extents_to_add_vector.begin(),
-                        extents_to_add_vector.end());
-  NormalizeExtents(&extents_vector);
-  extents->Clear();
-  StoreExtents(extents_vector, extents);
+  extents->MergeFrom(extents_to_add);
+  // Normalize the extents in place, without copying them to a vector.
+  int num_extents = 0;
+  for (int i = 0; i < extents->size(); i++) {
+    const Extent& curr_ext = extents->Get(i);
+    if (num_extents > 0) {
+      Extent* last_ext = extents->Mutable(num_extents - 1);
+      if (last_ext->start_block() + last_ext->num_blocks() ==
+          curr_ext.start_block()) {
+        last_ext->set_num_blocks(last_ext->num_blocks() +
+                                 curr_ext.num_blocks());
+        continue;
+      }
+    }
+    if (num_extents != i)
+      extents->SwapElements(num_extents, i);
+    num_extents++;
+  }
+  extents->DeleteSubrange(num_extents, extents->size() - num_extents);
 }
 
 // Stores all Extents in 'extents' into 'out'.
 void StoreExtents(const vector<Extent>& extents,
                   google::protobuf::RepeatedPtrField<Extent>* out) {
+  out->Reserve(out->size() + extents.size());
   for (const Extent& extent : extents) {
     Extent* new_extent = out->Add();
     *new_extent = extent;
@@ -81,6 +91,7 @@ void StoreExtents(const vector<Extent>& extents,
 void ExtentsToVector(const google::protobuf::RepeatedPtrField<Extent>& extents,
                      vector<Extent>* out_vector) {
   out_vector->clear();
+  out_vector->reserve(extents.size());
   for (int i = 0; i < extents.size(); i++) {
     out_vector->push_back(extents.Get(i));
   }
@@ -96,23 +107,26 @@ string ExtentsToString(const vector<Extent>& extents) {
 }
 
 void NormalizeExtents(vector<Extent>* extents) {
-  vector<Extent> new_extents;
-  for (const Extent& curr_ext : *extents) {
-    if (new_extents.empty()) {
-      new_extents.push_back(curr_ext);
-      continue;
-    }
-    Extent& last_ext = new_extents.back();
-    if (last_ext.start_block() + last_ext.num_blocks() ==
-        curr_ext.start_block()) {
-      // If the extents are touching, we want to combine them.
-      last_ext.set_num_blocks(last_ext.num_blocks() + curr_ext.num_blocks());
-    } else {
-      // Otherwise just include the extent as is.
-      new_extents.push_back(curr_ext);
+  // The extents are combined in place: the first |num_extents| of them are
+  // the normalized ones.
+  size_t num_extents = 0;
+  for (size_t i = 0; i < extents->size(); i++) {
+    const Extent& curr_ext = (*extents)[i];
+    if (num_extents > 0) {
+      Extent& last_ext = (*extents)[num_extents - 1];
+      if (last_ext.start_block() + last_ext.num_blocks() ==
+          curr_ext.start_block()) {
+        // If the extents are touching, we want to combine them.
+        last_ext.set_num_blocks(last_ext.num_blocks() + curr_ext.num_blocks());
+        continue;
+      }
     }
+    // Otherwise just include the extent as is.
+    if (num_extents != i)
+      (*extents)[num_extents].Swap(&(*extents)[i]);
+    num_extents++;
   }
-  *extents = new_extents;
+  extents->resize(num_extents);
 }
 
 vector<Extent> ExtentsSublist(const vector<Extent>& extents,
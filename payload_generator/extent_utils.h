@@ -37,6 +37,10 @@ void AppendBlockToExtents(std::vector<Extent>* extents, uint64_t block);
 template<typename T>
 std::vector<uint64_t> ExpandExtents(const T& extents) {
   std::vector<uint64_t> ret;
+  uint64_t num_blocks = 0;
+  for (const auto& extent : extents)
+    num_blocks += extent.num_blocks();
+  ret.reserve(num_blocks);
   for (const auto& extent : extents) {
     if (extent.start_block() == kSparseHole) {
       ret.resize(ret.size() + extent.num_blocks(), kSparseHole);
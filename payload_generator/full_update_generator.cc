@@ -22,17 +22,22 @@
 #include <algorithm>
 #include <deque>
 #include <memory>
+#include <string>
+#include <utility>
 
 #include <base/format_macros.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <base/synchronization/lock.h>
 #include <base/threading/simple_thread.h>
+#include <base/time/time.h>
 #include <brillo/secure_blob.h>
 
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/numa_topology.h"
 
+using std::string;
 using std::vector;
 
 namespace chromeos_update_engine {
@@ -41,6 +46,33 @@ namespace {
 
 const size_t kDefaultFullChunkSize = 1024 * 1024;  // 1 MiB
 
+// The number of blocks read from a chunk to estimate whether it compresses.
+const size_t kChunkSampleBlocks = 16;
+
+// Sets |compressible| to whether the |num_blocks| blocks of |block_size| bytes
+// from |start_block| in |fd| likely compress, estimated from the entropy of a
+// sample of its blocks.
+bool IsChunkLikelyCompressible(int fd,
+                               size_t block_size,
+                               size_t start_block,
+                               size_t num_blocks,
+                               bool* compressible) {
+  size_t sample_blocks = std::min(num_blocks, kChunkSampleBlocks);
+  brillo::Blob sample(sample_blocks * block_size);
+  for (size_t i = 0; i < sample_blocks; i++) {
+    size_t block = start_block + i * num_blocks / sample_blocks;
+    ssize_t bytes_read = -1;
+    TEST_AND_RETURN_FALSE(utils::PReadAll(fd,
+                                          sample.data() + i * block_size,
+                                          block_size,
+                                          static_cast<off_t>(block) * block_size,
+                                          &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(block_size));
+  }
+  *compressible = !diff_utils::IsLikelyIncompressible(sample);
+  return true;
+}
+
 // This class encapsulates a full update chunk processing thread work. The
 // processor reads a chunk of data from the input file descriptor and compresses
 // it. The processor will destroy itself when the work is done.
@@ -85,6 +117,7 @@ class ChunkProcessor : public base::DelegateSimpleThread::Delegate {
 };
 
 void ChunkProcessor::Run() {
+  diff_utils::ScopedThreadReservation thread_reservation;
   if (!ProcessChunk()) {
     LOG(ERROR) << "Error processing region at " << offset_ << " of size "
                << size_;
@@ -92,6 +125,10 @@ void ChunkProcessor::Run() {
 }
 
 bool ChunkProcessor::ProcessChunk() {
+  GenerationProfile* generation_profile = diff_utils::GetGenerationProfile();
+  GenerationProfile::Operation profile;
+  base::TimeTicks start = base::TimeTicks::Now();
+
   brillo::Blob buffer_in_(size_);
   brillo::Blob op_blob;
   ssize_t bytes_read = -1;
@@ -102,12 +139,41 @@ bool ChunkProcessor::ProcessChunk() {
                                         &bytes_read));
   TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size_));
 
+  // The operation is looked up in the diff cache first, if enabled.
+  const DiffCache* diff_cache = diff_utils::GetDiffCache();
+  string cache_key;
+  if (diff_cache) {
+    TEST_AND_RETURN_FALSE(
+        diff_utils::GetFullOperationCacheKey(buffer_in_, version_, &cache_key));
+  }
   InstallOperation_Type op_type;
-  TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
-      buffer_in_, version_, &op_blob, &op_type));
+  if (!cache_key.empty() &&
+      diff_cache->Lookup(cache_key, &op_type, &op_blob)) {
+    profile.cached = true;
+  } else {
+    // The read data isn't needed after this, so it becomes the blob of a
+    // REPLACE instead of being copied.
+    TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
+        std::move(buffer_in_),
+        version_,
+        &op_blob,
+        &op_type,
+        generation_profile ? &profile.encoders : nullptr));
+    if (!cache_key.empty())
+      diff_cache->Store(cache_key, op_type, op_blob);
+  }
 
   aop_->op.set_type(op_type);
   TEST_AND_RETURN_FALSE(aop_->SetOperationBlob(op_blob, blob_file_));
+
+  if (generation_profile) {
+    profile.name = aop_->name;
+    profile.new_size = size_;
+    profile.type = op_type;
+    profile.size = op_blob.size();
+    profile.duration = base::TimeTicks::Now() - start;
+    generation_profile->Add(std::move(profile));
+  }
   return true;
 }
 
@@ -149,20 +215,63 @@ bool FullUpdateGenerator::GenerateOperations(
   TEST_AND_RETURN_FALSE(in_fd >= 0);
   ScopedFdCloser in_fd_closer(&in_fd);
 
+  // Compressing bigger chunks gives smaller payloads, but the device has to
+  // hold bigger operations to apply them. When |max_full_chunk_size| allows
+  // bigger chunks, the consecutive chunks that likely compress are merged up
+  // to that size, while the ones that don't compress are kept small since
+  // merging them wouldn't help.
+  size_t max_chunk_blocks = chunk_blocks;
+  if (config.max_full_chunk_size > full_chunk_size) {
+    size_t max_chunk_size = config.max_full_chunk_size;
+    if (config.hard_chunk_size >= 0) {
+      max_chunk_size = std::min(max_chunk_size,
+                                static_cast<size_t>(config.hard_chunk_size));
+    }
+    max_chunk_blocks =
+        std::max(chunk_blocks, max_chunk_size / config.block_size);
+  }
+
+  // The start block and number of blocks of each chunk.
+  size_t partition_blocks = new_part.size / config.block_size;
+  vector<std::pair<size_t, size_t>> chunks;
+  bool last_compressible = false;
+  for (size_t start_block = 0; start_block < partition_blocks;
+       start_block += chunk_blocks) {
+    // The last chunk could be smaller.
+    size_t num_blocks =
+        std::min(chunk_blocks, partition_blocks - start_block);
+    if (max_chunk_blocks == chunk_blocks) {
+      chunks.emplace_back(start_block, num_blocks);
+      continue;
+    }
+    bool compressible;
+    TEST_AND_RETURN_FALSE(IsChunkLikelyCompressible(
+        in_fd, config.block_size, start_block, num_blocks, &compressible));
+    if (compressible && last_compressible &&
+        chunks.back().second + num_blocks <= max_chunk_blocks) {
+      chunks.back().second += num_blocks;
+    } else {
+      chunks.emplace_back(start_block, num_blocks);
+    }
+    last_compressible = compressible;
+  }
+  if (max_chunk_blocks > chunk_blocks) {
+    LOG(INFO) << "Merged the chunks of partition " << new_part.name
+              << " that compress up to " << max_chunk_blocks
+              << " blocks, in " << chunks.size() << " chunks.";
+  }
+
   // We potentially have all the ChunkProcessors in memory but only
   // |max_threads| will actually hold a block in memory while we process.
-  size_t partition_blocks = new_part.size / config.block_size;
-  size_t num_chunks = (partition_blocks + chunk_blocks - 1) / chunk_blocks;
+  size_t num_chunks = chunks.size();
   aops->resize(num_chunks);
   vector<ChunkProcessor> chunk_processors;
   chunk_processors.reserve(num_chunks);
   blob_file->SetTotalBlobs(num_chunks);
 
   for (size_t i = 0; i < num_chunks; ++i) {
-    size_t start_block = i * chunk_blocks;
-    // The last chunk could be smaller.
-    size_t num_blocks = std::min(chunk_blocks,
-                                 partition_blocks - i * chunk_blocks);
+    size_t start_block = chunks[i].first;
+    size_t num_blocks = chunks[i].second;
 
     // Preset all the static information about the operations. The
     // ChunkProcessor will set the rest.
@@ -182,17 +291,28 @@ bool FullUpdateGenerator::GenerateOperations(
         aop);
   }
 
-  // Thread pool used for worker threads.
-  base::DelegateSimpleThreadPool thread_pool("full-update-generator",
-                                             max_threads);
+  // Thread pool used for worker threads, where each chunk runs on the NUMA
+  // node assigned to its blocks, if enabled.
+  const NumaTopology* topology = diff_utils::GetNumaTopology();
+  NumaThreadPool thread_pool("full-update-generator", max_threads, topology);
   thread_pool.Start();
-  for (ChunkProcessor& processor : chunk_processors)
-    thread_pool.AddWork(&processor);
+  for (size_t i = 0; i < num_chunks; i++) {
+    if (!diff_utils::IsInWorkShard(i))
+      continue;
+    size_t node =
+        topology ? topology->NodeForBlock(chunks[i].first, partition_blocks)
+                 : 0;
+    thread_pool.AddWork(&chunk_processors[i], node);
+  }
   thread_pool.JoinAll();
 
   // All the work done, disable logging.
   blob_file->SetTotalBlobs(0);
 
+  // The chunks of the other shards are left without an operation.
+  if (diff_utils::IsWorkSharded())
+    return true;
+
   // All the operations must have a type set at this point. Otherwise, a
   // ChunkProcessor failed to complete.
   for (const AnnotatedOperation& aop : *aops) {
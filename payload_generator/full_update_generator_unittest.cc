@@ -17,13 +17,17 @@
 #include "update_engine/payload_generator/full_update_generator.h"
 
 #include <memory>
+#include <random>
 #include <string>
 #include <vector>
 
+#include <base/files/file_enumerator.h>
+#include <base/files/scoped_temp_dir.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_utils.h"
 
 using chromeos_update_engine::test_utils::FillWithData;
@@ -142,4 +146,84 @@ TEST_F(FullUpdateGeneratorTest, ImageSizeTooSmall) {
             utils::BlocksInExtents(aops[0].op.dst_extents()));
 }
 
+// Test that the consecutive chunks that compress are merged up to the
+// |max_full_chunk_size|, and the ones that don't compress are not.
+TEST_F(FullUpdateGeneratorTest, MergeCompressibleChunksTest) {
+  config_.hard_chunk_size = -1;
+  config_.soft_chunk_size = 128 * 1024;
+  config_.max_full_chunk_size = 512 * 1024;
+  // 1 MiB of zeros, 512 KiB of random data and 512 KiB of zeros.
+  brillo::Blob new_part(2 * 1024 * 1024);
+  std::mt19937 generator(42);
+  for (size_t i = 1024 * 1024; i < 1536 * 1024; i++)
+    new_part[i] = generator() & 0xFF;
+  new_part_conf.size = new_part.size();
+
+  EXPECT_TRUE(test_utils::WriteFileVector(new_part_conf.path, new_part));
+
+  EXPECT_TRUE(generator_.GenerateOperations(config_,
+                                            new_part_conf,  // this is ignored
+                                            new_part_conf,
+                                            blob_file_.get(),
+                                            &aops));
+  vector<uint64_t> expected_blocks = {128, 128, 32, 32, 32, 32, 128};
+  ASSERT_EQ(expected_blocks.size(), aops.size());
+  uint64_t start_block = 0;
+  for (size_t i = 0; i < aops.size(); i++) {
+    ASSERT_EQ(1, aops[i].op.dst_extents_size());
+    EXPECT_EQ(start_block, aops[i].op.dst_extents(0).start_block());
+    EXPECT_EQ(expected_blocks[i], aops[i].op.dst_extents(0).num_blocks());
+    start_block += expected_blocks[i];
+  }
+}
+
+// Test that the work shards only generate their chunks, stored in the diff
+// cache, where the generation without a shard finds them all.
+TEST_F(FullUpdateGeneratorTest, WorkShardTest) {
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+  ASSERT_TRUE(diff_utils::SetDiffCacheDir(cache_dir.GetPath().value()));
+  brillo::Blob new_part(1024 * 1024);
+  std::mt19937 generator(42);
+  for (uint8_t& byte : new_part)
+    byte = generator() % 4;
+  new_part_conf.size = new_part.size();
+  EXPECT_TRUE(test_utils::WriteFileVector(new_part_conf.path, new_part));
+  auto count_entries = [&cache_dir]() {
+    base::FileEnumerator entries(
+        cache_dir.GetPath(), false, base::FileEnumerator::FILES);
+    size_t count = 0;
+    while (!entries.Next().empty())
+      count++;
+    return count;
+  };
+
+  // The 8 chunks are split between the two shards.
+  for (size_t shard = 0; shard < 2; shard++) {
+    diff_utils::SetWorkShard(shard, 2);
+    vector<AnnotatedOperation> shard_aops;
+    EXPECT_TRUE(generator_.GenerateOperations(config_,
+                                              new_part_conf,
+                                              new_part_conf,
+                                              blob_file_.get(),
+                                              &shard_aops));
+    ASSERT_EQ(8U, shard_aops.size());
+    for (size_t i = 0; i < shard_aops.size(); i++)
+      EXPECT_EQ(i % 2 == shard, shard_aops[i].op.has_type()) << "i = " << i;
+    EXPECT_EQ(4 * (shard + 1), count_entries());
+  }
+
+  diff_utils::SetWorkShard(0, 0);
+  EXPECT_TRUE(generator_.GenerateOperations(config_,
+                                            new_part_conf,
+                                            new_part_conf,
+                                            blob_file_.get(),
+                                            &aops));
+  ASSERT_EQ(8U, aops.size());
+  for (const AnnotatedOperation& aop : aops)
+    EXPECT_TRUE(aop.op.has_type());
+  EXPECT_EQ(8U, count_entries());
+  EXPECT_TRUE(diff_utils::SetDiffCacheDir(""));
+}
+
 }  // namespace chromeos_update_engine
@@ -16,28 +16,40 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <xz.h>
 
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+#include <base/sys_info.h>
+#include <base/threading/simple_thread.h>
+#include <base/time/time.h>
 #include <brillo/flag_helper.h>
 #include <brillo/key_value_store.h>
 
 #include "update_engine/common/fake_boot_control.h"
 #include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/prefs.h"
 #include "update_engine/common/terminator.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/apply_stats.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/apply_time_estimator.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/generation_profile.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/payload_generator/payload_signer.h"
 #include "update_engine/payload_generator/xz.h"
@@ -54,6 +66,10 @@ namespace chromeos_update_engine {
 
 namespace {
 
+// The regressions of the apply times smaller than this are ignored, since
+// they are within the noise of the measurements.
+const int64_t kMinApplyRegressionMs = 100;
+
 void ParseSignatureSizes(const string& signature_sizes_flag,
                          vector<int>* signature_sizes) {
   signature_sizes->clear();
@@ -182,13 +198,90 @@ int VerifySignedPayload(const string& in_file, const string& public_key) {
   return 0;
 }
 
+// Returns the minor version supported by the |source| image, read from the
+// update_engine.conf in its partitions.
+uint32_t DetectMinorVersion(const ImageConfig& source) {
+  brillo::KeyValueStore store;
+  uint32_t minor_version;
+  for (const PartitionConfig& part : source.partitions) {
+    if (part.fs_interface && part.fs_interface->LoadSettings(&store) &&
+        utils::GetMinorVersion(store, &minor_version)) {
+      return minor_version;
+    }
+  }
+  return kInPlaceMinorPayloadVersion;
+}
+
+// Checks the hash of one target partition of an applied payload on one of the
+// threads of a pool.
+class TargetHashVerifier : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit TargetHashVerifier(const InstallPlan::Partition& partition)
+      : partition_(partition) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    HashCalculator hasher;
+    off_t size = static_cast<off_t>(partition_.target_size);
+    if (hasher.UpdateFile(partition_.target_path, size) != size ||
+        !hasher.Finalize()) {
+      LOG(ERROR) << "Unable to hash the target partition " << partition_.name
+                 << " in " << partition_.target_path;
+      return;
+    }
+    result_ = hasher.raw_hash() == partition_.target_hash;
+    LOG_IF(ERROR, !result_) << "The target partition " << partition_.name
+                            << " doesn't have the hash of the payload.";
+  }
+
+  bool result() const { return result_; }
+
+ private:
+  const InstallPlan::Partition& partition_;
+  bool result_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(TargetHashVerifier);
+};
+
+// Checks that the target partitions of |install_plan| have the hash of the
+// payload applied, hashing them in parallel. Returns whether they all match.
+bool VerifyTargetPartitions(const InstallPlan& install_plan) {
+  vector<std::unique_ptr<TargetHashVerifier>> verifiers;
+  for (const InstallPlan::Partition& partition : install_plan.partitions)
+    verifiers.emplace_back(new TargetHashVerifier(partition));
+  int num_threads =
+      std::min(base::SysInfo::NumberOfProcessors(),
+               static_cast<int>(std::max(verifiers.size(), size_t{1})));
+  base::DelegateSimpleThreadPool thread_pool("target-hash-verifier",
+                                             num_threads);
+  thread_pool.Start();
+  for (auto& verifier : verifiers)
+    thread_pool.AddWork(verifier.get());
+  thread_pool.JoinAll();
+  bool result = true;
+  for (const auto& verifier : verifiers)
+    result &= verifier->result();
+  if (result) {
+    LOG(INFO) << "Verified the hash of the " << verifiers.size()
+              << " target partitions.";
+  }
+  return result;
+}
+
+// Applies the payload |payload_file| to the target partitions of |config|,
+// from its source partitions for a delta, with |apply_threads| workers
+// applying the operations in parallel when bigger than one. Then checks the
+// hash of the target partitions if |verify_target|.
 // TODO(deymo): This function is likely broken for deltas minor version 2 or
 // newer. Move this function to a new file and make the delta_performer
 // integration tests use this instead.
 bool ApplyPayload(const string& payload_file,
                   // Simply reuses the payload config used for payload
                   // generation.
-                  const PayloadGenerationConfig& config) {
+                  const PayloadGenerationConfig& config,
+                  uint32_t apply_threads,
+                  bool verify_target,
+                  ApplyStats* stats) {
   LOG(INFO) << "Applying delta.";
   FakeBootControl fake_boot_control;
   FakeHardware fake_hardware;
@@ -198,6 +291,8 @@ bool ApplyPayload(const string& payload_file,
   install_plan.source_slot =
       config.is_delta ? 0 : BootControlInterface::kInvalidSlot;
   install_plan.target_slot = 1;
+  install_plan.apply_threads = std::max(apply_threads, 1U);
+  install_plan.pipelined_apply = install_plan.apply_threads > 1;
   payload.type =
       config.is_delta ? InstallPayloadType::kDelta : InstallPayloadType::kFull;
 
@@ -227,6 +322,7 @@ bool ApplyPayload(const string& payload_file,
                            &install_plan,
                            &payload,
                            true);  // is_interactive
+  performer.set_apply_stats(stats);
 
   brillo::Blob buf(1024 * 1024);
   int fd = open(payload_file.c_str(), O_RDONLY, 0);
@@ -244,7 +340,76 @@ bool ApplyPayload(const string& payload_file,
   DeltaPerformer::ResetUpdateProgress(&prefs, false);
   LOG(INFO) << "Completed applying " << (config.is_delta ? "delta" : "full")
             << " payload.";
-  return true;
+  return !verify_target || VerifyTargetPartitions(install_plan);
+}
+
+// Writes the results of applying a payload, from the |stats| and the
+// |duration| of the whole apply, to |results_file| as key=value pairs, or to
+// stdout if it is "-". If |baseline_file| isn't empty, the times and the peak
+// memory use are compared with the results of a previous run stored in it,
+// and false is returned if any of them regressed by more than
+// |max_regression_percent|.
+bool ReportApplyResults(const ApplyStats& stats,
+                        base::TimeDelta duration,
+                        const string& results_file,
+                        const string& baseline_file,
+                        int max_regression_percent) {
+  brillo::KeyValueStore results;
+  // The keys of the values compared with the baseline.
+  vector<string> compared_keys = {"total_ms"};
+  results.SetString("total_ms", base::Int64ToString(duration.InMilliseconds()));
+  for (size_t i = 0; i < ApplyStats::kNumPhases; i++) {
+    ApplyStats::Phase phase = static_cast<ApplyStats::Phase>(i);
+    string key = string(ApplyStats::PhaseName(phase)) + "_ms";
+    results.SetString(key,
+                      base::Int64ToString(stats.GetPhaseTotals(phase)
+                                              .duration.InMilliseconds()));
+    compared_keys.push_back(key);
+  }
+  results.SetString("applied_bytes",
+                    base::Uint64ToString(stats.applied_bytes()));
+  results.SetString("written_bytes",
+                    base::Uint64ToString(stats.written_bytes()));
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    results.SetString("peak_rss_kb", base::Int64ToString(usage.ru_maxrss));
+    compared_keys.push_back("peak_rss_kb");
+  }
+  if (results_file == "-") {
+    printf("%s", results.SaveToString().c_str());
+  } else if (!results_file.empty()) {
+    TEST_AND_RETURN_FALSE(results.Save(base::FilePath(results_file)));
+    LOG(INFO) << "Wrote the apply results to " << results_file;
+  }
+
+  if (baseline_file.empty())
+    return true;
+  brillo::KeyValueStore baseline;
+  TEST_AND_RETURN_FALSE(baseline.Load(base::FilePath(baseline_file)));
+  bool regressed = false;
+  for (const string& key : compared_keys) {
+    string value_str, baseline_str;
+    int64_t value, baseline_value;
+    if (!baseline.GetString(key, &baseline_str) ||
+        !base::StringToInt64(baseline_str, &baseline_value) ||
+        !results.GetString(key, &value_str) ||
+        !base::StringToInt64(value_str, &value)) {
+      LOG(WARNING) << "No baseline value of " << key << " to compare with.";
+      continue;
+    }
+    int64_t max_value =
+        baseline_value + baseline_value * max_regression_percent / 100;
+    if (base::EndsWith(key, "_ms", base::CompareCase::SENSITIVE))
+      max_value = std::max(max_value, baseline_value + kMinApplyRegressionMs);
+    if (value > max_value) {
+      LOG(ERROR) << key << " regressed from " << baseline_value << " to "
+                 << value << ", more than " << max_regression_percent << "%.";
+      regressed = true;
+    } else {
+      LOG(INFO) << key << ": " << value << ", baseline " << baseline_value;
+    }
+  }
+  return !regressed;
 }
 
 int ExtractProperties(const string& payload_path, const string& props_file) {
@@ -260,6 +425,36 @@ int ExtractProperties(const string& payload_path, const string& props_file) {
   return true;
 }
 
+// Prints the time predicted to download, apply and verify the payload at
+// |payload_path| on a device of the profile in |profile_file|.
+bool EstimateApplyTime(const string& payload_path,
+                       const string& profile_file,
+                       size_t max_dominant_ops) {
+  brillo::KeyValueStore store;
+  TEST_AND_RETURN_FALSE(store.Load(base::FilePath(profile_file)));
+  DeviceProfile profile;
+  TEST_AND_RETURN_FALSE(profile.Load(store));
+
+  DeltaArchiveManifest manifest;
+  uint64_t major_version, metadata_size;
+  uint32_t metadata_signature_size;
+  TEST_AND_RETURN_FALSE(PayloadSigner::LoadPayloadMetadata(
+      payload_path,
+      nullptr,
+      &manifest,
+      &major_version,
+      &metadata_size,
+      &metadata_signature_size));
+  if (major_version != kBrilloMajorPayloadVersion) {
+    LOG(ERROR) << "Only the payloads of major version "
+               << kBrilloMajorPayloadVersion << " can be estimated.";
+    return false;
+  }
+  ApplyTimeEstimator estimator(profile, manifest.block_size());
+  printf("%s", estimator.Report(manifest, max_dominant_ops).c_str());
+  return true;
+}
+
 int Main(int argc, char** argv) {
   DEFINE_string(old_image, "", "Path to the old rootfs");
   DEFINE_string(new_image, "", "Path to the new rootfs");
@@ -269,7 +464,12 @@ int Main(int argc, char** argv) {
                 "Path to the old partitions. To pass multiple partitions, use "
                 "a single argument with a colon between paths, e.g. "
                 "/path/to/part:/path/to/part2::/path/to/last_part . Path can "
-                "be empty, but it has to match the order of partition_names.");
+                "be empty, but it has to match the order of partition_names. "
+                "To generate a delta payload from each of several source "
+                "images to the same target, separate the partitions of each "
+                "source with a semicolon, and pass as many --out_file paths "
+                "also separated by a semicolon. The target is analyzed once "
+                "and the payloads are generated in parallel.");
   DEFINE_string(new_partitions, "",
                 "Path to the new partitions. To pass multiple partitions, use "
                 "a single argument with a colon between paths, e.g. "
@@ -281,7 +481,8 @@ int Main(int argc, char** argv) {
                 "in the old partition. The .map file is normally generated "
                 "when creating the image in Android builds. Only recommended "
                 "for unsupported filesystem. Pass multiple files separated by "
-                "a colon as with -old_partitions.");
+                "a colon as with -old_partitions, and the files of each "
+                "source image separated by a semicolon.");
   DEFINE_string(new_mapfiles,
                 "",
                 "Path to the .map files associated with the partition files "
@@ -296,12 +497,15 @@ int Main(int argc, char** argv) {
   DEFINE_string(in_file, "",
                 "Path to input delta payload file used to hash/sign payloads "
                 "and apply delta over old_image (for debugging)");
-  DEFINE_string(out_file, "", "Path to output delta payload file");
+  DEFINE_string(out_file, "",
+                "Path to output delta payload file, or one path per source "
+                "image separated by a semicolon, see --old_partitions.");
   DEFINE_string(out_hash_file, "", "Path to output hash file");
   DEFINE_string(out_metadata_hash_file, "",
                 "Path to output metadata hash file");
   DEFINE_string(out_metadata_size_file, "",
-                "Path to output metadata size file");
+                "Path to output metadata size file, or one path per source "
+                "image separated by a semicolon, see --old_partitions.");
   DEFINE_string(private_key, "", "Path to private key in .pem format");
   DEFINE_string(public_key, "", "Path to public key in .pem format");
   DEFINE_int32(public_key_version, -1,
@@ -339,6 +543,120 @@ int Main(int argc, char** argv) {
                0,
                "The maximum timestamp of the OS allowed to apply this "
                "payload.");
+  DEFINE_string(diff_cache_dir, "",
+                "If passed, the operations generated are cached in this "
+                "directory and reused by the payloads generated later from "
+                "the same source and target data.");
+  DEFINE_string(previous_payload, "",
+                "If passed, the operations of the partitions with the same old "
+                "and new data as in this payload, of major version 2, are "
+                "copied from it instead of generated again.");
+  DEFINE_uint64(max_full_chunk_size, 0,
+                "If passed, the consecutive chunks of the full operations that "
+                "compress are merged into operations of up to this many "
+                "bytes.");
+  DEFINE_uint64(memory_budget_mb, 0,
+                "If passed, the memory used by the bsdiff and puffdiff "
+                "operations generated at the same time is bounded to about "
+                "this many MiB. The biggest ones are generated alone.");
+  DEFINE_uint64(apply_memory_budget_mb, 0,
+                "If passed, the operations are split and encoded so each one "
+                "can be applied with this many MiB of memory, at least 16, "
+                "by the low memory devices. It bounds --chunk_size and "
+                "--max_full_chunk_size to half of it.");
+  DEFINE_uint64(suffix_array_cache_mb, 0,
+                "If passed, the suffix arrays built by bsdiff are kept in up "
+                "to this many MiB, to not sort the same old data again when "
+                "it is diffed against other new data.");
+  DEFINE_uint64(brotli_max_quality_kb, 0,
+                "If passed, only the BROTLI_BSDIFF patches of up to this many "
+                "KiB of data are compressed with the best brotli quality, "
+                "which is slow on big patches. The bigger ones use "
+                "--brotli_fast_quality.");
+  DEFINE_int32(brotli_fast_quality, 9,
+               "The brotli quality, from 0 to 11, of the BROTLI_BSDIFF "
+               "patches bigger than --brotli_max_quality_kb.");
+  DEFINE_uint64(work_shard_count, 0,
+                "If passed, the operations of the payload are generated by "
+                "this many processes sharing --diff_cache_dir, each passing "
+                "its --work_shard_index and storing its operations in the "
+                "cache without writing the payload. A last process without "
+                "these flags then writes the payload from the cache.");
+  DEFINE_uint64(work_shard_index, 0,
+                "The shard generated, from 0 to --work_shard_count - 1.");
+  DEFINE_uint64(zstd_dictionary_size, 0,
+                "If passed, a zstd dictionary of up to this many bytes is "
+                "trained from the new partitions and shipped in the payload, "
+                "to compress the small REPLACE_ZSTD operations. Only used in "
+                "minor version 6 or newer.");
+  DEFINE_bool(fast_cycle_breaking, false,
+              "If passed, the in-place deltas (minor version 1) break the "
+              "cycles of the operations with a fast heuristic, which may use "
+              "more scratch space or full operations.");
+  DEFINE_bool(content_defined_chunks, false,
+              "If passed, the files bigger than the chunk size are split "
+              "where their content allows instead of at fixed offsets, so "
+              "the data inserted in them doesn't shift all the later chunks "
+              "against the old file. Not used in minor version 1.");
+  DEFINE_bool(dst_hashes, false,
+              "If passed, the hash of the blocks written by each operation "
+              "is stored in the payload, so the operations applied before an "
+              "update was interrupted are skipped when it resumes. Not used "
+              "in minor version 1.");
+  DEFINE_bool(apply_memory_hints, false,
+              "If passed, the estimated peak memory needed to apply each "
+              "operation, and the largest one, are stored in the payload, so "
+              "the device can plan how many operations it applies at once "
+              "and reject the payloads needing more memory than it has.");
+  DEFINE_bool(locality_ordering, false,
+              "If passed, the operations of the A/B deltas are ordered so "
+              "both the reads of the source partition and the writes of the "
+              "target one are mostly sequential, instead of ordering them "
+              "only by destination.");
+  DEFINE_bool(numa_aware, false,
+              "If passed, the files and chunks are processed by the threads "
+              "of the NUMA node assigned to the blocks they read, on the "
+              "machines with several NUMA nodes.");
+  DEFINE_string(split_payload_dir, "",
+                "If passed, the payload is also written to this directory "
+                "split in a metadata file, one data file per partition named "
+                "after its hash, and a signature file, so the partitions can "
+                "be downloaded separately and cached once by a CDN.");
+  DEFINE_string(out_profile_file, "",
+                "If passed, the time spent by each encoder tried for each "
+                "operation generated, their output sizes and the operation "
+                "chosen are written to this file as JSON.");
+  DEFINE_string(out_apply_results_file, "",
+                "If passed with --in_file, the time spent in each phase of "
+                "applying the payload, the bytes written and the peak memory "
+                "use are written to this file as key=value pairs, or to "
+                "stdout if it is \"-\".");
+  DEFINE_string(apply_baseline_file, "",
+                "If passed with --in_file, the apply results are compared "
+                "with the ones in this file, written by a previous "
+                "--out_apply_results_file run, and the program fails if they "
+                "regressed by more than --max_apply_regression_percent.");
+  DEFINE_int32(apply_threads, 1,
+               "The number of threads applying the operations of the payload "
+               "passed in --in_file in parallel. The results compared with "
+               "an --apply_baseline_file must use the same number.");
+  DEFINE_bool(verify_target, true,
+              "Whether the hash of the target partitions is checked once the "
+              "payload passed in --in_file is applied, on one thread per "
+              "partition.");
+  DEFINE_int32(max_apply_regression_percent, 10,
+               "The largest increase of the apply times and peak memory use "
+               "over the --apply_baseline_file values that isn't reported as "
+               "a regression.");
+  DEFINE_string(device_profile_file, "",
+                "If passed with --in_file, the time to download, apply and "
+                "verify the payload on a device of this profile, key=value "
+                "pairs like the extent_io_benchmark --out_profile_file ones, "
+                "is estimated from its manifest and printed instead of "
+                "applying the payload.");
+  DEFINE_int32(max_dominant_ops, 10,
+               "The number of operations taking the longest to apply listed "
+               "with the --device_profile_file estimate.");
 
   DEFINE_string(old_channel, "",
                 "The channel for the old image. 'dev-channel', 'npo-channel', "
@@ -419,6 +737,14 @@ int Main(int argc, char** argv) {
   if (!FLAGS_properties_file.empty()) {
     return ExtractProperties(FLAGS_in_file, FLAGS_properties_file) ? 0 : 1;
   }
+  if (!FLAGS_device_profile_file.empty()) {
+    CHECK_GE(FLAGS_max_dominant_ops, 0);
+    return EstimateApplyTime(FLAGS_in_file,
+                             FLAGS_device_profile_file,
+                             FLAGS_max_dominant_ops)
+               ? 0
+               : 1;
+  }
 
   // A payload generation was requested. Convert the flags to a
   // PayloadGenerationConfig.
@@ -426,9 +752,18 @@ int Main(int argc, char** argv) {
   vector<string> partition_names, old_partitions, new_partitions;
   vector<string> old_mapfiles, new_mapfiles;
 
-  if (!FLAGS_old_mapfiles.empty()) {
+  // The partitions and .map files of each source image, when generating a
+  // payload from each of several source images.
+  vector<string> source_partitions = base::SplitString(
+      FLAGS_old_partitions, ";", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+  vector<string> source_mapfiles = base::SplitString(
+      FLAGS_old_mapfiles, ";", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+  CHECK(source_mapfiles.size() <= std::max<size_t>(source_partitions.size(), 1))
+      << "Pass the --old_mapfiles of each source image in --old_partitions.";
+
+  if (!source_mapfiles.empty() && !source_mapfiles[0].empty()) {
     old_mapfiles = base::SplitString(
-        FLAGS_old_mapfiles, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+        source_mapfiles[0], ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
   }
   if (!FLAGS_new_mapfiles.empty()) {
     new_mapfiles = base::SplitString(
@@ -485,7 +820,7 @@ int Main(int argc, char** argv) {
   if (payload_config.is_delta) {
     if (!FLAGS_old_partitions.empty()) {
       old_partitions =
-          base::SplitString(FLAGS_old_partitions, ":", base::TRIM_WHITESPACE,
+          base::SplitString(source_partitions[0], ":", base::TRIM_WHITESPACE,
                             base::SPLIT_WANT_ALL);
       CHECK(old_partitions.size() == new_partitions.size());
     } else {
@@ -502,7 +837,32 @@ int Main(int argc, char** argv) {
   }
 
   if (!FLAGS_in_file.empty()) {
-    return ApplyPayload(FLAGS_in_file, payload_config) ? 0 : 1;
+    CHECK(source_partitions.size() <= 1)
+        << "Only one source image can be passed to apply a payload.";
+    // The target partitions are written, so only the source partitions can
+    // be sparse images.
+    CHECK(payload_config.source.ExpandSparseImages());
+    ApplyStats stats;
+    base::TimeTicks start_time = base::TimeTicks::Now();
+    CHECK_GE(FLAGS_apply_threads, 1);
+    if (!ApplyPayload(FLAGS_in_file,
+                      payload_config,
+                      FLAGS_apply_threads,
+                      FLAGS_verify_target,
+                      &stats)) {
+      return 1;
+    }
+    LOG(INFO) << "Apply stats:\n" << stats.ToString();
+    if (FLAGS_out_apply_results_file.empty() &&
+        FLAGS_apply_baseline_file.empty())
+      return 0;
+    return ReportApplyResults(stats,
+                              base::TimeTicks::Now() - start_time,
+                              FLAGS_out_apply_results_file,
+                              FLAGS_apply_baseline_file,
+                              FLAGS_max_apply_regression_percent)
+               ? 0
+               : 1;
   }
 
   if (!FLAGS_new_postinstall_config_file.empty()) {
@@ -518,10 +878,13 @@ int Main(int argc, char** argv) {
   payload_config.block_size = kBlockSize;
 
   // The partition size is never passed to the delta_generator, so we
-  // need to detect those from the provided files.
+  // need to detect those from the provided files, once the sparse images
+  // are expanded.
   if (payload_config.is_delta) {
+    CHECK(payload_config.source.ExpandSparseImages());
     CHECK(payload_config.source.LoadImageSize());
   }
+  CHECK(payload_config.target.ExpandSparseImages());
   CHECK(payload_config.target.LoadImageSize());
 
   CHECK(!FLAGS_out_file.empty());
@@ -561,16 +924,7 @@ int Main(int argc, char** argv) {
     // Autodetect minor_version by looking at the update_engine.conf in the old
     // image.
     if (payload_config.is_delta) {
-      payload_config.version.minor = kInPlaceMinorPayloadVersion;
-      brillo::KeyValueStore store;
-      uint32_t minor_version;
-      for (const PartitionConfig& part : payload_config.source.partitions) {
-        if (part.fs_interface && part.fs_interface->LoadSettings(&store) &&
-            utils::GetMinorVersion(store, &minor_version)) {
-          payload_config.version.minor = minor_version;
-          break;
-        }
-      }
+      payload_config.version.minor = DetectMinorVersion(payload_config.source);
     } else {
       payload_config.version.minor = kFullPayloadMinorVersion;
     }
@@ -581,6 +935,39 @@ int Main(int argc, char** argv) {
   }
 
   payload_config.max_timestamp = FLAGS_max_timestamp;
+  payload_config.diff_cache_dir = FLAGS_diff_cache_dir;
+  payload_config.previous_payload = FLAGS_previous_payload;
+  payload_config.memory_budget = FLAGS_memory_budget_mb * 1024 * 1024;
+  payload_config.suffix_array_cache_size =
+      FLAGS_suffix_array_cache_mb * 1024 * 1024;
+  payload_config.brotli_max_quality_size = FLAGS_brotli_max_quality_kb * 1024;
+  payload_config.brotli_fast_quality = FLAGS_brotli_fast_quality;
+  payload_config.max_full_chunk_size = FLAGS_max_full_chunk_size;
+  payload_config.apply_memory_budget =
+      FLAGS_apply_memory_budget_mb * 1024 * 1024;
+  // The operations write at most half of the apply memory budget, so they
+  // fit in it with the data and decoders of the full operations.
+  if (payload_config.apply_memory_budget > 0) {
+    const ssize_t max_chunk_size =
+        payload_config.apply_memory_budget / 2 / kBlockSize * kBlockSize;
+    if (payload_config.hard_chunk_size == -1 ||
+        payload_config.hard_chunk_size > max_chunk_size) {
+      payload_config.hard_chunk_size = max_chunk_size;
+    }
+    payload_config.max_full_chunk_size =
+        std::min(payload_config.max_full_chunk_size,
+                 static_cast<size_t>(max_chunk_size));
+  }
+  payload_config.zstd_dictionary_size = FLAGS_zstd_dictionary_size;
+  payload_config.fast_cycle_breaking = FLAGS_fast_cycle_breaking;
+  payload_config.content_defined_chunks = FLAGS_content_defined_chunks;
+  payload_config.dst_hashes = FLAGS_dst_hashes;
+  payload_config.apply_memory_hints = FLAGS_apply_memory_hints;
+  payload_config.locality_ordering = FLAGS_locality_ordering;
+  payload_config.split_payload_dir = FLAGS_split_payload_dir;
+  payload_config.work_shard_index = FLAGS_work_shard_index;
+  payload_config.work_shard_count = FLAGS_work_shard_count;
+  payload_config.numa_aware = FLAGS_numa_aware;
 
   LOG(INFO) << "Generating " << (payload_config.is_delta ? "delta" : "full")
             << " update";
@@ -591,16 +978,90 @@ int Main(int argc, char** argv) {
     return 1;
   }
 
-  uint64_t metadata_size;
-  if (!GenerateUpdatePayloadFile(payload_config,
-                                 FLAGS_out_file,
-                                 FLAGS_private_key,
-                                 &metadata_size)) {
-    return 1;
-  }
+  vector<string> out_files = base::SplitString(
+      FLAGS_out_file, ";", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+  vector<string> out_metadata_size_files;
   if (!FLAGS_out_metadata_size_file.empty()) {
-    string metadata_size_string = std::to_string(metadata_size);
-    CHECK(utils::WriteFile(FLAGS_out_metadata_size_file.c_str(),
+    out_metadata_size_files =
+        base::SplitString(FLAGS_out_metadata_size_file, ";",
+                          base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+    CHECK(out_metadata_size_files.size() == out_files.size());
+  }
+
+  GenerationProfile profile;
+  if (!FLAGS_out_profile_file.empty())
+    diff_utils::SetGenerationProfile(&profile);
+
+  vector<uint64_t> metadata_sizes(1);
+  if (source_partitions.size() <= 1) {
+    CHECK(out_files.size() == 1);
+    if (!GenerateUpdatePayloadFile(payload_config,
+                                   FLAGS_out_file,
+                                   FLAGS_private_key,
+                                   &metadata_sizes[0])) {
+      return 1;
+    }
+  } else {
+    // Each source image gets its own payload, sharing the target partitions
+    // already opened.
+    CHECK(out_files.size() == source_partitions.size())
+        << "Pass one --out_file per source image in --old_partitions.";
+    vector<PayloadGenerationConfig> configs;
+    for (size_t i = 0; i < source_partitions.size(); i++) {
+      if (i == 0) {
+        configs.push_back(payload_config);
+        continue;
+      }
+      PayloadGenerationConfig config = payload_config;
+      old_partitions =
+          base::SplitString(source_partitions[i], ":", base::TRIM_WHITESPACE,
+                            base::SPLIT_WANT_ALL);
+      CHECK(old_partitions.size() == new_partitions.size());
+      old_mapfiles.clear();
+      if (i < source_mapfiles.size() && !source_mapfiles[i].empty()) {
+        old_mapfiles = base::SplitString(source_mapfiles[i], ":",
+                                         base::TRIM_WHITESPACE,
+                                         base::SPLIT_WANT_ALL);
+      }
+      for (size_t j = 0; j < config.source.partitions.size(); j++) {
+        PartitionConfig& part = config.source.partitions[j];
+        part.path = old_partitions[j];
+        part.mapfile_path = j < old_mapfiles.size() ? old_mapfiles[j] : "";
+        part.size = 0;
+        part.fs_interface.reset();
+        part.expanded_image_unlinker.reset();
+      }
+      CHECK(config.source.ExpandSparseImages());
+      CHECK(config.source.LoadImageSize());
+      for (PartitionConfig& part : config.source.partitions)
+        CHECK(part.OpenFilesystem());
+      if (FLAGS_minor_version == -1) {
+        config.version.minor = DetectMinorVersion(config.source);
+        LOG(INFO) << "Auto-detected minor_version=" << config.version.minor
+                  << " for " << out_files[i];
+      }
+      if (!config.Validate()) {
+        LOG(ERROR) << "Invalid options passed for the source image of "
+                   << out_files[i] << ". See errors above.";
+        return 1;
+      }
+      configs.push_back(std::move(config));
+    }
+    if (!GenerateUpdatePayloadFiles(
+            configs, out_files, FLAGS_private_key, &metadata_sizes)) {
+      return 1;
+    }
+  }
+  if (!FLAGS_out_profile_file.empty()) {
+    diff_utils::SetGenerationProfile(nullptr);
+    CHECK(profile.WriteJson(FLAGS_out_profile_file));
+  }
+  // The work shards don't write a payload.
+  if (payload_config.work_shard_count > 1)
+    return 0;
+  for (size_t i = 0; i < out_metadata_size_files.size(); i++) {
+    string metadata_size_string = std::to_string(metadata_sizes[i]);
+    CHECK(utils::WriteFile(out_metadata_size_files[i].c_str(),
                            metadata_size_string.data(),
                            metadata_size_string.size()));
   }
@@ -0,0 +1,183 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/generation_profile.h"
+
+#include <inttypes.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns |str| quoted as a JSON string.
+string JsonString(const string& str) {
+  string result = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      result += base::StringPrintf("\\u%04x", c);
+    } else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+}  // namespace
+
+void GenerationProfile::Add(Operation operation) {
+  struct rusage usage;
+  int64_t max_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss
+                                                           : 0;
+  base::AutoLock auto_lock(lock_);
+  records_.push_back(
+      {std::move(operation), base::PlatformThread::CurrentId(), max_rss_kb});
+}
+
+size_t GenerationProfile::size() const {
+  base::AutoLock auto_lock(lock_);
+  return records_.size();
+}
+
+const char* GenerationProfile::EncoderName(InstallOperation::Type type) {
+  switch (type) {
+    case InstallOperation::BSDIFF:
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+      return "bsdiff";
+    case InstallOperation::PUFFDIFF:
+      return "puffdiff";
+    case InstallOperation::REPLACE_XZ:
+      return "xz";
+    case InstallOperation::REPLACE_BZ:
+      return "bzip2";
+    case InstallOperation::REPLACE_ZSTD:
+      return "zstd";
+    default:
+      return "replace";
+  }
+}
+
+int64_t GenerationProfile::SavedBytes(const Operation& operation,
+                                      string* runner_up) {
+  string chosen = EncoderName(operation.type);
+  runner_up->clear();
+  uint64_t runner_up_size = 0;
+  // A REPLACE is always possible when the data had to be encoded.
+  if (chosen != "replace" && operation.new_size > 0) {
+    *runner_up = "replace";
+    runner_up_size = operation.new_size;
+  }
+  for (const Encoder& encoder : operation.encoders) {
+    if (encoder.name == chosen)
+      continue;
+    if (runner_up->empty() || encoder.size < runner_up_size) {
+      *runner_up = encoder.name;
+      runner_up_size = encoder.size;
+    }
+  }
+  if (runner_up->empty())
+    return 0;
+  return static_cast<int64_t>(runner_up_size) -
+         static_cast<int64_t>(operation.size);
+}
+
+bool GenerationProfile::WriteJson(const string& path) const {
+  base::AutoLock auto_lock(lock_);
+  struct ThreadTotals {
+    size_t operations{0};
+    base::TimeDelta duration;
+    int64_t max_rss_kb{0};
+  };
+  std::map<base::PlatformThreadId, ThreadTotals> threads;
+
+  string json = "{\"operations\":[";
+  for (size_t i = 0; i < records_.size(); i++) {
+    const Operation& operation = records_[i].operation;
+    string runner_up;
+    int64_t saved_bytes = SavedBytes(operation, &runner_up);
+    json += base::StringPrintf(
+        "%s\n{\"name\":%s,\"old_size\":%" PRIu64 ",\"new_size\":%" PRIu64
+        ",\"type\":\"%s\",\"size\":%" PRIu64 ",\"cached\":%s"
+        ",\"duration_us\":%" PRId64 ",\"runner_up\":%s"
+        ",\"saved_bytes\":%" PRId64 ",\"thread\":%" PRId64
+        ",\"max_rss_kb\":%" PRId64 ",\"encoders\":[",
+        i ? "," : "",
+        JsonString(operation.name).c_str(),
+        operation.old_size,
+        operation.new_size,
+        InstallOperationTypeName(operation.type),
+        operation.size,
+        operation.cached ? "true" : "false",
+        operation.duration.InMicroseconds(),
+        JsonString(runner_up).c_str(),
+        saved_bytes,
+        static_cast<int64_t>(records_[i].thread),
+        records_[i].max_rss_kb);
+    for (size_t j = 0; j < operation.encoders.size(); j++) {
+      const Encoder& encoder = operation.encoders[j];
+      json += base::StringPrintf(
+          "%s{\"name\":\"%s\",\"duration_us\":%" PRId64 ",\"size\":%" PRIu64
+          "}",
+          j ? "," : "",
+          encoder.name.c_str(),
+          encoder.duration.InMicroseconds(),
+          encoder.size);
+    }
+    json += "]}";
+
+    ThreadTotals& totals = threads[records_[i].thread];
+    totals.operations++;
+    totals.duration += operation.duration;
+    totals.max_rss_kb = std::max(totals.max_rss_kb, records_[i].max_rss_kb);
+  }
+  json += "],\n\"threads\":[";
+  bool first = true;
+  for (const auto& thread : threads) {
+    json += base::StringPrintf(
+        "%s\n{\"thread\":%" PRId64 ",\"operations\":%zu"
+        ",\"duration_us\":%" PRId64 ",\"max_rss_kb\":%" PRId64 "}",
+        first ? "" : ",",
+        static_cast<int64_t>(thread.first),
+        thread.second.operations,
+        thread.second.duration.InMicroseconds(),
+        thread.second.max_rss_kb);
+    first = false;
+  }
+  json += "]}\n";
+  TEST_AND_RETURN_FALSE(utils::WriteFile(path.c_str(), json.data(),
+                                         json.size()));
+  LOG(INFO) << "Wrote the generation profile of " << records_.size()
+            << " operations to " << path;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_PROFILE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_PROFILE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Collects the cost of generating each operation of a payload: the time spent
+// by each encoder tried, the size of their output and the operation chosen.
+// It is written out as JSON to find the few files dominating the generation
+// time. All the methods are thread safe, so the operations generated by the
+// worker threads can be added.
+class GenerationProfile {
+ public:
+  // An encoder tried to generate an operation.
+  struct Encoder {
+    // One of "bsdiff", "puffdiff", "xz", "bzip2" and "zstd". The brotli
+    // compression of the bsdiff patches is timed with bsdiff.
+    std::string name;
+    base::TimeDelta duration;
+    // The size of the encoded data.
+    uint64_t size{0};
+  };
+
+  struct Operation {
+    // The name of the AnnotatedOperation, usually the file and chunk.
+    std::string name;
+    uint64_t old_size{0};
+    uint64_t new_size{0};
+    // The operation chosen and the size of its data.
+    InstallOperation::Type type{InstallOperation::REPLACE};
+    uint64_t size{0};
+    // Whether the operation was found in the diff cache, without trying any
+    // encoder.
+    bool cached{false};
+    // The time spent generating the operation, including reading its data.
+    base::TimeDelta duration;
+    std::vector<Encoder> encoders;
+  };
+
+  GenerationProfile() = default;
+
+  // Adds the |operation| generated by the calling thread. The peak memory
+  // used by the process so far is recorded with it.
+  void Add(Operation operation);
+
+  // Returns the number of operations added.
+  size_t size() const;
+
+  // Returns the name of the encoder producing the operations of type |type|,
+  // or "replace" for the ones copying the data or without data.
+  static const char* EncoderName(InstallOperation::Type type);
+
+  // Returns the bytes saved by the chosen |operation| compared with the
+  // smallest of the other encoders tried and a REPLACE, stored in
+  // |runner_up|. It is negative when a bigger operation was preferred, and
+  // zero when there was no other candidate.
+  static int64_t SavedBytes(const Operation& operation,
+                            std::string* runner_up);
+
+  // Writes the operations and, per thread, the time spent and the peak memory
+  // used by the process while it ran, to the file |path| as JSON. Returns
+  // whether it succeeded.
+  bool WriteJson(const std::string& path) const;
+
+ private:
+  struct Record {
+    Operation operation;
+    base::PlatformThreadId thread;
+    // The maximum resident set size of the process when the operation was
+    // added, in KiB.
+    int64_t max_rss_kb;
+  };
+
+  mutable base::Lock lock_;
+  std::vector<Record> records_;
+
+  DISALLOW_COPY_AND_ASSIGN(GenerationProfile);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_PROFILE_H_
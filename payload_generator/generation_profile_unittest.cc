@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/generation_profile.h"
+
+#include <string>
+
+#include <base/files/file_util.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class GenerationProfileTest : public ::testing::Test {
+ protected:
+  // Returns an operation of |type| encoding 1000 bytes into |size| bytes,
+  // with xz and bsdiff tried.
+  GenerationProfile::Operation MakeOperation(InstallOperation::Type type,
+                                             uint64_t size) {
+    GenerationProfile::Operation operation;
+    operation.name = "file";
+    operation.old_size = 900;
+    operation.new_size = 1000;
+    operation.type = type;
+    operation.size = size;
+    operation.duration = base::TimeDelta::FromMilliseconds(3);
+    operation.encoders = {
+        {"xz", base::TimeDelta::FromMilliseconds(1), 400},
+        {"bsdiff", base::TimeDelta::FromMilliseconds(2), 100},
+    };
+    return operation;
+  }
+
+  GenerationProfile profile_;
+};
+
+TEST_F(GenerationProfileTest, SavedBytesTest) {
+  string runner_up;
+  EXPECT_EQ(300, GenerationProfile::SavedBytes(
+                     MakeOperation(InstallOperation::SOURCE_BSDIFF, 100),
+                     &runner_up));
+  EXPECT_EQ("xz", runner_up);
+
+  // The zstd operations can be chosen even if slightly bigger.
+  GenerationProfile::Operation operation =
+      MakeOperation(InstallOperation::REPLACE_ZSTD, 110);
+  operation.encoders.push_back(
+      {"zstd", base::TimeDelta::FromMilliseconds(1), 110});
+  EXPECT_EQ(-10, GenerationProfile::SavedBytes(operation, &runner_up));
+  EXPECT_EQ("bsdiff", runner_up);
+
+  // Without other encoders, a REPLACE is the runner-up.
+  operation.encoders.clear();
+  EXPECT_EQ(890, GenerationProfile::SavedBytes(operation, &runner_up));
+  EXPECT_EQ("replace", runner_up);
+
+  // Nothing else was possible for a SOURCE_COPY.
+  operation = GenerationProfile::Operation();
+  operation.type = InstallOperation::SOURCE_COPY;
+  EXPECT_EQ(0, GenerationProfile::SavedBytes(operation, &runner_up));
+  EXPECT_EQ("", runner_up);
+}
+
+TEST_F(GenerationProfileTest, WriteJsonTest) {
+  test_utils::ScopedTempFile profile_file("GenerationProfileTest.XXXXXX");
+  GenerationProfile::Operation operation =
+      MakeOperation(InstallOperation::SOURCE_BSDIFF, 100);
+  operation.name = "dir/\"quoted\"";
+  profile_.Add(operation);
+  profile_.Add(MakeOperation(InstallOperation::REPLACE_XZ, 400));
+  EXPECT_EQ(2U, profile_.size());
+
+  EXPECT_TRUE(profile_.WriteJson(profile_file.path()));
+  string json;
+  EXPECT_TRUE(
+      base::ReadFileToString(base::FilePath(profile_file.path()), &json));
+  EXPECT_EQ(0U,
+            json.find("{\"operations\":[\n{\"name\":\"dir/\\\"quoted\\\"\""));
+  EXPECT_NE(string::npos,
+            json.find("\"type\":\"SOURCE_BSDIFF\",\"size\":100,"
+                      "\"cached\":false,\"duration_us\":3000,"
+                      "\"runner_up\":\"xz\",\"saved_bytes\":300,"));
+  EXPECT_NE(string::npos,
+            json.find("\"encoders\":[{\"name\":\"xz\",\"duration_us\":1000,"
+                      "\"size\":400},{\"name\":\"bsdiff\",\"duration_us\":2000,"
+                      "\"size\":100}]"));
+  // Both operations were added by this thread.
+  EXPECT_NE(string::npos,
+            json.find("\"operations\":2,\"duration_us\":6000,"));
+}
+
+}  // namespace chromeos_update_engine
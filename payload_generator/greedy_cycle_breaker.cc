@@ -0,0 +1,224 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/greedy_cycle_breaker.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/payload_generator/graph_utils.h"
+
+using std::set;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+void GreedyCycleBreaker::BreakCycles(const Graph& graph,
+                                     set<Edge>* out_cut_edges) {
+  // Build the compact adjacency lists of the graph, with the in-edges too.
+  size_t num_vertices = graph.size();
+  out_offsets_.assign(num_vertices + 1, 0);
+  in_offsets_.assign(num_vertices + 1, 0);
+  out_targets_.clear();
+  out_weights_.clear();
+  for (Vertex::Index u = 0; u < num_vertices; u++) {
+    out_offsets_[u] = out_targets_.size();
+    for (const auto& edge : graph[u].out_edges) {
+      CHECK_LT(edge.first, num_vertices);
+      out_targets_.push_back(edge.first);
+      out_weights_.push_back(
+          graph_utils::EdgeWeight(graph, Edge(u, edge.first)));
+      in_offsets_[edge.first + 1]++;
+    }
+  }
+  out_offsets_[num_vertices] = out_targets_.size();
+  for (Vertex::Index v = 0; v < num_vertices; v++)
+    in_offsets_[v + 1] += in_offsets_[v];
+  in_sources_.resize(out_targets_.size());
+  in_weights_.resize(out_targets_.size());
+  vector<size_t> next_in_edge(in_offsets_.begin(), in_offsets_.end() - 1);
+  for (Vertex::Index u = 0; u < num_vertices; u++) {
+    for (size_t i = out_offsets_[u]; i < out_offsets_[u + 1]; i++) {
+      size_t j = next_in_edge[out_targets_[i]]++;
+      in_sources_[j] = u;
+      in_weights_[j] = out_weights_[i];
+    }
+  }
+
+  FindComponents();
+  vector<Vertex::Index> order = OrderVertices();
+  vector<size_t> position(num_vertices);
+  for (size_t i = 0; i < order.size(); i++)
+    position[order[i]] = i;
+
+  // The edges going backward in the order are cut, including the self-loops.
+  out_cut_edges->clear();
+  for (Vertex::Index u = 0; u < num_vertices; u++) {
+    for (size_t i = out_offsets_[u]; i < out_offsets_[u + 1]; i++) {
+      Vertex::Index v = out_targets_[i];
+      if (component_[u] == component_[v] && position[u] >= position[v])
+        out_cut_edges->insert(Edge(u, v));
+    }
+  }
+  LOG(INFO) << "Cut " << out_cut_edges->size() << " of " << out_targets_.size()
+            << " edges.";
+}
+
+void GreedyCycleBreaker::FindComponents() {
+  const size_t kUnvisited = std::numeric_limits<size_t>::max();
+  size_t num_vertices = out_offsets_.size() - 1;
+  vector<size_t> index(num_vertices, kUnvisited);
+  vector<size_t> lowlink(num_vertices);
+  vector<bool> on_stack(num_vertices, false);
+  vector<Vertex::Index> stack;
+  // The path of the depth-first search, with the next out-edge to visit from
+  // each of its vertices.
+  vector<std::pair<Vertex::Index, size_t>> path;
+  size_t next_index = 0;
+  size_t num_components = 0;
+  component_.assign(num_vertices, 0);
+
+  for (Vertex::Index root = 0; root < num_vertices; root++) {
+    if (index[root] != kUnvisited)
+      continue;
+    index[root] = lowlink[root] = next_index++;
+    stack.push_back(root);
+    on_stack[root] = true;
+    path.emplace_back(root, out_offsets_[root]);
+    while (!path.empty()) {
+      Vertex::Index u = path.back().first;
+      if (path.back().second < out_offsets_[u + 1]) {
+        Vertex::Index v = out_targets_[path.back().second++];
+        if (index[v] == kUnvisited) {
+          index[v] = lowlink[v] = next_index++;
+          stack.push_back(v);
+          on_stack[v] = true;
+          path.emplace_back(v, out_offsets_[v]);
+        } else if (on_stack[v]) {
+          lowlink[u] = std::min(lowlink[u], index[v]);
+        }
+        continue;
+      }
+
+      // All the out-edges of |u| were visited.
+      path.pop_back();
+      if (!path.empty()) {
+        Vertex::Index parent = path.back().first;
+        lowlink[parent] = std::min(lowlink[parent], lowlink[u]);
+      }
+      if (lowlink[u] == index[u]) {
+        Vertex::Index v;
+        do {
+          v = stack.back();
+          stack.pop_back();
+          on_stack[v] = false;
+          component_[v] = num_components;
+        } while (v != u);
+        num_components++;
+      }
+    }
+  }
+}
+
+vector<Vertex::Index> GreedyCycleBreaker::OrderVertices() {
+  size_t num_vertices = out_offsets_.size() - 1;
+  // The number of remaining edges within a component from and to each vertex,
+  // and the difference between their weights. The self-loops are ignored.
+  vector<size_t> out_degree(num_vertices, 0);
+  vector<size_t> in_degree(num_vertices, 0);
+  vector<int64_t> delta(num_vertices, 0);
+  for (Vertex::Index u = 0; u < num_vertices; u++) {
+    for (size_t i = out_offsets_[u]; i < out_offsets_[u + 1]; i++) {
+      Vertex::Index v = out_targets_[i];
+      if (u == v || component_[u] != component_[v])
+        continue;
+      out_degree[u]++;
+      in_degree[v]++;
+      delta[u] += out_weights_[i];
+      delta[v] -= out_weights_[i];
+    }
+  }
+
+  // The remaining vertices by |delta|, and the ones that became sinks or
+  // sources, which may have been removed since.
+  set<std::pair<int64_t, Vertex::Index>> by_delta;
+  vector<Vertex::Index> sinks;
+  vector<Vertex::Index> sources;
+  for (Vertex::Index v = 0; v < num_vertices; v++) {
+    by_delta.emplace(delta[v], v);
+    if (out_degree[v] == 0)
+      sinks.push_back(v);
+    else if (in_degree[v] == 0)
+      sources.push_back(v);
+  }
+
+  vector<bool> removed(num_vertices, false);
+  auto update_delta = [&by_delta, &delta](Vertex::Index v, int64_t change) {
+    by_delta.erase(std::make_pair(delta[v], v));
+    delta[v] += change;
+    by_delta.emplace(delta[v], v);
+  };
+
+  // The sinks are put at the end of the order, and the rest at the front.
+  vector<Vertex::Index> front;
+  vector<Vertex::Index> back;
+  while (!by_delta.empty()) {
+    Vertex::Index v;
+    if (!sinks.empty()) {
+      v = sinks.back();
+      sinks.pop_back();
+      if (removed[v])
+        continue;
+      back.push_back(v);
+    } else if (!sources.empty()) {
+      v = sources.back();
+      sources.pop_back();
+      if (removed[v])
+        continue;
+      front.push_back(v);
+    } else {
+      v = by_delta.rbegin()->second;
+      front.push_back(v);
+    }
+
+    removed[v] = true;
+    by_delta.erase(std::make_pair(delta[v], v));
+    for (size_t i = out_offsets_[v]; i < out_offsets_[v + 1]; i++) {
+      Vertex::Index w = out_targets_[i];
+      if (removed[w] || component_[w] != component_[v])
+        continue;
+      update_delta(w, out_weights_[i]);
+      if (--in_degree[w] == 0)
+        sources.push_back(w);
+    }
+    for (size_t i = in_offsets_[v]; i < in_offsets_[v + 1]; i++) {
+      Vertex::Index u = in_sources_[i];
+      if (removed[u] || component_[u] != component_[v])
+        continue;
+      update_delta(u, -static_cast<int64_t>(in_weights_[i]));
+      if (--out_degree[u] == 0)
+        sinks.push_back(u);
+    }
+  }
+
+  front.insert(front.end(), back.rbegin(), back.rend());
+  return front;
+}
+
+}  // namespace chromeos_update_engine
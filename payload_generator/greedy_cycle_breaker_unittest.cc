@@ -0,0 +1,173 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/greedy_cycle_breaker.h"
+
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/graph_types.h"
+
+using std::make_pair;
+using std::pair;
+using std::set;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+pair<Vertex::Index, EdgeProperties> EdgeWithWeight(Vertex::Index dest,
+                                                   uint64_t weight) {
+  EdgeProperties props;
+  props.extents.resize(1);
+  props.extents[0].set_num_blocks(weight);
+  return make_pair(dest, props);
+}
+
+// Returns whether |graph| without the |cut_edges| has no cycle.
+bool IsAcyclicWithout(const Graph& graph, const set<Edge>& cut_edges) {
+  vector<size_t> in_degree(graph.size(), 0);
+  for (Vertex::Index u = 0; u < graph.size(); u++) {
+    for (const auto& edge : graph[u].out_edges) {
+      if (!utils::SetContainsKey(cut_edges, make_pair(u, edge.first)))
+        in_degree[edge.first]++;
+    }
+  }
+  vector<Vertex::Index> ready;
+  for (Vertex::Index v = 0; v < graph.size(); v++) {
+    if (in_degree[v] == 0)
+      ready.push_back(v);
+  }
+  size_t sorted = 0;
+  while (!ready.empty()) {
+    Vertex::Index u = ready.back();
+    ready.pop_back();
+    sorted++;
+    for (const auto& edge : graph[u].out_edges) {
+      if (!utils::SetContainsKey(cut_edges, make_pair(u, edge.first)) &&
+          --in_degree[edge.first] == 0)
+        ready.push_back(edge.first);
+    }
+  }
+  return sorted == graph.size();
+}
+
+}  // namespace
+
+class GreedyCycleBreakerTest : public ::testing::Test {};
+
+TEST(GreedyCycleBreakerTest, SimpleTest) {
+  int counter = 0;
+  const Vertex::Index n_a = counter++;
+  const Vertex::Index n_b = counter++;
+  const Vertex::Index n_c = counter++;
+  const Vertex::Index n_d = counter++;
+  const Vertex::Index n_e = counter++;
+  const Vertex::Index n_f = counter++;
+  const Vertex::Index n_g = counter++;
+  const Vertex::Index n_h = counter++;
+  const Graph::size_type kNodeCount = counter++;
+
+  Graph graph(kNodeCount);
+  graph[n_a].out_edges.insert(make_pair(n_e, EdgeProperties()));
+  graph[n_a].out_edges.insert(make_pair(n_f, EdgeProperties()));
+  graph[n_b].out_edges.insert(make_pair(n_a, EdgeProperties()));
+  graph[n_c].out_edges.insert(make_pair(n_d, EdgeProperties()));
+  graph[n_d].out_edges.insert(make_pair(n_e, EdgeProperties()));
+  graph[n_d].out_edges.insert(make_pair(n_f, EdgeProperties()));
+  graph[n_e].out_edges.insert(make_pair(n_b, EdgeProperties()));
+  graph[n_e].out_edges.insert(make_pair(n_c, EdgeProperties()));
+  graph[n_e].out_edges.insert(make_pair(n_f, EdgeProperties()));
+  graph[n_f].out_edges.insert(make_pair(n_g, EdgeProperties()));
+  graph[n_g].out_edges.insert(make_pair(n_h, EdgeProperties()));
+  graph[n_h].out_edges.insert(make_pair(n_g, EdgeProperties()));
+
+  GreedyCycleBreaker breaker;
+  set<Edge> broken_edges;
+  breaker.BreakCycles(graph, &broken_edges);
+
+  EXPECT_TRUE(IsAcyclicWithout(graph, broken_edges));
+  // The edges out of the cycles, such as the ones to F, are never cut.
+  EXPECT_FALSE(utils::SetContainsKey(broken_edges, make_pair(n_a, n_f)));
+  EXPECT_FALSE(utils::SetContainsKey(broken_edges, make_pair(n_d, n_f)));
+  EXPECT_FALSE(utils::SetContainsKey(broken_edges, make_pair(n_e, n_f)));
+  EXPECT_FALSE(utils::SetContainsKey(broken_edges, make_pair(n_f, n_g)));
+  EXPECT_EQ(3U, broken_edges.size());
+}
+
+TEST(GreedyCycleBreakerTest, WeightTest) {
+  // The lightest edge of the cycle is cut.
+  Graph graph(3);
+  graph[0].out_edges.insert(EdgeWithWeight(1, 10));
+  graph[1].out_edges.insert(EdgeWithWeight(2, 1));
+  graph[2].out_edges.insert(EdgeWithWeight(0, 10));
+
+  GreedyCycleBreaker breaker;
+  set<Edge> broken_edges;
+  breaker.BreakCycles(graph, &broken_edges);
+  EXPECT_EQ(set<Edge>{make_pair(1, 2)}, broken_edges);
+}
+
+TEST(GreedyCycleBreakerTest, SelfLoopTest) {
+  Graph graph(2);
+  graph[0].out_edges.insert(EdgeWithWeight(0, 1));
+  graph[0].out_edges.insert(EdgeWithWeight(1, 1));
+
+  GreedyCycleBreaker breaker;
+  set<Edge> broken_edges;
+  breaker.BreakCycles(graph, &broken_edges);
+  EXPECT_EQ(set<Edge>{make_pair(0, 0)}, broken_edges);
+}
+
+TEST(GreedyCycleBreakerTest, BigGraphTest) {
+  // A graph with many cycles, for which enumerating them would take very long.
+  const Graph::size_type kNodeCount = 2000;
+  Graph graph(kNodeCount);
+  uint32_t seed = 1;
+  for (Vertex::Index u = 0; u < kNodeCount; u++) {
+    for (int i = 0; i < 4; i++) {
+      seed = seed * 1103515245 + 12345;
+      graph[u].out_edges.insert(
+          EdgeWithWeight((seed >> 8) % kNodeCount, (seed >> 4) % 16));
+    }
+  }
+
+  GreedyCycleBreaker breaker;
+  set<Edge> broken_edges;
+  breaker.BreakCycles(graph, &broken_edges);
+  EXPECT_TRUE(IsAcyclicWithout(graph, broken_edges));
+  EXPECT_FALSE(broken_edges.empty());
+
+  // A graph without cycles isn't cut.
+  for (Vertex::Index u = 0; u < kNodeCount; u++) {
+    for (auto it = graph[u].out_edges.begin();
+         it != graph[u].out_edges.end();) {
+      if (it->first <= u)
+        it = graph[u].out_edges.erase(it);
+      else
+        ++it;
+    }
+  }
+  breaker.BreakCycles(graph, &broken_edges);
+  EXPECT_TRUE(broken_edges.empty());
+}
+
+}  // namespace chromeos_update_engine
@@ -26,6 +26,7 @@
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/cycle_breaker.h"
+#include "update_engine/payload_generator/greedy_cycle_breaker.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
@@ -602,11 +603,17 @@ bool InplaceGenerator::ConvertGraphToDag(Graph* graph,
                                          const string& new_part,
                                          BlobFileWriter* blob_file,
                                          vector<Vertex::Index>* final_order,
-                                         Vertex::Index scratch_vertex) {
-  CycleBreaker cycle_breaker;
+                                         Vertex::Index scratch_vertex,
+                                         bool fast_cycle_breaking) {
   LOG(INFO) << "Finding cycles...";
   set<Edge> cut_edges;
-  cycle_breaker.BreakCycles(*graph, &cut_edges);
+  if (fast_cycle_breaking) {
+    GreedyCycleBreaker cycle_breaker;
+    cycle_breaker.BreakCycles(*graph, &cut_edges);
+  } else {
+    CycleBreaker cycle_breaker;
+    cycle_breaker.BreakCycles(*graph, &cut_edges);
+  }
   LOG(INFO) << "done finding cycles";
   CheckGraph(*graph);
 
@@ -740,6 +747,7 @@ bool InplaceGenerator::ResolveReadAfterWriteDependencies(
     uint64_t partition_size,
     size_t block_size,
     BlobFileWriter* blob_file,
+    bool fast_cycle_breaking,
     vector<AnnotatedOperation>* aops) {
   // Convert the operations to the graph.
   Graph graph;
@@ -773,7 +781,8 @@ bool InplaceGenerator::ResolveReadAfterWriteDependencies(
       new_part.path,
       blob_file,
       &final_order,
-      scratch_vertex));
+      scratch_vertex,
+      fast_cycle_breaking));
 
   // Copy operations over to the |aops| vector in the final_order generated by
   // the topological sort.
@@ -812,9 +821,18 @@ bool InplaceGenerator::GenerateOperations(
                                                        config.version,
                                                        blob_file));
   LOG(INFO) << "Done reading " << new_part.name;
+  // The operations of a work shard are only generated for the diff cache.
+  if (diff_utils::IsWorkSharded())
+    return true;
 
-  TEST_AND_RETURN_FALSE(ResolveReadAfterWriteDependencies(
-      old_part, new_part, partition_size, config.block_size, blob_file, aops));
+  TEST_AND_RETURN_FALSE(
+      ResolveReadAfterWriteDependencies(old_part,
+                                        new_part,
+                                        partition_size,
+                                        config.block_size,
+                                        blob_file,
+                                        config.fast_cycle_breaking,
+                                        aops));
   LOG(INFO) << "Done reordering " << new_part.name;
   return true;
 }
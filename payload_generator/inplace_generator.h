@@ -158,12 +158,15 @@ class InplaceGenerator : public OperationsGenerator {
   // |data_file_size| are be passed.
   // If |scratch_vertex| is not kInvalidIndex, removes it from
   // |final_order| before returning.
+  // The cycles are broken with the GreedyCycleBreaker heuristic if
+  // |fast_cycle_breaking|, or with the CycleBreaker otherwise.
   // Returns true on success.
   static bool ConvertGraphToDag(Graph* graph,
                                 const std::string& new_part,
                                 BlobFileWriter* blob_file,
                                 std::vector<Vertex::Index>* final_order,
-                                Vertex::Index scratch_vertex);
+                                Vertex::Index scratch_vertex,
+                                bool fast_cycle_breaking);
 
   // Creates a dummy REPLACE_BZ node in the given |vertex|. This can be used
   // to provide scratch space. The node writes |num_blocks| blocks starting at
@@ -209,6 +212,7 @@ class InplaceGenerator : public OperationsGenerator {
   // operations produce the same |new_part| result when applied in-place.
   // The new operations will create blobs in |data_file_fd| and update
   // the file size pointed by |data_file_size| if needed.
+  // |fast_cycle_breaking| is passed to ConvertGraphToDag().
   // On success, stores the new operations in |aops| in the right order and
   // returns true.
   static bool ResolveReadAfterWriteDependencies(
@@ -217,6 +221,7 @@ class InplaceGenerator : public OperationsGenerator {
       uint64_t partition_size,
       size_t block_size,
       BlobFileWriter* blob_file,
+      bool fast_cycle_breaking,
       std::vector<AnnotatedOperation>* aops);
 
   // Generate the update payload operations for the given partition using
@@ -485,7 +485,8 @@ TEST_F(InplaceGeneratorTest, AssignTempBlocksTest) {
                                                   "/dev/zero",
                                                   blob_file_.get(),
                                                   &final_order,
-                                                  Vertex::kInvalidIndex));
+                                                  Vertex::kInvalidIndex,
+                                                  false));
 
   Graph expected_graph(12);
   GenVertex(&expected_graph[0],
@@ -638,6 +639,7 @@ TEST_F(InplaceGeneratorTest, ResolveReadAfterWriteDependenciesAvoidMoveToZero) {
         part_blocks * block_size,
         block_size,
         blob_file_.get(),
+        false,
         &result_aops));
 
     size_t full_ops = 0;
@@ -719,6 +721,7 @@ TEST_F(InplaceGeneratorTest, ResolveReadAfterWriteDependenciesShrinkData) {
       (old_blocks + 2) * block_size,  // enough scratch space.
       block_size,
       blob_file_.get(),
+      false,
       &aops));
 
   size_t full_ops = 0;
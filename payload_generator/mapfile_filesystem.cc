@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <map>
+#include <utility>
 
 #include <base/files/file_util.h>
 #include <base/logging.h>
@@ -89,14 +90,17 @@ bool MapfileFilesystem::GetFiles(vector<File>* files) const {
   // line.
   vector<base::StringPiece> lines = base::SplitStringPiece(
       file_data, "\n", base::KEEP_WHITESPACE, base::SPLIT_WANT_ALL);
+  files->reserve(lines.size());
   for (const base::StringPiece& line : lines) {
     File mapped_file;
 
     mapped_file.extents = {};
     size_t delim, last_delim = line.size();
     while ((delim = line.rfind(' ', last_delim - 1)) != string::npos) {
-      string blocks =
-          line.substr(delim + 1, last_delim - (delim + 1)).as_string();
+      // The block ranges are parsed in place, since big images have lots of
+      // them.
+      base::StringPiece blocks =
+          line.substr(delim + 1, last_delim - (delim + 1));
       size_t dash = blocks.find('-', 0);
       uint64_t block_start, block_end;
       if (dash == string::npos && base::StringToUint64(blocks, &block_start)) {
@@ -135,7 +139,7 @@ bool MapfileFilesystem::GetFiles(vector<File>* files) const {
       continue;
     mapped_file.name = line.substr(0, last_delim).as_string();
 
-    files->push_back(mapped_file);
+    files->push_back(std::move(mapped_file));
   }
 
   return true;
@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/memory_budget.h"
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+MemoryBudget::MemoryBudget(uint64_t limit) : limit_(limit) {}
+
+void MemoryBudget::set_limit(uint64_t limit) {
+  base::AutoLock auto_lock(lock_);
+  CHECK_EQ(reserved_, 0U);
+  limit_ = limit;
+}
+
+uint64_t MemoryBudget::limit() const {
+  base::AutoLock auto_lock(lock_);
+  return limit_;
+}
+
+uint64_t MemoryBudget::Reserve(uint64_t bytes) {
+  base::AutoLock auto_lock(lock_);
+  if (limit_ == 0)
+    return 0;
+  bytes = std::min(bytes, limit_);
+  while (reserved_ + bytes > limit_)
+    released_.Wait();
+  reserved_ += bytes;
+  return bytes;
+}
+
+void MemoryBudget::Release(uint64_t bytes) {
+  if (bytes == 0)
+    return;
+  base::AutoLock auto_lock(lock_);
+  CHECK_LE(bytes, reserved_);
+  reserved_ -= bytes;
+  released_.Broadcast();
+}
+
+uint64_t MemoryBudget::reserved() const {
+  base::AutoLock auto_lock(lock_);
+  return reserved_;
+}
+
+}  // namespace chromeos_update_engine
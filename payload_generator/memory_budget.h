@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
+
+#include <stdint.h>
+
+#include <base/macros.h>
+#include <base/synchronization/condition_variable.h>
+#include <base/synchronization/lock.h>
+
+namespace chromeos_update_engine {
+
+// Bounds the memory used by the tasks running at the same time on several
+// threads. Each task reserves the memory it is estimated to use at its peak
+// before it starts, waiting until the other tasks release enough of it. A task
+// estimated to use more than the whole budget waits until no other task holds
+// any of it, so the biggest tasks run alone while the smaller ones can still
+// run in parallel. All the methods are thread safe.
+class MemoryBudget {
+ public:
+  // Creates a budget of |limit| bytes. A |limit| of zero doesn't bound the
+  // memory used, so reserving memory never waits.
+  explicit MemoryBudget(uint64_t limit);
+
+  // Changes the limit of the budget. It must not be called while some of it
+  // is reserved.
+  void set_limit(uint64_t limit);
+  uint64_t limit() const;
+
+  // Waits until |bytes| can be reserved without going over the limit and
+  // reserves them. Reservations over the limit reserve the whole budget.
+  // Returns the number of bytes reserved, which must be passed to Release()
+  // once the task is done.
+  uint64_t Reserve(uint64_t bytes);
+  void Release(uint64_t bytes);
+
+  // Returns the number of bytes reserved now.
+  uint64_t reserved() const;
+
+ private:
+  mutable base::Lock lock_;
+  base::ConditionVariable released_{&lock_};
+  uint64_t limit_;
+  uint64_t reserved_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+// Reserves memory from a MemoryBudget while the object is alive.
+class ScopedMemoryReservation {
+ public:
+  ScopedMemoryReservation(MemoryBudget* budget, uint64_t bytes)
+      : budget_(budget), bytes_(budget->Reserve(bytes)) {}
+  ~ScopedMemoryReservation() { budget_->Release(bytes_); }
+
+ private:
+  MemoryBudget* budget_;
+  uint64_t bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedMemoryReservation);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
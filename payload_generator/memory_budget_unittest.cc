@@ -0,0 +1,95 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/memory_budget.h"
+
+#include <memory>
+#include <vector>
+
+#include <base/threading/platform_thread.h>
+#include <base/threading/simple_thread.h>
+#include <base/time/time.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Reserves some bytes of a budget, then sleeps a bit and checks that the
+// budget is not exceeded.
+class Reserver : public base::DelegateSimpleThread::Delegate {
+ public:
+  Reserver(MemoryBudget* budget, uint64_t bytes)
+      : budget_(budget), bytes_(bytes) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    ScopedMemoryReservation reservation(budget_, bytes_);
+    EXPECT_LE(budget_->reserved(), budget_->limit());
+    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(1));
+    EXPECT_LE(budget_->reserved(), budget_->limit());
+  }
+
+ private:
+  MemoryBudget* budget_;
+  uint64_t bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(Reserver);
+};
+
+}  // namespace
+
+class MemoryBudgetTest : public ::testing::Test {};
+
+TEST_F(MemoryBudgetTest, UnlimitedTest) {
+  MemoryBudget budget(0);
+  EXPECT_EQ(0U, budget.Reserve(1000));
+  EXPECT_EQ(0U, budget.Reserve(1000));
+  EXPECT_EQ(0U, budget.reserved());
+  budget.Release(0);
+}
+
+TEST_F(MemoryBudgetTest, ReserveTest) {
+  MemoryBudget budget(100);
+  EXPECT_EQ(30U, budget.Reserve(30));
+  EXPECT_EQ(70U, budget.Reserve(70));
+  EXPECT_EQ(100U, budget.reserved());
+  budget.Release(30);
+  budget.Release(70);
+  EXPECT_EQ(0U, budget.reserved());
+
+  // A reservation over the limit takes the whole budget.
+  {
+    ScopedMemoryReservation reservation(&budget, 1000);
+    EXPECT_EQ(100U, budget.reserved());
+  }
+  EXPECT_EQ(0U, budget.reserved());
+}
+
+TEST_F(MemoryBudgetTest, ThreadsTest) {
+  MemoryBudget budget(100);
+  std::vector<std::unique_ptr<Reserver>> reservers;
+  base::DelegateSimpleThreadPool thread_pool("memory-budget-test", 8);
+  thread_pool.Start();
+  for (uint64_t i = 0; i < 64; i++) {
+    reservers.emplace_back(new Reserver(&budget, (i * 37) % 150));
+    thread_pool.AddWork(reservers.back().get());
+  }
+  thread_pool.JoinAll();
+  EXPECT_EQ(0U, budget.reserved());
+}
+
+}  // namespace chromeos_update_engine
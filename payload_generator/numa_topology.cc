@@ -0,0 +1,198 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/numa_topology.h"
+
+#include <sched.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <utility>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+#include <base/strings/stringprintf.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+const char kNodeDirPrefix[] = "node";
+}  // namespace
+
+bool NumaTopology::Load(const string& node_dir) {
+  // The nodes are sorted by number, which may not be contiguous.
+  std::map<size_t, vector<int>> nodes;
+  base::FileEnumerator entries(base::FilePath(node_dir),
+                               false,
+                               base::FileEnumerator::DIRECTORIES,
+                               string(kNodeDirPrefix) + "*");
+  for (base::FilePath entry = entries.Next(); !entry.empty();
+       entry = entries.Next()) {
+    size_t node;
+    if (!base::StringToSizeT(
+            entry.BaseName().value().substr(strlen(kNodeDirPrefix)), &node)) {
+      continue;
+    }
+    string cpu_list;
+    vector<int> cpus;
+    if (!base::ReadFileToString(entry.Append("cpulist"), &cpu_list) ||
+        !ParseCpuList(cpu_list, &cpus)) {
+      LOG(WARNING) << "Unable to read the CPUs of NUMA node " << entry.value();
+      continue;
+    }
+    if (!cpus.empty())
+      nodes[node] = std::move(cpus);
+  }
+
+  node_cpus_.clear();
+  for (auto& node : nodes)
+    node_cpus_.push_back(std::move(node.second));
+  return !node_cpus_.empty();
+}
+
+bool NumaTopology::ParseCpuList(const string& list, vector<int>* cpus) {
+  cpus->clear();
+  for (const string& range : base::SplitString(
+           list, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    vector<string> bounds = base::SplitString(
+        range, "-", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+    int first, last;
+    if (bounds.size() > 2 || !base::StringToInt(bounds[0], &first) ||
+        !base::StringToInt(bounds.back(), &last) || first < 0 ||
+        first > last) {
+      LOG(ERROR) << "Invalid CPU list: " << list;
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus->push_back(cpu);
+  }
+  return true;
+}
+
+size_t NumaTopology::num_cpus() const {
+  size_t result = 0;
+  for (const vector<int>& cpus : node_cpus_)
+    result += cpus.size();
+  return result;
+}
+
+size_t NumaTopology::NodeForBlock(uint64_t block, uint64_t num_blocks) const {
+  if (node_cpus_.size() <= 1 || num_blocks == 0)
+    return 0;
+  // The CPU whose share of the partition holds |block|, and then its node.
+  uint64_t cpu = std::min(block, num_blocks - 1) * num_cpus() / num_blocks;
+  for (size_t node = 0; node < node_cpus_.size(); node++) {
+    if (cpu < node_cpus_[node].size())
+      return node;
+    cpu -= node_cpus_[node].size();
+  }
+  return node_cpus_.size() - 1;
+}
+
+bool NumaTopology::BindCurrentThread(size_t node) const {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : node_cpus_[node]) {
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &cpu_set);
+  }
+  // A pid of zero is the calling thread.
+  return sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+}
+
+// Binds the thread running the work to the CPUs of the node of its pool
+// before running it.
+class NumaThreadPool::NodeDelegate
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  NodeDelegate(const NumaTopology* topology,
+               size_t node,
+               base::DelegateSimpleThread::Delegate* delegate)
+      : topology_(topology), node_(node), delegate_(delegate) {}
+
+  void Run() override {
+    // The threads of the pool only run the work of its node, so binding them
+    // again does nothing but is cheap compared to the work. The work still
+    // runs unbound if it fails, such as when the node CPUs aren't allowed.
+    static std::atomic<bool> logged_failure{false};
+    if (!topology_->BindCurrentThread(node_) && !logged_failure.exchange(true))
+      PLOG(WARNING) << "Unable to bind a thread to NUMA node " << node_;
+    delegate_->Run();
+  }
+
+ private:
+  const NumaTopology* topology_;
+  size_t node_;
+  base::DelegateSimpleThread::Delegate* delegate_;
+
+  DISALLOW_COPY_AND_ASSIGN(NodeDelegate);
+};
+
+NumaThreadPool::NumaThreadPool(const string& name_prefix,
+                               size_t num_threads,
+                               const NumaTopology* topology)
+    : topology_(topology && topology->num_nodes() > 1 ? topology : nullptr) {
+  if (!topology_) {
+    pools_.emplace_back(
+        new base::DelegateSimpleThreadPool(name_prefix, num_threads));
+    return;
+  }
+  size_t num_cpus = topology_->num_cpus();
+  for (size_t node = 0; node < topology_->num_nodes(); node++) {
+    size_t node_threads = std::max(
+        num_threads * topology_->node_cpus(node).size() / num_cpus,
+        static_cast<size_t>(1));
+    pools_.emplace_back(new base::DelegateSimpleThreadPool(
+        base::StringPrintf("%s-node%zu", name_prefix.c_str(), node),
+        node_threads));
+  }
+}
+
+NumaThreadPool::~NumaThreadPool() = default;
+
+void NumaThreadPool::Start() {
+  for (auto& pool : pools_)
+    pool->Start();
+}
+
+void NumaThreadPool::AddWork(base::DelegateSimpleThread::Delegate* delegate,
+                             size_t node) {
+  CHECK_LT(node, pools_.size());
+  if (!topology_) {
+    pools_[node]->AddWork(delegate);
+    return;
+  }
+  node_delegates_.emplace_back(new NodeDelegate(topology_, node, delegate));
+  pools_[node]->AddWork(node_delegates_.back().get());
+}
+
+void NumaThreadPool::JoinAll() {
+  for (auto& pool : pools_)
+    pool->JoinAll();
+  node_delegates_.clear();
+}
+
+}  // namespace chromeos_update_engine
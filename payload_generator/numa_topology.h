@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_NUMA_TOPOLOGY_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_NUMA_TOPOLOGY_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/threading/simple_thread.h>
+
+namespace chromeos_update_engine {
+
+// The CPUs of each NUMA node of the machine, as listed by the kernel in
+// sysfs. A machine without NUMA has a single node with all its CPUs.
+class NumaTopology {
+ public:
+  NumaTopology() = default;
+
+  // Loads the CPUs of the nodes listed in |node_dir|, normally
+  // /sys/devices/system/node, from the "cpulist" file of each of its "nodeN"
+  // subdirectories. The nodes without CPUs are skipped. Returns false if no
+  // node with CPUs was found.
+  bool Load(const std::string& node_dir);
+
+  // Parses a kernel CPU list like "0-3,8,10-11" into |cpus|.
+  static bool ParseCpuList(const std::string& list, std::vector<int>* cpus);
+
+  size_t num_nodes() const { return node_cpus_.size(); }
+  const std::vector<int>& node_cpus(size_t node) const {
+    return node_cpus_[node];
+  }
+  size_t num_cpus() const;
+
+  // Returns the node whose threads process the work reading the block
+  // |block| of a partition of |num_blocks| blocks. The partition is split in
+  // one contiguous range per node, sized by the CPUs of the node, so the
+  // partition data cached in memory by each node is mostly read by its own
+  // threads.
+  size_t NodeForBlock(uint64_t block, uint64_t num_blocks) const;
+
+  // Restricts the calling thread to the CPUs of |node|, so the memory it
+  // touches first is allocated there. Returns whether it succeeded.
+  bool BindCurrentThread(size_t node) const;
+
+ private:
+  std::vector<std::vector<int>> node_cpus_;
+
+  DISALLOW_COPY_AND_ASSIGN(NumaTopology);
+};
+
+// A pool of |num_threads| threads split in one DelegateSimpleThreadPool per
+// node of a NumaTopology, in proportion to the CPUs of each node and with at
+// least one thread per node. The work added to a node only runs on its
+// threads, bound to the CPUs of the node, so the buffers allocated by the
+// work are local to the node. Without a topology, or with a single node, it
+// is a plain DelegateSimpleThreadPool.
+class NumaThreadPool {
+ public:
+  NumaThreadPool(const std::string& name_prefix,
+                 size_t num_threads,
+                 const NumaTopology* topology);
+  ~NumaThreadPool();
+
+  void Start();
+
+  // Adds |delegate| to the work of the threads of |node|, which must be less
+  // than num_nodes(). The |delegate| must outlive the JoinAll() call.
+  void AddWork(base::DelegateSimpleThread::Delegate* delegate, size_t node);
+
+  // Waits until all the work added is done.
+  void JoinAll();
+
+  size_t num_nodes() const { return pools_.size(); }
+
+ private:
+  class NodeDelegate;
+
+  const NumaTopology* topology_;
+  std::vector<std::unique_ptr<base::DelegateSimpleThreadPool>> pools_;
+  std::vector<std::unique_ptr<NodeDelegate>> node_delegates_;
+
+  DISALLOW_COPY_AND_ASSIGN(NumaThreadPool);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_NUMA_TOPOLOGY_H_
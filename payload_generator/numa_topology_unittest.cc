@@ -0,0 +1,136 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/numa_topology.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Counts the times it is run.
+class CountingDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit CountingDelegate(std::atomic<size_t>* runs) : runs_(runs) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override { (*runs_)++; }
+
+ private:
+  std::atomic<size_t>* runs_;
+
+  DISALLOW_COPY_AND_ASSIGN(CountingDelegate);
+};
+
+}  // namespace
+
+class NumaTopologyTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(node_dir_.CreateUniqueTempDir()); }
+
+  // Writes the |cpu_list| of the node directory |name|.
+  void WriteNode(const string& name, const string& cpu_list) {
+    base::FilePath dir = node_dir_.GetPath().Append(name);
+    ASSERT_TRUE(base::CreateDirectory(dir));
+    ASSERT_EQ(static_cast<int>(cpu_list.size()),
+              base::WriteFile(
+                  dir.Append("cpulist"), cpu_list.data(), cpu_list.size()));
+  }
+
+  base::ScopedTempDir node_dir_;
+};
+
+TEST_F(NumaTopologyTest, ParseCpuListTest) {
+  vector<int> cpus;
+  EXPECT_TRUE(NumaTopology::ParseCpuList("0-3,8,10-11\n", &cpus));
+  EXPECT_EQ((vector<int>{0, 1, 2, 3, 8, 10, 11}), cpus);
+  // The nodes with only memory have no CPUs.
+  EXPECT_TRUE(NumaTopology::ParseCpuList("\n", &cpus));
+  EXPECT_TRUE(cpus.empty());
+
+  EXPECT_FALSE(NumaTopology::ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(NumaTopology::ParseCpuList("1-2-3", &cpus));
+  EXPECT_FALSE(NumaTopology::ParseCpuList("a", &cpus));
+}
+
+TEST_F(NumaTopologyTest, LoadTest) {
+  NumaTopology topology;
+  EXPECT_FALSE(topology.Load(node_dir_.GetPath().value()));
+
+  // The nodes are sorted by number and the ones without CPUs are skipped.
+  WriteNode("node10", "4-7\n");
+  WriteNode("node2", "0-1\n");
+  WriteNode("node3", "\n");
+  WriteNode("possible", "0-7\n");
+  EXPECT_TRUE(topology.Load(node_dir_.GetPath().value()));
+  ASSERT_EQ(2U, topology.num_nodes());
+  EXPECT_EQ((vector<int>{0, 1}), topology.node_cpus(0));
+  EXPECT_EQ((vector<int>{4, 5, 6, 7}), topology.node_cpus(1));
+  EXPECT_EQ(6U, topology.num_cpus());
+}
+
+TEST_F(NumaTopologyTest, NodeForBlockTest) {
+  WriteNode("node0", "0-1\n");
+  WriteNode("node1", "2-7\n");
+  NumaTopology topology;
+  ASSERT_TRUE(topology.Load(node_dir_.GetPath().value()));
+
+  // The first node has a quarter of the CPUs, so the first quarter of the
+  // partition.
+  EXPECT_EQ(0U, topology.NodeForBlock(0, 800));
+  EXPECT_EQ(0U, topology.NodeForBlock(199, 800));
+  EXPECT_EQ(1U, topology.NodeForBlock(200, 800));
+  EXPECT_EQ(1U, topology.NodeForBlock(799, 800));
+  EXPECT_EQ(1U, topology.NodeForBlock(1000, 800));
+  EXPECT_EQ(0U, topology.NodeForBlock(0, 0));
+}
+
+TEST_F(NumaTopologyTest, ThreadPoolRunsAllWorkTest) {
+  // Both nodes list the first CPU, so the threads can be bound anywhere.
+  WriteNode("node0", "0\n");
+  WriteNode("node1", "0\n");
+  NumaTopology topology;
+  ASSERT_TRUE(topology.Load(node_dir_.GetPath().value()));
+
+  for (const NumaTopology* pool_topology :
+       vector<const NumaTopology*>{&topology, nullptr}) {
+    std::atomic<size_t> runs{0};
+    vector<std::unique_ptr<CountingDelegate>> delegates;
+    NumaThreadPool thread_pool("numa-test", 4, pool_topology);
+    size_t num_nodes = pool_topology ? 2 : 1;
+    EXPECT_EQ(num_nodes, thread_pool.num_nodes());
+    thread_pool.Start();
+    for (size_t i = 0; i < 10; i++) {
+      delegates.emplace_back(new CountingDelegate(&runs));
+      thread_pool.AddWork(delegates.back().get(), i % num_nodes);
+    }
+    thread_pool.JoinAll();
+    EXPECT_EQ(10U, runs);
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,180 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_reader.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <limits>
+#include <map>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Reads an image mapped read-only in memory.
+class MappedPartitionReader : public PartitionReader {
+ public:
+  MappedPartitionReader(const uint8_t* data, size_t size)
+      : data_(data), size_(size) {}
+
+  ~MappedPartitionReader() override {
+    if (data_)
+      munmap(const_cast<uint8_t*>(data_), size_);
+  }
+
+  bool Read(void* buf, size_t count, off_t offset) const override {
+    TEST_AND_RETURN_FALSE(offset >= 0 &&
+                          static_cast<uint64_t>(offset) <= size_ &&
+                          count <= size_ - offset);
+    memcpy(buf, data_ + offset, count);
+    return true;
+  }
+
+ private:
+  // The mapped image, or nullptr if it is empty.
+  const uint8_t* data_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedPartitionReader);
+};
+
+// Reads an image with pread().
+class FilePartitionReader : public PartitionReader {
+ public:
+  explicit FilePartitionReader(int fd) : fd_(fd) {}
+
+  ~FilePartitionReader() override { IGNORE_EINTR(close(fd_)); }
+
+  bool Read(void* buf, size_t count, off_t offset) const override {
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd_, buf, count, offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(count));
+    return true;
+  }
+
+ private:
+  int fd_;
+
+  DISALLOW_COPY_AND_ASSIGN(FilePartitionReader);
+};
+
+// The images mapped by SetMappedPartitions(), by path.
+std::map<string, unique_ptr<PartitionReader>> mapped_partitions;
+
+}  // namespace
+
+unique_ptr<PartitionReader> PartitionReader::CreateMapped(const string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+  if (fd < 0) {
+    PLOG(ERROR) << "Opening " << path;
+    return nullptr;
+  }
+  ScopedFdCloser fd_closer(&fd);
+  off_t size = utils::FileSize(fd);
+  if (size < 0 ||
+      static_cast<uint64_t>(size) > std::numeric_limits<size_t>::max()) {
+    LOG(WARNING) << "Can't map " << path << " of size " << size;
+    return nullptr;
+  }
+  if (size == 0)
+    return unique_ptr<PartitionReader>(new MappedPartitionReader(nullptr, 0));
+
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    PLOG(WARNING) << "Failed to map " << path;
+    return nullptr;
+  }
+  return unique_ptr<PartitionReader>(
+      new MappedPartitionReader(static_cast<const uint8_t*>(data), size));
+}
+
+unique_ptr<PartitionReader> PartitionReader::CreateFromFile(
+    const string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+  if (fd < 0) {
+    PLOG(ERROR) << "Opening " << path;
+    return nullptr;
+  }
+  return unique_ptr<PartitionReader>(new FilePartitionReader(fd));
+}
+
+bool PartitionReader::ReadExtents(const vector<Extent>& extents,
+                                  brillo::Blob* out_data,
+                                  ssize_t out_data_size,
+                                  size_t block_size) const {
+  TEST_AND_RETURN_FALSE(out_data_size >= 0);
+  brillo::Blob data(out_data_size);
+  uint64_t bytes_read = 0;
+  for (const Extent& extent : extents) {
+    uint64_t bytes = extent.num_blocks() * block_size;
+    TEST_AND_RETURN_FALSE(bytes_read + bytes <=
+                          static_cast<uint64_t>(out_data_size));
+    TEST_AND_RETURN_FALSE(Read(
+        data.data() + bytes_read, bytes, extent.start_block() * block_size));
+    bytes_read += bytes;
+  }
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<uint64_t>(out_data_size));
+  *out_data = std::move(data);
+  return true;
+}
+
+void SetMappedPartitions(const vector<string>& paths) {
+  mapped_partitions.clear();
+  for (const string& path : paths) {
+    if (path.empty() || mapped_partitions.count(path))
+      continue;
+    unique_ptr<PartitionReader> reader = PartitionReader::CreateMapped(path);
+    if (!reader) {
+      LOG(WARNING) << "Reading " << path << " from the file instead.";
+      continue;
+    }
+    mapped_partitions[path] = std::move(reader);
+  }
+}
+
+const PartitionReader* GetMappedPartition(const string& path) {
+  auto reader = mapped_partitions.find(path);
+  return reader == mapped_partitions.end() ? nullptr : reader->second.get();
+}
+
+bool ReadPartitionExtents(const string& path,
+                          const vector<Extent>& extents,
+                          brillo::Blob* out_data,
+                          ssize_t out_data_size,
+                          size_t block_size) {
+  const PartitionReader* reader = GetMappedPartition(path);
+  if (reader)
+    return reader->ReadExtents(extents, out_data, out_data_size, block_size);
+  return utils::ReadExtents(
+      path, extents, out_data, out_data_size, block_size);
+}
+
+}  // namespace chromeos_update_engine
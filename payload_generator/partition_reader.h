@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_READER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_READER_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Reads the data of a partition image. All the methods are thread safe.
+class PartitionReader {
+ public:
+  virtual ~PartitionReader() = default;
+
+  // Creates a reader of the image at |path| mapped read-only in memory, so the
+  // reads are copies from the page cache without a syscall each. Returns
+  // nullptr if the image can't be mapped.
+  static std::unique_ptr<PartitionReader> CreateMapped(const std::string& path);
+
+  // Creates a reader of the image at |path| reading it with pread() through a
+  // file descriptor opened once. Returns nullptr if the image can't be opened.
+  static std::unique_ptr<PartitionReader> CreateFromFile(
+      const std::string& path);
+
+  // Reads the |count| bytes at |offset| into |buf|. Returns whether all of them
+  // were read.
+  virtual bool Read(void* buf, size_t count, off_t offset) const = 0;
+
+  // Reads the data of the |extents| of |block_size| bytes blocks, which must
+  // add up to |out_data_size| bytes, into |out_data|, like
+  // utils::ReadExtents().
+  bool ReadExtents(const std::vector<Extent>& extents,
+                   brillo::Blob* out_data,
+                   ssize_t out_data_size,
+                   size_t block_size) const;
+
+ protected:
+  PartitionReader() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PartitionReader);
+};
+
+// Maps the partition images at |paths| read-only, once for all the phases of
+// the generation, which then read them through GetMappedPartition() and
+// ReadPartitionExtents() instead of opening and reading them on every call.
+// The images that can't be mapped, like those too big for the address space,
+// are still read from their files. An empty |paths| unmaps them. It must not
+// be called while operations are being generated.
+void SetMappedPartitions(const std::vector<std::string>& paths);
+
+// Returns the reader of the image at |path| mapped by SetMappedPartitions(),
+// or nullptr if it isn't mapped.
+const PartitionReader* GetMappedPartition(const std::string& path);
+
+// Reads the |extents| of the image at |path| like utils::ReadExtents(),
+// through its mapped reader if it was mapped by SetMappedPartitions().
+bool ReadPartitionExtents(const std::string& path,
+                          const std::vector<Extent>& extents,
+                          brillo::Blob* out_data,
+                          ssize_t out_data_size,
+                          size_t block_size);
+
+// Maps the partition images at |paths| with SetMappedPartitions() while the
+// object is alive.
+class ScopedMappedPartitions {
+ public:
+  explicit ScopedMappedPartitions(const std::vector<std::string>& paths) {
+    SetMappedPartitions(paths);
+  }
+  ~ScopedMappedPartitions() { SetMappedPartitions({}); }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ScopedMappedPartitions);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_READER_H_
@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_reader.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class PartitionReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    part_data_.resize(4 * kBlockSize);
+    test_utils::FillWithData(&part_data_);
+    ASSERT_TRUE(utils::WriteFile(
+        part_file_.path().c_str(), part_data_.data(), part_data_.size()));
+  }
+
+  // Checks that |reader| reads the extents of the partition in order.
+  void ExpectReadsExtents(const PartitionReader& reader) {
+    brillo::Blob data;
+    EXPECT_TRUE(reader.ReadExtents(
+        {ExtentForRange(2, 1), ExtentForRange(0, 1)}, &data, 2 * kBlockSize,
+        kBlockSize));
+    brillo::Blob expected(part_data_.begin() + 2 * kBlockSize,
+                          part_data_.begin() + 3 * kBlockSize);
+    expected.insert(expected.end(),
+                    part_data_.begin(),
+                    part_data_.begin() + kBlockSize);
+    EXPECT_EQ(expected, data);
+
+    // The extents must add up to the size read.
+    EXPECT_FALSE(reader.ReadExtents(
+        {ExtentForRange(0, 2)}, &data, kBlockSize, kBlockSize));
+    // Reads past the end of the partition fail.
+    EXPECT_FALSE(reader.ReadExtents(
+        {ExtentForRange(3, 2)}, &data, 2 * kBlockSize, kBlockSize));
+  }
+
+  test_utils::ScopedTempFile part_file_{"PartitionReaderTest.XXXXXX"};
+  brillo::Blob part_data_;
+};
+
+TEST_F(PartitionReaderTest, MappedReaderTest) {
+  unique_ptr<PartitionReader> reader =
+      PartitionReader::CreateMapped(part_file_.path());
+  ASSERT_NE(nullptr, reader);
+  ExpectReadsExtents(*reader);
+}
+
+TEST_F(PartitionReaderTest, FileReaderTest) {
+  unique_ptr<PartitionReader> reader =
+      PartitionReader::CreateFromFile(part_file_.path());
+  ASSERT_NE(nullptr, reader);
+  ExpectReadsExtents(*reader);
+  EXPECT_EQ(nullptr, PartitionReader::CreateFromFile("/non/existent/path"));
+}
+
+TEST_F(PartitionReaderTest, MappedEmptyImageTest) {
+  test_utils::ScopedTempFile empty_file("PartitionReaderTest-empty.XXXXXX");
+  unique_ptr<PartitionReader> reader =
+      PartitionReader::CreateMapped(empty_file.path());
+  ASSERT_NE(nullptr, reader);
+  uint8_t byte;
+  EXPECT_TRUE(reader->Read(&byte, 0, 0));
+  EXPECT_FALSE(reader->Read(&byte, 1, 0));
+}
+
+TEST_F(PartitionReaderTest, MappedPartitionsTest) {
+  test_utils::ScopedTempFile other_file("PartitionReaderTest-other.XXXXXX");
+  ASSERT_TRUE(utils::WriteFile(
+      other_file.path().c_str(), part_data_.data(), part_data_.size()));
+
+  // The empty and repeated paths are ignored.
+  SetMappedPartitions({part_file_.path(), "", part_file_.path()});
+  const PartitionReader* reader = GetMappedPartition(part_file_.path());
+  ASSERT_NE(nullptr, reader);
+  ExpectReadsExtents(*reader);
+  EXPECT_EQ(nullptr, GetMappedPartition(other_file.path()));
+
+  // The partitions not mapped are read from their files.
+  brillo::Blob data;
+  EXPECT_TRUE(ReadPartitionExtents(
+      part_file_.path(), {ExtentForRange(1, 1)}, &data, kBlockSize,
+      kBlockSize));
+  EXPECT_EQ(brillo::Blob(part_data_.begin() + kBlockSize,
+                         part_data_.begin() + 2 * kBlockSize),
+            data);
+  EXPECT_TRUE(ReadPartitionExtents(
+      other_file.path(), {ExtentForRange(0, 4)}, &data, 4 * kBlockSize,
+      kBlockSize));
+  EXPECT_EQ(part_data_, data);
+
+  SetMappedPartitions({});
+  EXPECT_EQ(nullptr, GetMappedPartition(part_file_.path()));
+}
+
+}  // namespace chromeos_update_engine
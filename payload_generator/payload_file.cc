@@ -17,14 +17,22 @@
 #include "update_engine/payload_generator/payload_file.h"
 
 #include <endian.h>
+#include <fcntl.h>
 
 #include <algorithm>
 #include <map>
 
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/file_descriptor_utils.h"
 #include "update_engine/payload_consumer/file_writer.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/annotated_operation.h"
@@ -51,11 +59,39 @@ struct DeltaObject {
   off_t size;
 };
 
-// Writes the uint64_t passed in in host-endian to the file as big-endian.
-// Returns true on success.
-bool WriteUint64AsBigEndian(FileWriter* writer, const uint64_t value) {
+// The size of the buffer used to copy the data blobs to the payload.
+const size_t kCopyBufferSize = 1024 * 1024;
+
+// The files of the split payload other than the partition data.
+const char kSplitMetadataFileName[] = "metadata.bin";
+const char kSplitSignatureFileName[] = "signature.bin";
+
+// Appends the uint64_t passed in in host-endian to |data| as big-endian.
+void AppendUint64AsBigEndian(string* data, const uint64_t value) {
   uint64_t value_be = htobe64(value);
-  TEST_AND_RETURN_FALSE(writer->Write(&value_be, sizeof(value_be)));
+  data->append(reinterpret_cast<const char*>(&value_be), sizeof(value_be));
+}
+
+// Copies the |length| bytes at |offset| in |in_fd| to the new file |path|.
+bool CopyRangeToFile(int in_fd,
+                     uint64_t offset,
+                     uint64_t length,
+                     const string& path) {
+  DirectFileWriter writer;
+  TEST_AND_RETURN_FALSE_ERRNO(
+      writer.Open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) == 0);
+  ScopedFileWriterCloser writer_closer(&writer);
+  brillo::Blob buf(kCopyBufferSize);
+  for (uint64_t pos = 0; pos < length;) {
+    size_t count =
+        std::min(length - pos, static_cast<uint64_t>(buf.size()));
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(utils::PReadAll(
+        in_fd, buf.data(), count, offset + pos, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(count));
+    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), count));
+    pos += count;
+  }
   return true;
 }
 
@@ -65,6 +101,13 @@ bool PayloadFile::Init(const PayloadGenerationConfig& config) {
   TEST_AND_RETURN_FALSE(config.version.Validate());
   major_version_ = config.version.major;
   manifest_.set_minor_version(config.version.minor);
+  // The in-place operations read the blocks written by the previous ones, so
+  // none is skipped.
+  dst_hashes_ = config.dst_hashes && !config.version.InplaceUpdate();
+  apply_memory_hints_ = config.apply_memory_hints;
+  split_payload_dir_ = config.split_payload_dir;
+  TEST_AND_RETURN_FALSE(split_payload_dir_.empty() ||
+                        major_version_ == kBrilloMajorPayloadVersion);
 
   if (!config.source.ImageInfoIsEmpty())
     *(manifest_.mutable_old_image_info()) = config.source.image_info;
@@ -77,6 +120,10 @@ bool PayloadFile::Init(const PayloadGenerationConfig& config) {
   return true;
 }
 
+void PayloadFile::SetZstdDictionary(const brillo::Blob& dictionary) {
+  manifest_.set_zstd_dictionary(dictionary.data(), dictionary.size());
+}
+
 bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
                                const PartitionConfig& new_conf,
                                const vector<AnnotatedOperation>& aops) {
@@ -90,6 +137,18 @@ bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
   Partition part;
   part.name = new_conf.name;
   part.aops = aops;
+  if (dst_hashes_) {
+    TEST_AND_RETURN_FALSE(SetDestinationHashes(
+        new_conf.path, manifest_.block_size(), &part.aops));
+  }
+  if (apply_memory_hints_) {
+    for (AnnotatedOperation& aop : part.aops) {
+      aop.op.set_apply_memory(
+          diff_utils::EstimateApplyMemory(aop.op, manifest_.block_size()));
+      manifest_.set_max_apply_memory(
+          std::max(manifest_.max_apply_memory(), aop.op.apply_memory()));
+    }
+  }
   part.postinstall = new_conf.postinstall;
   // Initialize the PartitionInfo objects if present.
   if (!old_conf.path.empty())
@@ -106,13 +165,8 @@ bool PayloadFile::WritePayload(const string& payload_file,
                                const string& private_key_path,
                                uint64_t* metadata_size_out) {
   // Reorder the data blobs with the manifest_.
-  string ordered_blobs_path;
-  TEST_AND_RETURN_FALSE(utils::MakeTempFile(
-      "CrAU_temp_data.ordered.XXXXXX",
-      &ordered_blobs_path,
-      nullptr));
-  ScopedPathUnlinker ordered_blobs_unlinker(ordered_blobs_path);
-  TEST_AND_RETURN_FALSE(ReorderDataBlobs(data_blobs_path, ordered_blobs_path));
+  vector<BlobRange> blob_ranges;
+  TEST_AND_RETURN_FALSE(ReorderDataBlobs(data_blobs_path, &blob_ranges));
 
   // Check that install op blobs are in order.
   uint64_t next_blob_offset = 0;
@@ -143,6 +197,8 @@ bool PayloadFile::WritePayload(const string& payload_file,
         if (!part.postinstall.filesystem_type.empty())
           partition->set_filesystem_type(part.postinstall.filesystem_type);
         partition->set_postinstall_optional(part.postinstall.optional);
+        if (part.postinstall.parallel)
+          partition->set_postinstall_parallel(true);
       }
       for (const AnnotatedOperation& aop : part.aops) {
         *partition->add_operations() = aop.op;
@@ -151,6 +207,12 @@ bool PayloadFile::WritePayload(const string& payload_file,
         *(partition->mutable_old_partition_info()) = part.old_info;
       if (part.new_info.has_size() || part.new_info.has_hash())
         *(partition->mutable_new_partition_info()) = part.new_info;
+      if (!split_payload_dir_.empty() && part.data_length > 0) {
+        partition->set_data_offset(part.data_offset);
+        partition->set_data_length(part.data_length);
+        partition->set_data_sha256_hash(part.data_hash.data(),
+                                        part.data_hash.size());
+      }
     } else {
       // major_version_ == kChromeOSMajorPayloadVersion
       if (part.name == kLegacyPartitionNameKernel) {
@@ -187,35 +249,24 @@ bool PayloadFile::WritePayload(const string& payload_file,
   string serialized_manifest;
   TEST_AND_RETURN_FALSE(manifest_.AppendToString(&serialized_manifest));
 
-  uint64_t metadata_size =
-      sizeof(kDeltaMagic) + 2 * sizeof(uint64_t) + serialized_manifest.size();
-
-  LOG(INFO) << "Writing final delta file header...";
-  DirectFileWriter writer;
-  TEST_AND_RETURN_FALSE_ERRNO(writer.Open(payload_file.c_str(),
-                                          O_WRONLY | O_CREAT | O_TRUNC,
-                                          0644) == 0);
-  ScopedFileWriterCloser writer_closer(&writer);
-
-  // Write header
-  TEST_AND_RETURN_FALSE_ERRNO(writer.Write(kDeltaMagic, sizeof(kDeltaMagic)));
+  // The metadata is built in memory and the payload is then written in a
+  // single pass, hashing what is signed as it is written.
+  string metadata(kDeltaMagic, sizeof(kDeltaMagic));
 
   // Write major version number
-  TEST_AND_RETURN_FALSE(WriteUint64AsBigEndian(&writer, major_version_));
+  AppendUint64AsBigEndian(&metadata, major_version_);
 
   // Write protobuf length
-  TEST_AND_RETURN_FALSE(WriteUint64AsBigEndian(&writer,
-                                               serialized_manifest.size()));
+  AppendUint64AsBigEndian(&metadata, serialized_manifest.size());
 
   // Write metadata signature size.
   uint32_t metadata_signature_size = 0;
   if (major_version_ == kBrilloMajorPayloadVersion) {
     // Metadata signature has the same size as payload signature, because they
     // are both the same kind of signature for the same kind of hash.
-    uint32_t metadata_signature_size = htobe32(signature_blob_length);
-    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(&metadata_signature_size,
-                                             sizeof(metadata_signature_size)));
-    metadata_size += sizeof(metadata_signature_size);
+    uint32_t metadata_signature_size_be = htobe32(signature_blob_length);
+    metadata.append(reinterpret_cast<const char*>(&metadata_signature_size_be),
+                    sizeof(metadata_signature_size_be));
     // Set correct size instead of big endian size.
     metadata_signature_size = signature_blob_length;
   }
@@ -223,16 +274,28 @@ bool PayloadFile::WritePayload(const string& payload_file,
   // Write protobuf
   LOG(INFO) << "Writing final delta file protobuf... "
             << serialized_manifest.size();
-  TEST_AND_RETURN_FALSE_ERRNO(
-      writer.Write(serialized_manifest.data(), serialized_manifest.size()));
+  metadata += serialized_manifest;
+  uint64_t metadata_size = metadata.size();
+
+  LOG(INFO) << "Writing final delta file header...";
+  DirectFileWriter writer;
+  TEST_AND_RETURN_FALSE_ERRNO(writer.Open(payload_file.c_str(),
+                                          O_WRONLY | O_CREAT | O_TRUNC,
+                                          0644) == 0);
+  ScopedFileWriterCloser writer_closer(&writer);
+  TEST_AND_RETURN_FALSE_ERRNO(writer.Write(metadata.data(), metadata.size()));
+
+  // The payload signature is over the metadata and the data blobs, skipping
+  // the metadata signature.
+  HashCalculator payload_hasher;
+  TEST_AND_RETURN_FALSE(payload_hasher.Update(metadata.data(), metadata.size()));
 
   // Write metadata signature blob.
   if (major_version_ == kBrilloMajorPayloadVersion &&
       !private_key_path.empty()) {
     brillo::Blob metadata_hash, metadata_signature;
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfFile(payload_file,
-                                                             metadata_size,
-                                                             &metadata_hash));
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+        metadata.data(), metadata.size(), &metadata_hash));
     TEST_AND_RETURN_FALSE(
         PayloadSigner::SignHashWithKeys(metadata_hash,
                                         vector<string>(1, private_key_path),
@@ -243,82 +306,176 @@ bool PayloadFile::WritePayload(const string& payload_file,
 
   // Append the data blobs
   LOG(INFO) << "Writing final delta file data blobs...";
-  int blobs_fd = open(ordered_blobs_path.c_str(), O_RDONLY, 0);
-  ScopedFdCloser blobs_fd_closer(&blobs_fd);
-  TEST_AND_RETURN_FALSE(blobs_fd >= 0);
-  for (;;) {
-    vector<char> buf(1024 * 1024);
-    ssize_t rc = read(blobs_fd, buf.data(), buf.size());
-    if (0 == rc) {
-      // EOF
-      break;
-    }
-    TEST_AND_RETURN_FALSE_ERRNO(rc > 0);
-    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), rc));
-  }
+  TEST_AND_RETURN_FALSE(
+      WriteDataBlobs(data_blobs_path, blob_ranges, &writer, &payload_hasher));
 
   // Write payload signature blob.
   if (!private_key_path.empty()) {
     LOG(INFO) << "Signing the update...";
+    TEST_AND_RETURN_FALSE(payload_hasher.Finalize());
     brillo::Blob signature_blob;
-    TEST_AND_RETURN_FALSE(PayloadSigner::SignPayload(
-        payload_file,
-        vector<string>(1, private_key_path),
-        metadata_size,
-        metadata_signature_size,
-        metadata_size + metadata_signature_size + manifest_.signatures_offset(),
-        &signature_blob));
+    TEST_AND_RETURN_FALSE(
+        PayloadSigner::SignHashWithKeys(payload_hasher.raw_hash(),
+                                        vector<string>(1, private_key_path),
+                                        &signature_blob));
     TEST_AND_RETURN_FALSE_ERRNO(
         writer.Write(signature_blob.data(), signature_blob.size()));
   }
 
+  if (!split_payload_dir_.empty()) {
+    TEST_AND_RETURN_FALSE(WriteSplitPayload(payload_file,
+                                            metadata_size +
+                                                metadata_signature_size,
+                                            signature_blob_length));
+  }
+
   ReportPayloadUsage(metadata_size);
   *metadata_size_out = metadata_size;
   return true;
 }
 
-bool PayloadFile::ReorderDataBlobs(
-    const string& data_blobs_path,
-    const string& new_data_blobs_path) {
+bool PayloadFile::ReorderDataBlobs(const string& data_blobs_path,
+                                   vector<BlobRange>* blob_ranges) {
   int in_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
   TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
   ScopedFdCloser in_fd_closer(&in_fd);
 
-  DirectFileWriter writer;
-  int rc = writer.Open(
-      new_data_blobs_path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
-  if (rc != 0) {
-    PLOG(ERROR) << "Error creating " << new_data_blobs_path;
-    return false;
-  }
-  ScopedFileWriterCloser writer_closer(&writer);
+  blob_ranges->clear();
   uint64_t out_file_size = 0;
-
+  brillo::Blob buf;
   for (auto& part : part_vec_) {
+    HashCalculator part_hasher;
+    part.data_offset = out_file_size;
     for (AnnotatedOperation& aop : part.aops) {
       if (!aop.op.has_data_offset())
         continue;
       CHECK(aop.op.has_data_length());
-      brillo::Blob buf(aop.op.data_length());
-      ssize_t rc = pread(in_fd, buf.data(), buf.size(), aop.op.data_offset());
-      TEST_AND_RETURN_FALSE(rc == static_cast<ssize_t>(buf.size()));
+      uint64_t offset = aop.op.data_offset();
+      uint64_t length = aop.op.data_length();
+
+      // Add the hash of the data blobs for this operation. The blob of the
+      // dummy operation for the signature is not hashed, since it isn't in
+      // |data_blobs_path|.
+      HashCalculator hasher;
+      for (uint64_t pos = 0; pos < length; pos += buf.size()) {
+        buf.resize(
+            std::min(length - pos, static_cast<uint64_t>(kCopyBufferSize)));
+        ssize_t bytes_read = 0;
+        TEST_AND_RETURN_FALSE(utils::PReadAll(
+            in_fd, buf.data(), buf.size(), offset + pos, &bytes_read));
+        TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(buf.size()));
+        TEST_AND_RETURN_FALSE(hasher.Update(buf.data(), buf.size()));
+        TEST_AND_RETURN_FALSE(part_hasher.Update(buf.data(), buf.size()));
+      }
+      TEST_AND_RETURN_FALSE(hasher.Finalize());
+      const brillo::Blob& hash = hasher.raw_hash();
+      aop.op.set_data_sha256_hash(hash.data(), hash.size());
+
+      // The blobs stored one after the other are copied at once.
+      if (!blob_ranges->empty() &&
+          blob_ranges->back().offset + blob_ranges->back().length == offset) {
+        blob_ranges->back().length += length;
+      } else {
+        blob_ranges->push_back({offset, length});
+      }
+      aop.op.set_data_offset(out_file_size);
+      out_file_size += length;
+    }
+    part.data_length = out_file_size - part.data_offset;
+    TEST_AND_RETURN_FALSE(part_hasher.Finalize());
+    part.data_hash = part_hasher.raw_hash();
+  }
+  return true;
+}
 
-      // Add the hash of the data blobs for this operation
-      TEST_AND_RETURN_FALSE(AddOperationHash(&aop.op, buf));
+// static
+bool PayloadFile::SetDestinationHashes(const string& new_part_path,
+                                       uint64_t block_size,
+                                       vector<AnnotatedOperation>* aops) {
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+  TEST_AND_RETURN_FALSE(fd->Open(new_part_path.c_str(), O_RDONLY));
+  for (AnnotatedOperation& aop : *aops) {
+    if (aop.op.type() == InstallOperation::DISCARD ||
+        aop.op.dst_extents_size() == 0) {
+      continue;
+    }
+    brillo::Blob hash;
+    TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
+        fd, aop.op.dst_extents(), block_size, &hash));
+    aop.op.set_dst_sha256_hash(hash.data(), hash.size());
+  }
+  fd->Close();
+  return true;
+}
 
-      aop.op.set_data_offset(out_file_size);
-      TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), buf.size()));
-      out_file_size += buf.size();
+bool PayloadFile::WriteDataBlobs(const string& data_blobs_path,
+                                 const vector<BlobRange>& blob_ranges,
+                                 FileWriter* writer,
+                                 HashCalculator* hasher) {
+  int in_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
+  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
+  ScopedFdCloser in_fd_closer(&in_fd);
+
+  brillo::Blob buf(kCopyBufferSize);
+  for (const BlobRange& range : blob_ranges) {
+    for (uint64_t pos = 0; pos < range.length;) {
+      size_t count = std::min(range.length - pos,
+                              static_cast<uint64_t>(buf.size()));
+      ssize_t bytes_read = 0;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(
+          in_fd, buf.data(), count, range.offset + pos, &bytes_read));
+      TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(count));
+      TEST_AND_RETURN_FALSE(hasher->Update(buf.data(), count));
+      TEST_AND_RETURN_FALSE_ERRNO(writer->Write(buf.data(), count));
+      pos += count;
     }
   }
   return true;
 }
 
-bool PayloadFile::AddOperationHash(InstallOperation* op,
-                                   const brillo::Blob& buf) {
-  brillo::Blob hash;
-  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(buf, &hash));
-  op->set_data_sha256_hash(hash.data(), hash.size());
+bool PayloadFile::WriteSplitPayload(const string& payload_file,
+                                    uint64_t data_offset,
+                                    uint64_t signature_length) const {
+  base::FilePath dir(split_payload_dir_);
+  TEST_AND_RETURN_FALSE(base::CreateDirectory(dir));
+  int in_fd = open(payload_file.c_str(), O_RDONLY, 0);
+  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
+  ScopedFdCloser in_fd_closer(&in_fd);
+
+  LOG(INFO) << "Writing the split payload to " << split_payload_dir_;
+  TEST_AND_RETURN_FALSE(CopyRangeToFile(
+      in_fd, 0, data_offset, dir.Append(kSplitMetadataFileName).value()));
+  uint64_t data_length = 0;
+  for (const auto& part : part_vec_) {
+    data_length = std::max(data_length, part.data_offset + part.data_length);
+    if (part.data_length == 0)
+      continue;
+    base::FilePath path = dir.Append(
+        base::ToLowerASCII(
+            base::HexEncode(part.data_hash.data(), part.data_hash.size())) +
+        ".bin");
+    // The data of a partition is the same in every payload where the partition
+    // has the same operations, e.g. the full payloads of several versions of
+    // an unchanged partition, so it is written once in a shared directory.
+    int64_t size = 0;
+    if (base::GetFileSize(path, &size) &&
+        size == static_cast<int64_t>(part.data_length)) {
+      LOG(INFO) << "Reusing " << path.value() << " for partition "
+                << part.name;
+      continue;
+    }
+    TEST_AND_RETURN_FALSE(CopyRangeToFile(in_fd,
+                                          data_offset + part.data_offset,
+                                          part.data_length,
+                                          path.value()));
+  }
+  if (signature_length > 0) {
+    TEST_AND_RETURN_FALSE(
+        CopyRangeToFile(in_fd,
+                        data_offset + data_length,
+                        signature_length,
+                        dir.Append(kSplitSignatureFileName).value()));
+  }
   return true;
 }
 
@@ -356,6 +513,8 @@ void PayloadFile::ReportPayloadUsage(uint64_t metadata_size) const {
                                   "",
                                   "<total>",
                                   1);
+  LOG(INFO) << "REPLACE_BZ not tried for " << diff_utils::GetSkippedBzipCount()
+            << " operations with incompressible data.";
 }
 
 }  // namespace chromeos_update_engine
@@ -23,6 +23,8 @@
 #include <brillo/secure_blob.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/payload_consumer/file_writer.h"
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/update_metadata.pb.h"
@@ -45,6 +47,10 @@ class PayloadFile {
                     const PartitionConfig& new_conf,
                     const std::vector<AnnotatedOperation>& aops);
 
+  // Ship the zstd |dictionary| used by the REPLACE_ZSTD operations in the
+  // payload manifest.
+  void SetZstdDictionary(const brillo::Blob& dictionary);
+
   // Write the payload to the |payload_file| file. The operations reference
   // blobs in the |data_blobs_path| file and the blobs will be reordered in the
   // payload file to match the order of the operations. The size of the metadata
@@ -56,24 +62,48 @@ class PayloadFile {
 
  private:
   FRIEND_TEST(PayloadFileTest, ReorderBlobsTest);
+  FRIEND_TEST(PayloadFileTest, DestinationHashesTest);
+  FRIEND_TEST(PayloadFileTest, SplitPayloadTest);
 
-  // Computes a SHA256 hash of the given buf and sets the hash value in the
-  // operation so that update_engine could verify. This hash should be set
-  // for all operations that have a non-zero data blob. One exception is the
-  // dummy operation for signature blob because the contents of the signature
-  // blob will not be available at payload creation time. So, update_engine will
-  // gracefully ignore the dummy signature operation.
-  static bool AddOperationHash(InstallOperation* op, const brillo::Blob& buf);
+  // A range of bytes in the data blobs file.
+  struct BlobRange {
+    uint64_t offset;
+    uint64_t length;
+  };
 
   // Install operations in the manifest may reference data blobs, which
-  // are in data_blobs_path. This function creates a new data blobs file
-  // with the data blobs in the same order as the referencing install
-  // operations in the manifest. E.g. if manifest[0] has a data blob
-  // "X" at offset 1, manifest[1] has a data blob "Y" at offset 0,
-  // and data_blobs_path's file contains "YX", new_data_blobs_path
-  // will set to be a file that contains "XY".
+  // are in data_blobs_path. This function sets the data offsets of the
+  // operations to place the data blobs in the same order as the referencing
+  // install operations in the manifest, and stores in |blob_ranges| the ranges
+  // of |data_blobs_path| to copy in that order. E.g. if manifest[0] has a
+  // data blob "X" at offset 1, manifest[1] has a data blob "Y" at offset 0,
+  // and data_blobs_path's file contains "YX", the ranges copied make "XY".
+  // It also sets the SHA256 hash of the data blob of every operation, so
+  // update_engine can verify it, and the range and hash of the data of every
+  // partition.
   bool ReorderDataBlobs(const std::string& data_blobs_path,
-                        const std::string& new_data_blobs_path);
+                        std::vector<BlobRange>* blob_ranges);
+
+  // Sets the SHA256 hash of the blocks of the new partition |new_part_path|
+  // written by each operation of |aops|, except the DISCARD ones, whose blocks
+  // read as undefined.
+  static bool SetDestinationHashes(const std::string& new_part_path,
+                                   uint64_t block_size,
+                                   std::vector<AnnotatedOperation>* aops);
+
+  // Writes to |writer| the |blob_ranges| of |data_blobs_path|, in order, and
+  // adds them to |hasher|.
+  static bool WriteDataBlobs(const std::string& data_blobs_path,
+                             const std::vector<BlobRange>& blob_ranges,
+                             FileWriter* writer,
+                             HashCalculator* hasher);
+
+  // Writes the payload |payload_file|, whose data starts at |data_offset|,
+  // split in |split_payload_dir_| as described in PayloadGenerationConfig. The
+  // payload signature is the last |signature_length| bytes of the payload.
+  bool WriteSplitPayload(const std::string& payload_file,
+                         uint64_t data_offset,
+                         uint64_t signature_length) const;
 
   // Print in stderr the Payload usage report.
   void ReportPayloadUsage(uint64_t metadata_size) const;
@@ -81,6 +111,15 @@ class PayloadFile {
   // The major_version of the requested payload.
   uint64_t major_version_;
 
+  // Whether the operations carry the hash of their destination blocks.
+  bool dst_hashes_{false};
+
+  // Whether the operations carry the estimate of their apply memory.
+  bool apply_memory_hints_{false};
+
+  // The directory where the payload is also written split, if not empty.
+  std::string split_payload_dir_;
+
   DeltaArchiveManifest manifest_;
 
   // Struct has necessary information to write PartitionUpdate in protobuf.
@@ -95,6 +134,11 @@ class PayloadFile {
     PartitionInfo new_info;
 
     PostInstallConfig postinstall;
+
+    // The range of the payload data used by the operations, and its hash.
+    uint64_t data_offset{0};
+    uint64_t data_length{0};
+    brillo::Blob data_hash;
   };
 
   std::vector<Partition> part_vec_;
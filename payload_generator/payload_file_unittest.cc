@@ -16,13 +16,22 @@
 
 #include "update_engine/payload_generator/payload_file.h"
 
+#include <fcntl.h>
+
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <base/files/file_path.h>
+#include <base/files/scoped_temp_dir.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
+#include "update_engine/payload_consumer/file_writer.h"
+#include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
 using std::string;
@@ -71,7 +80,24 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   aop.op.set_data_length(6);
   payload_.part_vec_[1].aops = {aop};
 
-  EXPECT_TRUE(payload_.ReorderDataBlobs(orig_blobs, new_blobs));
+  vector<PayloadFile::BlobRange> blob_ranges;
+  EXPECT_TRUE(payload_.ReorderDataBlobs(orig_blobs, &blob_ranges));
+  // The two rootfs blobs are stored one after the other, so they are copied
+  // at once.
+  EXPECT_EQ(2U, blob_ranges.size());
+  {
+    DirectFileWriter writer;
+    EXPECT_EQ(0, writer.Open(new_blobs.c_str(), O_WRONLY | O_TRUNC, 0644));
+    ScopedFileWriterCloser writer_closer(&writer);
+    HashCalculator hasher;
+    EXPECT_TRUE(PayloadFile::WriteDataBlobs(
+        orig_blobs, blob_ranges, &writer, &hasher));
+    EXPECT_TRUE(hasher.Finalize());
+    brillo::Blob expected_hash;
+    EXPECT_TRUE(
+        HashCalculator::RawHashOfBytes("bcdakernel", 10, &expected_hash));
+    EXPECT_EQ(expected_hash, hasher.raw_hash());
+  }
 
   const vector<AnnotatedOperation>& part0_aops = payload_.part_vec_[0].aops;
   const vector<AnnotatedOperation>& part1_aops = payload_.part_vec_[1].aops;
@@ -89,6 +115,101 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   EXPECT_EQ(1U, part1_aops.size());
   EXPECT_EQ(4U, part1_aops[0].op.data_offset());
   EXPECT_EQ(6U, part1_aops[0].op.data_length());
+
+  // The operations have the hash of their blobs.
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes("bcd", 3, &expected_hash));
+  EXPECT_EQ(string(expected_hash.begin(), expected_hash.end()),
+            part0_aops[0].op.data_sha256_hash());
+}
+
+TEST_F(PayloadFileTest, DestinationHashesTest) {
+  test_utils::ScopedTempFile new_part("DestinationHashesTest.XXXXXX");
+  // Two blocks of 4 bytes.
+  string new_data = "abcdefgh";
+  EXPECT_TRUE(
+      utils::WriteFile(new_part.path().c_str(), new_data.data(), 8));
+
+  vector<AnnotatedOperation> aops(2);
+  aops[0].op.set_type(InstallOperation::REPLACE);
+  *aops[0].op.add_dst_extents() = ExtentForRange(1, 1);
+  *aops[0].op.add_dst_extents() = ExtentForRange(0, 1);
+  aops[1].op.set_type(InstallOperation::DISCARD);
+  *aops[1].op.add_dst_extents() = ExtentForRange(0, 2);
+  EXPECT_TRUE(PayloadFile::SetDestinationHashes(new_part.path(), 4, &aops));
+
+  // The hash covers the blocks in the order of the extents.
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes("efghabcd", 8, &expected_hash));
+  EXPECT_EQ(string(expected_hash.begin(), expected_hash.end()),
+            aops[0].op.dst_sha256_hash());
+  EXPECT_FALSE(aops[1].op.has_dst_sha256_hash());
+}
+
+TEST_F(PayloadFileTest, SplitPayloadTest) {
+  test_utils::ScopedTempFile blobs("SplitPayloadTest.blobs.XXXXXX");
+  test_utils::ScopedTempFile payload_path("SplitPayloadTest.payload.XXXXXX");
+  base::ScopedTempDir split_dir;
+  ASSERT_TRUE(split_dir.CreateUniqueTempDir());
+  string blobs_data = "rootkernel";
+  EXPECT_TRUE(utils::WriteFile(
+      blobs.path().c_str(), blobs_data.data(), blobs_data.size()));
+
+  payload_.major_version_ = kBrilloMajorPayloadVersion;
+  payload_.split_payload_dir_ = split_dir.GetPath().value();
+  // The last partition has no data.
+  payload_.part_vec_.resize(3);
+  payload_.part_vec_[0].name = "kernel";
+  payload_.part_vec_[1].name = "root";
+  payload_.part_vec_[2].name = "empty";
+  AnnotatedOperation aop;
+  aop.op.set_type(InstallOperation::REPLACE);
+  aop.op.set_data_offset(4);
+  aop.op.set_data_length(6);
+  payload_.part_vec_[0].aops = {aop};
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(4);
+  payload_.part_vec_[1].aops = {aop};
+
+  uint64_t metadata_size = 0;
+  EXPECT_TRUE(payload_.WritePayload(
+      payload_path.path(), blobs.path(), "", &metadata_size));
+
+  // The manifest has the range and hash of the data of each partition.
+  const DeltaArchiveManifest& manifest = payload_.manifest_;
+  ASSERT_EQ(3, manifest.partitions_size());
+  EXPECT_EQ(0U, manifest.partitions(0).data_offset());
+  EXPECT_EQ(6U, manifest.partitions(0).data_length());
+  EXPECT_EQ(6U, manifest.partitions(1).data_offset());
+  EXPECT_EQ(4U, manifest.partitions(1).data_length());
+  EXPECT_FALSE(manifest.partitions(2).has_data_sha256_hash());
+
+  // The split files put together are the payload.
+  string split_payload;
+  EXPECT_TRUE(utils::ReadFile(
+      split_dir.GetPath().Append("metadata.bin").value(), &split_payload));
+  EXPECT_EQ(metadata_size, split_payload.size());
+  for (const string& data : vector<string>{"kernel", "root"}) {
+    brillo::Blob hash;
+    EXPECT_TRUE(
+        HashCalculator::RawHashOfBytes(data.data(), data.size(), &hash));
+    string part_data;
+    EXPECT_TRUE(utils::ReadFile(
+        split_dir.GetPath()
+            .Append(base::ToLowerASCII(
+                        base::HexEncode(hash.data(), hash.size())) +
+                    ".bin")
+            .value(),
+        &part_data));
+    EXPECT_EQ(data, part_data);
+    split_payload += part_data;
+  }
+  string payload_data;
+  EXPECT_TRUE(utils::ReadFile(payload_path.path(), &payload_data));
+  EXPECT_EQ(payload_data, split_payload);
+  // Unsigned payloads have no signature file.
+  EXPECT_FALSE(utils::FileExists(
+      split_dir.GetPath().Append("signature.bin").value().c_str()));
 }
 
 }  // namespace chromeos_update_engine
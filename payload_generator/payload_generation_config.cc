@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_generator/payload_generation_config.h"
 
+#include <utility>
+
 #include <base/logging.h>
 
 #include "update_engine/common/utils.h"
@@ -25,11 +27,13 @@
 #include "update_engine/payload_generator/ext2_filesystem.h"
 #include "update_engine/payload_generator/mapfile_filesystem.h"
 #include "update_engine/payload_generator/raw_filesystem.h"
+#include "update_engine/payload_generator/sparse_image.h"
 
 namespace chromeos_update_engine {
 
 bool PostInstallConfig::IsEmpty() const {
-  return !run && path.empty() && filesystem_type.empty() && !optional;
+  return !run && path.empty() && filesystem_type.empty() && !optional &&
+         !parallel;
 }
 
 bool PartitionConfig::ValidateExists() const {
@@ -71,6 +75,21 @@ bool PartitionConfig::OpenFilesystem() {
   return true;
 }
 
+bool PartitionConfig::ExpandSparseImage() {
+  if (!IsSparseImage(path))
+    return true;
+  std::string raw_path;
+  TEST_AND_RETURN_FALSE(
+      utils::MakeTempFile(name + "_expanded.XXXXXX", &raw_path, nullptr));
+  std::shared_ptr<ScopedPathUnlinker> unlinker(
+      new ScopedPathUnlinker(raw_path));
+  TEST_AND_RETURN_FALSE(chromeos_update_engine::ExpandSparseImage(path,
+                                                                  raw_path));
+  path = raw_path;
+  expanded_image_unlinker = std::move(unlinker);
+  return true;
+}
+
 bool ImageConfig::ValidateIsEmpty() const {
   TEST_AND_RETURN_FALSE(ImageInfoIsEmpty());
   return partitions.empty();
@@ -85,6 +104,14 @@ bool ImageConfig::LoadImageSize() {
   return true;
 }
 
+bool ImageConfig::ExpandSparseImages() {
+  for (PartitionConfig& part : partitions) {
+    if (!part.path.empty())
+      TEST_AND_RETURN_FALSE(part.ExpandSparseImage());
+  }
+  return true;
+}
+
 bool ImageConfig::LoadPostInstallConfig(const brillo::KeyValueStore& store) {
   bool found_postinstall = false;
   for (PartitionConfig& part : partitions) {
@@ -99,6 +126,8 @@ bool ImageConfig::LoadPostInstallConfig(const brillo::KeyValueStore& store) {
                     &part.postinstall.filesystem_type);
     store.GetBoolean("POSTINSTALL_OPTIONAL_" + part.name,
                      &part.postinstall.optional);
+    store.GetBoolean("POSTINSTALL_PARALLEL_" + part.name,
+                     &part.postinstall.parallel);
   }
   if (!found_postinstall) {
     LOG(ERROR) << "No valid postinstall config found.";
@@ -129,7 +158,9 @@ bool PayloadVersion::Validate() const {
                         minor == kSourceMinorPayloadVersion ||
                         minor == kOpSrcHashMinorPayloadVersion ||
                         minor == kBrotliBsdiffMinorPayloadVersion ||
-                        minor == kPuffdiffMinorPayloadVersion);
+                        minor == kPuffdiffMinorPayloadVersion ||
+                        minor == kZstdMinorPayloadVersion ||
+                        minor == kPartitionCopyMinorPayloadVersion);
   return true;
 }
 
@@ -154,6 +185,11 @@ bool PayloadVersion::OperationAllowed(InstallOperation_Type operation) const {
       // them for delta payloads for now.
       return minor >= kBrotliBsdiffMinorPayloadVersion;
 
+    case InstallOperation::REPLACE_ZSTD:
+      // Full payloads always use the minor version 0, so only the delta
+      // payloads can use it.
+      return minor >= kZstdMinorPayloadVersion;
+
     // Delta operations:
     case InstallOperation::MOVE:
     case InstallOperation::BSDIFF:
@@ -171,6 +207,12 @@ bool PayloadVersion::OperationAllowed(InstallOperation_Type operation) const {
 
     case InstallOperation::PUFFDIFF:
       return minor >= kPuffdiffMinorPayloadVersion;
+
+    case InstallOperation::PARTITION_COPY:
+      // The source partition is identified by its name, which is only in the
+      // payloads of the major version used in Brillo.
+      return major == kBrilloMajorPayloadVersion &&
+             minor >= kPartitionCopyMinorPayloadVersion;
   }
   return false;
 }
@@ -221,6 +263,25 @@ bool PayloadGenerationConfig::Validate() const {
 
   TEST_AND_RETURN_FALSE(rootfs_partition_size % block_size == 0);
 
+  // The full operations of up to half of the apply memory budget fit in it
+  // with their decoder, as long as it holds the 8 MiB xz dictionary.
+  if (apply_memory_budget > 0) {
+    TEST_AND_RETURN_FALSE(apply_memory_budget >= 16 * 1024 * 1024);
+    TEST_AND_RETURN_FALSE(hard_chunk_size != -1 &&
+                          static_cast<uint64_t>(hard_chunk_size) * 2 <=
+                              apply_memory_budget);
+    TEST_AND_RETURN_FALSE(max_full_chunk_size * 2 <= apply_memory_budget);
+  }
+
+  // The brotli qualities go from 0 to 11.
+  TEST_AND_RETURN_FALSE(brotli_fast_quality >= 0 && brotli_fast_quality <= 11);
+
+  // The operations of the work shards are only kept in the diff cache.
+  if (work_shard_count > 1) {
+    TEST_AND_RETURN_FALSE(work_shard_index < work_shard_count);
+    TEST_AND_RETURN_FALSE(!diff_cache_dir.empty());
+  }
+
   return true;
 }
 
@@ -31,6 +31,8 @@
 
 namespace chromeos_update_engine {
 
+class ScopedPathUnlinker;
+
 struct PostInstallConfig {
   // Whether the postinstall config is empty.
   bool IsEmpty() const;
@@ -49,6 +51,10 @@ struct PostInstallConfig {
 
   // Whether this postinstall script should be ignored if it fails.
   bool optional = false;
+
+  // Whether this postinstall script may run concurrently with the ones of the
+  // adjacent partitions that also set it.
+  bool parallel = false;
 };
 
 struct PartitionConfig {
@@ -62,6 +68,12 @@ struct PartitionConfig {
   // |fs_interface|. Returns whether opening the filesystem worked.
   bool OpenFilesystem();
 
+  // If |path| is an Android sparse image, expands it to a temporary file,
+  // removed with the last copy of the PartitionConfig, and changes |path| to
+  // it. The blocks not stored in the sparse image are left as holes of the
+  // file. Returns whether it succeeded.
+  bool ExpandSparseImage();
+
   // The path to the partition file. This can be a regular file or a block
   // device such as a loop device.
   std::string path;
@@ -80,8 +92,12 @@ struct PartitionConfig {
   uint64_t size = 0;
 
   // The FilesystemInterface implementation used to access this partition's
-  // files.
-  std::unique_ptr<FilesystemInterface> fs_interface;
+  // files. It is shared by the copies of the PartitionConfig, such as the
+  // target partitions of the payloads generated from several sources.
+  std::shared_ptr<FilesystemInterface> fs_interface;
+
+  // Removes the temporary file expanded by ExpandSparseImage(), if any.
+  std::shared_ptr<ScopedPathUnlinker> expanded_image_unlinker;
 
   std::string name;
 
@@ -101,6 +117,11 @@ struct ImageConfig {
   // Returns whether the image size was properly detected.
   bool LoadImageSize();
 
+  // Expands the partitions stored as Android sparse images, calling
+  // ExpandSparseImage() on each of them. It must be called before
+  // LoadImageSize().
+  bool ExpandSparseImages();
+
   // Load postinstall config from a key value store.
   bool LoadPostInstallConfig(const brillo::KeyValueStore& store);
 
@@ -189,6 +210,95 @@ struct PayloadGenerationConfig {
 
   // The maximum timestamp of the OS allowed to apply this payload.
   int64_t max_timestamp = 0;
+
+  // The directory where the operations generated are cached to be reused by
+  // later payloads with the same source and target data, or empty to not
+  // cache them.
+  std::string diff_cache_dir;
+
+  // The path of a payload generated before, whose operations are reused for
+  // the partitions with the same old and new data, or empty to generate them
+  // all.
+  std::string previous_payload;
+
+  // The memory, in bytes, that the bsdiff and puffdiff operations generated
+  // at the same time can use, or zero to not bound it.
+  uint64_t memory_budget = 0;
+
+  // The memory, in bytes, the target devices have to apply one operation, or
+  // zero to not bound it. The diff operations needing more are replaced by
+  // full ones, and the hard chunk size and |max_full_chunk_size| must be at
+  // most half of it, so the full operations fit too.
+  uint64_t apply_memory_budget = 0;
+
+  // The memory, in bytes, used to keep the suffix arrays built by bsdiff to
+  // reuse them for the same old data, or zero to not keep them.
+  uint64_t suffix_array_cache_size = 0;
+
+  // The largest BROTLI_BSDIFF patch data, in bytes, compressed with the best
+  // and slowest brotli quality, bounding the time spent on each patch. The
+  // bigger ones use |brotli_fast_quality|. Zero uses the best quality for all.
+  uint64_t brotli_max_quality_size = 0;
+  int brotli_fast_quality = 9;
+
+  // The maximum size of the operations of a full payload, which bounds the
+  // memory used by the device to apply them. When it is bigger than the chunk
+  // size, the consecutive chunks of data that compress are merged up to this
+  // size. Zero doesn't merge them.
+  size_t max_full_chunk_size = 0;
+
+  // The maximum size of the zstd dictionary trained from the target partitions
+  // and shipped in the manifest, used to compress the small REPLACE_ZSTD
+  // operations. Zero doesn't train one.
+  size_t zstd_dictionary_size = 0;
+
+  // Whether the in-place deltas break the cycles of the operations with the
+  // near-linear GreedyCycleBreaker heuristic, instead of enumerating them with
+  // the CycleBreaker, which can take very long on big partitions but usually
+  // cuts fewer edges.
+  bool fast_cycle_breaking = false;
+
+  // Whether the files bigger than the hard chunk size are split in content
+  // defined chunks, paired with the chunks of the old file with the same
+  // boundaries, instead of at fixed offsets.
+  bool content_defined_chunks = false;
+
+  // Whether the hash of the blocks written by each operation is stored in the
+  // manifest, so a resumed update doesn't apply again the operations applied
+  // before it was interrupted. Not used in minor version 1.
+  bool dst_hashes = false;
+
+  // Whether the estimated peak memory needed to apply each operation is stored
+  // in the manifest, with the largest one of the payload.
+  bool apply_memory_hints = false;
+
+  // Whether the operations of the A/B deltas are ordered along a Hilbert
+  // curve over the start blocks of their source and destination, so the
+  // device reads the source partition and writes the target one mostly
+  // sequentially, instead of only by destination. Their data blobs follow
+  // the same order, so the payload is still downloaded sequentially.
+  bool locality_ordering = false;
+
+  // If not empty, the payload is also written split in this directory: the
+  // metadata in "metadata.bin", the data of each partition in a file named
+  // after the lowercase hex SHA256 hash of that data with a ".bin" extension,
+  // and the payload signature in "signature.bin". Their concatenation, in the
+  // order of the partitions, is the payload. The manifest has the range and
+  // hash of the data of each partition. Not supported in major version 1.
+  std::string split_payload_dir;
+
+  // The shard of the work generated when |work_shard_count| is bigger than
+  // one: the processes generating the shards from 0 to |work_shard_count| - 1
+  // store their operations in |diff_cache_dir|, without writing the payload,
+  // then a process without a shard writes it with the operations cached.
+  size_t work_shard_index = 0;
+  size_t work_shard_count = 1;
+
+  // Whether the files and full chunks are processed by worker groups bound to
+  // the NUMA nodes of the machine, each one assigned to the node of the
+  // blocks it reads, so the buffers and the cached partition data it uses are
+  // local to its node. Only used on machines with more than one node.
+  bool numa_aware = false;
 };
 
 }  // namespace chromeos_update_engine
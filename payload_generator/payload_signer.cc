@@ -17,13 +17,18 @@
 #include "update_engine/payload_generator/payload_signer.h"
 
 #include <endian.h>
+#include <fcntl.h>
 
+#include <algorithm>
+#include <memory>
 #include <utility>
 
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
+#include <base/threading/simple_thread.h>
 #include <brillo/data_encoding.h>
 #include <brillo/streams/file_stream.h>
 #include <brillo/streams/stream.h>
@@ -52,6 +57,33 @@ namespace {
 // version field to be included and be 1.
 const uint32_t kSignatureMessageLegacyVersion = 1;
 
+// The size of the chunks of the payload files read to hash them.
+const size_t kReadBufferSize = 1024 * 1024;
+
+// Signs a hash with one private key, on its own thread when there are several
+// keys to sign with.
+class KeySigner : public base::DelegateSimpleThread::Delegate {
+ public:
+  KeySigner(const brillo::Blob& hash, const string& private_key_path)
+      : hash_(hash), private_key_path_(private_key_path) {}
+
+  // base::DelegateSimpleThread::Delegate overrides.
+  void Run() override {
+    result_ = PayloadSigner::SignHash(hash_, private_key_path_, &signature_);
+  }
+
+  bool result() const { return result_; }
+  const brillo::Blob& signature() const { return signature_; }
+
+ private:
+  const brillo::Blob& hash_;
+  const string& private_key_path_;
+  brillo::Blob signature_;
+  bool result_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(KeySigner);
+};
+
 // Given raw |signatures|, packs them into a protobuf and serializes it into a
 // binary blob. Returns true on success, false otherwise.
 bool ConvertSignatureToProtobufBlob(const vector<brillo::Blob>& signatures,
@@ -211,6 +243,52 @@ bool CalculateHashFromPayload(const brillo::Blob& payload,
   return true;
 }
 
+// Reads the |size| bytes at |offset| in the file |fd| into |out|.
+bool ReadFileRange(int fd, uint64_t offset, uint64_t size, brillo::Blob* out) {
+  out->resize(size);
+  ssize_t bytes_read;
+  TEST_AND_RETURN_FALSE(
+      utils::PReadAll(fd, out->data(), out->size(), offset, &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size));
+  return true;
+}
+
+// Like CalculateHashFromPayload(), but reading the payload from the file |fd|
+// in a single pass of small chunks instead of loading it in memory.
+bool CalculateHashFromPayloadFile(int fd,
+                                  const uint64_t metadata_size,
+                                  const uint32_t metadata_signature_size,
+                                  const uint64_t signatures_offset,
+                                  brillo::Blob* out_hash_data,
+                                  brillo::Blob* out_metadata_hash) {
+  brillo::Blob buf;
+  TEST_AND_RETURN_FALSE(ReadFileRange(fd, 0, metadata_size, &buf));
+  if (out_metadata_hash) {
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+        buf.data(), buf.size(), out_metadata_hash));
+  }
+  if (out_hash_data) {
+    HashCalculator calc;
+    TEST_AND_RETURN_FALSE(calc.Update(buf.data(), buf.size()));
+    TEST_AND_RETURN_FALSE(signatures_offset >=
+                          metadata_size + metadata_signature_size);
+    for (uint64_t pos = metadata_size + metadata_signature_size;
+         pos < signatures_offset;
+         pos += buf.size()) {
+      TEST_AND_RETURN_FALSE(ReadFileRange(
+          fd,
+          pos,
+          std::min(signatures_offset - pos,
+                   static_cast<uint64_t>(kReadBufferSize)),
+          &buf));
+      TEST_AND_RETURN_FALSE(calc.Update(buf.data(), buf.size()));
+    }
+    TEST_AND_RETURN_FALSE(calc.Finalize());
+    *out_hash_data = calc.raw_hash();
+  }
+  return true;
+}
+
 }  // namespace
 
 void PayloadSigner::AddSignatureToManifest(uint64_t signature_blob_offset,
@@ -314,29 +392,32 @@ bool PayloadSigner::VerifySignedPayload(const string& payload_path,
                                             nullptr,
                                             &metadata_size,
                                             &metadata_signature_size));
-  brillo::Blob payload;
-  TEST_AND_RETURN_FALSE(utils::ReadFile(payload_path, &payload));
   TEST_AND_RETURN_FALSE(manifest.has_signatures_offset() &&
                         manifest.has_signatures_size());
   uint64_t signatures_offset = metadata_size + metadata_signature_size +
                                manifest.signatures_offset();
-  CHECK_EQ(payload.size(), signatures_offset + manifest.signatures_size());
+  int fd = HANDLE_EINTR(open(payload_path.c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  CHECK_EQ(static_cast<uint64_t>(utils::FileSize(fd)),
+           signatures_offset + manifest.signatures_size());
+  // Both hashes are computed in a single read of the payload.
   brillo::Blob payload_hash, metadata_hash;
-  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload,
-                                                 metadata_size,
-                                                 metadata_signature_size,
-                                                 signatures_offset,
-                                                 &payload_hash,
-                                                 &metadata_hash));
-  brillo::Blob signature_blob(payload.begin() + signatures_offset,
-                              payload.end());
+  TEST_AND_RETURN_FALSE(CalculateHashFromPayloadFile(fd,
+                                                     metadata_size,
+                                                     metadata_signature_size,
+                                                     signatures_offset,
+                                                     &payload_hash,
+                                                     &metadata_hash));
+  brillo::Blob signature_blob;
+  TEST_AND_RETURN_FALSE(ReadFileRange(
+      fd, signatures_offset, manifest.signatures_size(), &signature_blob));
   TEST_AND_RETURN_FALSE(PayloadVerifier::PadRSA2048SHA256Hash(&payload_hash));
   TEST_AND_RETURN_FALSE(PayloadVerifier::VerifySignature(
       signature_blob, public_key_path, payload_hash));
   if (metadata_signature_size) {
-    signature_blob.assign(payload.begin() + metadata_size,
-                          payload.begin() + metadata_size +
-                          metadata_signature_size);
+    TEST_AND_RETURN_FALSE(ReadFileRange(
+        fd, metadata_size, metadata_signature_size, &signature_blob));
     TEST_AND_RETURN_FALSE(
         PayloadVerifier::PadRSA2048SHA256Hash(&metadata_hash));
     TEST_AND_RETURN_FALSE(PayloadVerifier::VerifySignature(
@@ -385,11 +466,28 @@ bool PayloadSigner::SignHash(const brillo::Blob& hash,
 bool PayloadSigner::SignHashWithKeys(const brillo::Blob& hash_data,
                                      const vector<string>& private_key_paths,
                                      brillo::Blob* out_signature_blob) {
+  // Each key is loaded and used on its own thread, since the RSA signatures are
+  // independent and slow to compute.
+  vector<std::unique_ptr<KeySigner>> signers;
+  for (const string& path : private_key_paths)
+    signers.emplace_back(new KeySigner(hash_data, path));
+  if (signers.size() == 1) {
+    signers[0]->Run();
+  } else {
+    vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+    for (const auto& signer : signers) {
+      threads.emplace_back(
+          new base::DelegateSimpleThread(signer.get(), "key-signer"));
+      threads.back()->Start();
+    }
+    for (const auto& thread : threads)
+      thread->Join();
+  }
+
   vector<brillo::Blob> signatures;
-  for (const string& path : private_key_paths) {
-    brillo::Blob signature;
-    TEST_AND_RETURN_FALSE(SignHash(hash_data, path, &signature));
-    signatures.push_back(signature);
+  for (const auto& signer : signers) {
+    TEST_AND_RETURN_FALSE(signer->result());
+    signatures.push_back(signer->signature());
   }
   TEST_AND_RETURN_FALSE(ConvertSignatureToProtobufBlob(signatures,
                                                        out_signature_blob));
@@ -402,15 +500,16 @@ bool PayloadSigner::SignPayload(const string& unsigned_payload_path,
                                 const uint32_t metadata_signature_size,
                                 const uint64_t signatures_offset,
                                 brillo::Blob* out_signature_blob) {
-  brillo::Blob payload;
-  TEST_AND_RETURN_FALSE(utils::ReadFile(unsigned_payload_path, &payload));
+  int fd = HANDLE_EINTR(open(unsigned_payload_path.c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
   brillo::Blob hash_data;
-  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload,
-                                                 metadata_size,
-                                                 metadata_signature_size,
-                                                 signatures_offset,
-                                                 &hash_data,
-                                                 nullptr));
+  TEST_AND_RETURN_FALSE(CalculateHashFromPayloadFile(fd,
+                                                     metadata_size,
+                                                     metadata_signature_size,
+                                                     signatures_offset,
+                                                     &hash_data,
+                                                     nullptr));
   TEST_AND_RETURN_FALSE(SignHashWithKeys(hash_data,
                                          private_key_paths,
                                          out_signature_blob));
@@ -198,6 +198,23 @@ TEST_F(PayloadSignerTest, VerifyAllSignatureTest) {
       padded_hash_data_));
 }
 
+TEST_F(PayloadSignerTest, SignatureOrderTest) {
+  // The keys sign in parallel, but the signatures are in the order of the
+  // keys.
+  brillo::Blob signature_blob;
+  SignSampleData(&signature_blob,
+                 {GetBuildArtifactsPath(kUnittestPrivateKey2Path),
+                  GetBuildArtifactsPath(kUnittestPrivateKeyPath)});
+
+  Signatures signatures;
+  EXPECT_TRUE(signatures.ParseFromArray(signature_blob.data(),
+                                        signature_blob.size()));
+  ASSERT_EQ(2, signatures.signatures_size());
+  EXPECT_EQ(string(std::begin(kDataSignature), std::end(kDataSignature)),
+            signatures.signatures(1).data());
+  EXPECT_NE(signatures.signatures(0).data(), signatures.signatures(1).data());
+}
+
 TEST_F(PayloadSignerTest, VerifySignatureTest) {
   brillo::Blob signature_blob;
   SignSampleData(&signature_blob,
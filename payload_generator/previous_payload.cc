@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/previous_payload.h"
+
+#include <string>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/payload_signer.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns whether the partition infos |a| and |b| describe the same data.
+bool SamePartitionInfo(const PartitionInfo& a, const PartitionInfo& b) {
+  return a.size() == b.size() && a.hash() == b.hash();
+}
+
+}  // namespace
+
+bool PreviousPayload::Load(const string& path) {
+  uint64_t major_version;
+  uint64_t metadata_size;
+  uint32_t metadata_signature_size;
+  TEST_AND_RETURN_FALSE(PayloadSigner::LoadPayloadMetadata(
+      path,
+      nullptr,
+      &manifest_,
+      &major_version,
+      &metadata_size,
+      &metadata_signature_size));
+  if (major_version != kBrilloMajorPayloadVersion) {
+    LOG(ERROR) << "Only the operations of the payloads of major version "
+               << kBrilloMajorPayloadVersion << " can be reused, not "
+               << major_version;
+    return false;
+  }
+  path_ = path;
+  data_offset_ = metadata_size + metadata_signature_size;
+  return true;
+}
+
+const PartitionUpdate* PreviousPayload::FindPartition(
+    const string& name) const {
+  for (const PartitionUpdate& partition : manifest_.partitions()) {
+    if (partition.partition_name() == name)
+      return &partition;
+  }
+  return nullptr;
+}
+
+bool PreviousPayload::ReusePartition(const PayloadVersion& version,
+                                     size_t block_size,
+                                     const brillo::Blob& zstd_dictionary,
+                                     const PartitionConfig& old_part,
+                                     const PartitionConfig& new_part,
+                                     BlobFileWriter* blob_file,
+                                     vector<AnnotatedOperation>* aops,
+                                     bool* reused) const {
+  *reused = false;
+  const PartitionUpdate* partition = FindPartition(new_part.name);
+  if (!partition || manifest_.minor_version() != version.minor ||
+      manifest_.block_size() != block_size ||
+      partition->has_old_partition_info() == old_part.path.empty()) {
+    return true;
+  }
+  // The REPLACE_ZSTD operations may use the dictionary of their payload, and
+  // the PARTITION_COPY ones read another partition, which may have changed.
+  for (const InstallOperation& op : partition->operations()) {
+    if (op.type() == InstallOperation::PARTITION_COPY)
+      return true;
+    if (op.type() == InstallOperation::REPLACE_ZSTD &&
+        manifest_.zstd_dictionary() !=
+            string(zstd_dictionary.begin(), zstd_dictionary.end())) {
+      return true;
+    }
+  }
+
+  // The partitions are hashed again when added to the payload, which is still
+  // much faster than generating their operations.
+  PartitionInfo old_info;
+  PartitionInfo new_info;
+  if (!old_part.path.empty()) {
+    TEST_AND_RETURN_FALSE(
+        diff_utils::InitializePartitionInfo(old_part, &old_info));
+    if (!SamePartitionInfo(old_info, partition->old_partition_info()))
+      return true;
+  }
+  TEST_AND_RETURN_FALSE(
+      diff_utils::InitializePartitionInfo(new_part, &new_info));
+  if (!SamePartitionInfo(new_info, partition->new_partition_info()))
+    return true;
+
+  aops->clear();
+  aops->reserve(partition->operations_size());
+  for (int i = 0; i < partition->operations_size(); i++) {
+    AnnotatedOperation aop;
+    aop.name = "<previous-" + new_part.name + "-operation-" +
+               std::to_string(i) + ">";
+    aop.op = partition->operations(i);
+    brillo::Blob data;
+    if (aop.op.data_length() > 0) {
+      TEST_AND_RETURN_FALSE(utils::ReadFileChunk(
+          path_, data_offset_ + aop.op.data_offset(), aop.op.data_length(),
+          &data));
+      TEST_AND_RETURN_FALSE(data.size() == aop.op.data_length());
+    }
+    aop.op.clear_data_sha256_hash();
+    TEST_AND_RETURN_FALSE(aop.SetOperationBlob(data, blob_file));
+    aops->push_back(std::move(aop));
+  }
+  LOG(INFO) << "Reused the " << aops->size() << " operations of partition "
+            << new_part.name << " from the previous payload " << path_;
+  *reused = true;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
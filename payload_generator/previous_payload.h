@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PREVIOUS_PAYLOAD_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PREVIOUS_PAYLOAD_H_
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A payload generated before, whose operations are copied to the payload
+// being generated for the partitions whose old and new data didn't change
+// since, instead of generating them again. Consecutive builds often leave
+// some partitions identical.
+class PreviousPayload {
+ public:
+  PreviousPayload() = default;
+
+  // Loads the manifest of the payload |path|. Only the payloads of major
+  // version 2, which describe each partition, are supported. Returns whether
+  // it succeeded.
+  bool Load(const std::string& path);
+
+  // Sets |aops| to the operations of the partition |new_part| in the previous
+  // payload, with their data stored again in |blob_file|, if it was generated
+  // with the same |version|, |block_size| and |zstd_dictionary| and from and
+  // to the same data as |old_part| and |new_part|. |old_part| has no path for
+  // a full payload. Sets |reused| to whether they were copied. Returns false
+  // only if the operations couldn't be copied.
+  bool ReusePartition(const PayloadVersion& version,
+                      size_t block_size,
+                      const brillo::Blob& zstd_dictionary,
+                      const PartitionConfig& old_part,
+                      const PartitionConfig& new_part,
+                      BlobFileWriter* blob_file,
+                      std::vector<AnnotatedOperation>* aops,
+                      bool* reused) const;
+
+ private:
+  // Returns the partition |name| of the manifest, or nullptr.
+  const PartitionUpdate* FindPartition(const std::string& name) const;
+
+  std::string path_;
+  DeltaArchiveManifest manifest_;
+  // The offset of the data of the operations in the payload, after the
+  // metadata and its signature.
+  uint64_t data_offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(PreviousPayload);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PREVIOUS_PAYLOAD_H_
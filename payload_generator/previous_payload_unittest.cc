@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/previous_payload.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class PreviousPayloadTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    config_.is_delta = false;
+    config_.version =
+        PayloadVersion(kBrilloMajorPayloadVersion, kFullPayloadMinorVersion);
+    config_.hard_chunk_size = 64 * 1024;
+    config_.target.partitions.emplace_back("system");
+    config_.target.partitions.back().path = new_part_.path();
+
+    brillo::Blob data(256 * 1024);
+    std::mt19937 generator(42);
+    for (uint8_t& byte : data)
+      byte = generator() % 8;
+    WritePartition(data);
+
+    EXPECT_TRUE(utils::MakeTempFile(
+        "PreviousPayloadTest_blobs.XXXXXX", &blobs_path_, &blobs_fd_));
+    blobs_unlinker_.reset(new ScopedPathUnlinker(blobs_path_));
+    blob_file_.reset(new BlobFileWriter(blobs_fd_, &blobs_size_));
+  }
+
+  void WritePartition(const brillo::Blob& data) {
+    EXPECT_TRUE(test_utils::WriteFileVector(new_part_.path(), data));
+    config_.target.partitions.back().size = data.size();
+  }
+
+  // Generates the payload of |config_| in |payload_| and loads it in
+  // |previous_|.
+  void GeneratePreviousPayload() {
+    uint64_t metadata_size;
+    ASSERT_TRUE(config_.Validate());
+    ASSERT_TRUE(GenerateUpdatePayloadFile(
+        config_, payload_.path(), "", &metadata_size));
+    ASSERT_TRUE(previous_.Load(payload_.path()));
+  }
+
+  bool ReusePartition(bool* reused) {
+    return previous_.ReusePartition(config_.version,
+                                    config_.block_size,
+                                    brillo::Blob(),
+                                    PartitionConfig("system"),
+                                    config_.target.partitions.back(),
+                                    blob_file_.get(),
+                                    &aops_,
+                                    reused);
+  }
+
+  PayloadGenerationConfig config_;
+  test_utils::ScopedTempFile new_part_{"PreviousPayloadTest_part.XXXXXX"};
+  test_utils::ScopedTempFile payload_{"PreviousPayloadTest_payload.XXXXXX"};
+  PreviousPayload previous_;
+
+  string blobs_path_;
+  int blobs_fd_{-1};
+  off_t blobs_size_{0};
+  ScopedFdCloser blobs_fd_closer_{&blobs_fd_};
+  std::unique_ptr<ScopedPathUnlinker> blobs_unlinker_;
+  std::unique_ptr<BlobFileWriter> blob_file_;
+
+  vector<AnnotatedOperation> aops_;
+};
+
+TEST_F(PreviousPayloadTest, ReuseUnchangedPartitionTest) {
+  GeneratePreviousPayload();
+  bool reused;
+  EXPECT_TRUE(ReusePartition(&reused));
+  EXPECT_TRUE(reused);
+  // The partition has 4 chunks.
+  ASSERT_EQ(4U, aops_.size());
+  uint64_t start_block = 0;
+  for (const AnnotatedOperation& aop : aops_) {
+    ASSERT_EQ(1, aop.op.dst_extents_size());
+    EXPECT_EQ(start_block, aop.op.dst_extents(0).start_block());
+    start_block += aop.op.dst_extents(0).num_blocks();
+  }
+  // Their data is copied to the blob file.
+  EXPECT_LT(0, blobs_size_);
+  EXPECT_EQ(0U, aops_[0].op.data_offset());
+}
+
+TEST_F(PreviousPayloadTest, RegenerateChangedPartitionTest) {
+  GeneratePreviousPayload();
+  WritePartition(brillo::Blob(256 * 1024, 1));
+  bool reused;
+  EXPECT_TRUE(ReusePartition(&reused));
+  EXPECT_FALSE(reused);
+  EXPECT_TRUE(aops_.empty());
+}
+
+TEST_F(PreviousPayloadTest, RegenerateOtherVersionTest) {
+  GeneratePreviousPayload();
+  config_.version.minor = kOpSrcHashMinorPayloadVersion;
+  bool reused;
+  EXPECT_TRUE(ReusePartition(&reused));
+  EXPECT_FALSE(reused);
+  EXPECT_TRUE(aops_.empty());
+}
+
+TEST_F(PreviousPayloadTest, LoadInvalidPayloadTest) {
+  EXPECT_FALSE(previous_.Load(new_part_.path()));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/source_block_index.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/block_mapping.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The number of blocks read at once while indexing a partition.
+const uint64_t kBlocksPerRead = 256;
+
+}  // namespace
+
+bool SourceBlockIndex::AddPartitions(
+    const vector<PartitionConfig>& partitions) {
+  const brillo::Blob zeros(block_size_, 0);
+  brillo::Blob buffer;
+  for (const PartitionConfig& part : partitions) {
+    Partition partition;
+    partition.name = part.name;
+    partition.reader = GetMappedPartition(part.path);
+    if (!partition.reader) {
+      partition.file_reader = PartitionReader::CreateFromFile(part.path);
+      TEST_AND_RETURN_FALSE(partition.file_reader != nullptr);
+      partition.reader = partition.file_reader.get();
+    }
+
+    const uint32_t partition_index = partitions_.size();
+    const uint64_t num_blocks = part.size / block_size_;
+    for (uint64_t first = 0; first < num_blocks; first += kBlocksPerRead) {
+      const uint64_t count = std::min(num_blocks - first, kBlocksPerRead);
+      buffer.resize(count * block_size_);
+      TEST_AND_RETURN_FALSE(partition.reader->Read(
+          buffer.data(), buffer.size(), first * block_size_));
+      for (uint64_t i = 0; i < count; i++) {
+        const uint8_t* block = buffer.data() + i * block_size_;
+        if (memcmp(block, zeros.data(), block_size_) == 0)
+          continue;
+        entries_.push_back(
+            {HashBlockData(block, block_size_), partition_index, first + i});
+      }
+    }
+    partitions_.push_back(std::move(partition));
+  }
+
+  std::sort(entries_.begin(),
+            entries_.end(),
+            [](const Entry& first, const Entry& second) {
+              return std::tie(first.hash, first.partition, first.block) <
+                     std::tie(second.hash, second.partition, second.block);
+            });
+  entries_.erase(std::unique(entries_.begin(),
+                             entries_.end(),
+                             [](const Entry& first, const Entry& second) {
+                               return first.hash == second.hash &&
+                                      first.partition == second.partition;
+                             }),
+                 entries_.end());
+  LOG(INFO) << "Indexed " << entries_.size() << " blocks of "
+            << partitions_.size() << " source partitions.";
+  return true;
+}
+
+bool SourceBlockIndex::FindBlock(const uint8_t* block,
+                                 const string& exclude_name,
+                                 Location* location) const {
+  const Entry key{HashBlockData(block, block_size_), 0, 0};
+  auto range = std::equal_range(
+      entries_.begin(),
+      entries_.end(),
+      key,
+      [](const Entry& first, const Entry& second) {
+        return first.hash < second.hash;
+      });
+  brillo::Blob data(block_size_);
+  for (auto entry = range.first; entry != range.second; ++entry) {
+    const Partition& partition = partitions_[entry->partition];
+    if (partition.name == exclude_name)
+      continue;
+    // The hashes of different blocks may collide, so the data is compared.
+    TEST_AND_RETURN_FALSE(partition.reader->Read(
+        data.data(), block_size_, entry->block * block_size_));
+    if (memcmp(data.data(), block, block_size_) == 0) {
+      location->partition = entry->partition;
+      location->block = entry->block;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_SOURCE_BLOCK_INDEX_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_SOURCE_BLOCK_INDEX_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/partition_reader.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+namespace chromeos_update_engine {
+
+// An index of the blocks of the old partitions of a payload by their content,
+// used to find the blocks of a new partition which are in the old version of
+// another partition, like the libraries shipped in several of them. Only a
+// 64-bit hash and the location of each block are kept in memory, the data is
+// read again to compare it when a block is looked up. The blocks with only
+// zeros aren't indexed. Once built, it can be used from any thread.
+class SourceBlockIndex {
+ public:
+  struct Location {
+    // The index of the partition in the order they were added.
+    size_t partition;
+    uint64_t block;
+  };
+
+  explicit SourceBlockIndex(size_t block_size) : block_size_(block_size) {}
+
+  // Indexes all the blocks of the |partitions|, reading them through their
+  // mapping if mapped by SetMappedPartitions(). Returns whether all of them
+  // were read.
+  bool AddPartitions(const std::vector<PartitionConfig>& partitions);
+
+  // Looks up the block of |block_size| bytes with the data in |block| in the
+  // partitions other than the one named |exclude_name|. Returns whether it
+  // was found, storing where in |location|.
+  bool FindBlock(const uint8_t* block,
+                 const std::string& exclude_name,
+                 Location* location) const;
+
+  const std::string& partition_name(size_t partition) const {
+    return partitions_[partition].name;
+  }
+
+  // The number of blocks indexed.
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Partition {
+    std::string name;
+    const PartitionReader* reader;
+    std::unique_ptr<PartitionReader> file_reader;
+  };
+
+  // The entries are sorted by hash. Only the first block of each partition
+  // with a given hash is kept, since the others are almost always copies of
+  // it.
+  struct Entry {
+    uint64_t hash;
+    uint32_t partition;
+    uint64_t block;
+  };
+
+  size_t block_size_;
+  std::vector<Partition> partitions_;
+  std::vector<Entry> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(SourceBlockIndex);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_SOURCE_BLOCK_INDEX_H_
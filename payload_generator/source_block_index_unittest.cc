@@ -0,0 +1,100 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/source_block_index.h"
+
+#include <string>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const size_t kTestBlockSize = 4096;
+
+}  // namespace
+
+class SourceBlockIndexTest : public ::testing::Test {
+ protected:
+  // Returns a partition named |name| with the blocks filled with the bytes in
+  // |block_bytes|.
+  PartitionConfig CreatePartition(const string& name,
+                                  const string& block_bytes,
+                                  test_utils::ScopedTempFile* file) {
+    brillo::Blob data;
+    for (char byte : block_bytes)
+      data.insert(data.end(), kTestBlockSize, byte);
+    EXPECT_TRUE(test_utils::WriteFileVector(file->path(), data));
+    PartitionConfig part(name);
+    part.path = file->path();
+    part.size = data.size();
+    return part;
+  }
+
+  test_utils::ScopedTempFile system_file_{"SourceBlockIndexTest.XXXXXX"};
+  test_utils::ScopedTempFile vendor_file_{"SourceBlockIndexTest.XXXXXX"};
+};
+
+TEST_F(SourceBlockIndexTest, FindBlockTest) {
+  SourceBlockIndex index(kTestBlockSize);
+  EXPECT_TRUE(index.AddPartitions(
+      {CreatePartition("system", string("ab") + '\0', &system_file_),
+       CreatePartition("vendor", "bc", &vendor_file_)}));
+  // The block of zeros isn't indexed.
+  EXPECT_EQ(4U, index.size());
+
+  SourceBlockIndex::Location location;
+  brillo::Blob block(kTestBlockSize, 'b');
+  EXPECT_TRUE(index.FindBlock(block.data(), "system", &location));
+  EXPECT_EQ("vendor", index.partition_name(location.partition));
+  EXPECT_EQ(0U, location.block);
+  EXPECT_TRUE(index.FindBlock(block.data(), "vendor", &location));
+  EXPECT_EQ("system", index.partition_name(location.partition));
+  EXPECT_EQ(1U, location.block);
+
+  // The blocks only in the excluded partition aren't found.
+  block.assign(kTestBlockSize, 'a');
+  EXPECT_FALSE(index.FindBlock(block.data(), "system", &location));
+  block.assign(kTestBlockSize, 'd');
+  EXPECT_FALSE(index.FindBlock(block.data(), "", &location));
+  block.assign(kTestBlockSize, '\0');
+  EXPECT_FALSE(index.FindBlock(block.data(), "", &location));
+}
+
+TEST_F(SourceBlockIndexTest, RepeatedBlocksTest) {
+  SourceBlockIndex index(kTestBlockSize);
+  EXPECT_TRUE(index.AddPartitions(
+      {CreatePartition("system", "xxyx", &system_file_)}));
+  // Only the first copy of a block of each partition is kept.
+  EXPECT_EQ(2U, index.size());
+
+  SourceBlockIndex::Location location;
+  brillo::Blob block(kTestBlockSize, 'x');
+  EXPECT_TRUE(index.FindBlock(block.data(), "vendor", &location));
+  EXPECT_EQ(0U, location.partition);
+  EXPECT_EQ(0U, location.block);
+}
+
+}  // namespace chromeos_update_engine
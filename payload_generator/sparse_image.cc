@@ -0,0 +1,191 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/sparse_image.h"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The format of the Android sparse images, from libsparse's sparse_format.h.
+// All the fields are little endian.
+const uint32_t kSparseMagic = 0xed26ff3a;
+const uint16_t kSparseMajorVersion = 1;
+
+// The file header: the magic, the major and minor versions, the sizes of the
+// file and chunk headers, the block size, the number of blocks of the image,
+// the number of chunks and the checksum of the image.
+const size_t kFileHeaderSize = 28;
+
+// The chunk header: the chunk type, a reserved field, the number of blocks of
+// the image in the chunk and the size of the chunk including its header.
+const size_t kChunkHeaderSize = 12;
+
+const uint16_t kChunkTypeRaw = 0xCAC1;
+const uint16_t kChunkTypeFill = 0xCAC2;
+const uint16_t kChunkTypeDontCare = 0xCAC3;
+const uint16_t kChunkTypeCrc32 = 0xCAC4;
+
+// The size of the buffer used to copy the data of the RAW and FILL chunks.
+const size_t kCopyBufferSize = 1024 * 1024;  // 1 MiB
+
+uint16_t ReadLe16(const uint8_t* data) {
+  uint16_t value;
+  memcpy(&value, data, sizeof(value));
+  return le16toh(value);
+}
+
+uint32_t ReadLe32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return le32toh(value);
+}
+
+// Reads |size| bytes at |offset| of |fd| in |data|, failing on a short read.
+bool ReadExactly(int fd, uint8_t* data, size_t size, off_t offset) {
+  ssize_t bytes_read;
+  TEST_AND_RETURN_FALSE(utils::PReadAll(fd, data, size, offset, &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size));
+  return true;
+}
+
+}  // namespace
+
+bool IsSparseImage(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  ScopedFdCloser fd_closer(&fd);
+  uint8_t magic[sizeof(kSparseMagic)];
+  ssize_t bytes_read;
+  return utils::PReadAll(fd, magic, sizeof(magic), 0, &bytes_read) &&
+         bytes_read == sizeof(magic) && ReadLe32(magic) == kSparseMagic;
+}
+
+bool ExpandSparseImage(const string& sparse_path, const string& raw_path) {
+  int in_fd = open(sparse_path.c_str(), O_RDONLY);
+  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
+  ScopedFdCloser in_fd_closer(&in_fd);
+  int out_fd = open(raw_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  TEST_AND_RETURN_FALSE_ERRNO(out_fd >= 0);
+  ScopedFdCloser out_fd_closer(&out_fd);
+
+  uint8_t header[kFileHeaderSize];
+  TEST_AND_RETURN_FALSE(ReadExactly(in_fd, header, sizeof(header), 0));
+  TEST_AND_RETURN_FALSE(ReadLe32(header) == kSparseMagic);
+  TEST_AND_RETURN_FALSE(ReadLe16(header + 4) == kSparseMajorVersion);
+  uint16_t file_header_size = ReadLe16(header + 8);
+  uint16_t chunk_header_size = ReadLe16(header + 10);
+  uint32_t block_size = ReadLe32(header + 12);
+  uint32_t total_blocks = ReadLe32(header + 16);
+  uint32_t total_chunks = ReadLe32(header + 20);
+  // The headers can be bigger in later minor versions, with fields to skip.
+  TEST_AND_RETURN_FALSE(file_header_size >= kFileHeaderSize);
+  TEST_AND_RETURN_FALSE(chunk_header_size >= kChunkHeaderSize);
+  TEST_AND_RETURN_FALSE(block_size > 0 && block_size % sizeof(uint32_t) == 0);
+
+  brillo::Blob buffer;
+  off_t offset = file_header_size;
+  uint64_t block = 0;
+  uint64_t data_bytes = 0;
+  for (uint32_t i = 0; i < total_chunks; i++) {
+    uint8_t chunk_header[kChunkHeaderSize];
+    TEST_AND_RETURN_FALSE(
+        ReadExactly(in_fd, chunk_header, sizeof(chunk_header), offset));
+    uint16_t type = ReadLe16(chunk_header);
+    uint64_t num_blocks = ReadLe32(chunk_header + 4);
+    uint32_t chunk_size = ReadLe32(chunk_header + 8);
+    TEST_AND_RETURN_FALSE(chunk_size >= chunk_header_size);
+    off_t data_offset = offset + chunk_header_size;
+    uint64_t data_size = chunk_size - chunk_header_size;
+    uint64_t image_size = num_blocks * block_size;
+    TEST_AND_RETURN_FALSE(block + num_blocks <= total_blocks);
+    off_t out_offset = static_cast<off_t>(block) * block_size;
+
+    switch (type) {
+      case kChunkTypeRaw:
+        TEST_AND_RETURN_FALSE(data_size == image_size);
+        for (uint64_t pos = 0; pos < data_size; pos += buffer.size()) {
+          buffer.resize(std::min(data_size - pos,
+                                 static_cast<uint64_t>(kCopyBufferSize)));
+          TEST_AND_RETURN_FALSE(ReadExactly(
+              in_fd, buffer.data(), buffer.size(), data_offset + pos));
+          TEST_AND_RETURN_FALSE(utils::PWriteAll(
+              out_fd, buffer.data(), buffer.size(), out_offset + pos));
+        }
+        data_bytes += data_size;
+        break;
+      case kChunkTypeFill: {
+        TEST_AND_RETURN_FALSE(data_size == sizeof(uint32_t));
+        uint8_t fill[sizeof(uint32_t)];
+        TEST_AND_RETURN_FALSE(
+            ReadExactly(in_fd, fill, sizeof(fill), data_offset));
+        // The blocks filled with zeros are left as a hole.
+        if (ReadLe32(fill) == 0)
+          break;
+        buffer.resize(std::min(image_size,
+                               static_cast<uint64_t>(kCopyBufferSize)));
+        for (size_t j = 0; j < buffer.size(); j += sizeof(fill))
+          memcpy(buffer.data() + j, fill, sizeof(fill));
+        for (uint64_t pos = 0; pos < image_size; pos += buffer.size()) {
+          size_t size = std::min(image_size - pos,
+                                 static_cast<uint64_t>(buffer.size()));
+          TEST_AND_RETURN_FALSE(utils::PWriteAll(
+              out_fd, buffer.data(), size, out_offset + pos));
+        }
+        data_bytes += image_size;
+        break;
+      }
+      case kChunkTypeDontCare:
+        TEST_AND_RETURN_FALSE(data_size == 0);
+        break;
+      case kChunkTypeCrc32:
+        // The checksum of the image so far isn't checked. It covers no
+        // blocks.
+        TEST_AND_RETURN_FALSE(data_size == sizeof(uint32_t));
+        break;
+      default:
+        LOG(ERROR) << "Unknown chunk type " << type << " in the sparse image "
+                   << sparse_path;
+        return false;
+    }
+    block += num_blocks;
+    offset = data_offset + data_size;
+  }
+  TEST_AND_RETURN_FALSE(block == total_blocks);
+  TEST_AND_RETURN_FALSE_ERRNO(
+      ftruncate(out_fd, static_cast<off_t>(total_blocks) * block_size) == 0);
+  LOG(INFO) << "Expanded the sparse image " << sparse_path << " of "
+            << total_blocks << " blocks to " << raw_path << ", writing "
+            << data_bytes << " bytes of data.";
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,38 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_SPARSE_IMAGE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_SPARSE_IMAGE_H_
+
+#include <string>
+
+namespace chromeos_update_engine {
+
+// Returns whether the file |path| is an Android sparse image, as written by
+// img2simg and the Android build.
+bool IsSparseImage(const std::string& path);
+
+// Writes to |raw_path| the image stored in the Android sparse image
+// |sparse_path|. The DONT_CARE chunks and the FILL chunks of zeros are left
+// as holes of the file, so only the data of the other chunks uses disk space,
+// and the blocks in them read as zeros without being stored. Returns whether
+// it succeeded.
+bool ExpandSparseImage(const std::string& sparse_path,
+                       const std::string& raw_path);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_SPARSE_IMAGE_H_
@@ -0,0 +1,119 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/sparse_image.h"
+
+#include <endian.h>
+#include <string.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const uint32_t kBlockSize = 4096;
+
+void AppendLe16(brillo::Blob* data, uint16_t value) {
+  value = htole16(value);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  data->insert(data->end(), bytes, bytes + sizeof(value));
+}
+
+void AppendLe32(brillo::Blob* data, uint32_t value) {
+  value = htole32(value);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  data->insert(data->end(), bytes, bytes + sizeof(value));
+}
+
+void AppendChunkHeader(brillo::Blob* data,
+                       uint16_t type,
+                       uint32_t num_blocks,
+                       uint32_t data_size) {
+  AppendLe16(data, type);
+  AppendLe16(data, 0);
+  AppendLe32(data, num_blocks);
+  AppendLe32(data, 12 + data_size);
+}
+
+}  // namespace
+
+class SparseImageTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // The header of a sparse image of 6 blocks in 5 chunks.
+    AppendLe32(&sparse_, 0xed26ff3a);
+    AppendLe16(&sparse_, 1);
+    AppendLe16(&sparse_, 0);
+    AppendLe16(&sparse_, 28);
+    AppendLe16(&sparse_, 12);
+    AppendLe32(&sparse_, kBlockSize);
+    AppendLe32(&sparse_, 6);
+    AppendLe32(&sparse_, 5);
+    AppendLe32(&sparse_, 0);
+
+    // Two blocks of data, one filled with a pattern, two that don't matter,
+    // one filled with zeros and the checksum.
+    brillo::Blob raw_data(2 * kBlockSize);
+    test_utils::FillWithData(&raw_data);
+    AppendChunkHeader(&sparse_, 0xCAC1, 2, raw_data.size());
+    sparse_.insert(sparse_.end(), raw_data.begin(), raw_data.end());
+    AppendChunkHeader(&sparse_, 0xCAC2, 1, 4);
+    AppendLe32(&sparse_, 0x01020304);
+    AppendChunkHeader(&sparse_, 0xCAC3, 2, 0);
+    AppendChunkHeader(&sparse_, 0xCAC2, 1, 4);
+    AppendLe32(&sparse_, 0);
+    AppendChunkHeader(&sparse_, 0xCAC4, 0, 4);
+    AppendLe32(&sparse_, 0);
+
+    expected_ = raw_data;
+    for (size_t i = 0; i < kBlockSize / 4; i++)
+      expected_.insert(expected_.end(), {4, 3, 2, 1});
+    expected_.resize(6 * kBlockSize);
+  }
+
+  brillo::Blob sparse_;
+  brillo::Blob expected_;
+  test_utils::ScopedTempFile sparse_file_{"SparseImageTest_sparse.XXXXXX"};
+  test_utils::ScopedTempFile raw_file_{"SparseImageTest_raw.XXXXXX"};
+};
+
+TEST_F(SparseImageTest, ExpandTest) {
+  ASSERT_TRUE(test_utils::WriteFileVector(sparse_file_.path(), sparse_));
+  EXPECT_TRUE(IsSparseImage(sparse_file_.path()));
+  EXPECT_TRUE(ExpandSparseImage(sparse_file_.path(), raw_file_.path()));
+  brillo::Blob raw;
+  EXPECT_TRUE(utils::ReadFile(raw_file_.path(), &raw));
+  EXPECT_EQ(expected_, raw);
+  EXPECT_FALSE(IsSparseImage(raw_file_.path()));
+}
+
+TEST_F(SparseImageTest, TruncatedImageTest) {
+  // The image ends in the middle of the data of the first chunk.
+  sparse_.resize(28 + 12 + kBlockSize);
+  ASSERT_TRUE(test_utils::WriteFileVector(sparse_file_.path(), sparse_));
+  EXPECT_TRUE(IsSparseImage(sparse_file_.path()));
+  EXPECT_FALSE(ExpandSparseImage(sparse_file_.path(), raw_file_.path()));
+}
+
+}  // namespace chromeos_update_engine
@@ -17,13 +17,17 @@
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 
 #include <fcntl.h>
+#include <zlib.h>
 
 #include <algorithm>
+#include <map>
+#include <set>
 #include <string>
 #include <utility>
 
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <brillo/streams/file_stream.h>
@@ -96,23 +100,10 @@ bool GetFileMapContent(const string& sqfs_path, string* map) {
   return true;
 }
 
-}  // namespace
-
-bool SquashfsFilesystem::Init(const string& map,
-                              const string& sqfs_path,
-                              size_t size,
-                              const SquashfsHeader& header,
-                              bool extract_deflates) {
-  size_ = size;
-
-  bool is_zlib = header.compression_type == kSquashfsZlibCompression;
-  if (!is_zlib) {
-    LOG(WARNING) << "Filesystem is not Gzipped. Not filling deflates!";
-  }
-  vector<puffin::ByteExtent> zlib_blks;
-
-  // Reading files map. For the format of the file map look at the comments for
-  // |CreateFromFileMap()|.
+// Parses the file map |map|, in the format described in CreateFromFileMap(),
+// into |entries|.
+bool ParseFileMap(const string& map,
+                  vector<SquashfsFilesystem::FileMapEntry>* entries) {
   auto lines = base::SplitStringPiece(map,
                                       "\n",
                                       base::WhitespaceHandling::KEEP_WHITESPACE,
@@ -125,12 +116,313 @@ bool SquashfsFilesystem::Init(const string& map,
                                base::SplitResult::SPLIT_WANT_NONEMPTY);
     // Only filename is invalid.
     TEST_AND_RETURN_FALSE(splits.size() > 1);
-    uint64_t start;
-    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &start));
-    uint64_t cur_offset = start;
+    SquashfsFilesystem::FileMapEntry entry;
+    entry.name = splits[0].as_string();
+    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &entry.start));
     for (size_t i = 2; i < splits.size(); ++i) {
       uint64_t blk_size;
       TEST_AND_RETURN_FALSE(base::StringToUint64(splits[i], &blk_size));
+      entry.block_sizes.push_back(blk_size);
+    }
+    entries->push_back(std::move(entry));
+  }
+  return true;
+}
+
+// The layout of the squashfs 4 metadata read below, all in little-endian. See
+// fs/squashfs/squashfs_fs.h in the kernel tree for the whole format.
+//
+// The offsets of the tables in the super block.
+constexpr size_t kSuperBlockRootInodeOffset = 32;
+constexpr size_t kSuperBlockInodeTableOffset = 64;
+constexpr size_t kSuperBlockDirectoryTableOffset = 72;
+
+// The metadata blocks hold up to 8 KiB of data, after a 16 bit header with the
+// size stored and whether it is compressed.
+constexpr size_t kMetadataBlockSize = 8192;
+constexpr uint16_t kMetadataUncompressedBit = 1 << 15;
+
+// The inode types.
+constexpr uint16_t kDirectoryInode = 1;
+constexpr uint16_t kFileInode = 2;
+constexpr uint16_t kExtendedDirectoryInode = 8;
+constexpr uint16_t kExtendedFileInode = 9;
+
+// The sizes of the inode header common to all the types, and of the fields that
+// follow it, before the list of block sizes in the file inodes.
+constexpr size_t kInodeHeaderSize = 16;
+constexpr size_t kDirectoryInodeSize = 16;
+constexpr size_t kExtendedDirectoryInodeSize = 24;
+constexpr size_t kFileInodeSize = 16;
+constexpr size_t kExtendedFileInodeSize = 40;
+
+// A file without a fragment has this fragment index.
+constexpr uint32_t kNoFragment = 0xFFFFFFFF;
+
+// The directory listings are a series of headers of 12 bytes, each followed by
+// entries of 8 bytes and the entry name.
+constexpr size_t kDirectoryHeaderSize = 12;
+constexpr size_t kDirectoryEntrySize = 8;
+
+template <typename T>
+T ReadLittleEndian(const uint8_t* data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Reads the files of a squashfs image from its inode and directory tables,
+// in the same format as the "unsquashfs -m" file map.
+class SquashfsImageReader {
+ public:
+  explicit SquashfsImageReader(int fd) : fd_(fd) {}
+
+  bool ReadFiles(vector<SquashfsFilesystem::FileMapEntry>* entries) {
+    uint8_t super_block[kSquashfsSuperBlockSize];
+    TEST_AND_RETURN_FALSE(utils::PReadAll(
+        fd_, super_block, sizeof(super_block), 0, &bytes_read_));
+    TEST_AND_RETURN_FALSE(bytes_read_ == sizeof(super_block));
+    block_size_ = ReadLittleEndian<uint32_t>(super_block + 12);
+    inode_table_ = ReadLittleEndian<uint64_t>(super_block +
+                                              kSuperBlockInodeTableOffset);
+    directory_table_ = ReadLittleEndian<uint64_t>(
+        super_block + kSuperBlockDirectoryTableOffset);
+    TEST_AND_RETURN_FALSE(block_size_ > 0);
+    return ReadDirectory(
+        ReadLittleEndian<uint64_t>(super_block + kSuperBlockRootInodeOffset),
+        "",
+        entries);
+  }
+
+ private:
+  // A position in the metadata: the offset in the image of a metadata block
+  // and an offset in its uncompressed data.
+  struct Position {
+    uint64_t block;
+    size_t offset;
+  };
+
+  // Returns the position of the inode referenced by |inode_ref|.
+  Position InodePosition(uint64_t inode_ref) const {
+    return {inode_table_ + (inode_ref >> 16), inode_ref & 0xFFFF};
+  }
+
+  // Reads |size| bytes of metadata from |position| into |data|, advancing the
+  // position past them.
+  bool ReadMetadata(Position* position, size_t size, uint8_t* data) {
+    while (size > 0) {
+      const MetadataBlock* block;
+      TEST_AND_RETURN_FALSE(ReadMetadataBlock(position->block, &block));
+      if (position->offset >= block->data.size()) {
+        // The data continues on the next block.
+        TEST_AND_RETURN_FALSE(position->offset == block->data.size());
+        *position = {block->next_block, 0};
+        continue;
+      }
+      size_t length = std::min(size, block->data.size() - position->offset);
+      memcpy(data, block->data.data() + position->offset, length);
+      position->offset += length;
+      data += length;
+      size -= length;
+    }
+    return true;
+  }
+
+  struct MetadataBlock {
+    brillo::Blob data;
+    uint64_t next_block;
+  };
+
+  // Reads and uncompresses the metadata block at offset |offset| of the image.
+  // The blocks are cached, since the inodes listed in a directory are usually
+  // in the same few blocks.
+  bool ReadMetadataBlock(uint64_t offset, const MetadataBlock** result) {
+    auto it = metadata_blocks_.find(offset);
+    if (it != metadata_blocks_.end()) {
+      *result = &it->second;
+      return true;
+    }
+    uint16_t header;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd_, &header, sizeof(header), offset, &bytes_read_));
+    TEST_AND_RETURN_FALSE(bytes_read_ == sizeof(header));
+    size_t size = header & ~kMetadataUncompressedBit;
+    TEST_AND_RETURN_FALSE(size > 0 && size <= kMetadataBlockSize);
+    brillo::Blob stored(size);
+    TEST_AND_RETURN_FALSE(utils::PReadAll(
+        fd_, stored.data(), size, offset + sizeof(header), &bytes_read_));
+    TEST_AND_RETURN_FALSE(bytes_read_ == static_cast<ssize_t>(size));
+
+    MetadataBlock block;
+    block.next_block = offset + sizeof(header) + size;
+    if (header & kMetadataUncompressedBit) {
+      block.data = std::move(stored);
+    } else {
+      block.data.resize(kMetadataBlockSize);
+      uLongf data_size = block.data.size();
+      if (uncompress(block.data.data(), &data_size, stored.data(), size) !=
+          Z_OK) {
+        LOG(ERROR) << "Unable to uncompress the metadata block at " << offset;
+        return false;
+      }
+      block.data.resize(data_size);
+    }
+    *result = &(metadata_blocks_[offset] = std::move(block));
+    return true;
+  }
+
+  // Adds to |entries| the files in the directory of the inode |inode_ref| and
+  // in its subdirectories, with their names prefixed by |path|.
+  bool ReadDirectory(uint64_t inode_ref,
+                     const string& path,
+                     vector<SquashfsFilesystem::FileMapEntry>* entries) {
+    // Don't loop forever on corrupted images.
+    TEST_AND_RETURN_FALSE(visited_directories_.insert(inode_ref).second);
+
+    Position position = InodePosition(inode_ref);
+    uint8_t inode[kInodeHeaderSize + kExtendedDirectoryInodeSize];
+    TEST_AND_RETURN_FALSE(ReadMetadata(&position, kInodeHeaderSize, inode));
+    uint16_t type = ReadLittleEndian<uint16_t>(inode);
+    const uint8_t* fields = inode + kInodeHeaderSize;
+    uint32_t listing_size;
+    Position listing;
+    if (type == kDirectoryInode) {
+      TEST_AND_RETURN_FALSE(ReadMetadata(
+          &position, kDirectoryInodeSize, inode + kInodeHeaderSize));
+      listing_size = ReadLittleEndian<uint16_t>(fields + 8);
+      listing = {directory_table_ + ReadLittleEndian<uint32_t>(fields),
+                 ReadLittleEndian<uint16_t>(fields + 10)};
+    } else if (type == kExtendedDirectoryInode) {
+      TEST_AND_RETURN_FALSE(ReadMetadata(
+          &position, kExtendedDirectoryInodeSize, inode + kInodeHeaderSize));
+      listing_size = ReadLittleEndian<uint32_t>(fields + 4);
+      listing = {directory_table_ + ReadLittleEndian<uint32_t>(fields + 8),
+                 ReadLittleEndian<uint16_t>(fields + 18)};
+    } else {
+      LOG(ERROR) << "Inode " << inode_ref << " is not a directory.";
+      return false;
+    }
+
+    // The stored size counts three bytes more than the listing, for the "."
+    // and ".." entries which are not stored.
+    uint64_t remaining = listing_size > 3 ? listing_size - 3 : 0;
+    while (remaining > 0) {
+      uint8_t header[kDirectoryHeaderSize];
+      TEST_AND_RETURN_FALSE(remaining >= sizeof(header));
+      TEST_AND_RETURN_FALSE(ReadMetadata(&listing, sizeof(header), header));
+      remaining -= sizeof(header);
+      uint64_t count = ReadLittleEndian<uint32_t>(header) + 1;
+      uint64_t inode_block = ReadLittleEndian<uint32_t>(header + 4);
+      for (uint64_t i = 0; i < count; i++) {
+        uint8_t entry[kDirectoryEntrySize];
+        TEST_AND_RETURN_FALSE(remaining >= sizeof(entry));
+        TEST_AND_RETURN_FALSE(ReadMetadata(&listing, sizeof(entry), entry));
+        size_t name_size = ReadLittleEndian<uint16_t>(entry + 6) + 1;
+        TEST_AND_RETURN_FALSE(remaining >= sizeof(entry) + name_size);
+        string name(name_size, '\0');
+        TEST_AND_RETURN_FALSE(ReadMetadata(
+            &listing, name_size, reinterpret_cast<uint8_t*>(&name[0])));
+        remaining -= sizeof(entry) + name_size;
+
+        uint64_t entry_ref =
+            (inode_block << 16) | ReadLittleEndian<uint16_t>(entry);
+        string entry_path = path.empty() ? name : path + "/" + name;
+        uint16_t entry_type = ReadLittleEndian<uint16_t>(entry + 4);
+        if (entry_type == kDirectoryInode) {
+          TEST_AND_RETURN_FALSE(ReadDirectory(entry_ref, entry_path, entries));
+        } else if (entry_type == kFileInode) {
+          TEST_AND_RETURN_FALSE(ReadFile(entry_ref, entry_path, entries));
+        }
+      }
+    }
+    return true;
+  }
+
+  // Adds to |entries| the file of the inode |inode_ref| named |path|.
+  bool ReadFile(uint64_t inode_ref,
+                const string& path,
+                vector<SquashfsFilesystem::FileMapEntry>* entries) {
+    Position position = InodePosition(inode_ref);
+    uint8_t inode[kInodeHeaderSize + kExtendedFileInodeSize];
+    TEST_AND_RETURN_FALSE(ReadMetadata(&position, kInodeHeaderSize, inode));
+    uint16_t type = ReadLittleEndian<uint16_t>(inode);
+    const uint8_t* fields = inode + kInodeHeaderSize;
+    SquashfsFilesystem::FileMapEntry entry;
+    entry.name = path;
+    uint64_t file_size;
+    uint32_t fragment;
+    if (type == kFileInode) {
+      TEST_AND_RETURN_FALSE(
+          ReadMetadata(&position, kFileInodeSize, inode + kInodeHeaderSize));
+      entry.start = ReadLittleEndian<uint32_t>(fields);
+      fragment = ReadLittleEndian<uint32_t>(fields + 4);
+      file_size = ReadLittleEndian<uint32_t>(fields + 12);
+    } else if (type == kExtendedFileInode) {
+      TEST_AND_RETURN_FALSE(ReadMetadata(
+          &position, kExtendedFileInodeSize, inode + kInodeHeaderSize));
+      entry.start = ReadLittleEndian<uint64_t>(fields);
+      file_size = ReadLittleEndian<uint64_t>(fields + 8);
+      fragment = ReadLittleEndian<uint32_t>(fields + 28);
+    } else {
+      LOG(ERROR) << "Inode " << inode_ref << " is not a regular file.";
+      return false;
+    }
+
+    // The tail of the file is stored in a fragment, if it has one, instead of
+    // in a block of its own.
+    uint64_t num_blocks = fragment == kNoFragment
+                              ? (file_size + block_size_ - 1) / block_size_
+                              : file_size / block_size_;
+    for (uint64_t i = 0; i < num_blocks; i++) {
+      uint8_t block_size[4];
+      TEST_AND_RETURN_FALSE(
+          ReadMetadata(&position, sizeof(block_size), block_size));
+      entry.block_sizes.push_back(ReadLittleEndian<uint32_t>(block_size));
+    }
+    entries->push_back(std::move(entry));
+    return true;
+  }
+
+  int fd_;
+  ssize_t bytes_read_;
+  uint32_t block_size_{0};
+  uint64_t inode_table_{0};
+  uint64_t directory_table_{0};
+  std::map<uint64_t, MetadataBlock> metadata_blocks_;
+  std::set<uint64_t> visited_directories_;
+
+  DISALLOW_COPY_AND_ASSIGN(SquashfsImageReader);
+};
+
+// Reads the files of the image |sqfs_path| into |entries| without running
+// unsquashfs, when its compressor is supported.
+bool ReadFileMapFromImage(const string& sqfs_path,
+                          vector<SquashfsFilesystem::FileMapEntry>* entries) {
+  int fd = HANDLE_EINTR(open(sqfs_path.c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  return SquashfsImageReader(fd).ReadFiles(entries);
+}
+
+}  // namespace
+
+bool SquashfsFilesystem::Init(const vector<FileMapEntry>& entries,
+                              const string& sqfs_path,
+                              size_t size,
+                              const SquashfsHeader& header,
+                              bool extract_deflates) {
+  size_ = size;
+
+  bool is_zlib = header.compression_type == kSquashfsZlibCompression;
+  if (!is_zlib) {
+    LOG(WARNING) << "Filesystem is not Gzipped. Not filling deflates!";
+  }
+  vector<puffin::ByteExtent> zlib_blks;
+
+  for (const FileMapEntry& entry : entries) {
+    uint64_t start = entry.start;
+    uint64_t cur_offset = start;
+    for (uint64_t blk_size : entry.block_sizes) {
       // TODO(ahassani): For puffin push it into a proper list if uncompressed.
       auto new_blk_size = blk_size & ~kSquashfsCompressedBit;
       TEST_AND_RETURN_FALSE(new_blk_size <= header.block_size);
@@ -146,7 +438,7 @@ bool SquashfsFilesystem::Init(const string& map,
     // If size is zero do not add the file.
     if (cur_offset - start > 0) {
       File file;
-      file.name = splits[0].as_string();
+      file.name = entry.name;
       file.extents = {ExtentForBytes(kBlockSize, start, cur_offset - start)};
       files_.emplace_back(file);
     }
@@ -273,16 +565,24 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFile(
     return nullptr;
   }
 
-  // Read the map file.
-  string filemap;
-  if (!GetFileMapContent(sqfs_path, &filemap)) {
-    LOG(ERROR) << "Failed to produce squashfs map file: " << sqfs_path;
-    return nullptr;
+  // Read the files from the image, or from the map file produced by unsquashfs
+  // if that fails, for example with compressors other than zlib.
+  vector<FileMapEntry> entries;
+  if (!ReadFileMapFromImage(sqfs_path, &entries)) {
+    LOG(INFO) << "Unable to read the files of " << sqfs_path
+              << " directly, using unsquashfs.";
+    entries.clear();
+    string filemap;
+    if (!GetFileMapContent(sqfs_path, &filemap) ||
+        !ParseFileMap(filemap, &entries)) {
+      LOG(ERROR) << "Failed to produce squashfs map file: " << sqfs_path;
+      return nullptr;
+    }
   }
 
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
   if (!sqfs->Init(
-          filemap, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
+          entries, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
     LOG(ERROR) << "Failed to initialized the Squashfs file system";
     return nullptr;
   }
@@ -297,8 +597,14 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFileMap(
     return nullptr;
   }
 
+  vector<FileMapEntry> entries;
+  if (!ParseFileMap(filemap, &entries)) {
+    LOG(ERROR) << "Failed to parse the Squashfs filemap";
+    return nullptr;
+  }
+
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
-  if (!sqfs->Init(filemap, "", size, header, false)) {
+  if (!sqfs->Init(entries, "", size, header, false)) {
     LOG(ERROR) << "Failed to initialize the Squashfs file system using filemap";
     return nullptr;
   }
@@ -53,11 +53,20 @@ class SquashfsFilesystem : public FilesystemInterface {
     uint16_t major_version;
   };
 
+  // A file in the image, as listed in a file map. See CreateFromFileMap().
+  struct FileMapEntry {
+    std::string name;
+    uint64_t start;
+    std::vector<uint64_t> block_sizes;
+  };
+
   ~SquashfsFilesystem() override = default;
 
-  // Creates the file system from the Squashfs file itself. If
-  // |extract_deflates| is true, it will process files to find location of all
-  // deflate streams.
+  // Creates the file system from the Squashfs file itself. The files are read
+  // from the inode and directory tables of the image when its metadata is
+  // compressed with zlib or not compressed, and from the output of
+  // "unsquashfs -m" otherwise. If |extract_deflates| is true, it will process
+  // files to find location of all deflate streams.
   static std::unique_ptr<SquashfsFilesystem> CreateFromFile(
       const std::string& sqfs_path, bool extract_deflates);
 
@@ -100,8 +109,9 @@ class SquashfsFilesystem : public FilesystemInterface {
  private:
   SquashfsFilesystem() = default;
 
-  // Initialize and populates the files in the file system.
-  bool Init(const std::string& map,
+  // Initialize and populates the files in the file system from the |entries|
+  // of its files.
+  bool Init(const std::vector<FileMapEntry>& entries,
             const std::string& sqfs_path,
             size_t size,
             const SquashfsHeader& header,
@@ -18,6 +18,8 @@
 
 #include <unistd.h>
 
+#include <zlib.h>
+
 #include <algorithm>
 #include <map>
 #include <set>
@@ -68,6 +70,77 @@ SquashfsFilesystem::SquashfsHeader GetSimpleHeader() {
   };
 }
 
+template <typename T>
+void AppendLittleEndian(brillo::Blob* blob, T value) {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(&value);
+  blob->insert(blob->end(), data, data + sizeof(value));
+}
+
+// Appends the header of an inode of type |type| to |blob|.
+void AppendInodeHeader(brillo::Blob* blob, uint16_t type, uint32_t number) {
+  AppendLittleEndian<uint16_t>(blob, type);
+  AppendLittleEndian<uint16_t>(blob, 0755);  // permissions
+  AppendLittleEndian<uint16_t>(blob, 0);     // uid index
+  AppendLittleEndian<uint16_t>(blob, 0);     // gid index
+  AppendLittleEndian<uint32_t>(blob, 0);     // mtime
+  AppendLittleEndian<uint32_t>(blob, number);
+}
+
+// Appends a basic directory inode with its listing at |listing_offset| of the
+// first directory table block, |listing_size| bytes long.
+void AppendDirectoryInode(brillo::Blob* blob,
+                          uint32_t number,
+                          uint16_t listing_offset,
+                          uint16_t listing_size) {
+  AppendInodeHeader(blob, 1, number);
+  AppendLittleEndian<uint32_t>(blob, 0);  // directory block
+  AppendLittleEndian<uint32_t>(blob, 2);  // link count
+  AppendLittleEndian<uint16_t>(blob, listing_size + 3);
+  AppendLittleEndian<uint16_t>(blob, listing_offset);
+  AppendLittleEndian<uint32_t>(blob, 1);  // parent inode
+}
+
+// Appends a directory listing header for |count| entries whose inodes are in
+// the first inode table block.
+void AppendDirectoryHeader(brillo::Blob* blob, uint32_t count) {
+  AppendLittleEndian<uint32_t>(blob, count - 1);
+  AppendLittleEndian<uint32_t>(blob, 0);  // inode block
+  AppendLittleEndian<uint32_t>(blob, 1);  // inode number
+}
+
+void AppendDirectoryEntry(brillo::Blob* blob,
+                          uint16_t inode_offset,
+                          uint16_t type,
+                          const string& name) {
+  AppendLittleEndian<uint16_t>(blob, inode_offset);
+  AppendLittleEndian<int16_t>(blob, 0);
+  AppendLittleEndian<uint16_t>(blob, type);
+  AppendLittleEndian<uint16_t>(blob, name.size() - 1);
+  blob->insert(blob->end(), name.begin(), name.end());
+}
+
+// Appends a metadata block holding |data|, compressed if |compress|.
+void AppendMetadataBlock(brillo::Blob* blob,
+                         const brillo::Blob& data,
+                         bool compress) {
+  if (!compress) {
+    AppendLittleEndian<uint16_t>(blob, data.size() | 0x8000);
+    blob->insert(blob->end(), data.begin(), data.end());
+    return;
+  }
+  brillo::Blob compressed(compressBound(data.size()));
+  uLongf compressed_size = compressed.size();
+  ASSERT_EQ(Z_OK,
+            compress2(compressed.data(),
+                      &compressed_size,
+                      data.data(),
+                      data.size(),
+                      Z_BEST_COMPRESSION));
+  AppendLittleEndian<uint16_t>(blob, compressed_size);
+  blob->insert(blob->end(), compressed.begin(),
+               compressed.begin() + compressed_size);
+}
+
 }  // namespace
 
 class SquashfsFilesystemTest : public ::testing::Test {
@@ -150,6 +223,89 @@ TEST_F(SquashfsFilesystemTest, DefaultFilesystemTest) {
 }
 #endif  // __CHROMEOS__
 
+TEST_F(SquashfsFilesystemTest, ReadFilesFromImageTest) {
+  // An image with the files "a", of two blocks, and "dir/c", of one block,
+  // stored from the second 4 KiB block on, followed by the inode table and the
+  // directory table.
+  brillo::Blob inodes;
+  const uint16_t kRootInode = 0, kFileAInode = 32, kDirInode = 72,
+                 kFileCInode = 104;
+  const uint16_t kRootListing = 0, kDirListing = 32;
+  AppendDirectoryInode(&inodes, 1, kRootListing, 32);
+  ASSERT_EQ(kFileAInode, inodes.size());
+  AppendInodeHeader(&inodes, 2, 2);
+  AppendLittleEndian<uint32_t>(&inodes, kTestBlockSize);  // blocks start
+  AppendLittleEndian<uint32_t>(&inodes, 0xFFFFFFFF);      // no fragment
+  AppendLittleEndian<uint32_t>(&inodes, 0);               // fragment offset
+  AppendLittleEndian<uint32_t>(&inodes, kTestSqfsBlockSize + 10);
+  AppendLittleEndian<uint32_t>(&inodes, kTestBlockSize | (1 << 24));
+  AppendLittleEndian<uint32_t>(&inodes, kTestBlockSize);
+  ASSERT_EQ(kDirInode, inodes.size());
+  AppendDirectoryInode(&inodes, 3, kDirListing, 21);
+  ASSERT_EQ(kFileCInode, inodes.size());
+  AppendInodeHeader(&inodes, 2, 4);
+  AppendLittleEndian<uint32_t>(&inodes, 3 * kTestBlockSize);
+  AppendLittleEndian<uint32_t>(&inodes, 0xFFFFFFFF);
+  AppendLittleEndian<uint32_t>(&inodes, 0);
+  AppendLittleEndian<uint32_t>(&inodes, 100);
+  AppendLittleEndian<uint32_t>(&inodes, kTestBlockSize);
+
+  brillo::Blob directories;
+  AppendDirectoryHeader(&directories, 2);
+  AppendDirectoryEntry(&directories, kFileAInode, 2, "a");
+  AppendDirectoryEntry(&directories, kDirInode, 1, "dir");
+  ASSERT_EQ(kDirListing, directories.size());
+  AppendDirectoryHeader(&directories, 1);
+  AppendDirectoryEntry(&directories, kFileCInode, 2, "c");
+
+  brillo::Blob image;
+  AppendLittleEndian<uint32_t>(&image, 0x73717368);  // magic
+  AppendLittleEndian<uint32_t>(&image, 4);           // inode count
+  AppendLittleEndian<uint32_t>(&image, 0);           // mkfs time
+  AppendLittleEndian<uint32_t>(&image, kTestSqfsBlockSize);
+  AppendLittleEndian<uint32_t>(&image, 0);   // fragment count
+  AppendLittleEndian<uint16_t>(&image, 1);   // zlib
+  AppendLittleEndian<uint16_t>(&image, 15);  // block log
+  AppendLittleEndian<uint16_t>(&image, 0);   // flags
+  AppendLittleEndian<uint16_t>(&image, 1);   // id count
+  AppendLittleEndian<uint16_t>(&image, 4);   // major version
+  AppendLittleEndian<uint16_t>(&image, 0);   // minor version
+  AppendLittleEndian<uint64_t>(&image, kRootInode);
+  const uint64_t kInodeTable = 4 * kTestBlockSize;
+  brillo::Blob tables;
+  AppendMetadataBlock(&tables, inodes, true);
+  const uint64_t kDirectoryTable = kInodeTable + tables.size();
+  AppendMetadataBlock(&tables, directories, false);
+  AppendLittleEndian<uint64_t>(&image, kInodeTable + tables.size());
+  for (int i = 0; i < 2; i++)  // id and xattr tables
+    AppendLittleEndian<uint64_t>(&image, kInodeTable + tables.size());
+  AppendLittleEndian<uint64_t>(&image, kInodeTable);
+  AppendLittleEndian<uint64_t>(&image, kDirectoryTable);
+  for (int i = 0; i < 2; i++)  // fragment and export tables
+    AppendLittleEndian<uint64_t>(&image, kInodeTable + tables.size());
+  image.resize(kInodeTable);
+  image.insert(image.end(), tables.begin(), tables.end());
+  image.resize(5 * kTestBlockSize);
+
+  test_utils::ScopedTempFile sqfs_file("SquashfsFilesystemTest.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(sqfs_file.path(), image));
+  unique_ptr<SquashfsFilesystem> fs =
+      SquashfsFilesystem::CreateFromFile(sqfs_file.path(), false);
+  CheckSquashfs(fs);
+
+  vector<FilesystemInterface::File> files;
+  ASSERT_TRUE(fs->GetFiles(&files));
+  ASSERT_EQ(4U, files.size());
+  EXPECT_EQ("<metadata-0>", files[0].name);
+  EXPECT_EQ(vector<Extent>{ExtentForRange(0, 1)}, files[0].extents);
+  EXPECT_EQ("a", files[1].name);
+  EXPECT_EQ(vector<Extent>{ExtentForRange(1, 2)}, files[1].extents);
+  EXPECT_EQ("dir/c", files[2].name);
+  EXPECT_EQ(vector<Extent>{ExtentForRange(3, 1)}, files[2].extents);
+  EXPECT_EQ("<metadata-1>", files[3].name);
+  EXPECT_EQ(vector<Extent>{ExtentForRange(4, 1)}, files[3].extents);
+}
+
 TEST_F(SquashfsFilesystemTest, SimpleFileMapTest) {
   string filemap = R"(dir1/file1 96 4000
                       dir1/file2 4096 100)";
@@ -24,6 +24,8 @@
 
 #include <base/logging.h>
 
+#include "update_engine/payload_generator/delta_diff_utils.h"
+
 namespace {
 
 bool xz_initialized = false;
@@ -106,6 +108,18 @@ bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
   // The input size data is used to reduce the dictionary size if possible.
   lzma2Props.lzmaProps.reduceSize = in.size();
   Lzma2EncProps_Normalize(&lzma2Props);
+  // Inputs larger than one LZMA2 block (four times the dictionary size, once
+  // normalized) are split in blocks compressed in parallel. Each block resets
+  // the LZMA2 state but keeps the same dictionary size, so the result is a
+  // single xz stream that xz-embedded decodes with the same memory as before.
+  size_t num_blocks = (in.size() + lzma2Props.blockSize - 1) /
+                      lzma2Props.blockSize;
+  if (num_blocks > 1) {
+    lzma2Props.numBlockThreads = static_cast<int>(
+        std::min(num_blocks, diff_utils::GetMaxThreads()));
+    lzma2Props.numTotalThreads = 0;
+    Lzma2EncProps_Normalize(&lzma2Props);
+  }
 
   BlobWriterStream out_writer(out);
   BlobReaderStream in_reader(in);
@@ -17,21 +17,24 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <base/strings/stringprintf.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using chromeos_update_engine::test_utils::kRandomString;
-using google::protobuf::RepeatedPtrField;
 using std::string;
 using std::vector;
 
@@ -51,7 +54,7 @@ class MemoryExtentWriter : public ExtentWriter {
   ~MemoryExtentWriter() override = default;
 
   bool Init(FileDescriptorPtr fd,
-            const RepeatedPtrField<Extent>& extents,
+            ExtentSpan extents,
             uint32_t block_size) override {
     return true;
   }
@@ -115,11 +118,24 @@ class ZipTest<XzTest> : public ::testing::Test {
   }
 };
 
+class ZstdTest {};
+
+template <>
+class ZipTest<ZstdTest> : public ::testing::Test {
+ public:
+  bool ZipCompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return ZstdCompress(in, out);
+  }
+  bool ZipDecompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return DecompressWithWriter<ZstdExtentWriter>(in, out);
+  }
+};
+
 #ifdef __ANDROID__
-typedef ::testing::Types<BzipTest, XzTest> ZipTestTypes;
+typedef ::testing::Types<BzipTest, XzTest, ZstdTest> ZipTestTypes;
 #else
 // Chrome OS implementation of Xz compressor just returns false.
-typedef ::testing::Types<BzipTest> ZipTestTypes;
+typedef ::testing::Types<BzipTest, ZstdTest> ZipTestTypes;
 #endif  // __ANDROID__
 
 TYPED_TEST_CASE(ZipTest, ZipTestTypes);
@@ -170,4 +186,108 @@ TYPED_TEST(ZipTest, EmptyInputsTest) {
   EXPECT_EQ(0U, out.size());
 }
 
+class ZstdDictionaryTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // Small records sharing most of their content, like the small files of a
+    // partition.
+    brillo::Blob samples;
+    vector<size_t> sample_sizes;
+    for (int i = 0; i < 500; i++) {
+      brillo::Blob record = Record(i);
+      samples.insert(samples.end(), record.begin(), record.end());
+      sample_sizes.push_back(record.size());
+    }
+    ASSERT_TRUE(
+        ZstdTrainDictionary(samples, sample_sizes, 4096, &dictionary_content_));
+    dictionary_ = ZstdDictionary::Create(dictionary_content_);
+    ASSERT_NE(nullptr, dictionary_);
+    decompression_dictionary_ = ZstdDecompressionDictionary::Create(
+        string(dictionary_content_.begin(), dictionary_content_.end()));
+    ASSERT_NE(nullptr, decompression_dictionary_);
+    EXPECT_EQ(dictionary_->id(), decompression_dictionary_->id());
+  }
+
+  // Returns the record number |i|.
+  static brillo::Blob Record(int i) {
+    string record = base::StringPrintf(
+        "<service name=\"service%d\" user=\"system\" group=\"system\" "
+        "class=\"main\" path=\"/system/bin/service%d\" "
+        "seclabel=\"u:r:service%d:s0\" oneshot=\"%s\" />\n",
+        i,
+        i * 7,
+        i % 13,
+        i % 2 ? "true" : "false");
+    return brillo::Blob(record.begin(), record.end());
+  }
+
+  // Decompresses |in| into |out| with a ZstdExtentWriter using |dictionary|,
+  // writing |chunk_size| bytes at a time.
+  static bool Decompress(const brillo::Blob& in,
+                         const ZstdDecompressionDictionary* dictionary,
+                         size_t chunk_size,
+                         brillo::Blob* out) {
+    ZstdExtentWriter writer(std::make_unique<MemoryExtentWriter>(out),
+                            dictionary);
+    bool ok = writer.Init(nullptr, {}, 1);
+    for (size_t offset = 0; ok && offset < in.size(); offset += chunk_size) {
+      ok = writer.Write(in.data() + offset,
+                        std::min(chunk_size, in.size() - offset));
+    }
+    ok = writer.End() && ok;
+    return ok;
+  }
+
+  brillo::Blob dictionary_content_;
+  std::unique_ptr<ZstdDictionary> dictionary_;
+  std::unique_ptr<ZstdDecompressionDictionary> decompression_dictionary_;
+};
+
+TEST_F(ZstdDictionaryTest, SmallDataTest) {
+  brillo::Blob in = Record(1234);
+  brillo::Blob out;
+  EXPECT_TRUE(ZstdCompress(in, &out));
+  brillo::Blob out_dictionary;
+  EXPECT_TRUE(ZstdCompressWithDictionary(in, *dictionary_, &out_dictionary));
+  EXPECT_LT(out_dictionary.size(), out.size());
+
+  brillo::Blob decompressed;
+  EXPECT_TRUE(Decompress(
+      out_dictionary, decompression_dictionary_.get(), 4096, &decompressed));
+  EXPECT_EQ(in, decompressed);
+  // The frame can't be decompressed without the dictionary.
+  EXPECT_FALSE(Decompress(out_dictionary, nullptr, 4096, &decompressed));
+}
+
+TEST_F(ZstdDictionaryTest, MixedFramesTest) {
+  // Only the frames referencing the dictionary are decompressed with it, even
+  // when their headers are split across writes.
+  brillo::Blob in = Record(1);
+  brillo::Blob in_dictionary = Record(2);
+  brillo::Blob frames;
+  EXPECT_TRUE(ZstdCompress(in, &frames));
+  brillo::Blob frame;
+  EXPECT_TRUE(ZstdCompressWithDictionary(in_dictionary, *dictionary_, &frame));
+  frames.insert(frames.end(), frame.begin(), frame.end());
+  EXPECT_TRUE(ZstdCompress(in, &frame));
+  frames.insert(frames.end(), frame.begin(), frame.end());
+
+  brillo::Blob expected = in;
+  expected.insert(expected.end(), in_dictionary.begin(), in_dictionary.end());
+  expected.insert(expected.end(), in.begin(), in.end());
+  for (size_t chunk_size : {1, 3, 4096}) {
+    brillo::Blob decompressed;
+    EXPECT_TRUE(Decompress(
+        frames, decompression_dictionary_.get(), chunk_size, &decompressed));
+    EXPECT_EQ(expected, decompressed);
+  }
+}
+
+TEST_F(ZstdDictionaryTest, InvalidDictionaryTest) {
+  brillo::Blob in = Record(1);
+  EXPECT_EQ(nullptr, ZstdDictionary::Create(in));
+  EXPECT_EQ(nullptr,
+            ZstdDecompressionDictionary::Create(string(in.begin(), in.end())));
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,118 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/zstd.h"
+
+#include <zdict.h>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// Level 19 is the highest one not using the "ultra" settings, whose windows
+// need up to 128 MiB of RAM to decompress. It needs at most 8 MiB.
+const int kZstdCompressionLevel = 19;
+}  // namespace
+
+std::unique_ptr<ZstdDictionary> ZstdDictionary::Create(
+    const brillo::Blob& content) {
+  uint32_t id = ZDICT_getDictID(content.data(), content.size());
+  if (id == 0) {
+    LOG(ERROR) << "Invalid zstd dictionary of " << content.size() << " bytes.";
+    return nullptr;
+  }
+  ZSTD_CDict* cdict =
+      ZSTD_createCDict(content.data(), content.size(), kZstdCompressionLevel);
+  if (!cdict) {
+    LOG(ERROR) << "ZSTD_createCDict failed.";
+    return nullptr;
+  }
+  return std::unique_ptr<ZstdDictionary>(
+      new ZstdDictionary(content, id, cdict));
+}
+
+ZstdDictionary::~ZstdDictionary() {
+  ZSTD_freeCDict(cdict_);
+}
+
+bool ZstdCompress(const brillo::Blob& in, brillo::Blob* out) {
+  out->clear();
+  if (in.empty())
+    return true;
+
+  out->resize(ZSTD_compressBound(in.size()));
+  size_t size = ZSTD_compress(
+      out->data(), out->size(), in.data(), in.size(), kZstdCompressionLevel);
+  if (ZSTD_isError(size)) {
+    LOG(ERROR) << "ZSTD_compress failed: " << ZSTD_getErrorName(size);
+    out->clear();
+    return false;
+  }
+  out->resize(size);
+  return true;
+}
+
+bool ZstdCompressWithDictionary(const brillo::Blob& in,
+                                const ZstdDictionary& dictionary,
+                                brillo::Blob* out) {
+  out->clear();
+  if (in.empty())
+    return true;
+
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+  TEST_AND_RETURN_FALSE(cctx != nullptr);
+  out->resize(ZSTD_compressBound(in.size()));
+  size_t size = ZSTD_compress_usingCDict(cctx,
+                                         out->data(),
+                                         out->size(),
+                                         in.data(),
+                                         in.size(),
+                                         dictionary.cdict());
+  ZSTD_freeCCtx(cctx);
+  if (ZSTD_isError(size)) {
+    LOG(ERROR) << "ZSTD_compress_usingCDict failed: "
+               << ZSTD_getErrorName(size);
+    out->clear();
+    return false;
+  }
+  out->resize(size);
+  return true;
+}
+
+bool ZstdTrainDictionary(const brillo::Blob& samples,
+                         const std::vector<size_t>& sample_sizes,
+                         size_t max_size,
+                         brillo::Blob* dictionary) {
+  dictionary->resize(max_size);
+  size_t size = ZDICT_trainFromBuffer(dictionary->data(),
+                                      dictionary->size(),
+                                      samples.data(),
+                                      sample_sizes.data(),
+                                      sample_sizes.size());
+  if (ZDICT_isError(size)) {
+    LOG(ERROR) << "ZDICT_trainFromBuffer failed: "
+               << ZDICT_getErrorName(size);
+    dictionary->clear();
+    return false;
+  }
+  dictionary->resize(size);
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_H_
+
+#include <stdint.h>
+#include <zstd.h>
+
+#include <memory>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+namespace chromeos_update_engine {
+
+// A zstd dictionary prepared once to compress many buffers with it, from any
+// thread.
+class ZstdDictionary {
+ public:
+  // Returns the dictionary of |content|, or nullptr if |content| isn't a zstd
+  // dictionary with an ID, such as the ones trained by ZstdTrainDictionary().
+  static std::unique_ptr<ZstdDictionary> Create(const brillo::Blob& content);
+  ~ZstdDictionary();
+
+  const brillo::Blob& content() const { return content_; }
+  // The ID stored in the frames compressed with the dictionary.
+  uint32_t id() const { return id_; }
+  const ZSTD_CDict* cdict() const { return cdict_; }
+
+ private:
+  ZstdDictionary(const brillo::Blob& content, uint32_t id, ZSTD_CDict* cdict)
+      : content_(content), id_(id), cdict_(cdict) {}
+
+  brillo::Blob content_;
+  uint32_t id_;
+  ZSTD_CDict* cdict_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZstdDictionary);
+};
+
+// Compresses the input buffer |in| into |out| with zstd. The compressed frame
+// will be the equivalent of running zstd -19 --no-check, since the payload
+// already has the hash of the operation data.
+bool ZstdCompress(const brillo::Blob& in, brillo::Blob* out);
+
+// Compresses |in| into |out| like ZstdCompress(), but using the |dictionary|,
+// which must be given to decompress the frame too. It mostly helps small
+// buffers, whose matches are otherwise limited to their own data.
+bool ZstdCompressWithDictionary(const brillo::Blob& in,
+                                const ZstdDictionary& dictionary,
+                                brillo::Blob* out);
+
+// Trains in |dictionary| a zstd dictionary of up to |max_size| bytes from the
+// concatenated |samples|, whose sizes are in |sample_sizes|. It fails when the
+// samples are too few or too small to train a dictionary.
+bool ZstdTrainDictionary(const brillo::Blob& samples,
+                         const std::vector<size_t>& sample_sizes,
+                         size_t max_size,
+                         brillo::Blob* dictionary);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_H_
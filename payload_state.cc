@@ -18,6 +18,8 @@
 
 #include <algorithm>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <base/logging.h>
 #include <base/strings/string_util.h>
@@ -42,6 +44,7 @@ using base::Time;
 using base::TimeDelta;
 using std::min;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -55,6 +58,35 @@ static const int kMaxBackoffDays = 16;
 // We want to randomize retry attempts after the backoff by +/- 6 hours.
 static const uint32_t kMaxBackoffFuzzMinutes = 12 * 60;
 
+// The byte counters updated for every downloaded chunk are persisted once this
+// many bytes were downloaded or this much time passed since they last were,
+// and on the update state transitions.
+static const uint64_t kBytesDownloadedFlushSize = 4 * 1024 * 1024;
+static const int kBytesDownloadedFlushIntervalSeconds = 10;
+
+// Returns the key of the pref storing the throughput measured from the host
+// of |url|, or an empty string if |url| has no host.
+static string GetUrlHostThroughputKey(const string& url) {
+  size_t host_start = url.find("://");
+  if (host_start == string::npos)
+    return "";
+  host_start += 3;
+  size_t host_end = url.find_first_of("/?#", host_start);
+  string host = url.substr(host_start, host_end - host_start);
+  // Drop the user info, if any.
+  size_t user_info_end = host.rfind('@');
+  if (user_info_end != string::npos)
+    host.erase(0, user_info_end + 1);
+  if (host.empty())
+    return "";
+  // Only some characters are allowed in the pref keys.
+  for (char& c : host) {
+    if (!base::IsAsciiAlpha(c) && !base::IsAsciiDigit(c) && c != '-')
+      c = '_';
+  }
+  return kPrefsUrlHostThroughputPrefix + base::ToLowerASCII(host);
+}
+
 PayloadState::PayloadState()
     : prefs_(nullptr),
       using_p2p_for_downloading_(false),
@@ -97,10 +129,13 @@ bool PayloadState::Initialize(SystemState* system_state) {
   LoadRollbackVersion();
   LoadP2PFirstAttemptTimestamp();
   LoadP2PNumAttempts();
+  LoadNetworkEstimates();
   return true;
 }
 
 void PayloadState::SetResponse(const OmahaResponse& omaha_response) {
+  FlushBytesDownloaded();
+
   // Always store the latest response.
   response_ = omaha_response;
 
@@ -115,6 +150,10 @@ void PayloadState::SetResponse(const OmahaResponse& omaha_response) {
   string new_response_signature = CalculateResponseSignature();
   bool has_response_changed = (response_signature_ != new_response_signature);
 
+  // The signature uses the order of the response, so ranking the URLs after
+  // computing it doesn't make the response look new.
+  RankCandidateUrls();
+
   // If the response has changed, we should persist the new signature and
   // clear away all the existing state.
   if (has_response_changed) {
@@ -155,6 +194,7 @@ void PayloadState::SetUsingP2PForDownloading(bool value) {
 
 void PayloadState::DownloadComplete() {
   LOG(INFO) << "Payload downloaded successfully";
+  FlushBytesDownloaded();
   IncrementPayloadAttemptNumber();
   IncrementFullPayloadAttemptNumber();
 }
@@ -184,6 +224,8 @@ void PayloadState::DownloadProgress(size_t count) {
 }
 
 void PayloadState::AttemptStarted(AttemptType attempt_type) {
+  FlushBytesDownloaded();
+
   // Flush previous state from abnormal attempt failure, if any.
   ReportAndClearPersistedAttemptMetrics();
 
@@ -226,6 +268,8 @@ void PayloadState::UpdateRestarted() {
 }
 
 void PayloadState::UpdateSucceeded() {
+  FlushBytesDownloaded();
+
   // Send the relevant metrics that are tracked in this class to UMA.
   CalculateUpdateDurationUptime();
   SetUpdateTimestampEnd(system_state_->clock()->GetWallclockTime());
@@ -253,6 +297,8 @@ void PayloadState::UpdateSucceeded() {
 }
 
 void PayloadState::UpdateFailed(ErrorCode error) {
+  FlushBytesDownloaded();
+
   ErrorCode base_error = utils::GetBaseErrorCode(error);
   LOG(INFO) << "Updating payload state for error code: " << base_error
             << " (" << utils::ErrorCodeToString(base_error) << ")";
@@ -552,16 +598,38 @@ void PayloadState::UpdateCurrentDownloadSource() {
 }
 
 void PayloadState::UpdateBytesDownloaded(size_t count) {
-  SetCurrentBytesDownloaded(
-      current_download_source_,
-      GetCurrentBytesDownloaded(current_download_source_) + count,
-      false);
-  SetTotalBytesDownloaded(
-      current_download_source_,
-      GetTotalBytesDownloaded(current_download_source_) + count,
-      false);
-
   attempt_num_bytes_downloaded_ += count;
+  if (current_download_source_ >= kNumDownloadSources)
+    return;
+
+  // Only update the in-memory values, this is called for every downloaded
+  // chunk. At most the last few seconds of progress are lost on a crash.
+  current_bytes_downloaded_[current_download_source_] += count;
+  total_bytes_downloaded_[current_download_source_] += count;
+  bytes_downloaded_dirty_[current_download_source_] = true;
+  unflushed_bytes_downloaded_ += count;
+
+  Time now = system_state_->clock()->GetMonotonicTime();
+  if (unflushed_bytes_downloaded_ >= kBytesDownloadedFlushSize ||
+      now - bytes_downloaded_flush_time_ >=
+          TimeDelta::FromSeconds(kBytesDownloadedFlushIntervalSeconds)) {
+    FlushBytesDownloaded();
+  }
+}
+
+void PayloadState::FlushBytesDownloaded() {
+  for (int i = 0; i < kNumDownloadSources; i++) {
+    if (!bytes_downloaded_dirty_[i])
+      continue;
+    DownloadSource source = static_cast<DownloadSource>(i);
+    prefs_->SetInt64(GetPrefsKey(kPrefsCurrentBytesDownloaded, source),
+                     current_bytes_downloaded_[i]);
+    prefs_->SetInt64(GetPrefsKey(kPrefsTotalBytesDownloaded, source),
+                     total_bytes_downloaded_[i]);
+    bytes_downloaded_dirty_[i] = false;
+  }
+  unflushed_bytes_downloaded_ = 0;
+  bytes_downloaded_flush_time_ = system_state_->clock()->GetMonotonicTime();
 }
 
 PayloadType PayloadState::CalculatePayloadType() {
@@ -925,6 +993,33 @@ void PayloadState::SetScatteringWaitPeriod(TimeDelta wait_period) {
   }
 }
 
+void PayloadState::LoadNetworkEstimates() {
+  throughput_estimate_ = GetPersistedValue(kPrefsThroughputEstimate, prefs_);
+  round_trip_time_estimate_ = TimeDelta::FromMicroseconds(
+      GetPersistedValue(kPrefsRoundTripTimeEstimate, prefs_));
+}
+
+void PayloadState::SetNetworkEstimates(int64_t throughput,
+                                       TimeDelta round_trip_time) {
+  CHECK(prefs_);
+  throughput_estimate_ = throughput;
+  round_trip_time_estimate_ = round_trip_time;
+  LOG(INFO) << "Throughput estimate = " << throughput_estimate_
+            << " bytes/s, round trip time estimate = "
+            << round_trip_time_estimate_.InMilliseconds() << " ms";
+  prefs_->SetInt64(kPrefsThroughputEstimate, throughput_estimate_);
+  prefs_->SetInt64(kPrefsRoundTripTimeEstimate,
+                   round_trip_time_estimate_.InMicroseconds());
+
+  // Score the host we downloaded from, to rank it against the other mirrors
+  // the next time.
+  if (using_p2p_for_downloading_)
+    return;
+  string key = GetUrlHostThroughputKey(GetCurrentUrl());
+  if (!key.empty())
+    prefs_->SetInt64(key, throughput_estimate_);
+}
+
 void PayloadState::LoadUrlSwitchCount() {
   SetUrlSwitchCount(GetPersistedValue(kPrefsUrlSwitchCount, prefs_));
 }
@@ -1208,6 +1303,32 @@ void PayloadState::ComputeCandidateUrls() {
   }
 }
 
+void PayloadState::RankCandidateUrls() {
+  for (auto& urls : candidate_urls_) {
+    vector<std::pair<int64_t, string>> ranked_urls;
+    for (const string& url : urls)
+      ranked_urls.emplace_back(GetUrlHostThroughput(url), url);
+    std::stable_sort(ranked_urls.begin(),
+                     ranked_urls.end(),
+                     [](const std::pair<int64_t, string>& a,
+                        const std::pair<int64_t, string>& b) {
+                       return a.first > b.first;
+                     });
+    for (size_t i = 0; i < urls.size(); i++) {
+      if (urls[i] != ranked_urls[i].second) {
+        LOG(INFO) << "Ranked Url" << i << ": " << ranked_urls[i].second << " ("
+                  << ranked_urls[i].first << " bytes/s)";
+      }
+      urls[i] = ranked_urls[i].second;
+    }
+  }
+}
+
+int64_t PayloadState::GetUrlHostThroughput(const string& url) {
+  string key = GetUrlHostThroughputKey(url);
+  return key.empty() ? 0 : GetPersistedValue(key, prefs_);
+}
+
 void PayloadState::UpdateEngineStarted() {
   // Flush previous state from abnormal attempt failure, if any.
   ReportAndClearPersistedAttemptMetrics();
@@ -85,6 +85,15 @@ class PayloadState : public PayloadStateInterface {
                : "";
   }
 
+  inline std::string GetPayloadUrl(size_t payload_index) override {
+    if (payload_index == payload_index_)
+      return GetCurrentUrl();
+    return payload_index < candidate_urls_.size() &&
+                   candidate_urls_[payload_index].size()
+               ? candidate_urls_[payload_index][0]
+               : "";
+  }
+
   inline uint32_t GetUrlFailureCount() override {
     return url_failure_count_;
   }
@@ -142,6 +151,17 @@ class PayloadState : public PayloadStateInterface {
 
   void SetScatteringWaitPeriod(base::TimeDelta wait_period) override;
 
+  int64_t GetThroughputEstimate() const override {
+    return throughput_estimate_;
+  }
+
+  base::TimeDelta GetRoundTripTimeEstimate() const override {
+    return round_trip_time_estimate_;
+  }
+
+  void SetNetworkEstimates(int64_t throughput,
+                           base::TimeDelta round_trip_time) override;
+
   void SetP2PUrl(const std::string& url) override {
     p2p_url_ = url;
   }
@@ -205,6 +225,10 @@ class PayloadState : public PayloadStateInterface {
   // that were downloaded recently.
   void UpdateBytesDownloaded(size_t count);
 
+  // Persists the byte counters changed by UpdateBytesDownloaded() since they
+  // were last persisted.
+  void FlushBytesDownloaded();
+
   // Calculates the PayloadType we're using.
   PayloadType CalculatePayloadType();
 
@@ -383,6 +407,15 @@ class PayloadState : public PayloadStateInterface {
   // the Omaha response.
   void ComputeCandidateUrls();
 
+  // Orders the candidate URLs of each payload by the throughput last measured
+  // from their host, fastest first. The hosts never measured keep the order of
+  // the response, after the measured ones.
+  void RankCandidateUrls();
+
+  // Returns the throughput last measured from the host of |url| in bytes per
+  // second, or zero if unknown.
+  int64_t GetUrlHostThroughput(const std::string& url);
+
   // Sets |num_responses_seen_| and persist it to disk.
   void SetNumResponsesSeen(int num_responses_seen);
 
@@ -419,6 +452,9 @@ class PayloadState : public PayloadStateInterface {
   // Loads the persisted scattering wallclock-based wait period.
   void LoadScatteringWaitPeriod();
 
+  // Loads the persisted network estimates.
+  void LoadNetworkEstimates();
+
   // Get the total size of all payloads.
   int64_t GetPayloadSize();
 
@@ -527,20 +563,26 @@ class PayloadState : public PayloadStateInterface {
   // The number of bytes that have been downloaded for each source for each new
   // update attempt. If we resume an update, we'll continue from the previous
   // value, but if we get a new response or if the previous attempt failed,
-  // we'll reset this to 0 to start afresh. Each update to this value is
-  // persisted so we resume from the same value in case of a process restart.
+  // we'll reset this to 0 to start afresh. The download progress is persisted
+  // periodically by FlushBytesDownloaded(), and the other updates right away,
+  // so we resume from about the same value in case of a process restart.
   // The extra index in the array is to no-op accidental access in case the
   // return value from GetCurrentDownloadSource is used without validation.
   uint64_t current_bytes_downloaded_[kNumDownloadSources + 1];
 
   // The number of bytes that have been downloaded for each source since the
   // the last successful update. This is used to compute the overhead we incur.
-  // Each update to this value is persisted so we resume from the same value in
-  // case of a process restart.
+  // It is persisted like |current_bytes_downloaded_|.
   // The extra index in the array is to no-op accidental access in case the
   // return value from GetCurrentDownloadSource is used without validation.
   uint64_t total_bytes_downloaded_[kNumDownloadSources + 1];
 
+  // Whether the byte counters of each source changed since they were last
+  // persisted, the number of bytes downloaded since then, and when it was.
+  bool bytes_downloaded_dirty_[kNumDownloadSources] = {};
+  uint64_t unflushed_bytes_downloaded_ = 0;
+  base::Time bytes_downloaded_flush_time_;
+
   // A small timespan used when comparing wall-clock times for coping
   // with the fact that clocks drift and consequently are adjusted
   // (either forwards or backwards) via NTP.
@@ -577,6 +619,11 @@ class PayloadState : public PayloadStateInterface {
   // The current scattering wallclock-based wait period.
   base::TimeDelta scattering_wait_period_;
 
+  // The network estimates of the last download attempt. Unlike most of the
+  // state above they aren't tied to a response, so they are never reset.
+  int64_t throughput_estimate_{0};
+  base::TimeDelta round_trip_time_estimate_;
+
   DISALLOW_COPY_AND_ASSIGN(PayloadState);
 };
 
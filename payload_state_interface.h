@@ -114,6 +114,11 @@ class PayloadStateInterface {
   // Returns the current URL. Returns an empty string if there's no valid URL.
   virtual std::string GetCurrentUrl() = 0;
 
+  // Returns the URL of the payload |payload_index| of the response: the
+  // current URL for the current payload, and the first candidate URL for the
+  // other ones. Returns an empty string if there's no valid URL.
+  virtual std::string GetPayloadUrl(size_t payload_index) = 0;
+
   // Returns the current URL's failure count.
   virtual uint32_t GetUrlFailureCount() = 0;
 
@@ -189,6 +194,16 @@ class PayloadStateInterface {
   // Sets and persists the scattering wallclock-based wait period.
   virtual void SetScatteringWaitPeriod(base::TimeDelta wait_period) = 0;
 
+  // Returns the persisted download throughput in bytes per second and round
+  // trip time to the server measured by the previous attempts, or zero if
+  // unknown.
+  virtual int64_t GetThroughputEstimate() const = 0;
+  virtual base::TimeDelta GetRoundTripTimeEstimate() const = 0;
+
+  // Sets and persists the network estimates of the last download attempt.
+  virtual void SetNetworkEstimates(int64_t throughput,
+                                   base::TimeDelta round_trip_time) = 0;
+
   // Sets/gets the P2P download URL, if one is to be used.
   virtual void SetP2PUrl(const std::string& url) = 0;
   virtual std::string GetP2PUrl() const = 0;
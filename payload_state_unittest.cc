@@ -250,6 +250,30 @@ TEST(PayloadStateTest, SetResponseWorksWithMultipleUrls) {
   EXPECT_EQ(1, payload_state.GetNumResponsesSeen());
 }
 
+TEST(PayloadStateTest, GetPayloadUrlOfEachPayload) {
+  OmahaResponse response;
+  response.packages.push_back({.payload_urls = {"https://first.url.test",
+                                                "https://first.mirror.test"},
+                               .size = 523456789,
+                               .hash = "rhash"});
+  response.packages.push_back({.payload_urls = {"https://second.url.test",
+                                                "https://second.mirror.test"},
+                               .size = 123456,
+                               .hash = "rhash2"});
+  FakeSystemState fake_system_state;
+  PayloadState payload_state;
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+  payload_state.SetResponse(response);
+
+  EXPECT_EQ("https://first.url.test", payload_state.GetPayloadUrl(0));
+  EXPECT_EQ("https://second.url.test", payload_state.GetPayloadUrl(1));
+  EXPECT_EQ("", payload_state.GetPayloadUrl(2));
+
+  EXPECT_TRUE(payload_state.NextPayload());
+  EXPECT_EQ(payload_state.GetCurrentUrl(), payload_state.GetPayloadUrl(1));
+  EXPECT_EQ("https://first.url.test", payload_state.GetPayloadUrl(0));
+}
+
 TEST(PayloadStateTest, CanAdvanceUrlIndexCorrectly) {
   OmahaResponse response;
   FakeSystemState fake_system_state;
@@ -780,6 +804,43 @@ TEST(PayloadStateTest, BackoffLogicCanBeDisabled) {
   EXPECT_FALSE(payload_state.ShouldBackoffDownload());
 }
 
+TEST(PayloadStateTest, BytesDownloadedPersistedPeriodically) {
+  OmahaResponse response;
+  PayloadState payload_state;
+  FakeSystemState fake_system_state;
+  FakeClock fake_clock;
+  fake_clock.SetMonotonicTime(Time::FromInternalValue(1000000));
+  fake_system_state.set_clock(&fake_clock);
+  NiceMock<MockPrefs>* prefs = fake_system_state.mock_prefs();
+
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+  SetupPayloadStateWith2Urls(
+      "Hash1957", true, false, &payload_state, &response);
+
+  // The progress of every chunk isn't persisted.
+  EXPECT_CALL(*prefs, SetInt64(kCurrentBytesDownloadedFromHttp, _)).Times(0);
+  EXPECT_CALL(*prefs, SetInt64(kTotalBytesDownloadedFromHttp, _)).Times(0);
+  payload_state.DownloadProgress(100);
+  payload_state.DownloadProgress(200);
+  EXPECT_EQ(300U,
+            payload_state.GetCurrentBytesDownloaded(kDownloadSourceHttpServer));
+  Mock::VerifyAndClearExpectations(prefs);
+
+  // It is once enough time passed.
+  EXPECT_CALL(*prefs, SetInt64(kCurrentBytesDownloadedFromHttp, 400));
+  EXPECT_CALL(*prefs, SetInt64(kTotalBytesDownloadedFromHttp, 400));
+  fake_clock.SetMonotonicTime(Time::FromInternalValue(1000000) +
+                              TimeDelta::FromSeconds(10));
+  payload_state.DownloadProgress(100);
+  Mock::VerifyAndClearExpectations(prefs);
+
+  // And on the update state transitions.
+  EXPECT_CALL(*prefs, SetInt64(kCurrentBytesDownloadedFromHttp, 450));
+  EXPECT_CALL(*prefs, SetInt64(kTotalBytesDownloadedFromHttp, 450));
+  payload_state.DownloadProgress(50);
+  payload_state.DownloadComplete();
+}
+
 TEST(PayloadStateTest, BytesDownloadedMetricsGetAddedToCorrectSources) {
   OmahaResponse response;
   response.disable_payload_backoff = true;
@@ -1634,4 +1695,61 @@ TEST(PayloadStateTest, P2PStateVarsAreClearedOnNewResponse) {
   EXPECT_EQ(null_time, payload_state.GetP2PFirstAttemptTimestamp());
 }
 
+TEST(PayloadStateTest, NetworkEstimatesArePersisted) {
+  OmahaResponse response;
+  PayloadState payload_state;
+  FakeSystemState fake_system_state;
+  FakePrefs fake_prefs;
+  fake_system_state.set_prefs(&fake_prefs);
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+  EXPECT_EQ(0, payload_state.GetThroughputEstimate());
+  EXPECT_EQ(TimeDelta(), payload_state.GetRoundTripTimeEstimate());
+
+  payload_state.SetNetworkEstimates(123456, TimeDelta::FromMilliseconds(80));
+
+  // The estimates survive a new response and a restart.
+  SetupPayloadStateWith2Urls(
+      "Hash8593", true, false, &payload_state, &response);
+  PayloadState payload_state2;
+  EXPECT_TRUE(payload_state2.Initialize(&fake_system_state));
+  EXPECT_EQ(123456, payload_state2.GetThroughputEstimate());
+  EXPECT_EQ(TimeDelta::FromMilliseconds(80),
+            payload_state2.GetRoundTripTimeEstimate());
+}
+
+TEST(PayloadStateTest, CandidateUrlsAreRankedByHostThroughput) {
+  OmahaResponse response;
+  PayloadState payload_state;
+  FakeSystemState fake_system_state;
+  FakePrefs fake_prefs;
+  fake_system_state.set_prefs(&fake_prefs);
+  EXPECT_TRUE(payload_state.Initialize(&fake_system_state));
+  response.packages.push_back(
+      {.payload_urls = {"https://slow.example.com/payload",
+                        "https://user@Fast.example.com:443/payload",
+                        "https://new.example.com/payload"},
+       .size = 523456789,
+       .hash = "Hash8593"});
+  response.max_failure_count_per_url = 3;
+
+  // The download from the first URL scores its host.
+  payload_state.SetResponse(response);
+  EXPECT_EQ("https://slow.example.com/payload", payload_state.GetCurrentUrl());
+  payload_state.SetNetworkEstimates(1000, TimeDelta());
+  EXPECT_TRUE(fake_prefs.Exists("url-host-throughput-slow_example_com"));
+  fake_prefs.SetInt64("url-host-throughput-fast_example_com_443", 5000);
+
+  // The fastest host is tried first, then the slower and unknown ones, without
+  // resetting the state of the response.
+  string response_signature = payload_state.GetResponseSignature();
+  payload_state.SetResponse(response);
+  EXPECT_EQ(response_signature, payload_state.GetResponseSignature());
+  EXPECT_EQ("https://user@Fast.example.com:443/payload",
+            payload_state.GetCurrentUrl());
+  payload_state.UpdateFailed(ErrorCode::kPayloadHashMismatchError);
+  EXPECT_EQ("https://slow.example.com/payload", payload_state.GetCurrentUrl());
+  payload_state.UpdateFailed(ErrorCode::kPayloadHashMismatchError);
+  EXPECT_EQ("https://new.example.com/payload", payload_state.GetCurrentUrl());
+}
+
 }  // namespace chromeos_update_engine
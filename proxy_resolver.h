@@ -60,6 +60,12 @@ class ProxyResolver {
   // |request| value must be the one provided by GetProxiesForUrl().
   virtual bool CancelProxyRequest(ProxyRequestId request) = 0;
 
+  // Reports that no connection could be made to |url| through |proxy|, one
+  // of the proxies returned for it, so a resolver keeping them can try the
+  // others first next time.
+  virtual void ReportProxyFailure(const std::string& url,
+                                  const std::string& proxy) {}
+
  private:
   DISALLOW_COPY_AND_ASSIGN(ProxyResolver);
 };
@@ -66,20 +66,9 @@ bool RealSystemState::Initialize() {
     return false;
   }
 
-#if USE_CHROME_KIOSK_APP
-  libcros_proxy_.reset(new org::chromium::LibCrosServiceInterfaceProxy(
-      DBusConnection::Get()->GetDBus(), chromeos::kLibCrosServiceName));
-#endif  // USE_CHROME_KIOSK_APP
-
   LOG_IF(INFO, !hardware_->IsNormalBootMode()) << "Booted in dev mode.";
   LOG_IF(INFO, !hardware_->IsOfficialBuild()) << "Booted non-official build.";
 
-  connection_manager_ = connection_manager::CreateConnectionManager(this);
-  if (!connection_manager_) {
-    LOG(ERROR) << "Error intializing the ConnectionManagerInterface.";
-    return false;
-  }
-
   power_manager_ = power_manager::CreatePowerManager();
   if (!power_manager_) {
     LOG(ERROR) << "Error intializing the PowerManagerInterface.";
@@ -142,10 +131,36 @@ bool RealSystemState::Initialize() {
 
   update_attempter_.reset(new UpdateAttempter(this,
                                               certificate_checker_.get()));
+#if !defined(__ANDROID__)
+  // Android has no /run, so its clients always ask for the status.
+  if (status_page_.Init(kStatusPagePath)) {
+    update_attempter_->set_status_page(&status_page_);
+  } else {
+    LOG(WARNING) << "Unable to publish the status page, the clients will "
+                    "have to ask for the status.";
+  }
+#endif  // !defined(__ANDROID__)
 
   // Initialize the UpdateAttempter before the UpdateManager.
   update_attempter_->Init();
 
+  // The remaining objects are only needed to check for and apply updates, and
+  // are initialized by StartUpdater() once the service is registered.
+  return true;
+}
+
+bool RealSystemState::InitializeUpdater() {
+#if USE_CHROME_KIOSK_APP
+  libcros_proxy_.reset(new org::chromium::LibCrosServiceInterfaceProxy(
+      DBusConnection::Get()->GetDBus(), chromeos::kLibCrosServiceName));
+#endif  // USE_CHROME_KIOSK_APP
+
+  connection_manager_ = connection_manager::CreateConnectionManager(this);
+  if (!connection_manager_) {
+    LOG(ERROR) << "Error intializing the ConnectionManagerInterface.";
+    return false;
+  }
+
   // Initialize the Update Manager using the default state factory.
   chromeos_update_manager::State* um_state =
       chromeos_update_manager::DefaultStateFactory(&policy_provider_,
@@ -180,13 +195,19 @@ bool RealSystemState::Initialize() {
 }
 
 bool RealSystemState::StartUpdater() {
+  if (!InitializeUpdater()) {
+    LOG(ERROR) << "Failed to initialize the updater, not checking for updates.";
+    return false;
+  }
+
   // Initiate update checks.
   update_attempter_->ScheduleUpdates();
 
-  // Update boot flags after 45 seconds.
+  // Update boot flags and perform the p2p housekeeping after 45 seconds, in a
+  // single wakeup out of the boot.
   MessageLoop::current()->PostDelayedTask(
       FROM_HERE,
-      base::Bind(&UpdateAttempter::UpdateBootFlags,
+      base::Bind(&UpdateAttempter::PerformStartupHousekeeping,
                  base::Unretained(update_attempter_.get())),
       base::TimeDelta::FromSeconds(45));
 
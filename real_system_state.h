@@ -40,6 +40,7 @@
 #include "update_engine/p2p_manager.h"
 #include "update_engine/payload_state.h"
 #include "update_engine/power_manager_interface.h"
+#include "update_engine/status_page.h"
 #include "update_engine/update_attempter.h"
 #include "update_engine/update_manager/update_manager.h"
 
@@ -55,12 +56,15 @@ class RealSystemState : public SystemState, public DaemonStateInterface {
   ~RealSystemState() override;
 
   // Initializes and sets systems objects that require an initialization
-  // separately from construction. Returns |true| on success.
+  // separately from construction and are needed to answer the status queries
+  // of the service. Returns |true| on success.
   bool Initialize();
 
   // DaemonStateInterface overrides.
-  // Start the periodic update attempts. Must be called at the beginning of the
-  // program to start the periodic update check process.
+  // Initializes the objects used to check for updates, which make blocking
+  // D-Bus calls, and starts the periodic update attempts. Must be called at
+  // the beginning of the program, once the service is registered, to start
+  // the periodic update check process.
   bool StartUpdater() override;
 
   void AddObserver(ServiceObserverInterface* observer) override;
@@ -127,6 +131,11 @@ class RealSystemState : public SystemState, public DaemonStateInterface {
   inline bool system_rebooted() override { return system_rebooted_; }
 
  private:
+  // Initializes the connection manager, the Update Manager with its
+  // providers, the P2P manager and the payload state, which are only used
+  // once the updater is started. Returns |true| on success.
+  bool InitializeUpdater();
+
   // Real DBus proxies using the DBus connection.
 #if USE_CHROME_KIOSK_APP
   std::unique_ptr<org::chromium::LibCrosServiceInterfaceProxy> libcros_proxy_;
@@ -168,6 +177,9 @@ class RealSystemState : public SystemState, public DaemonStateInterface {
   OpenSSLWrapper openssl_wrapper_;
   std::unique_ptr<CertificateChecker> certificate_checker_;
 
+  // The status page published by the |update_attempter_|.
+  StatusPageWriter status_page_;
+
   // Pointer to the update attempter object.
   std::unique_ptr<UpdateAttempter> update_attempter_;
 
@@ -212,7 +212,7 @@ generate_fs() {
   local block_size="${5:-4096}"
   local block_groups="${6:-}"
 
-  local mkfs_opts=( -q -F -b "${block_size}" -L "ROOT-TEST" -t ext2 )
+  local mkfs_opts=( -q -F -b "${block_size}" -L "ROOT-TEST" -t "${type}" )
   if [[ -n "${block_groups}" ]]; then
     mkfs_opts+=( -G "${block_groups}" )
   fi
@@ -224,7 +224,7 @@ generate_fs() {
     rm -f "${filename}"
   fi
 
-  if [[ "${type}" == "ext2" ]]; then
+  if [[ "${type}" == "ext2" || "${type}" == "ext4" ]]; then
     truncate --size="${size}" "${filename}"
 
     mkfs.ext2 "${mkfs_opts[@]}" "${filename}"
@@ -266,6 +266,7 @@ main() {
   generate_image disk_ext2_4k ext2 default $((1024 * 4096)) 4096
   generate_image disk_ext2_4k_empty ext2 empty $((1024 * 4096)) 4096
   generate_image disk_ext2_unittest ext2 unittest $((1024 * 4096)) 4096
+  generate_image disk_ext4_4k ext4 default $((1024 * 4096)) 4096
 
   # Add squashfs sample images.
   generate_image disk_sqfs_empty sqfs empty $((1024 * 4096)) 4096
@@ -76,6 +76,11 @@ class ServiceDelegateAndroidInterface {
   virtual bool VerifyPayloadApplicable(const std::string& metadata_filename,
                                        brillo::ErrorPtr* error) = 0;
 
+  // Lets the update use the device resources at full speed while |enable|:
+  // the update I/O isn't throttled and the payload is applied, verified and
+  // downloaded with more threads, reads and connections. It can be switched
+  // at any time during an update. In case of error, returns false and sets
+  // |error| accordingly.
   virtual bool SetPerformanceMode(bool enable, brillo::ErrorPtr* error) = 0;
 
  protected:
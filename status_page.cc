@@ -0,0 +1,225 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/status_page.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_util.h>
+#include <base/threading/platform_thread.h>
+#include <base/time/time.h>
+
+using std::string;
+using update_engine::UpdateEngineStatus;
+using update_engine::UpdateStatus;
+
+namespace chromeos_update_engine {
+
+const char kStatusPagePath[] = "/run/update_engine/status_page";
+
+namespace {
+
+const uint32_t kStatusPageMagic = 0x50534555;  // "UESP"
+const uint32_t kStatusPageVersion = 1;
+const size_t kMaxVersionSize = 128;
+
+// A reader retries while the page is being updated. That only takes a few
+// hundred nanoseconds, so it first spins, then yields to let a preempted writer
+// finish, and then sleeps for exponentially longer, for a few ms overall.
+const int kReadSpins = 100;
+const int kReadYields = 10;
+const int kReadSleeps = 10;
+const int64_t kMinReadSleepMicroseconds = 10;
+const int64_t kMaxReadSleepMicroseconds = 1000;
+const int kMaxReadRetries = kReadSpins + kReadYields + kReadSleeps;
+
+// Waits before the retry |attempt| of a read, counted from zero.
+void BackOff(int attempt) {
+  if (attempt < kReadSpins)
+    return;
+  attempt -= kReadSpins;
+  if (attempt < kReadYields) {
+    base::PlatformThread::YieldCurrentThread();
+    return;
+  }
+  attempt -= kReadYields;
+  base::PlatformThread::Sleep(base::TimeDelta::FromMicroseconds(std::min(
+      kMinReadSleepMicroseconds << attempt, kMaxReadSleepMicroseconds)));
+}
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "The sequence lock needs lock-free atomics to be shared across "
+              "processes.");
+
+}  // namespace
+
+// The layout of the page, shared with the readers of other processes.
+struct StatusPageData {
+  // The fields protected by |sequence|.
+  struct Fields {
+    int64_t last_checked_time;
+    double progress;
+    uint64_t new_size_bytes;
+    int32_t status;
+    char new_version[kMaxVersionSize];
+    char new_system_version[kMaxVersionSize];
+  };
+
+  uint32_t magic;
+  uint32_t version;
+  // Odd while |fields| are being written, and zero until first published.
+  std::atomic<uint32_t> sequence;
+  Fields fields;
+};
+
+StatusPageWriter::~StatusPageWriter() {
+  if (data_)
+    munmap(data_, sizeof(StatusPageData));
+}
+
+bool StatusPageWriter::Init(const string& path) {
+  // The readers of other users need to search the directory, which
+  // base::CreateDirectory() creates only accessible to the daemon.
+  base::FilePath dir = base::FilePath(path).DirName();
+  if (!base::DirectoryExists(dir) &&
+      (!base::CreateDirectory(dir) || chmod(dir.value().c_str(), 0755) != 0)) {
+    PLOG(ERROR) << "Unable to create the directory of " << path;
+    return false;
+  }
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+  if (fd < 0) {
+    PLOG(ERROR) << "Unable to open the status page " << path;
+    return false;
+  }
+  void* data = MAP_FAILED;
+  // The readers only need to read it, whatever the umask of the daemon.
+  if (fchmod(fd, 0644) == 0 && ftruncate(fd, sizeof(StatusPageData)) == 0) {
+    data = mmap(nullptr,
+                sizeof(StatusPageData),
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED,
+                fd,
+                0);
+  }
+  if (data == MAP_FAILED)
+    PLOG(ERROR) << "Unable to map the status page " << path;
+  IGNORE_EINTR(close(fd));
+  if (data == MAP_FAILED)
+    return false;
+
+  data_ = static_cast<StatusPageData*>(data);
+  if (data_->magic != kStatusPageMagic ||
+      data_->version != kStatusPageVersion) {
+    memset(data_, 0, sizeof(StatusPageData));
+    data_->magic = kStatusPageMagic;
+    data_->version = kStatusPageVersion;
+  } else if (data_->sequence.load(std::memory_order_relaxed) & 1) {
+    // The previous daemon stopped while updating it.
+    data_->sequence.fetch_add(1, std::memory_order_release);
+  }
+  return true;
+}
+
+void StatusPageWriter::Publish(const UpdateEngineStatus& status) {
+  if (!data_)
+    return;
+  StatusPageData::Fields fields;
+  memset(&fields, 0, sizeof(fields));
+  fields.last_checked_time = status.last_checked_time;
+  fields.progress = status.progress;
+  fields.new_size_bytes = status.new_size_bytes;
+  fields.status = static_cast<int32_t>(status.status);
+  base::strlcpy(
+      fields.new_version, status.new_version.c_str(), kMaxVersionSize);
+  base::strlcpy(fields.new_system_version,
+                status.new_system_version.c_str(),
+                kMaxVersionSize);
+
+  uint32_t sequence = data_->sequence.load(std::memory_order_relaxed);
+  data_->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&data_->fields, &fields, sizeof(fields));
+  data_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+StatusPageReader::~StatusPageReader() {
+  if (data_)
+    munmap(const_cast<StatusPageData*>(data_), sizeof(StatusPageData));
+}
+
+bool StatusPageReader::Init(const string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return false;
+  struct stat stbuf;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &stbuf) == 0 &&
+      static_cast<size_t>(stbuf.st_size) >= sizeof(StatusPageData)) {
+    data = mmap(
+        nullptr, sizeof(StatusPageData), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  IGNORE_EINTR(close(fd));
+  if (data == MAP_FAILED)
+    return false;
+  data_ = static_cast<const StatusPageData*>(data);
+  return true;
+}
+
+bool StatusPageReader::Read(UpdateEngineStatus* status) const {
+  if (!data_ || data_->magic != kStatusPageMagic ||
+      data_->version != kStatusPageVersion) {
+    return false;
+  }
+  StatusPageData::Fields fields;
+  for (int i = 0; i <= kMaxReadRetries; i++) {
+    if (i > 0)
+      BackOff(i - 1);
+    uint32_t sequence = data_->sequence.load(std::memory_order_acquire);
+    if (sequence == 0)
+      return false;
+    if (sequence & 1)
+      continue;
+    memcpy(&fields, &data_->fields, sizeof(fields));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (data_->sequence.load(std::memory_order_relaxed) != sequence)
+      continue;
+
+    status->last_checked_time = fields.last_checked_time;
+    status->progress = fields.progress;
+    status->new_size_bytes = fields.new_size_bytes;
+    status->status = static_cast<UpdateStatus>(fields.status);
+    status->new_version = string(
+        fields.new_version, strnlen(fields.new_version, kMaxVersionSize));
+    status->new_system_version =
+        string(fields.new_system_version,
+               strnlen(fields.new_system_version, kMaxVersionSize));
+    return true;
+  }
+  return false;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_STATUS_PAGE_H_
+#define UPDATE_ENGINE_STATUS_PAGE_H_
+
+#include <string>
+
+#include <base/macros.h>
+
+#include "update_engine/client_library/include/update_engine/update_status.h"
+
+namespace chromeos_update_engine {
+
+// The file the daemon publishes its status page to, on a tmpfs. It isn't
+// published on Android, which has no /run.
+extern const char kStatusPagePath[];
+
+struct StatusPageData;
+
+// Publishes the status of the update_engine in a page of shared memory,
+// mapped from a file any process can map read-only with a StatusPageReader,
+// so the status can be watched at a high frequency without waking up the
+// daemon with an IPC. The page is protected by a sequence lock: the writer
+// makes the sequence number odd while updating it, and the readers retry
+// until they copy it with the same even sequence number before and after.
+class StatusPageWriter {
+ public:
+  StatusPageWriter() = default;
+  ~StatusPageWriter();
+
+  // Creates or opens the page file |path| and maps it. The file is kept and
+  // reused when the daemon restarts, so the running readers keep seeing the
+  // updates. Returns whether it succeeded.
+  bool Init(const std::string& path);
+
+  // Publishes |status| in the page, if initialized. The strings longer than
+  // the page fields are truncated.
+  void Publish(const update_engine::UpdateEngineStatus& status);
+
+ private:
+  StatusPageData* data_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(StatusPageWriter);
+};
+
+// Reads the status published by a StatusPageWriter, without any IPC. It only
+// needs read access to the page file.
+class StatusPageReader {
+ public:
+  StatusPageReader() = default;
+  ~StatusPageReader();
+
+  // Maps the page file |path| read-only. Returns whether it succeeded.
+  bool Init(const std::string& path);
+
+  // Copies the last published status to |status|, except the current
+  // versions which aren't published. Returns false if not initialized,
+  // nothing was published yet, or the page kept changing while read.
+  bool Read(update_engine::UpdateEngineStatus* status) const;
+
+ private:
+  const StatusPageData* data_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(StatusPageReader);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_STATUS_PAGE_H_
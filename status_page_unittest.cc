@@ -0,0 +1,116 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/status_page.h"
+
+#include <sys/stat.h>
+
+#include <string>
+
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+using std::string;
+using update_engine::UpdateEngineStatus;
+using update_engine::UpdateStatus;
+
+namespace chromeos_update_engine {
+
+class StatusPageTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    // The writer creates the missing directories.
+    path_ = temp_dir_.GetPath().Append("run/status_page").value();
+  }
+
+  base::ScopedTempDir temp_dir_;
+  string path_;
+};
+
+TEST_F(StatusPageTest, PublishAndReadTest) {
+  StatusPageReader reader;
+  EXPECT_FALSE(reader.Init(path_));
+
+  StatusPageWriter writer;
+  ASSERT_TRUE(writer.Init(path_));
+  ASSERT_TRUE(reader.Init(path_));
+  UpdateEngineStatus status;
+  // Nothing was published yet.
+  EXPECT_FALSE(reader.Read(&status));
+
+  UpdateEngineStatus published;
+  published.last_checked_time = 1234;
+  published.status = UpdateStatus::DOWNLOADING;
+  published.progress = 0.25;
+  published.new_size_bytes = 5678;
+  published.new_version = "10575.0.0";
+  published.new_system_version = string(200, 'x');
+  writer.Publish(published);
+  ASSERT_TRUE(reader.Read(&status));
+  EXPECT_EQ(1234, status.last_checked_time);
+  EXPECT_EQ(UpdateStatus::DOWNLOADING, status.status);
+  EXPECT_EQ(0.25, status.progress);
+  EXPECT_EQ(5678U, status.new_size_bytes);
+  EXPECT_EQ("10575.0.0", status.new_version);
+  // The long strings are truncated.
+  EXPECT_EQ(string(127, 'x'), status.new_system_version);
+
+  // The reader sees the next updates without mapping the page again.
+  published.progress = 0.5;
+  writer.Publish(published);
+  ASSERT_TRUE(reader.Read(&status));
+  EXPECT_EQ(0.5, status.progress);
+}
+
+TEST_F(StatusPageTest, OtherUsersCanReadThePageTest) {
+  StatusPageWriter writer;
+  ASSERT_TRUE(writer.Init(path_));
+
+  struct stat stbuf;
+  ASSERT_EQ(0, stat(temp_dir_.GetPath().Append("run").value().c_str(), &stbuf));
+  EXPECT_EQ(0755U, stbuf.st_mode & 0777);
+  ASSERT_EQ(0, stat(path_.c_str(), &stbuf));
+  EXPECT_EQ(0644U, stbuf.st_mode & 0777);
+}
+
+TEST_F(StatusPageTest, RestartedWriterKeepsThePageTest) {
+  StatusPageReader reader;
+  UpdateEngineStatus published;
+  published.last_checked_time = 1;
+  published.status = UpdateStatus::IDLE;
+  published.progress = 0;
+  published.new_size_bytes = 0;
+  {
+    StatusPageWriter writer;
+    ASSERT_TRUE(writer.Init(path_));
+    writer.Publish(published);
+    ASSERT_TRUE(reader.Init(path_));
+  }
+
+  // The last status is kept until the new writer publishes its own.
+  UpdateEngineStatus status;
+  StatusPageWriter writer;
+  ASSERT_TRUE(writer.Init(path_));
+  ASSERT_TRUE(reader.Read(&status));
+  EXPECT_EQ(1, status.last_checked_time);
+  published.status = UpdateStatus::UPDATED_NEED_REBOOT;
+  writer.Publish(published);
+  ASSERT_TRUE(reader.Read(&status));
+  EXPECT_EQ(UpdateStatus::UPDATED_NEED_REBOOT, status.status);
+}
+
+}  // namespace chromeos_update_engine
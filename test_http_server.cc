@@ -60,6 +60,10 @@ namespace chromeos_update_engine {
 
 static const char* kListeningMsgPrefix = "listening on port ";
 
+// The size of the writes of full payload lines, so big responses don't need a
+// write() per line.
+static const size_t kPayloadWriteSize = 64 * 1024;
+
 enum {
   RC_OK = 0,
   RC_BAD_ARGS,
@@ -252,7 +256,16 @@ size_t WritePayload(int fd, const off_t start_offset, const off_t end_offset,
       remaining_len -= partial.length();
   }
 
-  // Output full lines up to the maximal line boundary below the end offset.
+  // Output full lines up to the maximal line boundary below the end offset,
+  // as many of them as fit in a single write first.
+  string lines;
+  for (i = 0; i + line_len <= kPayloadWriteSize; i += line_len)
+    lines += line;
+  while (success && !lines.empty() && remaining_len >= lines.size()) {
+    ssize_t ret = WriteString(fd, lines);
+    if ((success = (ret >= 0 && (size_t) ret == lines.size())))
+      remaining_len -= lines.size();
+  }
   while (success && remaining_len >= line_len) {
     ssize_t ret = WriteString(fd, line);
     if ((success = (ret >= 0 && (size_t) ret == line_len)))
@@ -43,6 +43,7 @@
 #include "update_engine/common/clock_interface.h"
 #include "update_engine/common/constants.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/idle_memory.h"
 #include "update_engine/common/platform_constants.h"
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/subprocess.h"
@@ -55,6 +56,7 @@
 #include "update_engine/p2p_manager.h"
 #include "update_engine/payload_consumer/download_action.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
+#include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
 #include "update_engine/payload_state_interface.h"
 #include "update_engine/power_manager_interface.h"
@@ -77,6 +79,7 @@ using std::shared_ptr;
 using std::string;
 using std::vector;
 using update_engine::UpdateAttemptFlags;
+using update_engine::UpdateEnginePerformance;
 using update_engine::UpdateEngineStatus;
 
 namespace chromeos_update_engine {
@@ -90,6 +93,19 @@ const int kMaxConsecutiveObeyProxyRequests = 20;
 const double kBroadcastThresholdProgress = 0.01;  // 1%
 const int kBroadcastThresholdSeconds = 10;
 
+// How often the DownloadAction reports the bytes received, instead of for
+// every chunk, so the payload state and the progress aren't updated for every
+// few KiB downloaded.
+const int kProgressSampleIntervalMs = 250;
+
+// The throughput is measured over periods of at least this many seconds, and
+// is reported as zero when no bytes are received for twice as long.
+const int kThroughputSamplePeriodSeconds = 5;
+
+// The payloads after the current one downloaded at once into their p2p files
+// while it is applied.
+const size_t kPayloadCacheConnections = 2;
+
 // By default autest bypasses scattering. If we want to test scattering,
 // use kScheduledAUTestURLRequest. The URL used is same in both cases, but
 // different params are passed to CheckForUpdate().
@@ -140,6 +156,8 @@ void UpdateAttempter::Init() {
   // which requires them all to be constructed prior to it being used.
   prefs_ = system_state_->prefs();
   omaha_request_params_ = system_state_->request_params();
+  resource_scheduler_.reset(
+      new ResourceScheduler(system_state_->hardware(), &cpu_limiter_, nullptr));
 
   if (cert_checker_)
     cert_checker_->SetObserver(this);
@@ -150,6 +168,13 @@ void UpdateAttempter::Init() {
     status_ = UpdateStatus::UPDATED_NEED_REBOOT;
   else
     status_ = UpdateStatus::IDLE;
+
+  // The readers of the status page get the status before its first change.
+  if (status_page_) {
+    UpdateEngineStatus status;
+    GetStatus(&status);
+    status_page_->Publish(status);
+  }
 }
 
 void UpdateAttempter::ScheduleUpdates() {
@@ -167,6 +192,42 @@ void UpdateAttempter::ScheduleUpdates() {
   waiting_for_scheduled_check_ = true;
 }
 
+void UpdateAttempter::ScheduleDownloadRateLimitChange() {
+  if (waiting_for_download_rate_limit_)
+    return;
+
+  chromeos_update_manager::UpdateManager* const update_manager =
+      system_state_->update_manager();
+  CHECK(update_manager);
+  Callback<void(EvalStatus, const int64_t&)> callback = Bind(
+      &UpdateAttempter::OnDownloadRateLimitChange, base::Unretained(this));
+  int64_t rate_limit = bandwidth_limiter_.rate();
+  update_manager->AsyncPolicyRequest(
+      callback, &Policy::UpdateDownloadRateLimit, rate_limit);
+  waiting_for_download_rate_limit_ = true;
+}
+
+void UpdateAttempter::OnDownloadRateLimitChange(EvalStatus status,
+                                                const int64_t& rate_limit) {
+  waiting_for_download_rate_limit_ = false;
+
+  if (status == EvalStatus::kSucceeded) {
+    if (static_cast<uint64_t>(rate_limit) == bandwidth_limiter_.rate()) {
+      LOG(INFO) << "Download rate limit did not change, which means that it "
+                   "is permanent; not scheduling further checks.";
+      waiting_for_download_rate_limit_ = true;
+      return;
+    }
+    // The fetchers using the limiter follow the new rate right away.
+    bandwidth_limiter_.SetRate(rate_limit);
+  } else {
+    LOG(WARNING) << "Download rate limit tracking failed (possibly timed out); "
+                    "retrying.";
+  }
+
+  ScheduleDownloadRateLimitChange();
+}
+
 void UpdateAttempter::CertificateChecked(ServerToCheck server_to_check,
                                          CertificateCheckResult result) {
   system_state_->metrics_reporter()->ReportCertificateCheckMetrics(
@@ -283,13 +344,14 @@ void UpdateAttempter::Update(const string& app_version,
 
   BuildUpdateActions(interactive);
 
-  SetStatusAndNotify(UpdateStatus::CHECKING_FOR_UPDATE);
-
   // Update the last check time here; it may be re-updated when an Omaha
   // response is received, but this will prevent us from repeatedly scheduling
-  // checks in the case where a response is not received.
+  // checks in the case where a response is not received. It is updated before
+  // the status is broadcast so its observers see the new time.
   UpdateLastCheckedTime();
 
+  SetStatusAndNotify(UpdateStatus::CHECKING_FOR_UPDATE);
+
   // Just in case we didn't update boot flags yet, make sure they're updated
   // before any update processing starts.
   start_action_processor_ = true;
@@ -572,6 +634,7 @@ void UpdateAttempter::BuildPostInstallActions(
       new PostinstallRunnerAction(system_state_->boot_control(),
                                   system_state_->hardware()));
   postinstall_runner_action->set_delegate(this);
+  postinstall_runner_action->set_resource_scheduler(resource_scheduler_.get());
   actions_.push_back(shared_ptr<AbstractAction>(postinstall_runner_action));
   BondActions(previous_action,
               postinstall_runner_action.get());
@@ -608,6 +671,8 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
   download_fetcher->set_server_to_check(ServerToCheck::kDownload);
   if (interactive)
     download_fetcher->set_max_retry_count(kDownloadMaxRetryCountInteractive);
+  download_fetcher->set_bandwidth_limiter(&bandwidth_limiter_);
+  ScheduleDownloadRateLimitChange();
   shared_ptr<DownloadAction> download_action(
       new DownloadAction(prefs_,
                          system_state_->boot_control(),
@@ -632,15 +697,39 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
                              false));
 
   download_action->set_delegate(this);
+  download_action->set_progress_interval(
+      TimeDelta::FromMilliseconds(kProgressSampleIntervalMs));
+  download_action->set_partition_write_observer(
+      filesystem_verifier_action.get());
+  download_action->set_public_key_cache(&public_key_cache_);
+  LibcurlHttpFetcher* prefetch_fetcher =
+      new LibcurlHttpFetcher(GetProxyResolver(), system_state_->hardware());
+  prefetch_fetcher->set_server_to_check(ServerToCheck::kDownload);
+  prefetch_fetcher->set_bandwidth_limiter(&bandwidth_limiter_);
+  metadata_prefetcher_.reset(new MetadataPrefetcher(prefetch_fetcher));
+  download_action->set_metadata_prefetcher(metadata_prefetcher_.get());
+  for (size_t i = 0; i < kPayloadCacheConnections; i++) {
+    LibcurlHttpFetcher* cache_fetcher =
+        new LibcurlHttpFetcher(GetProxyResolver(), system_state_->hardware());
+    cache_fetcher->set_server_to_check(ServerToCheck::kDownload);
+    cache_fetcher->set_bandwidth_limiter(&bandwidth_limiter_);
+    download_action->AddPayloadCacheFetcher(cache_fetcher);  // passes ownership
+  }
   response_handler_action_ = response_handler_action;
   download_action_ = download_action;
+  throughput_sample_time_ = Time();
+  download_bytes_per_second_ = 0;
+  apply_bytes_per_second_ = 0;
+  disk_write_bytes_per_second_ = 0;
+  bytes_received_ = 0;
+  bytes_total_ = 0;
 
   actions_.push_back(shared_ptr<AbstractAction>(update_check_action));
   actions_.push_back(shared_ptr<AbstractAction>(response_handler_action));
   actions_.push_back(shared_ptr<AbstractAction>(download_started_action));
   actions_.push_back(shared_ptr<AbstractAction>(download_action));
-  actions_.push_back(shared_ptr<AbstractAction>(download_finished_action));
   actions_.push_back(shared_ptr<AbstractAction>(filesystem_verifier_action));
+  actions_.push_back(shared_ptr<AbstractAction>(download_finished_action));
 
   // Bond them together. We have to use the leaf-types when calling
   // BondActions().
@@ -654,9 +743,13 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
 
   actions_.push_back(shared_ptr<AbstractAction>(update_complete_action));
 
-  // Enqueue the actions
+  // Enqueue the actions. The download finished event is sent while the
+  // target partitions are verified, since it doesn't depend on them.
   for (const shared_ptr<AbstractAction>& action : actions_) {
-    processor_->EnqueueAction(action.get());
+    if (action == download_finished_action)
+      processor_->EnqueueConcurrentAction(action.get());
+    else
+      processor_->EnqueueAction(action.get());
   }
 }
 
@@ -904,9 +997,18 @@ void UpdateAttempter::UpdateLastCheckedTime() {
 void UpdateAttempter::ProcessingDone(const ActionProcessor* processor,
                                      ErrorCode code) {
   LOG(INFO) << "Processing Done.";
+  if (processor) {
+    system_state_->metrics_reporter()->ReportActionResourceMetrics(
+        processor->action_resource_usages());
+  }
   actions_.clear();
+  if (metadata_prefetcher_)
+    metadata_prefetcher_->Cancel();
+  ScheduleIdleMemoryTrim();
 
   // Reset cpu shares back to normal.
+  if (resource_scheduler_)
+    resource_scheduler_->Stop();
   cpu_limiter_.StopLimiter();
 
   // reset the state that's only valid for a single update pass
@@ -991,12 +1093,15 @@ void UpdateAttempter::ProcessingDone(const ActionProcessor* processor,
 
 void UpdateAttempter::ProcessingStopped(const ActionProcessor* processor) {
   // Reset cpu shares back to normal.
+  if (resource_scheduler_)
+    resource_scheduler_->Stop();
   cpu_limiter_.StopLimiter();
   download_progress_ = 0.0;
   SetStatusAndNotify(UpdateStatus::IDLE);
   ScheduleUpdates();
   actions_.clear();
   error_event_.reset(nullptr);
+  ScheduleIdleMemoryTrim();
 }
 
 // Called whenever an action has finished processing, either successfully
@@ -1031,6 +1136,11 @@ void UpdateAttempter::ActionCompleted(ActionProcessor* processor,
       // Store the server-dictated poll interval, if any.
       server_dictated_poll_interval_ =
           std::max(0, omaha_request_action->GetOutputObject().poll_interval);
+      server_load_ = omaha_request_action->GetOutputObject().server_load;
+
+      // The payload hosts are connected to while the response is handled.
+      if (code == ErrorCode::kSuccess)
+        WarmUpPayloadConnections(omaha_request_action->GetOutputObject());
     }
   } else if (type == OmahaResponseHandlerAction::StaticType()) {
     // Depending on the returned error code, note that an update is available.
@@ -1050,6 +1160,17 @@ void UpdateAttempter::ActionCompleted(ActionProcessor* processor,
       for (const auto& payload : plan.payloads)
         new_payload_size_ += payload.size;
       cpu_limiter_.StartLimiter();
+      if (resource_scheduler_)
+        resource_scheduler_->Start();
+      // The first bytes of the payload are downloaded while the download
+      // started event is sent, so the download starts applying operations
+      // with the first bytes it receives.
+      if (code == ErrorCode::kSuccess && metadata_prefetcher_ &&
+          !plan.is_resume && !plan.payloads.empty()) {
+        uint64_t size = DownloadAction::GetMetadataRangeSize(plan.payloads[0]);
+        if (size)
+          metadata_prefetcher_->Start(plan.download_url, 0, size);
+      }
       SetStatusAndNotify(UpdateStatus::UPDATE_AVAILABLE);
     }
   }
@@ -1068,6 +1189,8 @@ void UpdateAttempter::ActionCompleted(ActionProcessor* processor,
   }
   // Find out which action completed (successfully).
   if (type == DownloadAction::StaticType()) {
+    system_state_->metrics_reporter()->ReportApplyMetrics(
+        static_cast<DownloadAction*>(action)->apply_stats());
     SetStatusAndNotify(UpdateStatus::FINALIZING);
   } else if (type == FilesystemVerifierAction::StaticType()) {
     // Log the system properties before the postinst and after the file system
@@ -1087,6 +1210,9 @@ void UpdateAttempter::BytesReceived(uint64_t bytes_progressed,
   // The PayloadState keeps track of how many bytes were actually downloaded
   // from a given URL for the URL skipping logic.
   system_state_->payload_state()->DownloadProgress(bytes_progressed);
+  bytes_received_ = bytes_received;
+  bytes_total_ = total;
+  UpdateThroughput(bytes_received);
 
   double progress = 0;
   if (total)
@@ -1099,17 +1225,56 @@ void UpdateAttempter::BytesReceived(uint64_t bytes_progressed,
   }
 }
 
+void UpdateAttempter::UpdateThroughput(uint64_t bytes_received) {
+  Time now = system_state_->clock()->GetMonotonicTime();
+  uint64_t applied = 0;
+  uint64_t written = 0;
+  if (download_action_) {
+    applied = download_action_->apply_stats().applied_bytes();
+    written = download_action_->apply_stats().written_bytes();
+  }
+  // A new payload restarts the count of the bytes received.
+  if (!throughput_sample_time_.is_null() &&
+      bytes_received >= throughput_sample_downloaded_) {
+    TimeDelta elapsed = now - throughput_sample_time_;
+    if (elapsed < TimeDelta::FromSeconds(kThroughputSamplePeriodSeconds))
+      return;
+    int64_t elapsed_us = elapsed.InMicroseconds();
+    download_bytes_per_second_ =
+        (bytes_received - throughput_sample_downloaded_) *
+        Time::kMicrosecondsPerSecond / elapsed_us;
+    apply_bytes_per_second_ = (applied - throughput_sample_applied_) *
+                              Time::kMicrosecondsPerSecond / elapsed_us;
+    disk_write_bytes_per_second_ = (written - throughput_sample_written_) *
+                                   Time::kMicrosecondsPerSecond / elapsed_us;
+  }
+  throughput_sample_time_ = now;
+  throughput_sample_downloaded_ = bytes_received;
+  throughput_sample_applied_ = applied;
+  throughput_sample_written_ = written;
+}
+
 void UpdateAttempter::DownloadComplete() {
   system_state_->payload_state()->DownloadComplete();
 }
 
 void UpdateAttempter::ProgressUpdate(double progress) {
+  // Publishing to the status page doesn't wake up its readers, so it isn't
+  // throttled.
+  if (status_page_) {
+    UpdateEngineStatus status;
+    GetStatus(&status);
+    status.progress = progress;
+    status_page_->Publish(status);
+  }
   // Self throttle based on progress. Also send notifications if progress is
-  // too slow.
+  // too slow, but not when it didn't change at all, which would wake up every
+  // observer for a status they already have.
   if (progress == 1.0 ||
       progress - download_progress_ >= kBroadcastThresholdProgress ||
-      TimeTicks::Now() - last_notify_time_ >=
-          TimeDelta::FromSeconds(kBroadcastThresholdSeconds)) {
+      (progress != download_progress_ &&
+       TimeTicks::Now() - last_notify_time_ >=
+           TimeDelta::FromSeconds(kBroadcastThresholdSeconds))) {
     download_progress_ = progress;
     BroadcastStatus();
   }
@@ -1176,6 +1341,42 @@ bool UpdateAttempter::GetStatus(UpdateEngineStatus* out_status) {
   return true;
 }
 
+bool UpdateAttempter::GetPerformance(
+    UpdateEnginePerformance* out_performance) {
+  *out_performance = UpdateEnginePerformance();
+  out_performance->eta_seconds = -1;
+  out_performance->current_operation_index = -1;
+  if (status_ != UpdateStatus::DOWNLOADING)
+    return true;
+
+  // The last rates are stale if the download stalled since.
+  TimeDelta since_sample =
+      system_state_->clock()->GetMonotonicTime() - throughput_sample_time_;
+  if (since_sample <
+      TimeDelta::FromSeconds(2 * kThroughputSamplePeriodSeconds)) {
+    out_performance->download_bytes_per_second = download_bytes_per_second_;
+    out_performance->apply_bytes_per_second = apply_bytes_per_second_;
+    out_performance->disk_write_bytes_per_second =
+        disk_write_bytes_per_second_;
+  }
+  if (out_performance->download_bytes_per_second > 0 &&
+      bytes_total_ >= bytes_received_) {
+    out_performance->eta_seconds =
+        (bytes_total_ - bytes_received_) /
+        out_performance->download_bytes_per_second;
+  }
+
+  InstallOperation::Type type;
+  size_t operation_num;
+  if (download_action_ &&
+      download_action_->apply_stats().GetCurrentOperation(&type,
+                                                          &operation_num)) {
+    out_performance->current_operation_type = InstallOperationTypeName(type);
+    out_performance->current_operation_index = operation_num;
+  }
+  return true;
+}
+
 void UpdateAttempter::UpdateBootFlags() {
   if (update_boot_flags_running_) {
     LOG(INFO) << "Update boot flags running, nothing to do.";
@@ -1213,6 +1414,8 @@ void UpdateAttempter::BroadcastStatus() {
   // Use common method for generating the current status.
   GetStatus(&broadcast_status);
 
+  if (status_page_)
+    status_page_->Publish(broadcast_status);
   for (const auto& observer : service_observers_) {
     observer->SendStatusUpdate(broadcast_status);
   }
@@ -1338,6 +1541,47 @@ void UpdateAttempter::ScheduleProcessingStart() {
            base::Unretained(processor_.get())));
 }
 
+void UpdateAttempter::WarmUpPayloadConnections(const OmahaResponse& response) {
+  PayloadStateInterface* payload_state = system_state_->payload_state();
+  if (!response.update_exists || payload_state->GetUsingP2PForDownloading())
+    return;
+  // The payload state ranked the URLs allowed, but only exposes the first
+  // one. The other hosts tried are the HTTPS ones, always allowed.
+  vector<string> urls = {payload_state->GetCurrentUrl()};
+  for (const auto& package : response.packages) {
+    for (const string& url : package.payload_urls) {
+      if (base::StartsWith(
+              url, "https://", base::CompareCase::INSENSITIVE_ASCII)) {
+        urls.push_back(url);
+      }
+    }
+  }
+  if (!connection_warmer_) {
+    connection_warmer_.reset(
+        new ConnectionWarmer(GetProxyResolver(), system_state_->hardware()));
+  }
+  connection_warmer_->Start(urls);
+}
+
+void UpdateAttempter::ScheduleIdleMemoryTrim() {
+  MessageLoop::current()->PostTask(
+      FROM_HERE,
+      Bind(&UpdateAttempter::TrimIdleMemory, base::Unretained(this)));
+}
+
+void UpdateAttempter::TrimIdleMemory() {
+  if (processor_->IsRunning())
+    return;
+  // The DownloadAction keeps the DeltaPerformer with the manifest, and the
+  // HTTP fetchers with their connections.
+  download_action_.reset();
+  int64_t resident_before, resident_after;
+  if (ReleaseIdleMemory(&resident_before, &resident_after)) {
+    system_state_->metrics_reporter()->ReportIdleMemoryMetrics(
+        resident_after, resident_before - resident_after);
+  }
+}
+
 void UpdateAttempter::DisableDeltaUpdateIfNeeded() {
   int64_t delta_failures;
   if (omaha_request_params_->delta_okay() &&
@@ -1461,6 +1705,10 @@ void UpdateAttempter::UpdateEngineStarted() {
   }
 
   system_state_->payload_state()->UpdateEngineStarted();
+}
+
+void UpdateAttempter::PerformStartupHousekeeping() {
+  UpdateBootFlags();
   StartP2PAtStartup();
 }
 
@@ -35,13 +35,19 @@
 #include "update_engine/certificate_checker.h"
 #include "update_engine/client_library/include/update_engine/update_status.h"
 #include "update_engine/common/action_processor.h"
+#include "update_engine/common/bandwidth_limiter.h"
 #include "update_engine/common/cpu_limiter.h"
+#include "update_engine/common/resource_scheduler.h"
+#include "update_engine/connection_warmer.h"
 #include "update_engine/omaha_request_params.h"
 #include "update_engine/omaha_response_handler_action.h"
 #include "update_engine/payload_consumer/download_action.h"
+#include "update_engine/payload_consumer/metadata_prefetcher.h"
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
+#include "update_engine/payload_consumer/public_key_cache.h"
 #include "update_engine/proxy_resolver.h"
 #include "update_engine/service_observer_interface.h"
+#include "update_engine/status_page.h"
 #include "update_engine/system_state.h"
 #include "update_engine/update_manager/policy.h"
 #include "update_engine/update_manager/update_manager.h"
@@ -107,6 +113,11 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // Returns the current status in the out param. Returns true on success.
   virtual bool GetStatus(update_engine::UpdateEngineStatus* out_status);
 
+  // Returns the current throughput and position of the update in progress in
+  // the out param. Returns true on success.
+  virtual bool GetPerformance(
+      update_engine::UpdateEnginePerformance* out_performance);
+
   // Runs chromeos-setgoodkernel, whose responsibility it is to mark the
   // currently booted partition has high priority/permanent/etc. The execution
   // is asynchronous. On completion, the action processor may be started
@@ -184,6 +195,11 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // Called at update_engine startup to do various house-keeping.
   void UpdateEngineStarted();
 
+  // Called once, a while after update_engine startup, to do the house-keeping
+  // that can wait for the boot to be done: marking the booted slot as good
+  // and starting p2p to clean up the files it shares.
+  void PerformStartupHousekeeping();
+
   // Reloads the device policy from libbrillo. Note: This method doesn't
   // cause a real-time policy fetch from the policy server. It just reloads the
   // latest value that libbrillo has cached. libbrillo fetches the policies
@@ -210,6 +226,10 @@ class UpdateAttempter : public ActionProcessorDelegate,
     return server_dictated_poll_interval_;
   }
 
+  // Returns the load, in percent, reported by Omaha in the last response;
+  // zero if none.
+  virtual unsigned int server_load() const { return server_load_; }
+
   // Sets a callback to be used when either a forced update request is received
   // (first argument set to true) or cleared by an update attempt (first
   // argument set to false). The callback further encodes whether the forced
@@ -244,6 +264,13 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // Remove all the observers.
   void ClearObservers() { service_observers_.clear(); }
 
+  // Sets the page where the status is published on every change, including
+  // the progress changes too small to be broadcast. The |status_page| is not
+  // owned and must outlive this attempter.
+  void set_status_page(StatusPageWriter* status_page) {
+    status_page_ = status_page;
+  }
+
  private:
   // Update server URL for automated lab test.
   static const char* const kTestUpdateUrl;
@@ -261,11 +288,13 @@ class UpdateAttempter : public ActionProcessorDelegate,
   FRIEND_TEST(UpdateAttempterTest, CreatePendingErrorEventResumedTest);
   FRIEND_TEST(UpdateAttempterTest, DisableDeltaUpdateIfNeededTest);
   FRIEND_TEST(UpdateAttempterTest, DownloadProgressAccumulationTest);
+  FRIEND_TEST(UpdateAttempterTest, GetPerformanceTest);
   FRIEND_TEST(UpdateAttempterTest, MarkDeltaUpdateFailureTest);
   FRIEND_TEST(UpdateAttempterTest, PingOmahaTest);
   FRIEND_TEST(UpdateAttempterTest, ReportDailyMetrics);
   FRIEND_TEST(UpdateAttempterTest, ScheduleErrorEventActionNoEventTest);
   FRIEND_TEST(UpdateAttempterTest, ScheduleErrorEventActionTest);
+  FRIEND_TEST(UpdateAttempterTest, SlowProgressBroadcastTest);
   FRIEND_TEST(UpdateAttempterTest, TargetVersionPrefixSetAndReset);
   FRIEND_TEST(UpdateAttempterTest, UpdateAttemptFlagsCachedAtUpdateStart);
   FRIEND_TEST(UpdateAttempterTest, UpdateDeferredByPolicyTest);
@@ -303,6 +332,18 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // scheduled asynchronously to unblock the event loop.
   void ScheduleProcessingStart();
 
+  // Starts connecting to the hosts the payloads of |response| are likely
+  // downloaded from, see ConnectionWarmer.
+  void WarmUpPayloadConnections(const OmahaResponse& response);
+
+  // Schedules an event loop callback to TrimIdleMemory(), once the actions of
+  // the finished update attempt are destroyed.
+  void ScheduleIdleMemoryTrim();
+
+  // Releases the memory kept from the last update attempt, unless another one
+  // started, and reports the idle resident memory.
+  void TrimIdleMemory();
+
   // Checks if a full update is needed and forces it by updating the Omaha
   // request params.
   void DisableDeltaUpdateIfNeeded();
@@ -393,6 +434,20 @@ class UpdateAttempter : public ActionProcessorDelegate,
       chromeos_update_manager::EvalStatus status,
       const chromeos_update_manager::UpdateCheckParams& params);
 
+  // Starts following the download rate limit set by the policy, unless
+  // already doing so.
+  void ScheduleDownloadRateLimitChange();
+
+  // Callback for the async UpdateDownloadRateLimit policy request. Applies the
+  // new limit to the downloads in progress and the next ones.
+  void OnDownloadRateLimitChange(chromeos_update_manager::EvalStatus status,
+                                 const int64_t& rate_limit);
+
+  // Samples the bytes downloaded, applied and written, updating the
+  // throughput reported by GetPerformance() once enough time has passed since
+  // the previous sample.
+  void UpdateThroughput(uint64_t bytes_received);
+
   // Updates the time an update was last attempted to the current time.
   void UpdateLastCheckedTime();
 
@@ -417,12 +472,23 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // The list of services observing changes in the updater.
   std::set<ServiceObserverInterface*> service_observers_;
 
+  // The page the status is published to, not owned. May be null.
+  StatusPageWriter* status_page_{nullptr};
+
   // Pointer to the OmahaResponseHandlerAction in the actions_ vector.
   std::shared_ptr<OmahaResponseHandlerAction> response_handler_action_;
 
   // Pointer to the DownloadAction in the actions_ vector.
   std::shared_ptr<DownloadAction> download_action_;
 
+  // Downloads the first bytes of the payload for the |download_action_| once
+  // the Omaha response is handled.
+  std::unique_ptr<MetadataPrefetcher> metadata_prefetcher_;
+
+  // Connects to the payload hosts once the update check completes, created
+  // when first needed.
+  std::unique_ptr<ConnectionWarmer> connection_warmer_;
+
   // Pointer to the preferences store interface. This is just a cached
   // copy of system_state->prefs() because it's used in many methods and
   // is convenient this way.
@@ -440,6 +506,10 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // CPU limiter during the update.
   CPULimiter cpu_limiter_;
 
+  // Raises the cpu shares of the update and the priority of the postinstall
+  // processes while the device is idle. Created in Init().
+  std::unique_ptr<ResourceScheduler> resource_scheduler_;
+
   // For status:
   UpdateStatus status_{UpdateStatus::IDLE};
   double download_progress_ = 0.0;
@@ -448,6 +518,17 @@ class UpdateAttempter : public ActionProcessorDelegate,
   std::string new_version_ = "0.0.0.0";
   std::string new_system_version_;
   uint64_t new_payload_size_ = 0;
+  // The last throughput sample, on the monotonic clock, and the rates (bytes
+  // per second) computed at that time.
+  base::Time throughput_sample_time_;
+  uint64_t throughput_sample_downloaded_ = 0;
+  uint64_t throughput_sample_applied_ = 0;
+  uint64_t throughput_sample_written_ = 0;
+  int64_t download_bytes_per_second_ = 0;
+  int64_t apply_bytes_per_second_ = 0;
+  int64_t disk_write_bytes_per_second_ = 0;
+  uint64_t bytes_received_ = 0;
+  uint64_t bytes_total_ = 0;
   // Flags influencing all periodic update checks
   UpdateAttemptFlags update_attempt_flags_ = UpdateAttemptFlags::kNone;
   // Flags influencing the currently in-progress check (cached at the start of
@@ -498,9 +579,21 @@ class UpdateAttempter : public ActionProcessorDelegate,
   // otherwise. This is needed for calculating the update check interval.
   unsigned int server_dictated_poll_interval_ = 0;
 
+  // The load (in percent) reported by Omaha in the last response, if any; zero
+  // otherwise. This is used to spread the next update checks.
+  unsigned int server_load_ = 0;
+
   // Tracks whether we have scheduled update checks.
   bool waiting_for_scheduled_check_ = false;
 
+  // Limits the rate of the payload downloads, following the policy from the
+  // first download on.
+  BandwidthLimiter bandwidth_limiter_;
+  bool waiting_for_download_rate_limit_ = false;
+
+  // The public keys the payloads are verified with, parsed once.
+  PublicKeyCache public_key_cache_;
+
   // A callback to use when a forced update request is either received (true) or
   // cleared by an update attempt (false). The second argument indicates whether
   // this is an interactive update, and its value is significant iff the first
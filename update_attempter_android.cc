@@ -25,6 +25,7 @@
 #include <base/bind.h>
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
+#include <base/sys_info.h>
 #include <brillo/bind_lambda.h>
 #include <brillo/data_encoding.h>
 #include <brillo/message_loops/message_loop.h>
@@ -35,6 +36,7 @@
 #include "update_engine/common/constants.h"
 #include "update_engine/common/error_code_utils.h"
 #include "update_engine/common/file_fetcher.h"
+#include "update_engine/common/idle_memory.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/daemon_state_interface.h"
 #include "update_engine/metrics_reporter_interface.h"
@@ -73,6 +75,22 @@ namespace {
 const double kBroadcastThresholdProgress = 0.01;  // 1%
 const int kBroadcastThresholdSeconds = 10;
 
+// How often the DownloadAction reports the bytes received, instead of for
+// every chunk, so the prefs of the bytes downloaded and the progress aren't
+// updated for every few KiB downloaded.
+const int kProgressSampleIntervalMs = 250;
+
+// The number of download connections used in performance mode, if more than
+// the ones requested for the update.
+const uint32_t kPerformanceDownloadConnections = 4;
+
+// The maximum number of download connections requested for the update, each
+// one being another HTTP fetcher.
+const uint32_t kMaxDownloadConnections = 8;
+
+// The directory with the capacity of each core, to place the update threads.
+const char kSysfsCpuDir[] = "/sys/devices/system/cpu";
+
 const char* const kErrorDomain = "update_engine";
 // TODO(deymo): Convert the different errors to a numeric value to report them
 // back on the service error.
@@ -107,10 +125,16 @@ UpdateAttempterAndroid::UpdateAttempterAndroid(
       boot_control_(boot_control),
       hardware_(hardware),
       processor_(new ActionProcessor()),
-      clock_(new Clock()) {
+      clock_(new Clock()),
+      resource_scheduler_(hardware, nullptr, &io_limiter_) {
   metrics_reporter_ = metrics::CreateMetricsReporter();
   network_selector_ = network::CreateNetworkSelector();
   set_cpuset_policy(0, SP_BACKGROUND);
+  CoreTopology core_topology;
+  if (ReadCoreTopology(base::FilePath(kSysfsCpuDir), &core_topology))
+    io_limiter_.SetCoreTopology(core_topology);
+  // The verifier reads and the non-pipelined operations run on this thread.
+  io_limiter_.RegisterCurrentThread();
 }
 
 UpdateAttempterAndroid::~UpdateAttempterAndroid() {
@@ -214,6 +238,68 @@ bool UpdateAttempterAndroid::ApplyPayload(
   install_plan_.switch_slot_on_reboot =
       GetHeaderAsBool(headers[kPayloadPropertySwitchSlotOnReboot], true);
 
+  install_plan_.pipelined_apply =
+      GetHeaderAsBool(headers[kPayloadPropertyPipelinedApply], false);
+  install_plan_.apply_threads = 1;
+  if (!headers[kPayloadPropertyApplyThreads].empty()) {
+    unsigned apply_threads;
+    if (!base::StringToUint(headers[kPayloadPropertyApplyThreads],
+                            &apply_threads) ||
+        apply_threads == 0) {
+      LOG(WARNING) << "Ignoring invalid " << kPayloadPropertyApplyThreads
+                   << " value: " << headers[kPayloadPropertyApplyThreads];
+    } else {
+      // Each thread opens the partitions again, so there are no more of them
+      // than the cores that can run them.
+      const unsigned max_apply_threads =
+          std::max(base::SysInfo::NumberOfProcessors(), 1);
+      if (apply_threads > max_apply_threads) {
+        LOG(WARNING) << "Limiting " << kPayloadPropertyApplyThreads << " from "
+                     << apply_threads << " to the " << max_apply_threads
+                     << " processors.";
+        apply_threads = max_apply_threads;
+      }
+      install_plan_.apply_threads = apply_threads;
+    }
+  }
+  install_plan_.async_writes =
+      GetHeaderAsBool(headers[kPayloadPropertyAsyncWrites], false);
+  install_plan_.direct_io =
+      GetHeaderAsBool(headers[kPayloadPropertyDirectIo], false);
+  install_plan_.verify_source_once =
+      GetHeaderAsBool(headers[kPayloadPropertyVerifySourceOnce], false);
+  install_plan_.mmap_source =
+      GetHeaderAsBool(headers[kPayloadPropertyMmapSource], false);
+  install_plan_.trace_apply =
+      GetHeaderAsBool(headers[kPayloadPropertyTraceApply], false);
+  install_plan_.trace_io =
+      GetHeaderAsBool(headers[kPayloadPropertyTraceIo], false);
+  install_plan_.clone_source_copy =
+      GetHeaderAsBool(headers[kPayloadPropertyCloneSourceCopy], false);
+  install_plan_.verify_written_hash =
+      GetHeaderAsBool(headers[kPayloadPropertyVerifyWrittenHash], false);
+  install_plan_.write_verity =
+      GetHeaderAsBool(headers[kPayloadPropertyWriteVerity], false);
+  install_plan_.download_connections = 1;
+  if (!headers[kPayloadPropertyDownloadConnections].empty()) {
+    unsigned download_connections;
+    if (!base::StringToUint(headers[kPayloadPropertyDownloadConnections],
+                            &download_connections) ||
+        download_connections == 0) {
+      LOG(WARNING) << "Ignoring invalid " << kPayloadPropertyDownloadConnections
+                   << " value: "
+                   << headers[kPayloadPropertyDownloadConnections];
+    } else {
+      if (download_connections > kMaxDownloadConnections) {
+        LOG(WARNING) << "Limiting " << kPayloadPropertyDownloadConnections
+                     << " from " << download_connections << " to "
+                     << kMaxDownloadConnections << ".";
+        download_connections = kMaxDownloadConnections;
+      }
+      install_plan_.download_connections = download_connections;
+    }
+  }
+
   install_plan_.run_post_install = true;
   // Optionally skip post install if and only if:
   // a) we're resuming
@@ -245,6 +331,11 @@ bool UpdateAttempterAndroid::ApplyPayload(
     }
   }
 
+  // Apply the payload with fewer threads while the device is in use.
+  resource_scheduler_.Start();
+  install_plan_.apply_threads =
+      resource_scheduler_.LimitApplyThreads(install_plan_.apply_threads);
+
   LOG(INFO) << "Using this install plan:";
   install_plan_.Dump();
 
@@ -378,8 +469,10 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
         "Failed to read metadata and signature from " + metadata_filename);
   }
   fd->Close();
+  std::shared_ptr<const PublicKey> public_key =
+      public_key_cache_.GetKeyFromFile(constants::kUpdatePayloadPublicKeyPath);
   errorcode = payload_metadata.ValidateMetadataSignature(
-      metadata, "", base::FilePath(constants::kUpdatePayloadPublicKeyPath));
+      metadata, "", public_key.get());
   if (errorcode != ErrorCode::kSuccess) {
     return LogAndSetError(error,
                           FROM_HERE,
@@ -390,6 +483,15 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
   if (!payload_metadata.GetManifest(metadata, &manifest)) {
     return LogAndSetError(error, FROM_HERE, "Failed to parse manifest.");
   }
+  const int64_t physical_memory = base::SysInfo::AmountOfPhysicalMemory();
+  if (manifest.max_apply_memory() > static_cast<uint64_t>(physical_memory)) {
+    return LogAndSetError(
+        error,
+        FROM_HERE,
+        "Payload needs " + std::to_string(manifest.max_apply_memory()) +
+            " bytes of memory to apply an operation, more than the " +
+            std::to_string(physical_memory) + " bytes of the device.");
+  }
 
   BootControlInterface::Slot current_slot = boot_control_->GetCurrentSlot();
   for (const PartitionUpdate& partition : manifest.partitions()) {
@@ -436,6 +538,7 @@ bool UpdateAttempterAndroid::SetPerformanceMode(bool enable,
     return true;
   if (set_cpuset_policy(0, enable ? SP_FOREGROUND : SP_BACKGROUND) < 0)
     return LogAndSetError(error, FROM_HERE, "Could not change policy");
+  resource_scheduler_.SetPerformanceMode(enable);
   performance_mode_ = enable;
   return true;
 }
@@ -443,6 +546,10 @@ bool UpdateAttempterAndroid::SetPerformanceMode(bool enable,
 void UpdateAttempterAndroid::ProcessingDone(const ActionProcessor* processor,
                                             ErrorCode code) {
   LOG(INFO) << "Processing Done.";
+  if (processor) {
+    metrics_reporter_->ReportActionResourceMetrics(
+        processor->action_resource_usages());
+  }
 
   switch (code) {
     case ErrorCode::kSuccess:
@@ -501,6 +608,8 @@ void UpdateAttempterAndroid::ActionCompleted(ActionProcessor* processor,
     return;
   }
   if (type == DownloadAction::StaticType()) {
+    metrics_reporter_->ReportApplyMetrics(
+        static_cast<DownloadAction*>(action)->apply_stats());
     SetStatusAndNotify(UpdateStatus::FINALIZING);
   }
 }
@@ -541,11 +650,13 @@ void UpdateAttempterAndroid::DownloadComplete() {
 
 void UpdateAttempterAndroid::ProgressUpdate(double progress) {
   // Self throttle based on progress. Also send notifications if progress is
-  // too slow.
+  // too slow, but not when it didn't change at all, which would wake up every
+  // observer for a status they already have.
   if (progress == 1.0 ||
       progress - download_progress_ >= kBroadcastThresholdProgress ||
-      TimeTicks::Now() - last_notify_time_ >=
-          TimeDelta::FromSeconds(kBroadcastThresholdSeconds)) {
+      (progress != download_progress_ &&
+       TimeTicks::Now() - last_notify_time_ >=
+           TimeDelta::FromSeconds(kBroadcastThresholdSeconds))) {
     download_progress_ = progress;
     SetStatusAndNotify(status_);
   }
@@ -554,10 +665,13 @@ void UpdateAttempterAndroid::ProgressUpdate(double progress) {
 void UpdateAttempterAndroid::UpdateBootFlags() {
   if (updated_boot_flags_) {
     LOG(INFO) << "Already updated boot flags. Skipping.";
-    CompleteUpdateBootFlags(true);
+    ScheduleProcessingStart();
     return;
   }
-  // This is purely best effort.
+  // This is purely best effort. The boot control implementations on Android
+  // apply the slot flag changes in the order requested, so the new slot is
+  // only marked as unbootable once the booted one is marked as good and the
+  // update doesn't need to wait for the slow HAL call.
   LOG(INFO) << "Marking booted slot as good.";
   if (!boot_control_->MarkBootSuccessfulAsync(
           Bind(&UpdateAttempterAndroid::CompleteUpdateBootFlags,
@@ -565,11 +679,11 @@ void UpdateAttempterAndroid::UpdateBootFlags() {
     LOG(ERROR) << "Failed to mark current boot as successful.";
     CompleteUpdateBootFlags(false);
   }
+  ScheduleProcessingStart();
 }
 
 void UpdateAttempterAndroid::CompleteUpdateBootFlags(bool successful) {
   updated_boot_flags_ = true;
-  ScheduleProcessingStart();
 }
 
 void UpdateAttempterAndroid::ScheduleProcessingStart() {
@@ -580,6 +694,25 @@ void UpdateAttempterAndroid::ScheduleProcessingStart() {
            base::Unretained(processor_.get())));
 }
 
+void UpdateAttempterAndroid::ScheduleIdleMemoryTrim() {
+  brillo::MessageLoop::current()->PostTask(
+      FROM_HERE,
+      Bind(&UpdateAttempterAndroid::TrimIdleMemory, base::Unretained(this)));
+}
+
+void UpdateAttempterAndroid::TrimIdleMemory() {
+  if (ongoing_update_)
+    return;
+  // The DownloadAction keeps the DeltaPerformer with the manifest, and the
+  // HTTP fetchers with their connections.
+  download_action_.reset();
+  int64_t resident_before, resident_after;
+  if (ReleaseIdleMemory(&resident_before, &resident_after)) {
+    metrics_reporter_->ReportIdleMemoryMetrics(
+        resident_after, resident_before - resident_after);
+  }
+}
+
 void UpdateAttempterAndroid::TerminateUpdateAndNotify(ErrorCode error_code) {
   if (status_ == UpdateStatus::IDLE) {
     LOG(ERROR) << "No ongoing update, but TerminatedUpdate() called.";
@@ -588,6 +721,8 @@ void UpdateAttempterAndroid::TerminateUpdateAndNotify(ErrorCode error_code) {
 
   download_progress_ = 0;
   actions_.clear();
+  ScheduleIdleMemoryTrim();
+  resource_scheduler_.Stop();
   UpdateStatus new_status =
       (error_code == ErrorCode::kSuccess ? UpdateStatus::UPDATED_NEED_REBOOT
                                          : UpdateStatus::IDLE);
@@ -662,9 +797,33 @@ void UpdateAttempterAndroid::BuildUpdateActions(const string& url) {
       new PostinstallRunnerAction(boot_control_, hardware_));
 
   download_action->set_delegate(this);
+  download_action->set_progress_interval(
+      TimeDelta::FromMilliseconds(kProgressSampleIntervalMs));
   download_action->set_base_offset(base_offset_);
+#ifndef _UE_SIDELOAD
+  if (!FileFetcher::SupportedUrl(url)) {
+    // The connections over |download_connections| are only used in
+    // performance mode.
+    download_action->set_background_connections(
+        install_plan_.download_connections);
+    const uint32_t num_connections = std::max(
+        install_plan_.download_connections, kPerformanceDownloadConnections);
+    for (uint32_t i = 1; i < num_connections; i++) {
+      LibcurlHttpFetcher* libcurl_fetcher =
+          new LibcurlHttpFetcher(&proxy_resolver_, hardware_);
+      libcurl_fetcher->set_server_to_check(ServerToCheck::kDownload);
+      download_action->AddDownloadConnection(libcurl_fetcher);
+    }
+  }
+#endif  // _UE_SIDELOAD
+  download_action->set_io_limiter(&io_limiter_);
+  filesystem_verifier_action->set_io_limiter(&io_limiter_);
+  download_action->set_partition_write_observer(
+      filesystem_verifier_action.get());
+  download_action->set_public_key_cache(&public_key_cache_);
   download_action_ = download_action;
   postinstall_runner_action->set_delegate(this);
+  postinstall_runner_action->set_resource_scheduler(&resource_scheduler_);
 
   actions_.push_back(shared_ptr<AbstractAction>(install_plan_action));
   actions_.push_back(shared_ptr<AbstractAction>(download_action));
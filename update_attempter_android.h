@@ -30,6 +30,8 @@
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/clock.h"
 #include "update_engine/common/hardware_interface.h"
+#include "update_engine/common/io_limiter.h"
+#include "update_engine/common/resource_scheduler.h"
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/daemon_state_interface.h"
 #include "update_engine/metrics_reporter_interface.h"
@@ -37,6 +39,7 @@
 #include "update_engine/network_selector_interface.h"
 #include "update_engine/payload_consumer/download_action.h"
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
+#include "update_engine/payload_consumer/public_key_cache.h"
 #include "update_engine/service_delegate_android_interface.h"
 #include "update_engine/service_observer_interface.h"
 
@@ -94,9 +97,8 @@ class UpdateAttempterAndroid
  private:
   friend class UpdateAttempterAndroidTest;
 
-  // Asynchronously marks the current slot as successful if needed. If already
-  // marked as good, CompleteUpdateBootFlags() is called starting the action
-  // processor.
+  // Asynchronously marks the current slot as successful if needed and starts
+  // the action processor without waiting for it.
   void UpdateBootFlags();
 
   // Called when the boot flags have been updated.
@@ -106,6 +108,14 @@ class UpdateAttempterAndroid
   // scheduled asynchronously to unblock the event loop.
   void ScheduleProcessingStart();
 
+  // Schedules an event loop callback to TrimIdleMemory(), once the actions of
+  // the finished update attempt are destroyed.
+  void ScheduleIdleMemoryTrim();
+
+  // Releases the memory kept from the last update attempt, unless another one
+  // started, and reports the idle resident memory.
+  void TrimIdleMemory();
+
   // Notifies an update request completed with the given error |code| to all
   // observers.
   void TerminateUpdateAndNotify(ErrorCode error_code);
@@ -211,6 +221,16 @@ class UpdateAttempterAndroid
 
   bool performance_mode_ = false;
 
+  // Limits the I/O of the update while not in performance mode.
+  IOLimiter io_limiter_;
+
+  // The public keys the payloads are verified with, parsed once.
+  PublicKeyCache public_key_cache_;
+
+  // Adapts the I/O limiter and the postinstall priority to the device
+  // activity during the update.
+  ResourceScheduler resource_scheduler_;
+
   DISALLOW_COPY_AND_ASSIGN(UpdateAttempterAndroid);
 };
 
@@ -21,6 +21,7 @@
 
 #include <android-base/properties.h>
 #include <base/time/time.h>
+#include <brillo/message_loops/fake_message_loop.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/fake_boot_control.h"
@@ -45,6 +46,7 @@ class UpdateAttempterAndroidTest : public ::testing::Test {
   UpdateAttempterAndroidTest() = default;
 
   void SetUp() override {
+    loop_.SetAsCurrent();
     clock_ = new FakeClock();
     metrics_reporter_ = new testing::NiceMock<MockMetricsReporter>();
     update_attempter_android_.metrics_reporter_.reset(metrics_reporter_);
@@ -53,10 +55,18 @@ class UpdateAttempterAndroidTest : public ::testing::Test {
         new testing::NiceMock<MockActionProcessor>());
   }
 
+  void TearDown() override {
+    // Runs the idle memory trim scheduled by the finished attempts.
+    while (loop_.RunOnce(false)) {
+    }
+  }
+
   void SetUpdateStatus(update_engine::UpdateStatus status) {
     update_attempter_android_.status_ = status;
   }
 
+  brillo::FakeMessageLoop loop_{nullptr};
+
   UpdateAttempterAndroid update_attempter_android_{
       &daemon_state_, &prefs_, &boot_control_, &hardware_};
 
@@ -206,4 +216,15 @@ TEST_F(UpdateAttempterAndroidTest, ReportMetricsForBytesDownloaded) {
       0, metrics_utils::GetPersistedValue(kPrefsTotalBytesDownloaded, &prefs_));
 }
 
+TEST_F(UpdateAttempterAndroidTest, TrimIdleMemoryOnUpdateTerminated) {
+  EXPECT_CALL(*metrics_reporter_, ReportIdleMemoryMetrics(_, _)).Times(0);
+
+  SetUpdateStatus(UpdateStatus::UPDATE_AVAILABLE);
+  update_attempter_android_.ProcessingDone(nullptr, ErrorCode::kError);
+  // The memory is released once the processor returned.
+  testing::Mock::VerifyAndClearExpectations(metrics_reporter_);
+  EXPECT_CALL(*metrics_reporter_, ReportIdleMemoryMetrics(_, _)).Times(1);
+  EXPECT_TRUE(loop_.RunOnce(false));
+}
+
 }  // namespace chromeos_update_engine
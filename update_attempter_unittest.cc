@@ -21,6 +21,7 @@
 #include <memory>
 
 #include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
 #include <base/message_loop/message_loop.h>
 #include <brillo/message_loops/base_message_loop.h>
 #include <brillo/message_loops/message_loop.h>
@@ -50,6 +51,7 @@
 
 using base::Time;
 using base::TimeDelta;
+using base::TimeTicks;
 using chromeos_update_manager::EvalStatus;
 using chromeos_update_manager::UpdateCheckParams;
 using std::string;
@@ -66,6 +68,7 @@ using testing::ReturnPointee;
 using testing::SaveArg;
 using testing::SetArgPointee;
 using update_engine::UpdateAttemptFlags;
+using update_engine::UpdateEnginePerformance;
 using update_engine::UpdateEngineStatus;
 using update_engine::UpdateStatus;
 
@@ -206,6 +209,9 @@ TEST_F(UpdateAttempterTest, ActionCompletedDownloadTest) {
                         fetcher.release(),
                         false /* is_interactive */);
   EXPECT_CALL(*prefs_, GetInt64(kPrefsDeltaUpdateFailures, _)).Times(0);
+  EXPECT_CALL(*fake_system_state_.mock_metrics_reporter(),
+              ReportApplyMetrics(_))
+      .Times(1);
   attempter_.ActionCompleted(nullptr, &action, ErrorCode::kSuccess);
   EXPECT_EQ(UpdateStatus::FINALIZING, attempter_.status());
   EXPECT_EQ(0.0, attempter_.download_progress_);
@@ -302,6 +308,90 @@ TEST_F(UpdateAttempterTest, BroadcastCompleteDownloadTest) {
   EXPECT_EQ(1.0, attempter_.download_progress_);
 }
 
+TEST_F(UpdateAttempterTest, SlowProgressBroadcastTest) {
+  attempter_.status_ = UpdateStatus::DOWNLOADING;
+  attempter_.download_progress_ = 0.5;
+  // The last broadcast was more than |kBroadcastThresholdSeconds| ago.
+  attempter_.last_notify_time_ = TimeTicks();
+  NiceMock<MockServiceObserver> observer;
+  EXPECT_CALL(observer,
+              SendStatusUpdate(Field(&UpdateEngineStatus::progress, 0.501)));
+  attempter_.AddObserver(&observer);
+  // An unchanged progress isn't broadcast again.
+  attempter_.ProgressUpdate(0.5);
+  attempter_.ProgressUpdate(0.501);
+  EXPECT_EQ(0.501, attempter_.download_progress_);
+}
+
+TEST_F(UpdateAttempterTest, StatusPageGetsEveryProgressTest) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  const string path = temp_dir.GetPath().Append("status_page").value();
+  StatusPageWriter status_page;
+  ASSERT_TRUE(status_page.Init(path));
+  StatusPageReader reader;
+  ASSERT_TRUE(reader.Init(path));
+  attempter_.set_status_page(&status_page);
+
+  attempter_.status_ = UpdateStatus::DOWNLOADING;
+  attempter_.download_progress_ = 0.5;
+  attempter_.last_notify_time_ = TimeTicks::Now();
+  NiceMock<MockServiceObserver> observer;
+  EXPECT_CALL(observer, SendStatusUpdate(_)).Times(0);
+  attempter_.AddObserver(&observer);
+  // The small change isn't broadcast, but is published.
+  attempter_.ProgressUpdate(0.501);
+  UpdateEngineStatus status;
+  ASSERT_TRUE(reader.Read(&status));
+  EXPECT_EQ(0.501, status.progress);
+  EXPECT_EQ(UpdateStatus::DOWNLOADING, status.status);
+  EXPECT_EQ(0.5, attempter_.download_progress_);
+  attempter_.set_status_page(nullptr);
+}
+
+TEST_F(UpdateAttempterTest, GetPerformanceTest) {
+  FakeClock* fake_clock = fake_system_state_.fake_clock();
+  fake_clock->SetMonotonicTime(Time::FromInternalValue(1000000));
+  uint64_t bytes_total = 10 * 1024 * 1024;
+  attempter_.status_ = UpdateStatus::DOWNLOADING;
+  attempter_.BytesReceived(1024, 1024, bytes_total);
+
+  // No throughput is known until a full sample period passed.
+  UpdateEnginePerformance performance;
+  EXPECT_TRUE(attempter_.GetPerformance(&performance));
+  EXPECT_EQ(0, performance.download_bytes_per_second);
+  EXPECT_EQ(-1, performance.eta_seconds);
+  EXPECT_EQ("", performance.current_operation_type);
+  EXPECT_EQ(-1, performance.current_operation_index);
+
+  fake_clock->SetMonotonicTime(fake_clock->GetMonotonicTime() +
+                               TimeDelta::FromSeconds(2));
+  attempter_.BytesReceived(1024 * 1024, 1024 * 1024 + 1024, bytes_total);
+  EXPECT_TRUE(attempter_.GetPerformance(&performance));
+  EXPECT_EQ(0, performance.download_bytes_per_second);
+
+  fake_clock->SetMonotonicTime(fake_clock->GetMonotonicTime() +
+                               TimeDelta::FromSeconds(8));
+  attempter_.BytesReceived(
+      4 * 1024 * 1024 - 1024, 5 * 1024 * 1024 + 1024, bytes_total);
+  EXPECT_TRUE(attempter_.GetPerformance(&performance));
+  // 5 MiB were received in 10 seconds, and about 5 MiB are left.
+  EXPECT_EQ(512 * 1024, performance.download_bytes_per_second);
+  EXPECT_EQ(9, performance.eta_seconds);
+
+  // The throughput drops to zero when the download stalls.
+  fake_clock->SetMonotonicTime(fake_clock->GetMonotonicTime() +
+                               TimeDelta::FromSeconds(11));
+  EXPECT_TRUE(attempter_.GetPerformance(&performance));
+  EXPECT_EQ(0, performance.download_bytes_per_second);
+  EXPECT_EQ(-1, performance.eta_seconds);
+
+  // Nothing is reported once the download is over.
+  attempter_.status_ = UpdateStatus::FINALIZING;
+  EXPECT_TRUE(attempter_.GetPerformance(&performance));
+  EXPECT_EQ(0, performance.download_bytes_per_second);
+}
+
 TEST_F(UpdateAttempterTest, ActionCompletedOmahaRequestTest) {
   unique_ptr<MockHttpFetcher> fetcher(new MockHttpFetcher("", 0, nullptr));
   fetcher->FailTransfer(500);  // Sets the HTTP response code.
@@ -311,12 +401,14 @@ TEST_F(UpdateAttempterTest, ActionCompletedOmahaRequestTest) {
   BondActions(&action, &collector_action);
   OmahaResponse response;
   response.poll_interval = 234;
+  response.server_load = 60;
   action.SetOutputObject(response);
   EXPECT_CALL(*prefs_, GetInt64(kPrefsDeltaUpdateFailures, _)).Times(0);
   attempter_.ActionCompleted(nullptr, &action, ErrorCode::kSuccess);
   EXPECT_EQ(500, attempter_.http_response_code());
   EXPECT_EQ(UpdateStatus::IDLE, attempter_.status());
   EXPECT_EQ(234U, attempter_.server_dictated_poll_interval_);
+  EXPECT_EQ(60U, attempter_.server_load());
   ASSERT_TRUE(attempter_.error_event_.get() == nullptr);
 }
 
@@ -437,12 +529,16 @@ const string kUpdateActionTypes[] = {  // NOLINT(runtime/string)
   OmahaResponseHandlerAction::StaticType(),
   OmahaRequestAction::StaticType(),
   DownloadAction::StaticType(),
-  OmahaRequestAction::StaticType(),
   FilesystemVerifierAction::StaticType(),
+  OmahaRequestAction::StaticType(),
   PostinstallRunnerAction::StaticType(),
   OmahaRequestAction::StaticType()
 };
 
+// The index in kUpdateActionTypes of the download finished event, enqueued to
+// run concurrently with the FilesystemVerifierAction.
+const size_t kConcurrentUpdateActionIndex = 5;
+
 // Actions that will be built as part of a user-initiated rollback.
 const string kRollbackActionTypes[] = {  // NOLINT(runtime/string)
   InstallPlanAction::StaticType(),
@@ -465,9 +561,15 @@ void UpdateAttempterTest::UpdateTestStart() {
   {
     InSequence s;
     for (size_t i = 0; i < arraysize(kUpdateActionTypes); ++i) {
-      EXPECT_CALL(*processor_,
-                  EnqueueAction(Property(&AbstractAction::Type,
-                                         kUpdateActionTypes[i])));
+      if (i == kConcurrentUpdateActionIndex) {
+        EXPECT_CALL(*processor_,
+                    EnqueueConcurrentAction(Property(&AbstractAction::Type,
+                                                     kUpdateActionTypes[i])));
+      } else {
+        EXPECT_CALL(*processor_,
+                    EnqueueAction(Property(&AbstractAction::Type,
+                                           kUpdateActionTypes[i])));
+      }
     }
     EXPECT_CALL(*processor_, StartProcessing());
   }
@@ -660,7 +762,7 @@ TEST_F(UpdateAttempterTest, P2PNotStartedAtStartupWhenNotEnabled) {
   fake_system_state_.set_p2p_manager(&mock_p2p_manager);
   mock_p2p_manager.fake().SetP2PEnabled(false);
   EXPECT_CALL(mock_p2p_manager, EnsureP2PRunning()).Times(0);
-  attempter_.UpdateEngineStarted();
+  attempter_.PerformStartupHousekeeping();
 }
 
 TEST_F(UpdateAttempterTest, P2PNotStartedAtStartupWhenEnabledButNotSharing) {
@@ -668,7 +770,7 @@ TEST_F(UpdateAttempterTest, P2PNotStartedAtStartupWhenEnabledButNotSharing) {
   fake_system_state_.set_p2p_manager(&mock_p2p_manager);
   mock_p2p_manager.fake().SetP2PEnabled(true);
   EXPECT_CALL(mock_p2p_manager, EnsureP2PRunning()).Times(0);
-  attempter_.UpdateEngineStarted();
+  attempter_.PerformStartupHousekeeping();
 }
 
 TEST_F(UpdateAttempterTest, P2PStartedAtStartupWhenEnabledAndSharing) {
@@ -677,7 +779,7 @@ TEST_F(UpdateAttempterTest, P2PStartedAtStartupWhenEnabledAndSharing) {
   mock_p2p_manager.fake().SetP2PEnabled(true);
   mock_p2p_manager.fake().SetCountSharedFilesResult(1);
   EXPECT_CALL(mock_p2p_manager, EnsureP2PRunning());
-  attempter_.UpdateEngineStarted();
+  attempter_.PerformStartupHousekeeping();
 }
 
 TEST_F(UpdateAttempterTest, P2PNotEnabled) {
@@ -131,6 +131,7 @@
           'libcrypto',
           'xz-embedded',
           'libpuffpatch',
+          'libzstd',
         ],
         'deps': ['<@(exported_deps)'],
       },
@@ -155,24 +156,40 @@
       },
       'sources': [
         'common/action_processor.cc',
+        'common/bandwidth_limiter.cc',
+        'common/blob_pool.cc',
         'common/boot_control_stub.cc',
         'common/clock.cc',
         'common/constants.cc',
         'common/cpu_limiter.cc',
         'common/error_code_utils.cc',
+        'common/file_fetcher.cc',
         'common/hash_calculator.cc',
+        'common/hot_path_log.cc',
         'common/http_common.cc',
         'common/http_fetcher.cc',
         'common/hwid_override.cc',
+        'common/idle_memory.cc',
+        'common/io_limiter.cc',
         'common/multi_range_http_fetcher.cc',
+        'common/multipart_byteranges_parser.cc',
         'common/platform_constants_chromeos.cc',
         'common/prefs.cc',
+        'common/progress_sampler.cc',
+        'common/resource_scheduler.cc',
+        'common/resource_usage.cc',
+        'common/spawned_process.cc',
         'common/subprocess.cc',
         'common/terminator.cc',
+        'common/throughput_estimator.cc',
         'common/utils.cc',
+        'payload_consumer/aio_file_descriptor.cc',
+        'payload_consumer/apply_stats.cc',
         'payload_consumer/bzip_extent_writer.cc',
         'payload_consumer/cached_file_descriptor.cc',
+        'payload_consumer/decoder_pool.cc',
         'payload_consumer/delta_performer.cc',
+        'payload_consumer/direct_file_descriptor.cc',
         'payload_consumer/download_action.cc',
         'payload_consumer/extent_reader.cc',
         'payload_consumer/extent_writer.cc',
@@ -180,13 +197,24 @@
         'payload_consumer/file_descriptor_utils.cc',
         'payload_consumer/file_writer.cc',
         'payload_consumer/filesystem_verifier_action.cc',
+        'payload_consumer/hashing_file_descriptor.cc',
         'payload_consumer/install_plan.cc',
+        'payload_consumer/io_trace.cc',
+        'payload_consumer/metadata_prefetcher.cc',
         'payload_consumer/mount_history.cc',
+        'payload_consumer/operation_pipeline.cc',
+        'payload_consumer/p2p_file_writer.cc',
+        'payload_consumer/payload_cache_downloader.cc',
         'payload_consumer/payload_constants.cc',
         'payload_consumer/payload_metadata.cc',
         'payload_consumer/payload_verifier.cc',
         'payload_consumer/postinstall_runner_action.cc',
+        'payload_consumer/public_key_cache.cc',
+        'payload_consumer/segmented_buffer.cc',
+        'payload_consumer/verity_writer.cc',
+        'payload_consumer/writeback_file_descriptor.cc',
         'payload_consumer/xz_extent_writer.cc',
+        'payload_consumer/zstd_extent_writer.cc',
       ],
       'conditions': [
         ['USE_mtd == 1', {
@@ -224,6 +252,7 @@
           'libssl',
           'libupdate_engine-client',
           'vboot_host',
+          'zlib',
         ],
         'deps': ['<@(exported_deps)'],
       },
@@ -253,6 +282,7 @@
         'common_service.cc',
         'connection_manager.cc',
         'connection_utils.cc',
+        'connection_warmer.cc',
         'daemon.cc',
         'dbus_connection.cc',
         'dbus_service.cc',
@@ -271,6 +301,7 @@
         'proxy_resolver.cc',
         'real_system_state.cc',
         'shill_proxy.cc',
+        'status_page.cc',
         'update_attempter.cc',
         'update_manager/boxed_value.cc',
         'update_manager/chromeos_policy.cc',
@@ -284,6 +315,7 @@
         'update_manager/out_of_box_experience_policy_impl.cc',
         'update_manager/policy.cc',
         'update_manager/policy_test_utils.cc',
+        'update_manager/policy_trace.cc',
         'update_manager/real_config_provider.cc',
         'update_manager/real_device_policy_provider.cc',
         'update_manager/real_random_provider.cc',
@@ -292,7 +324,10 @@
         'update_manager/real_time_provider.cc',
         'update_manager/real_updater_provider.cc',
         'update_manager/state_factory.cc',
+        'update_manager/timer_wheel.cc',
         'update_manager/update_manager.cc',
+        'update_manager/variable.cc',
+        'update_manager/variable_snapshot.cc',
         'update_status_utils.cc',
       ],
       'conditions': [
@@ -332,6 +367,7 @@
       'sources': [
         'client_library/client.cc',
         'client_library/client_dbus.cc',
+        'status_page.cc',
         'update_status_utils.cc',
       ],
       'include_dirs': [
@@ -364,6 +400,7 @@
         'exported_deps': [
           'ext2fs',
           'libpuffdiff',
+          'zlib',
         ],
         'deps': ['<@(exported_deps)'],
       },
@@ -387,29 +424,42 @@
       'sources': [
         'payload_generator/ab_generator.cc',
         'payload_generator/annotated_operation.cc',
+        'payload_generator/apply_time_estimator.cc',
         'payload_generator/blob_file_writer.cc',
+        'payload_generator/block_bitmap.cc',
         'payload_generator/block_mapping.cc',
         'payload_generator/bzip.cc',
+        'payload_generator/content_chunker.cc',
         'payload_generator/cycle_breaker.cc',
         'payload_generator/deflate_utils.cc',
         'payload_generator/delta_diff_generator.cc',
         'payload_generator/delta_diff_utils.cc',
+        'payload_generator/diff_cache.cc',
         'payload_generator/ext2_filesystem.cc',
         'payload_generator/extent_ranges.cc',
         'payload_generator/extent_utils.cc',
         'payload_generator/full_update_generator.cc',
+        'payload_generator/generation_profile.cc',
         'payload_generator/graph_types.cc',
         'payload_generator/graph_utils.cc',
+        'payload_generator/greedy_cycle_breaker.cc',
         'payload_generator/inplace_generator.cc',
         'payload_generator/mapfile_filesystem.cc',
+        'payload_generator/memory_budget.cc',
+        'payload_generator/numa_topology.cc',
+        'payload_generator/partition_reader.cc',
         'payload_generator/payload_file.cc',
         'payload_generator/payload_generation_config.cc',
         'payload_generator/payload_signer.cc',
+        'payload_generator/previous_payload.cc',
         'payload_generator/raw_filesystem.cc',
+        'payload_generator/source_block_index.cc',
+        'payload_generator/sparse_image.cc',
         'payload_generator/squashfs_filesystem.cc',
         'payload_generator/tarjan.cc',
         'payload_generator/topological_sort.cc',
         'payload_generator/xz_chromeos.cc',
+        'payload_generator/zstd.cc',
       ],
     },
     # server-side delta generator.
@@ -476,6 +526,54 @@
             'test_subprocess.cc',
           ],
         },
+        # Benchmark of the payload apply throughput per operation type.
+        {
+          'target_name': 'update_engine_benchmarks',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+            'libpayload_generator',
+          ],
+          'sources': [
+            'payload_consumer/delta_performer_benchmark.cc',
+          ],
+        },
+        # Benchmark of the extent writers, readers and write cache.
+        {
+          'target_name': 'extent_io_benchmarks',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+            'libpayload_generator',
+          ],
+          'sources': [
+            'payload_consumer/extent_io_benchmark.cc',
+            'payload_consumer/fake_file_descriptor.cc',
+          ],
+        },
+        # Replay of the I/O traces recorded while applying an update.
+        {
+          'target_name': 'io_trace_replay',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+          ],
+          'sources': [
+            'payload_consumer/io_trace_replay.cc',
+          ],
+        },
+        # Benchmark of the delta generation scaling with the thread count.
+        {
+          'target_name': 'delta_generator_benchmarks',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+            'libpayload_generator',
+          ],
+          'sources': [
+            'payload_generator/delta_generator_benchmark.cc',
+          ],
+        },
         # Main unittest file.
         {
           'target_name': 'update_engine_unittests',
@@ -501,20 +599,31 @@
             'common/action_pipe_unittest.cc',
             'common/action_processor_unittest.cc',
             'common/action_unittest.cc',
+            'common/bandwidth_limiter_unittest.cc',
+            'common/blob_pool_unittest.cc',
             'common/cpu_limiter_unittest.cc',
             'common/fake_prefs.cc',
-            'common/file_fetcher.cc',  # Only required for tests.
             'common/hash_calculator_unittest.cc',
+            'common/hot_path_log_unittest.cc',
             'common/http_fetcher_unittest.cc',
             'common/hwid_override_unittest.cc',
+            'common/idle_memory_unittest.cc',
+            'common/io_limiter_unittest.cc',
             'common/mock_http_fetcher.cc',
+            'common/multipart_byteranges_parser_unittest.cc',
             'common/prefs_unittest.cc',
+            'common/progress_sampler_unittest.cc',
+            'common/resource_scheduler_unittest.cc',
+            'common/resource_usage_unittest.cc',
+            'common/spawned_process_unittest.cc',
             'common/subprocess_unittest.cc',
             'common/terminator_unittest.cc',
+            'common/throughput_estimator_unittest.cc',
             'common/test_utils.cc',
             'common/utils_unittest.cc',
             'common_service_unittest.cc',
             'connection_manager_unittest.cc',
+            'connection_warmer_unittest.cc',
             'fake_shill_proxy.cc',
             'fake_system_state.cc',
             'hardware_chromeos_unittest.cc',
@@ -526,48 +635,79 @@
             'omaha_response_handler_action_unittest.cc',
             'omaha_utils_unittest.cc',
             'p2p_manager_unittest.cc',
+            'payload_consumer/aio_file_descriptor_unittest.cc',
+            'payload_consumer/apply_stats_unittest.cc',
             'payload_consumer/bzip_extent_writer_unittest.cc',
             'payload_consumer/cached_file_descriptor_unittest.cc',
+            'payload_consumer/decoder_pool_unittest.cc',
             'payload_consumer/delta_performer_integration_test.cc',
             'payload_consumer/delta_performer_unittest.cc',
+            'payload_consumer/direct_file_descriptor_unittest.cc',
             'payload_consumer/download_action_unittest.cc',
             'payload_consumer/extent_reader_unittest.cc',
+            'payload_consumer/extent_span_unittest.cc',
             'payload_consumer/extent_writer_unittest.cc',
             'payload_consumer/fake_file_descriptor.cc',
+            'payload_consumer/fake_file_descriptor_unittest.cc',
             'payload_consumer/file_descriptor_utils_unittest.cc',
             'payload_consumer/file_writer_unittest.cc',
             'payload_consumer/filesystem_verifier_action_unittest.cc',
+            'payload_consumer/hashing_file_descriptor_unittest.cc',
+            'payload_consumer/io_trace_unittest.cc',
+            'payload_consumer/metadata_prefetcher_unittest.cc',
+            'payload_consumer/operation_pipeline_unittest.cc',
+            'payload_consumer/p2p_file_writer_unittest.cc',
+            'payload_consumer/payload_cache_downloader_unittest.cc',
             'payload_consumer/postinstall_runner_action_unittest.cc',
+            'payload_consumer/public_key_cache_unittest.cc',
+            'payload_consumer/segmented_buffer_unittest.cc',
+            'payload_consumer/verity_writer_unittest.cc',
+            'payload_consumer/writeback_file_descriptor_unittest.cc',
             'payload_consumer/xz_extent_writer_unittest.cc',
+            'payload_consumer/zstd_extent_writer_unittest.cc',
             'payload_generator/ab_generator_unittest.cc',
+            'payload_generator/apply_time_estimator_unittest.cc',
             'payload_generator/blob_file_writer_unittest.cc',
+            'payload_generator/block_bitmap_unittest.cc',
             'payload_generator/block_mapping_unittest.cc',
+            'payload_generator/content_chunker_unittest.cc',
             'payload_generator/cycle_breaker_unittest.cc',
             'payload_generator/deflate_utils_unittest.cc',
             'payload_generator/delta_diff_utils_unittest.cc',
+            'payload_generator/diff_cache_unittest.cc',
             'payload_generator/ext2_filesystem_unittest.cc',
             'payload_generator/extent_ranges_unittest.cc',
             'payload_generator/extent_utils_unittest.cc',
             'payload_generator/fake_filesystem.cc',
             'payload_generator/full_update_generator_unittest.cc',
+            'payload_generator/generation_profile_unittest.cc',
             'payload_generator/graph_utils_unittest.cc',
+            'payload_generator/greedy_cycle_breaker_unittest.cc',
             'payload_generator/inplace_generator_unittest.cc',
             'payload_generator/mapfile_filesystem_unittest.cc',
+            'payload_generator/memory_budget_unittest.cc',
+            'payload_generator/numa_topology_unittest.cc',
+            'payload_generator/partition_reader_unittest.cc',
             'payload_generator/payload_file_unittest.cc',
             'payload_generator/payload_generation_config_unittest.cc',
             'payload_generator/payload_signer_unittest.cc',
+            'payload_generator/previous_payload_unittest.cc',
+            'payload_generator/source_block_index_unittest.cc',
+            'payload_generator/sparse_image_unittest.cc',
             'payload_generator/squashfs_filesystem_unittest.cc',
             'payload_generator/tarjan_unittest.cc',
             'payload_generator/topological_sort_unittest.cc',
             'payload_generator/zip_unittest.cc',
             'payload_state_unittest.cc',
             'proxy_resolver_unittest.cc',
+            'status_page_unittest.cc',
             'testrunner.cc',
             'update_attempter_unittest.cc',
             'update_manager/boxed_value_unittest.cc',
             'update_manager/chromeos_policy_unittest.cc',
             'update_manager/evaluation_context_unittest.cc',
             'update_manager/generic_variables_unittest.cc',
+            'update_manager/policy_trace_unittest.cc',
             'update_manager/prng_unittest.cc',
             'update_manager/real_device_policy_provider_unittest.cc',
             'update_manager/real_random_provider_unittest.cc',
@@ -575,12 +715,30 @@
             'update_manager/real_system_provider_unittest.cc',
             'update_manager/real_time_provider_unittest.cc',
             'update_manager/real_updater_provider_unittest.cc',
+            'update_manager/timer_wheel_unittest.cc',
             'update_manager/umtest_utils.cc',
             'update_manager/update_manager_unittest.cc',
+            'update_manager/variable_snapshot_unittest.cc',
             'update_manager/variable_unittest.cc',
           ],
         },
       ],
     }],
+    ['USE_fuzzer == 1', {
+      'targets': [
+        # Fuzzer of the payload metadata parsing.
+        {
+          'target_name': 'update_engine_payload_metadata_fuzzer',
+          'type': 'executable',
+          'dependencies': [
+            'libpayload_consumer',
+          ],
+          'includes': ['../../../platform2/common-mk/common_fuzzer.gypi'],
+          'sources': [
+            'payload_consumer/payload_metadata_fuzzer.cc',
+          ],
+        },
+      ],
+    }],
   ],
 }
@@ -87,8 +87,9 @@ class UpdateEngineClient : public brillo::Daemon {
   }
 
  private:
-  // Show the status of the update engine in stdout.
-  bool ShowStatus();
+  // Show the status of the update engine in stdout. If |from_page|, it is
+  // read from the status page published by the update engine, if any.
+  bool ShowStatus(bool from_page);
 
   // Return whether we need to reboot. 0 if reboot is needed, 1 if an error
   // occurred, 2 if no reboot is needed.
@@ -150,7 +151,7 @@ void WatchingStatusUpdateHandler::HandleStatusUpdate(
   LOG(INFO) << "  new_size: " << new_size;
 }
 
-bool UpdateEngineClient::ShowStatus() {
+bool UpdateEngineClient::ShowStatus(bool from_page) {
   int64_t last_checked_time = 0;
   double progress = 0.0;
   UpdateStatus current_op;
@@ -159,6 +160,13 @@ bool UpdateEngineClient::ShowStatus() {
 
   int retry_count = kShowStatusRetryCount;
   while (retry_count > 0) {
+    if (from_page && client_->GetStatusFromPage(&last_checked_time,
+                                                &progress,
+                                                &current_op,
+                                                &new_version,
+                                                &new_size)) {
+      break;
+    }
     if (client_->GetStatus(&last_checked_time, &progress, &current_op,
                            &new_version, &new_size)) {
       break;
@@ -282,6 +290,9 @@ int UpdateEngineClient::ProcessFlags() {
   DEFINE_bool(show_update_over_cellular, false,
               "Show the current setting for updates over cellular networks.");
   DEFINE_bool(status, false, "Print the status to stdout.");
+  DEFINE_bool(status_page, false,
+              "With --status, read the status from the shared memory page "
+              "published by update_engine, without asking it.");
   DEFINE_bool(update, false,
               "Forces an update and waits for it to complete. "
               "Implies --follow.");
@@ -294,6 +305,12 @@ int UpdateEngineClient::ProcessFlags() {
               "Show the previous OS version used before the update reboot.");
   DEFINE_bool(last_attempt_error, false, "Show the last attempt error.");
   DEFINE_bool(eol_status, false, "Show the current end-of-life status.");
+  DEFINE_bool(policy_trace, false,
+              "Show the last policy evaluations, with the time spent and the "
+              "variables read by each one.");
+  DEFINE_bool(performance, false,
+              "Show the throughput and the estimated time left of the update "
+              "in progress, and the install operation being applied.");
 
   // Boilerplate init commands.
   base::CommandLine::Init(argc_, argv_);
@@ -506,7 +523,7 @@ int UpdateEngineClient::ProcessFlags() {
 
   if (FLAGS_status) {
     LOG(INFO) << "Querying Update Engine status...";
-    if (!ShowStatus()) {
+    if (!ShowStatus(FLAGS_status_page)) {
       LOG(ERROR) << "Failed to query status";
       return 1;
     }
@@ -586,6 +603,39 @@ int UpdateEngineClient::ProcessFlags() {
     }
   }
 
+  if (FLAGS_policy_trace) {
+    string trace;
+    if (!client_->GetPolicyEvaluationTrace(&trace)) {
+      LOG(ERROR) << "Error getting the policy evaluation trace.";
+    } else {
+      printf("%s\n", trace.c_str());
+    }
+  }
+
+  if (FLAGS_performance) {
+    update_engine::UpdateEnginePerformance performance;
+    if (!client_->GetPerformance(&performance)) {
+      LOG(ERROR) << "Error getting the update performance.";
+    } else {
+      printf("DOWNLOAD_BYTES_PER_SECOND=%" PRIi64
+             "\n"
+             "APPLY_BYTES_PER_SECOND=%" PRIi64
+             "\n"
+             "DISK_WRITE_BYTES_PER_SECOND=%" PRIi64
+             "\n"
+             "ETA_SECONDS=%" PRIi64
+             "\n"
+             "CURRENT_OPERATION_TYPE=%s\n"
+             "CURRENT_OPERATION_INDEX=%" PRIi64 "\n",
+             performance.download_bytes_per_second,
+             performance.apply_bytes_per_second,
+             performance.disk_write_bytes_per_second,
+             performance.eta_seconds,
+             performance.current_operation_type.c_str(),
+             performance.current_operation_index);
+    }
+  }
+
   return 0;
 }
 
@@ -17,7 +17,6 @@
 #include "update_engine/update_manager/android_things_policy.h"
 
 #include <string>
-#include <vector>
 
 #include <base/logging.h>
 #include <base/time/time.h>
@@ -30,7 +29,6 @@
 using base::Time;
 using chromeos_update_engine::ErrorCode;
 using std::string;
-using std::vector;
 
 namespace chromeos_update_manager {
 
@@ -63,31 +61,27 @@ EvalStatus AndroidThingsPolicy::UpdateCheckAllowed(
   NextUpdateCheckTimePolicyImpl next_update_check_time_policy(
       kNextUpdateCheckPolicyConstants);
 
-  vector<Policy const*> policies_to_consult = {
+  // Now that the list of policy implementations, and the order to consult them,
+  // as been setup, do that.  If none of the policies make a definitive
+  // decisions about whether or not to check for updates, then allow the update
+  // check to happen.
+  EvalStatus status = ConsultPolicyChain(
+      &Policy::UpdateCheckAllowed,
+      [&](const auto& policy) {
+        return policy.UpdateCheckAllowed(ec, state, error, result);
+      },
       // Do not perform any updates if there are not enough slots to do
       // A/B updates
-      &enough_slots_ab_updates_policy,
+      enough_slots_ab_updates_policy,
 
       // Unofficial builds should not perform periodic update checks.
-      &only_update_official_builds_policy,
+      only_update_official_builds_policy,
 
       // Check to see if an interactive update was requested.
-      &interactive_update_policy,
+      interactive_update_policy,
 
       // Ensure that periodic update checks are timed properly.
-      &next_update_check_time_policy,
-  };
-
-  // Now that the list of policy implementations, and the order to consult them,
-  // as been setup, do that.  If none of the policies make a definitive
-  // decisions about whether or not to check for updates, then allow the update
-  // check to happen.
-  EvalStatus status = ConsultPolicies(policies_to_consult,
-                                      &Policy::UpdateCheckAllowed,
-                                      ec,
-                                      state,
-                                      error,
-                                      result);
+      next_update_check_time_policy);
   if (status != EvalStatus::kContinue) {
     return status;
   } else {
@@ -109,22 +103,18 @@ EvalStatus AndroidThingsPolicy::UpdateCanBeApplied(
   // result structure, even if it signals kContinue.
   ApiRestrictedDownloadsPolicyImpl api_restricted_downloads_policy;
 
-  vector<Policy const*> policies_to_consult = {
-      // Do not apply the update if all updates are restricted by the API.
-      &api_restricted_downloads_policy,
-  };
-
   // Now that the list of policy implementations, and the order to consult them,
   // as been setup, do that.  If none of the policies make a definitive
   // decisions about whether or not to check for updates, then allow the update
   // check to happen.
-  EvalStatus status = ConsultPolicies(policies_to_consult,
-                                      &Policy::UpdateCanBeApplied,
-                                      ec,
-                                      state,
-                                      error,
-                                      result,
-                                      install_plan);
+  EvalStatus status = ConsultPolicyChain(
+      &Policy::UpdateCanBeApplied,
+      [&](const auto& policy) {
+        return policy.UpdateCanBeApplied(
+            ec, state, error, result, install_plan);
+      },
+      // Do not apply the update if all updates are restricted by the API.
+      api_restricted_downloads_policy);
   if (EvalStatus::kContinue != status) {
     return status;
   } else {
@@ -156,6 +146,18 @@ EvalStatus AndroidThingsPolicy::UpdateDownloadAllowed(EvaluationContext* ec,
   return EvalStatus::kSucceeded;
 }
 
+// The download is never limited. Returns |result|==0 and
+// |EvalStatus::kSucceeded|
+EvalStatus AndroidThingsPolicy::UpdateDownloadRateLimit(
+    EvaluationContext* ec,
+    State* state,
+    string* error,
+    int64_t* result,
+    int64_t prev_result) const {
+  *result = 0;
+  return EvalStatus::kSucceeded;
+}
+
 // P2P is always disabled.  Returns |result|==|false| and
 // |EvalStatus::kSucceeded|
 EvalStatus AndroidThingsPolicy::P2PEnabled(EvaluationContext* ec,
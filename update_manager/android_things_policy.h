@@ -59,6 +59,14 @@ class AndroidThingsPolicy : public Policy {
                                    std::string* error,
                                    bool* result) const override;
 
+  // The download is never limited. Returns |result|==0 and
+  // |EvalStatus::kSucceeded|
+  EvalStatus UpdateDownloadRateLimit(EvaluationContext* ec,
+                                     State* state,
+                                     std::string* error,
+                                     int64_t* result,
+                                     int64_t prev_result) const override;
+
   // P2P is always disabled.  Returns |result|==|false| and
   // |EvalStatus::kSucceeded|
   EvalStatus P2PEnabled(EvaluationContext* ec,
@@ -19,7 +19,6 @@
 #include <algorithm>
 #include <set>
 #include <string>
-#include <vector>
 
 #include <base/logging.h>
 #include <base/strings/string_util.h>
@@ -47,7 +46,6 @@ using std::get;
 using std::min;
 using std::set;
 using std::string;
-using std::vector;
 
 namespace {
 
@@ -175,6 +173,17 @@ bool IsUrlUsable(const string& url, bool http_allowed) {
                            base::CompareCase::INSENSITIVE_ASCII);
 }
 
+// Returns whether the local |hour| is in the off-peak download window from
+// |start_hour| until before |end_hour|, which wraps around midnight when
+// |end_hour| is the smaller one. Invalid hours make the window empty.
+bool IsOffPeakDownloadHour(int hour, int64_t start_hour, int64_t end_hour) {
+  if (start_hour >= 24 || end_hour >= 24)
+    return false;
+  if (start_hour <= end_hour)
+    return start_hour <= hour && hour < end_hour;
+  return hour >= start_hour || hour < end_hour;
+}
+
 }  // namespace
 
 namespace chromeos_update_manager {
@@ -209,38 +218,34 @@ EvalStatus ChromeOSPolicy::UpdateCheckAllowed(
   NextUpdateCheckTimePolicyImpl next_update_check_time_policy(
       kNextUpdateCheckPolicyConstants);
 
-  vector<Policy const*> policies_to_consult = {
+  // Now that the list of policy implementations, and the order to consult them,
+  // has been setup, consult the policies. If none of the policies make a
+  // definitive decisions about whether or not to check for updates, then allow
+  // the update check to happen.
+  EvalStatus status = ConsultPolicyChain(
+      &Policy::UpdateCheckAllowed,
+      [&](const auto& policy) {
+        return policy.UpdateCheckAllowed(ec, state, error, result);
+      },
       // Do not perform any updates if there are not enough slots to do A/B
       // updates.
-      &enough_slots_ab_updates_policy,
+      enough_slots_ab_updates_policy,
 
       // Check to see if Enterprise-managed (has DevicePolicy) and/or
       // Kiosk-mode.  If so, then defer to those settings.
-      &enterprise_device_policy,
+      enterprise_device_policy,
 
       // Check to see if an interactive update was requested.
-      &interactive_update_policy,
+      interactive_update_policy,
 
       // Unofficial builds should not perform periodic update checks.
-      &only_update_official_builds_policy,
+      only_update_official_builds_policy,
 
       // If OOBE is enabled, wait until it is completed.
-      &oobe_policy,
+      oobe_policy,
 
       // Ensure that periodic update checks are timed properly.
-      &next_update_check_time_policy,
-  };
-
-  // Now that the list of policy implementations, and the order to consult them,
-  // has been setup, consult the policies. If none of the policies make a
-  // definitive decisions about whether or not to check for updates, then allow
-  // the update check to happen.
-  EvalStatus status = ConsultPolicies(policies_to_consult,
-                                      &Policy::UpdateCheckAllowed,
-                                      ec,
-                                      state,
-                                      error,
-                                      result);
+      next_update_check_time_policy);
   if (EvalStatus::kContinue != status) {
     return status;
   } else {
@@ -433,21 +438,10 @@ EvalStatus ChromeOSPolicy::UpdateDownloadAllowed(
     State* state,
     string* error,
     bool* result) const {
-  // Get the current connection type.
-  ShillProvider* const shill_provider = state->shill_provider();
-  const ConnectionType* conn_type_p = ec->GetValue(
-      shill_provider->var_conn_type());
-  POLICY_CHECK_VALUE_AND_FAIL(conn_type_p, error);
-  ConnectionType conn_type = *conn_type_p;
-
-  // If we're tethering, treat it as a cellular connection.
-  if (conn_type != ConnectionType::kCellular) {
-    const ConnectionTethering* conn_tethering_p = ec->GetValue(
-        shill_provider->var_conn_tethering());
-    POLICY_CHECK_VALUE_AND_FAIL(conn_tethering_p, error);
-    if (*conn_tethering_p == ConnectionTethering::kConfirmed)
-      conn_type = ConnectionType::kCellular;
-  }
+  ConnectionType conn_type;
+  EvalStatus status = GetConnectionType(ec, state, error, &conn_type);
+  if (status != EvalStatus::kSucceeded)
+    return status;
 
   // By default, we allow updates for all connection types, with exceptions as
   // noted below. This also determines whether a device policy can override the
@@ -504,6 +498,49 @@ EvalStatus ChromeOSPolicy::UpdateDownloadAllowed(
   return (*result ? EvalStatus::kSucceeded : EvalStatus::kAskMeAgainLater);
 }
 
+// The metered connections, cellular ones as for UpdateDownloadAllowed(), have
+// their own limit, since their bandwidth is usually scarcer or billed.
+EvalStatus ChromeOSPolicy::UpdateDownloadRateLimit(EvaluationContext* ec,
+                                                   State* state,
+                                                   string* error,
+                                                   int64_t* result,
+                                                   int64_t prev_result) const {
+  ConnectionType conn_type;
+  EvalStatus status = GetConnectionType(ec, state, error, &conn_type);
+  if (status != EvalStatus::kSucceeded)
+    return status;
+
+  UpdaterProvider* const updater_provider = state->updater_provider();
+  const int64_t* rate_limit_p = ec->GetValue(
+      conn_type == ConnectionType::kCellular
+          ? updater_provider->var_metered_download_rate_limit()
+          : updater_provider->var_download_rate_limit());
+  *result = rate_limit_p ? *rate_limit_p : 0;
+
+  // Plan the download around the off-peak window, if set: it goes on at the
+  // low peak rate until the window comes, then at full rate. The current hour
+  // is polled, so the limit is raised soon after the window starts.
+  const int64_t* peak_rate_limit_p =
+      ec->GetValue(updater_provider->var_peak_download_rate_limit());
+  if (peak_rate_limit_p && *peak_rate_limit_p > 0 &&
+      (*result == 0 || *peak_rate_limit_p < *result)) {
+    const int* curr_hour_p =
+        ec->GetValue(state->time_provider()->var_curr_hour());
+    const int64_t* start_hour_p =
+        ec->GetValue(updater_provider->var_off_peak_download_start_hour());
+    const int64_t* end_hour_p =
+        ec->GetValue(updater_provider->var_off_peak_download_end_hour());
+    if (curr_hour_p && start_hour_p && end_hour_p &&
+        !IsOffPeakDownloadHour(*curr_hour_p, *start_hour_p, *end_hour_p)) {
+      *result = *peak_rate_limit_p;
+    }
+  }
+
+  if (*result == prev_result)
+    return EvalStatus::kAskMeAgainLater;
+  return EvalStatus::kSucceeded;
+}
+
 EvalStatus ChromeOSPolicy::P2PEnabled(EvaluationContext* ec,
                                       State* state,
                                       string* error,
@@ -551,6 +588,27 @@ EvalStatus ChromeOSPolicy::P2PEnabledChanged(EvaluationContext* ec,
   return status;
 }
 
+EvalStatus ChromeOSPolicy::GetConnectionType(EvaluationContext* ec,
+                                             State* state,
+                                             string* error,
+                                             ConnectionType* result) const {
+  ShillProvider* const shill_provider = state->shill_provider();
+  const ConnectionType* conn_type_p = ec->GetValue(
+      shill_provider->var_conn_type());
+  POLICY_CHECK_VALUE_AND_FAIL(conn_type_p, error);
+  *result = *conn_type_p;
+
+  // If we're tethering, treat it as a cellular connection.
+  if (*result != ConnectionType::kCellular) {
+    const ConnectionTethering* conn_tethering_p = ec->GetValue(
+        shill_provider->var_conn_tethering());
+    POLICY_CHECK_VALUE_AND_FAIL(conn_tethering_p, error);
+    if (*conn_tethering_p == ConnectionTethering::kConfirmed)
+      *result = ConnectionType::kCellular;
+  }
+  return EvalStatus::kSucceeded;
+}
+
 EvalStatus ChromeOSPolicy::UpdateBackoffAndDownloadUrl(
     EvaluationContext* ec, State* state, string* error,
     UpdateBackoffAndDownloadUrlResult* result,
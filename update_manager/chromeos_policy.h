@@ -78,6 +78,13 @@ class ChromeOSPolicy : public Policy {
       std::string* error,
       bool* result) const override;
 
+  EvalStatus UpdateDownloadRateLimit(
+      EvaluationContext* ec,
+      State* state,
+      std::string* error,
+      int64_t* result,
+      int64_t prev_result) const override;
+
   EvalStatus P2PEnabled(
       EvaluationContext* ec,
       State* state,
@@ -125,6 +132,15 @@ class ChromeOSPolicy : public Policy {
   // Maximum period of time allowed for download a payload via P2P, in seconds.
   static const int kMaxP2PAttemptsPeriodInSeconds;
 
+  // A private policy returning in |result| the type of the current network
+  // connection, where a connection tethered to a cellular one is also
+  // cellular.
+  EvalStatus GetConnectionType(EvaluationContext* ec,
+                               State* state,
+                               std::string* error,
+                               chromeos_update_engine::ConnectionType* result)
+      const;
+
   // A private policy for determining backoff and the download URL to use.
   // Within |update_state|, |backoff_expiry| and |is_backoff_disabled| are used
   // for determining whether backoff is still in effect; if not,
@@ -1496,4 +1496,86 @@ TEST_F(UmChromeOSPolicyTest, P2PEnabledChangedBlocks) {
                      &result, false);
 }
 
+TEST_F(UmChromeOSPolicyTest, UpdateDownloadRateLimitWifi) {
+  fake_state_.shill_provider()->var_conn_type()->
+      reset(new ConnectionType(ConnectionType::kWifi));
+  fake_state_.updater_provider()->var_download_rate_limit()->
+      reset(new int64_t(100000));
+  fake_state_.updater_provider()->var_metered_download_rate_limit()->
+      reset(new int64_t(1000));
+
+  int64_t result;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadRateLimit, &result, -1);
+  EXPECT_EQ(100000, result);
+  // The same limit blocks until it changes.
+  ExpectPolicyStatus(EvalStatus::kAskMeAgainLater,
+                     &Policy::UpdateDownloadRateLimit, &result, 100000);
+}
+
+TEST_F(UmChromeOSPolicyTest, UpdateDownloadRateLimitWifiTethered) {
+  // Tethered wifi uses the metered limit.
+  fake_state_.shill_provider()->var_conn_type()->
+      reset(new ConnectionType(ConnectionType::kWifi));
+  fake_state_.shill_provider()->var_conn_tethering()->
+      reset(new ConnectionTethering(ConnectionTethering::kConfirmed));
+  fake_state_.updater_provider()->var_metered_download_rate_limit()->
+      reset(new int64_t(1000));
+
+  int64_t result;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadRateLimit, &result, 0);
+  EXPECT_EQ(1000, result);
+}
+
+TEST_F(UmChromeOSPolicyTest, UpdateDownloadRateLimitOffPeakWindow) {
+  fake_state_.shill_provider()->var_conn_type()->
+      reset(new ConnectionType(ConnectionType::kWifi));
+  fake_state_.updater_provider()->var_download_rate_limit()->
+      reset(new int64_t(100000));
+  fake_state_.updater_provider()->var_peak_download_rate_limit()->
+      reset(new int64_t(1000));
+  // The window wraps around midnight, from 22:00 until 06:00.
+  fake_state_.updater_provider()->var_off_peak_download_start_hour()->
+      reset(new int64_t(22));
+  fake_state_.updater_provider()->var_off_peak_download_end_hour()->
+      reset(new int64_t(6));
+
+  // Outside of the window, the download goes on at the peak rate.
+  fake_state_.time_provider()->var_curr_hour()->reset(new int(14));
+  int64_t result;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadRateLimit, &result, 0);
+  EXPECT_EQ(1000, result);
+
+  // In the window, it goes on at full rate.
+  fake_state_.time_provider()->var_curr_hour()->reset(new int(23));
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadRateLimit, &result, 1000);
+  EXPECT_EQ(100000, result);
+  fake_state_.time_provider()->var_curr_hour()->reset(new int(5));
+  ExpectPolicyStatus(EvalStatus::kAskMeAgainLater,
+                     &Policy::UpdateDownloadRateLimit, &result, 100000);
+  fake_state_.time_provider()->var_curr_hour()->reset(new int(6));
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadRateLimit, &result, 100000);
+  EXPECT_EQ(1000, result);
+}
+
+TEST_F(UmChromeOSPolicyTest, UpdateDownloadRateLimitPeakAboveLimit) {
+  // A peak rate above the user limit doesn't raise it.
+  fake_state_.shill_provider()->var_conn_type()->
+      reset(new ConnectionType(ConnectionType::kWifi));
+  fake_state_.updater_provider()->var_download_rate_limit()->
+      reset(new int64_t(1000));
+  fake_state_.updater_provider()->var_peak_download_rate_limit()->
+      reset(new int64_t(100000));
+  fake_state_.time_provider()->var_curr_hour()->reset(new int(14));
+
+  int64_t result;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::UpdateDownloadRateLimit, &result, 0);
+  EXPECT_EQ(1000, result);
+}
+
 }  // namespace chromeos_update_manager
@@ -94,6 +94,17 @@ EvalStatus DefaultPolicy::UpdateDownloadAllowed(
   return EvalStatus::kSucceeded;
 }
 
+EvalStatus DefaultPolicy::UpdateDownloadRateLimit(
+    EvaluationContext* ec,
+    State* state,
+    std::string* error,
+    int64_t* result,
+    int64_t prev_result) const {
+  // The download is never limited, so the decision is final.
+  *result = 0;
+  return EvalStatus::kSucceeded;
+}
+
 EvalStatus DefaultPolicy::P2PEnabled(
     EvaluationContext* ec,
     State* state,
@@ -89,6 +89,10 @@ class DefaultPolicy : public Policy {
       EvaluationContext* ec, State* state, std::string* error,
       bool* result) const override;
 
+  EvalStatus UpdateDownloadRateLimit(
+      EvaluationContext* ec, State* state, std::string* error,
+      int64_t* result, int64_t prev_result) const override;
+
   EvalStatus P2PEnabledChanged(
       EvaluationContext* ec, State* state, std::string* error,
       bool* result, bool prev_result) const override;
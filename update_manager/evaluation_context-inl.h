@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_UPDATE_MANAGER_EVALUATION_CONTEXT_INL_H_
 #define UPDATE_ENGINE_UPDATE_MANAGER_EVALUATION_CONTEXT_INL_H_
 
+#include <memory>
 #include <string>
 
 #include <base/logging.h>
@@ -31,23 +32,35 @@ const T* EvaluationContext::GetValue(Variable<T>* var) {
   }
 
   // Search for the value on the cache first.
-  ValueCacheMap::iterator it = value_cache_.find(var);
-  if (it != value_cache_.end())
-    return reinterpret_cast<const T*>(it->second.value());
+  const size_t id = var->GetId();
+  if (id < value_cache_.size() && value_cache_[id].var == var)
+    return reinterpret_cast<const T*>(value_cache_[id].value->value());
+
+  // Then reuse the value just read by another EvaluationContext, if any.
+  std::shared_ptr<const BoxedValue> value;
+  if (snapshot_)
+    value = snapshot_->Get(var);
 
   // Get the value from the variable if not found on the cache.
-  std::string errmsg;
-  const T* result = var->GetValue(RemainingTime(evaluation_monotonic_deadline_),
-                                  &errmsg);
-  if (result == nullptr) {
-    LOG(WARNING) << "Error reading Variable " << var->GetName() << ": \""
-        << errmsg << "\"";
+  if (!value) {
+    std::string errmsg;
+    const T* result = var->GetValue(
+        RemainingTime(evaluation_monotonic_deadline_), &errmsg);
+    if (result == nullptr) {
+      LOG(WARNING) << "Error reading Variable " << var->GetName() << ": \""
+          << errmsg << "\"";
+    }
+    value = std::make_shared<const BoxedValue>(result);
+    if (snapshot_)
+      snapshot_->Add(var, value);
   }
-  // Cache the value for the next time. The map of CachedValues keeps the
-  // ownership of the pointer until the map is destroyed.
-  value_cache_.emplace(
-    static_cast<BaseVariable*>(var), BoxedValue(result));
-  return result;
+  // Cache the value for the next time. The BoxedValue keeps the ownership of
+  // the pointer until every cache holding it drops it.
+  if (id >= value_cache_.size())
+    value_cache_.resize(id + 1);
+  value_cache_[id].var = var;
+  value_cache_[id].value = value;
+  return reinterpret_cast<const T*>(value->value());
 }
 
 }  // namespace chromeos_update_manager
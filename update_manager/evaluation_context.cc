@@ -20,6 +20,7 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/json/json_writer.h>
@@ -37,6 +38,7 @@ using brillo::MessageLoop;
 using chromeos_update_engine::ClockInterface;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 namespace {
 
@@ -69,8 +71,12 @@ EvaluationContext::EvaluationContext(
     ClockInterface* clock,
     TimeDelta evaluation_timeout,
     TimeDelta expiration_timeout,
-    unique_ptr<Callback<void(EvaluationContext*)>> unregister_cb)
+    unique_ptr<Callback<void(EvaluationContext*)>> unregister_cb,
+    VariableSnapshot* snapshot,
+    TimerWheel* timer_wheel)
     : clock_(clock),
+      snapshot_(snapshot),
+      timer_wheel_(timer_wheel),
       evaluation_timeout_(evaluation_timeout),
       expiration_timeout_(expiration_timeout),
       unregister_cb_(std::move(unregister_cb)),
@@ -87,11 +93,16 @@ EvaluationContext::~EvaluationContext() {
 
 unique_ptr<Closure> EvaluationContext::RemoveObserversAndTimeout() {
   for (auto& it : value_cache_) {
-    if (it.first->GetMode() == kVariableModeAsync)
-      it.first->RemoveObserver(this);
+    if (it.var && it.var->GetMode() == kVariableModeAsync)
+      it.var->RemoveObserver(this);
+  }
+  if (timeout_event_ != MessageLoop::kTaskIdNull) {
+    if (timer_wheel_)
+      timer_wheel_->CancelTask(timeout_event_);
+    else
+      MessageLoop::current()->CancelTask(timeout_event_);
+    timeout_event_ = MessageLoop::kTaskIdNull;
   }
-  MessageLoop::current()->CancelTask(timeout_event_);
-  timeout_event_ = MessageLoop::kTaskIdNull;
 
   return std::move(callback_);
 }
@@ -110,6 +121,7 @@ Time EvaluationContext::MonotonicDeadline(TimeDelta timeout) {
 
 void EvaluationContext::ValueChanged(BaseVariable* var) {
   DLOG(INFO) << "ValueChanged() called for variable " << var->GetName();
+  reevaluation_reason_ = var->GetName();
   OnValueChangedOrTimeout();
 }
 
@@ -118,6 +130,7 @@ void EvaluationContext::OnTimeout() {
              << (timeout_marks_expiration_ ? "expiration" : "poll interval");
   timeout_event_ = MessageLoop::kTaskIdNull;
   is_expired_ = timeout_marks_expiration_;
+  reevaluation_reason_ = is_expired_ ? "expiration" : "timeout";
   OnValueChangedOrTimeout();
 }
 
@@ -147,11 +160,10 @@ void EvaluationContext::ResetEvaluation() {
   evaluation_monotonic_deadline_ = MonotonicDeadline(evaluation_timeout_);
 
   // Remove the cached values of non-const variables
-  for (auto it = value_cache_.begin(); it != value_cache_.end(); ) {
-    if (it->first->GetMode() == kVariableModeConst) {
-      ++it;
-    } else {
-      it = value_cache_.erase(it);
+  for (auto& it : value_cache_) {
+    if (it.var && it.var->GetMode() != kVariableModeConst) {
+      it.var = nullptr;
+      it.value.reset();
     }
   }
 }
@@ -184,14 +196,16 @@ bool EvaluationContext::RunOnValueChangeOrTimeout(Closure callback) {
   // Handle reevaluation due to async or poll variables.
   bool waiting_for_value_change = false;
   for (auto& it : value_cache_) {
-    switch (it.first->GetMode()) {
+    if (!it.var)
+      continue;
+    switch (it.var->GetMode()) {
       case kVariableModeAsync:
-        DLOG(INFO) << "Waiting for value on " << it.first->GetName();
-        it.first->AddObserver(this);
+        DLOG(INFO) << "Waiting for value on " << it.var->GetName();
+        it.var->AddObserver(this);
         waiting_for_value_change = true;
         break;
       case kVariableModePoll:
-        timeout = std::min(timeout, it.first->GetPollInterval());
+        timeout = std::min(timeout, it.var->GetPollInterval());
         break;
       case kVariableModeConst:
         // Ignored.
@@ -217,20 +231,33 @@ bool EvaluationContext::RunOnValueChangeOrTimeout(Closure callback) {
   if (!timeout.is_max()) {
     DLOG(INFO) << "Waiting for timeout in "
                << chromeos_update_engine::utils::FormatTimeDelta(timeout);
-    timeout_event_ = MessageLoop::current()->PostDelayedTask(
-        FROM_HERE,
-        base::Bind(&EvaluationContext::OnTimeout,
-                   weak_ptr_factory_.GetWeakPtr()),
-        timeout);
+    Closure on_timeout = base::Bind(&EvaluationContext::OnTimeout,
+                                    weak_ptr_factory_.GetWeakPtr());
+    if (timer_wheel_) {
+      timeout_event_ = timer_wheel_->PostDelayedTask(on_timeout, timeout);
+    } else {
+      timeout_event_ = MessageLoop::current()->PostDelayedTask(
+          FROM_HERE, on_timeout, timeout);
+    }
   }
 
   return true;
 }
 
+vector<string> EvaluationContext::GetVariableNames() const {
+  vector<string> names;
+  for (auto& it : value_cache_) {
+    if (it.var)
+      names.push_back(it.var->GetName());
+  }
+  return names;
+}
+
 string EvaluationContext::DumpContext() const {
   auto variables = std::make_unique<base::DictionaryValue>();
   for (auto& it : value_cache_) {
-    variables->SetString(it.first->GetName(), it.second.ToString());
+    if (it.var)
+      variables->SetString(it.var->GetName(), it.value->ToString());
   }
 
   base::DictionaryValue value;
@@ -17,9 +17,10 @@
 #ifndef UPDATE_ENGINE_UPDATE_MANAGER_EVALUATION_CONTEXT_H_
 #define UPDATE_ENGINE_UPDATE_MANAGER_EVALUATION_CONTEXT_H_
 
-#include <map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/callback.h>
@@ -31,6 +32,8 @@
 #include "update_engine/common/clock_interface.h"
 #include "update_engine/update_manager/boxed_value.h"
 #include "update_engine/update_manager/variable.h"
+#include "update_engine/update_manager/timer_wheel.h"
+#include "update_engine/update_manager/variable_snapshot.h"
 
 namespace chromeos_update_manager {
 
@@ -65,11 +68,26 @@ namespace chromeos_update_manager {
 class EvaluationContext : public base::RefCounted<EvaluationContext>,
                           private BaseVariable::ObserverInterface {
  public:
+  // The values read from the variables are also looked up in and added to the
+  // |snapshot|, if not null, to share them with the other EvaluationContexts
+  // using it. The timeout of RunOnValueChangeOrTimeout() is scheduled on the
+  // |timer_wheel|, if not null, or else on the current MessageLoop. The
+  // |snapshot| and the |timer_wheel| must outlive this EvaluationContext.
   EvaluationContext(
       chromeos_update_engine::ClockInterface* clock,
       base::TimeDelta evaluation_timeout,
       base::TimeDelta expiration_timeout,
-      std::unique_ptr<base::Callback<void(EvaluationContext*)>> unregister_cb);
+      std::unique_ptr<base::Callback<void(EvaluationContext*)>> unregister_cb,
+      VariableSnapshot* snapshot,
+      TimerWheel* timer_wheel);
+  EvaluationContext(
+      chromeos_update_engine::ClockInterface* clock,
+      base::TimeDelta evaluation_timeout,
+      base::TimeDelta expiration_timeout,
+      std::unique_ptr<base::Callback<void(EvaluationContext*)>> unregister_cb)
+      : EvaluationContext(clock, evaluation_timeout, expiration_timeout,
+                          std::move(unregister_cb), nullptr,
+                          nullptr) {}
   EvaluationContext(chromeos_update_engine::ClockInterface* clock,
                     base::TimeDelta evaluation_timeout)
       : EvaluationContext(
@@ -122,6 +140,17 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   // to help with debugging and the format may change in the future.
   std::string DumpContext() const;
 
+  // Returns the names of the variables read since the last ResetEvaluation(),
+  // including the const variables read by the previous evaluations.
+  std::vector<std::string> GetVariableNames() const;
+
+  // Returns why the context was last re-evaluated: the name of the variable
+  // whose value changed, "timeout" or "expiration"; or an empty string if the
+  // RunOnValueChangeOrTimeout() callback never ran.
+  const std::string& reevaluation_reason() const {
+    return reevaluation_reason_;
+  }
+
   // Removes all the Observers callbacks and timeout events scheduled by
   // RunOnValueChangeOrTimeout(). Also releases and returns the closure
   // associated with these events. This method is idempotent.
@@ -149,11 +178,18 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   // since the current time.
   base::Time MonotonicDeadline(base::TimeDelta timeout);
 
-  // A map to hold the cached values for every variable.
-  typedef std::map<BaseVariable*, BoxedValue> ValueCacheMap;
+  // The cached value of a variable. The value can be shared with the
+  // |snapshot_|.
+  struct CachedValue {
+    // The variable read, or null if the entry is unused.
+    BaseVariable* var = nullptr;
+    std::shared_ptr<const BoxedValue> value;
+  };
 
-  // The cached values of the called Variables.
-  ValueCacheMap value_cache_;
+  // The cached values of the called Variables, indexed by the
+  // BaseVariable::GetId() of the variables. The vector is kept across the
+  // evaluations so re-evaluating doesn't allocate it again.
+  std::vector<CachedValue> value_cache_;
 
   // A callback used for triggering re-evaluation upon a value change or poll
   // timeout, or notifying about the evaluation context expiration. It is up to
@@ -173,9 +209,20 @@ class EvaluationContext : public base::RefCounted<EvaluationContext>,
   // Whether the evaluation context has indeed expired.
   bool is_expired_ = false;
 
+  // Returned by reevaluation_reason().
+  std::string reevaluation_reason_;
+
   // Pointer to the mockable clock interface;
   chromeos_update_engine::ClockInterface* const clock_;
 
+  // The snapshot of the variable values shared with other EvaluationContexts,
+  // or null.
+  VariableSnapshot* const snapshot_;
+
+  // The timer wheel scheduling |timeout_event_|, or null to use the current
+  // MessageLoop.
+  TimerWheel* const timer_wheel_;
+
   // The timestamps when the evaluation of this EvaluationContext started,
   // corresponding to ClockInterface::GetWallclockTime() and
   // ClockInterface::GetMonotonicTime(), respectively. These values are reset
@@ -67,6 +67,26 @@ class FakeUpdaterProvider : public UpdaterProvider {
     return &var_cellular_enabled_;
   }
 
+  FakeVariable<int64_t>* var_download_rate_limit() override {
+    return &var_download_rate_limit_;
+  }
+
+  FakeVariable<int64_t>* var_metered_download_rate_limit() override {
+    return &var_metered_download_rate_limit_;
+  }
+
+  FakeVariable<int64_t>* var_peak_download_rate_limit() override {
+    return &var_peak_download_rate_limit_;
+  }
+
+  FakeVariable<int64_t>* var_off_peak_download_start_hour() override {
+    return &var_off_peak_download_start_hour_;
+  }
+
+  FakeVariable<int64_t>* var_off_peak_download_end_hour() override {
+    return &var_off_peak_download_end_hour_;
+  }
+
   FakeVariable<unsigned int>* var_consecutive_failed_update_checks() override {
     return &var_consecutive_failed_update_checks_;
   }
@@ -75,6 +95,10 @@ class FakeUpdaterProvider : public UpdaterProvider {
     return &var_server_dictated_poll_interval_;
   }
 
+  FakeVariable<unsigned int>* var_server_load() override {
+    return &var_server_load_;
+  }
+
   FakeVariable<UpdateRequestStatus>* var_forced_update_requested() override {
     return &var_forced_update_requested_;
   }
@@ -100,10 +124,22 @@ class FakeUpdaterProvider : public UpdaterProvider {
   FakeVariable<bool> var_p2p_enabled_{"p2p_enabled", kVariableModeAsync};
   FakeVariable<bool> var_cellular_enabled_{"cellular_enabled",
                                            kVariableModeAsync};
+  FakeVariable<int64_t> var_download_rate_limit_{"download_rate_limit",
+                                                 kVariableModeAsync};
+  FakeVariable<int64_t> var_metered_download_rate_limit_{
+      "metered_download_rate_limit", kVariableModeAsync};
+  FakeVariable<int64_t> var_peak_download_rate_limit_{
+      "peak_download_rate_limit", kVariableModeAsync};
+  FakeVariable<int64_t> var_off_peak_download_start_hour_{
+      "off_peak_download_start_hour", kVariableModeAsync};
+  FakeVariable<int64_t> var_off_peak_download_end_hour_{
+      "off_peak_download_end_hour", kVariableModeAsync};
   FakeVariable<unsigned int> var_consecutive_failed_update_checks_{
       "consecutive_failed_update_checks", kVariableModePoll};
   FakeVariable<unsigned int> var_server_dictated_poll_interval_{
       "server_dictated_poll_interval", kVariableModePoll};
+  FakeVariable<unsigned int> var_server_load_{"server_load",
+                                              kVariableModePoll};
   FakeVariable<UpdateRequestStatus> var_forced_update_requested_{
       "forced_update_requested", kVariableModeAsync};
   FakeVariable<UpdateRestrictions> var_update_restrictions_{
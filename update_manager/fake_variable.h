@@ -41,6 +41,7 @@ class FakeVariable : public Variable<T> {
   // null.
   void reset(const T* p_value) {
     ptr_.reset(p_value);
+    this->MarkValueChanged();
   }
 
   // Make the NotifyValueChanged() public for FakeVariables.
@@ -49,6 +49,10 @@ class MockPolicy : public Policy {
                                          testing::_))
         .WillByDefault(testing::Invoke(
                 &default_policy_, &DefaultPolicy::UpdateDownloadAllowed));
+    ON_CALL(*this, UpdateDownloadRateLimit(testing::_, testing::_, testing::_,
+                                           testing::_, testing::_))
+        .WillByDefault(testing::Invoke(
+                &default_policy_, &DefaultPolicy::UpdateDownloadRateLimit));
     ON_CALL(*this, P2PEnabled(testing::_, testing::_, testing::_, testing::_))
         .WillByDefault(testing::Invoke(
                 &default_policy_, &DefaultPolicy::P2PEnabled));
@@ -81,6 +85,10 @@ class MockPolicy : public Policy {
                      EvalStatus(EvaluationContext*, State*, std::string*,
                                 bool*));
 
+  MOCK_CONST_METHOD5(UpdateDownloadRateLimit,
+                     EvalStatus(EvaluationContext*, State*, std::string*,
+                                int64_t*, int64_t));
+
   MOCK_CONST_METHOD4(P2PEnabled,
                      EvalStatus(EvaluationContext*, State*, std::string*,
                                 bool*));
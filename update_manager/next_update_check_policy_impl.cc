@@ -23,6 +23,7 @@
 using base::Time;
 using base::TimeDelta;
 using std::max;
+using std::min;
 using std::string;
 
 namespace chromeos_update_manager {
@@ -130,6 +131,20 @@ EvalStatus NextUpdateCheckTimePolicyImpl::NextUpdateCheckTime(
   if (fuzz == 0)
     fuzz = interval;
 
+  // When the server reports being loaded, such as right after a release, the
+  // interval is stretched by up to twice at full load and the checks are
+  // spread over the whole interval, so the fleet converges on a smooth check
+  // rate instead of checking together. The interactive checks are not
+  // affected, so urgent updates still get through.
+  const unsigned int* server_load =
+      ec->GetValue(updater_provider->var_server_load());
+  if (server_load && *server_load > 0) {
+    int load = min(*server_load, 100U);
+    interval = min(interval + interval * load / 100,
+                   constants.timeout_max_backoff_interval);
+    fuzz = max(fuzz, interval);
+  }
+
   *next_update_check =
       *last_checked_time + FuzzedInterval(&prng, interval, fuzz);
   return EvalStatus::kSucceeded;
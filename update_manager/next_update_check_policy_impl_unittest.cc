@@ -160,4 +160,26 @@ TEST_F(UmNextUpdateCheckTimePolicyImplTest, ExponentialBackoffIsCapped) {
             next_update_check);
 }
 
+TEST_F(UmNextUpdateCheckTimePolicyImplTest, ServerLoadSpreadsChecks) {
+  // At full load the periodic interval is doubled and the checks are spread
+  // over the whole interval.
+  Time next_update_check;
+
+  fake_state_.updater_provider()->var_server_load()->reset(
+      new unsigned int(100));  // NOLINT(readability/casting)
+
+  ExpectStatus(EvalStatus::kSucceeded,
+               &NextUpdateCheckTimePolicyImpl::NextUpdateCheckTime,
+               &next_update_check,
+               policy_test_constants);
+
+  int interval = policy_test_constants.timeout_periodic_interval * 2;
+  EXPECT_LE(fake_clock_.GetWallclockTime() +
+                TimeDelta::FromSeconds(interval - interval / 2),
+            next_update_check);
+  EXPECT_GE(fake_clock_.GetWallclockTime() +
+                TimeDelta::FromSeconds(interval + interval / 2),
+            next_update_check);
+}
+
 }  // namespace chromeos_update_manager
@@ -24,7 +24,7 @@
 namespace chromeos_update_manager {
 
 // Unofficial builds should not perform periodic update checks.
-class OnlyUpdateOfficialBuildsPolicyImpl : public PolicyImplBase {
+class OnlyUpdateOfficialBuildsPolicyImpl final : public PolicyImplBase {
  public:
   OnlyUpdateOfficialBuildsPolicyImpl() = default;
   ~OnlyUpdateOfficialBuildsPolicyImpl() override = default;
@@ -215,6 +215,9 @@ class Policy {
     if (reinterpret_cast<typeof(&Policy::UpdateDownloadAllowed)>(
             policy_method) == &Policy::UpdateDownloadAllowed)
       return class_name + "UpdateDownloadAllowed";
+    if (reinterpret_cast<typeof(&Policy::UpdateDownloadRateLimit)>(
+            policy_method) == &Policy::UpdateDownloadRateLimit)
+      return class_name + "UpdateDownloadRateLimit";
     if (reinterpret_cast<typeof(&Policy::P2PEnabled)>(
             policy_method) == &Policy::P2PEnabled)
       return class_name + "P2PEnabled";
@@ -276,6 +279,19 @@ class Policy {
       std::string* error,
       bool* result) const = 0;
 
+  // Returns in |result| the maximum rate, in bytes per second, at which the
+  // update can be downloaded over the current network connection, or zero if
+  // there's no limit. Blocks (returns |EvalStatus::kAskMeAgainLater|) until it
+  // is different from |prev_result|, so a download in progress can follow the
+  // changes of the limit. The limit can follow a schedule, such as a lower rate
+  // outside of an off-peak window so most of the download happens off-peak.
+  virtual EvalStatus UpdateDownloadRateLimit(
+      EvaluationContext* ec,
+      State* state,
+      std::string* error,
+      int64_t* result,
+      int64_t prev_result) const = 0;
+
   // Checks whether P2P is enabled. This may consult device policy and other
   // global settings.
   virtual EvalStatus P2PEnabled(
@@ -57,6 +57,8 @@ void UmPolicyTestBase::SetUpDefaultState() {
       new unsigned int(0));  // NOLINT(readability/casting)
   fake_state_.updater_provider()->var_server_dictated_poll_interval()->reset(
       new unsigned int(0));  // NOLINT(readability/casting)
+  fake_state_.updater_provider()->var_server_load()->reset(
+      new unsigned int(0));  // NOLINT(readability/casting)
   fake_state_.updater_provider()->var_forced_update_requested()->reset(
       new UpdateRequestStatus{UpdateRequestStatus::kNone});
 
@@ -0,0 +1,86 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/update_manager/policy_trace.h"
+
+#include <memory>
+#include <utility>
+
+#include <base/json/json_writer.h>
+#include <base/strings/string_util.h>
+#include <base/values.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_manager {
+
+PolicyTrace::PolicyTrace(size_t max_evaluations)
+    : max_evaluations_(max_evaluations) {}
+
+void PolicyTrace::Add(PolicyEvaluation evaluation) {
+  Totals& totals = totals_[evaluation.policy_name];
+  totals.count++;
+  totals.duration += evaluation.duration;
+
+  if (max_evaluations_ == 0)
+    return;
+  if (evaluations_.size() == max_evaluations_)
+    evaluations_.pop_front();
+  evaluations_.push_back(std::move(evaluation));
+}
+
+string PolicyTrace::ToString() const {
+  auto totals = std::make_unique<base::DictionaryValue>();
+  for (const auto& it : totals_) {
+    auto policy_totals = std::make_unique<base::DictionaryValue>();
+    policy_totals->SetInteger("count", static_cast<int>(it.second.count));
+    policy_totals->SetDouble("duration_ms",
+                             it.second.duration.InMillisecondsF());
+    totals->SetWithoutPathExpansion(it.first, std::move(policy_totals));
+  }
+
+  auto evaluations = std::make_unique<base::ListValue>();
+  for (const PolicyEvaluation& evaluation : evaluations_) {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetString("policy", evaluation.policy_name);
+    value->SetString("start", chromeos_update_engine::utils::ToString(
+                                  evaluation.start_time));
+    value->SetDouble("duration_ms", evaluation.duration.InMillisecondsF());
+    value->SetString("status",
+                     chromeos_update_manager::ToString(evaluation.status));
+    if (!evaluation.trigger.empty())
+      value->SetString("trigger", evaluation.trigger);
+    auto variables = std::make_unique<base::ListValue>();
+    for (const string& variable : evaluation.variables)
+      variables->AppendString(variable);
+    value->Set("variables", std::move(variables));
+    evaluations->Append(std::move(value));
+  }
+
+  base::DictionaryValue value;
+  value.Set("totals", std::move(totals));
+  value.Set("evaluations", std::move(evaluations));
+
+  string json_str;
+  base::JSONWriter::WriteWithOptions(
+      value, base::JSONWriter::OPTIONS_PRETTY_PRINT, &json_str);
+  base::TrimWhitespaceASCII(json_str, base::TRIM_TRAILING, &json_str);
+  return json_str;
+}
+
+}  // namespace chromeos_update_manager
@@ -0,0 +1,92 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_UPDATE_MANAGER_POLICY_TRACE_H_
+#define UPDATE_ENGINE_UPDATE_MANAGER_POLICY_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+#include "update_engine/update_manager/policy.h"
+
+namespace chromeos_update_manager {
+
+// A single evaluation of a policy method by the UpdateManager.
+struct PolicyEvaluation {
+  // The name of the policy method, as returned by Policy::PolicyRequestName().
+  std::string policy_name;
+  // The wallclock time when the evaluation started.
+  base::Time start_time;
+  // The time spent evaluating the policy, including the default policy.
+  base::TimeDelta duration;
+  EvalStatus status = EvalStatus::kFailed;
+  // Why the policy was evaluated again, as returned by
+  // EvaluationContext::reevaluation_reason(), or empty for the first
+  // evaluation of a request.
+  std::string trigger;
+  // The names of the variables read by the evaluation.
+  std::vector<std::string> variables;
+};
+
+// Keeps the last policy evaluations made by the UpdateManager and the totals of
+// all the evaluations per policy method, to find out which policies are
+// evaluated often or are slow to evaluate and why.
+class PolicyTrace {
+ public:
+  // The totals of the evaluations of a policy method.
+  struct Totals {
+    uint64_t count = 0;
+    base::TimeDelta duration;
+  };
+
+  // Keeps up to |max_evaluations| evaluations, dropping the oldest ones.
+  explicit PolicyTrace(size_t max_evaluations);
+
+  // Records the passed |evaluation|.
+  void Add(PolicyEvaluation evaluation);
+
+  // Returns the recorded evaluations, from the oldest to the newest.
+  const std::deque<PolicyEvaluation>& evaluations() const {
+    return evaluations_;
+  }
+
+  // Returns the totals of all the evaluations, including the dropped ones, by
+  // policy name.
+  const std::map<std::string, Totals>& totals() const { return totals_; }
+
+  // Returns the totals and the recorded evaluations as JSON.
+  std::string ToString() const;
+
+ private:
+  const size_t max_evaluations_;
+
+  std::deque<PolicyEvaluation> evaluations_;
+  std::map<std::string, Totals> totals_;
+
+  DISALLOW_COPY_AND_ASSIGN(PolicyTrace);
+};
+
+}  // namespace chromeos_update_manager
+
+#endif  // UPDATE_ENGINE_UPDATE_MANAGER_POLICY_TRACE_H_
@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/update_manager/policy_trace.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+using base::Time;
+using base::TimeDelta;
+using std::string;
+
+namespace chromeos_update_manager {
+
+namespace {
+
+PolicyEvaluation MakeEvaluation(const string& policy_name, int duration_ms) {
+  PolicyEvaluation evaluation;
+  evaluation.policy_name = policy_name;
+  evaluation.start_time = Time::FromTimeT(1240428300);
+  evaluation.duration = TimeDelta::FromMilliseconds(duration_ms);
+  evaluation.status = EvalStatus::kSucceeded;
+  evaluation.variables = {"var_a", "var_b"};
+  return evaluation;
+}
+
+}  // namespace
+
+TEST(UmPolicyTraceTest, OldestEvaluationsDropped) {
+  PolicyTrace trace(2);
+  trace.Add(MakeEvaluation("Policy::A", 1));
+  trace.Add(MakeEvaluation("Policy::B", 2));
+  trace.Add(MakeEvaluation("Policy::A", 4));
+
+  ASSERT_EQ(2U, trace.evaluations().size());
+  EXPECT_EQ("Policy::B", trace.evaluations()[0].policy_name);
+  EXPECT_EQ("Policy::A", trace.evaluations()[1].policy_name);
+
+  // The totals include the dropped evaluation.
+  ASSERT_EQ(2U, trace.totals().size());
+  EXPECT_EQ(2U, trace.totals().at("Policy::A").count);
+  EXPECT_EQ(TimeDelta::FromMilliseconds(5),
+            trace.totals().at("Policy::A").duration);
+  EXPECT_EQ(1U, trace.totals().at("Policy::B").count);
+}
+
+TEST(UmPolicyTraceTest, ToStringTest) {
+  PolicyTrace trace(10);
+  PolicyEvaluation evaluation = MakeEvaluation("Policy::A", 3);
+  evaluation.trigger = "var_b";
+  trace.Add(evaluation);
+
+  string json = trace.ToString();
+  EXPECT_NE(string::npos, json.find("\"policy\": \"Policy::A\""));
+  EXPECT_NE(string::npos, json.find("\"trigger\": \"var_b\""));
+  EXPECT_NE(string::npos, json.find("\"var_a\""));
+  EXPECT_NE(string::npos, json.find("\"count\": 1"));
+}
+
+}  // namespace chromeos_update_manager
@@ -18,7 +18,6 @@
 #define UPDATE_ENGINE_UPDATE_MANAGER_POLICY_UTILS_H_
 
 #include <string>
-#include <vector>
 
 #include "update_engine/update_manager/policy.h"
 
@@ -40,28 +39,40 @@
 
 namespace chromeos_update_manager {
 
-// Call the passed-in Policy method on a series of Policy implementations, until
-// one of them renders a decision by returning a value other than
-// |EvalStatus::kContinue|.
-template <typename T, typename R, typename... Args>
-EvalStatus ConsultPolicies(const std::vector<Policy const*> policies,
-                           T policy_method,
-                           EvaluationContext* ec,
-                           State* state,
-                           std::string* error,
-                           R* result,
-                           Args... args) {
-  for (auto policy : policies) {
-    EvalStatus status =
-        (policy->*policy_method)(ec, state, error, result, args...);
-    if (status != EvalStatus::kContinue) {
-      LOG(INFO) << "decision by " << policy->PolicyRequestName(policy_method);
-      return status;
-    }
-  }
+// Calls |consult| on a series of Policy implementations, in order, until one of
+// them renders a decision by returning a value other than
+// |EvalStatus::kContinue|. |consult| calls the |policy_method| of the policy it
+// is passed; the |policy_method| is only used for logging the decision. For
+// example:
+//
+//   EvalStatus status = ConsultPolicyChain(
+//       &Policy::UpdateCheckAllowed,
+//       [&](const auto& policy) {
+//         return policy.UpdateCheckAllowed(ec, state, error, result);
+//       },
+//       first_policy, second_policy);
+//
+// The chain is expanded at compile time and each policy is passed to |consult|
+// with its own type, so the calls to the final policy implementations are
+// bound statically instead of going through the Policy vtable.
+template <typename T, typename F>
+EvalStatus ConsultPolicyChain(T /* policy_method */, const F& /* consult */) {
   return EvalStatus::kContinue;
 }
 
+template <typename T, typename F, typename P, typename... Policies>
+EvalStatus ConsultPolicyChain(T policy_method,
+                              const F& consult,
+                              const P& policy,
+                              const Policies&... policies) {
+  EvalStatus status = consult(policy);
+  if (status != EvalStatus::kContinue) {
+    LOG(INFO) << "decision by " << policy.PolicyRequestName(policy_method);
+    return status;
+  }
+  return ConsultPolicyChain(policy_method, consult, policies...);
+}
+
 // Base class implementation that returns |EvalStatus::kContinue| for all
 // decisions, to be used as a base-class for various Policy facets that only
 // pertain to certain situations. This might be better folded into Policy
@@ -100,6 +111,14 @@ class PolicyImplBase : public Policy {
     return EvalStatus::kContinue;
   };
 
+  EvalStatus UpdateDownloadRateLimit(EvaluationContext* ec,
+                                     State* state,
+                                     std::string* error,
+                                     int64_t* result,
+                                     int64_t prev_result) const override {
+    return EvalStatus::kContinue;
+  };
+
   EvalStatus P2PEnabled(EvaluationContext* ec,
                         State* state,
                         std::string* error,
@@ -70,11 +70,8 @@ void RealDevicePolicyProvider::OnPropertyChangedCompletedSignal(
     LOG(WARNING) << "Received device policy updated signal with a failure.";
   }
   // We refresh the policy file even if the payload string is kSignalFailure.
-  LOG(INFO) << "Reloading and re-scheduling device policy due to signal "
-               "received.";
-  MessageLoop::current()->CancelTask(scheduled_refresh_);
-  scheduled_refresh_ = MessageLoop::kTaskIdNull;
-  RefreshDevicePolicyAndReschedule();
+  LOG(INFO) << "Reloading device policy due to signal received.";
+  RefreshDevicePolicy();
 }
 
 void RealDevicePolicyProvider::OnSignalConnected(const string& interface_name,
@@ -84,6 +81,11 @@ void RealDevicePolicyProvider::OnSignalConnected(const string& interface_name,
     LOG(WARNING) << "We couldn't connect to SessionManager signal for updates "
                     "on the device policy blob. We will reload the policy file "
                     "periodically.";
+  } else {
+    // The signal tells when the device policy changes, so there is no need to
+    // wake up to reload it periodically.
+    MessageLoop::current()->CancelTask(scheduled_refresh_);
+    scheduled_refresh_ = MessageLoop::kTaskIdNull;
   }
   // We do a one-time refresh of the DevicePolicy just in case we missed a
   // signal between the first refresh and the time the signal handler was
@@ -98,6 +98,7 @@ class RealDevicePolicyProvider : public DevicePolicyProvider {
 
  private:
   FRIEND_TEST(UmRealDevicePolicyProviderTest, RefreshScheduledTest);
+  FRIEND_TEST(UmRealDevicePolicyProviderTest, SignalConnectedStopsRefreshes);
   FRIEND_TEST(UmRealDevicePolicyProviderTest, NonExistentDevicePolicyReloaded);
   FRIEND_TEST(UmRealDevicePolicyProviderTest, ValuesUpdated);
 
@@ -111,7 +112,9 @@ class RealDevicePolicyProvider : public DevicePolicyProvider {
                          const std::string& signal_name,
                          bool successful);
 
-  // Schedules a call to periodically refresh the device policy.
+  // Schedules a call to periodically refresh the device policy, until the
+  // session manager signal telling when the device policy changes is
+  // connected.
   void RefreshDevicePolicyAndReschedule();
 
   // Reloads the device policy and updates all the exposed variables.
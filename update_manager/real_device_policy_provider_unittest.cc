@@ -163,6 +163,20 @@ TEST_F(UmRealDevicePolicyProviderTest, SessionManagerSignalForcesReload) {
   ASSERT_TRUE(property_change_complete_.IsHandlerRegistered());
   property_change_complete_.signal_callback().Run("success");
 }
+
+TEST_F(UmRealDevicePolicyProviderTest, SignalConnectedStopsRefreshes) {
+  // Checks that the policy is only reloaded from the signal once connected.
+  EXPECT_TRUE(provider_->Init());
+  EXPECT_NE(MessageLoop::kTaskIdNull, provider_->scheduled_refresh_);
+  loop_.RunOnce(false);
+  EXPECT_EQ(MessageLoop::kTaskIdNull, provider_->scheduled_refresh_);
+  EXPECT_FALSE(loop_.PendingTasks());
+
+  EXPECT_CALL(mock_policy_provider_, Reload());
+  ASSERT_TRUE(property_change_complete_.IsHandlerRegistered());
+  property_change_complete_.signal_callback().Run("success");
+  EXPECT_EQ(MessageLoop::kTaskIdNull, provider_->scheduled_refresh_);
+}
 #endif  // USE_DBUS
 
 TEST_F(UmRealDevicePolicyProviderTest, NonExistentDevicePolicyEmptyVariables) {
@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 
+#include <memory>
 #include <string>
 
 #include <base/bind.h>
@@ -29,12 +30,14 @@
 #include "update_engine/common/clock_interface.h"
 #include "update_engine/common/prefs.h"
 #include "update_engine/omaha_request_params.h"
+#include "update_engine/service_observer_interface.h"
 #include "update_engine/update_attempter.h"
 #include "update_engine/update_status_utils.h"
 
 using base::StringPrintf;
 using base::Time;
 using base::TimeDelta;
+using chromeos_update_engine::ErrorCode;
 using chromeos_update_engine::OmahaRequestParams;
 using chromeos_update_engine::SystemState;
 using std::string;
@@ -60,6 +63,46 @@ class UpdaterVariableBase : public Variable<T> {
   SystemState* const system_state_;
 };
 
+// A base class for the variables reporting the state of the UpdateAttempter.
+// Instead of being polled, they are async variables observing the status
+// broadcast by the UpdateAttempter whenever its state changes, and notify
+// their observers when their value read after a broadcast differs from the
+// previous one.
+template<typename T>
+class UpdaterAsyncVariableBase
+    : public UpdaterVariableBase<T>,
+      public chromeos_update_engine::ServiceObserverInterface {
+ public:
+  UpdaterAsyncVariableBase(const string& name, SystemState* system_state)
+      : UpdaterVariableBase<T>(name, kVariableModeAsync, system_state) {
+    system_state->update_attempter()->AddObserver(this);
+  }
+  ~UpdaterAsyncVariableBase() override {
+    this->system_state()->update_attempter()->RemoveObserver(this);
+  }
+
+  // ServiceObserverInterface overrides.
+  void SendStatusUpdate(
+      const UpdateEngineStatus& /* update_engine_status */) override {
+    std::unique_ptr<const T> value(this->GetValue(TimeDelta(), nullptr));
+    bool changed = !has_value_ ||
+                   (value == nullptr) != (last_value_ == nullptr) ||
+                   (value && !(*value == *last_value_));
+    has_value_ = true;
+    last_value_ = std::move(value);
+    if (changed)
+      this->NotifyValueChanged();
+  }
+
+  void SendPayloadApplicationComplete(ErrorCode /* error_code */) override {}
+
+ private:
+  // Whether a status was already received, and the value read after the last
+  // one, which is null if it couldn't be read.
+  bool has_value_ = false;
+  std::unique_ptr<const T> last_value_;
+};
+
 // Helper class for issuing a GetStatus() to the UpdateAttempter.
 class GetStatusHelper {
  public:
@@ -93,10 +136,10 @@ class GetStatusHelper {
 };
 
 // A variable reporting the time when a last update check was issued.
-class LastCheckedTimeVariable : public UpdaterVariableBase<Time> {
+class LastCheckedTimeVariable : public UpdaterAsyncVariableBase<Time> {
  public:
   LastCheckedTimeVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<Time>(name, kVariableModePoll, system_state) {}
+      : UpdaterAsyncVariableBase<Time>(name, system_state) {}
 
  private:
   const Time* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -112,10 +155,10 @@ class LastCheckedTimeVariable : public UpdaterVariableBase<Time> {
 
 // A variable reporting the update (download) progress as a decimal fraction
 // between 0.0 and 1.0.
-class ProgressVariable : public UpdaterVariableBase<double> {
+class ProgressVariable : public UpdaterAsyncVariableBase<double> {
  public:
   ProgressVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<double>(name, kVariableModePoll, system_state) {}
+      : UpdaterAsyncVariableBase<double>(name, system_state) {}
 
  private:
   const double* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -138,10 +181,10 @@ class ProgressVariable : public UpdaterVariableBase<double> {
 };
 
 // A variable reporting the stage in which the update process is.
-class StageVariable : public UpdaterVariableBase<Stage> {
+class StageVariable : public UpdaterAsyncVariableBase<Stage> {
  public:
   StageVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<Stage>(name, kVariableModePoll, system_state) {}
+      : UpdaterAsyncVariableBase<Stage>(name, system_state) {}
 
  private:
   struct CurrOpStrToStage {
@@ -187,10 +230,10 @@ const Stage* StageVariable::GetValue(TimeDelta /* timeout */,
 }
 
 // A variable reporting the version number that an update is updating to.
-class NewVersionVariable : public UpdaterVariableBase<string> {
+class NewVersionVariable : public UpdaterAsyncVariableBase<string> {
  public:
   NewVersionVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<string>(name, kVariableModePoll, system_state) {}
+      : UpdaterAsyncVariableBase<string>(name, system_state) {}
 
  private:
   const string* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -205,10 +248,10 @@ class NewVersionVariable : public UpdaterVariableBase<string> {
 };
 
 // A variable reporting the size of the update being processed in bytes.
-class PayloadSizeVariable : public UpdaterVariableBase<uint64_t> {
+class PayloadSizeVariable : public UpdaterAsyncVariableBase<uint64_t> {
  public:
   PayloadSizeVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<uint64_t>(name, kVariableModePoll, system_state) {}
+      : UpdaterAsyncVariableBase<uint64_t>(name, system_state) {}
 
  private:
   const uint64_t* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -229,10 +272,10 @@ class PayloadSizeVariable : public UpdaterVariableBase<uint64_t> {
 // readings should come from the time provider and be moderated by the
 // evaluation context, so that they are uniform throughout the evaluation of a
 // policy request.
-class UpdateCompletedTimeVariable : public UpdaterVariableBase<Time> {
+class UpdateCompletedTimeVariable : public UpdaterAsyncVariableBase<Time> {
  public:
   UpdateCompletedTimeVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<Time>(name, kVariableModePoll, system_state) {}
+      : UpdaterAsyncVariableBase<Time>(name, system_state) {}
 
  private:
   const Time* GetValue(TimeDelta /* timeout */, string* errmsg) override {
@@ -344,14 +387,56 @@ class BooleanPrefVariable
   DISALLOW_COPY_AND_ASSIGN(BooleanPrefVariable);
 };
 
+// A variable class for reading non-negative integer prefs values. A negative
+// value is replaced by the default one.
+class Int64PrefVariable
+    : public AsyncCopyVariable<int64_t>,
+      public chromeos_update_engine::PrefsInterface::ObserverInterface {
+ public:
+  Int64PrefVariable(const string& name,
+                    chromeos_update_engine::PrefsInterface* prefs,
+                    const char* key,
+                    int64_t default_val)
+      : AsyncCopyVariable<int64_t>(name),
+        prefs_(prefs),
+        key_(key),
+        default_val_(default_val) {
+    prefs->AddObserver(key, this);
+    OnPrefSet(key);
+  }
+  ~Int64PrefVariable() {
+    prefs_->RemoveObserver(key_, this);
+  }
+
+ private:
+  void OnPrefSet(const string& key) override {
+    int64_t result = default_val_;
+    if (prefs_ && prefs_->Exists(key_) &&
+        (!prefs_->GetInt64(key_, &result) || result < 0)) {
+      result = default_val_;
+    }
+    SetValue(result);
+  }
+
+  void OnPrefDeleted(const string& key) override {
+    SetValue(default_val_);
+  }
+
+  chromeos_update_engine::PrefsInterface* prefs_;
+
+  const char* const key_;
+  const int64_t default_val_;
+
+  DISALLOW_COPY_AND_ASSIGN(Int64PrefVariable);
+};
+
 // A variable returning the number of consecutive failed update checks.
 class ConsecutiveFailedUpdateChecksVariable
-    : public UpdaterVariableBase<unsigned int> {
+    : public UpdaterAsyncVariableBase<unsigned int> {
  public:
   ConsecutiveFailedUpdateChecksVariable(const string& name,
                                         SystemState* system_state)
-      : UpdaterVariableBase<unsigned int>(name, kVariableModePoll,
-                                          system_state) {}
+      : UpdaterAsyncVariableBase<unsigned int>(name, system_state) {}
 
  private:
   const unsigned int* GetValue(TimeDelta /* timeout */,
@@ -365,12 +450,11 @@ class ConsecutiveFailedUpdateChecksVariable
 
 // A variable returning the server-dictated poll interval.
 class ServerDictatedPollIntervalVariable
-    : public UpdaterVariableBase<unsigned int> {
+    : public UpdaterAsyncVariableBase<unsigned int> {
  public:
   ServerDictatedPollIntervalVariable(const string& name,
                                      SystemState* system_state)
-      : UpdaterVariableBase<unsigned int>(name, kVariableModePoll,
-                                          system_state) {}
+      : UpdaterAsyncVariableBase<unsigned int>(name, system_state) {}
 
  private:
   const unsigned int* GetValue(TimeDelta /* timeout */,
@@ -382,6 +466,21 @@ class ServerDictatedPollIntervalVariable
   DISALLOW_COPY_AND_ASSIGN(ServerDictatedPollIntervalVariable);
 };
 
+// A variable returning the load reported by the server.
+class ServerLoadVariable : public UpdaterAsyncVariableBase<unsigned int> {
+ public:
+  ServerLoadVariable(const string& name, SystemState* system_state)
+      : UpdaterAsyncVariableBase<unsigned int>(name, system_state) {}
+
+ private:
+  const unsigned int* GetValue(TimeDelta /* timeout */,
+                               string* /* errmsg */) override {
+    return new unsigned int(system_state()->update_attempter()->server_load());
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(ServerLoadVariable);
+};
+
 // An async variable that tracks changes to forced update requests.
 class ForcedUpdateRequestedVariable
     : public UpdaterVariableBase<UpdateRequestStatus> {
@@ -419,11 +518,10 @@ class ForcedUpdateRequestedVariable
 
 // A variable returning the current update restrictions that are in effect.
 class UpdateRestrictionsVariable
-    : public UpdaterVariableBase<UpdateRestrictions> {
+    : public UpdaterAsyncVariableBase<UpdateRestrictions> {
  public:
   UpdateRestrictionsVariable(const string& name, SystemState* system_state)
-      : UpdaterVariableBase<UpdateRestrictions>(
-            name, kVariableModePoll, system_state) {}
+      : UpdaterAsyncVariableBase<UpdateRestrictions>(name, system_state) {}
 
  private:
   const UpdateRestrictions* GetValue(TimeDelta /* timeout */,
@@ -470,11 +568,37 @@ RealUpdaterProvider::RealUpdaterProvider(SystemState* system_state)
           system_state_->prefs(),
           chromeos_update_engine::kPrefsUpdateOverCellularPermission,
           false)),
+      var_download_rate_limit_(new Int64PrefVariable(
+          "download_rate_limit",
+          system_state_->prefs(),
+          chromeos_update_engine::kPrefsDownloadRateLimit,
+          0)),
+      var_metered_download_rate_limit_(new Int64PrefVariable(
+          "metered_download_rate_limit",
+          system_state_->prefs(),
+          chromeos_update_engine::kPrefsMeteredDownloadRateLimit,
+          0)),
+      var_peak_download_rate_limit_(new Int64PrefVariable(
+          "peak_download_rate_limit",
+          system_state_->prefs(),
+          chromeos_update_engine::kPrefsPeakDownloadRateLimit,
+          0)),
+      var_off_peak_download_start_hour_(new Int64PrefVariable(
+          "off_peak_download_start_hour",
+          system_state_->prefs(),
+          chromeos_update_engine::kPrefsOffPeakDownloadStartHour,
+          0)),
+      var_off_peak_download_end_hour_(new Int64PrefVariable(
+          "off_peak_download_end_hour",
+          system_state_->prefs(),
+          chromeos_update_engine::kPrefsOffPeakDownloadEndHour,
+          0)),
       var_consecutive_failed_update_checks_(
           new ConsecutiveFailedUpdateChecksVariable(
               "consecutive_failed_update_checks", system_state_)),
       var_server_dictated_poll_interval_(new ServerDictatedPollIntervalVariable(
           "server_dictated_poll_interval", system_state_)),
+      var_server_load_(new ServerLoadVariable("server_load", system_state_)),
       var_forced_update_requested_(new ForcedUpdateRequestedVariable(
           "forced_update_requested", system_state_)),
       var_update_restrictions_(new UpdateRestrictionsVariable(
@@ -84,6 +84,26 @@ class RealUpdaterProvider : public UpdaterProvider {
     return var_cellular_enabled_.get();
   }
 
+  Variable<int64_t>* var_download_rate_limit() override {
+    return var_download_rate_limit_.get();
+  }
+
+  Variable<int64_t>* var_metered_download_rate_limit() override {
+    return var_metered_download_rate_limit_.get();
+  }
+
+  Variable<int64_t>* var_peak_download_rate_limit() override {
+    return var_peak_download_rate_limit_.get();
+  }
+
+  Variable<int64_t>* var_off_peak_download_start_hour() override {
+    return var_off_peak_download_start_hour_.get();
+  }
+
+  Variable<int64_t>* var_off_peak_download_end_hour() override {
+    return var_off_peak_download_end_hour_.get();
+  }
+
   Variable<unsigned int>* var_consecutive_failed_update_checks() override {
     return var_consecutive_failed_update_checks_.get();
   }
@@ -92,6 +112,10 @@ class RealUpdaterProvider : public UpdaterProvider {
     return var_server_dictated_poll_interval_.get();
   }
 
+  Variable<unsigned int>* var_server_load() override {
+    return var_server_load_.get();
+  }
+
   Variable<UpdateRequestStatus>* var_forced_update_requested() override {
     return var_forced_update_requested_.get();
   }
@@ -116,8 +140,14 @@ class RealUpdaterProvider : public UpdaterProvider {
   std::unique_ptr<Variable<std::string>> var_new_channel_;
   std::unique_ptr<Variable<bool>> var_p2p_enabled_;
   std::unique_ptr<Variable<bool>> var_cellular_enabled_;
+  std::unique_ptr<Variable<int64_t>> var_download_rate_limit_;
+  std::unique_ptr<Variable<int64_t>> var_metered_download_rate_limit_;
+  std::unique_ptr<Variable<int64_t>> var_peak_download_rate_limit_;
+  std::unique_ptr<Variable<int64_t>> var_off_peak_download_start_hour_;
+  std::unique_ptr<Variable<int64_t>> var_off_peak_download_end_hour_;
   std::unique_ptr<Variable<unsigned int>> var_consecutive_failed_update_checks_;
   std::unique_ptr<Variable<unsigned int>> var_server_dictated_poll_interval_;
+  std::unique_ptr<Variable<unsigned int>> var_server_load_;
   std::unique_ptr<Variable<UpdateRequestStatus>> var_forced_update_requested_;
   std::unique_ptr<Variable<UpdateRestrictions>> var_update_restrictions_;
 
@@ -20,6 +20,8 @@
 #include <string>
 
 #include <base/time/time.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
 #include <gtest/gtest.h>
 #include <update_engine/dbus-constants.h>
 
@@ -32,6 +34,7 @@
 
 using base::Time;
 using base::TimeDelta;
+using brillo::MessageLoopRunMaxIterations;
 using chromeos_update_engine::FakeClock;
 using chromeos_update_engine::FakePrefs;
 using chromeos_update_engine::FakeSystemState;
@@ -395,6 +398,37 @@ TEST_F(UmRealUpdaterProviderTest, GetCellularEnabledOkayPrefReadsTrue) {
   UmTestUtils::ExpectVariableHasValue(true, provider_->var_cellular_enabled());
 }
 
+TEST_F(UmRealUpdaterProviderTest, GetDownloadRateLimitOkayPrefDoesntExist) {
+  UmTestUtils::ExpectVariableHasValue(static_cast<int64_t>(0),
+                                      provider_->var_download_rate_limit());
+}
+
+TEST_F(UmRealUpdaterProviderTest, GetDownloadRateLimitOkayPrefReadsValue) {
+  fake_prefs_.SetInt64(chromeos_update_engine::kPrefsMeteredDownloadRateLimit,
+                       100000);
+  UmTestUtils::ExpectVariableHasValue(
+      static_cast<int64_t>(100000),
+      provider_->var_metered_download_rate_limit());
+  // A negative limit is ignored.
+  fake_prefs_.SetInt64(chromeos_update_engine::kPrefsMeteredDownloadRateLimit,
+                       -1);
+  UmTestUtils::ExpectVariableHasValue(
+      static_cast<int64_t>(0), provider_->var_metered_download_rate_limit());
+}
+
+TEST_F(UmRealUpdaterProviderTest, GetOffPeakDownloadWindowOkay) {
+  fake_prefs_.SetInt64(chromeos_update_engine::kPrefsPeakDownloadRateLimit,
+                       1000);
+  fake_prefs_.SetInt64(chromeos_update_engine::kPrefsOffPeakDownloadStartHour,
+                       22);
+  UmTestUtils::ExpectVariableHasValue(
+      static_cast<int64_t>(1000), provider_->var_peak_download_rate_limit());
+  UmTestUtils::ExpectVariableHasValue(
+      static_cast<int64_t>(22), provider_->var_off_peak_download_start_hour());
+  UmTestUtils::ExpectVariableHasValue(
+      static_cast<int64_t>(0), provider_->var_off_peak_download_end_hour());
+}
+
 TEST_F(UmRealUpdaterProviderTest, GetUpdateCompletedTimeOkay) {
   Time expected = SetupUpdateCompletedTime(true);
   UmTestUtils::ExpectVariableHasValue(expected,
@@ -430,6 +464,12 @@ TEST_F(UmRealUpdaterProviderTest, GetServerDictatedPollInterval) {
       kPollInterval, provider_->var_server_dictated_poll_interval());
 }
 
+TEST_F(UmRealUpdaterProviderTest, GetServerLoad) {
+  EXPECT_CALL(*fake_sys_state_.mock_update_attempter(), server_load())
+      .WillRepeatedly(Return(60));
+  UmTestUtils::ExpectVariableHasValue(60U, provider_->var_server_load());
+}
+
 TEST_F(UmRealUpdaterProviderTest, GetUpdateRestrictions) {
   EXPECT_CALL(*fake_sys_state_.mock_update_attempter(),
               GetCurrentUpdateAttemptFlags())
@@ -446,4 +486,46 @@ TEST_F(UmRealUpdaterProviderTest, GetUpdateRestrictionsNone) {
   UmTestUtils::ExpectVariableHasValue(UpdateRestrictions::kNone,
                                       provider_->var_update_restrictions());
 }
+
+class CallCounterObserver : public BaseVariable::ObserverInterface {
+ public:
+  void ValueChanged(BaseVariable* variable) override { calls_count_++; }
+
+  int calls_count_ = 0;
+};
+
+TEST_F(UmRealUpdaterProviderTest, ProgressNotifiedOnStatusChange) {
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  EXPECT_EQ(kVariableModeAsync, provider_->var_progress()->GetMode());
+  CallCounterObserver observer;
+  provider_->var_progress()->AddObserver(&observer);
+
+  // Broadcasts a status with |progress| from the UpdateAttempter.
+  auto broadcast_progress = [this](double progress) {
+    EXPECT_CALL(*fake_sys_state_.mock_update_attempter(), GetStatus(_))
+        .WillRepeatedly(
+            DoAll(ActionSetUpdateEngineStatusProgress(progress), Return(true)));
+    update_engine::UpdateEngineStatus status;
+    status.progress = progress;
+    for (auto* service_observer :
+         fake_sys_state_.mock_update_attempter()->service_observers()) {
+      service_observer->SendStatusUpdate(status);
+    }
+    MessageLoopRunMaxIterations(&loop, 100);
+  };
+
+  // The first status and the changes of the progress fire the notification,
+  // but not the other status updates.
+  broadcast_progress(0.3);
+  EXPECT_EQ(1, observer.calls_count_);
+  broadcast_progress(0.3);
+  EXPECT_EQ(1, observer.calls_count_);
+  broadcast_progress(0.5);
+  EXPECT_EQ(2, observer.calls_count_);
+
+  provider_->var_progress()->RemoveObserver(&observer);
+  EXPECT_FALSE(loop.PendingTasks());
+}
+
 }  // namespace chromeos_update_manager
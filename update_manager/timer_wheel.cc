@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/update_manager/timer_wheel.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/bind.h>
+#include <base/location.h>
+#include <base/logging.h>
+
+using base::Time;
+using base::TimeDelta;
+using brillo::MessageLoop;
+using chromeos_update_engine::ClockInterface;
+
+namespace chromeos_update_manager {
+
+namespace {
+
+// The part of the delay of a task it can be deferred by.
+const int kSlackDivisor = 10;
+
+}  // namespace
+
+TimerWheel::TimerWheel(ClockInterface* clock, TimeDelta max_slack)
+    : clock_(clock), max_slack_(max_slack) {}
+
+TimerWheel::~TimerWheel() {
+  for (const auto& it : slots_)
+    MessageLoop::current()->CancelTask(it.second.loop_task_id);
+}
+
+TimerWheel::TaskId TimerWheel::PostDelayedTask(const base::Closure& task,
+                                               TimeDelta delay) {
+  delay = std::max(delay, TimeDelta());
+  Time now = clock_->GetMonotonicTime();
+  Time deadline = now + delay;
+  Time latest = deadline + std::min(delay / kSlackDivisor, max_slack_);
+
+  // Join the first slot in the window, if any.
+  auto slot_it = slots_.lower_bound(deadline);
+  if (slot_it == slots_.end() || slot_it->first > latest) {
+    // Otherwise create a slot, on the grid if it falls in the window.
+    Time slot_time = latest;
+    if (max_slack_ > TimeDelta()) {
+      int64_t offset =
+          (latest - Time()).InMicroseconds() % max_slack_.InMicroseconds();
+      Time grid_time = latest - TimeDelta::FromMicroseconds(offset);
+      if (grid_time >= deadline)
+        slot_time = grid_time;
+    }
+    slot_it = slots_.emplace(slot_time, Slot()).first;
+    slot_it->second.loop_task_id = MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&TimerWheel::RunSlot, base::Unretained(this), slot_time),
+        slot_time - now);
+  }
+
+  TaskId task_id = ++last_task_id_;
+  slot_it->second.tasks.emplace(task_id, task);
+  task_slots_.emplace(task_id, slot_it->first);
+  return task_id;
+}
+
+bool TimerWheel::CancelTask(TaskId task_id) {
+  auto task_it = task_slots_.find(task_id);
+  if (task_it == task_slots_.end())
+    return false;
+  auto slot_it = slots_.find(task_it->second);
+  task_slots_.erase(task_it);
+  DCHECK(slot_it != slots_.end());
+  slot_it->second.tasks.erase(task_id);
+  if (slot_it->second.tasks.empty()) {
+    MessageLoop::current()->CancelTask(slot_it->second.loop_task_id);
+    slots_.erase(slot_it);
+  }
+  return true;
+}
+
+void TimerWheel::RunSlot(Time slot_time) {
+  auto slot_it = slots_.find(slot_time);
+  if (slot_it == slots_.end())
+    return;
+  // The tasks can post and cancel other tasks, so take them out first.
+  std::map<TaskId, base::Closure> tasks = std::move(slot_it->second.tasks);
+  slots_.erase(slot_it);
+  for (const auto& it : tasks)
+    task_slots_.erase(it.first);
+  for (const auto& it : tasks)
+    it.second.Run();
+}
+
+}  // namespace chromeos_update_manager
@@ -0,0 +1,87 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_UPDATE_MANAGER_TIMER_WHEEL_H_
+#define UPDATE_ENGINE_UPDATE_MANAGER_TIMER_WHEEL_H_
+
+#include <map>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+#include "update_engine/common/clock_interface.h"
+
+namespace chromeos_update_manager {
+
+// Runs delayed tasks in shared wakeup slots, so the update manager timeouts
+// scheduled close to each other wake up the device once. Each task may run up
+// to a tenth of its delay late, never more than the |max_slack| passed on
+// construction. A task joins an existing slot within that window when there is
+// one; otherwise a new slot is placed on a grid of |max_slack| intervals of the
+// monotonic clock when possible, or at the end of the window, to make the
+// slots of independent timeouts meet. The slots are scheduled on the current
+// MessageLoop, which uses the monotonic time: the slots are deferred while the
+// device is suspended and never wake it up.
+class TimerWheel {
+ public:
+  typedef brillo::MessageLoop::TaskId TaskId;
+
+  TimerWheel(chromeos_update_engine::ClockInterface* clock,
+             base::TimeDelta max_slack);
+  ~TimerWheel();
+
+  // Schedules |task| to run after |delay| plus the slack, and returns an id to
+  // cancel it with CancelTask(). The returned id is never
+  // brillo::MessageLoop::kTaskIdNull.
+  TaskId PostDelayedTask(const base::Closure& task, base::TimeDelta delay);
+
+  // Cancels the task |task_id| returned by PostDelayedTask(), if it didn't run
+  // yet. Returns whether it was cancelled.
+  bool CancelTask(TaskId task_id);
+
+  // Returns the number of scheduled wakeup slots.
+  size_t num_slots() const { return slots_.size(); }
+
+ private:
+  struct Slot {
+    // The MessageLoop task running the slot.
+    brillo::MessageLoop::TaskId loop_task_id{brillo::MessageLoop::kTaskIdNull};
+    // The tasks to run in the slot, by id.
+    std::map<TaskId, base::Closure> tasks;
+  };
+
+  // Runs the tasks of the slot at the monotonic time |slot_time|.
+  void RunSlot(base::Time slot_time);
+
+  chromeos_update_engine::ClockInterface* const clock_;
+  const base::TimeDelta max_slack_;
+
+  // The scheduled slots by monotonic time.
+  std::map<base::Time, Slot> slots_;
+
+  // The monotonic time of the slot of each scheduled task, by task id.
+  std::map<TaskId, base::Time> task_slots_;
+
+  TaskId last_task_id_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+}  // namespace chromeos_update_manager
+
+#endif  // UPDATE_ENGINE_UPDATE_MANAGER_TIMER_WHEEL_H_
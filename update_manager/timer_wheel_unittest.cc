@@ -0,0 +1,154 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/update_manager/timer_wheel.h"
+
+#include <memory>
+
+#include <base/bind.h>
+#include <base/test/simple_test_clock.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_clock.h"
+
+using base::TimeDelta;
+using brillo::MessageLoop;
+using brillo::MessageLoopRunMaxIterations;
+using chromeos_update_engine::FakeClock;
+using std::unique_ptr;
+
+namespace chromeos_update_manager {
+
+namespace {
+
+void Increment(int* count) {
+  (*count)++;
+}
+
+void PostIncrement(TimerWheel* wheel, int* count) {
+  wheel->PostDelayedTask(base::Bind(Increment, count),
+                         TimeDelta::FromSeconds(100));
+}
+
+}  // namespace
+
+class UmTimerWheelTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    fake_clock_.SetMonotonicTime(base::Time::FromInternalValue(1));
+  }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  // Advances both the loop and the wheel clocks by |delta| and runs the
+  // tasks due.
+  void Advance(TimeDelta delta) {
+    test_clock_.Advance(delta);
+    fake_clock_.SetMonotonicTime(fake_clock_.GetMonotonicTime() + delta);
+    MessageLoopRunMaxIterations(MessageLoop::current(), 10);
+  }
+
+  base::SimpleTestClock test_clock_;
+  brillo::FakeMessageLoop loop_{&test_clock_};
+  FakeClock fake_clock_;
+  TimerWheel wheel_{&fake_clock_, TimeDelta::FromSeconds(10)};
+};
+
+TEST_F(UmTimerWheelTest, CloseTasksShareSlot) {
+  int count = 0;
+  EXPECT_NE(MessageLoop::kTaskIdNull,
+            wheel_.PostDelayedTask(base::Bind(Increment, &count),
+                                   TimeDelta::FromSeconds(100)));
+  EXPECT_NE(MessageLoop::kTaskIdNull,
+            wheel_.PostDelayedTask(base::Bind(Increment, &count),
+                                   TimeDelta::FromSeconds(105)));
+  EXPECT_EQ(1U, wheel_.num_slots());
+
+  Advance(TimeDelta::FromSeconds(99));
+  EXPECT_EQ(0, count);
+  // Both tasks run together, no later than the slack of the first one.
+  Advance(TimeDelta::FromSeconds(11));
+  EXPECT_EQ(2, count);
+  EXPECT_EQ(0U, wheel_.num_slots());
+}
+
+TEST_F(UmTimerWheelTest, DistantTasksUseSeparateSlots) {
+  int count = 0;
+  wheel_.PostDelayedTask(base::Bind(Increment, &count),
+                         TimeDelta::FromSeconds(100));
+  wheel_.PostDelayedTask(base::Bind(Increment, &count),
+                         TimeDelta::FromSeconds(200));
+  EXPECT_EQ(2U, wheel_.num_slots());
+
+  Advance(TimeDelta::FromSeconds(110));
+  EXPECT_EQ(1, count);
+  Advance(TimeDelta::FromSeconds(110));
+  EXPECT_EQ(2, count);
+}
+
+TEST_F(UmTimerWheelTest, ShortDelaysGetProportionalSlack) {
+  int count = 0;
+  wheel_.PostDelayedTask(base::Bind(Increment, &count),
+                         TimeDelta::FromSeconds(1));
+  // The task isn't deferred by more than a tenth of its delay.
+  Advance(TimeDelta::FromMilliseconds(1100));
+  EXPECT_EQ(1, count);
+}
+
+TEST_F(UmTimerWheelTest, CancelTask) {
+  int count = 0;
+  TimerWheel::TaskId first = wheel_.PostDelayedTask(
+      base::Bind(Increment, &count), TimeDelta::FromSeconds(100));
+  TimerWheel::TaskId second = wheel_.PostDelayedTask(
+      base::Bind(Increment, &count), TimeDelta::FromSeconds(100));
+  EXPECT_NE(first, second);
+
+  EXPECT_TRUE(wheel_.CancelTask(first));
+  EXPECT_FALSE(wheel_.CancelTask(first));
+  EXPECT_EQ(1U, wheel_.num_slots());
+  // Cancelling the last task of a slot cancels its wakeup.
+  EXPECT_TRUE(wheel_.CancelTask(second));
+  EXPECT_EQ(0U, wheel_.num_slots());
+  EXPECT_FALSE(loop_.PendingTasks());
+  EXPECT_FALSE(wheel_.CancelTask(MessageLoop::kTaskIdNull));
+}
+
+TEST_F(UmTimerWheelTest, TaskPostsTask) {
+  int count = 0;
+  wheel_.PostDelayedTask(base::Bind(PostIncrement, &wheel_, &count),
+                         TimeDelta::FromSeconds(100));
+  Advance(TimeDelta::FromSeconds(110));
+  EXPECT_EQ(0, count);
+  EXPECT_EQ(1U, wheel_.num_slots());
+  Advance(TimeDelta::FromSeconds(110));
+  EXPECT_EQ(1, count);
+}
+
+TEST_F(UmTimerWheelTest, DestructorCancelsWakeups) {
+  unique_ptr<TimerWheel> wheel(
+      new TimerWheel(&fake_clock_, TimeDelta::FromSeconds(10)));
+  int count = 0;
+  wheel->PostDelayedTask(base::Bind(Increment, &count),
+                         TimeDelta::FromSeconds(100));
+  EXPECT_TRUE(loop_.PendingTasks());
+  wheel.reset();
+  EXPECT_FALSE(loop_.PendingTasks());
+}
+
+}  // namespace chromeos_update_manager
@@ -19,6 +19,9 @@
 
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/location.h>
@@ -48,7 +51,12 @@ EvalStatus UpdateManager::EvaluatePolicy(
   // Reset the evaluation context.
   ec->ResetEvaluation();
 
-  const std::string policy_name = policy_->PolicyRequestName(policy_method);
+  PolicyEvaluation evaluation;
+  evaluation.policy_name = policy_->PolicyRequestName(policy_method);
+  evaluation.start_time = clock_->GetWallclockTime();
+  evaluation.trigger = ec->reevaluation_reason();
+  const base::Time start_monotonic = clock_->GetMonotonicTime();
+  const std::string& policy_name = evaluation.policy_name;
   LOG(INFO) << policy_name << ": START";
 
   // First try calling the actual policy.
@@ -73,6 +81,11 @@ EvalStatus UpdateManager::EvaluatePolicy(
 
   LOG(INFO) << policy_name << ": END";
 
+  evaluation.duration = clock_->GetMonotonicTime() - start_monotonic;
+  evaluation.status = status;
+  evaluation.variables = ec->GetVariableNames();
+  policy_trace_.Add(std::move(evaluation));
+
   return status;
 }
 
@@ -118,7 +131,10 @@ EvalStatus UpdateManager::PolicyRequest(
                                         ExpectedArgs...) const,
     R* result, ActualArgs... args) {
   scoped_refptr<EvaluationContext> ec(
-      new EvaluationContext(clock_, evaluation_timeout_));
+      new EvaluationContext(
+          clock_, evaluation_timeout_, base::TimeDelta::Max(),
+          std::unique_ptr<base::Callback<void(EvaluationContext*)>>(),
+          &variable_snapshot_, &timer_wheel_));
   // A PolicyRequest always consists on a single evaluation on a new
   // EvaluationContext.
   // IMPORTANT: To ensure that ActualArgs can be converted to ExpectedArgs, we
@@ -140,13 +156,34 @@ void UpdateManager::AsyncPolicyRequest(
                                         std::string*, R*,
                                         ExpectedArgs...) const,
     ActualArgs... args) {
+  typedef base::Callback<void(EvalStatus, const R& result)> CallbackType;
+
+  // Merge the request with an identical pending one.
+  std::string key(reinterpret_cast<const char*>(&policy_method),
+                  sizeof(policy_method));
+  bool mergeable = AppendRequestKey(&key, static_cast<ExpectedArgs>(args)...);
+  if (mergeable) {
+    auto it = pending_requests_.find(key);
+    if (it != pending_requests_.end()) {
+      std::static_pointer_cast<std::vector<CallbackType>>(it->second)
+          ->push_back(callback);
+      return;
+    }
+    auto callbacks = std::make_shared<std::vector<CallbackType>>();
+    callbacks->push_back(callback);
+    pending_requests_[key] = callbacks;
+    callback = base::Bind(&UpdateManager::RunPolicyCallbacks<R>,
+                          weak_ptr_factory_.GetWeakPtr(), key, callbacks);
+  }
+
   scoped_refptr<EvaluationContext> ec =
       new EvaluationContext(
           clock_, evaluation_timeout_, expiration_timeout_,
           std::unique_ptr<base::Callback<void(EvaluationContext*)>>(
               new base::Callback<void(EvaluationContext*)>(
                   base::Bind(&UpdateManager::UnregisterEvalContext,
-                             weak_ptr_factory_.GetWeakPtr()))));
+                             weak_ptr_factory_.GetWeakPtr()))),
+          &variable_snapshot_, &timer_wheel_);
   if (!ec_repo_.insert(ec.get()).second) {
     LOG(ERROR) << "Failed to register evaluation context; this is a bug.";
   }
@@ -160,6 +197,29 @@ void UpdateManager::AsyncPolicyRequest(
   brillo::MessageLoop::current()->PostTask(FROM_HERE, eval_callback);
 }
 
+template<typename T, typename... Rest>
+bool UpdateManager::AppendRequestKey(std::string* key, const T& arg,
+                                     const Rest&... rest) {
+  if (!std::is_trivially_copyable<T>::value)
+    return false;
+  key->append(reinterpret_cast<const char*>(&arg), sizeof(arg));
+  return AppendRequestKey(key, rest...);
+}
+
+template<typename R>
+void UpdateManager::RunPolicyCallbacks(
+    const std::string& key,
+    std::shared_ptr<std::vector<base::Callback<void(EvalStatus, const R&)>>>
+        callbacks,
+    EvalStatus status,
+    const R& result) {
+  // The requests made from now on, including from the callbacks, need a new
+  // evaluation.
+  pending_requests_.erase(key);
+  for (const auto& callback : *callbacks)
+    callback.Run(status, result);
+}
+
 }  // namespace chromeos_update_manager
 
 #endif  // UPDATE_ENGINE_UPDATE_MANAGER_UPDATE_MANAGER_INL_H_
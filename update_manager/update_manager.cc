@@ -25,12 +25,31 @@
 
 namespace chromeos_update_manager {
 
+namespace {
+
+// How long the value read from a variable by a policy request is reused by the
+// other requests, unless the variable reports a change. It only has to cover
+// the requests made from the same main loop task.
+const base::TimeDelta kVariableSnapshotMaxAge =
+    base::TimeDelta::FromMilliseconds(100);
+
+// The number of policy evaluations kept in the trace.
+const size_t kMaxTracedPolicyEvaluations = 100;
+
+// The most the policy re-evaluation timeouts are deferred by to share wakeups.
+const base::TimeDelta kTimerMaxSlack = base::TimeDelta::FromSeconds(30);
+
+}  // namespace
+
 UpdateManager::UpdateManager(chromeos_update_engine::ClockInterface* clock,
                              base::TimeDelta evaluation_timeout,
                              base::TimeDelta expiration_timeout, State* state)
       : default_policy_(clock), state_(state), clock_(clock),
         evaluation_timeout_(evaluation_timeout),
         expiration_timeout_(expiration_timeout),
+        variable_snapshot_(clock, kVariableSnapshotMaxAge),
+        timer_wheel_(clock, kTimerMaxSlack),
+        policy_trace_(kMaxTracedPolicyEvaluations),
         weak_ptr_factory_(this) {
 #ifdef __ANDROID__
   policy_.reset(new AndroidThingsPolicy());
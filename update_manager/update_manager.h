@@ -17,9 +17,11 @@
 #ifndef UPDATE_ENGINE_UPDATE_MANAGER_UPDATE_MANAGER_H_
 #define UPDATE_ENGINE_UPDATE_MANAGER_UPDATE_MANAGER_H_
 
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <base/callback.h>
 #include <base/memory/ref_counted.h>
@@ -29,7 +31,10 @@
 #include "update_engine/update_manager/default_policy.h"
 #include "update_engine/update_manager/evaluation_context.h"
 #include "update_engine/update_manager/policy.h"
+#include "update_engine/update_manager/policy_trace.h"
 #include "update_engine/update_manager/state.h"
+#include "update_engine/update_manager/timer_wheel.h"
+#include "update_engine/update_manager/variable_snapshot.h"
 
 namespace chromeos_update_manager {
 
@@ -83,6 +88,11 @@ class UpdateManager {
   // policy until another status is returned. If the policy implementation based
   // its return value solely on const variables, the callback will be called
   // with the EvalStatus::kAskMeAgainLater status (which indicates an error).
+  //
+  // A request identical to one still pending, with the same |policy_method| and
+  // |args|, doesn't evaluate the policy again: its |callback| is called with
+  // the result of the pending request. Only the requests whose arguments are
+  // trivially copyable, so they can be compared bytewise, are merged.
   template<typename R, typename... ActualArgs, typename... ExpectedArgs>
   void AsyncPolicyRequest(
       base::Callback<void(EvalStatus, const R& result)> callback,
@@ -91,6 +101,13 @@ class UpdateManager {
                                           ExpectedArgs...) const,
       ActualArgs... args);
 
+  // Returns the last policy evaluations and the totals of all the evaluations
+  // as JSON, to find out which policies are evaluated often and why.
+  std::string DumpPolicyTrace() const { return policy_trace_.ToString(); }
+
+  // Returns the trace of the policy evaluations.
+  const PolicyTrace& policy_trace() const { return policy_trace_; }
+
  protected:
   // The UpdateManager receives ownership of the passed Policy instance.
   void set_policy(const Policy* policy) {
@@ -134,6 +151,23 @@ class UpdateManager {
                                           Args...) const,
       Args... args);
 
+  // Appends the bytes of the |args| to |key| and returns true if they are all
+  // trivially copyable; otherwise returns false.
+  static bool AppendRequestKey(std::string* /* key */) { return true; }
+  template<typename T, typename... Rest>
+  static bool AppendRequestKey(std::string* key, const T& arg,
+                               const Rest&... rest);
+
+  // Calls all the |callbacks| of the pending request identified by |key| with
+  // its result, once no more callbacks can be added to them.
+  template<typename R>
+  void RunPolicyCallbacks(
+      const std::string& key,
+      std::shared_ptr<std::vector<base::Callback<void(EvalStatus, const R&)>>>
+          callbacks,
+      EvalStatus status,
+      const R& result);
+
   // Unregisters (removes from repo) a previously created EvaluationContext.
   void UnregisterEvalContext(EvaluationContext* ec);
 
@@ -157,6 +191,17 @@ class UpdateManager {
   // Timeout for expiration of the evaluation context, used for async requests.
   const base::TimeDelta expiration_timeout_;
 
+  // The variable values shared by the EvaluationContexts of the policy requests
+  // made together. It must outlive the contexts in |ec_repo_|.
+  VariableSnapshot variable_snapshot_;
+
+  // Schedules the timeouts of the contexts in |ec_repo_| in shared wakeups. It
+  // must outlive them.
+  TimerWheel timer_wheel_;
+
+  // The last policy evaluations.
+  PolicyTrace policy_trace_;
+
   // Repository of previously created EvaluationContext objects. These are being
   // unregistered (and the reference released) when the context is being
   // destructed; alternatively, when the UpdateManager instance is destroyed, it
@@ -165,6 +210,11 @@ class UpdateManager {
   std::set<scoped_refptr<EvaluationContext>,
            ScopedRefPtrLess<EvaluationContext>> ec_repo_;
 
+  // The callbacks of the pending async policy requests which can be merged, a
+  // std::vector<base::Callback<void(EvalStatus, const R&)>> for each one, by
+  // the request key: the bytes of the policy method and of its arguments.
+  std::map<std::string, std::shared_ptr<void>> pending_requests_;
+
   base::WeakPtrFactory<UpdateManager> weak_ptr_factory_;
 
   DISALLOW_COPY_AND_ASSIGN(UpdateManager);
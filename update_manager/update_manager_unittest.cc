@@ -260,6 +260,29 @@ TEST_F(UmUpdateManagerTest, AsyncPolicyRequestDelaysEvaluation) {
   EXPECT_EQ(1U, calls.size());
 }
 
+TEST_F(UmUpdateManagerTest, AsyncPolicyRequestsMerged) {
+  int num_called = 0;
+  umut_->set_policy(new FailingPolicy(&num_called));
+
+  vector<pair<EvalStatus, UpdateCheckParams>> calls;
+  Callback<void(EvalStatus, const UpdateCheckParams&)> callback = Bind(
+      AccumulateCallsCallback<UpdateCheckParams>, &calls);
+
+  // The identical requests made while the first one is pending get the result
+  // of a single evaluation.
+  umut_->AsyncPolicyRequest(callback, &Policy::UpdateCheckAllowed);
+  umut_->AsyncPolicyRequest(callback, &Policy::UpdateCheckAllowed);
+  MessageLoopRunMaxIterations(MessageLoop::current(), 100);
+  EXPECT_EQ(1, num_called);
+  EXPECT_EQ(2U, calls.size());
+
+  // A request made once the previous ones finished is evaluated again.
+  umut_->AsyncPolicyRequest(callback, &Policy::UpdateCheckAllowed);
+  MessageLoopRunMaxIterations(MessageLoop::current(), 100);
+  EXPECT_EQ(2, num_called);
+  EXPECT_EQ(3U, calls.size());
+}
+
 TEST_F(UmUpdateManagerTest, AsyncPolicyRequestTimeoutDoesNotFire) {
   // Set up an async policy call to return immediately, then wait a little and
   // ensure that the timeout event does not fire.
@@ -324,4 +347,40 @@ TEST_F(UmUpdateManagerTest, AsyncPolicyRequestTimesOut) {
   EXPECT_EQ(EvalStatus::kSucceeded, calls[0].first);
 }
 
+TEST_F(UmUpdateManagerTest, PolicyEvaluationsTraced) {
+  umut_->set_policy(new DelayPolicy(
+          0, fake_clock_.GetWallclockTime() + TimeDelta::FromSeconds(3),
+          nullptr));
+
+  vector<pair<EvalStatus, UpdateCheckParams>> calls;
+  Callback<void(EvalStatus, const UpdateCheckParams&)> callback =
+      Bind(AccumulateCallsCallback<UpdateCheckParams>, &calls);
+
+  umut_->AsyncPolicyRequest(callback, &Policy::UpdateCheckAllowed);
+  MessageLoopRunMaxIterations(MessageLoop::current(), 100);
+  // The first reevaluation comes from the expiration timeout and the second
+  // one from the wallclock time threshold.
+  for (int i = 0; i < 2; i++) {
+    test_clock_.Advance(TimeDelta::FromSeconds(2));
+    fake_clock_.SetWallclockTime(fake_clock_.GetWallclockTime() +
+                                 TimeDelta::FromSeconds(2));
+    MessageLoopRunMaxIterations(MessageLoop::current(), 10);
+  }
+  ASSERT_EQ(1U, calls.size());
+
+  const auto& evaluations = umut_->policy_trace().evaluations();
+  ASSERT_EQ(3U, evaluations.size());
+  EXPECT_EQ("DelayPolicy::UpdateCheckAllowed", evaluations[0].policy_name);
+  EXPECT_EQ("", evaluations[0].trigger);
+  EXPECT_EQ(EvalStatus::kAskMeAgainLater, evaluations[0].status);
+  EXPECT_EQ("expiration", evaluations[1].trigger);
+  EXPECT_EQ("timeout", evaluations[2].trigger);
+  EXPECT_EQ(EvalStatus::kSucceeded, evaluations[2].status);
+
+  const auto& totals = umut_->policy_trace().totals();
+  ASSERT_EQ(1U, totals.size());
+  EXPECT_EQ(3U, totals.at("DelayPolicy::UpdateCheckAllowed").count);
+  EXPECT_NE(string::npos, umut_->DumpPolicyTrace().find("\"expiration\""));
+}
+
 }  // namespace chromeos_update_manager
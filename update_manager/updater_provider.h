@@ -100,12 +100,33 @@ class UpdaterProvider : public Provider {
   // network.
   virtual Variable<bool>* var_cellular_enabled() = 0;
 
+  // Variables returning the maximum download rate set by the user, in bytes
+  // per second, over the metered connections and over the other ones. Zero
+  // means no limit.
+  virtual Variable<int64_t>* var_download_rate_limit() = 0;
+  virtual Variable<int64_t>* var_metered_download_rate_limit() = 0;
+
+  // A variable returning the maximum download rate, in bytes per second, used
+  // outside of the off-peak download window, or zero to not plan the download
+  // around the window.
+  virtual Variable<int64_t>* var_peak_download_rate_limit() = 0;
+
+  // Variables returning the local hours the off-peak download window starts at
+  // and ends before. The window wraps around midnight if it ends before it
+  // starts, and is empty if both hours are the same.
+  virtual Variable<int64_t>* var_off_peak_download_start_hour() = 0;
+  virtual Variable<int64_t>* var_off_peak_download_end_hour() = 0;
+
   // A variable returning the number of consecutive failed update checks.
   virtual Variable<unsigned int>* var_consecutive_failed_update_checks() = 0;
 
   // A server-dictated update check interval in seconds, if one was given.
   virtual Variable<unsigned int>* var_server_dictated_poll_interval() = 0;
 
+  // The load of the update server, in percent, as reported in the last
+  // response; zero if none was reported.
+  virtual Variable<unsigned int>* var_server_load() = 0;
+
   // A variable denoting whether a forced update was request but no update check
   // performed yet; also tells whether this request is for an interactive or
   // scheduled update.
@@ -0,0 +1,53 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/update_manager/variable.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace chromeos_update_manager {
+
+namespace {
+
+// Returns whether each id is used by an existing variable, indexed by id. It is
+// never deleted, so the variables may be destroyed at exit.
+std::vector<bool>* GetUsedIds() {
+  static std::vector<bool>* used_ids = new std::vector<bool>();
+  return used_ids;
+}
+
+}  // namespace
+
+size_t BaseVariable::AllocateId() {
+  std::vector<bool>* used_ids = GetUsedIds();
+  auto it = std::find(used_ids->begin(), used_ids->end(), false);
+  size_t id = it - used_ids->begin();
+  if (it == used_ids->end())
+    used_ids->push_back(true);
+  else
+    *it = true;
+  return id;
+}
+
+void BaseVariable::ReleaseId(size_t id) {
+  std::vector<bool>* used_ids = GetUsedIds();
+  DCHECK_LT(id, used_ids->size());
+  DCHECK((*used_ids)[id]);
+  (*used_ids)[id] = false;
+}
+
+}  // namespace chromeos_update_manager
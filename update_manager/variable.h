@@ -17,6 +17,9 @@
 #ifndef UPDATE_ENGINE_UPDATE_MANAGER_VARIABLE_H_
 #define UPDATE_ENGINE_UPDATE_MANAGER_VARIABLE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <algorithm>
 #include <list>
 #include <string>
@@ -71,6 +74,14 @@ class BaseVariable {
     }
     DCHECK(observer_list_.empty()) << "Don't destroy the variable without "
                                       "removing the observers.";
+    ReleaseId(id_);
+  }
+
+  // Returns the id of the variable, unique among the existing variables. The
+  // ids are small, dense numbers reused after the variables are destroyed, so
+  // they can index a vector holding a value per variable.
+  size_t GetId() const {
+    return id_;
   }
 
   // Returns the variable name as a string.
@@ -89,6 +100,12 @@ class BaseVariable {
     return poll_interval_;
   }
 
+  // Returns a counter increased every time the variable reports a change of
+  // its value, used to detect that a value read earlier is outdated.
+  uint64_t GetChangeGeneration() const {
+    return change_generation_;
+  }
+
   // Adds and removes observers for value changes on the variable. This only
   // works for kVariableAsync variables since the other modes don't track value
   // changes. Adding the same observer twice has no effect.
@@ -121,8 +138,15 @@ class BaseVariable {
     poll_interval_ = poll_interval;
   }
 
+  // Reports that the value changed to the callers of GetChangeGeneration()
+  // only, without notifying the observers.
+  void MarkValueChanged() {
+    change_generation_++;
+  }
+
   // Calls ValueChanged on all the observers.
   void NotifyValueChanged() {
+    MarkValueChanged();
     // Fire all the observer methods from the main loop as single call. In order
     // to avoid scheduling these callbacks when it is not needed, we check
     // first the list of observers.
@@ -144,7 +168,14 @@ class BaseVariable {
                base::TimeDelta poll_interval)
     : name_(name), mode_(mode),
       poll_interval_(mode == kVariableModePoll ?
-                     poll_interval : base::TimeDelta()) {}
+                     poll_interval : base::TimeDelta()),
+      id_(AllocateId()) {}
+
+  // Returns the lowest id not used by an existing variable, and releases the
+  // |id| of a destroyed variable. The variables must all be created and
+  // destroyed on the same thread.
+  static size_t AllocateId();
+  static void ReleaseId(size_t id);
 
   void OnValueChangedNotification() {
     // A ValueChanged() method can change the list of observers, for example
@@ -175,9 +206,15 @@ class BaseVariable {
   // other modes.
   base::TimeDelta poll_interval_;
 
+  // The variable's id, returned by GetId().
+  const size_t id_;
+
   // The list of value changes observers.
   std::list<BaseVariable::ObserverInterface*> observer_list_;
 
+  // The number of times MarkValueChanged() was called.
+  uint64_t change_generation_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(BaseVariable);
 };
 
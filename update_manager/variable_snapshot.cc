@@ -0,0 +1,56 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/update_manager/variable_snapshot.h"
+
+#include <utility>
+
+using base::Time;
+using base::TimeDelta;
+using chromeos_update_engine::ClockInterface;
+using std::shared_ptr;
+
+namespace chromeos_update_manager {
+
+VariableSnapshot::VariableSnapshot(ClockInterface* clock, TimeDelta max_age)
+    : clock_(clock), max_age_(max_age) {}
+
+shared_ptr<const BoxedValue> VariableSnapshot::Get(BaseVariable* var) {
+  const size_t id = var->GetId();
+  if (id >= entries_.size() || entries_[id].var != var)
+    return nullptr;
+  Entry& entry = entries_[id];
+  if (clock_->GetMonotonicTime() - entry.read_time >= max_age_ ||
+      var->GetChangeGeneration() != entry.change_generation) {
+    entry = Entry();
+    return nullptr;
+  }
+  return entry.value;
+}
+
+void VariableSnapshot::Add(BaseVariable* var,
+                           shared_ptr<const BoxedValue> value) {
+  const size_t id = var->GetId();
+  if (id >= entries_.size())
+    entries_.resize(id + 1);
+  Entry& entry = entries_[id];
+  entry.var = var;
+  entry.read_time = clock_->GetMonotonicTime();
+  entry.change_generation = var->GetChangeGeneration();
+  entry.value = std::move(value);
+}
+
+}  // namespace chromeos_update_manager
@@ -0,0 +1,77 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_UPDATE_MANAGER_VARIABLE_SNAPSHOT_H_
+#define UPDATE_ENGINE_UPDATE_MANAGER_VARIABLE_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+#include "update_engine/common/clock_interface.h"
+#include "update_engine/update_manager/boxed_value.h"
+#include "update_engine/update_manager/variable.h"
+
+namespace chromeos_update_manager {
+
+// The values of the variables read by the EvaluationContexts of the policy
+// requests made at about the same time, such as the back-to-back requests
+// made when an update check starts, so each variable is only read once for
+// all of them. A value is reused for |max_age| after it was read, which is
+// meant to cover a single scheduling tick, unless the variable notifies a
+// change of its value in the meantime. The values are shared with the
+// contexts that read them, so they stay valid for the whole evaluation after
+// the snapshot drops them.
+class VariableSnapshot {
+ public:
+  VariableSnapshot(chromeos_update_engine::ClockInterface* clock,
+                   base::TimeDelta max_age);
+
+  // Returns the value of |var| read less than |max_age| ago, if it didn't
+  // change since, or null if there is none. The returned value can hold a null
+  // pointer when reading the variable failed.
+  std::shared_ptr<const BoxedValue> Get(BaseVariable* var);
+
+  // Stores the |value| just read from |var|.
+  void Add(BaseVariable* var, std::shared_ptr<const BoxedValue> value);
+
+ private:
+  struct Entry {
+    // The variable read, or null if the entry is unused.
+    BaseVariable* var = nullptr;
+    // The monotonic time when the value was read.
+    base::Time read_time;
+    // The BaseVariable::GetChangeGeneration() when the value was read.
+    uint64_t change_generation = 0;
+    std::shared_ptr<const BoxedValue> value;
+  };
+
+  chromeos_update_engine::ClockInterface* const clock_;
+  const base::TimeDelta max_age_;
+
+  // The values indexed by the BaseVariable::GetId() of the variables.
+  std::vector<Entry> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(VariableSnapshot);
+};
+
+}  // namespace chromeos_update_manager
+
+#endif  // UPDATE_ENGINE_UPDATE_MANAGER_VARIABLE_SNAPSHOT_H_
@@ -0,0 +1,119 @@
+//
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/update_manager/variable_snapshot.h"
+
+#include <memory>
+
+#include <base/memory/ref_counted.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_clock.h"
+#include "update_engine/update_manager/evaluation_context.h"
+#include "update_engine/update_manager/fake_variable.h"
+
+using base::Time;
+using base::TimeDelta;
+using chromeos_update_engine::FakeClock;
+using std::unique_ptr;
+
+namespace chromeos_update_manager {
+
+class UmVariableSnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    fake_clock_.SetMonotonicTime(Time::FromTimeT(1240428300));
+  }
+
+  void TearDown() override {
+    EXPECT_FALSE(loop_.PendingTasks());
+  }
+
+  // Returns a new EvaluationContext sharing the |snapshot_|.
+  scoped_refptr<EvaluationContext> NewContext() {
+    return new EvaluationContext(
+        &fake_clock_, TimeDelta::FromSeconds(5), TimeDelta::FromSeconds(5),
+        unique_ptr<base::Callback<void(EvaluationContext*)>>(), &snapshot_,
+        nullptr);
+  }
+
+  const TimeDelta max_age_ = TimeDelta::FromMilliseconds(100);
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  FakeClock fake_clock_;
+  VariableSnapshot snapshot_{&fake_clock_, max_age_};
+
+  // The FakeVariables return their value only once, so a second read only
+  // succeeds when it comes from the |snapshot_|.
+  FakeVariable<int> fake_poll_var_ = {"fake_poll", kVariableModePoll};
+  FakeVariable<int> fake_async_var_ = {"fake_async", kVariableModeAsync};
+};
+
+TEST_F(UmVariableSnapshotTest, GetMissingValue) {
+  EXPECT_EQ(nullptr, snapshot_.Get(&fake_poll_var_));
+}
+
+TEST_F(UmVariableSnapshotTest, ValueSharedBetweenContexts) {
+  fake_poll_var_.reset(new int(42));
+  const int* value = NewContext()->GetValue(&fake_poll_var_);
+  ASSERT_NE(nullptr, value);
+  EXPECT_EQ(42, *value);
+
+  // The value outlives the context that read it.
+  fake_clock_.SetMonotonicTime(fake_clock_.GetMonotonicTime() +
+                               max_age_ - TimeDelta::FromMilliseconds(1));
+  scoped_refptr<EvaluationContext> ec = NewContext();
+  const int* shared_value = ec->GetValue(&fake_poll_var_);
+  EXPECT_EQ(value, shared_value);
+  EXPECT_EQ(42, *shared_value);
+}
+
+TEST_F(UmVariableSnapshotTest, FailedReadShared) {
+  EXPECT_EQ(nullptr, NewContext()->GetValue(&fake_poll_var_));
+  ASSERT_NE(nullptr, snapshot_.Get(&fake_poll_var_));
+  EXPECT_EQ(nullptr, NewContext()->GetValue(&fake_poll_var_));
+}
+
+TEST_F(UmVariableSnapshotTest, ValueExpires) {
+  fake_poll_var_.reset(new int(42));
+  ASSERT_NE(nullptr, NewContext()->GetValue(&fake_poll_var_));
+
+  fake_clock_.SetMonotonicTime(fake_clock_.GetMonotonicTime() + max_age_);
+  EXPECT_EQ(nullptr, snapshot_.Get(&fake_poll_var_));
+  EXPECT_EQ(nullptr, NewContext()->GetValue(&fake_poll_var_));
+}
+
+TEST_F(UmVariableSnapshotTest, ValueChangeInvalidatesValue) {
+  fake_async_var_.reset(new int(42));
+  scoped_refptr<EvaluationContext> ec = NewContext();
+  ASSERT_NE(nullptr, ec->GetValue(&fake_async_var_));
+
+  // A change notified by the variable isn't seen by the context which already
+  // read it, but by the new ones.
+  fake_async_var_.NotifyValueChanged();
+  EXPECT_EQ(nullptr, snapshot_.Get(&fake_async_var_));
+  EXPECT_EQ(42, *ec->GetValue(&fake_async_var_));
+  EXPECT_EQ(nullptr, NewContext()->GetValue(&fake_async_var_));
+
+  fake_async_var_.reset(new int(5));
+  const int* value = NewContext()->GetValue(&fake_async_var_);
+  ASSERT_NE(nullptr, value);
+  EXPECT_EQ(5, *value);
+}
+
+}  // namespace chromeos_update_manager
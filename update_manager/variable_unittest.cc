@@ -79,6 +79,19 @@ TEST_F(UmBaseVariableTest, DefaultPollIntervalTest) {
   EXPECT_EQ(poll_var.GetPollInterval(), TimeDelta::FromMinutes(5));
 }
 
+TEST_F(UmBaseVariableTest, IdReusedTest) {
+  DefaultVariable<int> var("var", kVariableModeConst);
+  size_t other_id;
+  {
+    DefaultVariable<int> other_var("other_var", kVariableModeConst);
+    other_id = other_var.GetId();
+    EXPECT_NE(var.GetId(), other_id);
+  }
+  // The id of the destroyed variable is the lowest free one.
+  DefaultVariable<int> new_var("new_var", kVariableModeConst);
+  EXPECT_EQ(other_id, new_var.GetId());
+}
+
 TEST_F(UmBaseVariableTest, GetPollIntervalTest) {
   DefaultVariable<int> var("var", TimeDelta::FromMinutes(3));
   EXPECT_EQ(var.GetMode(), kVariableModePoll);